@@ -165,7 +165,7 @@ fi
 case "$1" in
     *)
         case "$2" in
-            verifyjoinsplit)
+            verifyjoinsplit|verifyjoinsplits)
                 litecoinzd_start "${@:2}"
                 RAWJOINSPLIT=$(litecoinz_rpc zcsamplejoinsplit)
                 litecoinzd_stop
@@ -188,6 +188,18 @@ case "$1" in
             verifyjoinsplit)
                 litecoinz_rpc zcbenchmark verifyjoinsplit 1000 "\"$RAWJOINSPLIT\""
                 ;;
+            verifyjoinsplits)
+                litecoinz_rpc zcbenchmark verifyjoinsplits 1000 "\"$RAWJOINSPLIT\"" "${@:3}"
+                ;;
+            verifysaplingspends)
+                litecoinz_rpc zcbenchmark verifysaplingspends 1000 "${@:3}"
+                ;;
+            verifysaplingoutputs)
+                litecoinz_rpc zcbenchmark verifysaplingoutputs 1000 "${@:3}"
+                ;;
+            verifysaplingbundles)
+                litecoinz_rpc zcbenchmark verifysaplingbundles 500 "${@:3}"
+                ;;
             solveequihash)
                 litecoinz_rpc_slow zcbenchmark solveequihash 50 "${@:3}"
                 ;;
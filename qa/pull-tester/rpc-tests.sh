@@ -24,6 +24,7 @@ testScripts=(
     'wallet.py'
     'wallet_overwintertx.py'
     'wallet_persistence.py'
+    'multiwallet.py'
     'wallet_nullifiers.py'
     'wallet_1941.py'
     'wallet_addresses.py'
@@ -89,6 +90,7 @@ testScriptsExt=(
     'invalidblockrequest.py'
 #    'forknotify.py'
     'p2p-acceptblock.py'
+    'p2p_relay_load.py'
 );
 
 if [ "x$ENABLE_ZMQ" = "x1" ]; then
@@ -11,6 +11,7 @@
 import decimal
 
 from test_framework.test_framework import BitcoinTestFramework
+from test_framework.authproxy import JSONRPCException
 from test_framework.util import (
     initialize_chain,
     assert_equal,
@@ -23,6 +24,7 @@ class BlockchainTest(BitcoinTestFramework):
     Test blockchain-related RPC calls:
 
         - gettxoutsetinfo
+        - dumptxoutset
 
     """
 
@@ -44,10 +46,30 @@ class BlockchainTest(BitcoinTestFramework):
         assert_equal(res[u'transactions'], 200)
         assert_equal(res[u'height'], 200)
         assert_equal(res[u'txouts'], 349) # 150*2 + 49
-        assert_equal(res[u'bytes_serialized'], 14951), # 32*199 + 48*90 + 49*60 + 27*49
+        # One record per output: a 32 byte txid, the height and coinbase flag
+        # (1 byte below height 64, 2 above) and the compressed output. The
+        # outputs are as in the per-transaction layout: 6787 bytes for the
+        # two of each of the first 150 coinbases (7260 less 2 bytes of
+        # version and code each and 173 of heights), 23 for each of the 49
+        # after. Both outputs of a coinbase carry its height.
+        assert_equal(res[u'bytes_serialized'], 19654) # 32*349 + 6787 + 23*49 + 1*2*63 + 2*2*87 + 2*49
         assert_equal(len(res[u'bestblock']), 64)
         assert_equal(len(res[u'hash_serialized']), 64)
 
+        dump = node.dumptxoutset('utxo.dat')
+        assert_equal(dump[u'height'], 200)
+        assert_equal(dump[u'base_hash'], res[u'bestblock'])
+        assert_equal(dump[u'coins_written'], 349)
+        assert_equal(len(dump[u'txoutset_hash']), 64)
+        assert_equal(dump[u'committed'], False)
+        # The same chainstate gives the same hash, but an existing file is kept
+        try:
+            node.dumptxoutset('utxo.dat')
+            raise AssertionError('dumptxoutset overwrote an existing file')
+        except JSONRPCException as e:
+            assert('already exists' in e.error['message'])
+        assert_equal(node.dumptxoutset('utxo2.dat')[u'txoutset_hash'], dump[u'txoutset_hash'])
+
 
 if __name__ == '__main__':
     BlockchainTest().main()
@@ -0,0 +1,87 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018 The LitecoinZ developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Exercise several wallets loaded by one node with -wallet, each reached
+# at /wallet/<name>.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.authproxy import AuthServiceProxy, JSONRPCException
+from test_framework.util import assert_equal, initialize_chain_clean, \
+    start_nodes, litecoinzd_processes
+
+from decimal import Decimal
+
+WALLETS = ['w1.dat', 'w2.dat', 'w3.dat']
+
+
+class MultiWalletTest (BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(1, self.options.tmpdir,
+            [['-experimentalfeatures', '-developerencryptwallet'] + ['-wallet=' + w for w in WALLETS]])
+        self.is_network_split = False
+
+    def wallet(self, name):
+        return AuthServiceProxy(self.nodes[0].url + '/wallet/' + name)
+
+    def run_test (self):
+        w1, w2, w3 = [self.wallet(w) for w in WALLETS]
+
+        # The miner pays into the first wallet, which is the default one
+        self.nodes[0].generate(101)
+        balance = w1.getbalance()
+        assert(balance > 0)
+        assert_equal(self.nodes[0].getbalance(), balance)
+        assert_equal(w2.getbalance(), 0)
+        assert_equal(w3.getbalance(), 0)
+
+        # Each wallet has keys of its own
+        addr2 = w2.getnewaddress()
+        assert_equal(w2.validateaddress(addr2)['ismine'], True)
+        assert_equal(w1.validateaddress(addr2)['ismine'], False)
+        assert_equal(w3.validateaddress(addr2)['ismine'], False)
+
+        w1.sendtoaddress(addr2, 7)
+        self.nodes[0].generate(1)
+        assert_equal(w2.getbalance(), Decimal('7'))
+        assert_equal(w3.getbalance(), 0)
+
+        addr3 = w3.getnewaddress()
+        w2.sendtoaddress(addr3, 2)
+        self.nodes[0].generate(1)
+        assert_equal(w3.getbalance(), Decimal('2'))
+        assert(w2.getbalance() < Decimal('5'))
+
+        # Locking one wallet leaves the others alone. Encrypting a wallet
+        # stops the node.
+        w3.encryptwallet('test')
+        litecoinzd_processes[0].wait()
+        self.setup_network()
+        w1, w2, w3 = [self.wallet(w) for w in WALLETS]
+        assert_equal(w3.getbalance(), Decimal('2'))
+        assert('unlocked_until' in w3.getwalletinfo())
+        assert('unlocked_until' not in w2.getwalletinfo())
+        w2.sendtoaddress(w1.getnewaddress(), 1)
+        try:
+            w3.sendtoaddress(w1.getnewaddress(), 1)
+            assert(False)
+        except JSONRPCException as e:
+            assert_equal(e.error['code'], -13)
+
+        # A wallet that isn't loaded
+        try:
+            self.wallet('nope.dat').getbalance()
+            assert(False)
+        except JSONRPCException as e:
+            assert_equal(e.error['code'], -18)
+
+if __name__ == '__main__':
+    MultiWalletTest ().main ()
@@ -0,0 +1,490 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018 The LitecoinZ developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Drive a node with simulated peers sending a mix of inv, tx, getdata,
+# headers and block messages, and measure what it makes of them: how fast it
+# accepts transactions, how long it takes to relay them to another peer, the
+# time it spends on each message command, and its CPU and memory use.
+#
+# The transactions, transparent and Sapling shielded ones with valid proofs,
+# and the blocks come from a corpus that a second, unconnected node makes on
+# the same chain. Making it takes a while, so --corpus=<file> keeps it for
+# later runs, which must pass the same --txs, --shieldedtxs and --extrablocks.
+#
+# For example, to relay 2000 transactions from 32 peers as fast as they go:
+#   p2p_relay_load.py --corpus=/tmp/corpus.json --txs=2000 --peers=32 \
+#       --mix=tx=1,inv=1,getdata=1 --output=/tmp/load.json
+#
+
+from test_framework.mininode import NodeConn, NodeConnCB, NetworkThread, \
+    CInv, CBlockHeader, msg_inv, msg_getdata, msg_headers, msg_ping, \
+    msg_pong, mininode_lock, hash256, SAPLING_PROTO_VERSION
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.authproxy import AuthServiceProxy
+from test_framework.util import assert_equal, assert_greater_than, \
+    initialize_chain_clean, start_node, p2p_port, litecoinzd_processes, \
+    wait_and_assert_operationid_status
+
+from binascii import hexlify, unhexlify
+from decimal import Decimal
+from threading import Thread, Event
+import cStringIO
+import json
+import os
+import random
+import time
+
+NUPARAMS = [
+    '-nuparams=5ba81b19:1', # Overwinter
+    '-nuparams=76b809bb:1', # Sapling
+]
+
+MSG_TX = 1
+MSG_BLOCK = 2
+
+MESSAGE_TYPES = ['inv', 'tx', 'getdata', 'headers', 'block']
+
+FEE = Decimal('0.0001')
+
+
+# A transaction or block as the node serialized it. Sapling transactions
+# aren't parsed here, so they are sent as they were received.
+class msg_raw(object):
+    def __init__(self, command, data):
+        self.command = command
+        self.data = data
+
+    def serialize(self):
+        return self.data
+
+    def __repr__(self):
+        return "msg_raw(command=%s, size=%d)" % (self.command, len(self.data))
+
+
+def txid_of(raw):
+    return hash256(raw)[::-1].encode('hex_codec')
+
+
+class LoadPeer(NodeConnCB):
+    """A peer sending its share of the load, and serving what it announced"""
+    def __init__(self):
+        NodeConnCB.__init__(self)
+        self.create_callback_map()
+        self.connection = None
+        self.announced = {}
+        self.requested = set()
+        self.ping_counter = 1
+        self.last_pong = msg_pong()
+
+    def add_connection(self, conn):
+        self.connection = conn
+
+    def send_message(self, message):
+        self.connection.send_message(message)
+
+    def on_inv(self, conn, message):
+        pass
+
+    def on_getdata(self, conn, message):
+        for inv in message.inv:
+            txid = '%064x' % inv.hash
+            if inv.type == MSG_TX and txid in self.announced:
+                conn.send_message(msg_raw('tx', self.announced.pop(txid)))
+                self.requested.add(txid)
+
+    def on_pong(self, conn, message):
+        self.last_pong = message
+
+    def sync_with_ping(self, timeout=60):
+        self.connection.send_message(msg_ping(nonce=self.ping_counter))
+        deadline = time.time() + timeout
+        received_pong = False
+        while not received_pong and time.time() < deadline:
+            time.sleep(0.05)
+            with mininode_lock:
+                received_pong = self.last_pong.nonce == self.ping_counter
+        self.ping_counter += 1
+        return received_pong
+
+
+class ObserverPeer(NodeConnCB):
+    """A peer sending nothing, noting when the node announces each hash to it"""
+    def __init__(self):
+        NodeConnCB.__init__(self)
+        self.create_callback_map()
+        self.first_seen = {}
+
+    def on_inv(self, conn, message):
+        now = time.time()
+        for inv in message.inv:
+            self.first_seen.setdefault('%064x' % inv.hash, now)
+
+
+class ResourceSampler(Thread):
+    """Samples the mempool and the memory of the node until stopped"""
+    def __init__(self, url, pid, interval):
+        Thread.__init__(self)
+        self.daemon = True
+        self.rpc = AuthServiceProxy(url)
+        self.pid = pid
+        self.interval = interval
+        self.stopped = Event()
+        self.samples = []
+
+    def run(self):
+        while not self.stopped.is_set():
+            mempool = self.rpc.getmempoolinfo()
+            self.samples.append({
+                'time': time.time(),
+                'mempool_size': mempool['size'],
+                'mempool_usage': mempool['usage'],
+                'rss_bytes': read_rss(self.pid),
+            })
+            self.stopped.wait(self.interval)
+
+    def stop(self):
+        self.stopped.set()
+        self.join()
+
+
+def read_rss(pid):
+    try:
+        with open('/proc/%d/status' % pid) as f:
+            for line in f:
+                if line.startswith('VmRSS:'):
+                    return int(line.split()[1]) * 1024
+    except IOError:
+        pass
+    return None
+
+
+def read_cpu_secs(pid):
+    try:
+        with open('/proc/%d/stat' % pid) as f:
+            fields = f.read().rsplit(')', 1)[1].split()
+        # utime and stime, the 14th and 15th fields
+        return (int(fields[11]) + int(fields[12])) / float(os.sysconf('SC_CLK_TCK'))
+    except (IOError, OSError):
+        return None
+
+
+def percentile(values, p):
+    if not values:
+        return None
+    values = sorted(values)
+    return values[min(len(values) - 1, int(p * len(values)))]
+
+
+def latency_stats(latencies):
+    return {
+        'count': len(latencies),
+        'median_secs': percentile(latencies, 0.5),
+        'p90_secs': percentile(latencies, 0.9),
+        'max_secs': max(latencies) if latencies else None,
+    }
+
+
+def parse_mix(spec):
+    mix = {}
+    for part in spec.split(','):
+        name, weight = part.split('=')
+        if name not in MESSAGE_TYPES:
+            raise ValueError("unknown message type %s in --mix" % name)
+        mix[name] = float(weight)
+    return mix
+
+
+class P2PRelayLoadTest(BitcoinTestFramework):
+
+    def add_options(self, parser):
+        parser.add_option("--peers", dest="peers", default=8, type="int",
+                          help="Simulated peers sending load (default: %default)")
+        parser.add_option("--duration", dest="duration", default=30, type="float",
+                          help="Most seconds to send load for (default: %default)")
+        parser.add_option("--rate", dest="rate", default=0, type="float",
+                          help="Messages a second across all peers, 0 for as fast as possible (default: %default)")
+        parser.add_option("--mix", dest="mix", default="tx=4,inv=4,getdata=2,headers=1,block=1",
+                          help="Relative weights of the message types sent (default: %default)")
+        parser.add_option("--txs", dest="txs", default=200, type="int",
+                          help="Transparent transactions in the corpus (default: %default)")
+        parser.add_option("--shieldedtxs", dest="shieldedtxs", default=8, type="int",
+                          help="Sapling shielded transactions in the corpus (default: %default)")
+        parser.add_option("--extrablocks", dest="extrablocks", default=10, type="int",
+                          help="New blocks in the corpus for block messages to bring (default: %default)")
+        parser.add_option("--corpus", dest="corpus", default=None,
+                          help="File to read the corpus from, or to write it to if it doesn't exist")
+        parser.add_option("--drain", dest="drain", default=60, type="float",
+                          help="Most seconds to wait after the load for every transaction sent to be accepted (default: %default)")
+        parser.add_option("--output", dest="output", default=None,
+                          help="File to write the results to, as JSON")
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        # Node 0 takes the load. Node 1 makes the corpus, and is never
+        # connected to it, so that the transactions are new to node 0.
+        self.nodes = []
+        self.nodes.append(start_node(0, self.options.tmpdir,
+            NUPARAMS + ['-whitelist=127.0.0.1', '-maxconnections=%d' % (self.options.peers + 16)]))
+        self.is_network_split = False
+
+    def make_corpus(self):
+        opts = self.options
+        generator = start_node(1, self.options.tmpdir,
+            NUPARAMS + ['-txexpirydelta=%d' % (opts.extrablocks + 100), '-debug=zrpc'])
+        self.nodes.append(generator)
+
+        print("Making a corpus of %d transparent and %d shielded transactions..." % (opts.txs, opts.shieldedtxs))
+        generator.generate(100 + opts.txs + opts.shieldedtxs)
+        base_height = generator.getblockcount()
+
+        # Blocks for block messages to bring, mined first and then
+        # disconnected, so that the transactions stay valid after them
+        extra_hashes = generator.generate(opts.extrablocks) if opts.extrablocks > 0 else []
+        extra_blocks = [generator.getblock(h, False) for h in extra_hashes]
+        if extra_hashes:
+            generator.invalidateblock(extra_hashes[0])
+        assert_equal(generator.getblockcount(), base_height)
+
+        # One transparent transaction per mature coinbase
+        coinbases = [u for u in generator.listunspent(101) if u.get('generated', True)]
+        assert_greater_than(len(coinbases) + 1, opts.txs + opts.shieldedtxs)
+        for utxo in coinbases[:opts.txs]:
+            inputs = [{'txid': utxo['txid'], 'vout': utxo['vout']}]
+            outputs = {generator.getnewaddress(): utxo['amount'] - FEE}
+            signed = generator.signrawtransaction(generator.createrawtransaction(inputs, outputs))
+            assert signed['complete']
+            generator.sendrawtransaction(signed['hex'])
+
+        # One Sapling transaction per coinbase, proven in parallel
+        if opts.shieldedtxs > 0:
+            zaddr = generator.z_getnewaddress('sapling')
+            result = generator.z_shieldcoinbase('*', zaddr, FEE, 1, opts.shieldedtxs)
+            assert_equal(result['transactions'], opts.shieldedtxs)
+            wait_and_assert_operationid_status(generator, result['opid'], timeout=60 * opts.shieldedtxs)
+
+        txs = []
+        for txid in generator.getrawmempool():
+            raw = generator.getrawtransaction(txid)
+            decoded = generator.decoderawtransaction(raw)
+            shielded = len(decoded.get('vShieldedOutput', [])) > 0 or len(decoded.get('vjoinsplit', [])) > 0
+            txs.append({'txid': txid, 'hex': raw, 'shielded': shielded})
+        assert_equal(len(txs), opts.txs + opts.shieldedtxs)
+
+        blocks = [generator.getblock(generator.getblockhash(h), False) for h in range(1, base_height + 1)]
+        return {
+            'version': 1,
+            'blocks': blocks,
+            'extrablocks': [{'hash': h, 'hex': b} for h, b in zip(extra_hashes, extra_blocks)],
+            'txs': txs,
+        }
+
+    def load_corpus(self):
+        path = self.options.corpus
+        if path is not None and os.path.exists(path):
+            print("Reading the corpus from %s" % path)
+            with open(path) as f:
+                return json.load(f)
+        corpus = self.make_corpus()
+        if path is not None:
+            with open(path, 'w') as f:
+                json.dump(corpus, f)
+            print("Wrote the corpus to %s" % path)
+        return corpus
+
+    def run_test(self):
+        opts = self.options
+        node = self.nodes[0]
+        mix = parse_mix(opts.mix)
+
+        corpus = self.load_corpus()
+        for block in corpus['blocks']:
+            node.submitblock(block)
+        assert_equal(node.getblockcount(), len(corpus['blocks']))
+
+        base_headers = []
+        for block in corpus['blocks']:
+            header = CBlockHeader()
+            header.deserialize(cStringIO.StringIO(unhexlify(block)))
+            base_headers.append(header)
+        base_hashes = [node.getblockhash(h) for h in range(1, len(corpus['blocks']) + 1)]
+        txs = [(tx['txid'], unhexlify(tx['hex']), tx['shielded']) for tx in corpus['txs']]
+        for txid, raw, shielded in txs:
+            assert_equal(txid_of(raw), txid)
+        random.shuffle(txs)
+        extra_blocks = [(b['hash'], unhexlify(b['hex'])) for b in corpus['extrablocks']]
+
+        # Connect the peers
+        peers = []
+        connections = []
+        for i in range(opts.peers):
+            peer = LoadPeer()
+            conn = NodeConn('127.0.0.1', p2p_port(0), node, peer, "regtest", SAPLING_PROTO_VERSION)
+            peer.add_connection(conn)
+            peers.append(peer)
+            connections.append(conn)
+        observer = ObserverPeer()
+        connections.append(NodeConn('127.0.0.1', p2p_port(0), node, observer, "regtest", SAPLING_PROTO_VERSION))
+        NetworkThread().start()
+        for peer in peers + [observer]:
+            while True:
+                with mininode_lock:
+                    if peer.verack_received:
+                        break
+                time.sleep(0.05)
+
+        pid = litecoinzd_processes[0].pid
+        nettotals_before = node.getnettotals()['msgstats']
+        cpu_before = read_cpu_secs(pid)
+        sampler = ResourceSampler(node.url, pid, 0.5)
+        sampler.start()
+
+        # Send the load
+        print("Sending load from %d peers for up to %g seconds..." % (opts.peers, opts.duration))
+        sent_counts = dict((name, 0) for name in MESSAGE_TYPES)
+        sent_time = {}
+        shielded_txids = set()
+        next_tx = 0
+        next_block = 0
+        start = time.time()
+        n = 0
+        while time.time() - start < opts.duration:
+            choices = [name for name in mix if mix[name] > 0 and
+                       (name not in ('tx', 'inv') or next_tx < len(txs))]
+            if not choices:
+                break
+            r = random.uniform(0, sum(mix[c] for c in choices))
+            for name in choices:
+                r -= mix[name]
+                if r <= 0:
+                    break
+            peer = peers[n % len(peers)]
+            n += 1
+
+            with mininode_lock:
+                if name in ('tx', 'inv'):
+                    txid, raw, shielded = txs[next_tx]
+                    next_tx += 1
+                    if shielded:
+                        shielded_txids.add(txid)
+                    sent_time[txid] = time.time()
+                    if name == 'tx':
+                        peer.send_message(msg_raw('tx', raw))
+                    else:
+                        peer.announced[txid] = raw
+                        peer.send_message(msg_inv([CInv(MSG_TX, int(txid, 16))]))
+                elif name == 'getdata':
+                    want = msg_getdata()
+                    if random.random() < 0.5 and len(sent_time) > 0:
+                        want.inv.append(CInv(MSG_TX, int(random.choice(sent_time.keys()), 16)))
+                    else:
+                        want.inv.append(CInv(MSG_BLOCK, int(random.choice(base_hashes), 16)))
+                    peer.send_message(want)
+                elif name == 'headers':
+                    first = random.randrange(len(base_headers))
+                    headers = msg_headers()
+                    headers.headers = base_headers[first:first + 160]
+                    peer.send_message(headers)
+                elif name == 'block':
+                    if next_block < len(extra_blocks):
+                        blockhash, raw = extra_blocks[next_block]
+                        next_block += 1
+                        sent_time[blockhash] = time.time()
+                        peer.send_message(msg_raw('block', raw))
+                    else:
+                        # Blocks the node already has still cost a look up
+                        peer.send_message(msg_raw('block', unhexlify(random.choice(corpus['blocks']))))
+            sent_counts[name] += 1
+
+            if opts.rate > 0:
+                delay = start + n / opts.rate - time.time()
+                if delay > 0:
+                    time.sleep(delay)
+        load_secs = time.time() - start
+
+        # Let the node catch up with what was sent
+        for peer in peers:
+            peer.sync_with_ping()
+        sent_txids = set(txid for txid, raw, shielded in txs[:next_tx])
+        deadline = time.time() + opts.drain
+        while time.time() < deadline:
+            if len(sent_txids - set(node.getrawmempool())) == 0:
+                break
+            time.sleep(0.5)
+        sampler.stop()
+
+        # Work out the results
+        mempool = set(node.getrawmempool())
+        accepted = sent_txids & mempool
+        times = [s['time'] for s in sampler.samples if s['mempool_size'] >= len(accepted)]
+        accept_secs = (times[0] if times else time.time()) - start
+        with mininode_lock:
+            tx_latencies = [observer.first_seen[t] - sent_time[t] for t in accepted if t in observer.first_seen]
+            shielded_latencies = [observer.first_seen[t] - sent_time[t] for t in accepted & shielded_txids if t in observer.first_seen]
+            block_latencies = [observer.first_seen[h] - sent_time[h] for h, raw in extra_blocks[:next_block] if h in observer.first_seen]
+
+        nettotals_after = node.getnettotals()['msgstats']
+        messages = {}
+        for command, after in nettotals_after.items():
+            before = nettotals_before.get(command, {'recvmsgs': 0, 'recvbytes': 0, 'processtime': 0})
+            count = after['recvmsgs'] - before['recvmsgs']
+            if count == 0:
+                continue
+            secs = after['processtime'] - before['processtime']
+            messages[command] = {
+                'count': count,
+                'bytes': after['recvbytes'] - before['recvbytes'],
+                'process_secs': secs,
+                'process_secs_per_msg': secs / count,
+            }
+        cpu_after = read_cpu_secs(pid)
+        rss = [s['rss_bytes'] for s in sampler.samples if s['rss_bytes'] is not None]
+
+        results = {
+            'peers': opts.peers,
+            'mix': mix,
+            'load_secs': load_secs,
+            'sent': sent_counts,
+            'transactions': {
+                'sent': len(sent_txids),
+                'shielded_sent': len(sent_txids & shielded_txids),
+                'accepted': len(accepted),
+                'accepted_per_sec': len(accepted) / accept_secs if accept_secs > 0 else None,
+            },
+            'blocks': {
+                'sent': next_block,
+                'height': node.getblockcount(),
+            },
+            'relay_latency': {
+                'transactions': latency_stats(tx_latencies),
+                'shielded_transactions': latency_stats(shielded_latencies),
+                'blocks': latency_stats(block_latencies),
+            },
+            'messages': messages,
+            'node': {
+                'cpu_secs': cpu_after - cpu_before if cpu_before is not None and cpu_after is not None else None,
+                'rss_start_bytes': rss[0] if rss else None,
+                'rss_peak_bytes': max(rss) if rss else None,
+                'rss_end_bytes': rss[-1] if rss else None,
+                'mempool_usage_peak_bytes': max(s['mempool_usage'] for s in sampler.samples) if sampler.samples else None,
+            },
+        }
+        print(json.dumps(results, indent=2, sort_keys=True))
+        if opts.output is not None:
+            with open(opts.output, 'w') as f:
+                json.dump(results, f, indent=2, sort_keys=True)
+
+        for conn in connections:
+            conn.disconnect_node()
+
+        # Valid transactions are all accepted, however heavy the load
+        assert_equal(len(accepted), len(sent_txids))
+        assert_equal(node.getblockcount(), len(corpus['blocks']) + next_block)
+
+if __name__ == '__main__':
+    P2PRelayLoadTest().main()
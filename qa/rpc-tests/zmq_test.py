@@ -91,6 +91,14 @@ class ZMQTest(BitcoinTestFramework):
 
         assert_equal(hashRPC, hashZMQ) #blockhash from generate must be equal to the hash received over zmq
 
+        # nothing was dropped, and the sequences match what was received
+        info = self.nodes[0].getzmqnotifications()
+        assert_equal(info['dropped_blocks'], 0)
+        assert_equal(info['dropped_transactions'], 0)
+        sequences = dict((n['type'], n['sequence']) for n in info['notifiers'])
+        assert_equal(sequences['pubhashblock'], blockcount+1)
+        assert_equal(sequences['pubhashtx'], blockcount+2)
+
 
 if __name__ == '__main__':
     ZMQTest ().main ()
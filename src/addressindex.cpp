@@ -0,0 +1,30 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+
+#include "pubkey.h"
+#include "script/standard.h"
+
+AddressIndexType GetAddressIndexKey(const CScript& scriptPubKey, uint160& hashBytes)
+{
+    // The common forms are matched directly, without running the solver
+    if (scriptPubKey.IsPayToScriptHash()) {
+        hashBytes = uint160(std::vector<unsigned char>(scriptPubKey.begin() + 2, scriptPubKey.begin() + 22));
+        return ADDRESS_INDEX_SCRIPTHASH;
+    }
+    if (scriptPubKey.size() == 25 && scriptPubKey[0] == OP_DUP && scriptPubKey[1] == OP_HASH160 &&
+        scriptPubKey[2] == 20 && scriptPubKey[23] == OP_EQUALVERIFY && scriptPubKey[24] == OP_CHECKSIG) {
+        hashBytes = uint160(std::vector<unsigned char>(scriptPubKey.begin() + 3, scriptPubKey.begin() + 23));
+        return ADDRESS_INDEX_PUBKEYHASH;
+    }
+
+    txnouttype whichType;
+    std::vector<std::vector<unsigned char> > vSolutions;
+    if (Solver(scriptPubKey, whichType, vSolutions) && whichType == TX_PUBKEY) {
+        hashBytes = CPubKey(vSolutions[0]).GetID();
+        return ADDRESS_INDEX_PUBKEYHASH;
+    }
+    return ADDRESS_INDEX_NONE;
+}
@@ -0,0 +1,258 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRESSINDEX_H
+#define BITCOIN_ADDRESSINDEX_H
+
+#include "amount.h"
+#include "script/script.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <utility>
+#include <vector>
+
+/** Kinds of transparent address in the address indexes */
+enum AddressIndexType
+{
+    ADDRESS_INDEX_NONE = 0,
+    ADDRESS_INDEX_PUBKEYHASH = 1, //!< P2PKH, and P2PK by the ID of its key
+    ADDRESS_INDEX_SCRIPTHASH = 2,
+};
+
+/**
+ * Entry of the address index (-addressindex): an output paying to an
+ * address, or an input spending one, with the amount as the value
+ * (negative for spends). The height and position in the block are stored
+ * big-endian, so the entries of an address are in chain order and a height
+ * range is one contiguous range of keys.
+ */
+struct CAddressIndexKey
+{
+    uint8_t type;
+    uint160 hashBytes;
+    int blockHeight;
+    unsigned int txindex;
+    uint256 txhash;
+    unsigned int index;
+    bool spending;
+
+    CAddressIndexKey() : type(0), blockHeight(0), txindex(0), index(0), spending(false) {}
+    CAddressIndexKey(uint8_t typeIn, const uint160& hashBytesIn, int blockHeightIn, unsigned int txindexIn,
+                     const uint256& txhashIn, unsigned int indexIn, bool spendingIn) :
+        type(typeIn), hashBytes(hashBytesIn), blockHeight(blockHeightIn), txindex(txindexIn),
+        txhash(txhashIn), index(indexIn), spending(spendingIn) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s);
+        ser_writedata32be(s, blockHeight);
+        ser_writedata32be(s, txindex);
+        txhash.Serialize(s);
+        ser_writedata32(s, index);
+        ser_writedata8(s, spending);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        type = ser_readdata8(s);
+        hashBytes.Unserialize(s);
+        blockHeight = ser_readdata32be(s);
+        txindex = ser_readdata32be(s);
+        txhash.Unserialize(s);
+        index = ser_readdata32(s);
+        spending = ser_readdata8(s) != 0;
+    }
+};
+
+/** The start of the address index keys of an address, from a height on */
+struct CAddressIndexIteratorKey
+{
+    uint8_t type;
+    uint160 hashBytes;
+    int blockHeight;
+
+    CAddressIndexIteratorKey(uint8_t typeIn, const uint160& hashBytesIn, int blockHeightIn) :
+        type(typeIn), hashBytes(hashBytesIn), blockHeight(blockHeightIn) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s);
+        ser_writedata32be(s, blockHeight);
+    }
+};
+
+/** Key of the unspent outputs of an address (part of -addressindex) */
+struct CAddressUnspentKey
+{
+    uint8_t type;
+    uint160 hashBytes;
+    uint256 txhash;
+    unsigned int index;
+
+    CAddressUnspentKey() : type(0), index(0) {}
+    CAddressUnspentKey(uint8_t typeIn, const uint160& hashBytesIn, const uint256& txhashIn, unsigned int indexIn) :
+        type(typeIn), hashBytes(hashBytesIn), txhash(txhashIn), index(indexIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(type);
+        READWRITE(hashBytes);
+        READWRITE(txhash);
+        READWRITE(index);
+    }
+};
+
+/** The start of the unspent output keys of an address */
+struct CAddressUnspentIteratorKey
+{
+    uint8_t type;
+    uint160 hashBytes;
+
+    CAddressUnspentIteratorKey(uint8_t typeIn, const uint160& hashBytesIn) :
+        type(typeIn), hashBytes(hashBytesIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(type);
+        READWRITE(hashBytes);
+    }
+};
+
+/** An unspent output of an address. A null value means the entry is to be erased. */
+struct CAddressUnspentValue
+{
+    CAmount satoshis;
+    CScript script;
+    int blockHeight;
+
+    CAddressUnspentValue() : satoshis(-1), blockHeight(0) {}
+    CAddressUnspentValue(CAmount satoshisIn, const CScript& scriptIn, int blockHeightIn) :
+        satoshis(satoshisIn), script(scriptIn), blockHeight(blockHeightIn) {}
+
+    bool IsNull() const { return satoshis == -1; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(satoshis);
+        READWRITE(*(CScriptBase*)(&script));
+        READWRITE(blockHeight);
+    }
+};
+
+/** Key of the spent index (-spentindex): a transparent output */
+struct CSpentIndexKey
+{
+    uint256 txid;
+    unsigned int outputIndex;
+
+    CSpentIndexKey() : outputIndex(0) {}
+    CSpentIndexKey(const uint256& txidIn, unsigned int outputIndexIn) :
+        txid(txidIn), outputIndex(outputIndexIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(txid);
+        READWRITE(outputIndex);
+    }
+};
+
+/** The input that spent an output. A null value means the entry is to be erased. */
+struct CSpentIndexValue
+{
+    uint256 txid;
+    unsigned int inputIndex;
+    int blockHeight;
+    CAmount satoshis;
+    uint8_t addressType;
+    uint160 addressHash;
+
+    CSpentIndexValue() : inputIndex(0), blockHeight(0), satoshis(0), addressType(0) {}
+    CSpentIndexValue(const uint256& txidIn, unsigned int inputIndexIn, int blockHeightIn, CAmount satoshisIn,
+                     uint8_t addressTypeIn, const uint160& addressHashIn) :
+        txid(txidIn), inputIndex(inputIndexIn), blockHeight(blockHeightIn), satoshis(satoshisIn),
+        addressType(addressTypeIn), addressHash(addressHashIn) {}
+
+    bool IsNull() const { return txid.IsNull(); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(txid);
+        READWRITE(inputIndex);
+        READWRITE(blockHeight);
+        READWRITE(satoshis);
+        READWRITE(addressType);
+        READWRITE(addressHash);
+    }
+};
+
+/** Key of the timestamp index (-timestampindex), with the time big-endian so keys sort by time */
+struct CTimestampIndexKey
+{
+    unsigned int timestamp;
+    uint256 blockHash;
+
+    CTimestampIndexKey() : timestamp(0) {}
+    CTimestampIndexKey(unsigned int timestampIn, const uint256& blockHashIn) :
+        timestamp(timestampIn), blockHash(blockHashIn) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata32be(s, timestamp);
+        blockHash.Serialize(s);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        timestamp = ser_readdata32be(s);
+        blockHash.Unserialize(s);
+    }
+};
+
+/** The start of the timestamp index keys from a time on */
+struct CTimestampIndexIteratorKey
+{
+    unsigned int timestamp;
+
+    CTimestampIndexIteratorKey(unsigned int timestampIn) : timestamp(timestampIn) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata32be(s, timestamp);
+    }
+};
+
+/**
+ * What connecting or disconnecting a block changes in the address, spent and
+ * timestamp indexes. CBlockTreeDB::WriteBlockIndexes writes it together
+ * with the block's -txindex entries, in one batch.
+ */
+struct CBlockIndexesUpdate
+{
+    //! Address index entries to write, or to erase when disconnecting
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+    //! Unspent outputs to write, or to erase where the value is null
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vAddressUnspentIndex;
+    //! Spends to write, or to erase where the value is null
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > vSpentIndex;
+    //! Timestamp index entries to write, or to erase when disconnecting
+    std::vector<CTimestampIndexKey> vTimestampIndex;
+};
+
+/** Get the type and hash the address indexes file an output script under */
+AddressIndexType GetAddressIndexKey(const CScript& scriptPubKey, uint160& hashBytes);
+
+#endif // BITCOIN_ADDRESSINDEX_H
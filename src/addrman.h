@@ -5,6 +5,7 @@
 #ifndef BITCOIN_ADDRMAN_H
 #define BITCOIN_ADDRMAN_H
 
+#include "memusage.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "random.h"
@@ -12,11 +13,14 @@
 #include "timedata.h"
 #include "util.h"
 
+#include <limits>
 #include <map>
 #include <set>
 #include <stdint.h>
 #include <vector>
 
+#include <boost/unordered_map.hpp>
+
 /**
  * Extended statistics about a CAddress
  */
@@ -169,6 +173,20 @@ public:
 /** 
  * Stochastical (IP) address manager 
  */
+/** Salted hasher for the network address index, so that peers can't pick addresses that collide */
+class CNetAddrHasher
+{
+private:
+    uint64_t k0, k1;
+
+public:
+    CNetAddrHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+    size_t operator()(const CNetAddr& addr) const {
+        return addr.GetHash(k0, k1);
+    }
+};
+
 class CAddrMan
 {
 private:
@@ -178,11 +196,17 @@ private:
     //! last used nId
     int nIdCount;
 
+    typedef boost::unordered_map<int, CAddrInfo> InfoMap;
+    typedef boost::unordered_map<CNetAddr, int, CNetAddrHasher> AddrMap;
+
     //! table with information about all nIds
-    std::map<int, CAddrInfo> mapInfo;
+    InfoMap mapInfo;
 
     //! find an nId based on its network address
-    std::map<CNetAddr, int> mapAddr;
+    AddrMap mapAddr;
+
+    //! number of changes made, so that unchanged tables aren't written out again
+    uint64_t nModifications;
 
     //! randomly-ordered vector of all nIds
     std::vector<int> vRandom;
@@ -292,9 +316,9 @@ public:
 
         int nUBuckets = ADDRMAN_NEW_BUCKET_COUNT ^ (1 << 30);
         s << nUBuckets;
-        std::map<int, int> mapUnkIds;
+        boost::unordered_map<int, int> mapUnkIds;
         int nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
+        for (InfoMap::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
             mapUnkIds[(*it).first] = nIds;
             const CAddrInfo &info = (*it).second;
             if (info.nRefCount) {
@@ -304,7 +328,7 @@ public:
             }
         }
         nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
+        for (InfoMap::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
             const CAddrInfo &info = (*it).second;
             if (info.fInTried) {
                 assert(nIds != nTried); // this means nTried was wrong, oh ow
@@ -418,9 +442,9 @@ public:
 
         // Prune new entries with refcount 0 (as a result of collisions).
         int nLostUnk = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); ) {
+        for (InfoMap::const_iterator it = mapInfo.begin(); it != mapInfo.end(); ) {
             if (it->second.fInTried == false && it->second.nRefCount == 0) {
-                std::map<int, CAddrInfo>::const_iterator itCopy = it++;
+                InfoMap::const_iterator itCopy = it++;
                 Delete(itCopy->first);
                 nLostUnk++;
             } else {
@@ -452,9 +476,10 @@ public:
         nIdCount = 0;
         nTried = 0;
         nNew = 0;
+        nModifications++;
     }
 
-    CAddrMan()
+    CAddrMan() : nModifications(0)
     {
         Clear();
     }
@@ -470,6 +495,20 @@ public:
         return vRandom.size();
     }
 
+    //! Approximate heap use of the address tables.
+    size_t DynamicMemoryUsage() const
+    {
+        LOCK(cs);
+        return memusage::DynamicUsage(mapInfo) + memusage::DynamicUsage(mapAddr) + memusage::DynamicUsage(vRandom);
+    }
+
+    //! Return a counter that changes whenever the tables may have changed.
+    uint64_t GetModificationCount() const
+    {
+        LOCK(cs);
+        return nModifications;
+    }
+
     //! Consistency check
     void Check()
     {
@@ -491,6 +530,7 @@ public:
             LOCK(cs);
             Check();
             fRet |= Add_(addr, source, nTimePenalty);
+            nModifications++;
             Check();
         }
         if (fRet)
@@ -507,6 +547,7 @@ public:
             Check();
             for (std::vector<CAddress>::const_iterator it = vAddr.begin(); it != vAddr.end(); it++)
                 nAdd += Add_(*it, source, nTimePenalty) ? 1 : 0;
+            nModifications++;
             Check();
         }
         if (nAdd)
@@ -521,6 +562,7 @@ public:
             LOCK(cs);
             Check();
             Good_(addr, nTime);
+            nModifications++;
             Check();
         }
     }
@@ -532,6 +574,7 @@ public:
             LOCK(cs);
             Check();
             Attempt_(addr, nTime);
+            nModifications++;
             Check();
         }
     }
@@ -571,6 +614,7 @@ public:
             LOCK(cs);
             Check();
             Connected_(addr, nTime);
+            nModifications++;
             Check();
         }
     }
@@ -7,6 +7,7 @@
 
 #include "clientversion.h"
 #include "net.h"
+#include "notifysink.h"
 #include "pubkey.h"
 #include "timedata.h"
 #include "ui_interface.h"
@@ -249,6 +250,8 @@ bool CAlert::ProcessAlert(const std::vector<unsigned char>& alertKey, bool fThre
 void
 CAlert::Notify(const std::string& strMessage, bool fThread)
 {
+    NotifySink("alert", strMessage);
+
     std::string strCmd = GetArg("-alertnotify", "");
     if (strCmd.empty()) return;
 
@@ -4,6 +4,8 @@
 
 #include "asyncrpcoperation.h"
 
+#include "rpc/server.h"
+
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
@@ -27,7 +29,7 @@ static std::map<OperationStatus, std::string> OperationStatusMap = {
 /**
  * Every operation instance should have a globally unique id
  */
-AsyncRPCOperation::AsyncRPCOperation() : error_code_(0), error_message_() {
+AsyncRPCOperation::AsyncRPCOperation() : error_code_(0), error_message_(), request_uri_(GetRPCRequestURI()) {
     // Set a unique reference for each operation
     boost::uuids::uuid uuid = uuidgen();
     id_ = "opid-" + boost::uuids::to_string(uuid);
@@ -39,13 +41,14 @@ AsyncRPCOperation::AsyncRPCOperation(const AsyncRPCOperation& o) :
         id_(o.id_), creation_time_(o.creation_time_), state_(o.state_.load()),
         start_time_(o.start_time_), end_time_(o.end_time_),
         error_code_(o.error_code_), error_message_(o.error_message_),
-        result_(o.result_)
+        result_(o.result_), request_uri_(o.request_uri_)
 {
 }
 
 AsyncRPCOperation& AsyncRPCOperation::operator=( const AsyncRPCOperation& other ) {
     this->id_ = other.id_;
     this->creation_time_ = other.creation_time_;
+    this->request_uri_ = other.request_uri_;
     this->state_.store(other.state_.load());
     this->start_time_ = other.start_time_;
     this->end_time_ = other.end_time_;
@@ -82,6 +85,23 @@ void AsyncRPCOperation::start_execution_clock() {
 void AsyncRPCOperation::stop_execution_clock() {
     std::lock_guard<std::mutex> guard(lock_);
     end_time_ = std::chrono::system_clock::now();
+    end_phase();
+}
+
+void AsyncRPCOperation::start_phase(const std::string& phase) {
+    std::lock_guard<std::mutex> guard(lock_);
+    end_phase();
+    current_phase_ = phase;
+    phase_start_ = std::chrono::steady_clock::now();
+}
+
+void AsyncRPCOperation::end_phase() {
+    if (current_phase_.empty()) {
+        return;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - phase_start_;
+    phase_secs_[current_phase_] += elapsed.count();
+    current_phase_.clear();
 }
 
 /**
@@ -169,6 +189,24 @@ UniValue AsyncRPCOperation::getStatus() const {
         obj.push_back(Pair("execution_secs", elapsed_seconds.count()));
 
     }
+
+    // Time spent in each phase so far, including the one under way
+    std::lock_guard<std::mutex> guard(lock_);
+    if (!current_phase_.empty()) {
+        obj.push_back(Pair("phase", current_phase_));
+    }
+    std::map<std::string, double> phases = phase_secs_;
+    if (!current_phase_.empty()) {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - phase_start_;
+        phases[current_phase_] += elapsed.count();
+    }
+    if (!phases.empty()) {
+        UniValue timing(UniValue::VOBJ);
+        for (auto & entry : phases) {
+            timing.push_back(Pair(entry.first + "_secs", entry.second));
+        }
+        obj.push_back(Pair("timing", timing));
+    }
     return obj;
 }
 
@@ -62,9 +62,21 @@ public:
         return creation_time_;
     }
 
+    // The request URI of the RPC call that created the operation, which picks
+    // the wallet it works on. The queue runs main() with it set again.
+    std::string getRequestURI() const {
+        return request_uri_;
+    }
+
     // Override this method to add data to the default status object.
     virtual UniValue getStatus() const;
 
+    // Override this method to return true if the operation can take long enough
+    // that it should not hold up all workers of the queue at once.
+    virtual bool isHeavy() const {
+        return false;
+    }
+
     UniValue getError() const;
     
     UniValue getResult() const;
@@ -119,6 +131,11 @@ protected:
     void start_execution_clock();
     void stop_execution_clock();
 
+    // Account the time from now on to the named phase of main(), such as
+    // "selection" or "proving", until the next phase starts or the execution
+    // clock stops. Phases entered more than once add up.
+    void start_phase(const std::string& phase);
+
     void set_state(OperationStatus state) {
         this->state_.store(state);
     }
@@ -139,6 +156,12 @@ protected:
     }
     
 private:
+    std::map<std::string, double> phase_secs_;
+    std::string current_phase_;
+    std::chrono::time_point<std::chrono::steady_clock> phase_start_;
+
+    // Requires lock_
+    void end_phase();
 
     // Derived classes should write their own copy constructor and assignment operators
     AsyncRPCOperation(const AsyncRPCOperation& orig);
@@ -147,6 +170,7 @@ private:
     // Initialized in the operation constructor, never to be modified again.
     AsyncRPCOperationId id_;
     int64_t creation_time_;
+    std::string request_uri_;
 };
 
 #endif /* ASYNCRPCOPERATION_H */
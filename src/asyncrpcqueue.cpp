@@ -4,8 +4,22 @@
 
 #include "asyncrpcqueue.h"
 
+#include "corebudget.h"
+#include "rpc/server.h"
+#include "util.h"
+
+#include <algorithm>
+#include <ctime>
+
 static std::atomic<size_t> workerCounter(0);
 
+// Seconds between erasing expired results from the result database
+static const int64_t RESULT_DB_EXPIRY_INTERVAL = 60 * 60;
+
+static bool IsFinishedStatus(const std::string& status) {
+    return status == "success" || status == "failed" || status == "cancelled";
+}
+
 /**
  * Static method to return the shared/default queue.
  */
@@ -28,46 +42,255 @@ AsyncRPCQueue::~AsyncRPCQueue() {
 void AsyncRPCQueue::run(size_t workerId) {
 
     while (true) {
-        AsyncRPCOperationId key;
         std::shared_ptr<AsyncRPCOperation> operation;
+        bool isHeavy = false;
         {
             std::unique_lock<std::mutex> guard(lock_);
-            while (operation_id_queue_.empty() && !isClosed() && !isFinishing()) {
+            while (true) {
+                // Exit if the queue is closing.
+                if (isClosed()) {
+                    operation_id_queue_.clear();
+                    return;
+                }
+
+                if (take_next_operation(operation, isHeavy)) {
+                    break;
+                }
+
+                // Exit if the queue is empty and we are finishing up
+                if (isFinishing() && operation_id_queue_.empty()) {
+                    return;
+                }
+
                 this->condition_.wait(guard);
             }
+        }
 
-            // Exit if the queue is empty and we are finishing up
-            if (isFinishing() && operation_id_queue_.empty()) {
-                break;
+        {
+            CCoreReservation core(CORE_CLASS_WALLET);
+            RPCRequestURIScope uriScope(operation->getRequestURI());
+            operation->main();
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            running_.erase(operation->getId());
+            add_finished(operation);
+            if (isHeavy) {
+                heavy_running_--;
+                // A worker may be waiting for this one to finish to take a heavy operation
+                this->condition_.notify_all();
             }
+        }
+    }
+}
 
-            // Exit if the queue is closing.
-            if (isClosed()) {
-                while (!operation_id_queue_.empty()) {
-                    operation_id_queue_.pop();
-                }
-                break;
+bool AsyncRPCQueue::take_next_operation(std::shared_ptr<AsyncRPCOperation>& operation, bool& isHeavy) {
+    size_t maxHeavy = workers_.size() > 1 ? workers_.size() - 1 : 1;
+    auto it = operation_id_queue_.begin();
+    while (it != operation_id_queue_.end()) {
+        AsyncRPCOperationMap::const_iterator iter = operation_map_.find(*it);
+        if (iter == operation_map_.end() || iter->second->isCancelled()) {
+            // cannot find operation in map, may have been removed, or it was cancelled
+            if (iter != operation_map_.end()) {
+                add_finished(iter->second);
             }
+            it = operation_id_queue_.erase(it);
+            continue;
+        }
+        if (iter->second->isHeavy() && heavy_running_ >= maxHeavy) {
+            ++it;
+            continue;
+        }
+        operation = iter->second;
+        isHeavy = operation->isHeavy();
+        if (isHeavy) {
+            heavy_running_++;
+        }
+        running_.insert(*it);
+        operation_id_queue_.erase(it);
+        return true;
+    }
+    return false;
+}
+
+void AsyncRPCQueue::add_finished(const std::shared_ptr<AsyncRPCOperation>& operation) {
+    AsyncRPCOperationId id = operation->getId();
+    // It may have been removed while it was executing
+    if (!operation_map_.count(id) || finished_.count(id)) {
+        return;
+    }
+    if (!operation->isSuccess() && !operation->isFailed() && !operation->isCancelled()) {
+        return;
+    }
+
+    FinishedOperation finished;
+    finished.finished_time = (int64_t)time(NULL);
+    finished.creation_time = operation->getCreationTime();
+    finished.status = operation->getStateAsString();
+    finished_by_time_.insert(std::make_pair(finished.finished_time, id));
+    finished_by_status_[finished.status].insert(std::make_pair(finished.creation_time, id));
+    finished_.emplace(id, finished);
+
+    if (result_db_) {
+        CAsyncRPCResult result;
+        result.status = finished.status;
+        result.nCreationTime = finished.creation_time;
+        result.nFinishedTime = finished.finished_time;
+        result.strStatus = operation->getStatus().write();
+        if (!result_db_->WriteResult(id, result)) {
+            LogPrintf("%s: failed to write the result of %s\n", __func__, id);
+        }
+    }
+
+    expire_finished();
+}
+
+void AsyncRPCQueue::remove_finished(const AsyncRPCOperationId& id) {
+    auto iter = finished_.find(id);
+    if (iter == finished_.end()) {
+        return;
+    }
+    finished_by_time_.erase(std::make_pair(iter->second.finished_time, id));
+    auto byStatus = finished_by_status_.find(iter->second.status);
+    if (byStatus != finished_by_status_.end()) {
+        byStatus->second.erase(std::make_pair(iter->second.creation_time, id));
+        if (byStatus->second.empty()) {
+            finished_by_status_.erase(byStatus);
+        }
+    }
+    finished_.erase(iter);
+}
+
+void AsyncRPCQueue::expire_finished() {
+    int64_t now = (int64_t)time(NULL);
+    // The oldest are dropped first. Their results stay in result_db_, if any.
+    while (!finished_by_time_.empty() &&
+           (finished_.size() > max_results_ || now - finished_by_time_.begin()->first >= result_ttl_)) {
+        AsyncRPCOperationId id = finished_by_time_.begin()->second;
+        remove_finished(id);
+        operation_map_.erase(id);
+    }
 
-            // Get operation id
-            key = operation_id_queue_.front();
-            operation_id_queue_.pop();
+    if (result_db_ && now - db_expired_time_ >= RESULT_DB_EXPIRY_INTERVAL) {
+        size_t erased = result_db_->EraseFinishedBefore(now - result_ttl_);
+        if (erased > 0) {
+            LogPrint("zrpc", "%s: erased %d expired operation results\n", __func__, erased);
+        }
+        db_expired_time_ = now;
+    }
+}
+
+/**
+ * Limit the finished operations kept in memory, by number and by how long ago they finished.
+ */
+void AsyncRPCQueue::setResultLimits(size_t maxResults, int64_t ttl) {
+    std::lock_guard<std::mutex> guard(lock_);
+    max_results_ = maxResults;
+    result_ttl_ = std::max<int64_t>(ttl, 0);
+    expire_finished();
+}
+
+/**
+ * Write the results of operations as they finish to db, and look there for those no longer in memory.
+ */
+void AsyncRPCQueue::setResultDB(const std::shared_ptr<CAsyncRPCResultDB>& db) {
+    std::lock_guard<std::mutex> guard(lock_);
+    result_db_ = db;
+    db_expired_time_ = 0;
+    expire_finished();
+}
+
+/**
+ * Return the status objects of the operations matching filter, the oldest created first.
+ * Finished operations are looked up by status and creation time through the indexes,
+ * and those which are no longer in memory are read from the result database.
+ */
+std::vector<UniValue> AsyncRPCQueue::getOperationStatuses(const AsyncRPCOperationFilter& filter, bool removeFinished) {
+    std::vector<std::shared_ptr<AsyncRPCOperation> > operations;
+    std::vector<std::pair<AsyncRPCOperationId, CAsyncRPCResult> > stored;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        expire_finished();
 
-            // Search operation map
-            AsyncRPCOperationMap::const_iterator iter = operation_map_.find(key);
+        auto addOperation = [&](const AsyncRPCOperationId& id) {
+            AsyncRPCOperationMap::const_iterator iter = operation_map_.find(id);
             if (iter != operation_map_.end()) {
-                operation = iter->second;
+                operations.push_back(iter->second);
+            }
+        };
+        if (!filter.ids.empty()) {
+            for (const AsyncRPCOperationId& id : filter.ids) {
+                addOperation(id);
+            }
+        } else if (!filter.status.empty()) {
+            // Those not finished yet may be in any state by now
+            for (const AsyncRPCOperationId& id : operation_id_queue_) {
+                addOperation(id);
+            }
+            for (const AsyncRPCOperationId& id : running_) {
+                addOperation(id);
+            }
+            auto byStatus = finished_by_status_.find(filter.status);
+            if (byStatus != finished_by_status_.end()) {
+                auto begin = byStatus->second.lower_bound(std::make_pair(filter.fromTime, AsyncRPCOperationId()));
+                auto end = byStatus->second.lower_bound(std::make_pair(filter.toTime, AsyncRPCOperationId()));
+                for (auto it = begin; it != end; ++it) {
+                    addOperation(it->second);
+                }
+            }
+        } else {
+            for (auto& entry : operation_map_) {
+                operations.push_back(entry.second);
             }
         }
 
-        if (!operation) {
-            // cannot find operation in map, may have been removed
-        } else if (operation->isCancelled()) {
-            // skip cancelled operation
-        } else {
-            operation->main();
+        if (result_db_ && (filter.status.empty() || IsFinishedStatus(filter.status))) {
+            result_db_->FindResults(filter, stored);
+            stored.erase(std::remove_if(stored.begin(), stored.end(), [this](const std::pair<AsyncRPCOperationId, CAsyncRPCResult>& entry) {
+                return operation_map_.count(entry.first) > 0;
+            }), stored.end());
+        }
+    }
+
+    // Statuses are made without the lock, as those of batches take a while
+    std::vector<UniValue> statuses;
+    std::set<AsyncRPCOperationId> seen;
+    for (auto& operation : operations) {
+        if (!filter.MatchesTime(operation->getCreationTime()) || !seen.insert(operation->getId()).second) {
+            continue;
         }
+        UniValue obj = operation->getStatus();
+        const std::string& status = find_value(obj, "status").get_str();
+        if (!filter.status.empty() && status != filter.status) {
+            continue;
+        }
+        if (removeFinished && !IsFinishedStatus(status)) {
+            continue;
+        }
+        statuses.push_back(obj);
+    }
+    for (auto& entry : stored) {
+        UniValue obj;
+        if (obj.read(entry.second.strStatus) && obj.isObject()) {
+            statuses.push_back(obj);
+        }
+    }
+
+    // sort results chronologically by creation_time
+    std::stable_sort(statuses.begin(), statuses.end(), [](const UniValue& a, const UniValue& b) -> bool {
+        return find_value(a, "creation_time").get_int64() < find_value(b, "creation_time").get_int64();
+    });
+    if (filter.limit != 0 && statuses.size() > filter.limit) {
+        statuses.resize(filter.limit);
     }
+
+    if (removeFinished) {
+        for (const UniValue& obj : statuses) {
+            popOperationForId(find_value(obj, "id").get_str());
+        }
+    }
+    return statuses;
 }
 
 
@@ -91,7 +314,7 @@ void AsyncRPCQueue::addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOp
 
     AsyncRPCOperationId id = ptrOperation->getId();
     operation_map_.emplace(id, ptrOperation);
-    operation_id_queue_.push(id);
+    operation_id_queue_.push_back(id);
     this->condition_.notify_one();
 }
 
@@ -113,12 +336,20 @@ std::shared_ptr<AsyncRPCOperation> AsyncRPCQueue::getOperationForId(AsyncRPCOper
  * Return the operation for a given operation id and then remove the operation from internal storage.
  */
 std::shared_ptr<AsyncRPCOperation> AsyncRPCQueue::popOperationForId(AsyncRPCOperationId id) {
-    std::shared_ptr<AsyncRPCOperation> ptr = getOperationForId(id);
-    if (ptr) {
-        std::lock_guard<std::mutex> guard(lock_);
+    std::shared_ptr<AsyncRPCOperation> ptr;
+
+    std::lock_guard<std::mutex> guard(lock_);
+    AsyncRPCOperationMap::iterator iter = operation_map_.find(id);
+    if (iter != operation_map_.end()) {
+        ptr = iter->second;
         // Note: if the id still exists in the operationIdQueue, when it gets processed by a worker
         // there will no operation in the map to execute, so nothing will happen.
-        operation_map_.erase(id);
+        operation_map_.erase(iter);
+        remove_finished(id);
+    }
+    // The result may only be left on disk
+    if (result_db_) {
+        result_db_->EraseResult(id);
     }
     return ptr;
 }
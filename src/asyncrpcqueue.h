@@ -6,12 +6,16 @@
 #define ASYNCRPCQUEUE_H
 
 #include "asyncrpcoperation.h"
+#include "asyncrpcresultdb.h"
 
 #include <iostream>
 #include <string>
 #include <chrono>
-#include <queue>
+#include <deque>
+#include <map>
+#include <set>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <future>
 #include <thread>
@@ -21,6 +25,11 @@
 
 typedef std::unordered_map<AsyncRPCOperationId, std::shared_ptr<AsyncRPCOperation> > AsyncRPCOperationMap; 
 
+// Finished operations kept in memory by default (-rpcasyncresults)
+static const unsigned int DEFAULT_ASYNC_RESULTS = 1000;
+// Seconds the result of a finished operation is kept by default (-rpcasyncresultttl)
+static const int64_t DEFAULT_ASYNC_RESULT_TTL = 7 * 24 * 60 * 60;
+
 
 class AsyncRPCQueue {
 public:
@@ -50,19 +59,64 @@ public:
     void addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOperation);
     std::vector<AsyncRPCOperationId> getAllOperationIds() const;
 
+    // Keep at most maxResults finished operations in memory, none of them
+    // for longer than ttl seconds after it finished.
+    void setResultLimits(size_t maxResults, int64_t ttl);
+    // Also keep the results of finished operations in db, where they outlive
+    // the limits on memory and restarts, or stop keeping them when db is null.
+    void setResultDB(const std::shared_ptr<CAsyncRPCResultDB>& db);
+    // Status of the operations matching filter, in memory or in the result
+    // database, the oldest created first. If removeFinished, only finished
+    // operations are returned, and they are removed.
+    std::vector<UniValue> getOperationStatuses(const AsyncRPCOperationFilter& filter, bool removeFinished);
+
 private:
     // addWorker() will spawn a new thread on run())
     void run(size_t workerId);
     void wait_for_worker_threads();
 
+    // Requires lock_. Take the first queued operation that may run now,
+    // passing over heavy operations while too many of them are running.
+    bool take_next_operation(std::shared_ptr<AsyncRPCOperation>& operation, bool& isHeavy);
+
+    // Requires lock_. Index an operation that finished, or was cancelled
+    // before it ran, and drop the finished operations beyond the limits.
+    void add_finished(const std::shared_ptr<AsyncRPCOperation>& operation);
+    // Requires lock_. Forget the finished operation id, if it is one.
+    void remove_finished(const AsyncRPCOperationId& id);
+    // Requires lock_. Drop the finished operations beyond the limits.
+    void expire_finished();
+
+    struct FinishedOperation {
+        int64_t finished_time;
+        int64_t creation_time;
+        std::string status;
+    };
+
     // Why this is not a recursive lock: http://www.zaval.org/resources/library/butenhof1.html
     mutable std::mutex lock_;
     std::condition_variable condition_;
     std::atomic<bool> closed_;
     std::atomic<bool> finish_;
     AsyncRPCOperationMap operation_map_;
-    std::queue <AsyncRPCOperationId> operation_id_queue_;
+    std::deque <AsyncRPCOperationId> operation_id_queue_;
     std::vector<std::thread> workers_;
+    // Heavy operations being executed. All workers but one may run them at
+    // the same time, so that one is always left for short operations.
+    size_t heavy_running_ = 0;
+
+    // Finished operations still in operation_map_, indexed by the time they
+    // finished for expiry, and by status and creation time for queries.
+    std::unordered_map<AsyncRPCOperationId, FinishedOperation> finished_;
+    // Operations being executed, which with those queued are all the others
+    std::unordered_set<AsyncRPCOperationId> running_;
+    std::set<std::pair<int64_t, AsyncRPCOperationId> > finished_by_time_;
+    std::map<std::string, std::set<std::pair<int64_t, AsyncRPCOperationId> > > finished_by_status_;
+    size_t max_results_ = DEFAULT_ASYNC_RESULTS;
+    int64_t result_ttl_ = DEFAULT_ASYNC_RESULT_TTL;
+    std::shared_ptr<CAsyncRPCResultDB> result_db_;
+    // When expired results were last erased from result_db_
+    int64_t db_expired_time_ = 0;
 };
 
 #endif
@@ -0,0 +1,170 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "asyncrpcresultdb.h"
+
+#include <algorithm>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+static const char DB_RESULT = 'r';
+static const char DB_CREATED = 'c';
+static const char DB_STATUS = 's';
+static const char DB_FINISHED = 'f';
+
+namespace {
+
+/** Key of the time indexes, with the time big-endian so keys sort by time */
+struct CResultTimeKey
+{
+    uint32_t nTime;
+    AsyncRPCOperationId id;
+
+    CResultTimeKey() : nTime(0) {}
+    CResultTimeKey(uint32_t nTimeIn, const AsyncRPCOperationId& idIn) : nTime(nTimeIn), id(idIn) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata32be(s, nTime);
+        s << id;
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        nTime = ser_readdata32be(s);
+        s >> id;
+    }
+};
+
+/** The start of the keys of a time index from a time on */
+struct CResultTimeIteratorKey
+{
+    uint32_t nTime;
+
+    CResultTimeIteratorKey(uint32_t nTimeIn) : nTime(nTimeIn) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata32be(s, nTime);
+    }
+};
+
+uint32_t IndexTime(int64_t nTime)
+{
+    return std::max<int64_t>(0, std::min<int64_t>(nTime, std::numeric_limits<uint32_t>::max()));
+}
+
+void EraseIndexes(CDBBatch& batch, const AsyncRPCOperationId& id, const CAsyncRPCResult& result)
+{
+    batch.Erase(std::make_pair(DB_CREATED, CResultTimeKey(IndexTime(result.nCreationTime), id)));
+    batch.Erase(std::make_pair(DB_STATUS, std::make_pair(result.status, CResultTimeKey(IndexTime(result.nCreationTime), id))));
+    batch.Erase(std::make_pair(DB_FINISHED, CResultTimeKey(IndexTime(result.nFinishedTime), id)));
+}
+
+}
+
+CAsyncRPCResultDB::CAsyncRPCResultDB(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe) :
+    CDBWrapper(path, nCacheSize, fMemory, fWipe)
+{
+}
+
+bool CAsyncRPCResultDB::WriteResult(const AsyncRPCOperationId& id, const CAsyncRPCResult& result)
+{
+    CDBBatch batch(*this);
+    CAsyncRPCResult old;
+    if (ReadResult(id, old))
+        EraseIndexes(batch, id, old);
+    batch.Write(std::make_pair(DB_RESULT, id), result);
+    batch.Write(std::make_pair(DB_CREATED, CResultTimeKey(IndexTime(result.nCreationTime), id)), '\0');
+    batch.Write(std::make_pair(DB_STATUS, std::make_pair(result.status, CResultTimeKey(IndexTime(result.nCreationTime), id))), '\0');
+    batch.Write(std::make_pair(DB_FINISHED, CResultTimeKey(IndexTime(result.nFinishedTime), id)), '\0');
+    return WriteBatch(batch);
+}
+
+bool CAsyncRPCResultDB::ReadResult(const AsyncRPCOperationId& id, CAsyncRPCResult& result) const
+{
+    return Read(std::make_pair(DB_RESULT, id), result);
+}
+
+bool CAsyncRPCResultDB::EraseResult(const AsyncRPCOperationId& id)
+{
+    CAsyncRPCResult result;
+    if (!ReadResult(id, result))
+        return true;
+    CDBBatch batch(*this);
+    EraseIndexes(batch, id, result);
+    batch.Erase(std::make_pair(DB_RESULT, id));
+    return WriteBatch(batch);
+}
+
+bool CAsyncRPCResultDB::FindResults(const AsyncRPCOperationFilter& filter, std::vector<std::pair<AsyncRPCOperationId, CAsyncRPCResult> >& vResults)
+{
+    vResults.clear();
+    if (!filter.ids.empty()) {
+        for (const AsyncRPCOperationId& id : filter.ids) {
+            CAsyncRPCResult result;
+            if (ReadResult(id, result) && filter.MatchesTime(result.nCreationTime) &&
+                (filter.status.empty() || filter.status == result.status))
+                vResults.push_back(std::make_pair(id, result));
+        }
+        std::sort(vResults.begin(), vResults.end(), [](const std::pair<AsyncRPCOperationId, CAsyncRPCResult>& a, const std::pair<AsyncRPCOperationId, CAsyncRPCResult>& b) {
+            return a.second.nCreationTime < b.second.nCreationTime;
+        });
+        if (filter.limit != 0 && vResults.size() > filter.limit)
+            vResults.resize(filter.limit);
+        return true;
+    }
+
+    // Walk the index by creation time, of the status asked for if any
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    if (filter.status.empty())
+        pcursor->Seek(std::make_pair(DB_CREATED, CResultTimeIteratorKey(IndexTime(filter.fromTime))));
+    else
+        pcursor->Seek(std::make_pair(DB_STATUS, std::make_pair(filter.status, CResultTimeIteratorKey(IndexTime(filter.fromTime)))));
+
+    while (pcursor->Valid() && (filter.limit == 0 || vResults.size() < filter.limit)) {
+        boost::this_thread::interruption_point();
+        CResultTimeKey timeKey;
+        if (filter.status.empty()) {
+            std::pair<char, CResultTimeKey> key;
+            if (!pcursor->GetKey(key) || key.first != DB_CREATED)
+                break;
+            timeKey = key.second;
+        } else {
+            std::pair<char, std::pair<std::string, CResultTimeKey> > key;
+            if (!pcursor->GetKey(key) || key.first != DB_STATUS || key.second.first != filter.status)
+                break;
+            timeKey = key.second.second;
+        }
+        if (timeKey.nTime >= filter.toTime)
+            break;
+
+        CAsyncRPCResult result;
+        if (ReadResult(timeKey.id, result) && filter.MatchesTime(result.nCreationTime))
+            vResults.push_back(std::make_pair(timeKey.id, result));
+        pcursor->Next();
+    }
+    return true;
+}
+
+size_t CAsyncRPCResultDB::EraseFinishedBefore(int64_t nTime)
+{
+    std::vector<AsyncRPCOperationId> vExpired;
+    {
+        boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+        pcursor->Seek(std::make_pair(DB_FINISHED, CResultTimeIteratorKey(0)));
+        while (pcursor->Valid()) {
+            std::pair<char, CResultTimeKey> key;
+            if (!pcursor->GetKey(key) || key.first != DB_FINISHED || key.second.nTime >= nTime)
+                break;
+            vExpired.push_back(key.second.id);
+            pcursor->Next();
+        }
+    }
+
+    for (const AsyncRPCOperationId& id : vExpired)
+        EraseResult(id);
+    return vExpired.size();
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ASYNCRPCRESULTDB_H
+#define BITCOIN_ASYNCRPCRESULTDB_H
+
+#include "asyncrpcoperation.h"
+#include "dbwrapper.h"
+#include "serialize.h"
+
+#include <limits>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+/** Which operations z_getoperationstatus and z_getoperationresult report */
+struct AsyncRPCOperationFilter
+{
+    //! Only these operations, or all of them if empty
+    std::set<AsyncRPCOperationId> ids;
+    //! Only operations in this state, e.g. "success", or in any if empty
+    std::string status;
+    //! Only operations created at or after fromTime and before toTime
+    int64_t fromTime;
+    int64_t toTime;
+    //! At most this many operations, the oldest created first, or all if 0
+    size_t limit;
+
+    AsyncRPCOperationFilter() : fromTime(0), toTime(std::numeric_limits<int64_t>::max()), limit(0) {}
+
+    bool MatchesTime(int64_t nCreationTime) const { return nCreationTime >= fromTime && nCreationTime < toTime; }
+};
+
+/** A finished operation as kept by the result database */
+struct CAsyncRPCResult
+{
+    std::string status;
+    int64_t nCreationTime;
+    int64_t nFinishedTime;
+    //! What getStatus() returned once the operation finished, as JSON
+    std::string strStatus;
+
+    CAsyncRPCResult() : nCreationTime(0), nFinishedTime(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(status);
+        READWRITE(nCreationTime);
+        READWRITE(nFinishedTime);
+        READWRITE(strStatus);
+    }
+};
+
+/**
+ * Results of finished async RPC operations kept on disk (-rpcasyncpersist),
+ * so that they outlive the bounded set AsyncRPCQueue keeps in memory and a
+ * restart of the node. Besides the results, by operation id, the database
+ * indexes them by creation time, by status and creation time, and by the
+ * time they finished, to answer filtered queries and drop expired results
+ * without reading every record.
+ */
+class CAsyncRPCResultDB : public CDBWrapper
+{
+public:
+    CAsyncRPCResultDB(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    bool WriteResult(const AsyncRPCOperationId& id, const CAsyncRPCResult& result);
+    bool ReadResult(const AsyncRPCOperationId& id, CAsyncRPCResult& result) const;
+    bool EraseResult(const AsyncRPCOperationId& id);
+
+    //! Results matching filter, the oldest created first
+    bool FindResults(const AsyncRPCOperationFilter& filter, std::vector<std::pair<AsyncRPCOperationId, CAsyncRPCResult> >& vResults);
+
+    //! Erase the results of operations that finished before nTime
+    size_t EraseFinishedBefore(int64_t nTime);
+};
+
+#endif // BITCOIN_ASYNCRPCRESULTDB_H
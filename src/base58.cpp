@@ -8,10 +8,38 @@
 #include <uint256.h>
 
 #include <assert.h>
+#include <stdint.h>
 #include <string.h>
 
 /** All alphanumeric characters except for "0", "I", "O", and "l" */
 static const char* pszBase58 = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+/** Value of each base58 character, -1 for the others */
+static const int8_t mapBase58[256] = {
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1, 0, 1, 2, 3, 4, 5, 6,  7, 8,-1,-1,-1,-1,-1,-1,
+    -1, 9,10,11,12,13,14,15, 16,-1,17,18,19,20,21,-1,
+    22,23,24,25,26,27,28,29, 30,31,32,-1,-1,-1,-1,-1,
+    -1,33,34,35,36,37,38,39, 40,41,42,43,-1,44,45,46,
+    47,48,49,50,51,52,53,54, 55,56,57,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+};
+
+/**
+ * The conversions work on limbs holding several digits at once rather than
+ * one digit at a time: 32-bit limbs of base 58^5 when encoding, taking three
+ * bytes per pass, and 32-bit limbs of base 2^32 when decoding, taking five
+ * characters per pass. The products fit in 64 bits.
+ */
+static const uint32_t BASE58_LIMB = 58 * 58 * 58 * 58 * 58;
 
 bool DecodeBase58(const char* psz, std::vector<unsigned char>& vch)
 {
@@ -24,38 +52,47 @@ bool DecodeBase58(const char* psz, std::vector<unsigned char>& vch)
         zeroes++;
         psz++;
     }
-    // Allocate enough space in big-endian base256 representation.
-    std::vector<unsigned char> b256(strlen(psz) * 733 / 1000 + 1); // log(58) / log(256), rounded up.
-    // Process the characters.
+    // Little-endian base 2^32 representation.
+    std::vector<uint32_t> limbs;
+    limbs.reserve(strlen(psz) * 733 / 4000 + 1); // log(58) / log(2^32), rounded up.
+    // Process the characters, up to five at a time.
     while (*psz && !isspace(*psz)) {
-        // Decode base58 character
-        const char* ch = strchr(pszBase58, *psz);
-        if (ch == NULL)
-            return false;
-        // Apply "b256 = b256 * 58 + ch".
-        int carry = ch - pszBase58;
-        for (std::vector<unsigned char>::reverse_iterator it = b256.rbegin(); it != b256.rend(); it++) {
-            carry += 58 * (*it);
-            *it = carry % 256;
-            carry /= 256;
+        uint64_t carry = 0;
+        uint64_t mul = 1;
+        for (int i = 0; i < 5 && *psz && !isspace(*psz); i++, psz++) {
+            // Decode base58 character
+            int digit = mapBase58[(uint8_t)*psz];
+            if (digit == -1)
+                return false;
+            carry = carry * 58 + digit;
+            mul *= 58;
+        }
+        // Apply "limbs = limbs * mul + carry".
+        for (std::vector<uint32_t>::iterator it = limbs.begin(); it != limbs.end(); it++) {
+            carry += mul * (*it);
+            *it = (uint32_t)carry;
+            carry >>= 32;
+        }
+        while (carry != 0) {
+            limbs.push_back((uint32_t)carry);
+            carry >>= 32;
         }
-        assert(carry == 0);
-        psz++;
     }
     // Skip trailing spaces.
     while (isspace(*psz))
         psz++;
     if (*psz != 0)
         return false;
-    // Skip leading zeroes in b256.
-    std::vector<unsigned char>::iterator it = b256.begin();
-    while (it != b256.end() && *it == 0)
-        it++;
-    // Copy result into output vector.
-    vch.reserve(zeroes + (b256.end() - it));
+    // Copy result into output vector, without the leading zeroes of the top limb.
+    vch.reserve(zeroes + limbs.size() * 4);
     vch.assign(zeroes, 0x00);
-    while (it != b256.end())
-        vch.push_back(*(it++));
+    for (std::vector<uint32_t>::reverse_iterator it = limbs.rbegin(); it != limbs.rend(); it++) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            unsigned char c = (*it >> shift) & 0xff;
+            if (c != 0 || it != limbs.rbegin() || vch.size() > (size_t)zeroes)
+                vch.push_back(c);
+        }
+    }
     return true;
 }
 
@@ -67,30 +104,46 @@ std::string EncodeBase58(const unsigned char* pbegin, const unsigned char* pend)
         pbegin++;
         zeroes++;
     }
-    // Allocate enough space in big-endian base58 representation.
-    std::vector<unsigned char> b58((pend - pbegin) * 138 / 100 + 1); // log(256) / log(58), rounded up.
-    // Process the bytes.
+    // Little-endian base 58^5 representation.
+    std::vector<uint32_t> limbs;
+    limbs.reserve((pend - pbegin) * 138 / 500 + 1); // log(256) / log(58^5), rounded up.
+    // Process the bytes, up to three at a time.
     while (pbegin != pend) {
-        int carry = *pbegin;
-        // Apply "b58 = b58 * 256 + ch".
-        for (std::vector<unsigned char>::reverse_iterator it = b58.rbegin(); it != b58.rend(); it++) {
-            carry += 256 * (*it);
-            *it = carry % 58;
-            carry /= 58;
+        uint64_t carry = 0;
+        uint64_t mul = 1;
+        for (int i = 0; i < 3 && pbegin != pend; i++, pbegin++) {
+            carry = (carry << 8) | *pbegin;
+            mul <<= 8;
+        }
+        // Apply "limbs = limbs * mul + carry".
+        for (std::vector<uint32_t>::iterator it = limbs.begin(); it != limbs.end(); it++) {
+            carry += mul * (*it);
+            *it = carry % BASE58_LIMB;
+            carry /= BASE58_LIMB;
+        }
+        while (carry != 0) {
+            limbs.push_back(carry % BASE58_LIMB);
+            carry /= BASE58_LIMB;
         }
-        assert(carry == 0);
-        pbegin++;
     }
-    // Skip leading zeroes in base58 result.
-    std::vector<unsigned char>::iterator it = b58.begin();
-    while (it != b58.end() && *it == 0)
-        it++;
-    // Translate the result into a string.
+    // Translate the result into a string, without the leading zeroes of the top limb.
     std::string str;
-    str.reserve(zeroes + (b58.end() - it));
+    str.reserve(zeroes + limbs.size() * 5);
     str.assign(zeroes, '1');
-    while (it != b58.end())
-        str += pszBase58[*(it++)];
+    for (std::vector<uint32_t>::reverse_iterator it = limbs.rbegin(); it != limbs.rend(); it++) {
+        char digits[5];
+        uint32_t limb = *it;
+        for (int i = 4; i >= 0; i--) {
+            digits[i] = pszBase58[limb % 58];
+            limb /= 58;
+        }
+        int skip = 0;
+        if (it == limbs.rbegin()) {
+            while (digits[skip] == '1')
+                skip++;
+        }
+        str.append(digits + skip, 5 - skip);
+    }
     return str;
 }
 
@@ -0,0 +1,167 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+
+#include <algorithm>
+
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+/** Samples are made long enough that a benchmark's budget holds about this many */
+const int TARGET_SAMPLES = 25;
+/** Samples taken however long they run, so that there is a median */
+const size_t MIN_SAMPLES = 5;
+/** Samples after which a benchmark stops even if its budget isn't spent */
+const size_t MAX_SAMPLES = 1000;
+
+double Seconds(benchmark::clock::duration d)
+{
+    return std::chrono::duration_cast<std::chrono::duration<double> >(d).count();
+}
+
+benchmark::Result Run(const std::string& name, const benchmark::BenchFunction& func, double elapsedTimeForOne, double warmupTimeForOne)
+{
+    benchmark::State state(name, elapsedTimeForOne, warmupTimeForOne);
+    func(state);
+    return state.GetResult();
+}
+
+} // namespace
+
+benchmark::BenchRunner::BenchmarkMap &benchmark::BenchRunner::benchmarks()
+{
+    static BenchmarkMap benchmarks_map;
+    return benchmarks_map;
+}
+
+benchmark::BenchRunner::BenchRunner(std::string name, benchmark::BenchFunction func)
+{
+    benchmarks().insert(std::make_pair(name, func));
+}
+
+std::vector<benchmark::Result> benchmark::BenchRunner::RunAll(const std::string& filter, double elapsedTimeForOne, double warmupTimeForOne)
+{
+    printf("#Benchmark,samples,iterations,min(s),median(s),max(s)\n");
+
+    std::vector<Result> results;
+    for (BenchmarkMap::iterator it = benchmarks().begin(); it != benchmarks().end(); ++it) {
+        if (it->first.find(filter) == std::string::npos)
+            continue;
+        results.push_back(Run(it->first, it->second, elapsedTimeForOne, warmupTimeForOne));
+    }
+    return results;
+}
+
+std::vector<benchmark::Result> benchmark::BenchRunner::RunNamed(const std::vector<std::string>& names, double elapsedTimeForOne, double warmupTimeForOne)
+{
+    printf("#Benchmark,samples,iterations,min(s),median(s),max(s)\n");
+
+    std::vector<Result> results;
+    for (const std::string& name : names) {
+        BenchmarkMap::iterator it = benchmarks().find(name);
+        if (it == benchmarks().end())
+            continue;
+        results.push_back(Run(it->first, it->second, elapsedTimeForOne, warmupTimeForOne));
+    }
+    return results;
+}
+
+benchmark::State::State(std::string _name, double _maxElapsed, double _warmupTime) :
+    name(_name), maxElapsed(_maxElapsed), warmupTime(_warmupTime), fWarmingUp(true),
+    nIterations(0), nPerSample(1), nInSample(0)
+{
+}
+
+bool benchmark::State::KeepRunning()
+{
+    if (nInSample > 0 && nInSample < nPerSample) {
+        ++nInSample;
+        return true;
+    }
+
+    clock::time_point now = clock::now();
+    if (nInSample == 0) {
+        // First call
+        beginTime = sampleTime = now;
+        nInSample = 1;
+        return true;
+    }
+
+    // A sample is complete
+    double elapsed = Seconds(now - sampleTime);
+    if (fWarmingUp) {
+        if (elapsed < maxElapsed / TARGET_SAMPLES && nPerSample < (1ULL << 40)) {
+            nPerSample *= 2;
+        } else if (Seconds(now - beginTime) >= warmupTime) {
+            fWarmingUp = false;
+            beginTime = now;
+        }
+    } else {
+        nIterations += nPerSample;
+        vSamples.push_back(elapsed / nPerSample);
+        if (vSamples.size() >= MAX_SAMPLES || (Seconds(now - beginTime) >= maxElapsed && vSamples.size() >= MIN_SAMPLES)) {
+            Report();
+            return false;
+        }
+    }
+
+    nInSample = 1;
+    sampleTime = clock::now();
+    return true;
+}
+
+benchmark::Result benchmark::State::GetResult() const
+{
+    Result result;
+    result.name = name;
+    result.nSamples = vSamples.size();
+    result.nIterations = nIterations;
+    result.min = result.median = result.max = 0;
+    if (vSamples.empty())
+        return result;
+
+    std::vector<double> vSorted(vSamples);
+    std::sort(vSorted.begin(), vSorted.end());
+    size_t nMid = vSorted.size() / 2;
+    result.min = vSorted.front();
+    result.median = vSorted.size() % 2 ? vSorted[nMid] : (vSorted[nMid - 1] + vSorted[nMid]) / 2;
+    result.max = vSorted.back();
+    return result;
+}
+
+void benchmark::State::Report() const
+{
+    Result result = GetResult();
+    printf("%s,%u,%lu,%g,%g,%g\n", name.c_str(), (unsigned int)result.nSamples, (unsigned long)result.nIterations,
+           result.min, result.median, result.max);
+}
+
+uint256 benchmark::SeededHash(uint64_t nSeed)
+{
+    uint256 hash;
+    SeededBytes(hash.begin(), hash.size(), nSeed);
+    return hash;
+}
+
+void benchmark::SeededBytes(unsigned char* buf, size_t len, uint64_t nSeed)
+{
+    // SHA256 of the seed and a block counter, as many blocks as it takes
+    unsigned char block[CSHA256::OUTPUT_SIZE];
+    for (uint64_t n = 0; len > 0; n++) {
+        unsigned char data[16];
+        WriteLE64(data, nSeed);
+        WriteLE64(data + 8, n);
+        CSHA256().Write(data, sizeof(data)).Finalize(block);
+        size_t nCopy = std::min(len, sizeof(block));
+        memcpy(buf, block, nCopy);
+        buf += nCopy;
+        len -= nCopy;
+    }
+}
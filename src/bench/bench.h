@@ -0,0 +1,115 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BENCH_BENCH_H
+#define BITCOIN_BENCH_BENCH_H
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "uint256.h"
+
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+// Simple micro-benchmarking framework; API mostly matches a subset of the Google Benchmark
+// framework (see https://github.com/google/benchmark)
+// Why not use the Google Benchmark framework? Because adding Yet Another Dependency
+// (that uses cmake as its build system and has lots of features we don't need) isn't
+// worth it.
+
+/*
+ * Usage:
+
+static void CODE_TO_TIME(benchmark::State& state)
+{
+    ... do any setup needed...
+    while (state.KeepRunning()) {
+       ... do stuff you want to time...
+    }
+    ... do any cleanup needed...
+}
+
+BENCHMARK(CODE_TO_TIME);
+
+ */
+
+namespace benchmark {
+
+    typedef std::chrono::steady_clock clock;
+
+    /** What a benchmark measured; times are seconds per iteration */
+    struct Result {
+        std::string name;
+        size_t nSamples;
+        uint64_t nIterations;
+        double min;
+        double median;
+        double max;
+    };
+
+    /**
+     * Drives the timed loop of one benchmark. Iterations are timed in
+     * samples of a calibrated number of iterations, long enough for the
+     * clock to resolve them. Samples taken while warming up calibrate that
+     * number and are discarded; the rest are run until the time budget is
+     * spent and reported per iteration as min, median and max.
+     */
+    class State {
+        std::string name;
+        double maxElapsed;
+        double warmupTime;
+        clock::time_point beginTime;
+        clock::time_point sampleTime;
+        bool fWarmingUp;
+        uint64_t nIterations;
+        uint64_t nPerSample;
+        uint64_t nInSample;
+        std::vector<double> vSamples;
+
+        void Report() const;
+
+    public:
+        State(std::string _name, double _maxElapsed, double _warmupTime);
+        bool KeepRunning();
+
+        //! The measurement, once KeepRunning has returned false
+        Result GetResult() const;
+    };
+
+    /**
+     * Inputs derived from a seed rather than drawn from GetRandHash, so
+     * that every run of a benchmark works on the same data and runs can
+     * be compared with a baseline.
+     */
+    uint256 SeededHash(uint64_t nSeed);
+    void SeededBytes(unsigned char* buf, size_t len, uint64_t nSeed);
+
+    typedef std::function<void(State&)> BenchFunction;
+
+    class BenchRunner
+    {
+        typedef std::map<std::string, BenchFunction> BenchmarkMap;
+        static BenchmarkMap &benchmarks();
+
+    public:
+        BenchRunner(std::string name, BenchFunction func);
+
+        /** Run the benchmarks whose name contains filter, each for about elapsedTimeForOne seconds */
+        static std::vector<Result> RunAll(const std::string& filter, double elapsedTimeForOne = 1.0, double warmupTimeForOne = 0.1);
+
+        /** Run only the named benchmarks; names that aren't registered are skipped */
+        static std::vector<Result> RunNamed(const std::vector<std::string>& names, double elapsedTimeForOne = 1.0, double warmupTimeForOne = 0.1);
+    };
+}
+
+// BENCHMARK(foo) expands to:  benchmark::BenchRunner bench_11foo("foo", foo);
+#define BENCHMARK(n) \
+    benchmark::BenchRunner BOOST_PP_CAT(bench_, BOOST_PP_CAT(__LINE__, n))(BOOST_PP_STRINGIZE(n), n);
+
+#endif // BITCOIN_BENCH_BENCH_H
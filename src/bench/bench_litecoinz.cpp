@@ -0,0 +1,79 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "bench/perf.h"
+
+#include "chainparams.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "key.h"
+#include "util.h"
+
+#include <stdio.h>
+
+static const double DEFAULT_BENCH_TIME = 1.0;
+static const double DEFAULT_BENCH_WARMUP = 0.1;
+static const double DEFAULT_BENCH_THRESHOLD = 10.0;
+
+int main(int argc, char** argv)
+{
+    ParseParameters(argc, argv);
+    if (mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help")) {
+        printf("Usage: bench_litecoinz [options]\n\n"
+               "Options:\n"
+               "  -filter=<s>   Only run benchmarks whose name contains <s>\n"
+               "  -time=<n>     Seconds to spend measuring each benchmark (default: %g)\n"
+               "  -warmup=<n>   Seconds to warm each benchmark up for (default: %g)\n"
+               "  -json=<file>  Also write the results to <file> as JSON\n"
+               "  -baseline=<file>\n"
+               "                Run the benchmarks listed in the results file <file> instead of those\n"
+               "                -filter selects, and exit with an error if any is slower, relative to\n"
+               "                the Calibration benchmark, than -threshold allows\n"
+               "  -threshold=<n> Percentage by which a benchmark may be slower than in the baseline\n"
+               "                (default: %g)\n",
+               DEFAULT_BENCH_TIME, DEFAULT_BENCH_WARMUP, DEFAULT_BENCH_THRESHOLD);
+        return 0;
+    }
+
+    if (init_and_check_sodium() == -1)
+        return 1;
+    SHA256AutoDetect();
+    ECC_Start();
+    SetupEnvironment();
+    fPrintToDebugLog = false; // don't want to write to debug.log file
+    SelectParams(CBaseChainParams::MAIN);
+
+    double nTime = atof(GetArg("-time", strprintf("%g", DEFAULT_BENCH_TIME)).c_str());
+    double nWarmup = atof(GetArg("-warmup", strprintf("%g", DEFAULT_BENCH_WARMUP)).c_str());
+    double nThreshold = atof(GetArg("-threshold", strprintf("%g", DEFAULT_BENCH_THRESHOLD)).c_str());
+
+    // Read before running anything, as -json may name the same file to record a new baseline
+    UniValue baseline;
+    if (mapArgs.count("-baseline")) {
+        std::string strError;
+        if (!benchmark::ReadBaseline(mapArgs["-baseline"], baseline, strError)) {
+            fprintf(stderr, "Error: %s\n", strError.c_str());
+            return 1;
+        }
+    }
+
+    std::vector<benchmark::Result> results;
+    if (mapArgs.count("-baseline"))
+        results = benchmark::BenchRunner::RunNamed(benchmark::BaselineNames(baseline), nTime, nWarmup);
+    else
+        results = benchmark::BenchRunner::RunAll(GetArg("-filter", ""), nTime, nWarmup);
+    UniValue json = benchmark::ResultsToJSON(results);
+
+    int ret = 0;
+    if (mapArgs.count("-json") && !benchmark::WriteJSON(mapArgs["-json"], json)) {
+        fprintf(stderr, "Error: cannot write %s\n", mapArgs["-json"].c_str());
+        ret = 1;
+    }
+    if (mapArgs.count("-baseline") && !benchmark::CompareWithBaseline(baseline, json, nThreshold))
+        ret = 1;
+
+    ECC_Stop();
+    return ret;
+}
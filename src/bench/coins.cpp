@@ -0,0 +1,62 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "coins.h"
+#include "pubkey.h"
+#include "script/standard.h"
+
+#include <assert.h>
+#include <vector>
+
+/** Outputs added, looked up and spent per iteration */
+static const size_t COINS_PER_ITERATION = 1000;
+
+static std::vector<COutPoint> MakeOutPoints()
+{
+    std::vector<COutPoint> vOutPoints;
+    for (size_t i = 0; i < COINS_PER_ITERATION; i++)
+        vOutPoints.push_back(COutPoint(benchmark::SeededHash(i), i % 4));
+    return vOutPoints;
+}
+
+static CTxOut MakeTxOut()
+{
+    CKeyID id;
+    return CTxOut(50000, GetScriptForDestination(id));
+}
+
+static void CCoinsViewCache_AddSpend(benchmark::State& state)
+{
+    CCoinsView base;
+    CCoinsViewCache cache(&base);
+    std::vector<COutPoint> vOutPoints = MakeOutPoints();
+    CTxOut out = MakeTxOut();
+    while (state.KeepRunning()) {
+        for (const COutPoint& outpoint : vOutPoints)
+            cache.AddCoin(outpoint, Coin(CTxOut(out), 100, false), false);
+        for (const COutPoint& outpoint : vOutPoints)
+            cache.SpendCoin(outpoint);
+    }
+}
+
+/** Lookups through a second cache layer, as validation does on top of pcoinsTip */
+static void CCoinsViewCache_AccessLayered(benchmark::State& state)
+{
+    CCoinsView base;
+    CCoinsViewCache tip(&base);
+    std::vector<COutPoint> vOutPoints = MakeOutPoints();
+    CTxOut out = MakeTxOut();
+    for (const COutPoint& outpoint : vOutPoints)
+        tip.AddCoin(outpoint, Coin(CTxOut(out), 100, false), false);
+    while (state.KeepRunning()) {
+        CCoinsViewCache view(&tip);
+        for (const COutPoint& outpoint : vOutPoints)
+            assert(!view.AccessCoin(outpoint).IsSpent());
+    }
+}
+
+BENCHMARK(CCoinsViewCache_AddSpend);
+BENCHMARK(CCoinsViewCache_AccessLayered);
@@ -0,0 +1,60 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "uint256.h"
+
+#include "sodium.h"
+
+#include <string.h>
+#include <vector>
+
+/* Number of bytes to hash per iteration */
+static const uint64_t BUFFER_SIZE = 1000*1000;
+
+static void SHA256(benchmark::State& state)
+{
+    uint8_t hash[CSHA256::OUTPUT_SIZE];
+    std::vector<uint8_t> in(BUFFER_SIZE,0);
+    while (state.KeepRunning())
+        CSHA256().Write(in.data(), in.size()).Finalize(hash);
+}
+
+static void SHA256_32b(benchmark::State& state)
+{
+    std::vector<uint8_t> in(32,0);
+    while (state.KeepRunning())
+        CSHA256().Write(in.data(), in.size()).Finalize(in.data());
+}
+
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    std::vector<uint8_t> out(32 * 1024);
+    while (state.KeepRunning())
+        SHA256D64(out.data(), in.data(), 1024);
+}
+
+/** BLAKE2b as Equihash uses it, personalised and with a 50 byte digest */
+static void BLAKE2b_Equihash(benchmark::State& state)
+{
+    unsigned char personalization[crypto_generichash_blake2b_PERSONALBYTES] = {};
+    memcpy(personalization, "ZcashPoW", 8);
+    unsigned char hash[50];
+    std::vector<uint8_t> in(BUFFER_SIZE,0);
+    while (state.KeepRunning()) {
+        crypto_generichash_blake2b_state hasher;
+        crypto_generichash_blake2b_init_salt_personal(&hasher, NULL, 0, sizeof(hash), NULL, personalization);
+        crypto_generichash_blake2b_update(&hasher, in.data(), in.size());
+        crypto_generichash_blake2b_final(&hasher, hash, sizeof(hash));
+    }
+}
+
+BENCHMARK(SHA256);
+BENCHMARK(SHA256_32b);
+BENCHMARK(SHA256D64_1024);
+BENCHMARK(BLAKE2b_Equihash);
@@ -0,0 +1,49 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "crypto/equihash.h"
+#include "pow.h"
+#include "primitives/block.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <vector>
+
+static void Equihash_Verify(benchmark::State& state)
+{
+    const CChainParams& params = Params(CBaseChainParams::MAIN);
+    CBlockHeader header = params.GenesisBlock().GetBlockHeader();
+    while (state.KeepRunning())
+        assert(CheckEquihashSolution(&header, params));
+}
+
+// A solution whose indices are out of order, turned down before any hashing
+static void Equihash_VerifyMisordered(benchmark::State& state)
+{
+    const CChainParams& params = Params(CBaseChainParams::MAIN);
+    CBlockHeader header = params.GenesisBlock().GetBlockHeader();
+    size_t cBitLen = params.EquihashN(0)/(params.EquihashK(0)+1);
+    std::vector<eh_index> indices = GetIndicesFromMinimal(header.nSolution, cBitLen);
+    std::swap(indices[0], indices[1]);
+    header.nSolution = GetMinimalFromIndices(indices, cBitLen);
+    while (state.KeepRunning())
+        assert(!CheckEquihashSolution(&header, params));
+}
+
+// A well-formed solution for another header, turned down at its first collision
+static void Equihash_VerifyWrongHeader(benchmark::State& state)
+{
+    const CChainParams& params = Params(CBaseChainParams::MAIN);
+    CBlockHeader header = params.GenesisBlock().GetBlockHeader();
+    header.nTime++;
+    while (state.KeepRunning())
+        assert(!CheckEquihashSolution(&header, params));
+}
+
+BENCHMARK(Equihash_Verify);
+BENCHMARK(Equihash_VerifyMisordered);
+BENCHMARK(Equihash_VerifyWrongHeader);
@@ -0,0 +1,36 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "zcash/IncrementalMerkleTree.hpp"
+
+static void PedersenHash_Combine(benchmark::State& state)
+{
+    libzcash::PedersenHash a(benchmark::SeededHash(0));
+    libzcash::PedersenHash b(benchmark::SeededHash(1));
+    while (state.KeepRunning())
+        a = libzcash::PedersenHash::combine(a, b, 0);
+}
+
+/** Appending to a tree costs a combine for each full level it completes */
+static void SaplingMerkleTree_Append(benchmark::State& state)
+{
+    SaplingMerkleTree tree;
+    uint256 cm = benchmark::SeededHash(0);
+    while (state.KeepRunning())
+        tree.append(cm);
+}
+
+static void SproutMerkleTree_Append(benchmark::State& state)
+{
+    SproutMerkleTree tree;
+    uint256 cm = benchmark::SeededHash(0);
+    while (state.KeepRunning())
+        tree.append(cm);
+}
+
+BENCHMARK(PedersenHash_Combine);
+BENCHMARK(SaplingMerkleTree_Append);
+BENCHMARK(SproutMerkleTree_Append);
@@ -0,0 +1,151 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/perf.h"
+
+#include <fstream>
+#include <sstream>
+
+#include <stdio.h>
+
+namespace {
+
+/** The "benchmarks" entry of a results file with the given name, or a null value */
+const UniValue& FindEntry(const UniValue& json, const std::string& name)
+{
+    static const UniValue nullValue;
+    const UniValue& entries = find_value(json, "benchmarks");
+    if (!entries.isArray())
+        return nullValue;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].isObject() && find_value(entries[i], "name").isStr() &&
+            find_value(entries[i], "name").get_str() == name)
+            return entries[i];
+    }
+    return nullValue;
+}
+
+} // namespace
+
+/** Fixed work for the other benchmarks to be measured against */
+static void Calibration(benchmark::State& state)
+{
+    uint64_t x = 88172645463325252ULL;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000; i++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+        }
+    }
+    volatile uint64_t sink = x;
+    (void)sink;
+}
+
+BENCHMARK(Calibration);
+
+UniValue benchmark::ResultsToJSON(const std::vector<Result>& results)
+{
+    double reference = 0;
+    for (const Result& result : results) {
+        if (result.name == REFERENCE_BENCHMARK)
+            reference = result.median;
+    }
+
+    UniValue entries(UniValue::VARR);
+    for (const Result& result : results) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("name", result.name));
+        entry.push_back(Pair("samples", (uint64_t)result.nSamples));
+        entry.push_back(Pair("iterations", result.nIterations));
+        entry.push_back(Pair("min", result.min));
+        entry.push_back(Pair("median", result.median));
+        entry.push_back(Pair("max", result.max));
+        if (reference > 0)
+            entry.push_back(Pair("relative", result.median / reference));
+        entries.push_back(entry);
+    }
+
+    UniValue json(UniValue::VOBJ);
+    json.push_back(Pair("reference", REFERENCE_BENCHMARK));
+    json.push_back(Pair("benchmarks", entries));
+    return json;
+}
+
+bool benchmark::WriteJSON(const std::string& path, const UniValue& json)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file)
+        return false;
+    std::string str = json.write(2) + "\n";
+    bool fOk = fwrite(str.data(), 1, str.size(), file) == str.size();
+    return fclose(file) == 0 && fOk;
+}
+
+bool benchmark::ReadBaseline(const std::string& path, UniValue& baseline, std::string& strError)
+{
+    std::ifstream file(path.c_str());
+    if (!file) {
+        strError = "cannot open " + path;
+        return false;
+    }
+    std::stringstream ss;
+    ss << file.rdbuf();
+    if (!baseline.read(ss.str()) || !baseline.isObject() || !find_value(baseline, "benchmarks").isArray()) {
+        strError = path + " is not a benchmark results file";
+        return false;
+    }
+    const UniValue& reference = find_value(baseline, "reference");
+    if (!reference.isNull() && (!reference.isStr() || reference.get_str() != REFERENCE_BENCHMARK)) {
+        strError = path + " is relative to another reference benchmark";
+        return false;
+    }
+    return true;
+}
+
+std::vector<std::string> benchmark::BaselineNames(const UniValue& baseline)
+{
+    std::vector<std::string> names;
+    names.push_back(REFERENCE_BENCHMARK);
+    const UniValue& entries = find_value(baseline, "benchmarks");
+    for (size_t i = 0; i < entries.size(); i++) {
+        const UniValue& name = find_value(entries[i], "name");
+        if (name.isStr() && name.get_str() != REFERENCE_BENCHMARK)
+            names.push_back(name.get_str());
+    }
+    return names;
+}
+
+bool benchmark::CompareWithBaseline(const UniValue& baseline, const UniValue& results, double threshold)
+{
+    printf("#Comparison,baseline(relative),current(relative),change(%%),status\n");
+
+    bool fOk = true;
+    std::vector<std::string> names = BaselineNames(baseline);
+    for (const std::string& name : names) {
+        if (name == REFERENCE_BENCHMARK)
+            continue;
+        const UniValue& base = find_value(FindEntry(baseline, name), "relative");
+        const UniValue& entry = FindEntry(results, name);
+        const UniValue& current = find_value(entry, "relative");
+        if (entry.isNull()) {
+            printf("%s,,,,MISSING\n", name.c_str());
+            fOk = false;
+        } else if (!current.isNum()) {
+            // Only when the reference itself did not run
+            printf("%s,,,,UNMEASURED\n", name.c_str());
+            fOk = false;
+        } else if (!base.isNum() || base.get_real() <= 0) {
+            printf("%s,,%g,,NEW\n", name.c_str(), current.get_real());
+        } else {
+            double change = (current.get_real() / base.get_real() - 1) * 100;
+            bool fRegressed = change > threshold;
+            printf("%s,%g,%g,%+.1f,%s\n", name.c_str(), base.get_real(), current.get_real(), change,
+                   fRegressed ? "REGRESSION" : "OK");
+            if (fRegressed)
+                fOk = false;
+        }
+    }
+    return fOk;
+}
@@ -0,0 +1,43 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BENCH_PERF_H
+#define BITCOIN_BENCH_PERF_H
+
+#include "bench.h"
+
+#include <string>
+#include <vector>
+
+#include <univalue.h>
+
+/**
+ * Regression checks against a committed baseline.
+ *
+ * Results are written as JSON, and each median is also given relative to
+ * the Calibration benchmark, a fixed integer loop that no code in the tree
+ * affects. Baselines hold those relative times, so one recorded on one
+ * machine still means something on another of a similar kind; a benchmark
+ * whose relative time grew by more than the threshold is a regression.
+ *
+ * A baseline is a results file. The benchmarks it lists are the ones that
+ * are checked, and an entry without a "relative" time is run and reported
+ * but not compared, until the baseline is recorded again.
+ */
+namespace benchmark {
+
+    static const char* const REFERENCE_BENCHMARK = "Calibration";
+
+    UniValue ResultsToJSON(const std::vector<Result>& results);
+    bool WriteJSON(const std::string& path, const UniValue& json);
+    bool ReadBaseline(const std::string& path, UniValue& baseline, std::string& strError);
+
+    //! The benchmarks a baseline lists, and the reference they are relative to
+    std::vector<std::string> BaselineNames(const UniValue& baseline);
+
+    /** Print how the results compare; false if any slowed by more than threshold percent or is missing */
+    bool CompareWithBaseline(const UniValue& baseline, const UniValue& results, double threshold);
+}
+
+#endif // BITCOIN_BENCH_PERF_H
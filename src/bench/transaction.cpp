@@ -0,0 +1,117 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "consensus/upgrades.h"
+#include "primitives/transaction.h"
+#include "pubkey.h"
+#include "script/interpreter.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "version.h"
+
+#include <vector>
+
+/**
+ * A Sapling transaction with many transparent inputs and shielded spends
+ * and outputs. The proofs and signatures are seeded bytes: serializing and
+ * hashing don't look at them.
+ */
+static CTransaction MakeShieldedTransaction(size_t nInputs, size_t nShielded)
+{
+    CMutableTransaction mtx;
+    mtx.fOverwintered = true;
+    mtx.nVersion = SAPLING_TX_VERSION;
+    mtx.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+    CKeyID id;
+    uint64_t nSeed = 0;
+    for (size_t i = 0; i < nInputs; i++) {
+        mtx.vin.push_back(CTxIn(COutPoint(benchmark::SeededHash(nSeed++), 0)));
+        mtx.vin.back().scriptSig = CScript() << std::vector<unsigned char>(72) << std::vector<unsigned char>(33);
+    }
+    mtx.vout.push_back(CTxOut(10000, GetScriptForDestination(id)));
+    for (size_t i = 0; i < nShielded; i++) {
+        SpendDescription spend;
+        spend.cv = benchmark::SeededHash(nSeed++);
+        spend.anchor = benchmark::SeededHash(nSeed++);
+        spend.nullifier = benchmark::SeededHash(nSeed++);
+        spend.rk = benchmark::SeededHash(nSeed++);
+        benchmark::SeededBytes(spend.zkproof.begin(), spend.zkproof.size(), nSeed++);
+        mtx.vShieldedSpend.push_back(spend);
+
+        OutputDescription output;
+        output.cv = benchmark::SeededHash(nSeed++);
+        output.cm = benchmark::SeededHash(nSeed++);
+        output.ephemeralKey = benchmark::SeededHash(nSeed++);
+        benchmark::SeededBytes(output.encCiphertext.begin(), output.encCiphertext.size(), nSeed++);
+        benchmark::SeededBytes(output.zkproof.begin(), output.zkproof.size(), nSeed++);
+        mtx.vShieldedOutput.push_back(output);
+    }
+    return CTransaction(mtx);
+}
+
+static void ShieldedTransaction_Serialize(benchmark::State& state)
+{
+    CTransaction tx = MakeShieldedTransaction(10, 50);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    while (state.KeepRunning()) {
+        ss.clear();
+        ss << tx;
+    }
+}
+
+static void ShieldedTransaction_Deserialize(benchmark::State& state)
+{
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << MakeShieldedTransaction(10, 50);
+    while (state.KeepRunning()) {
+        CDataStream ss(ssTx);
+        CTransaction tx;
+        ss >> tx;
+    }
+}
+
+/** The signature hashes of every input, with the shared parts computed once as in validation */
+static void SignatureHash_Sapling(benchmark::State& state)
+{
+    CTransaction tx = MakeShieldedTransaction(100, 2);
+    uint32_t consensusBranchId = NetworkUpgradeInfo[Consensus::UPGRADE_SAPLING].nBranchId;
+    CKeyID id;
+    CScript scriptCode = GetScriptForDestination(id);
+    while (state.KeepRunning()) {
+        PrecomputedTransactionData txdata(tx);
+        for (unsigned int i = 0; i < tx.vin.size(); i++)
+            SignatureHash(scriptCode, tx, i, SIGHASH_ALL, 10000, consensusBranchId, &txdata);
+    }
+}
+
+/** Inserting and then removing a chain of transactions, so their ancestors are tracked */
+static void MempoolInsertion(benchmark::State& state)
+{
+    uint32_t consensusBranchId = NetworkUpgradeInfo[Consensus::UPGRADE_SAPLING].nBranchId;
+    CKeyID id;
+    std::vector<CTransaction> vtx;
+    uint256 hashPrev = benchmark::SeededHash(0);
+    for (int i = 0; i < 25; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.push_back(CTxIn(COutPoint(hashPrev, 0)));
+        mtx.vout.push_back(CTxOut(100000 - i * 1000, GetScriptForDestination(id)));
+        vtx.push_back(CTransaction(mtx));
+        hashPrev = vtx.back().GetHash();
+    }
+
+    CTxMemPool pool(CFeeRate(1000));
+    while (state.KeepRunning()) {
+        for (const CTransaction& tx : vtx)
+            pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 1000, 0, 0.0, 1, false, false, 1, consensusBranchId));
+        pool.clear();
+    }
+}
+
+BENCHMARK(ShieldedTransaction_Serialize);
+BENCHMARK(ShieldedTransaction_Deserialize);
+BENCHMARK(SignatureHash_Sapling);
+BENCHMARK(MempoolInsertion);
@@ -18,6 +18,7 @@
 #include "utilmoneystr.h"
 #include "utilstrencodings.h"
 
+#include <iostream>
 #include <stdio.h>
 
 #include <boost/algorithm/string.hpp>
@@ -63,6 +64,7 @@ static int AppInitRawTx(int argc, char* argv[])
         strUsage += HelpMessageOpt("-?", _("This help message"));
         strUsage += HelpMessageOpt("-create", _("Create new, empty TX."));
         strUsage += HelpMessageOpt("-json", _("Select JSON output"));
+        strUsage += HelpMessageOpt("-stdin", _("Read commands from standard input, one per line, after those on the command line"));
         strUsage += HelpMessageOpt("-txid", _("Output only the hex-encoded transaction id of the resultant transaction."));
         AppendParamsHelpMessages(strUsage);
 
@@ -382,7 +384,7 @@ static void MutateTxSign(CMutableTransaction& tx, const std::string& strInput)
         if (!findSighashFlags(nHashType, flagStr))
             throw std::runtime_error("unknown sighash flag/sign option");
 
-    std::vector<CTransaction> txVariants;
+    std::vector<CMutableTransaction> txVariants;
     txVariants.push_back(tx);
 
     // mergedTx will end up with all the signatures; it
@@ -433,20 +435,22 @@ static void MutateTxSign(CMutableTransaction& tx, const std::string& strInput)
             CScript scriptPubKey(pkData.begin(), pkData.end());
 
             {
-                CCoinsModifier coins = view.ModifyCoins(txid);
-                if (coins->IsAvailable(nOut) && coins->vout[nOut].scriptPubKey != scriptPubKey) {
+                const COutPoint out(txid, nOut);
+                const Coin& coin = view.AccessCoin(out);
+                if (!coin.IsSpent() && coin.out.scriptPubKey != scriptPubKey) {
                     std::string err("Previous output scriptPubKey mismatch:\n");
-                    err = err + ScriptToAsmStr(coins->vout[nOut].scriptPubKey) + "\nvs:\n"+
+                    err = err + ScriptToAsmStr(coin.out.scriptPubKey) + "\nvs:\n"+
                         ScriptToAsmStr(scriptPubKey);
                     throw std::runtime_error(err);
                 }
-                if ((unsigned int)nOut >= coins->vout.size())
-                    coins->vout.resize(nOut+1);
-                coins->vout[nOut].scriptPubKey = scriptPubKey;
-                coins->vout[nOut].nValue = 0;
+                Coin newcoin;
+                newcoin.out.scriptPubKey = scriptPubKey;
+                newcoin.out.nValue = 0;
                 if (prevOut.exists("amount")) {
-                    coins->vout[nOut].nValue = AmountFromValue(prevOut["amount"]);
+                    newcoin.out.nValue = AmountFromValue(prevOut["amount"]);
                 }
+                newcoin.nHeight = 1;
+                view.AddCoin(out, std::move(newcoin), true);
             }
 
             // if redeemScript given and private keys given,
@@ -463,32 +467,22 @@ static void MutateTxSign(CMutableTransaction& tx, const std::string& strInput)
 
     const CKeyStore& keystore = tempKeystore;
 
-    bool fHashSingle = ((nHashType & ~SIGHASH_ANYONECANPAY) == SIGHASH_SINGLE);
-
     // Grab the consensus branch ID for the given height
     auto consensusBranchId = CurrentEpochBranchId(nHeight, Params().GetConsensus());
 
+    // Outputs spent by the inputs, null where unknown
+    std::vector<CTxOut> vSpent(mergedTx.vin.size());
+    for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
+        const Coin& coin = view.AccessCoin(mergedTx.vin[i].prevout);
+        if (!coin.IsSpent())
+            vSpent[i] = coin.out;
+    }
+
     // Sign what we can:
+    std::vector<ScriptError> vScriptErrors = SignTransactionInputs(keystore, mergedTx, vSpent, txVariants,
+                                                                   nHashType, consensusBranchId, GetNumCores());
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
-        CTxIn& txin = mergedTx.vin[i];
-        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if (!coins || !coins->IsAvailable(txin.prevout.n)) {
-            fComplete = false;
-            continue;
-        }
-        const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
-        const CAmount& amount = coins->vout[txin.prevout.n].nValue;
-
-        SignatureData sigdata;
-        // Only sign SIGHASH_SINGLE if there's a corresponding output:
-        if (!fHashSingle || (i < mergedTx.vout.size()))
-            ProduceSignature(MutableTransactionSignatureCreator(&keystore, &mergedTx, i, amount, nHashType), prevPubKey, sigdata, consensusBranchId);
-
-        // ... and merge in other signatures:
-        BOOST_FOREACH(const CTransaction& txv, txVariants)
-            sigdata = CombineSignatures(prevPubKey, MutableTransactionSignatureChecker(&mergedTx, i, amount), sigdata, DataFromTransaction(txv, i), consensusBranchId);
-        UpdateTransaction(mergedTx, i, sigdata);
-         if (!VerifyScript(txin.scriptSig, prevPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, MutableTransactionSignatureChecker(&mergedTx, i, amount), consensusBranchId))
+        if (vSpent[i].IsNull() || vScriptErrors[i] != SCRIPT_ERR_OK)
             fComplete = false;
     }
 
@@ -605,6 +599,20 @@ static std::string readStdin()
     return ret;
 }
 
+static void MutateTxCommand(CMutableTransaction& tx, const std::string& arg)
+{
+    std::string key, value;
+    size_t eqpos = arg.find('=');
+    if (eqpos == std::string::npos)
+        key = arg;
+    else {
+        key = arg.substr(0, eqpos);
+        value = arg.substr(eqpos + 1);
+    }
+
+    MutateTx(tx, key, value);
+}
+
 static int CommandLineRawTx(int argc, char* argv[])
 {
     std::string strPrint;
@@ -619,6 +627,7 @@ static int CommandLineRawTx(int argc, char* argv[])
 
         CTransaction txDecodeTmp;
         int startArg;
+        bool fCommandsStdin = GetBoolArg("-stdin", false);
 
         if (!fCreateBlank) {
             // require at least one param
@@ -627,8 +636,11 @@ static int CommandLineRawTx(int argc, char* argv[])
 
             // param: hex-encoded bitcoin transaction
             std::string strHexTx(argv[1]);
-            if (strHexTx == "-")                 // "-" implies standard input
+            if (strHexTx == "-") {               // "-" implies standard input
+                if (fCommandsStdin)
+                    throw std::runtime_error("cannot read both the transaction and commands from standard input");
                 strHexTx = readStdin();
+            }
 
             if (!DecodeHexTx(txDecodeTmp, strHexTx))
                 throw std::runtime_error("invalid transaction encoding");
@@ -639,18 +651,20 @@ static int CommandLineRawTx(int argc, char* argv[])
 
         CMutableTransaction tx(txDecodeTmp);
 
-        for (int i = startArg; i < argc; i++) {
-            std::string arg = argv[i];
-            std::string key, value;
-            size_t eqpos = arg.find('=');
-            if (eqpos == std::string::npos)
-                key = arg;
-            else {
-                key = arg.substr(0, eqpos);
-                value = arg.substr(eqpos + 1);
+        for (int i = startArg; i < argc; i++)
+            MutateTxCommand(tx, argv[i]);
+
+        // Commands are applied as they are read, so a transaction with many
+        // inputs can be built without them all on the command line
+        if (fCommandsStdin) {
+            std::string line;
+            while (std::getline(std::cin, line)) {
+                boost::algorithm::trim(line);
+                if (!line.empty())
+                    MutateTxCommand(tx, line);
             }
-
-            MutateTx(tx, key, value);
+            if (std::cin.bad())
+                throw std::runtime_error("error reading stdin");
         }
 
         OutputTx(tx);
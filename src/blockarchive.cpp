@@ -0,0 +1,302 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "blockarchive.h"
+
+#include "blockfilemap.h"
+#include "crypto/common.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+const char ARCHIVE_MAGIC[8] = {'b', 'l', 'k', 'z', 's', 't', 'd', '1'};
+
+/**
+ * Follows the frame table: the size of the original file, the frame size,
+ * the number of frames, where the table starts, then the magic.
+ */
+const size_t ARCHIVE_TRAILER_SIZE = 8 + 4 + 4 + 8 + sizeof(ARCHIVE_MAGIC);
+
+//! Read [nPos, nPos + nSize) of the file at path into pdata
+bool ReadFileRange(const boost::filesystem::path& path, uint64_t nPos, size_t nSize, char* pdata)
+{
+    FILE* file = fopen(path.string().c_str(), "rb");
+    if (!file)
+        return false;
+    bool fOk = fseek(file, nPos, SEEK_SET) == 0 && fread(pdata, 1, nSize, file) == nSize;
+    fclose(file);
+    return fOk;
+}
+
+//! Raw size of frame nFrame of a file of nRawSize bytes
+size_t FrameRawSize(uint64_t nRawSize, uint32_t nFrameSize, uint32_t nFrame)
+{
+    return std::min<uint64_t>(nFrameSize, nRawSize - (uint64_t)nFrame * nFrameSize);
+}
+
+} // namespace
+
+bool IsBlockArchiveAvailable()
+{
+#ifdef USE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+boost::filesystem::path CBlockArchive::GetArchivePath(const boost::filesystem::path& rawPath)
+{
+    boost::filesystem::path path = rawPath;
+    return path.replace_extension(".zst");
+}
+
+bool CBlockArchive::Compress(const boost::filesystem::path& rawPath, uint64_t nRawSize, int nLevel)
+{
+#ifdef USE_ZSTD
+    boost::filesystem::path pathTmp = GetArchivePath(rawPath);
+    pathTmp += ".tmp";
+    FILE* filein = fopen(rawPath.string().c_str(), "rb");
+    if (!filein)
+        return error("%s: can't open %s", __func__, rawPath.string());
+    FILE* fileout = fopen(pathTmp.string().c_str(), "wb");
+    if (!fileout) {
+        fclose(filein);
+        return error("%s: can't create %s", __func__, pathTmp.string());
+    }
+    ZSTD_CCtx* pctx = ZSTD_createCCtx();
+    std::vector<char> vIn(BLOCK_ARCHIVE_FRAME_SIZE), vOut(ZSTD_compressBound(BLOCK_ARCHIVE_FRAME_SIZE));
+    std::vector<uint64_t> vOffsets(1, 0);
+    bool fOk = pctx != NULL;
+    try {
+        for (uint64_t nDone = 0; fOk && nDone < nRawSize; ) {
+            // A file takes a while at high levels, so shutdown needn't wait for it
+            boost::this_thread::interruption_point();
+            size_t nIn = std::min<uint64_t>(BLOCK_ARCHIVE_FRAME_SIZE, nRawSize - nDone);
+            size_t nOut = 0;
+            fOk = fread(vIn.data(), 1, nIn, filein) == nIn;
+            if (fOk) {
+                nOut = ZSTD_compressCCtx(pctx, vOut.data(), vOut.size(), vIn.data(), nIn, nLevel);
+                fOk = !ZSTD_isError(nOut) && fwrite(vOut.data(), 1, nOut, fileout) == nOut;
+            }
+            nDone += nIn;
+            vOffsets.push_back(vOffsets.back() + nOut);
+        }
+    } catch (...) {
+        ZSTD_freeCCtx(pctx);
+        fclose(filein);
+        fclose(fileout);
+        boost::filesystem::remove(pathTmp);
+        throw;
+    }
+    ZSTD_freeCCtx(pctx);
+    fclose(filein);
+
+    if (fOk) {
+        std::vector<unsigned char> vTable(vOffsets.size() * 8 + ARCHIVE_TRAILER_SIZE);
+        unsigned char* p = vTable.data();
+        for (size_t i = 0; i < vOffsets.size(); i++, p += 8)
+            WriteLE64(p, vOffsets[i]);
+        WriteLE64(p, nRawSize);
+        WriteLE32(p + 8, BLOCK_ARCHIVE_FRAME_SIZE);
+        WriteLE32(p + 12, vOffsets.size() - 1);
+        WriteLE64(p + 16, vOffsets.back());
+        memcpy(p + 24, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+        fOk = fwrite(vTable.data(), 1, vTable.size(), fileout) == vTable.size();
+    }
+    if (fOk)
+        FileCommit(fileout);
+    fclose(fileout);
+    if (!fOk || !RenameOver(pathTmp, GetArchivePath(rawPath))) {
+        boost::filesystem::remove(pathTmp);
+        return error("%s: compressing %s failed", __func__, rawPath.string());
+    }
+    return true;
+#else
+    return error("%s: compiled without zstd", __func__);
+#endif
+}
+
+bool CBlockArchive::Load(int nFile, const boost::filesystem::path& rawPath)
+{
+    std::shared_ptr<CArchivedFile> file(new CArchivedFile());
+    file->path = GetArchivePath(rawPath);
+
+    boost::system::error_code ec;
+    uint64_t nFileSize = boost::filesystem::file_size(file->path, ec);
+    unsigned char trailer[ARCHIVE_TRAILER_SIZE];
+    if (ec || nFileSize < ARCHIVE_TRAILER_SIZE ||
+        !ReadFileRange(file->path, nFileSize - ARCHIVE_TRAILER_SIZE, ARCHIVE_TRAILER_SIZE, (char*)trailer) ||
+        memcmp(trailer + 24, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0)
+        return error("%s: %s is not a block file archive", __func__, file->path.string());
+    file->nRawSize = ReadLE64(trailer);
+    file->nFrameSize = ReadLE32(trailer + 8);
+    uint32_t nFrames = ReadLE32(trailer + 12);
+    uint64_t nTablePos = ReadLE64(trailer + 16);
+    if (file->nFrameSize == 0 || (file->nRawSize + file->nFrameSize - 1) / file->nFrameSize != nFrames ||
+        nTablePos + (nFrames + 1) * 8ULL + ARCHIVE_TRAILER_SIZE != nFileSize)
+        return error("%s: bad trailer in %s", __func__, file->path.string());
+
+    std::vector<unsigned char> vTable((nFrames + 1) * 8);
+    if (!ReadFileRange(file->path, nTablePos, vTable.size(), (char*)vTable.data()))
+        return error("%s: can't read the frame table of %s", __func__, file->path.string());
+    file->vOffsets.resize(nFrames + 1);
+    for (uint32_t i = 0; i <= nFrames; i++) {
+        file->vOffsets[i] = ReadLE64(&vTable[i * 8]);
+        if (i > 0 && file->vOffsets[i] < file->vOffsets[i - 1])
+            return error("%s: bad frame table in %s", __func__, file->path.string());
+    }
+    if (file->vOffsets[0] != 0 || file->vOffsets[nFrames] != nTablePos)
+        return error("%s: bad frame table in %s", __func__, file->path.string());
+
+    LOCK(cs);
+    mapFiles[nFile] = file;
+    return true;
+}
+
+bool CBlockArchive::IsCompressed(int nFile) const
+{
+    LOCK(cs);
+    return mapFiles.count(nFile) > 0;
+}
+
+size_t CBlockArchive::size() const
+{
+    LOCK(cs);
+    return mapFiles.size();
+}
+
+std::shared_ptr<const std::vector<char> > CBlockArchive::GetFrame(int nFile, const CArchivedFile& file, uint32_t nFrame)
+{
+    FrameKey key(nFile, nFrame);
+    {
+        LOCK(cs);
+        std::map<FrameKey, FrameList::iterator>::iterator it = mapFrames.find(key);
+        if (it != mapFrames.end()) {
+            listFrames.splice(listFrames.begin(), listFrames, it->second);
+            return listFrames.front().second;
+        }
+    }
+
+#ifdef USE_ZSTD
+    uint64_t nPos = file.vOffsets[nFrame];
+    size_t nSize = file.vOffsets[nFrame + 1] - nPos;
+    CBlockFileRegion compressed;
+    if (!filemap.Read(MapKey(nFile), file.path, nPos, nSize, compressed) &&
+        !ReadFileRange(file.path, nPos, nSize, compressed.SetCopied(nSize))) {
+        error("%s: can't read frame %u of %s", __func__, nFrame, file.path.string());
+        return std::shared_ptr<const std::vector<char> >();
+    }
+    std::shared_ptr<std::vector<char> > frame(new std::vector<char>(FrameRawSize(file.nRawSize, file.nFrameSize, nFrame)));
+    size_t nOut = ZSTD_decompress(frame->data(), frame->size(), compressed.begin(), compressed.size());
+    if (ZSTD_isError(nOut) || nOut != frame->size()) {
+        error("%s: frame %u of %s is corrupt", __func__, nFrame, file.path.string());
+        return std::shared_ptr<const std::vector<char> >();
+    }
+
+    LOCK(cs);
+    if (mapFrames.count(key) == 0) {
+        listFrames.push_front(std::make_pair(key, frame));
+        mapFrames[key] = listFrames.begin();
+        while (listFrames.size() > MAX_CACHED_FRAMES) {
+            mapFrames.erase(listFrames.back().first);
+            listFrames.pop_back();
+        }
+    }
+    return frame;
+#else
+    error("%s: compiled without zstd, can't read %s", __func__, file.path.string());
+    return std::shared_ptr<const std::vector<char> >();
+#endif
+}
+
+bool CBlockArchive::Read(int nFile, size_t nPos, size_t nSize, CBlockFileRegion& region)
+{
+    std::shared_ptr<const CArchivedFile> file;
+    {
+        LOCK(cs);
+        std::map<int, std::shared_ptr<const CArchivedFile> >::const_iterator it = mapFiles.find(nFile);
+        if (it == mapFiles.end())
+            return false;
+        file = it->second;
+    }
+    if (nPos + nSize > file->nRawSize)
+        return false;
+
+    char* pout = region.SetCopied(nSize);
+    for (size_t nDone = 0; nDone < nSize; ) {
+        uint64_t nAt = nPos + nDone;
+        uint32_t nFrame = nAt / file->nFrameSize;
+        std::shared_ptr<const std::vector<char> > frame = GetFrame(nFile, *file, nFrame);
+        if (!frame)
+            return false;
+        size_t nOffset = nAt - (uint64_t)nFrame * file->nFrameSize;
+        size_t nCopy = std::min(nSize - nDone, frame->size() - nOffset);
+        memcpy(pout + nDone, frame->data() + nOffset, nCopy);
+        nDone += nCopy;
+    }
+    return true;
+}
+
+bool CBlockArchive::Expand(int nFile, const boost::filesystem::path& rawPath)
+{
+    std::shared_ptr<const CArchivedFile> file;
+    {
+        LOCK(cs);
+        std::map<int, std::shared_ptr<const CArchivedFile> >::const_iterator it = mapFiles.find(nFile);
+        if (it == mapFiles.end())
+            return false;
+        file = it->second;
+    }
+
+    boost::filesystem::path pathTmp = rawPath;
+    pathTmp += ".tmp";
+    FILE* fileout = fopen(pathTmp.string().c_str(), "wb");
+    if (!fileout)
+        return error("%s: can't create %s", __func__, pathTmp.string());
+    bool fOk = true;
+    for (uint32_t nFrame = 0; fOk && nFrame + 1 < file->vOffsets.size(); nFrame++) {
+        std::shared_ptr<const std::vector<char> > frame = GetFrame(nFile, *file, nFrame);
+        fOk = frame && fwrite(frame->data(), 1, frame->size(), fileout) == frame->size();
+    }
+    if (fOk)
+        FileCommit(fileout);
+    fclose(fileout);
+    if (!fOk || !RenameOver(pathTmp, rawPath)) {
+        boost::filesystem::remove(pathTmp);
+        return error("%s: expanding %s failed", __func__, file->path.string());
+    }
+    Forget(nFile);
+    boost::filesystem::remove(file->path);
+    return true;
+}
+
+void CBlockArchive::Forget(int nFile)
+{
+    LOCK(cs);
+    mapFiles.erase(nFile);
+    for (FrameList::iterator it = listFrames.begin(); it != listFrames.end(); ) {
+        if (it->first.first == nFile) {
+            mapFrames.erase(it->first);
+            it = listFrames.erase(it);
+        } else {
+            it++;
+        }
+    }
+    filemap.Invalidate(MapKey(nFile));
+}
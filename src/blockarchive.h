@@ -0,0 +1,97 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKARCHIVE_H
+#define BITCOIN_BLOCKARCHIVE_H
+
+#include "sync.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+class CBlockFileMap;
+class CBlockFileRegion;
+
+/** Default for -compressblocks, the zstd level old block files are compressed at (0 = leave them as they are) */
+static const int DEFAULT_COMPRESS_BLOCKS = 0;
+/** Blocks the last block of a block file must be buried under before the file is compressed */
+static const int BLOCK_ARCHIVE_MIN_DEPTH = 2880;
+/** Bytes of a block file compressed on their own: the most a read decompresses that it doesn't need */
+static const unsigned int BLOCK_ARCHIVE_FRAME_SIZE = 256 * 1024;
+
+/** Whether this build can compress and read compressed block files */
+bool IsBlockArchiveAvailable();
+
+/**
+ * Compressed block files. The archive of blkNNNNN.dat is blkNNNNN.zst next
+ * to it: the file cut into frames of BLOCK_ARCHIVE_FRAME_SIZE bytes, each
+ * compressed on its own with zstd, followed by a table of where each frame
+ * starts. Positions in an archived file are those of the original, so the
+ * CDiskBlockPos of a block stays valid, and reading a block decompresses
+ * only the frames it spans. Compressed bytes are read through the block
+ * file mappings, and the most recently used frames are kept decompressed.
+ */
+class CBlockArchive
+{
+private:
+    struct CArchivedFile
+    {
+        boost::filesystem::path path;
+        uint64_t nRawSize;
+        uint32_t nFrameSize;
+        //! Start of each frame, and the end of the last
+        std::vector<uint64_t> vOffsets;
+    };
+
+    typedef std::pair<int, uint32_t> FrameKey;
+    typedef std::list<std::pair<FrameKey, std::shared_ptr<const std::vector<char> > > > FrameList;
+
+    mutable CCriticalSection cs;
+    CBlockFileMap& filemap;
+    std::map<int, std::shared_ptr<const CArchivedFile> > mapFiles;
+    //! Most recently used first
+    FrameList listFrames;
+    std::map<FrameKey, FrameList::iterator> mapFrames;
+
+    //! Key of archive nFile in filemap, apart from those of the block files
+    static int MapKey(int nFile) { return -1 - nFile; }
+
+    std::shared_ptr<const std::vector<char> > GetFrame(int nFile, const CArchivedFile& file, uint32_t nFrame);
+
+public:
+    //! Frames kept decompressed
+    static const size_t MAX_CACHED_FRAMES = 16;
+
+    explicit CBlockArchive(CBlockFileMap& filemapIn) : filemap(filemapIn) {}
+
+    static boost::filesystem::path GetArchivePath(const boost::filesystem::path& rawPath);
+
+    /**
+     * Write the archive of the first nRawSize bytes of the block file at
+     * rawPath at zstd level nLevel, committed to disk. It isn't used until
+     * it is loaded.
+     */
+    static bool Compress(const boost::filesystem::path& rawPath, uint64_t nRawSize, int nLevel);
+
+    //! Start reading block file nFile from the archive of rawPath
+    bool Load(int nFile, const boost::filesystem::path& rawPath);
+    bool IsCompressed(int nFile) const;
+    size_t size() const;
+
+    //! Decompress [nPos, nPos + nSize) of block file nFile into region
+    bool Read(int nFile, size_t nPos, size_t nSize, CBlockFileRegion& region);
+
+    //! Write block file nFile back to rawPath, then remove its archive
+    bool Expand(int nFile, const boost::filesystem::path& rawPath);
+
+    //! Stop reading block file nFile from its archive, before the archive is deleted
+    void Forget(int nFile);
+};
+
+#endif // BITCOIN_BLOCKARCHIVE_H
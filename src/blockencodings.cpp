@@ -0,0 +1,173 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+
+#include "consensus/consensus.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "util.h"
+#include "version.h"
+
+#include <boost/unordered_map.hpp>
+
+/** No transaction serializes to fewer bytes than this, the size of one with
+ *  a single empty input and no outputs */
+static const size_t MIN_SERIALIZABLE_TRANSACTION_SIZE = 60;
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block) :
+        nonce(GetRand(std::numeric_limits<uint64_t>::max())),
+        shorttxids(block.vtx.size() - 1), prefilledtxn(1), header(block.GetBlockHeader())
+{
+    FillShortTxIDSelector();
+    // The coinbase is never in a mempool
+    prefilledtxn[0].index = 0;
+    prefilledtxn[0].tx = block.vtx[0];
+    for (size_t i = 1; i < block.vtx.size(); i++)
+        shorttxids[i - 1] = GetShortID(block.vtx[i]->GetHash());
+}
+
+void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector() const
+{
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << header << nonce;
+    CSHA256 hasher;
+    hasher.Write((unsigned char*)&(*stream.begin()), stream.end() - stream.begin());
+    uint256 shorttxidhash;
+    hasher.Finalize(shorttxidhash.begin());
+    shorttxidk0 = ReadLE64(shorttxidhash.begin());
+    shorttxidk1 = ReadLE64(shorttxidhash.begin() + 8);
+}
+
+uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const
+{
+    static_assert(SHORTTXIDS_LENGTH == 6, "shorttxids calculation assumes 6-byte shorttxids");
+    return CSipHasher(shorttxidk0, shorttxidk1).Write(txhash.begin(), 32).Finalize() & 0xffffffffffffL;
+}
+
+ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock)
+{
+    if (cmpctblock.header.IsNull() || (cmpctblock.shorttxids.empty() && cmpctblock.prefilledtxn.empty()))
+        return READ_STATUS_INVALID;
+    if (cmpctblock.shorttxids.size() + cmpctblock.prefilledtxn.size() > MAX_BLOCK_SIZE / MIN_SERIALIZABLE_TRANSACTION_SIZE)
+        return READ_STATUS_INVALID;
+
+    assert(header.IsNull() && txn_available.empty());
+    header = cmpctblock.header;
+    txn_available.resize(cmpctblock.BlockTxCount());
+    vAvailable.assign(cmpctblock.BlockTxCount(), false);
+
+    int32_t lastprefilledindex = -1;
+    for (size_t i = 0; i < cmpctblock.prefilledtxn.size(); i++) {
+        if (cmpctblock.prefilledtxn[i].tx->IsNull())
+            return READ_STATUS_INVALID;
+
+        // The index is a difference to the last one, so it can't overflow
+        // int32_t unless the encoding itself is nonsense
+        lastprefilledindex += cmpctblock.prefilledtxn[i].index + 1;
+        if (lastprefilledindex > std::numeric_limits<uint16_t>::max())
+            return READ_STATUS_INVALID;
+        if ((uint32_t)lastprefilledindex > cmpctblock.shorttxids.size() + i) {
+            // The prefilled transactions would leave gaps that the short
+            // ids can't fill
+            return READ_STATUS_INVALID;
+        }
+        txn_available[lastprefilledindex] = cmpctblock.prefilledtxn[i].tx;
+        vAvailable[lastprefilledindex] = true;
+    }
+    prefilled_count = cmpctblock.prefilledtxn.size();
+
+    // Place each short id at its index in the block, skipping the prefilled
+    // transactions
+    boost::unordered_map<uint64_t, uint16_t> shorttxids(cmpctblock.shorttxids.size());
+    uint16_t index_offset = 0;
+    for (size_t i = 0; i < cmpctblock.shorttxids.size(); i++) {
+        while (vAvailable[i + index_offset])
+            index_offset++;
+        shorttxids[cmpctblock.shorttxids[i]] = i + index_offset;
+    }
+    if (shorttxids.size() != cmpctblock.shorttxids.size()) {
+        // Two transactions with the same short id; the sender could not have
+        // told them apart either
+        return READ_STATUS_FAILED;
+    }
+
+    std::vector<bool> have_txn(txn_available.size());
+    {
+        LOCK(pool->cs);
+        for (CTxMemPool::indexed_transaction_set::const_iterator it = pool->mapTx.begin(); it != pool->mapTx.end(); ++it) {
+            boost::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(cmpctblock.GetShortID(it->GetTx().GetHash()));
+            if (idit == shorttxids.end())
+                continue;
+            if (!have_txn[idit->second]) {
+                txn_available[idit->second] = it->GetSharedTx();
+                vAvailable[idit->second] = true;
+                have_txn[idit->second] = true;
+                mempool_count++;
+            } else {
+                // Two mempool transactions match the same short id. Leave it
+                // to be sent in blocktxn rather than guess.
+                if (vAvailable[idit->second]) {
+                    txn_available[idit->second].reset();
+                    vAvailable[idit->second] = false;
+                    mempool_count--;
+                }
+            }
+            // Every short id has been matched, so stop scanning
+            if (mempool_count == shorttxids.size())
+                break;
+        }
+    }
+
+    LogPrint("cmpctblock", "Initialized PartiallyDownloadedBlock for block %s using a cmpctblock of size %lu\n",
+             cmpctblock.header.GetHash().ToString(), GetSerializeSize(cmpctblock, SER_NETWORK, PROTOCOL_VERSION));
+
+    return READ_STATUS_OK;
+}
+
+bool PartiallyDownloadedBlock::IsTxAvailable(size_t index) const
+{
+    assert(!header.IsNull());
+    assert(index < txn_available.size());
+    return vAvailable[index];
+}
+
+ReadStatus PartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<CTransactionRef>& vtx_missing) const
+{
+    assert(!header.IsNull());
+    uint256 hash = header.GetHash();
+    block = header;
+    block.vtx.resize(txn_available.size());
+
+    size_t tx_missing_offset = 0;
+    for (size_t i = 0; i < txn_available.size(); i++) {
+        if (!vAvailable[i]) {
+            if (vtx_missing.size() <= tx_missing_offset)
+                return READ_STATUS_INVALID;
+            block.vtx[i] = vtx_missing[tx_missing_offset++];
+        } else {
+            block.vtx[i] = txn_available[i];
+        }
+    }
+    if (vtx_missing.size() != tx_missing_offset)
+        return READ_STATUS_INVALID;
+
+    // A short id collision gives a block that does not match its header.
+    // That is not the sender's fault, so fetch the whole block instead.
+    if (block.BuildMerkleTree() != block.hashMerkleRoot)
+        return READ_STATUS_FAILED;
+
+    LogPrint("cmpctblock", "Successfully reconstructed block %s with %lu txn prefilled, %lu txn from mempool and %lu txn requested\n",
+             hash.ToString(), prefilled_count, mempool_count, vtx_missing.size());
+    if (vtx_missing.size() < 5) {
+        BOOST_FOREACH(const CTransactionRef& tx, vtx_missing)
+            LogPrint("cmpctblock", "Reconstructed block %s required tx %s\n", hash.ToString(), tx->GetHash().ToString());
+    }
+
+    return READ_STATUS_OK;
+}
@@ -0,0 +1,220 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKENCODINGS_H
+#define BITCOIN_BLOCKENCODINGS_H
+
+#include "primitives/block.h"
+#include "serialize.h"
+
+#include <algorithm>
+#include <ios>
+#include <limits>
+#include <stdint.h>
+#include <vector>
+
+class CTxMemPool;
+
+/** The highest compact block encoding version we know */
+static const uint64_t COMPACT_BLOCKS_ENCODING_VERSION = 1;
+/** Blocks deeper than this below the tip are sent whole when asked for as compact blocks */
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+/** Transactions of blocks deeper than this below the tip are not sent in blocktxn */
+static const int MAX_BLOCKTXN_DEPTH = 10;
+/** The number of peers asked to announce new blocks with a cmpctblock straight away */
+static const unsigned int MAX_HIGH_BANDWIDTH_PEERS = 3;
+
+/**
+ * Transactions that a peer is missing from a compact block, by their index
+ * in the block. Indexes are sent as the differences between consecutive
+ * indexes, minus one.
+ */
+class BlockTransactionsRequest
+{
+public:
+    uint256 blockhash;
+    std::vector<uint16_t> indexes;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(blockhash);
+        uint64_t nIndexes = indexes.size();
+        READWRITE(COMPACTSIZE(nIndexes));
+        if (ser_action.ForRead()) {
+            size_t i = 0;
+            while (indexes.size() < nIndexes) {
+                indexes.resize(std::min((uint64_t)(1000 + indexes.size()), nIndexes));
+                for (; i < indexes.size(); i++) {
+                    uint64_t nIndex = 0;
+                    READWRITE(COMPACTSIZE(nIndex));
+                    if (nIndex > std::numeric_limits<uint16_t>::max())
+                        throw std::ios_base::failure("index overflowed 16 bits");
+                    indexes[i] = nIndex;
+                }
+            }
+
+            int32_t nOffset = 0;
+            for (size_t j = 0; j < indexes.size(); j++) {
+                if (int32_t(indexes[j]) + nOffset > std::numeric_limits<uint16_t>::max())
+                    throw std::ios_base::failure("indexes overflowed 16 bits");
+                indexes[j] = indexes[j] + nOffset;
+                nOffset = int32_t(indexes[j]) + 1;
+            }
+        } else {
+            for (size_t i = 0; i < indexes.size(); i++) {
+                uint64_t nIndex = indexes[i] - (i == 0 ? 0 : (indexes[i - 1] + 1));
+                READWRITE(COMPACTSIZE(nIndex));
+            }
+        }
+    }
+};
+
+/** The transactions asked for with a BlockTransactionsRequest */
+class BlockTransactions
+{
+public:
+    uint256 blockhash;
+    std::vector<CTransactionRef> txn;
+
+    BlockTransactions() {}
+    BlockTransactions(const BlockTransactionsRequest& req) :
+        blockhash(req.blockhash), txn(req.indexes.size()) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(blockhash);
+        READWRITE(txn);
+    }
+};
+
+/**
+ * A transaction sent whole in a compact block. The index is the difference
+ * to the previous prefilled transaction's index, minus one.
+ */
+struct PrefilledTransaction
+{
+    uint16_t index;
+    CTransactionRef tx;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        uint64_t nIndex = index;
+        READWRITE(COMPACTSIZE(nIndex));
+        if (nIndex > std::numeric_limits<uint16_t>::max())
+            throw std::ios_base::failure("index overflowed 16 bits");
+        index = nIndex;
+        READWRITE(tx);
+    }
+};
+
+typedef enum ReadStatus_t
+{
+    READ_STATUS_OK,
+    READ_STATUS_INVALID, //!< Invalid object, the peer is sending bogus data
+    READ_STATUS_FAILED, //!< Failed to reconstruct, ask for the whole block instead
+} ReadStatus;
+
+/**
+ * A block header with 6-byte short ids for its transactions, in the style
+ * of BIP 152. The short ids are SipHash-2-4 of the txid, keyed from the
+ * header and a random nonce so that collisions can't be planned. Only the
+ * coinbase is sent whole; shielded transactions, by far the largest part of
+ * most blocks, are expected to be in the receiver's mempool already.
+ */
+class CBlockHeaderAndShortTxIDs
+{
+private:
+    mutable uint64_t shorttxidk0, shorttxidk1;
+    uint64_t nonce;
+
+    void FillShortTxIDSelector() const;
+
+    friend class PartiallyDownloadedBlock;
+
+    static const int SHORTTXIDS_LENGTH = 6;
+
+protected:
+    std::vector<uint64_t> shorttxids;
+    std::vector<PrefilledTransaction> prefilledtxn;
+
+public:
+    CBlockHeader header;
+
+    // Dummy for deserialization
+    CBlockHeaderAndShortTxIDs() {}
+
+    CBlockHeaderAndShortTxIDs(const CBlock& block);
+
+    uint64_t GetShortID(const uint256& txhash) const;
+
+    size_t BlockTxCount() const { return shorttxids.size() + prefilledtxn.size(); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(header);
+        READWRITE(nonce);
+
+        uint64_t nShortTxIDs = shorttxids.size();
+        READWRITE(COMPACTSIZE(nShortTxIDs));
+        if (ser_action.ForRead()) {
+            size_t i = 0;
+            while (shorttxids.size() < nShortTxIDs) {
+                shorttxids.resize(std::min((uint64_t)(1000 + shorttxids.size()), nShortTxIDs));
+                for (; i < shorttxids.size(); i++) {
+                    uint32_t lsb = 0;
+                    uint16_t msb = 0;
+                    READWRITE(lsb);
+                    READWRITE(msb);
+                    shorttxids[i] = (uint64_t(msb) << 32) | uint64_t(lsb);
+                }
+            }
+        } else {
+            for (size_t i = 0; i < shorttxids.size(); i++) {
+                uint32_t lsb = shorttxids[i] & 0xffffffff;
+                uint16_t msb = (shorttxids[i] >> 32) & 0xffff;
+                READWRITE(lsb);
+                READWRITE(msb);
+            }
+        }
+
+        READWRITE(prefilledtxn);
+
+        if (ser_action.ForRead())
+            FillShortTxIDSelector();
+    }
+};
+
+/**
+ * A block being put together from a compact block, the mempool and the
+ * transactions that were still missing.
+ */
+class PartiallyDownloadedBlock
+{
+protected:
+    std::vector<CTransactionRef> txn_available;
+    std::vector<bool> vAvailable;
+    size_t prefilled_count, mempool_count;
+    CTxMemPool* pool;
+
+public:
+    CBlockHeader header;
+
+    PartiallyDownloadedBlock(CTxMemPool* poolIn) : prefilled_count(0), mempool_count(0), pool(poolIn) {}
+
+    ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock);
+    bool IsTxAvailable(size_t index) const;
+    size_t BlockTxCount() const { return txn_available.size(); }
+    /** Fill block with the transactions we have and vtx_missing, in order */
+    ReadStatus FillBlock(CBlock& block, const std::vector<CTransactionRef>& vtx_missing) const;
+};
+
+#endif // BITCOIN_BLOCKENCODINGS_H
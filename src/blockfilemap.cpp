@@ -0,0 +1,133 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+
+#include "util.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool CBlockFileMapping::Open(const boost::filesystem::path& path)
+{
+    assert(pdata == NULL);
+#ifdef WIN32
+    // Block files are read through stdio on Windows.
+    return false;
+#else
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+    if (p == MAP_FAILED) {
+        LogPrint("mmap", "Unable to map %s\n", path.string());
+        return false;
+    }
+    pdata = (const char*)p;
+    nSize = st.st_size;
+    return true;
+#endif
+}
+
+CBlockFileMapping::~CBlockFileMapping()
+{
+#ifndef WIN32
+    if (pdata)
+        munmap((void*)pdata, nSize);
+#endif
+}
+
+void CBlockFileRegion::SetMapped(const std::shared_ptr<const CBlockFileMapping>& mappingIn, size_t nPos, size_t nSizeIn)
+{
+    assert(nPos + nSizeIn <= mappingIn->size());
+    mapping = mappingIn;
+    std::vector<char>().swap(vData);
+    pbegin = mapping->data() + nPos;
+    nSize = nSizeIn;
+}
+
+char* CBlockFileRegion::SetCopied(size_t nSizeIn)
+{
+    mapping.reset();
+    vData.resize(nSizeIn);
+    pbegin = vData.data();
+    nSize = nSizeIn;
+    return vData.data();
+}
+
+void CBlockFileMap::SetLimit(size_t n)
+{
+    LOCK(cs);
+    nMaxMappings = n;
+    while (listMappings.size() > nMaxMappings) {
+        mapMappings.erase(listMappings.back().first);
+        listMappings.pop_back();
+    }
+}
+
+bool CBlockFileMap::IsEnabled() const
+{
+    LOCK(cs);
+    return nMaxMappings > 0;
+}
+
+bool CBlockFileMap::Read(int nFile, const boost::filesystem::path& path, size_t nPos, size_t nSize, CBlockFileRegion& region)
+{
+    LOCK(cs);
+    if (nMaxMappings == 0)
+        return false;
+
+    std::map<int, MappingList::iterator>::iterator it = mapMappings.find(nFile);
+    if (it != mapMappings.end()) {
+        // Move to the front as the most recently used.
+        listMappings.splice(listMappings.begin(), listMappings, it->second);
+        if (nPos + nSize <= listMappings.front().second->size()) {
+            region.SetMapped(listMappings.front().second, nPos, nSize);
+            return true;
+        }
+        // The file has been appended to since it was mapped.
+        listMappings.pop_front();
+        mapMappings.erase(it);
+    }
+
+    std::shared_ptr<CBlockFileMapping> mapping(new CBlockFileMapping());
+    if (!mapping->Open(path) || nPos + nSize > mapping->size())
+        return false;
+    listMappings.push_front(std::make_pair(nFile, mapping));
+    mapMappings[nFile] = listMappings.begin();
+    while (listMappings.size() > nMaxMappings) {
+        mapMappings.erase(listMappings.back().first);
+        listMappings.pop_back();
+    }
+    region.SetMapped(mapping, nPos, nSize);
+    return true;
+}
+
+void CBlockFileMap::Invalidate(int nFile)
+{
+    LOCK(cs);
+    std::map<int, MappingList::iterator>::iterator it = mapMappings.find(nFile);
+    if (it != mapMappings.end()) {
+        listMappings.erase(it->second);
+        mapMappings.erase(it);
+    }
+}
+
+void CBlockFileMap::Clear()
+{
+    LOCK(cs);
+    listMappings.clear();
+    mapMappings.clear();
+}
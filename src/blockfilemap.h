@@ -0,0 +1,100 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEMAP_H
+#define BITCOIN_BLOCKFILEMAP_H
+
+#include "sync.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <stddef.h>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+/** A read-only memory mapping of a whole block file */
+class CBlockFileMapping
+{
+private:
+    const char* pdata;
+    size_t nSize;
+
+    CBlockFileMapping(const CBlockFileMapping&);
+    void operator=(const CBlockFileMapping&);
+
+public:
+    CBlockFileMapping() : pdata(NULL), nSize(0) {}
+    ~CBlockFileMapping();
+
+    //! Map the file at path as it is now. Returns false if that is not possible.
+    bool Open(const boost::filesystem::path& path);
+
+    const char* data() const { return pdata; }
+    size_t size() const { return nSize; }
+};
+
+/**
+ * Some bytes of a block file. They either point into a mapping, which is kept
+ * alive for as long as the region is, or are a copy read from the file.
+ */
+class CBlockFileRegion
+{
+private:
+    std::shared_ptr<const CBlockFileMapping> mapping;
+    std::vector<char> vData;
+    const char* pbegin;
+    size_t nSize;
+
+public:
+    CBlockFileRegion() : pbegin(NULL), nSize(0) {}
+
+    void SetMapped(const std::shared_ptr<const CBlockFileMapping>& mappingIn, size_t nPos, size_t nSizeIn);
+    //! Switch to an owned buffer of nSizeIn bytes, to be filled by the caller
+    char* SetCopied(size_t nSizeIn);
+
+    const char* begin() const { return pbegin; }
+    const char* end() const { return pbegin + nSize; }
+    size_t size() const { return nSize; }
+    bool IsMapped() const { return mapping != NULL; }
+};
+
+/**
+ * Pool of block file mappings, holding at most a configured number of files.
+ * The least recently used file is unmapped when another one is needed.
+ * A file must be invalidated before it is truncated or deleted.
+ */
+class CBlockFileMap
+{
+private:
+    typedef std::list<std::pair<int, std::shared_ptr<const CBlockFileMapping> > > MappingList;
+
+    mutable CCriticalSection cs;
+    size_t nMaxMappings;
+    //! Most recently used first
+    MappingList listMappings;
+    std::map<int, MappingList::iterator> mapMappings;
+
+public:
+    CBlockFileMap() : nMaxMappings(0) {}
+
+    //! Keep at most n files mapped; 0 disables mapping
+    void SetLimit(size_t n);
+    bool IsEnabled() const;
+
+    /**
+     * Point region at [nPos, nPos + nSize) of block file nFile, which lives
+     * at path. The file is mapped again if it has grown past the end of its
+     * mapping. Returns false if mapping is disabled or failed, or if the
+     * range lies beyond the end of the file.
+     */
+    bool Read(int nFile, const boost::filesystem::path& path, size_t nPos, size_t nSize, CBlockFileRegion& region);
+
+    //! Drop the mapping of file nFile, if any
+    void Invalidate(int nFile);
+    void Clear();
+};
+
+#endif // BITCOIN_BLOCKFILEMAP_H
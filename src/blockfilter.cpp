@@ -0,0 +1,159 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "hash.h"
+
+#include <algorithm>
+
+namespace {
+
+/** Map x uniformly into [0, n), as (x * n) >> 64. */
+uint64_t FastRange64(uint64_t x, uint64_t n)
+{
+#ifdef __SIZEOF_INT128__
+    return (static_cast<unsigned __int128>(x) * static_cast<unsigned __int128>(n)) >> 64;
+#else
+    uint64_t x_hi = x >> 32, x_lo = x & 0xFFFFFFFF;
+    uint64_t n_hi = n >> 32, n_lo = n & 0xFFFFFFFF;
+    uint64_t ac = x_hi * n_hi;
+    uint64_t ad = x_hi * n_lo;
+    uint64_t bc = x_lo * n_hi;
+    uint64_t bd = x_lo * n_lo;
+    uint64_t mid34 = (bd >> 32) + (bc & 0xFFFFFFFF) + (ad & 0xFFFFFFFF);
+    return ac + (bc >> 32) + (ad >> 32) + (mid34 >> 32);
+#endif
+}
+
+class BitWriter
+{
+private:
+    std::vector<unsigned char>& vch;
+    int nBits;
+
+public:
+    BitWriter(std::vector<unsigned char>& vchIn) : vch(vchIn), nBits(0) {}
+
+    void Write(uint64_t data, int nCount)
+    {
+        for (int i = nCount - 1; i >= 0; i--) {
+            if (nBits % 8 == 0) {
+                vch.push_back(0);
+            }
+            if ((data >> i) & 1) {
+                vch.back() |= 0x80 >> (nBits % 8);
+            }
+            nBits++;
+        }
+    }
+};
+
+class BitReader
+{
+private:
+    const std::vector<unsigned char>& vch;
+    size_t nPos;
+
+public:
+    BitReader(const std::vector<unsigned char>& vchIn) : vch(vchIn), nPos(0) {}
+
+    bool Read(uint64_t& data, int nCount)
+    {
+        data = 0;
+        for (int i = 0; i < nCount; i++) {
+            if (nPos / 8 >= vch.size()) {
+                return false;
+            }
+            data = (data << 1) | ((vch[nPos / 8] >> (7 - nPos % 8)) & 1);
+            nPos++;
+        }
+        return true;
+    }
+};
+
+void GolombRiceEncode(BitWriter& writer, uint8_t P, uint64_t x)
+{
+    uint64_t q = x >> P;
+    while (q > 0) {
+        int nBits = q <= 64 ? static_cast<int>(q) : 64;
+        writer.Write(~0ULL, nBits);
+        q -= nBits;
+    }
+    writer.Write(0, 1);
+    writer.Write(x, P);
+}
+
+bool GolombRiceDecode(BitReader& reader, uint8_t P, uint64_t& x)
+{
+    uint64_t q = 0;
+    uint64_t bit;
+    while (true) {
+        if (!reader.Read(bit, 1)) {
+            return false;
+        }
+        if (!bit) {
+            break;
+        }
+        q++;
+    }
+    uint64_t r;
+    if (!reader.Read(r, P)) {
+        return false;
+    }
+    x = (q << P) + r;
+    return true;
+}
+
+} // namespace
+
+uint64_t GCSFilter::HashElement(uint64_t k0, uint64_t k1, const Element& element)
+{
+    return CSipHasher(k0, k1).Write(element.data(), element.size()).Finalize();
+}
+
+GCSFilter::GCSFilter(uint64_t k0, uint64_t k1, const ElementSet& elements) :
+    nElements(elements.size())
+{
+    uint64_t F = static_cast<uint64_t>(nElements) * M;
+    std::vector<uint64_t> values;
+    values.reserve(elements.size());
+    for (const Element& element : elements) {
+        values.push_back(FastRange64(HashElement(k0, k1, element), F));
+    }
+    std::sort(values.begin(), values.end());
+
+    BitWriter writer(vEncoded);
+    uint64_t last = 0;
+    for (uint64_t value : values) {
+        GolombRiceEncode(writer, P, value - last);
+        last = value;
+    }
+}
+
+bool GCSFilter::MatchAnyHashed(const std::vector<uint64_t>& vSortedHashes) const
+{
+    if (nElements == 0 || vSortedHashes.empty()) {
+        return false;
+    }
+    uint64_t F = static_cast<uint64_t>(nElements) * M;
+    auto mappedLess = [F](uint64_t hash, uint64_t value) { return FastRange64(hash, F) < value; };
+
+    BitReader reader(vEncoded);
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < nElements; i++) {
+        uint64_t delta;
+        if (!GolombRiceDecode(reader, P, delta)) {
+            // A truncated filter cannot rule anything out
+            return true;
+        }
+        value += delta;
+        // FastRange64 is monotonic, so the query hashes stay sorted once mapped
+        auto it = std::lower_bound(vSortedHashes.begin(), vSortedHashes.end(), value, mappedLess);
+        if (it != vSortedHashes.end() && FastRange64(*it, F) == value) {
+            return true;
+        }
+    }
+    return false;
+}
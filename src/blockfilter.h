@@ -0,0 +1,63 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include "serialize.h"
+
+#include <set>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * A Golomb-coded set, as used by BIP 158 block filters: a compact,
+ * probabilistic set of byte strings that can be tested for membership with
+ * a false positive rate of 1/M and never has a false negative.
+ *
+ * Each element is hashed with SipHash-2-4 under (k0, k1), mapped into
+ * [0, N * M) and the sorted values are stored as Golomb-Rice coded deltas
+ * with parameter P.
+ */
+class GCSFilter
+{
+public:
+    typedef std::vector<unsigned char> Element;
+    typedef std::set<Element> ElementSet;
+
+    static const uint8_t P = 19;
+    static const uint32_t M = 784931;
+
+private:
+    uint32_t nElements;
+    std::vector<unsigned char> vEncoded;
+
+public:
+    GCSFilter() : nElements(0) {}
+    GCSFilter(uint64_t k0, uint64_t k1, const ElementSet& elements);
+
+    uint32_t GetN() const { return nElements; }
+    const std::vector<unsigned char>& GetEncoded() const { return vEncoded; }
+
+    /** Hash an element under (k0, k1), before it is mapped into a filter's range. */
+    static uint64_t HashElement(uint64_t k0, uint64_t k1, const Element& element);
+
+    /**
+     * Whether any of the given element hashes (as returned by HashElement
+     * with this filter's key, sorted ascending) may be in the set. This costs
+     * one pass over the filter plus a binary search per filter entry, so it
+     * stays cheap when the query set is much larger than the filter.
+     */
+    bool MatchAnyHashed(const std::vector<uint64_t>& vSortedHashes) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nElements);
+        READWRITE(vEncoded);
+    }
+};
+
+#endif // BITCOIN_BLOCKFILTER_H
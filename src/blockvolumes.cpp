@@ -0,0 +1,103 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockvolumes.h"
+
+#include "tinyformat.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+
+static boost::filesystem::path FileName(int nFile, const char* prefix)
+{
+    return strprintf("%s%05u.dat", prefix, nFile);
+}
+
+static uint64_t AvailableSpace(const boost::filesystem::path& path)
+{
+    boost::system::error_code ec;
+    boost::filesystem::space_info space = boost::filesystem::space(path, ec);
+    return ec ? 0 : space.available;
+}
+
+CBlockVolumes::CBlockVolumes()
+{
+    vVolumes.push_back(boost::filesystem::path());
+}
+
+void CBlockVolumes::SetVolumes(const std::vector<boost::filesystem::path>& vVolumesIn)
+{
+    assert(!vVolumesIn.empty());
+    LOCK(cs);
+    vVolumes = vVolumesIn;
+    mapFileVolume.clear();
+}
+
+std::vector<boost::filesystem::path> CBlockVolumes::GetVolumes() const
+{
+    LOCK(cs);
+    return vVolumes;
+}
+
+size_t CBlockVolumes::Locate(int nFile) const
+{
+    AssertLockHeld(cs);
+    std::map<int, size_t>::const_iterator it = mapFileVolume.find(nFile);
+    if (it != mapFileVolume.end())
+        return it->second;
+    // Only found files are remembered, as a missing one may be created later
+    boost::filesystem::path name = FileName(nFile, "blk");
+    boost::filesystem::path archive = strprintf("blk%05u.zst", nFile);
+    for (size_t i = 0; i < vVolumes.size(); i++) {
+        if (boost::filesystem::exists(vVolumes[i] / name) || boost::filesystem::exists(vVolumes[i] / archive)) {
+            mapFileVolume[nFile] = i;
+            return i;
+        }
+    }
+    return vVolumes.size();
+}
+
+boost::filesystem::path CBlockVolumes::GetFilePath(int nFile, const char* prefix) const
+{
+    LOCK(cs);
+    size_t nVolume = Locate(nFile);
+    if (nVolume == vVolumes.size())
+        nVolume = 0;
+    return vVolumes[nVolume] / FileName(nFile, prefix);
+}
+
+void CBlockVolumes::PlaceNewFile(int nFile)
+{
+    LOCK(cs);
+    if (Locate(nFile) != vVolumes.size())
+        return;
+    size_t nVolume = nFile % vVolumes.size();
+    if (vVolumes.size() > 1 && AvailableSpace(vVolumes[nVolume]) < MIN_FREE_SPACE) {
+        uint64_t nBest = 0;
+        for (size_t i = 0; i < vVolumes.size(); i++) {
+            uint64_t nAvailable = AvailableSpace(vVolumes[i]);
+            if (nAvailable > nBest) {
+                nBest = nAvailable;
+                nVolume = i;
+            }
+        }
+    }
+    mapFileVolume[nFile] = nVolume;
+    LogPrint("blockvolumes", "Placing blk%05u.dat in %s\n", nFile, vVolumes[nVolume].string());
+}
+
+uint64_t CBlockVolumes::GetAvailableSpace(int nFile) const
+{
+    boost::filesystem::path path = GetFilePath(nFile, "blk").parent_path();
+    // The volume may not have been created yet, until its first file is written
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(path, ec);
+    return AvailableSpace(path);
+}
+
+void CBlockVolumes::Forget(int nFile)
+{
+    LOCK(cs);
+    mapFileVolume.erase(nFile);
+}
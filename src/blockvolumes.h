@@ -0,0 +1,62 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKVOLUMES_H
+#define BITCOIN_BLOCKVOLUMES_H
+
+#include "sync.h"
+
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+/**
+ * The directories block and undo files are kept in. The undo file and the
+ * compressed archive of a block file are kept next to it. New block files
+ * are striped across the volumes, so that reads of recent blocks spread over
+ * several disks, and a file found on a volume stays there: volumes may be
+ * added or reordered between runs.
+ */
+class CBlockVolumes
+{
+private:
+    mutable CCriticalSection cs;
+    //! The first is where files are looked for first and the index lives
+    std::vector<boost::filesystem::path> vVolumes;
+    //! Volume of each block file located so far
+    mutable std::map<int, size_t> mapFileVolume;
+
+    //! Volume holding nFile, or vVolumes.size() if none does (yet)
+    size_t Locate(int nFile) const;
+
+public:
+    //! Free space a volume must keep for it to be given a new file
+    static const uint64_t MIN_FREE_SPACE = 256 * 1024 * 1024;
+
+    CBlockVolumes();
+
+    //! Set the volumes; the first must be given. Forgets where files were found.
+    void SetVolumes(const std::vector<boost::filesystem::path>& vVolumesIn);
+    std::vector<boost::filesystem::path> GetVolumes() const;
+
+    //! Path of file nFile with prefix "blk" or "rev", where it is or will be created
+    boost::filesystem::path GetFilePath(int nFile, const char* prefix) const;
+
+    /**
+     * Pick the volume a new block file nFile is created on: the next in
+     * turn, unless it is short of space, in which case the roomiest.
+     * A file that already exists stays where it is.
+     */
+    void PlaceNewFile(int nFile);
+
+    //! Bytes available on the volume of nFile
+    uint64_t GetAvailableSpace(int nFile) const;
+
+    //! Forget the volume of nFile, once its files are deleted
+    void Forget(int nFile);
+};
+
+#endif // BITCOIN_BLOCKVOLUMES_H
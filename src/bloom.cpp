@@ -4,13 +4,17 @@
 
 #include "bloom.h"
 
+#include "crypto/common.h"
 #include "primitives/transaction.h"
 #include "hash.h"
+#include "memusage.h"
 #include "script/script.h"
 #include "script/standard.h"
 #include "random.h"
 #include "streams.h"
 
+#include <algorithm>
+#include <limits>
 #include <math.h>
 #include <stdlib.h>
 
@@ -52,10 +56,10 @@ CBloomFilter::CBloomFilter(unsigned int nElements, double nFPRate, unsigned int
 {
 }
 
-inline unsigned int CBloomFilter::Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const
+inline unsigned int CBloomFilter::Hash(unsigned int nHashNum, const unsigned char* pDataToHash, size_t nDataLen) const
 {
     // 0xFBA4C795 chosen as it guarantees a reasonable bit difference between nHashNum values.
-    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, vDataToHash) % (vData.size() * 8);
+    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, pDataToHash, nDataLen) % (vData.size() * 8);
 }
 
 void CBloomFilter::insert(const vector<unsigned char>& vKey)
@@ -64,7 +68,7 @@ void CBloomFilter::insert(const vector<unsigned char>& vKey)
         return;
     for (unsigned int i = 0; i < nHashFuncs; i++)
     {
-        unsigned int nIndex = Hash(i, vKey);
+        unsigned int nIndex = Hash(i, vKey.data(), vKey.size());
         // Sets bit nIndex of vData
         vData[nIndex >> 3] |= (1 << (7 & nIndex));
     }
@@ -86,6 +90,11 @@ void CBloomFilter::insert(const uint256& hash)
 }
 
 bool CBloomFilter::contains(const vector<unsigned char>& vKey) const
+{
+    return contains(vKey.data(), vKey.size());
+}
+
+bool CBloomFilter::contains(const unsigned char* pKey, size_t nKeyLen) const
 {
     if (isFull)
         return true;
@@ -93,7 +102,7 @@ bool CBloomFilter::contains(const vector<unsigned char>& vKey) const
         return false;
     for (unsigned int i = 0; i < nHashFuncs; i++)
     {
-        unsigned int nIndex = Hash(i, vKey);
+        unsigned int nIndex = Hash(i, pKey, nKeyLen);
         // Checks bit nIndex of vData
         if (!(vData[nIndex >> 3] & (1 << (7 & nIndex))))
             return false;
@@ -133,7 +142,87 @@ bool CBloomFilter::IsWithinSizeConstraints() const
     return vData.size() <= MAX_BLOOM_FILTER_SIZE && nHashFuncs <= MAX_HASH_FUNCS;
 }
 
+CBloomTxElements::CBloomTxElements(const CTransaction& tx) : hash(tx.GetHash())
+{
+    vOutputs.resize(tx.vout.size());
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+    {
+        const CScript& scriptPubKey = tx.vout[i].scriptPubKey;
+        Output& output = vOutputs[i];
+        output.nFirst = vElements.size();
+        CScript::const_iterator pc = scriptPubKey.begin();
+        vector<unsigned char> data;
+        while (pc < scriptPubKey.end())
+        {
+            opcodetype opcode;
+            if (!scriptPubKey.GetOp(pc, opcode, data))
+                break;
+            AddPushData(data);
+        }
+        output.nEnd = vElements.size();
+
+        output.fPubKeyOrMultisig = false;
+        if (output.nEnd != output.nFirst) {
+            txnouttype type;
+            vector<vector<unsigned char> > vSolutions;
+            output.fPubKeyOrMultisig = Solver(scriptPubKey, type, vSolutions) &&
+                                       (type == TX_PUBKEY || type == TX_MULTISIG);
+        }
+    }
+
+    vInputs.resize(tx.vin.size());
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+    {
+        const CTxIn& txin = tx.vin[i];
+        Input& input = vInputs[i];
+        // As CBloomFilter::contains(const COutPoint&) serializes it
+        input.prevout.nBegin = vData.size();
+        input.prevout.nSize = 36;
+        vData.insert(vData.end(), txin.prevout.hash.begin(), txin.prevout.hash.end());
+        unsigned char n[4];
+        WriteLE32(n, txin.prevout.n);
+        vData.insert(vData.end(), n, n + 4);
+
+        input.nFirst = vElements.size();
+        CScript::const_iterator pc = txin.scriptSig.begin();
+        vector<unsigned char> data;
+        while (pc < txin.scriptSig.end())
+        {
+            opcodetype opcode;
+            if (!txin.scriptSig.GetOp(pc, opcode, data))
+                break;
+            AddPushData(data);
+        }
+        input.nEnd = vElements.size();
+    }
+}
+
+void CBloomTxElements::AddPushData(const vector<unsigned char>& data)
+{
+    // Empty pushes and opcodes never match
+    if (data.empty())
+        return;
+    Element element = { (uint32_t)vData.size(), (uint32_t)data.size() };
+    vData.insert(vData.end(), data.begin(), data.end());
+    vElements.push_back(element);
+}
+
+size_t CBloomTxElements::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(vData) + memusage::DynamicUsage(vElements) +
+           memusage::DynamicUsage(vOutputs) + memusage::DynamicUsage(vInputs);
+}
+
 bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
+{
+    if (isFull)
+        return true;
+    if (isEmpty)
+        return false;
+    return IsRelevantAndUpdate(CBloomTxElements(tx));
+}
+
+bool CBloomFilter::IsRelevantAndUpdate(const CBloomTxElements& tx)
 {
     bool fFound = false;
     // Match if the filter contains the hash of tx
@@ -142,37 +231,25 @@ bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
         return true;
     if (isEmpty)
         return false;
-    const uint256& hash = tx.GetHash();
-    if (contains(hash))
+    if (contains(tx.hash))
         fFound = true;
 
-    for (unsigned int i = 0; i < tx.vout.size(); i++)
+    for (unsigned int i = 0; i < tx.vOutputs.size(); i++)
     {
-        const CTxOut& txout = tx.vout[i];
+        const CBloomTxElements::Output& output = tx.vOutputs[i];
         // Match if the filter contains any arbitrary script data element in any scriptPubKey in tx
         // If this matches, also add the specific output that was matched.
         // This means clients don't have to update the filter themselves when a new relevant tx 
         // is discovered in order to find spending transactions, which avoids round-tripping and race conditions.
-        CScript::const_iterator pc = txout.scriptPubKey.begin();
-        vector<unsigned char> data;
-        while (pc < txout.scriptPubKey.end())
+        for (uint32_t j = output.nFirst; j < output.nEnd; j++)
         {
-            opcodetype opcode;
-            if (!txout.scriptPubKey.GetOp(pc, opcode, data))
-                break;
-            if (data.size() != 0 && contains(data))
+            if (contains(tx, tx.vElements[j]))
             {
                 fFound = true;
                 if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_ALL)
-                    insert(COutPoint(hash, i));
-                else if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_P2PUBKEY_ONLY)
-                {
-                    txnouttype type;
-                    vector<vector<unsigned char> > vSolutions;
-                    if (Solver(txout.scriptPubKey, type, vSolutions) &&
-                            (type == TX_PUBKEY || type == TX_MULTISIG))
-                        insert(COutPoint(hash, i));
-                }
+                    insert(COutPoint(tx.hash, i));
+                else if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_P2PUBKEY_ONLY && output.fPubKeyOrMultisig)
+                    insert(COutPoint(tx.hash, i));
                 break;
             }
         }
@@ -181,21 +258,16 @@ bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
     if (fFound)
         return true;
 
-    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    BOOST_FOREACH(const CBloomTxElements::Input& input, tx.vInputs)
     {
         // Match if the filter contains an outpoint tx spends
-        if (contains(txin.prevout))
+        if (contains(tx, input.prevout))
             return true;
 
         // Match if the filter contains any arbitrary script data element in any scriptSig in tx
-        CScript::const_iterator pc = txin.scriptSig.begin();
-        vector<unsigned char> data;
-        while (pc < txin.scriptSig.end())
+        for (uint32_t j = input.nFirst; j < input.nEnd; j++)
         {
-            opcodetype opcode;
-            if (!txin.scriptSig.GetOp(pc, opcode, data))
-                break;
-            if (data.size() != 0 && contains(data))
+            if (contains(tx, tx.vElements[j]))
                 return true;
         }
     }
@@ -270,3 +342,56 @@ void CRollingBloomFilter::reset()
     b2.reset(nNewTweak);
     nInsertions = 0;
 }
+
+/* Bits of filter per element. With four bits set per element, this gives a
+ * false-positive rate of well under 1% at full capacity. */
+static const size_t BLOCKED_BLOOM_BITS_PER_ELEMENT = 16;
+static const unsigned int BLOCKED_BLOOM_HASH_FUNCS = 4;
+
+CBlockedBloomFilter::CBlockedBloomFilter(size_t nElements)
+{
+    reset(nElements);
+}
+
+void CBlockedBloomFilter::Locate(const uint256& hash, size_t& nWord, uint64_t& mask) const
+{
+    uint64_t h = SipHashUint256Extra(k0, k1, hash, 0);
+    // The upper half picks the word (by multiply-shift, which avoids a
+    // division), six bits of the lower half each pick one bit in that word.
+    nWord = (size_t)(((h >> 32) * vData.size()) >> 32);
+    mask = 0;
+    for (unsigned int i = 0; i < BLOCKED_BLOOM_HASH_FUNCS; i++) {
+        mask |= (uint64_t)1 << ((h >> (6 * i)) & 63);
+    }
+}
+
+void CBlockedBloomFilter::insert(const uint256& hash)
+{
+    size_t nWord;
+    uint64_t mask;
+    Locate(hash, nWord, mask);
+    vData[nWord] |= mask;
+    nInsertions++;
+}
+
+bool CBlockedBloomFilter::contains(const uint256& hash) const
+{
+    size_t nWord;
+    uint64_t mask;
+    Locate(hash, nWord, mask);
+    return (vData[nWord] & mask) == mask;
+}
+
+void CBlockedBloomFilter::reset(size_t nElements)
+{
+    nCapacity = nElements;
+    nInsertions = 0;
+    k0 = GetRand(std::numeric_limits<uint64_t>::max());
+    k1 = GetRand(std::numeric_limits<uint64_t>::max());
+    vData.assign(std::max<size_t>(1, nElements * BLOCKED_BLOOM_BITS_PER_ELEMENT / 64), 0);
+}
+
+size_t CBlockedBloomFilter::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(vData);
+}
@@ -6,12 +6,61 @@
 #define BITCOIN_BLOOM_H
 
 #include "serialize.h"
+#include "uint256.h"
 
+#include <stdint.h>
 #include <vector>
 
 class COutPoint;
 class CTransaction;
-class uint256;
+
+/**
+ * The data a bloom filter is matched against in one transaction: its txid,
+ * the push data of its scripts and the outpoints it spends. Extracting them
+ * once lets a block be matched against many peers' filters without parsing
+ * its scripts again for each.
+ */
+class CBloomTxElements
+{
+public:
+    //! A range of vData
+    struct Element
+    {
+        uint32_t nBegin;
+        uint32_t nSize;
+    };
+
+    struct Output
+    {
+        //! Its push data, as a range of vElements
+        uint32_t nFirst;
+        uint32_t nEnd;
+        //! Pays to a pubkey or multisig, for BLOOM_UPDATE_P2PUBKEY_ONLY
+        bool fPubKeyOrMultisig;
+    };
+
+    struct Input
+    {
+        //! The serialized outpoint spent, as an element
+        Element prevout;
+        //! Push data of the scriptSig, as a range of vElements
+        uint32_t nFirst;
+        uint32_t nEnd;
+    };
+
+    uint256 hash;
+    std::vector<unsigned char> vData;
+    std::vector<Element> vElements;
+    std::vector<Output> vOutputs;
+    std::vector<Input> vInputs;
+
+    explicit CBloomTxElements(const CTransaction& tx);
+
+    size_t DynamicMemoryUsage() const;
+
+private:
+    void AddPushData(const std::vector<unsigned char>& data);
+};
 
 //! 20,000 items with fp rate < 0.1% or 10,000 items and <0.0001%
 static const unsigned int MAX_BLOOM_FILTER_SIZE = 36000; // bytes
@@ -51,7 +100,12 @@ private:
     unsigned int nTweak;
     unsigned char nFlags;
 
-    unsigned int Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const;
+    unsigned int Hash(unsigned int nHashNum, const unsigned char* pDataToHash, size_t nDataLen) const;
+    bool contains(const unsigned char* pKey, size_t nKeyLen) const;
+    bool contains(const CBloomTxElements& tx, const CBloomTxElements::Element& element) const
+    {
+        return contains(tx.vData.data() + element.nBegin, element.nSize);
+    }
 
     // Private constructor for CRollingBloomFilter, no restrictions on size
     CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweak);
@@ -97,6 +151,8 @@ public:
 
     //! Also adds any outputs which match the filter to the filter (to match their spending txes)
     bool IsRelevantAndUpdate(const CTransaction& tx);
+    //! As above, with the transaction's elements already extracted
+    bool IsRelevantAndUpdate(const CBloomTxElements& tx);
 
     //! Checks for empty and full filters to avoid wasting cpu
     void UpdateEmptyFull();
@@ -135,4 +191,43 @@ private:
 };
 
 
+/**
+ * CBlockedBloomFilter is a bloom filter over uint256 keys that places all
+ * the bits for any one key in a single 64-bit word, so that a lookup costs
+ * one hash and one memory access. It is meant to rule out lookups into large
+ * on-disk sets without touching the disk.
+ *
+ * Elements cannot be removed; removing one from the underlying set merely
+ * leaves a false positive behind. Filling the filter beyond the number of
+ * elements it was sized for raises the false-positive rate, which callers
+ * can detect with size() > capacity() and reset() with a larger size.
+ */
+class CBlockedBloomFilter
+{
+public:
+    // Like CRollingBloomFilter this calls GetRand() at creation time, so
+    // don't create global CBlockedBloomFilter objects.
+    explicit CBlockedBloomFilter(size_t nElements = 0);
+
+    void insert(const uint256& hash);
+    bool contains(const uint256& hash) const;
+    //! Empty the filter, pick a new salt and size it for nElements.
+    void reset(size_t nElements);
+
+    //! Number of insertions since the last reset
+    size_t size() const { return nInsertions; }
+    //! Number of insertions the filter was sized for
+    size_t capacity() const { return nCapacity; }
+    size_t DynamicMemoryUsage() const;
+
+private:
+    std::vector<uint64_t> vData;
+    size_t nCapacity;
+    size_t nInsertions;
+    uint64_t k0, k1;
+
+    //! Index of the word and bit mask within it that hash maps to
+    void Locate(const uint256& hash, size_t& nWord, uint64_t& mask) const;
+};
+
 #endif // BITCOIN_BLOOM_H
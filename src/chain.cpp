@@ -5,8 +5,21 @@
 
 #include "chain.h"
 
+#include "util.h"
+
+#include <stdexcept>
+
 using namespace std;
 
+CBlockHeader CBlockIndex::GetBlockHeader() const
+{
+    CBlockHeader block = GetBlockHeaderWithoutSolution();
+    // A header without its solution fails proof of work for whoever gets it
+    if (!ReadBlockIndexSolution(this, block.nSolution))
+        throw std::runtime_error(strprintf("%s: no Equihash solution for block %s", __func__, GetBlockHash().ToString()));
+    return block;
+}
+
 /**
  * CChain implementation
  */
@@ -98,6 +98,8 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 
     BLOCK_ACTIVATES_UPGRADE  =   128, //! block activates a network upgrade
+
+    BLOCK_PROOFS_VALID       =   256, //! passed CheckBlock, JoinSplit proofs included, before being connected
 };
 
 //! Short-hand for the highest consensus validity we implement.
@@ -109,6 +111,14 @@ static const BlockStatus BLOCK_VALID_CONSENSUS = BLOCK_VALID_SCRIPTS;
  * candidates to be the next block. A blockindex may have multiple pprev pointing
  * to it, but at most one of them can be part of the currently active branch.
  */
+class CBlockIndex;
+
+/**
+ * Look up the Equihash solution of a block index entry, which CBlockIndex
+ * doesn't keep. Defined in main.cpp.
+ */
+bool ReadBlockIndexSolution(const CBlockIndex* pindex, std::vector<unsigned char>& nSolution);
+
 class CBlockIndex
 {
 public:
@@ -121,6 +131,9 @@ public:
     //! pointer to the index of some further predecessor of this block
     CBlockIndex* pskip;
 
+    // The fields are grouped by size to keep the padding down; there is one
+    // of these for every header we know of.
+
     //! height of the entry in the chain. The genesis block has height 0
     int nHeight;
 
@@ -133,9 +146,6 @@ public:
     //! Byte offset within rev?????.dat where this block's undo data is stored
     unsigned int nUndoPos;
 
-    //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
-    arith_uint256 nChainWork;
-
     //! Number of transactions in this block.
     //! Note: in a potential headers-first mode, this number cannot be relied upon
     unsigned int nTx;
@@ -148,17 +158,40 @@ public:
     //! Verification status of this block. See enum BlockStatus
     unsigned int nStatus;
 
+    //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
+    uint32_t nSequenceId;
+
     //! Branch ID corresponding to the consensus rules used to validate this block.
     //! Only cached if block validity is BLOCK_VALID_CONSENSUS.
     //! Persisted at each activation height, memory-only for intervening blocks.
     boost::optional<uint32_t> nCachedBranchId;
 
+    //! block header, without the Equihash solution. That is most of the size
+    //! of a header, so it stays on disk; see GetBlockHeader.
+    int nVersion;
+    unsigned int nTime;
+    unsigned int nBits;
+    uint256 hashMerkleRoot;
+    uint256 hashFinalSaplingRoot;
+    uint256 nNonce;
+
+    //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
+    arith_uint256 nChainWork;
+
     //! The anchor for the tree state up to the start of this block
     uint256 hashSproutAnchor;
 
     //! (memory only) The anchor for the tree state up to the end of this block
     uint256 hashFinalSproutRoot;
 
+    // The time at which this block was first seen locally.
+    int64_t nArrivalTime;
+
+    //! Change in value held by the Sapling circuit over this block.
+    //! Not a boost::optional because this was added before Sapling activated, so we can
+    //! rely on the invariant that every block before this was added had nSaplingValue = 0.
+    CAmount nSaplingValue;
+
     //! Change in value held by the Sprout circuit over this block.
     //! Will be boost::none for older blocks on old nodes until a reindex has taken place.
     boost::optional<CAmount> nSproutValue;
@@ -168,30 +201,10 @@ public:
     //! Will be boost::none if nChainTx is zero.
     boost::optional<CAmount> nChainSproutValue;
 
-    //! Change in value held by the Sapling circuit over this block.
-    //! Not a boost::optional because this was added before Sapling activated, so we can
-    //! rely on the invariant that every block before this was added had nSaplingValue = 0.
-    CAmount nSaplingValue;
-
     //! (memory only) Total value held by the Sapling circuit up to and including this block.
     //! Will be boost::none if nChainTx is zero.
     boost::optional<CAmount> nChainSaplingValue;
 
-    //! block header
-    int nVersion;
-    uint256 hashMerkleRoot;
-    uint256 hashFinalSaplingRoot;
-    unsigned int nTime;
-    unsigned int nBits;
-    uint256 nNonce;
-    std::vector<unsigned char> nSolution;
-
-    //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
-    uint32_t nSequenceId;
-
-    // The time at which this block was first seen locally.
-    int64_t nArrivalTime;
-
     void SetNull()
     {
         phashBlock = NULL;
@@ -221,7 +234,6 @@ public:
         nBits          = 0;
         nNonce         = uint256();
         nArrivalTime   = -1;
-        nSolution.clear();
     }
 
     CBlockIndex()
@@ -239,7 +251,6 @@ public:
         nTime          = block.nTime;
         nBits          = block.nBits;
         nNonce         = block.nNonce;
-        nSolution      = block.nSolution;
     }
 
     CDiskBlockPos GetBlockPos() const {
@@ -260,7 +271,8 @@ public:
         return ret;
     }
 
-    CBlockHeader GetBlockHeader() const
+    //! The header with an empty nSolution
+    CBlockHeader GetBlockHeaderWithoutSolution() const
     {
         CBlockHeader block;
         block.nVersion       = nVersion;
@@ -271,10 +283,14 @@ public:
         block.nTime          = nTime;
         block.nBits          = nBits;
         block.nNonce         = nNonce;
-        block.nSolution      = nSolution;
         return block;
     }
 
+    //! The full header. The solution is looked up with ReadBlockIndexSolution,
+    //! which may read it from the block tree database or the block file.
+    //! Throws std::runtime_error if it can't be found.
+    CBlockHeader GetBlockHeader() const;
+
     uint256 GetBlockHash() const
     {
         return *phashBlock;
@@ -350,6 +366,8 @@ class CDiskBlockIndex : public CBlockIndex
 {
 public:
     uint256 hashPrev;
+    //! Left empty if the solution could not be looked up
+    std::vector<unsigned char> nSolution;
 
     CDiskBlockIndex() {
         hashPrev = uint256();
@@ -357,6 +375,8 @@ public:
 
     explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex) {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
+        if (!ReadBlockIndexSolution(pindex, nSolution))
+            nSolution.clear();
     }
 
     ADD_SERIALIZE_METHODS;
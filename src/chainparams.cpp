@@ -40,7 +40,7 @@ static CBlock CreateGenesisBlock(const char* pszTimestamp, const CScript& genesi
     genesis.nNonce    = nNonce;
     genesis.nSolution = nSolution;
     genesis.nVersion  = nVersion;
-    genesis.vtx.push_back(txNew);
+    genesis.vtx.push_back(MakeTransactionRef(txNew));
     genesis.hashPrevBlock.SetNull();
     genesis.hashMerkleRoot = genesis.BuildMerkleTree();
     return genesis;
@@ -108,6 +108,13 @@ public:
         // The best chain should have at least this much work.
         consensus.nMinimumChainWork = uint256S("0x000000000000000000000000000000000000000000000000000003cbab61c14c");
 
+        // By default assume that the proofs and signatures in ancestors of this block are valid.
+        consensus.defaultAssumeValid = uint256S("0x00000038101895ae9add3b5d288db258b053c4bdc39642aeb6be44f7f53bc929"); // 93096
+
+        // The header chain up to the last checkpoint
+        consensus.hashHeaderCommitment = uint256S("0x00000038101895ae9add3b5d288db258b053c4bdc39642aeb6be44f7f53bc929");
+        consensus.nHeaderCommitmentHeight = 93096;
+
         pchMessageStart[0] = 0xd8;
         pchMessageStart[1] = 0xcf;
         pchMessageStart[2] = 0xcd;
@@ -234,6 +241,12 @@ public:
         // The best chain should have at least this much work.
         consensus.nMinimumChainWork = uint256S("0x0000000000000000000000000000000000000000000000000000000000f1eb9b");
 
+        // By default assume that the proofs and signatures in ancestors of this block are valid.
+        consensus.defaultAssumeValid = uint256();
+
+        consensus.hashHeaderCommitment = uint256();
+        consensus.nHeaderCommitmentHeight = 0;
+
         pchMessageStart[0] = 0xfe;
         pchMessageStart[1] = 0x90;
         pchMessageStart[2] = 0x86;
@@ -345,6 +358,12 @@ public:
         // The best chain should have at least this much work.
         consensus.nMinimumChainWork = uint256S("0x00");
 
+        // By default assume that the proofs and signatures in ancestors of this block are valid.
+        consensus.defaultAssumeValid = uint256();
+
+        consensus.hashHeaderCommitment = uint256();
+        consensus.nHeaderCommitmentHeight = 0;
+
         pchMessageStart[0] = 0xea;
         pchMessageStart[1] = 0x8c;
         pchMessageStart[2] = 0x71;
@@ -117,6 +117,8 @@ public:
     const std::string& Bech32HRP(Bech32Type type) const { return bech32HRPs[type]; }
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     const CCheckpointData& Checkpoints() const { return checkpointData; }
+    /** Known dumptxoutset content hashes, by the height of their base block */
+    const std::map<int, uint256>& TxOutSetHashes() const { return mapTxOutSetHashes; }
     /** Enforce coinbase consensus rule in regtest mode */
     void SetRegTestCoinbaseMustBeProtected() { consensus.fCoinbaseMustBeProtected = true; }
 
@@ -148,6 +150,7 @@ protected:
     bool fMineBlocksOnDemand = false;
     bool fTestnetToBeDeprecatedFieldRPC = false;
     CCheckpointData checkpointData;
+    std::map<int, uint256> mapTxOutSetHashes;
 };
 
 /**
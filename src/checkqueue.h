@@ -5,6 +5,8 @@
 #ifndef BITCOIN_CHECKQUEUE_H
 #define BITCOIN_CHECKQUEUE_H
 
+#include "corebudget.h"
+
 #include <algorithm>
 #include <vector>
 
@@ -25,6 +27,10 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Workers hold a -par worker slot, and a core of the process-wide budget
+  * of the queue's class, while running a batch. The master holds neither,
+  * as it may hold locks that work waiting for them needs.
   */
 template <typename T>
 class CCheckQueue
@@ -65,6 +71,17 @@ private:
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! The class of the work, for the core budget
+    CoreClass coreClass;
+
+    static bool RunBatch(std::vector<T>& vChecks, bool fOk)
+    {
+        BOOST_FOREACH (T& check, vChecks)
+            if (fOk)
+                fOk = check();
+        return fOk;
+    }
+
     /** Internal function that does bulk of the verification work. */
     bool Loop(bool fMaster = false)
     {
@@ -119,16 +136,21 @@ private:
                 fOk = fAllOk;
             }
             // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
+            if (fMaster) {
+                fOk = RunBatch(vChecks, fOk);
+            } else {
+                CWorkerSlot slot;
+                CCoreReservation core(coreClass);
+                fOk = RunBatch(vChecks, fOk);
+            }
             vChecks.clear();
         } while (true);
     }
 
 public:
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn, CoreClass coreClassIn = CORE_CLASS_VALIDATION) :
+        nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn), coreClass(coreClassIn) {}
 
     //! Worker thread
     void Thread()
@@ -7,47 +7,40 @@
 #include "memusage.h"
 #include "random.h"
 #include "version.h"
+#include "consensus/consensus.h"
 #include "policy/fees.h"
 
 #include <assert.h>
+#include <algorithm>
+#include <limits>
+#include <tuple>
 
-/**
- * calculate number of bytes for the bitmask, and its number of non-zero bytes
- * each bit in the bitmask represents the availability of one output, but the
- * availabilities of the first two outputs are encoded separately
- */
-void CCoins::CalcMaskSize(unsigned int &nBytes, unsigned int &nNonzeroBytes) const {
-    unsigned int nLastUsedByte = 0;
-    for (unsigned int b = 0; 2+b*8 < vout.size(); b++) {
-        bool fZero = true;
-        for (unsigned int i = 0; i < 8 && 2+b*8+i < vout.size(); i++) {
-            if (!vout[2+b*8+i].IsNull()) {
-                fZero = false;
-                continue;
-            }
+bool CCoinsView::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const { return false; }
+bool CCoinsView::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const { return false; }
+bool CCoinsView::HaveAnchor(const uint256 &rt, ShieldedType type) const
+{
+    switch (type) {
+        case SPROUT: {
+            SproutMerkleTree tree;
+            return GetSproutAnchorAt(rt, tree);
         }
-        if (!fZero) {
-            nLastUsedByte = b + 1;
-            nNonzeroBytes++;
+        case SAPLING: {
+            SaplingMerkleTree tree;
+            return GetSaplingAnchorAt(rt, tree);
         }
+        default:
+            throw std::runtime_error("Unknown shielded type");
     }
-    nBytes += nLastUsedByte;
 }
-
-bool CCoins::Spend(uint32_t nPos) 
+bool CCoinsView::GetNullifier(const uint256 &nullifier, ShieldedType type) const { return false; }
+bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
+bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
 {
-    if (nPos >= vout.size() || vout[nPos].IsNull())
-        return false;
-    vout[nPos].SetNull();
-    Cleanup();
-    return true;
+    Coin coin;
+    return GetCoin(outpoint, coin);
 }
-bool CCoinsView::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const { return false; }
-bool CCoinsView::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const { return false; }
-bool CCoinsView::GetNullifier(const uint256 &nullifier, ShieldedType type) const { return false; }
-bool CCoinsView::GetCoins(const uint256 &txid, CCoins &coins) const { return false; }
-bool CCoinsView::HaveCoins(const uint256 &txid) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
+std::vector<uint256> CCoinsView::GetHeadBlocks() const { return std::vector<uint256>(); }
 uint256 CCoinsView::GetBestAnchor(ShieldedType type) const { return uint256(); };
 bool CCoinsView::BatchWrite(CCoinsMap &mapCoins,
                             const uint256 &hashBlock,
@@ -56,7 +49,8 @@ bool CCoinsView::BatchWrite(CCoinsMap &mapCoins,
                             CAnchorsSproutMap &mapSproutAnchors,
                             CAnchorsSaplingMap &mapSaplingAnchors,
                             CNullifiersMap &mapSproutNullifiers,
-                            CNullifiersMap &mapSaplingNullifiers) { return false; }
+                            CNullifiersMap &mapSaplingNullifiers,
+                            bool fErase) { return false; }
 bool CCoinsView::GetStats(CCoinsStats &stats) const { return false; }
 
 
@@ -64,10 +58,12 @@ CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
 
 bool CCoinsViewBacked::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const { return base->GetSproutAnchorAt(rt, tree); }
 bool CCoinsViewBacked::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const { return base->GetSaplingAnchorAt(rt, tree); }
+bool CCoinsViewBacked::HaveAnchor(const uint256 &rt, ShieldedType type) const { return base->HaveAnchor(rt, type); }
 bool CCoinsViewBacked::GetNullifier(const uint256 &nullifier, ShieldedType type) const { return base->GetNullifier(nullifier, type); }
-bool CCoinsViewBacked::GetCoins(const uint256 &txid, CCoins &coins) const { return base->GetCoins(txid, coins); }
-bool CCoinsViewBacked::HaveCoins(const uint256 &txid) const { return base->HaveCoins(txid); }
+bool CCoinsViewBacked::GetCoin(const COutPoint &outpoint, Coin &coin) const { return base->GetCoin(outpoint, coin); }
+bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const { return base->HaveCoin(outpoint); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
+std::vector<uint256> CCoinsViewBacked::GetHeadBlocks() const { return base->GetHeadBlocks(); }
 uint256 CCoinsViewBacked::GetBestAnchor(ShieldedType type) const { return base->GetBestAnchor(type); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
 bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins,
@@ -77,92 +73,127 @@ bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins,
                                   CAnchorsSproutMap &mapSproutAnchors,
                                   CAnchorsSaplingMap &mapSaplingAnchors,
                                   CNullifiersMap &mapSproutNullifiers,
-                                  CNullifiersMap &mapSaplingNullifiers) { return base->BatchWrite(mapCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor, mapSproutAnchors, mapSaplingAnchors, mapSproutNullifiers, mapSaplingNullifiers); }
+                                  CNullifiersMap &mapSaplingNullifiers,
+                                  bool fErase) { return base->BatchWrite(mapCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor, mapSproutAnchors, mapSaplingAnchors, mapSproutNullifiers, mapSaplingNullifiers, fErase); }
 bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStats(stats); }
 
-CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
+CCoinsKeyHasher::CCoinsKeyHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0) { }
+SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::~CCoinsViewCache()
-{
-    assert(!hasModifier);
-}
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0), cachedAnchorsUsage(0), nShieldedAccessCounter(0) { }
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
-    return memusage::DynamicUsage(cacheCoins) +
-           memusage::DynamicUsage(cacheSproutAnchors) +
+    return DynamicMemoryUsageCoins() +
+           DynamicMemoryUsageAnchors() +
+           DynamicMemoryUsageNullifiers();
+}
+
+size_t CCoinsViewCache::DynamicMemoryUsageCoins() const {
+    return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
+}
+
+size_t CCoinsViewCache::DynamicMemoryUsageAnchors() const {
+    return memusage::DynamicUsage(cacheSproutAnchors) +
            memusage::DynamicUsage(cacheSaplingAnchors) +
-           memusage::DynamicUsage(cacheSproutNullifiers) +
-           memusage::DynamicUsage(cacheSaplingNullifiers) +
-           cachedCoinsUsage;
+           cachedAnchorsUsage;
 }
 
-CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const {
-    CCoinsMap::iterator it = cacheCoins.find(txid);
+size_t CCoinsViewCache::DynamicMemoryUsageNullifiers() const {
+    return memusage::DynamicUsage(cacheSproutNullifiers) +
+           memusage::DynamicUsage(cacheSaplingNullifiers);
+}
+
+CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
+    CCoinsMap::iterator it = cacheCoins.find(outpoint);
     if (it != cacheCoins.end())
         return it;
-    CCoins tmp;
-    if (!base->GetCoins(txid, tmp))
+    Coin tmp;
+    if (!base->GetCoin(outpoint, tmp))
         return cacheCoins.end();
-    CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry())).first;
-    tmp.swap(ret->second.coins);
-    if (ret->second.coins.IsPruned()) {
-        // The parent only has an empty entry for this txid; we can consider our
+    CCoinsMap::iterator ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(tmp))).first;
+    if (ret->second.coin().IsSpent()) {
+        // The parent only has an empty entry for this outpoint; we can consider our
         // version as fresh.
         ret->second.flags = CCoinsCacheEntry::FRESH;
     }
-    cachedCoinsUsage += ret->second.coins.DynamicMemoryUsage();
+    cachedCoinsUsage += ret->second.coin().DynamicMemoryUsage();
     return ret;
 }
 
 
-bool CCoinsViewCache::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const {
-    CAnchorsSproutMap::const_iterator it = cacheSproutAnchors.find(rt);
-    if (it != cacheSproutAnchors.end()) {
-        if (it->second.entered) {
-            tree = it->second.tree;
-            return true;
-        } else {
-            return false;
-        }
-    }
+static bool GetAnchorFromView(const CCoinsView &view, const uint256 &rt, SproutMerkleTree &tree)
+{
+    return view.GetSproutAnchorAt(rt, tree);
+}
 
-    if (!base->GetSproutAnchorAt(rt, tree)) {
-        return false;
+static bool GetAnchorFromView(const CCoinsView &view, const uint256 &rt, SaplingMerkleTree &tree)
+{
+    return view.GetSaplingAnchorAt(rt, tree);
+}
+
+/**
+ * Find the entry for rt in cacheAnchors, pulling it in from base if needed.
+ * Returns cacheAnchors.end() if neither has it.
+ */
+template<typename Cache>
+static typename Cache::iterator FetchAnchor(
+    const CCoinsView &base,
+    Cache &cacheAnchors,
+    const uint256 &rt,
+    uint32_t &nAccessCounter,
+    size_t &cachedAnchorsUsage)
+{
+    typename Cache::iterator it = cacheAnchors.find(rt);
+    if (it != cacheAnchors.end()) {
+        it->second.nLastUsed = ++nAccessCounter;
+        return it;
     }
 
-    CAnchorsSproutMap::iterator ret = cacheSproutAnchors.insert(std::make_pair(rt, CAnchorsSproutCacheEntry())).first;
-    ret->second.entered = true;
-    ret->second.tree = tree;
-    cachedCoinsUsage += ret->second.tree.DynamicMemoryUsage();
+    // Deserialize straight into the new cache entry rather than into a
+    // temporary tree that then has to be copied.
+    it = cacheAnchors.insert(std::make_pair(rt, typename Cache::mapped_type())).first;
+    if (!GetAnchorFromView(base, rt, it->second.tree)) {
+        cacheAnchors.erase(it);
+        return cacheAnchors.end();
+    }
+    it->second.entered = true;
+    it->second.nLastUsed = ++nAccessCounter;
+    cachedAnchorsUsage += it->second.tree.DynamicMemoryUsage();
+    return it;
+}
 
+bool CCoinsViewCache::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const {
+    CAnchorsSproutMap::iterator it = FetchAnchor(*base, cacheSproutAnchors, rt, nShieldedAccessCounter, cachedAnchorsUsage);
+    if (it == cacheSproutAnchors.end() || !it->second.entered)
+        return false;
+    tree = it->second.tree;
     return true;
 }
 
 bool CCoinsViewCache::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const {
-    CAnchorsSaplingMap::const_iterator it = cacheSaplingAnchors.find(rt);
-    if (it != cacheSaplingAnchors.end()) {
-        if (it->second.entered) {
-            tree = it->second.tree;
-            return true;
-        } else {
-            return false;
-        }
-    }
-
-    if (!base->GetSaplingAnchorAt(rt, tree)) {
+    CAnchorsSaplingMap::iterator it = FetchAnchor(*base, cacheSaplingAnchors, rt, nShieldedAccessCounter, cachedAnchorsUsage);
+    if (it == cacheSaplingAnchors.end() || !it->second.entered)
         return false;
-    }
-
-    CAnchorsSaplingMap::iterator ret = cacheSaplingAnchors.insert(std::make_pair(rt, CAnchorsSaplingCacheEntry())).first;
-    ret->second.entered = true;
-    ret->second.tree = tree;
-    cachedCoinsUsage += ret->second.tree.DynamicMemoryUsage();
-
+    tree = it->second.tree;
     return true;
 }
 
+bool CCoinsViewCache::HaveAnchor(const uint256 &rt, ShieldedType type) const {
+    switch (type) {
+        case SPROUT: {
+            CAnchorsSproutMap::iterator it = FetchAnchor(*base, cacheSproutAnchors, rt, nShieldedAccessCounter, cachedAnchorsUsage);
+            return it != cacheSproutAnchors.end() && it->second.entered;
+        }
+        case SAPLING: {
+            CAnchorsSaplingMap::iterator it = FetchAnchor(*base, cacheSaplingAnchors, rt, nShieldedAccessCounter, cachedAnchorsUsage);
+            return it != cacheSaplingAnchors.end() && it->second.entered;
+        }
+        default:
+            throw std::runtime_error("Unknown shielded type");
+    }
+}
+
 bool CCoinsViewCache::GetNullifier(const uint256 &nullifier, ShieldedType type) const {
     CNullifiersMap* cacheToUse;
     switch (type) {
@@ -176,12 +207,15 @@ bool CCoinsViewCache::GetNullifier(const uint256 &nullifier, ShieldedType type)
             throw std::runtime_error("Unknown shielded type");
     }
     CNullifiersMap::iterator it = cacheToUse->find(nullifier);
-    if (it != cacheToUse->end())
+    if (it != cacheToUse->end()) {
+        it->second.nLastUsed = ++nShieldedAccessCounter;
         return it->second.entered;
+    }
 
     CNullifiersCacheEntry entry;
     bool tmp = base->GetNullifier(nullifier, type);
     entry.entered = tmp;
+    entry.nLastUsed = ++nShieldedAccessCounter;
 
     cacheToUse->insert(std::make_pair(nullifier, entry));
 
@@ -209,14 +243,16 @@ void CCoinsViewCache::AbstractPushAnchor(
         auto insertRet = cacheAnchors.insert(std::make_pair(newrt, CacheEntry()));
         CacheIterator ret = insertRet.first;
 
+        if (!insertRet.second) {
+            // Replacing an existing entry
+            cachedAnchorsUsage -= ret->second.tree.DynamicMemoryUsage();
+        }
+
         ret->second.entered = true;
         ret->second.tree = tree;
         ret->second.flags = CacheEntry::DIRTY;
-
-        if (insertRet.second) {
-            // An insert took place
-            cachedCoinsUsage += ret->second.tree.DynamicMemoryUsage();
-        }
+        ret->second.nLastUsed = ++nShieldedAccessCounter;
+        cachedAnchorsUsage += ret->second.tree.DynamicMemoryUsage();
 
         hash = newrt;
     }
@@ -321,61 +357,97 @@ void CCoinsViewCache::SetNullifiers(const CTransaction& tx, bool spent) {
             std::pair<CNullifiersMap::iterator, bool> ret = cacheSproutNullifiers.insert(std::make_pair(nullifier, CNullifiersCacheEntry()));
             ret.first->second.entered = spent;
             ret.first->second.flags |= CNullifiersCacheEntry::DIRTY;
+            ret.first->second.nLastUsed = ++nShieldedAccessCounter;
         }
     }
     for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
         std::pair<CNullifiersMap::iterator, bool> ret = cacheSaplingNullifiers.insert(std::make_pair(spendDescription.nullifier, CNullifiersCacheEntry()));
         ret.first->second.entered = spent;
         ret.first->second.flags |= CNullifiersCacheEntry::DIRTY;
+        ret.first->second.nLastUsed = ++nShieldedAccessCounter;
     }
 }
 
-bool CCoinsViewCache::GetCoins(const uint256 &txid, CCoins &coins) const {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
+bool CCoinsViewCache::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it != cacheCoins.end()) {
-        coins = it->second.coins;
-        return true;
+        coin = it->second.coin();
+        return !coin.IsSpent();
     }
     return false;
 }
 
-CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
-    assert(!hasModifier);
-    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
-    size_t cachedCoinUsage = 0;
-    if (ret.second) {
-        if (!base->GetCoins(txid, ret.first->second.coins)) {
-            // The parent view does not have this entry; mark it as fresh.
-            ret.first->second.coins.Clear();
-            ret.first->second.flags = CCoinsCacheEntry::FRESH;
-        } else if (ret.first->second.coins.IsPruned()) {
-            // The parent view only has a pruned entry for this; mark it as fresh.
-            ret.first->second.flags = CCoinsCacheEntry::FRESH;
+void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possible_overwrite) {
+    assert(!coin.IsSpent());
+    if (coin.out.scriptPubKey.IsUnspendable()) return;
+    CCoinsMap::iterator it;
+    bool inserted;
+    std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::tuple<>());
+    bool fresh = false;
+    if (!inserted) {
+        cachedCoinsUsage -= it->second.coin().DynamicMemoryUsage();
+    }
+    if (!possible_overwrite) {
+        if (!it->second.coin().IsSpent()) {
+            throw std::logic_error("Adding new coin that replaces non-pruned entry");
         }
+        fresh = !(it->second.flags & CCoinsCacheEntry::DIRTY);
+    }
+    it->second.coin() = std::move(coin);
+    it->second.flags |= CCoinsCacheEntry::DIRTY | (fresh ? CCoinsCacheEntry::FRESH : 0);
+    cachedCoinsUsage += it->second.coin().DynamicMemoryUsage();
+}
+
+void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, bool check) {
+    bool fCoinbase = tx.IsCoinBase();
+    const uint256& txid = tx.GetHash();
+    for (size_t i = 0; i < tx.vout.size(); ++i) {
+        bool overwrite = check ? cache.HaveCoin(COutPoint(txid, i)) : fCoinbase;
+        // Always set the possible_overwrite flag to AddCoin for coinbase txn, in order to correctly
+        // deal with the pre-BIP30 occurrences of duplicate coinbase transactions.
+        cache.AddCoin(COutPoint(txid, i), Coin(tx.vout[i], nHeight, fCoinbase), overwrite);
+    }
+}
+
+bool CCoinsViewCache::SpendCoin(const COutPoint &outpoint, Coin* moveout) {
+    CCoinsMap::iterator it = FetchCoin(outpoint);
+    if (it == cacheCoins.end()) return false;
+    cachedCoinsUsage -= it->second.coin().DynamicMemoryUsage();
+    if (moveout) {
+        *moveout = std::move(it->second.coin());
+    }
+    if (it->second.flags & CCoinsCacheEntry::FRESH) {
+        cacheCoins.erase(it);
     } else {
-        cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
+        it->second.flags |= CCoinsCacheEntry::DIRTY;
+        it->second.coin().Clear();
     }
-    // Assume that whenever ModifyCoins is called, the entry will be modified.
-    ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
-    return CCoinsModifier(*this, ret.first, cachedCoinUsage);
+    return true;
 }
 
-const CCoins* CCoinsViewCache::AccessCoins(const uint256 &txid) const {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
+static const Coin coinEmpty;
+
+const Coin& CCoinsViewCache::AccessCoin(const COutPoint &outpoint) const {
+    CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it == cacheCoins.end()) {
-        return NULL;
+        return coinEmpty;
     } else {
-        return &it->second.coins;
+        return it->second.coin();
     }
 }
 
-bool CCoinsViewCache::HaveCoins(const uint256 &txid) const {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
-    // We're using vtx.empty() instead of IsPruned here for performance reasons,
-    // as we only care about the case where a transaction was replaced entirely
-    // in a reorganization (which wipes vout entirely, as opposed to spending
-    // which just cleans individual outputs).
-    return (it != cacheCoins.end() && !it->second.coins.vout.empty());
+bool CCoinsViewCache::HaveCoin(const COutPoint &outpoint) const {
+    CCoinsMap::const_iterator it = FetchCoin(outpoint);
+    return (it != cacheCoins.end() && !it->second.coin().IsSpent());
+}
+
+bool CCoinsViewCache::HaveCoinInCache(const COutPoint &outpoint) const {
+    CCoinsMap::const_iterator it = cacheCoins.find(outpoint);
+    return (it != cacheCoins.end() && !it->second.coin().IsSpent());
+}
+
+bool CCoinsViewCache::IsCoinCached(const COutPoint &outpoint) const {
+    return cacheCoins.count(outpoint) > 0;
 }
 
 uint256 CCoinsViewCache::GetBestBlock() const {
@@ -406,7 +478,7 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
-void BatchWriteNullifiers(CNullifiersMap &mapNullifiers, CNullifiersMap &cacheNullifiers)
+void BatchWriteNullifiers(CNullifiersMap &mapNullifiers, CNullifiersMap &cacheNullifiers, uint32_t &nAccessCounter, bool fErase)
 {
     for (CNullifiersMap::iterator child_it = mapNullifiers.begin(); child_it != mapNullifiers.end();) {
         if (child_it->second.flags & CNullifiersCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
@@ -416,15 +488,21 @@ void BatchWriteNullifiers(CNullifiersMap &mapNullifiers, CNullifiersMap &cacheNu
                 CNullifiersCacheEntry& entry = cacheNullifiers[child_it->first];
                 entry.entered = child_it->second.entered;
                 entry.flags = CNullifiersCacheEntry::DIRTY;
+                entry.nLastUsed = ++nAccessCounter;
             } else {
                 if (parent_it->second.entered != child_it->second.entered) {
                     parent_it->second.entered = child_it->second.entered;
                     parent_it->second.flags |= CNullifiersCacheEntry::DIRTY;
                 }
+                parent_it->second.nLastUsed = ++nAccessCounter;
             }
         }
-        CNullifiersMap::iterator itOld = child_it++;
-        mapNullifiers.erase(itOld);
+        if (fErase) {
+            CNullifiersMap::iterator itOld = child_it++;
+            mapNullifiers.erase(itOld);
+        } else {
+            child_it++;
+        }
     }
 }
 
@@ -432,7 +510,9 @@ template<typename Map, typename MapIterator, typename MapEntry>
 void BatchWriteAnchors(
     Map &mapAnchors,
     Map &cacheAnchors,
-    size_t &cachedCoinsUsage
+    size_t &cachedAnchorsUsage,
+    uint32_t &nAccessCounter,
+    bool fErase
 )
 {
     for (MapIterator child_it = mapAnchors.begin(); child_it != mapAnchors.end();)
@@ -445,19 +525,25 @@ void BatchWriteAnchors(
                 entry.entered = child_it->second.entered;
                 entry.tree = child_it->second.tree;
                 entry.flags = MapEntry::DIRTY;
+                entry.nLastUsed = ++nAccessCounter;
 
-                cachedCoinsUsage += entry.tree.DynamicMemoryUsage();
+                cachedAnchorsUsage += entry.tree.DynamicMemoryUsage();
             } else {
                 if (parent_it->second.entered != child_it->second.entered) {
                     // The parent may have removed the entry.
                     parent_it->second.entered = child_it->second.entered;
                     parent_it->second.flags |= MapEntry::DIRTY;
                 }
+                parent_it->second.nLastUsed = ++nAccessCounter;
             }
         }
 
-        MapIterator itOld = child_it++;
-        mapAnchors.erase(itOld);
+        if (fErase) {
+            MapIterator itOld = child_it++;
+            mapAnchors.erase(itOld);
+        } else {
+            child_it++;
+        }
     }
 }
 
@@ -468,48 +554,75 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                                  CAnchorsSproutMap &mapSproutAnchors,
                                  CAnchorsSaplingMap &mapSaplingAnchors,
                                  CNullifiersMap &mapSproutNullifiers,
-                                 CNullifiersMap &mapSaplingNullifiers) {
-    assert(!hasModifier);
+                                 CNullifiersMap &mapSaplingNullifiers,
+                                 bool fErase) {
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
             CCoinsMap::iterator itUs = cacheCoins.find(it->first);
             if (itUs == cacheCoins.end()) {
-                if (!it->second.coins.IsPruned()) {
-                    // The parent cache does not have an entry, while the child
-                    // cache does have (a non-pruned) one. Move the data up, and
-                    // mark it as fresh (if the grandparent did have it, we
-                    // would have pulled it in at first GetCoins).
-                    assert(it->second.flags & CCoinsCacheEntry::FRESH);
+                // The parent cache does not have an entry, while the child does
+                // We can ignore it if it's both FRESH and pruned in the child
+                if (!(it->second.flags & CCoinsCacheEntry::FRESH && it->second.coin().IsSpent())) {
+                    // Otherwise we will need to create it in the parent
+                    // and move the data up and mark it as dirty
                     CCoinsCacheEntry& entry = cacheCoins[it->first];
-                    entry.coins.swap(it->second.coins);
-                    cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
-                    entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+                    if (fErase)
+                        entry.coin() = std::move(it->second.coin());
+                    else
+                        entry.coin() = it->second.coin();
+                    cachedCoinsUsage += entry.coin().DynamicMemoryUsage();
+                    entry.flags = CCoinsCacheEntry::DIRTY;
+                    // We can mark it FRESH in the parent if it was FRESH in the child
+                    // Otherwise it might have just been flushed from the parent's cache
+                    // and already exist in the grandparent
+                    if (it->second.flags & CCoinsCacheEntry::FRESH)
+                        entry.flags |= CCoinsCacheEntry::FRESH;
                 }
             } else {
-                if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
+                // Assert that the child cache entry was not marked FRESH if the
+                // parent cache entry has unspent outputs. If this ever happens,
+                // it means the FRESH flag was misapplied and there is a logic
+                // error in the calling code.
+                if ((it->second.flags & CCoinsCacheEntry::FRESH) && !itUs->second.coin().IsSpent())
+                    throw std::logic_error("FRESH flag misapplied to cache entry for base transaction with spendable outputs");
+
+                // Found the entry in the parent cache
+                if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coin().IsSpent()) {
                     // The grandparent does not have an entry, and the child is
                     // modified and being pruned. This means we can just delete
                     // it from the parent.
-                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
+                    cachedCoinsUsage -= itUs->second.coin().DynamicMemoryUsage();
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
-                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
-                    itUs->second.coins.swap(it->second.coins);
-                    cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
+                    cachedCoinsUsage -= itUs->second.coin().DynamicMemoryUsage();
+                    if (fErase)
+                        itUs->second.coin() = std::move(it->second.coin());
+                    else
+                        itUs->second.coin() = it->second.coin();
+                    cachedCoinsUsage += itUs->second.coin().DynamicMemoryUsage();
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                    // NOTE: It is possible the child has a FRESH flag here in
+                    // the event the entry we found in the parent is pruned. But
+                    // we must not copy that FRESH flag to the parent as that
+                    // pruned state likely still needs to be communicated to the
+                    // grandparent.
                 }
             }
         }
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase) {
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+        } else {
+            it++;
+        }
     }
 
-    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::iterator, CAnchorsSproutCacheEntry>(mapSproutAnchors, cacheSproutAnchors, cachedCoinsUsage);
-    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry>(mapSaplingAnchors, cacheSaplingAnchors, cachedCoinsUsage);
+    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::iterator, CAnchorsSproutCacheEntry>(mapSproutAnchors, cacheSproutAnchors, cachedAnchorsUsage, nShieldedAccessCounter, fErase);
+    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry>(mapSaplingAnchors, cacheSaplingAnchors, cachedAnchorsUsage, nShieldedAccessCounter, fErase);
 
-    ::BatchWriteNullifiers(mapSproutNullifiers, cacheSproutNullifiers);
-    ::BatchWriteNullifiers(mapSaplingNullifiers, cacheSaplingNullifiers);
+    ::BatchWriteNullifiers(mapSproutNullifiers, cacheSproutNullifiers, nShieldedAccessCounter, fErase);
+    ::BatchWriteNullifiers(mapSaplingNullifiers, cacheSaplingNullifiers, nShieldedAccessCounter, fErase);
 
     hashSproutAnchor = hashSproutAnchorIn;
     hashSaplingAnchor = hashSaplingAnchorIn;
@@ -525,18 +638,148 @@ bool CCoinsViewCache::Flush() {
     cacheSproutNullifiers.clear();
     cacheSaplingNullifiers.clear();
     cachedCoinsUsage = 0;
+    cachedAnchorsUsage = 0;
     return fOk;
 }
 
+void CCoinsViewCache::ClearCoins() {
+    cacheCoins.clear();
+    cachedCoinsUsage = 0;
+}
+
+template<typename Map, typename MapIterator, typename MapEntry>
+static void SyncAnchors(Map &cacheAnchors, size_t &cachedAnchorsUsage)
+{
+    for (MapIterator it = cacheAnchors.begin(); it != cacheAnchors.end();) {
+        if ((it->second.flags & MapEntry::DIRTY) && !it->second.entered) {
+            cachedAnchorsUsage -= it->second.tree.DynamicMemoryUsage();
+            MapIterator itOld = it++;
+            cacheAnchors.erase(itOld);
+        } else {
+            it->second.flags = 0;
+            it++;
+        }
+    }
+}
+
+static void SyncNullifiers(CNullifiersMap &cacheNullifiers)
+{
+    for (CNullifiersMap::iterator it = cacheNullifiers.begin(); it != cacheNullifiers.end();) {
+        if ((it->second.flags & CNullifiersCacheEntry::DIRTY) && !it->second.entered) {
+            CNullifiersMap::iterator itOld = it++;
+            cacheNullifiers.erase(itOld);
+        } else {
+            it->second.flags = 0;
+            it++;
+        }
+    }
+}
+
+bool CCoinsViewCache::Sync() {
+    bool fOk = base->BatchWrite(cacheCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor, cacheSproutAnchors, cacheSaplingAnchors, cacheSproutNullifiers, cacheSaplingNullifiers, false);
+    // Everything that was dirty now exists in the base, so nothing is FRESH
+    // any more, and spent entries carry no information the base lacks.
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        if (it->second.coin().IsSpent()) {
+            cachedCoinsUsage -= it->second.coin().DynamicMemoryUsage();
+            CCoinsMap::iterator itOld = it++;
+            cacheCoins.erase(itOld);
+        } else {
+            it->second.flags = 0;
+            it++;
+        }
+    }
+    SyncAnchors<CAnchorsSproutMap, CAnchorsSproutMap::iterator, CAnchorsSproutCacheEntry>(cacheSproutAnchors, cachedAnchorsUsage);
+    SyncAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry>(cacheSaplingAnchors, cachedAnchorsUsage);
+    SyncNullifiers(cacheSproutNullifiers);
+    SyncNullifiers(cacheSaplingNullifiers);
+    return fOk;
+}
+
+void CCoinsViewCache::Uncache(const COutPoint& hash)
+{
+    CCoinsMap::iterator it = cacheCoins.find(hash);
+    if (it != cacheCoins.end() && it->second.flags == 0) {
+        cachedCoinsUsage -= it->second.coin().DynamicMemoryUsage();
+        cacheCoins.erase(it);
+    }
+}
+
+void CCoinsViewCache::WarmCoin(const COutPoint &outpoint, Coin&& coin)
+{
+    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(coin)));
+    if (!ret.second)
+        return;
+    if (ret.first->second.coin().IsSpent()) {
+        ret.first->second.flags = CCoinsCacheEntry::FRESH;
+    }
+    cachedCoinsUsage += ret.first->second.coin().DynamicMemoryUsage();
+}
+
+/** Clean entries of a shielded cache, keyed by recency, as candidates for eviction. */
+typedef std::vector<std::pair<uint32_t, std::pair<ShieldedType, uint256> > > ShieldedEvictionList;
+
+template<typename Map>
+static void CollectEvictable(const Map &cache, ShieldedType type, ShieldedEvictionList &vEvictable)
+{
+    for (typename Map::const_iterator it = cache.begin(); it != cache.end(); it++) {
+        if (it->second.flags == 0)
+            vEvictable.push_back(std::make_pair(it->second.nLastUsed, std::make_pair(type, it->first)));
+    }
+}
+
+static bool CompareLastUsed(const ShieldedEvictionList::value_type &a, const ShieldedEvictionList::value_type &b)
+{
+    return a.first < b.first;
+}
+
+void CCoinsViewCache::TrimShieldedCaches(size_t nAnchorCacheLimit, size_t nNullifierCacheLimit)
+{
+    // Trim a little below the limit so that the next few blocks do not
+    // immediately trigger another pass.
+    if (DynamicMemoryUsageAnchors() > nAnchorCacheLimit) {
+        ShieldedEvictionList vEvictable;
+        CollectEvictable(cacheSproutAnchors, SPROUT, vEvictable);
+        CollectEvictable(cacheSaplingAnchors, SAPLING, vEvictable);
+        std::sort(vEvictable.begin(), vEvictable.end(), CompareLastUsed);
+        size_t nTarget = nAnchorCacheLimit / 10 * 9;
+        for (ShieldedEvictionList::const_iterator it = vEvictable.begin(); it != vEvictable.end() && DynamicMemoryUsageAnchors() > nTarget; it++) {
+            if (it->second.first == SPROUT) {
+                CAnchorsSproutMap::iterator itAnchor = cacheSproutAnchors.find(it->second.second);
+                cachedAnchorsUsage -= itAnchor->second.tree.DynamicMemoryUsage();
+                cacheSproutAnchors.erase(itAnchor);
+            } else {
+                CAnchorsSaplingMap::iterator itAnchor = cacheSaplingAnchors.find(it->second.second);
+                cachedAnchorsUsage -= itAnchor->second.tree.DynamicMemoryUsage();
+                cacheSaplingAnchors.erase(itAnchor);
+            }
+        }
+    }
+
+    if (DynamicMemoryUsageNullifiers() > nNullifierCacheLimit) {
+        ShieldedEvictionList vEvictable;
+        CollectEvictable(cacheSproutNullifiers, SPROUT, vEvictable);
+        CollectEvictable(cacheSaplingNullifiers, SAPLING, vEvictable);
+        std::sort(vEvictable.begin(), vEvictable.end(), CompareLastUsed);
+        size_t nTarget = nNullifierCacheLimit / 10 * 9;
+        for (ShieldedEvictionList::const_iterator it = vEvictable.begin(); it != vEvictable.end() && DynamicMemoryUsageNullifiers() > nTarget; it++) {
+            if (it->second.first == SPROUT)
+                cacheSproutNullifiers.erase(it->second.second);
+            else
+                cacheSaplingNullifiers.erase(it->second.second);
+        }
+    }
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
 
 const CTxOut &CCoinsViewCache::GetOutputFor(const CTxIn& input) const
 {
-    const CCoins* coins = AccessCoins(input.prevout.hash);
-    assert(coins && coins->IsAvailable(input.prevout.n));
-    return coins->vout[input.prevout.n];
+    const Coin& coin = AccessCoin(input.prevout);
+    assert(!coin.IsSpent());
+    return coin.out;
 }
 
 CAmount CCoinsViewCache::GetValueIn(const CTransaction& tx) const
@@ -588,8 +831,7 @@ bool CCoinsViewCache::HaveShieldedRequirements(const CTransaction& tx) const
         if (GetNullifier(spendDescription.nullifier, SAPLING)) // Prevent double spends
             return false;
 
-        SaplingMerkleTree tree;
-        if (!GetSaplingAnchorAt(spendDescription.anchor, tree)) {
+        if (!HaveAnchor(spendDescription.anchor, SAPLING)) {
             return false;
         }
     }
@@ -601,9 +843,7 @@ bool CCoinsViewCache::HaveInputs(const CTransaction& tx) const
 {
     if (!tx.IsCoinBase()) {
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
-            const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins* coins = AccessCoins(prevout.hash);
-            if (!coins || !coins->IsAvailable(prevout.n)) {
+            if (!HaveCoin(tx.vin[i].prevout)) {
                 return false;
             }
         }
@@ -629,32 +869,26 @@ double CCoinsViewCache::GetPriority(const CTransaction &tx, int nHeight) const
     double dResult = 0.0;
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
     {
-        const CCoins* coins = AccessCoins(txin.prevout.hash);
-        assert(coins);
-        if (!coins->IsAvailable(txin.prevout.n)) continue;
-        if (coins->nHeight < nHeight) {
-            dResult += coins->vout[txin.prevout.n].nValue * (nHeight-coins->nHeight);
+        const Coin& coin = AccessCoin(txin.prevout);
+        if (coin.IsSpent()) continue;
+        if (coin.nHeight < nHeight) {
+            dResult += coin.out.nValue * (nHeight - coin.nHeight);
         }
     }
 
     return tx.ComputePriority(dResult);
 }
 
-CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage) : cache(cache_), it(it_), cachedCoinUsage(usage) {
-    assert(!cache.hasModifier);
-    cache.hasModifier = true;
-}
+static const size_t MIN_TRANSACTION_OUTPUT_SIZE = ::GetSerializeSize(CTxOut(), SER_NETWORK, PROTOCOL_VERSION);
+static const size_t MAX_OUTPUTS_PER_BLOCK = MAX_BLOCK_SIZE / MIN_TRANSACTION_OUTPUT_SIZE;
 
-CCoinsModifier::~CCoinsModifier()
+const Coin& AccessByTxid(const CCoinsViewCache& view, const uint256& txid)
 {
-    assert(cache.hasModifier);
-    cache.hasModifier = false;
-    it->second.coins.Cleanup();
-    cache.cachedCoinsUsage -= cachedCoinUsage; // Subtract the old usage
-    if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
-        cache.cacheCoins.erase(it);
-    } else {
-        // If the coin still exists after the modification, add the new usage
-        cache.cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
+    COutPoint iter(txid, 0);
+    while (iter.n < MAX_OUTPUTS_PER_BLOCK) {
+        const Coin& alternate = view.AccessCoin(iter);
+        if (!alternate.IsSpent()) return alternate;
+        ++iter.n;
     }
+    return coinEmpty;
 }
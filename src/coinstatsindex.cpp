@@ -0,0 +1,46 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinstatsindex.h"
+
+#include "coins.h"
+#include "streams.h"
+#include "version.h"
+
+uint64_t GetBogoSize(const CScript& scriptPubKey)
+{
+    return 32 /* txid */ +
+           4 /* vout index */ +
+           4 /* height + coinbase */ +
+           8 /* amount */ +
+           2 /* scriptPubKey len */ +
+           scriptPubKey.size() /* scriptPubKey */;
+}
+
+static void SerializeCoin(CDataStream& ss, const COutPoint& outpoint, const Coin& coin)
+{
+    ss << outpoint;
+    ss << (uint32_t)(coin.nHeight * 2 + coin.fCoinBase);
+    ss << coin.out;
+}
+
+void CCoinStatsRecord::AddCoin(const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    SerializeCoin(ss, outpoint, coin);
+    muhash.Insert((const unsigned char*)&ss[0], ss.size());
+    nTransactionOutputs++;
+    nBogoSize += GetBogoSize(coin.out.scriptPubKey);
+    nTotalAmount += coin.out.nValue;
+}
+
+void CCoinStatsRecord::RemoveCoin(const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    SerializeCoin(ss, outpoint, coin);
+    muhash.Remove((const unsigned char*)&ss[0], ss.size());
+    nTransactionOutputs--;
+    nBogoSize -= GetBogoSize(coin.out.scriptPubKey);
+    nTotalAmount -= coin.out.nValue;
+}
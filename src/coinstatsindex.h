@@ -0,0 +1,53 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSTATSINDEX_H
+#define BITCOIN_COINSTATSINDEX_H
+
+#include "amount.h"
+#include "crypto/muhash.h"
+#include "serialize.h"
+
+#include <stdint.h>
+
+class COutPoint;
+class Coin;
+class CScript;
+
+/**
+ * Statistics of the UTXO set as of a block, kept per block by
+ * -coinstatsindex. Each connected block's record is its parent's with the
+ * block's spent coins removed and new coins added, so gettxoutsetinfo can
+ * answer without walking the coin database.
+ */
+class CCoinStatsRecord
+{
+public:
+    //! Order independent hash of the unspent coins
+    MuHash3072 muhash;
+    uint64_t nTransactionOutputs;
+    //! Rough size of the set that does not depend on the database format
+    uint64_t nBogoSize;
+    CAmount nTotalAmount;
+
+    CCoinStatsRecord() : nTransactionOutputs(0), nBogoSize(0), nTotalAmount(0) {}
+
+    void AddCoin(const COutPoint& outpoint, const Coin& coin);
+    void RemoveCoin(const COutPoint& outpoint, const Coin& coin);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(muhash);
+        READWRITE(VARINT(nTransactionOutputs));
+        READWRITE(VARINT(nBogoSize));
+        READWRITE(nTotalAmount);
+    }
+};
+
+/** The size a coin adds to nBogoSize: its script plus a fixed overhead */
+uint64_t GetBogoSize(const CScript& scriptPubKey);
+
+#endif // BITCOIN_COINSTATSINDEX_H
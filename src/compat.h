@@ -93,8 +93,14 @@ typedef u_int SOCKET;
 size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
+// The socket thread waits on epoll where it is available, which has no
+// limit on descriptor numbers, and select() elsewhere.
+#if defined(HAVE_SYS_EPOLL_H) && !defined(WIN32)
+#define USE_EPOLL
+#endif
+
 bool static inline IsSelectableSocket(SOCKET s) {
-#ifdef WIN32
+#if defined(WIN32) || defined(USE_EPOLL)
     return true;
 #else
     return (s < FD_SETSIZE);
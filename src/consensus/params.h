@@ -89,6 +89,19 @@ struct Params {
     int64_t MinActualTimespan() const { return (AveragingWindowTimespan() * (100 - nPowMaxAdjustUp  )) / 100; }
     int64_t MaxActualTimespan() const { return (AveragingWindowTimespan() * (100 + nPowMaxAdjustDown)) / 100; }
     uint256 nMinimumChainWork;
+    /** By default assume that the proofs and signatures in ancestors of this block are valid */
+    uint256 defaultAssumeValid;
+    /**
+     * The header chain up to this block, at nHeaderCommitmentHeight, along
+     * with the checkpoints below it. Until we have its header, headers that
+     * link to one of these hashes are accepted without verifying their
+     * Equihash solutions: as each header commits to its parent, a chain that
+     * reaches a committed hash is the committed one. Headers that don't link
+     * to one yet are kept out of the block index until they do. Null for
+     * none.
+     */
+    uint256 hashHeaderCommitment;
+    int nHeaderCommitmentHeight;
 };
 } // namespace Consensus
 
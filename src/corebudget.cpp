@@ -0,0 +1,179 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "corebudget.h"
+
+#include "utiltime.h"
+
+#include <algorithm>
+
+#include <boost/thread.hpp>
+
+namespace {
+
+boost::mutex cs_budget;
+boost::condition_variable condBudget;
+//! Reservations that may be held at once, 0 for no limit
+int nBudget = 0;
+//! Reservations held, of every class
+int nRunning = 0;
+CoreClassStats classStats[CORE_CLASS_COUNT];
+
+boost::mutex cs_workers;
+boost::condition_variable condWorkers;
+//! -par worker slots, 0 for no limit
+int nWorkerBudget = 0;
+//! -par worker slots taken
+int nWorkersRunning = 0;
+
+const char* const CORE_CLASS_NAMES[CORE_CLASS_COUNT] = {
+    "validation",
+    "relay",
+    "rpc",
+    "wallet",
+    "mining",
+};
+
+//! The reservation holding the calling thread's core; not owned
+void NoCleanup(CCoreReservation*) {}
+boost::thread_specific_ptr<CCoreReservation> threadReservation(NoCleanup);
+
+bool HigherClassWaiting(CoreClass coreClass)
+{
+    for (int i = 0; i < coreClass; i++) {
+        if (classStats[i].nWaiting > 0)
+            return true;
+    }
+    return false;
+}
+
+} // namespace
+
+void SetCoreBudget(int nCores)
+{
+    boost::unique_lock<boost::mutex> lock(cs_budget);
+    nBudget = std::max(nCores, 0);
+    condBudget.notify_all();
+}
+
+int GetCoreBudget()
+{
+    boost::unique_lock<boost::mutex> lock(cs_budget);
+    return nBudget;
+}
+
+const char* CoreClassName(CoreClass coreClass)
+{
+    return CORE_CLASS_NAMES[coreClass];
+}
+
+CoreClassStats GetCoreClassStats(CoreClass coreClass)
+{
+    boost::unique_lock<boost::mutex> lock(cs_budget);
+    return classStats[coreClass];
+}
+
+CCoreReservation::CCoreReservation(CoreClass coreClassIn) : coreClass(coreClassIn), fOwner(false), fHeld(false), nStart(0)
+{
+    if (threadReservation.get() != NULL)
+        return;
+    Take();
+    fOwner = true;
+    threadReservation.reset(this);
+}
+
+CCoreReservation::~CCoreReservation()
+{
+    if (!fOwner)
+        return;
+    if (fHeld)
+        Give();
+    threadReservation.reset();
+}
+
+void CCoreReservation::Take()
+{
+    boost::unique_lock<boost::mutex> lock(cs_budget);
+    CoreClassStats& stats = classStats[coreClass];
+    int64_t nWaitStart = GetTimeMicros();
+
+    // Validation is never held up: everything else waits for it instead
+    if (coreClass != CORE_CLASS_VALIDATION) {
+        stats.nWaiting++;
+        try {
+            while ((nBudget > 0 && nRunning >= nBudget) || HigherClassWaiting(coreClass))
+                condBudget.wait(lock); // interruption point
+        } catch (...) {
+            stats.nWaiting--;
+            condBudget.notify_all();
+            throw;
+        }
+        // Lower classes may have been waiting only for this one
+        if (--stats.nWaiting == 0)
+            condBudget.notify_all();
+    }
+
+    nStart = GetTimeMicros();
+    nRunning++;
+    stats.nRunning++;
+    stats.nReservations++;
+    stats.nWaitMicros += nStart - nWaitStart;
+    fHeld = true;
+}
+
+void CCoreReservation::Give()
+{
+    boost::unique_lock<boost::mutex> lock(cs_budget);
+    CoreClassStats& stats = classStats[coreClass];
+    nRunning--;
+    stats.nRunning--;
+    stats.nHeldMicros += GetTimeMicros() - nStart;
+    fHeld = false;
+    condBudget.notify_all();
+}
+
+CCoreRelease::CCoreRelease() : preservation(threadReservation.get())
+{
+    if (preservation != NULL && preservation->fHeld)
+        preservation->Give();
+    else
+        preservation = NULL;
+}
+
+CCoreRelease::~CCoreRelease()
+{
+    if (preservation != NULL) {
+        // A destructor can't throw, so the wait for the core can't be interrupted
+        boost::this_thread::disable_interruption noInterrupt;
+        preservation->Take();
+    }
+}
+
+void SetWorkerBudget(int nWorkers)
+{
+    boost::unique_lock<boost::mutex> lock(cs_workers);
+    nWorkerBudget = std::max(nWorkers, 0);
+    condWorkers.notify_all();
+}
+
+int GetWorkerBudget()
+{
+    boost::unique_lock<boost::mutex> lock(cs_workers);
+    return nWorkerBudget;
+}
+
+CWorkerSlot::CWorkerSlot()
+{
+    boost::unique_lock<boost::mutex> lock(cs_workers);
+    while (nWorkerBudget > 0 && nWorkersRunning >= nWorkerBudget)
+        condWorkers.wait(lock); // interruption point
+    nWorkersRunning++;
+}
+
+CWorkerSlot::~CWorkerSlot()
+{
+    boost::unique_lock<boost::mutex> lock(cs_workers);
+    nWorkersRunning--;
+    condWorkers.notify_one();
+}
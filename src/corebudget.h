@@ -0,0 +1,108 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COREBUDGET_H
+#define BITCOIN_COREBUDGET_H
+
+#include <stdint.h>
+
+/**
+ * Classes of CPU-heavy work, highest priority first. Work of a class only
+ * starts while a core of the budget is free and no work of a higher class
+ * is waiting for one.
+ */
+enum CoreClass {
+    //! Block and header validation. Never waits, but counts against the budget.
+    CORE_CLASS_VALIDATION,
+    //! Checking transactions relayed by peers
+    CORE_CLASS_RELAY,
+    //! RPC and REST requests
+    CORE_CLASS_RPC,
+    //! Wallet operations such as proving, and note scanning
+    CORE_CLASS_WALLET,
+    //! Equihash solving
+    CORE_CLASS_MINING,
+    CORE_CLASS_COUNT
+};
+
+/** Default for -threads, the cores CPU-heavy work may use at once (0 = all of them) */
+static const int DEFAULT_CORE_BUDGET = 0;
+
+/** Set how many reservations may be held at once; 0 or less for no limit */
+void SetCoreBudget(int nCores);
+int GetCoreBudget();
+
+const char* CoreClassName(CoreClass coreClass);
+
+/** Use of the budget by one class since startup */
+struct CoreClassStats
+{
+    uint64_t nReservations;
+    int64_t nWaitMicros;
+    int64_t nHeldMicros;
+    int nRunning;
+    int nWaiting;
+};
+
+CoreClassStats GetCoreClassStats(CoreClass coreClass);
+
+/**
+ * Holds one core of the process-wide budget while it exists, waiting in the
+ * constructor until one may be taken. A thread that already holds a core
+ * doesn't take a second one, so reserved work may call into other reserved
+ * work. As it may wait, create it before taking any lock that work holding
+ * a core could need.
+ */
+class CCoreReservation
+{
+private:
+    CoreClass coreClass;
+    //! Whether this object holds the core, rather than an outer reservation
+    bool fOwner;
+    bool fHeld;
+    int64_t nStart;
+
+    void Take();
+    void Give();
+
+    friend class CCoreRelease;
+
+public:
+    explicit CCoreReservation(CoreClass coreClassIn);
+    ~CCoreReservation();
+};
+
+/**
+ * Gives back the calling thread's core, if it holds one, while it exists,
+ * so that a thread waiting a long time for an event doesn't keep it.
+ */
+class CCoreRelease
+{
+private:
+    CCoreReservation* preservation;
+
+public:
+    CCoreRelease();
+    ~CCoreRelease();
+};
+
+/** Set how many -par worker threads may run work at once; 0 or less for no limit */
+void SetWorkerBudget(int nWorkers);
+int GetWorkerBudget();
+
+/**
+ * Holds one of the -par worker slots while it exists, waiting in the
+ * constructor until one is free. Every queue with -par worker threads
+ * starts -par - 1 of them, so that one queue being busy doesn't leave
+ * another without threads, but only that many run work at once between
+ * them all. The thread that waits for a queue doesn't take a slot.
+ */
+class CWorkerSlot
+{
+public:
+    CWorkerSlot();
+    ~CWorkerSlot();
+};
+
+#endif // BITCOIN_COREBUDGET_H
@@ -0,0 +1,238 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "crypto/blake2b.h"
+
+#include "crypto/common.h"
+#include "crypto/cpuid.h"
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(ENABLE_AVX2) && defined(HAVE_GETCPUID)
+#define USE_AVX2_DETECTION 1
+#endif
+
+#if defined(USE_AVX2_DETECTION)
+namespace blake2b_avx2
+{
+void FinalizeLE32_4way(const uint64_t* h, uint64_t t0, uint64_t t1,
+                       const unsigned char* block, size_t pos,
+                       const uint32_t* suffixes, unsigned char* out, size_t outlen);
+}
+#endif
+
+// Internal implementation code.
+namespace
+{
+/// Internal BLAKE2b implementation.
+namespace blake2b
+{
+const uint64_t IV[8] = {
+    0x6a09e667f3bcc908ull, 0xbb67ae8584caa73bull, 0x3c6ef372fe94f82bull, 0xa54ff53a5f1d36f1ull,
+    0x510e527fade682d1ull, 0x9b05688c2b3e6c1full, 0x1f83d9abfb41bd6bull, 0x5be0cd19137e2179ull
+};
+
+const uint8_t SIGMA[12][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 }
+};
+
+/**
+ * Mirror of blake2b_state in libsodium's crypto_generichash/blake2b/ref/blake2.h,
+ * which crypto_generichash_blake2b_state is an opaque wrapper around.
+ */
+struct SodiumState
+{
+    uint64_t h[8];
+    uint64_t t[2];
+    uint64_t f[2];
+    uint8_t buf[2 * CBLAKE2bMidstate::BLOCK_SIZE];
+    size_t buflen;
+    uint8_t last_node;
+};
+static_assert(sizeof(SodiumState) <= sizeof(crypto_generichash_blake2b_state),
+              "libsodium BLAKE2b state is smaller than expected");
+
+uint64_t inline Rotr(uint64_t x, int n) { return (x >> n) | (x << (64 - n)); }
+
+void inline G(uint64_t& a, uint64_t& b, uint64_t& c, uint64_t& d, uint64_t x, uint64_t y)
+{
+    a = a + b + x;
+    d = Rotr(d ^ a, 32);
+    c = c + d;
+    b = Rotr(b ^ c, 24);
+    a = a + b + y;
+    d = Rotr(d ^ a, 16);
+    c = c + d;
+    b = Rotr(b ^ c, 63);
+}
+
+void inline IncrementCounter(uint64_t* t, size_t inc)
+{
+    t[0] += inc;
+    t[1] += (t[0] < inc);
+}
+
+/** Perform one BLAKE2b compression, processing a 128-byte block. */
+void Compress(uint64_t* h, const uint64_t* t, const unsigned char* block, bool last)
+{
+    uint64_t m[16];
+    uint64_t v[16];
+    for (int i = 0; i < 16; i++) {
+        m[i] = ReadLE64(block + 8 * i);
+    }
+    for (int i = 0; i < 8; i++) {
+        v[i] = h[i];
+        v[i + 8] = IV[i];
+    }
+    v[12] ^= t[0];
+    v[13] ^= t[1];
+    if (last) {
+        v[14] = ~v[14];
+    }
+    for (int r = 0; r < 12; r++) {
+        const uint8_t* s = SIGMA[r];
+        G(v[0], v[4], v[8],  v[12], m[s[0]],  m[s[1]]);
+        G(v[1], v[5], v[9],  v[13], m[s[2]],  m[s[3]]);
+        G(v[2], v[6], v[10], v[14], m[s[4]],  m[s[5]]);
+        G(v[3], v[7], v[11], v[15], m[s[6]],  m[s[7]]);
+        G(v[0], v[5], v[10], v[15], m[s[8]],  m[s[9]]);
+        G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+        G(v[2], v[7], v[8],  v[13], m[s[12]], m[s[13]]);
+        G(v[3], v[4], v[9],  v[14], m[s[14]], m[s[15]]);
+    }
+    for (int i = 0; i < 8; i++) {
+        h[i] ^= v[i] ^ v[i + 8];
+    }
+}
+
+void WriteOutput(const uint64_t* h, unsigned char* out, size_t outlen)
+{
+    unsigned char buffer[CBLAKE2bMidstate::MAX_OUTPUT_SIZE];
+    for (int i = 0; i < 8; i++) {
+        WriteLE64(buffer + 8 * i, h[i]);
+    }
+    memcpy(out, buffer, outlen);
+}
+
+#if defined(USE_AVX2_DETECTION)
+bool UseAVX2()
+{
+    static const bool fAVX2 = DetectCPUFeatures().avx2;
+    return fAVX2;
+}
+#endif
+
+} // namespace blake2b
+} // namespace
+
+CBLAKE2bMidstate::CBLAKE2bMidstate(const crypto_generichash_blake2b_state& state, size_t outlenIn) :
+    buflen(0), outlen(outlenIn), valid(false)
+{
+    memset(buf, 0, sizeof(buf));
+
+    blake2b::SodiumState s;
+    memcpy(&s, &state, sizeof(s));
+    if (outlen == 0 || outlen > MAX_OUTPUT_SIZE || s.f[0] != 0 || s.f[1] != 0 ||
+        s.last_node != 0 || s.buflen > sizeof(s.buf)) {
+        return;
+    }
+
+    memcpy(h, s.h, sizeof(h));
+    t[0] = s.t[0];
+    t[1] = s.t[1];
+
+    // Compress every buffered block that can no longer be the last one
+    // once the suffix has been appended.
+    const unsigned char* pending = s.buf;
+    size_t len = s.buflen;
+    while (len >= BLOCK_SIZE) {
+        blake2b::IncrementCounter(t, BLOCK_SIZE);
+        blake2b::Compress(h, t, pending, false);
+        pending += BLOCK_SIZE;
+        len -= BLOCK_SIZE;
+    }
+    memcpy(buf, pending, len);
+    buflen = len;
+
+    // Make sure the state was interpreted the way libsodium would finish it.
+    const uint32_t suffix = 0x01234567;
+    unsigned char leSuffix[4];
+    WriteLE32(leSuffix, suffix);
+    crypto_generichash_blake2b_state check = state;
+    unsigned char expected[MAX_OUTPUT_SIZE];
+    unsigned char actual[MAX_OUTPUT_SIZE];
+    crypto_generichash_blake2b_update(&check, leSuffix, sizeof(leSuffix));
+    crypto_generichash_blake2b_final(&check, expected, outlen);
+    FinalizeLE32Scalar(suffix, actual);
+    valid = memcmp(expected, actual, outlen) == 0;
+}
+
+void CBLAKE2bMidstate::FinalizeLE32Scalar(uint32_t suffix, unsigned char* out) const
+{
+    uint64_t hl[8];
+    uint64_t tl[2] = { t[0], t[1] };
+    memcpy(hl, h, sizeof(hl));
+
+    unsigned char block[2 * BLOCK_SIZE] = {};
+    memcpy(block, buf, buflen);
+    WriteLE32(block + buflen, suffix);
+    size_t len = buflen + 4;
+    const unsigned char* p = block;
+    if (len > BLOCK_SIZE) {
+        blake2b::IncrementCounter(tl, BLOCK_SIZE);
+        blake2b::Compress(hl, tl, p, false);
+        p += BLOCK_SIZE;
+        len -= BLOCK_SIZE;
+    }
+    blake2b::IncrementCounter(tl, len);
+    blake2b::Compress(hl, tl, p, true);
+    blake2b::WriteOutput(hl, out, outlen);
+}
+
+void CBLAKE2bMidstate::FinalizeLE32(const uint32_t* suffixes, size_t count, unsigned char* out) const
+{
+    assert(valid);
+#if defined(USE_AVX2_DETECTION)
+    if (count >= 4 && buflen + 4 <= BLOCK_SIZE && blake2b::UseAVX2()) {
+        uint64_t tl[2] = { t[0], t[1] };
+        blake2b::IncrementCounter(tl, buflen + 4);
+        while (count >= 4) {
+            blake2b_avx2::FinalizeLE32_4way(h, tl[0], tl[1], buf, buflen, suffixes, out, outlen);
+            suffixes += 4;
+            out += 4 * outlen;
+            count -= 4;
+        }
+    }
+#endif
+    for (; count > 0; count--) {
+        FinalizeLE32Scalar(*suffixes++, out);
+        out += outlen;
+    }
+}
+
+const char* BLAKE2bBatchImplementation()
+{
+#if defined(USE_AVX2_DETECTION)
+    if (blake2b::UseAVX2()) {
+        return "avx2(4way)";
+    }
+#endif
+    return "standard";
+}
@@ -0,0 +1,52 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_BLAKE2B_H
+#define BITCOIN_CRYPTO_BLAKE2B_H
+
+#include "sodium.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * A BLAKE2b state that has absorbed a common prefix, used to finalize many
+ * messages of the form prefix || LE32(suffix) in one go.
+ *
+ * libsodium only exposes an opaque state, so the midstate is read out of
+ * libsodium's reference layout and checked against libsodium itself on
+ * construction. If that check fails IsValid() returns false and callers must
+ * fall back to crypto_generichash_blake2b_update/final.
+ */
+class CBLAKE2bMidstate
+{
+public:
+    static const size_t BLOCK_SIZE = 128;
+    static const size_t MAX_OUTPUT_SIZE = 64;
+
+    CBLAKE2bMidstate(const crypto_generichash_blake2b_state& state, size_t outlen);
+
+    bool IsValid() const { return valid; }
+
+    /**
+     * Write BLAKE2b(prefix || LE32(suffixes[i])) to out + i * outlen for each
+     * i < count. Must only be called on a valid midstate.
+     */
+    void FinalizeLE32(const uint32_t* suffixes, size_t count, unsigned char* out) const;
+
+private:
+    uint64_t h[8];
+    uint64_t t[2];
+    unsigned char buf[BLOCK_SIZE];
+    size_t buflen;
+    size_t outlen;
+    bool valid;
+
+    void FinalizeLE32Scalar(uint32_t suffix, unsigned char* out) const;
+};
+
+/** Returns a string describing the BLAKE2b finalization backend in use. */
+const char* BLAKE2bBatchImplementation();
+
+#endif // BITCOIN_CRYPTO_BLAKE2B_H
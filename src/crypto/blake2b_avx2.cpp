@@ -0,0 +1,131 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// This is a 4-lane BLAKE2b finalization using AVX2. Each 64-bit lane of a
+// 256-bit register holds the same state word of a different message.
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "crypto/common.h"
+
+namespace blake2b_avx2
+{
+namespace
+{
+const uint64_t IV[8] = {
+    0x6a09e667f3bcc908ull, 0xbb67ae8584caa73bull, 0x3c6ef372fe94f82bull, 0xa54ff53a5f1d36f1ull,
+    0x510e527fade682d1ull, 0x9b05688c2b3e6c1full, 0x1f83d9abfb41bd6bull, 0x5be0cd19137e2179ull
+};
+
+const uint8_t SIGMA[12][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 }
+};
+
+const size_t BLOCK_SIZE = 128;
+
+__m256i inline Add(__m256i x, __m256i y) { return _mm256_add_epi64(x, y); }
+__m256i inline Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+__m256i inline Rotr32(__m256i x) { return _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)); }
+__m256i inline Rotr24(__m256i x)
+{
+    const __m256i mask = _mm256_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+                                          3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+    return _mm256_shuffle_epi8(x, mask);
+}
+__m256i inline Rotr16(__m256i x)
+{
+    const __m256i mask = _mm256_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+                                          2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+    return _mm256_shuffle_epi8(x, mask);
+}
+__m256i inline Rotr63(__m256i x) { return _mm256_or_si256(_mm256_srli_epi64(x, 63), _mm256_add_epi64(x, x)); }
+
+void inline G(__m256i& a, __m256i& b, __m256i& c, __m256i& d, __m256i x, __m256i y)
+{
+    a = Add(Add(a, b), x);
+    d = Rotr32(Xor(d, a));
+    c = Add(c, d);
+    b = Rotr24(Xor(b, c));
+    a = Add(Add(a, b), y);
+    d = Rotr16(Xor(d, a));
+    c = Add(c, d);
+    b = Rotr63(Xor(b, c));
+}
+
+} // namespace
+
+/**
+ * Finalize four messages that share the state h and differ only in the
+ * 32-bit little-endian word written at offset pos of the last block.
+ * t0/t1 is the byte counter including the last block.
+ */
+void FinalizeLE32_4way(const uint64_t* h, uint64_t t0, uint64_t t1,
+                       const unsigned char* block, size_t pos,
+                       const uint32_t* suffixes, unsigned char* out, size_t outlen)
+{
+    unsigned char blocks[4][BLOCK_SIZE];
+    for (int l = 0; l < 4; l++) {
+        memcpy(blocks[l], block, BLOCK_SIZE);
+        WriteLE32(blocks[l] + pos, suffixes[l]);
+    }
+
+    __m256i m[16];
+    for (int i = 0; i < 16; i++) {
+        m[i] = _mm256_set_epi64x(ReadLE64(blocks[3] + 8 * i), ReadLE64(blocks[2] + 8 * i),
+                                 ReadLE64(blocks[1] + 8 * i), ReadLE64(blocks[0] + 8 * i));
+    }
+
+    __m256i v[16];
+    for (int i = 0; i < 8; i++) {
+        v[i] = _mm256_set1_epi64x(h[i]);
+        v[i + 8] = _mm256_set1_epi64x(IV[i]);
+    }
+    v[12] = _mm256_set1_epi64x(IV[4] ^ t0);
+    v[13] = _mm256_set1_epi64x(IV[5] ^ t1);
+    v[14] = _mm256_set1_epi64x(~IV[6]);
+
+    for (int r = 0; r < 12; r++) {
+        const uint8_t* s = SIGMA[r];
+        G(v[0], v[4], v[8],  v[12], m[s[0]],  m[s[1]]);
+        G(v[1], v[5], v[9],  v[13], m[s[2]],  m[s[3]]);
+        G(v[2], v[6], v[10], v[14], m[s[4]],  m[s[5]]);
+        G(v[3], v[7], v[11], v[15], m[s[6]],  m[s[7]]);
+        G(v[0], v[5], v[10], v[15], m[s[8]],  m[s[9]]);
+        G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+        G(v[2], v[7], v[8],  v[13], m[s[12]], m[s[13]]);
+        G(v[3], v[4], v[9],  v[14], m[s[14]], m[s[15]]);
+    }
+
+    unsigned char result[4][64];
+    for (int i = 0; i < 8; i++) {
+        uint64_t words[4];
+        __m256i x = Xor(_mm256_set1_epi64x(h[i]), Xor(v[i], v[i + 8]));
+        _mm256_storeu_si256((__m256i*)words, x);
+        for (int l = 0; l < 4; l++) {
+            WriteLE64(result[l] + 8 * i, words[l]);
+        }
+    }
+    for (int l = 0; l < 4; l++) {
+        memcpy(out + l * outlen, result[l], outlen);
+    }
+}
+
+} // namespace blake2b_avx2
+
+#endif
@@ -0,0 +1,50 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_CPUID_H
+#define BITCOIN_CRYPTO_CPUID_H
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+#define HAVE_GETCPUID
+
+#include <cpuid.h>
+
+/** x86 instruction set extensions the crypto code can dispatch to at runtime. */
+struct CCPUFeatures
+{
+    bool sse41;
+    bool avx2;  //!< CPU support and YMM state saved by the OS
+    bool shani;
+};
+
+CCPUFeatures static inline DetectCPUFeatures()
+{
+    CCPUFeatures features = {false, false, false};
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t maxLeaf = __get_cpuid_max(0, nullptr);
+    if (maxLeaf < 1) {
+        return features;
+    }
+    __cpuid(1, eax, ebx, ecx, edx);
+    features.sse41 = (ecx >> 19) & 1;
+    // OSXSAVE and AVX must both be set before xgetbv may be used.
+    bool fAVX = false;
+    if (((ecx >> 27) & 1) && ((ecx >> 28) & 1)) {
+        uint32_t xcr0_lo, xcr0_hi;
+        __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+        fAVX = (xcr0_lo & 6) == 6;
+    }
+    if (maxLeaf >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        features.avx2 = fAVX && ((ebx >> 5) & 1);
+        features.shani = features.sse41 && ((ebx >> 29) & 1);
+    }
+    return features;
+}
+
+#endif // __x86_64__ || __amd64__ || __i386__
+
+#endif // BITCOIN_CRYPTO_CPUID_H
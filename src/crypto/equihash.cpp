@@ -18,6 +18,7 @@
 #endif
 
 #include "compat/endian.h"
+#include "crypto/blake2b.h"
 #include "crypto/equihash.h"
 #include "util.h"
 
@@ -56,6 +57,22 @@ void GenerateHash(const eh_HashState& base_state, eh_index g,
     crypto_generichash_blake2b_final(&state, hash, hLen);
 }
 
+// Hashes are generated EH_HASH_BATCH at a time where the indices are known up front.
+static const size_t EH_HASH_BATCH = 8;
+
+static void GenerateHashes(const eh_HashState& base_state, const CBLAKE2bMidstate& midstate,
+                           const eh_index* g, size_t count,
+                           unsigned char* hashes, size_t hLen)
+{
+    if (midstate.IsValid()) {
+        midstate.FinalizeLE32(g, count, hashes);
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        GenerateHash(base_state, g[i], hashes + i*hLen, hLen);
+    }
+}
+
 void ExpandArray(const unsigned char* in, size_t in_len,
                  unsigned char* out, size_t out_len,
                  size_t bit_len, size_t byte_pad)
@@ -339,12 +356,19 @@ bool Equihash<N,K>::BasicSolve(const eh_HashState& base_state,
     size_t lenIndices = sizeof(eh_index);
     std::vector<FullStepRow<FullWidth>> X;
     X.reserve(init_size);
-    unsigned char tmpHash[HashOutput];
-    for (eh_index g = 0; X.size() < init_size; g++) {
-        GenerateHash(base_state, g, tmpHash, HashOutput);
-        for (eh_index i = 0; i < IndicesPerHashOutput && X.size() < init_size; i++) {
-            X.emplace_back(tmpHash+(i*N/8), N/8, HashLength,
-                           CollisionBitLength, (g*IndicesPerHashOutput)+i);
+    CBLAKE2bMidstate midstate(base_state, HashOutput);
+    eh_index gs[EH_HASH_BATCH];
+    unsigned char tmpHash[EH_HASH_BATCH*HashOutput];
+    for (eh_index g = 0; X.size() < init_size; g += EH_HASH_BATCH) {
+        for (size_t b = 0; b < EH_HASH_BATCH; b++) {
+            gs[b] = g + b;
+        }
+        GenerateHashes(base_state, midstate, gs, EH_HASH_BATCH, tmpHash, HashOutput);
+        for (size_t b = 0; b < EH_HASH_BATCH && X.size() < init_size; b++) {
+            for (eh_index i = 0; i < IndicesPerHashOutput && X.size() < init_size; i++) {
+                X.emplace_back(tmpHash+(b*HashOutput)+(i*N/8), N/8, HashLength,
+                               CollisionBitLength, (gs[b]*IndicesPerHashOutput)+i);
+            }
         }
         if (cancelled(ListGeneration)) throw solver_cancelled;
     }
@@ -518,12 +542,19 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
         size_t lenIndices = sizeof(eh_trunc);
         std::vector<TruncatedStepRow<TruncatedWidth>> Xt;
         Xt.reserve(init_size);
-        unsigned char tmpHash[HashOutput];
-        for (eh_index g = 0; Xt.size() < init_size; g++) {
-            GenerateHash(base_state, g, tmpHash, HashOutput);
-            for (eh_index i = 0; i < IndicesPerHashOutput && Xt.size() < init_size; i++) {
-                Xt.emplace_back(tmpHash+(i*N/8), N/8, HashLength, CollisionBitLength,
-                                (g*IndicesPerHashOutput)+i, CollisionBitLength + 1);
+        CBLAKE2bMidstate midstate(base_state, HashOutput);
+        eh_index gs[EH_HASH_BATCH];
+        unsigned char tmpHash[EH_HASH_BATCH*HashOutput];
+        for (eh_index g = 0; Xt.size() < init_size; g += EH_HASH_BATCH) {
+            for (size_t b = 0; b < EH_HASH_BATCH; b++) {
+                gs[b] = g + b;
+            }
+            GenerateHashes(base_state, midstate, gs, EH_HASH_BATCH, tmpHash, HashOutput);
+            for (size_t b = 0; b < EH_HASH_BATCH && Xt.size() < init_size; b++) {
+                for (eh_index i = 0; i < IndicesPerHashOutput && Xt.size() < init_size; i++) {
+                    Xt.emplace_back(tmpHash+(b*HashOutput)+(i*N/8), N/8, HashLength, CollisionBitLength,
+                                    (gs[b]*IndicesPerHashOutput)+i, CollisionBitLength + 1);
+                }
             }
             if (cancelled(ListGeneration)) throw solver_cancelled;
         }
@@ -718,6 +749,259 @@ invalidsolution:
 
     return false;
 }
+
+/**
+ * Row used by the bucketed solver: the remaining collision bits of a partial
+ * solution followed by a reference into the previous round's pair table (or,
+ * in the first round, the leaf index itself). Full index lists are only
+ * rebuilt for candidate solutions, which keeps each row a few dozen bytes.
+ */
+template<size_t WIDTH>
+struct BucketRow
+{
+    unsigned char hash[WIDTH];
+    eh_index ref;
+};
+
+template<size_t LEN>
+struct CompareBucketRow
+{
+    template<size_t W>
+    inline bool operator()(const BucketRow<W>& a, const BucketRow<W>& b) const { return memcmp(a.hash, b.hash, LEN) < 0; }
+};
+
+typedef std::vector<std::pair<eh_index, eh_index>> BucketPairTable;
+
+// The top BBITS bits of the first collision block of a row.
+template<size_t CBYTES, size_t CBITS, size_t BBITS>
+inline size_t BucketKey(const unsigned char* hash)
+{
+    BOOST_STATIC_ASSERT(BBITS <= CBITS);
+    uint32_t v = 0;
+    for (size_t i = 0; i < CBYTES; i++)
+        v = (v << 8) | hash[i];
+    return v >> (CBITS - BBITS);
+}
+
+// Counting sort of in into out by bucket key; bucketStart[b] .. bucketStart[b+1]
+// delimits bucket b in out afterwards. All buffers keep their capacity between
+// rounds so that no allocation happens once the first round has run.
+template<size_t CBYTES, size_t CBITS, size_t BBITS, size_t WIDTH>
+void PartitionRows(const std::vector<BucketRow<WIDTH>>& in, std::vector<BucketRow<WIDTH>>& out,
+                   std::vector<uint32_t>& bucketStart, std::vector<uint32_t>& bucketPos)
+{
+    bucketStart.assign((1 << BBITS) + 1, 0);
+    for (const BucketRow<WIDTH>& row : in)
+        bucketStart[BucketKey<CBYTES, CBITS, BBITS>(row.hash) + 1]++;
+    for (size_t b = 0; b < (1 << BBITS); b++)
+        bucketStart[b+1] += bucketStart[b];
+    bucketPos.assign(bucketStart.begin(), bucketStart.end() - 1);
+    out.resize(in.size());
+    for (const BucketRow<WIDTH>& row : in)
+        out[bucketPos[BucketKey<CBYTES, CBITS, BBITS>(row.hash)]++] = row;
+}
+
+// Append the leaf indices below ref at the given level to out, ordering each
+// pair of subtrees so that the one with the smaller first index comes first.
+void ExpandBucketIndices(const std::vector<BucketPairTable>& pairs, size_t level,
+                         eh_index ref, std::vector<eh_index>& out)
+{
+    if (level == 0) {
+        out.push_back(ref);
+        return;
+    }
+    const std::pair<eh_index, eh_index>& p = pairs[level-1][ref];
+    size_t start = out.size();
+    ExpandBucketIndices(pairs, level-1, p.first, out);
+    size_t mid = out.size();
+    ExpandBucketIndices(pairs, level-1, p.second, out);
+    if (out[mid] < out[start])
+        std::rotate(out.begin()+start, out.begin()+mid, out.end());
+}
+
+// Whether the subtrees below a and b at the given level share no leaf index.
+bool DistinctBucketIndices(const std::vector<BucketPairTable>& pairs, size_t level,
+                           eh_index a, eh_index b, std::vector<eh_index>& scratch)
+{
+    scratch.clear();
+    ExpandBucketIndices(pairs, level, a, scratch);
+    ExpandBucketIndices(pairs, level, b, scratch);
+    std::sort(scratch.begin(), scratch.end());
+    return std::adjacent_find(scratch.begin(), scratch.end()) == scratch.end();
+}
+
+// The tables of BucketSolve, reused by every round and, through an
+// EhSolverArena, by later runs.
+template<size_t WIDTH>
+struct BucketTables
+{
+    // The rows of the current round, and the same rows partitioned into buckets
+    std::vector<BucketRow<WIDTH>> X;
+    std::vector<BucketRow<WIDTH>> Xb;
+    std::vector<uint32_t> bucketStart;
+    std::vector<uint32_t> bucketPos;
+    // pairs[r-1] holds the (left, right) references of the rows created in round r
+    std::vector<BucketPairTable> pairs;
+    std::vector<eh_index> scratch;
+};
+
+template<unsigned int N, unsigned int K>
+bool Equihash<N,K>::BucketSolve(const eh_HashState& base_state,
+                                const std::function<bool(std::vector<unsigned char>)> validBlock,
+                                const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                EhSolverArena* arena)
+{
+    // Rows are partitioned on the top BucketBits bits of their next collision
+    // block, so each bucket is small enough to be sorted within cache.
+    enum : size_t { BucketBits=CollisionBitLength < 12 ? CollisionBitLength : 12 };
+    typedef BucketRow<HashLength> Row;
+    typedef BucketTables<HashLength> Tables;
+
+    eh_index init_size { 1 << (CollisionBitLength + 1) };
+
+    std::shared_ptr<void> localTables;
+    if (!arena) {
+        localTables = std::make_shared<Tables>();
+    } else if (arena->n != N || arena->k != K || !arena->tables) {
+        arena->tables = std::make_shared<Tables>();
+        arena->n = N;
+        arena->k = K;
+    }
+    Tables& tables = *static_cast<Tables*>(arena ? arena->tables.get() : localTables.get());
+    std::vector<Row>& X = tables.X;
+    std::vector<Row>& Xb = tables.Xb;
+    std::vector<uint32_t>& bucketStart = tables.bucketStart;
+    std::vector<uint32_t>& bucketPos = tables.bucketPos;
+    std::vector<BucketPairTable>& pairs = tables.pairs;
+    std::vector<eh_index>& scratch = tables.scratch;
+    // Every row is written by the first list, so the previous contents need
+    // not be cleared.
+    X.resize(init_size);
+    Xb.reserve(init_size);
+    pairs.resize(K);
+    for (size_t r = 0; r < pairs.size(); r++)
+        pairs[r].clear();
+
+    // 1) Generate first list
+    LogPrint("pow", "Generating first list\n");
+    CBLAKE2bMidstate midstate(base_state, HashOutput);
+    eh_index gs[EH_HASH_BATCH];
+    unsigned char tmpHash[EH_HASH_BATCH*HashOutput];
+    for (eh_index g = 0; g*IndicesPerHashOutput < init_size; g += EH_HASH_BATCH) {
+        for (size_t b = 0; b < EH_HASH_BATCH; b++) {
+            gs[b] = g + b;
+        }
+        GenerateHashes(base_state, midstate, gs, EH_HASH_BATCH, tmpHash, HashOutput);
+        for (size_t b = 0; b < EH_HASH_BATCH && gs[b]*IndicesPerHashOutput < init_size; b++) {
+            for (eh_index i = 0; i < IndicesPerHashOutput && gs[b]*IndicesPerHashOutput+i < init_size; i++) {
+                Row& row = X[gs[b]*IndicesPerHashOutput+i];
+                ExpandArray(tmpHash+(b*HashOutput)+(i*N/8), N/8, row.hash, HashLength, CollisionBitLength);
+                row.ref = gs[b]*IndicesPerHashOutput+i;
+            }
+        }
+        if (cancelled(ListGeneration)) throw solver_cancelled;
+    }
+
+    // 3) Repeat step 2 until 2n/(k+1) bits remain
+    size_t hashLen = HashLength;
+    for (int r = 1; r < K && X.size() > 0; r++) {
+        LogPrint("pow", "Round %d:\n", r);
+        // 2a) Partition the list into buckets
+        LogPrint("pow", "- Partitioning list\n");
+        PartitionRows<CollisionByteLength, CollisionBitLength, BucketBits>(X, Xb, bucketStart, bucketPos);
+        if (cancelled(ListSorting)) throw solver_cancelled;
+
+        LogPrint("pow", "- Finding collisions\n");
+        X.clear();
+        BucketPairTable& P = pairs[r-1];
+        P.reserve(Xb.size());
+        for (size_t b = 0; b < (1 << BucketBits); b++) {
+            typename std::vector<Row>::iterator begin = Xb.begin() + bucketStart[b];
+            typename std::vector<Row>::iterator end = Xb.begin() + bucketStart[b+1];
+            if (end - begin < 2)
+                continue;
+            std::sort(begin, end, CompareBucketRow<CollisionByteLength>());
+
+            // 2b) Find next set of unordered pairs with collisions on the next n/(k+1) bits
+            for (typename std::vector<Row>::iterator i = begin; i < end - 1; ) {
+                typename std::vector<Row>::iterator j = i + 1;
+                while (j < end && memcmp(i->hash, j->hash, CollisionByteLength) == 0)
+                    j++;
+
+                // 2c) Calculate tuples (X_i ^ X_j, (i, j))
+                for (typename std::vector<Row>::iterator l = i; l < j - 1; l++) {
+                    for (typename std::vector<Row>::iterator m = l + 1; m < j; m++) {
+                        Row row;
+                        bool isZero = true;
+                        for (size_t x = CollisionByteLength; x < hashLen; x++) {
+                            row.hash[x-CollisionByteLength] = l->hash[x] ^ m->hash[x];
+                            isZero &= row.hash[x-CollisionByteLength] == 0;
+                        }
+                        // A zero remainder almost always means both sides were
+                        // built from the same indices.
+                        if (isZero && !DistinctBucketIndices(pairs, r-1, l->ref, m->ref, scratch))
+                            continue;
+                        row.ref = P.size();
+                        P.push_back(std::make_pair(l->ref, m->ref));
+                        X.push_back(row);
+                    }
+                }
+                i = j;
+            }
+            if (cancelled(ListColliding)) throw solver_cancelled;
+        }
+
+        hashLen -= CollisionByteLength;
+        if (cancelled(RoundEnd)) throw solver_cancelled;
+    }
+
+    // k+1) Find a collision on last 2n(k+1) bits
+    LogPrint("pow", "Final round:\n");
+    if (X.size() > 1) {
+        LogPrint("pow", "- Partitioning list\n");
+        PartitionRows<CollisionByteLength, CollisionBitLength, BucketBits>(X, Xb, bucketStart, bucketPos);
+        if (cancelled(FinalSorting)) throw solver_cancelled;
+        LogPrint("pow", "- Finding collisions\n");
+        std::vector<eh_index> indices;
+        indices.reserve(1 << K);
+        for (size_t b = 0; b < (1 << BucketBits); b++) {
+            typename std::vector<Row>::iterator begin = Xb.begin() + bucketStart[b];
+            typename std::vector<Row>::iterator end = Xb.begin() + bucketStart[b+1];
+            if (end - begin < 2)
+                continue;
+            std::sort(begin, end, CompareBucketRow<2*CollisionByteLength>());
+
+            for (typename std::vector<Row>::iterator i = begin; i < end - 1; ) {
+                typename std::vector<Row>::iterator j = i + 1;
+                while (j < end && memcmp(i->hash, j->hash, hashLen) == 0)
+                    j++;
+
+                for (typename std::vector<Row>::iterator l = i; l < j - 1; l++) {
+                    for (typename std::vector<Row>::iterator m = l + 1; m < j; m++) {
+                        if (!DistinctBucketIndices(pairs, K-1, l->ref, m->ref, scratch))
+                            continue;
+                        indices.clear();
+                        ExpandBucketIndices(pairs, K-1, l->ref, indices);
+                        size_t mid = indices.size();
+                        ExpandBucketIndices(pairs, K-1, m->ref, indices);
+                        if (indices[mid] < indices[0])
+                            std::rotate(indices.begin(), indices.begin()+mid, indices.end());
+                        auto soln = GetMinimalFromIndices(indices, CollisionBitLength);
+                        assert(soln.size() == equihash_solution_size(N, K));
+                        if (validBlock(soln)) {
+                            return true;
+                        }
+                    }
+                }
+                i = j;
+            }
+            if (cancelled(FinalColliding)) throw solver_cancelled;
+        }
+    } else
+        LogPrint("pow", "- List is empty\n");
+
+    return false;
+}
 #endif // ENABLE_MINING
 
 template<unsigned int N, unsigned int K>
@@ -729,43 +1013,77 @@ bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, std::vector<
         return false;
     }
 
-    std::vector<FullStepRow<FinalFullWidth>> X;
-    X.reserve(1 << K);
-    unsigned char tmpHash[HashOutput];
-    for (eh_index i : GetIndicesFromMinimal(soln, CollisionBitLength)) {
-        GenerateHash(base_state, i/IndicesPerHashOutput, tmpHash, HashOutput);
-        X.emplace_back(tmpHash+((i % IndicesPerHashOutput) * N/8),
-                       N/8, HashLength, CollisionBitLength, i);
-    }
+    std::vector<eh_index> indices = GetIndicesFromMinimal(soln, CollisionBitLength);
 
-    size_t hashLen = HashLength;
-    size_t lenIndices = sizeof(eh_index);
-    while (X.size() > 1) {
-        std::vector<FullStepRow<FinalFullWidth>> Xc;
-        for (int i = 0; i < X.size(); i += 2) {
-            if (!HasCollision(X[i], X[i+1], CollisionByteLength)) {
-                LogPrint("pow", "Invalid solution: invalid collision length between StepRows\n");
-                LogPrint("pow", "X[i]   = %s\n", X[i].GetHex(hashLen));
-                LogPrint("pow", "X[i+1] = %s\n", X[i+1].GetHex(hashLen));
-                return false;
-            }
-            if (X[i+1].IndicesBefore(X[i], hashLen, lenIndices)) {
+    // The checks on the indices alone come first, so that malformed
+    // solutions are turned down before anything is hashed. Once every index
+    // is known to be distinct, sibling subtrees are ordered by their first
+    // index, as comparing their index lists would find.
+    std::vector<eh_index> sorted(indices);
+    std::sort(sorted.begin(), sorted.end());
+    if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+        LogPrint("pow", "Invalid solution: duplicate indices\n");
+        return false;
+    }
+    for (size_t width = 1; width < indices.size(); width *= 2) {
+        for (size_t j = 0; j < indices.size(); j += 2*width) {
+            if (indices[j+width] < indices[j]) {
                 LogPrint("pow", "Invalid solution: Index tree incorrectly ordered\n");
                 return false;
             }
-            if (!DistinctIndices(X[i], X[i+1], hashLen, lenIndices)) {
-                LogPrint("pow", "Invalid solution: duplicate indices\n");
+        }
+    }
+
+    // The tree is then built leaf by leaf, each pair of subtrees merged as
+    // soon as both are complete, so the first failed collision ends the
+    // check. Hashes are generated in batches doubling in size, keeping the
+    // batched finalization without hashing far past a failure.
+    std::vector<eh_index> gs(indices.size());
+    for (size_t j = 0; j < indices.size(); j++) {
+        gs[j] = indices[j]/IndicesPerHashOutput;
+    }
+    std::vector<unsigned char> hashes(gs.size()*HashOutput);
+    CBLAKE2bMidstate midstate(base_state, HashOutput);
+    size_t nHashed = 0;
+
+    std::vector<FullStepRow<FinalFullWidth>> X;
+    std::vector<size_t> levels;
+    X.reserve(K+1);
+    levels.reserve(K+1);
+    for (size_t j = 0; j < indices.size(); j++) {
+        if (j == nHashed) {
+            size_t nBatch = std::min(indices.size() - nHashed, std::max<size_t>(2, nHashed));
+            GenerateHashes(base_state, midstate, gs.data()+nHashed, nBatch,
+                           hashes.data()+(nHashed*HashOutput), HashOutput);
+            nHashed += nBatch;
+        }
+        X.emplace_back(hashes.data()+(j*HashOutput)+((indices[j] % IndicesPerHashOutput) * N/8),
+                       N/8, HashLength, CollisionBitLength, indices[j]);
+        levels.push_back(0);
+
+        while (levels.size() > 1 && levels[levels.size()-1] == levels[levels.size()-2]) {
+            size_t level = levels.back();
+            size_t hashLen = HashLength - level*CollisionByteLength;
+            size_t lenIndices = sizeof(eh_index) << level;
+            FullStepRow<FinalFullWidth>& a = X[X.size()-2];
+            FullStepRow<FinalFullWidth>& b = X[X.size()-1];
+            if (!HasCollision(a, b, CollisionByteLength)) {
+                LogPrint("pow", "Invalid solution: invalid collision length between StepRows\n");
+                LogPrint("pow", "X[i]   = %s\n", a.GetHex(hashLen));
+                LogPrint("pow", "X[i+1] = %s\n", b.GetHex(hashLen));
                 return false;
             }
-            Xc.emplace_back(X[i], X[i+1], hashLen, lenIndices, CollisionByteLength);
+            FullStepRow<FinalFullWidth> merged(a, b, hashLen, lenIndices, CollisionByteLength);
+            X.pop_back();
+            X.pop_back();
+            X.push_back(merged);
+            levels.pop_back();
+            levels.back() = level + 1;
         }
-        X = Xc;
-        hashLen -= CollisionByteLength;
-        lenIndices *= 2;
     }
 
     assert(X.size() == 1);
-    return X[0].IsZero(hashLen);
+    return X[0].IsZero(HashLength - K*CollisionByteLength);
 }
 
 // Explicit instantiations for Equihash<96,3>
@@ -777,6 +1095,10 @@ template bool Equihash<96,3>::BasicSolve(const eh_HashState& base_state,
 template bool Equihash<96,3>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
+template bool Equihash<96,3>::BucketSolve(const eh_HashState& base_state,
+                                          const std::function<bool(std::vector<unsigned char>)> validBlock,
+                                          const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                          EhSolverArena* arena);
 #endif
 template bool Equihash<96,3>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
 
@@ -789,6 +1111,10 @@ template bool Equihash<200,9>::BasicSolve(const eh_HashState& base_state,
 template bool Equihash<200,9>::OptimisedSolve(const eh_HashState& base_state,
                                               const std::function<bool(std::vector<unsigned char>)> validBlock,
                                               const std::function<bool(EhSolverCancelCheck)> cancelled);
+template bool Equihash<200,9>::BucketSolve(const eh_HashState& base_state,
+                                           const std::function<bool(std::vector<unsigned char>)> validBlock,
+                                           const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                           EhSolverArena* arena);
 #endif
 template bool Equihash<200,9>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
 
@@ -801,6 +1127,10 @@ template bool Equihash<96,5>::BasicSolve(const eh_HashState& base_state,
 template bool Equihash<96,5>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
+template bool Equihash<96,5>::BucketSolve(const eh_HashState& base_state,
+                                          const std::function<bool(std::vector<unsigned char>)> validBlock,
+                                          const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                          EhSolverArena* arena);
 #endif
 template bool Equihash<96,5>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
 
@@ -813,6 +1143,10 @@ template bool Equihash<48,5>::BasicSolve(const eh_HashState& base_state,
 template bool Equihash<48,5>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
+template bool Equihash<48,5>::BucketSolve(const eh_HashState& base_state,
+                                          const std::function<bool(std::vector<unsigned char>)> validBlock,
+                                          const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                          EhSolverArena* arena);
 #endif
 template bool Equihash<48,5>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
 
@@ -825,6 +1159,10 @@ template bool Equihash<144,5>::BasicSolve(const eh_HashState& base_state,
 template bool Equihash<144,5>::OptimisedSolve(const eh_HashState& base_state,
                                               const std::function<bool(std::vector<unsigned char>)> validBlock,
                                               const std::function<bool(EhSolverCancelCheck)> cancelled);
+template bool Equihash<144,5>::BucketSolve(const eh_HashState& base_state,
+                                           const std::function<bool(std::vector<unsigned char>)> validBlock,
+                                           const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                           EhSolverArena* arena);
 #endif
 template bool Equihash<144,5>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
 
@@ -837,5 +1175,9 @@ template bool Equihash<192,7>::BasicSolve(const eh_HashState& base_state,
 template bool Equihash<192,7>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
+template bool Equihash<192,7>::BucketSolve(const eh_HashState& base_state,
+                                          const std::function<bool(std::vector<unsigned char>)> validBlock,
+                                          const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                          EhSolverArena* arena);
 #endif
 template bool Equihash<192,7>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
@@ -17,6 +17,7 @@
 #include <functional>
 #include <memory>
 #include <set>
+#include <stdexcept>
 #include <vector>
 
 #include <boost/static_assert.hpp>
@@ -160,6 +161,21 @@ inline constexpr size_t equihash_solution_size(unsigned int N, unsigned int K) {
     return (1 << K)*(N/(K+1)+1)/8;
 }
 
+/**
+ * Tables kept by one mining thread between runs of the bucketed solver, so
+ * that they are not allocated and faulted in again for every nonce. An arena
+ * must only be used by one solver run at a time; it is set up on first use
+ * for the parameters it is used with.
+ */
+struct EhSolverArena
+{
+    unsigned int n;
+    unsigned int k;
+    std::shared_ptr<void> tables;
+
+    EhSolverArena() : n(0), k(0) {}
+};
+
 template<unsigned int N, unsigned int K>
 class Equihash
 {
@@ -190,6 +206,10 @@ public:
     bool OptimisedSolve(const eh_HashState& base_state,
                         const std::function<bool(std::vector<unsigned char>)> validBlock,
                         const std::function<bool(EhSolverCancelCheck)> cancelled);
+    bool BucketSolve(const eh_HashState& base_state,
+                     const std::function<bool(std::vector<unsigned char>)> validBlock,
+                     const std::function<bool(EhSolverCancelCheck)> cancelled,
+                     EhSolverArena* arena = NULL);
 #endif
     bool IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
 };
@@ -276,6 +296,35 @@ inline bool EhOptimisedSolveUncancellable(unsigned int n, unsigned int k, const
     return EhOptimisedSolve(n, k, base_state, validBlock,
                             [](EhSolverCancelCheck pos) { return false; });
 }
+
+inline bool EhBucketSolve(unsigned int n, unsigned int k, const eh_HashState& base_state,
+                    const std::function<bool(std::vector<unsigned char>)> validBlock,
+                    const std::function<bool(EhSolverCancelCheck)> cancelled,
+                    EhSolverArena* arena = NULL)
+{
+    if (n == 96 && k == 3) {
+        return Eh96_3.BucketSolve(base_state, validBlock, cancelled, arena);
+    } else if (n == 200 && k == 9) {
+        return Eh200_9.BucketSolve(base_state, validBlock, cancelled, arena);
+    } else if (n == 96 && k == 5) {
+        return Eh96_5.BucketSolve(base_state, validBlock, cancelled, arena);
+    } else if (n == 48 && k == 5) {
+        return Eh48_5.BucketSolve(base_state, validBlock, cancelled, arena);
+    } else if (n == 144 && k == 5) {
+        return Eh144_5.BucketSolve(base_state, validBlock, cancelled, arena);
+    } else if (n == 192 && k == 7) {
+        return Eh192_7.BucketSolve(base_state, validBlock, cancelled, arena);
+    } else {
+        throw std::invalid_argument("Unsupported Equihash parameters");
+    }
+}
+
+inline bool EhBucketSolveUncancellable(unsigned int n, unsigned int k, const eh_HashState& base_state,
+                    const std::function<bool(std::vector<unsigned char>)> validBlock)
+{
+    return EhBucketSolve(n, k, base_state, validBlock,
+                         [](EhSolverCancelCheck pos) { return false; });
+}
 #endif // ENABLE_MINING
 
 #define EhIsValidSolution(n, k, base_state, soln, ret)   \
@@ -0,0 +1,179 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/muhash.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "crypto/sha512.h"
+
+#include <assert.h>
+#include <string.h>
+
+namespace {
+
+/** 2^3072 - MAX_PRIME_DIFF is the largest prime below 2^3072 */
+const uint32_t MAX_PRIME_DIFF = 1103717;
+
+/** Add x to r from limb i upwards. Returns the carry out of the top limb. */
+uint32_t AddCarry(uint32_t* r, int i, uint64_t x)
+{
+    for (; x && i < Num3072::LIMBS; i++) {
+        x += r[i];
+        r[i] = (uint32_t)x;
+        x >>= 32;
+    }
+    return (uint32_t)x;
+}
+
+} // namespace
+
+Num3072::Num3072()
+{
+    SetToOne();
+}
+
+Num3072::Num3072(const unsigned char (&data)[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; i++)
+        limbs[i] = ReadLE32(data + 4 * i);
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; i++)
+        limbs[i] = 0;
+}
+
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] < (uint32_t)(0 - MAX_PRIME_DIFF))
+        return false;
+    for (int i = 1; i < LIMBS; i++) {
+        if (limbs[i] != 0xffffffff)
+            return false;
+    }
+    return true;
+}
+
+void Num3072::FullReduce()
+{
+    // Subtracting the prime is adding MAX_PRIME_DIFF and dropping 2^3072
+    AddCarry(limbs, 0, MAX_PRIME_DIFF);
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    uint32_t tmp[2 * LIMBS];
+    memset(tmp, 0, sizeof(tmp));
+    for (int i = 0; i < LIMBS; i++) {
+        uint64_t carry = 0;
+        for (int j = 0; j < LIMBS; j++) {
+            uint64_t t = (uint64_t)limbs[i] * a.limbs[j] + tmp[i + j] + carry;
+            tmp[i + j] = (uint32_t)t;
+            carry = t >> 32;
+        }
+        tmp[i + LIMBS] = (uint32_t)carry;
+    }
+
+    // 2^3072 is MAX_PRIME_DIFF modulo the prime, so fold the high half in
+    uint64_t carry = 0;
+    for (int i = 0; i < LIMBS; i++) {
+        uint64_t t = (uint64_t)tmp[i + LIMBS] * MAX_PRIME_DIFF + tmp[i] + carry;
+        limbs[i] = (uint32_t)t;
+        carry = t >> 32;
+    }
+    // Fold what is left above 2^3072. A second fold only happens when the
+    // first wrapped around, leaving the low limbs small.
+    while (carry)
+        carry = AddCarry(limbs, 0, carry * MAX_PRIME_DIFF);
+    if (IsOverflow())
+        FullReduce();
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // Fermat: a^(p - 2) is the inverse of a. p - 2 has every bit set above
+    // the lowest limb.
+    uint32_t nLowLimb = (uint32_t)(0 - MAX_PRIME_DIFF - 2);
+    Num3072 result;
+    for (int i = LIMBS - 1; i >= 0; i--) {
+        uint32_t e = i == 0 ? nLowLimb : 0xffffffff;
+        for (int bit = 31; bit >= 0; bit--) {
+            result.Multiply(result);
+            if ((e >> bit) & 1)
+                result.Multiply(*this);
+        }
+    }
+    return result;
+}
+
+void Num3072::Divide(const Num3072& a)
+{
+    Multiply(a.GetInverse());
+}
+
+void Num3072::ToBytes(unsigned char (&out)[BYTE_SIZE]) const
+{
+    Num3072 tmp(*this);
+    if (tmp.IsOverflow())
+        tmp.FullReduce();
+    for (int i = 0; i < LIMBS; i++)
+        WriteLE32(out + 4 * i, tmp.limbs[i]);
+}
+
+Num3072 MuHash3072::ToNum3072(const unsigned char* data, size_t len)
+{
+    // Stretch the SHA256 of the element to 3072 bits with SHA512 in
+    // counter mode.
+    unsigned char key[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(key);
+    unsigned char buf[Num3072::BYTE_SIZE];
+    static_assert(Num3072::BYTE_SIZE % CSHA512::OUTPUT_SIZE == 0, "element expansion assumes whole SHA512 blocks");
+    for (uint32_t n = 0; n < Num3072::BYTE_SIZE / CSHA512::OUTPUT_SIZE; n++) {
+        unsigned char counter[4];
+        WriteLE32(counter, n);
+        CSHA512().Write(key, sizeof(key)).Write(counter, sizeof(counter)).Finalize(buf + n * CSHA512::OUTPUT_SIZE);
+    }
+    // Values of at least the prime are so rare that they are left as they
+    // are; Multiply reduces them.
+    return Num3072(buf);
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    numerator.Multiply(mul.numerator);
+    denominator.Multiply(mul.denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& div)
+{
+    numerator.Multiply(div.denominator);
+    denominator.Multiply(div.numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char out[32])
+{
+    numerator.Divide(denominator);
+    denominator.SetToOne();
+
+    unsigned char data[Num3072::BYTE_SIZE];
+    numerator.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(out);
+}
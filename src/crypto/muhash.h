@@ -0,0 +1,87 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** A number modulo the prime 2^3072 - 1103717, little endian in 32-bit limbs. */
+class Num3072
+{
+public:
+    static const size_t BYTE_SIZE = 384;
+    static const int LIMBS = 96;
+
+    uint32_t limbs[LIMBS];
+
+    //! Set to one
+    Num3072();
+    //! Read BYTE_SIZE little endian bytes
+    explicit Num3072(const unsigned char (&data)[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    //! Divide by a, which must not be zero modulo the prime
+    void Divide(const Num3072& a);
+    //! Write the fully reduced value as BYTE_SIZE little endian bytes
+    void ToBytes(unsigned char (&out)[BYTE_SIZE]) const;
+
+private:
+    bool IsOverflow() const;
+    void FullReduce();
+    Num3072 GetInverse() const;
+};
+
+/**
+ * An order-independent hash of a multiset of byte strings (MuHash, Clarke et
+ * al.). Each element is expanded to a number modulo a 3072-bit prime, and the
+ * set hash is their product, so elements can be added and removed one at a
+ * time in any order and two sets can be combined. Removals are accumulated in
+ * a separate denominator so that no inverse is needed until Finalize.
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    //! The hash of the empty set
+    MuHash3072() {}
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+
+    //! Combine with the set of another hash
+    MuHash3072& operator*=(const MuHash3072& mul);
+    //! Remove the set of another hash, which must be a subset
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    //! Write the SHA256 of the reduced set value to out. Costs an inverse.
+    void Finalize(unsigned char out[32]);
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        unsigned char buf[Num3072::BYTE_SIZE];
+        numerator.ToBytes(buf);
+        s.write((const char*)buf, Num3072::BYTE_SIZE);
+        denominator.ToBytes(buf);
+        s.write((const char*)buf, Num3072::BYTE_SIZE);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        unsigned char buf[Num3072::BYTE_SIZE];
+        s.read((char*)buf, Num3072::BYTE_SIZE);
+        numerator = Num3072(buf);
+        s.read((char*)buf, Num3072::BYTE_SIZE);
+        denominator = Num3072(buf);
+    }
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
@@ -0,0 +1,245 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CUCKOOCACHE_H
+#define BITCOIN_CUCKOOCACHE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+/**
+ * A fixed-size cache of hashes, laid out as a cuckoo hash table: each element
+ * may live in one of eight slots picked by its hashes, and inserting into a
+ * full set of slots moves a resident to another of its own slots.
+ *
+ * Nothing is allocated per element, and lookups only read the table, so
+ * readers can share a lock with each other. The only thing a lookup writes is
+ * the per-slot "may be erased" flag, which is atomic so that a reader can mark
+ * an element it has used up. Eviction is by generation: once enough of the
+ * current generation's elements are in the table, every element of the
+ * previous generation becomes erasable and insertion overwrites those first.
+ */
+namespace CuckooCache
+{
+
+/** Bits, one per slot, that can be set and cleared from several threads */
+class bit_packed_atomic_flags
+{
+    std::unique_ptr<std::atomic<uint8_t>[]> mem;
+
+public:
+    //! All bits start set, meaning every slot is free
+    explicit bit_packed_atomic_flags(uint32_t size)
+    {
+        size = (size + 7) / 8;
+        mem.reset(new std::atomic<uint8_t>[size]);
+        for (uint32_t i = 0; i < size; ++i)
+            mem[i].store(0xFF);
+    }
+
+    //! Replace the bits with b fresh, set ones. Not thread safe.
+    void setup(uint32_t b)
+    {
+        bit_packed_atomic_flags d(b);
+        std::swap(mem, d.mem);
+    }
+
+    void bit_set(uint32_t s)
+    {
+        mem[s >> 3].fetch_or(1 << (s & 7), std::memory_order_relaxed);
+    }
+
+    void bit_unset(uint32_t s)
+    {
+        mem[s >> 3].fetch_and(~(1 << (s & 7)), std::memory_order_relaxed);
+    }
+
+    bool bit_is_set(uint32_t s) const
+    {
+        return (1 << (s & 7)) & mem[s >> 3].load(std::memory_order_relaxed);
+    }
+};
+
+/**
+ * Hash for 256-bit elements that are already uniformly random, such as
+ * salted digests: the eight hashes are just the element's eight words.
+ */
+class random_blob_hasher
+{
+public:
+    template <uint8_t hash_select, typename Blob>
+    uint32_t operator()(const Blob& key) const
+    {
+        static_assert(hash_select < 8, "random_blob_hasher only has 8 hashes available");
+        uint32_t u;
+        memcpy(&u, key.begin() + 4 * hash_select, 4);
+        return u;
+    }
+};
+
+/**
+ * The cache. Hash must provide template<uint8_t n> uint32_t operator()(const
+ * Element&) const returning eight independent hashes; for elements that are
+ * already uniformly random, such as salted digests, these can just be parts
+ * of the element.
+ *
+ * contains() may run concurrently with other contains() calls, but not with
+ * insert() or setup(), so callers guard the cache with a shared mutex taken
+ * exclusively for those.
+ */
+template <typename Element, typename Hash>
+class cache
+{
+private:
+    std::vector<Element> table;
+    uint32_t size;
+    //! Set for slots that are free or whose element may be overwritten
+    mutable bit_packed_atomic_flags collection_flags;
+    //! Set for slots holding an element of the current generation
+    std::vector<bool> epoch_flags;
+    //! Insertions left before the generation is next checked
+    uint32_t epoch_heuristic_counter;
+    //! Current-generation elements that start the next generation
+    uint32_t epoch_size;
+    //! Moves an insertion may make before dropping the element it holds
+    uint8_t depth_limit;
+    const Hash hash_function;
+
+    std::array<uint32_t, 8> compute_hashes(const Element& e) const
+    {
+        // Multiply-shift maps a 32-bit hash onto [0, size) without a division
+        return {{(uint32_t)(((uint64_t)hash_function.template operator()<0>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)(((uint64_t)hash_function.template operator()<1>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)(((uint64_t)hash_function.template operator()<2>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)(((uint64_t)hash_function.template operator()<3>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)(((uint64_t)hash_function.template operator()<4>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)(((uint64_t)hash_function.template operator()<5>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)(((uint64_t)hash_function.template operator()<6>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)(((uint64_t)hash_function.template operator()<7>(e) * (uint64_t)size) >> 32)}};
+    }
+
+    static uint32_t invalid() { return ~(uint32_t)0; }
+
+    void allow_erase(uint32_t n) const { collection_flags.bit_set(n); }
+    void please_keep(uint32_t n) const { collection_flags.bit_unset(n); }
+
+    /**
+     * Start a new generation once epoch_size live elements belong to the
+     * current one. Counting them scans the table, so the scan is only
+     * repeated after about as many insertions as are still needed.
+     */
+    void epoch_check()
+    {
+        if (epoch_heuristic_counter != 0) {
+            --epoch_heuristic_counter;
+            return;
+        }
+        uint32_t epoch_unused_count = 0;
+        for (uint32_t i = 0; i < size; ++i)
+            epoch_unused_count += epoch_flags[i] && !collection_flags.bit_is_set(i);
+        if (epoch_unused_count >= epoch_size) {
+            for (uint32_t i = 0; i < size; ++i) {
+                if (epoch_flags[i]) {
+                    epoch_flags[i] = false;
+                } else {
+                    allow_erase(i);
+                }
+            }
+            epoch_heuristic_counter = epoch_size;
+        } else {
+            epoch_heuristic_counter = std::max(1u, std::max(epoch_size / 16,
+                        epoch_size - std::min(epoch_size, epoch_unused_count)));
+        }
+    }
+
+public:
+    cache() : table(), size(), collection_flags(0), epoch_flags(),
+              epoch_heuristic_counter(), epoch_size(), depth_limit(0), hash_function() {}
+
+    //! Make room for new_size elements (at least 2), dropping any held. Returns the size.
+    uint32_t setup(uint32_t new_size)
+    {
+        size = std::max<uint32_t>(2, new_size);
+        depth_limit = static_cast<uint8_t>(std::log2(static_cast<float>(size)));
+        table.assign(size, Element());
+        collection_flags.setup(size);
+        epoch_flags.assign(size, false);
+        // A generation holds 45% of the table, so two fit with room to move elements
+        epoch_size = std::max<uint32_t>(1, (uint64_t)45 * size / 100);
+        epoch_heuristic_counter = epoch_size;
+        return size;
+    }
+
+    //! As setup, for as many elements as fit in bytes. Returns the number of elements.
+    uint32_t setup_bytes(size_t bytes)
+    {
+        return setup(std::min<size_t>(bytes / sizeof(Element), 0xffffffff));
+    }
+
+    /**
+     * Insert e, overwriting a free or erasable slot if one of its own is. If
+     * not, residents are moved to their other slots, up to depth_limit
+     * times, and the one held at the end is dropped: the table is a cache,
+     * so losing an old element is acceptable.
+     */
+    void insert(Element e)
+    {
+        epoch_check();
+        uint32_t last_loc = invalid();
+        bool last_epoch = true;
+        std::array<uint32_t, 8> locs = compute_hashes(e);
+        for (const uint32_t loc : locs) {
+            if (table[loc] == e) {
+                please_keep(loc);
+                epoch_flags[loc] = last_epoch;
+                return;
+            }
+        }
+        for (uint8_t depth = 0; depth < depth_limit; ++depth) {
+            for (const uint32_t loc : locs) {
+                if (!collection_flags.bit_is_set(loc))
+                    continue;
+                table[loc] = std::move(e);
+                please_keep(loc);
+                epoch_flags[loc] = last_epoch;
+                return;
+            }
+            // Move into the slot after the one the held element came from,
+            // so that two elements don't keep swapping the same slot
+            last_loc = locs[(1 + (std::find(locs.begin(), locs.end(), last_loc) - locs.begin())) & 7];
+            std::swap(table[last_loc], e);
+            bool epoch = last_epoch;
+            last_epoch = epoch_flags[last_loc];
+            epoch_flags[last_loc] = epoch;
+            locs = compute_hashes(e);
+        }
+    }
+
+    /**
+     * Whether e is in the cache. With erase, its slot is also marked as
+     * overwritable, for elements that won't be looked up again.
+     */
+    bool contains(const Element& e, const bool erase) const
+    {
+        std::array<uint32_t, 8> locs = compute_hashes(e);
+        for (const uint32_t loc : locs) {
+            if (table[loc] == e) {
+                if (erase)
+                    allow_erase(loc);
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+} // namespace CuckooCache
+
+#endif // BITCOIN_CUCKOOCACHE_H
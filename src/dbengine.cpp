@@ -0,0 +1,633 @@
+// Copyright (c) 2012-2014 The Bitcoin Core developers
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "dbengine.h"
+
+#include "dbwrapper.h"
+#include "tinyformat.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <leveldb/cache.h>
+#include <leveldb/db.h>
+#include <leveldb/env.h>
+#include <leveldb/filter_policy.h>
+#include <memenv.h>
+
+#ifdef USE_LMDB
+#include <lmdb.h>
+#endif
+
+#include <atomic>
+#include <sstream>
+#include <vector>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+/** Block cache that counts lookups, on top of LevelDB's LRU cache */
+class CCountingCache : public leveldb::Cache
+{
+private:
+    leveldb::Cache* pcache;
+    std::atomic<uint64_t>& nHits;
+    std::atomic<uint64_t>& nMisses;
+
+public:
+    CCountingCache(leveldb::Cache* pcacheIn, std::atomic<uint64_t>& nHitsIn, std::atomic<uint64_t>& nMissesIn) :
+        pcache(pcacheIn), nHits(nHitsIn), nMisses(nMissesIn) {}
+    ~CCountingCache() { delete pcache; }
+
+    Handle* Insert(const leveldb::Slice& key, void* value, size_t charge,
+                   void (*deleter)(const leveldb::Slice& key, void* value)) {
+        return pcache->Insert(key, value, charge, deleter);
+    }
+    Handle* Lookup(const leveldb::Slice& key) {
+        Handle* handle = pcache->Lookup(key);
+        if (handle)
+            nHits++;
+        else
+            nMisses++;
+        return handle;
+    }
+    void Release(Handle* handle) { pcache->Release(handle); }
+    void* Value(Handle* handle) { return pcache->Value(handle); }
+    void Erase(const leveldb::Slice& key) { pcache->Erase(key); }
+    uint64_t NewId() { return pcache->NewId(); }
+};
+
+/** Sends LevelDB's info log to debug.log, counting the compactions in it */
+class CBitcoinLevelDBLogger : public leveldb::Logger
+{
+private:
+    std::atomic<uint64_t>& nCompactions;
+
+public:
+    CBitcoinLevelDBLogger(std::atomic<uint64_t>& nCompactionsIn) : nCompactions(nCompactionsIn) {}
+
+    void Logv(const char* format, va_list ap) {
+        // Every compaction, but not a trivial move of a file to the next
+        // level, ends with this message.
+        if (strncmp(format, "Compacted ", 10) == 0)
+            nCompactions++;
+        if (!LogAcceptCategory("leveldb"))
+            return;
+        char buffer[500];
+        int n = vsnprintf(buffer, sizeof(buffer), format, ap);
+        if (n < 0)
+            return;
+        LogPrintf("leveldb: %s%s\n", buffer, n >= (int)sizeof(buffer) ? "..." : "");
+    }
+};
+
+leveldb::Options GetLevelDBOptions(size_t nCacheSize, const CDBOptions& dbOptions)
+{
+    leveldb::Options options;
+    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
+    if (dbOptions.nWriteBufferSize)
+        options.write_buffer_size = dbOptions.nWriteBufferSize;
+    else
+        options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+    options.block_size = dbOptions.nBlockSize;
+    if (dbOptions.nBloomBits > 0)
+        options.filter_policy = leveldb::NewBloomFilterPolicy(dbOptions.nBloomBits);
+    options.compression = leveldb::kNoCompression;
+    options.max_open_files = 64;
+    if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
+        // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
+        // on corruption in later versions.
+        options.paranoid_checks = true;
+    }
+    return options;
+}
+
+class CLevelDBSnapshot : public CDBEngineSnapshot
+{
+public:
+    leveldb::DB* pdb;
+    const leveldb::Snapshot* psnapshot;
+
+    explicit CLevelDBSnapshot(leveldb::DB* pdbIn) : pdb(pdbIn), psnapshot(pdbIn->GetSnapshot()) {}
+    ~CLevelDBSnapshot() { pdb->ReleaseSnapshot(psnapshot); }
+};
+
+class CLevelDBIterator : public CDBEngineIterator
+{
+private:
+    leveldb::Iterator* piter;
+
+public:
+    explicit CLevelDBIterator(leveldb::Iterator* piterIn) : piter(piterIn) {}
+    ~CLevelDBIterator() { delete piter; }
+
+    bool Valid() const { return piter->Valid(); }
+    void SeekToFirst() { piter->SeekToFirst(); }
+    void Seek(const leveldb::Slice& key) { piter->Seek(key); }
+    void Next() { piter->Next(); }
+    leveldb::Slice key() const { return piter->key(); }
+    leveldb::Slice value() const { return piter->value(); }
+};
+
+class CLevelDBEngine : public CDBEngine
+{
+private:
+    //! custom environment this database is using (may be NULL in case of default environment)
+    leveldb::Env* penv;
+
+    //! database options used
+    leveldb::Options options;
+
+    //! options used when reading from the database
+    leveldb::ReadOptions readoptions;
+
+    //! options used when iterating over values of the database
+    leveldb::ReadOptions iteroptions;
+
+    //! options used when writing to the database
+    leveldb::WriteOptions writeoptions;
+
+    //! options used when sync writing to the database
+    leveldb::WriteOptions syncoptions;
+
+    //! the database itself
+    leveldb::DB* pdb;
+
+    //! block cache lookups and compactions, counted for GetStats()
+    std::atomic<uint64_t> nCacheHits;
+    std::atomic<uint64_t> nCacheMisses;
+    std::atomic<uint64_t> nCompactions;
+
+    const leveldb::Snapshot* GetSnapshot(const CDBEngineSnapshot* snapshot) const
+    {
+        return snapshot ? static_cast<const CLevelDBSnapshot*>(snapshot)->psnapshot : NULL;
+    }
+
+public:
+    CLevelDBEngine(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, const CDBOptions& dbOptions) :
+        penv(NULL), nCacheHits(0), nCacheMisses(0), nCompactions(0)
+    {
+        readoptions.verify_checksums = true;
+        iteroptions.verify_checksums = true;
+        iteroptions.fill_cache = false;
+        syncoptions.sync = true;
+        options = GetLevelDBOptions(nCacheSize, dbOptions);
+        options.block_cache = new CCountingCache(options.block_cache, nCacheHits, nCacheMisses);
+        options.info_log = new CBitcoinLevelDBLogger(nCompactions);
+        options.create_if_missing = true;
+        if (fMemory) {
+            penv = leveldb::NewMemEnv(leveldb::Env::Default());
+            options.env = penv;
+        } else {
+            TryCreateDirectory(path);
+            LogPrintf("Opening LevelDB in %s\n", path.string());
+        }
+        leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
+        dbwrapper_private::HandleError(status);
+        LogPrintf("Opened LevelDB successfully\n");
+    }
+
+    ~CLevelDBEngine()
+    {
+        delete pdb;
+        pdb = NULL;
+        delete options.filter_policy;
+        options.filter_policy = NULL;
+        delete options.block_cache;
+        options.block_cache = NULL;
+        delete options.info_log;
+        options.info_log = NULL;
+        delete penv;
+        options.env = NULL;
+    }
+
+    const char* GetName() const { return "leveldb"; }
+
+    leveldb::Status Get(const leveldb::Slice& key, std::string* value, const CDBEngineSnapshot* snapshot) const
+    {
+        leveldb::ReadOptions options = readoptions;
+        options.snapshot = GetSnapshot(snapshot);
+        return pdb->Get(options, key, value);
+    }
+
+    leveldb::Status Write(leveldb::WriteBatch& batch, bool fSync)
+    {
+        return pdb->Write(fSync ? syncoptions : writeoptions, &batch);
+    }
+
+    CDBEngineIterator* NewIterator(const CDBEngineSnapshot* snapshot) const
+    {
+        leveldb::ReadOptions options = iteroptions;
+        options.snapshot = GetSnapshot(snapshot);
+        return new CLevelDBIterator(pdb->NewIterator(options));
+    }
+
+    CDBEngineSnapshot* NewSnapshot() const
+    {
+        return new CLevelDBSnapshot(pdb);
+    }
+
+    void CompactRange(const leveldb::Slice& begin, const leveldb::Slice& end) const
+    {
+        pdb->CompactRange(&begin, &end);
+    }
+
+    uint64_t EstimateSize(const leveldb::Slice& begin, const leveldb::Slice& end) const
+    {
+        uint64_t size = 0;
+        leveldb::Range range(begin, end);
+        pdb->GetApproximateSizes(&range, 1, &size);
+        return size;
+    }
+
+    void GetStats(CDBStats& stats) const
+    {
+        stats.nCacheHits = nCacheHits;
+        stats.nCacheMisses = nCacheMisses;
+        stats.nCompactions = nCompactions;
+        stats.dCompactionTime = 0;
+        if (!pdb->GetProperty("leveldb.stats", &stats.strEngineStats))
+            stats.strEngineStats.clear();
+
+        // Sum the Time(sec) column over the per-level rows of the table.
+        std::istringstream ss(stats.strEngineStats);
+        std::string strLine;
+        while (std::getline(ss, strLine)) {
+            int nLevel, nFiles;
+            double dSize, dTime;
+            if (sscanf(strLine.c_str(), "%d %d %lf %lf", &nLevel, &nFiles, &dSize, &dTime) == 4)
+                stats.dCompactionTime += dTime;
+        }
+    }
+};
+
+#ifdef USE_LMDB
+
+leveldb::Status LMDBStatus(int rc)
+{
+    switch (rc) {
+    case MDB_SUCCESS:
+        return leveldb::Status::OK();
+    case MDB_NOTFOUND:
+        return leveldb::Status::NotFound(mdb_strerror(rc));
+    case MDB_CORRUPTED:
+    case MDB_PAGE_NOTFOUND:
+    case MDB_INVALID:
+    case MDB_VERSION_MISMATCH:
+        return leveldb::Status::Corruption(mdb_strerror(rc));
+    default:
+        return leveldb::Status::IOError(mdb_strerror(rc));
+    }
+}
+
+void HandleLMDBError(int rc)
+{
+    dbwrapper_private::HandleError(LMDBStatus(rc));
+}
+
+MDB_val ToMDBVal(const leveldb::Slice& slice)
+{
+    MDB_val val;
+    val.mv_size = slice.size();
+    val.mv_data = const_cast<char*>(slice.data());
+    return val;
+}
+
+leveldb::Slice ToSlice(const MDB_val& val)
+{
+    return leveldb::Slice((const char*)val.mv_data, val.mv_size);
+}
+
+/**
+ * A read transaction. With MDB_NOTLS it may move between threads, but it and
+ * its cursors must only be used by one thread at a time, so every use of a
+ * snapshot shared between threads takes its lock.
+ */
+class CLMDBSnapshot : public CDBEngineSnapshot
+{
+public:
+    MDB_txn* ptxn;
+    mutable boost::mutex cs;
+
+    explicit CLMDBSnapshot(MDB_env* penv)
+    {
+        HandleLMDBError(mdb_txn_begin(penv, NULL, MDB_RDONLY, &ptxn));
+    }
+    ~CLMDBSnapshot() { mdb_txn_abort(ptxn); }
+};
+
+class CLMDBIterator : public CDBEngineIterator
+{
+private:
+    //! Set when the iterator made its own transaction rather than using a snapshot's
+    CLMDBSnapshot* pownsnapshot;
+    const CLMDBSnapshot* psnapshot;
+    MDB_cursor* pcursor;
+    MDB_val mvKey;
+    MDB_val mvValue;
+    bool fValid;
+
+    void Move(MDB_cursor_op op)
+    {
+        boost::unique_lock<boost::mutex> lock(psnapshot->cs);
+        int rc = mdb_cursor_get(pcursor, &mvKey, &mvValue, op);
+        fValid = rc == MDB_SUCCESS;
+        if (rc != MDB_NOTFOUND)
+            HandleLMDBError(rc);
+    }
+
+public:
+    CLMDBIterator(MDB_env* penv, MDB_dbi dbi, const CLMDBSnapshot* snapshot) : pownsnapshot(NULL), fValid(false)
+    {
+        if (!snapshot)
+            snapshot = pownsnapshot = new CLMDBSnapshot(penv);
+        psnapshot = snapshot;
+        int rc;
+        {
+            boost::unique_lock<boost::mutex> lock(psnapshot->cs);
+            rc = mdb_cursor_open(psnapshot->ptxn, dbi, &pcursor);
+        }
+        if (rc != MDB_SUCCESS) {
+            delete pownsnapshot;
+            HandleLMDBError(rc);
+        }
+    }
+
+    ~CLMDBIterator()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(psnapshot->cs);
+            // Cursors of read transactions are not freed with the transaction
+            mdb_cursor_close(pcursor);
+        }
+        delete pownsnapshot;
+    }
+
+    bool Valid() const { return fValid; }
+    void SeekToFirst() { Move(MDB_FIRST); }
+
+    void Seek(const leveldb::Slice& key)
+    {
+        // LMDB has no empty keys, and every key sorts after the empty one
+        if (key.empty())
+            return Move(MDB_FIRST);
+        mvKey = ToMDBVal(key);
+        Move(MDB_SET_RANGE);
+    }
+
+    void Next() { Move(MDB_NEXT); }
+    leveldb::Slice key() const { return ToSlice(mvKey); }
+    leveldb::Slice value() const { return ToSlice(mvValue); }
+};
+
+/** Applies the changes of a leveldb::WriteBatch to an LMDB write transaction */
+class CLMDBBatchWriter : public leveldb::WriteBatch::Handler
+{
+private:
+    MDB_txn* ptxn;
+    MDB_dbi dbi;
+
+public:
+    //! The first error, after which further changes are skipped
+    int rc;
+
+    CLMDBBatchWriter(MDB_txn* ptxnIn, MDB_dbi dbiIn) : ptxn(ptxnIn), dbi(dbiIn), rc(MDB_SUCCESS) {}
+
+    void Put(const leveldb::Slice& key, const leveldb::Slice& value)
+    {
+        if (rc != MDB_SUCCESS)
+            return;
+        MDB_val mvKey = ToMDBVal(key), mvValue = ToMDBVal(value);
+        rc = mdb_put(ptxn, dbi, &mvKey, &mvValue, 0);
+    }
+
+    void Delete(const leveldb::Slice& key)
+    {
+        if (rc != MDB_SUCCESS)
+            return;
+        MDB_val mvKey = ToMDBVal(key);
+        rc = mdb_del(ptxn, dbi, &mvKey, NULL);
+        if (rc == MDB_NOTFOUND)
+            rc = MDB_SUCCESS;
+    }
+};
+
+/**
+ * LMDB keeps the whole database in one memory-mapped B+tree, so reads take
+ * no lock, don't contend with the writer and are served from the OS page
+ * cache rather than a block cache of their own. It has no compactions: the
+ * pages of erased entries are reused by later writes.
+ */
+class CLMDBEngine : public CDBEngine
+{
+private:
+    MDB_env* penv;
+    MDB_dbi dbi;
+
+    //! Reset read transactions, renewed for each read rather than begun anew
+    mutable boost::mutex cs_readers;
+    mutable std::vector<MDB_txn*> vReaders;
+
+    //! Address space reserved for the map; it's only backed by disk as it fills
+    static const size_t MAP_SIZE = sizeof(void*) >= 8 ? ((size_t)1 << 40) : ((size_t)1 << 30);
+    //! Concurrent read transactions, including those of iterators and snapshots
+    static const unsigned int MAX_READERS = 512;
+
+public:
+    CLMDBEngine(const boost::filesystem::path& path) : penv(NULL)
+    {
+        TryCreateDirectory(path);
+        LogPrintf("Opening LMDB in %s\n", path.string());
+        HandleLMDBError(mdb_env_create(&penv));
+        int rc = mdb_env_set_mapsize(penv, MAP_SIZE);
+        if (rc == MDB_SUCCESS)
+            rc = mdb_env_set_maxreaders(penv, MAX_READERS);
+        // Transactions aren't tied to threads, as CDBWrapper users hand
+        // iterators and snapshots to other threads. Commits sync the data
+        // but not the meta page, so a crash loses at most the last commit.
+        if (rc == MDB_SUCCESS)
+            rc = mdb_env_open(penv, path.string().c_str(), MDB_NOTLS | MDB_NOMETASYNC, 0644);
+        MDB_txn* ptxn = NULL;
+        if (rc == MDB_SUCCESS)
+            rc = mdb_txn_begin(penv, NULL, 0, &ptxn);
+        if (rc == MDB_SUCCESS) {
+            rc = mdb_dbi_open(ptxn, NULL, 0, &dbi);
+            if (rc == MDB_SUCCESS)
+                rc = mdb_txn_commit(ptxn);
+            else
+                mdb_txn_abort(ptxn);
+        }
+        if (rc != MDB_SUCCESS) {
+            mdb_env_close(penv);
+            HandleLMDBError(rc);
+        }
+        LogPrintf("Opened LMDB successfully\n");
+    }
+
+    ~CLMDBEngine()
+    {
+        for (MDB_txn* ptxn : vReaders)
+            mdb_txn_abort(ptxn);
+        mdb_env_close(penv);
+    }
+
+    const char* GetName() const { return "lmdb"; }
+
+    leveldb::Status Get(const leveldb::Slice& key, std::string* value, const CDBEngineSnapshot* snapshot) const
+    {
+        MDB_val mvKey = ToMDBVal(key), mvValue;
+        if (snapshot) {
+            const CLMDBSnapshot* psnapshot = static_cast<const CLMDBSnapshot*>(snapshot);
+            boost::unique_lock<boost::mutex> lock(psnapshot->cs);
+            int rc = mdb_get(psnapshot->ptxn, dbi, &mvKey, &mvValue);
+            if (rc == MDB_SUCCESS)
+                value->assign((const char*)mvValue.mv_data, mvValue.mv_size);
+            return LMDBStatus(rc);
+        }
+
+        MDB_txn* ptxn = NULL;
+        {
+            boost::unique_lock<boost::mutex> lock(cs_readers);
+            if (!vReaders.empty()) {
+                ptxn = vReaders.back();
+                vReaders.pop_back();
+            }
+        }
+        int rc;
+        if (ptxn) {
+            rc = mdb_txn_renew(ptxn);
+            if (rc != MDB_SUCCESS)
+                mdb_txn_abort(ptxn);
+        } else {
+            rc = mdb_txn_begin(penv, NULL, MDB_RDONLY, &ptxn);
+        }
+        if (rc != MDB_SUCCESS)
+            return LMDBStatus(rc);
+        rc = mdb_get(ptxn, dbi, &mvKey, &mvValue);
+        if (rc == MDB_SUCCESS)
+            value->assign((const char*)mvValue.mv_data, mvValue.mv_size);
+        mdb_txn_reset(ptxn);
+        boost::unique_lock<boost::mutex> lock(cs_readers);
+        vReaders.push_back(ptxn);
+        return LMDBStatus(rc);
+    }
+
+    leveldb::Status Write(leveldb::WriteBatch& batch, bool fSync)
+    {
+        MDB_txn* ptxn;
+        int rc = mdb_txn_begin(penv, NULL, 0, &ptxn);
+        if (rc != MDB_SUCCESS)
+            return LMDBStatus(rc);
+        CLMDBBatchWriter writer(ptxn, dbi);
+        leveldb::Status status = batch.Iterate(&writer);
+        if (!status.ok() || writer.rc != MDB_SUCCESS) {
+            mdb_txn_abort(ptxn);
+            return status.ok() ? LMDBStatus(writer.rc) : status;
+        }
+        rc = mdb_txn_commit(ptxn);
+        if (rc == MDB_SUCCESS && fSync)
+            rc = mdb_env_sync(penv, 1);
+        return LMDBStatus(rc);
+    }
+
+    CDBEngineIterator* NewIterator(const CDBEngineSnapshot* snapshot) const
+    {
+        return new CLMDBIterator(penv, dbi, static_cast<const CLMDBSnapshot*>(snapshot));
+    }
+
+    CDBEngineSnapshot* NewSnapshot() const
+    {
+        return new CLMDBSnapshot(penv);
+    }
+
+    void CompactRange(const leveldb::Slice& begin, const leveldb::Slice& end) const {}
+
+    //! Nothing to compact, so no range is worth compacting
+    uint64_t EstimateSize(const leveldb::Slice& begin, const leveldb::Slice& end) const { return 0; }
+
+    void GetStats(CDBStats& stats) const
+    {
+        MDB_stat stat;
+        MDB_envinfo info;
+        if (mdb_env_stat(penv, &stat) != MDB_SUCCESS || mdb_env_info(penv, &info) != MDB_SUCCESS) {
+            stats.strEngineStats.clear();
+            return;
+        }
+        stats.strEngineStats = strprintf(
+            "entries: %u\ndepth: %u\npage size: %u\nbranch pages: %u\nleaf pages: %u\noverflow pages: %u\n"
+            "last page: %u\nmap size: %u\nreaders: %u/%u\n",
+            (uint64_t)stat.ms_entries, stat.ms_depth, stat.ms_psize, (uint64_t)stat.ms_branch_pages,
+            (uint64_t)stat.ms_leaf_pages, (uint64_t)stat.ms_overflow_pages, (uint64_t)info.me_last_pgno,
+            (uint64_t)info.me_mapsize, info.me_numreaders, info.me_maxreaders);
+    }
+};
+
+#endif // USE_LMDB
+
+//! Engine whose files path holds, or "" if there are none
+std::string FindDBEngine(const boost::filesystem::path& path)
+{
+    if (boost::filesystem::exists(path / "CURRENT"))
+        return "leveldb";
+    if (boost::filesystem::exists(path / "data.mdb"))
+        return "lmdb";
+    return "";
+}
+
+} // namespace
+
+bool IsDBEngineAvailable(const std::string& strEngine)
+{
+#ifdef USE_LMDB
+    if (strEngine == "lmdb")
+        return true;
+#endif
+    return strEngine == "leveldb";
+}
+
+std::string GetDBEngineNames()
+{
+#ifdef USE_LMDB
+    return "leveldb, lmdb";
+#else
+    return "leveldb";
+#endif
+}
+
+CDBEngine* OpenDBEngine(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbOptions)
+{
+    if (!IsDBEngineAvailable(dbOptions.strEngine))
+        throw dbwrapper_error(strprintf("Unknown database engine %s (available: %s)", dbOptions.strEngine, GetDBEngineNames()));
+    if (fMemory)
+        return new CLevelDBEngine(path, nCacheSize, true, dbOptions);
+
+    if (fWipe) {
+        // Whichever engine wrote it, so that a wipe also switches engines
+        LogPrintf("Wiping database in %s\n", path.string());
+        leveldb::Status result = leveldb::DestroyDB(path.string(), leveldb::Options());
+        dbwrapper_private::HandleError(result);
+        boost::filesystem::remove(path / "data.mdb");
+        boost::filesystem::remove(path / "lock.mdb");
+    }
+    std::string strFound = FindDBEngine(path);
+    if (!strFound.empty() && strFound != dbOptions.strEngine) {
+        LogPrintf("Database in %s was written by %s, not %s\n", path.string(), strFound, dbOptions.strEngine);
+        throw dbwrapper_error(strprintf("Database written by another engine (%s); reindex to convert it", strFound));
+    }
+
+#ifdef USE_LMDB
+    if (dbOptions.strEngine == "lmdb")
+        return new CLMDBEngine(path);
+#endif
+    return new CLevelDBEngine(path, nCacheSize, false, dbOptions);
+}
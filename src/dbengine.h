@@ -0,0 +1,97 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_DBENGINE_H
+#define BITCOIN_DBENGINE_H
+
+#include <stdint.h>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+#include <leveldb/slice.h>
+#include <leveldb/status.h>
+#include <leveldb/write_batch.h>
+
+struct CDBOptions;
+struct CDBStats;
+
+/**
+ * Storage engine interfaces behind CDBWrapper. Keys and values are raw bytes
+ * here: serialization and obfuscation stay in CDBWrapper, so every engine
+ * stores the same bytes. Whatever the engine, changes are queued in a
+ * leveldb::WriteBatch, which the engine must apply atomically, and errors are
+ * reported as leveldb::Status so that HandleError() treats them alike.
+ */
+
+/** A point-in-time view of the database, passed back to the engine's reads */
+class CDBEngineSnapshot
+{
+public:
+    virtual ~CDBEngineSnapshot() {}
+};
+
+/** Iterator over the keys of a database in bytewise order */
+class CDBEngineIterator
+{
+public:
+    virtual ~CDBEngineIterator() {}
+
+    virtual bool Valid() const = 0;
+    virtual void SeekToFirst() = 0;
+    virtual void Seek(const leveldb::Slice& key) = 0;
+    virtual void Next() = 0;
+    //! Only valid until the iterator is next moved
+    virtual leveldb::Slice key() const = 0;
+    virtual leveldb::Slice value() const = 0;
+};
+
+class CDBEngine
+{
+public:
+    virtual ~CDBEngine() {}
+
+    //! The name selecting the engine, as given to -<name>engine
+    virtual const char* GetName() const = 0;
+
+    //! Read key, from snapshot if it isn't NULL; IsNotFound() if it is missing
+    virtual leveldb::Status Get(const leveldb::Slice& key, std::string* value, const CDBEngineSnapshot* snapshot) const = 0;
+
+    //! Apply every change of batch or none of them, syncing to disk if fSync
+    virtual leveldb::Status Write(leveldb::WriteBatch& batch, bool fSync) = 0;
+
+    //! Caller owns the result, which must be deleted before snapshot
+    virtual CDBEngineIterator* NewIterator(const CDBEngineSnapshot* snapshot) const = 0;
+
+    //! Caller owns the result
+    virtual CDBEngineSnapshot* NewSnapshot() const = 0;
+
+    //! Reclaim the space of erased entries in [begin, end], if the engine needs to
+    virtual void CompactRange(const leveldb::Slice& begin, const leveldb::Slice& end) const = 0;
+
+    //! Size on disk of [begin, end), or 0 if the engine can't tell
+    virtual uint64_t EstimateSize(const leveldb::Slice& begin, const leveldb::Slice& end) const = 0;
+
+    //! Fill in the statistics this engine keeps
+    virtual void GetStats(CDBStats& stats) const = 0;
+};
+
+/** Name of the default engine */
+static const char* const DEFAULT_DB_ENGINE = "leveldb";
+
+/** Whether strEngine names an engine compiled into this binary */
+bool IsDBEngineAvailable(const std::string& strEngine);
+
+/** Comma-separated names of the engines compiled in, for help messages */
+std::string GetDBEngineNames();
+
+/**
+ * Open the engine named by dbOptions.strEngine on path, creating the database
+ * if it doesn't exist. Memory-only databases always use LevelDB's memory
+ * environment. Throws dbwrapper_error if the engine is unknown, or if path
+ * holds a database written by another engine.
+ */
+CDBEngine* OpenDBEngine(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbOptions);
+
+#endif // BITCOIN_DBENGINE_H
@@ -9,53 +9,26 @@
 #include "random.h"
 
 #include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
 
-#include <leveldb/cache.h>
-#include <leveldb/env.h>
-#include <leveldb/filter_policy.h>
-#include <memenv.h>
 #include <stdint.h>
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+#include <algorithm>
+
+CDBOptions GetDBOptionsFromArgs(const std::string& strName)
 {
-    leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
-    if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
-        // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
-        // on corruption in later versions.
-        options.paranoid_checks = true;
-    }
-    return options;
+    CDBOptions dbOptions;
+    dbOptions.strEngine = GetArg("-" + strName + "engine", dbOptions.strEngine);
+    dbOptions.nWriteBufferSize = std::max<int64_t>(0, GetArg("-" + strName + "writebuffer", 0)) << 20;
+    dbOptions.nBlockSize = std::max<int64_t>(1024, GetArg("-" + strName + "blocksize", dbOptions.nBlockSize));
+    dbOptions.nBloomBits = std::max<int64_t>(0, GetArg("-" + strName + "bloombits", dbOptions.nBloomBits));
+    return dbOptions;
 }
 
-CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
+CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate, const CDBOptions& dbOptions) :
+    nRangeCompactions(0), nRangeCompactionMicros(0)
 {
-    penv = NULL;
-    readoptions.verify_checksums = true;
-    iteroptions.verify_checksums = true;
-    iteroptions.fill_cache = false;
-    syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
-    options.create_if_missing = true;
-    if (fMemory) {
-        penv = leveldb::NewMemEnv(leveldb::Env::Default());
-        options.env = penv;
-    } else {
-        if (fWipe) {
-            LogPrintf("Wiping LevelDB in %s\n", path.string());
-            leveldb::Status result = leveldb::DestroyDB(path.string(), options);
-            dbwrapper_private::HandleError(result);
-        }
-        TryCreateDirectory(path);
-        LogPrintf("Opening LevelDB in %s\n", path.string());
-    }
-    leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
-    dbwrapper_private::HandleError(status);
-    LogPrintf("Opened LevelDB successfully\n");
+    pengine = OpenDBEngine(path, nCacheSize, fMemory, fWipe, dbOptions);
 
     // The base-case obfuscation key, which is a noop.
     obfuscate_key = std::vector<unsigned char>(OBFUSCATE_KEY_NUM_BYTES, '\000');
@@ -79,19 +52,13 @@ CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, b
 
 CDBWrapper::~CDBWrapper()
 {
-    delete pdb;
-    pdb = NULL;
-    delete options.filter_policy;
-    options.filter_policy = NULL;
-    delete options.block_cache;
-    options.block_cache = NULL;
-    delete penv;
-    options.env = NULL;
+    delete pengine;
+    pengine = NULL;
 }
 
 bool CDBWrapper::WriteBatch(CDBBatch& batch, bool fSync)
 {
-    leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
+    leveldb::Status status = pengine->Write(batch.batch, fSync);
     dbwrapper_private::HandleError(status);
     return true;
 }
@@ -123,6 +90,24 @@ bool CDBWrapper::IsEmpty()
     return !(it->Valid());
 }
 
+CDBSnapshot::CDBSnapshot(const CDBWrapper &_parent) : parent(_parent)
+{
+    psnapshot = parent.pengine->NewSnapshot();
+}
+
+CDBSnapshot::~CDBSnapshot()
+{
+    delete psnapshot;
+}
+
+void CDBWrapper::GetDBStats(CDBStats& stats) const
+{
+    pengine->GetStats(stats);
+    stats.strEngine = pengine->GetName();
+    stats.nRangeCompactions = nRangeCompactions;
+    stats.dRangeCompactionTime = nRangeCompactionMicros * 0.000001;
+}
+
 CDBIterator::~CDBIterator() { delete piter; }
 bool CDBIterator::Valid() { return piter->Valid(); }
 void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
@@ -149,4 +134,38 @@ const std::vector<unsigned char>& GetObfuscateKey(const CDBWrapper &w)
     return w.obfuscate_key;
 }
 
+static boost::thread_specific_ptr<CPlainDataStream> threadKeyStream;
+static boost::thread_specific_ptr<CPlainDataStream> threadValueStream;
+
+static CPlainDataStream& GetThreadStream(boost::thread_specific_ptr<CPlainDataStream>& stream, size_t nReserve)
+{
+    if (stream.get() == NULL) {
+        stream.reset(new CPlainDataStream(SER_DISK, CLIENT_VERSION));
+        stream->reserve(nReserve);
+    }
+    stream->clear();
+    return *stream;
+}
+
+CPlainDataStream& GetThreadKeyStream()
+{
+    return GetThreadStream(threadKeyStream, DBWRAPPER_PREALLOC_KEY_SIZE);
+}
+
+CPlainDataStream& GetThreadValueStream()
+{
+    return GetThreadStream(threadValueStream, DBWRAPPER_PREALLOC_VALUE_SIZE);
+}
+
+void Deobfuscate(std::string& strValue, const std::vector<unsigned char>& key)
+{
+    if (key.empty())
+        return;
+    for (size_t i = 0, j = 0; i < strValue.size(); i++) {
+        strValue[i] ^= key[j++];
+        if (j == key.size())
+            j = 0;
+    }
+}
+
 };
@@ -7,16 +7,16 @@
 #define BITCOIN_DBWRAPPER_H
 
 #include "clientversion.h"
+#include "dbengine.h"
 #include "serialize.h"
 #include "streams.h"
 #include "util.h"
 #include "utilstrencodings.h"
 #include "version.h"
 
-#include <boost/filesystem/path.hpp>
+#include <atomic>
 
-#include <leveldb/db.h>
-#include <leveldb/write_batch.h>
+#include <boost/filesystem/path.hpp>
 
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
@@ -29,6 +29,49 @@ public:
 
 class CDBWrapper;
 
+/** Storage engine and LevelDB settings of a database that can be tuned per database. */
+struct CDBOptions
+{
+    //! Name of the storage engine, one of GetDBEngineNames()
+    std::string strEngine;
+    //! Size of a memtable in bytes, or 0 to derive it from the cache size
+    size_t nWriteBufferSize;
+    //! Approximate amount of data packed into a table block, in bytes
+    size_t nBlockSize;
+    //! Bloom filter bits per key, or 0 for no bloom filter
+    int nBloomBits;
+
+    CDBOptions() : strEngine(DEFAULT_DB_ENGINE), nWriteBufferSize(0), nBlockSize(4096), nBloomBits(10) {}
+};
+
+/**
+ * Options of the database called strName, read from -<strName>engine,
+ * -<strName>writebuffer (MiB), -<strName>blocksize (bytes) and
+ * -<strName>bloombits. The LevelDB settings don't apply to other engines.
+ */
+CDBOptions GetDBOptionsFromArgs(const std::string& strName);
+
+/** Statistics of a CDBWrapper since it was opened */
+struct CDBStats
+{
+    uint64_t nCacheHits;
+    uint64_t nCacheMisses;
+    uint64_t nCompactions;
+    //! Time spent in compactions, in seconds
+    double dCompactionTime;
+    //! Compactions of key ranges requested through CompactRange()
+    uint64_t nRangeCompactions;
+    //! Time spent in those, in seconds
+    double dRangeCompactionTime;
+    //! Name of the storage engine
+    std::string strEngine;
+    //! The engine's own statistics, such as the leveldb.stats property
+    std::string strEngineStats;
+
+    CDBStats() : nCacheHits(0), nCacheMisses(0), nCompactions(0), dCompactionTime(0),
+                 nRangeCompactions(0), dRangeCompactionTime(0) {}
+};
+
 /** These should be considered an implementation detail of the specific database.
  */
 namespace dbwrapper_private {
@@ -43,6 +86,17 @@ void HandleError(const leveldb::Status& status);
  */
 const std::vector<unsigned char>& GetObfuscateKey(const CDBWrapper &w);
 
+/**
+ * Streams kept by each thread for serializing keys and copying values out of
+ * iterators, so lookups reuse their buffers rather than allocating new ones.
+ * Each use clears the stream first and is done with it before returning.
+ */
+CPlainDataStream& GetThreadKeyStream();
+CPlainDataStream& GetThreadValueStream();
+
+//! Undo the obfuscation of a value read from the database, in place
+void Deobfuscate(std::string& strValue, const std::vector<unsigned char>& key);
+
 };
 
 /** Batch of changes queued to be written to a CDBWrapper */
@@ -53,55 +107,83 @@ class CDBBatch
 private:
     const CDBWrapper &parent;
     leveldb::WriteBatch batch;
+    //! Reused by every write, as leveldb copies what it is given
+    CPlainDataStream ssKey;
+    CPlainDataStream ssValue;
+
+    size_t size_estimate;
 
 public:
     /**
      * @param[in] _parent   CDBWrapper that this batch is to be submitted to
      */
-    CDBBatch(const CDBWrapper &_parent) : parent(_parent) { };
+    CDBBatch(const CDBWrapper &_parent) : parent(_parent), ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION), size_estimate(0)
+    {
+        ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssValue.reserve(DBWRAPPER_PREALLOC_VALUE_SIZE);
+    };
+
+    void Clear()
+    {
+        batch.Clear();
+        size_estimate = 0;
+    }
 
     template <typename K, typename V>
     void Write(const K& key, const V& value)
     {
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKey.clear();
         ssKey << key;
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
-        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-        ssValue.reserve(DBWRAPPER_PREALLOC_VALUE_SIZE);
+        ssValue.clear();
         ssValue << value;
         ssValue.Xor(dbwrapper_private::GetObfuscateKey(parent));
         leveldb::Slice slValue(&ssValue[0], ssValue.size());
 
         batch.Put(slKey, slValue);
+        // LevelDB serializes writes as:
+        // - byte: header
+        // - varint: key length (1 byte up to 127B, 2 bytes up to 16383B, ...)
+        // - byte[]: key
+        // - varint: value length
+        // - byte[]: value
+        // The formula below assumes the key and value are both less than 16k.
+        size_estimate += 3 + (slKey.size() > 127) + slKey.size() + (slValue.size() > 127) + slValue.size();
     }
 
     template <typename K>
     void Erase(const K& key)
     {
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKey.clear();
         ssKey << key;
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         batch.Delete(slKey);
+        // LevelDB serializes erases as:
+        // - byte: header
+        // - varint: key length
+        // - byte[]: key
+        // The formula below assumes the key is less than 16kB.
+        size_estimate += 2 + (slKey.size() > 127) + slKey.size();
     }
+
+    size_t SizeEstimate() const { return size_estimate; }
 };
 
 class CDBIterator
 {
 private:
     const CDBWrapper &parent;
-    leveldb::Iterator *piter;
+    CDBEngineIterator *piter;
 
 public:
 
     /**
      * @param[in] _parent          Parent CDBWrapper instance.
-     * @param[in] _piter           The original leveldb iterator.
+     * @param[in] _piter           The iterator of the storage engine.
      */
-    CDBIterator(const CDBWrapper &_parent, leveldb::Iterator *_piter) :
+    CDBIterator(const CDBWrapper &_parent, CDBEngineIterator *_piter) :
         parent(_parent), piter(_piter) { };
     ~CDBIterator();
 
@@ -110,8 +192,7 @@ public:
     void SeekToFirst();
 
     template<typename K> void Seek(const K& key) {
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        CPlainDataStream& ssKey = dbwrapper_private::GetThreadKeyStream();
         ssKey << key;
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
         piter->Seek(slKey);
@@ -122,7 +203,7 @@ public:
     template<typename K> bool GetKey(K& key) {
         leveldb::Slice slKey = piter->key();
         try {
-            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            CSpanReader ssKey((const unsigned char*)slKey.data(), (const unsigned char*)slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
             ssKey >> key;
         } catch(std::exception &e) {
             return false;
@@ -137,7 +218,8 @@ public:
     template<typename V> bool GetValue(V& value) {
         leveldb::Slice slValue = piter->value();
         try {
-            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CPlainDataStream& ssValue = dbwrapper_private::GetThreadValueStream();
+            ssValue.write(slValue.data(), slValue.size());
             ssValue.Xor(dbwrapper_private::GetObfuscateKey(parent));
             ssValue >> value;
         } catch(std::exception &e) {
@@ -150,32 +232,41 @@ public:
         return piter->value().size();
     }
 
+    /** Copy the value out still serialized, so it can be deserialized off this thread. */
+    void GetValueStream(CDataStream& ssValue) {
+        leveldb::Slice slValue = piter->value();
+        ssValue = CDataStream(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue.Xor(dbwrapper_private::GetObfuscateKey(parent));
+    }
+
 };
 
-class CDBWrapper
+/**
+ * A consistent point-in-time view of a CDBWrapper. Reads and iterators made
+ * with it do not see writes to the database made after it was taken.
+ */
+class CDBSnapshot
 {
-    friend const std::vector<unsigned char>& dbwrapper_private::GetObfuscateKey(const CDBWrapper &w);
+    friend class CDBWrapper;
 private:
-    //! custom environment this database is using (may be NULL in case of default environment)
-    leveldb::Env* penv;
-
-    //! database options used
-    leveldb::Options options;
-
-    //! options used when reading from the database
-    leveldb::ReadOptions readoptions;
-
-    //! options used when iterating over values of the database
-    leveldb::ReadOptions iteroptions;
+    const CDBWrapper &parent;
+    CDBEngineSnapshot *psnapshot;
 
-    //! options used when writing to the database
-    leveldb::WriteOptions writeoptions;
+    CDBSnapshot(const CDBSnapshot&);
+    void operator=(const CDBSnapshot&);
 
-    //! options used when sync writing to the database
-    leveldb::WriteOptions syncoptions;
+public:
+    explicit CDBSnapshot(const CDBWrapper &_parent);
+    ~CDBSnapshot();
+};
 
-    //! the database itself
-    leveldb::DB* pdb;
+class CDBWrapper
+{
+    friend const std::vector<unsigned char>& dbwrapper_private::GetObfuscateKey(const CDBWrapper &w);
+    friend class CDBSnapshot;
+private:
+    //! the storage engine holding the database
+    CDBEngine* pengine;
 
     //! a key used for optional XOR-obfuscation of the database
     std::vector<unsigned char> obfuscate_key;
@@ -188,37 +279,29 @@ private:
 
     std::vector<unsigned char> CreateObfuscateKey() const;
 
-public:
-    /**
-     * @param[in] path        Location in the filesystem where leveldb data will be stored.
-     * @param[in] nCacheSize  Configures various leveldb cache settings.
-     * @param[in] fMemory     If true, use leveldb's memory environment.
-     * @param[in] fWipe       If true, remove all existing data.
-     * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
-     *                        with a zero'd byte array.
-     */
-    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
-    ~CDBWrapper();
+    //! range compactions requested, counted for GetDBStats()
+    mutable std::atomic<uint64_t> nRangeCompactions;
+    mutable std::atomic<int64_t> nRangeCompactionMicros;
 
     template <typename K, typename V>
-    bool Read(const K& key, V& value) const
+    bool Read(const K& key, V& value, const CDBEngineSnapshot* psnapshot) const
     {
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        CPlainDataStream& ssKey = dbwrapper_private::GetThreadKeyStream();
         ssKey << key;
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status = pengine->Get(slKey, &strValue, psnapshot);
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
-            LogPrintf("LevelDB read failure: %s\n", status.ToString());
+            LogPrintf("%s read failure: %s\n", pengine->GetName(), status.ToString());
             dbwrapper_private::HandleError(status);
         }
         try {
-            CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
-            ssValue.Xor(obfuscate_key);
+            // Deserialized straight from the string the engine filled, without a copy
+            dbwrapper_private::Deobfuscate(strValue, obfuscate_key);
+            CSpanReader ssValue((const unsigned char*)strValue.data(), (const unsigned char*)strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
             ssValue >> value;
         } catch (const std::exception&) {
             return false;
@@ -226,6 +309,33 @@ public:
         return true;
     }
 
+public:
+    /**
+     * @param[in] path        Location in the filesystem where the data will be stored.
+     * @param[in] nCacheSize  Configures various leveldb cache settings.
+     * @param[in] fMemory     If true, use leveldb's memory environment, whatever the engine.
+     * @param[in] fWipe       If true, remove all existing data, of any engine.
+     * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
+     *                        with a zero'd byte array.
+     * @param[in] dbOptions   Engine and LevelDB settings to use on top of the cache size.
+     */
+    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false, const CDBOptions& dbOptions = CDBOptions());
+    ~CDBWrapper();
+
+    template <typename K, typename V>
+    bool Read(const K& key, V& value) const
+    {
+        return Read(key, value, (const CDBEngineSnapshot*)NULL);
+    }
+
+    //! Read key as it was when snapshot was taken
+    template <typename K, typename V>
+    bool Read(const K& key, V& value, const CDBSnapshot& snapshot) const
+    {
+        assert(&snapshot.parent == this);
+        return Read(key, value, snapshot.psnapshot);
+    }
+
     template <typename K, typename V>
     bool Write(const K& key, const V& value, bool fSync = false)
     {
@@ -237,17 +347,16 @@ public:
     template <typename K>
     bool Exists(const K& key) const
     {
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        CPlainDataStream& ssKey = dbwrapper_private::GetThreadKeyStream();
         ssKey << key;
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status = pengine->Get(slKey, &strValue, NULL);
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
-            LogPrintf("LevelDB read failure: %s\n", status.ToString());
+            LogPrintf("%s read failure: %s\n", pengine->GetName(), status.ToString());
             dbwrapper_private::HandleError(status);
         }
         return true;
@@ -263,7 +372,7 @@ public:
 
     bool WriteBatch(CDBBatch& batch, bool fSync = false);
 
-    // not available for LevelDB; provide for compatibility with BDB
+    // not available for the storage engines; provide for compatibility with BDB
     bool Flush()
     {
         return true;
@@ -277,13 +386,65 @@ public:
 
     CDBIterator *NewIterator()
     {
-        return new CDBIterator(*this, pdb->NewIterator(iteroptions));
+        return new CDBIterator(*this, pengine->NewIterator(NULL));
+    }
+
+    //! Iterate over the database as it was when snapshot was taken
+    CDBIterator *NewIterator(const CDBSnapshot& snapshot) const
+    {
+        assert(&snapshot.parent == this);
+        return new CDBIterator(*this, pengine->NewIterator(snapshot.psnapshot));
     }
 
     /**
      * Return true if the database managed by this class contains no entries.
      */
     bool IsEmpty();
+
+    //! Name of the storage engine holding the database
+    const char* GetEngineName() const { return pengine->GetName(); }
+
+    //! Collect block cache, compaction and storage engine statistics
+    void GetDBStats(CDBStats& stats) const;
+
+    /**
+     * Compact the key range [key_begin, key_end] so that space freed by
+     * erased entries is reclaimed. Engines that reuse freed space as they
+     * go do nothing.
+     */
+    template<typename K>
+    void CompactRange(const K& key_begin, const K& key_end) const
+    {
+        CDataStream ssKey1(SER_DISK, CLIENT_VERSION), ssKey2(SER_DISK, CLIENT_VERSION);
+        ssKey1.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKey2.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKey1 << key_begin;
+        ssKey2 << key_end;
+        leveldb::Slice slKey1(&ssKey1[0], ssKey1.size());
+        leveldb::Slice slKey2(&ssKey2[0], ssKey2.size());
+        int64_t nStart = GetTimeMicros();
+        pengine->CompactRange(slKey1, slKey2);
+        nRangeCompactionMicros += GetTimeMicros() - nStart;
+        nRangeCompactions++;
+    }
+
+    /**
+     * Estimate the size on disk of the key range [key_begin, key_end). Data
+     * still in the write buffer is not counted, and engines that can't
+     * estimate it return 0.
+     */
+    template<typename K>
+    size_t EstimateSize(const K& key_begin, const K& key_end) const
+    {
+        CDataStream ssKey1(SER_DISK, CLIENT_VERSION), ssKey2(SER_DISK, CLIENT_VERSION);
+        ssKey1.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKey2.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKey1 << key_begin;
+        ssKey2 << key_end;
+        leveldb::Slice slKey1(&ssKey1[0], ssKey1.size());
+        leveldb::Slice slKey2(&ssKey2[0], ssKey2.size());
+        return pengine->EstimateSize(slKey1, slKey2);
+    }
 };
 
 #endif // BITCOIN_DBWRAPPER_H
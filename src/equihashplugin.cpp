@@ -0,0 +1,226 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "equihashplugin.h"
+
+#include "crypto/common.h"
+#include "tinyformat.h"
+#include "utilstrencodings.h"
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/thread.hpp>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+CEquihashPlugin* pEquihashPlugin = NULL;
+
+static void* LoadLibraryHandle(const std::string& strPath, std::string& strError)
+{
+#ifdef WIN32
+    HMODULE handle = LoadLibraryA(strPath.c_str());
+    if (!handle)
+        strError = strprintf("error %u", GetLastError());
+    return (void*)handle;
+#else
+    void* handle = dlopen(strPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+        strError = dlerror();
+    return handle;
+#endif
+}
+
+static void* GetLibrarySymbol(void* handle, const char* pszName)
+{
+#ifdef WIN32
+    return (void*)GetProcAddress((HMODULE)handle, pszName);
+#else
+    return dlsym(handle, pszName);
+#endif
+}
+
+static void FreeLibraryHandle(void* handle)
+{
+#ifdef WIN32
+    FreeLibrary((HMODULE)handle);
+#else
+    dlclose(handle);
+#endif
+}
+
+CEquihashPlugin::~CEquihashPlugin()
+{
+    if (handle)
+        FreeLibraryHandle(handle);
+}
+
+CEquihashPlugin* CEquihashPlugin::Load(const std::string& strPath, std::string& strError)
+{
+    if (strPath.empty()) {
+        strError = "no plugin given";
+        return NULL;
+    }
+    std::string strLoadError;
+    void* handle = LoadLibraryHandle(strPath, strLoadError);
+    if (!handle) {
+        strError = strprintf("can't load %s: %s", strPath, strLoadError);
+        return NULL;
+    }
+    std::unique_ptr<CEquihashPlugin> plugin(new CEquihashPlugin());
+    plugin->handle = handle;
+
+    equihash_plugin_api_version_fn apiVersion = (equihash_plugin_api_version_fn)GetLibrarySymbol(handle, EQUIHASH_PLUGIN_API_VERSION);
+    if (!apiVersion) {
+        strError = strprintf("%s is not an Equihash solver plugin", strPath);
+        return NULL;
+    }
+    if (apiVersion() != EQUIHASH_PLUGIN_API_VER) {
+        strError = strprintf("%s implements interface version %u, not %u", strPath, apiVersion(), EQUIHASH_PLUGIN_API_VER);
+        return NULL;
+    }
+    plugin->deviceCount = (equihash_plugin_device_count_fn)GetLibrarySymbol(handle, EQUIHASH_PLUGIN_DEVICE_COUNT);
+    plugin->deviceName = (equihash_plugin_device_name_fn)GetLibrarySymbol(handle, EQUIHASH_PLUGIN_DEVICE_NAME);
+    plugin->create = (equihash_plugin_create_fn)GetLibrarySymbol(handle, EQUIHASH_PLUGIN_CREATE);
+    plugin->destroy = (equihash_plugin_destroy_fn)GetLibrarySymbol(handle, EQUIHASH_PLUGIN_DESTROY);
+    plugin->solve = (equihash_plugin_solve_fn)GetLibrarySymbol(handle, EQUIHASH_PLUGIN_SOLVE);
+    if (!plugin->deviceCount || !plugin->deviceName || !plugin->create || !plugin->destroy || !plugin->solve) {
+        strError = strprintf("%s lacks functions of the plugin interface", strPath);
+        return NULL;
+    }
+    if (plugin->DeviceCount() <= 0) {
+        strError = strprintf("%s found no device to run on", strPath);
+        return NULL;
+    }
+    return plugin.release();
+}
+
+int CEquihashPlugin::DeviceCount() const
+{
+    return deviceCount();
+}
+
+std::string CEquihashPlugin::DeviceName(int nDevice) const
+{
+    char name[256];
+    if (deviceName(nDevice, name, sizeof(name)) != 0)
+        return strprintf("device %d", nDevice);
+    name[sizeof(name) - 1] = '\0';
+    return name;
+}
+
+bool CEquihashPlugin::SelectDevices(const std::string& strDevices, std::string& strError)
+{
+    int nCount = DeviceCount();
+    vDevices.clear();
+    if (strDevices.empty()) {
+        for (int i = 0; i < nCount; i++)
+            vDevices.push_back(i);
+        return true;
+    }
+    std::vector<std::string> vstr;
+    boost::split(vstr, strDevices, boost::is_any_of(","));
+    for (const std::string& str : vstr) {
+        int32_t nDevice;
+        if (!ParseInt32(str, &nDevice) || nDevice < 0 || nDevice >= nCount) {
+            strError = strprintf("no device '%s', the plugin has %d", str, nCount);
+            return false;
+        }
+        if (std::find(vDevices.begin(), vDevices.end(), nDevice) != vDevices.end()) {
+            strError = strprintf("device %d given twice", nDevice);
+            return false;
+        }
+        vDevices.push_back(nDevice);
+    }
+    return true;
+}
+
+CEquihashPlugin::Solver::Solver(const CEquihashPlugin& pluginIn, int nDevice, unsigned int nIn, unsigned int kIn) :
+    plugin(pluginIn), n(nIn), k(kIn)
+{
+    solver = plugin.create(nDevice, n, k);
+}
+
+CEquihashPlugin::Solver::~Solver()
+{
+    if (solver)
+        plugin.destroy(solver);
+}
+
+namespace {
+
+//! What the callbacks of one run need, passed through the plugin as user
+struct CSolveContext
+{
+    const std::function<bool(std::vector<unsigned char>)>* validBlock;
+    const std::function<bool()>* cancelled;
+    bool fFound;
+    //! Exceptions can't unwind through the plugin, so are kept for after the run
+    std::exception_ptr error;
+};
+
+} // anon namespace
+
+extern "C" {
+
+static int EquihashPluginSolution(void* user, const unsigned char* solution, size_t solutionLen)
+{
+    CSolveContext& ctx = *(CSolveContext*)user;
+    try {
+        if ((*ctx.validBlock)(std::vector<unsigned char>(solution, solution + solutionLen))) {
+            ctx.fFound = true;
+            return 1;
+        }
+        return 0;
+    } catch (...) {
+        ctx.error = std::current_exception();
+        return 1;
+    }
+}
+
+static int EquihashPluginCancel(void* user)
+{
+    CSolveContext& ctx = *(CSolveContext*)user;
+    if (ctx.error)
+        return 1;
+    try {
+        return (*ctx.cancelled)() || boost::this_thread::interruption_requested();
+    } catch (...) {
+        ctx.error = std::current_exception();
+        return 1;
+    }
+}
+
+} // extern "C"
+
+bool CEquihashPlugin::Solver::Solve(const std::vector<unsigned char>& vInput, const uint256& nonce,
+                                    const std::function<bool(std::vector<unsigned char>)>& validBlock,
+                                    const std::function<bool()>& cancelled)
+{
+    // As in EhInitialiseState
+    unsigned char personal[EQUIHASH_PLUGIN_PERSONAL_BYTES] = {};
+    memcpy(personal, "ZcashPoW", 8);
+    WriteLE32(personal + 8, n);
+    WriteLE32(personal + 12, k);
+
+    CSolveContext ctx;
+    ctx.validBlock = &validBlock;
+    ctx.cancelled = &cancelled;
+    ctx.fFound = false;
+    int nResult = plugin.solve(solver, personal, vInput.data(), vInput.size(), nonce.begin(), nonce.size(),
+                               EquihashPluginSolution, EquihashPluginCancel, &ctx);
+    if (ctx.error)
+        std::rethrow_exception(ctx.error);
+    if (nResult < 0)
+        throw std::runtime_error(strprintf("Equihash plugin solver failed with %d", nResult));
+    return ctx.fFound;
+}
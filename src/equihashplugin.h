@@ -0,0 +1,81 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_EQUIHASHPLUGIN_H
+#define BITCOIN_EQUIHASHPLUGIN_H
+
+#include "pow/equihash_plugin.h"
+#include "uint256.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * An Equihash solver plugin loaded from a shared library, and the devices
+ * of it the miner runs on, one mining thread each. The library is kept
+ * loaded until the plugin is deleted, which must not happen while a
+ * Solver of it is alive.
+ */
+class CEquihashPlugin
+{
+private:
+    void* handle;
+    equihash_plugin_device_count_fn deviceCount;
+    equihash_plugin_device_name_fn deviceName;
+    equihash_plugin_create_fn create;
+    equihash_plugin_destroy_fn destroy;
+    equihash_plugin_solve_fn solve;
+    //! The devices mined on
+    std::vector<int> vDevices;
+
+    CEquihashPlugin() : handle(NULL), deviceCount(NULL), deviceName(NULL), create(NULL), destroy(NULL), solve(NULL) {}
+
+public:
+    /** A solver for one device and Equihash parameters, run from one thread at a time */
+    class Solver
+    {
+    private:
+        const CEquihashPlugin& plugin;
+        void* solver;
+        unsigned int n;
+        unsigned int k;
+
+        Solver(const Solver&);
+        Solver& operator=(const Solver&);
+
+    public:
+        Solver(const CEquihashPlugin& pluginIn, int nDevice, unsigned int nIn, unsigned int kIn);
+        ~Solver();
+
+        bool IsValid() const { return solver != NULL; }
+        bool Matches(unsigned int nIn, unsigned int kIn) const { return n == nIn && k == kIn; }
+        /**
+         * Run the solver once over the serialized header input and nonce,
+         * calling validBlock with each solution until it returns true. An
+         * exception thrown by validBlock is thrown again once the run has
+         * stopped. Returns whether a solution was taken.
+         */
+        bool Solve(const std::vector<unsigned char>& vInput, const uint256& nonce,
+                   const std::function<bool(std::vector<unsigned char>)>& validBlock,
+                   const std::function<bool()>& cancelled);
+    };
+
+    ~CEquihashPlugin();
+
+    /** Load the plugin at strPath, or return NULL with strError set */
+    static CEquihashPlugin* Load(const std::string& strPath, std::string& strError);
+
+    int DeviceCount() const;
+    std::string DeviceName(int nDevice) const;
+
+    /** Mine on the devices in the comma-separated list strDevices, or on all of them if it is empty */
+    bool SelectDevices(const std::string& strDevices, std::string& strError);
+    const std::vector<int>& GetDevices() const { return vDevices; }
+};
+
+/** The plugin of -equihashsolver=plugin, or NULL */
+extern CEquihashPlugin* pEquihashPlugin;
+
+#endif // BITCOIN_EQUIHASHPLUGIN_H
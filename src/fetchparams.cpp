@@ -15,13 +15,69 @@
 #include <curl/easy.h>
 #include <openssl/sha.h>
 
+#include <fstream>
+#include <set>
 #include <sstream>
 #include <string>
 
 #include <boost/filesystem.hpp>
 
+/**
+ * Parameter files that have been hashed before, one line per file with its
+ * name, size, modification time and hash, kept next to the files. A file
+ * whose line still matches is not hashed again.
+ */
+static const char* VERIFIED_PARAMS_FILENAME = "params.verified";
+
+static std::string VerifiedParamsEntry(const boost::filesystem::path& p, const std::string& sha256)
+{
+    boost::system::error_code ec;
+    uintmax_t nSize = boost::filesystem::file_size(p, ec);
+    if (ec)
+        return "";
+    std::time_t nTime = boost::filesystem::last_write_time(p, ec);
+    if (ec)
+        return "";
+    return strprintf("%s %u %d %s", p.filename().string(), (uint64_t)nSize, (int64_t)nTime, sha256);
+}
+
+static std::set<std::string> ReadVerifiedParams(const boost::filesystem::path& dir)
+{
+    std::set<std::string> entries;
+    std::ifstream file((dir / VERIFIED_PARAMS_FILENAME).string().c_str());
+    std::string line;
+    while (std::getline(file, line))
+        entries.insert(line);
+    return entries;
+}
+
+static void WriteVerifiedParams(const boost::filesystem::path& dir, const std::string& filename, const std::string& entry)
+{
+    // Replace whatever was recorded for this file before
+    std::set<std::string> entries = ReadVerifiedParams(dir);
+    for (std::set<std::string>::iterator it = entries.begin(); it != entries.end(); ) {
+        if (it->compare(0, filename.size() + 1, filename + " ") == 0)
+            entries.erase(it++);
+        else
+            ++it;
+    }
+    entries.insert(entry);
+
+    // Failing to write only means hashing again on the next start
+    std::ofstream file((dir / VERIFIED_PARAMS_FILENAME).string().c_str(), std::ios::trunc);
+    for (const std::string& line : entries)
+        file << line << "\n";
+}
+
 bool LTZ_VerifyParams(std::string file, std::string sha256expected)
 {
+    boost::filesystem::path p(file);
+    std::string entry = VerifiedParamsEntry(p, sha256expected);
+    if (!entry.empty() && ReadVerifiedParams(p.parent_path()).count(entry)) {
+        LogPrintf("%s was verified on an earlier start and has not changed\n", file);
+        return true;
+    }
+
     std::string msg = "Verifying " + file + "...";
     LogPrintf("%s\n", msg.c_str());
 
@@ -29,6 +85,7 @@ bool LTZ_VerifyParams(std::string file, std::string sha256expected)
     if(!fp) {
         msg = "Can not open " + file + "!";
         LogPrintf("%s\n", msg.c_str());
+        return false;
     }
 
     unsigned char buffer[BUFSIZ];
@@ -37,7 +94,6 @@ bool LTZ_VerifyParams(std::string file, std::string sha256expected)
     int len = 0;
     int bytesRead = 0;
 
-    boost::filesystem::path p(file);
     std::string initMsg = "Verifying " + p.filename().string() + "...";
     uiInterface.InitMessage(_(initMsg.c_str()));
 
@@ -68,6 +124,9 @@ bool LTZ_VerifyParams(std::string file, std::string sha256expected)
         return false;
     }
 
+    if (!entry.empty())
+        WriteVerifiedParams(p.parent_path(), p.filename().string(), entry);
+
     return true;
 }
 
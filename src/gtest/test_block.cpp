@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 
+#include "hash.h"
 #include "primitives/block.h"
 
 
@@ -11,3 +12,26 @@ TEST(block_tests, header_size_is_expected) {
 
     ASSERT_EQ(ss.size(), CBlockHeader::HEADER_SIZE);
 }
+
+TEST(block_tests, cached_hash_follows_changes) {
+    CBlockHeader header;
+    header.nSolution.assign(1344, 0x5a);
+    uint256 hash = header.GetHash();
+    EXPECT_EQ(hash, SerializeHash(header));
+    EXPECT_EQ(hash, header.GetHash());
+
+    // Every change to the header, including one inside the solution, is
+    // noticed rather than answered with the old hash
+    header.nNonce = uint256S("1");
+    EXPECT_NE(hash, header.GetHash());
+    EXPECT_EQ(SerializeHash(header), header.GetHash());
+    header.nSolution[700] ^= 1;
+    EXPECT_EQ(SerializeHash(header), header.GetHash());
+
+    // Copies share the cached hash and stay independent of the original
+    CBlockHeader copy = header;
+    header.nTime++;
+    EXPECT_EQ(SerializeHash(copy), copy.GetHash());
+    EXPECT_EQ(SerializeHash(header), header.GetHash());
+    EXPECT_NE(copy.GetHash(), header.GetHash());
+}
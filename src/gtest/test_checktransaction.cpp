@@ -430,6 +430,29 @@ TEST(checktransaction_tests, bad_txns_inputs_duplicate) {
     CheckTransactionWithoutProofVerification(tx, state);
 }
 
+TEST(checktransaction_tests, bad_txns_inputs_duplicate_many_inputs) {
+    // More inputs than are checked without allocating, the duplicates far apart
+    CMutableTransaction mtx = GetValidTransaction();
+    mtx.vin.resize(100);
+    for (uint32_t i = 0; i < mtx.vin.size(); i++) {
+        mtx.vin[i].prevout.hash = uint256S("0000000000000000000000000000000000000000000000000000000000000001");
+        mtx.vin[i].prevout.n = mtx.vin.size() - i;
+    }
+
+    {
+        CTransaction tx(mtx);
+        MockCValidationState state;
+        EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, "bad-txns-inputs-duplicate", false)).Times(0);
+        CheckTransactionWithoutProofVerification(tx, state);
+    }
+
+    mtx.vin[97].prevout = mtx.vin[3].prevout;
+    CTransaction tx(mtx);
+    MockCValidationState state;
+    EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, "bad-txns-inputs-duplicate", false)).Times(1);
+    CheckTransactionWithoutProofVerification(tx, state);
+}
+
 TEST(checktransaction_tests, bad_joinsplits_nullifiers_duplicate_same_joinsplit) {
     CMutableTransaction mtx = GetValidTransaction();
     mtx.vjoinsplit[0].nullifiers.at(0) = uint256S("0000000000000000000000000000000000000000000000000000000000000000");
@@ -370,4 +370,40 @@ TEST(keystore_tests, store_and_retrieve_spending_key_in_encrypted_store) {
     ASSERT_EQ(1, addrs.count(addr));
     ASSERT_EQ(1, addrs.count(addr2));
 }
+
+TEST(keystore_tests, StoreAndRetrieveSaplingSpendingKeyInEncryptedStore) {
+    TestCCryptoKeyStore keyStore;
+    uint256 r {GetRandHash()};
+    CKeyingMaterial vMasterKey (r.begin(), r.end());
+    libzcash::SaplingExtendedSpendingKey skOut;
+
+    auto seed = HDSeed::Random();
+    auto sk = libzcash::SaplingExtendedSpendingKey::Master(seed);
+    auto fvk = sk.expsk.full_viewing_key();
+    ASSERT_TRUE(keyStore.AddSaplingSpendingKey(sk, sk.DefaultAddress()));
+    ASSERT_TRUE(keyStore.EncryptKeys(vMasterKey));
+    EXPECT_FALSE(keyStore.GetSaplingSpendingKey(fvk, skOut));
+
+    // The only record to check the master key against is the Sapling key
+    CKeyingMaterial vModifiedKey (r.begin(), r.end());
+    vModifiedKey[0] += 1;
+    EXPECT_FALSE(keyStore.Unlock(vModifiedKey));
+    EXPECT_FALSE(keyStore.GetSaplingSpendingKey(fvk, skOut));
+
+    // The key is decrypted on first use and then served from memory
+    ASSERT_TRUE(keyStore.Unlock(vMasterKey));
+    ASSERT_TRUE(keyStore.GetSaplingSpendingKey(fvk, skOut));
+    EXPECT_EQ(sk, skOut);
+    ASSERT_TRUE(keyStore.GetSaplingSpendingKey(fvk, skOut));
+    EXPECT_EQ(sk, skOut);
+
+    // Locking forgets the decrypted key
+    ASSERT_TRUE(keyStore.Lock());
+    EXPECT_TRUE(keyStore.HaveSaplingSpendingKey(fvk));
+    EXPECT_FALSE(keyStore.GetSaplingSpendingKey(fvk, skOut));
+
+    ASSERT_TRUE(keyStore.Unlock(vMasterKey));
+    ASSERT_TRUE(keyStore.GetSaplingSpendingKey(fvk, skOut));
+    EXPECT_EQ(sk, skOut);
+}
 #endif
@@ -16,6 +16,7 @@
 
 #include <iostream>
 
+#include <list>
 #include <stdexcept>
 
 #include "utilstrencodings.h"
@@ -342,3 +343,176 @@ TEST(merkletree, testZeroElements) {
         ASSERT_TRUE(newTree.root() == oldroot);
     }
 }
+
+template<typename Tree, typename Witness, typename WitnessFrontier>
+void test_witness_frontier(UniValue commitment_tests)
+{
+    Tree tree;
+    std::list<Witness> appended, batched;
+    std::vector<Tree> trees;
+
+    // Add the commitments in batches of varying size, witnessing some of
+    // them, and check the batched witnesses against appending to each
+    size_t i = 0;
+    for (size_t batch = 1; i < 16; batch++) {
+        WitnessFrontier frontier;
+        for (Witness& wit : batched) {
+            frontier.track(wit, tree);
+        }
+        trees.push_back(tree);
+
+        for (size_t j = 0; j < batch % 4 && i < 16; j++, i++) {
+            uint256 test_commitment = uint256S(commitment_tests[i].get_str());
+            tree.append(test_commitment);
+            frontier.appended(tree);
+            for (Witness& wit : appended) {
+                wit.append(test_commitment);
+            }
+            if (i % 3 != 1) {
+                appended.push_back(tree.witness());
+                batched.push_back(tree.witness());
+                frontier.track(batched.back(), tree);
+            }
+        }
+        frontier.finish(tree);
+
+        ASSERT_TRUE(appended == batched);
+        for (const Witness& wit : batched) {
+            ASSERT_TRUE(tree.root() == wit.root());
+        }
+    }
+
+    // Rewinding a witness gives the witness of an earlier tree
+    for (const Witness& wit : appended) {
+        for (const Tree& earlier : trees) {
+            Witness rewound = wit;
+            if (earlier.size() <= wit.position()) {
+                ASSERT_THROW(rewound.rewind(earlier), std::runtime_error);
+                continue;
+            }
+            rewound.rewind(earlier);
+            ASSERT_TRUE(earlier.root() == rewound.root());
+        }
+    }
+}
+
+TEST(merkletree, WitnessFrontier) {
+    UniValue commitment_tests = read_json(MAKE_STRING(json_tests::merkle_commitments));
+    test_witness_frontier<SproutTestingMerkleTree, SproutTestingWitness, SproutTestingWitnessFrontier>(commitment_tests);
+}
+
+TEST(merkletree, SaplingWitnessFrontier) {
+    UniValue commitment_tests = read_json(MAKE_STRING(json_tests::merkle_commitments_sapling));
+    test_witness_frontier<SaplingTestingMerkleTree, SaplingTestingWitness, SaplingTestingWitnessFrontier>(commitment_tests);
+}
+
+template<typename Tree, typename Hash>
+void test_append_many(UniValue commitment_tests)
+{
+    // Appending any run of commitments at once, to a tree of any size,
+    // gives the tree appending them one at a time does
+    for (size_t start = 0; start <= 16; start++) {
+        for (size_t count = 0; start + count <= 16; count++) {
+            Tree appended, batched;
+            std::vector<Hash> batch;
+            for (size_t i = 0; i < start + count; i++) {
+                uint256 test_commitment = uint256S(commitment_tests[i].get_str());
+                appended.append(test_commitment);
+                if (i < start) {
+                    batched.append(test_commitment);
+                } else {
+                    batch.push_back(test_commitment);
+                }
+            }
+            uint256 rootBefore = batched.root();
+            batched.append_many(batch);
+
+            ASSERT_TRUE(appended == batched);
+            ASSERT_TRUE(appended.root() == batched.root());
+            ASSERT_EQ(appended.size(), batched.size());
+            if (count > 0) {
+                ASSERT_TRUE(rootBefore != batched.root());
+            }
+        }
+    }
+
+    Tree full;
+    std::vector<Hash> batch;
+    for (size_t i = 0; i < 16; i++) {
+        batch.push_back(uint256S(commitment_tests[i].get_str()));
+    }
+    full.append_many(batch);
+    ASSERT_THROW(full.append_many(std::vector<Hash>(1)), std::runtime_error);
+    ASSERT_THROW(full.append(Hash()), std::runtime_error);
+
+    Tree half;
+    half.append_many(std::vector<Hash>(batch.begin(), batch.begin() + 8));
+    ASSERT_THROW(half.append_many(std::vector<Hash>(9)), std::runtime_error);
+    ASSERT_EQ(half.size(), 8);
+}
+
+TEST(merkletree, AppendMany) {
+    UniValue commitment_tests = read_json(MAKE_STRING(json_tests::merkle_commitments));
+    test_append_many<SproutTestingMerkleTree, libzcash::SHA256Compress>(commitment_tests);
+}
+
+TEST(merkletree, SaplingAppendMany) {
+    UniValue commitment_tests = read_json(MAKE_STRING(json_tests::merkle_commitments_sapling));
+    test_append_many<SaplingTestingMerkleTree, libzcash::PedersenHash>(commitment_tests);
+}
+
+template<typename Tree>
+void test_compact_frontier(UniValue commitment_tests)
+{
+    Tree tree;
+    for (size_t i = 0; i <= 16; i++) {
+        if (i > 0) {
+            tree.append(uint256S(commitment_tests[i - 1].get_str()));
+        }
+
+        CDataStream ssCompact(SER_NETWORK, PROTOCOL_VERSION);
+        ssCompact << libzcash::CompactFrontier<Tree>(tree);
+        CDataStream ssDefault(SER_NETWORK, PROTOCOL_VERSION);
+        ssDefault << tree;
+        ASSERT_LT(ssCompact.size(), ssDefault.size());
+
+        // Both formats read back to the same tree, replacing what was
+        // there and its cached root
+        Tree fromCompact;
+        fromCompact.append(uint256());
+        fromCompact.root();
+        libzcash::CompactFrontier<Tree> compact(fromCompact);
+        ssCompact >> compact;
+        ASSERT_TRUE(ssCompact.empty());
+        ASSERT_TRUE(fromCompact == tree);
+        ASSERT_TRUE(fromCompact.root() == tree.root());
+
+        Tree fromDefault;
+        libzcash::CompactFrontier<Tree> compactDefault(fromDefault);
+        ssDefault >> compactDefault;
+        ASSERT_TRUE(ssDefault.empty());
+        ASSERT_TRUE(fromDefault == tree);
+    }
+
+    // A mask naming more parents than the tree has room for
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << (unsigned char)0xff << VARINT((uint64_t)1 << 10);
+    Tree invalid;
+    libzcash::CompactFrontier<Tree> compactInvalid(invalid);
+    ASSERT_THROW(ss >> compactInvalid, std::ios_base::failure);
+
+    // A first byte that is neither the marker nor an optional discriminant
+    CDataStream ss2(SER_NETWORK, PROTOCOL_VERSION);
+    ss2 << (unsigned char)0x02;
+    ASSERT_THROW(ss2 >> compactInvalid, std::ios_base::failure);
+}
+
+TEST(merkletree, CompactFrontier) {
+    UniValue commitment_tests = read_json(MAKE_STRING(json_tests::merkle_commitments));
+    test_compact_frontier<SproutTestingMerkleTree>(commitment_tests);
+}
+
+TEST(merkletree, SaplingCompactFrontier) {
+    UniValue commitment_tests = read_json(MAKE_STRING(json_tests::merkle_commitments_sapling));
+    test_compact_frontier<SaplingTestingMerkleTree>(commitment_tests);
+}
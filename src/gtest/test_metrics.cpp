@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include "metrics.h"
+#include "tinyformat.h"
 #include "utiltime.h"
 
 
@@ -93,6 +94,62 @@ TEST(Metrics, GetLocalSolPS) {
     EXPECT_EQ(1, GetLocalSolPS());
 }
 
+TEST(Metrics, GetLocalSolPSByThread) {
+    SetMockTime(100);
+    MinerThreadMetrics& thread0 = GetMinerThreadMetrics(0);
+    MinerThreadMetrics& thread1 = GetMinerThreadMetrics(1);
+    EXPECT_EQ(&thread0, &GetMinerThreadMetrics(0));
+    EXPECT_TRUE(GetLocalSolPSByThread().empty());
+
+    thread0.timer.start();
+    thread1.timer.start();
+    SetMockTime(102);
+    thread0.solutionTargetChecks.increment();
+    thread1.solutionTargetChecks.increment();
+    thread1.solutionTargetChecks.increment();
+
+    std::vector<std::pair<int, double> > rates = GetLocalSolPSByThread();
+    ASSERT_EQ(2, rates.size());
+    EXPECT_EQ(0, rates[0].first);
+    EXPECT_EQ(0.5, rates[0].second);
+    EXPECT_EQ(1, rates[1].first);
+    EXPECT_EQ(1, rates[1].second);
+
+    // Stopped threads are not reported
+    thread0.timer.stop();
+    rates = GetLocalSolPSByThread();
+    ASSERT_EQ(1, rates.size());
+    EXPECT_EQ(1, rates[0].first);
+    thread1.timer.stop();
+}
+
+TEST(Metrics, AtomicHistogram) {
+    AtomicHistogram h;
+    EXPECT_EQ(0, h.cumulativeCount(AtomicHistogram::BUCKETS));
+
+    h.observe(50);          // 0.00005s, first bucket
+    h.observe(100);         // on the first bound
+    h.observe(2000);        // 0.002s, fourth bucket
+    h.observe(120000000);   // past the last bound
+    EXPECT_EQ(2, h.cumulativeCount(0));
+    EXPECT_EQ(2, h.cumulativeCount(2));
+    EXPECT_EQ(3, h.cumulativeCount(3));
+    EXPECT_EQ(3, h.cumulativeCount(AtomicHistogram::BUCKETS - 1));
+    EXPECT_EQ(4, h.cumulativeCount(AtomicHistogram::BUCKETS));
+    EXPECT_DOUBLE_EQ(120.00215, h.sum());
+}
+
+TEST(Metrics, GetNetMessageMetrics) {
+    NetMessageMetrics& ping = GetNetMessageMetrics("ping");
+    EXPECT_EQ(&ping, &GetNetMessageMetrics("ping"));
+
+    // Made-up commands are lumped together once there are too many
+    for (size_t i = 0; i < MAX_METRICS_LABELS; i++)
+        GetNetMessageMetrics(strprintf("bogus%d", i));
+    EXPECT_EQ(&GetNetMessageMetrics("other"), &GetNetMessageMetrics("bogus-new"));
+    EXPECT_EQ(&ping, &GetNetMessageMetrics("ping"));
+}
+
 TEST(Metrics, EstimateNetHeightInner) {
     // Ensure that the (rounded) current height is returned if the tip is current
     SetMockTime(15000);
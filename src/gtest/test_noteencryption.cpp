@@ -94,6 +94,11 @@ TEST(noteencryption, NotePlaintext)
     ASSERT_TRUE(note.r == new_note.r);
     ASSERT_TRUE(note.cm() == new_note.cm());
 
+    // The recipient derived while checking the commitment can be returned
+    uint256 pk_d;
+    ASSERT_TRUE(SaplingNotePlaintext::decrypt(ct, ivk, epk, cmu, &pk_d));
+    ASSERT_TRUE(pk_d == addr.pk_d);
+
     SaplingOutgoingPlaintext out_pt;
     out_pt.pk_d = note.pk_d;
     out_pt.esk = encryptor.get_esk();
@@ -429,6 +434,47 @@ TEST(noteencryption, api)
     }
 }
 
+TEST(noteencryption, TrialDecryption)
+{
+    uint256 sk_enc = ZCNoteEncryption::generate_privkey(uint252(uint256S("21035d60bc1983e37950ce4803418a8fb33ea68d5b937ca382ecbae7564d6a07")));
+    uint256 pk_enc = ZCNoteEncryption::generate_pubkey(sk_enc);
+    ZCNoteDecryption decrypter(sk_enc);
+    ZCNoteDecryption other(ZCNoteEncryption::generate_privkey(uint252()));
+
+    ZCNoteEncryption b = ZCNoteEncryption(uint256());
+    std::array<unsigned char, ZC_NOTEPLAINTEXT_SIZE> message;
+    for (size_t i = 0; i < ZC_NOTEPLAINTEXT_SIZE; i++) {
+        message[i] = (unsigned char) i;
+    }
+
+    // Ciphertexts under one ephemeral key share the secret, as the two
+    // ciphertexts of a JoinSplit do
+    auto ciphertext0 = b.encrypt(pk_enc, message);
+    auto ciphertext1 = b.encrypt(pk_enc, message);
+    uint256 dhsecret = decrypter.shared_secret(b.get_epk());
+    ASSERT_TRUE(dhsecret == decrypter.shared_secret(b.get_epk()));
+
+    auto plaintext0 = decrypter.try_decrypt(ciphertext0, dhsecret, b.get_epk(), uint256(), 0);
+    auto plaintext1 = decrypter.try_decrypt(ciphertext1, dhsecret, b.get_epk(), uint256(), 1);
+    ASSERT_TRUE(plaintext0 && *plaintext0 == message);
+    ASSERT_TRUE(plaintext1 && *plaintext1 == message);
+    ASSERT_TRUE(*plaintext0 == decrypter.decrypt(ciphertext0, b.get_epk(), uint256(), 0));
+
+    // Failures are reported without throwing
+    ASSERT_TRUE(decrypter.try_decrypt(ciphertext0, dhsecret, b.get_epk(), uint256(), 1) == boost::none);
+    ASSERT_TRUE(decrypter.try_decrypt(ciphertext0, uint256(), b.get_epk(), uint256(), 0) == boost::none);
+    uint256 otherSecret = other.shared_secret(b.get_epk());
+    ASSERT_TRUE(other.try_decrypt(ciphertext0, otherSecret, b.get_epk(), uint256(), 0) == boost::none);
+    ciphertext1[10] ^= 0xff;
+    ASSERT_TRUE(decrypter.try_decrypt(ciphertext1, dhsecret, b.get_epk(), uint256(), 1) == boost::none);
+
+    // Notes encrypted with the sender's key in the KDF still decrypt
+    ZCNoteEncryption c = ZCNoteEncryption(uint256());
+    auto ciphertext2 = c.encrypt(pk_enc, message, sk_enc);
+    auto plaintext2 = decrypter.try_decrypt(ciphertext2, decrypter.shared_secret(c.get_epk()), c.get_epk(), uint256(), 0);
+    ASSERT_TRUE(plaintext2 && *plaintext2 == message);
+}
+
 uint256 test_prf(
     unsigned char distinguisher,
     uint252 seed_x,
@@ -70,3 +70,33 @@ TEST(SaplingNote, Random)
     ASSERT_NE(note1.d, note3.d);
     ASSERT_NE(note1.pk_d, note3.pk_d);
 }
+
+TEST(SaplingNote, CompactDecrypt)
+{
+    auto sk = SaplingSpendingKey::random();
+    auto ivk = sk.full_viewing_key().in_viewing_key();
+    auto address = sk.default_address();
+    SaplingNote note(address, GetRand(MAX_MONEY));
+    auto cm = note.cm().get();
+
+    std::array<unsigned char, ZC_MEMO_SIZE> memo;
+    memo.fill(0xf6);
+    SaplingNotePlaintext pt(note, memo);
+    auto encrypted = pt.encrypt(note.pk_d).get();
+    auto epk = encrypted.second.get_epk();
+
+    SaplingCompactCiphertext compact;
+    std::copy(encrypted.first.begin(), encrypted.first.begin() + compact.size(), compact.begin());
+
+    // The ciphertext prefix is enough to recognise the note
+    ASSERT_TRUE(SaplingNotePlaintext::compact_decrypt(compact, ivk, epk, cm));
+
+    // Other keys and commitments do not match
+    auto ivk2 = SaplingSpendingKey::random().full_viewing_key().in_viewing_key();
+    ASSERT_FALSE(SaplingNotePlaintext::compact_decrypt(compact, ivk2, epk, cm));
+    ASSERT_FALSE(SaplingNotePlaintext::compact_decrypt(compact, ivk, epk, random_uint256()));
+
+    // Corrupting the prefix changes the recovered note
+    compact[20] ^= 1;
+    ASSERT_FALSE(SaplingNotePlaintext::compact_decrypt(compact, ivk, epk, cm));
+}
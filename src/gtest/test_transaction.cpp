@@ -1,6 +1,8 @@
 #include <gtest/gtest.h>
 
+#include "clientversion.h"
 #include "primitives/transaction.h"
+#include "streams.h"
 #include "zcash/Note.hpp"
 #include "zcash/Address.hpp"
 
@@ -88,3 +90,54 @@ TEST(Transaction, JSDescriptionRandomized) {
         EXPECT_EQ(expectedOutputMap, outputMap);
     }
 }
+
+TEST(Transaction, SerializeWithoutProofs) {
+    CMutableTransaction mtx;
+    mtx.fOverwintered = true;
+    mtx.nVersion = SAPLING_TX_VERSION;
+    mtx.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+    mtx.vjoinsplit.push_back(JSDescription());
+    mtx.vjoinsplit[0].proof = libzcash::GrothProof();
+    mtx.vjoinsplit[0].nullifiers[0] = uint256S("01");
+    mtx.vjoinsplit[0].ciphertexts[0][0] = 1;
+    mtx.joinSplitPubKey = uint256S("02");
+    mtx.joinSplitSig[0] = 3;
+    mtx.vShieldedSpend.push_back(SpendDescription());
+    mtx.vShieldedSpend[0].nullifier = uint256S("04");
+    mtx.vShieldedSpend[0].zkproof.fill(5);
+    mtx.vShieldedSpend[0].spendAuthSig.fill(6);
+    mtx.vShieldedOutput.push_back(OutputDescription());
+    mtx.vShieldedOutput[0].cm = uint256S("07");
+    mtx.vShieldedOutput[0].encCiphertext.fill(8);
+    mtx.vShieldedOutput[0].outCiphertext.fill(9);
+    mtx.vShieldedOutput[0].zkproof.fill(10);
+    mtx.bindingSig[0] = 11;
+    CTransaction tx(mtx);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << tx;
+    size_t nFullSize = ss.size();
+    ss.clear();
+    OverrideStream<CDataStream> os(&ss, SER_DISK | SER_WITHOUT_PROOFS, CLIENT_VERSION);
+    os << tx;
+    // Three Groth proofs, the spend authorization, JoinSplit and binding signatures, and outCiphertext
+    EXPECT_EQ(nFullSize - (3 * libzcash::GROTH_PROOF_SIZE + 3 * 64 + ZC_SAPLING_OUTCIPHERTEXT_SIZE), ss.size());
+
+    CTransaction txOut;
+    os >> txOut;
+    EXPECT_TRUE(ss.empty());
+    // What the wallet uses is kept, the rest comes back empty
+    EXPECT_TRUE(txOut.GetHash().IsNull());
+    EXPECT_EQ(tx.vjoinsplit[0].nullifiers[0], txOut.vjoinsplit[0].nullifiers[0]);
+    EXPECT_EQ(tx.vjoinsplit[0].ciphertexts[0], txOut.vjoinsplit[0].ciphertexts[0]);
+    EXPECT_TRUE(txOut.vjoinsplit[0].proof == libzcash::SproutProof(libzcash::GrothProof()));
+    EXPECT_EQ(tx.joinSplitPubKey, txOut.joinSplitPubKey);
+    EXPECT_EQ(0, txOut.joinSplitSig[0]);
+    EXPECT_EQ(tx.vShieldedSpend[0].nullifier, txOut.vShieldedSpend[0].nullifier);
+    EXPECT_EQ(0, txOut.vShieldedSpend[0].zkproof[0]);
+    EXPECT_EQ(0, txOut.vShieldedSpend[0].spendAuthSig[0]);
+    EXPECT_EQ(tx.vShieldedOutput[0].cm, txOut.vShieldedOutput[0].cm);
+    EXPECT_EQ(tx.vShieldedOutput[0].encCiphertext, txOut.vShieldedOutput[0].encCiphertext);
+    EXPECT_EQ(0, txOut.vShieldedOutput[0].outCiphertext[0]);
+    EXPECT_EQ(0, txOut.bindingSig[0]);
+}
@@ -1,6 +1,7 @@
 #include "httprpc.h"
 
 #include "chainparams.h"
+#include "crypto/sha256.h"
 #include "httpserver.h"
 #include "key_io.h"
 #include "rpc/protocol.h"
@@ -11,10 +12,32 @@
 #include "utilstrencodings.h"
 #include "ui_interface.h"
 
+#include <memory>
+#include <set>
+
 #include <boost/algorithm/string.hpp> // boost::trim
+#include <boost/bind.hpp>
 
 /** WWW-Authenticate to present with 401 Unauthorized response */
 static const char* WWW_AUTH_HEADER_DATA = "Basic realm=\"jsonrpc\"";
+/** How much of a request body is looked at to find the method it calls */
+static const size_t RPC_CLASSIFY_PEEK_SIZE = 1024;
+/** Number of distinct Authorization headers remembered as verified */
+static const size_t MAX_RPC_AUTH_CACHE = 16;
+
+/** Calls that can run for minutes, given their own threads */
+static const char* const HEAVY_RPC_METHODS[] = {
+    "gettxoutsetinfo", "dumptxoutset", "verifychain", "benchconnectblocks",
+    "importprivkey", "importaddress", "importwallet", "dumpwallet",
+    "z_importkey", "z_importviewingkey", "z_importkeys", "z_importwallet", "z_exportwallet",
+    "z_getbalance", "z_gettotalbalance", "z_listreceivedbyaddress", "z_listunspent",
+    "getaddressbalance", "getaddressdeltas", "getaddresstxids", "getaddressutxos",
+    "getrawtransactions", "z_getnotewitness",
+};
+/** Cheap calls used to check on a node, besides the read-only ones */
+static const char* const FAST_RPC_METHODS[] = {
+    "getblockchaininfo", "getmempoolinfo", "getnetworkinfo", "getconnectioncount", "ping",
+};
 
 /** Simple one-shot callback timer to be used by the RPC mechanism to e.g.
  * re-lock the wallet.
@@ -55,6 +78,12 @@ private:
 
 /* Pre-base64-encoded authentication token */
 static std::string strRPCUserColonPass;
+/* Digests of the Authorization headers already found to be right, so that
+ * clients sending the same header on every call skip the decoding. Digests
+ * are kept rather than the headers so that lookups reveal nothing by their
+ * timing. */
+static std::set<uint256> setRPCAuthVerified;
+static CCriticalSection cs_rpcAuthVerified;
 /* Stored RPC timer interface (for unregistration) */
 static HTTPRPCTimerInterface* httpRPCTimerInterface = 0;
 
@@ -75,16 +104,39 @@ static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const Uni
     req->WriteReply(nStatus, strReply);
 }
 
+static void JSONDeferredReply(std::shared_ptr<HTTPRequest> req, const UniValue& id, const UniValue& result, const UniValue& objError)
+{
+    if (!objError.isNull()) {
+        JSONErrorReply(req.get(), objError, id);
+        return;
+    }
+    req->WriteHeader("Content-Type", "application/json");
+    req->WriteReply(HTTP_OK, JSONRPCReply(result, NullUniValue, id));
+}
+
 static bool RPCAuthorized(const std::string& strAuth)
 {
     if (strRPCUserColonPass.empty()) // Belt-and-suspenders measure if InitRPCAuthentication was not called
         return false;
+    uint256 hashAuth;
+    CSHA256().Write((const unsigned char*)strAuth.data(), strAuth.size()).Finalize(hashAuth.begin());
+    {
+        LOCK(cs_rpcAuthVerified);
+        if (setRPCAuthVerified.count(hashAuth))
+            return true;
+    }
     if (strAuth.substr(0, 6) != "Basic ")
         return false;
     std::string strUserPass64 = strAuth.substr(6);
     boost::trim(strUserPass64);
     std::string strUserPass = DecodeBase64(strUserPass64);
-    return TimingResistantEqual(strUserPass, strRPCUserColonPass);
+    if (!TimingResistantEqual(strUserPass, strRPCUserColonPass))
+        return false;
+    LOCK(cs_rpcAuthVerified);
+    if (setRPCAuthVerified.size() >= MAX_RPC_AUTH_CACHE)
+        setRPCAuthVerified.clear();
+    setRPCAuthVerified.insert(hashAuth);
+    return true;
 }
 
 static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
@@ -115,19 +167,34 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         return false;
     }
 
+    // Calls to one of several wallets come in on /wallet/<name>
+    RPCRequestURIScope uriScope(req->GetURI());
+
     JSONRequest jreq;
     try {
-        // Parse request
+        // Parse request: calls without parameters, the most frequent ones,
+        // need no UniValue of the whole request
+        std::string strRequest = req->ReadBody();
+        bool fSimple = jreq.parseSimple(strRequest);
         UniValue valRequest;
-        if (!valRequest.read(req->ReadBody()))
+        if (!fSimple && !valRequest.read(strRequest))
             throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
 
         std::string strReply;
         // singleton request
-        if (valRequest.isObject()) {
-            jreq.parse(valRequest);
+        if (fSimple || valRequest.isObject()) {
+            if (!fSimple)
+                jreq.parse(valRequest);
 
-            UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
+            UniValue result;
+            try {
+                RPCDeferralScope deferralScope;
+                result = tableRPC.execute(jreq.strMethod, jreq.params);
+            } catch (const RPCDeferral& deferral) {
+                std::shared_ptr<HTTPRequest> preq(req->Detach());
+                deferral.start(boost::bind(&JSONDeferredReply, preq, jreq.id, _1, _2));
+                return true;
+            }
 
             // Send reply
             strReply = JSONRPCReply(result, NullUniValue, jreq.id);
@@ -150,6 +217,54 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
     return true;
 }
 
+/** Find the method of a single request from the start of its body, without
+ * parsing all of it. Batches and anything unusual give false.
+ */
+static bool PeekRPCMethod(const std::string& strBody, std::string& strMethod)
+{
+    size_t nPos = strBody.find_first_not_of(" \t\r\n");
+    if (nPos == std::string::npos || strBody[nPos] != '{')
+        return false;
+    nPos = strBody.find("\"method\"", nPos);
+    if (nPos == std::string::npos)
+        return false;
+    nPos = strBody.find_first_not_of(" \t\r\n", nPos + 8);
+    if (nPos == std::string::npos || strBody[nPos] != ':')
+        return false;
+    nPos = strBody.find_first_not_of(" \t\r\n", nPos + 1);
+    if (nPos == std::string::npos || strBody[nPos] != '"')
+        return false;
+    size_t nEnd = strBody.find_first_of("\"\\", nPos + 1);
+    if (nEnd == std::string::npos || strBody[nEnd] != '"')
+        return false;
+    strMethod = strBody.substr(nPos + 1, nEnd - nPos - 1);
+    return true;
+}
+
+/** Pick the work queue of a JSON-RPC request by the method it calls. A wrong
+ * guess only affects which threads run the call, not what it does.
+ */
+static HTTPWorkClass HTTPReq_JSONRPC_Class(HTTPRequest* req, const std::string &)
+{
+    std::string strMethod;
+    if (req->GetRequestMethod() != HTTPRequest::POST || !PeekRPCMethod(req->PeekBody(RPC_CLASSIFY_PEEK_SIZE), strMethod))
+        return HTTP_WORK_DEFAULT;
+    const CRPCCommand* pcmd = tableRPC[strMethod];
+    if (!pcmd)
+        return HTTP_WORK_FAST;
+    for (size_t i = 0; i < ARRAYLEN(HEAVY_RPC_METHODS); i++)
+        if (strMethod == HEAVY_RPC_METHODS[i])
+            return HTTP_WORK_HEAVY;
+    if (pcmd->okParallel)
+        return HTTP_WORK_FAST;
+    for (size_t i = 0; i < ARRAYLEN(FAST_RPC_METHODS); i++)
+        if (strMethod == FAST_RPC_METHODS[i])
+            return HTTP_WORK_FAST;
+    if (pcmd->category == "wallet")
+        return HTTP_WORK_WALLET;
+    return HTTP_WORK_DEFAULT;
+}
+
 static bool InitRPCAuthentication()
 {
     if (mapArgs["-rpcpassword"] == "")
@@ -164,6 +279,8 @@ static bool InitRPCAuthentication()
     } else {
         strRPCUserColonPass = mapArgs["-rpcuser"] + ":" + mapArgs["-rpcpassword"];
     }
+    LOCK(cs_rpcAuthVerified);
+    setRPCAuthVerified.clear();
     return true;
 }
 
@@ -173,7 +290,10 @@ bool StartHTTPRPC()
     if (!InitRPCAuthentication())
         return false;
 
-    RegisterHTTPHandler("/", true, HTTPReq_JSONRPC);
+    RegisterHTTPHandler("/", true, HTTPReq_JSONRPC, HTTPReq_JSONRPC_Class);
+#ifdef ENABLE_WALLET
+    RegisterHTTPHandler("/wallet/", false, HTTPReq_JSONRPC, HTTPReq_JSONRPC_Class);
+#endif
 
     assert(EventBase());
     httpRPCTimerInterface = new HTTPRPCTimerInterface(EventBase());
@@ -190,6 +310,9 @@ void StopHTTPRPC()
 {
     LogPrint("rpc", "Stopping HTTP RPC server\n");
     UnregisterHTTPHandler("/", true);
+#ifdef ENABLE_WALLET
+    UnregisterHTTPHandler("/wallet/", false);
+#endif
     if (httpRPCTimerInterface) {
         RPCUnsetTimerInterface(httpRPCTimerInterface);
         delete httpRPCTimerInterface;
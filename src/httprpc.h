@@ -34,4 +34,13 @@ void InterruptREST();
  */
 void StopREST();
 
+/** Start the Prometheus metrics endpoint at /metrics.
+ * Precondition; HTTP has been started.
+ */
+bool StartHTTPMetrics();
+/** Stop the metrics endpoint.
+ * Precondition; HTTP has been stopped.
+ */
+void StopHTTPMetrics();
+
 #endif
@@ -7,6 +7,7 @@
 
 #include "chainparamsbase.h"
 #include "compat.h"
+#include "corebudget.h"
 #include "util.h"
 #include "netbase.h"
 #include "rpc/protocol.h" // For HTTP status codes
@@ -59,6 +60,22 @@ private:
     HTTPRequestHandler func;
 };
 
+/** Work item for other tasks run on the HTTP worker threads */
+class HTTPTaskItem : public HTTPClosure
+{
+public:
+    HTTPTaskItem(const boost::function<void(void)>& func): func(func)
+    {
+    }
+    void operator()()
+    {
+        func();
+    }
+
+private:
+    boost::function<void(void)> func;
+};
+
 /** Simple work queue for distributing work over multiple threads.
  * Work items are simply callable objects.
  */
@@ -70,10 +87,17 @@ private:
     CWaitableCriticalSection cs;
     CConditionVariable cond;
     /* XXX in C++11 we can use std::unique_ptr here and avoid manual cleanup */
-    std::deque<WorkItem*> queue;
+    //! Items with the time they were queued at
+    std::deque<std::pair<WorkItem*, int64_t> > queue;
     bool running;
     size_t maxDepth;
     int numThreads;
+    uint64_t nRequests;
+    uint64_t nRejected;
+    int64_t nWaitTotal;
+    int64_t nWaitMax;
+    int64_t nRunTotal;
+    int64_t nRunMax;
 
     /** RAII object to keep track of number of running worker threads */
     class ThreadCounter
@@ -96,7 +120,13 @@ private:
 public:
     WorkQueue(size_t maxDepth) : running(true),
                                  maxDepth(maxDepth),
-                                 numThreads(0)
+                                 numThreads(0),
+                                 nRequests(0),
+                                 nRejected(0),
+                                 nWaitTotal(0),
+                                 nWaitMax(0),
+                                 nRunTotal(0),
+                                 nRunMax(0)
     {
     }
     /*( Precondition: worker threads have all stopped
@@ -105,7 +135,7 @@ public:
     ~WorkQueue()
     {
         while (!queue.empty()) {
-            delete queue.front();
+            delete queue.front().first;
             queue.pop_front();
         }
     }
@@ -114,9 +144,10 @@ public:
     {
         boost::unique_lock<boost::mutex> lock(cs);
         if (queue.size() >= maxDepth) {
+            nRejected++;
             return false;
         }
-        queue.push_back(item);
+        queue.push_back(std::make_pair(item, GetTimeMicros()));
         cond.notify_one();
         return true;
     }
@@ -126,17 +157,32 @@ public:
         ThreadCounter count(*this);
         while (running) {
             WorkItem* i = 0;
+            int64_t nTimeStart;
             {
                 boost::unique_lock<boost::mutex> lock(cs);
                 while (running && queue.empty())
                     cond.wait(lock);
                 if (!running)
                     break;
-                i = queue.front();
+                i = queue.front().first;
+                nTimeStart = GetTimeMicros();
+                int64_t nWait = nTimeStart - queue.front().second;
+                nWaitTotal += nWait;
+                nWaitMax = std::max(nWaitMax, nWait);
                 queue.pop_front();
             }
-            (*i)();
+            {
+                CCoreReservation core(CORE_CLASS_RPC);
+                (*i)();
+            }
             delete i;
+            int64_t nRun = GetTimeMicros() - nTimeStart;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                nRequests++;
+                nRunTotal += nRun;
+                nRunMax = std::max(nRunMax, nRun);
+            }
         }
     }
     /** Interrupt and exit loops */
@@ -160,18 +206,47 @@ public:
         boost::unique_lock<boost::mutex> lock(cs);
         return queue.size();
     }
+
+    void GetStats(HTTPWorkStats& stats)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        stats.nThreads = numThreads;
+        stats.nDepth = queue.size();
+        stats.nRequests = nRequests;
+        stats.nRejected = nRejected;
+        stats.nWaitTotal = nWaitTotal;
+        stats.nWaitMax = nWaitMax;
+        stats.nRunTotal = nRunTotal;
+        stats.nRunMax = nRunMax;
+    }
 };
 
 struct HTTPPathHandler
 {
     HTTPPathHandler() {}
-    HTTPPathHandler(std::string prefix, bool exactMatch, HTTPRequestHandler handler):
-        prefix(prefix), exactMatch(exactMatch), handler(handler)
+    HTTPPathHandler(std::string prefix, bool exactMatch, HTTPRequestHandler handler, HTTPRequestClassifier classifier):
+        prefix(prefix), exactMatch(exactMatch), handler(handler), classifier(classifier)
     {
     }
     std::string prefix;
     bool exactMatch;
     HTTPRequestHandler handler;
+    HTTPRequestClassifier classifier;
+};
+
+/** A class of work: its name, the option for its number of threads and the default */
+struct HTTPWorkClassInfo
+{
+    const char* name;
+    const char* threadsArg;
+    int defaultThreads;
+};
+
+static const HTTPWorkClassInfo workClassInfo[HTTP_WORK_CLASSES] = {
+    {"fast", "-rpcfastthreads", DEFAULT_HTTP_FAST_THREADS},
+    {"default", "-rpcthreads", DEFAULT_HTTP_THREADS},
+    {"wallet", "-rpcwalletthreads", DEFAULT_HTTP_WALLET_THREADS},
+    {"heavy", "-rpcheavythreads", DEFAULT_HTTP_HEAVY_THREADS},
 };
 
 /** HTTP module state */
@@ -182,8 +257,8 @@ static struct event_base* eventBase = 0;
 struct evhttp* eventHTTP = 0;
 //! List of subnets to allow RPC connections from
 static std::vector<CSubNet> rpc_allow_subnets;
-//! Work queue for handling longer requests off the event loop thread
-static WorkQueue<HTTPClosure>* workQueue = 0;
+//! Work queues for handling longer requests off the event loop thread, one per HTTPWorkClass
+static WorkQueue<HTTPClosure>* workQueues[HTTP_WORK_CLASSES] = {0};
 //! Handlers for (sub)paths
 std::vector<HTTPPathHandler> pathHandlers;
 //! Bound listening sockets
@@ -286,6 +361,8 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
 
     // Dispatch to worker thread
     if (i != iend) {
+        HTTPWorkClass workClass = i->classifier ? i->classifier(hreq.get(), path) : HTTP_WORK_DEFAULT;
+        WorkQueue<HTTPClosure>* workQueue = workQueues[workClass];
         std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(hreq.release(), path, i->handler));
         assert(workQueue);
         if (workQueue->Enqueue(item.get()))
@@ -297,6 +374,18 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
     }
 }
 
+bool HTTPEnqueueTask(const boost::function<void(void)>& task, HTTPWorkClass workClass)
+{
+    WorkQueue<HTTPClosure>* workQueue = workQueues[workClass];
+    if (!workQueue)
+        return false;
+    std::unique_ptr<HTTPTaskItem> item(new HTTPTaskItem(task));
+    if (!workQueue->Enqueue(item.get()))
+        return false;
+    item.release(); /* queue took ownership */
+    return true;
+}
+
 /** Callback to reject HTTP requests after shutdown. */
 static void http_reject_request_cb(struct evhttp_request* req, void*)
 {
@@ -431,9 +520,10 @@ bool InitHTTPServer()
 
     LogPrint("http", "Initialized HTTP server\n");
     int workQueueDepth = std::max((long)GetArg("-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE), 1L);
-    LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
+    LogPrintf("HTTP: creating work queues of depth %d\n", workQueueDepth);
 
-    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
+    for (int c = 0; c < HTTP_WORK_CLASSES; c++)
+        workQueues[c] = new WorkQueue<HTTPClosure>(workQueueDepth);
     eventBase = base;
     eventHTTP = http;
     return true;
@@ -444,13 +534,15 @@ boost::thread threadHTTP;
 bool StartHTTPServer()
 {
     LogPrint("http", "Starting HTTP server\n");
-    int rpcThreads = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
-    LogPrintf("HTTP: starting %d worker threads\n", rpcThreads);
     threadHTTP = boost::thread(boost::bind(&ThreadHTTP, eventBase, eventHTTP));
 
-    for (int i = 0; i < rpcThreads; i++) {
-        boost::thread rpc_worker(HTTPWorkQueueRun, workQueue);
-        rpc_worker.detach();
+    for (int c = 0; c < HTTP_WORK_CLASSES; c++) {
+        int rpcThreads = std::max((long)GetArg(workClassInfo[c].threadsArg, workClassInfo[c].defaultThreads), 1L);
+        LogPrintf("HTTP: starting %d %s worker threads\n", rpcThreads, workClassInfo[c].name);
+        for (int i = 0; i < rpcThreads; i++) {
+            boost::thread rpc_worker(HTTPWorkQueueRun, workQueues[c]);
+            rpc_worker.detach();
+        }
     }
     return true;
 }
@@ -466,17 +558,21 @@ void InterruptHTTPServer()
         // Reject requests on current connections
         evhttp_set_gencb(eventHTTP, http_reject_request_cb, NULL);
     }
-    if (workQueue)
-        workQueue->Interrupt();
+    for (int c = 0; c < HTTP_WORK_CLASSES; c++)
+        if (workQueues[c])
+            workQueues[c]->Interrupt();
 }
 
 void StopHTTPServer()
 {
     LogPrint("http", "Stopping HTTP server\n");
-    if (workQueue) {
-        LogPrint("http", "Waiting for HTTP worker threads to exit\n");
-        workQueue->WaitExit();
-        delete workQueue;
+    LogPrint("http", "Waiting for HTTP worker threads to exit\n");
+    for (int c = 0; c < HTTP_WORK_CLASSES; c++) {
+        if (workQueues[c]) {
+            workQueues[c]->WaitExit();
+            delete workQueues[c];
+            workQueues[c] = 0;
+        }
     }
     if (eventBase) {
         LogPrint("http", "Waiting for HTTP event thread to exit\n");
@@ -510,6 +606,20 @@ struct event_base* EventBase()
     return eventBase;
 }
 
+std::vector<HTTPWorkStats> GetHTTPWorkStats()
+{
+    std::vector<HTTPWorkStats> vStats;
+    for (int c = 0; c < HTTP_WORK_CLASSES; c++) {
+        if (!workQueues[c])
+            continue;
+        HTTPWorkStats stats;
+        stats.strClass = workClassInfo[c].name;
+        workQueues[c]->GetStats(stats);
+        vStats.push_back(stats);
+    }
+    return vStats;
+}
+
 static void httpevent_callback_fn(evutil_socket_t, short, void* data)
 {
     // Static handler: simply call inner handler
@@ -536,12 +646,77 @@ void HTTPEvent::trigger(struct timeval* tv)
     else
         evtimer_add(ev, tv); // trigger after timeval passed
 }
+/** A reply being sent in chunks. The worker thread producing it queues the
+ * chunks, and the main http thread hands them to libevent in order.
+ */
+struct HTTPReplyStream
+{
+    boost::mutex cs;
+    struct evhttp_request* req;
+    int nStatus;
+    std::deque<struct evbuffer*> queue;
+    //! Whether an event to pass on the queue has been sent and not run yet
+    bool fFlushPending;
+    bool fStarted;
+    bool fEnd;
+    bool fDone;
+
+    HTTPReplyStream(struct evhttp_request* req, int nStatus): req(req), nStatus(nStatus),
+        fFlushPending(false), fStarted(false), fEnd(false), fDone(false)
+    {
+    }
+    ~HTTPReplyStream()
+    {
+        BOOST_FOREACH(struct evbuffer* buf, queue)
+            evbuffer_free(buf);
+    }
+};
+
+/** Runs in the main http thread */
+static void httpreplystream_flush(std::shared_ptr<HTTPReplyStream> stream)
+{
+    boost::unique_lock<boost::mutex> lock(stream->cs);
+    stream->fFlushPending = false;
+    if (stream->fDone)
+        return;
+    if (!stream->fStarted) {
+        evhttp_send_reply_start(stream->req, stream->nStatus, NULL);
+        stream->fStarted = true;
+    }
+    while (!stream->queue.empty()) {
+        evhttp_send_reply_chunk(stream->req, stream->queue.front());
+        evbuffer_free(stream->queue.front());
+        stream->queue.pop_front();
+    }
+    if (stream->fEnd) {
+        evhttp_send_reply_end(stream->req);
+        stream->fDone = true;
+    }
+}
+
+/** Have the main http thread pass on what is queued, unless it is about to already */
+static void httpreplystream_trigger(const std::shared_ptr<HTTPReplyStream>& stream)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(stream->cs);
+        if (stream->fFlushPending)
+            return;
+        stream->fFlushPending = true;
+    }
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, boost::bind(httpreplystream_flush, stream));
+    ev->trigger(0);
+}
+
 HTTPRequest::HTTPRequest(struct evhttp_request* req) : req(req),
                                                        replySent(false)
 {
 }
 HTTPRequest::~HTTPRequest()
 {
+    if (replyStream) {
+        LogPrintf("%s: Unfinished reply\n", __func__);
+        EndReply();
+    }
     if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
@@ -581,6 +756,19 @@ std::string HTTPRequest::ReadBody()
     return rv;
 }
 
+std::string HTTPRequest::PeekBody(size_t nMaxSize)
+{
+    struct evbuffer* buf = evhttp_request_get_input_buffer(req);
+    if (!buf)
+        return "";
+    std::string rv(std::min(nMaxSize, evbuffer_get_length(buf)), '\0');
+    if (rv.empty())
+        return rv;
+    ev_ssize_t nCopied = evbuffer_copyout(buf, &rv[0], rv.size());
+    rv.resize(std::max(nCopied, (ev_ssize_t)0));
+    return rv;
+}
+
 void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
 {
     struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
@@ -607,6 +795,51 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     req = 0; // transferred back to main thread
 }
 
+void HTTPRequest::StartReply(int nStatus)
+{
+    assert(!replySent && req && !replyStream);
+    replyStream.reset(new HTTPReplyStream(req, nStatus));
+    httpreplystream_trigger(replyStream);
+}
+
+void HTTPRequest::WriteReplyChunk(const char* pbegin, size_t nSize)
+{
+    assert(replyStream);
+    if (nSize == 0)
+        return;
+    struct evbuffer* buf = evbuffer_new();
+    assert(buf);
+    evbuffer_add(buf, pbegin, nSize);
+    {
+        boost::unique_lock<boost::mutex> lock(replyStream->cs);
+        replyStream->queue.push_back(buf);
+    }
+    httpreplystream_trigger(replyStream);
+}
+
+void HTTPRequest::EndReply()
+{
+    assert(replyStream);
+    {
+        boost::unique_lock<boost::mutex> lock(replyStream->cs);
+        replyStream->fEnd = true;
+    }
+    httpreplystream_trigger(replyStream);
+    replyStream.reset();
+    replySent = true;
+    req = 0; // transferred back to main thread
+}
+
+HTTPRequest* HTTPRequest::Detach()
+{
+    assert(!replySent && !replyStream);
+    HTTPRequest* preq = new HTTPRequest(req);
+    // The new object answers it, so this one must not on destruction
+    replySent = true;
+    req = 0;
+    return preq;
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
@@ -647,10 +880,11 @@ HTTPRequest::RequestMethod HTTPRequest::GetRequestMethod()
     }
 }
 
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler)
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler,
+                         const HTTPRequestClassifier &classifier)
 {
     LogPrint("http", "Registering HTTP handler for %s (exactmatch %d)\n", prefix, exactMatch);
-    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler));
+    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler, classifier));
 }
 
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch)
@@ -667,3 +901,14 @@ void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch)
     }
 }
 
+std::string urlDecode(const std::string &urlEncoded) {
+    std::string res;
+    if (!urlEncoded.empty()) {
+        char *decoded = evhttp_uridecode(urlEncoded.c_str(), false, NULL);
+        if (decoded) {
+            res = std::string(decoded);
+            free(decoded);
+        }
+    }
+    return res;
+}
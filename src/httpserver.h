@@ -5,13 +5,18 @@
 #ifndef BITCOIN_HTTPSERVER_H
 #define BITCOIN_HTTPSERVER_H
 
+#include <memory>
 #include <string>
 #include <stdint.h>
+#include <vector>
 #include <boost/thread.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/function.hpp>
 
 static const int DEFAULT_HTTP_THREADS=4;
+static const int DEFAULT_HTTP_FAST_THREADS=2;
+static const int DEFAULT_HTTP_WALLET_THREADS=2;
+static const int DEFAULT_HTTP_HEAVY_THREADS=1;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
 
@@ -19,6 +24,7 @@ struct evhttp_request;
 struct event_base;
 class CService;
 class HTTPRequest;
+struct HTTPReplyStream;
 
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
@@ -34,13 +40,30 @@ void InterruptHTTPServer();
 /** Stop HTTP server */
 void StopHTTPServer();
 
+/** Classes of requests. Each class has its own work queue and worker threads,
+ * so that long-running calls can't hold up cheap ones such as health checks.
+ */
+enum HTTPWorkClass
+{
+    HTTP_WORK_FAST,     //!< Short read-only calls
+    HTTP_WORK_DEFAULT,
+    HTTP_WORK_WALLET,
+    HTTP_WORK_HEAVY,    //!< Calls that can take minutes, such as scans of the UTXO set or the wallet
+    HTTP_WORK_CLASSES
+};
+
 /** Handler for requests to a certain HTTP path */
 typedef boost::function<void(HTTPRequest* req, const std::string &)> HTTPRequestHandler;
+/** Picks the class of a request. This runs on the event loop thread, so it
+ * must be quick and may only look at the request.
+ */
+typedef boost::function<HTTPWorkClass(HTTPRequest* req, const std::string &)> HTTPRequestClassifier;
 /** Register handler for prefix.
  * If multiple handlers match a prefix, the first-registered one will
- * be invoked.
+ * be invoked. Without a classifier, requests are of class HTTP_WORK_DEFAULT.
  */
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler);
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler,
+                         const HTTPRequestClassifier &classifier = HTTPRequestClassifier());
 /** Unregister handler for prefix */
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
 
@@ -49,6 +72,23 @@ void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
  */
 struct event_base* EventBase();
 
+/** Counters of one class of work. Times are in microseconds. */
+struct HTTPWorkStats
+{
+    std::string strClass;
+    int nThreads;
+    size_t nDepth;
+    uint64_t nRequests;
+    uint64_t nRejected;
+    int64_t nWaitTotal;
+    int64_t nWaitMax;
+    int64_t nRunTotal;
+    int64_t nRunMax;
+};
+
+/** Get the counters of each class of work, in HTTPWorkClass order */
+std::vector<HTTPWorkStats> GetHTTPWorkStats();
+
 /** In-flight HTTP request.
  * Thin C++ wrapper around evhttp_request.
  */
@@ -56,6 +96,8 @@ class HTTPRequest
 {
 private:
     struct evhttp_request* req;
+    //! Set while a reply is being sent in chunks
+    std::shared_ptr<HTTPReplyStream> replyStream;
 
     // For test access
 protected:
@@ -99,6 +141,12 @@ public:
      */
     std::string ReadBody();
 
+    /**
+     * Get up to nMaxSize bytes from the start of the request body, leaving
+     * it to be read later.
+     */
+    std::string PeekBody(size_t nMaxSize);
+
     /**
      * Write output header.
      *
@@ -115,6 +163,28 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     virtual void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a reply whose body is sent in chunks, so that it goes out while
+     * the rest is still being produced.
+     *
+     * @note call WriteHeader before this, then WriteReplyChunk for each part
+     * of the body and finally EndReply. Only these may be called in between.
+     */
+    void StartReply(int nStatus);
+    void WriteReplyChunk(const char* pbegin, size_t nSize);
+    void WriteReplyChunk(const std::string& strChunk)
+    {
+        WriteReplyChunk(strChunk.data(), strChunk.size());
+    }
+    void EndReply();
+
+    /**
+     * Hand the request over to a new object, so that it can be answered
+     * after the handler has returned. Call this before any part of the
+     * reply is written; this object may not be used afterwards.
+     */
+    HTTPRequest* Detach();
 };
 
 /** Event handler closure.
@@ -126,6 +196,12 @@ public:
     virtual ~HTTPClosure() {}
 };
 
+/** Run a task on one of the worker threads of a class, by default a short
+ * task on the HTTP_WORK_FAST ones.
+ * Returns false if the work queue is full or the server isn't running.
+ */
+bool HTTPEnqueueTask(const boost::function<void(void)>& task, HTTPWorkClass workClass = HTTP_WORK_FAST);
+
 /** Event class. This can be used either as an cross-thread trigger or as a timer.
  */
 class HTTPEvent
@@ -149,4 +225,7 @@ private:
     struct event* ev;
 };
 
+/** Decode the %-escapes of a part of a URI, such as a wallet name */
+std::string urlDecode(const std::string &urlEncoded);
+
 #endif // BITCOIN_HTTPSERVER_H
@@ -9,13 +9,21 @@
 #endif
 
 #include "init.h"
+#include "crypto/blake2b.h"
 #include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "addrman.h"
 #include "amount.h"
+#include "asyncrpcqueue.h"
+#include "blockarchive.h"
+#include "blockfilemap.h"
+#include "blockvolumes.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
+#include "corebudget.h"
+#include "equihashplugin.h"
 #include "httpserver.h"
 #include "httprpc.h"
 #include "key.h"
@@ -26,12 +34,19 @@
 #include "metrics.h"
 #include "miner.h"
 #include "net.h"
+#include "proofcache.h"
+#include "responsecache.h"
 #include "rpc/server.h"
 #include "rpc/register.h"
 #include "script/standard.h"
 #include "scheduler.h"
+#include "notifysink.h"
+#include "stratum.h"
 #include "txdb.h"
+#include "txindexcache.h"
 #include "torcontrol.h"
+#include "trace.h"
+#include "txarrivallog.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
@@ -44,6 +59,9 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <memory>
+#if defined(HAVE_MALLOPT_ARENA_MAX) || defined(HAVE_MALLOC_TRIM)
+#include <malloc.h>
+#endif
 
 #ifndef WIN32
 #include <signal.h>
@@ -64,6 +82,7 @@
 
 #if ENABLE_ZMQ
 #include "zmq/zmqnotificationinterface.h"
+#include "zmq/zmqrpc.h"
 #endif
 
 #include "librustzcash.h"
@@ -74,18 +93,20 @@ using namespace std;
 extern void ThreadSendAlert();
 
 ZCJoinSplit* pzcashParams = NULL;
+//! Loads pzcashParams and the Sapling parameters while the block index
+//! loads; ZC_WaitForParams joins it before anything checks a proof
+static boost::thread threadLoadParams;
+static bool fParamsLoaded = false;
 
 #ifdef ENABLE_WALLET
 CWallet* pwalletMain = NULL;
+std::vector<CWallet*> vpwallets;
 #endif
 bool fFeeEstimatesInitialized = false;
+static bool fDumpMempoolLater = false;
 
 std::unique_ptr<CConnman> g_connman;
 
-#if ENABLE_ZMQ
-static CZMQNotificationInterface* pzmqNotificationInterface = NULL;
-#endif
-
 #ifdef WIN32
 // Win32 LevelDB doesn't use file descriptors, and the ones used for
 // accessing block files don't count towards the fd_set size limit
@@ -147,9 +168,9 @@ class CCoinsViewErrorCatcher : public CCoinsViewBacked
 {
 public:
     CCoinsViewErrorCatcher(CCoinsView* view) : CCoinsViewBacked(view) {}
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
         try {
-            return CCoinsViewBacked::GetCoins(txid, coins);
+            return CCoinsViewBacked::GetCoin(outpoint, coin);
         } catch(const std::runtime_error& e) {
             uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
             LogPrintf("Error reading from database: %s\n", e.what());
@@ -163,7 +184,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
@@ -174,6 +194,8 @@ void Interrupt(boost::thread_group& threadGroup)
     InterruptRPC();
     InterruptREST();
     InterruptTorControl();
+    InterruptStratum();
+    InterruptNotifySink();
     threadGroup.interrupt_all();
 }
 
@@ -194,11 +216,14 @@ void Shutdown()
 
     StopHTTPRPC();
     StopREST();
+    StopHTTPMetrics();
+    SetMetricsScheduler(NULL);
     StopRPC();
+    getAsyncRPCQueue()->setResultDB(nullptr);
     StopHTTPServer();
 #ifdef ENABLE_WALLET
-    if (pwalletMain)
-        pwalletMain->Flush(false);
+    for (CWallet* pwallet : vpwallets)
+        pwallet->Flush(false);
 #endif
 #ifdef ENABLE_MINING
  #ifdef ENABLE_WALLET
@@ -206,12 +231,19 @@ void Shutdown()
  #else
     GenerateBitcoins(false, 0);
  #endif
+    delete pEquihashPlugin;
+    pEquihashPlugin = NULL;
 #endif
+    StopStratum();
+    StopNotifySink();
     StopNode(*g_connman);
     g_connman.reset();
+    CloseTxArrivalLog();
 
     StopTorControl();
     UnregisterNodeSignals(GetNodeSignals());
+    if (fDumpMempoolLater && GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL))
+        DumpMempool();
 
     if (fFeeEstimatesInitialized)
     {
@@ -224,6 +256,11 @@ void Shutdown()
         fFeeEstimatesInitialized = false;
     }
 
+    // Listeners take cs_main, so deliver what is left without holding it.
+    // The final flush below then notifies synchronously, after everything
+    // raised before it.
+    StopValidationInterfaceQueue();
+
     {
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
@@ -231,6 +268,8 @@ void Shutdown()
         }
         delete pcoinsTip;
         pcoinsTip = NULL;
+        delete pcoinsmemory;
+        pcoinsmemory = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
         delete pcoinsdbview;
@@ -238,9 +277,11 @@ void Shutdown()
         delete pblocktree;
         pblocktree = NULL;
     }
+    // Pruned files the prune thread didn't get to
+    FlushPruneUnlinks();
 #ifdef ENABLE_WALLET
-    if (pwalletMain)
-        pwalletMain->Flush(true);
+    for (CWallet* pwallet : vpwallets)
+        pwallet->Flush(true);
 #endif
 
 #if ENABLE_ZMQ
@@ -260,14 +301,19 @@ void Shutdown()
 #endif
     UnregisterAllValidationInterfaces();
 #ifdef ENABLE_WALLET
-    delete pwalletMain;
+    for (CWallet* pwallet : vpwallets)
+        delete pwallet;
+    vpwallets.clear();
     pwalletMain = NULL;
 #endif
+    if (threadLoadParams.joinable())
+        threadLoadParams.join();
     delete pzcashParams;
     pzcashParams = NULL;
     globalVerifyHandle.reset();
     ECC_Stop();
     LogPrintf("%s: done\n", __func__);
+    StopAsyncLogging();
 }
 
 /**
@@ -333,9 +379,12 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-?", _("This help message"));
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-asyncnotifications", strprintf(_("Deliver block and transaction notifications to the wallet and ZMQ on a background thread, so they do not hold up block connection (default: %u)"), DEFAULT_ASYNC_NOTIFICATIONS));
+    strUsage += HelpMessageOpt("-blockfilesync=<n>", strprintf(_("Sync downloaded block and undo data to disk at most every <n> seconds instead of at every block index write; after a crash use -reindex if blocks are missing (default: %u)"), DEFAULT_BLOCKFILE_SYNC_INTERVAL));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), 288));
     strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), 3));
+    strUsage += HelpMessageOpt("-checkinbackground", strprintf(_("Verify the -checkblocks blocks once the node has started, serving peers and RPC meanwhile, and shut down if they are corrupted (default: %u)"), DEFAULT_CHECK_IN_BACKGROUND));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), "litecoinz.conf"));
     if (mode == HMM_BITCOIND)
     {
@@ -343,17 +392,32 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-daemon", _("Run in the background as a daemon and accept commands"));
 #endif
     }
+    strUsage += HelpMessageOpt("-blocksdir=<dir>", _("Specify directory to hold block and undo files (default: <datadir>)"));
+    strUsage += HelpMessageOpt("-blocksvolume=<dir>", _("Also store block and undo files in <dir>, spreading new files across it and -blocksdir (can be specified multiple times)"));
+    strUsage += HelpMessageOpt("-chainstateinmemory", strprintf(_("Hold the whole chainstate in memory, writing it to the database in the background every hour and at shutdown (default: %u)"), DEFAULT_CHAINSTATE_IN_MEMORY));
+    strUsage += HelpMessageOpt("-compressblocks=<n>", strprintf(_("Compress block files in the background once their blocks are %u deep, at zstd level <n> (1-22, 0 = never, default: %u)"), BLOCK_ARCHIVE_MIN_DEPTH, DEFAULT_COMPRESS_BLOCKS));
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-exportdir=<dir>", _("Specify directory to be used when exporting data"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file") + " " + _("on startup"));
+#ifdef HAVE_MALLOPT_ARENA_MAX
+    strUsage += HelpMessageOpt("-mallocarenas=<n>", strprintf(_("Limit glibc's heap to <n> arenas, trading some allocation contention between threads for less memory held free (0 = glibc's default, default: %u)"), DEFAULT_MALLOC_ARENAS));
+#endif
+#ifdef HAVE_MALLOC_TRIM
+    strUsage += HelpMessageOpt("-malloctrim=<n>", strprintf(_("Give free heap memory back to the operating system every <n> seconds, 0 to disable (default: %u)"), DEFAULT_MALLOC_TRIM_INTERVAL));
+#endif
+    strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-mempooltxinputlimit=<n>", _("[DEPRECATED FROM OVERWINTER] Set the maximum number of transparent inputs in a transaction that the mempool will accept (default: 0 = no limit applied)"));
-    strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+    strUsage += HelpMessageOpt("-notifysink=<sink>", strprintf(_("Write a line for each best block change, wallet transaction change and alert (\"blocktip <hash>\", \"wallettx <txid>\", \"alert <message>\") to <sink>, reopening it if it goes away: pipe:<path> for a named pipe or file, unix:<path> for a UNIX socket, exec:<cmd> for the input of a command run once (at most %u lines are held while it is slow or away)"), NOTIFY_SINK_MAX_QUEUE));
+    strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script and proof verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), "litecoinzd.pid"));
 #endif
+    strUsage += HelpMessageOpt("-proofthreads=<n>", strprintf(_("Set the number of threads used to create a Sprout proof (0 = the cores not used by -par, default: %d)"),
+        DEFAULT_PROOF_THREADS));
     strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode disables wallet support and is incompatible with -txindex. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
@@ -361,7 +425,15 @@ std::string HelpMessage(HelpMessageMode mode)
 #if !defined(WIN32)
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
+    strUsage += HelpMessageOpt("-threads=<n>", strprintf(_("Set the number of cores CPU-heavy work may use at once; block validation always runs, and relay, RPC, wallet and mining work wait in that order of priority (0 = all cores, default: %d)"),
+        DEFAULT_CORE_BUDGET));
+    strUsage += HelpMessageOpt("-addressindex", strprintf(_("Maintain an index of the transparent outputs and spends of each address, used by the getaddress* rpc calls (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-coinstatsindex", strprintf(_("Maintain running statistics of the UTXO set per block, so that gettxoutsetinfo answers without scanning it (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-shieldedindex", strprintf(_("Maintain a compact index of shielded outputs and transparent scripts per block, used to speed up wallet rescans (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-spentindex", strprintf(_("Maintain an index of the input spending each transparent output, used by the getspentinfo rpc call (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-timestampindex", strprintf(_("Maintain an index of blocks by time, used by the getblockhashes rpc call (default: %u)"), 0));
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-txindexcache=<n>", strprintf(_("Keep up to <n> MiB of transactions read through the transaction index in memory, 0 to disable (default: %u)"), DEFAULT_TXINDEX_CACHE));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
     strUsage += HelpMessageOpt("-addnode=<ip>", _("Add a node to connect to and attempt to keep the connection open"));
@@ -379,6 +451,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), DEFAULT_MAX_PEER_CONNECTIONS));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), 5000));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), 1000));
+    strUsage += HelpMessageOpt("-msghandlerthreads=<n>", strprintf(_("Handle peer messages on <n> threads, each serving its share of the peers (1 to %d, default: %d)"), MAX_MESSAGE_HANDLER_THREADS, DEFAULT_MESSAGE_HANDLER_THREADS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), 1));
@@ -389,6 +462,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-port=<port>", strprintf(_("Listen for connections on <port> (default: %u or testnet: %u)"), 29333, 39333));
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), 1));
+    strUsage += HelpMessageOpt("-relaycache=<n>", strprintf(_("Keep up to <n> MiB of transactions announced to peers that have since left the mempool, for them to fetch (default: %u)"), DEFAULT_RELAY_CACHE));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
@@ -410,13 +484,17 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-salvagewallet", _("Attempt to recover private keys from a corrupt wallet.dat") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-sendfreetransactions", strprintf(_("Send transactions as zero-fee transactions if possible (default: %u)"), 0));
     strUsage += HelpMessageOpt("-spendzeroconfchange", strprintf(_("Spend unconfirmed change when sending transactions (default: %u)"), 1));
+    strUsage += HelpMessageOpt("-consolidateinputs=<n>", strprintf(_("When a transaction you send has change, also spend up to <n> of your smallest coins or notes into it (default: %u)"), DEFAULT_CONSOLIDATE_INPUTS));
     strUsage += HelpMessageOpt("-txconfirmtarget=<n>", strprintf(_("If paytxfee is not set, include enough fee so transactions begin confirmation on average within n blocks (default: %u)"), DEFAULT_TX_CONFIRM_TARGET));
     strUsage += HelpMessageOpt("-txexpirydelta", strprintf(_("Set the number of blocks after which a transaction that has not been mined will become invalid (min: %u, default: %u)"), TX_EXPIRING_SOON_THRESHOLD + 1, DEFAULT_TX_EXPIRY_DELTA));
     strUsage += HelpMessageOpt("-maxtxfee=<amt>", strprintf(_("Maximum total fees (in %s) to use in a single wallet transaction; setting this too low may abort large transactions (default: %s)"),
         CURRENCY_UNIT, FormatMoney(maxTxFee)));
     strUsage += HelpMessageOpt("-upgradewallet", _("Upgrade wallet to latest format") + " " + _("on startup"));
-    strUsage += HelpMessageOpt("-wallet=<file>", _("Specify wallet file (within data directory)") + " " + strprintf(_("(default: %s)"), "wallet.dat"));
+    strUsage += HelpMessageOpt("-wallet=<file>", _("Specify wallet file (within data directory)") + " " + strprintf(_("(default: %s)"), "wallet.dat") + ". " +
+        _("Can be specified multiple times to load multiple wallets, which RPC clients reach at /wallet/<file>. The first is the default wallet"));
     strUsage += HelpMessageOpt("-walletbroadcast", _("Make the wallet broadcast transactions") + " " + strprintf(_("(default: %u)"), true));
+    strUsage += HelpMessageOpt("-walletcompacttx", strprintf(_("Store shielded wallet transactions that can no longer be reorganized away without their proofs, reading them back from the block files when needed (default: %u)"), DEFAULT_WALLET_COMPACT_TX));
+    strUsage += HelpMessageOpt("-walletformat=<format>", strprintf(_("Format of wallet files: bdb (Berkeley DB) or log (append-only log). Existing Berkeley DB wallets are migrated to log on startup (default: %s)"), DEFAULT_WALLET_FORMAT));
     strUsage += HelpMessageOpt("-walletnotify=<cmd>", _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)"));
     strUsage += HelpMessageOpt("-zapwallettxes=<mode>", _("Delete all wallet transactions and only recover those parts of the blockchain through -rescan on startup") +
         " " + _("(1 = keep tx meta data e.g. account owner and payment request information, 2 = drop tx meta data)"));
@@ -428,12 +506,17 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-zmqpubhashtx=<address>", _("Enable publish hash transaction in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawtx=<address>", _("Enable publish raw transaction in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubshieldedreceipt=<address>", _("Enable publish shielded outputs the wallet receives, when first seen and when mined, in <address>"));
+    strUsage += HelpMessageOpt("-zmqqueuesize=<n>", strprintf(_("Keep at most <n> events waiting to be published; later ones are dropped and leave a gap in the sequence numbers (default: %u)"), DEFAULT_ZMQ_QUEUE_SIZE));
 #endif
 
     strUsage += HelpMessageGroup(_("Debugging/Testing options:"));
     if (showDebug)
     {
         strUsage += HelpMessageOpt("-checkpoints", strprintf("Disable expensive verification for known chain history (default: %u)", 1));
+        strUsage += HelpMessageOpt("-assumevalid=<hex>", strprintf("If this block is in the chain, assume that it and its ancestors are valid and skip their proof, signature and Equihash verification (0 to verify all, default: %s, testnet: %s)",
+            Params(CBaseChainParams::MAIN).GetConsensus().defaultAssumeValid.GetHex(), Params(CBaseChainParams::TESTNET).GetConsensus().defaultAssumeValid.GetHex()));
+        strUsage += HelpMessageOpt("-headercommitment", strprintf("Accept headers that link to the header chain the chain parameters commit to without verifying their Equihash solutions (default: %u)", DEFAULT_HEADER_COMMITMENT));
         strUsage += HelpMessageOpt("-dblogsize=<n>", strprintf("Flush database activity from memory pool to disk log every <n> megabytes (default: %u)", 100));
         strUsage += HelpMessageOpt("-disablesafemode", strprintf("Disable safemode, override a real safe mode event (default: %u)", 0));
         strUsage += HelpMessageOpt("-testsafemode", strprintf("Force safe mode (default: %u)", 0));
@@ -443,20 +526,36 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-stopafterblockimport", strprintf("Stop running after importing blocks from disk (default: %u)", 0));
         strUsage += HelpMessageOpt("-nuparams=hexBranchId:activationHeight", "Use given activation height for specified network upgrade (regtest-only)");
     }
-    string debugCategories = "addrman, alert, bench, coindb, db, estimatefee, http, libevent, lock, mempool, net, partitioncheck, pow, proxy, prune, "
-                             "rand, reindex, rpc, selectcoins, tor, zmq, zrpc, zrpcunsafe (implies zrpc)"; // Don't translate these
+    strUsage += HelpMessageOpt("-asynclog", strprintf(_("Write debug.log from a background thread, so that logging never waits on the disk (default: %u)"), DEFAULT_ASYNC_LOG));
+    string debugCategories = "addrman, alert, bench, cmpctblock, coindb, db, estimatefee, http, leveldb, libevent, lock, mempool, net, partitioncheck, pow, proxy, prune, "
+                             "rand, reindex, rpc, selectcoins, tor, trace, zmq, zrpc, zrpcunsafe (implies zrpc)"; // Don't translate these
     strUsage += HelpMessageOpt("-debug=<category>", strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + ". " +
         _("If <category> is not supplied or if <category> = 1, output all debugging information.") + " " + _("<category> can be:") + " " + debugCategories + ".");
+    strUsage += HelpMessageOpt("-debugratelimit=<n>", strprintf(_("Log at most <n> messages a second of each debugging category, counting the rest, 0 for no limit (default: %u)"), DEFAULT_LOG_RATE_LIMIT));
     strUsage += HelpMessageOpt("-experimentalfeatures", _("Enable use of experimental features"));
     strUsage += HelpMessageOpt("-help-debug", _("Show all debugging options (usage: --help -help-debug)"));
     strUsage += HelpMessageOpt("-logips", strprintf(_("Include IP addresses in debug output (default: %u)"), 0));
     strUsage += HelpMessageOpt("-logtimestamps", strprintf(_("Prepend debug output with timestamp (default: %u)"), 1));
+    strUsage += HelpMessageOpt("-maxdebuglogsize=<n>", strprintf(_("Move debug.log to debug.log.1 and start a new one when it reaches <n> MB, 0 to never rotate (default: %u)"), DEFAULT_MAX_DEBUG_LOG_SIZE));
     if (showDebug)
     {
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", 15));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", 0));
-        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> entries (default: %u)", 50000));
+        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxproofcachesize=<n>", strprintf("Limit size of shielded proof verification cache to <n> transactions (default: %u)", DEFAULT_MAX_PROOF_CACHE_SIZE));
         strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
+        strUsage += HelpMessageOpt("-dbbatchsize=<n>", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize));
+        strUsage += HelpMessageOpt("-mmapblockfiles=<n>", strprintf("Read blocks through memory mappings of up to <n> block files, 0 to disable (default: %u)", DEFAULT_MMAP_BLOCK_FILES));
+        strUsage += HelpMessageOpt("-dbcompactinterval=<n>", strprintf("Compact part of the chainstate database every <n> seconds when it has not been written to for as long, 0 to disable (default: %u)", nDefaultDbCompactInterval));
+        strUsage += HelpMessageOpt("-dbcompactrate=<n>", strprintf("Compact at most about <n> megabytes of the chainstate database at a time (default: %u)", nDefaultDbCompactRate));
+        strUsage += HelpMessageOpt("-coindbengine=<name>", strprintf("Storage engine of the chainstate database, one of %s; changing it needs -reindex (default: %s)", GetDBEngineNames(), DEFAULT_DB_ENGINE));
+        strUsage += HelpMessageOpt("-coindbwritebuffer=<n>", "Size of the chainstate database write buffer in megabytes (default: a quarter of its cache)");
+        strUsage += HelpMessageOpt("-coindbblocksize=<n>", strprintf("Size of a chainstate database table block in bytes (default: %u)", CDBOptions().nBlockSize));
+        strUsage += HelpMessageOpt("-coindbbloombits=<n>", strprintf("Bits per key of the chainstate database bloom filters, 0 to disable (default: %u)", CDBOptions().nBloomBits));
+        strUsage += HelpMessageOpt("-blockdbengine=<name>", strprintf("Storage engine of the block index database, one of %s; changing it needs -reindex (default: %s)", GetDBEngineNames(), DEFAULT_DB_ENGINE));
+        strUsage += HelpMessageOpt("-blockdbwritebuffer=<n>", "Size of the block index database write buffer in megabytes (default: a quarter of its cache)");
+        strUsage += HelpMessageOpt("-blockdbblocksize=<n>", strprintf("Size of a block index database table block in bytes (default: %u)", CDBOptions().nBlockSize));
+        strUsage += HelpMessageOpt("-blockdbbloombits=<n>", strprintf("Bits per key of the block index database bloom filters, 0 to disable (default: %u)", CDBOptions().nBloomBits));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying (default: %s)"),
         CURRENCY_UNIT, FormatMoney(::minRelayTxFee.GetFeePerK())));
@@ -468,7 +567,10 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-regtest", "Enter regression test mode, which uses a special chain in which blocks can be solved instantly. "
             "This is intended for regression testing tools and app development.");
     }
-    strUsage += HelpMessageOpt("-shrinkdebugfile", _("Shrink debug.log file on client startup (default: 1 when no -debug)"));
+    strUsage += HelpMessageOpt("-shrinkdebugfile", _("Shrink debug.log file on client startup (default: 1 when no -debug and no -maxdebuglogsize)"));
+    strUsage += HelpMessageOpt("-tracebuffer=<n>", strprintf(_("Keep the last <n> block and transaction trace points for gettraces, 0 to disable (default: %u)"), DEFAULT_TRACE_BUFFER));
+    if (showDebug)
+        strUsage += HelpMessageOpt("-txarrivallog=<file>", "Record the transactions peers send, and when, to <file> for zcbenchmark acceptmempool to replay (relative to the data directory)");
 
     AppendParamsHelpMessages(strUsage, showDebug);
 
@@ -480,6 +582,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockminsize=<n>", strprintf(_("Set minimum block size in bytes (default: %u)"), 0));
     strUsage += HelpMessageOpt("-blockmaxsize=<n>", strprintf(_("Set maximum block size in bytes (default: %d)"), DEFAULT_BLOCK_MAX_SIZE));
     strUsage += HelpMessageOpt("-blockprioritysize=<n>", strprintf(_("Set maximum size of high-priority/low-fee transactions in bytes (default: %d)"), DEFAULT_BLOCK_PRIORITY_SIZE));
+    strUsage += HelpMessageOpt("-longpollfeedelta=<amt>", strprintf(_("Answer a getblocktemplate long poll once transactions paying this much in fees (in %s) have arrived since its template (default: %s)"),
+        CURRENCY_UNIT, FormatMoney(DEFAULT_LONGPOLL_FEE_DELTA)));
     if (GetBoolArg("-help-debug", false))
         strUsage += HelpMessageOpt("-blockversion=<n>", strprintf("Override block version to test forking scenarios (default: %d)", (int)CBlock::CURRENT_VERSION));
 
@@ -487,7 +591,9 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageGroup(_("Mining options:"));
     strUsage += HelpMessageOpt("-gen", strprintf(_("Generate coins (default: %u)"), 0));
     strUsage += HelpMessageOpt("-genproclimit=<n>", strprintf(_("Set the number of threads for coin generation if enabled (-1 = half cores, default: %d)"), 1));
-    strUsage += HelpMessageOpt("-equihashsolver=<name>", _("Specify the Equihash solver to be used if enabled (default: \"default\")"));
+    strUsage += HelpMessageOpt("-equihashsolver=<name>", _("Specify the Equihash solver to be used if enabled (\"default\", \"bucket\", \"tromp\" or \"plugin\", default: \"default\")"));
+    strUsage += HelpMessageOpt("-equihashplugin=<file>", _("Load the Equihash solver plugin of -equihashsolver=plugin from <file>"));
+    strUsage += HelpMessageOpt("-equihashdevices=<list>", _("Mine on the comma-separated devices of the solver plugin, with a thread each (default: all)"));
     strUsage += HelpMessageOpt("-mineraddress=<addr>", _("Send mined coins to a specific single address"));
     strUsage += HelpMessageOpt("-minetolocalwallet", strprintf(
             _("Require that mined blocks use a coinbase address in the local wallet (default: %u)"),
@@ -497,19 +603,33 @@ std::string HelpMessage(HelpMessageMode mode)
             0
  #endif
             ));
+    strUsage += HelpMessageOpt("-stratum", strprintf(_("Serve pool miners over Stratum, paying the coinbase to -mineraddress (default: %u)"), DEFAULT_STRATUM));
+    strUsage += HelpMessageOpt("-stratumbind=<addr>", strprintf(_("Bind the Stratum server to the given address (default: %s)"), DEFAULT_STRATUM_BIND));
+    strUsage += HelpMessageOpt("-stratumport=<port>", strprintf(_("Listen for Stratum connections on <port> (default: %u or testnet: %u)"), 29335, 39335));
+    strUsage += HelpMessageOpt("-stratumpassword=<pw>", _("Password the Stratum workers must authorize with (default: none)"));
+    strUsage += HelpMessageOpt("-stratumdifficulty=<n>", strprintf(_("Share difficulty each Stratum connection starts at (default: %g)"), DEFAULT_STRATUM_DIFFICULTY));
+    strUsage += HelpMessageOpt("-stratumthreads=<n>", strprintf(_("Set the number of threads checking Stratum shares (0 = one per core, default: %d)"), DEFAULT_STRATUM_THREADS));
 #endif
 
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands (default: 1"));
     strUsage += HelpMessageOpt("-rest", strprintf(_("Accept public REST requests (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-metrics", strprintf(_("Serve Prometheus metrics at /metrics on the RPC port, without authentication (default: %u)"), DEFAULT_HTTP_METRICS));
     strUsage += HelpMessageOpt("-rpcbind=<addr>", _("Bind to given address to listen for JSON-RPC connections. Use [host]:port notation for IPv6. This option can be specified multiple times (default: bind to all interfaces)"));
     strUsage += HelpMessageOpt("-rpcuser=<user>", _("Username for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcpassword=<pw>", _("Password for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), 29332, 39332));
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
+    strUsage += HelpMessageOpt("-rpcfastthreads=<n>", strprintf(_("Set the number of threads kept for short read-only RPC calls (default: %d)"), DEFAULT_HTTP_FAST_THREADS));
+    strUsage += HelpMessageOpt("-rpcwalletthreads=<n>", strprintf(_("Set the number of threads kept for wallet RPC calls (default: %d)"), DEFAULT_HTTP_WALLET_THREADS));
+    strUsage += HelpMessageOpt("-rpcheavythreads=<n>", strprintf(_("Set the number of threads kept for long-running RPC calls such as gettxoutsetinfo and wallet imports (default: %d)"), DEFAULT_HTTP_HEAVY_THREADS));
+    strUsage += HelpMessageOpt("-rpcasyncresults=<n>", strprintf(_("Keep the results of up to <n> finished async operations, such as those of z_sendmany, in memory (default: %u)"), DEFAULT_ASYNC_RESULTS));
+    strUsage += HelpMessageOpt("-rpcasyncresultttl=<n>", strprintf(_("Keep the result of a finished async operation for <n> seconds (default: %u)"), DEFAULT_ASYNC_RESULT_TTL));
+    strUsage += HelpMessageOpt("-rpcasyncpersist", strprintf(_("Also keep the results of finished async operations on disk, where they outlive -rpcasyncresults and restarts (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-rpcresponsecache=<n>", strprintf(_("Keep up to <n> MiB of RPC and REST replies about blocks and transactions too deep to be reorganized away in memory, 0 to disable (default: %u)"), DEFAULT_RESPONSE_CACHE));
     if (showDebug) {
-        strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
+        strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of each work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
         strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
     }
 
@@ -528,12 +648,22 @@ std::string HelpMessage(HelpMessageMode mode)
 
 static void BlockNotifyCallback(const uint256& hashNewTip)
 {
-    std::string strCmd = GetArg("-blocknotify", "");
+    NotifySink("blocktip", hashNewTip.GetHex());
 
+    std::string strCmd = GetArg("-blocknotify", "");
+    if (strCmd.empty())
+        return;
     boost::replace_all(strCmd, "%s", hashNewTip.GetHex());
     boost::thread t(runCommand, strCmd); // thread runs free
 }
 
+#ifdef HAVE_MALLOC_TRIM
+static void TrimHeap()
+{
+    malloc_trim(0);
+}
+#endif
+
 struct CImportingNow
 {
     CImportingNow() {
@@ -563,16 +693,19 @@ void CleanupBlockRevFiles()
     // Remove the rev files immediately and insert the blk file paths into an
     // ordered map keyed by block file index.
     LogPrintf("Removing unusable blk?????.dat and rev?????.dat files for -reindex with -prune\n");
-    path blocksdir = GetDataDir() / "blocks";
-    for (directory_iterator it(blocksdir); it != directory_iterator(); it++) {
-        if (is_regular_file(*it) &&
-            it->path().filename().string().length() == 12 &&
-            it->path().filename().string().substr(8,4) == ".dat")
-        {
-            if (it->path().filename().string().substr(0,3) == "blk")
-                mapBlockFiles[it->path().filename().string().substr(3,5)] = it->path();
-            else if (it->path().filename().string().substr(0,3) == "rev")
-                remove(it->path());
+    BOOST_FOREACH(const path& blocksdir, blockVolumes.GetVolumes()) {
+        if (!is_directory(blocksdir))
+            continue;
+        for (directory_iterator it(blocksdir); it != directory_iterator(); it++) {
+            if (is_regular_file(*it) &&
+                it->path().filename().string().length() == 12 &&
+                it->path().filename().string().substr(8,4) == ".dat")
+            {
+                if (it->path().filename().string().substr(0,3) == "blk")
+                    mapBlockFiles[it->path().filename().string().substr(3,5)] = it->path();
+                else if (it->path().filename().string().substr(0,3) == "rev")
+                    remove(it->path());
+            }
         }
     }
 
@@ -590,6 +723,17 @@ void CleanupBlockRevFiles()
     }
 }
 
+/** Verify the -checkblocks blocks while the node runs, shutting it down if they are corrupted */
+static void ThreadVerifyDB(int nCheckLevel, int nCheckDepth)
+{
+    RenameThread("litecoinz-verify");
+    if (!CVerifyDB().VerifyDB(pcoinsTip, nCheckLevel, nCheckDepth)) {
+        uiInterface.ThreadSafeMessageBox(_("Corrupted block database detected") + ".\nPlease restart with -reindex to recover.",
+                                         "", CClientUIInterface::MSG_ERROR);
+        StartShutdown();
+    }
+}
+
 void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
 {
     RenameThread("litecoinz-loadblk");
@@ -599,6 +743,9 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         int nFile = 0;
         while (true) {
             CDiskBlockPos pos(nFile, 0);
+            // Reindexing reads the files as they were written
+            if (blockArchive.IsCompressed(nFile) && !blockArchive.Expand(nFile, GetBlockPosFilename(pos, "blk")))
+                break;
             if (!boost::filesystem::exists(GetBlockPosFilename(pos, "blk")))
                 break; // No block files left to reindex
             FILE *file = OpenBlockFile(pos, true);
@@ -646,6 +793,12 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         LogPrintf("Stopping after block import\n");
         StartShutdown();
     }
+
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        LoadMempool();
+        // Don't overwrite mempool.dat with what an interrupted load got through
+        fDumpMempoolLater = !ShutdownRequested();
+    }
 }
 
 /** Sanity checks
@@ -664,13 +817,69 @@ bool InitSanityCheck(void)
     return true;
 }
 
-static bool ZC_LoadParams(
-    const CChainParams& chainparams
-)
+static void ZC_LoadParamsThread(
+    const boost::filesystem::path& vk_path,
+    const boost::filesystem::path& pk_path,
+    const boost::filesystem::path& sapling_spend,
+    const boost::filesystem::path& sapling_output,
+    const boost::filesystem::path& sprout_groth16)
 {
+    RenameThread("litecoinz-params");
+
     struct timeval tv_start, tv_end;
     float elapsed;
 
+    try {
+        // Only the verifying key is read here; the proving key is read when
+        // a JoinSplit is first proved
+        LogPrintf("Loading verifying key from %s\n", vk_path.string().c_str());
+        gettimeofday(&tv_start, 0);
+
+        pzcashParams = ZCJoinSplit::Prepared(vk_path.string(), pk_path.string());
+
+        gettimeofday(&tv_end, 0);
+        elapsed = float(tv_end.tv_sec-tv_start.tv_sec) + (tv_end.tv_usec-tv_start.tv_usec)/float(1000000);
+        LogPrintf("Loaded verifying key in %fs seconds.\n", elapsed);
+    } catch (const std::exception& e) {
+        LogPrintf("Error loading verifying key: %s\n", e.what());
+        return;
+    }
+
+    static_assert(
+        sizeof(boost::filesystem::path::value_type) == sizeof(codeunit),
+        "librustzcash not configured correctly");
+    auto sapling_spend_str = sapling_spend.native();
+    auto sapling_output_str = sapling_output.native();
+    auto sprout_groth16_str = sprout_groth16.native();
+
+    LogPrintf("Loading Sapling (Spend) parameters from %s\n", sapling_spend.string().c_str());
+    LogPrintf("Loading Sapling (Output) parameters from %s\n", sapling_output.string().c_str());
+    LogPrintf("Loading Sapling (Sprout Groth16) parameters from %s\n", sprout_groth16.string().c_str());
+    gettimeofday(&tv_start, 0);
+
+    librustzcash_init_zksnark_params(
+        reinterpret_cast<const codeunit*>(sapling_spend_str.c_str()),
+        sapling_spend_str.length(),
+        "8270785a1a0d0bc77196f000ee6d221c9c9894f55307bd9357c3f0105d31ca63991ab91324160d8f53e2bbd3c2633a6eb8bdf5205d822e7f3f73edac51b2b70c",
+        reinterpret_cast<const codeunit*>(sapling_output_str.c_str()),
+        sapling_output_str.length(),
+        "657e3d38dbb5cb5e7dd2970e8b03d69b4787dd907285b5a7f0790dcc8072f60bf593b32cc2d1c030e00ff5ae64bf84c5c3beb84ddc841d48264b4a171744d028",
+        reinterpret_cast<const codeunit*>(sprout_groth16_str.c_str()),
+        sprout_groth16_str.length(),
+        "e9b238411bd6c0ec4791e9d04245ec350c9c5744f5610dfcce4365d5ca49dfefd5054e371842b3f88fa1b9d7e8e075249b3ebabd167fa8b0f3161292d36c180a"
+    );
+
+    gettimeofday(&tv_end, 0);
+    elapsed = float(tv_end.tv_sec-tv_start.tv_sec) + (tv_end.tv_usec-tv_start.tv_usec)/float(1000000);
+    LogPrintf("Loaded Sapling parameters in %fs seconds.\n", elapsed);
+
+    fParamsLoaded = true;
+}
+
+static bool ZC_LoadParams(
+    const CChainParams& chainparams
+)
+{
     boost::filesystem::path pk_path = ZC_GetParamsDir() / "sprout-proving.key";
     boost::filesystem::path vk_path = ZC_GetParamsDir() / "sprout-verifying.key";
     boost::filesystem::path sapling_spend = ZC_GetParamsDir() / "sapling-spend.params";
@@ -743,46 +952,17 @@ static bool ZC_LoadParams(
         return false;
     }
 
-    LogPrintf("Loading verifying key from %s\n", vk_path.string().c_str());
-    gettimeofday(&tv_start, 0);
-
-    pzcashParams = ZCJoinSplit::Prepared(vk_path.string(), pk_path.string());
-
-    gettimeofday(&tv_end, 0);
-    elapsed = float(tv_end.tv_sec-tv_start.tv_sec) + (tv_end.tv_usec-tv_start.tv_usec)/float(1000000);
-    LogPrintf("Loaded verifying key in %fs seconds.\n", elapsed);
-
-    static_assert(
-        sizeof(boost::filesystem::path::value_type) == sizeof(codeunit),
-        "librustzcash not configured correctly");
-    auto sapling_spend_str = sapling_spend.native();
-    auto sapling_output_str = sapling_output.native();
-    auto sprout_groth16_str = sprout_groth16.native();
-
-    LogPrintf("Loading Sapling (Spend) parameters from %s\n", sapling_spend.string().c_str());
-    LogPrintf("Loading Sapling (Output) parameters from %s\n", sapling_output.string().c_str());
-    LogPrintf("Loading Sapling (Sprout Groth16) parameters from %s\n", sprout_groth16.string().c_str());
-    gettimeofday(&tv_start, 0);
-
-    librustzcash_init_zksnark_params(
-        reinterpret_cast<const codeunit*>(sapling_spend_str.c_str()),
-        sapling_spend_str.length(),
-        "8270785a1a0d0bc77196f000ee6d221c9c9894f55307bd9357c3f0105d31ca63991ab91324160d8f53e2bbd3c2633a6eb8bdf5205d822e7f3f73edac51b2b70c",
-        reinterpret_cast<const codeunit*>(sapling_output_str.c_str()),
-        sapling_output_str.length(),
-        "657e3d38dbb5cb5e7dd2970e8b03d69b4787dd907285b5a7f0790dcc8072f60bf593b32cc2d1c030e00ff5ae64bf84c5c3beb84ddc841d48264b4a171744d028",
-        reinterpret_cast<const codeunit*>(sprout_groth16_str.c_str()),
-        sprout_groth16_str.length(),
-        "e9b238411bd6c0ec4791e9d04245ec350c9c5744f5610dfcce4365d5ca49dfefd5054e371842b3f88fa1b9d7e8e075249b3ebabd167fa8b0f3161292d36c180a"
-    );
-
-    gettimeofday(&tv_end, 0);
-    elapsed = float(tv_end.tv_sec-tv_start.tv_sec) + (tv_end.tv_usec-tv_start.tv_usec)/float(1000000);
-    LogPrintf("Loaded Sapling parameters in %fs seconds.\n", elapsed);
-
+    threadLoadParams = boost::thread(&ZC_LoadParamsThread, vk_path, pk_path, sapling_spend, sapling_output, sprout_groth16);
     return true;
 }
 
+static bool ZC_WaitForParams()
+{
+    if (threadLoadParams.joinable())
+        threadLoadParams.join();
+    return fParamsLoaded;
+}
+
 bool AppInitServers(boost::thread_group& threadGroup)
 {
     RPCServer::OnStopped(&OnRPCStopped);
@@ -795,6 +975,8 @@ bool AppInitServers(boost::thread_group& threadGroup)
         return false;
     if (GetBoolArg("-rest", false) && !StartREST())
         return false;
+    if (GetBoolArg("-metrics", DEFAULT_HTTP_METRICS) && !StartHTTPMetrics())
+        return false;
     if (!StartHTTPServer())
         return false;
     return true;
@@ -863,11 +1045,171 @@ void InitLogging()
     fPrintToConsole = GetBoolArg("-printtoconsole", false);
     fLogTimestamps = GetBoolArg("-logtimestamps", DEFAULT_LOGTIMESTAMPS);
     fLogIPs = GetBoolArg("-logips", DEFAULT_LOGIPS);
+    nLogRateLimit = std::max<int64_t>(0, GetArg("-debugratelimit", DEFAULT_LOG_RATE_LIMIT));
+    nMaxDebugLogSize = (uint64_t)std::max<int64_t>(0, GetArg("-maxdebuglogsize", DEFAULT_MAX_DEBUG_LOG_SIZE)) * 1000000;
 
     LogPrintf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     LogPrintf("LitecoinZ version %s (%s)\n", FormatFullVersion(), CLIENT_DATE);
 }
 
+#ifdef ENABLE_WALLET
+/**
+ * Load or create, upgrade and rescan the wallet strWalletFile, and register
+ * it for notifications. Returns NULL if the node can't start with it, with
+ * the error already reported; lesser errors are added to strErrors.
+ */
+static CWallet* LoadWalletFile(const std::string& strWalletFile, bool clearWitnessCaches, std::ostringstream& strErrors)
+{
+    // needed to restore wallet transaction meta data after -zapwallettxes
+    std::vector<CWalletTx> vWtx;
+
+    if (GetBoolArg("-zapwallettxes", false)) {
+        uiInterface.InitMessage(_("Zapping all transactions from wallet..."));
+
+        CWallet* pwallet = new CWallet(strWalletFile);
+        DBErrors nZapWalletRet = pwallet->ZapWalletTx(vWtx);
+        if (nZapWalletRet != DB_LOAD_OK) {
+            uiInterface.InitMessage(strprintf(_("Error loading %s: Wallet corrupted"), strWalletFile));
+            delete pwallet;
+            return NULL;
+        }
+
+        delete pwallet;
+    }
+
+    uiInterface.InitMessage(_("Loading wallet..."));
+
+    int64_t nStart = GetTimeMillis();
+    bool fFirstRun = true;
+    CWallet* pwallet = new CWallet(strWalletFile);
+    DBErrors nLoadWalletRet = pwallet->LoadWallet(fFirstRun);
+    if (nLoadWalletRet != DB_LOAD_OK)
+    {
+        if (nLoadWalletRet == DB_CORRUPT)
+            strErrors << strprintf(_("Error loading %s: Wallet corrupted"), strWalletFile) << "\n";
+        else if (nLoadWalletRet == DB_NONCRITICAL_ERROR)
+        {
+            string msg(strprintf(_("Warning: error reading %s! All keys read correctly, but transaction data"
+                         " or address book entries might be missing or incorrect."), strWalletFile));
+            InitWarning(msg);
+        }
+        else if (nLoadWalletRet == DB_TOO_NEW)
+            strErrors << strprintf(_("Error loading %s: Wallet requires newer version of LitecoinZ"), strWalletFile) << "\n";
+        else if (nLoadWalletRet == DB_NEED_REWRITE)
+        {
+            strErrors << _("Wallet needed to be rewritten: restart LitecoinZ to complete") << "\n";
+            LogPrintf("%s", strErrors.str());
+            InitError(strErrors.str());
+            delete pwallet;
+            return NULL;
+        }
+        else
+            strErrors << strprintf(_("Error loading %s"), strWalletFile) << "\n";
+    }
+
+    if (GetBoolArg("-upgradewallet", fFirstRun))
+    {
+        int nMaxVersion = GetArg("-upgradewallet", 0);
+        if (nMaxVersion == 0) // the -upgradewallet without argument case
+        {
+            LogPrintf("Performing wallet upgrade to %i\n", FEATURE_LATEST);
+            nMaxVersion = CLIENT_VERSION;
+            pwallet->SetMinVersion(FEATURE_LATEST); // permanently upgrade the wallet immediately
+        }
+        else
+            LogPrintf("Allowing wallet upgrade up to %i\n", nMaxVersion);
+        if (nMaxVersion < pwallet->GetVersion())
+            strErrors << _("Cannot downgrade wallet") << "\n";
+        pwallet->SetMaxVersion(nMaxVersion);
+    }
+
+    if (!pwallet->HaveHDSeed())
+    {
+        // generate a new HD seed
+        pwallet->GenerateNewSeed();
+    }
+
+    if (fFirstRun)
+    {
+        // Create new keyUser and set as default key
+        CPubKey newDefaultKey;
+        if (pwallet->GetKeyFromPool(newDefaultKey)) {
+            pwallet->SetDefaultKey(newDefaultKey);
+            if (!pwallet->SetAddressBook(pwallet->vchDefaultKey.GetID(), "", "receive"))
+                strErrors << _("Cannot write default address") << "\n";
+        }
+
+        pwallet->SetBestChain(chainActive.GetLocator());
+    }
+
+    LogPrintf("%s", strErrors.str());
+    LogPrintf(" wallet      %15dms (%s)\n", GetTimeMillis() - nStart, strWalletFile);
+
+    // Each wallet takes its notifications on a thread of its own, so
+    // that they keep up with the chain side by side
+    RegisterValidationInterface(pwallet, true);
+
+    CBlockIndex *pindexRescan = chainActive.Tip();
+    if (clearWitnessCaches || GetBoolArg("-rescan", false))
+    {
+        pwallet->ClearNoteWitnessCache();
+        pindexRescan = chainActive.Genesis();
+    }
+    else
+    {
+        CWalletDB walletdb(strWalletFile);
+        CBlockLocator locator;
+        if (walletdb.ReadBestBlock(locator))
+            pindexRescan = FindForkInGlobalIndex(chainActive, locator);
+        else
+            pindexRescan = chainActive.Genesis();
+    }
+    if (chainActive.Tip() && chainActive.Tip() != pindexRescan)
+    {
+        uiInterface.InitMessage(_("Rescanning..."));
+        LogPrintf("Rescanning last %i blocks of %s (from block %i)...\n", chainActive.Height() - pindexRescan->nHeight, strWalletFile, pindexRescan->nHeight);
+        nStart = GetTimeMillis();
+        pwallet->ScanForWalletTransactions(pindexRescan, true);
+        LogPrintf(" rescan      %15dms\n", GetTimeMillis() - nStart);
+        pwallet->SetBestChain(chainActive.GetLocator());
+        nWalletDBUpdated++;
+
+        // Restore wallet transaction metadata after -zapwallettxes=1
+        if (GetBoolArg("-zapwallettxes", false) && GetArg("-zapwallettxes", "1") != "2")
+        {
+            CWalletDB walletdb(strWalletFile);
+
+            BOOST_FOREACH(const CWalletTx& wtxOld, vWtx)
+            {
+                uint256 hash = wtxOld.GetHash();
+                std::map<uint256, CWalletTx>::iterator mi = pwallet->mapWallet.find(hash);
+                if (mi != pwallet->mapWallet.end())
+                {
+                    const CWalletTx* copyFrom = &wtxOld;
+                    CWalletTx* copyTo = &mi->second;
+                    copyTo->mapValue = copyFrom->mapValue;
+                    copyTo->vOrderForm = copyFrom->vOrderForm;
+                    copyTo->nTimeReceived = copyFrom->nTimeReceived;
+                    copyTo->nTimeSmart = copyFrom->nTimeSmart;
+                    copyTo->fFromMe = copyFrom->fFromMe;
+                    copyTo->strFromAccount = copyFrom->strFromAccount;
+                    copyTo->nOrderPos = copyFrom->nOrderPos;
+                    copyTo->WriteToDisk(&walletdb);
+                }
+            }
+        }
+    }
+    {
+        // What was buried while the node was down, or before -walletcompacttx was set
+        LOCK2(cs_main, pwallet->cs_wallet);
+        pwallet->CompactTransactions();
+    }
+    pwallet->SetBroadcastTransactions(GetBoolArg("-walletbroadcast", true));
+
+    return pwallet;
+}
+#endif // ENABLE_WALLET
+
 /** Initialize bitcoin.
  *  @pre Parameters should be parsed and config file should be read.
  */
@@ -897,6 +1239,16 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (setProcDEPPol != NULL) setProcDEPPol(PROCESS_DEP_ENABLE);
 #endif
 
+#ifdef HAVE_MALLOPT_ARENA_MAX
+    // glibc gives threads that allocate at once their own heap arenas, up to
+    // eight per core, and memory freed in one can't serve another. With many
+    // threads briefly allocating messages and transactions the heap grows
+    // well past what is in use; fewer arenas keep it tighter.
+    int nMallocArenas = GetArg("-mallocarenas", sizeof(void*) == 4 ? 1 : DEFAULT_MALLOC_ARENAS);
+    if (nMallocArenas > 0)
+        mallopt(M_ARENA_MAX, nMallocArenas);
+#endif
+
     if (!SetupNetworking())
         return InitError("Error: Initializing networking failed");
 
@@ -966,6 +1318,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (GetArg("-prune", 0)) {
         if (GetBoolArg("-txindex", false))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (GetArg("-compressblocks", DEFAULT_COMPRESS_BLOCKS) > 0)
+            return InitError(_("Prune mode is incompatible with -compressblocks."));
 #ifdef ENABLE_WALLET
         if (!GetBoolArg("-disablewallet", false)) {
             if (SoftSetBoolArg("-disablewallet", true))
@@ -1013,6 +1367,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = GetBoolArg("-checkpoints", true);
+    hashAssumeValid = uint256S(GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
+    if (!hashAssumeValid.IsNull())
+        LogPrintf("Assuming ancestors of block %s have valid proofs and signatures.\n", hashAssumeValid.GetHex());
+    else
+        LogPrintf("Validating proofs and signatures for all blocks.\n");
+    fHeaderCommitment = GetBoolArg("-headercommitment", DEFAULT_HEADER_COMMITMENT);
 
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
     nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
@@ -1022,6 +1382,40 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         nScriptCheckThreads = 0;
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
+    // Each queue below gets threads of its own, but together they only run
+    // as many at once as -par allows, besides the thread waiting for them.
+    SetWorkerBudget(nScriptCheckThreads - 1);
+
+    // Proofs verified during block validation run on the script check
+    // threads, which already use the cores -par gives them, so each of those
+    // stays single-threaded. Proving, and verification without those
+    // threads, gets the rest of the cores.
+    int nProofThreads = GetArg("-proofthreads", DEFAULT_PROOF_THREADS);
+    if (nProofThreads <= 0)
+        nProofThreads = std::max(GetNumCores() - nScriptCheckThreads, 1);
+    libzcash::SetProofThreads(nProofThreads, nScriptCheckThreads ? 1 : nProofThreads);
+    LogPrintf("Using up to %d threads for proving Sprout JoinSplits\n", nProofThreads);
+
+    int nCoreBudget = GetArg("-threads", DEFAULT_CORE_BUDGET);
+    if (nCoreBudget <= 0)
+        nCoreBudget = GetNumCores();
+    SetCoreBudget(nCoreBudget);
+    LogPrintf("Sharing %d cores between validation, relay, RPC, wallet and mining work\n", nCoreBudget);
+
+    int64_t nMmapBlockFiles = GetArg("-mmapblockfiles", DEFAULT_MMAP_BLOCK_FILES);
+    blockFileMap.SetLimit(std::max<int64_t>(nMmapBlockFiles, 0));
+    txIndexCache.SetLimit(std::max<int64_t>(GetArg("-txindexcache", DEFAULT_TXINDEX_CACHE), 0) << 20);
+    responseCache.SetLimit(std::max<int64_t>(GetArg("-rpcresponsecache", DEFAULT_RESPONSE_CACHE), 0) << 20);
+    getAsyncRPCQueue()->setResultLimits(std::max<int64_t>(GetArg("-rpcasyncresults", DEFAULT_ASYNC_RESULTS), 0), GetArg("-rpcasyncresultttl", DEFAULT_ASYNC_RESULT_TTL));
+    relayCache.SetLimit(std::max<int64_t>(GetArg("-relaycache", DEFAULT_RELAY_CACHE), 0) << 20);
+    nBlockFileSyncInterval = std::max<int64_t>(GetArg("-blockfilesync", DEFAULT_BLOCKFILE_SYNC_INTERVAL), 0);
+    SetTraceBufferSize(std::max<int64_t>(GetArg("-tracebuffer", DEFAULT_TRACE_BUFFER), 0));
+    const char* const DB_NAMES[] = {"coindb", "blockdb"};
+    BOOST_FOREACH(const char* strName, DB_NAMES) {
+        std::string strEngine = GetDBOptionsFromArgs(strName).strEngine;
+        if (!IsDBEngineAvailable(strEngine))
+            return InitError(strprintf(_("Unknown storage engine -%sengine=%s (available: %s)"), strName, strEngine, GetDBEngineNames()));
+    }
 
     fServer = GetBoolArg("-server", DEFAULT_SERVER);
 
@@ -1045,6 +1439,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (!fDisableWallet)
         RegisterWalletRPCCommands(tableRPC);
 #endif
+#if ENABLE_ZMQ
+    RegisterZMQRPCCommands(tableRPC);
+#endif
 
     nConnectTimeout = GetArg("-timeout", DEFAULT_CONNECT_TIMEOUT);
     if (nConnectTimeout <= 0)
@@ -1064,6 +1461,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         else
             return InitError(strprintf(_("Invalid amount for -minrelaytxfee=<amount>: '%s'"), mapArgs["-minrelaytxfee"]));
     }
+    if (mapArgs.count("-longpollfeedelta"))
+    {
+        CAmount n = 0;
+        if (!ParseMoney(mapArgs["-longpollfeedelta"], n) || n < 0)
+            return InitError(strprintf(_("Invalid amount for -longpollfeedelta=<amount>: '%s'"), mapArgs["-longpollfeedelta"]));
+    }
 
 #ifdef ENABLE_WALLET
     if (mapArgs.count("-mintxfee"))
@@ -1109,9 +1512,18 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         return InitError(strprintf(_("Invalid value for -expiryDelta='%u' (must be least %u)"), expiryDelta, minExpiryDelta));
     }
     bSpendZeroConfChange = GetBoolArg("-spendzeroconfchange", true);
+    nConsolidateInputs = std::max<int64_t>(0, GetArg("-consolidateinputs", DEFAULT_CONSOLIDATE_INPUTS));
     fSendFreeTransactions = GetBoolArg("-sendfreetransactions", false);
-
-    std::string strWalletFile = GetArg("-wallet", "wallet.dat");
+    fWalletCompactTx = GetBoolArg("-walletcompacttx", DEFAULT_WALLET_COMPACT_TX);
+    std::string strWalletFormat = GetArg("-walletformat", DEFAULT_WALLET_FORMAT);
+    if (strWalletFormat != "bdb" && strWalletFormat != "log")
+        return InitError(strprintf(_("Unknown wallet format -walletformat=%s (must be bdb or log)"), strWalletFormat));
+
+    std::vector<std::string> vstrWalletFiles;
+    if (mapMultiArgs.count("-wallet"))
+        vstrWalletFiles = mapMultiArgs["-wallet"];
+    else
+        vstrWalletFiles.push_back("wallet.dat");
 #endif // ENABLE_WALLET
 
     fIsBareMultisigStd = GetBoolArg("-permitbaremultisig", true);
@@ -1136,6 +1548,24 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 mapArgs["-mineraddress"]));
         }
     }
+    std::string strSolver = GetArg("-equihashsolver", "default");
+    if (strSolver != "default" && strSolver != "bucket" && strSolver != "tromp" && strSolver != "plugin")
+        return InitError(strprintf(_("Unknown Equihash solver -equihashsolver=%s"), strSolver));
+    if (strSolver == "plugin") {
+        std::string strError;
+        pEquihashPlugin = CEquihashPlugin::Load(GetArg("-equihashplugin", ""), strError);
+        if (!pEquihashPlugin || !pEquihashPlugin->SelectDevices(GetArg("-equihashdevices", ""), strError))
+            return InitError(strprintf(_("Unable to use the Equihash solver plugin: %s"), strError));
+        for (int nDevice : pEquihashPlugin->GetDevices())
+            LogPrintf("Equihash solver plugin device %d: %s\n", nDevice, pEquihashPlugin->DeviceName(nDevice));
+    }
+    if (GetBoolArg("-stratum", DEFAULT_STRATUM)) {
+        if (GetArg("-mineraddress", "").empty())
+            return InitError(_("-stratum requires -mineraddress to be set"));
+        double dDifficulty;
+        if (mapArgs.count("-stratumdifficulty") && (!ParseDouble(mapArgs["-stratumdifficulty"], &dDifficulty) || dDifficulty <= 0))
+            return InitError(strprintf(_("Invalid difficulty for -stratumdifficulty=<n>: '%s'"), mapArgs["-stratumdifficulty"]));
+    }
 #endif
 
     // Default value of 0 for mempooltxinputlimit means no limit is applied
@@ -1192,6 +1622,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         return false;
     }
 
+    // Pick the fastest SHA256 implementation before anything is hashed
+    std::string sha256_algo = SHA256AutoDetect();
+
     // Initialize elliptic curve code
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
@@ -1202,9 +1635,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     std::string strDataDir = GetDataDir().string();
 #ifdef ENABLE_WALLET
-    // Wallet file must be a plain filename without a directory
-    if (strWalletFile != boost::filesystem::basename(strWalletFile) + boost::filesystem::extension(strWalletFile))
-        return InitError(strprintf(_("Wallet %s resides outside data directory %s"), strWalletFile, strDataDir));
+    std::set<std::string> setWalletFiles;
+    for (const std::string& strWalletFile : vstrWalletFiles) {
+        // Wallet file must be a plain filename without a directory
+        if (strWalletFile != boost::filesystem::basename(strWalletFile) + boost::filesystem::extension(strWalletFile))
+            return InitError(strprintf(_("Wallet %s resides outside data directory %s"), strWalletFile, strDataDir));
+        if (!setWalletFiles.insert(strWalletFile).second)
+            return InitError(strprintf(_("Wallet %s is specified more than once"), strWalletFile));
+    }
 #endif
     // Make sure only a single Bitcoin process is using the data directory.
     boost::filesystem::path pathLockFile = GetDataDir() / ".lock";
@@ -1222,16 +1660,22 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 #ifndef WIN32
     CreatePidFile(GetPidFile(), getpid());
 #endif
-    if (GetBoolArg("-shrinkdebugfile", !fDebug))
+    // Rotation keeps debug.log bounded without rewriting it here
+    if (GetBoolArg("-shrinkdebugfile", !fDebug && nMaxDebugLogSize == 0))
         ShrinkDebugFile();
 
-    if (fPrintToDebugLog)
+    if (fPrintToDebugLog) {
         OpenDebugLog();
+        if (GetBoolArg("-asynclog", DEFAULT_ASYNC_LOG))
+            StartAsyncLogging();
+    }
 
     LogPrintf("Using OpenSSL version %s\n", SSLeay_version(SSLEAY_VERSION));
 #ifdef ENABLE_WALLET
     LogPrintf("Using BerkeleyDB version %s\n", DbEnv::version(0, 0, 0));
 #endif
+    LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
+    LogPrintf("Using BLAKE2b batch implementation: %s\n", BLAKE2bBatchImplementation());
     if (!fLogTimestamps)
         LogPrintf("Startup time: %s\n", DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetTime()));
     LogPrintf("Default data directory %s\n", GetDefaultDataDir().string());
@@ -1240,15 +1684,36 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
-    LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    LogPrintf("Using %u threads for script and proof verification and input prefetch\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadProofCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadCoinPrefetch);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadTxPrecheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadBlockPrevalidation);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadHeaderCheck);
+    }
+    if (fPruneMode)
+        threadGroup.create_thread(&ThreadPruneUnlink);
+    int nCompressBlocks = std::min<int64_t>(GetArg("-compressblocks", DEFAULT_COMPRESS_BLOCKS), 22);
+    if (nCompressBlocks > 0) {
+        if (!IsBlockArchiveAvailable())
+            return InitError(_("-compressblocks is not supported by this build, which lacks zstd."));
+        threadGroup.create_thread(boost::bind(&ThreadCompressBlockFiles, nCompressBlocks));
     }
 
-    // Start the lightweight task scheduler thread
+    // Start the lightweight task scheduler threads, more than one so that
+    // a slow task doesn't hold up the others
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
-    threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    for (int i = 0; i < DEFAULT_SCHEDULER_THREADS; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    SetMetricsScheduler(&scheduler);
 
     // Count uptime
     MarkStartTime();
@@ -1287,19 +1752,22 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     // ********************************************************* Step 5: verify wallet database integrity
 #ifdef ENABLE_WALLET
     if (!fDisableWallet) {
-        LogPrintf("Using wallet %s\n", strWalletFile);
         uiInterface.InitMessage(_("Verifying wallet..."));
 
-        std::string warningString;
-        std::string errorString;
+        for (const std::string& strWalletFile : vstrWalletFiles) {
+            LogPrintf("Using wallet %s\n", strWalletFile);
 
-        if (!CWallet::Verify(strWalletFile, warningString, errorString))
-            return false;
+            std::string warningString;
+            std::string errorString;
+
+            if (!CWallet::Verify(strWalletFile, warningString, errorString))
+                return false;
 
-        if (!warningString.empty())
-            InitWarning(warningString);
-        if (!errorString.empty())
-            return InitError(warningString);
+            if (!warningString.empty())
+                InitWarning(warningString);
+            if (!errorString.empty())
+                return InitError(warningString);
+        }
 
     } // (!fDisableWallet)
 #endif // ENABLE_WALLET
@@ -1446,8 +1914,34 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     fReindex = GetBoolArg("-reindex", false);
 
+    // Block files live in <blocksdir>/blocks, and in the same place under
+    // each -blocksvolume. The block index stays in the data directory.
+    std::vector<boost::filesystem::path> vBlockVolumes;
+    std::vector<std::string> vVolumeArgs;
+    vVolumeArgs.push_back(GetArg("-blocksdir", ""));
+    if (mapMultiArgs.count("-blocksvolume"))
+        vVolumeArgs.insert(vVolumeArgs.end(), mapMultiArgs["-blocksvolume"].begin(), mapMultiArgs["-blocksvolume"].end());
+    BOOST_FOREACH(const std::string& strVolume, vVolumeArgs) {
+        if (strVolume.empty()) {
+            vBlockVolumes.push_back(GetDataDir() / "blocks");
+            continue;
+        }
+        boost::filesystem::path volume = boost::filesystem::system_complete(strVolume);
+        if (!boost::filesystem::is_directory(volume))
+            return InitError(strprintf(_("Specified blocks directory \"%s\" does not exist."), strVolume));
+        vBlockVolumes.push_back(volume / BaseParams().DataDir() / "blocks");
+        boost::filesystem::create_directories(vBlockVolumes.back());
+    }
+    blockVolumes.SetVolumes(vBlockVolumes);
+    BOOST_FOREACH(const boost::filesystem::path& volume, vBlockVolumes)
+        LogPrintf("Using block files directory %s\n", volume.string());
+    if (!LoadBlockArchives())
+        return InitError(_("Error reading compressed block files"));
+    if (blockArchive.size() && !IsBlockArchiveAvailable())
+        return InitError(_("Some block files are compressed, which this build can't read as it lacks zstd."));
+
     // Upgrading to 0.8; hard-link the old blknnnn.dat files into /blocks/
-    boost::filesystem::path blocksDir = GetDataDir() / "blocks";
+    boost::filesystem::path blocksDir = vBlockVolumes[0];
     if (!boost::filesystem::exists(blocksDir))
     {
         boost::filesystem::create_directories(blocksDir);
@@ -1483,11 +1977,16 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     nTotalCache -= nBlockTreeDBCache;
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nTotalCache -= nCoinDBCache;
+    nAnchorCacheUsage = nTotalCache / 16; // 1/16 of the in-memory cache for anchor trees
+    nNullifierCacheUsage = nTotalCache / 8; // 1/8 for nullifiers
+    nTotalCache -= nAnchorCacheUsage + nNullifierCacheUsage;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for in-memory anchor trees\n", nAnchorCacheUsage * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for in-memory nullifiers\n", nNullifierCacheUsage * (1.0 / 1024 / 1024));
 
     bool clearWitnessCaches = false;
 
@@ -1503,12 +2002,22 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
+                delete pcoinsmemory;
+                pcoinsmemory = NULL;
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
+
+                // Migrate a chainstate written with one record per transaction
+                // to one record per output.
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
+
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
@@ -1524,11 +2033,44 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                // Finish a chainstate flush that was interrupted part way
+                // through before anything reads the best block from it.
+                if (!ReplayBlocks(chainparams, pcoinsdbview)) {
+                    strLoadError = _("Unable to replay blocks. You will need to rebuild the database using -reindex.");
+                    break;
+                }
+                // Only then can the chainstate be loaded into memory, and
+                // pcoinsTip put over it.
+                if (GetBoolArg("-chainstateinmemory", DEFAULT_CHAINSTATE_IN_MEMORY)) {
+                    uiInterface.InitMessage(_("Loading the chainstate into memory..."));
+                    pcoinsmemory = new CCoinsViewMemory(*pcoinsdbview);
+                    if (!pcoinsmemory->Load()) {
+                        strLoadError = _("Error loading the chainstate database into memory");
+                        break;
+                    }
+                    delete pcoinsTip;
+                    pcoinsTip = new CCoinsViewCache(pcoinsmemory);
+                }
+                if (!LoadChainTip(chainparams)) {
+                    strLoadError = _("Error initializing block database");
+                    break;
+                }
+                // Nullifiers missing from memory are never looked up on disk
+                if (!pcoinsmemory && !pcoinsdbview->LoadNullifierFilters()) {
+                    strLoadError = _("Error loading nullifiers from the chainstate database");
+                    break;
+                }
+
                 // If the loaded chain has a wrong genesis, bail out immediately
                 // (we're likely using a testnet datadir, or the other way around).
                 if (!mapBlockIndex.empty() && mapBlockIndex.count(chainparams.GetConsensus().hashGenesisBlock) == 0)
                     return InitError(_("Incorrect or no genesis block found. Wrong datadir for network?"));
 
+                // The parameters were loading alongside the block index.
+                // Connecting the genesis block and VerifyDB check proofs.
+                if (!ZC_WaitForParams())
+                    return InitError(_("Error loading LitecoinZ network parameters"));
+
                 // Initialize the block index (no-op if non-empty database was already loaded)
                 if (!InitBlockIndex()) {
                     strLoadError = _("Error initializing block database");
@@ -1541,6 +2083,32 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                // Check for changed -shieldedindex state
+                if (fShieldedIndex != GetBoolArg("-shieldedindex", false)) {
+                    strLoadError = _("You need to rebuild the database using -reindex to change -shieldedindex");
+                    break;
+                }
+
+                // Check for changed -addressindex, -spentindex and -timestampindex state
+                if (fAddressIndex != GetBoolArg("-addressindex", false)) {
+                    strLoadError = _("You need to rebuild the database using -reindex to change -addressindex");
+                    break;
+                }
+                if (fSpentIndex != GetBoolArg("-spentindex", false)) {
+                    strLoadError = _("You need to rebuild the database using -reindex to change -spentindex");
+                    break;
+                }
+                if (fTimestampIndex != GetBoolArg("-timestampindex", false)) {
+                    strLoadError = _("You need to rebuild the database using -reindex to change -timestampindex");
+                    break;
+                }
+
+                // Check for changed -coinstatsindex state
+                if (fCoinStatsIndex != GetBoolArg("-coinstatsindex", false)) {
+                    strLoadError = _("You need to rebuild the database using -reindex to change -coinstatsindex");
+                    break;
+                }
+
                 // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
                 // in the past, but is now trying to run unpruned.
                 if (fHavePruned && !fPruneMode) {
@@ -1573,7 +2141,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     }
                 }
 
-                if (!CVerifyDB().VerifyDB(pcoinsdbview, GetArg("-checklevel", 3),
+                if (!GetBoolArg("-checkinbackground", DEFAULT_CHECK_IN_BACKGROUND) &&
+                    !CVerifyDB().VerifyDB(pcoinsdbview, GetArg("-checklevel", 3),
                               GetArg("-checkblocks", 288))) {
                     strLoadError = _("Corrupted block database detected");
                     break;
@@ -1617,6 +2186,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    // Everything from here on may check or create proofs
+    if (!ZC_WaitForParams())
+        return InitError(_("Error loading LitecoinZ network parameters"));
+
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1624,6 +2197,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         mempool.ReadFeeEstimates(est_filein);
     fFeeEstimatesInitialized = true;
 
+    if (GetBoolArg("-rpcasyncpersist", false)) {
+        try {
+            getAsyncRPCQueue()->setResultDB(std::make_shared<CAsyncRPCResultDB>(GetDataDir() / "asyncresults", 1 << 20));
+        } catch (const std::exception& e) {
+            return InitError(strprintf(_("Error opening the async operation result database: %s"), e.what()));
+        }
+    }
+
 
     // ********************************************************* Step 8: load wallet
 #ifdef ENABLE_WALLET
@@ -1632,142 +2213,17 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         LogPrintf("Wallet disabled!\n");
     } else {
 
-        // needed to restore wallet transaction meta data after -zapwallettxes
-        std::vector<CWalletTx> vWtx;
-
-        if (GetBoolArg("-zapwallettxes", false)) {
-            uiInterface.InitMessage(_("Zapping all transactions from wallet..."));
-
-            pwalletMain = new CWallet(strWalletFile);
-            DBErrors nZapWalletRet = pwalletMain->ZapWalletTx(vWtx);
-            if (nZapWalletRet != DB_LOAD_OK) {
-                uiInterface.InitMessage(_("Error loading wallet.dat: Wallet corrupted"));
+        for (const std::string& strWalletFile : vstrWalletFiles) {
+            CWallet* pwallet = LoadWalletFile(strWalletFile, clearWitnessCaches, strErrors);
+            if (!pwallet)
                 return false;
-            }
-
-            delete pwalletMain;
-            pwalletMain = NULL;
-        }
-
-        uiInterface.InitMessage(_("Loading wallet..."));
-
-        nStart = GetTimeMillis();
-        bool fFirstRun = true;
-        pwalletMain = new CWallet(strWalletFile);
-        DBErrors nLoadWalletRet = pwalletMain->LoadWallet(fFirstRun);
-        if (nLoadWalletRet != DB_LOAD_OK)
-        {
-            if (nLoadWalletRet == DB_CORRUPT)
-                strErrors << _("Error loading wallet.dat: Wallet corrupted") << "\n";
-            else if (nLoadWalletRet == DB_NONCRITICAL_ERROR)
-            {
-                string msg(_("Warning: error reading wallet.dat! All keys read correctly, but transaction data"
-                             " or address book entries might be missing or incorrect."));
-                InitWarning(msg);
-            }
-            else if (nLoadWalletRet == DB_TOO_NEW)
-                strErrors << _("Error loading wallet.dat: Wallet requires newer version of LitecoinZ") << "\n";
-            else if (nLoadWalletRet == DB_NEED_REWRITE)
-            {
-                strErrors << _("Wallet needed to be rewritten: restart LitecoinZ to complete") << "\n";
-                LogPrintf("%s", strErrors.str());
-                return InitError(strErrors.str());
-            }
-            else
-                strErrors << _("Error loading wallet.dat") << "\n";
-        }
-
-        if (GetBoolArg("-upgradewallet", fFirstRun))
-        {
-            int nMaxVersion = GetArg("-upgradewallet", 0);
-            if (nMaxVersion == 0) // the -upgradewallet without argument case
-            {
-                LogPrintf("Performing wallet upgrade to %i\n", FEATURE_LATEST);
-                nMaxVersion = CLIENT_VERSION;
-                pwalletMain->SetMinVersion(FEATURE_LATEST); // permanently upgrade the wallet immediately
-            }
-            else
-                LogPrintf("Allowing wallet upgrade up to %i\n", nMaxVersion);
-            if (nMaxVersion < pwalletMain->GetVersion())
-                strErrors << _("Cannot downgrade wallet") << "\n";
-            pwalletMain->SetMaxVersion(nMaxVersion);
+            vpwallets.push_back(pwallet);
         }
+        pwalletMain = vpwallets[0];
 
-        if (!pwalletMain->HaveHDSeed())
-        {
-            // generate a new HD seed
-            pwalletMain->GenerateNewSeed();
-        }
-
-        if (fFirstRun)
-        {
-            // Create new keyUser and set as default key
-            CPubKey newDefaultKey;
-            if (pwalletMain->GetKeyFromPool(newDefaultKey)) {
-                pwalletMain->SetDefaultKey(newDefaultKey);
-                if (!pwalletMain->SetAddressBook(pwalletMain->vchDefaultKey.GetID(), "", "receive"))
-                    strErrors << _("Cannot write default address") << "\n";
-            }
-
-            pwalletMain->SetBestChain(chainActive.GetLocator());
-        }
-
-        LogPrintf("%s", strErrors.str());
-        LogPrintf(" wallet      %15dms\n", GetTimeMillis() - nStart);
-
-        RegisterValidationInterface(pwalletMain);
-
-        CBlockIndex *pindexRescan = chainActive.Tip();
-        if (clearWitnessCaches || GetBoolArg("-rescan", false))
-        {
-            pwalletMain->ClearNoteWitnessCache();
-            pindexRescan = chainActive.Genesis();
-        }
-        else
-        {
-            CWalletDB walletdb(strWalletFile);
-            CBlockLocator locator;
-            if (walletdb.ReadBestBlock(locator))
-                pindexRescan = FindForkInGlobalIndex(chainActive, locator);
-            else
-                pindexRescan = chainActive.Genesis();
-        }
-        if (chainActive.Tip() && chainActive.Tip() != pindexRescan)
-        {
-            uiInterface.InitMessage(_("Rescanning..."));
-            LogPrintf("Rescanning last %i blocks (from block %i)...\n", chainActive.Height() - pindexRescan->nHeight, pindexRescan->nHeight);
-            nStart = GetTimeMillis();
-            pwalletMain->ScanForWalletTransactions(pindexRescan, true);
-            LogPrintf(" rescan      %15dms\n", GetTimeMillis() - nStart);
-            pwalletMain->SetBestChain(chainActive.GetLocator());
-            nWalletDBUpdated++;
-
-            // Restore wallet transaction metadata after -zapwallettxes=1
-            if (GetBoolArg("-zapwallettxes", false) && GetArg("-zapwallettxes", "1") != "2")
-            {
-                CWalletDB walletdb(strWalletFile);
-
-                BOOST_FOREACH(const CWalletTx& wtxOld, vWtx)
-                {
-                    uint256 hash = wtxOld.GetHash();
-                    std::map<uint256, CWalletTx>::iterator mi = pwalletMain->mapWallet.find(hash);
-                    if (mi != pwalletMain->mapWallet.end())
-                    {
-                        const CWalletTx* copyFrom = &wtxOld;
-                        CWalletTx* copyTo = &mi->second;
-                        copyTo->mapValue = copyFrom->mapValue;
-                        copyTo->vOrderForm = copyFrom->vOrderForm;
-                        copyTo->nTimeReceived = copyFrom->nTimeReceived;
-                        copyTo->nTimeSmart = copyFrom->nTimeSmart;
-                        copyTo->fFromMe = copyFrom->fFromMe;
-                        copyTo->strFromAccount = copyFrom->strFromAccount;
-                        copyTo->nOrderPos = copyFrom->nOrderPos;
-                        copyTo->WriteToDisk(&walletdb);
-                    }
-                }
-            }
-        }
-        pwalletMain->SetBroadcastTransactions(GetBoolArg("-walletbroadcast", true));
+        // Trial decryption shares the -par worker slots with script and proof checks
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadTrialDecryption);
     } // (!fDisableWallet)
 #else // ENABLE_WALLET
     LogPrintf("No wallet support compiled in!\n");
@@ -1817,9 +2273,25 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (!CheckDiskSpace())
         return false;
 
-    if (mapArgs.count("-blocknotify"))
+    // Only now that the wallet has caught up and registered, so that what it
+    // is told about follows on from its rescan
+    if (GetBoolArg("-asyncnotifications", DEFAULT_ASYNC_NOTIFICATIONS))
+        StartValidationInterfaceQueue();
+
+    std::string strNotifySinkError;
+    if (!StartNotifySink(strNotifySinkError))
+        return InitError(strprintf(_("Invalid -notifysink: %s"), strNotifySinkError));
+    if (mapArgs.count("-blocknotify") || IsNotifySinkRunning())
         uiInterface.NotifyBlockTip.connect(BlockNotifyCallback);
 
+    if (mapArgs.count("-txarrivallog")) {
+        boost::filesystem::path pathArrivalLog(GetArg("-txarrivallog", ""));
+        if (!pathArrivalLog.is_complete())
+            pathArrivalLog = GetDataDir() / pathArrivalLog;
+        if (!OpenTxArrivalLog(pathArrivalLog))
+            return InitError(strprintf(_("Cannot write -txarrivallog=%s"), pathArrivalLog.string()));
+    }
+
     uiInterface.InitMessage(_("Activating best chain..."));
     // scan for better chains in the block chain database, that are not yet connected in the active best chain
     CValidationState state;
@@ -1838,6 +2310,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         while (!fRequestShutdown && chainActive.Tip() == NULL)
             MilliSleep(10);
     }
+    if (!fReindex && GetBoolArg("-checkinbackground", DEFAULT_CHECK_IN_BACKGROUND))
+        threadGroup.create_thread(boost::bind(&ThreadVerifyDB, GetArg("-checklevel", 3), GetArg("-checkblocks", 288)));
 
     // ********************************************************* Step 11: start node
 
@@ -1848,9 +2322,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("mapBlockIndex.size() = %u\n",   mapBlockIndex.size());
     LogPrintf("nBestHeight = %d\n",                   chainActive.Height());
 #ifdef ENABLE_WALLET
-    LogPrintf("setKeyPool.size() = %u\n",      pwalletMain ? pwalletMain->setKeyPool.size() : 0);
-    LogPrintf("mapWallet.size() = %u\n",       pwalletMain ? pwalletMain->mapWallet.size() : 0);
-    LogPrintf("mapAddressBook.size() = %u\n",  pwalletMain ? pwalletMain->mapAddressBook.size() : 0);
+    for (CWallet* pwallet : vpwallets) {
+        LogPrintf("%s setKeyPool.size() = %u\n",      pwallet->strWalletFile, pwallet->setKeyPool.size());
+        LogPrintf("%s mapWallet.size() = %u\n",       pwallet->strWalletFile, pwallet->mapWallet.size());
+        LogPrintf("%s mapAddressBook.size() = %u\n",  pwallet->strWalletFile, pwallet->mapAddressBook.size());
+    }
 #endif
 
     if (GetBoolArg("-listenonion", DEFAULT_LISTEN_ONION))
@@ -1864,7 +2340,31 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t nPowTargetSpacing = Params().GetConsensus().nPowTargetSpacing;
     CScheduler::Function f = boost::bind(&PartitionCheck, &IsInitialBlockDownload,
                                          boost::ref(cs_main), boost::cref(pindexBestHeader), nPowTargetSpacing);
-    scheduler.scheduleEvery(f, nPowTargetSpacing);
+    scheduler.scheduleEvery(f, nPowTargetSpacing, "partitioncheck");
+
+    // Snapshots of a chainstate held in memory are written on a thread of their own
+    if (pcoinsmemory)
+        threadGroup.create_thread(boost::bind(&CCoinsViewMemory::ThreadSnapshot, pcoinsmemory));
+
+    // Compact the chainstate a little at a time while it is not being written
+    int64_t nCompactInterval = GetArg("-dbcompactinterval", nDefaultDbCompactInterval);
+    if (nCompactInterval > 0) {
+        size_t nCompactBytes = std::max<int64_t>(1, GetArg("-dbcompactrate", nDefaultDbCompactRate)) << 20;
+        CScheduler::Function compact = boost::bind(&CCoinsViewDB::CompactStep, pcoinsdbview, nCompactBytes, nCompactInterval);
+        scheduler.scheduleEvery(compact, nCompactInterval, "dbcompact");
+    }
+
+    // Refresh the getblocktemplate long polls waiting on a changed mempool
+    if (fServer)
+        scheduler.scheduleEvery(&CheckLongPolls, 10, "longpoll");
+
+#ifdef HAVE_MALLOC_TRIM
+    // Give back the pages freed once messages are processed, which glibc
+    // otherwise keeps for reuse everywhere but the top of each heap
+    int64_t nTrimInterval = GetArg("-malloctrim", DEFAULT_MALLOC_TRIM_INTERVAL);
+    if (nTrimInterval > 0)
+        scheduler.scheduleEvery(&TrimHeap, nTrimInterval, "malloctrim");
+#endif
 
 #ifdef ENABLE_MINING
     // Generate coins in the background
@@ -1874,6 +2374,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
  #else
     GenerateBitcoins(GetBoolArg("-gen", false), GetArg("-genproclimit", 1));
  #endif
+
+    if (GetBoolArg("-stratum", DEFAULT_STRATUM) && !StartStratum())
+        return InitError(_("Unable to start the Stratum server. See debug log for details."));
 #endif
 
     // ********************************************************* Step 11: finished
@@ -1882,12 +2385,16 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     uiInterface.InitMessage(_("Done loading"));
 
 #ifdef ENABLE_WALLET
-    if (pwalletMain) {
-        // Add wallet transactions that aren't already in a block to mapTransactions
-        pwalletMain->ReacceptWalletTransactions();
+    if (!vpwallets.empty()) {
+        std::vector<std::string> vstrFiles;
+        for (CWallet* pwallet : vpwallets) {
+            // Add wallet transactions that aren't already in a block to mapTransactions
+            pwallet->ReacceptWalletTransactions();
+            vstrFiles.push_back(pwallet->strWalletFile);
+        }
 
-        // Run a thread to flush wallet periodically
-        threadGroup.create_thread(boost::bind(&ThreadFlushWalletDB, boost::ref(pwalletMain->strWalletFile)));
+        // Run a thread to flush the wallets periodically
+        threadGroup.create_thread(boost::bind(&ThreadFlushWalletDB, vstrFiles));
     }
 #endif
 
@@ -7,7 +7,9 @@
 #ifndef BITCOIN_INIT_H
 #define BITCOIN_INIT_H
 
+#include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "zcash/JoinSplit.hpp"
 
@@ -20,6 +22,8 @@ class thread_group;
 } // namespace boost
 
 extern CWallet* pwalletMain;
+//! Every wallet loaded, in the order of the -wallet options; the first is pwalletMain
+extern std::vector<CWallet*> vpwallets;
 extern ZCJoinSplit* pzcashParams;
 
 void StartShutdown();
@@ -33,6 +37,11 @@ void InitLogging();
 void InitParameterInteraction();
 bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler);
 
+/** Default for -mallocarenas, 0 to keep glibc's own limit (1 is used on 32-bit systems) */
+static const int DEFAULT_MALLOC_ARENAS = 0;
+/** Default for -malloctrim, the seconds between giving free heap pages back to the OS */
+static const int64_t DEFAULT_MALLOC_TRIM_INTERVAL = 300;
+
 /** The help message mode determines what help message to show */
 enum HelpMessageMode {
     HMM_BITCOIND,
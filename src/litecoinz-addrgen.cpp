@@ -1,52 +1,375 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "chainparamsbase.h"
+#include "clientversion.h"
+#include "key.h"
+#include "key_io.h"
+#include "pubkey.h"
+#include "support/cleanse.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "zcash/zip32.h"
+
+#include <secp256k1.h>
 
+#include <atomic>
+#include <map>
+#include <stdio.h>
+#include <string>
 #include <vector>
 
-#include "config/bitcoin-config.h"
-#include "chainparams.h"
-#include "base58.h"
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+
+static const int CONTINUE_EXECUTION=-1;
 
-int main(int argc, char **argv)
+/** Addresses generated, written out and checkpointed as one unit */
+static const uint64_t ADDRGEN_BLOCK_SIZE = 1000;
+/** Blocks per thread that may be generated ahead of the one being written */
+static const uint64_t ADDRGEN_BLOCKS_AHEAD = 4;
+/** Indexes must stay below this, the first hardened child index */
+static const uint64_t ADDRGEN_MAX_INDEX = 0x80000000;
+
+enum AddrGenType {
+    ADDRGEN_TRANSPARENT,
+    ADDRGEN_SAPLING,
+};
+
+struct AddrGenParams {
+    AddrGenType type;
+    bool fSequential;
+    bool fPrivKeys;
+    //! m/44'/coin_type'/0'/0, the parent of the transparent keys
+    CExtKey extChain;
+    //! m/32'/coin_type', the parent of the Sapling account keys
+    libzcash::SaplingExtendedSpendingKey xskCoin;
+    //! Generator point, added to step from one sequential key to the next
+    secp256k1_pubkey pointG;
+};
+
+//! Context for the generator point and the point arithmetic of sequential keys
+static secp256k1_context* secp256k1_context_addrgen = NULL;
+
+static void AppendLine(std::string& strOut, uint64_t nIndex, const std::string& strAddress, const std::string& strKey)
 {
-	if(argc != 2) {
-		fprintf(stderr, "need seed as an argument\n");
-		return 1;
-	}
-	if(strlen(argv[1]) == 64) {
-		fprintf(stderr, "WARNING: seed should be 63, not 64 characters. Ignoring the first.\n");
-		argv[1]++;
-	}
-	if(strlen(argv[1]) != 63) {
-		fprintf(stderr, "seed must be exactly 63 characters\n");
-		return 1;
-	}
-
-	std::vector<unsigned char> vec;
-	char digit[3];
-	digit[2] = '\x0';
-	for(int i=0; i<32; i++) {
-		if(i == 0) {
-			digit[0] = argv[1][0];
-			digit[1] = '\x0';
-		} else {
-			digit[0] = argv[1][i*2-1];
-			digit[1] = argv[1][i*2];
-		}
-		long int n = strtol(digit, NULL, 16);
-		unsigned char chr = n;
-		vec.push_back(chr);
-	}
-	uint256 uv(vec);
-	uint252 uv2(uv);
-
-	SelectParams(CBaseChainParams::MAIN);
-	libzcash::SpendingKey k(uv2);
-	CZCSpendingKey ck(k);
-	printf("sk: %s\n", ck.ToString().c_str());
-	CZCPaymentAddress pa = k.address();
-	printf("pa: %s\n", pa.ToString().c_str());
-
-	return 0;
+    strOut += strprintf("%d %s", nIndex, strAddress);
+    if (!strKey.empty())
+        strOut += " " + strKey;
+    strOut += "\n";
+}
+
+/**
+ * Keys are the chain key plus the index, so from the second one on the
+ * public key is the previous one plus G: a point addition instead of a
+ * multiplication.
+ */
+static void GenerateSequential(const AddrGenParams& params, uint64_t nBegin, uint64_t nEnd, std::string& strOut)
+{
+    unsigned char tweak[32] = {};
+    for (int i = 0; i < 8; i++)
+        tweak[31 - i] = (nBegin >> (8 * i)) & 0xff;
+    unsigned char secret[32];
+    memcpy(secret, params.extChain.key.begin(), 32);
+    if (!secp256k1_ec_privkey_tweak_add(secp256k1_context_addrgen, secret, tweak))
+        throw std::runtime_error("invalid sequential key");
+
+    CKey key;
+    key.Set(secret, secret + 32, true);
+    CPubKey pubkey = key.GetPubKey();
+    secp256k1_pubkey point;
+    if (!secp256k1_ec_pubkey_parse(secp256k1_context_addrgen, &point, pubkey.begin(), pubkey.size()))
+        throw std::runtime_error("invalid sequential public key");
+
+    static const unsigned char one[32] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                          0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+    for (uint64_t nIndex = nBegin; nIndex < nEnd; nIndex++) {
+        if (nIndex > nBegin) {
+            const secp256k1_pubkey* points[2] = {&point, &params.pointG};
+            secp256k1_pubkey next;
+            if (!secp256k1_ec_pubkey_combine(secp256k1_context_addrgen, &next, points, 2) ||
+                !secp256k1_ec_privkey_tweak_add(secp256k1_context_addrgen, secret, one))
+                throw std::runtime_error("invalid sequential key");
+            point = next;
+        }
+        unsigned char pub[CPubKey::COMPRESSED_PUBLIC_KEY_SIZE];
+        size_t publen = sizeof(pub);
+        secp256k1_ec_pubkey_serialize(secp256k1_context_addrgen, pub, &publen, &point, SECP256K1_EC_COMPRESSED);
+        pubkey.Set(pub, pub + publen);
+
+        std::string strKey;
+        if (params.fPrivKeys) {
+            key.Set(secret, secret + 32, true);
+            strKey = EncodeSecret(key);
+        }
+        AppendLine(strOut, nIndex, EncodeDestination(pubkey.GetID()), strKey);
+    }
+    memory_cleanse(secret, sizeof(secret));
+}
+
+static std::string GenerateBlock(const AddrGenParams& params, uint64_t nBegin, uint64_t nEnd)
+{
+    std::string strOut;
+    if (params.type == ADDRGEN_TRANSPARENT && params.fSequential) {
+        GenerateSequential(params, nBegin, nEnd, strOut);
+        return strOut;
+    }
+
+    for (uint64_t nIndex = nBegin; nIndex < nEnd; nIndex++) {
+        if (params.type == ADDRGEN_TRANSPARENT) {
+            CExtKey child;
+            // BIP32 skips the rare index whose key is invalid
+            if (!params.extChain.Derive(child, nIndex))
+                continue;
+            AppendLine(strOut, nIndex, EncodeDestination(child.key.GetPubKey().GetID()),
+                       params.fPrivKeys ? EncodeSecret(child.key) : "");
+        } else {
+            // The path the wallet uses, m/32'/coin_type'/account', with each account's default address
+            libzcash::SaplingExtendedSpendingKey xsk = params.xskCoin.Derive(nIndex | ZIP32_HARDENED_KEY_LIMIT);
+            AppendLine(strOut, nIndex, EncodePaymentAddress(xsk.DefaultAddress()),
+                       params.fPrivKeys ? EncodeSpendingKey(xsk) : "");
+        }
+    }
+    return strOut;
+}
+
+static void WriteCheckpoint(const boost::filesystem::path& pathCheckpoint, uint64_t nNext, long nOffset)
+{
+    boost::filesystem::path pathTmp = pathCheckpoint;
+    pathTmp += ".new";
+    FILE* file = fopen(pathTmp.string().c_str(), "w");
+    if (!file)
+        throw std::runtime_error("cannot write " + pathTmp.string());
+    fprintf(file, "%llu %ld\n", (unsigned long long)nNext, nOffset);
+    FileCommit(file);
+    fclose(file);
+    if (!RenameOver(pathTmp, pathCheckpoint))
+        throw std::runtime_error("cannot replace " + pathCheckpoint.string());
+}
+
+static int AppInitAddrGen(int argc, char* argv[])
+{
+    ParseParameters(argc, argv);
+
+    // Check for -testnet or -regtest parameter (Params() calls are only valid after this clause)
+    try {
+        SelectParams(ChainNameFromCommandLine());
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    if (argc < 2 || mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help")) {
+        std::string strUsage = _("LitecoinZ litecoinz-addrgen utility version") + " " + FormatFullVersion() + "\n\n" +
+            _("Usage:") + "\n" +
+              "  litecoinz-addrgen [options] -seed=<hex>  " + _("Derive addresses from an HD seed, offline") + "\n" +
+              "\n";
+
+        strUsage += HelpMessageGroup(_("Options:"));
+        strUsage += HelpMessageOpt("-?", _("This help message"));
+        strUsage += HelpMessageOpt("-seed=<hex>", _("HD seed of 32 to 64 bytes to derive the keys from"));
+        strUsage += HelpMessageOpt("-type=<type>", _("Address type, transparent (m/44'/coin_type'/0'/0/index) or sapling (m/32'/coin_type'/index') (default: transparent)"));
+        strUsage += HelpMessageOpt("-start=<n>", _("First index to derive (default: 0)"));
+        strUsage += HelpMessageOpt("-count=<n>", _("Number of indexes to derive (default: 1)"));
+        strUsage += HelpMessageOpt("-threads=<n>", _("Threads to derive keys on (default: number of cores)"));
+        strUsage += HelpMessageOpt("-privkeys", _("Write each address's private key after it"));
+        strUsage += HelpMessageOpt("-sequential", _("Transparent keys are the chain key plus the index rather than BIP32 children. Faster, but one leaked private key gives away all the others"));
+        strUsage += HelpMessageOpt("-out=<file>", _("Write to file, and the index reached to file.checkpoint, instead of to standard output"));
+        strUsage += HelpMessageOpt("-resume", _("Continue an interrupted -out run from its checkpoint"));
+        AppendParamsHelpMessages(strUsage);
+
+        fprintf(stdout, "%s", strUsage.c_str());
+        if (argc < 2) {
+            fprintf(stderr, "Error: too few parameters\n");
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+    return CONTINUE_EXECUTION;
+}
+
+static int CommandLineAddrGen()
+{
+    std::vector<unsigned char> vchSeed = ParseHex(GetArg("-seed", ""));
+    if (vchSeed.size() < 32 || vchSeed.size() > 64)
+        throw std::runtime_error("-seed must be 32 to 64 bytes of hex");
+
+    AddrGenParams params;
+    std::string strType = GetArg("-type", "transparent");
+    if (strType == "transparent")
+        params.type = ADDRGEN_TRANSPARENT;
+    else if (strType == "sapling")
+        params.type = ADDRGEN_SAPLING;
+    else
+        throw std::runtime_error("unknown -type " + strType);
+    params.fSequential = GetBoolArg("-sequential", false);
+    if (params.fSequential && params.type != ADDRGEN_TRANSPARENT)
+        throw std::runtime_error("-sequential is only for transparent addresses");
+    params.fPrivKeys = GetBoolArg("-privkeys", false);
+
+    uint32_t nCoinType = Params().BIP44CoinType();
+    if (params.type == ADDRGEN_TRANSPARENT) {
+        CExtKey extMaster, extPurpose, extCoin, extAccount;
+        extMaster.SetMaster(vchSeed.data(), vchSeed.size());
+        if (!extMaster.Derive(extPurpose, 44 | ADDRGEN_MAX_INDEX) ||
+            !extPurpose.Derive(extCoin, nCoinType | ADDRGEN_MAX_INDEX) ||
+            !extCoin.Derive(extAccount, 0 | ADDRGEN_MAX_INDEX) ||
+            !extAccount.Derive(params.extChain, 0))
+            throw std::runtime_error("cannot derive the chain key from this seed");
+    } else {
+        RawHDSeed rawSeed(vchSeed.begin(), vchSeed.end());
+        HDSeed seed(rawSeed);
+        libzcash::SaplingExtendedSpendingKey m = libzcash::SaplingExtendedSpendingKey::Master(seed);
+        params.xskCoin = m.Derive(32 | ZIP32_HARDENED_KEY_LIMIT).Derive(nCoinType | ZIP32_HARDENED_KEY_LIMIT);
+    }
+    memory_cleanse(vchSeed.data(), vchSeed.size());
+
+    static const unsigned char one[32] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                          0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+    if (!secp256k1_ec_pubkey_create(secp256k1_context_addrgen, &params.pointG, one))
+        throw std::runtime_error("cannot compute the generator point");
+
+    int64_t nStartArg = GetArg("-start", 0);
+    int64_t nCountArg = GetArg("-count", 1);
+    if (nStartArg < 0 || nCountArg < 0 || (uint64_t)(nStartArg + nCountArg) > ADDRGEN_MAX_INDEX)
+        throw std::runtime_error(strprintf("indexes must be from 0 to %d", ADDRGEN_MAX_INDEX - 1));
+    uint64_t nStart = nStartArg;
+    uint64_t nEnd = nStart + nCountArg;
+
+    // The output, and where the checkpoint says to continue it
+    FILE* fileOut = stdout;
+    boost::filesystem::path pathOut, pathCheckpoint;
+    bool fCheckpoint = mapArgs.count("-out");
+    if (fCheckpoint) {
+        pathOut = GetArg("-out", "");
+        pathCheckpoint = pathOut;
+        pathCheckpoint += ".checkpoint";
+        if (GetBoolArg("-resume", false)) {
+            FILE* file = fopen(pathCheckpoint.string().c_str(), "r");
+            unsigned long long nNext = 0, nOffset = 0;
+            if (!file || fscanf(file, "%llu %llu", &nNext, &nOffset) != 2)
+                throw std::runtime_error("cannot read " + pathCheckpoint.string());
+            fclose(file);
+            if (nNext < nStart || nNext > nEnd)
+                throw std::runtime_error("checkpoint is outside -start and -count");
+            // Drop whatever was written after the checkpoint
+            boost::filesystem::resize_file(pathOut, nOffset);
+            nStart = nNext;
+        } else if (boost::filesystem::exists(pathOut)) {
+            throw std::runtime_error(pathOut.string() + " exists; use -resume to continue it");
+        }
+        fileOut = fopen(pathOut.string().c_str(), "ab");
+        if (!fileOut)
+            throw std::runtime_error("cannot open " + pathOut.string());
+    }
+
+    // Workers take blocks in order and hand them to this thread, which
+    // writes and checkpoints them in order
+    uint64_t nBlocks = (nEnd - nStart + ADDRGEN_BLOCK_SIZE - 1) / ADDRGEN_BLOCK_SIZE;
+    int nThreads = std::max<int64_t>(GetArg("-threads", GetNumCores()), 1);
+    uint64_t nAhead = nThreads * ADDRGEN_BLOCKS_AHEAD;
+    std::atomic<uint64_t> nNextBlock(0);
+    boost::mutex cs_blocks;
+    boost::condition_variable condBlocks;
+    std::map<uint64_t, std::string> mapBlocks;
+    uint64_t nWritten = 0;
+    std::string strError;
+
+    auto generate = [&]() {
+        for (uint64_t nBlock = nNextBlock++; nBlock < nBlocks; nBlock = nNextBlock++) {
+            {
+                boost::unique_lock<boost::mutex> lock(cs_blocks);
+                while (nBlock >= nWritten + nAhead)
+                    condBlocks.wait(lock);
+            }
+            uint64_t nBegin = nStart + nBlock * ADDRGEN_BLOCK_SIZE;
+            std::string strBlock;
+            std::string strBlockError;
+            try {
+                strBlock = GenerateBlock(params, nBegin, std::min(nBegin + ADDRGEN_BLOCK_SIZE, nEnd));
+            } catch (const std::exception& e) {
+                strBlockError = e.what();
+            }
+            boost::unique_lock<boost::mutex> lock(cs_blocks);
+            if (!strBlockError.empty() && strError.empty())
+                strError = strBlockError;
+            mapBlocks[nBlock].swap(strBlock);
+            condBlocks.notify_all();
+        }
+    };
+
+    boost::thread_group workers;
+    for (int i = 0; i < nThreads; i++)
+        workers.create_thread(generate);
+
+    for (uint64_t nBlock = 0; nBlock < nBlocks; nBlock++) {
+        std::string strBlock;
+        {
+            boost::unique_lock<boost::mutex> lock(cs_blocks);
+            while (!mapBlocks.count(nBlock))
+                condBlocks.wait(lock);
+            if (!strError.empty())
+                break;
+            strBlock.swap(mapBlocks[nBlock]);
+            mapBlocks.erase(nBlock);
+            nWritten = nBlock + 1;
+            condBlocks.notify_all();
+        }
+        try {
+            if (fwrite(strBlock.data(), 1, strBlock.size(), fileOut) != strBlock.size())
+                throw std::runtime_error("error writing output");
+            if (fCheckpoint) {
+                // The checkpoint only ever names output that is on disk
+                FileCommit(fileOut);
+                WriteCheckpoint(pathCheckpoint, std::min(nStart + nWritten * ADDRGEN_BLOCK_SIZE, nEnd), ftell(fileOut));
+            }
+        } catch (const std::exception& e) {
+            boost::unique_lock<boost::mutex> lock(cs_blocks);
+            strError = e.what();
+            break;
+        }
+    }
+
+    {
+        // Let workers waiting for room finish after an error
+        boost::unique_lock<boost::mutex> lock(cs_blocks);
+        nWritten = nBlocks;
+        nNextBlock = nBlocks;
+        condBlocks.notify_all();
+    }
+    workers.join_all();
+    fflush(fileOut);
+    if (fileOut != stdout)
+        fclose(fileOut);
+    if (!strError.empty())
+        throw std::runtime_error(strError);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+    SetupEnvironment();
+
+    try {
+        int ret = AppInitAddrGen(argc, argv);
+        if (ret != CONTINUE_EXECUTION)
+            return ret;
+    } catch (const std::exception& e) {
+        PrintExceptionContinue(&e, "AppInitAddrGen()");
+        return EXIT_FAILURE;
+    }
+
+    ECC_Start();
+    secp256k1_context_addrgen = secp256k1_context_create(SECP256K1_CONTEXT_SIGN);
+    int ret = EXIT_FAILURE;
+    try {
+        ret = CommandLineAddrGen();
+    } catch (const std::exception& e) {
+        fprintf(stderr, "error: %s\n", e.what());
+    }
+    secp256k1_context_destroy(secp256k1_context_addrgen);
+    ECC_Stop();
+    return ret;
 }
@@ -8,22 +8,39 @@
 
 #include "sodium.h"
 
+#include "addressindex.h"
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockarchive.h"
+#include "blockencodings.h"
+#include "blockfilemap.h"
+#include "blockvolumes.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinstatsindex.h"
 #include "consensus/params.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
+#include "core_memusage.h"
+#include "corebudget.h"
+#include "crypto/common.h"
 #include "deprecation.h"
 #include "init.h"
+#include "memusage.h"
 #include "merkleblock.h"
 #include "metrics.h"
 #include "net.h"
 #include "pow.h"
+#include "prevector.h"
+#include "proofcache.h"
+#include "responsecache.h"
+#include "shieldedindex.h"
+#include "trace.h"
+#include "txarrivallog.h"
 #include "txdb.h"
+#include "txindexcache.h"
 #include "txmempool.h"
 #include "ui_interface.h"
 #include "undo.h"
@@ -36,7 +53,9 @@
 
 #include <algorithm>
 #include <atomic>
+#include <deque>
 #include <sstream>
+#include <unordered_set>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
@@ -70,14 +89,24 @@ bool fExperimentalMode = false;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
+bool fShieldedIndex = false;
+bool fAddressIndex = false;
+bool fSpentIndex = false;
+bool fTimestampIndex = false;
+bool fCoinStatsIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = true;
+uint256 hashAssumeValid;
+bool fHeaderCommitment = DEFAULT_HEADER_COMMITMENT;
 bool fCoinbaseEnforcedProtectionEnabled = true;
 size_t nCoinCacheUsage = 5000 * 300;
+size_t nAnchorCacheUsage = 5000 * 300 / 16;
+size_t nNullifierCacheUsage = 5000 * 300 / 8;
 uint64_t nPruneTarget = 0;
+int64_t nBlockFileSyncInterval = DEFAULT_BLOCKFILE_SYNC_INTERVAL;
 bool fAlerts = DEFAULT_ALERTS;
 /* If the tip is older than this (in seconds), the node is considered to be in initial block download.
  */
@@ -91,12 +120,33 @@ CFeeRate minRelayTxFee = CFeeRate(DEFAULT_MIN_RELAY_TX_FEE);
 CTxMemPool mempool(::minRelayTxFee);
 
 struct COrphanTx {
-    CTransaction tx;
+    CTransactionRef tx;
     NodeId fromPeer;
+    int64_t nTimeExpire;
+    unsigned int nSize;
+    size_t nPeerPos; //! Position in the vOrphans of fromPeer
 };
-map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);;
-map<uint256, set<uint256> > mapOrphanTransactionsByPrev GUARDED_BY(cs_main);;
-void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+typedef boost::unordered_map<uint256, COrphanTx, CCoinsKeyHasher> OrphanMap;
+struct IteratorComparator
+{
+    template<typename I>
+    bool operator()(const I& a, const I& b) const
+    {
+        return &(*a) < &(*b);
+    }
+};
+/** Orphans of one peer, for accounting and for evicting from the peer that holds the most */
+struct COrphanPeer {
+    std::vector<OrphanMap::iterator> vOrphans;
+    size_t nBytes;
+    COrphanPeer() : nBytes(0) {}
+};
+CCriticalSection cs_orphans;
+OrphanMap mapOrphanTransactions GUARDED_BY(cs_orphans);
+boost::unordered_map<COutPoint, std::set<OrphanMap::iterator, IteratorComparator>, SaltedOutpointHasher> mapOrphanTransactionsByPrev GUARDED_BY(cs_orphans);
+std::map<NodeId, COrphanPeer> mapOrphanPeers GUARDED_BY(cs_orphans);
+size_t nOrphanBytes GUARDED_BY(cs_orphans) = 0;
+void EraseOrphansFor(NodeId peer) LOCKS_EXCLUDED(cs_orphans);
 
 /**
  * Returns true if there are nRequired or more blocks of minVersion or above
@@ -113,6 +163,58 @@ const string strMessageMagic = "LitecoinZ Signed Message:\n";
 // Internal stuff
 namespace {
 
+    /**
+     * Block index entries are allocated in chunks rather than one by one,
+     * so that entries created together (as headers are during a sync) sit
+     * next to each other for pprev and pskip walks, and so that the whole
+     * index is freed with a few deallocations. Entries given back are
+     * reused before the arena grows.
+     */
+    class CBlockIndexArena
+    {
+    private:
+        std::vector<std::unique_ptr<CBlockIndex[]> > vChunks;
+        size_t nUsedInLastChunk;
+        std::vector<CBlockIndex*> vFree;
+
+    public:
+        CBlockIndexArena() : nUsedInLastChunk(BLOCK_INDEX_ARENA_CHUNK_SIZE) {}
+
+        CBlockIndex* Allocate()
+        {
+            if (!vFree.empty()) {
+                CBlockIndex* pindex = vFree.back();
+                vFree.pop_back();
+                return pindex;
+            }
+            if (nUsedInLastChunk == BLOCK_INDEX_ARENA_CHUNK_SIZE) {
+                vChunks.emplace_back(new CBlockIndex[BLOCK_INDEX_ARENA_CHUNK_SIZE]);
+                nUsedInLastChunk = 0;
+            }
+            return &vChunks.back()[nUsedInLastChunk++];
+        }
+
+        void Free(CBlockIndex* pindex)
+        {
+            *pindex = CBlockIndex();
+            vFree.push_back(pindex);
+        }
+
+        void Clear()
+        {
+            vChunks.clear();
+            vFree.clear();
+            nUsedInLastChunk = BLOCK_INDEX_ARENA_CHUNK_SIZE;
+        }
+
+        size_t DynamicMemoryUsage() const
+        {
+            return memusage::MallocUsage(sizeof(CBlockIndex) * BLOCK_INDEX_ARENA_CHUNK_SIZE) * vChunks.size() +
+                   memusage::DynamicUsage(vChunks) + memusage::DynamicUsage(vFree);
+        }
+    };
+    CBlockIndexArena blockIndexArena;
+
     struct CBlockIndexWorkComparator
     {
         bool operator()(CBlockIndex *pa, CBlockIndex *pb) const {
@@ -157,6 +259,244 @@ namespace {
      *  or if we allocate more file space when we're in prune mode
      */
     bool fCheckForPruning = false;
+    /** Height up to which pruneblockchain asked for block files to be pruned, or 0 */
+    int nManualPruneHeight = 0;
+    /** Files below this one have all been pruned, so FindFilesToPrune starts here */
+    int nFirstUnprunedFile = 0;
+    /**
+     * The block index entries with data in each block file, so that pruning a
+     * file doesn't walk mapBlockIndex. Lists can hold stale entries, of blocks
+     * already pruned or of entries erased since; users check nFile and
+     * BLOCK_HAVE_DATA. Requires cs_LastBlockFile.
+     */
+    std::vector<std::vector<CBlockIndex*> > vBlocksByFile;
+
+    void AddToBlockFileList(CBlockIndex* pindex)
+    {
+        if (vBlocksByFile.size() <= (size_t)pindex->nFile)
+            vBlocksByFile.resize(pindex->nFile + 1);
+        vBlocksByFile[pindex->nFile].push_back(pindex);
+    }
+
+    /**
+     * The blk or rev file being appended to, kept open between writes so
+     * that storing a block doesn't cost an open, a seek and a close. Records
+     * are serialized in memory and handed to the OS in a single write, then
+     * flushed so readers see them; syncing them is left to FlushBlockFile.
+     * Requires cs_LastBlockFile.
+     */
+    class CBlockFileWriter
+    {
+    private:
+        FILE* (*openFile)(const CDiskBlockPos&, bool);
+        int nFile;
+        FILE* file;
+
+    public:
+        CBlockFileWriter(FILE* (*openFileIn)(const CDiskBlockPos&, bool)) : openFile(openFileIn), nFile(-1), file(NULL) {}
+        ~CBlockFileWriter() { Close(); }
+
+        int GetFile() const { return file ? nFile : -1; }
+
+        /** The handle of file nFileIn, opening it if another one is open */
+        FILE* Open(int nFileIn)
+        {
+            if (file && nFile == nFileIn)
+                return file;
+            Close();
+            file = openFile(CDiskBlockPos(nFileIn, 0), false);
+            if (file)
+                nFile = nFileIn;
+            return file;
+        }
+
+        /** Write the record in ss at pos, moving pos past its first nHeaderSize bytes */
+        bool Append(CDiskBlockPos& pos, const CDataStream& ss, unsigned int nHeaderSize)
+        {
+            FILE* f = Open(pos.nFile);
+            if (!f)
+                return false;
+            // Allocating the file may have moved the position on platforms
+            // without fallocate
+            if (ftell(f) != (long)pos.nPos && fseek(f, pos.nPos, SEEK_SET) != 0)
+                return false;
+            if (fwrite(&ss[0], 1, ss.size(), f) != ss.size() || fflush(f) != 0) {
+                Close();
+                return false;
+            }
+            pos.nPos += nHeaderSize;
+            return true;
+        }
+
+        /** Make what was written to file nFileIn durable, if it is the open one */
+        void Commit(int nFileIn)
+        {
+            if (file && nFile == nFileIn)
+                FileCommit(file);
+        }
+
+        void Close()
+        {
+            if (file)
+                fclose(file);
+            file = NULL;
+            nFile = -1;
+        }
+    };
+
+    CBlockFileWriter blockFileWriter(OpenBlockFile);
+    CBlockFileWriter undoFileWriter(OpenUndoFile);
+
+    /** Bytes of a block file read at once by a -txindex lookup that follows the one before it */
+    static const unsigned int TXINDEX_READAHEAD_SIZE = 256 * 1024;
+
+    /**
+     * Reads transactions found through -txindex from the block files. A
+     * lookup that starts shortly after the one before it in the same file,
+     * or that the caller knows is followed by more, reads ahead a window of
+     * the file; the lookups that fall in the window are served from it.
+     * The header of the last block read is kept too, so that walking the
+     * transactions of a block costs one read rather than three per
+     * transaction. Requires cs_main.
+     */
+    class CTxIndexReader
+    {
+    private:
+        //! Bytes of file nWindowFile from nWindowPos on
+        int nWindowFile;
+        unsigned int nWindowPos;
+        std::vector<unsigned char> vWindow;
+        //! Where the last transaction read ended
+        int nLastFile;
+        unsigned int nLastEnd;
+        //! The block whose header was read last
+        CDiskBlockPos posHeader;
+        unsigned int nHeaderSize;
+        uint256 hashHeader;
+
+        bool InWindow(int nFile, unsigned int nPos) const
+        {
+            return nFile == nWindowFile && nPos >= nWindowPos && nPos - nWindowPos < vWindow.size();
+        }
+
+        void FillWindow(int nFile, unsigned int nPos)
+        {
+            // The window already holds the whole block, see ReadHeader()
+            if (blockArchive.IsCompressed(nFile))
+                return;
+            nWindowFile = -1;
+            vWindow.resize(TXINDEX_READAHEAD_SIZE);
+            CAutoFile file(OpenBlockFile(CDiskBlockPos(nFile, nPos), true), SER_DISK, CLIENT_VERSION);
+            if (file.IsNull()) {
+                vWindow.clear();
+                return;
+            }
+            vWindow.resize(fread(vWindow.data(), 1, vWindow.size(), file.Get()));
+            nWindowFile = nFile;
+            nWindowPos = nPos;
+        }
+
+        bool ReadHeader(const CDiskBlockPos& pos)
+        {
+            if (pos == posHeader)
+                return true;
+            CBlockHeader header;
+            if (blockArchive.IsCompressed(pos.nFile)) {
+                // Compressed files are decompressed a block at a time, and
+                // the block read serves its transactions as the window.
+                CBlockFileRegion region;
+                if (!ReadRawBlockFromDisk(region, pos))
+                    return false;
+                nWindowFile = -1;
+                vWindow.assign(region.begin(), region.end());
+                try {
+                    CSpanReader ss(vWindow.data(), vWindow.data() + vWindow.size(), SER_DISK, CLIENT_VERSION);
+                    ss >> header;
+                } catch (const std::exception& e) {
+                    return error("%s: Deserialize error - %s", __func__, e.what());
+                }
+                nWindowFile = pos.nFile;
+                nWindowPos = pos.nPos;
+            } else {
+                CAutoFile file(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+                if (file.IsNull())
+                    return error("%s: OpenBlockFile failed", __func__);
+                try {
+                    file >> header;
+                } catch (const std::exception& e) {
+                    return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+                }
+            }
+            posHeader = pos;
+            nHeaderSize = ::GetSerializeSize(header, SER_DISK, CLIENT_VERSION);
+            hashHeader = header.GetHash();
+            return true;
+        }
+
+    public:
+        CTxIndexReader() : nWindowFile(-1), nWindowPos(0), nLastFile(-1), nLastEnd(0), nHeaderSize(0) {}
+
+        bool Read(const uint256& hash, const CDiskTxPos& pos, CTransaction& tx, uint256& hashBlock, bool fReadAhead)
+        {
+            if (!ReadHeader(pos))
+                return false;
+            unsigned int nTxPos = pos.nPos + nHeaderSize + pos.nTxOffset;
+            if (!InWindow(pos.nFile, nTxPos) &&
+                (fReadAhead || (pos.nFile == nLastFile && nTxPos >= nLastEnd && nTxPos - nLastEnd < TXINDEX_READAHEAD_SIZE)))
+                FillWindow(pos.nFile, nTxPos);
+            nLastFile = pos.nFile;
+
+            if (InWindow(pos.nFile, nTxPos)) {
+                // The window may also end mid-transaction, or hold space that
+                // was still preallocated when it was read; both fall back to
+                // reading the transaction on its own.
+                try {
+                    CSpanReader ss(vWindow.data() + (nTxPos - nWindowPos), vWindow.data() + vWindow.size(), SER_DISK, CLIENT_VERSION);
+                    ss >> tx;
+                    if (tx.GetHash() == hash) {
+                        hashBlock = hashHeader;
+                        nLastEnd = nTxPos + ss.consumed();
+                        return true;
+                    }
+                } catch (const std::exception&) {
+                }
+            }
+
+            CAutoFile file(OpenBlockFile(CDiskBlockPos(pos.nFile, nTxPos), true), SER_DISK, CLIENT_VERSION);
+            if (file.IsNull())
+                return error("%s: OpenBlockFile failed", __func__);
+            try {
+                file >> tx;
+            } catch (const std::exception& e) {
+                return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+            }
+            if (tx.GetHash() != hash)
+                return error("%s: txid mismatch", __func__);
+            hashBlock = hashHeader;
+            nLastEnd = nTxPos + ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+            return true;
+        }
+
+        //! Forget what was read from file nFile, before it is removed
+        void Invalidate(int nFile)
+        {
+            if (nWindowFile == nFile) {
+                nWindowFile = -1;
+                vWindow.clear();
+            }
+            if (posHeader.nFile == nFile)
+                posHeader.SetNull();
+            if (nLastFile == nFile)
+                nLastFile = -1;
+        }
+    };
+
+    CTxIndexReader txIndexReader;
+
+    /** Block files whose blk and rev files are waiting to be removed by ThreadPruneUnlink */
+    boost::mutex csPruneUnlink;
+    boost::condition_variable condPruneUnlink;
+    std::deque<int> queuePruneUnlink;
 
     /**
      * Every received block is assigned a unique and increasing identifier, so we
@@ -201,9 +541,31 @@ namespace {
         uint256 hash;
         CBlockIndex *pindex;  //! Optional.
         bool fValidatedHeaders;  //! Whether this block has validated headers at the time of request.
+        int64_t nTimeRequested;  //! When the block was asked for (in microseconds).
+        //! The block as far as it has been rebuilt from a cmpctblock, if it was asked for in one
+        std::shared_ptr<PartiallyDownloadedBlock> partialBlock;
     };
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
+    /** The last tip sent whole, as a message all the peers asking for it share. Requires cs_main. */
+    std::pair<uint256, CMessageBuffer> mostRecentBlockMessage;
+
+    /** A block asked for filtered, and the bloom elements of its transactions */
+    struct CFilteredBlockSource {
+        CBlock block;
+        std::vector<CBloomTxElements> vElements;
+    };
+    /**
+     * The blocks most recently asked for filtered, newest first, so that
+     * light clients syncing the same blocks share one read and one parse of
+     * each. Requires cs_main.
+     */
+    std::list<std::pair<uint256, std::shared_ptr<const CFilteredBlockSource> > > lFilteredBlockSources;
+    static const size_t MAX_FILTERED_BLOCK_SOURCES = 16;
+
+    /** Peers that were asked to announce new blocks with a cmpctblock, oldest first. Requires cs_main. */
+    std::list<NodeId> lNodesAnnouncingHeaderAndIDs;
+
     /** Number of preferable block download peers. */
     int nPreferredDownload = 0;
 
@@ -215,13 +577,77 @@ namespace {
 
     /** Number of peers from which we're downloading blocks. */
     int nPeersWithValidatedDownloads = 0;
+
+    /** Number of headers held back in CNodeState::vPendingHeaders, of all peers. Requires cs_main. */
+    size_t nPendingHeaders = 0;
+
+    /**
+     * Equihash solutions for CBlockIndex::GetBlockHeader. Those of entries
+     * not written to the block tree database yet are kept until they are;
+     * of the rest, the ones read back most recently are cached.
+     */
+    CCriticalSection cs_blockSolutions;
+    map<uint256, std::vector<unsigned char> > mapUnwrittenSolutions;
+    typedef list<pair<uint256, std::vector<unsigned char> > > BlockSolutionList;
+    BlockSolutionList listCachedSolutions;
+    map<uint256, BlockSolutionList::iterator> mapCachedSolutions;
 } // anon namespace
 
+/** Make a solution the most recently used in the cache. Requires cs_blockSolutions. */
+static void CacheBlockSolution(const uint256& hash, const std::vector<unsigned char>& nSolution)
+{
+    map<uint256, BlockSolutionList::iterator>::iterator it = mapCachedSolutions.find(hash);
+    if (it != mapCachedSolutions.end()) {
+        listCachedSolutions.splice(listCachedSolutions.begin(), listCachedSolutions, it->second);
+        return;
+    }
+    listCachedSolutions.push_front(make_pair(hash, nSolution));
+    mapCachedSolutions[hash] = listCachedSolutions.begin();
+    if (listCachedSolutions.size() > BLOCK_SOLUTION_CACHE_SIZE) {
+        mapCachedSolutions.erase(listCachedSolutions.back().first);
+        listCachedSolutions.pop_back();
+    }
+}
+
+bool ReadBlockIndexSolution(const CBlockIndex* pindex, std::vector<unsigned char>& nSolution)
+{
+    const uint256 hash = pindex->GetBlockHash();
+    {
+        LOCK(cs_blockSolutions);
+        map<uint256, std::vector<unsigned char> >::const_iterator unwritten = mapUnwrittenSolutions.find(hash);
+        if (unwritten != mapUnwrittenSolutions.end()) {
+            nSolution = unwritten->second;
+            return true;
+        }
+        map<uint256, BlockSolutionList::iterator>::iterator cached = mapCachedSolutions.find(hash);
+        if (cached != mapCachedSolutions.end()) {
+            nSolution = cached->second->second;
+            listCachedSolutions.splice(listCachedSolutions.begin(), listCachedSolutions, cached->second);
+            return true;
+        }
+    }
+
+    if (!pblocktree || !pblocktree->ReadBlockSolution(hash, nSolution)) {
+        // The block file has it too, if we have the block
+        CBlock block;
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA) || !ReadBlockFromDisk(block, pindex))
+            return false;
+        LogPrintf("%s: Equihash solution of block %s read from its block file\n", __func__, hash.ToString());
+        nSolution = block.nSolution;
+    }
+    LOCK(cs_blockSolutions);
+    CacheBlockSolution(hash, nSolution);
+    return true;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Registration of network node signals.
 //
 
+// Defined with the transaction precheck queue
+static void FinalizeTxPrecheck(NodeId nodeid);
+
 namespace {
 
 struct CBlockReject {
@@ -266,6 +692,20 @@ struct CNodeState {
     int nBlocksInFlightValidHeaders;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! How many blocks may be in flight from this peer, sized from the measurements below.
+    int nBlockWindow;
+    //! Moving average of the time from asking for a block to receiving it (in microseconds), or 0.
+    int64_t nBlockLatencyAvg;
+    //! Moving average of the rate at which this peer delivers blocks it was asked for, or 0.
+    double dBlocksPerSecond;
+    //! When the last block asked of this peer arrived (in microseconds), or 0.
+    int64_t nLastBlockReceived;
+    //! Whether this peer can be asked for blocks with MSG_CMPCT_BLOCK.
+    bool fProvidesCompactBlocks;
+    //! Whether this peer wants new blocks announced with a cmpctblock instead of an inv.
+    bool fPreferHighBandwidth;
+    //! Headers below the header commitment that don't link to a committed hash yet, kept out of mapBlockIndex.
+    std::vector<CBlockHeader> vPendingHeaders;
 
     CNodeState() {
         fCurrentlyConnected = false;
@@ -280,6 +720,12 @@ struct CNodeState {
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
         fPreferredDownload = false;
+        nBlockWindow = DEFAULT_BLOCKS_IN_TRANSIT_PER_PEER;
+        nBlockLatencyAvg = 0;
+        dBlocksPerSecond = 0;
+        nLastBlockReceived = 0;
+        fProvidesCompactBlocks = false;
+        fPreferHighBandwidth = false;
     }
 };
 
@@ -296,8 +742,8 @@ CNodeState *State(NodeId pnode) {
 
 int GetHeight()
 {
-    LOCK(cs_main);
-    return chainActive.Height();
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    return tip ? tip->nHeight : -1;
 }
 
 void UpdatePreferredDownload(CNode* node, CNodeState* state)
@@ -318,6 +764,7 @@ void InitializeNode(NodeId nodeid, const CNode *pnode) {
 }
 
 void FinalizeNode(NodeId nodeid) {
+    FinalizeTxPrecheck(nodeid);
     LOCK(cs_main);
     CNodeState *state = State(nodeid);
 
@@ -334,16 +781,38 @@ void FinalizeNode(NodeId nodeid) {
     nPreferredDownload -= state->fPreferredDownload;
     nPeersWithValidatedDownloads -= (state->nBlocksInFlightValidHeaders != 0);
     assert(nPeersWithValidatedDownloads >= 0);
+    lNodesAnnouncingHeaderAndIDs.remove(nodeid);
+    nPendingHeaders -= state->vPendingHeaders.size();
 
     mapNodeState.erase(nodeid);
 }
 
+// Requires cs_main.
+/** Fold the delivery of a block asked of a peer into its measurements, and resize its window to match. */
+void UpdateBlockDownloadStats(CNodeState *state, const QueuedBlock& queued, int64_t nNow) {
+    int64_t nLatency = std::max<int64_t>(nNow - queued.nTimeRequested, 0);
+    state->nBlockLatencyAvg = state->nBlockLatencyAvg == 0 ? nLatency : (state->nBlockLatencyAvg * 7 + nLatency) / 8;
+
+    // Only the time the peer spent on this block counts towards its rate,
+    // not the time it was queued behind the previous one.
+    int64_t nInterval = nNow - std::max(queued.nTimeRequested, state->nLastBlockReceived);
+    state->nLastBlockReceived = nNow;
+    double dRate = 1000000.0 / std::max<int64_t>(nInterval, 1000);
+    state->dBlocksPerSecond = state->dBlocksPerSecond == 0 ? dRate : (state->dBlocksPerSecond * 7 + dRate) / 8;
+
+    int nWindow = state->dBlocksPerSecond * BLOCK_DOWNLOAD_TARGET_TIME;
+    state->nBlockWindow = std::max(MIN_BLOCKS_IN_TRANSIT_PER_PEER, std::min(MAX_BLOCKS_IN_TRANSIT_PER_PEER, nWindow));
+}
+
 // Requires cs_main.
 // Returns a bool indicating whether we requested this block.
-bool MarkBlockAsReceived(const uint256& hash) {
+// nodeidFrom is the peer that delivered it, if it arrived at all.
+bool MarkBlockAsReceived(const uint256& hash, NodeId nodeidFrom = -1) {
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
     if (itInFlight != mapBlocksInFlight.end()) {
         CNodeState *state = State(itInFlight->second.first);
+        if (itInFlight->second.first == nodeidFrom)
+            UpdateBlockDownloadStats(state, *itInFlight->second.second, GetTimeMicros());
         state->nBlocksInFlightValidHeaders -= itInFlight->second.second->fValidatedHeaders;
         if (state->nBlocksInFlightValidHeaders == 0 && itInFlight->second.second->fValidatedHeaders) {
             // Last validated block on the queue was received.
@@ -363,14 +832,15 @@ bool MarkBlockAsReceived(const uint256& hash) {
 }
 
 // Requires cs_main.
-void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL) {
+void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL,
+                         const std::shared_ptr<PartiallyDownloadedBlock>& partialBlock = std::shared_ptr<PartiallyDownloadedBlock>()) {
     CNodeState *state = State(nodeid);
     assert(state != NULL);
 
     // Make sure it's not listed somewhere already.
     MarkBlockAsReceived(hash);
 
-    QueuedBlock newentry = {hash, pindex, pindex != NULL};
+    QueuedBlock newentry = {hash, pindex, pindex != NULL, GetTimeMicros(), partialBlock};
     list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(), newentry);
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += newentry.fValidatedHeaders;
@@ -417,6 +887,45 @@ void UpdateBlockAvailability(NodeId nodeid, const uint256 &hash) {
     }
 }
 
+// Requires cs_main.
+/**
+ * Ask nodeid to announce new blocks to us with a cmpctblock, since it was
+ * first to give us the latest one. Only the last MAX_HIGH_BANDWIDTH_PEERS
+ * such peers are kept; the oldest is told to go back to sending invs.
+ */
+void MaybeSetPeerAsAnnouncingHeaderAndIDs(NodeId nodeid) {
+    CNodeState *state = State(nodeid);
+    assert(state != NULL);
+    if (!state->fProvidesCompactBlocks)
+        return;
+
+    std::list<NodeId>::iterator it = std::find(lNodesAnnouncingHeaderAndIDs.begin(), lNodesAnnouncingHeaderAndIDs.end(), nodeid);
+    if (it != lNodesAnnouncingHeaderAndIDs.end()) {
+        // Already announcing; it is now the most recent one
+        lNodesAnnouncingHeaderAndIDs.splice(lNodesAnnouncingHeaderAndIDs.end(), lNodesAnnouncingHeaderAndIDs, it);
+        return;
+    }
+
+    LOCK(cs_vNodes);
+    BOOST_FOREACH(CNode* pnode, vNodes) {
+        if (pnode->GetId() != nodeid)
+            continue;
+        if (lNodesAnnouncingHeaderAndIDs.size() >= MAX_HIGH_BANDWIDTH_PEERS) {
+            NodeId nodeidEvicted = lNodesAnnouncingHeaderAndIDs.front();
+            lNodesAnnouncingHeaderAndIDs.pop_front();
+            BOOST_FOREACH(CNode* pnodeEvicted, vNodes) {
+                if (pnodeEvicted->GetId() == nodeidEvicted) {
+                    pnodeEvicted->PushMessage("sendcmpct", false, COMPACT_BLOCKS_ENCODING_VERSION);
+                    break;
+                }
+            }
+        }
+        pnode->PushMessage("sendcmpct", true, COMPACT_BLOCKS_ENCODING_VERSION);
+        lNodesAnnouncingHeaderAndIDs.push_back(nodeid);
+        break;
+    }
+}
+
 /** Find the last common ancestor two blocks have.
  *  Both pa and pb must be non-NULL. */
 CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
@@ -437,8 +946,9 @@ CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
 }
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
-void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller) {
+ *  at most count entries. If the download window is held up by another peer, that peer and the
+ *  block it holds it up with are returned in nodeStaller and pindexStaller. */
+void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller, CBlockIndex*& pindexStaller) {
     if (count == 0)
         return;
 
@@ -474,6 +984,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
     int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    CBlockIndex *pindexWaitingFor = NULL;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -505,6 +1016,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
                         // We aren't able to fetch anything, but we would be if the download window was one larger.
                         nodeStaller = waitingfor;
+                        pindexStaller = pindexWaitingFor;
                     }
                     return;
                 }
@@ -515,6 +1027,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaitingFor = pindex;
             }
         }
     }
@@ -534,6 +1047,9 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.nBlockWindow = state->nBlockWindow;
+    stats.nBlockLatency = state->nBlockLatencyAvg;
+    stats.dBlocksPerSecond = state->dBlocksPerSecond;
     return true;
 }
 
@@ -573,6 +1089,13 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
     return chain.Genesis();
 }
 
+CBlockFileMap blockFileMap;
+CBlockArchive blockArchive(blockFileMap);
+CBlockVolumes blockVolumes;
+CTxIndexCache txIndexCache;
+CResponseCache responseCache;
+CCoinsViewDB *pcoinsdbview = NULL;
+CCoinsViewMemory *pcoinsmemory = NULL;
 CCoinsViewCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
@@ -581,8 +1104,9 @@ CBlockTreeDB *pblocktree = NULL;
 // mapOrphanTransactions
 //
 
-bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+bool AddOrphanTx(const CTransactionRef& ptx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_orphans)
 {
+    const CTransaction& tx = *ptx;
     uint256 hash = tx.GetHash();
     if (mapOrphanTransactions.count(hash))
         return false;
@@ -595,72 +1119,158 @@ bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(c
     // 10,000 orphans, each of which is at most 5,000 bytes big is
     // at most 500 megabytes of orphans:
     unsigned int sz = GetSerializeSize(tx, SER_NETWORK, tx.nVersion);
-    if (sz > 5000)
+    if (sz > MAX_ORPHAN_TX_SIZE)
     {
         LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
         return false;
     }
 
-    mapOrphanTransactions[hash].tx = tx;
-    mapOrphanTransactions[hash].fromPeer = peer;
+    COrphanPeer& orphanPeer = mapOrphanPeers[peer];
+    COrphanTx orphan = { ptx, peer, GetTime() + ORPHAN_TX_EXPIRE_TIME, sz, orphanPeer.vOrphans.size() };
+    OrphanMap::iterator it = mapOrphanTransactions.insert(std::make_pair(hash, orphan)).first;
+    orphanPeer.vOrphans.push_back(it);
+    orphanPeer.nBytes += sz;
+    nOrphanBytes += sz;
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
-        mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
+        mapOrphanTransactionsByPrev[txin.prevout].insert(it);
 
-    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u)\n", hash.ToString(),
-             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
+    LogPrint("mempool", "stored orphan tx %s (mapsz %u outsz %u bytes %u)\n", hash.ToString(),
+             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size(), nOrphanBytes);
     return true;
 }
 
-void static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+int static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_orphans)
 {
-    map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
+    OrphanMap::iterator it = mapOrphanTransactions.find(hash);
     if (it == mapOrphanTransactions.end())
-        return;
-    BOOST_FOREACH(const CTxIn& txin, it->second.tx.vin)
+        return 0;
+    BOOST_FOREACH(const CTxIn& txin, it->second.tx->vin)
     {
-        map<uint256, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout.hash);
+        boost::unordered_map<COutPoint, std::set<OrphanMap::iterator, IteratorComparator>, SaltedOutpointHasher>::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
         if (itPrev == mapOrphanTransactionsByPrev.end())
             continue;
-        itPrev->second.erase(hash);
+        itPrev->second.erase(it);
         if (itPrev->second.empty())
             mapOrphanTransactionsByPrev.erase(itPrev);
     }
+
+    // Swap the last orphan of the peer into the freed slot
+    std::map<NodeId, COrphanPeer>::iterator itPeer = mapOrphanPeers.find(it->second.fromPeer);
+    assert(itPeer != mapOrphanPeers.end());
+    COrphanPeer& orphanPeer = itPeer->second;
+    size_t nPos = it->second.nPeerPos;
+    assert(nPos < orphanPeer.vOrphans.size() && orphanPeer.vOrphans[nPos] == it);
+    orphanPeer.vOrphans[nPos] = orphanPeer.vOrphans.back();
+    orphanPeer.vOrphans[nPos]->second.nPeerPos = nPos;
+    orphanPeer.vOrphans.pop_back();
+    orphanPeer.nBytes -= it->second.nSize;
+    nOrphanBytes -= it->second.nSize;
+    if (orphanPeer.vOrphans.empty())
+        mapOrphanPeers.erase(itPeer);
+
     mapOrphanTransactions.erase(it);
+    return 1;
 }
 
 void EraseOrphansFor(NodeId peer)
 {
+    LOCK(cs_orphans);
     int nErased = 0;
-    map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end())
-    {
-        map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
-        if (maybeErase->second.fromPeer == peer)
-        {
-            EraseOrphanTx(maybeErase->second.tx.GetHash());
-            ++nErased;
-        }
+    std::map<NodeId, COrphanPeer>::iterator itPeer = mapOrphanPeers.find(peer);
+    if (itPeer != mapOrphanPeers.end()) {
+        std::vector<uint256> vErase;
+        BOOST_FOREACH(OrphanMap::iterator it, itPeer->second.vOrphans)
+            vErase.push_back(it->first);
+        BOOST_FOREACH(const uint256& hash, vErase)
+            nErased += EraseOrphanTx(hash);
     }
     if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", nErased, peer);
 }
 
+/** Drop orphans that a block has made redundant: those it includes, and those spending an input it spends */
+void static EraseOrphansForBlock(const CBlock& block) LOCKS_EXCLUDED(cs_orphans)
+{
+    LOCK(cs_orphans);
+    if (mapOrphanTransactions.empty())
+        return;
+
+    std::vector<uint256> vErase;
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+        const CTransaction& tx = *ptx;
+        if (mapOrphanTransactions.count(tx.GetHash()))
+            vErase.push_back(tx.GetHash());
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            boost::unordered_map<COutPoint, std::set<OrphanMap::iterator, IteratorComparator>, SaltedOutpointHasher>::iterator itByPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
+            if (itByPrev == mapOrphanTransactionsByPrev.end())
+                continue;
+            BOOST_FOREACH(OrphanMap::iterator it, itByPrev->second)
+                vErase.push_back(it->first);
+        }
+    }
+
+    int nErased = 0;
+    BOOST_FOREACH(const uint256& hash, vErase)
+        nErased += EraseOrphanTx(hash);
+    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx included or conflicted by block\n", nErased);
+}
 
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxBytes) LOCKS_EXCLUDED(cs_orphans)
 {
+    LOCK(cs_orphans);
     unsigned int nEvicted = 0;
-    while (mapOrphanTransactions.size() > nMaxOrphans)
+
+    static int64_t nNextSweep;
+    int64_t nNow = GetTime();
+    if (nNextSweep <= nNow) {
+        // Sweep out expired orphan pool entries:
+        int nErased = 0;
+        int64_t nMinExpTime = nNow + ORPHAN_TX_EXPIRE_TIME - ORPHAN_TX_EXPIRE_INTERVAL;
+        std::vector<uint256> vErase;
+        for (OrphanMap::iterator it = mapOrphanTransactions.begin(); it != mapOrphanTransactions.end(); ++it) {
+            if (it->second.nTimeExpire <= nNow)
+                vErase.push_back(it->first);
+            else
+                nMinExpTime = std::min(it->second.nTimeExpire, nMinExpTime);
+        }
+        BOOST_FOREACH(const uint256& hash, vErase)
+            nErased += EraseOrphanTx(hash);
+        // Sweep again 5 minutes after the next entry that expires in order to batch the linear scan.
+        nNextSweep = nMinExpTime + ORPHAN_TX_EXPIRE_INTERVAL;
+        if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx due to expiration\n", nErased);
+    }
+
+    while (mapOrphanTransactions.size() > nMaxOrphans || nOrphanBytes > nMaxBytes)
     {
-        // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
+        // Evict a random orphan of the peer holding the most bytes, so that
+        // a peer flooding orphans pushes out its own first
+        std::map<NodeId, COrphanPeer>::iterator itPeer = mapOrphanPeers.begin();
+        for (std::map<NodeId, COrphanPeer>::iterator it = mapOrphanPeers.begin(); it != mapOrphanPeers.end(); ++it) {
+            if (it->second.nBytes > itPeer->second.nBytes)
+                itPeer = it;
+        }
+        const std::vector<OrphanMap::iterator>& vOrphans = itPeer->second.vOrphans;
+        EraseOrphanTx(vOrphans[GetRand(vOrphans.size())]->first);
         ++nEvicted;
     }
     return nEvicted;
 }
 
+size_t GetOrphanPoolMemoryUsage(size_t& nOrphans)
+{
+    LOCK(cs_orphans);
+    nOrphans = mapOrphanTransactions.size();
+    size_t nUsage = memusage::DynamicUsage(mapOrphanTransactions) +
+                    memusage::DynamicUsage(mapOrphanTransactionsByPrev) +
+                    memusage::DynamicUsage(mapOrphanPeers);
+    for (OrphanMap::const_iterator it = mapOrphanTransactions.begin(); it != mapOrphanTransactions.end(); ++it)
+        nUsage += RecursiveDynamicUsage(it->second.tx);
+    for (auto it = mapOrphanTransactionsByPrev.begin(); it != mapOrphanTransactionsByPrev.end(); ++it)
+        nUsage += memusage::DynamicUsage(it->second);
+    for (std::map<NodeId, COrphanPeer>::const_iterator it = mapOrphanPeers.begin(); it != mapOrphanPeers.end(); ++it)
+        nUsage += memusage::DynamicUsage(it->second.vOrphans);
+    return nUsage;
+}
+
 
 bool IsStandardTx(const CTransaction& tx, string& reason, const int nHeight)
 {
@@ -860,16 +1470,7 @@ bool AreInputsStandard(const CTransaction& tx, const CCoinsViewCache& mapInputs,
 
 unsigned int GetLegacySigOpCount(const CTransaction& tx)
 {
-    unsigned int nSigOps = 0;
-    BOOST_FOREACH(const CTxIn& txin, tx.vin)
-    {
-        nSigOps += txin.scriptSig.GetSigOpCount(false);
-    }
-    BOOST_FOREACH(const CTxOut& txout, tx.vout)
-    {
-        nSigOps += txout.scriptPubKey.GetSigOpCount(false);
-    }
-    return nSigOps;
+    return tx.GetLegacySigOpCount();
 }
 
 unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& inputs)
@@ -887,6 +1488,39 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& in
     return nSigOps;
 }
 
+/** Translate a failed CSaplingCheck into the matching rejection. */
+static bool InvalidSaplingCheck(CValidationState& state, const CSaplingCheck& check)
+{
+    const std::string txid = check.GetTransaction()->GetHash().ToString();
+    switch (check.GetError()) {
+    case CSaplingCheck::SAPLING_BAD_SPEND:
+        return state.DoS(100, error("ContextualCheckTransaction(): Sapling spend description invalid (tx %s)", txid),
+                              REJECT_INVALID, "bad-txns-sapling-spend-description-invalid");
+    case CSaplingCheck::SAPLING_BAD_OUTPUT:
+        return state.DoS(100, error("ContextualCheckTransaction(): Sapling output description invalid (tx %s)", txid),
+                              REJECT_INVALID, "bad-txns-sapling-output-description-invalid");
+    default:
+        return state.DoS(100, error("ContextualCheckTransaction(): Sapling binding signature invalid (tx %s)", txid),
+                              REJECT_INVALID, "bad-txns-sapling-binding-signature-invalid");
+    }
+}
+
+static bool InvalidJoinSplitSig(CValidationState& state, bool (*isInitBlockDownload)())
+{
+    return state.DoS(isInitBlockDownload() ? 0 : 100,
+                        error("CheckTransaction(): invalid joinsplit signature"),
+                        REJECT_INVALID, "bad-txns-invalid-joinsplit-signature");
+}
+
+/** Verify a JoinSplit proof, timing it for the metrics unless verification is disabled */
+static bool VerifyJoinSplit(const JSDescription& joinsplit, libzcash::ProofVerifier& verifier, const uint256& joinSplitPubKey)
+{
+    if (!verifier.IsEnabled())
+        return joinsplit.Verify(*pzcashParams, verifier, joinSplitPubKey);
+    HistogramTimer timer(sproutProofTime);
+    return joinsplit.Verify(*pzcashParams, verifier, joinSplitPubKey);
+}
+
 /**
  * Check a transaction contextually against a set of consensus rules valid at a given block height.
  *
@@ -901,7 +1535,9 @@ bool ContextualCheckTransaction(
         CValidationState &state,
         const int nHeight,
         const int dosLevel,
-        bool (*isInitBlockDownload)())
+        bool (*isInitBlockDownload)(),
+        CShieldedBatchVerifier* pShieldedBatch,
+        bool fCheckShieldedProofs)
 {
     bool overwinterActive = NetworkUpgradeActive(nHeight, Params().GetConsensus(), Consensus::UPGRADE_OVERWINTER);
     bool saplingActive = NetworkUpgradeActive(nHeight, Params().GetConsensus(), Consensus::UPGRADE_SAPLING);
@@ -980,11 +1616,15 @@ bool ContextualCheckTransaction(
     if (!saplingActive) {
         // Size limits
         BOOST_STATIC_ASSERT(MAX_BLOCK_SIZE > MAX_TX_SIZE_BEFORE_SAPLING); // sanity
-        if (::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION) > MAX_TX_SIZE_BEFORE_SAPLING)
+        if (tx.GetTotalSize() > MAX_TX_SIZE_BEFORE_SAPLING)
             return state.DoS(100, error("ContextualCheckTransaction(): size limits failed"),
                             REJECT_INVALID, "bad-txns-oversize");
     }
 
+    // The rest is signature and proof verification
+    if (!fCheckShieldedProofs)
+        return true;
+
     uint256 dataToBeSigned;
 
     if (!tx.vjoinsplit.empty() ||
@@ -992,6 +1632,11 @@ bool ContextualCheckTransaction(
         !tx.vShieldedOutput.empty())
     {
         auto consensusBranchId = CurrentEpochBranchId(nHeight, Params().GetConsensus());
+        // The proofs and signatures were already checked under this branch,
+        // typically when the transaction was accepted to the mempool.
+        if (GetProofCacheEntry(tx.GetHash(), consensusBranchId)) {
+            return true;
+        }
         // Empty output script.
         CScript scriptCode;
         try {
@@ -1004,99 +1649,214 @@ bool ContextualCheckTransaction(
 
     if (!tx.vjoinsplit.empty())
     {
-        BOOST_STATIC_ASSERT(crypto_sign_PUBLICKEYBYTES == 32);
-
-        // We rely on libsodium to check that the signature is canonical.
-        // https://github.com/jedisct1/libsodium/commit/62911edb7ff2275cccd74bf1c8aefcc4d76924e0
-        if (crypto_sign_verify_detached(&tx.joinSplitSig[0],
-                                        dataToBeSigned.begin(), 32,
-                                        tx.joinSplitPubKey.begin()
-                                        ) != 0) {
-            return state.DoS(isInitBlockDownload() ? 0 : 100,
-                                error("CheckTransaction(): invalid joinsplit signature"),
-                                REJECT_INVALID, "bad-txns-invalid-joinsplit-signature");
+        if (pShieldedBatch) {
+            // Verified together with the rest of the block by the caller
+            pShieldedBatch->AddJoinSplitSig(tx, dataToBeSigned);
+        } else {
+            CJoinSplitSigCheck check(tx, dataToBeSigned);
+            if (!check()) {
+                return InvalidJoinSplitSig(state, isInitBlockDownload);
+            }
         }
     }
 
     if (!tx.vShieldedSpend.empty() ||
         !tx.vShieldedOutput.empty())
     {
-        auto ctx = librustzcash_sapling_verification_ctx_init();
-
-        for (const SpendDescription &spend : tx.vShieldedSpend) {
-            if (!librustzcash_sapling_check_spend(
-                ctx,
-                spend.cv.begin(),
-                spend.anchor.begin(),
-                spend.nullifier.begin(),
-                spend.rk.begin(),
-                spend.zkproof.begin(),
-                spend.spendAuthSig.begin(),
-                dataToBeSigned.begin()
-            ))
-            {
-                librustzcash_sapling_verification_ctx_free(ctx);
-                return state.DoS(100, error("ContextualCheckTransaction(): Sapling spend description invalid"),
-                                      REJECT_INVALID, "bad-txns-sapling-spend-description-invalid");
+        if (pShieldedBatch) {
+            pShieldedBatch->AddSapling(tx, dataToBeSigned);
+        } else {
+            CSaplingCheck check(tx, dataToBeSigned);
+            if (!check()) {
+                return InvalidSaplingCheck(state, check);
             }
         }
+    }
+    return true;
+}
 
-        for (const OutputDescription &output : tx.vShieldedOutput) {
-            if (!librustzcash_sapling_check_output(
-                ctx,
-                output.cv.begin(),
-                output.cm.begin(),
-                output.ephemeralKey.begin(),
-                output.zkproof.begin()
-            ))
-            {
-                librustzcash_sapling_verification_ctx_free(ctx);
-                return state.DoS(100, error("ContextualCheckTransaction(): Sapling output description invalid"),
-                                      REJECT_INVALID, "bad-txns-sapling-output-description-invalid");
-            }
-        }
+bool CJoinSplitSigCheck::operator()()
+{
+    BOOST_STATIC_ASSERT(crypto_sign_PUBLICKEYBYTES == 32);
+
+    // We rely on libsodium to check that the signature is canonical.
+    // https://github.com/jedisct1/libsodium/commit/62911edb7ff2275cccd74bf1c8aefcc4d76924e0
+    return crypto_sign_verify_detached(&ptx->joinSplitSig[0],
+                                       dataToBeSigned.begin(), 32,
+                                       ptx->joinSplitPubKey.begin()
+                                       ) == 0;
+}
+
+bool CSaplingCheck::operator()()
+{
+    HistogramTimer timer(saplingProofTime);
+    auto ctx = librustzcash_sapling_verification_ctx_init();
 
-        if (!librustzcash_sapling_final_check(
+    for (const SpendDescription &spend : ptx->vShieldedSpend) {
+        if (!librustzcash_sapling_check_spend(
             ctx,
-            tx.valueBalance,
-            tx.bindingSig.begin(),
+            spend.cv.begin(),
+            spend.anchor.begin(),
+            spend.nullifier.begin(),
+            spend.rk.begin(),
+            spend.zkproof.begin(),
+            spend.spendAuthSig.begin(),
             dataToBeSigned.begin()
         ))
         {
             librustzcash_sapling_verification_ctx_free(ctx);
-            return state.DoS(100, error("ContextualCheckTransaction(): Sapling binding signature invalid"),
-                                  REJECT_INVALID, "bad-txns-sapling-binding-signature-invalid");
+            error = SAPLING_BAD_SPEND;
+            return false;
+        }
+    }
+
+    for (const OutputDescription &output : ptx->vShieldedOutput) {
+        if (!librustzcash_sapling_check_output(
+            ctx,
+            output.cv.begin(),
+            output.cm.begin(),
+            output.ephemeralKey.begin(),
+            output.zkproof.begin()
+        ))
+        {
+            librustzcash_sapling_verification_ctx_free(ctx);
+            error = SAPLING_BAD_OUTPUT;
+            return false;
         }
+    }
 
+    if (!librustzcash_sapling_final_check(
+        ctx,
+        ptx->valueBalance,
+        ptx->bindingSig.begin(),
+        dataToBeSigned.begin()
+    ))
+    {
         librustzcash_sapling_verification_ctx_free(ctx);
+        error = SAPLING_BAD_BINDING_SIG;
+        return false;
     }
+
+    librustzcash_sapling_verification_ctx_free(ctx);
+    error = SAPLING_OK;
     return true;
 }
 
-
-bool CheckTransaction(const CTransaction& tx, CValidationState &state,
-                      libzcash::ProofVerifier& verifier)
+bool CProofCheck::operator()()
 {
-    // Don't count coinbase transactions because mining skews the count
-    if (!tx.IsCoinBase()) {
-        transactionsValidated.increment();
+    if (nJoinSplit == JOINSPLIT_SIG) {
+        if (!joinSplitSigCheck()) {
+            return ::error("CProofCheck(): %s joinsplit signature invalid", ptx->GetHash().ToString());
+        }
+        return true;
     }
-
-    if (!CheckTransactionWithoutProofVerification(tx, state)) {
-        return false;
-    } else {
-        // Ensure that zk-SNARKs verify
-        BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
-            if (!joinsplit.Verify(*pzcashParams, verifier, tx.joinSplitPubKey)) {
-                return state.DoS(100, error("CheckTransaction(): joinsplit does not verify"),
-                                    REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
-            }
+    if (nJoinSplit == SAPLING) {
+        if (!saplingCheck()) {
+            return ::error("CProofCheck(): %s Sapling proof or signature check failed", ptx->GetHash().ToString());
         }
         return true;
     }
+
+    auto verifier = libzcash::ProofVerifier::Strict();
+    if (!VerifyJoinSplit(ptx->vjoinsplit[nJoinSplit], verifier, ptx->joinSplitPubKey)) {
+        return ::error("CProofCheck(): %s:%d joinsplit does not verify", ptx->GetHash().ToString(), nJoinSplit);
+    }
+    return true;
 }
 
-bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidationState &state)
+static CCheckQueue<CProofCheck> proofcheckqueue(4);
+
+void ThreadProofCheck() {
+    RenameThread("litecoinz-proofch");
+    proofcheckqueue.Thread();
+}
+
+void CShieldedBatchVerifier::AddJoinSplitSig(const CTransaction& tx, const uint256& dataToBeSigned)
+{
+    vJoinSplitSigChecks.push_back(CJoinSplitSigCheck());
+    CJoinSplitSigCheck check(tx, dataToBeSigned);
+    vJoinSplitSigChecks.back().swap(check);
+}
+
+void CShieldedBatchVerifier::AddSapling(const CTransaction& tx, const uint256& dataToBeSigned)
+{
+    vSaplingChecks.push_back(CSaplingCheck());
+    CSaplingCheck check(tx, dataToBeSigned);
+    vSaplingChecks.back().swap(check);
+}
+
+bool CShieldedBatchVerifier::Verify(CValidationState& state)
+{
+    if (nScriptCheckThreads && Size() > 1) {
+        std::vector<CProofCheck> vProofChecks;
+        vProofChecks.reserve(Size());
+        BOOST_FOREACH(const CJoinSplitSigCheck& check, vJoinSplitSigChecks) {
+            vProofChecks.push_back(CProofCheck(check));
+        }
+        BOOST_FOREACH(const CSaplingCheck& check, vSaplingChecks) {
+            vProofChecks.push_back(CProofCheck(check));
+        }
+        CCheckQueueControl<CProofCheck> control(&proofcheckqueue);
+        control.Add(vProofChecks);
+        if (control.Wait()) {
+            return true;
+        }
+        // Fall through and re-check serially to find the offending transaction
+    }
+
+    BOOST_FOREACH(CJoinSplitSigCheck& check, vJoinSplitSigChecks) {
+        if (!check()) {
+            return InvalidJoinSplitSig(state, isInitBlockDownload);
+        }
+    }
+    BOOST_FOREACH(CSaplingCheck& check, vSaplingChecks) {
+        if (!check()) {
+            return InvalidSaplingCheck(state, check);
+        }
+    }
+    return true;
+}
+
+
+bool CheckTransaction(const CTransaction& tx, CValidationState &state,
+                      libzcash::ProofVerifier& verifier)
+{
+    // Don't count coinbase transactions because mining skews the count
+    if (!tx.IsCoinBase()) {
+        transactionsValidated.increment();
+    }
+
+    if (!CheckTransactionWithoutProofVerification(tx, state)) {
+        return false;
+    } else {
+        // Ensure that zk-SNARKs verify
+        BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
+            if (!VerifyJoinSplit(joinsplit, verifier, tx.joinSplitPubKey)) {
+                return state.DoS(100, error("CheckTransaction(): joinsplit does not verify"),
+                                    REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+            }
+        }
+        return true;
+    }
+}
+
+/**
+ * Whether v holds the same value twice. v is sorted in place so that
+ * duplicates end up next to each other; up to N values live on the stack,
+ * so the common transaction is checked without allocating.
+ */
+template <unsigned int N, typename T>
+static bool SortAndFindDuplicate(prevector<N, T>& v)
+{
+    if (v.size() < 2)
+        return false;
+    T* begin = &v[0];
+    T* end = begin + v.size();
+    std::sort(begin, end);
+    return std::adjacent_find(begin, end) != end;
+}
+
+bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidationState &state)
 {
     // Basic checks that don't depend on any context
 
@@ -1156,7 +1916,7 @@ bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidatio
     // Size limits
     BOOST_STATIC_ASSERT(MAX_BLOCK_SIZE >= MAX_TX_SIZE_AFTER_SAPLING); // sanity
     BOOST_STATIC_ASSERT(MAX_TX_SIZE_AFTER_SAPLING > MAX_TX_SIZE_BEFORE_SAPLING); // sanity
-    if (::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION) > MAX_TX_SIZE_AFTER_SAPLING)
+    if (tx.GetTotalSize() > MAX_TX_SIZE_AFTER_SAPLING)
         return state.DoS(100, error("CheckTransaction(): size limits failed"),
                          REJECT_INVALID, "bad-txns-oversize");
 
@@ -1262,42 +2022,41 @@ bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidatio
     }
 
     // Check for duplicate inputs
-    set<COutPoint> vInOutPoints;
-    BOOST_FOREACH(const CTxIn& txin, tx.vin)
     {
-        if (vInOutPoints.count(txin.prevout))
+        prevector<16, COutPoint> vInOutPoints;
+        vInOutPoints.reserve(tx.vin.size());
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            vInOutPoints.push_back(txin.prevout);
+        if (SortAndFindDuplicate(vInOutPoints))
             return state.DoS(100, error("CheckTransaction(): duplicate inputs"),
                              REJECT_INVALID, "bad-txns-inputs-duplicate");
-        vInOutPoints.insert(txin.prevout);
     }
 
     // Check for duplicate joinsplit nullifiers in this transaction
+    if (tx.vjoinsplit.size() > 0)
     {
-        set<uint256> vJoinSplitNullifiers;
+        prevector<8, uint256> vJoinSplitNullifiers;
+        vJoinSplitNullifiers.reserve(tx.vjoinsplit.size() * ZC_NUM_JS_INPUTS);
         BOOST_FOREACH(const JSDescription& joinsplit, tx.vjoinsplit)
         {
             BOOST_FOREACH(const uint256& nf, joinsplit.nullifiers)
-            {
-                if (vJoinSplitNullifiers.count(nf))
-                    return state.DoS(100, error("CheckTransaction(): duplicate nullifiers"),
-                                REJECT_INVALID, "bad-joinsplits-nullifiers-duplicate");
-
-                vJoinSplitNullifiers.insert(nf);
-            }
+                vJoinSplitNullifiers.push_back(nf);
         }
+        if (SortAndFindDuplicate(vJoinSplitNullifiers))
+            return state.DoS(100, error("CheckTransaction(): duplicate nullifiers"),
+                        REJECT_INVALID, "bad-joinsplits-nullifiers-duplicate");
     }
 
     // Check for duplicate sapling nullifiers in this transaction
+    if (tx.vShieldedSpend.size() > 1)
     {
-        set<uint256> vSaplingNullifiers;
+        prevector<8, uint256> vSaplingNullifiers;
+        vSaplingNullifiers.reserve(tx.vShieldedSpend.size());
         BOOST_FOREACH(const SpendDescription& spend_desc, tx.vShieldedSpend)
-        {
-            if (vSaplingNullifiers.count(spend_desc.nullifier))
-                return state.DoS(100, error("CheckTransaction(): duplicate nullifiers"),
-                             REJECT_INVALID, "bad-spend-description-nullifiers-duplicate");
-
-            vSaplingNullifiers.insert(spend_desc.nullifier);
-        }
+            vSaplingNullifiers.push_back(spend_desc.nullifier);
+        if (SortAndFindDuplicate(vSaplingNullifiers))
+            return state.DoS(100, error("CheckTransaction(): duplicate nullifiers"),
+                         REJECT_INVALID, "bad-spend-description-nullifiers-duplicate");
     }
 
     if (tx.IsCoinBase())
@@ -1361,10 +2120,20 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectAbsurdFee)
+void LimitMempoolSize(CTxMemPool& pool)
+{
+    std::vector<COutPoint> vNoSpendsRemaining;
+    pool.TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, &vNoSpendsRemaining);
+    BOOST_FOREACH(const COutPoint& removed, vNoSpendsRemaining)
+        pcoinsTip->Uncache(removed);
+}
+
+static bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const CTransactionRef &ptx, bool fLimitFree,
+                                     bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectAbsurdFee,
+                                     bool fOverrideMempoolLimit)
 {
     AssertLockHeld(cs_main);
+    const CTransaction& tx = *ptx;
     if (pfMissingInputs)
         *pfMissingInputs = false;
 
@@ -1385,8 +2154,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         }
     }
 
+    bool fShielded = !tx.vjoinsplit.empty() || !tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty();
+    bool fProofsCached = fShielded && GetProofCacheEntry(tx.GetHash(), consensusBranchId);
+
     auto verifier = libzcash::ProofVerifier::Strict();
-    if (!CheckTransaction(tx, state, verifier))
+    auto disabledVerifier = libzcash::ProofVerifier::Disabled();
+    if (!CheckTransaction(tx, state, fProofsCached ? disabledVerifier : verifier))
         return error("AcceptToMemoryPool: CheckTransaction failed");
 
     // DoS level set to 10 to be more forgiving.
@@ -1395,6 +2168,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         return error("AcceptToMemoryPool: ContextualCheckTransaction failed");
     }
 
+    // All proofs and shielded signatures are now known to be valid; remember
+    // that so ConnectBlock does not verify them again.
+    if (fShielded && !fProofsCached) {
+        SetProofCacheEntry(tx.GetHash(), consensusBranchId);
+    }
+
     // DoS mitigation: reject transactions expiring soon
     // Note that if a valid transaction belonging to the wallet is in the mempool and the node is shutdown,
     // upon restart, CWalletTx::AcceptToMemoryPool() will be invoked which might result in rejection.
@@ -1462,14 +2241,16 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         view.SetBackend(viewMemPool);
 
         // do we already have it?
-        if (view.HaveCoins(hash))
-            return false;
+        for (size_t out = 0; out < tx.vout.size(); out++) {
+            if (view.HaveCoin(COutPoint(hash, out)))
+                return false;
+        }
 
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent).
+        // Spent and missing outputs can no longer be told apart, so any input
+        // that is not in the UTXO set is treated as a possibly missing parent.
         BOOST_FOREACH(const CTxIn txin, tx.vin) {
-            if (!view.HaveCoins(txin.prevout.hash)) {
+            if (!view.HaveCoin(txin.prevout)) {
                 if (pfMissingInputs)
                     *pfMissingInputs = true;
                 return false;
@@ -1518,8 +2299,8 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         // during reorgs to ensure COINBASE_MATURITY is still met.
         bool fSpendsCoinbase = false;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            const CCoins *coins = view.AccessCoins(txin.prevout.hash);
-            if (coins->IsCoinBase()) {
+            const Coin &coin = view.AccessCoin(txin.prevout);
+            if (coin.IsCoinBase()) {
                 fSpendsCoinbase = true;
                 break;
             }
@@ -1530,7 +2311,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         // it has passed ContextualCheckInputs and therefore this is correct.
         auto consensusBranchId = CurrentEpochBranchId(chainActive.Height() + 1, Params().GetConsensus());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx), fSpendsCoinbase, consensusBranchId);
+        CTxMemPoolEntry entry(ptx, nFees, nAcceptTime, dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx), fSpendsCoinbase, nSigOps, consensusBranchId);
         unsigned int nSize = entry.GetTxSize();
 
         // Accept a tx if it contains joinsplits and has at least the default fee specified by z_sendmany.
@@ -1545,6 +2326,17 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                                 REJECT_INSUFFICIENTFEE, "insufficient fee");
         }
 
+        // Once the mempool has been full, what it evicted sets the fee rate
+        // needed to get in, shielded transactions included.
+        double dPriorityDelta = 0;
+        CAmount nFeeDelta = 0;
+        pool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
+        CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+        if (mempoolRejectFee > 0 && nFees + nFeeDelta < mempoolRejectFee)
+            return state.DoS(0, error("AcceptToMemoryPool: mempool min fee not met %s, %d < %d",
+                                    hash.ToString(), nFees + nFeeDelta, mempoolRejectFee),
+                            REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+
         // Require that free transactions have sufficient priority to be mined in the next block.
         if (GetBoolArg("-relaypriority", false) && nFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(view.GetPriority(tx, chainActive.Height() + 1))) {
             return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient priority");
@@ -1584,7 +2376,10 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        PrecomputedTransactionData txdata(tx);
+        // The sighash midstates are kept with the entry, so that the miner
+        // and ConnectBlock do not have to hash the transaction again.
+        std::shared_ptr<const PrecomputedTransactionData> ptxdata = std::make_shared<PrecomputedTransactionData>(tx);
+        const PrecomputedTransactionData& txdata = *ptxdata;
         if (!ContextualCheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, txdata, Params().GetConsensus(), consensusBranchId))
         {
             return error("AcceptToMemoryPool: ConnectInputs failed %s", hash.ToString());
@@ -1605,19 +2400,81 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         }
 
         // Store transaction in memory
+        entry.SetTxData(ptxdata);
         pool.addUnchecked(hash, entry, !IsInitialBlockDownload());
+
+        // Make room for it, which may mean evicting the transaction itself
+        if (!fOverrideMempoolLimit) {
+            LimitMempoolSize(pool);
+            if (!pool.exists(hash))
+                return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
+        }
     }
 
-    SyncWithWallets(tx, NULL);
+    SyncWithWallets(ptx);
 
     return true;
 }
 
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransactionRef &ptx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectAbsurdFee,
+                                bool fOverrideMempoolLimit)
+{
+    int64_t nStart = GetTimeMicros();
+    bool fAccepted = AcceptToMemoryPoolWorker(pool, state, ptx, fLimitFree, pfMissingInputs, nAcceptTime,
+                                              fRejectAbsurdFee, fOverrideMempoolLimit);
+    int64_t nDuration = GetTimeMicros() - nStart;
+    mempoolAcceptTime.observe(nDuration);
+    if (fAccepted) {
+        mempoolAccepted.increment();
+        Trace(TRACE_TX_ACCEPTED, ptx->GetHash(), -1, -1, nDuration);
+    } else {
+        mempoolRejected.increment();
+    }
+    return fAccepted;
+}
+
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectAbsurdFee,
+                                bool fOverrideMempoolLimit)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, MakeTransactionRef(tx), fLimitFree, pfMissingInputs, nAcceptTime,
+                                      fRejectAbsurdFee, fOverrideMempoolLimit);
+}
+
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransactionRef &ptx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fRejectAbsurdFee, bool fOverrideMempoolLimit)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, ptx, fLimitFree, pfMissingInputs, GetTime(),
+                                      fRejectAbsurdFee, fOverrideMempoolLimit);
+}
+
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fRejectAbsurdFee, bool fOverrideMempoolLimit)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, MakeTransactionRef(tx), fLimitFree, pfMissingInputs, GetTime(),
+                                      fRejectAbsurdFee, fOverrideMempoolLimit);
+}
+
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
+static bool ReadTxIndexEntry(const uint256& hash, const CDiskTxPos& pos, CTransaction& txOut, uint256& hashBlock, bool fReadAhead)
+{
+    AssertLockHeld(cs_main);
+    if (!txIndexReader.Read(hash, pos, txOut, hashBlock, fReadAhead))
+        return false;
+    txIndexCache.Put(txOut, hashBlock);
+    return true;
+}
+
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock, bool fAllowSlow)
 {
     CBlockIndex *pindexSlow = NULL;
 
+    // A transaction in the cache is in a block of the active chain, so it
+    // can't be in the mempool as well
+    if (fTxIndex && txIndexCache.Get(hash, txOut, hashBlock))
+        return true;
+
     LOCK(cs_main);
 
     if (mempool.lookup(hash, txOut))
@@ -1627,32 +2484,17 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
 
     if (fTxIndex) {
         CDiskTxPos postx;
-        if (pblocktree->ReadTxIndex(hash, postx)) {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            if (file.IsNull())
-                return error("%s: OpenBlockFile failed", __func__);
-            CBlockHeader header;
-            try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txOut;
-            } catch (const std::exception& e) {
-                return error("%s: Deserialize or I/O error - %s", __func__, e.what());
-            }
-            hashBlock = header.GetHash();
-            if (txOut.GetHash() != hash)
-                return error("%s: txid mismatch", __func__);
-            return true;
-        }
+        if (pblocktree->ReadTxIndex(hash, postx))
+            return ReadTxIndexEntry(hash, postx, txOut, hashBlock, false);
     }
 
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
         int nHeight = -1;
         {
             CCoinsViewCache &view = *pcoinsTip;
-            const CCoins* coins = view.AccessCoins(hash);
-            if (coins)
-                nHeight = coins->nHeight;
+            const Coin& coin = AccessByTxid(view, hash);
+            if (!coin.IsSpent())
+                nHeight = coin.nHeight;
         }
         if (nHeight > 0)
             pindexSlow = chainActive[nHeight];
@@ -1661,7 +2503,8 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
     if (pindexSlow) {
         CBlock block;
         if (ReadBlockFromDisk(block, pindexSlow)) {
-            BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+            BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+                const CTransaction& tx = *ptx;
                 if (tx.GetHash() == hash) {
                     txOut = tx;
                     hashBlock = pindexSlow->GetBlockHash();
@@ -1674,6 +2517,66 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
     return false;
 }
 
+void GetTransactions(const std::vector<uint256>& vHash, std::vector<CTransaction>& vTx, std::vector<uint256>& vHashBlock,
+                     std::vector<bool>& vFound, bool fAllowSlow)
+{
+    vTx.assign(vHash.size(), CTransaction());
+    vHashBlock.assign(vHash.size(), uint256());
+    vFound.assign(vHash.size(), false);
+
+    std::vector<size_t> vMissing;
+    for (size_t i = 0; i < vHash.size(); i++) {
+        if (fTxIndex && txIndexCache.Get(vHash[i], vTx[i], vHashBlock[i]))
+            vFound[i] = true;
+        else
+            vMissing.push_back(i);
+    }
+    if (vMissing.empty())
+        return;
+
+    LOCK(cs_main);
+
+    std::vector<std::pair<CDiskTxPos, size_t> > vPos;
+    std::vector<size_t> vSlow;
+    for (size_t i : vMissing) {
+        if (mempool.lookup(vHash[i], vTx[i])) {
+            vFound[i] = true;
+            continue;
+        }
+        CDiskTxPos pos;
+        if (fTxIndex && pblocktree->ReadTxIndex(vHash[i], pos))
+            vPos.push_back(std::make_pair(pos, i));
+        else
+            vSlow.push_back(i);
+    }
+
+    // In file order, so that each file is read front to back and
+    // neighbouring transactions come from one read
+    std::sort(vPos.begin(), vPos.end(), [](const std::pair<CDiskTxPos, size_t>& a, const std::pair<CDiskTxPos, size_t>& b) {
+        if (a.first.nFile != b.first.nFile)
+            return a.first.nFile < b.first.nFile;
+        if (a.first.nPos != b.first.nPos)
+            return a.first.nPos < b.first.nPos;
+        return a.first.nTxOffset < b.first.nTxOffset;
+    });
+    for (size_t k = 0; k < vPos.size(); k++) {
+        const CDiskTxPos& pos = vPos[k].first;
+        bool fReadAhead = false;
+        if (k + 1 < vPos.size()) {
+            const CDiskTxPos& posNext = vPos[k + 1].first;
+            uint64_t nStart = (uint64_t)pos.nPos + pos.nTxOffset;
+            fReadAhead = posNext.nFile == pos.nFile && (uint64_t)posNext.nPos + posNext.nTxOffset - nStart < TXINDEX_READAHEAD_SIZE;
+        }
+        size_t i = vPos[k].second;
+        vFound[i] = ReadTxIndexEntry(vHash[i], pos, vTx[i], vHashBlock[i], fReadAhead);
+    }
+
+    if (fAllowSlow) {
+        for (size_t i : vSlow)
+            vFound[i] = GetTransaction(vHash[i], vTx[i], vHashBlock[i], true);
+    }
+}
+
 
 
 
@@ -1686,22 +2589,75 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
 
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("WriteBlockToDisk: OpenBlockFile failed");
+    // Index header then block, written as one record
+    unsigned int nSize = GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss.reserve(MESSAGE_START_SIZE + sizeof(nSize) + nSize);
+    ss << FLATDATA(messageStart) << nSize << block;
+
+    // Append to the open history file
+    LOCK(cs_LastBlockFile);
+    if (!blockFileWriter.Append(pos, ss, MESSAGE_START_SIZE + sizeof(nSize)))
+        return error("WriteBlockToDisk: writing to %s failed", pos.ToString());
+
+    return true;
+}
+
+/** Blocks are stored as message start, size and the serialized block */
+static const unsigned int BLOCK_FILE_HEADER_SIZE = MESSAGE_START_SIZE + sizeof(uint32_t);
+
+static bool CheckBlockFileHeader(const unsigned char* header, const CDiskBlockPos& pos, unsigned int& nSize)
+{
+    if (memcmp(header, Params().MessageStart(), MESSAGE_START_SIZE) != 0)
+        return error("%s: block magic mismatch at %s", __func__, pos.ToString());
+    nSize = ReadLE32(header + MESSAGE_START_SIZE);
+    if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+        return error("%s: invalid block size %u at %s", __func__, nSize, pos.ToString());
+    return true;
+}
 
-    // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, block);
-    fileout << FLATDATA(messageStart) << nSize;
+bool ReadRawBlockFromDisk(CBlockFileRegion& region, const CDiskBlockPos& pos)
+{
+    if (pos.IsNull() || pos.nPos < BLOCK_FILE_HEADER_SIZE)
+        return error("%s: invalid block position %s", __func__, pos.ToString());
+    CDiskBlockPos posHeader(pos.nFile, pos.nPos - BLOCK_FILE_HEADER_SIZE);
+    boost::filesystem::path path = GetBlockPosFilename(pos, "blk");
+    unsigned char header[BLOCK_FILE_HEADER_SIZE];
+    unsigned int nSize;
+
+    if (blockArchive.IsCompressed(pos.nFile)) {
+        if (!blockArchive.Read(pos.nFile, posHeader.nPos, BLOCK_FILE_HEADER_SIZE, region))
+            return error("%s: can't read block header at %s from the archive", __func__, pos.ToString());
+        memcpy(header, region.begin(), BLOCK_FILE_HEADER_SIZE);
+        if (!CheckBlockFileHeader(header, pos, nSize))
+            return false;
+        if (!blockArchive.Read(pos.nFile, pos.nPos, nSize, region))
+            return error("%s: can't read block at %s from the archive", __func__, pos.ToString());
+        return true;
+    }
 
-    // Write block
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("WriteBlockToDisk: ftell failed");
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+    if (blockFileMap.Read(pos.nFile, path, posHeader.nPos, BLOCK_FILE_HEADER_SIZE, region)) {
+        memcpy(header, region.begin(), BLOCK_FILE_HEADER_SIZE);
+        if (!CheckBlockFileHeader(header, pos, nSize))
+            return false;
+        if (blockFileMap.Read(pos.nFile, path, pos.nPos, nSize, region))
+            return true;
+    }
 
+    // Not mapped: read the header and the block in one go
+    CAutoFile filein(OpenBlockFile(posHeader, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        // The file may have been compressed and removed since it was looked up
+        if (blockArchive.IsCompressed(pos.nFile))
+            return ReadRawBlockFromDisk(region, pos);
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+    }
+    if (fread(header, 1, BLOCK_FILE_HEADER_SIZE, filein.Get()) != BLOCK_FILE_HEADER_SIZE)
+        return error("%s: I/O error reading block header at %s", __func__, pos.ToString());
+    if (!CheckBlockFileHeader(header, pos, nSize))
+        return false;
+    if (fread(region.SetCopied(nSize), 1, nSize, filein.Get()) != nSize)
+        return error("%s: I/O error reading block at %s", __func__, pos.ToString());
     return true;
 }
 
@@ -1709,17 +2665,31 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    if (blockFileMap.IsEnabled() || blockArchive.IsCompressed(pos.nFile)) {
+        CBlockFileRegion region;
+        if (!ReadRawBlockFromDisk(region, pos))
+            return false;
+        try {
+            // Read from the mapping itself rather than a copy of the block
+            CSpanReader ss((const unsigned char*)region.begin(), (const unsigned char*)region.end(), SER_DISK, CLIENT_VERSION);
+            ss >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
 
-    // Read block
-    try {
-        filein >> block;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        // Read block
+        try {
+            filein >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
     }
 
     // Check the header
@@ -1760,23 +2730,20 @@ bool IsInitialBlockDownload()
 
     // Once this function has returned false, it must remain false.
     static std::atomic<bool> latchToFalse{false};
-    // Optimization: pre-test latch before taking the lock.
     if (latchToFalse.load(std::memory_order_relaxed))
         return false;
 
-    LOCK(cs_main);
-    if (latchToFalse.load(std::memory_order_relaxed))
-        return false;
     if (fImporting || fReindex)
         return true;
-    if (chainActive.Tip() == NULL)
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    if (!tip)
         return true;
-    if (chainActive.Tip()->nChainWork < UintToArith256(chainParams.GetConsensus().nMinimumChainWork))
+    if (tip->nChainWork < UintToArith256(chainParams.GetConsensus().nMinimumChainWork))
         return true;
-    if (chainActive.Tip()->GetBlockTime() < (GetTime() - nMaxTipAge))
+    if (tip->nTime < (GetTime() - nMaxTipAge))
         return true;
-    LogPrintf("Leaving InitialBlockDownload (latching to false)\n");
-    latchToFalse.store(true, std::memory_order_relaxed);
+    if (!latchToFalse.exchange(true))
+        LogPrintf("Leaving InitialBlockDownload (latching to false)\n");
     return false;
 }
 
@@ -1867,6 +2834,8 @@ void Misbehaving(NodeId pnode, int howmuch)
     if (howmuch == 0)
         return;
 
+    // Some messages are handled without cs_main held
+    LOCK(cs_main);
     CNodeState *state = State(pnode);
     if (state == NULL)
         return;
@@ -1923,20 +2892,10 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
-            unsigned nPos = txin.prevout.n;
-
-            if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
-                assert(false);
             // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
-            coins->Spend(nPos);
-            if (coins->vout.size() == 0) {
-                CTxInUndo& undo = txundo.vprevout.back();
-                undo.nHeight = coins->nHeight;
-                undo.fCoinBase = coins->fCoinBase;
-                undo.nVersion = coins->nVersion;
-            }
+            txundo.vprevout.emplace_back();
+            bool is_spent = inputs.SpendCoin(txin.prevout, &txundo.vprevout.back());
+            assert(is_spent);
         }
     }
 
@@ -1944,7 +2903,7 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
     inputs.SetNullifiers(tx, true);
 
     // add outputs
-    inputs.ModifyCoins(tx.GetHash())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
@@ -1985,14 +2944,14 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
-            if (coins->IsCoinBase()) {
+            if (coin.IsCoinBase()) {
                 // Ensure that coinbases are matured
-                if (nSpendHeight - coins->nHeight < COINBASE_MATURITY) {
+                if (nSpendHeight - coin.nHeight < COINBASE_MATURITY) {
                     return state.Invalid(
-                        error("CheckInputs(): tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight),
+                        error("CheckInputs(): tried to spend coinbase at depth %d", nSpendHeight - coin.nHeight),
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase");
                 }
 
@@ -2008,8 +2967,8 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, error("CheckInputs(): txin values out of range"),
                                  REJECT_INVALID, "bad-txns-inputvalues-outofrange");
 
@@ -2045,7 +3004,7 @@ bool ContextualCheckInputs(
     bool fScriptChecks,
     unsigned int flags,
     bool cacheStore,
-    PrecomputedTransactionData& txdata,
+    const PrecomputedTransactionData& txdata,
     const Consensus::Params& consensusParams,
     uint32_t consensusBranchId,
     std::vector<CScriptCheck> *pvChecks)
@@ -2069,11 +3028,11 @@ bool ContextualCheckInputs(
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore, consensusBranchId, &txdata);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore, consensusBranchId, &txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -2085,7 +3044,7 @@ bool ContextualCheckInputs(
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check2(*coins, tx, i,
+                        CScriptCheck check2(coin.out, tx, i,
                                 flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, consensusBranchId, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -2110,27 +3069,21 @@ namespace {
 
 bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
-
-    // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, blockundo);
-    fileout << FLATDATA(messageStart) << nSize;
-
-    // Write undo data
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("%s: ftell failed", __func__);
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
-
-    // calculate & write checksum
+    // calculate checksum
     CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
     hasher << hashBlock;
     hasher << blockundo;
-    fileout << hasher.GetHash();
+
+    // Index header, undo data and checksum, written as one record
+    unsigned int nSize = GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss.reserve(MESSAGE_START_SIZE + sizeof(nSize) + nSize + sizeof(uint256));
+    ss << FLATDATA(messageStart) << nSize << blockundo << hasher.GetHash();
+
+    // Append to the open history file
+    LOCK(cs_LastBlockFile);
+    if (!undoFileWriter.Append(pos, ss, MESSAGE_START_SIZE + sizeof(nSize)))
+        return error("%s: writing to %s failed", __func__, pos.ToString());
 
     return true;
 }
@@ -2183,39 +3136,35 @@ bool AbortNode(CValidationState& state, const std::string& strMessage, const std
 } // anon namespace
 
 /**
- * Apply the undo operation of a CTxInUndo to the given chain state.
- * @param undo The undo object.
+ * Restore the UTXO in a Coin at a given COutPoint.
+ * @param undo The Coin to be restored.
  * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
  * @return True on success.
  */
-static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+static bool ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 {
     bool fClean = true;
 
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
-    }
-    if (coins->IsAvailable(out.n))
+    if (view.HaveCoin(out))
         fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
+    if (undo.nHeight == 0) {
+        // Missing undo metadata (height and coinbase). Older versions included this
+        // information only in undo records for the last spend of a transactions'
+        // outputs. This implies that it must be present for some other output of the same tx.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (alternate.IsSpent())
+            return error("%s: undo data adding output to missing transaction", __func__);
+        undo.nHeight = alternate.nHeight;
+        undo.fCoinBase = alternate.fCoinBase;
+    }
+    view.AddCoin(out, std::move(undo), !fClean);
 
     return fClean;
 }
 
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean,
+                     CBlockIndexesUpdate* pindexesUpdate, CBlockUndo* pblockUndo)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
@@ -2224,38 +3173,50 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
 
     bool fClean = true;
 
-    CBlockUndo blockUndo;
-    CDiskBlockPos pos = pindex->GetUndoPos();
-    if (pos.IsNull())
-        return error("DisconnectBlock(): no undo data available");
-    if (!UndoReadFromDisk(blockUndo, pos, pindex->pprev->GetBlockHash()))
-        return error("DisconnectBlock(): failure reading undo data");
+    CBlockUndo blockUndoRead;
+    if (!pblockUndo) {
+        CDiskBlockPos pos = pindex->GetUndoPos();
+        if (pos.IsNull())
+            return error("DisconnectBlock(): no undo data available");
+        if (!UndoReadFromDisk(blockUndoRead, pos, pindex->pprev->GetBlockHash()))
+            return error("DisconnectBlock(): failure reading undo data");
+        pblockUndo = &blockUndoRead;
+    }
+    CBlockUndo& blockUndo = *pblockUndo;
 
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock(): block and undo data inconsistent");
 
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
-        const CTransaction &tx = block.vtx[i];
+        const CTransaction &tx = *block.vtx[i];
         uint256 hash = tx.GetHash();
 
-        // Check that all outputs are available and match the outputs in the block itself
-        // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
+        bool fCoinBase = tx.IsCoinBase();
 
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
+        if (pindexesUpdate && fAddressIndex) {
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                uint160 hashBytes;
+                AddressIndexType type = GetAddressIndexKey(tx.vout[o].scriptPubKey, hashBytes);
+                if (type == ADDRESS_INDEX_NONE)
+                    continue;
+                pindexesUpdate->vAddressIndex.push_back(std::make_pair(
+                    CAddressIndexKey(type, hashBytes, pindex->nHeight, i, hash, o, false), tx.vout[o].nValue));
+                pindexesUpdate->vAddressUnspentIndex.push_back(std::make_pair(
+                    CAddressUnspentKey(type, hashBytes, hash, o), CAddressUnspentValue()));
+            }
+        }
 
-        // remove outputs
-        outs->Clear();
+        // Check that all outputs are available and match the outputs in the block itself
+        // exactly.
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                COutPoint out(hash, o);
+                Coin coin;
+                bool is_spent = view.SpendCoin(out, &coin);
+                if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != coin.nHeight || fCoinBase != coin.fCoinBase)
+                    fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
+            }
         }
 
         // unspend nullifiers
@@ -2263,18 +3224,34 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
 
         // restore inputs
         if (i > 0) { // not coinbases
-            const CTxUndo &txundo = blockUndo.vtxundo[i-1];
+            CTxUndo &txundo = blockUndo.vtxundo[i-1];
             if (txundo.vprevout.size() != tx.vin.size())
                 return error("DisconnectBlock(): transaction and undo data inconsistent");
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
-                const CTxInUndo &undo = txundo.vprevout[j];
-                if (!ApplyTxInUndo(undo, view, out))
+                if (pindexesUpdate && (fAddressIndex || fSpentIndex)) {
+                    const CTxOut &prevout = txundo.vprevout[j].out;
+                    uint160 hashBytes;
+                    AddressIndexType type = GetAddressIndexKey(prevout.scriptPubKey, hashBytes);
+                    if (fAddressIndex && type != ADDRESS_INDEX_NONE) {
+                        pindexesUpdate->vAddressIndex.push_back(std::make_pair(
+                            CAddressIndexKey(type, hashBytes, pindex->nHeight, i, hash, j, true), -prevout.nValue));
+                        pindexesUpdate->vAddressUnspentIndex.push_back(std::make_pair(
+                            CAddressUnspentKey(type, hashBytes, out.hash, out.n),
+                            CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, txundo.vprevout[j].nHeight)));
+                    }
+                    if (fSpentIndex)
+                        pindexesUpdate->vSpentIndex.push_back(std::make_pair(CSpentIndexKey(out.hash, out.n), CSpentIndexValue()));
+                }
+                if (!ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out))
                     fClean = false;
             }
         }
     }
 
+    if (pindexesUpdate && fTimestampIndex)
+        pindexesUpdate->vTimestampIndex.push_back(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash()));
+
     // set the old best Sprout anchor back
     view.PopAnchor(blockUndo.old_sprout_tree_root, SPROUT);
 
@@ -2300,26 +3277,36 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
     return fClean;
 }
 
+/**
+ * Sync the block and undo data of the last block file, and the undo file
+ * being written if that is another one. Finalizing trims the preallocated
+ * space off the last block file and closes it, as nothing is appended to it
+ * again, except undo data of its blocks connected later.
+ */
 void static FlushBlockFile(bool fFinalize = false)
 {
     LOCK(cs_LastBlockFile);
 
-    CDiskBlockPos posOld(nLastBlockFile, 0);
-
-    FILE *fileOld = OpenBlockFile(posOld);
+    FILE *fileOld = blockFileWriter.Open(nLastBlockFile);
     if (fileOld) {
-        if (fFinalize)
+        if (fFinalize) {
+            blockFileMap.Invalidate(nLastBlockFile);
             TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
+        }
         FileCommit(fileOld);
-        fclose(fileOld);
+        if (fFinalize)
+            blockFileWriter.Close();
     }
 
-    fileOld = OpenUndoFile(posOld);
+    if (undoFileWriter.GetFile() >= 0 && undoFileWriter.GetFile() != nLastBlockFile)
+        undoFileWriter.Commit(undoFileWriter.GetFile());
+    fileOld = undoFileWriter.Open(nLastBlockFile);
     if (fileOld) {
         if (fFinalize)
             TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
         FileCommit(fileOld);
-        fclose(fileOld);
+        if (fFinalize)
+            undoFileWriter.Close();
     }
 }
 
@@ -2332,6 +3319,61 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+static CCheckQueue<CCoinPrefetch> coinprefetchqueue(64);
+
+void ThreadCoinPrefetch() {
+    RenameThread("litecoinz-prefetch");
+    coinprefetchqueue.Thread();
+}
+
+/**
+ * Load the inputs of a block that are not in the coins cache yet from its
+ * backing view on the -par worker threads, so that ConnectBlock finds them in
+ * memory instead of reading them from disk one at a time under cs_main.
+ * Nullifiers need no such treatment: the coin database answers lookups of
+ * unspent ones from memory.
+ */
+static void PrefetchBlockInputs(const CBlock& block, CCoinsViewCache& cache, const CCoinsViewCache* pviewAbove = NULL)
+{
+    // With the chainstate in memory there is no disk read to get ahead of
+    if (!nScriptCheckThreads || pcoinsmemory)
+        return;
+
+    std::set<uint256> setBlockTxids;
+    std::vector<COutPoint> vOutPoints;
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+        const CTransaction& tx = *ptx;
+        if (!tx.IsCoinBase()) {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                // Outputs created earlier in this block, or in the layer
+                // above the cache it is connected through, are not on disk.
+                if (!setBlockTxids.count(txin.prevout.hash) && !cache.IsCoinCached(txin.prevout) &&
+                    !(pviewAbove && pviewAbove->IsCoinCached(txin.prevout)))
+                    vOutPoints.push_back(txin.prevout);
+            }
+        }
+        setBlockTxids.insert(tx.GetHash());
+    }
+    if (vOutPoints.size() < 2)
+        return;
+
+    std::vector<Coin> vCoins(vOutPoints.size());
+    std::vector<CCoinPrefetch> vPrefetch;
+    vPrefetch.reserve(vOutPoints.size());
+    for (size_t i = 0; i < vOutPoints.size(); i++) {
+        vPrefetch.push_back(CCoinPrefetch(*cache.GetBackend(), vOutPoints[i], vCoins[i]));
+    }
+    {
+        CCheckQueueControl<CCoinPrefetch> control(&coinprefetchqueue);
+        control.Add(vPrefetch);
+        control.Wait();
+    }
+    for (size_t i = 0; i < vOutPoints.size(); i++) {
+        if (!vCoins[i].IsSpent())
+            cache.WarmCoin(vOutPoints[i], std::move(vCoins[i]));
+    }
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -2393,11 +3435,84 @@ void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const
     }
 }
 
-static int64_t nTimeVerify = 0;
-static int64_t nTimeConnect = 0;
-static int64_t nTimeIndex = 0;
-static int64_t nTimeCallbacks = 0;
-static int64_t nTimeTotal = 0;
+/**
+ * Whether the scripts, JoinSplit and Sapling proofs and signatures, and the
+ * Equihash solution of a block can be taken as verified. That is the case
+ * for ancestors of the -assumevalid block, as long as it is on the best
+ * header chain, that chain has the minimum chain work, and the block is
+ * well below the best header. The coin, nullifier and anchor state is still
+ * updated in full.
+ */
+static bool IsAssumedValid(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    if (hashAssumeValid.IsNull() || pindexBestHeader == NULL)
+        return false;
+    BlockMap::const_iterator it = mapBlockIndex.find(hashAssumeValid);
+    if (it == mapBlockIndex.end())
+        return false;
+    const CBlockIndex* pindexAssumeValid = it->second;
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    return pindexAssumeValid->GetAncestor(pindex->nHeight) == pindex &&
+           pindexBestHeader->GetAncestor(pindexAssumeValid->nHeight) == pindexAssumeValid &&
+           pindexBestHeader->nChainWork >= UintToArith256(consensusParams.nMinimumChainWork) &&
+           GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader, consensusParams) > ASSUME_VALID_MIN_PROOF_TIME;
+}
+
+namespace {
+
+/**
+ * Blocks whose transactions passed TestBlockValidity, such as the templates
+ * handed to miners, most recent first. Guarded by cs_main.
+ */
+std::deque<uint256> dequeCheckedTemplates;
+const size_t MAX_CHECKED_TEMPLATES = 8;
+
+/**
+ * Commits to a block's parent and every transaction but the coinbase, which
+ * pools rewrite. Blocks with the same key have their non-coinbase
+ * transactions verified alike, whatever their header and coinbase.
+ */
+uint256 BlockTemplateKey(const CBlock& block)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << block.hashPrevBlock;
+    for (size_t i = 1; i < block.vtx.size(); i++)
+        ss << block.vtx[i]->GetHash();
+    return ss.GetHash();
+}
+
+} // namespace
+
+static bool IsBlockTemplateChecked(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    if (dequeCheckedTemplates.empty())
+        return false;
+    uint256 key = BlockTemplateKey(block);
+    return std::find(dequeCheckedTemplates.begin(), dequeCheckedTemplates.end(), key) != dequeCheckedTemplates.end();
+}
+
+static void SetBlockTemplateChecked(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    uint256 key = BlockTemplateKey(block);
+    if (std::find(dequeCheckedTemplates.begin(), dequeCheckedTemplates.end(), key) != dequeCheckedTemplates.end())
+        return;
+    dequeCheckedTemplates.push_front(key);
+    if (dequeCheckedTemplates.size() > MAX_CHECKED_TEMPLATES)
+        dequeCheckedTemplates.pop_back();
+}
+
+CBlockConnectStats blockConnectStats;
+
+/** Add the time since nMark to nPhase, and start the next phase */
+static inline void AddPhaseTime(int64_t& nPhase, int64_t& nMark)
+{
+    int64_t nNow = GetTimeMicros();
+    nPhase += nNow - nMark;
+    nMark = nNow;
+}
 
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck)
 {
@@ -2412,13 +3527,41 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             fExpensiveChecks = false;
         }
     }
+    bool fAssumedValid = IsAssumedValid(pindex);
+    if (fAssumedValid)
+        fExpensiveChecks = false;
+
+    // A block solved from a template this node checked, as submitblock
+    // gets, needs neither its scripts nor its JoinSplit proofs verified
+    // again: the same transactions passed ConnectBlock on the same parent.
+    // Its Equihash solution was checked when it arrived, in this run, as
+    // the templates aren't kept across restarts.
+    bool fTemplateChecked = !fJustCheck && IsBlockTemplateChecked(block);
+    if (fTemplateChecked) {
+        fExpensiveChecks = false;
+        LogPrint("bench", "    - Transactions checked with the block template\n");
+    }
 
-    auto verifier = libzcash::ProofVerifier::Strict();
     auto disabledVerifier = libzcash::ProofVerifier::Disabled();
 
-    // Check it again to verify JoinSplit proofs, and in case a previous version let a bad block in
-    if (!CheckBlock(block, state, fExpensiveChecks ? verifier : disabledVerifier, !fJustCheck, !fJustCheck))
+    // JoinSplit proofs are verified per transaction below, so that proofs
+    // already verified at mempool acceptance can be skipped and the rest can
+    // be queued when proof checking threads are available.
+    bool fParallelProofs = fExpensiveChecks && nScriptCheckThreads;
+
+    // A block whose JoinSplit proofs were verified while it waited to be
+    // connected was checked in full, Equihash solution included, when it
+    // arrived.
+    bool fProofsChecked = pindex->nStatus & BLOCK_PROOFS_VALID;
+
+    // Check it again in case a previous version let a bad block in. The
+    // merkle root is always checked, tying the block read from disk to the
+    // header that was checked.
+    int64_t nTimeCheckStart = GetTimeMicros();
+    int64_t nTimeMark = nTimeCheckStart;
+    if (!CheckBlock(block, state, disabledVerifier, !fJustCheck && !fProofsChecked && !fAssumedValid && !fTemplateChecked, !fJustCheck))
         return false;
+    AddPhaseTime(blockConnectStats.nTimeCheckBlock, nTimeMark);
 
     // verify that the view's current state corresponds to the previous block
     uint256 hashPrevBlock = pindex->pprev == NULL ? uint256() : pindex->pprev->GetBlockHash();
@@ -2434,17 +3577,23 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             pindex->hashSproutAnchor = tree.root();
             // The genesis block contained no JoinSplits
             pindex->hashFinalSproutRoot = pindex->hashSproutAnchor;
+            // The genesis coinbase never enters the UTXO set
+            if (fCoinStatsIndex && !pblocktree->WriteCoinStatsIndex(pindex->GetBlockHash(), CCoinStatsRecord()))
+                return AbortNode(state, "Failed to write coin stats index");
         }
         return true;
     }
 
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
     // unless those are already completely spent.
-    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
-        const CCoins* coins = view.AccessCoins(tx.GetHash());
-        if (coins && !coins->IsPruned())
-            return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                             REJECT_INVALID, "bad-txns-BIP30");
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+        const CTransaction& tx = *ptx;
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (view.HaveCoin(COutPoint(tx.GetHash(), o))) {
+                return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
+                                 REJECT_INVALID, "bad-txns-BIP30");
+            }
+        }
     }
 
     unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
@@ -2454,7 +3603,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CBlockUndo blockundo;
 
     CCheckQueueControl<CScriptCheck> control(fExpensiveChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    CCheckQueueControl<CProofCheck> proofControl(fParallelProofs ? &proofcheckqueue : NULL);
 
+    AddPhaseTime(blockConnectStats.nTimeCoins, nTimeMark);
     int64_t nTimeStart = GetTimeMicros();
     CAmount nFees = 0;
     int nInputs = 0;
@@ -2463,6 +3614,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
+    CBlockIndexesUpdate indexesUpdate;
 
     // Construct the incremental merkle tree at the current
     // block position,
@@ -2484,18 +3636,24 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     SaplingMerkleTree sapling_tree;
     assert(view.GetSaplingAnchorAt(view.GetBestAnchor(SAPLING), sapling_tree));
+    // Appended to the tree together once every transaction is connected
+    std::vector<libzcash::PedersenHash> vSaplingCommitments;
 
     // Grab the consensus branch ID for the block's height
     auto consensusBranchId = CurrentEpochBranchId(pindex->nHeight, Params().GetConsensus());
 
-    std::vector<PrecomputedTransactionData> txdata;
-    txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
+    // Transactions accepted to the mempool already carry their sighash
+    // midstates; only the others are hashed here.
+    std::vector<std::shared_ptr<const PrecomputedTransactionData> > txdata;
+    txdata.reserve(block.vtx.size());
+    AddPhaseTime(blockConnectStats.nTimeAnchors, nTimeMark);
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
-        const CTransaction &tx = block.vtx[i];
+        const CTransaction &tx = *block.vtx[i];
 
         nInputs += tx.vin.size();
-        nSigOps += GetLegacySigOpCount(tx);
+        unsigned int nLegacySigOps = GetLegacySigOpCount(tx);
+        nSigOps += nLegacySigOps;
         if (nSigOps > MAX_BLOCK_SIGOPS)
             return state.DoS(100, error("ConnectBlock(): too many sigops"),
                              REJECT_INVALID, "bad-blk-sigops");
@@ -2513,24 +3671,60 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             // Add in sigops done by pay-to-script-hash inputs;
             // this is to prevent a "rogue miner" from creating
-            // an incredibly-expensive-to-validate block.
-            nSigOps += GetP2SHSigOpCount(tx, view);
+            // an incredibly-expensive-to-validate block. The mempool
+            // counted them for its transactions already, and as they only
+            // depend on the outputs spent, its count holds here too.
+            unsigned int nTxSigOps;
+            if (mempool.GetSigOpCount(tx.GetHash(), nTxSigOps))
+                nSigOps += nTxSigOps - nLegacySigOps;
+            else
+                nSigOps += GetP2SHSigOpCount(tx, view);
             if (nSigOps > MAX_BLOCK_SIGOPS)
                 return state.DoS(100, error("ConnectBlock(): too many sigops"),
                                  REJECT_INVALID, "bad-blk-sigops");
         }
 
-        txdata.emplace_back(tx);
+        AddPhaseTime(blockConnectStats.nTimeCoins, nTimeMark);
 
-        if (!tx.IsCoinBase())
-        {
-            nFees += view.GetValueIn(tx)-tx.GetValueOut();
+        std::shared_ptr<const PrecomputedTransactionData> ptxdata;
+        if (!tx.IsCoinBase()) {
+            ptxdata = mempool.GetTxData(tx.GetHash());
+            if (!ptxdata)
+                ptxdata = std::make_shared<PrecomputedTransactionData>(tx);
+        }
+        txdata.push_back(ptxdata);
+        AddPhaseTime(blockConnectStats.nTimeScripts, nTimeMark);
+
+        if (fExpensiveChecks && !fProofsChecked && !tx.vjoinsplit.empty() &&
+            !GetProofCacheEntry(tx.GetHash(), consensusBranchId))
+        {
+            std::vector<CProofCheck> vProofChecks;
+            vProofChecks.reserve(tx.vjoinsplit.size());
+            for (unsigned int js = 0; js < tx.vjoinsplit.size(); js++) {
+                vProofChecks.push_back(CProofCheck(tx, js));
+            }
+            if (fParallelProofs) {
+                proofControl.Add(vProofChecks);
+            } else {
+                BOOST_FOREACH(CProofCheck& check, vProofChecks) {
+                    if (!check())
+                        return state.DoS(100, error("ConnectBlock(): joinsplit does not verify"),
+                                         REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+                }
+            }
+        }
+        AddPhaseTime(blockConnectStats.nTimeProofs, nTimeMark);
+
+        if (!tx.IsCoinBase())
+        {
+            nFees += view.GetValueIn(tx)-tx.GetValueOut();
 
             std::vector<CScriptCheck> vChecks;
-            if (!ContextualCheckInputs(tx, state, view, fExpensiveChecks, flags, false, txdata[i], chainparams.GetConsensus(), consensusBranchId, nScriptCheckThreads ? &vChecks : NULL))
+            if (!ContextualCheckInputs(tx, state, view, fExpensiveChecks, flags, false, *txdata[i], chainparams.GetConsensus(), consensusBranchId, nScriptCheckThreads ? &vChecks : NULL))
                 return false;
             control.Add(vChecks);
         }
+        AddPhaseTime(blockConnectStats.nTimeScripts, nTimeMark);
 
         CTxUndo undoDummy;
         if (i > 0) {
@@ -2538,6 +3732,39 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
         UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
 
+        if (!fJustCheck && (fAddressIndex || fSpentIndex)) {
+            const uint256 hash = tx.GetHash();
+            // The undo data now holds the outputs the inputs spent
+            for (size_t j = 0; i > 0 && j < tx.vin.size(); j++) {
+                const COutPoint &out = tx.vin[j].prevout;
+                const CTxOut &prevout = blockundo.vtxundo.back().vprevout[j].out;
+                uint160 hashBytes;
+                AddressIndexType type = GetAddressIndexKey(prevout.scriptPubKey, hashBytes);
+                if (fAddressIndex && type != ADDRESS_INDEX_NONE) {
+                    indexesUpdate.vAddressIndex.push_back(std::make_pair(
+                        CAddressIndexKey(type, hashBytes, pindex->nHeight, i, hash, j, true), -prevout.nValue));
+                    indexesUpdate.vAddressUnspentIndex.push_back(std::make_pair(
+                        CAddressUnspentKey(type, hashBytes, out.hash, out.n), CAddressUnspentValue()));
+                }
+                if (fSpentIndex)
+                    indexesUpdate.vSpentIndex.push_back(std::make_pair(CSpentIndexKey(out.hash, out.n),
+                        CSpentIndexValue(hash, j, pindex->nHeight, prevout.nValue, type, hashBytes)));
+            }
+            for (size_t k = 0; fAddressIndex && k < tx.vout.size(); k++) {
+                uint160 hashBytes;
+                AddressIndexType type = GetAddressIndexKey(tx.vout[k].scriptPubKey, hashBytes);
+                if (type == ADDRESS_INDEX_NONE)
+                    continue;
+                indexesUpdate.vAddressIndex.push_back(std::make_pair(
+                    CAddressIndexKey(type, hashBytes, pindex->nHeight, i, hash, k, false), tx.vout[k].nValue));
+                indexesUpdate.vAddressUnspentIndex.push_back(std::make_pair(
+                    CAddressUnspentKey(type, hashBytes, hash, k),
+                    CAddressUnspentValue(tx.vout[k].nValue, tx.vout[k].scriptPubKey, pindex->nHeight)));
+            }
+        }
+
+        AddPhaseTime(blockConnectStats.nTimeCoins, nTimeMark);
+
         BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
             BOOST_FOREACH(const uint256 &note_commitment, joinsplit.commitments) {
                 // Insert the note commitments into our temporary tree.
@@ -2547,13 +3774,16 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
 
         BOOST_FOREACH(const OutputDescription &outputDescription, tx.vShieldedOutput) {
-            sapling_tree.append(outputDescription.cm);
+            vSaplingCommitments.push_back(outputDescription.cm);
         }
 
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
         pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        AddPhaseTime(blockConnectStats.nTimeAnchors, nTimeMark);
     }
 
+    sapling_tree.append_many(vSaplingCommitments);
+
     view.PushAnchor(sprout_tree);
     view.PushAnchor(sapling_tree);
     if (!fJustCheck) {
@@ -2571,23 +3801,35 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
     }
 
-    int64_t nTime1 = GetTimeMicros(); nTimeConnect += nTime1 - nTimeStart;
-    LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime1 - nTimeStart) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime1 - nTimeStart) / (nInputs-1), nTimeConnect * 0.000001);
+    AddPhaseTime(blockConnectStats.nTimeAnchors, nTimeMark);
+    int64_t nTime1 = nTimeMark;
+    LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [coins %.2fs, anchors %.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime1 - nTimeStart) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime1 - nTimeStart) / (nInputs-1), blockConnectStats.nTimeCoins * 0.000001, blockConnectStats.nTimeAnchors * 0.000001);
 
     CAmount blockReward = nFees + GetBlockSubsidy(pindex->nHeight, chainparams.GetConsensus());
-    if (block.vtx[0].GetValueOut() > blockReward)
+    if (block.vtx[0]->GetValueOut() > blockReward)
         return state.DoS(100,
                          error("ConnectBlock(): coinbase pays too much (actual=%d vs limit=%d)",
-                               block.vtx[0].GetValueOut(), blockReward),
+                               block.vtx[0]->GetValueOut(), blockReward),
                                REJECT_INVALID, "bad-cb-amount");
 
+    AddPhaseTime(blockConnectStats.nTimeCoins, nTimeMark);
     if (!control.Wait())
         return state.DoS(100, false);
-    int64_t nTime2 = GetTimeMicros(); nTimeVerify += nTime2 - nTimeStart;
-    LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs-1), nTimeVerify * 0.000001);
-
-    if (fJustCheck)
+    AddPhaseTime(blockConnectStats.nTimeScripts, nTimeMark);
+    if (!proofControl.Wait())
+        return state.DoS(100, error("ConnectBlock(): joinsplit does not verify"),
+                         REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+    AddPhaseTime(blockConnectStats.nTimeProofs, nTimeMark);
+    int64_t nTime2 = nTimeMark;
+    blockConnectStats.nBlocks++;
+    blockConnectStats.nTransactions += block.vtx.size();
+    blockConnectStats.nInputs += nInputs - 1;
+    LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [scripts %.2fs, proofs %.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs-1), blockConnectStats.nTimeScripts * 0.000001, blockConnectStats.nTimeProofs * 0.000001);
+
+    if (fJustCheck) {
+        blockConnectStats.nTimeConnect += nTime2 - nTimeCheckStart;
         return true;
+    }
 
     // Write undo information to disk
     if (pindex->GetUndoPos().IsNull() || !pindex->IsValid(BLOCK_VALID_SCRIPTS))
@@ -2619,23 +3861,46 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         setDirtyBlockIndex.insert(pindex);
     }
 
-    if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
+    if (fTimestampIndex)
+        indexesUpdate.vTimestampIndex.push_back(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash()));
+
+    if (!fJustCheck && fCoinStatsIndex) {
+        // Roll the parent's statistics forward by the coins this block
+        // created and the ones its undo data shows it spent
+        CCoinStatsRecord coinStats;
+        if (!pblocktree->ReadCoinStatsIndex(hashPrevBlock, coinStats))
+            return AbortNode(state, "Failed to read coin stats index");
+        for (size_t i = 0; i < block.vtx.size(); i++) {
+            const CTransaction &tx = *block.vtx[i];
+            for (size_t j = 0; i > 0 && j < tx.vin.size(); j++)
+                coinStats.RemoveCoin(tx.vin[j].prevout, blockundo.vtxundo[i - 1].vprevout[j]);
+            for (size_t k = 0; k < tx.vout.size(); k++) {
+                if (!tx.vout[k].scriptPubKey.IsUnspendable())
+                    coinStats.AddCoin(COutPoint(tx.GetHash(), k), Coin(tx.vout[k], pindex->nHeight, tx.IsCoinBase()));
+            }
+        }
+        if (!pblocktree->WriteCoinStatsIndex(pindex->GetBlockHash(), coinStats))
+            return AbortNode(state, "Failed to write coin stats index");
+    }
+
+    if (fTxIndex || fAddressIndex || fSpentIndex || fTimestampIndex)
+        if (!pblocktree->UpdateBlockIndexes(fTxIndex ? vPos : std::vector<std::pair<uint256, CDiskTxPos> >(), indexesUpdate, false))
             return AbortNode(state, "Failed to write transaction index");
 
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
-    int64_t nTime3 = GetTimeMicros(); nTimeIndex += nTime3 - nTime2;
-    LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime3 - nTime2), nTimeIndex * 0.000001);
+    int64_t nTime3 = GetTimeMicros(); blockConnectStats.nTimeIndex += nTime3 - nTime2;
+    LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime3 - nTime2), blockConnectStats.nTimeIndex * 0.000001);
 
     // Watch for changes to the previous coinbase transaction.
     static uint256 hashPrevBestCoinBase;
-    GetMainSignals().UpdatedTransaction(hashPrevBestCoinBase);
-    hashPrevBestCoinBase = block.vtx[0].GetHash();
+    NotifyUpdatedTransaction(hashPrevBestCoinBase);
+    hashPrevBestCoinBase = block.vtx[0]->GetHash();
 
-    int64_t nTime4 = GetTimeMicros(); nTimeCallbacks += nTime4 - nTime3;
-    LogPrint("bench", "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime4 - nTime3), nTimeCallbacks * 0.000001);
+    int64_t nTime4 = GetTimeMicros();
+    blockConnectStats.nTimeConnect += nTime4 - nTimeCheckStart;
+    LogPrint("bench", "    - Callbacks: %.2fms\n", 0.001 * (nTime4 - nTime3));
 
     return true;
 }
@@ -2647,6 +3912,8 @@ enum FlushStateMode {
     FLUSH_STATE_ALWAYS
 };
 
+static void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeight);
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed depending on the mode we're called with
@@ -2658,12 +3925,20 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     static int64_t nLastWrite = 0;
     static int64_t nLastFlush = 0;
     static int64_t nLastSetChain = 0;
+    static int64_t nLastBlockFileSync = 0;
     std::set<int> setFilesToPrune;
     bool fFlushForPrune = false;
     try {
-    if (fPruneMode && fCheckForPruning && !fReindex) {
-        FindFilesToPrune(setFilesToPrune);
-        fCheckForPruning = false;
+    if (pcoinsmemory && pcoinsmemory->SnapshotFailed())
+        return AbortNode(state, "Failed to write a chainstate snapshot to the coin database");
+    if (fPruneMode && (fCheckForPruning || nManualPruneHeight > 0) && !fReindex) {
+        if (nManualPruneHeight > 0) {
+            FindFilesToPruneManual(setFilesToPrune, nManualPruneHeight);
+            nManualPruneHeight = 0;
+        } else {
+            FindFilesToPrune(setFilesToPrune);
+            fCheckForPruning = false;
+        }
         if (!setFilesToPrune.empty()) {
             fFlushForPrune = true;
             if (!fHavePruned) {
@@ -2683,7 +3958,15 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     if (nLastSetChain == 0) {
         nLastSetChain = nNow;
     }
-    size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+    // The anchor and nullifier caches have budgets of their own. Evict what
+    // they can; only the modified remainder that does not fit counts against
+    // the coins cache and forces a flush.
+    pcoinsTip->TrimShieldedCaches(nAnchorCacheUsage, nNullifierCacheUsage);
+    size_t nAnchorsSize = pcoinsTip->DynamicMemoryUsageAnchors();
+    size_t nNullifiersSize = pcoinsTip->DynamicMemoryUsageNullifiers();
+    size_t cacheSize = pcoinsTip->DynamicMemoryUsageCoins() +
+                       (nAnchorsSize > nAnchorCacheUsage ? nAnchorsSize - nAnchorCacheUsage : 0) +
+                       (nNullifiersSize > nNullifierCacheUsage ? nNullifiersSize - nNullifierCacheUsage : 0);
     // The cache is large and close to the limit, but we have time now (not in the middle of a block processing).
     bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize * (10.0/9) > nCoinCacheUsage;
     // The cache is over the limit, we have to write now.
@@ -2692,15 +3975,26 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     bool fPeriodicWrite = mode == FLUSH_STATE_PERIODIC && nNow > nLastWrite + (int64_t)DATABASE_WRITE_INTERVAL * 1000000;
     // It's been very long since we flushed the cache. Do this infrequently, to optimize cache usage.
     bool fPeriodicFlush = mode == FLUSH_STATE_PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
-    // Combine all conditions that result in a full cache flush.
-    bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
+    // Combine all conditions that result in a full cache flush. With the
+    // chainstate in memory that is no disk write, so a snapshot of it is
+    // also taken whenever the block index is written.
+    bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune ||
+                        (pcoinsmemory && fPeriodicWrite);
     // Write blocks and block index to disk.
     if (fDoFullFlush || fPeriodicWrite) {
         // Depend on nMinDiskSpace to ensure we can write block index
         if (!CheckDiskSpace(0))
             return state.Error("out of disk space");
-        // First make sure all block and undo data is flushed to disk.
-        FlushBlockFile();
+        HistogramTimer timer(blockIndexWriteTime);
+        // First make sure all block and undo data is flushed to disk. With
+        // -blockfilesync that is batched over several index writes, except
+        // before files are pruned or at shutdown; a crash in between may
+        // lose blocks the index says we have, which -reindex recovers.
+        if (nBlockFileSyncInterval == 0 || mode == FLUSH_STATE_ALWAYS || fFlushForPrune ||
+            nNow > nLastBlockFileSync + nBlockFileSyncInterval * 1000000) {
+            FlushBlockFile();
+            nLastBlockFileSync = nNow;
+        }
         // Then update all block file information (which may refer to block and undo files).
         {
             std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
@@ -2718,6 +4012,15 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
             if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
                 return AbortNode(state, "Files to write to block index database");
             }
+            // The solutions just written can be read back from now on
+            LOCK(cs_blockSolutions);
+            BOOST_FOREACH(const CBlockIndex* pindex, vBlocks) {
+                map<uint256, std::vector<unsigned char> >::iterator it = mapUnwrittenSolutions.find(pindex->GetBlockHash());
+                if (it != mapUnwrittenSolutions.end()) {
+                    CacheBlockSolution(it->first, it->second);
+                    mapUnwrittenSolutions.erase(it);
+                }
+            }
         }
         // Finally remove any pruned files
         if (fFlushForPrune)
@@ -2726,21 +4029,44 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
     if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+        // Typical Coin structures on disk are around 48 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
-            return AbortNode(state, "Failed to write to coin database");
+        // Only empty the cache when it is memory we are short of; periodic
+        // and prune flushes write it back and keep the working set. Even
+        // then only the coins are dropped: the anchor and nullifier caches
+        // are kept within their own budgets instead.
+        bool fEmptyCache = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical;
+        {
+            HistogramTimer timer(chainstateFlushTime);
+            if (!pcoinsTip->Sync())
+                return AbortNode(state, "Failed to write to coin database");
+        }
+        if (pcoinsmemory) {
+            // At shutdown, and before block files the snapshot may need to
+            // replay from are pruned, the coin database is brought up to
+            // date now; otherwise in the background, once the block index
+            // is written.
+            if (mode == FLUSH_STATE_ALWAYS || fFlushForPrune) {
+                if (!pcoinsmemory->WriteSnapshot())
+                    return AbortNode(state, "Failed to write a chainstate snapshot to the coin database");
+            } else if (fPeriodicWrite || fPeriodicFlush) {
+                pcoinsmemory->RequestSnapshot();
+            }
+        }
+        if (fEmptyCache)
+            pcoinsTip->ClearCoins();
+        pcoinsTip->TrimShieldedCaches(nAnchorCacheUsage, nNullifierCacheUsage);
         nLastFlush = nNow;
     }
     if ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000) {
         // Update best block in wallet (so we can detect restored wallets).
-        GetMainSignals().SetBestChain(chainActive.GetLocator());
+        NotifySetBestChain(chainActive.GetLocator());
         nLastSetChain = nNow;
     }
     } catch (const std::runtime_error& e) {
@@ -2761,18 +4087,48 @@ void PruneAndFlush() {
 }
 
 /** Update chainActive and related internal data structures. */
+// Only replaced under cs_main, but read without it
+static std::shared_ptr<const CChainTipSnapshot> chainTipSnapshot;
+
+std::shared_ptr<const CChainTipSnapshot> GetChainTipSnapshot()
+{
+    return std::atomic_load(&chainTipSnapshot);
+}
+
+/** Publish chainActive's tip, after each change of it */
+static void PublishChainTip() EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    const CBlockIndex* pindex = chainActive.Tip();
+    std::shared_ptr<CChainTipSnapshot> tip;
+    if (pindex) {
+        tip = std::make_shared<CChainTipSnapshot>();
+        tip->hash = pindex->GetBlockHash();
+        tip->nHeight = pindex->nHeight;
+        tip->nTime = pindex->GetBlockTime();
+        tip->nMedianTimePast = pindex->GetMedianTimePast();
+        tip->nChainWork = pindex->nChainWork;
+        tip->hashFinalSproutRoot = pindex->hashFinalSproutRoot;
+        tip->hashFinalSaplingRoot = pindex->hashFinalSaplingRoot;
+        tip->nNetworkSolPS = GetNetworkSolPS(pindex, DEFAULT_SOLPS_LOOKUP, Params().GetConsensus());
+    }
+    std::atomic_store(&chainTipSnapshot, std::shared_ptr<const CChainTipSnapshot>(tip));
+}
+
 void static UpdateTip(CBlockIndex *pindexNew) {
     const CChainParams& chainParams = Params();
     chainActive.SetTip(pindexNew);
+    PublishChainTip();
+    Trace(TRACE_BLOCK_TIP_UPDATED, pindexNew->GetBlockHash(), -1, pindexNew->nHeight);
 
     // New best block
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("%s: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n", __func__,
+    LogPrintf("%s: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx) anchors=%.1fMiB nullifiers=%.1fMiB\n", __func__,
       chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble())/log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
       DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-      Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1<<20)), pcoinsTip->GetCacheSize());
+      Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip()), pcoinsTip->DynamicMemoryUsageCoins() * (1.0 / (1<<20)), pcoinsTip->GetCacheSize(),
+      pcoinsTip->DynamicMemoryUsageAnchors() * (1.0 / (1<<20)), pcoinsTip->DynamicMemoryUsageNullifiers() * (1.0 / (1<<20)));
 
     cvBlockChange.notify_all();
 
@@ -2800,43 +4156,95 @@ void static UpdateTip(CBlockIndex *pindexNew) {
     }
 }
 
+/**
+ * Blocks at the tip being rewound together by DisconnectTipsTo, read ahead
+ * with their undo data, and the cache layer they are disconnected into.
+ * vBlocks[0] is the tip the batch started from.
+ */
+struct CRewindBatch
+{
+    CCoinsViewCache view;
+    std::vector<CBlock> vBlocks;
+    std::vector<CBlockUndo> vBlockUndo;
+    size_t nNext;
+
+    CRewindBatch(CCoinsView* viewIn) : view(viewIn), nNext(0) {}
+};
+
 /**
  * Disconnect chainActive's tip. You probably want to call mempool.removeForReorg and
- * mempool.removeWithoutBranchId after this, with cs_main held.
+ * mempool.removeWithoutBranchId after this, with cs_main held. With pbatch the
+ * block comes from the batch and is disconnected into its view, which the
+ * caller flushes; the mempool isn't touched then, so fBare must be set.
  */
-bool static DisconnectTip(CValidationState &state, bool fBare = false) {
+bool static DisconnectTip(CValidationState &state, bool fBare = false, CRewindBatch* pbatch = NULL) {
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
+    assert(!pbatch || fBare);
     // Read block from disk.
-    CBlock block;
-    if (!ReadBlockFromDisk(block, pindexDelete))
+    CBlock blockRead;
+    if (!pbatch && !ReadBlockFromDisk(blockRead, pindexDelete))
         return AbortNode(state, "Failed to read block");
+    const CBlock& block = pbatch ? pbatch->vBlocks[pbatch->nNext] : blockRead;
+    CCoinsViewCache& viewTip = pbatch ? pbatch->view : *pcoinsTip;
     // Apply the block atomically to the chain state.
-    uint256 sproutAnchorBeforeDisconnect = pcoinsTip->GetBestAnchor(SPROUT);
-    uint256 saplingAnchorBeforeDisconnect = pcoinsTip->GetBestAnchor(SAPLING);
+    uint256 sproutAnchorBeforeDisconnect = viewTip.GetBestAnchor(SPROUT);
+    uint256 saplingAnchorBeforeDisconnect = viewTip.GetBestAnchor(SAPLING);
     int64_t nStart = GetTimeMicros();
-    {
+    CBlockIndexesUpdate indexesUpdate;
+    if (pbatch) {
+        if (!DisconnectBlock(block, state, pindexDelete, pbatch->view, NULL, &indexesUpdate, &pbatch->vBlockUndo[pbatch->nNext]))
+            return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
+        pbatch->nNext++;
+    } else {
         CCoinsViewCache view(pcoinsTip);
-        if (!DisconnectBlock(block, state, pindexDelete, view))
+        if (!DisconnectBlock(block, state, pindexDelete, view, NULL, &indexesUpdate))
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
     }
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
-    uint256 sproutAnchorAfterDisconnect = pcoinsTip->GetBestAnchor(SPROUT);
-    uint256 saplingAnchorAfterDisconnect = pcoinsTip->GetBestAnchor(SAPLING);
-    // Write the chain state to disk, if necessary.
-    if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
+    uint256 sproutAnchorAfterDisconnect = viewTip.GetBestAnchor(SPROUT);
+    uint256 saplingAnchorAfterDisconnect = viewTip.GetBestAnchor(SAPLING);
+    // Write the chain state to disk, if necessary. A batch must reach
+    // pcoinsTip first.
+    if (!pbatch && !FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
+    if (fShieldedIndex && !pblocktree->EraseShieldedIndex(pindexDelete->GetBlockHash()))
+        return AbortNode(state, "Failed to erase shielded index");
+    // The coin stats record of the block is left in place: it still
+    // describes the block, and the chain state may not be flushed past it
+    // before a crash.
+    if ((fAddressIndex || fSpentIndex || fTimestampIndex) &&
+        !pblocktree->UpdateBlockIndexes(std::vector<std::pair<uint256, CDiskTxPos> >(), indexesUpdate, true))
+        return AbortNode(state, "Failed to update address indexes");
+    // The transactions stay in the tx index, pointing at this block, but
+    // the cache only holds transactions of the active chain
+    if (fTxIndex) {
+        for (const CTransactionRef& ptx : block.vtx)
+            txIndexCache.Erase(ptx->GetHash());
+    }
+    responseCache.BlockDisconnected(pindexDelete->nHeight);
 
     if (!fBare) {
         // Resurrect mempool transactions from the disconnected block.
-        BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+        std::vector<uint256> vHashUpdate;
+        BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+            const CTransaction& tx = *ptx;
             // ignore validation errors in resurrected transactions
             list<CTransaction> removed;
             CValidationState stateDummy;
-            if (tx.IsCoinBase() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL))
+            if (tx.IsCoinBase() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL, false, true))
                 mempool.remove(tx, removed, true);
-        }
+            else if (mempool.exists(tx.GetHash()))
+                vHashUpdate.push_back(tx.GetHash());
+        }
+        // AcceptToMemoryPool/addUnchecked assume that a new entry has no
+        // in-mempool children, which is generally not true of transactions
+        // coming back from a disconnected block.
+        mempool.UpdateTransactionsFromBlock(vHashUpdate);
+        // The limit was not enforced while adding them back, so that
+        // eviction would see complete packages.
+        LimitMempoolSize(mempool);
         if (sproutAnchorBeforeDisconnect != sproutAnchorAfterDisconnect) {
             // The anchor may not change between block disconnects,
             // in which case we don't want to evict from the mempool yet!
@@ -2854,30 +4262,113 @@ bool static DisconnectTip(CValidationState &state, bool fBare = false) {
     // Get the current commitment tree
     SproutMerkleTree newSproutTree;
     SaplingMerkleTree newSaplingTree;
-    assert(pcoinsTip->GetSproutAnchorAt(pcoinsTip->GetBestAnchor(SPROUT), newSproutTree));
-    assert(pcoinsTip->GetSaplingAnchorAt(pcoinsTip->GetBestAnchor(SAPLING), newSaplingTree));
+    assert(viewTip.GetSproutAnchorAt(viewTip.GetBestAnchor(SPROUT), newSproutTree));
+    assert(viewTip.GetSaplingAnchorAt(viewTip.GetBestAnchor(SAPLING), newSaplingTree));
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
-    BOOST_FOREACH(const CTransaction &tx, block.vtx) {
-        SyncWithWallets(tx, NULL);
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+        SyncWithWallets(ptx);
+    }
+    // Update cached incremental witnesses. The listeners may run after the
+    // block here is gone, so they get a copy.
+    NotifyChainTip(pindexDelete, std::make_shared<const CBlock>(block), newSproutTree, newSaplingTree, false);
+    return true;
+}
+
+/**
+ * Disconnect chainActive's tip down to height nHeight without touching the
+ * mempool. Blocks are taken REWIND_BATCH_SIZE at a time: the -par threads
+ * read them and their undo data ahead, they are disconnected into a single
+ * cache layer, and that is flushed to pcoinsTip once per batch rather than
+ * once per block. Pruned nodes stop at the first block without data.
+ */
+static bool DisconnectTipsTo(CValidationState& state, int nHeight)
+{
+    AssertLockHeld(cs_main);
+    int nStartHeight = chainActive.Height();
+    if (nStartHeight <= nHeight)
+        return true;
+    LogPrintf("Rewinding %d blocks from height %d\n", nStartHeight - nHeight, nStartHeight);
+    uiInterface.ShowProgress(_("Rewinding blocks..."), 0);
+    int64_t nStart = GetTimeMicros();
+
+    while (chainActive.Height() > nHeight) {
+        // If pruning, don't try rewinding past the HAVE_DATA point;
+        // since older blocks can't be served anyway, there's
+        // no need to walk further, and trying to DisconnectTip()
+        // will fail (and require a needless reindex/redownload
+        // of the blockchain).
+        std::vector<CBlockIndex*> vpindex;
+        for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->nHeight > nHeight && (int)vpindex.size() < REWIND_BATCH_SIZE; pindex = pindex->pprev) {
+            if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA))
+                break;
+            vpindex.push_back(pindex);
+        }
+        if (vpindex.empty())
+            break;
+
+        CRewindBatch batch(pcoinsTip);
+        batch.vBlocks.resize(vpindex.size());
+        batch.vBlockUndo.resize(vpindex.size());
+        std::vector<char> vfRead(vpindex.size(), false);
+        std::atomic<size_t> nNext(0);
+        auto read = [&]() {
+            for (size_t i = nNext++; i < vpindex.size(); i = nNext++) {
+                CDiskBlockPos pos = vpindex[i]->GetUndoPos();
+                vfRead[i] = ReadBlockFromDisk(batch.vBlocks[i], vpindex[i]) && !pos.IsNull() &&
+                            UndoReadFromDisk(batch.vBlockUndo[i], pos, vpindex[i]->pprev->GetBlockHash());
+            }
+        };
+        boost::thread_group workers;
+        for (int i = 1; i < std::min<int>(vpindex.size(), nScriptCheckThreads); i++)
+            workers.create_thread(read);
+        read();
+        workers.join_all();
+
+        for (size_t i = 0; i < vpindex.size(); i++) {
+            if (!vfRead[i])
+                return AbortNode(state, strprintf("Failed to read block or undo data at height %d", vpindex[i]->nHeight));
+            if (!DisconnectTip(state, true, &batch))
+                return false;
+        }
+        assert(batch.view.Flush());
+        // Occasionally flush state to disk.
+        if (!FlushStateToDisk(state, FLUSH_STATE_PERIODIC))
+            return false;
+
+        int nDone = nStartHeight - chainActive.Height();
+        LogPrintf("Rewound to height %d, %d of %d blocks (%.2fs)\n", chainActive.Height(), nDone, nStartHeight - nHeight,
+            (GetTimeMicros() - nStart) * 0.000001);
+        uiInterface.ShowProgress(_("Rewinding blocks..."), std::max(1, std::min(99, (int)(nDone * 100.0 / (nStartHeight - nHeight)))));
     }
-    // Update cached incremental witnesses
-    GetMainSignals().ChainTip(pindexDelete, &block, newSproutTree, newSaplingTree, false);
+
+    uiInterface.ShowProgress("", 100);
     return true;
 }
 
-static int64_t nTimeReadFromDisk = 0;
-static int64_t nTimeConnectTotal = 0;
-static int64_t nTimeFlush = 0;
-static int64_t nTimeChainState = 0;
-static int64_t nTimePostConnect = 0;
+/**
+ * Blocks connected together by ActivateBestChainStep during initial block
+ * download. Each is connected into a layer over view, which is flushed to
+ * pcoinsTip once for the run by FlushConnectBatch, so that outputs created
+ * and spent within the run never reach pcoinsTip. The wallet notifications
+ * of the run are queued together then.
+ */
+struct CConnectBatch
+{
+    CCoinsViewCache view;
+    std::vector<CConnectedBlock> vConnected;
+
+    CConnectBatch(CCoinsView* viewIn) : view(viewIn) {}
+};
 
 /**
  * Connect a new block to chainActive. pblock is either NULL or a pointer to a CBlock
  * corresponding to pindexNew, to bypass loading it again from disk.
  * You probably want to call mempool.removeWithoutBranchId after this, with cs_main held.
+ * With pbatch the block is connected into the batch's view, and the chain state
+ * write and wallet notifications are left to FlushConnectBatch.
  */
-bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, const CBlock *pblock) {
+bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, const CBlock *pblock, CConnectBatch* pbatch = NULL) {
     assert(pindexNew->pprev == chainActive.Tip());
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
@@ -2887,17 +4378,19 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, const CB
             return AbortNode(state, "Failed to read block");
         pblock = &block;
     }
+    CCoinsViewCache& viewTip = pbatch ? pbatch->view : *pcoinsTip;
     // Get the current commitment tree
     SproutMerkleTree oldSproutTree;
     SaplingMerkleTree oldSaplingTree;
-    assert(pcoinsTip->GetSproutAnchorAt(pcoinsTip->GetBestAnchor(SPROUT), oldSproutTree));
-    assert(pcoinsTip->GetSaplingAnchorAt(pcoinsTip->GetBestAnchor(SAPLING), oldSaplingTree));
+    assert(viewTip.GetSproutAnchorAt(viewTip.GetBestAnchor(SPROUT), oldSproutTree));
+    assert(viewTip.GetSaplingAnchorAt(viewTip.GetBestAnchor(SAPLING), oldSaplingTree));
     // Apply the block atomically to the chain state.
-    int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
+    PrefetchBlockInputs(*pblock, *pcoinsTip, pbatch ? &pbatch->view : NULL);
+    int64_t nTime2 = GetTimeMicros(); blockConnectStats.nTimeLoad += nTime2 - nTime1;
     int64_t nTime3;
-    LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    LogPrint("bench", "  - Load block and inputs from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, blockConnectStats.nTimeLoad * 0.000001);
     {
-        CCoinsViewCache view(pcoinsTip);
+        CCoinsViewCache view(&viewTip);
         bool rv = ConnectBlock(*pblock, state, pindexNew, view);
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
@@ -2906,46 +4399,84 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, const CB
             return error("ConnectTip(): ConnectBlock %s failed", pindexNew->GetBlockHash().ToString());
         }
         mapBlockSource.erase(pindexNew->GetBlockHash());
-        nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
-        LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
+        nTime3 = GetTimeMicros();
+        LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, blockConnectStats.nTimeConnect * 0.000001);
         assert(view.Flush());
     }
-    int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
-    LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
+    int64_t nTime4 = GetTimeMicros(); blockConnectStats.nTimeFlush += nTime4 - nTime3;
+    LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, blockConnectStats.nTimeFlush * 0.000001);
     // Write the chain state to disk, if necessary.
-    if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
+    if (!pbatch && !FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
-    int64_t nTime5 = GetTimeMicros(); nTimeChainState += nTime5 - nTime4;
-    LogPrint("bench", "  - Writing chainstate: %.2fms [%.2fs]\n", (nTime5 - nTime4) * 0.001, nTimeChainState * 0.000001);
+    if (fShieldedIndex && !pblocktree->WriteShieldedIndex(pindexNew->GetBlockHash(), CCompactShieldedBlock(*pblock)))
+        return AbortNode(state, "Failed to write shielded index");
+    int64_t nTime5 = GetTimeMicros(); blockConnectStats.nTimeChainState += nTime5 - nTime4;
+    LogPrint("bench", "  - Writing chainstate: %.2fms [%.2fs]\n", (nTime5 - nTime4) * 0.001, blockConnectStats.nTimeChainState * 0.000001);
     // Remove conflicting transactions from the mempool.
     list<CTransaction> txConflicted;
     mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted, !IsInitialBlockDownload());
+    EraseOrphansForBlock(*pblock);
 
     // Remove transactions that expire at new block height from mempool
     mempool.removeExpired(pindexNew->nHeight);
 
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
-    // Tell wallet about transactions that went from mempool
-    // to conflicted:
-    BOOST_FOREACH(const CTransaction &tx, txConflicted) {
-        SyncWithWallets(tx, NULL);
-    }
-    // ... and about transactions that got confirmed:
-    BOOST_FOREACH(const CTransaction &tx, pblock->vtx) {
-        SyncWithWallets(tx, pblock);
+    // The listeners may run after the caller's block is gone, so they share a copy.
+    std::shared_ptr<const CBlock> pblockShared = std::make_shared<const CBlock>(*pblock);
+    if (pbatch) {
+        CConnectedBlock connected;
+        connected.pindex = pindexNew;
+        connected.pblock = pblockShared;
+        connected.sproutTree = oldSproutTree;
+        connected.saplingTree = oldSaplingTree;
+        BOOST_FOREACH(const CTransaction &tx, txConflicted) {
+            connected.vtxConflicted.push_back(std::make_shared<const CTransaction>(tx));
+        }
+        pbatch->vConnected.push_back(std::move(connected));
+    } else {
+        // Tell wallet about transactions that went from mempool
+        // to conflicted:
+        BOOST_FOREACH(const CTransaction &tx, txConflicted) {
+            SyncWithWallets(tx);
+        }
+        // ... and about transactions that got confirmed.
+        SyncBlockWithWallets(pblockShared);
+        // Update cached incremental witnesses
+        NotifyChainTip(pindexNew, pblockShared, oldSproutTree, oldSaplingTree, true);
     }
-    // Update cached incremental witnesses
-    GetMainSignals().ChainTip(pindexNew, pblock, oldSproutTree, oldSaplingTree, true);
 
     EnforceNodeDeprecation(pindexNew->nHeight);
 
-    int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
-    LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
-    LogPrint("bench", "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
+    int64_t nTime6 = GetTimeMicros(); blockConnectStats.nTimePostConnect += nTime6 - nTime5; blockConnectStats.nTimeTotal += nTime6 - nTime1;
+    blockConnectTime.observe(nTime6 - nTime1);
+    Trace(TRACE_BLOCK_CONNECTED, pindexNew->GetBlockHash(), -1, pindexNew->nHeight, nTime6 - nTime1);
+    if (!IsInitialBlockDownload()) {
+        for (size_t i = 1; i < pblock->vtx.size(); i++)
+            Trace(TRACE_TX_MINED, pblock->vtx[i]->GetHash(), -1, pindexNew->nHeight);
+    }
+    LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, blockConnectStats.nTimePostConnect * 0.000001);
+    LogPrint("bench", "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, blockConnectStats.nTimeTotal * 0.000001);
     return true;
 }
 
+/**
+ * Merge the blocks connected into batch into pcoinsTip, write the chain state
+ * if it is due, and queue the wallet notifications of the blocks.
+ */
+static bool FlushConnectBatch(CValidationState& state, CConnectBatch& batch)
+{
+    if (batch.vConnected.empty())
+        return true;
+    int64_t nTimeStart = GetTimeMicros();
+    assert(batch.view.Flush());
+    blockConnectStats.nTimeFlush += GetTimeMicros() - nTimeStart;
+    LogPrint("bench", "- Flush %u connected blocks: %.2fms\n", batch.vConnected.size(), (GetTimeMicros() - nTimeStart) * 0.001);
+    NotifyBlocksConnected(std::move(batch.vConnected));
+    batch.vConnected.clear();
+    return FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED);
+}
+
 /**
  * Return the tip of the chain with the most work in it, that isn't
  * known to be invalid (it's however far from certain to be valid).
@@ -3076,9 +4607,24 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
         }
         nHeight = nTargetHeight;
 
+        // During initial block download the whole run is connected at once,
+        // through a single cache layer, rather than returning to release the
+        // lock after every block.
+        std::unique_ptr<CConnectBatch> pbatch;
+        if (vpindexToConnect.size() > 1 && IsInitialBlockDownload())
+            pbatch.reset(new CConnectBatch(pcoinsTip));
+
         // Connect new blocks.
         BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect) {
-            if (!ConnectTip(state, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL)) {
+            if (!ConnectTip(state, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL, pbatch.get())) {
+                // The blocks before it are on chainActive already
+                if (pbatch) {
+                    CValidationState stateFlush;
+                    if (!FlushConnectBatch(stateFlush, *pbatch)) {
+                        state = stateFlush;
+                        return false;
+                    }
+                }
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible())
@@ -3093,6 +4639,8 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
                 }
             } else {
                 PruneBlockIndexCandidates();
+                if (pbatch)
+                    continue;
                 if (!pindexOldTip || chainActive.Tip()->nChainWork > pindexOldTip->nChainWork) {
                     // We're in a better position than we were. Return temporarily to release the lock.
                     fContinue = false;
@@ -3100,6 +4648,13 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
                 }
             }
         }
+        if (pbatch && fContinue) {
+            // The whole run connected
+            if (!FlushConnectBatch(state, *pbatch))
+                return false;
+            if (!pindexOldTip || chainActive.Tip()->nChainWork > pindexOldTip->nChainWork)
+                fContinue = false;
+        }
     }
 
     if (fBlocksDisconnected) {
@@ -3157,13 +4712,29 @@ bool ActivateBestChain(CValidationState &state, const CBlock *pblock) {
             if (fCheckpointsEnabled)
                 nBlockEstimate = Checkpoints::GetTotalBlocksEstimate(chainParams.Checkpoints());
             {
-                LOCK(cs_vNodes);
-                BOOST_FOREACH(CNode* pnode, vNodes)
-                    if (chainActive.Height() > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
+                // Peers that asked for it get the new block as a cmpctblock
+                // straight away, which is only possible if it is the block
+                // we were handed.
+                CMessageBuffer cmpctblock;
+                if (pblock && pblock->GetHash() == hashNewTip)
+                    cmpctblock = CNode::MakeMessage("cmpctblock", CBlockHeaderAndShortTxIDs(*pblock));
+                LOCK2(cs_main, cs_vNodes);
+                BOOST_FOREACH(CNode* pnode, vNodes) {
+                    if (chainActive.Height() <= (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
+                        continue;
+                    CNodeState *nodestate = State(pnode->GetId());
+                    if (cmpctblock && nodestate && nodestate->fPreferHighBandwidth && !pnode->fDisconnect) {
+                        LogPrint("cmpctblock", "sending cmpctblock %s to peer=%d\n", hashNewTip.ToString(), pnode->id);
+                        pnode->AddInventoryKnown(CInv(MSG_BLOCK, hashNewTip));
+                        pnode->PushMessageBuffer(cmpctblock);
+                    } else {
                         pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                    }
+                }
+                Trace(TRACE_BLOCK_RELAYED, hashNewTip, -1, pindexNewTip->nHeight);
             }
             // Notify external listeners about the new tip.
-            GetMainSignals().UpdatedBlockTip(pindexNewTip);
+            NotifyUpdatedBlockTip(pindexNewTip);
             uiInterface.NotifyBlockTip(hashNewTip);
         }
     } while(pindexMostWork != chainActive.Tip());
@@ -3259,14 +4830,18 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
+    *pindexNew = CBlockIndex(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
     pindexNew->nSequenceId = 0;
     BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
+    {
+        LOCK(cs_blockSolutions);
+        mapUnwrittenSolutions[hash] = block.nSolution;
+    }
     BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
     if (miPrev != mapBlockIndex.end())
     {
@@ -3291,14 +4866,14 @@ bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBl
     pindexNew->nChainTx = 0;
     CAmount sproutValue = 0;
     CAmount saplingValue = 0;
-    for (auto tx : block.vtx) {
+    for (const CTransactionRef& tx : block.vtx) {
         // Negative valueBalance "takes" money from the transparent value pool
         // and adds it to the Sapling value pool. Positive valueBalance "gives"
         // money to the transparent value pool, removing from the Sapling value
         // pool. So we invert the sign here.
-        saplingValue += -tx.valueBalance;
+        saplingValue += -tx->valueBalance;
 
-        for (auto js : tx.vjoinsplit) {
+        for (const JSDescription& js : tx->vjoinsplit) {
             sproutValue += js.vpub_old;
             sproutValue -= js.vpub_new;
         }
@@ -3313,6 +4888,10 @@ bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBl
     pindexNew->nStatus |= BLOCK_HAVE_DATA;
     pindexNew->RaiseValidity(BLOCK_VALID_TRANSACTIONS);
     setDirtyBlockIndex.insert(pindexNew);
+    {
+        LOCK(cs_LastBlockFile);
+        AddToBlockFileList(pindexNew);
+    }
 
     if (pindexNew->pprev == NULL || pindexNew->pprev->nChainTx) {
         // If pindexNew is the genesis block or all parents are BLOCK_VALID_TRANSACTIONS.
@@ -3364,6 +4943,14 @@ bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBl
     return true;
 }
 
+/** Like CheckDiskSpace(), for the volume holding block file nFile */
+static bool CheckBlockFileSpace(int nFile, uint64_t nAdditionalBytes)
+{
+    if (blockVolumes.GetAvailableSpace(nFile) < nMinDiskSpace + nAdditionalBytes)
+        return AbortNode("Disk space is low!", _("Error: Disk space is low!"));
+    return true;
+}
+
 bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAddSize, unsigned int nHeight, uint64_t nTime, bool fKnown = false)
 {
     LOCK(cs_LastBlockFile);
@@ -3382,6 +4969,8 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         }
         pos.nFile = nFile;
         pos.nPos = vinfoBlockFile[nFile].nSize;
+        if (pos.nPos == 0)
+            blockVolumes.PlaceNewFile(nFile);
     }
 
     if (nFile != nLastBlockFile) {
@@ -3399,17 +4988,18 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         vinfoBlockFile[nFile].nSize += nAddSize;
 
     if (!fKnown) {
-        unsigned int nOldChunks = (pos.nPos + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
-        unsigned int nNewChunks = (vinfoBlockFile[nFile].nSize + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
+        // Pruned nodes keep to the small chunks their disk usage target allows for
+        unsigned int nChunkSize = fPruneMode ? BLOCKFILE_CHUNK_SIZE : BLOCKFILE_PREALLOC_SIZE;
+        unsigned int nOldChunks = (pos.nPos + nChunkSize - 1) / nChunkSize;
+        unsigned int nNewChunks = (vinfoBlockFile[nFile].nSize + nChunkSize - 1) / nChunkSize;
         if (nNewChunks > nOldChunks) {
             if (fPruneMode)
                 fCheckForPruning = true;
-            if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos)) {
-                FILE *file = OpenBlockFile(pos);
+            if (CheckBlockFileSpace(pos.nFile, nNewChunks * nChunkSize - pos.nPos)) {
+                FILE *file = blockFileWriter.Open(pos.nFile);
                 if (file) {
-                    LogPrintf("Pre-allocating up to position 0x%x in blk%05u.dat\n", nNewChunks * BLOCKFILE_CHUNK_SIZE, pos.nFile);
-                    AllocateFileRange(file, pos.nPos, nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos);
-                    fclose(file);
+                    LogPrintf("Pre-allocating up to position 0x%x in blk%05u.dat\n", nNewChunks * nChunkSize, pos.nFile);
+                    AllocateFileRange(file, pos.nPos, nNewChunks * nChunkSize - pos.nPos);
                 }
             }
             else
@@ -3432,17 +5022,17 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     nNewSize = vinfoBlockFile[nFile].nUndoSize += nAddSize;
     setDirtyFileInfo.insert(nFile);
 
-    unsigned int nOldChunks = (pos.nPos + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
-    unsigned int nNewChunks = (nNewSize + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
+    unsigned int nChunkSize = fPruneMode ? UNDOFILE_CHUNK_SIZE : UNDOFILE_PREALLOC_SIZE;
+    unsigned int nOldChunks = (pos.nPos + nChunkSize - 1) / nChunkSize;
+    unsigned int nNewChunks = (nNewSize + nChunkSize - 1) / nChunkSize;
     if (nNewChunks > nOldChunks) {
         if (fPruneMode)
             fCheckForPruning = true;
-        if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos)) {
-            FILE *file = OpenUndoFile(pos);
+        if (CheckBlockFileSpace(pos.nFile, nNewChunks * nChunkSize - pos.nPos)) {
+            FILE *file = undoFileWriter.Open(pos.nFile);
             if (file) {
-                LogPrintf("Pre-allocating up to position 0x%x in rev%05u.dat\n", nNewChunks * UNDOFILE_CHUNK_SIZE, pos.nFile);
-                AllocateFileRange(file, pos.nPos, nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos);
-                fclose(file);
+                LogPrintf("Pre-allocating up to position 0x%x in rev%05u.dat\n", nNewChunks * nChunkSize, pos.nFile);
+                AllocateFileRange(file, pos.nPos, nNewChunks * nChunkSize - pos.nPos);
             }
         }
         else
@@ -3452,7 +5042,30 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     return true;
 }
 
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW)
+/**
+ * Hashes of headers whose Equihash solution has been verified. The hash
+ * commits to the solution, so a header found here needn't have it checked
+ * again when its block arrives, or when an imported block goes through
+ * CheckBlock and AcceptBlockHeader after its batch was verified together.
+ */
+static CCriticalSection cs_verifiedSolutions;
+static std::unordered_set<uint256, CCoinsKeyHasher> setVerifiedSolutions;
+
+static bool IsSolutionVerified(const uint256& hash)
+{
+    LOCK(cs_verifiedSolutions);
+    return setVerifiedSolutions.count(hash) > 0;
+}
+
+static void MarkSolutionVerified(const uint256& hash)
+{
+    LOCK(cs_verifiedSolutions);
+    if (setVerifiedSolutions.size() >= MAX_VERIFIED_SOLUTIONS)
+        setVerifiedSolutions.erase(setVerifiedSolutions.begin());
+    setVerifiedSolutions.insert(hash);
+}
+
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW, bool fCheckSolution)
 {
     // Check block version
     if (block.nVersion < MIN_BLOCK_VERSION)
@@ -3469,9 +5082,17 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
                                         block.nSolution.size(), oldSize, newSize),
                              REJECT_INVALID, "invalid-solution-size");
 
-        if (!CheckEquihashSolution(&block, Params()))
-            return state.DoS(100, error("CheckBlockHeader(): Equihash solution invalid"),
-                             REJECT_INVALID, "invalid-solution");
+        // The headers message handler verifies whole batches of solutions
+        // in parallel before accepting them
+        if (fCheckSolution) {
+            uint256 hash = block.GetHash();
+            if (!IsSolutionVerified(hash)) {
+                if (!CheckEquihashSolution(&block, Params()))
+                    return state.DoS(100, error("CheckBlockHeader(): Equihash solution invalid"),
+                                     REJECT_INVALID, "invalid-solution");
+                MarkSolutionVerified(hash);
+            }
+        }
     }
 
     // Check proof of work matches claimed amount
@@ -3524,23 +5145,23 @@ bool CheckBlock(const CBlock& block, CValidationState& state,
                          REJECT_INVALID, "bad-blk-length");
 
     // First transaction must be coinbase, the rest must not be
-    if (block.vtx.empty() || !block.vtx[0].IsCoinBase())
+    if (block.vtx.empty() || !block.vtx[0]->IsCoinBase())
         return state.DoS(100, error("CheckBlock(): first tx is not coinbase"),
                          REJECT_INVALID, "bad-cb-missing");
     for (unsigned int i = 1; i < block.vtx.size(); i++)
-        if (block.vtx[i].IsCoinBase())
+        if (block.vtx[i]->IsCoinBase())
             return state.DoS(100, error("CheckBlock(): more than one coinbase"),
                              REJECT_INVALID, "bad-cb-multiple");
 
     // Check transactions
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
-        if (!CheckTransaction(tx, state, verifier))
+    BOOST_FOREACH(const CTransactionRef& tx, block.vtx)
+        if (!CheckTransaction(*tx, state, verifier))
             return error("CheckBlock(): CheckTransaction failed");
 
     unsigned int nSigOps = 0;
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+    BOOST_FOREACH(const CTransactionRef& tx, block.vtx)
     {
-        nSigOps += GetLegacySigOpCount(tx);
+        nSigOps += GetLegacySigOpCount(*tx);
     }
     if (nSigOps > MAX_BLOCK_SIGOPS)
         return state.DoS(100, error("CheckBlock(): out-of-bounds SigOpCount"),
@@ -3597,16 +5218,22 @@ bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& sta
     return true;
 }
 
-bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIndex * const pindexPrev)
+bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIndex * const pindexPrev, bool fCheckShieldedProofs)
 {
     const int nHeight = pindexPrev == NULL ? 0 : pindexPrev->nHeight + 1;
     const Consensus::Params& consensusParams = Params().GetConsensus();
 
+    // JoinSplit signatures and Sapling proofs and signatures for the whole
+    // block are collected here and verified once the cheaper per-transaction
+    // checks have passed.
+    CShieldedBatchVerifier shieldedBatch;
+
     // Check that all transactions are finalized
-    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+        const CTransaction& tx = *ptx;
 
         // Check transaction contextually against consensus rules at block height
-        if (!ContextualCheckTransaction(tx, state, nHeight, 100)) {
+        if (!ContextualCheckTransaction(tx, state, nHeight, 100, IsInitialBlockDownload, &shieldedBatch, fCheckShieldedProofs)) {
             return false; // Failure reason has been set in validation state object
         }
 
@@ -3626,16 +5253,136 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     if (nHeight > 0)
     {
         CScript expect = CScript() << nHeight;
-        if (block.vtx[0].vin[0].scriptSig.size() < expect.size() ||
-            !std::equal(expect.begin(), expect.end(), block.vtx[0].vin[0].scriptSig.begin())) {
+        if (block.vtx[0]->vin[0].scriptSig.size() < expect.size() ||
+            !std::equal(expect.begin(), expect.end(), block.vtx[0]->vin[0].scriptSig.begin())) {
             return state.DoS(100, error("%s: block height mismatch in coinbase", __func__), REJECT_INVALID, "bad-cb-height");
         }
     }
 
+    if (!shieldedBatch.Verify(state)) {
+        return false; // Failure reason has been set in validation state object
+    }
+
+    return true;
+}
+
+bool CHeaderCheck::operator()()
+{
+    if (!CheckEquihashSolution(pheader, Params()))
+        return false;
+    MarkSolutionVerified(pheader->GetHash());
     return true;
 }
 
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex)
+static CCheckQueue<CHeaderCheck> headercheckqueue(4);
+
+void ThreadHeaderCheck() {
+    RenameThread("litecoinz-hdrcheck");
+    headercheckqueue.Thread();
+}
+
+/**
+ * Which headers of a headers message lead up to a hash the chain parameters
+ * commit to, so that their Equihash solutions need not be verified: each
+ * header commits to its parent, so a continuous run of headers that ends in
+ * a committed hash is the committed chain. The committed hashes are the
+ * checkpoints up to the header commitment, and the commitment itself.
+ *
+ * While we don't have the committed header, a continuous run below it that
+ * doesn't reach a committed hash yet is held back in nHeld, the number of
+ * headers at the end to keep out of mapBlockIndex until those that follow
+ * link them, if fMore says the peer has more and MAX_PENDING_HEADERS allows.
+ * Every other header is verified in full.
+ */
+static std::vector<bool> GetCommittedHeaders(const std::vector<CBlockHeader>& headers, bool fMore, size_t& nHeld)
+{
+    AssertLockHeld(cs_main);
+    std::vector<bool> vCommitted(headers.size(), false);
+    nHeld = 0;
+    const CChainParams& chainparams = Params();
+    const Consensus::Params& consensusParams = chainparams.GetConsensus();
+    // The committed hashes are only as trusted as the checkpoints are
+    if (!fHeaderCommitment || !fCheckpointsEnabled || headers.empty() || consensusParams.hashHeaderCommitment.IsNull())
+        return vCommitted;
+    if (mapBlockIndex.count(consensusParams.hashHeaderCommitment))
+        return vCommitted;
+    BlockMap::const_iterator mi = mapBlockIndex.find(headers[0].hashPrevBlock);
+    if (mi == mapBlockIndex.end())
+        return vCommitted;
+
+    const MapCheckpoints& checkpoints = chainparams.Checkpoints().mapCheckpoints;
+    int nHeight = mi->second->nHeight + 1;
+    size_t nLinked = 0;
+    size_t i = 0;
+    for (; i < headers.size() && nHeight <= consensusParams.nHeaderCommitmentHeight; i++, nHeight++) {
+        if (i > 0 && headers[i].hashPrevBlock != headers[i - 1].GetHash())
+            break;
+        uint256 hashCommitted;
+        if (nHeight == consensusParams.nHeaderCommitmentHeight) {
+            hashCommitted = consensusParams.hashHeaderCommitment;
+        } else {
+            MapCheckpoints::const_iterator it = checkpoints.find(nHeight);
+            if (it != checkpoints.end())
+                hashCommitted = it->second;
+        }
+        if (hashCommitted.IsNull())
+            continue;
+        // Off the committed chain: everything left is verified in full
+        if (headers[i].GetHash() != hashCommitted)
+            break;
+        nLinked = i + 1;
+    }
+    for (size_t j = 0; j < nLinked; j++)
+        vCommitted[j] = true;
+
+    size_t nRest = headers.size() - nLinked;
+    if (fMore && i == headers.size() && nRest > 0 && nPendingHeaders + nRest <= MAX_PENDING_HEADERS)
+        nHeld = nRest;
+    return vCommitted;
+}
+
+/**
+ * Verify the Equihash solutions of a batch of headers on the -par worker
+ * threads. Headers that are already in the index, or vCommitted marks, are
+ * skipped. Returns false if any solution fails, in which case the caller
+ * checks them one by one to find the offending header.
+ */
+static bool CheckHeaderSolutions(const std::vector<CBlockHeader>& headers, const std::vector<bool>& vCommitted)
+{
+    std::vector<CHeaderCheck> vChecks;
+    vChecks.reserve(headers.size());
+    {
+        LOCK(cs_main);
+        for (size_t i = 0; i < headers.size(); i++) {
+            if (!vCommitted[i] && !mapBlockIndex.count(headers[i].GetHash()))
+                vChecks.push_back(CHeaderCheck(headers[i]));
+        }
+    }
+    CCheckQueueControl<CHeaderCheck> control(&headercheckqueue);
+    control.Add(vChecks);
+    return control.Wait();
+}
+
+/**
+ * Verify the Equihash solutions of a batch of blocks read from a block file
+ * on the -par worker threads. Blocks that pass are remembered, so accepting
+ * them afterwards doesn't verify them again; any that fail are left to be
+ * rejected when they are accepted.
+ */
+static void CheckImportedSolutions(const std::vector<CBlock>& vBlocks)
+{
+    std::vector<CHeaderCheck> vChecks;
+    vChecks.reserve(vBlocks.size());
+    BOOST_FOREACH(const CBlock& block, vBlocks) {
+        if (!IsSolutionVerified(block.GetHash()))
+            vChecks.push_back(CHeaderCheck(block));
+    }
+    CCheckQueueControl<CHeaderCheck> control(&headercheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+}
+
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, bool fCheckSolution)
 {
     const CChainParams& chainparams = Params();
     AssertLockHeld(cs_main);
@@ -3653,7 +5400,7 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
         return true;
     }
 
-    if (!CheckBlockHeader(block, state))
+    if (!CheckBlockHeader(block, state, true, fCheckSolution))
         return false;
 
     // Get prev block index
@@ -3670,8 +5417,10 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
     if (!ContextualCheckBlockHeader(block, state, pindexPrev))
         return false;
 
-    if (pindex == NULL)
+    if (pindex == NULL) {
         pindex = AddToBlockIndex(block);
+        Trace(TRACE_BLOCK_HEADER_RECEIVED, hash, -1, pindex->nHeight);
+    }
 
     if (ppindex)
         *ppindex = pindex;
@@ -3712,7 +5461,8 @@ bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockIndex** ppi
 
     // See method docstring for why this is always disabled
     auto verifier = libzcash::ProofVerifier::Disabled();
-    if ((!CheckBlock(block, state, verifier)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
+    bool fAssumedValid = IsAssumedValid(pindex);
+    if ((!CheckBlock(block, state, verifier, !fAssumedValid)) || !ContextualCheckBlock(block, state, pindex->pprev, !fAssumedValid)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
             setDirtyBlockIndex.insert(pindex);
@@ -3758,15 +5508,117 @@ static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned
 }
 
 
+/**
+ * Blocks stored ahead of the tip during initial block download, waiting for
+ * their JoinSplit proofs to be verified by worker threads. The rest of
+ * CheckBlock, Equihash included, has passed already when a block arrives.
+ * A block that passes is marked BLOCK_PROOFS_VALID, so that ConnectBlock
+ * neither verifies its proofs nor its Equihash solution again. One that
+ * fails is left alone and rejected when ConnectBlock gets to it.
+ */
+class CBlockPrevalidationQueue
+{
+private:
+    //! Blocks are copied in, so only so many are kept waiting
+    static const size_t MAX_PENDING = 64;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<CBlock> queue;
+    int nThreads;
+
+public:
+    CBlockPrevalidationQueue() : nThreads(0) {}
+
+    //! Queue a block to be checked; false if it is left for ConnectBlock
+    bool Push(const CBlock& block)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (nThreads == 0 || queue.size() >= MAX_PENDING)
+            return false;
+        queue.push_back(block);
+        cond.notify_one();
+        return true;
+    }
+
+    void Thread()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nThreads++;
+        try {
+            while (true) {
+                while (queue.empty())
+                    cond.wait(lock); // interruption point
+                CBlock block;
+                std::swap(block, queue.front());
+                queue.pop_front();
+                lock.unlock();
+
+                bool fValid = true;
+                {
+                    CWorkerSlot slot;
+                    CCoreReservation core(CORE_CLASS_VALIDATION);
+                    auto verifier = libzcash::ProofVerifier::Strict();
+                    for (size_t i = 0; i < block.vtx.size() && fValid; i++) {
+                        const CTransaction& tx = *block.vtx[i];
+                        BOOST_FOREACH(const JSDescription& joinsplit, tx.vjoinsplit) {
+                            if (!VerifyJoinSplit(joinsplit, verifier, tx.joinSplitPubKey)) {
+                                fValid = false;
+                                break;
+                            }
+                        }
+                    }
+                }
+
+                {
+                    LOCK(cs_main);
+                    BlockMap::iterator mi = mapBlockIndex.find(block.GetHash());
+                    if (mi != mapBlockIndex.end()) {
+                        CBlockIndex* pindex = mi->second;
+                        if (!fValid) {
+                            LogPrintf("Prevalidation of block %s found a JoinSplit that does not verify\n", pindex->GetBlockHash().ToString());
+                        } else if (!(pindex->nStatus & (BLOCK_PROOFS_VALID | BLOCK_FAILED_MASK)) && !pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
+                            pindex->nStatus |= BLOCK_PROOFS_VALID;
+                            setDirtyBlockIndex.insert(pindex);
+                        }
+                    }
+                }
+
+                lock.lock();
+            }
+        } catch (const boost::thread_interrupted&) {
+            nThreads--;
+            throw;
+        }
+    }
+};
+
+static CBlockPrevalidationQueue blockPrevalidationQueue;
+
+void ThreadBlockPrevalidation() {
+    RenameThread("litecoinz-blkcheck");
+    blockPrevalidationQueue.Thread();
+}
+
 bool ProcessNewBlock(CValidationState &state, const CNode* pfrom, const CBlock* pblock, bool fForceProcessing, CDiskBlockPos *dbp)
 {
-    // Preliminary checks
+    int64_t nTimeReceived = GetTimeMicros();
+    Trace(TRACE_BLOCK_RECEIVED, pblock->GetHash(), pfrom ? pfrom->GetId() : -1);
+
+    // Preliminary checks. The Equihash solution of a block whose header is
+    // known to be below -assumevalid isn't checked again.
+    bool fAssumedValid = false;
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(pblock->GetHash());
+        fAssumedValid = mi != mapBlockIndex.end() && IsAssumedValid(mi->second);
+    }
     auto verifier = libzcash::ProofVerifier::Disabled();
-    bool checked = CheckBlock(*pblock, state, verifier);
+    bool checked = CheckBlock(*pblock, state, verifier, !fAssumedValid);
 
     {
         LOCK(cs_main);
-        bool fRequested = MarkBlockAsReceived(pblock->GetHash());
+        bool fRequested = MarkBlockAsReceived(pblock->GetHash(), pfrom ? pfrom->GetId() : -1);
         fRequested |= fForceProcessing;
         if (!checked) {
             return error("%s: CheckBlock FAILED", __func__);
@@ -3781,6 +5633,15 @@ bool ProcessNewBlock(CValidationState &state, const CNode* pfrom, const CBlock*
         CheckBlockIndex();
         if (!ret)
             return error("%s: AcceptBlock FAILED", __func__);
+        Trace(TRACE_BLOCK_PREVALIDATED, pindex->GetBlockHash(), pfrom ? pfrom->GetId() : -1, pindex->nHeight,
+              GetTimeMicros() - nTimeReceived);
+
+        // During initial block download, a block that can't be connected
+        // right away has its proofs verified in the background while it
+        // waits.
+        if (pindex && IsInitialBlockDownload() && pindex->nHeight > chainActive.Height() + 1 && (pindex->nStatus & BLOCK_HAVE_DATA) &&
+            !pindex->IsValid(BLOCK_VALID_SCRIPTS) && !IsAssumedValid(pindex))
+            blockPrevalidationQueue.Push(*pblock);
     }
 
     if (!ActivateBestChain(state, pblock))
@@ -3812,6 +5673,7 @@ bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex
         return false;
     assert(state.IsValid());
 
+    SetBlockTemplateChecked(block);
     return true;
 }
 
@@ -3836,9 +5698,11 @@ void PruneOneBlockFile(const int fileNumber)
 {
     LOCK(cs_LastBlockFile);
 
-    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
-        CBlockIndex* pindex = it->second;
-        if (pindex->nFile == fileNumber) {
+    std::vector<CBlockIndex*> vBlocks;
+    if ((size_t)fileNumber < vBlocksByFile.size())
+        vBlocks.swap(vBlocksByFile[fileNumber]);
+    BOOST_FOREACH(CBlockIndex* pindex, vBlocks) {
+        if (pindex->nFile == fileNumber && (pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO))) {
             pindex->nStatus &= ~BLOCK_HAVE_DATA;
             pindex->nStatus &= ~BLOCK_HAVE_UNDO;
             pindex->nFile = 0;
@@ -3866,55 +5730,212 @@ void PruneOneBlockFile(const int fileNumber)
 }
 
 
+static void UnlinkPrunedFile(int nFile)
+{
+    CDiskBlockPos pos(nFile, 0);
+    if (blockArchive.IsCompressed(nFile)) {
+        blockArchive.Forget(nFile);
+        boost::filesystem::remove(CBlockArchive::GetArchivePath(GetBlockPosFilename(pos, "blk")));
+    }
+    boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
+    boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
+    blockVolumes.Forget(nFile);
+    LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, nFile);
+}
+
 void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
+    // Nothing reads from or writes to a pruned file once its index entries
+    // are written, so removing it can wait for the prune thread instead of
+    // holding up cs_main.
+    boost::unique_lock<boost::mutex> lock(csPruneUnlink);
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
-        CDiskBlockPos pos(*it, 0);
-        boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
-        boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
-        LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
+        blockFileMap.Invalidate(*it);
+        txIndexReader.Invalidate(*it);
+        queuePruneUnlink.push_back(*it);
     }
+    condPruneUnlink.notify_one();
 }
 
-/* Calculate the block/rev files that should be deleted to remain under target*/
-void FindFilesToPrune(std::set<int>& setFilesToPrune)
+void ThreadPruneUnlink()
 {
-    LOCK2(cs_main, cs_LastBlockFile);
-    if (chainActive.Tip() == NULL || nPruneTarget == 0) {
-        return;
-    }
-    if (chainActive.Tip()->nHeight <= Params().PruneAfterHeight()) {
-        return;
+    RenameThread("litecoinz-prune");
+    boost::unique_lock<boost::mutex> lock(csPruneUnlink);
+    while (true) {
+        while (queuePruneUnlink.empty())
+            condPruneUnlink.wait(lock); // interruption point
+        int nFile = queuePruneUnlink.front();
+        queuePruneUnlink.pop_front();
+        lock.unlock();
+        UnlinkPrunedFile(nFile);
+        lock.lock();
     }
+}
 
-    unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP;
-    uint64_t nCurrentUsage = CalculateCurrentUsage();
-    // We don't check to prune until after we've allocated new space for files
-    // So we should leave a buffer under our target to account for another allocation
-    // before the next pruning.
-    uint64_t nBuffer = BLOCKFILE_CHUNK_SIZE + UNDOFILE_CHUNK_SIZE;
-    uint64_t nBytesToPrune;
-    int count=0;
-
-    if (nCurrentUsage + nBuffer >= nPruneTarget) {
-        for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
-            nBytesToPrune = vinfoBlockFile[fileNumber].nSize + vinfoBlockFile[fileNumber].nUndoSize;
+void FlushPruneUnlinks()
+{
+    boost::unique_lock<boost::mutex> lock(csPruneUnlink);
+    while (!queuePruneUnlink.empty()) {
+        UnlinkPrunedFile(queuePruneUnlink.front());
+        queuePruneUnlink.pop_front();
+    }
+}
 
-            if (vinfoBlockFile[fileNumber].nSize == 0)
+bool LoadBlockArchives()
+{
+    BOOST_FOREACH(const boost::filesystem::path& volume, blockVolumes.GetVolumes()) {
+        if (!boost::filesystem::is_directory(volume))
+            continue;
+        for (boost::filesystem::directory_iterator it(volume); it != boost::filesystem::directory_iterator(); it++) {
+            std::string strName = it->path().filename().string();
+            if (strName.size() != 12 || strName.compare(0, 3, "blk") != 0 || strName.compare(8, 4, ".zst") != 0)
                 continue;
+            int nFile = atoi(strName.substr(3, 5));
+            boost::filesystem::path path = GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk");
+            if (!blockArchive.Load(nFile, path))
+                return false;
+            // Archives are complete once renamed into place, so a block file
+            // next to one was left by a compression that was interrupted
+            boost::system::error_code ec;
+            boost::filesystem::remove(path, ec);
+        }
+    }
+    if (blockArchive.size())
+        LogPrintf("%s: %u block files are compressed\n", __func__, blockArchive.size());
+    return true;
+}
 
-            if (nCurrentUsage + nBuffer < nPruneTarget)  // are we below our target?
-                break;
+/** Block files to leave as they are, as compressing them failed */
+static std::set<int> setUncompressibleFiles;
 
-            // don't prune files that could have a block within MIN_BLOCKS_TO_KEEP of the main chain's tip but keep scanning
-            if (vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
+/** Compress the oldest block file that is buried deep enough, if any. Returns whether one was found. */
+static bool CompressNextBlockFile(int nLevel)
+{
+    int nFile = -1;
+    uint64_t nRawSize = 0;
+    {
+        LOCK2(cs_main, cs_LastBlockFile);
+        for (int i = 0; i < nLastBlockFile; i++) {
+            const CBlockFileInfo& info = vinfoBlockFile[i];
+            if (info.nSize == 0 || (int)info.nHeightLast + BLOCK_ARCHIVE_MIN_DEPTH > chainActive.Height() ||
+                blockArchive.IsCompressed(i) || setUncompressibleFiles.count(i))
                 continue;
-
-            PruneOneBlockFile(fileNumber);
-            // Queue up the files for removal
-            setFilesToPrune.insert(fileNumber);
-            nCurrentUsage -= nBytesToPrune;
-            count++;
+            nFile = i;
+            nRawSize = info.nSize;
+            break;
+        }
+    }
+    if (nFile < 0)
+        return false;
+
+    // Nothing writes to a file before the last one, so it is compressed as it is
+    boost::filesystem::path path = GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk");
+    int64_t nStart = GetTimeMicros();
+    if (!CBlockArchive::Compress(path, nRawSize, nLevel) || !blockArchive.Load(nFile, path)) {
+        setUncompressibleFiles.insert(nFile);
+        return true;
+    }
+    {
+        LOCK(cs_main);
+        blockFileMap.Invalidate(nFile);
+        txIndexReader.Invalidate(nFile);
+    }
+    boost::system::error_code ec;
+    uint64_t nArchiveSize = boost::filesystem::file_size(CBlockArchive::GetArchivePath(path), ec);
+    boost::filesystem::remove(path, ec);
+    LogPrintf("Compressed blk%05u.dat from %u to %u bytes in %.2fs\n", nFile, nRawSize, nArchiveSize, (GetTimeMicros() - nStart) * 0.000001);
+    return true;
+}
+
+void ThreadCompressBlockFiles(int nLevel)
+{
+    RenameThread("litecoinz-blkzstd");
+    while (true) {
+        // Compressing competes for the disk with syncing, so it waits until that is done
+        if (IsInitialBlockDownload() || fImporting || fReindex || !CompressNextBlockFile(nLevel))
+            MilliSleep(60 * 1000); // interruption point
+    }
+}
+
+/* Calculate the block/rev files to delete to prune up to nManualPruneHeight */
+static void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeight)
+{
+    assert(fPruneMode && nManualPruneHeight > 0);
+
+    LOCK2(cs_main, cs_LastBlockFile);
+    if (chainActive.Tip() == NULL)
+        return;
+
+    // last block to prune is the lesser of (user-specified height, MIN_BLOCKS_TO_KEEP from the tip)
+    unsigned int nLastBlockWeCanPrune = std::min((unsigned)nManualPruneHeight, chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP);
+    int count = 0;
+    for (int fileNumber = nFirstUnprunedFile; fileNumber < nLastBlockFile; fileNumber++) {
+        if (vinfoBlockFile[fileNumber].nSize == 0 || vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
+            continue;
+        PruneOneBlockFile(fileNumber);
+        setFilesToPrune.insert(fileNumber);
+        count++;
+    }
+    LogPrintf("Prune (Manual): prune_height=%d removed %d blk/rev pairs\n", nLastBlockWeCanPrune, count);
+}
+
+void PruneBlockFilesManual(int nPruneUpToHeight)
+{
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        nManualPruneHeight = nPruneUpToHeight;
+    }
+    FlushStateToDisk(state, FLUSH_STATE_NONE);
+}
+
+/* Calculate the block/rev files that should be deleted to remain under target*/
+void FindFilesToPrune(std::set<int>& setFilesToPrune)
+{
+    LOCK2(cs_main, cs_LastBlockFile);
+    if (chainActive.Tip() == NULL || nPruneTarget == 0) {
+        return;
+    }
+    if (chainActive.Tip()->nHeight <= Params().PruneAfterHeight()) {
+        return;
+    }
+
+    unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP;
+    uint64_t nCurrentUsage = CalculateCurrentUsage();
+    // We don't check to prune until after we've allocated new space for files
+    // So we should leave a buffer under our target to account for another allocation
+    // before the next pruning.
+    uint64_t nBuffer = BLOCKFILE_CHUNK_SIZE + UNDOFILE_CHUNK_SIZE;
+    uint64_t nBytesToPrune;
+    int count=0;
+
+    if (nCurrentUsage + nBuffer >= nPruneTarget) {
+        bool fAllPruned = true;
+        for (int fileNumber = nFirstUnprunedFile; fileNumber < nLastBlockFile; fileNumber++) {
+            nBytesToPrune = vinfoBlockFile[fileNumber].nSize + vinfoBlockFile[fileNumber].nUndoSize;
+
+            if (vinfoBlockFile[fileNumber].nSize == 0) {
+                if (fAllPruned)
+                    nFirstUnprunedFile = fileNumber + 1;
+                continue;
+            }
+
+            if (nCurrentUsage + nBuffer < nPruneTarget)  // are we below our target?
+                break;
+
+            // don't prune files that could have a block within MIN_BLOCKS_TO_KEEP of the main chain's tip but keep scanning
+            if (vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune) {
+                fAllPruned = false;
+                continue;
+            }
+
+            PruneOneBlockFile(fileNumber);
+            if (fAllPruned)
+                nFirstUnprunedFile = fileNumber + 1;
+            // Queue up the files for removal
+            setFilesToPrune.insert(fileNumber);
+            nCurrentUsage -= nBytesToPrune;
+            count++;
         }
     }
 
@@ -3968,7 +5989,12 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly) {
 
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix)
 {
-    return GetDataDir() / "blocks" / strprintf("%s%05u.dat", prefix, pos.nFile);
+    return blockVolumes.GetFilePath(pos.nFile, prefix);
+}
+
+size_t GetBlockIndexMemoryUsage()
+{
+    return memusage::DynamicUsage(mapBlockIndex) + blockIndexArena.DynamicMemoryUsage();
 }
 
 CBlockIndex * InsertBlockIndex(uint256 hash)
@@ -3982,9 +6008,7 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex(): new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
@@ -3993,24 +6017,29 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
 
 bool static LoadBlockIndexDB()
 {
-    const CChainParams& chainparams = Params();
+    int64_t nStart = GetTimeMillis();
     if (!pblocktree->LoadBlockIndexGuts())
         return false;
+    LogPrintf("%s: loaded %u block index entries in %dms\n", __func__, mapBlockIndex.size(), GetTimeMillis() - nStart);
 
     boost::this_thread::interruption_point();
 
-    // Calculate nChainWork
-    vector<pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
+    // Calculate nChainWork. Parents must come before their children, which
+    // a counting sort on the height gives in linear time.
+    nStart = GetTimeMillis();
+    int nMaxHeight = -1;
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        nMaxHeight = std::max(nMaxHeight, item.second->nHeight);
+    vector<size_t> vHeightStart(nMaxHeight + 2, 0);
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vHeightStart[item.second->nHeight + 1]++;
+    for (int nHeight = 1; nHeight <= nMaxHeight + 1; nHeight++)
+        vHeightStart[nHeight] += vHeightStart[nHeight - 1];
+    vector<CBlockIndex*> vSortedByHeight(mapBlockIndex.size());
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vSortedByHeight[vHeightStart[item.second->nHeight]++] = item.second;
+    BOOST_FOREACH(CBlockIndex* pindex, vSortedByHeight)
     {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
-    }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
-    {
-        CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
@@ -4062,8 +6091,10 @@ bool static LoadBlockIndexDB()
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    LogPrintf("%s: computed chain work in %dms\n", __func__, GetTimeMillis() - nStart);
 
     // Load block file info
+    nStart = GetTimeMillis();
     pblocktree->ReadLastBlockFile(nLastBlockFile);
     vinfoBlockFile.resize(nLastBlockFile + 1);
     LogPrintf("%s: last block file = %i\n", __func__, nLastBlockFile);
@@ -4083,20 +6114,25 @@ bool static LoadBlockIndexDB()
     // Check presence of blk files
     LogPrintf("Checking all blk files are present...\n");
     set<int> setBlkDataFiles;
-    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
     {
-        CBlockIndex* pindex = item.second;
-        if (pindex->nStatus & BLOCK_HAVE_DATA) {
-            setBlkDataFiles.insert(pindex->nFile);
+        LOCK(cs_LastBlockFile);
+        BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        {
+            CBlockIndex* pindex = item.second;
+            if (pindex->nStatus & BLOCK_HAVE_DATA) {
+                setBlkDataFiles.insert(pindex->nFile);
+                AddToBlockFileList(pindex);
+            }
         }
     }
     for (std::set<int>::iterator it = setBlkDataFiles.begin(); it != setBlkDataFiles.end(); it++)
     {
         CDiskBlockPos pos(*it, 0);
-        if (CAutoFile(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION).IsNull()) {
+        if (!blockArchive.IsCompressed(*it) && CAutoFile(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION).IsNull()) {
             return false;
         }
     }
+    LogPrintf("%s: checked block files in %dms\n", __func__, GetTimeMillis() - nStart);
 
     // Check whether we have ever pruned block & undo files
     pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
@@ -4112,6 +6148,22 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
 
+    // Check whether we have a shielded index
+    pblocktree->ReadFlag("shieldedindex", fShieldedIndex);
+    LogPrintf("%s: shielded index %s\n", __func__, fShieldedIndex ? "enabled" : "disabled");
+
+    // Check whether we have address, spent and timestamp indexes
+    pblocktree->ReadFlag("addressindex", fAddressIndex);
+    LogPrintf("%s: address index %s\n", __func__, fAddressIndex ? "enabled" : "disabled");
+    pblocktree->ReadFlag("spentindex", fSpentIndex);
+    LogPrintf("%s: spent index %s\n", __func__, fSpentIndex ? "enabled" : "disabled");
+    pblocktree->ReadFlag("timestampindex", fTimestampIndex);
+    LogPrintf("%s: timestamp index %s\n", __func__, fTimestampIndex ? "enabled" : "disabled");
+
+    // Check whether we have a coin stats index
+    pblocktree->ReadFlag("coinstatsindex", fCoinStatsIndex);
+    LogPrintf("%s: coin stats index %s\n", __func__, fCoinStatsIndex ? "enabled" : "disabled");
+
     // Fill in-memory data
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
     {
@@ -4126,6 +6178,13 @@ bool static LoadBlockIndexDB()
         }
     }
 
+    return true;
+}
+
+bool LoadChainTip(const CChainParams& chainparams)
+{
+    LOCK(cs_main);
+
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
@@ -4133,6 +6192,7 @@ bool static LoadBlockIndexDB()
     chainActive.SetTip(it->second);
     // Set hashFinalSproutRoot for the end of best chain
     it->second->hashFinalSproutRoot = pcoinsTip->GetBestAnchor(SPROUT);
+    PublishChainTip();
 
     PruneBlockIndexCandidates();
 
@@ -4158,72 +6218,132 @@ CVerifyDB::~CVerifyDB()
 
 bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth)
 {
-    LOCK(cs_main);
-    if (chainActive.Tip() == NULL || chainActive.Tip()->pprev == NULL)
-        return true;
+    std::vector<CBlockIndex*> vpindexCheck;
+    CBlockIndex* pindexTip;
+    {
+        LOCK(cs_main);
+        if (chainActive.Tip() == NULL || chainActive.Tip()->pprev == NULL)
+            return true;
 
-    // Verify blocks in the best chain
-    if (nCheckDepth <= 0)
-        nCheckDepth = 1000000000; // suffices until the year 19000
-    if (nCheckDepth > chainActive.Height())
-        nCheckDepth = chainActive.Height();
+        // Verify blocks in the best chain
+        if (nCheckDepth <= 0)
+            nCheckDepth = 1000000000; // suffices until the year 19000
+        if (nCheckDepth > chainActive.Height())
+            nCheckDepth = chainActive.Height();
+        pindexTip = chainActive.Tip();
+        for (CBlockIndex* pindex = pindexTip; pindex && pindex->pprev && pindex->nHeight >= pindexTip->nHeight - nCheckDepth; pindex = pindex->pprev)
+            vpindexCheck.push_back(pindex);
+    }
     nCheckLevel = std::max(0, std::min(4, nCheckLevel));
     LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
     CCoinsViewCache coins(coinsview);
-    CBlockIndex* pindexState = chainActive.Tip();
+    CBlockIndex* pindexState = pindexTip;
     CBlockIndex* pindexFailure = NULL;
     int nGoodTransactions = 0;
-    CValidationState state;
-    // No need to verify JoinSplits twice
-    auto verifier = libzcash::ProofVerifier::Disabled();
-    for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev)
+    // Once the tip moves, the coins no longer match what is being disconnected
+    bool fTipMoved = false;
+    enum { VERIFY_OK, VERIFY_READ_FAILED, VERIFY_BAD_BLOCK, VERIFY_BAD_UNDO };
+    for (size_t nFirst = 0; nFirst < vpindexCheck.size() && !fTipMoved; nFirst += VERIFYDB_BATCH_SIZE)
     {
         boost::this_thread::interruption_point();
-        uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
-        if (pindex->nHeight < chainActive.Height()-nCheckDepth)
-            break;
-        CBlock block;
-        // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex))
-            return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state, verifier))
-            return error("VerifyDB(): *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 2: verify undo validity
-        if (nCheckLevel >= 2 && pindex) {
-            CBlockUndo undo;
-            CDiskBlockPos pos = pindex->GetUndoPos();
-            if (!pos.IsNull()) {
-                if (!UndoReadFromDisk(undo, pos, pindex->pprev->GetBlockHash()))
-                    return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-            }
-        }
-        // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
-            bool fClean = true;
-            if (!DisconnectBlock(block, state, pindex, coins, &fClean))
-                return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            pindexState = pindex->pprev;
-            if (!fClean) {
-                nGoodTransactions = 0;
-                pindexFailure = pindex;
-            } else
-                nGoodTransactions += block.vtx.size();
+        const size_t nBatch = std::min<size_t>(VERIFYDB_BATCH_SIZE, vpindexCheck.size() - nFirst);
+        std::vector<CDiskBlockPos> vPos(nBatch), vUndoPos(nBatch);
+        {
+            LOCK(cs_main);
+            for (size_t i = 0; i < nBatch; i++) {
+                vPos[i] = vpindexCheck[nFirst + i]->GetBlockPos();
+                vUndoPos[i] = vpindexCheck[nFirst + i]->GetUndoPos();
+            }
         }
+
+        // Check levels 0 to 2 don't depend on the other blocks: the -par
+        // threads read and check the batch without cs_main.
+        std::vector<CBlock> vBlocks(nBatch);
+        std::vector<CBlockUndo> vBlockUndo(nBatch);
+        std::vector<char> vfUndo(nBatch, false);
+        std::vector<int> vResult(nBatch, VERIFY_OK);
+        std::atomic<size_t> nNext(0);
+        auto check = [&]() {
+            // No need to verify JoinSplits twice
+            auto verifier = libzcash::ProofVerifier::Disabled();
+            for (size_t i = nNext++; i < nBatch; i = nNext++) {
+                const CBlockIndex* pindex = vpindexCheck[nFirst + i];
+                // check level 0: read from disk
+                if (!ReadBlockFromDisk(vBlocks[i], vPos[i]) || vBlocks[i].GetHash() != pindex->GetBlockHash()) {
+                    vResult[i] = VERIFY_READ_FAILED;
+                    continue;
+                }
+                // check level 1: verify block validity
+                CValidationState state;
+                if (nCheckLevel >= 1 && !CheckBlock(vBlocks[i], state, verifier)) {
+                    vResult[i] = VERIFY_BAD_BLOCK;
+                    continue;
+                }
+                // check level 2: verify undo validity
+                if (nCheckLevel >= 2 && !vUndoPos[i].IsNull()) {
+                    if (!UndoReadFromDisk(vBlockUndo[i], vUndoPos[i], pindex->pprev->GetBlockHash()))
+                        vResult[i] = VERIFY_BAD_UNDO;
+                    else
+                        vfUndo[i] = true;
+                }
+            }
+        };
+        boost::thread_group workers;
+        for (int i = 1; i < std::min<int>(nBatch, nScriptCheckThreads); i++)
+            workers.create_thread(check);
+        check();
+        workers.join_all();
         if (ShutdownRequested())
             return true;
+
+        LOCK(cs_main);
+        if (chainActive.Tip() != pindexTip) {
+            fTipMoved = true;
+            break;
+        }
+        for (size_t i = 0; i < nBatch; i++) {
+            CBlockIndex* pindex = vpindexCheck[nFirst + i];
+            uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(pindexTip->nHeight - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
+            if (vResult[i] == VERIFY_READ_FAILED)
+                return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+            if (vResult[i] == VERIFY_BAD_BLOCK)
+                return error("VerifyDB(): *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+            if (vResult[i] == VERIFY_BAD_UNDO)
+                return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+            // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
+            if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
+                bool fClean = true;
+                CValidationState state;
+                if (!DisconnectBlock(vBlocks[i], state, pindex, coins, &fClean, NULL, vfUndo[i] ? &vBlockUndo[i] : NULL))
+                    return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+                pindexState = pindex->pprev;
+                if (!fClean) {
+                    nGoodTransactions = 0;
+                    pindexFailure = pindex;
+                } else
+                    nGoodTransactions += vBlocks[i].vtx.size();
+            }
+            if (ShutdownRequested())
+                return true;
+        }
     }
     if (pindexFailure)
-        return error("VerifyDB(): *** coin database inconsistencies found (last %i blocks, %i good transactions before that)\n", chainActive.Height() - pindexFailure->nHeight + 1, nGoodTransactions);
+        return error("VerifyDB(): *** coin database inconsistencies found (last %i blocks, %i good transactions before that)\n", pindexTip->nHeight - pindexFailure->nHeight + 1, nGoodTransactions);
 
     // check level 4: try reconnecting blocks
-    if (nCheckLevel >= 4) {
+    if (nCheckLevel >= 4 && !fTipMoved) {
         CBlockIndex *pindex = pindexState;
-        while (pindex != chainActive.Tip()) {
+        while (pindex != pindexTip) {
             boost::this_thread::interruption_point();
-            uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * 50))));
+            uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(pindexTip->nHeight - pindex->nHeight)) / (double)nCheckDepth * 50))));
+            LOCK(cs_main);
+            if (chainActive.Tip() != pindexTip) {
+                fTipMoved = true;
+                break;
+            }
             pindex = chainActive.Next(pindex);
             CBlock block;
+            CValidationState state;
             if (!ReadBlockFromDisk(block, pindex))
                 return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
             if (!ConnectBlock(block, state, pindex, coins))
@@ -4231,7 +6351,9 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
         }
     }
 
-    LogPrintf("No coin database inconsistencies in last %i blocks (%i transactions)\n", chainActive.Height() - pindexState->nHeight, nGoodTransactions);
+    if (fTipMoved)
+        LogPrintf("VerifyDB(): the tip moved while the blocks were verified, stopped at height %d\n", pindexState->nHeight);
+    LogPrintf("No coin database inconsistencies in last %i blocks (%i transactions)\n", pindexTip->nHeight - pindexState->nHeight, nGoodTransactions);
 
     return true;
 }
@@ -4310,22 +6432,8 @@ bool RewindBlockIndex(const CChainParams& params, bool& clearWitnessCaches)
     }
 
     CValidationState state;
-    CBlockIndex* pindex = chainActive.Tip();
-    while (chainActive.Height() >= nHeight) {
-        if (fPruneMode && !(chainActive.Tip()->nStatus & BLOCK_HAVE_DATA)) {
-            // If pruning, don't try rewinding past the HAVE_DATA point;
-            // since older blocks can't be served anyway, there's
-            // no need to walk further, and trying to DisconnectTip()
-            // will fail (and require a needless reindex/redownload
-            // of the blockchain).
-            break;
-        }
-        if (!DisconnectTip(state, true)) {
-            return error("RewindBlockIndex: unable to disconnect block at height %i", pindex->nHeight);
-        }
-        // Occasionally flush state to disk.
-        if (!FlushStateToDisk(state, FLUSH_STATE_PERIODIC))
-            return false;
+    if (!DisconnectTipsTo(state, nHeight - 1)) {
+        return error("RewindBlockIndex: unable to disconnect block at height %i", chainActive.Height());
     }
 
     // Collect blocks to be removed (blocks in mapBlockIndex must be at least BLOCK_VALID_TREE).
@@ -4375,8 +6483,8 @@ bool RewindBlockIndex(const CChainParams& params, bool& clearWitnessCaches)
     for (auto pindex : vBlocks) {
         auto ret = mapBlockIndex.find(*pindex->phashBlock);
         if (ret != mapBlockIndex.end()) {
+            blockIndexArena.Free(ret->second);
             mapBlockIndex.erase(ret);
-            delete pindex;
         }
     }
 
@@ -4391,33 +6499,226 @@ bool RewindBlockIndex(const CChainParams& params, bool& clearWitnessCaches)
     return true;
 }
 
+/** Apply the effects of a block to the view without validating it. */
+static bool RollforwardBlock(const CBlockIndex* pindex, CCoinsViewCache& inputs)
+{
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex)) {
+        return error("ReplayBlocks(): ReadBlockFromDisk() failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+    }
+
+    SproutMerkleTree sprout_tree;
+    if (!inputs.GetSproutAnchorAt(inputs.GetBestAnchor(SPROUT), sprout_tree))
+        return error("ReplayBlocks(): missing Sprout anchor before block %s", pindex->GetBlockHash().ToString());
+    SaplingMerkleTree sapling_tree;
+    if (!inputs.GetSaplingAnchorAt(inputs.GetBestAnchor(SAPLING), sapling_tree))
+        return error("ReplayBlocks(): missing Sapling anchor before block %s", pindex->GetBlockHash().ToString());
+
+    std::vector<libzcash::PedersenHash> vSaplingCommitments;
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+        const CTransaction& tx = *ptx;
+        if (!tx.IsCoinBase()) {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                inputs.SpendCoin(txin.prevout);
+            }
+        }
+        inputs.SetNullifiers(tx, true);
+        // Pass check = true as every addition may be an overwrite.
+        AddCoins(inputs, tx, pindex->nHeight, true);
+
+        BOOST_FOREACH(const JSDescription& joinsplit, tx.vjoinsplit) {
+            BOOST_FOREACH(const uint256& note_commitment, joinsplit.commitments) {
+                sprout_tree.append(note_commitment);
+            }
+        }
+        BOOST_FOREACH(const OutputDescription& outputDescription, tx.vShieldedOutput) {
+            vSaplingCommitments.push_back(outputDescription.cm);
+        }
+    }
+    sapling_tree.append_many(vSaplingCommitments);
+
+    inputs.PushAnchor(sprout_tree);
+    inputs.PushAnchor(sapling_tree);
+    inputs.SetBestBlock(pindex->GetBlockHash());
+    return true;
+}
+
+bool ReplayBlocks(const CChainParams& params, CCoinsView* view)
+{
+    LOCK(cs_main);
+
+    CCoinsViewCache cache(view);
+
+    std::vector<uint256> hashHeads = view->GetHeadBlocks();
+    if (hashHeads.empty()) return true; // We're already in a consistent state.
+    if (hashHeads.size() != 2) return error("ReplayBlocks(): unknown inconsistent state");
+
+    uiInterface.ShowProgress(_("Replaying blocks..."), 0);
+    LogPrintf("Replaying blocks\n");
+
+    const CBlockIndex* pindexOld = NULL;  // Old tip during the interrupted flush.
+    const CBlockIndex* pindexNew;         // New tip during the interrupted flush.
+    const CBlockIndex* pindexFork = NULL; // Latest block common to both the old and the new tip.
+
+    if (mapBlockIndex.count(hashHeads[0]) == 0) {
+        return error("ReplayBlocks(): reorganization to unknown block requested");
+    }
+    pindexNew = mapBlockIndex[hashHeads[0]];
+
+    if (!hashHeads[1].IsNull()) { // The old tip is allowed to be null, indicating it's the first flush.
+        if (mapBlockIndex.count(hashHeads[1]) == 0) {
+            return error("ReplayBlocks(): reorganization from unknown block requested");
+        }
+        pindexOld = mapBlockIndex[hashHeads[1]];
+        pindexFork = LastCommonAncestor(const_cast<CBlockIndex*>(pindexOld), const_cast<CBlockIndex*>(pindexNew));
+        assert(pindexFork != NULL);
+        // The best block marker was cleared by the interrupted flush; the
+        // anchors and undo data still describe the old tip.
+        cache.SetBestBlock(pindexOld->GetBlockHash());
+    }
+
+    // Rollback along the old branch.
+    while (pindexOld != pindexFork) {
+        if (pindexOld->nHeight > 0) { // Never disconnect the genesis block.
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindexOld)) {
+                return error("ReplayBlocks(): ReadBlockFromDisk() failed at %d, hash=%s", pindexOld->nHeight, pindexOld->GetBlockHash().ToString());
+            }
+            LogPrintf("Rolling back %s (%i)\n", pindexOld->GetBlockHash().ToString(), pindexOld->nHeight);
+            CValidationState state;
+            bool fClean = true;
+            // An unclean disconnect means some of the block's effects never
+            // reached the database. Writing and deleting a coin are both
+            // idempotent, so the result still has the block undone.
+            CBlockIndexesUpdate indexesUpdate;
+            if (!DisconnectBlock(block, state, pindexOld, cache, &fClean, &indexesUpdate)) {
+                return error("ReplayBlocks(): DisconnectBlock failed at %d, hash=%s", pindexOld->nHeight, pindexOld->GetBlockHash().ToString());
+            }
+            if ((fAddressIndex || fSpentIndex || fTimestampIndex) &&
+                !pblocktree->UpdateBlockIndexes(std::vector<std::pair<uint256, CDiskTxPos> >(), indexesUpdate, true)) {
+                return error("ReplayBlocks(): failed to update address indexes at %d", pindexOld->nHeight);
+            }
+        }
+        pindexOld = pindexOld->pprev;
+    }
+
+    // Roll forward from the forking point to the new tip. The genesis block
+    // never touches the chainstate, so a first flush starts at height 1.
+    int nForkHeight = pindexFork ? pindexFork->nHeight : 0;
+    for (int nHeight = nForkHeight + 1; nHeight <= pindexNew->nHeight; ++nHeight) {
+        const CBlockIndex* pindex = pindexNew->GetAncestor(nHeight);
+        LogPrintf("Rolling forward %s (%i)\n", pindex->GetBlockHash().ToString(), nHeight);
+        uiInterface.ShowProgress(_("Replaying blocks..."), (int)((nHeight - nForkHeight) * 100.0 / (pindexNew->nHeight - nForkHeight)));
+        if (!RollforwardBlock(pindex, cache)) return false;
+    }
+
+    cache.SetBestBlock(pindexNew->GetBlockHash());
+    cache.Flush();
+    uiInterface.ShowProgress("", 100);
+    return true;
+}
+
+bool BenchmarkConnectBlocks(int nStartHeight, int nEndHeight, CBlockConnectStats& stats, std::string& strError)
+{
+    LOCK(cs_main);
+    if (nStartHeight < 1 || nStartHeight > nEndHeight || nEndHeight > chainActive.Height()) {
+        strError = strprintf("Heights must be within 1 and %d, in order", chainActive.Height());
+        return false;
+    }
+
+    // Take the chain state back to just below the range, leaving pcoinsTip
+    // as it is
+    CCoinsViewCache viewReplay(pcoinsTip);
+    CValidationState state;
+    for (CBlockIndex* pindex = chainActive.Tip(); pindex->nHeight >= nStartHeight; pindex = pindex->pprev) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex) || !DisconnectBlock(block, state, pindex, viewReplay)) {
+            strError = strprintf("Failed to disconnect block at height %d", pindex->nHeight);
+            return false;
+        }
+    }
+
+    LogPrintf("Replaying blocks %d to %d\n", nStartHeight, nEndHeight);
+    CBlockConnectStats statsBefore = blockConnectStats;
+    for (int nHeight = nStartHeight; nHeight <= nEndHeight; nHeight++) {
+        CBlockIndex* pindex = chainActive[nHeight];
+        int64_t nTime1 = GetTimeMicros();
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex)) {
+            strError = strprintf("Failed to read block at height %d", nHeight);
+            return false;
+        }
+        PrefetchBlockInputs(block, viewReplay);
+        int64_t nTime2 = GetTimeMicros(); blockConnectStats.nTimeLoad += nTime2 - nTime1;
+        {
+            // Nothing is written with fJustCheck, so the best block is moved
+            // on here
+            CCoinsViewCache view(&viewReplay);
+            if (!ConnectBlock(block, state, pindex, view, true)) {
+                strError = strprintf("Failed to connect block at height %d: %s", nHeight, state.GetRejectReason());
+                return false;
+            }
+            view.SetBestBlock(pindex->GetBlockHash());
+            int64_t nTime3 = GetTimeMicros();
+            assert(view.Flush());
+            blockConnectStats.nTimeFlush += GetTimeMicros() - nTime3;
+        }
+        blockConnectStats.nTimeTotal += GetTimeMicros() - nTime1;
+        if (ShutdownRequested()) {
+            strError = "Shutting down";
+            return false;
+        }
+    }
+    stats = blockConnectStats;
+    stats -= statsBefore;
+    return true;
+}
+
 void UnloadBlockIndex()
 {
     LOCK(cs_main);
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
+    PublishChainTip();
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
     mempool.clear();
-    mapOrphanTransactions.clear();
-    mapOrphanTransactionsByPrev.clear();
+    {
+        LOCK(cs_orphans);
+        mapOrphanTransactions.clear();
+        mapOrphanTransactionsByPrev.clear();
+        mapOrphanPeers.clear();
+        nOrphanBytes = 0;
+    }
     nSyncStarted = 0;
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
     nLastBlockFile = 0;
+    vBlocksByFile.clear();
+    nFirstUnprunedFile = 0;
+    {
+        LOCK(cs_LastBlockFile);
+        blockFileWriter.Close();
+        undoFileWriter.Close();
+    }
     nBlockSequenceId = 1;
     mapBlockSource.clear();
     mapBlocksInFlight.clear();
     nPreferredDownload = 0;
+    nPendingHeaders = 0;
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
+    {
+        LOCK(cs_blockSolutions);
+        mapUnwrittenSolutions.clear();
+        listCachedSolutions.clear();
+        mapCachedSolutions.clear();
+    }
     mapNodeState.clear();
     recentRejects.reset(NULL);
 
-    BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
+    blockIndexArena.Clear();
     fHavePruned = false;
 }
 
@@ -4444,6 +6745,16 @@ bool InitBlockIndex() {
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", false);
     pblocktree->WriteFlag("txindex", fTxIndex);
+    fShieldedIndex = GetBoolArg("-shieldedindex", false);
+    pblocktree->WriteFlag("shieldedindex", fShieldedIndex);
+    fAddressIndex = GetBoolArg("-addressindex", false);
+    pblocktree->WriteFlag("addressindex", fAddressIndex);
+    fSpentIndex = GetBoolArg("-spentindex", false);
+    pblocktree->WriteFlag("spentindex", fSpentIndex);
+    fTimestampIndex = GetBoolArg("-timestampindex", false);
+    pblocktree->WriteFlag("timestampindex", fTimestampIndex);
+    fCoinStatsIndex = GetBoolArg("-coinstatsindex", false);
+    pblocktree->WriteFlag("coinstatsindex", fCoinStatsIndex);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -4482,62 +6793,42 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
     static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
-    int nLoaded = 0;
-    try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
+    // Blocks are read in batches of IMPORT_BATCH_SIZE. The Equihash
+    // solutions of a batch are verified in parallel, then its blocks are
+    // accepted and connected one by one in file order.
+    std::vector<CBlock> vBlocks;
+    std::vector<CDiskBlockPos> vPos;
+    vBlocks.reserve(IMPORT_BATCH_SIZE);
+    vPos.reserve(IMPORT_BATCH_SIZE);
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(Params().MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
-            }
+    int nLoaded = 0;
+    // Returns false when importing has to stop
+    auto processBlocks = [&]() {
+        CheckImportedSolutions(vBlocks);
+        bool fContinue = true;
+        for (size_t i = 0; i < vBlocks.size() && fContinue; i++) {
+            CBlock& block = vBlocks[i];
+            CDiskBlockPos* pos = dbp ? &vPos[i] : NULL;
             try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
                 // detect out of order blocks, and store them for later
                 uint256 hash = block.GetHash();
                 if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
                     LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
                             block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+                    if (pos)
+                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *pos));
                     continue;
                 }
 
                 // process in case the block isn't known yet
                 if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
                     CValidationState state;
-                    if (ProcessNewBlock(state, NULL, &block, true, dbp))
+                    if (ProcessNewBlock(state, NULL, &block, true, pos))
                         nLoaded++;
-                    if (state.IsError())
+                    if (state.IsError()) {
+                        fContinue = false;
                         break;
+                    }
                 } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
                     LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
                 }
@@ -4570,6 +6861,59 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
                 LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
         }
+        vBlocks.clear();
+        vPos.clear();
+        return fContinue;
+    };
+
+    try {
+        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+        uint64_t nRewind = blkdat.GetPos();
+        while (!blkdat.eof()) {
+            boost::this_thread::interruption_point();
+
+            blkdat.SetPos(nRewind);
+            nRewind++; // start one byte further next time, in case of failure
+            blkdat.SetLimit(); // remove former limit
+            unsigned int nSize = 0;
+            try {
+                // locate a header
+                unsigned char buf[MESSAGE_START_SIZE];
+                blkdat.FindByte(Params().MessageStart()[0]);
+                nRewind = blkdat.GetPos()+1;
+                blkdat >> FLATDATA(buf);
+                if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
+                    continue;
+                // read size
+                blkdat >> nSize;
+                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                    continue;
+            } catch (const std::exception&) {
+                // no valid block header found; don't complain
+                break;
+            }
+            try {
+                // read block
+                uint64_t nBlockPos = blkdat.GetPos();
+                if (dbp)
+                    dbp->nPos = nBlockPos;
+                blkdat.SetLimit(nBlockPos + nSize);
+                blkdat.SetPos(nBlockPos);
+                vBlocks.push_back(CBlock());
+                blkdat >> vBlocks.back();
+                nRewind = blkdat.GetPos();
+                vPos.push_back(dbp ? *dbp : CDiskBlockPos());
+            } catch (const std::exception& e) {
+                if (vBlocks.size() > vPos.size())
+                    vBlocks.pop_back();
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+            if (vBlocks.size() >= IMPORT_BATCH_SIZE && !processBlocks())
+                break;
+        }
+        // Blocks left over at the end of the file
+        processBlocks();
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
@@ -4578,6 +6922,144 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
     return nLoaded > 0;
 }
 
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+/** Parents before children, so that each transaction finds its inputs when loaded */
+struct CompareMempoolEntryByDepth
+{
+    bool operator()(CTxMemPool::txiter a, CTxMemPool::txiter b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
+
+bool LoadMempool()
+{
+    FILE* filestr = fopen((GetDataDir() / "mempool.dat").string().c_str(), "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t count = 0;
+    int64_t failed = 0;
+    int64_t nStart = GetTimeMicros();
+
+    try {
+        uint64_t version;
+        file >> version;
+        if (version != MEMPOOL_DUMP_VERSION) {
+            return false;
+        }
+        uint64_t num;
+        file >> num;
+        while (num--) {
+            CTransaction tx;
+            int64_t nTime;
+            double dPriorityDelta;
+            CAmount nFeeDelta;
+            file >> tx;
+            file >> nTime;
+            file >> dPriorityDelta;
+            file >> nFeeDelta;
+
+            if (dPriorityDelta != 0 || nFeeDelta != 0) {
+                mempool.PrioritiseTransaction(tx.GetHash(), tx.GetHash().ToString(), dPriorityDelta, nFeeDelta);
+            }
+            // cs_main is taken per transaction, so block processing and RPC
+            // carry on while a large mempool is being loaded.
+            CValidationState state;
+            {
+                LOCK(cs_main);
+                AcceptToMemoryPoolWithTime(mempool, state, tx, true, NULL, nTime);
+            }
+            if (state.IsValid() && mempool.exists(tx.GetHash())) {
+                ++count;
+            } else {
+                ++failed;
+            }
+            if (ShutdownRequested())
+                return false;
+        }
+
+        // Deltas of transactions that were not in the mempool themselves
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        file >> mapDeltas;
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); ++it) {
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed in %.2fs\n",
+        count, failed, (GetTimeMicros() - nStart) * 0.000001);
+    return true;
+}
+
+void DumpMempool()
+{
+    int64_t start = GetTimeMicros();
+
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    std::vector<std::pair<CTransaction, int64_t> > vtx;
+
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        std::vector<CTxMemPool::txiter> vEntries;
+        vEntries.reserve(mempool.mapTx.size());
+        for (CTxMemPool::txiter it = mempool.mapTx.begin(); it != mempool.mapTx.end(); ++it)
+            vEntries.push_back(it);
+        std::sort(vEntries.begin(), vEntries.end(), CompareMempoolEntryByDepth());
+        vtx.reserve(vEntries.size());
+        BOOST_FOREACH(CTxMemPool::txiter it, vEntries)
+            vtx.push_back(std::make_pair(it->GetTx(), it->GetTime()));
+    }
+
+    int64_t mid = GetTimeMicros();
+
+    try {
+        FILE* filestr = fopen((GetDataDir() / "mempool.dat.new").string().c_str(), "wb");
+        if (!filestr) {
+            return;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        uint64_t version = MEMPOOL_DUMP_VERSION;
+        file << version;
+
+        file << (uint64_t)vtx.size();
+        for (std::vector<std::pair<CTransaction, int64_t> >::const_iterator it = vtx.begin(); it != vtx.end(); ++it) {
+            const uint256& hash = it->first.GetHash();
+            std::pair<double, CAmount> delta(0, 0);
+            std::map<uint256, std::pair<double, CAmount> >::iterator itDelta = mapDeltas.find(hash);
+            if (itDelta != mapDeltas.end()) {
+                delta = itDelta->second;
+                mapDeltas.erase(itDelta);
+            }
+            file << it->first;
+            file << it->second;
+            file << delta.first;
+            file << delta.second;
+        }
+
+        file << mapDeltas;
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(GetDataDir() / "mempool.dat.new", GetDataDir() / "mempool.dat");
+        int64_t last = GetTimeMicros();
+        LogPrintf("Dumped mempool: %gs to copy, %gs to dump\n", (mid-start)*0.000001, (last-mid)*0.000001);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump mempool: %s. Continuing anyway.\n", e.what());
+    }
+}
+
 void static CheckBlockIndex()
 {
     const Consensus::Params& consensusParams = Params().GetConsensus();
@@ -4786,6 +7268,274 @@ std::string CBlockFileInfo::ToString() const
 //
 
 
+/**
+ * Verification cost of the parts of a shielded transaction, in rough
+ * milliseconds of a core, and the budget of it each peer gets for
+ * transactions that don't make it into the mempool: at most
+ * PRECHECK_BUDGET_BURST at once, refilled by PRECHECK_BUDGET_RATE a second.
+ */
+static const unsigned int PRECHECK_COST_BASE = 1;
+static const unsigned int PRECHECK_COST_JOINSPLIT = 10;
+static const unsigned int PRECHECK_COST_SPEND = 5;
+static const unsigned int PRECHECK_COST_OUTPUT = 4;
+static const unsigned int PRECHECK_BUDGET_BURST = 2000;
+static const unsigned int PRECHECK_BUDGET_RATE = 100;
+
+static unsigned int GetPrecheckCost(const CTransaction& tx)
+{
+    return PRECHECK_COST_BASE + PRECHECK_COST_JOINSPLIT * tx.vjoinsplit.size() +
+           PRECHECK_COST_SPEND * tx.vShieldedSpend.size() + PRECHECK_COST_OUTPUT * tx.vShieldedOutput.size();
+}
+
+/**
+ * The checks of a shielded transaction that need no proof or signature to
+ * be verified, so that the transactions failing them are turned away before
+ * any of that work starts. Requires cs_main.
+ */
+static bool PrecheckTransactionCheap(const CTransaction& tx, CValidationState& state, int nHeight)
+{
+    AssertLockHeld(cs_main);
+    if (!CheckTransactionWithoutProofVerification(tx, state) ||
+        !ContextualCheckTransaction(tx, state, nHeight, 10, IsInitialBlockDownload, NULL, false))
+        return false;
+    // Its proofs are worth nothing while it conflicts with the mempool.
+    // AcceptToMemoryPool turns those away without a reject reason too.
+    LOCK(mempool.cs);
+    for (const CTxIn& txin : tx.vin) {
+        if (mempool.mapNextTx.count(txin.prevout))
+            return false;
+    }
+    for (const JSDescription& joinsplit : tx.vjoinsplit) {
+        for (const uint256& nf : joinsplit.nullifiers) {
+            if (mempool.nullifierExists(nf, SPROUT))
+                return false;
+        }
+    }
+    for (const SpendDescription& spend : tx.vShieldedSpend) {
+        if (mempool.nullifierExists(spend.nullifier, SAPLING))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Shielded transactions from peers have their proofs and shielded
+ * signatures verified here, on worker threads and without cs_main, before
+ * they go through AcceptToMemoryPool. A transaction that passes is put in
+ * the proof cache, so that AcceptToMemoryPool only runs the contextual
+ * checks under the lock. The message handler picks up finished transactions
+ * the next time it processes messages of the peer that sent them.
+ *
+ * Each peer has a budget of verification work, refilled at a fixed rate,
+ * that is charged for every transaction it has checked here and paid back
+ * when the transaction makes it into the mempool. So it only runs out for
+ * peers sending transactions that fail, whether in the proofs or later.
+ * The transactions of a peer that has run out wait until nothing else
+ * does, and are dropped rather than checked inline when too many do.
+ */
+class CTxPrecheckQueue
+{
+public:
+    struct Result
+    {
+        CTransactionRef tx;
+        unsigned int nCost;
+        bool fValid;
+        CValidationState state;
+    };
+
+    enum PushResult {
+        PUSH_QUEUED,
+        //! Not queued; check it inline
+        PUSH_INLINE,
+        //! Not queued, from a peer that has run out of budget; drop it
+        PUSH_DROPPED,
+    };
+
+private:
+    struct Job
+    {
+        NodeId nodeid;
+        CTransactionRef tx;
+        int nHeight;
+        unsigned int nCost;
+    };
+
+    struct Budget
+    {
+        double dCredit;
+        int64_t nLastRefill;
+    };
+
+    //! Jobs waiting for a worker, and finished ones not yet picked up, are bounded together
+    static const size_t MAX_PENDING = 1000;
+    //! Of those, the jobs of peers out of budget
+    static const size_t MAX_PENDING_LOW = MAX_PENDING / 4;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<Job> queue;
+    //! Jobs of peers that were out of budget, taken only while queue is empty
+    std::deque<Job> queueLow;
+    std::map<NodeId, std::list<Result> > mapDone;
+    std::map<NodeId, Budget> mapBudget;
+    //! Transactions queued, being checked or finished, not yet picked up
+    std::set<uint256> setPending;
+    //! Jobs being checked per peer, and peers that went away in the meantime
+    std::map<NodeId, int> mapRunning;
+    std::set<NodeId> setFinalized;
+    int nThreads;
+
+public:
+    CTxPrecheckQueue() : nThreads(0) {}
+
+    bool IsEnabled()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return nThreads > 0;
+    }
+
+    bool IsPending(const uint256& hash)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return setPending.count(hash) != 0;
+    }
+
+    //! Queue tx for checking at nHeight, charging nodeid's budget nCost
+    PushResult Push(NodeId nodeid, const CTransactionRef& tx, int nHeight, unsigned int nCost)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (nThreads == 0)
+            return PUSH_INLINE;
+
+        int64_t nNow = GetTimeMicros();
+        std::map<NodeId, Budget>::iterator it = mapBudget.find(nodeid);
+        if (it == mapBudget.end()) {
+            Budget budget = { (double)PRECHECK_BUDGET_BURST, nNow };
+            it = mapBudget.insert(std::make_pair(nodeid, budget)).first;
+        }
+        Budget& budget = it->second;
+        budget.dCredit = std::min<double>(budget.dCredit + (nNow - budget.nLastRefill) * 0.000001 * PRECHECK_BUDGET_RATE, PRECHECK_BUDGET_BURST);
+        budget.nLastRefill = nNow;
+        bool fLow = budget.dCredit < nCost;
+
+        if (setPending.size() >= MAX_PENDING || (fLow && queueLow.size() >= MAX_PENDING_LOW))
+            return fLow ? PUSH_DROPPED : PUSH_INLINE;
+        if (!setPending.insert(tx->GetHash()).second)
+            return PUSH_INLINE;
+        if (fLow)
+            LogPrint("mempool", "peer=%d is out of verification budget, deferring %s\n", nodeid, tx->GetHash().ToString());
+        budget.dCredit -= nCost;
+        Job job = { nodeid, tx, nHeight, nCost };
+        (fLow ? queueLow : queue).push_back(job);
+        cond.notify_one();
+        return PUSH_QUEUED;
+    }
+
+    //! Give back the budget charged for a transaction that was accepted
+    void Refund(NodeId nodeid, unsigned int nCost)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        std::map<NodeId, Budget>::iterator it = mapBudget.find(nodeid);
+        if (it != mapBudget.end())
+            it->second.dCredit = std::min<double>(it->second.dCredit + nCost, PRECHECK_BUDGET_BURST);
+    }
+
+    //! Move the finished transactions of a peer to listDone, oldest first
+    void TakeDone(NodeId nodeid, std::list<Result>& listDone)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        std::map<NodeId, std::list<Result> >::iterator it = mapDone.find(nodeid);
+        if (it == mapDone.end())
+            return;
+        BOOST_FOREACH(const Result& result, it->second)
+            setPending.erase(result.tx->GetHash());
+        listDone.splice(listDone.end(), it->second);
+        mapDone.erase(it);
+    }
+
+    //! Drop everything of a peer that disconnected
+    void FinalizeNode(NodeId nodeid)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        std::map<NodeId, std::list<Result> >::iterator it = mapDone.find(nodeid);
+        if (it != mapDone.end()) {
+            BOOST_FOREACH(const Result& result, it->second)
+                setPending.erase(result.tx->GetHash());
+            mapDone.erase(it);
+        }
+        std::deque<Job>* queues[] = { &queue, &queueLow };
+        for (std::deque<Job>* pqueue : queues) {
+            for (std::deque<Job>::iterator itJob = pqueue->begin(); itJob != pqueue->end(); ) {
+                if (itJob->nodeid == nodeid) {
+                    setPending.erase(itJob->tx->GetHash());
+                    itJob = pqueue->erase(itJob);
+                } else {
+                    ++itJob;
+                }
+            }
+        }
+        mapBudget.erase(nodeid);
+        if (mapRunning.count(nodeid))
+            setFinalized.insert(nodeid);
+    }
+
+    void Thread()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nThreads++;
+        try {
+            while (true) {
+                while (queue.empty() && queueLow.empty())
+                    cond.wait(lock); // interruption point
+                std::deque<Job>& queueNext = queue.empty() ? queueLow : queue;
+                Job job = queueNext.front();
+                queueNext.pop_front();
+                mapRunning[job.nodeid]++;
+                lock.unlock();
+
+                Result result;
+                result.tx = job.tx;
+                result.nCost = job.nCost;
+                {
+                    CWorkerSlot slot;
+                    CCoreReservation core(CORE_CLASS_RELAY);
+                    auto verifier = libzcash::ProofVerifier::Strict();
+                    result.fValid = CheckTransaction(*job.tx, result.state, verifier) &&
+                                    ContextualCheckTransaction(*job.tx, result.state, job.nHeight, 10);
+                }
+                if (result.fValid)
+                    SetProofCacheEntry(job.tx->GetHash(), CurrentEpochBranchId(job.nHeight, Params().GetConsensus()));
+
+                lock.lock();
+                if (--mapRunning[job.nodeid] == 0)
+                    mapRunning.erase(job.nodeid);
+                if (setFinalized.count(job.nodeid)) {
+                    setPending.erase(job.tx->GetHash());
+                    if (!mapRunning.count(job.nodeid))
+                        setFinalized.erase(job.nodeid);
+                } else {
+                    mapDone[job.nodeid].push_back(result);
+                }
+            }
+        } catch (const boost::thread_interrupted&) {
+            nThreads--;
+            throw;
+        }
+    }
+};
+
+static CTxPrecheckQueue txPrecheckQueue;
+
+static void FinalizeTxPrecheck(NodeId nodeid) {
+    txPrecheckQueue.FinalizeNode(nodeid);
+}
+
+void ThreadTxPrecheck() {
+    RenameThread("litecoinz-txcheck");
+    txPrecheckQueue.Thread();
+}
+
 bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     switch (inv.type)
@@ -4803,10 +7553,14 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
                 recentRejects->reset();
             }
 
+            LOCK(cs_orphans);
             return recentRejects->contains(inv.hash) ||
+                   txPrecheckQueue.IsPending(inv.hash) ||
                    mempool.exists(inv.hash) ||
                    mapOrphanTransactions.count(inv.hash) ||
-                   pcoinsTip->HaveCoins(inv.hash);
+                   // Best effort: only try output 0 and 1
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) ||
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
         }
     case MSG_BLOCK:
         return mapBlockIndex.count(inv.hash);
@@ -4815,6 +7569,41 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
     return true;
 }
 
+/** The block of pindex and its bloom elements, from the cache or read now */
+static std::shared_ptr<const CFilteredBlockSource> GetFilteredBlockSource(const CBlockIndex* pindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    const uint256 hash = pindex->GetBlockHash();
+    for (std::list<std::pair<uint256, std::shared_ptr<const CFilteredBlockSource> > >::iterator it = lFilteredBlockSources.begin();
+         it != lFilteredBlockSources.end(); ++it) {
+        if (it->first == hash) {
+            lFilteredBlockSources.splice(lFilteredBlockSources.begin(), lFilteredBlockSources, it);
+            return it->second;
+        }
+    }
+
+    std::shared_ptr<CFilteredBlockSource> source = std::make_shared<CFilteredBlockSource>();
+    if (!ReadBlockFromDisk(source->block, pindex))
+        assert(!"cannot load block from disk");
+    source->vElements.reserve(source->block.vtx.size());
+    BOOST_FOREACH(const CTransactionRef& ptx, source->block.vtx)
+        source->vElements.push_back(CBloomTxElements(*ptx));
+
+    lFilteredBlockSources.push_front(std::make_pair(hash, source));
+    if (lFilteredBlockSources.size() > MAX_FILTERED_BLOCK_SOURCES)
+        lFilteredBlockSources.pop_back();
+    return source;
+}
+
+/**
+ * Blocks as recent as those served as compact blocks go ahead of a peer's
+ * other traffic; older ones, which it is catching up with, are bulk.
+ */
+static SendClass GetBlockSendClass(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    return pindex->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH ? SEND_CLASS_BLOCK : SEND_CLASS_BULK;
+}
+
 void static ProcessGetData(CNode* pfrom)
 {
     int currentHeight = GetHeight();
@@ -4835,7 +7624,7 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
@@ -4861,17 +7650,46 @@ void static ProcessGetData(CNode* pfrom)
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
                     // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
                     if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
+                    {
+                        if (mostRecentBlockMessage.second && mostRecentBlockMessage.first == inv.hash) {
+                            pfrom->PushMessageBuffer(mostRecentBlockMessage.second);
+                        } else {
+                            // The stored serialization is sent as it is, straight
+                            // from the block file mapping if there is one.
+                            CBlockFileRegion region;
+                            if (!ReadRawBlockFromDisk(region, mi->second->GetBlockPos()))
+                                assert(!"cannot load block from disk");
+                            CMessageBuffer msg = CNode::MakeMessage("block", CFlatData((void*)region.begin(), (void*)region.end()));
+                            // Only the tip gets asked for by many peers at once
+                            if (mi->second == chainActive.Tip())
+                                mostRecentBlockMessage = std::make_pair(inv.hash, msg);
+                            pfrom->PushMessageBuffer(msg, GetBlockSendClass(mi->second));
+                        }
+                    }
+                    else if (inv.type == MSG_CMPCT_BLOCK)
+                    {
+                        // Only recent blocks are likely to have their
+                        // transactions in the peer's mempool; send older
+                        // ones whole.
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second))
+                            assert(!"cannot load block from disk");
+                        if (mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
+                            CBlockHeaderAndShortTxIDs cmpctblock(block);
+                            pfrom->PushMessage("cmpctblock", cmpctblock);
+                        } else {
+                            pfrom->PushMessageBuffer(CNode::MakeMessage("block", block), SEND_CLASS_BULK);
+                        }
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
+                        std::shared_ptr<const CFilteredBlockSource> source = GetFilteredBlockSource(mi->second);
+                        const CBlock& block = source->block;
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter)
                         {
-                            CMerkleBlock merkleBlock(block, *pfrom->pfilter);
+                            CMerkleBlock merkleBlock(block, source->vElements, *pfrom->pfilter);
                             pfrom->PushMessage("merkleblock", merkleBlock);
                             // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
                             // This avoids hurting performance by pointlessly requiring a round-trip
@@ -4894,9 +7712,10 @@ void static ProcessGetData(CNode* pfrom)
                         // Bypass PushInventory, this must send even if redundant,
                         // and we want it right after the last block so they don't
                         // wait for other stuff first.
+                        // It is queued with the block it follows.
                         vector<CInv> vInv;
                         vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
-                        pfrom->PushMessage("inv", vInv);
+                        pfrom->PushMessageBuffer(CNode::MakeMessage("inv", vInv), GetBlockSendClass(mi->second));
                         pfrom->hashContinue.SetNull();
                     }
                 }
@@ -4904,32 +7723,23 @@ void static ProcessGetData(CNode* pfrom)
             else if (inv.IsKnownType())
             {
                 // Check the mempool to see if a transaction is expiring soon.  If so, do not send to peer.
-                // Note that a transaction enters the mempool first, before the serialized form is cached
-                // in mapRelay after a successful relay.
+                // Note that a transaction enters the mempool first, before it is kept in the relay
+                // cache after a successful relay.
                 bool isExpiringSoon = false;
                 bool pushed = false;
-                CTransaction tx;
-                bool isInMempool = mempool.lookup(inv.hash, tx);
+                CTransactionRef ptx = mempool.get(inv.hash);
+                bool isInMempool = ptx != NULL;
                 if (isInMempool) {
-                    isExpiringSoon = IsExpiringSoonTx(tx, currentHeight + 1);
+                    isExpiringSoon = IsExpiringSoonTx(*ptx, currentHeight + 1);
                 }
 
-                if (!isExpiringSoon) {
-                    // Send stream from relay memory
-                    {
-                        LOCK(cs_mapRelay);
-                        map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
-                        if (mi != mapRelay.end()) {
-                            pfrom->PushMessage(inv.GetCommand(), (*mi).second);
-                            pushed = true;
-                        }
-                    }
-                    if (!pushed && inv.type == MSG_TX) {
-                        if (isInMempool) {
-                            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                            ss.reserve(1000);
-                            ss << tx;
-                            pfrom->PushMessage("tx", ss);
+                if (!isExpiringSoon) {
+                    if (inv.type == MSG_TX) {
+                        // Transactions relayed recently are served even if they have left the mempool
+                        if (!isInMempool)
+                            ptx = relayCache.Get(inv.hash);
+                        if (ptx) {
+                            pfrom->PushMessage("tx", *ptx);
                             pushed = true;
                         }
                     }
@@ -4943,7 +7753,7 @@ void static ProcessGetData(CNode* pfrom)
             // Track requests for our stuff.
             GetMainSignals().Inventory(inv.hash);
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -4962,6 +7772,233 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+/**
+ * Handle a transaction received from pfrom. pPrecheckState is the result of
+ * a failed check done before, if there was one. Returns whether the
+ * transaction was accepted to the mempool.
+ */
+bool static ProcessTransaction(CNode* pfrom, const CTransactionRef& ptx, const CValidationState* pPrecheckState)
+{
+    const CTransaction& tx = *ptx;
+    vector<COutPoint> vWorkQueue;
+    vector<uint256> vEraseQueue;
+    CInv inv(MSG_TX, tx.GetHash());
+
+    LOCK2(cs_main, cs_orphans);
+
+    bool fMissingInputs = false;
+    CValidationState state;
+
+    pfrom->setAskFor.erase(inv.hash);
+    mapAlreadyAskedFor.erase(inv);
+
+    bool fAccepted = false;
+    if (pPrecheckState)
+        state = *pPrecheckState;
+    else
+        fAccepted = !AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, ptx, true, &fMissingInputs);
+
+    if (fAccepted)
+    {
+        pfrom->nLastTxTime = GetTime();
+        pfrom->nTxsFirst++;
+        mempool.check(pcoinsTip);
+        RelayTransaction(tx);
+        for (unsigned int i = 0; i < tx.vout.size(); i++)
+            vWorkQueue.push_back(COutPoint(inv.hash, i));
+
+        LogPrint("mempool", "AcceptToMemoryPool: peer=%d %s: accepted %s (poolsz %u)\n",
+            pfrom->id, pfrom->cleanSubVer,
+            tx.GetHash().ToString(),
+            mempool.mapTx.size());
+
+        // Recursively process any orphan transactions that depended on this one
+        set<NodeId> setMisbehaving;
+        for (unsigned int i = 0; i < vWorkQueue.size(); i++)
+        {
+            boost::unordered_map<COutPoint, std::set<OrphanMap::iterator, IteratorComparator>, SaltedOutpointHasher>::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
+            if (itByPrev == mapOrphanTransactionsByPrev.end())
+                continue;
+            for (std::set<OrphanMap::iterator, IteratorComparator>::iterator mi = itByPrev->second.begin();
+                 mi != itByPrev->second.end();
+                 ++mi)
+            {
+                // Held here, as the orphan may be erased while it is in use
+                const CTransactionRef porphanTx = (*mi)->second.tx;
+                const CTransaction& orphanTx = *porphanTx;
+                const uint256& orphanHash = orphanTx.GetHash();
+                NodeId fromPeer = (*mi)->second.fromPeer;
+                bool fMissingInputs2 = false;
+                // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+                // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+                // anyone relaying LegitTxX banned)
+                CValidationState stateDummy;
+
+
+                if (setMisbehaving.count(fromPeer))
+                    continue;
+                if (AcceptToMemoryPool(mempool, stateDummy, porphanTx, true, &fMissingInputs2))
+                {
+                    LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
+                    RelayTransaction(orphanTx);
+                    for (unsigned int j = 0; j < orphanTx.vout.size(); j++)
+                        vWorkQueue.push_back(COutPoint(orphanHash, j));
+                    vEraseQueue.push_back(orphanHash);
+                }
+                else if (!fMissingInputs2)
+                {
+                    int nDos = 0;
+                    if (stateDummy.IsInvalid(nDos) && nDos > 0)
+                    {
+                        // Punish peer that gave us an invalid orphan tx
+                        Misbehaving(fromPeer, nDos);
+                        setMisbehaving.insert(fromPeer);
+                        LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
+                    }
+                    // Has inputs but not accepted to mempool
+                    // Probably non-standard or insufficient fee/priority
+                    LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
+                    vEraseQueue.push_back(orphanHash);
+                    assert(recentRejects);
+                    recentRejects->insert(orphanHash);
+                }
+                mempool.check(pcoinsTip);
+            }
+        }
+
+        BOOST_FOREACH(uint256 hash, vEraseQueue)
+            EraseOrphanTx(hash);
+    }
+    // TODO: currently, prohibit joinsplits and shielded spends/outputs from entering mapOrphans
+    else if (fMissingInputs &&
+             tx.vjoinsplit.empty() &&
+             tx.vShieldedSpend.empty() &&
+             tx.vShieldedOutput.empty())
+    {
+        // A transaction spending an output of one we rejected is not worth keeping
+        bool fRejectedParents = false;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            if (recentRejects->contains(txin.prevout.hash)) {
+                fRejectedParents = true;
+                break;
+            }
+        }
+        if (!fRejectedParents) {
+            AddOrphanTx(ptx, pfrom->GetId());
+
+            // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
+            unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx, (size_t)nMaxOrphanTx * MAX_ORPHAN_BYTES_PER_TX);
+            if (nEvicted > 0)
+                LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
+        } else {
+            LogPrint("mempool", "not keeping orphan with rejected parents %s\n", tx.GetHash().ToString());
+            recentRejects->insert(tx.GetHash());
+        }
+    } else {
+        assert(recentRejects);
+        recentRejects->insert(tx.GetHash());
+
+        if (pfrom->fWhitelisted) {
+            // Always relay transactions received from whitelisted peers, even
+            // if they were already in the mempool or rejected from it due
+            // to policy, allowing the node to function as a gateway for
+            // nodes hidden behind it.
+            //
+            // Never relay transactions that we would assign a non-zero DoS
+            // score for, as we expect peers to do the same with us in that
+            // case.
+            int nDoS = 0;
+            if (!state.IsInvalid(nDoS) || nDoS == 0) {
+                LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->id);
+                RelayTransaction(tx);
+            } else {
+                LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s (code %d))\n",
+                    tx.GetHash().ToString(), pfrom->id, state.GetRejectReason(), state.GetRejectCode());
+            }
+        }
+    }
+    int nDoS = 0;
+    if (state.IsInvalid(nDoS))
+    {
+        LogPrint("mempool", "%s from peer=%d %s was not accepted into the memory pool: %s\n", tx.GetHash().ToString(),
+            pfrom->id, pfrom->cleanSubVer,
+            state.GetRejectReason());
+        pfrom->PushMessage("reject", string("tx"), state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
+        if (nDoS > 0)
+            Misbehaving(pfrom->GetId(), nDoS);
+    }
+    return fAccepted;
+}
+
+//! Whether we have the data of the block hash (requires cs_main)
+static bool HaveBlockData(const uint256& hash)
+{
+    BlockMap::iterator mi = mapBlockIndex.find(hash);
+    return mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA);
+}
+
+/**
+ * ProcessNewBlock for a block pfrom sent, which is counted as delivered
+ * first by the peer if we didn't have it before. Must be called without
+ * cs_main.
+ */
+static bool ProcessBlockFromPeer(CValidationState& state, CNode* pfrom, const CBlock& block, bool fForceProcessing)
+{
+    uint256 hash = block.GetHash();
+    bool fHadBlock;
+    {
+        LOCK(cs_main);
+        fHadBlock = HaveBlockData(hash);
+    }
+    bool ret = ProcessNewBlock(state, pfrom, &block, fForceProcessing, NULL);
+    if (ret && !fHadBlock) {
+        LOCK(cs_main);
+        if (HaveBlockData(hash)) {
+            pfrom->nLastBlockTime = GetTime();
+            pfrom->nBlocksFirst++;
+        }
+    }
+    return ret;
+}
+
+/**
+ * Process a block rebuilt from a cmpctblock, and pick its sender to announce
+ * with cmpctblocks if the block became our new tip. Must be called without
+ * cs_main.
+ */
+static void ProcessReconstructedBlock(CNode* pfrom, const CBlock& block)
+{
+    CValidationState state;
+    // The header has been checked already and the block extends our tip, so
+    // it is processed as if it had been asked for.
+    ProcessBlockFromPeer(state, pfrom, block, true);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        pfrom->PushMessage("reject", std::string("block"), state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), block.GetHash());
+        if (nDoS > 0) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), nDoS);
+        }
+        return;
+    }
+
+    LOCK(cs_main);
+    if (chainActive.Tip()->GetBlockHash() == block.GetHash())
+        MaybeSetPeerAsAnnouncingHeaderAndIDs(pfrom->GetId());
+}
+
+/** Deserialize obj from the unread part of vRecv in place, so that the transactions in it are hashed from the received bytes */
+template<typename T>
+static void UnserializeInPlace(CDataStream& vRecv, T& obj)
+{
+    CSpanReader reader(vRecv);
+    reader >> obj;
+    vRecv.ignore(reader.consumed());
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     const CChainParams& chainparams = Params();
@@ -5079,9 +8116,11 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 }
             }
 
-            // Get recent addresses
-            pfrom->PushMessage("getaddr");
-            pfrom->fGetAddr = true;
+            // Get recent addresses, which block-relay-only peers don't exchange
+            if (!pfrom->fBlockRelayOnly) {
+                pfrom->PushMessage("getaddr");
+                pfrom->fGetAddr = true;
+            }
             addrman.Good(pfrom->addr);
         } else {
             if (((CNetAddr)pfrom->addr) == (CNetAddr)addrFrom)
@@ -5132,6 +8171,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
+
+        if (pfrom->nVersion >= COMPACT_BLOCKS_VERSION) {
+            // Tell the peer we can take blocks as cmpctblocks, but only when
+            // we ask for them; it is picked to announce with them later on.
+            pfrom->PushMessage("sendcmpct", false, COMPACT_BLOCKS_ENCODING_VERSION);
+        }
     }
 
 
@@ -5153,6 +8198,11 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
     else if (strCommand == "addr")
     {
+        // Addresses from block-relay-only peers are ignored, so they can't
+        // be told apart from our other peers by the addresses we relay
+        if (pfrom->fBlockRelayOnly)
+            return true;
+
         vector<CAddress> vAddr;
         vRecv >> vAddr;
 
@@ -5237,7 +8287,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             bool fAlreadyHave = AlreadyHave(inv);
             LogPrint("net", "got inv: %s  %s peer=%d\n", inv.ToString(), fAlreadyHave ? "have" : "new", pfrom->id);
 
-            if (!fAlreadyHave && !fImporting && !fReindex && inv.type != MSG_BLOCK)
+            if (!fAlreadyHave && !fImporting && !fReindex && inv.type != MSG_BLOCK && !pfrom->fBlockRelayOnly)
                 pfrom->AskFor(inv);
 
             if (inv.type == MSG_BLOCK) {
@@ -5254,8 +8304,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
                     CNodeState *nodestate = State(pfrom->GetId());
                     if (chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - chainparams.GetConsensus().nPowTargetSpacing * 20 &&
-                        nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
-                        vToFetch.push_back(inv);
+                        nodestate->nBlocksInFlight < nodestate->nBlockWindow) {
+                        // A new block's transactions are most likely in our
+                        // mempool already, so ask for it as a cmpctblock.
+                        if (nodestate->fProvidesCompactBlocks)
+                            vToFetch.push_back(CInv(MSG_CMPCT_BLOCK, inv.hash));
+                        else
+                            vToFetch.push_back(inv);
                         // Mark block as in flight already, even though the actual "getdata" message only goes out
                         // later (within the same cs_main lock, though).
                         MarkBlockAsInFlight(pfrom->GetId(), inv.hash, chainparams.GetConsensus());
@@ -5387,134 +8442,58 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
     else if (strCommand == "tx")
     {
-        vector<uint256> vWorkQueue;
-        vector<uint256> vEraseQueue;
-        CTransaction tx;
-        vRecv >> tx;
+        if (pfrom->fBlockRelayOnly) {
+            LogPrint("net", "transaction sent by block-relay-only peer=%d ignored\n", pfrom->id);
+            return true;
+        }
+
+        CTransactionRef ptx;
+        UnserializeInPlace(vRecv, ptx);
+        const CTransaction& tx = *ptx;
 
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
+        Trace(TRACE_TX_RECEIVED, inv.hash, pfrom->GetId());
+        RecordTxArrival(tx, GetTimeMicros());
 
-        LOCK(cs_main);
-
-        bool fMissingInputs = false;
-        CValidationState state;
-
-        pfrom->setAskFor.erase(inv.hash);
-        mapAlreadyAskedFor.erase(inv);
-
-        if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs))
+        // Verify the proofs of shielded transactions on the precheck threads
+        if (txPrecheckQueue.IsEnabled() &&
+            !(tx.vjoinsplit.empty() && tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty()))
         {
-            mempool.check(pcoinsTip);
-            RelayTransaction(tx);
-            vWorkQueue.push_back(inv.hash);
-
-            LogPrint("mempool", "AcceptToMemoryPool: peer=%d %s: accepted %s (poolsz %u)\n",
-                pfrom->id, pfrom->cleanSubVer,
-                tx.GetHash().ToString(),
-                mempool.mapTx.size());
-
-            // Recursively process any orphan transactions that depended on this one
-            set<NodeId> setMisbehaving;
-            for (unsigned int i = 0; i < vWorkQueue.size(); i++)
+            bool fHave;
+            int nHeight;
+            CValidationState stateCheap;
+            bool fCheap = true;
             {
-                map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (set<uint256>::iterator mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const uint256& orphanHash = *mi;
-                    const CTransaction& orphanTx = mapOrphanTransactions[orphanHash].tx;
-                    NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2))
-                    {
-                        LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx);
-                        vWorkQueue.push_back(orphanHash);
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee/priority
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                        assert(recentRejects);
-                        recentRejects->insert(orphanHash);
-                    }
-                    mempool.check(pcoinsTip);
+                LOCK(cs_main);
+                if (txPrecheckQueue.IsPending(inv.hash)) {
+                    // Another peer sent it first
+                    pfrom->setAskFor.erase(inv.hash);
+                    mapAlreadyAskedFor.erase(inv);
+                    return true;
                 }
+                fHave = AlreadyHave(inv);
+                nHeight = chainActive.Height() + 1;
+                if (!fHave)
+                    fCheap = PrecheckTransactionCheap(tx, stateCheap, nHeight);
             }
-
-            BOOST_FOREACH(uint256 hash, vEraseQueue)
-                EraseOrphanTx(hash);
-        }
-        // TODO: currently, prohibit joinsplits and shielded spends/outputs from entering mapOrphans
-        else if (fMissingInputs &&
-                 tx.vjoinsplit.empty() &&
-                 tx.vShieldedSpend.empty() &&
-                 tx.vShieldedOutput.empty())
-        {
-            AddOrphanTx(tx, pfrom->GetId());
-
-            // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-            unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
-            if (nEvicted > 0)
-                LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
-        } else {
-            assert(recentRejects);
-            recentRejects->insert(tx.GetHash());
-
-            if (pfrom->fWhitelisted) {
-                // Always relay transactions received from whitelisted peers, even
-                // if they were already in the mempool or rejected from it due
-                // to policy, allowing the node to function as a gateway for
-                // nodes hidden behind it.
-                //
-                // Never relay transactions that we would assign a non-zero DoS
-                // score for, as we expect peers to do the same with us in that
-                // case.
-                int nDoS = 0;
-                if (!state.IsInvalid(nDoS) || nDoS == 0) {
-                    LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->id);
-                    RelayTransaction(tx);
-                } else {
-                    LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s (code %d))\n",
-                        tx.GetHash().ToString(), pfrom->id, state.GetRejectReason(), state.GetRejectCode());
+            if (!fCheap) {
+                ProcessTransaction(pfrom, ptx, &stateCheap);
+                return true;
+            }
+            if (!fHave && !GetProofCacheEntry(inv.hash, CurrentEpochBranchId(nHeight, chainparams.GetConsensus()))) {
+                CTxPrecheckQueue::PushResult push = txPrecheckQueue.Push(pfrom->GetId(), ptx, nHeight, GetPrecheckCost(tx));
+                if (push == CTxPrecheckQueue::PUSH_DROPPED) {
+                    LOCK(cs_main);
+                    pfrom->setAskFor.erase(inv.hash);
+                    mapAlreadyAskedFor.erase(inv);
                 }
+                if (push != CTxPrecheckQueue::PUSH_INLINE)
+                    return true;
             }
         }
-        int nDoS = 0;
-        if (state.IsInvalid(nDoS))
-        {
-            LogPrint("mempool", "%s from peer=%d %s was not accepted into the memory pool: %s\n", tx.GetHash().ToString(),
-                pfrom->id, pfrom->cleanSubVer,
-                state.GetRejectReason());
-            pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-            if (nDoS > 0)
-                Misbehaving(pfrom->GetId(), nDoS);
-        }
+
+        ProcessTransaction(pfrom, ptx, NULL);
     }
 
 
@@ -5534,21 +8513,53 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Headers held back from earlier messages come first. Those that
+        // link to a committed hash are accepted without their solutions;
+        // a run that doesn't yet is held back again.
+        std::vector<bool> vCommitted;
+        size_t nHeld = 0;
+        uint256 hashLastHeld;
+        {
+            LOCK(cs_main);
+            CNodeState *nodestate = State(pfrom->GetId());
+            // An announcement that doesn't follow on leaves them held
+            if (!nodestate->vPendingHeaders.empty() &&
+                (headers.empty() || headers[0].hashPrevBlock == nodestate->vPendingHeaders.back().GetHash())) {
+                headers.insert(headers.begin(), nodestate->vPendingHeaders.begin(), nodestate->vPendingHeaders.end());
+                nPendingHeaders -= nodestate->vPendingHeaders.size();
+                nodestate->vPendingHeaders.clear();
+            }
+            bool fMore = nCount == MAX_HEADERS_RESULTS && nodestate->vPendingHeaders.empty();
+            vCommitted = GetCommittedHeaders(headers, fMore, nHeld);
+            if (nHeld > 0) {
+                hashLastHeld = headers.back().GetHash();
+                nodestate->vPendingHeaders.assign(headers.end() - nHeld, headers.end());
+                nPendingHeaders += nHeld;
+                headers.resize(headers.size() - nHeld);
+                vCommitted.resize(headers.size());
+            }
+        }
+
+        // Verify the solutions of the whole batch before taking cs_main. If
+        // any fails, AcceptBlockHeader checks each one again to find it.
+        bool fSolutionsChecked = nScriptCheckThreads && headers.size() > 1 && CheckHeaderSolutions(headers, vCommitted);
+
         LOCK(cs_main);
 
-        if (nCount == 0) {
+        if (headers.empty() && nHeld == 0) {
             // Nothing interesting. Stop asking this peers for more headers.
             return true;
         }
 
         CBlockIndex *pindexLast = NULL;
-        BOOST_FOREACH(const CBlockHeader& header, headers) {
+        for (size_t i = 0; i < headers.size(); i++) {
+            const CBlockHeader& header = headers[i];
             CValidationState state;
             if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            if (!AcceptBlockHeader(header, state, &pindexLast)) {
+            if (!AcceptBlockHeader(header, state, &pindexLast, !fSolutionsChecked && !vCommitted[i])) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -5561,7 +8572,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         if (pindexLast)
             UpdateBlockAvailability(pfrom->GetId(), pindexLast->GetBlockHash());
 
-        if (nCount == MAX_HEADERS_RESULTS && pindexLast) {
+        if (nHeld > 0) {
+            // The peer picks up after the last header held back, which only
+            // we know about
+            CBlockLocator locator = chainActive.GetLocator(pindexLast);
+            locator.vHave.insert(locator.vHave.begin(), hashLastHeld);
+            LogPrint("net", "more getheaders (%d held back) to end to peer=%d (startheight:%d)\n", nHeld, pfrom->id, pfrom->nStartingHeight);
+            pfrom->PushMessage("getheaders", locator, uint256());
+        } else if (nCount == MAX_HEADERS_RESULTS && pindexLast) {
             // Headers message had its maximum size; the peer may have more headers.
             // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
             // from there instead.
@@ -5575,7 +8593,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     else if (strCommand == "block" && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         CBlock block;
-        vRecv >> block;
+        UnserializeInPlace(vRecv, block);
 
         CInv inv(MSG_BLOCK, block.GetHash());
         LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
@@ -5588,7 +8606,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         // Such an unrequested block may still be processed, subject to the
         // conditions in AcceptBlock().
         bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
-        ProcessNewBlock(state, pfrom, &block, forceProcessing, NULL);
+        ProcessBlockFromPeer(state, pfrom, block, forceProcessing);
         int nDoS;
         if (state.IsInvalid(nDoS)) {
             pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
@@ -5602,6 +8620,191 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
+    else if (strCommand == "sendcmpct")
+    {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        // Versions we don't know are ignored, as BIP 152 asks
+        if (nCMPCTBLOCKVersion == COMPACT_BLOCKS_ENCODING_VERSION) {
+            LOCK(cs_main);
+            CNodeState *nodestate = State(pfrom->GetId());
+            nodestate->fProvidesCompactBlocks = true;
+            nodestate->fPreferHighBandwidth = fAnnounceUsingCMPCTBLOCK;
+        }
+    }
+
+
+    else if (strCommand == "getblocktxn")
+    {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+
+        BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
+        if (it == mapBlockIndex.end() || !(it->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrint("cmpctblock", "peer=%d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+            return true;
+        }
+
+        // Only blocks near the tip were sent as cmpctblocks; anything deeper
+        // is a probe for what we have stored.
+        if (!chainActive.Contains(it->second) || it->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            LogPrint("cmpctblock", "peer=%d sent us a getblocktxn for a block that is not recent\n", pfrom->id);
+            return true;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, it->second))
+            assert(!"cannot load block from disk");
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer=%d sent us a getblocktxn with out-of-bounds tx indices", pfrom->id);
+            }
+            resp.txn[i] = block.vtx[req.indexes[i]];
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        UnserializeInPlace(vRecv, cmpctblock);
+
+        CBlock block;
+        bool fBlockReconstructed = false;
+        {
+            LOCK(cs_main);
+
+            if (mapBlockIndex.find(cmpctblock.header.hashPrevBlock) == mapBlockIndex.end()) {
+                // The block doesn't connect to anything we know; fetch the
+                // headers leading up to it first.
+                if (!IsInitialBlockDownload())
+                    pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), uint256());
+                return true;
+            }
+
+            CBlockIndex *pindex = NULL;
+            CValidationState state;
+            if (!AcceptBlockHeader(cmpctblock.header, state, &pindex)) {
+                int nDoS;
+                if (state.IsInvalid(nDoS)) {
+                    if (nDoS > 0)
+                        Misbehaving(pfrom->GetId(), nDoS);
+                    return error("invalid header received in cmpctblock");
+                }
+                return true;
+            }
+            assert(pindex);
+
+            const uint256 hash = pindex->GetBlockHash();
+            pfrom->AddInventoryKnown(CInv(MSG_BLOCK, hash));
+            UpdateBlockAvailability(pfrom->GetId(), hash);
+
+            if (pindex->nStatus & BLOCK_HAVE_DATA)
+                return true;
+
+            // Only a block on top of our tip is worth rebuilding from the
+            // mempool. Anything else is left to the normal download logic,
+            // which now knows the header.
+            if (pindex->pprev != chainActive.Tip()) {
+                LogPrint("cmpctblock", "cmpctblock %s from peer=%d does not extend our tip\n", hash.ToString(), pfrom->id);
+                return true;
+            }
+
+            CNodeState *nodestate = State(pfrom->GetId());
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+            // Only ask this peer for the rest if nobody else is sending it
+            // and there is room in its download queue
+            bool fCanRequest = itInFlight != mapBlocksInFlight.end() ?
+                itInFlight->second.first == pfrom->GetId() :
+                nodestate->nBlocksInFlight < nodestate->nBlockWindow;
+
+            std::shared_ptr<PartiallyDownloadedBlock> partialBlock(new PartiallyDownloadedBlock(&mempool));
+            ReadStatus status = partialBlock->InitData(cmpctblock);
+            if (status == READ_STATUS_INVALID) {
+                // Reset the download in case it was asked of this peer
+                if (itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == pfrom->GetId())
+                    MarkBlockAsReceived(hash);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer=%d sent us an invalid cmpctblock", pfrom->id);
+            }
+
+            BlockTransactionsRequest req;
+            if (status == READ_STATUS_OK) {
+                for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                    if (!partialBlock->IsTxAvailable(i))
+                        req.indexes.push_back(i);
+                }
+                if (req.indexes.empty()) {
+                    // Everything was prefilled or in our mempool
+                    status = partialBlock->FillBlock(block, std::vector<CTransactionRef>());
+                    fBlockReconstructed = (status == READ_STATUS_OK);
+                }
+            }
+
+            if (!fBlockReconstructed && fCanRequest) {
+                if (status == READ_STATUS_OK) {
+                    req.blockhash = hash;
+                    MarkBlockAsInFlight(pfrom->GetId(), hash, chainparams.GetConsensus(), pindex, partialBlock);
+                    pfrom->PushMessage("getblocktxn", req);
+                } else {
+                    // Rebuilding failed; ask for the whole block
+                    MarkBlockAsInFlight(pfrom->GetId(), hash, chainparams.GetConsensus(), pindex);
+                    pfrom->PushMessage("getdata", std::vector<CInv>(1, CInv(MSG_BLOCK, hash)));
+                }
+            }
+        }
+
+        if (fBlockReconstructed)
+            ProcessReconstructedBlock(pfrom, block);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        UnserializeInPlace(vRecv, resp);
+
+        CBlock block;
+        bool fBlockReconstructed = false;
+        {
+            LOCK(cs_main);
+
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(resp.blockhash);
+            if (itInFlight == mapBlocksInFlight.end() || !itInFlight->second.second->partialBlock ||
+                    itInFlight->second.first != pfrom->GetId()) {
+                LogPrint("cmpctblock", "peer=%d sent us block transactions for block we weren't expecting\n", pfrom->id);
+                return true;
+            }
+
+            std::shared_ptr<PartiallyDownloadedBlock> partialBlock = itInFlight->second.second->partialBlock;
+            ReadStatus status = partialBlock->FillBlock(block, resp.txn);
+            if (status == READ_STATUS_INVALID) {
+                // Reset the download so that someone else can be asked
+                MarkBlockAsReceived(resp.blockhash);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer=%d sent us invalid compact block transactions", pfrom->id);
+            } else if (status == READ_STATUS_FAILED) {
+                // A short id collision; ask for the whole block
+                CBlockIndex *pindex = itInFlight->second.second->pindex;
+                MarkBlockAsInFlight(pfrom->GetId(), resp.blockhash, chainparams.GetConsensus(), pindex);
+                pfrom->PushMessage("getdata", std::vector<CInv>(1, CInv(MSG_BLOCK, resp.blockhash)));
+            } else {
+                fBlockReconstructed = true;
+            }
+        }
+
+        if (fBlockReconstructed)
+            ProcessReconstructedBlock(pfrom, block);
+    }
+
+
     // This asymmetric behavior for inbound and outbound connections was introduced
     // to prevent a fingerprinting attack: an attacker can send specific fake addresses
     // to users' AddrMan and later request them by sending getaddr messages.
@@ -5617,7 +8820,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr();
         BOOST_FOREACH(const CAddress &addr, vAddr)
             pfrom->PushAddress(addr);
@@ -5641,16 +8847,16 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         mempool.queryHashes(vtxid);
         vector<CInv> vInv;
         BOOST_FOREACH(uint256& hash, vtxid) {
-            CTransaction tx;
-            bool fInMemPool = mempool.lookup(hash, tx);
-            if (fInMemPool && IsExpiringSoonTx(tx, currentHeight + 1)) {
+            CTransactionRef ptx = mempool.get(hash);
+            bool fInMemPool = ptx != NULL;
+            if (fInMemPool && IsExpiringSoonTx(*ptx, currentHeight + 1)) {
                 continue;
             }
 
             CInv inv(MSG_TX, hash);
             if (pfrom->pfilter) {
                 if (!fInMemPool) continue; // another thread removed since queryHashes, maybe...
-                if (!pfrom->pfilter->IsRelevantAndUpdate(tx)) continue;
+                if (!pfrom->pfilter->IsRelevantAndUpdate(*ptx)) continue;
             }
             vInv.push_back(inv);
             if (vInv.size() == MAX_INV_SZ) {
@@ -5872,6 +9078,22 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     return true;
 }
 
+/**
+ * Serializes the handling of messages that use chain state, the mempool or
+ * block download state, as the single message handler thread used to. The
+ * messages accepted by IsPeerMessage only touch their own peer and state with
+ * locks of its own, so every handler thread can work on them at once.
+ */
+static CCriticalSection cs_chainMessages;
+
+static bool IsPeerMessage(const std::string& strCommand)
+{
+    return strCommand == "ping" || strCommand == "pong" ||
+           strCommand == "addr" || strCommand == "getaddr" ||
+           strCommand == "filterload" || strCommand == "filteradd" || strCommand == "filterclear" ||
+           strCommand == "reject" || strCommand == "notfound";
+}
+
 // requires LOCK(cs_vRecvMsg)
 bool ProcessMessages(CNode* pfrom)
 {
@@ -5888,8 +9110,20 @@ bool ProcessMessages(CNode* pfrom)
     //
     bool fOk = true;
 
-    if (!pfrom->vRecvGetData.empty())
+    std::list<CTxPrecheckQueue::Result> listPrechecked;
+    txPrecheckQueue.TakeDone(pfrom->GetId(), listPrechecked);
+    if (!listPrechecked.empty()) {
+        LOCK(cs_chainMessages);
+        BOOST_FOREACH(const CTxPrecheckQueue::Result& result, listPrechecked) {
+            if (ProcessTransaction(pfrom, result.tx, result.fValid ? NULL : &result.state))
+                txPrecheckQueue.Refund(pfrom->GetId(), result.nCost);
+        }
+    }
+
+    if (!pfrom->vRecvGetData.empty()) {
+        LOCK(cs_chainMessages);
         ProcessGetData(pfrom);
+    }
 
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return fOk;
@@ -5936,8 +9170,8 @@ bool ProcessMessages(CNode* pfrom)
 
         // Checksum
         CDataStream& vRecv = msg.vRecv;
-        uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
-        unsigned int nChecksum = ReadLE32((unsigned char*)&hash);
+        const uint256& hash = msg.GetMessageHash();
+        unsigned int nChecksum = ReadLE32(hash.begin());
         if (nChecksum != hdr.nChecksum)
         {
             LogPrintf("%s(%s, %u bytes): CHECKSUM ERROR nChecksum=%08x hdr.nChecksum=%08x\n", __func__,
@@ -5946,10 +9180,19 @@ bool ProcessMessages(CNode* pfrom)
         }
 
         // Process message
+        NetMessageMetrics& metrics = GetNetMessageMetrics(strCommand);
+        metrics.received.increment();
+        metrics.receivedBytes.value += nMessageSize + CMessageHeader::HEADER_SIZE;
+        int64_t nProcessStart = GetTimeMicros();
         bool fRet = false;
         try
         {
-            fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+            if (IsPeerMessage(strCommand)) {
+                fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+            } else {
+                LOCK(cs_chainMessages);
+                fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+            }
             boost::this_thread::interruption_point();
         }
         catch (const std::ios_base::failure& e)
@@ -5979,6 +9222,10 @@ bool ProcessMessages(CNode* pfrom)
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
 
+        int64_t nProcessMicros = GetTimeMicros() - nProcessStart;
+        metrics.processTime.observe(nProcessMicros);
+        pfrom->RecordMessageProcessed(strCommand, nMessageSize + CMessageHeader::HEADER_SIZE, nProcessMicros);
+
         if (!fRet)
             LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
 
@@ -5986,13 +9233,19 @@ bool ProcessMessages(CNode* pfrom)
     }
 
     // In case the connection got shut down, its receive buffer was wiped
-    if (!pfrom->fDisconnect)
+    if (!pfrom->fDisconnect) {
+        for (std::deque<CNetMessage>::iterator itDone = pfrom->vRecvMsg.begin(); itDone != it; ++itDone)
+            itDone->ReleaseBuffer();
         pfrom->vRecvMsg.erase(pfrom->vRecvMsg.begin(), it);
+    }
 
     return fOk;
 }
 
 
+/** Time (in usec) of the next transaction announcement batch to inbound peers. Guarded by cs_main. */
+static int64_t nNextInboundInvSend = 0;
+
 bool SendMessages(CNode* pto, bool fSendTrickle)
 {
     const Consensus::Params& consensusParams = Params().GetConsensus();
@@ -6036,8 +9289,10 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             BOOST_FOREACH(CNode* pnode, vNodes)
             {
                 // Periodically clear addrKnown to allow refresh broadcasts
-                if (nLastRebroadcast)
+                if (nLastRebroadcast) {
+                    LOCK(pnode->cs_vAddrToSend);
                     pnode->addrKnown.reset();
+                }
 
                 // Rebroadcast our address
                 AdvertizeLocal(pnode);
@@ -6051,23 +9306,32 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         if (fSendTrickle)
         {
-            vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
+            vector<CAddress> vAddrToSend;
             {
-                if (!pto->addrKnown.contains(addr.GetKey()))
+                LOCK(pto->cs_vAddrToSend);
+                vAddrToSend.swap(pto->vAddrToSend);
+                vector<CAddress>::iterator itNew = vAddrToSend.begin();
+                BOOST_FOREACH(const CAddress& addr, vAddrToSend)
                 {
-                    pto->addrKnown.insert(addr.GetKey());
-                    vAddr.push_back(addr);
-                    // receiver rejects addr messages larger than 1000
-                    if (vAddr.size() >= 1000)
+                    if (!pto->addrKnown.contains(addr.GetKey()))
                     {
-                        pto->PushMessage("addr", vAddr);
-                        vAddr.clear();
+                        pto->addrKnown.insert(addr.GetKey());
+                        *itNew++ = addr;
                     }
                 }
+                vAddrToSend.erase(itNew, vAddrToSend.end());
+            }
+            vector<CAddress> vAddr;
+            BOOST_FOREACH(const CAddress& addr, vAddrToSend)
+            {
+                vAddr.push_back(addr);
+                // receiver rejects addr messages larger than 1000
+                if (vAddr.size() >= 1000)
+                {
+                    pto->PushMessage("addr", vAddr);
+                    vAddr.clear();
+                }
             }
-            pto->vAddrToSend.clear();
             if (!vAddr.empty())
                 pto->PushMessage("addr", vAddr);
         }
@@ -6118,38 +9382,54 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         // Message: inventory
         //
+        // Transactions are announced in batches, at random times following a
+        // Poisson process per peer. Inbound peers share one timer so that
+        // connecting many times doesn't tell a spy more about where a
+        // transaction came from. Waiting also lets most peers announce a
+        // transaction to us first, which saves announcing it back to them.
+        int64_t nNow = GetTimeMicros();
+        bool fSendTxInv = pto->fWhitelisted;
+        if (pto->nNextInvSend < nNow) {
+            fSendTxInv = true;
+            if (pto->fInbound) {
+                if (nNextInboundInvSend < nNow)
+                    nNextInboundInvSend = PoissonNextSend(nNow, INVENTORY_BROADCAST_INTERVAL);
+                pto->nNextInvSend = nNextInboundInvSend;
+            } else {
+                pto->nNextInvSend = PoissonNextSend(nNow, INVENTORY_BROADCAST_INTERVAL >> 1);
+            }
+        }
         vector<CInv> vInv;
         vector<CInv> vInvWait;
+        // Block announcements go in messages of their own, ahead of the
+        // transaction relay queued to the peer
+        vector<CInv> vInvBlock;
         {
             LOCK(pto->cs_inventory);
             vInv.reserve(pto->vInventoryToSend.size());
             vInvWait.reserve(pto->vInventoryToSend.size());
+            unsigned int nTxInvSent = 0;
             BOOST_FOREACH(const CInv& inv, pto->vInventoryToSend)
             {
                 if (pto->setInventoryKnown.count(inv))
                     continue;
 
-                // trickle out tx inv to protect privacy
-                if (inv.type == MSG_TX && !fSendTrickle)
-                {
-                    // 1/4 of tx invs blast to all immediately
-                    static uint256 hashSalt;
-                    if (hashSalt.IsNull())
-                        hashSalt = GetRandHash();
-                    uint256 hashRand = ArithToUint256(UintToArith256(inv.hash) ^ UintToArith256(hashSalt));
-                    hashRand = Hash(BEGIN(hashRand), END(hashRand));
-                    bool fTrickleWait = ((UintToArith256(hashRand) & 3) != 0);
-
-                    if (fTrickleWait)
-                    {
+                // Hold transactions back until the next batch, of a bounded size
+                if (inv.type == MSG_TX) {
+                    if (!fSendTxInv || nTxInvSent >= INVENTORY_BROADCAST_MAX) {
                         vInvWait.push_back(inv);
                         continue;
                     }
+                    nTxInvSent++;
                 }
 
                 // returns true if wasn't already contained in the set
                 if (pto->setInventoryKnown.insert(inv).second)
                 {
+                    if (inv.type == MSG_BLOCK) {
+                        vInvBlock.push_back(inv);
+                        continue;
+                    }
                     vInv.push_back(inv);
                     if (vInv.size() >= 1000)
                     {
@@ -6160,11 +9440,13 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             }
             pto->vInventoryToSend = vInvWait;
         }
+        if (!vInvBlock.empty())
+            pto->PushMessageBuffer(CNode::MakeMessage("inv", vInvBlock), SEND_CLASS_BLOCK);
         if (!vInv.empty())
             pto->PushMessage("inv", vInv);
 
         // Detect whether we're stalling
-        int64_t nNow = GetTimeMicros();
+        nNow = GetTimeMicros();
         if (!pto->fDisconnect && state.nStallingSince && state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
             // Stalling only triggers when the block download window cannot move. During normal steady state,
             // the download window should be much larger than the to-be-downloaded set of blocks, so disconnection
@@ -6190,16 +9472,32 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: getdata (blocks)
         //
         vector<CInv> vGetData;
-        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < state.nBlockWindow) {
             vector<CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
+            CBlockIndex *pindexStaller = NULL;
+            FindNextBlocksToDownload(pto->GetId(), state.nBlockWindow - state.nBlocksInFlight, vToDownload, staller, pindexStaller);
             BOOST_FOREACH(CBlockIndex *pindex, vToDownload) {
                 vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), consensusParams, pindex);
                 LogPrint("net", "Requesting block %s (%d) peer=%d\n", pindex->GetBlockHash().ToString(),
                     pindex->nHeight, pto->id);
             }
+            if (vToDownload.empty() && staller != -1 && state.nBlockLatencyAvg > 0) {
+                // The window is held up by a block in flight from a slower peer. Once it has been
+                // waiting for twice as long as this peer usually takes, ask this peer for it
+                // instead, before the other one gets disconnected for stalling.
+                const QueuedBlock& queuedBlock = *mapBlocksInFlight[pindexStaller->GetBlockHash()].second;
+                if (nNow - queuedBlock.nTimeRequested > 2 * state.nBlockLatencyAvg) {
+                    CNodeState *stallerState = State(staller);
+                    stallerState->nBlockWindow = std::max(MIN_BLOCKS_IN_TRANSIT_PER_PEER, stallerState->nBlockWindow / 2);
+                    vGetData.push_back(CInv(MSG_BLOCK, pindexStaller->GetBlockHash()));
+                    MarkBlockAsInFlight(pto->GetId(), pindexStaller->GetBlockHash(), consensusParams, pindexStaller);
+                    LogPrint("net", "Reassigning block %s (%d) from peer=%d to peer=%d\n", pindexStaller->GetBlockHash().ToString(),
+                        pindexStaller->nHeight, staller, pto->id);
+                    staller = -1;
+                }
+            }
             if (state.nBlocksInFlight == 0 && staller != -1) {
                 if (State(staller)->nStallingSince == 0) {
                     State(staller)->nStallingSince = nNow;
@@ -6243,14 +9541,13 @@ public:
     CMainCleanup() {}
     ~CMainCleanup() {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        blockIndexArena.Clear();
 
         // orphan transactions
         mapOrphanTransactions.clear();
         mapOrphanTransactionsByPrev.clear();
+        mapOrphanPeers.clear();
     }
 } instance_of_cmaincleanup;
 
@@ -31,6 +31,7 @@
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -40,9 +41,20 @@
 #include <boost/unordered_map.hpp>
 
 class CBlockIndex;
+class CBlockArchive;
+class CBlockFileMap;
+class CBlockVolumes;
+class CResponseCache;
+class CTxIndexCache;
+class CBlockFileRegion;
 class CBlockTreeDB;
+class CBlockUndo;
+struct CBlockIndexesUpdate;
 class CBloomFilter;
+class CCoinsViewDB;
+class CCoinsViewMemory;
 class CInv;
+class CShieldedBatchVerifier;
 class CScriptCheck;
 class CValidationInterface;
 class CValidationState;
@@ -67,8 +79,22 @@ static const unsigned int MAX_P2SH_SIGOPS = 15;
 static const unsigned int MAX_STANDARD_TX_SIGOPS = MAX_BLOCK_SIGOPS/5;
 /** Default for -minrelaytxfee, minimum relay fee for transactions */
 static const unsigned int DEFAULT_MIN_RELAY_TX_FEE = 100;
+/** Default for -mmapblockfiles, the number of block files kept memory mapped for reading */
+static const unsigned int DEFAULT_MMAP_BLOCK_FILES = 0;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** The maximum size of an orphan transaction that is kept */
+static const unsigned int MAX_ORPHAN_TX_SIZE = 5000;
+/** Orphans may take up this many bytes per -maxorphantx on average */
+static const unsigned int MAX_ORPHAN_BYTES_PER_TX = 1000;
+/** Expiration time for orphan transactions in seconds */
+static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
+/** Minimum time between orphan transactions expire time checks in seconds */
+static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
 /** Default for -txexpirydelta, in number of blocks */
 static const unsigned int DEFAULT_TX_EXPIRY_DELTA = 20;
 /** The number of blocks within expiry height when a tx is considered to be expiring soon */
@@ -79,17 +105,50 @@ static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** The pre-allocation extent for blk?????.dat files when not pruning */
+static const unsigned int BLOCKFILE_PREALLOC_SIZE = 0x4000000; // 64 MiB
+/** The pre-allocation extent for rev?????.dat files when not pruning */
+static const unsigned int UNDOFILE_PREALLOC_SIZE = 0x800000; // 8 MiB
+/** -blockfilesync default (seconds between syncs of block and undo data, 0 = at every block index write) */
+static const int64_t DEFAULT_BLOCKFILE_SYNC_INTERVAL = 0;
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
-static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** -proofthreads default (threads for one Sprout proof, 0 = the cores script verification leaves) */
+static const int DEFAULT_PROOF_THREADS = 0;
+/** Number of blocks that can be requested at any given time from a single peer whose download speed is not known yet. */
+static const int DEFAULT_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds of the number of blocks in flight from a single peer, which follows its measured download speed. */
+static const int MIN_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 64;
+/** A peer is given as many blocks at a time as it delivers in this many seconds. */
+static const unsigned int BLOCK_DOWNLOAD_TARGET_TIME = 4;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached its tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 160;
+/** Number of Equihash solutions read back from the block tree database that are kept in memory */
+static const unsigned int BLOCK_SOLUTION_CACHE_SIZE = 1000;
+/** Number of block index entries allocated together */
+static const size_t BLOCK_INDEX_ARENA_CHUNK_SIZE = 4096;
+/** Number of hashes of headers with a verified Equihash solution that are remembered */
+static const size_t MAX_VERIFIED_SOLUTIONS = 10000;
+/** Number of blocks read from a block file before their Equihash solutions are verified together */
+static const size_t IMPORT_BATCH_SIZE = 16;
+/** Default for -headercommitment, accepting headers the chain parameters commit to without verifying each solution */
+static const bool DEFAULT_HEADER_COMMITMENT = true;
+/** Headers, of all peers, held back until they link to a committed hash; more than the gap between two checkpoints */
+static const size_t MAX_PENDING_HEADERS = 20000;
+/** Blocks this close to the best header, in equivalent time, are verified in full even below -assumevalid */
+static const int64_t ASSUME_VALID_MIN_PROOF_TIME = 14 * 24 * 60 * 60;
+/** Number of blocks a rewind reads ahead and disconnects into one cache layer before flushing it */
+static const int REWIND_BATCH_SIZE = 128;
+/** Number of blocks the startup verification reads and checks on the -par threads at a time */
+static const int VERIFYDB_BATCH_SIZE = 64;
+/** Default for -checkinbackground */
+static const bool DEFAULT_CHECK_IN_BACKGROUND = true;
 /** Size of the "block download window": how far ahead of our current height do we fetch?
  *  Larger windows tolerate larger download speed differences between peer, but increase the potential
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
@@ -106,25 +165,32 @@ static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
 static const int64_t BLOCK_DOWNLOAD_TIMEOUT_BASE = 1000000;
 /** Additional block download timeout per parallel downloading peer (i.e. 5 min) */
 static const int64_t BLOCK_DOWNLOAD_TIMEOUT_PER_PEER = 500000;
+/** Average delay between transaction announcements to inbound peers, in seconds. Outbound peers get
+ *  theirs twice as often. Transactions that a peer announces to us in the meantime are not sent back. */
+static const unsigned int INVENTORY_BROADCAST_INTERVAL = 5;
+/** Maximum number of transactions announced to a peer at a time, per broadcast interval second. */
+static const unsigned int INVENTORY_BROADCAST_MAX = 7 * INVENTORY_BROADCAST_INTERVAL;
 
 // Sanity check the magic numbers when we change them
 BOOST_STATIC_ASSERT(DEFAULT_BLOCK_MAX_SIZE <= MAX_BLOCK_SIZE);
 BOOST_STATIC_ASSERT(DEFAULT_BLOCK_PRIORITY_SIZE <= DEFAULT_BLOCK_MAX_SIZE);
+BOOST_STATIC_ASSERT(MIN_BLOCKS_IN_TRANSIT_PER_PEER <= DEFAULT_BLOCKS_IN_TRANSIT_PER_PEER);
+BOOST_STATIC_ASSERT(DEFAULT_BLOCKS_IN_TRANSIT_PER_PEER <= MAX_BLOCKS_IN_TRANSIT_PER_PEER);
 
 #define equihash_parameters_acceptable(N, K) \
     ((CBlockHeader::HEADER_SIZE + equihash_solution_size(N, K))*MAX_HEADERS_RESULTS < \
      MAX_PROTOCOL_MESSAGE_LENGTH-1000)
 
-struct BlockHasher
-{
-    size_t operator()(const uint256& hash) const { return hash.GetCheapHash(); }
-};
-
 extern unsigned int expiryDelta;
 extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
+/**
+ * Guards the orphan transaction pool, so that looking up and evicting
+ * orphans doesn't need cs_main. When both are held, cs_main is taken first.
+ */
+extern CCriticalSection cs_orphans ACQUIRED_AFTER(cs_main);
 extern CTxMemPool mempool;
-typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
+typedef boost::unordered_map<uint256, CBlockIndex*, CCoinsKeyHasher> BlockMap;
 extern BlockMap mapBlockIndex;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
@@ -136,13 +202,24 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fShieldedIndex;
+extern bool fAddressIndex;
+extern bool fSpentIndex;
+extern bool fTimestampIndex;
+extern bool fCoinStatsIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+/** Block whose ancestors on the best header chain have their proofs and signatures assumed valid, or null */
+extern uint256 hashAssumeValid;
+extern bool fHeaderCommitment;
 // TODO: remove this flag by structuring our code such that
 // it is unneeded for testing
 extern bool fCoinbaseEnforcedProtectionEnabled;
 extern size_t nCoinCacheUsage;
+/** Memory budgets of the anchor tree and nullifier caches in pcoinsTip (bytes) */
+extern size_t nAnchorCacheUsage;
+extern size_t nNullifierCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 extern int64_t nMaxTipAge;
@@ -160,6 +237,8 @@ extern bool fHavePruned;
 extern bool fPruneMode;
 /** Number of MiB of block files that we're trying to stay below. */
 extern uint64_t nPruneTarget;
+/** Seconds that block and undo data may go unsynced across block index writes (-blockfilesync). */
+extern int64_t nBlockFileSyncInterval;
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
 static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
 
@@ -197,7 +276,7 @@ bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
 FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 /** Open an undo file (rev?????.dat) */
 FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
-/** Translation to a filesystem path */
+/** Translation to a filesystem path, on whichever volume holds the block file */
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp = NULL);
@@ -205,6 +284,8 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp = NULL);
 bool InitBlockIndex();
 /** Load the block tree and coins database from disk */
 bool LoadBlockIndex();
+/** Update the chain tip based on database information. */
+bool LoadChainTip(const CChainParams& chainparams);
 /** Unload database information */
 void UnloadBlockIndex();
 /** Process protocol messages received from a given node */
@@ -218,14 +299,61 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the shielded proof checking thread */
+void ThreadProofCheck();
+/** Run an instance of the coin prefetch thread */
+void ThreadCoinPrefetch();
+/** Run an instance of the thread checking shielded transactions from peers */
+void ThreadTxPrecheck();
+/** Run an instance of the thread verifying proofs of blocks waiting to be connected */
+void ThreadBlockPrevalidation();
+/** Run an instance of the header Equihash checking thread */
+void ThreadHeaderCheck();
+/** Run the thread removing the block and undo files of pruned block files */
+void ThreadPruneUnlink();
+/** Remove the files still waiting for the prune thread, on shutdown */
+void FlushPruneUnlinks();
+/** Find the compressed block files, returning false if one can't be read */
+bool LoadBlockArchives();
+/** Run the thread compressing old block files at zstd level nLevel */
+void ThreadCompressBlockFiles(int nLevel);
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader, int64_t nPowTargetSpacing);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
+
+/** The active chain tip, copied out of the block index whenever it changes */
+struct CChainTipSnapshot
+{
+    uint256 hash;
+    int nHeight;
+    int64_t nTime;
+    int64_t nMedianTimePast;
+    arith_uint256 nChainWork;
+    uint256 hashFinalSproutRoot;
+    uint256 hashFinalSaplingRoot;
+    //! Network solutions per second over the DEFAULT_SOLPS_LOOKUP blocks up to the tip
+    int64_t nNetworkSolPS;
+};
+
+/**
+ * The tip as of its last change, or NULL while there is none. It is
+ * read without cs_main, for callers that only need the tip itself; one
+ * holding cs_main sees the same tip as chainActive.
+ */
+std::shared_ptr<const CChainTipSnapshot> GetChainTipSnapshot();
 /** Format a string that describes several potential problems detected by the core */
 std::string GetWarnings(const std::string& strFor);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock, bool fAllowSlow = false);
+/**
+ * Retrieve each of vHash as GetTransaction would. Those found through
+ * -txindex are read in block file order, reading ahead over neighbouring
+ * ones, rather than in the order asked for. vFound[i] tells whether vHash[i]
+ * was found, in which case vTx[i] and vHashBlock[i] are set.
+ */
+void GetTransactions(const std::vector<uint256>& vHash, std::vector<CTransaction>& vTx, std::vector<uint256>& vHashBlock,
+                     std::vector<bool>& vFound, bool fAllowSlow = false);
 /** Find the best known block, and make it the tip of the block chain */
 bool ActivateBestChain(CValidationState &state, const CBlock *pblock = NULL);
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams);
@@ -248,10 +376,17 @@ CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams);
 void FindFilesToPrune(std::set<int>& setFilesToPrune);
 
 /**
- *  Actually unlink the specified files
+ *  Queue the specified files to be unlinked by the prune thread. Their block
+ *  index entries must have been written already.
  */
 void UnlinkPrunedFiles(std::set<int>& setFilesToPrune);
 
+/**
+ * Prune the block files holding only blocks at or below nManualPruneHeight,
+ * and never within MIN_BLOCKS_TO_KEEP of the tip, regardless of the target.
+ */
+void PruneBlockFilesManual(int nManualPruneHeight);
+
 /** Create a new block index entry for a given block hash */
 CBlockIndex * InsertBlockIndex(uint256 hash);
 /** Get statistics from node state */
@@ -263,9 +398,29 @@ void FlushStateToDisk();
 /** Prune block files and flush state to disk. */
 void PruneAndFlush();
 
-/** (try to) add transaction to memory pool **/
+/** (try to) add transaction to memory pool; the pool shares ptx rather than copying it **/
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransactionRef &ptx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fRejectAbsurdFee=false, bool fOverrideMempoolLimit=false);
+/** As above, for a transaction the caller keeps; the pool holds a copy **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectAbsurdFee=false);
+                        bool* pfMissingInputs, bool fRejectAbsurdFee=false, bool fOverrideMempoolLimit=false);
+
+/** (try to) add transaction to memory pool with a specified acceptance time **/
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransactionRef &ptx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectAbsurdFee=false,
+                                bool fOverrideMempoolLimit=false);
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectAbsurdFee=false,
+                                bool fOverrideMempoolLimit=false);
+
+/** Evict transactions until the mempool is within -maxmempool */
+void LimitMempoolSize(CTxMemPool& pool);
+
+/** Dump the mempool to disk. */
+void DumpMempool();
+
+/** Load the mempool from disk. */
+bool LoadMempool();
 
 
 struct CNodeStateStats {
@@ -273,6 +428,9 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nBlockWindow;
+    int64_t nBlockLatency;
+    double dBlocksPerSecond;
 };
 
 struct CDiskTxPos : public CDiskBlockPos
@@ -345,13 +503,15 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& ma
  * instead of being performed inline.
  */
 bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
-                           unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata,
+                           unsigned int flags, bool cacheStore, const PrecomputedTransactionData& txdata,
                            const Consensus::Params& consensusParams, uint32_t consensusBranchId,
                            std::vector<CScriptCheck> *pvChecks = NULL);
 
 /** Check a transaction contextually against a set of consensus rules */
 bool ContextualCheckTransaction(const CTransaction& tx, CValidationState &state, int nHeight, int dosLevel,
-                                bool (*isInitBlockDownload)() = IsInitialBlockDownload);
+                                bool (*isInitBlockDownload)() = IsInitialBlockDownload,
+                                CShieldedBatchVerifier* pShieldedBatch = NULL,
+                                bool fCheckShieldedProofs = true);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
@@ -420,12 +580,12 @@ private:
     bool cacheStore;
     uint32_t consensusBranchId;
     ScriptError error;
-    PrecomputedTransactionData *txdata;
+    const PrecomputedTransactionData *txdata;
 
 public:
     CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), consensusBranchId(0), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, uint32_t consensusBranchIdIn, PrecomputedTransactionData* txdataIn) :
-        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey), amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, uint32_t consensusBranchIdIn, const PrecomputedTransactionData* txdataIn) :
+        scriptPubKey(outIn.scriptPubKey), amount(outIn.nValue),
         ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), consensusBranchId(consensusBranchIdIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
 
     bool operator()();
@@ -445,10 +605,186 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the Sapling spend, output and binding signature checks
+ * of one transaction, bound to that transaction's signature hash.
+ */
+class CSaplingCheck
+{
+public:
+    enum Error {
+        SAPLING_OK,
+        SAPLING_BAD_SPEND,
+        SAPLING_BAD_OUTPUT,
+        SAPLING_BAD_BINDING_SIG,
+    };
+
+private:
+    const CTransaction *ptx;
+    uint256 dataToBeSigned;
+    Error error;
+
+public:
+    CSaplingCheck(): ptx(0), error(SAPLING_OK) {}
+    CSaplingCheck(const CTransaction& txIn, const uint256& dataToBeSignedIn) :
+        ptx(&txIn), dataToBeSigned(dataToBeSignedIn), error(SAPLING_OK) { }
+
+    bool operator()();
+
+    void swap(CSaplingCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(dataToBeSigned, check.dataToBeSigned);
+        std::swap(error, check.error);
+    }
+
+    const CTransaction* GetTransaction() const { return ptx; }
+    Error GetError() const { return error; }
+};
+
+/**
+ * Closure representing the Ed25519 check of the joinSplitSig of one
+ * transaction over its signature hash.
+ */
+class CJoinSplitSigCheck
+{
+private:
+    const CTransaction *ptx;
+    uint256 dataToBeSigned;
+
+public:
+    CJoinSplitSigCheck(): ptx(0) {}
+    CJoinSplitSigCheck(const CTransaction& txIn, const uint256& dataToBeSignedIn) :
+        ptx(&txIn), dataToBeSigned(dataToBeSignedIn) { }
+
+    bool operator()();
+
+    void swap(CJoinSplitSigCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(dataToBeSigned, check.dataToBeSigned);
+    }
+
+    const CTransaction* GetTransaction() const { return ptx; }
+};
+
+/**
+ * Closure representing a single shielded proof check: either one JoinSplit of
+ * a transaction, the JoinSplit signature of a transaction, or the Sapling
+ * bundle of a transaction. These are queued on a CCheckQueue so that
+ * verification is spread across the -par worker threads in the same way as
+ * transparent script checks.
+ */
+class CProofCheck
+{
+private:
+    const CTransaction *ptx;
+    //! Index into ptx->vjoinsplit, or SAPLING or JOINSPLIT_SIG
+    int nJoinSplit;
+    CSaplingCheck saplingCheck;
+    CJoinSplitSigCheck joinSplitSigCheck;
+
+public:
+    static const int SAPLING = -1;
+    static const int JOINSPLIT_SIG = -2;
+
+    CProofCheck(): ptx(0), nJoinSplit(SAPLING) {}
+    CProofCheck(const CTransaction& txIn, int nJoinSplitIn) :
+        ptx(&txIn), nJoinSplit(nJoinSplitIn) { }
+    CProofCheck(const CSaplingCheck& saplingCheckIn) :
+        ptx(saplingCheckIn.GetTransaction()), nJoinSplit(SAPLING), saplingCheck(saplingCheckIn) { }
+    CProofCheck(const CJoinSplitSigCheck& joinSplitSigCheckIn) :
+        ptx(joinSplitSigCheckIn.GetTransaction()), nJoinSplit(JOINSPLIT_SIG), joinSplitSigCheck(joinSplitSigCheckIn) { }
+
+    bool operator()();
+
+    void swap(CProofCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(nJoinSplit, check.nJoinSplit);
+        saplingCheck.swap(check.saplingCheck);
+        joinSplitSigCheck.swap(check.joinSplitSigCheck);
+    }
+};
+
+/**
+ * Reads one input of a block from the view backing the coins cache. Run on
+ * a CCheckQueue so that the disk reads ConnectBlock would otherwise make one
+ * by one are spread across the -par worker threads.
+ */
+class CCoinPrefetch
+{
+private:
+    const CCoinsView *pview;
+    COutPoint outpoint;
+    Coin *pcoin;
+
+public:
+    CCoinPrefetch(): pview(0), pcoin(0) {}
+    CCoinPrefetch(const CCoinsView& viewIn, const COutPoint& outpointIn, Coin& coinOut) :
+        pview(&viewIn), outpoint(outpointIn), pcoin(&coinOut) { }
+
+    bool operator()() {
+        pview->GetCoin(outpoint, *pcoin);
+        return true;
+    }
+
+    void swap(CCoinPrefetch &prefetch) {
+        std::swap(pview, prefetch.pview);
+        std::swap(outpoint, prefetch.outpoint);
+        std::swap(pcoin, prefetch.pcoin);
+    }
+};
+
+/**
+ * Checks the Equihash solution of one header of a headers message. Run on a
+ * CCheckQueue so that a whole batch of headers is verified across the -par
+ * worker threads before the headers are linked into the index in order.
+ */
+class CHeaderCheck
+{
+private:
+    const CBlockHeader *pheader;
+
+public:
+    CHeaderCheck(): pheader(0) {}
+    CHeaderCheck(const CBlockHeader& headerIn) : pheader(&headerIn) { }
+
+    bool operator()();
+
+    void swap(CHeaderCheck &check) {
+        std::swap(pheader, check.pheader);
+    }
+};
+
+/**
+ * Collects the JoinSplit signature and Sapling checks of every transaction in
+ * a block so that they are verified together once the rest of the block's
+ * contextual checks have passed, instead of interleaving them with the
+ * per-transaction checks. If the block fails, the offending transaction is
+ * reported in the validation state.
+ */
+class CShieldedBatchVerifier
+{
+private:
+    std::vector<CJoinSplitSigCheck> vJoinSplitSigChecks;
+    std::vector<CSaplingCheck> vSaplingChecks;
+    //! Whether a bad JoinSplit signature is not to be punished, as in ContextualCheckTransaction
+    bool (*isInitBlockDownload)();
+
+public:
+    CShieldedBatchVerifier(bool (*isInitBlockDownloadIn)() = IsInitialBlockDownload) :
+        isInitBlockDownload(isInitBlockDownloadIn) { }
+
+    void AddJoinSplitSig(const CTransaction& tx, const uint256& dataToBeSigned);
+    void AddSapling(const CTransaction& tx, const uint256& dataToBeSigned);
+    bool Verify(CValidationState& state);
+    size_t Size() const { return vJoinSplitSigChecks.size() + vSaplingChecks.size(); }
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
+/** Read a block as it is serialized on disk, without checking it. Preferably from blockFileMap. */
+bool ReadRawBlockFromDisk(CBlockFileRegion& region, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
 
 
@@ -457,23 +793,85 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
- *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+ *  of problems. Note that in any case, coins may be modified. If pindexesUpdate is provided,
+ *  the changes to the address, spent and timestamp indexes are added to it for the caller
+ *  to write. The undo data is read from disk unless the caller already read it into
+ *  pblockUndo, which is consumed. */
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL,
+                     CBlockIndexesUpdate* pindexesUpdate = NULL, CBlockUndo* pblockUndo = NULL);
+
+/**
+ * Microseconds spent in each phase of connecting blocks, summed since
+ * startup, and the size of what was connected. The phases of ConnectBlock
+ * are also counted for blocks that are only checked. Requires cs_main.
+ */
+struct CBlockConnectStats
+{
+    int64_t nBlocks;
+    int64_t nTransactions;
+    int64_t nInputs;
+    int64_t nTimeLoad;        //!< reading the block and prefetching its inputs
+    int64_t nTimeCheckBlock;  //!< context-free checks of the block
+    int64_t nTimeCoins;       //!< looking inputs up and updating the coins
+    int64_t nTimeScripts;     //!< script checks, and waiting for the script threads
+    int64_t nTimeProofs;      //!< JoinSplit proof checks, and waiting for the proof threads
+    int64_t nTimeAnchors;     //!< commitment tree appends and anchors
+    int64_t nTimeConnect;     //!< all of ConnectBlock
+    int64_t nTimeIndex;       //!< undo data and index writes
+    int64_t nTimeFlush;       //!< flushing the block's cache layer
+    int64_t nTimeChainState;  //!< writing the chain state when it is due
+    int64_t nTimePostConnect; //!< mempool and wallet updates
+    int64_t nTimeTotal;       //!< all of ConnectTip
+
+    CBlockConnectStats() { SetNull(); }
+
+    void SetNull()
+    {
+        nBlocks = nTransactions = nInputs = 0;
+        nTimeLoad = nTimeCheckBlock = nTimeCoins = nTimeScripts = nTimeProofs = nTimeAnchors = 0;
+        nTimeConnect = nTimeIndex = nTimeFlush = nTimeChainState = nTimePostConnect = nTimeTotal = 0;
+    }
+
+    CBlockConnectStats& operator-=(const CBlockConnectStats& b)
+    {
+        nBlocks -= b.nBlocks;
+        nTransactions -= b.nTransactions;
+        nInputs -= b.nInputs;
+        nTimeLoad -= b.nTimeLoad;
+        nTimeCheckBlock -= b.nTimeCheckBlock;
+        nTimeCoins -= b.nTimeCoins;
+        nTimeScripts -= b.nTimeScripts;
+        nTimeProofs -= b.nTimeProofs;
+        nTimeAnchors -= b.nTimeAnchors;
+        nTimeConnect -= b.nTimeConnect;
+        nTimeIndex -= b.nTimeIndex;
+        nTimeFlush -= b.nTimeFlush;
+        nTimeChainState -= b.nTimeChainState;
+        nTimePostConnect -= b.nTimePostConnect;
+        nTimeTotal -= b.nTimeTotal;
+        return *this;
+    }
+};
+extern CBlockConnectStats blockConnectStats;
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck = false);
 
 /** Context-independent validity checks */
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true, bool fCheckSolution = true);
 bool CheckBlock(const CBlock& block, CValidationState& state,
                 libzcash::ProofVerifier& verifier,
                 bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 
 /** Context-dependent validity checks */
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex *pindexPrev);
-bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIndex *pindexPrev);
+bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIndex *pindexPrev, bool fCheckShieldedProofs = true);
 
-/** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
+/**
+ * Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held).
+ * A block with the same parent and transactions, but for the coinbase, is then connected without verifying their scripts
+ * and proofs again.
+ */
 bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex *pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 
 /**
@@ -484,7 +882,7 @@ bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex
  * If dbp is non-NULL, the file is known to already reside on disk
  */
 bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockIndex **pindex, bool fRequested, CDiskBlockPos* dbp);
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL);
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL, bool fCheckSolution = true);
 
 
 
@@ -498,6 +896,22 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
  */
 bool RewindBlockIndex(const CChainParams& params, bool& clearWitnessCaches);
 
+/**
+ * Bring a chainstate whose last flush was interrupted part way through back
+ * to a consistent state, by rolling back the old tip and rolling forward to
+ * the new one recorded in the head blocks marker.
+ */
+bool ReplayBlocks(const CChainParams& params, CCoinsView* view);
+
+/**
+ * Time connecting the blocks of chainActive from nStartHeight to nEndHeight
+ * again, from the block files and without changing any state. The chain
+ * state is taken back to nStartHeight - 1 in a cache layer above pcoinsTip,
+ * and each block is connected into a layer of its own that is then flushed
+ * into it, as ConnectTip does. stats gets the time the replay took.
+ */
+bool BenchmarkConnectBlocks(int nStartHeight, int nEndHeight, CBlockConnectStats& stats, std::string& strError);
+
 class CBlockFileInfo
 {
 public:
@@ -552,7 +966,12 @@ public:
      }
 };
 
-/** RAII wrapper for VerifyDB: Verify consistency of the block and coin databases */
+/**
+ * RAII wrapper for VerifyDB: Verify consistency of the block and coin databases.
+ * The blocks are read and checked on their own VERIFYDB_BATCH_SIZE at a time,
+ * with cs_main only held to disconnect and reconnect them in order, so that
+ * the node may run meanwhile; should the tip move, verification stops there.
+ */
 class CVerifyDB {
 public:
     CVerifyDB();
@@ -572,12 +991,38 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex);
 /** The currently-connected chain of blocks (protected by cs_main). */
 extern CChain chainActive;
 
+/** Memory mappings of the block files, used if enabled with -mmapblockfiles */
+extern CBlockFileMap blockFileMap;
+
+/** Directories of the block and undo files, set by -blocksdir and -blocksvolume */
+extern CBlockVolumes blockVolumes;
+
+/** Block files compressed by -compressblocks */
+extern CBlockArchive blockArchive;
+
+/** Transactions recently read through -txindex, sized by -txindexcache */
+extern CTxIndexCache txIndexCache;
+
+/** RPC and REST replies about buried blocks, sized by -rpcresponsecache */
+extern CResponseCache responseCache;
+
+/** Global variable that points to the coin database below pcoinsTip */
+extern CCoinsViewDB *pcoinsdbview;
+
+/** With -chainstateinmemory, the view between pcoinsTip and pcoinsdbview holding all of the chainstate, else NULL */
+extern CCoinsViewMemory *pcoinsmemory;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/** Approximate heap use of mapBlockIndex and its entries (requires cs_main) */
+size_t GetBlockIndexMemoryUsage();
+/** Approximate heap use of the orphan transaction pool, and how many it holds (requires cs_main) */
+size_t GetOrphanPoolMemoryUsage(size_t& nOrphans);
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
@@ -139,6 +139,12 @@ public:
      */
     CMerkleBlock(const CBlock& block, CBloomFilter& filter);
 
+    /**
+     * As above, with the elements of each of the block's transactions
+     * already extracted, so that many filters can be matched against them
+     */
+    CMerkleBlock(const CBlock& block, const std::vector<CBloomTxElements>& vElements, CBloomFilter& filter);
+
     // Create from a CBlock, matching the txids in the set
     CMerkleBlock(const CBlock& block, const std::set<uint256>& txids);
 
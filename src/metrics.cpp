@@ -8,15 +8,25 @@
 
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "corebudget.h"
+#include "httprpc.h"
+#include "httpserver.h"
 #include "main.h"
+#include "net.h"
+#include "rpc/protocol.h"
+#include "scheduler.h"
+#include "txdb.h"
+#include "txmempool.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utiltime.h"
 #include "utilmoneystr.h"
 #include "utilstrencodings.h"
+#include "validationinterface.h"
 
 #include <boost/thread.hpp>
 #include <boost/thread/synchronized_value.hpp>
+#include <map>
 #include <string>
 #ifdef WIN32
 #include <io.h>
@@ -70,6 +80,44 @@ double AtomicTimer::rate(const AtomicCounter& count)
     return duration > 0 ? (double)count.get() / duration : 0;
 }
 
+const double AtomicHistogram::BUCKET_BOUNDS[AtomicHistogram::BUCKETS] = {
+    0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60
+};
+
+AtomicHistogram::AtomicHistogram() : nSumMicros(0)
+{
+    for (int i = 0; i <= BUCKETS; i++)
+        buckets[i] = 0;
+}
+
+void AtomicHistogram::observe(int64_t nMicros)
+{
+    if (nMicros < 0)
+        nMicros = 0;
+    int i = 0;
+    while (i < BUCKETS && nMicros > BUCKET_BOUNDS[i] * 1000000)
+        i++;
+    ++buckets[i];
+    nSumMicros += nMicros;
+}
+
+uint64_t AtomicHistogram::cumulativeCount(int i) const
+{
+    uint64_t n = 0;
+    for (int j = 0; j <= i; j++)
+        n += buckets[j].load();
+    return n;
+}
+
+HistogramTimer::HistogramTimer(AtomicHistogram& histogramIn) : histogram(histogramIn), nStart(GetTimeMicros())
+{
+}
+
+HistogramTimer::~HistogramTimer()
+{
+    histogram.observe(GetTimeMicros() - nStart);
+}
+
 static CCriticalSection cs_metrics;
 
 static boost::synchronized_value<int64_t> nNodeStartTime;
@@ -79,15 +127,31 @@ AtomicCounter ehSolverRuns;
 AtomicCounter solutionTargetChecks;
 static AtomicCounter minedBlocks;
 AtomicTimer miningTimer;
+AtomicHistogram blockConnectTime;
+AtomicHistogram mempoolAcceptTime;
+AtomicCounter mempoolAccepted;
+AtomicCounter mempoolRejected;
+AtomicHistogram sproutProofTime;
+AtomicHistogram saplingProofTime;
+AtomicHistogram blockIndexWriteTime;
+AtomicHistogram chainstateFlushTime;
 
 static boost::synchronized_value<std::list<uint256>> trackedBlocks;
 
+// Entries are never erased, so references to them stay valid
+static std::mutex cs_minerThreadMetrics;
+static std::map<int, MinerThreadMetrics> minerThreadMetrics;
+
+// Likewise never erased
+static std::mutex cs_labelledMetrics;
+static std::map<std::string, NetMessageMetrics> netMessageMetrics;
+static std::map<std::string, AtomicHistogram> rpcMethodMetrics;
+
 static boost::synchronized_value<std::list<std::string>> messageBox;
 static boost::synchronized_value<std::string> initMessage;
+static std::atomic<const CScheduler*> metricsScheduler(NULL);
 static bool loaded = false;
 
-extern int64_t GetNetworkHashPS(int lookup, int height);
-
 void TrackMinedBlock(uint256 hash)
 {
     LOCK(cs_metrics);
@@ -110,6 +174,335 @@ double GetLocalSolPS()
     return miningTimer.rate(solutionTargetChecks);
 }
 
+MinerThreadMetrics& GetMinerThreadMetrics(int nThread)
+{
+    std::unique_lock<std::mutex> lock(cs_minerThreadMetrics);
+    return minerThreadMetrics[nThread];
+}
+
+std::vector<std::pair<int, double> > GetLocalSolPSByThread()
+{
+    std::unique_lock<std::mutex> lock(cs_minerThreadMetrics);
+    std::vector<std::pair<int, double> > rates;
+    for (std::map<int, MinerThreadMetrics>::iterator it = minerThreadMetrics.begin(); it != minerThreadMetrics.end(); ++it) {
+        if (it->second.timer.running())
+            rates.push_back(std::make_pair(it->first, it->second.timer.rate(it->second.solutionTargetChecks)));
+    }
+    return rates;
+}
+
+void SetMinerThreadDevice(int nThread, const std::string& strDevice)
+{
+    std::unique_lock<std::mutex> lock(cs_minerThreadMetrics);
+    minerThreadMetrics[nThread].strDevice = strDevice;
+}
+
+std::string GetMinerThreadDevice(int nThread)
+{
+    std::unique_lock<std::mutex> lock(cs_minerThreadMetrics);
+    std::map<int, MinerThreadMetrics>::const_iterator it = minerThreadMetrics.find(nThread);
+    return it != minerThreadMetrics.end() ? it->second.strDevice : "";
+}
+
+NetMessageMetrics& GetNetMessageMetrics(const std::string& strCommand)
+{
+    std::unique_lock<std::mutex> lock(cs_labelledMetrics);
+    std::map<std::string, NetMessageMetrics>::iterator it = netMessageMetrics.find(strCommand);
+    if (it != netMessageMetrics.end())
+        return it->second;
+    if (netMessageMetrics.size() >= MAX_METRICS_LABELS)
+        return netMessageMetrics["other"];
+    return netMessageMetrics[strCommand];
+}
+
+void ForEachNetMessageMetrics(const std::function<void(const std::string&, const NetMessageMetrics&)>& f)
+{
+    std::unique_lock<std::mutex> lock(cs_labelledMetrics);
+    for (std::map<std::string, NetMessageMetrics>::const_iterator it = netMessageMetrics.begin(); it != netMessageMetrics.end(); ++it)
+        f(it->first, it->second);
+}
+
+AtomicHistogram& GetRPCMethodMetrics(const std::string& strMethod)
+{
+    // Only registered methods are timed, so there are few enough of them
+    std::unique_lock<std::mutex> lock(cs_labelledMetrics);
+    return rpcMethodMetrics[strMethod];
+}
+
+/** Escape a label value for the text format */
+void SetMetricsScheduler(const CScheduler* scheduler)
+{
+    metricsScheduler = scheduler;
+}
+
+static std::string MetricLabel(const std::string& strName, const std::string& strValue)
+{
+    std::string strEscaped;
+    BOOST_FOREACH(char c, strValue) {
+        if (c == '\\' || c == '"')
+            strEscaped += '\\';
+        if (c == '\n')
+            strEscaped += "\\n";
+        else
+            strEscaped += c;
+    }
+    return strName + "=\"" + strEscaped + "\"";
+}
+
+static void WriteMetricHeader(std::string& out, const std::string& strName, const std::string& strType, const std::string& strHelp)
+{
+    out += "# HELP " + strName + " " + strHelp + "\n";
+    out += "# TYPE " + strName + " " + strType + "\n";
+}
+
+static void WriteSample(std::string& out, const std::string& strName, const std::string& strLabels, uint64_t nValue)
+{
+    out += strName + (strLabels.empty() ? "" : "{" + strLabels + "}") + strprintf(" %d\n", nValue);
+}
+
+static void WriteSample(std::string& out, const std::string& strName, const std::string& strLabels, double dValue)
+{
+    out += strName + (strLabels.empty() ? "" : "{" + strLabels + "}") + strprintf(" %.6f\n", dValue);
+}
+
+static void WriteMetric(std::string& out, const std::string& strName, const std::string& strType, const std::string& strHelp, uint64_t nValue)
+{
+    WriteMetricHeader(out, strName, strType, strHelp);
+    WriteSample(out, strName, "", nValue);
+}
+
+static void WriteHistogramSamples(std::string& out, const std::string& strName, const std::string& strLabels, const AtomicHistogram& histogram)
+{
+    std::string strPrefix = strLabels.empty() ? "" : strLabels + ",";
+    // The buckets can move while they are read; don't let the counts go down
+    uint64_t nCumulative = 0;
+    for (int i = 0; i <= AtomicHistogram::BUCKETS; i++) {
+        nCumulative = std::max(nCumulative, histogram.cumulativeCount(i));
+        std::string strBound = i < AtomicHistogram::BUCKETS ? strprintf("%g", AtomicHistogram::BUCKET_BOUNDS[i]) : "+Inf";
+        WriteSample(out, strName + "_bucket", strPrefix + MetricLabel("le", strBound), nCumulative);
+    }
+    WriteSample(out, strName + "_sum", strLabels, histogram.sum());
+    WriteSample(out, strName + "_count", strLabels, nCumulative);
+}
+
+static void WriteHistogram(std::string& out, const std::string& strName, const std::string& strHelp, const AtomicHistogram& histogram)
+{
+    WriteMetricHeader(out, strName, "histogram", strHelp);
+    WriteHistogramSamples(out, strName, "", histogram);
+}
+
+std::string GetPrometheusMetrics()
+{
+    std::string out;
+
+    CBlockConnectStats stats;
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    int nHeight = tip ? tip->nHeight : -1;
+    size_t nCoinsUsage, nAnchorsUsage, nNullifiersUsage;
+    {
+        LOCK(cs_main);
+        stats = blockConnectStats;
+        nCoinsUsage = pcoinsTip ? pcoinsTip->DynamicMemoryUsageCoins() : 0;
+        nAnchorsUsage = pcoinsTip ? pcoinsTip->DynamicMemoryUsageAnchors() : 0;
+        nNullifiersUsage = pcoinsTip ? pcoinsTip->DynamicMemoryUsageNullifiers() : 0;
+    }
+
+    WriteMetric(out, "litecoinz_uptime_seconds", "gauge", "Seconds since the node started", GetUptime());
+    WriteMetric(out, "litecoinz_chain_height", "gauge", "Height of the active chain tip", std::max(nHeight, 0));
+
+    // Block connection
+    WriteMetric(out, "litecoinz_blocks_connected_total", "counter", "Blocks connected", stats.nBlocks);
+    WriteMetric(out, "litecoinz_block_transactions_connected_total", "counter", "Transactions in the connected blocks", stats.nTransactions);
+    WriteMetric(out, "litecoinz_block_inputs_connected_total", "counter", "Transparent inputs in the connected blocks", stats.nInputs);
+    WriteMetricHeader(out, "litecoinz_block_connect_phase_seconds_total", "counter", "Time spent connecting blocks, by phase");
+    const std::pair<const char*, int64_t> phases[] = {
+        std::make_pair("load", stats.nTimeLoad),
+        std::make_pair("checkblock", stats.nTimeCheckBlock),
+        std::make_pair("coins", stats.nTimeCoins),
+        std::make_pair("scripts", stats.nTimeScripts),
+        std::make_pair("proofs", stats.nTimeProofs),
+        std::make_pair("anchors", stats.nTimeAnchors),
+        std::make_pair("connect", stats.nTimeConnect),
+        std::make_pair("index", stats.nTimeIndex),
+        std::make_pair("flush", stats.nTimeFlush),
+        std::make_pair("chainstate", stats.nTimeChainState),
+        std::make_pair("postconnect", stats.nTimePostConnect),
+        std::make_pair("total", stats.nTimeTotal),
+    };
+    for (size_t i = 0; i < ARRAYLEN(phases); i++)
+        WriteSample(out, "litecoinz_block_connect_phase_seconds_total", MetricLabel("phase", phases[i].first), phases[i].second * 0.000001);
+    WriteHistogram(out, "litecoinz_block_connect_duration_seconds", "Time to connect each block to the tip", blockConnectTime);
+
+    // Mempool
+    WriteMetric(out, "litecoinz_mempool_transactions", "gauge", "Transactions in the mempool", mempool.size());
+    WriteMetric(out, "litecoinz_mempool_bytes", "gauge", "Serialized size of the mempool transactions", mempool.GetTotalTxSize());
+    WriteMetric(out, "litecoinz_mempool_usage_bytes", "gauge", "Memory used by the mempool", mempool.DynamicMemoryUsage());
+    WriteMetric(out, "litecoinz_mempool_accepted_total", "counter", "Transactions accepted to the mempool", mempoolAccepted.value.load());
+    WriteMetric(out, "litecoinz_mempool_rejected_total", "counter", "Transactions refused by the mempool", mempoolRejected.value.load());
+    WriteHistogram(out, "litecoinz_mempool_accept_duration_seconds", "Time to accept or refuse a transaction", mempoolAcceptTime);
+
+    // Proofs
+    WriteMetric(out, "litecoinz_transactions_validated_total", "counter", "Non-coinbase transactions checked", transactionsValidated.value.load());
+    WriteMetricHeader(out, "litecoinz_proof_verification_duration_seconds", "histogram", "Time to verify each JoinSplit proof or Sapling bundle");
+    WriteHistogramSamples(out, "litecoinz_proof_verification_duration_seconds", MetricLabel("type", "sprout"), sproutProofTime);
+    WriteHistogramSamples(out, "litecoinz_proof_verification_duration_seconds", MetricLabel("type", "sapling"), saplingProofTime);
+
+    // Chain state cache
+    WriteMetricHeader(out, "litecoinz_dbcache_usage_bytes", "gauge", "Memory used by the chain state caches");
+    WriteSample(out, "litecoinz_dbcache_usage_bytes", MetricLabel("cache", "coins"), (uint64_t)nCoinsUsage);
+    WriteSample(out, "litecoinz_dbcache_usage_bytes", MetricLabel("cache", "anchors"), (uint64_t)nAnchorsUsage);
+    WriteSample(out, "litecoinz_dbcache_usage_bytes", MetricLabel("cache", "nullifiers"), (uint64_t)nNullifiersUsage);
+    WriteMetricHeader(out, "litecoinz_dbcache_limit_bytes", "gauge", "Budgets of the chain state caches");
+    WriteSample(out, "litecoinz_dbcache_limit_bytes", MetricLabel("cache", "coins"), (uint64_t)nCoinCacheUsage);
+    WriteSample(out, "litecoinz_dbcache_limit_bytes", MetricLabel("cache", "anchors"), (uint64_t)nAnchorCacheUsage);
+    WriteSample(out, "litecoinz_dbcache_limit_bytes", MetricLabel("cache", "nullifiers"), (uint64_t)nNullifierCacheUsage);
+    WriteHistogram(out, "litecoinz_block_index_write_duration_seconds", "Time to write the block index and sync the block files", blockIndexWriteTime);
+    WriteHistogram(out, "litecoinz_chainstate_flush_duration_seconds", "Time to write the chain state cache to disk", chainstateFlushTime);
+
+    // Wallet and other listeners
+    int nDeliveredHeight = GetValidationInterfaceTipHeight();
+    WriteMetric(out, "litecoinz_notifications_pending", "gauge", "Block and transaction notifications not yet delivered to the wallet", GetValidationInterfaceQueueDepth());
+    WriteMetric(out, "litecoinz_wallet_lag_blocks", "gauge", "Blocks the wallet has yet to be told about",
+                nDeliveredHeight < 0 ? 0 : std::max(nHeight - nDeliveredHeight, 0));
+
+    // P2P
+    {
+        LOCK(cs_vNodes);
+        WriteMetric(out, "litecoinz_peers", "gauge", "Connected peers", vNodes.size());
+    }
+    {
+        std::unique_lock<std::mutex> lock(cs_labelledMetrics);
+        const char* names[] = {
+            "litecoinz_net_messages_received_total", "litecoinz_net_received_bytes_total",
+            "litecoinz_net_messages_sent_total", "litecoinz_net_sent_bytes_total",
+        };
+        const char* helps[] = {
+            "Messages received from peers, by command", "Bytes received from peers, by command",
+            "Messages sent to peers, by command", "Bytes sent to peers, by command",
+        };
+        for (int n = 0; n < 4; n++) {
+            WriteMetricHeader(out, names[n], "counter", helps[n]);
+            for (std::map<std::string, NetMessageMetrics>::const_iterator it = netMessageMetrics.begin(); it != netMessageMetrics.end(); ++it) {
+                const NetMessageMetrics& m = it->second;
+                const AtomicCounter& counter = n == 0 ? m.received : n == 1 ? m.receivedBytes : n == 2 ? m.sent : m.sentBytes;
+                WriteSample(out, names[n], MetricLabel("command", it->first), counter.value.load());
+            }
+        }
+        WriteMetricHeader(out, "litecoinz_net_message_process_duration_seconds", "histogram", "Time to handle each message received, by command");
+        for (std::map<std::string, NetMessageMetrics>::const_iterator it = netMessageMetrics.begin(); it != netMessageMetrics.end(); ++it)
+            WriteHistogramSamples(out, "litecoinz_net_message_process_duration_seconds", MetricLabel("command", it->first), it->second.processTime);
+
+        // RPC
+        WriteMetricHeader(out, "litecoinz_rpc_request_duration_seconds", "histogram", "Time to run each RPC call, by method");
+        for (std::map<std::string, AtomicHistogram>::const_iterator it = rpcMethodMetrics.begin(); it != rpcMethodMetrics.end(); ++it)
+            WriteHistogramSamples(out, "litecoinz_rpc_request_duration_seconds", MetricLabel("method", it->first), it->second);
+    }
+
+    // Core budget, by class of work
+    WriteMetric(out, "litecoinz_core_budget", "gauge", "Cores CPU-heavy work may use at once", GetCoreBudget());
+    CoreClassStats coreStats[CORE_CLASS_COUNT];
+    for (int i = 0; i < CORE_CLASS_COUNT; i++)
+        coreStats[i] = GetCoreClassStats((CoreClass)i);
+    WriteMetricHeader(out, "litecoinz_core_reservations_total", "counter", "Times work took a core, by class");
+    for (int i = 0; i < CORE_CLASS_COUNT; i++)
+        WriteSample(out, "litecoinz_core_reservations_total", MetricLabel("class", CoreClassName((CoreClass)i)), coreStats[i].nReservations);
+    WriteMetricHeader(out, "litecoinz_core_wait_seconds_total", "counter", "Time work spent waiting for a core, by class");
+    for (int i = 0; i < CORE_CLASS_COUNT; i++)
+        WriteSample(out, "litecoinz_core_wait_seconds_total", MetricLabel("class", CoreClassName((CoreClass)i)), coreStats[i].nWaitMicros * 0.000001);
+    WriteMetricHeader(out, "litecoinz_core_busy_seconds_total", "counter", "Time cores were held, by class");
+    for (int i = 0; i < CORE_CLASS_COUNT; i++)
+        WriteSample(out, "litecoinz_core_busy_seconds_total", MetricLabel("class", CoreClassName((CoreClass)i)), coreStats[i].nHeldMicros * 0.000001);
+    WriteMetricHeader(out, "litecoinz_core_running", "gauge", "Cores held, by class");
+    for (int i = 0; i < CORE_CLASS_COUNT; i++)
+        WriteSample(out, "litecoinz_core_running", MetricLabel("class", CoreClassName((CoreClass)i)), (uint64_t)std::max(coreStats[i].nRunning, 0));
+    WriteMetricHeader(out, "litecoinz_core_waiting", "gauge", "Work waiting for a core, by class");
+    for (int i = 0; i < CORE_CLASS_COUNT; i++)
+        WriteSample(out, "litecoinz_core_waiting", MetricLabel("class", CoreClassName((CoreClass)i)), (uint64_t)std::max(coreStats[i].nWaiting, 0));
+
+    // Scheduled tasks, by name
+    const CScheduler* scheduler = metricsScheduler;
+    if (scheduler) {
+        boost::chrono::system_clock::time_point first, last;
+        WriteMetric(out, "litecoinz_scheduler_queue_depth", "gauge", "Tasks waiting in the scheduler queue", (uint64_t)scheduler->getQueueInfo(first, last));
+        std::map<std::string, CScheduler::TaskStats> taskStats = scheduler->getTaskStats();
+        WriteMetricHeader(out, "litecoinz_scheduler_runs_total", "counter", "Scheduled task runs, by task");
+        for (std::map<std::string, CScheduler::TaskStats>::const_iterator it = taskStats.begin(); it != taskStats.end(); ++it)
+            WriteSample(out, "litecoinz_scheduler_runs_total", MetricLabel("task", it->first), it->second.nRuns);
+        WriteMetricHeader(out, "litecoinz_scheduler_run_seconds_total", "counter", "Time spent running scheduled tasks, by task");
+        for (std::map<std::string, CScheduler::TaskStats>::const_iterator it = taskStats.begin(); it != taskStats.end(); ++it)
+            WriteSample(out, "litecoinz_scheduler_run_seconds_total", MetricLabel("task", it->first), it->second.nRunMicros * 0.000001);
+        WriteMetricHeader(out, "litecoinz_scheduler_run_max_seconds", "gauge", "Longest run of a scheduled task, by task");
+        for (std::map<std::string, CScheduler::TaskStats>::const_iterator it = taskStats.begin(); it != taskStats.end(); ++it)
+            WriteSample(out, "litecoinz_scheduler_run_max_seconds", MetricLabel("task", it->first), it->second.nMaxRunMicros * 0.000001);
+        WriteMetricHeader(out, "litecoinz_scheduler_late_seconds_total", "counter", "Time scheduled tasks started after they were due, by task");
+        for (std::map<std::string, CScheduler::TaskStats>::const_iterator it = taskStats.begin(); it != taskStats.end(); ++it)
+            WriteSample(out, "litecoinz_scheduler_late_seconds_total", MetricLabel("task", it->first), it->second.nLateMicros * 0.000001);
+    }
+
+    // Locks, by name so that the labels stay few
+    std::vector<CLockSiteStats> vLocks = GetLockSiteStats(true);
+    WriteMetricHeader(out, "litecoinz_lock_acquired_total", "counter", "Times each lock was taken");
+    BOOST_FOREACH(const CLockSiteStats& stats, vLocks)
+        WriteSample(out, "litecoinz_lock_acquired_total", MetricLabel("lock", stats.strName), stats.nAcquired);
+    WriteMetricHeader(out, "litecoinz_lock_hold_seconds_total", "counter", "Time each lock was held for");
+    BOOST_FOREACH(const CLockSiteStats& stats, vLocks)
+        WriteSample(out, "litecoinz_lock_hold_seconds_total", MetricLabel("lock", stats.strName), stats.nHoldMicros * 0.000001);
+    WriteMetricHeader(out, "litecoinz_lock_wait_duration_seconds", "histogram", "Time spent waiting for each lock, over the acquisitions that had to wait");
+    BOOST_FOREACH(const CLockSiteStats& stats, vLocks) {
+        std::string strLabel = MetricLabel("lock", stats.strName);
+        uint64_t nCumulative = 0;
+        for (int i = 0; i < CLockSite::WAIT_BUCKETS; i++) {
+            nCumulative += stats.waitBuckets[i];
+            std::string strBound = i < CLockSite::WAIT_BUCKETS - 1 ? strprintf("%g", CLockSite::WAIT_BUCKET_BOUNDS[i] * 0.000001) : "+Inf";
+            WriteSample(out, "litecoinz_lock_wait_duration_seconds_bucket", strLabel + "," + MetricLabel("le", strBound), nCumulative);
+        }
+        WriteSample(out, "litecoinz_lock_wait_duration_seconds_sum", strLabel, stats.nWaitMicros * 0.000001);
+        WriteSample(out, "litecoinz_lock_wait_duration_seconds_count", strLabel, nCumulative);
+    }
+
+    // Mining
+    WriteMetric(out, "litecoinz_equihash_solver_runs_total", "counter", "Equihash solver runs", ehSolverRuns.value.load());
+    WriteMetric(out, "litecoinz_solution_target_checks_total", "counter", "Equihash solutions checked against the target", solutionTargetChecks.value.load());
+    WriteMetric(out, "litecoinz_mined_blocks_total", "counter", "Blocks mined by this node", minedBlocks.value.load());
+    std::vector<std::pair<int, double> > threadsolps = GetLocalSolPSByThread();
+    WriteMetricHeader(out, "litecoinz_miner_solution_rate", "gauge", "Equihash solutions per second of each running mining thread, by thread and device");
+    for (size_t i = 0; i < threadsolps.size(); i++) {
+        std::string strDevice = GetMinerThreadDevice(threadsolps[i].first);
+        WriteSample(out, "litecoinz_miner_solution_rate", MetricLabel("thread", itostr(threadsolps[i].first)) + "," +
+                    MetricLabel("device", strDevice.empty() ? "cpu" : strDevice), threadsolps[i].second);
+    }
+
+    return out;
+}
+
+static bool HTTPReq_Metrics(HTTPRequest* req, const std::string&)
+{
+    if (req->GetRequestMethod() != HTTPRequest::GET) {
+        req->WriteReply(HTTP_BAD_METHOD, "Only GET requests are allowed");
+        return false;
+    }
+    req->WriteHeader("Content-Type", "text/plain; version=0.0.4");
+    req->WriteReply(HTTP_OK, GetPrometheusMetrics());
+    return true;
+}
+
+static HTTPWorkClass HTTPReq_Metrics_Class(HTTPRequest*, const std::string&)
+{
+    return HTTP_WORK_FAST;
+}
+
+bool StartHTTPMetrics()
+{
+    LogPrint("http", "Starting metrics endpoint\n");
+    RegisterHTTPHandler("/metrics", true, HTTPReq_Metrics, HTTPReq_Metrics_Class);
+    return true;
+}
+
+void StopHTTPMetrics()
+{
+    UnregisterHTTPHandler("/metrics", true);
+}
+
 int EstimateNetHeightInner(int height, int64_t tipmediantime,
                            int heightLastCheckpoint, int64_t timeLastCheckpoint,
                            int64_t genesisTime, int64_t targetSpacing)
@@ -203,18 +596,24 @@ void ConnectMetricsScreen()
 int printStats(bool mining)
 {
     // Number of lines that are always displayed
-    int lines = 4;
+    int lines = 5;
 
     int height;
     int64_t tipmediantime;
     size_t connections;
     int64_t netsolps;
+    CDBStats dbstats;
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    height = tip ? tip->nHeight : 0;
+    tipmediantime = tip ? tip->nMedianTimePast : 0;
+    netsolps = tip ? tip->nNetworkSolPS : 0;
     {
-        LOCK2(cs_main, cs_vNodes);
-        height = chainActive.Height();
-        tipmediantime = chainActive.Tip()->GetMedianTimePast();
+        LOCK(cs_vNodes);
         connections = vNodes.size();
-        netsolps = GetNetworkHashPS(120, -1);
+    }
+    {
+        LOCK(cs_main);
+        pcoinsdbview->GetDBStats(dbstats);
     }
     auto localsolps = GetLocalSolPS();
 
@@ -234,9 +633,24 @@ int printStats(bool mining)
     }
     std::cout << "            " << _("Connections") << " | " << ANSI_COLOR_LCYAN << connections << ANSI_COLOR_RESET << std::endl;
     std::cout << "  " << _("Network solution rate") << " | " << ANSI_COLOR_LCYAN << netsolps << ANSI_COLOR_RESET << " Sol/s" << std::endl;
+    uint64_t dblookups = dbstats.nCacheHits + dbstats.nCacheMisses;
+    std::cout << "  " << _("Chainstate cache hits") << " | " <<
+        strprintf(ANSI_COLOR_LCYAN "%.1f%%" ANSI_COLOR_RESET ", %d compactions (%ds)",
+                  dblookups ? dbstats.nCacheHits * 100.0 / dblookups : 0.0, dbstats.nCompactions, (int64_t)dbstats.dCompactionTime) << std::endl;
     if (mining && miningTimer.running()) {
         std::cout << "    " << _("Local solution rate") << " | " << strprintf(ANSI_COLOR_LCYAN "%.4f " ANSI_COLOR_RESET " Sol/s", localsolps) << std::endl;
         lines++;
+        std::vector<std::pair<int, double> > threadsolps = GetLocalSolPSByThread();
+        if (threadsolps.size() > 1) {
+            std::string strRates;
+            for (size_t i = 0; i < threadsolps.size(); i++) {
+                std::string strDevice = GetMinerThreadDevice(threadsolps[i].first);
+                strRates += strprintf("%s%s " ANSI_COLOR_LCYAN "%.4f" ANSI_COLOR_RESET, i > 0 ? ", " : "",
+                                      strDevice.empty() ? strprintf("#%d", threadsolps[i].first) : strDevice, threadsolps[i].second);
+            }
+            std::cout << "       " << _("Rate per thread") << " | " << strRates << " Sol/s" << std::endl;
+            lines++;
+        }
     }
     std::cout << std::endl;
 
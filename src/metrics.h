@@ -3,11 +3,19 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#ifndef BITCOIN_METRICS_H
+#define BITCOIN_METRICS_H
+
 #include "uint256.h"
 
 #include <atomic>
+#include <functional>
 #include <mutex>
 #include <string>
+#include <utility>
+#include <vector>
+
+class CScheduler;
 
 struct AtomicCounter {
     std::atomic<uint64_t> value;
@@ -55,15 +63,108 @@ public:
     double rate(const AtomicCounter& count);
 };
 
+/**
+ * A histogram of durations, exported by the metrics endpoint in the
+ * Prometheus text format. Each observation is counted in the first bucket
+ * whose bound it does not exceed, or in an overflow bucket past the last.
+ */
+class AtomicHistogram
+{
+public:
+    static const int BUCKETS = 13;
+    //! Upper bounds of the buckets, in seconds
+    static const double BUCKET_BOUNDS[BUCKETS];
+
+    AtomicHistogram();
+
+    void observe(int64_t nMicros);
+
+    //! Observations at or below the bound of bucket i, BUCKETS for all of them
+    uint64_t cumulativeCount(int i) const;
+    //! Total of the observations, in seconds
+    double sum() const { return nSumMicros.load() * 0.000001; }
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS + 1];
+    std::atomic<uint64_t> nSumMicros;
+};
+
+/** Observes the time between its construction and destruction */
+class HistogramTimer
+{
+private:
+    AtomicHistogram& histogram;
+    int64_t nStart;
+
+public:
+    explicit HistogramTimer(AtomicHistogram& histogramIn);
+    ~HistogramTimer();
+};
+
+/** Default for -metrics */
+static const bool DEFAULT_HTTP_METRICS = false;
+
+/** Distinct labels, such as P2P commands, tracked before the rest are lumped together */
+static const size_t MAX_METRICS_LABELS = 64;
+
+/** Traffic and handling time of one P2P message command */
+struct NetMessageMetrics
+{
+    AtomicCounter received;
+    AtomicCounter receivedBytes;
+    AtomicCounter sent;
+    AtomicCounter sentBytes;
+    AtomicHistogram processTime;
+};
+
+/** Solution checks and mining time of one mining thread */
+struct MinerThreadMetrics
+{
+    AtomicCounter solutionTargetChecks;
+    AtomicTimer timer;
+    //! The device the thread runs a solver plugin on, if any; guarded by the lock of the thread metrics
+    std::string strDevice;
+};
+
 extern AtomicCounter transactionsValidated;
 extern AtomicCounter ehSolverRuns;
 extern AtomicCounter solutionTargetChecks;
 extern AtomicTimer miningTimer;
+extern AtomicHistogram blockConnectTime;
+extern AtomicHistogram mempoolAcceptTime;
+extern AtomicCounter mempoolAccepted;
+extern AtomicCounter mempoolRejected;
+extern AtomicHistogram sproutProofTime;
+extern AtomicHistogram saplingProofTime;
+extern AtomicHistogram blockIndexWriteTime;
+extern AtomicHistogram chainstateFlushTime;
 
 void TrackMinedBlock(uint256 hash);
 
 void MarkStartTime();
 double GetLocalSolPS();
+/** The metrics of mining thread nThread, kept for the lifetime of the process */
+MinerThreadMetrics& GetMinerThreadMetrics(int nThread);
+/** The solution rates of the running mining threads, by thread number */
+std::vector<std::pair<int, double> > GetLocalSolPSByThread();
+/** Name the device mining thread nThread runs its solver plugin on */
+void SetMinerThreadDevice(int nThread, const std::string& strDevice);
+/** The device of mining thread nThread, or "" if it mines on the CPU */
+std::string GetMinerThreadDevice(int nThread);
+/**
+ * The metrics of P2P command strCommand, or of "other" once
+ * MAX_METRICS_LABELS commands have been seen, so that peers sending made-up
+ * commands can't grow them without bound
+ */
+NetMessageMetrics& GetNetMessageMetrics(const std::string& strCommand);
+/** Call f with each P2P command seen and its metrics, in command order */
+void ForEachNetMessageMetrics(const std::function<void(const std::string&, const NetMessageMetrics&)>& f);
+/** The latency histogram of RPC method strMethod */
+AtomicHistogram& GetRPCMethodMetrics(const std::string& strMethod);
+/** Report the tasks of scheduler in the metrics, or none if NULL */
+void SetMetricsScheduler(const CScheduler* scheduler);
+/** All metrics in the Prometheus text exposition format */
+std::string GetPrometheusMetrics();
 int EstimateNetHeightInner(int height, int64_t tipmediantime,
                            int heightLastCheckpoint, int64_t timeLastCheckpoint,
                            int64_t genesisTime, int64_t targetSpacing);
@@ -72,3 +173,5 @@ void TriggerRefresh();
 
 void ConnectMetricsScreen();
 void ThreadShowMetricsScreen();
+
+#endif // BITCOIN_METRICS_H
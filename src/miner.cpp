@@ -14,9 +14,12 @@
 #include "consensus/consensus.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
+#include "coins.h"
+#include "corebudget.h"
 #ifdef ENABLE_MINING
 #include "crypto/equihash.h"
 #endif
+#include "equihashplugin.h"
 #include "hash.h"
 #include "key_io.h"
 #include "main.h"
@@ -35,11 +38,14 @@
 
 #include "sodium.h"
 
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
+#include <deque>
 #ifdef ENABLE_MINING
 #include <functional>
 #endif
+#include <memory>
 #include <mutex>
 
 using namespace std;
@@ -109,288 +115,572 @@ void UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams,
     }
 }
 
-CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
+/**
+ * The block the miner is working towards, kept up to date as transactions
+ * enter and leave the mempool, so that a template is not assembled from
+ * scratch on every request.
+ *
+ * The candidate is first assembled from the whole mempool by priority and
+ * fee rate, checking the scripts of every transaction, as it always was.
+ * After that, transactions entering the mempool are appended if they fit,
+ * and on a tip change the transactions of the candidate that are still in
+ * the mempool are carried over. Those passed the script checks when they
+ * were accepted; TestBlockValidity on every template backs this up, and if
+ * it fails the candidate is assembled from scratch again.
+ *
+ * Guarded by cs_main and mempool.cs, which the mempool notifications are
+ * called with.
+ */
+class CBlockAssembler
 {
-    const CChainParams& chainparams = Params();
-    // Create new block
-    std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
-    if(!pblocktemplate.get())
-        return NULL;
-    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
-
-    // -regtest only: allow overriding block.nVersion with
-    // -blockversion=N to test forking scenarios
-    if (Params().MineBlocksOnDemand())
-        pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
-
-    // Add dummy coinbase tx as first transaction
-    pblock->vtx.push_back(CTransaction());
-    pblocktemplate->vTxFees.push_back(-1); // updated at end
-    pblocktemplate->vTxSigOps.push_back(-1); // updated at end
+private:
+    struct CCandidateTx
+    {
+        CTransactionRef tx; //! Shared with the mempool and the block
+        CAmount nTxFees;
+        int64_t nTxSigOps;
+        unsigned int nTxSize;
+    };
+
+    // What the candidate was assembled for
+    const CCoinsView* pcoinsBase;
+    const CBlockIndex* pindexPrev;
+    uint256 hashPrevBlock;
+    int nHeight;
+    int64_t nLockTimeCutoff;
+    uint32_t consensusBranchId;
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockPrioritySize;
+    unsigned int nBlockMinSize;
+
+    std::unique_ptr<CCoinsViewCache> pview; //! The chain tip with the candidate applied
+    SaplingMerkleTree sapling_tree;         //! ... and its Sapling commitment tree
+    std::vector<CCandidateTx> vCandidate;
+    std::set<uint256> setIncluded;
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    int nBlockSigOps;
+    CAmount nFees;
+    CFeeRate minFeeRate; //! Lowest fee rate in the candidate
+
+    std::vector<uint256> vAdded;    //! Entered the mempool since the last template
+    std::set<uint256> setDeferred;  //! In the mempool, but did not fit or could not be mined yet
+    bool fConnected;
+    bool fStale;       //! A transaction of the candidate left the mempool
+    bool fFullRebuild; //! Assemble from the whole mempool next time
+
+    void Reset();
+    void Append(const CTransactionRef& ptx, CAmount nTxFees, int64_t nTxSigOps, unsigned int nTxSize, const CFeeRate& feeRate);
+    bool TryAppend(const CTxMemPoolEntry& entry);
+    void AssembleFromScratch();
+    void CarryOver();
+    void AppendAdded();
+    CBlockTemplate* CreateTemplate(const CScript& scriptPubKeyIn, CValidationState& state);
 
-    // Largest block you're willing to create:
-    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
-    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
-    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
+public:
+    CBlockAssembler() : pcoinsBase(NULL), pindexPrev(NULL), nHeight(0), nLockTimeCutoff(0), consensusBranchId(0),
+        nBlockMaxSize(0), nBlockPrioritySize(0), nBlockMinSize(0),
+        nBlockSize(0), nBlockTx(0), nBlockSigOps(0), nFees(0), minFeeRate(0),
+        fConnected(false), fStale(false), fFullRebuild(true) { }
 
-    // How much of the block should be dedicated to high-priority transactions,
-    // included regardless of the fees they pay
-    unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
-    nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
+    void TransactionAdded(const CTxMemPoolEntry& entry);
+    void TransactionRemoved(const CTransaction& tx);
 
-    // Minimum block size you want to create; block will be filled with free transactions
-    // until there are no more or the block reaches this size:
-    unsigned int nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
-    nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
+    CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn);
+};
 
-    // Collect memory pool transactions into the block
-    CAmount nFees = 0;
+static CBlockAssembler blockAssembler;
 
-    {
-        LOCK2(cs_main, mempool.cs);
-        CBlockIndex* pindexPrev = chainActive.Tip();
-        const int nHeight = pindexPrev->nHeight + 1;
-        uint32_t consensusBranchId = CurrentEpochBranchId(nHeight, chainparams.GetConsensus());
-        pblock->nTime = GetAdjustedTime();
-        const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
-        CCoinsViewCache view(pcoinsTip);
-
-        SaplingMerkleTree sapling_tree;
-        assert(view.GetSaplingAnchorAt(view.GetBestAnchor(SAPLING), sapling_tree));
-
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi)
-        {
-            const CTransaction& tx = mi->GetTx();
+void CBlockAssembler::TransactionAdded(const CTxMemPoolEntry& entry)
+{
+    vAdded.push_back(entry.GetTx().GetHash());
+}
 
-            int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
-                                    ? nMedianTimePast
-                                    : pblock->GetBlockTime();
+void CBlockAssembler::TransactionRemoved(const CTransaction& tx)
+{
+    const uint256& hash = tx.GetHash();
+    if (setIncluded.erase(hash))
+        fStale = true;
+    setDeferred.erase(hash);
+}
 
-            if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, nLockTimeCutoff) || IsExpiredTx(tx, nHeight))
-                continue;
+void CBlockAssembler::Reset()
+{
+    pview.reset(new CCoinsViewCache(pcoinsTip));
+    assert(pview->GetSaplingAnchorAt(pview->GetBestAnchor(SAPLING), sapling_tree));
+    vCandidate.clear();
+    setIncluded.clear();
+    nBlockSize = 1000;
+    nBlockTx = 0;
+    nBlockSigOps = 100;
+    nFees = 0;
+    minFeeRate = CFeeRate(MAX_MONEY);
+    fStale = false;
+}
 
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash))
-                {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash))
-                    {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
+void CBlockAssembler::Append(const CTransactionRef& ptx, CAmount nTxFees, int64_t nTxSigOps, unsigned int nTxSize, const CFeeRate& feeRate)
+{
+    const CTransaction& tx = *ptx;
+    UpdateCoins(tx, *pview, nHeight);
 
-                    // Has to wait for dependencies
-                    if (!porphan)
-                    {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx.find(txin.prevout.hash)->GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
+    BOOST_FOREACH(const OutputDescription &outDescription, tx.vShieldedOutput) {
+        sapling_tree.append(outDescription.cm);
+    }
 
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
+    CCandidateTx candidate = { ptx, nTxFees, nTxSigOps, nTxSize };
+    vCandidate.push_back(candidate);
+    setIncluded.insert(tx.GetHash());
+    nBlockSize += nTxSize;
+    ++nBlockTx;
+    nBlockSigOps += nTxSigOps;
+    nFees += nTxFees;
+    if (feeRate < minFeeRate)
+        minFeeRate = feeRate;
+}
 
-                int nConf = nHeight - coins->nHeight;
+bool CBlockAssembler::TryAppend(const CTxMemPoolEntry& entry)
+{
+    const CTransaction& tx = entry.GetTx();
+    const uint256& hash = tx.GetHash();
+
+    if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, nLockTimeCutoff) || IsExpiredTx(tx, nHeight))
+        return false;
+
+    // Parents that are not in the candidate yet are missing inputs here
+    if (!pview->HaveInputs(tx) || !pview->HaveShieldedRequirements(tx))
+        return false;
+
+    double dPriorityDelta = 0;
+    CAmount nFeeDelta = 0;
+    mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
+    unsigned int nTxSize = entry.GetTxSize();
+    CAmount nTxFees = pview->GetValueIn(tx) - tx.GetValueOut();
+    CFeeRate feeRate(nTxFees + nFeeDelta, nTxSize);
+    // Counted, legacy and P2SH, when the mempool took the transaction
+    int64_t nTxSigOps = entry.GetSigOpCount();
+
+    if (nBlockSize + nTxSize >= nBlockMaxSize || nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS) {
+        // Only reshuffling the whole block can make room for it
+        if (minFeeRate < feeRate)
+            fFullRebuild = true;
+        return false;
+    }
 
-                dPriority += (double)nValueIn * nConf;
-            }
-            nTotalIn += tx.GetShieldedValueIn();
+    // The same rule for free transactions as once past the priority area below
+    double dPriority = entry.GetPriority(nHeight) + dPriorityDelta;
+    bool fPriorityArea = (nBlockSize + nTxSize < nBlockPrioritySize) && AllowFree(dPriority);
+    if (!fPriorityArea && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
+        return false;
 
-            if (fMissingInputs) continue;
+    Append(entry.GetSharedTx(), nTxFees, nTxSigOps, nTxSize, feeRate);
 
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
+    if (GetBoolArg("-printpriority", false))
+    {
+        LogPrintf("priority %.1f fee %s txid %s (appended)\n",
+            dPriority, feeRate.ToString(), hash.ToString());
+    }
+    return true;
+}
 
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
+void CBlockAssembler::AssembleFromScratch()
+{
+    Reset();
+    vAdded.clear();
+    setDeferred.clear();
+
+    // Priority order to process transactions
+    list<COrphan> vOrphan; // list memory doesn't move
+    map<uint256, vector<COrphan*> > mapDependers;
+    bool fPrintPriority = GetBoolArg("-printpriority", false);
+    CCoinsViewCache& view = *pview;
+
+    // This vector will be sorted into a priority queue:
+    vector<TxPriority> vecPriority;
+    vecPriority.reserve(mempool.mapTx.size());
+    for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
+         mi != mempool.mapTx.end(); ++mi)
+    {
+        const CTransaction& tx = mi->GetTx();
 
-            CFeeRate feeRate(nTotalIn-tx.GetValueOut(), nTxSize);
+        if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, nLockTimeCutoff) || IsExpiredTx(tx, nHeight))
+            continue;
 
-            if (porphan)
+        COrphan* porphan = NULL;
+        double dPriority = 0;
+        CAmount nTotalIn = 0;
+        bool fMissingInputs = false;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            // Read prev transaction
+            if (!view.HaveCoin(txin.prevout))
             {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
+                // This should never happen; all transactions in the memory
+                // pool should connect to either transactions in the chain
+                // or other transactions in the memory pool.
+                if (!mempool.mapTx.count(txin.prevout.hash))
+                {
+                    LogPrintf("ERROR: mempool transaction missing input\n");
+                    if (fDebug) assert("mempool transaction missing input" == 0);
+                    fMissingInputs = true;
+                    if (porphan)
+                        vOrphan.pop_back();
+                    break;
+                }
+
+                // Has to wait for dependencies
+                if (!porphan)
+                {
+                    // Use list for automatic deletion
+                    vOrphan.push_back(COrphan(&tx));
+                    porphan = &vOrphan.back();
+                }
+                mapDependers[txin.prevout.hash].push_back(porphan);
+                porphan->setDependsOn.insert(txin.prevout.hash);
+                nTotalIn += mempool.mapTx.find(txin.prevout.hash)->GetTx().vout[txin.prevout.n].nValue;
+                continue;
             }
-            else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &(mi->GetTx())));
-        }
+            const Coin& coin = view.AccessCoin(txin.prevout);
+            assert(!coin.IsSpent());
 
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
+            CAmount nValueIn = coin.out.nValue;
+            nTotalIn += nValueIn;
 
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+            int nConf = nHeight - coin.nHeight;
 
-        while (!vecPriority.empty())
-        {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
+            dPriority += (double)nValueIn * nConf;
+        }
+        nTotalIn += tx.GetShieldedValueIn();
 
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
+        if (fMissingInputs) continue;
 
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
+        // Priority is sum(valuein * age) / modified_txsize
+        unsigned int nTxSize = mi->GetTxSize();
+        dPriority = tx.ComputePriority(dPriority, nTxSize);
 
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
+        uint256 hash = tx.GetHash();
+        mempool.ApplyDeltas(hash, dPriority, nTotalIn);
 
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
+        CFeeRate feeRate(nTotalIn-tx.GetValueOut(), nTxSize);
 
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority)))
-            {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
+        if (porphan)
+        {
+            porphan->dPriority = dPriority;
+            porphan->feeRate = feeRate;
+        }
+        else
+            vecPriority.push_back(TxPriority(dPriority, feeRate, &(mi->GetTx())));
+    }
 
-            if (!view.HaveInputs(tx))
-                continue;
+    // Collect transactions into block
+    bool fSortedByFee = (nBlockPrioritySize <= 0);
 
-            CAmount nTxFees = view.GetValueIn(tx)-tx.GetValueOut();
+    TxPriorityCompare comparer(fSortedByFee);
+    std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
 
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
+    while (!vecPriority.empty())
+    {
+        // Take highest priority transaction off the priority queue:
+        double dPriority = vecPriority.front().get<0>();
+        CFeeRate feeRate = vecPriority.front().get<1>();
+        const CTransaction& tx = *(vecPriority.front().get<2>());
+
+        std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
+        vecPriority.pop_back();
+
+        // Size limits
+        unsigned int nTxSize = tx.GetTotalSize();
+        if (nBlockSize + nTxSize >= nBlockMaxSize)
+            continue;
+
+        // Legacy limits on sigOps:
+        unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+        if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+            continue;
+
+        // Skip free transactions if we're past the minimum block size:
+        const uint256& hash = tx.GetHash();
+        double dPriorityDelta = 0;
+        CAmount nFeeDelta = 0;
+        mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
+        if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
+            continue;
+
+        // Prioritise by fee once past the priority size or we run out of high-priority
+        // transactions:
+        if (!fSortedByFee &&
+            ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority)))
+        {
+            fSortedByFee = true;
+            comparer = TxPriorityCompare(fSortedByFee);
+            std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+        }
 
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            PrecomputedTransactionData txdata(tx);
-            if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, Params().GetConsensus(), consensusBranchId))
-                continue;
+        if (!view.HaveInputs(tx))
+            continue;
 
-            UpdateCoins(tx, view, nHeight);
+        CAmount nTxFees = view.GetValueIn(tx)-tx.GetValueOut();
 
-            BOOST_FOREACH(const OutputDescription &outDescription, tx.vShieldedOutput) {
-                sapling_tree.append(outDescription.cm);
-            }
+        // The mempool counted the P2SH sigops too when it took the transaction
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        assert(it != mempool.mapTx.end());
+        nTxSigOps = it->GetSigOpCount();
+        if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+            continue;
 
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
+        // Note that flags: we don't want to set mempool/IsStandard()
+        // policy here, but we still have to ensure that the block we
+        // create only contains transactions that are valid in new blocks.
+        CValidationState state;
+        std::shared_ptr<const PrecomputedTransactionData> txdata = mempool.GetTxData(hash);
+        if (!txdata)
+            txdata = std::make_shared<PrecomputedTransactionData>(tx);
+        if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, *txdata, Params().GetConsensus(), consensusBranchId))
+            continue;
 
-            if (fPrintPriority)
-            {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
-            }
+        // Added
+        Append(it->GetSharedTx(), nTxFees, nTxSigOps, nTxSize, feeRate);
 
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash))
+        if (fPrintPriority)
+        {
+            LogPrintf("priority %.1f fee %s txid %s\n",
+                dPriority, feeRate.ToString(), tx.GetHash().ToString());
+        }
+
+        // Add transactions that depend on this one to the priority queue
+        if (mapDependers.count(hash))
+        {
+            BOOST_FOREACH(COrphan* porphan, mapDependers[hash])
             {
-                BOOST_FOREACH(COrphan* porphan, mapDependers[hash])
+                if (!porphan->setDependsOn.empty())
                 {
-                    if (!porphan->setDependsOn.empty())
+                    porphan->setDependsOn.erase(hash);
+                    if (porphan->setDependsOn.empty())
                     {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                        {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
+                        vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
+                        std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
                     }
                 }
             }
         }
+    }
 
-        nLastBlockTx = nBlockTx;
-        nLastBlockSize = nBlockSize;
-        LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
-
-        // Create coinbase tx
-        CMutableTransaction txNew = CreateNewContextualCMutableTransaction(chainparams.GetConsensus(), nHeight);
-        txNew.vin.resize(1);
-        txNew.vin[0].prevout.SetNull();
-        txNew.vout.resize(1);
-        txNew.vout[0].scriptPubKey = scriptPubKeyIn;
-        txNew.vout[0].nValue = GetBlockSubsidy(nHeight, chainparams.GetConsensus());
-        // Set to 0 so expiry height does not apply to coinbase txs
-        txNew.nExpiryHeight = 0;
-
-        // Add fees
-        txNew.vout[0].nValue += nFees;
-        txNew.vin[0].scriptSig = CScript() << nHeight << OP_0;
-
-        pblock->vtx[0] = txNew;
-        pblocktemplate->vTxFees[0] = -nFees;
-
-        // Randomise nonce
-        arith_uint256 nonce = UintToArith256(GetRandHash());
-        // Clear the top and bottom 16 bits (for local use as thread flags and counters)
-        nonce <<= 32;
-        nonce >>= 16;
-        pblock->nNonce = ArithToUint256(nonce);
-
-        // Fill in header
-        pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
-        pblock->hashFinalSaplingRoot   = sapling_tree.root();
-        UpdateTime(pblock, Params().GetConsensus(), pindexPrev);
-        pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, Params().GetConsensus());
-        pblock->nSolution.clear();
-        pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
+    // Whatever was left out is tried again at the next tip change
+    for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
+         mi != mempool.mapTx.end(); ++mi)
+    {
+        if (!setIncluded.count(mi->GetTx().GetHash()))
+            setDeferred.insert(mi->GetTx().GetHash());
+    }
+    fFullRebuild = false;
+}
 
-        CValidationState state;
-        if (!TestBlockValidity(state, *pblock, pindexPrev, false, false))
-            throw std::runtime_error("CreateNewBlock(): TestBlockValidity failed");
+void CBlockAssembler::CarryOver()
+{
+    std::vector<CCandidateTx> vOld;
+    vOld.swap(vCandidate);
+    Reset();
+
+    // Transactions set aside before may be minable now
+    vAdded.insert(vAdded.end(), setDeferred.begin(), setDeferred.end());
+    setDeferred.clear();
+
+    BOOST_FOREACH(const CCandidateTx& candidate, vOld) {
+        CTxMemPool::txiter it = mempool.mapTx.find(candidate.tx->GetHash());
+        if (it == mempool.mapTx.end())
+            continue;
+        if (!TryAppend(*it))
+            setDeferred.insert(candidate.tx->GetHash());
+    }
+}
+
+/** Parents before children, then by fee rate with ancestors */
+struct CompareTxIterByAncestorCount
+{
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CompareTxMemPoolEntryByAncestorFee()(*a, *b);
+    }
+};
+
+void CBlockAssembler::AppendAdded()
+{
+    // An in-mempool parent has fewer ancestors than any of its children,
+    // so this puts each transaction after the parents it needs.
+    std::vector<CTxMemPool::txiter> vEntries;
+    vEntries.reserve(vAdded.size());
+    BOOST_FOREACH(const uint256& hash, vAdded) {
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it != mempool.mapTx.end())
+            vEntries.push_back(it);
+    }
+    vAdded.clear();
+    std::sort(vEntries.begin(), vEntries.end(), CompareTxIterByAncestorCount());
+
+    BOOST_FOREACH(CTxMemPool::txiter it, vEntries) {
+        const uint256& hash = it->GetTx().GetHash();
+        if (setIncluded.count(hash))
+            continue;
+        if (TryAppend(*it))
+            setDeferred.erase(hash);
+        else
+            setDeferred.insert(hash);
+    }
+}
+
+CBlockTemplate* CBlockAssembler::CreateTemplate(const CScript& scriptPubKeyIn, CValidationState& state)
+{
+    const CChainParams& chainparams = Params();
+    // Create new block
+    std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
+    if(!pblocktemplate.get())
+        return NULL;
+    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
+
+    // -regtest only: allow overriding block.nVersion with
+    // -blockversion=N to test forking scenarios
+    if (chainparams.MineBlocksOnDemand())
+        pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
+
+    // Add dummy coinbase tx as first transaction
+    pblock->vtx.push_back(MakeTransactionRef());
+    pblocktemplate->vTxFees.push_back(-1); // updated at end
+    pblocktemplate->vTxSigOps.push_back(-1); // updated at end
+
+    pblock->vtx.reserve(vCandidate.size() + 1);
+    BOOST_FOREACH(const CCandidateTx& candidate, vCandidate) {
+        pblock->vtx.push_back(candidate.tx);
+        pblocktemplate->vTxFees.push_back(candidate.nTxFees);
+        pblocktemplate->vTxSigOps.push_back(candidate.nTxSigOps);
     }
 
+    nLastBlockTx = nBlockTx;
+    nLastBlockSize = nBlockSize;
+    LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
+
+    // Create coinbase tx
+    CMutableTransaction txNew = CreateNewContextualCMutableTransaction(chainparams.GetConsensus(), nHeight);
+    txNew.vin.resize(1);
+    txNew.vin[0].prevout.SetNull();
+    txNew.vout.resize(1);
+    txNew.vout[0].scriptPubKey = scriptPubKeyIn;
+    txNew.vout[0].nValue = GetBlockSubsidy(nHeight, chainparams.GetConsensus());
+    // Set to 0 so expiry height does not apply to coinbase txs
+    txNew.nExpiryHeight = 0;
+
+    // Add fees
+    txNew.vout[0].nValue += nFees;
+    txNew.vin[0].scriptSig = CScript() << nHeight << OP_0;
+
+    pblock->vtx[0] = MakeTransactionRef(txNew);
+    pblocktemplate->vTxFees[0] = -nFees;
+
+    // Randomise nonce
+    arith_uint256 nonce = UintToArith256(GetRandHash());
+    // Clear the top and bottom 16 bits (for local use as thread flags and counters)
+    nonce <<= 32;
+    nonce >>= 16;
+    pblock->nNonce = ArithToUint256(nonce);
+
+    // Fill in header
+    CBlockIndex* pindexTip = chainActive.Tip();
+    pblock->hashPrevBlock  = pindexTip->GetBlockHash();
+    pblock->hashFinalSaplingRoot   = sapling_tree.root();
+    UpdateTime(pblock, chainparams.GetConsensus(), pindexTip);
+    pblock->nBits          = GetNextWorkRequired(pindexTip, pblock, chainparams.GetConsensus());
+    pblock->nSolution.clear();
+    pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(*pblock->vtx[0]);
+
+    if (!TestBlockValidity(state, *pblock, pindexTip, false, false))
+        return NULL;
+
     return pblocktemplate.release();
 }
 
+CBlockTemplate* CBlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
+{
+    const CChainParams& chainparams = Params();
+
+    if (!fConnected) {
+        mempool.NotifyEntryAdded.connect(boost::bind(&CBlockAssembler::TransactionAdded, this, _1));
+        mempool.NotifyEntryRemoved.connect(boost::bind(&CBlockAssembler::TransactionRemoved, this, _1));
+        fConnected = true;
+        fFullRebuild = true;
+    }
+
+    // Largest block you're willing to create:
+    unsigned int nBlockMaxSizeIn = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
+    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
+    nBlockMaxSizeIn = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSizeIn));
+
+    // How much of the block should be dedicated to high-priority transactions,
+    // included regardless of the fees they pay
+    unsigned int nBlockPrioritySizeIn = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
+    nBlockPrioritySizeIn = std::min(nBlockMaxSizeIn, nBlockPrioritySizeIn);
+
+    // Minimum block size you want to create; block will be filled with free transactions
+    // until there are no more or the block reaches this size:
+    unsigned int nBlockMinSizeIn = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
+    nBlockMinSizeIn = std::min(nBlockMaxSizeIn, nBlockMinSizeIn);
+
+    if (nBlockMaxSizeIn != nBlockMaxSize || nBlockPrioritySizeIn != nBlockPrioritySize || nBlockMinSizeIn != nBlockMinSize) {
+        nBlockMaxSize = nBlockMaxSizeIn;
+        nBlockPrioritySize = nBlockPrioritySizeIn;
+        nBlockMinSize = nBlockMinSizeIn;
+        fFullRebuild = true;
+    }
+
+    CBlockIndex* pindexTip = chainActive.Tip();
+    const int nHeightIn = pindexTip->nHeight + 1;
+    const int64_t nMedianTimePast = pindexTip->GetMedianTimePast();
+    const int64_t nLockTimeCutoffIn = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                                    ? nMedianTimePast
+                                    : GetAdjustedTime();
+
+    // A different coins view is a different chainstate altogether
+    if (pcoinsBase != pcoinsTip)
+        fFullRebuild = true;
+    bool fMoved = pindexPrev != pindexTip ||
+                  hashPrevBlock != pindexTip->GetBlockHash() || nHeight != nHeightIn ||
+                  nLockTimeCutoff != nLockTimeCutoffIn;
+    pcoinsBase = pcoinsTip;
+    pindexPrev = pindexTip;
+    hashPrevBlock = pindexTip->GetBlockHash();
+    nHeight = nHeightIn;
+    nLockTimeCutoff = nLockTimeCutoffIn;
+    consensusBranchId = CurrentEpochBranchId(nHeight, chainparams.GetConsensus());
+
+    bool fFromScratch = fFullRebuild;
+    if (fFromScratch) {
+        AssembleFromScratch();
+    } else {
+        if (fMoved || fStale)
+            CarryOver();
+        AppendAdded();
+    }
+
+    CValidationState state;
+    CBlockTemplate* pblocktemplate = CreateTemplate(scriptPubKeyIn, state);
+    if (!pblocktemplate && !fFromScratch) {
+        LogPrintf("CreateNewBlock(): candidate block is invalid (%s), assembling it from scratch\n", state.GetRejectReason());
+        state = CValidationState();
+        AssembleFromScratch();
+        pblocktemplate = CreateTemplate(scriptPubKeyIn, state);
+    }
+    if (!pblocktemplate) {
+        fFullRebuild = true;
+        throw std::runtime_error("CreateNewBlock(): TestBlockValidity failed");
+    }
+    return pblocktemplate;
+}
+
+CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
+{
+    LOCK2(cs_main, mempool.cs);
+    return blockAssembler.CreateNewBlock(scriptPubKeyIn);
+}
+
 #ifdef ENABLE_WALLET
 boost::optional<CScript> GetMinerScriptPubKey(CReserveKey& reservekey)
 #else
@@ -451,11 +741,11 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     }
     ++nExtraNonce;
     unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
-    CMutableTransaction txCoinbase(pblock->vtx[0]);
+    CMutableTransaction txCoinbase(*pblock->vtx[0]);
     txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
     assert(txCoinbase.vin[0].scriptSig.size() <= 100);
 
-    pblock->vtx[0] = txCoinbase;
+    pblock->vtx[0] = MakeTransactionRef(txCoinbase);
     pblock->hashMerkleRoot = pblock->BuildMerkleTree();
 }
 
@@ -466,7 +756,7 @@ static bool ProcessBlockFound(const CBlock* pblock)
 #endif // ENABLE_WALLET
 {
     LogPrintf("%s\n", pblock->ToString());
-    LogPrintf("generated %s\n", FormatMoney(pblock->vtx[0].vout[0].nValue));
+    LogPrintf("generated %s\n", FormatMoney(pblock->vtx[0]->vout[0].nValue));
 
     // Found a solution
     {
@@ -498,27 +788,175 @@ static bool ProcessBlockFound(const CBlock* pblock)
     return true;
 }
 
+/**
+ * Work shared by the mining threads started by one GenerateBitcoins call.
+ * The block template is built once per tip or mempool change, however many
+ * threads are mining, and each thread only varies the nonce. Solved blocks
+ * are handed to a separate thread, so a solver thread goes straight back to
+ * work instead of waiting for the block to be connected.
+ */
+class CMinerPool
+{
+public:
+    struct Job
+    {
+        std::shared_ptr<const CBlockTemplate> pblocktemplate;
+        CBlockIndex* pindexPrev;
+        unsigned int nTransactionsUpdated;
+        int64_t nStart;
+
+        Job() : pindexPrev(NULL), nTransactionsUpdated(0), nStart(0) {}
+    };
+
+private:
+    boost::mutex cs;
+    boost::condition_variable cond;
 #ifdef ENABLE_WALLET
-void static BitcoinMiner(CWallet *pwallet)
+    CWallet* pwallet;
+    //! Guarded by its own lock, as submission runs alongside template building
+    boost::mutex cs_key;
+    CReserveKey reservekey;
+#endif
+    unsigned int nExtraNonce;
+    Job current;
+    std::deque<CBlock> queueFound;
+    //! Blocks queued or being processed
+    int nSubmitting;
+
+public:
+#ifdef ENABLE_WALLET
+    CMinerPool(CWallet* pwalletIn) : pwallet(pwalletIn), reservekey(pwalletIn), nExtraNonce(0), nSubmitting(0) {}
 #else
-void static BitcoinMiner()
+    CMinerPool() : nExtraNonce(0), nSubmitting(0) {}
 #endif
+
+    //! Get the template to mine on, rebuilding it if it is out of date.
+    //! Returns false if no block can be built.
+    bool GetJob(Job& job);
+    //! Queue a solved block for SubmitBlocks
+    void Submit(const CBlock& block);
+    //! Wait until every queued block has been processed
+    void WaitForSubmissions();
+    //! Thread that processes the queued blocks
+    void SubmitBlocks();
+};
+
+bool CMinerPool::GetJob(Job& job)
 {
-    LogPrintf("LitecoinzMiner started\n");
-    SetThreadPriority(THREAD_PRIORITY_LOWEST);
-    RenameThread("litecoinz-miner");
-    const CChainParams& chainparams = Params();
+    boost::unique_lock<boost::mutex> lock(cs);
+    // A queued block is about to move the tip, so don't build on the old one
+    while (nSubmitting > 0)
+        cond.wait(lock);
+
+    CBlockIndex* pindexTip = chainActive.Tip();
+    if (!current.pblocktemplate || current.pindexPrev != pindexTip ||
+        (mempool.GetTransactionsUpdated() != current.nTransactionsUpdated && GetTime() - current.nStart > 60)) {
+        if (pindexTip == NULL) {
+            LogPrintf("Error in LitecoinzMiner: chainActive.Tip() returned NULL\n");
+            return false;
+        }
+        unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+        std::unique_ptr<CBlockTemplate> pblocktemplate;
+        {
+#ifdef ENABLE_WALLET
+            boost::lock_guard<boost::mutex> lockKey(cs_key);
+            pblocktemplate.reset(CreateNewBlockWithKey(reservekey));
+#else
+            pblocktemplate.reset(CreateNewBlockWithKey());
+#endif
+        }
+        if (!pblocktemplate) {
+            if (GetArg("-mineraddress", "").empty()) {
+                LogPrintf("Error in LitecoinzMiner: Keypool ran out, please call keypoolrefill before restarting the mining thread\n");
+            } else {
+                // Should never reach here, because -mineraddress validity is checked in init.cpp
+                LogPrintf("Error in LitecoinzMiner: Invalid -mineraddress\n");
+            }
+            return false;
+        }
+        IncrementExtraNonce(&pblocktemplate->block, pindexTip, nExtraNonce);
+
+        LogPrintf("Running LitecoinzMiner with %u transactions in block (%u bytes)\n", pblocktemplate->block.vtx.size(),
+            ::GetSerializeSize(pblocktemplate->block, SER_NETWORK, PROTOCOL_VERSION));
+
+        current.pblocktemplate.reset(pblocktemplate.release());
+        current.pindexPrev = pindexTip;
+        current.nTransactionsUpdated = nTransactionsUpdated;
+        current.nStart = GetTime();
+    }
+    job = current;
+    return true;
+}
+
+void CMinerPool::Submit(const CBlock& block)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(cs);
+        queueFound.push_back(block);
+        nSubmitting++;
+    }
+    cond.notify_all();
+}
+
+void CMinerPool::WaitForSubmissions()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (nSubmitting > 0)
+        cond.wait(lock);
+}
 
+void CMinerPool::SubmitBlocks()
+{
+    RenameThread("litecoinz-submit");
+    try {
+        while (true) {
+            CBlock block;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (queueFound.empty())
+                    cond.wait(lock);
+                block = queueFound.front();
+                queueFound.pop_front();
+            }
 #ifdef ENABLE_WALLET
-    // Each thread has its own key
-    CReserveKey reservekey(pwallet);
+            {
+                boost::lock_guard<boost::mutex> lockKey(cs_key);
+                ProcessBlockFound(&block, *pwallet, reservekey);
+            }
+#else
+            ProcessBlockFound(&block);
 #endif
+            {
+                boost::lock_guard<boost::mutex> lock(cs);
+                nSubmitting--;
+            }
+            cond.notify_all();
+        }
+    }
+    catch (const boost::thread_interrupted&)
+    {
+        LogPrintf("LitecoinzMiner submitter terminated\n");
+        throw;
+    }
+}
 
-    // Each thread has its own counter
-    unsigned int nExtraNonce = 0;
+void static BitcoinMiner(CMinerPool& pool, int nThread)
+{
+    LogPrintf("LitecoinzMiner started\n");
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+    RenameThread("litecoinz-miner");
+    const CChainParams& chainparams = Params();
+    MinerThreadMetrics& threadMetrics = GetMinerThreadMetrics(nThread);
 
     std::string solver = GetArg("-equihashsolver", "default");
-    assert(solver == "tromp" || solver == "default");
+    assert(solver == "tromp" || solver == "bucket" || solver == "default" || solver == "plugin");
+    // GenerateBitcoins starts one thread for each device of a plugin
+    int nDevice = -1;
+    if (solver == "plugin") {
+        assert(pEquihashPlugin);
+        nDevice = pEquihashPlugin->GetDevices()[nThread];
+        SetMinerThreadDevice(nThread, pEquihashPlugin->DeviceName(nDevice));
+    }
 
     std::mutex m_cs;
     bool cancelSolver = false;
@@ -529,16 +967,22 @@ void static BitcoinMiner()
         }
     );
     miningTimer.start();
+    threadMetrics.timer.start();
 
     try {
+        // Solver memory is kept for the lifetime of the thread
         unique_ptr<equi> peq;
         if (solver == "tromp")
             peq.reset(new equi(1));
+        EhSolverArena arena;
+        std::unique_ptr<CEquihashPlugin::Solver> psolver;
+
         while (true) {
             if (chainparams.MiningRequiresPeers()) {
                 // Busy-wait for the network to come online so we don't waste time mining
                 // on an obsolete chain. In regtest mode we expect to fly solo.
                 miningTimer.stop();
+                threadMetrics.timer.stop();
                 do {
                     bool fvNodesEmpty;
                     {
@@ -550,52 +994,51 @@ void static BitcoinMiner()
                     MilliSleep(1000);
                 } while (true);
                 miningTimer.start();
+                threadMetrics.timer.start();
             }
 
             //
-            // Create new block
+            // Get the shared block template
             //
-            unsigned int nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-
-            // Get the height of current tip
-            int nHeight = chainActive.Height();
-            if (nHeight == -1) {
-                LogPrintf("Error in LitecoinzMiner: chainActive.Height() returned -1\n");
-                return;
+            CMinerPool::Job job;
+            if (!pool.GetJob(job))
+                break;
+            {
+                // Tip changes up to now are reflected in the template
+                std::lock_guard<std::mutex> lock{m_cs};
+                cancelSolver = false;
             }
-            CBlockIndex* pindexPrev = chainActive.Tip();
+            CBlockIndex* pindexPrev = job.pindexPrev;
 
             // Get equihash parameters for the next block to be mined.
-            unsigned int n = chainparams.EquihashN(nHeight + 1);
-            unsigned int k = chainparams.EquihashK(nHeight + 1);
+            unsigned int n = chainparams.EquihashN(pindexPrev->nHeight + 1);
+            unsigned int k = chainparams.EquihashK(pindexPrev->nHeight + 1);
             LogPrint("pow", "Using Equihash solver \"%s\" with n = %u, k = %u\n", solver, n, k);
-
-#ifdef ENABLE_WALLET
-            unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey(reservekey));
-#else
-            unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey());
-#endif
-            if (!pblocktemplate.get())
-            {
-                if (GetArg("-mineraddress", "").empty()) {
-                    LogPrintf("Error in LitecoinzMiner: Keypool ran out, please call keypoolrefill before restarting the mining thread\n");
-                } else {
-                    // Should never reach here, because -mineraddress validity is checked in init.cpp
-                    LogPrintf("Error in LitecoinzMiner: Invalid -mineraddress\n");
+            if (solver == "plugin" && (!psolver || !psolver->Matches(n, k))) {
+                psolver.reset();
+                psolver.reset(new CEquihashPlugin::Solver(*pEquihashPlugin, nDevice, n, k));
+                if (!psolver->IsValid()) {
+                    LogPrintf("LitecoinzMiner: Equihash plugin can't solve n = %u, k = %u on %s\n",
+                              n, k, pEquihashPlugin->DeviceName(nDevice));
+                    break;
                 }
-                return;
             }
-            CBlock *pblock = &pblocktemplate->block;
-            IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
 
-            LogPrintf("Running LitecoinzMiner with %u transactions in block (%u bytes)\n", pblock->vtx.size(),
-                ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
+            CBlock block(job.pblocktemplate->block);
+            CBlock *pblock = &block;
+
+            // Every thread mines the same template, so each one starts from
+            // its own random nonce, with the same bits cleared as in CreateNewBlock
+            arith_uint256 nonce = UintToArith256(GetRandHash());
+            nonce <<= 32;
+            nonce >>= 16;
+            pblock->nNonce = ArithToUint256(nonce);
 
             //
             // Search
             //
-            int64_t nStart = GetTime();
             arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
+            bool found = false;
 
             while (true) {
                 // Hash state
@@ -622,38 +1065,27 @@ void static BitcoinMiner()
                          solver, pblock->nNonce.ToString());
 
                 std::function<bool(std::vector<unsigned char>)> validBlock =
-#ifdef ENABLE_WALLET
-                        [&pblock, &hashTarget, &pwallet, &reservekey, &m_cs, &cancelSolver, &chainparams]
-#else
-                        [&pblock, &hashTarget, &m_cs, &cancelSolver, &chainparams]
-#endif
+                        [&pblock, &hashTarget, &pool, &threadMetrics, &found, &chainparams]
                         (std::vector<unsigned char> soln) {
                     // Write the solution to the hash and compute the result.
                     LogPrint("pow", "- Checking solution against target\n");
                     pblock->nSolution = soln;
                     solutionTargetChecks.increment();
+                    threadMetrics.solutionTargetChecks.increment();
 
                     if (UintToArith256(pblock->GetHash()) > hashTarget) {
                         return false;
                     }
 
                     // Found a solution
-                    SetThreadPriority(THREAD_PRIORITY_NORMAL);
                     LogPrintf("LitecoinzMiner:\n");
                     LogPrintf("proof-of-work found  \n  hash: %s  \ntarget: %s\n", pblock->GetHash().GetHex(), hashTarget.GetHex());
-#ifdef ENABLE_WALLET
-                    if (ProcessBlockFound(pblock, *pwallet, reservekey)) {
-#else
-                    if (ProcessBlockFound(pblock)) {
-#endif
-                        // Ignore chain updates caused by us
-                        std::lock_guard<std::mutex> lock{m_cs};
-                        cancelSolver = false;
-                    }
-                    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+                    pool.Submit(*pblock);
+                    found = true;
 
                     // In regression test mode, stop mining after a block is found.
                     if (chainparams.MineBlocksOnDemand()) {
+                        pool.WaitForSubmissions();
                         // Increment here because throwing skips the call below
                         ehSolverRuns.increment();
                         throw boost::thread_interrupted();
@@ -666,6 +1098,7 @@ void static BitcoinMiner()
                     return cancelSolver;
                 };
 
+                CCoreReservation core(CORE_CLASS_MINING);
                 // TODO: factor this out into a function with the same API for each solver.
                 if (solver == "tromp") {
                     equi& eq = *peq;
@@ -699,20 +1132,26 @@ void static BitcoinMiner()
                             break;
                         }
                     }
+                } else if (solver == "plugin") {
+                    std::vector<unsigned char> vInput(ss.begin(), ss.end());
+                    found = psolver->Solve(vInput, pblock->nNonce, validBlock,
+                                           [&cancelled]() { return cancelled(ListGeneration); });
+                    ehSolverRuns.increment();
                 } else {
                     try {
                         // If we find a valid block, we rebuild
-                        bool found = EhOptimisedSolve(n, k, curr_state, validBlock, cancelled);
+                        found = solver == "bucket" ?
+                            EhBucketSolve(n, k, curr_state, validBlock, cancelled, &arena) :
+                            EhOptimisedSolve(n, k, curr_state, validBlock, cancelled);
                         ehSolverRuns.increment();
-                        if (found) {
-                            break;
-                        }
                     } catch (EhSolverCancelledException&) {
                         LogPrint("pow", "Equihash solver cancelled\n");
                         std::lock_guard<std::mutex> lock{m_cs};
                         cancelSolver = false;
                     }
                 }
+                if (found)
+                    break;
 
                 // Check for stop or if block needs to be rebuilt
                 boost::this_thread::interruption_point();
@@ -721,7 +1160,7 @@ void static BitcoinMiner()
                     break;
                 if ((UintToArith256(pblock->nNonce) & 0xffff) == 0xffff)
                     break;
-                if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60)
+                if (mempool.GetTransactionsUpdated() != job.nTransactionsUpdated && GetTime() - job.nStart > 60)
                     break;
                 if (pindexPrev != chainActive.Tip())
                     break;
@@ -740,6 +1179,7 @@ void static BitcoinMiner()
     catch (const boost::thread_interrupted&)
     {
         miningTimer.stop();
+        threadMetrics.timer.stop();
         c.disconnect();
         LogPrintf("LitecoinzMiner terminated\n");
         throw;
@@ -747,11 +1187,13 @@ void static BitcoinMiner()
     catch (const std::runtime_error &e)
     {
         miningTimer.stop();
+        threadMetrics.timer.stop();
         c.disconnect();
         LogPrintf("LitecoinzMiner runtime error: %s\n", e.what());
         return;
     }
     miningTimer.stop();
+    threadMetrics.timer.stop();
     c.disconnect();
 }
 
@@ -762,31 +1204,40 @@ void GenerateBitcoins(bool fGenerate, int nThreads)
 #endif
 {
     static boost::thread_group* minerThreads = NULL;
+    static CMinerPool* minerPool = NULL;
 
     if (nThreads < 0)
         nThreads = GetNumCores() / 2; // New algo is more hardware intensive, so we use only half cores
     else if (nThreads == GetNumCores())
         nThreads = nThreads / 2; // New algo is more hardware intensive, so we use only half cores
 
+    // A solver plugin mines with a thread for each of its devices
+    if (pEquihashPlugin)
+        nThreads = pEquihashPlugin->GetDevices().size();
+
     if (minerThreads != NULL)
     {
         minerThreads->interrupt_all();
         minerThreads->join_all();
         delete minerThreads;
         minerThreads = NULL;
+        delete minerPool;
+        minerPool = NULL;
     }
 
     if (nThreads == 0 || !fGenerate)
         return;
 
-    minerThreads = new boost::thread_group();
-    for (int i = 0; i < nThreads; i++) {
 #ifdef ENABLE_WALLET
-        minerThreads->create_thread(boost::bind(&BitcoinMiner, pwallet));
+    minerPool = new CMinerPool(pwallet);
 #else
-        minerThreads->create_thread(&BitcoinMiner);
+    minerPool = new CMinerPool();
 #endif
+    minerThreads = new boost::thread_group();
+    for (int i = 0; i < nThreads; i++) {
+        minerThreads->create_thread(boost::bind(&BitcoinMiner, boost::ref(*minerPool), i));
     }
+    minerThreads->create_thread(boost::bind(&CMinerPool::SubmitBlocks, minerPool));
 }
 
 #endif // ENABLE_MINING
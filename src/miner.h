@@ -27,6 +27,9 @@ struct CBlockTemplate
     std::vector<int64_t> vTxSigOps;
 };
 
+/** Default for -longpollfeedelta, the fees that new transactions must pay to answer a long poll */
+static const CAmount DEFAULT_LONGPOLL_FEE_DELTA = COIN / 1000;
+
 /** Generate a new block, without valid proof-of-work */
 CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn);
 #ifdef ENABLE_WALLET
@@ -14,17 +14,29 @@
 #include "addrman.h"
 #include "chainparams.h"
 #include "clientversion.h"
+#include "memusage.h"
+#include "metrics.h"
 #include "primitives/transaction.h"
 #include "scheduler.h"
+#include "trace.h"
 #include "ui_interface.h"
 #include "crypto/common.h"
 
 #ifdef WIN32
+#include <math.h>
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
 #endif
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#include <limits>
+#include <thread>
 
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
@@ -50,7 +62,14 @@ using namespace std;
 
 namespace {
     const int MAX_OUTBOUND_CONNECTIONS = 8;
+    /** Outbound connections, on top of the others, that only relay blocks (see CNode::fBlockRelayOnly) */
+    const int MAX_BLOCK_RELAY_ONLY_CONNECTIONS = 2;
     const int MAX_FEELER_CONNECTIONS = 1;
+    /**
+     * Delay before another outbound connection attempt is raced against those
+     * still connecting, as happy eyeballs (RFC 8305) does
+     */
+    const int CONNECT_ATTEMPT_DELAY_MS = 250;
 }
 
 //
@@ -72,9 +91,7 @@ std::string strSubVersion;
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
-deque<pair<int64_t, CInv> > vRelayExpiration;
-CCriticalSection cs_mapRelay;
+CRelayCache relayCache;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
 
 static deque<string> vOneShots;
@@ -92,6 +109,20 @@ CCriticalSection cs_nLastNodeId;
 static CSemaphore *semOutbound = NULL;
 static boost::condition_variable messageHandlerCondition;
 
+/** An outbound connection ThreadOpenConnections queued for the connect threads */
+struct CConnectAttempt
+{
+    CAddress addr;
+    bool fBlockRelayOnly;
+    //! The outbound slot of the connection, which moves to its node
+    std::shared_ptr<CSemaphoreGrant> grant;
+};
+static boost::mutex mutexConnectAttempts;
+static boost::condition_variable condConnectAttempts;
+static deque<CConnectAttempt> dequeConnectAttempts;
+//! Network group of each attempt queued or connecting, and whether it is block-relay-only
+static map<vector<unsigned char>, bool> mapGroupsConnecting;
+
 // Signals for message handling
 static CNodeSignals g_signals;
 CNodeSignals& GetNodeSignals() { return g_signals; }
@@ -348,7 +379,7 @@ CNode* FindNode(const CService& addr)
     return NULL;
 }
 
-CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
+CNode* ConnectNode(CAddress addrConnect, const char *pszDest, bool fBlockRelayOnly)
 {
     if (pszDest == NULL) {
         if (IsLocal(addrConnect))
@@ -383,7 +414,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
         addrman.Attempt(addrConnect);
 
         // Add node
-        CNode* pnode = new CNode(hSocket, addrConnect, pszDest ? pszDest : "", false);
+        CNode* pnode = new CNode(hSocket, addrConnect, pszDest ? pszDest : "", false, fBlockRelayOnly);
         pnode->AddRef();
 
         {
@@ -431,7 +462,7 @@ void CNode::PushVersion()
     else
         LogPrint("net", "send version message: version %d, blocks=%d, us=%s, peer=%d\n", PROTOCOL_VERSION, nBestHeight, addrMe.ToString(), id);
     PushMessage("version", PROTOCOL_VERSION, nLocalServices, nTime, addrYou, addrMe,
-                nLocalHostNonce, strSubVersion, nBestHeight, true);
+                nLocalHostNonce, strSubVersion, nBestHeight, !fBlockRelayOnly);
 }
 
 
@@ -441,29 +472,25 @@ void CNode::PushVersion()
 banmap_t CNode::setBanned;
 CCriticalSection CNode::cs_setBanned;
 bool CNode::setBannedIsDirty;
+CSubNetIndex CNode::banIndex;
+boost::shared_mutex CNode::cs_banIndex;
 
 void CNode::ClearBanned()
 {
     LOCK(cs_setBanned);
     setBanned.clear();
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_banIndex);
+        banIndex.clear();
+    }
     setBannedIsDirty = true;
 }
 
 bool CNode::IsBanned(CNetAddr ip)
 {
-    bool fResult = false;
-    {
-        LOCK(cs_setBanned);
-        for (banmap_t::iterator it = setBanned.begin(); it != setBanned.end(); it++)
-        {
-            CSubNet subNet = (*it).first;
-            CBanEntry banEntry = (*it).second;
-
-            if(subNet.Match(ip) && GetTime() < banEntry.nBanUntil)
-                fResult = true;
-        }
-    }
-    return fResult;
+    int64_t nNow = GetTime();
+    boost::shared_lock<boost::shared_mutex> lock(cs_banIndex);
+    return banIndex.Match(ip, nNow);
 }
 
 bool CNode::IsBanned(CSubNet subnet)
@@ -488,6 +515,10 @@ void CNode::Ban(const CNetAddr& addr, const BanReason &banReason, int64_t bantim
 }
 
 void CNode::Ban(const CSubNet& subNet, const BanReason &banReason, int64_t bantimeoffset, bool sinceUnixEpoch) {
+    Ban(std::vector<CSubNet>(1, subNet), banReason, bantimeoffset, sinceUnixEpoch);
+}
+
+void CNode::Ban(const std::vector<CSubNet>& vSubNet, const BanReason &banReason, int64_t bantimeoffset, bool sinceUnixEpoch) {
     CBanEntry banEntry(GetTime());
     banEntry.banReason = banReason;
     if (bantimeoffset <= 0)
@@ -498,12 +529,21 @@ void CNode::Ban(const CSubNet& subNet, const BanReason &banReason, int64_t banti
     banEntry.nBanUntil = (sinceUnixEpoch ? 0 : GetTime() )+bantimeoffset;
 
     LOCK(cs_setBanned);
-    if (setBanned[subNet].nBanUntil < banEntry.nBanUntil)
-        setBanned[subNet] = banEntry;
-
+    for (const CSubNet& subNet : vSubNet)
+        BanLocked(subNet, banEntry);
     setBannedIsDirty = true;
 }
 
+void CNode::BanLocked(const CSubNet& subNet, const CBanEntry& banEntry) {
+    AssertLockHeld(cs_setBanned);
+    CBanEntry& entry = setBanned[subNet];
+    if (entry.nBanUntil < banEntry.nBanUntil) {
+        entry = banEntry;
+        boost::unique_lock<boost::shared_mutex> lock(cs_banIndex);
+        banIndex.Set(subNet, banEntry.nBanUntil);
+    }
+}
+
 bool CNode::Unban(const CNetAddr &addr) {
     CSubNet subNet(addr);
     return Unban(subNet);
@@ -513,6 +553,10 @@ bool CNode::Unban(const CSubNet &subNet) {
     LOCK(cs_setBanned);
     if (setBanned.erase(subNet))
     {
+        {
+            boost::unique_lock<boost::shared_mutex> lock(cs_banIndex);
+            banIndex.Erase(subNet);
+        }
         setBannedIsDirty = true;
         return true;
     }
@@ -529,6 +573,12 @@ void CNode::SetBanned(const banmap_t &banMap)
 {
     LOCK(cs_setBanned);
     setBanned = banMap;
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_banIndex);
+        banIndex.clear();
+        for (banmap_t::const_iterator it = setBanned.begin(); it != setBanned.end(); ++it)
+            banIndex.Set(it->first, it->second.nBanUntil);
+    }
     setBannedIsDirty = true;
 }
 
@@ -543,6 +593,10 @@ void CNode::SweepBanned()
         CBanEntry banEntry = (*it).second;
         if(now > banEntry.nBanUntil)
         {
+            {
+                boost::unique_lock<boost::shared_mutex> lock(cs_banIndex);
+                banIndex.Erase(it->first);
+            }
             setBanned.erase(it++);
             setBannedIsDirty = true;
         }
@@ -594,8 +648,19 @@ void CNode::copyStats(CNodeStats &stats)
     stats.fInbound = fInbound;
     stats.nStartingHeight = nStartingHeight;
     stats.nSendBytes = nSendBytes;
+    {
+        // Left at zero rather than waited for while a send is under way
+        TRY_LOCK(cs_vSend, lockSend);
+        for (int nClass = 0; nClass < SEND_CLASS_COUNT; nClass++)
+            stats.nSendQueued[nClass] = lockSend ? nSendSizeByClass[nClass] : 0;
+    }
     stats.nRecvBytes = nRecvBytes;
     stats.fWhitelisted = fWhitelisted;
+    stats.fBlockRelayOnly = fBlockRelayOnly;
+    stats.nLastBlockTime = nLastBlockTime;
+    stats.nLastTxTime = nLastTxTime;
+    stats.nBlocksFirst = nBlocksFirst;
+    stats.nTxsFirst = nTxsFirst;
 
     // It is common for nodes with good ping times to suddenly become lagged,
     // due to a new block arriving or other large transfer.
@@ -614,6 +679,34 @@ void CNode::copyStats(CNodeStats &stats)
 
     // Leave string empty if addrLocal invalid (not filled in yet)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
+
+    LOCK(cs_msgStats);
+    stats.mapMsgStats = mapMsgStats;
+}
+
+/**
+ * The stats of command strCommand in map, or of "other" once
+ * MAX_METRICS_LABELS commands have been seen, as made-up commands could
+ * grow it without bound
+ */
+static CNodeMsgStats& GetMsgCmdStats(mapMsgCmdStats& map, const std::string& strCommand)
+{
+    mapMsgCmdStats::iterator it = map.find(strCommand);
+    if (it != map.end())
+        return it->second;
+    if (map.size() >= MAX_METRICS_LABELS)
+        return map["other"];
+    return map[strCommand];
+}
+
+void CNode::RecordMessageProcessed(const std::string& strCommand, uint64_t nBytes, int64_t nProcessMicros)
+{
+    LOCK(cs_msgStats);
+    CNodeMsgStats& stats = GetMsgCmdStats(mapMsgStats, strCommand);
+    stats.nRecvMsgs++;
+    stats.nRecvBytes += nBytes;
+    stats.nProcessMicros += nProcessMicros;
+    stats.nMaxProcessMicros = std::max(stats.nMaxProcessMicros, nProcessMicros);
 }
 
 // requires LOCK(cs_vRecvMsg)
@@ -648,7 +741,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
 
         if (msg.complete()) {
             msg.nTime = GetTimeMicros();
-            messageHandlerCondition.notify_one();
+            messageHandlerCondition.notify_all();
         }
     }
 
@@ -686,50 +779,262 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
     return nCopy;
 }
 
+static CRecvBufferPool recvBufferPool;
+
+CRecvBufferPool::CRecvBufferPool() : nPooledBytes(0)
+{
+    size_t nClasses = SizeClass(MAX_PROTOCOL_MESSAGE_LENGTH) + 1;
+    vFree.resize(nClasses);
+}
+
+size_t CRecvBufferPool::SizeClass(size_t nSize)
+{
+    // The class whose buffers are just big enough for nSize
+    size_t nClass = 0;
+    while ((MIN_BUFFER_SIZE << nClass) < nSize)
+        nClass++;
+    return nClass;
+}
+
+bool CRecvBufferPool::TakeFree(CSerializeData& vch, size_t nClass)
+{
+    for (; nClass < vFree.size(); nClass++) {
+        if (!vFree[nClass].empty()) {
+            vch.swap(vFree[nClass].back());
+            vFree[nClass].pop_back();
+            nPooledBytes -= vch.capacity();
+            return true;
+        }
+    }
+    return false;
+}
+
+void CRecvBufferPool::Take(CSerializeData& vch, size_t nSize, size_t nSizeIfFree)
+{
+    assert(vch.capacity() == 0);
+    {
+        LOCK(cs);
+        if (TakeFree(vch, SizeClass(nSizeIfFree)) || TakeFree(vch, SizeClass(nSize)))
+            return;
+    }
+    vch.reserve(std::max(nSize, MIN_BUFFER_SIZE << SizeClass(nSize)));
+}
+
+void CRecvBufferPool::Give(CSerializeData& vch)
+{
+    size_t nCapacity = vch.capacity();
+    vch.clear();
+    if (nCapacity >= MIN_BUFFER_SIZE) {
+        // A buffer goes in the biggest class it has room for
+        size_t nClass = std::min(SizeClass(nCapacity + 1) - 1, vFree.size() - 1);
+        LOCK(cs);
+        if (vFree[nClass].size() < MAX_BUFFERS_PER_CLASS && nPooledBytes + nCapacity <= MAX_POOLED_BYTES) {
+            vFree[nClass].push_back(CSerializeData());
+            vFree[nClass].back().swap(vch);
+            nPooledBytes += nCapacity;
+            return;
+        }
+    }
+    CSerializeData().swap(vch);
+}
+
+size_t CRecvBufferPool::PooledBytes()
+{
+    LOCK(cs);
+    return nPooledBytes;
+}
+
+CPeerMemoryUsage GetPeerMemoryUsage()
+{
+    CPeerMemoryUsage usage;
+    usage.nRecvBuffers = recvBufferPool.PooledBytes();
+
+    LOCK(cs_vNodes);
+    BOOST_FOREACH(CNode* pnode, vNodes) {
+        usage.nPeers++;
+        {
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (lockSend)
+                usage.nSendBuffers += pnode->nSendSize;
+        }
+        {
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (lockRecv) {
+                usage.nRecvBuffers += pnode->GetTotalRecvSize();
+                usage.nQueues += pnode->vRecvGetData.size() * sizeof(CInv);
+            }
+        }
+        {
+            LOCK(pnode->cs_inventory);
+            usage.nQueues += memusage::DynamicUsage(pnode->vInventoryToSend) +
+                             pnode->setInventoryKnown.size() * (memusage::MallocUsage(sizeof(memusage::stl_tree_node<CInv>)) + sizeof(void*));
+        }
+        {
+            LOCK(pnode->cs_vAddrToSend);
+            usage.nQueues += memusage::DynamicUsage(pnode->vAddrToSend);
+        }
+    }
+    return usage;
+}
+
 int CNetMessage::readData(const char *pch, unsigned int nBytes)
 {
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
     if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+        // Allocate up to 256 KiB ahead, or double what has arrived, but
+        // never more than the total message size. The size in the header
+        // is only trusted so far as to reuse a pooled buffer for it.
+        unsigned int nNewSize = std::min(hdr.nMessageSize, std::max(nDataPos + nCopy + 256 * 1024, 2 * nDataPos));
+        if (nNewSize >= CRecvBufferPool::MIN_BUFFER_SIZE && vRecv.capacity() < nNewSize) {
+            CSerializeData vch;
+            recvBufferPool.Take(vch, nNewSize, hdr.nMessageSize);
+            vch.assign(vRecv.begin(), vRecv.begin() + nDataPos);
+            vRecv.swap(vch);
+            recvBufferPool.Give(vch);
+        }
+        vRecv.resize(nNewSize);
     }
 
     memcpy(&vRecv[nDataPos], pch, nCopy);
+    // Hash while the data is at hand, so the checksum is ready as soon as
+    // the last byte arrives
+    hasher.Write((const unsigned char*)pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
 }
 
+const uint256& CNetMessage::GetMessageHash()
+{
+    assert(complete());
+    if (data_hash.IsNull())
+        hasher.Finalize(data_hash.begin());
+    return data_hash;
+}
+
+void CNetMessage::ReleaseBuffer()
+{
+    CSerializeData vch;
+    vRecv.swap(vch);
+    recvBufferPool.Give(vch);
+}
+
+
+
+
+
 
 
 
 
+#ifndef WIN32
+/** The most queued messages handed to one sendmsg() call */
+static const size_t MAX_SEND_IOVECS = 64;
+#endif
 
+SendClass GetSendClass(const std::string& strCommand)
+{
+    if (strCommand == "tx" || strCommand == "inv" || strCommand == "notfound")
+        return SEND_CLASS_TX;
+    if (strCommand == "addr" || strCommand == "getaddr" || strCommand == "alert")
+        return SEND_CLASS_BULK;
+    return SEND_CLASS_BLOCK;
+}
 
+const char* GetSendClassName(SendClass sendClass)
+{
+    switch (sendClass) {
+    case SEND_CLASS_BLOCK: return "block";
+    case SEND_CLASS_TX: return "tx";
+    case SEND_CLASS_BULK: return "bulk";
+    default: return "unknown";
+    }
+}
 
+/**
+ * The class to send the next message from, or -1 if nothing is queued, and
+ * in nMaxMsgs how many of its messages to send in a row. A message once
+ * begun is finished first.
+ */
+static int ChooseSendClass(const CNode* pnode, size_t& nMaxMsgs)
+{
+    nMaxMsgs = 1;
+    if (pnode->nSendOffset > 0)
+        return pnode->nSendClass;
+    int nFirst = -1;
+    for (int nClass = 0; nClass < SEND_CLASS_COUNT; nClass++) {
+        if (pnode->vSendMsg[nClass].empty())
+            continue;
+        if (nFirst < 0)
+            nFirst = nClass;
+        else if (pnode->nSendPassedByClass[nClass] >= MAX_SEND_PASSED_BYTES)
+            return nClass;
+    }
+    if (nFirst >= 0)
+        nMaxMsgs = pnode->vSendMsg[nFirst].size();
+    return nFirst;
+}
 
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
-
-    while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+    size_t nMaxMsgs;
+    int nClass;
+    while ((nClass = ChooseSendClass(pnode, nMaxMsgs)) >= 0) {
+        std::deque<CMessageBuffer>& queue = pnode->vSendMsg[nClass];
+        std::deque<CMessageBuffer>::iterator it = queue.begin();
+        pnode->nSendClass = nClass;
+        assert((*it)->size() > pnode->nSendOffset);
+#ifdef WIN32
+        const std::vector<char> &data = **it;
+        size_t nRequested = data.size() - pnode->nSendOffset;
+        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], nRequested, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+        // Hand the kernel as many queued messages of the class as one call
+        // takes, straight from the shared buffers.
+        struct iovec iov[MAX_SEND_IOVECS];
+        size_t nIov = 0;
+        size_t nRequested = 0;
+        for (std::deque<CMessageBuffer>::iterator itIov = it; itIov != queue.end() && nIov < MAX_SEND_IOVECS && nIov < nMaxMsgs; ++itIov, ++nIov) {
+            size_t nSkip = (nIov == 0 ? pnode->nSendOffset : 0);
+            iov[nIov].iov_base = (void*)((*itIov)->data() + nSkip);
+            iov[nIov].iov_len = (*itIov)->size() - nSkip;
+            nRequested += iov[nIov].iov_len;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = nIov;
+        ssize_t nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             pnode->RecordBytesSent(nBytes);
-            if (pnode->nSendOffset == data.size()) {
+            // Drop the messages that were sent completely
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                size_t nRemaining = (*it)->size() - pnode->nSendOffset;
+                if (nLeft < nRemaining) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nRemaining;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= (*it)->size();
+                pnode->nSendSizeByClass[nClass] -= (*it)->size();
+                pnode->nSendPassedByClass[nClass] = 0;
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            queue.erase(queue.begin(), it);
+            // The other classes that are waiting were passed by what was sent
+            for (int nOther = 0; nOther < SEND_CLASS_COUNT; nOther++)
+                if (nOther != nClass && !pnode->vSendMsg[nOther].empty())
+                    pnode->nSendPassedByClass[nOther] += nBytes;
+            if ((size_t)nBytes < nRequested) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -747,11 +1052,10 @@ void SocketSendData(CNode *pnode)
         }
     }
 
-    if (it == pnode->vSendMsg.end()) {
+    if (nClass < 0) {
         assert(pnode->nSendOffset == 0);
         assert(pnode->nSendSize == 0);
     }
-    pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
 }
 
 static list<CNode*> vNodesDisconnected;
@@ -803,6 +1107,20 @@ static bool ReverseCompareNodeTimeConnected(const CNodeRef &a, const CNodeRef &b
     return a->nTimeConnected > b->nTimeConnected;
 }
 
+static bool CompareNodeBlockTime(const CNodeRef &a, const CNodeRef &b)
+{
+    // There is a fall-through here because it is common for a node to have many peers which have not yet relayed a block.
+    if (a->nLastBlockTime != b->nLastBlockTime) return a->nLastBlockTime < b->nLastBlockTime;
+    return a->nTimeConnected > b->nTimeConnected;
+}
+
+static bool CompareNodeTxTime(const CNodeRef &a, const CNodeRef &b)
+{
+    // There is a fall-through here because it is common for a node to have more than a few peers that have not yet relayed txn.
+    if (a->nLastTxTime != b->nLastTxTime) return a->nLastTxTime < b->nLastTxTime;
+    return a->nTimeConnected > b->nTimeConnected;
+}
+
 class CompareNetGroupKeyed
 {
     std::vector<unsigned char> vchSecretKey;
@@ -902,6 +1220,20 @@ static bool AttemptToEvictConnection(bool fPreferNewConnection) {
 
     if (vEvictionCandidates.empty()) return false;
 
+    // Protect 4 nodes that most recently sent us transactions we hadn't had.
+    // An attacker cannot manipulate this metric without performing useful work.
+    std::sort(vEvictionCandidates.begin(), vEvictionCandidates.end(), CompareNodeTxTime);
+    vEvictionCandidates.erase(vEvictionCandidates.end() - std::min(4, static_cast<int>(vEvictionCandidates.size())), vEvictionCandidates.end());
+
+    if (vEvictionCandidates.empty()) return false;
+
+    // Protect 4 nodes that most recently sent us blocks we hadn't had.
+    // An attacker cannot manipulate this metric without performing useful work.
+    std::sort(vEvictionCandidates.begin(), vEvictionCandidates.end(), CompareNodeBlockTime);
+    vEvictionCandidates.erase(vEvictionCandidates.end() - std::min(4, static_cast<int>(vEvictionCandidates.size())), vEvictionCandidates.end());
+
+    if (vEvictionCandidates.empty()) return false;
+
     // Protect the half of the remaining nodes which have been connected the longest.
     // This replicates the existing implicit behavior.
     std::sort(vEvictionCandidates.begin(), vEvictionCandidates.end(), ReverseCompareNodeTimeConnected);
@@ -948,7 +1280,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
     CAddress addr;
     int nInbound = 0;
-    int nMaxInbound = nMaxConnections - MAX_OUTBOUND_CONNECTIONS;
+    int nMaxInbound = nMaxConnections - (MAX_OUTBOUND_CONNECTIONS + MAX_BLOCK_RELAY_ONLY_CONNECTIONS);
 
     if (hSocket != INVALID_SOCKET)
         if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
@@ -1015,273 +1347,479 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
-void CConnman::ThreadSocketHandler()
+void CConnman::DisconnectNodes()
 {
-    unsigned int nPrevNodeCount = 0;
-    while (true)
     {
-        //
-        // Disconnect nodes
-        //
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        vector<CNode*> vNodesCopy = vNodes;
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
         {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            vector<CNode*> vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            if (pnode->fDisconnect ||
+                (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty()))
             {
-                if (pnode->fDisconnect ||
-                    (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty()))
-                {
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
-
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
-
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
-
-                    // hold in disconnected pool until all refs are released
-                    if (pnode->fNetworkNode || pnode->fInbound)
-                        pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
+
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
+
+#ifdef USE_EPOLL
+                // stop looking up socket events for it
+                if (pnode->fEventsRegistered) {
+                    mapEventNodes.erase(pnode->id);
+                    if (pnode->fEventsQueued)
+                        vEventNodesQueued.erase(remove(vEventNodesQueued.begin(), vEventNodesQueued.end(), pnode), vEventNodesQueued.end());
+                    pnode->fEventsRegistered = false;
+                    pnode->fEventsQueued = false;
                 }
+#endif
+
+                // hold in disconnected pool until all refs are released
+                if (pnode->fNetworkNode || pnode->fInbound)
+                    pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
+    }
+    {
+        // Delete disconnected nodes
+        list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy)
         {
-            // Delete disconnected nodes
-            list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy)
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0)
             {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0)
+                bool fDelete = false;
                 {
-                    bool fDelete = false;
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend)
                     {
-                        TRY_LOCK(pnode->cs_vSend, lockSend);
-                        if (lockSend)
+                        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                        if (lockRecv)
                         {
-                            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                            if (lockRecv)
-                            {
-                                TRY_LOCK(pnode->cs_inventory, lockInv);
-                                if (lockInv)
-                                    fDelete = true;
-                            }
+                            TRY_LOCK(pnode->cs_inventory, lockInv);
+                            if (lockInv)
+                                fDelete = true;
                         }
                     }
-                    if (fDelete)
-                    {
-                        vNodesDisconnected.remove(pnode);
-                        delete pnode;
-                    }
+                }
+                if (fDelete)
+                {
+                    vNodesDisconnected.remove(pnode);
+                    delete pnode;
                 }
             }
         }
-        if(vNodes.size() != nPrevNodeCount) {
-            nPrevNodeCount = vNodes.size();
-            uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+}
+
+/**
+ * Read what is waiting on the socket of pnode, which must be locked with
+ * cs_vRecvMsg. Returns true if the read filled the buffer, so more may be
+ * waiting.
+ */
+static bool SocketRecvData(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    if (nBytes > 0)
+    {
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+            pnode->CloseSocketDisconnect();
+        pnode->nLastRecv = GetTime();
+        pnode->nRecvBytes += nBytes;
+        pnode->RecordBytesRecv(nBytes);
+        return nBytes == sizeof(pchBuf);
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    }
+    else if (nBytes < 0)
+    {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+        {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
         }
+    }
+    return false;
+}
 
+static void InactivityCheck(CNode* pnode, int64_t nTime)
+{
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
+        {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastRecv > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
+void CConnman::ThreadSocketHandler()
+{
+    unsigned int nPrevNodeCount = 0;
+#ifdef USE_EPOLL
+    int64_t nLastInactivityCheck = 0;
+#endif
+    while (true)
+    {
         //
-        // Find which sockets have data to receive
+        // Disconnect nodes
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
+        DisconnectNodes();
+        if(vNodes.size() != nPrevNodeCount) {
+            nPrevNodeCount = vNodes.size();
+            uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
         }
 
-        {
+#ifdef USE_EPOLL
+        ServiceSocketEvents();
+
+        // Only sockets with events were looked at, so check the others for
+        // timeouts once a second
+        int64_t nTime = GetTime();
+        if (nTime != nLastInactivityCheck) {
+            nLastInactivityCheck = nTime;
             LOCK(cs_vNodes);
             BOOST_FOREACH(CNode* pnode, vNodes)
-            {
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signaling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (
-                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
+                InactivityCheck(pnode, nTime);
         }
+#else
+        ServiceSocketsSelect();
+#endif
+    }
+}
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        boost::this_thread::interruption_point();
+#ifdef USE_EPOLL
 
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
+/** The most socket events to take from epoll at once */
+static const int MAX_SOCKET_EVENTS = 1024;
+/** Reads from one socket before moving on to the next one with events */
+static const int MAX_SOCKET_READS = 4;
+/** Event data of the listening sockets; nodes use their id */
+static const uint64_t LISTEN_SOCKET_EVENT = std::numeric_limits<uint64_t>::max();
+
+void CConnman::RegisterSocketEvents()
+{
+    LOCK(cs_vNodes);
+    BOOST_FOREACH(CNode* pnode, vNodes)
+    {
+        if (pnode->fEventsRegistered || pnode->hSocket == INVALID_SOCKET)
+            continue;
+        // Readiness the socket already has is reported on the next wait
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.u64 = pnode->id;
+        if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+            LogPrintf("epoll_ctl for peer=%d failed: %s\n", pnode->id, NetworkErrorString(WSAGetLastError()));
+            pnode->fDisconnect = true;
+            continue;
+        }
+        pnode->fEventsRegistered = true;
+        mapEventNodes[pnode->id] = pnode;
+    }
+}
+
+void CConnman::QueueSocketEvents(CNode* pnode)
+{
+    if (!pnode->fEventsQueued) {
+        pnode->fEventsQueued = true;
+        vEventNodesQueued.push_back(pnode);
+    }
+}
+
+void CConnman::ServiceSocketEvents()
+{
+    RegisterSocketEvents();
+
+    //
+    // Wait for sockets that became ready. Sockets that are still readable or
+    // writable were queued on the previous pass; only wait for them when it
+    // was the receive flood limit or a busy lock that held them back.
+    //
+    struct epoll_event events[MAX_SOCKET_EVENTS];
+    int nEvents = epoll_wait(hEpoll, events, MAX_SOCKET_EVENTS, fRecvBacklog ? 0 : 50);
+    boost::this_thread::interruption_point();
+
+    if (nEvents < 0)
+    {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+            MilliSleep(50);
+        }
+        nEvents = 0;
+    }
+
+    for (int i = 0; i < nEvents; i++)
+    {
+        if (events[i].data.u64 == LISTEN_SOCKET_EVENT) {
+            //
+            // Accept new connections
+            //
+            BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
             {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
+                if (hListenSocket.socket != INVALID_SOCKET)
+                    AcceptConnection(hListenSocket);
             }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
+            continue;
         }
+        // A socket closed by another thread may still report events until
+        // its node is gone
+        std::map<NodeId, CNode*>::iterator it = mapEventNodes.find((NodeId)events[i].data.u64);
+        if (it == mapEventNodes.end())
+            continue;
+        CNode* pnode = it->second;
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            pnode->fRecvReady = true;
+        if (events[i].events & EPOLLOUT)
+            pnode->fSendReady = true;
+        QueueSocketEvents(pnode);
+    }
+
+    //
+    // Service each ready socket
+    //
+    std::vector<CNode*> vNodesReady;
+    vNodesReady.swap(vEventNodesQueued);
+    fRecvBacklog = false;
+    BOOST_FOREACH(CNode* pnode, vNodesReady)
+    {
+        pnode->fEventsQueued = false;
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+        bool fRetry = false;
 
         //
-        // Accept new connections
+        // Send
         //
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+        // As with select(), a peer that is not draining what we send does not
+        // get more of its data read until it does.
+        bool fSendPending = false;
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
-            {
-                AcceptConnection(hListenSocket);
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (!lockSend) {
+                fRetry = true;
+            } else if (pnode->nSendSize > 0) {
+                if (pnode->fSendReady) {
+                    SocketSendData(pnode);
+                    // What is left waits for the socket to become writable again
+                    if (pnode->nSendSize > 0)
+                        pnode->fSendReady = false;
+                }
+                fSendPending = pnode->nSendSize > 0;
             }
         }
 
         //
-        // Service each socket
+        // Receive
         //
-        vector<CNode*> vNodesCopy;
+        if (pnode->fRecvReady && !fSendPending && pnode->hSocket != INVALID_SOCKET)
         {
-            LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
-                pnode->AddRef();
-        }
-        BOOST_FOREACH(CNode* pnode, vNodesCopy)
-        {
-            boost::this_thread::interruption_point();
-
-            //
-            // Receive
-            //
-            if (pnode->hSocket == INVALID_SOCKET)
-                continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
-            {
-                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv)
-                {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0)
-                        {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        }
-                        else if (nBytes == 0)
-                        {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        }
-                        else if (nBytes < 0)
-                        {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                            {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (!lockRecv) {
+                fRetry = true;
+            } else {
+                for (int nReads = 0; pnode->fRecvReady; nReads++) {
+                    if (!pnode->vRecvMsg.empty() && pnode->vRecvMsg.front().complete() &&
+                        pnode->GetTotalRecvSize() > ReceiveFloodSize()) {
+                        // Wait for the message handler to catch up
+                        fRetry = true;
+                        break;
                     }
+                    if (nReads == MAX_SOCKET_READS) {
+                        fRetry = true;
+                        fRecvBacklog = true;
+                        break;
+                    }
+                    pnode->fRecvReady = SocketRecvData(pnode);
                 }
             }
+        }
 
-            //
-            // Send
-            //
+        if (fRetry && pnode->hSocket != INVALID_SOCKET)
+            QueueSocketEvents(pnode);
+    }
+}
+
+#else // USE_EPOLL
+
+void CConnman::ServiceSocketsSelect()
+{
+    //
+    // Find which sockets have data to receive
+    //
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = max(hSocketMax, hListenSocket.socket);
+        have_fds = true;
+    }
+
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+        {
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+            FD_SET(pnode->hSocket, &fdsetError);
+            hSocketMax = max(hSocketMax, pnode->hSocket);
+            have_fds = true;
+
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this only
+            //   happens when optimistic write failed, we choose to first drain the
+            //   write buffer in this case before receiving more. This avoids
+            //   needlessly queueing received data, if the remote peer is not themselves
+            //   receiving data. This means properly utilizing TCP flow control signaling.
+            // * Otherwise, if there is no (complete) message in the receive buffer,
+            //   or there is space left in the buffer, select() for receiving data.
+            // * (if neither of the above applies, there is certainly one message
+            //   in the receiver buffer ready to be processed).
+            // Together, that means that at least one of the following is always possible,
+            // so we don't deadlock:
+            // * We send some data.
+            // * We wait for data to be received (and disconnect after timeout).
+            // * We process a message in the buffer (message handler thread).
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
-                    SocketSendData(pnode);
+                if (lockSend && pnode->nSendSize > 0) {
+                    FD_SET(pnode->hSocket, &fdsetSend);
+                    continue;
+                }
             }
-
-            //
-            // Inactivity checking
-            //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60)
             {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
-                {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
+                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                if (lockRecv && (
+                    pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                    pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+                    FD_SET(pnode->hSocket, &fdsetRecv);
             }
         }
+    }
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    boost::this_thread::interruption_point();
+
+    if (nSelect == SOCKET_ERROR)
+    {
+        if (have_fds)
         {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
-                pnode->Release();
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (unsigned int i = 0; i <= hSocketMax; i++)
+                FD_SET(i, &fdsetRecv);
+        }
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        MilliSleep(timeout.tv_usec/1000);
+    }
+
+    //
+    // Accept new connections
+    //
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+    {
+        if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+        {
+            AcceptConnection(hListenSocket);
         }
     }
+
+    //
+    // Service each socket
+    //
+    vector<CNode*> vNodesCopy;
+    {
+        LOCK(cs_vNodes);
+        vNodesCopy = vNodes;
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            pnode->AddRef();
+    }
+    BOOST_FOREACH(CNode* pnode, vNodesCopy)
+    {
+        boost::this_thread::interruption_point();
+
+        //
+        // Receive
+        //
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+        if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+        {
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (lockRecv)
+                SocketRecvData(pnode);
+        }
+
+        //
+        // Send
+        //
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+        if (FD_ISSET(pnode->hSocket, &fdsetSend))
+        {
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (lockSend)
+                SocketSendData(pnode);
+        }
+
+        //
+        // Inactivity checking
+        //
+        InactivityCheck(pnode, GetTime());
+    }
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            pnode->Release();
+    }
 }
 
+#endif // USE_EPOLL
+
 
 void CConnman::ThreadDNSAddressSeed()
 {
@@ -1298,32 +1836,41 @@ void CConnman::ThreadDNSAddressSeed()
     }
 
     const vector<CDNSSeedData> &vSeeds = Params().DNSSeeds();
-    int found = 0;
+    std::atomic<int> found(0);
+    int64_t nStart = GetTimeMillis();
 
     LogPrintf("Loading addresses from DNS seeds (could take a while)\n");
 
+    // Resolve the seeds all at once, so that a slow one doesn't hold up the
+    // others. Each adds what it finds to addrman as soon as it has it, where
+    // ThreadOpenConnections picks it up.
+    vector<std::thread> vLookups;
     BOOST_FOREACH(const CDNSSeedData &seed, vSeeds) {
         if (HaveNameProxy()) {
             AddOneShot(seed.host);
         } else {
-            vector<CNetAddr> vIPs;
-            vector<CAddress> vAdd;
-            if (LookupHost(seed.host.c_str(), vIPs))
-            {
-                BOOST_FOREACH(const CNetAddr& ip, vIPs)
+            vLookups.emplace_back([&seed, &found]() {
+                vector<CNetAddr> vIPs;
+                vector<CAddress> vAdd;
+                if (LookupHost(seed.host.c_str(), vIPs))
                 {
-                    int nOneDay = 24*3600;
-                    CAddress addr = CAddress(CService(ip, Params().GetDefaultPort()));
-                    addr.nTime = GetTime() - 3*nOneDay - GetRand(4*nOneDay); // use a random age between 3 and 7 days old
-                    vAdd.push_back(addr);
-                    found++;
+                    BOOST_FOREACH(const CNetAddr& ip, vIPs)
+                    {
+                        int nOneDay = 24*3600;
+                        CAddress addr = CAddress(CService(ip, Params().GetDefaultPort()));
+                        addr.nTime = GetTime() - 3*nOneDay - GetRand(4*nOneDay); // use a random age between 3 and 7 days old
+                        vAdd.push_back(addr);
+                        found++;
+                    }
                 }
-            }
-            addrman.Add(vAdd, CNetAddr(seed.name, true));
+                addrman.Add(vAdd, CNetAddr(seed.name, true));
+            });
         }
     }
+    BOOST_FOREACH(std::thread& lookup, vLookups)
+        lookup.join();
 
-    LogPrintf("%d addresses found from DNS seeds\n", found);
+    LogPrintf("%d addresses found from DNS seeds in %dms\n", found.load(), GetTimeMillis() - nStart);
 }
 
 
@@ -1339,10 +1886,24 @@ void CConnman::ThreadDNSAddressSeed()
 
 void DumpAddresses()
 {
+    // The modification count of the last successful write, to skip
+    // rewriting peers.dat when nothing has changed since
+    static bool fDumped = false;
+    static uint64_t nDumpedModifications = 0;
+
     int64_t nStart = GetTimeMillis();
 
+    uint64_t nModifications = addrman.GetModificationCount();
+    if (fDumped && nModifications == nDumpedModifications) {
+        LogPrint("net", "peers.dat is up to date\n");
+        return;
+    }
+
     CAddrDB adb;
-    adb.Write(addrman);
+    if (!adb.Write(addrman))
+        return;
+    fDumped = true;
+    nDumpedModifications = nModifications;
 
     LogPrint("net", "Flushed %d addresses to peers.dat  %dms\n",
            addrman.size(), GetTimeMillis() - nStart);
@@ -1398,13 +1959,22 @@ void CConnman::ThreadOpenConnections()
         }
     }
 
-    // Initiate network connections
+    // Initiate network connections. They are queued for the connect threads
+    // rather than made here, and a new attempt doesn't wait for the last one
+    // to connect or time out: it starts CONNECT_ATTEMPT_DELAY_MS after it,
+    // as long as there is a free slot.
     int64_t nStart = GetTime();
+    bool fQueued = false;
+    // Network of the last attempt queued, for nodes that reach both IPv4 and
+    // IPv6 to alternate between them
+    bool fDualStack = IsReachable(NET_IPV4) && IsReachable(NET_IPV6);
+    enum Network netLastQueued = NET_UNROUTABLE;
     while (true)
     {
         ProcessOneShot();
 
-        MilliSleep(500);
+        MilliSleep(fQueued ? CONNECT_ATTEMPT_DELAY_MS : 500);
+        fQueued = false;
 
         CSemaphoreGrant grant(*semOutbound);
         boost::this_thread::interruption_point();
@@ -1427,16 +1997,35 @@ void CConnman::ThreadOpenConnections()
         // Only connect out to one peer per network group (/16 for IPv4).
         // Do this here so we don't have to critsect vNodes inside mapAddresses critsect.
         int nOutbound = 0;
+        int nOutboundBlockRelayOnly = 0;
         set<vector<unsigned char> > setConnected;
         {
             LOCK(cs_vNodes);
             BOOST_FOREACH(CNode* pnode, vNodes) {
                 if (!pnode->fInbound) {
                     setConnected.insert(pnode->addr.GetGroup());
-                    nOutbound++;
+                    if (pnode->fBlockRelayOnly)
+                        nOutboundBlockRelayOnly++;
+                    else
+                        nOutbound++;
                 }
             }
         }
+        {
+            boost::unique_lock<boost::mutex> lock(mutexConnectAttempts);
+            for (map<vector<unsigned char>, bool>::const_iterator it = mapGroupsConnecting.begin(); it != mapGroupsConnecting.end(); ++it) {
+                setConnected.insert(it->first);
+                if (it->second)
+                    nOutboundBlockRelayOnly++;
+                else
+                    nOutbound++;
+            }
+        }
+
+        // Fill the full relay slots first, then the block-relay-only ones
+        bool fBlockRelayOnly = nOutbound >= MAX_OUTBOUND_CONNECTIONS;
+        if (fBlockRelayOnly && nOutboundBlockRelayOnly >= MAX_BLOCK_RELAY_ONLY_CONNECTIONS)
+            continue;
 
         int64_t nANow = GetAdjustedTime();
 
@@ -1467,12 +2056,55 @@ void CConnman::ThreadOpenConnections()
             if (addr.GetPort() != Params().GetDefaultPort() && nTries < 50)
                 continue;
 
+            // Alternate address families, as happy eyeballs does, so that
+            // attempts to one that is broken don't take all the slots
+            if (fDualStack && addr.GetNetwork() == netLastQueued && nTries < 10)
+                continue;
+
             addrConnect = addr;
             break;
         }
 
         if (addrConnect.IsValid())
-            OpenNetworkConnection(addrConnect, &grant);
+        {
+            CConnectAttempt attempt;
+            attempt.addr = addrConnect;
+            attempt.fBlockRelayOnly = fBlockRelayOnly;
+            attempt.grant = std::make_shared<CSemaphoreGrant>();
+            grant.MoveTo(*attempt.grant);
+            {
+                boost::unique_lock<boost::mutex> lock(mutexConnectAttempts);
+                mapGroupsConnecting[addrConnect.GetGroup()] = fBlockRelayOnly;
+                dequeConnectAttempts.push_back(attempt);
+            }
+            condConnectAttempts.notify_one();
+            netLastQueued = addrConnect.GetNetwork();
+            fQueued = true;
+        }
+    }
+}
+
+void CConnman::ThreadConnectAttempts()
+{
+    while (true)
+    {
+        CConnectAttempt attempt;
+        {
+            boost::unique_lock<boost::mutex> lock(mutexConnectAttempts);
+            while (dequeConnectAttempts.empty())
+                condConnectAttempts.wait(lock);
+            attempt = dequeConnectAttempts.front();
+            dequeConnectAttempts.pop_front();
+        }
+
+        // The slot is released here if the connection fails
+        OpenNetworkConnection(attempt.addr, attempt.grant.get(), NULL, false, attempt.fBlockRelayOnly);
+        attempt.grant.reset();
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutexConnectAttempts);
+            mapGroupsConnecting.erase(attempt.addr.GetGroup());
+        }
     }
 }
 
@@ -1548,7 +2180,7 @@ void CConnman::ThreadOpenAddedConnections()
 }
 
 // if successful, this moves the passed grant to the constructed node
-bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOutbound, const char *pszDest, bool fOneShot)
+bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOutbound, const char *pszDest, bool fOneShot, bool fBlockRelayOnly)
 {
     //
     // Initiate outbound network connection
@@ -1562,7 +2194,7 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
     } else if (FindNode(std::string(pszDest)))
         return false;
 
-    CNode* pnode = ConnectNode(addrConnect, pszDest);
+    CNode* pnode = ConnectNode(addrConnect, pszDest, fBlockRelayOnly);
     boost::this_thread::interruption_point();
 
     if (!pnode)
@@ -1577,7 +2209,7 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 }
 
 
-void CConnman::ThreadMessageHandler()
+void CConnman::ThreadMessageHandler(int nThread, int nThreads)
 {
     boost::mutex condition_mutex;
     boost::unique_lock<boost::mutex> lock(condition_mutex);
@@ -1585,12 +2217,16 @@ void CConnman::ThreadMessageHandler()
     SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
     while (true)
     {
+        // Each thread handles the peers whose id falls in its shard, so the
+        // messages of a peer are still handled one at a time and in order
         vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy) {
+            BOOST_FOREACH(CNode* pnode, vNodes) {
+                if (pnode->GetId() % nThreads != nThread)
+                    continue;
                 pnode->AddRef();
+                vNodesCopy.push_back(pnode);
             }
         }
 
@@ -1801,6 +2437,10 @@ void static Discover(boost::thread_group& threadGroup)
 
 CConnman::CConnman()
 {
+#ifdef USE_EPOLL
+    hEpoll = -1;
+    fRecvBacklog = false;
+#endif
 }
 
 bool StartNode(CConnman& connman, boost::thread_group& threadGroup, CScheduler& scheduler, std::string& strNodeError)
@@ -1830,10 +2470,11 @@ bool StartNode(CConnman& connman, boost::thread_group& threadGroup, CScheduler&
 
     Discover(threadGroup);
 
+    mempool.NotifyEntryRemoved.connect(boost::bind(&CRelayCache::RemovedFromMempool, &relayCache, _1));
     bool ret = connman.Start(threadGroup, strNodeError);
 
     // Dump network addresses
-    scheduler.scheduleEvery(DumpData, DUMP_ADDRESSES_INTERVAL);
+    scheduler.scheduleEvery(DumpData, DUMP_ADDRESSES_INTERVAL, "dumpdata");
     return ret;
 }
 
@@ -1841,13 +2482,33 @@ bool CConnman::Start(boost::thread_group& threadGroup, std::string& strNodeError
 {
     if (semOutbound == NULL) {
         // initialize semaphore
-        int nMaxOutbound = min(MAX_OUTBOUND_CONNECTIONS, nMaxConnections);
+        int nMaxOutbound = min(MAX_OUTBOUND_CONNECTIONS + MAX_BLOCK_RELAY_ONLY_CONNECTIONS, nMaxConnections);
         semOutbound = new CSemaphore(nMaxOutbound);
     }
 
     if (pnodeLocalHost == NULL)
         pnodeLocalHost = new CNode(INVALID_SOCKET, CAddress(CService("127.0.0.1", 0), nLocalServices));
 
+#ifdef USE_EPOLL
+    if (hEpoll == -1) {
+        hEpoll = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpoll == -1) {
+            strNodeError = strprintf("epoll_create1 failed: %s", NetworkErrorString(WSAGetLastError()));
+            return false;
+        }
+        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+            // Listening sockets are level triggered, so one accept per wakeup is enough
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.u64 = LISTEN_SOCKET_EVENT;
+            if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0) {
+                strNodeError = strprintf("epoll_ctl for listening socket failed: %s", NetworkErrorString(WSAGetLastError()));
+                return false;
+            }
+        }
+    }
+#endif
+
     //
     // Start threads
     //
@@ -1866,8 +2527,14 @@ bool CConnman::Start(boost::thread_group& threadGroup, std::string& strNodeError
     // Initiate outbound connections
     threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "opencon", boost::function<void()>(boost::bind(&CConnman::ThreadOpenConnections, this))));
 
+    // Connect those it queues, as many at a time as there are outbound slots
+    for (int i = 0; i < MAX_OUTBOUND_CONNECTIONS + MAX_BLOCK_RELAY_ONLY_CONNECTIONS; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "connect", boost::function<void()>(boost::bind(&CConnman::ThreadConnectAttempts, this))));
+
     // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msghand", boost::function<void()>(boost::bind(&CConnman::ThreadMessageHandler, this))));
+    int nMessageHandlerThreads = std::max(1, std::min((int)GetArg("-msghandlerthreads", DEFAULT_MESSAGE_HANDLER_THREADS), MAX_MESSAGE_HANDLER_THREADS));
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msghand", boost::function<void()>(boost::bind(&CConnman::ThreadMessageHandler, this, i, nMessageHandlerThreads))));
 
     return true;
 }
@@ -1883,6 +2550,7 @@ bool StopNode(CConnman& connman)
     }
 
     connman.Stop();
+    mempool.NotifyEntryRemoved.disconnect(boost::bind(&CRelayCache::RemovedFromMempool, &relayCache, _1));
     return true;
 }
 
@@ -1904,7 +2572,7 @@ instance_of_cnetcleanup;
 void CConnman::Stop()
 {
     if (semOutbound)
-        for (int i=0; i<(MAX_OUTBOUND_CONNECTIONS + MAX_FEELER_CONNECTIONS); i++)
+        for (int i=0; i<(MAX_OUTBOUND_CONNECTIONS + MAX_BLOCK_RELAY_ONLY_CONNECTIONS + MAX_FEELER_CONNECTIONS); i++)
             semOutbound->post();
 
     // Close sockets
@@ -1924,6 +2592,20 @@ void CConnman::Stop()
     vNodes.clear();
     vNodesDisconnected.clear();
     vhListenSocket.clear();
+#ifdef USE_EPOLL
+    mapEventNodes.clear();
+    vEventNodesQueued.clear();
+    if (hEpoll != -1) {
+        close(hEpoll);
+        hEpoll = -1;
+    }
+#endif
+    {
+        // Release the slots of the attempts still queued
+        boost::unique_lock<boost::mutex> lock(mutexConnectAttempts);
+        dequeConnectAttempts.clear();
+        mapGroupsConnecting.clear();
+    }
     delete semOutbound;
     semOutbound = NULL;
     delete pnodeLocalHost;
@@ -1935,38 +2617,30 @@ CConnman::~CConnman()
 }
 
 void RelayTransaction(const CTransaction& tx)
-{
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss.reserve(10000);
-    ss << tx;
-    RelayTransaction(tx, ss);
-}
-
-void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
 {
     CInv inv(MSG_TX, tx.GetHash());
+    Trace(TRACE_TX_RELAYED, inv.hash);
     {
-        LOCK(cs_mapRelay);
-        // Expire old relay messages
-        while (!vRelayExpiration.empty() && vRelayExpiration.front().first < GetTime())
-        {
-            mapRelay.erase(vRelayExpiration.front().second);
-            vRelayExpiration.pop_front();
-        }
-
-        // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
-        vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
-    }
+        // Share the mempool's copy where there is one
+        CTransactionRef ptx = mempool.get(inv.hash);
+        bool fInMempool = ptx != NULL;
+        if (!fInMempool)
+            ptx = MakeTransactionRef(tx);
+        relayCache.Add(ptx, fInMempool);
+    }
+    // Parsed for the first peer with a filter, and shared by the rest
+    std::unique_ptr<CBloomTxElements> elements;
     LOCK(cs_vNodes);
     BOOST_FOREACH(CNode* pnode, vNodes)
     {
-        if(!pnode->fRelayTxes)
+        if(!pnode->fRelayTxes || pnode->fBlockRelayOnly)
             continue;
         LOCK(pnode->cs_filter);
         if (pnode->pfilter)
         {
-            if (pnode->pfilter->IsRelevantAndUpdate(tx))
+            if (!elements)
+                elements.reset(new CBloomTxElements(tx));
+            if (pnode->pfilter->IsRelevantAndUpdate(*elements))
                 pnode->PushInventory(inv);
         } else
             pnode->PushInventory(inv);
@@ -2035,7 +2709,7 @@ void CNode::Fuzz(int nChance)
 unsigned int ReceiveFloodSize() { return 1000*GetArg("-maxreceivebuffer", 5*1000); }
 unsigned int SendBufferSize() { return 1000*GetArg("-maxsendbuffer", 1*1000); }
 
-CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNameIn, bool fInboundIn) :
+CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNameIn, bool fInboundIn, bool fBlockRelayOnlyIn) :
     ssSend(SER_NETWORK, INIT_PROTO_VERSION),
     addrKnown(5000, 0.001),
     setInventoryKnown(SendBufferSize() / 1000)
@@ -2055,14 +2729,24 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     strSubVer = "";
     fWhitelisted = false;
     fOneShot = false;
+    fBlockRelayOnly = fBlockRelayOnlyIn;
     fClient = false; // set by version message
     fInbound = fInboundIn;
     fNetworkNode = false;
     fSuccessfullyConnected = false;
     fDisconnect = false;
     nRefCount = 0;
+    fEventsRegistered = false;
+    fEventsQueued = false;
+    fRecvReady = false;
+    fSendReady = false;
     nSendSize = 0;
     nSendOffset = 0;
+    nSendClass = SEND_CLASS_BLOCK;
+    for (int nClass = 0; nClass < SEND_CLASS_COUNT; nClass++) {
+        nSendSizeByClass[nClass] = 0;
+        nSendPassedByClass[nClass] = 0;
+    }
     hashContinue = uint256();
     nStartingHeight = -1;
     fGetAddr = false;
@@ -2070,10 +2754,15 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     fSentAddr = false;
     pfilter = new CBloomFilter();
     nPingNonceSent = 0;
+    nNextInvSend = 0;
     nPingUsecStart = 0;
     nPingUsecTime = 0;
     fPingQueued = false;
     nMinPingUsecTime = std::numeric_limits<int64_t>::max();
+    nLastBlockTime = 0;
+    nLastTxTime = 0;
+    nBlocksFirst = 0;
+    nTxsFirst = 0;
 
     {
         LOCK(cs_nLastNodeId);
@@ -2136,11 +2825,12 @@ void CNode::AskFor(const CInv& inv)
     mapAskFor.insert(std::make_pair(nRequestTime, inv));
 }
 
-void CNode::BeginMessage(const char* pszCommand) EXCLUSIVE_LOCK_FUNCTION(cs_vSend)
+void CNode::BeginMessage(const char* pszCommand, size_t nPayloadSize) EXCLUSIVE_LOCK_FUNCTION(cs_vSend)
 {
     ENTER_CRITICAL_SECTION(cs_vSend);
     assert(ssSend.size() == 0);
-    ssSend << CMessageHeader(Params().MessageStart(), pszCommand, 0);
+    ssSend.reserve(CMessageHeader::HEADER_SIZE + nPayloadSize);
+    WriteMessageHeader(ssSend, pszCommand);
     LogPrint("net", "sending: %s ", SanitizeString(pszCommand));
 }
 
@@ -2172,28 +2862,89 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
         LEAVE_CRITICAL_SECTION(cs_vSend);
         return;
     }
+    LogPrint("net", "(%d bytes) peer=%d\n", ssSend.size() - CMessageHeader::HEADER_SIZE, id);
+
+    const char* pszCommand = &ssSend[MESSAGE_START_SIZE];
+    std::string strCommand(pszCommand, strnlen(pszCommand, CMessageHeader::COMMAND_SIZE));
+    NetMessageMetrics& metrics = GetNetMessageMetrics(strCommand);
+    metrics.sent.increment();
+    metrics.sentBytes.value += ssSend.size();
+    {
+        LOCK(cs_msgStats);
+        CNodeMsgStats& stats = GetMsgCmdStats(mapMsgStats, strCommand);
+        stats.nSendMsgs++;
+        stats.nSendBytes += ssSend.size();
+    }
+
+    QueueMessage(FinishMessage(ssSend), GetSendClass(strCommand));
+
+    LEAVE_CRITICAL_SECTION(cs_vSend);
+}
+
+void CNode::WriteMessageHeader(CPlainDataStream& ss, const char* pszCommand)
+{
+    ss << CMessageHeader(Params().MessageStart(), pszCommand, 0);
+}
+
+CMessageBuffer CNode::FinishMessage(CPlainDataStream& ss)
+{
     // Set the size
-    unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
-    WriteLE32((uint8_t*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
+    unsigned int nSize = ss.size() - CMessageHeader::HEADER_SIZE;
+    WriteLE32((uint8_t*)&ss[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
 
     // Set the checksum
-    uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
+    uint256 hash = Hash(ss.begin() + CMessageHeader::HEADER_SIZE, ss.end());
     unsigned int nChecksum = 0;
     memcpy(&nChecksum, &hash, sizeof(nChecksum));
-    assert(ssSend.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
-    memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+    assert(ss.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
+    memcpy((char*)&ss[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+
+    // The message takes the stream's buffer rather than a copy of it; the
+    // next message reserves its own at full size
+    std::shared_ptr<std::vector<char> > msg(new std::vector<char>());
+    ss.swap(*msg);
+    return msg;
+}
+
+void CNode::PushMessageBuffer(const CMessageBuffer& msg)
+{
+    assert(msg->size() >= CMessageHeader::HEADER_SIZE);
+    const char* pszCommand = msg->data() + MESSAGE_START_SIZE;
+    PushMessageBuffer(msg, GetSendClass(std::string(pszCommand, strnlen(pszCommand, CMessageHeader::COMMAND_SIZE))));
+}
+
+void CNode::PushMessageBuffer(const CMessageBuffer& msg, SendClass sendClass)
+{
+    assert(msg->size() >= CMessageHeader::HEADER_SIZE);
+    if (mapArgs.count("-dropmessagestest") && GetRand(GetArg("-dropmessagestest", 2)) == 0)
+    {
+        LogPrint("net", "dropmessages DROPPING SEND MESSAGE\n");
+        return;
+    }
+
+    LOCK(cs_vSend);
+    std::string strCommand(msg->data() + MESSAGE_START_SIZE, CMessageHeader::COMMAND_SIZE);
+    LogPrint("net", "sending: %s (%d bytes, shared) peer=%d\n", SanitizeString(strCommand),
+             msg->size() - CMessageHeader::HEADER_SIZE, id);
 
-    LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
+    QueueMessage(msg, sendClass);
+}
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
-    nSendSize += (*it).size();
+void CNode::QueueMessage(const CMessageBuffer& msg, SendClass sendClass)
+{
+    bool fWasEmpty = (nSendSize == 0);
+    vSendMsg[sendClass].push_back(msg);
+    nSendSize += msg->size();
+    nSendSizeByClass[sendClass] += msg->size();
 
     // If write queue empty, attempt "optimistic write"
-    if (it == vSendMsg.begin())
+    if (fWasEmpty)
         SocketSendData(this);
+}
 
-    LEAVE_CRITICAL_SECTION(cs_vSend);
+int64_t PoissonNextSend(int64_t nNow, int nAverageIntervalSeconds)
+{
+    return nNow + (int64_t)(log1p(GetRand(1ULL << 48) * -0.0000000000000035527136788 /* -1/2^48 */) * nAverageIntervalSeconds * -1000000.0 + 0.5);
 }
 
 void DumpBanlist()
@@ -16,14 +16,18 @@
 #include "netbase.h"
 #include "protocol.h"
 #include "random.h"
+#include "relaycache.h"
 #include "streams.h"
 #include "sync.h"
 #include "uint256.h"
 #include "utilstrencodings.h"
 
+#include <atomic>
 #include <deque>
+#include <map>
 #include <stdint.h>
 #include <memory>
+#include <vector>
 
 #ifndef WIN32
 #include <arpa/inet.h>
@@ -32,6 +36,7 @@
 #include <boost/filesystem/path.hpp>
 #include <boost/foreach.hpp>
 #include <boost/signals2/signal.hpp>
+#include <boost/thread/shared_mutex.hpp>
 
 class CAddrMan;
 class CBlockIndex;
@@ -42,6 +47,33 @@ namespace boost {
     class thread_group;
 } // namespace boost
 
+/**
+ * A complete serialized message, header included. It is never changed once
+ * built, so one copy can sit in the send queues of any number of peers.
+ */
+typedef std::shared_ptr<const std::vector<char> > CMessageBuffer;
+
+/**
+ * Classes of outgoing messages. A peer's queued messages are sent class by
+ * class in this order, so a new block doesn't wait behind megabytes of
+ * transactions or old blocks, except that a class which has waited while
+ * MAX_SEND_PASSED_BYTES of others went past it gets to send one message.
+ */
+enum SendClass
+{
+    //! Blocks, headers and compact blocks near the tip, and control messages
+    SEND_CLASS_BLOCK,
+    //! Transaction relay
+    SEND_CLASS_TX,
+    //! Addresses, and historical blocks a peer downloads from us
+    SEND_CLASS_BULK,
+    SEND_CLASS_COUNT
+};
+
+//! The class of a message, from its command, unless the sender knows better
+SendClass GetSendClass(const std::string& strCommand);
+const char* GetSendClassName(SendClass sendClass);
+
 /** Time between pings automatically sent out for latency probing and keepalive (in seconds). */
 static const int PING_INTERVAL = 2 * 60;
 /** Time after which to disconnect, after waiting for a ping response (or inactivity). */
@@ -52,6 +84,8 @@ static const unsigned int MAX_INV_SZ = 50000;
 static const unsigned int MAX_ADDR_TO_SEND = 1000;
 /** Maximum length of incoming protocol messages (no message over 2 MiB is currently acceptable). */
 static const unsigned int MAX_PROTOCOL_MESSAGE_LENGTH = 2 * 1024 * 1024;
+/** Bytes of the other classes sent past a waiting class of messages before it gets a turn */
+static const size_t MAX_SEND_PASSED_BYTES = 1000 * 1000;
 /** Maximum length of strSubVer in `version` message */
 static const unsigned int MAX_SUBVERSION_LENGTH = 256;
 /** -server default */
@@ -62,6 +96,10 @@ static const bool DEFAULT_LISTEN = true;
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 /** The maximum number of entries in setAskFor (larger due to getdata latency)*/
 static const size_t SETASKFOR_MAX_SZ = 2 * MAX_INV_SZ;
+/** -msghandlerthreads default */
+static const int DEFAULT_MESSAGE_HANDLER_THREADS = 2;
+/** The maximum number of message handler threads */
+static const int MAX_MESSAGE_HANDLER_THREADS = 16;
 /** The maximum number of peer connections to maintain. */
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
 /** The period before a network upgrade activates, where connections to upgrading peers are preferred (in blocks). */
@@ -76,8 +114,10 @@ CNode* FindNode(const CNetAddr& ip);
 CNode* FindNode(const CSubNet& subNet);
 CNode* FindNode(const std::string& addrName);
 CNode* FindNode(const CService& ip);
-CNode* ConnectNode(CAddress addrConnect, const char *pszDest = NULL);
-bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOutbound = NULL, const char *strDest = NULL, bool fOneShot = false);
+CNode* ConnectNode(CAddress addrConnect, const char *pszDest = NULL, bool fBlockRelayOnly = false);
+bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOutbound = NULL, const char *strDest = NULL, bool fOneShot = false, bool fBlockRelayOnly = false);
+
+typedef int NodeId;
 
 struct ListenSocket {
     SOCKET socket;
@@ -97,10 +137,30 @@ private:
     void ThreadOpenAddedConnections();
     void ProcessOneShot();
     void ThreadOpenConnections();
-    void ThreadMessageHandler();
+    //! Make the outbound connections ThreadOpenConnections queues
+    void ThreadConnectAttempts();
+    void ThreadMessageHandler(int nThread, int nThreads);
     void AcceptConnection(const ListenSocket& hListenSocket);
+    void DisconnectNodes();
     void ThreadSocketHandler();
+#ifdef USE_EPOLL
+    void RegisterSocketEvents();
+    void QueueSocketEvents(CNode* pnode);
+    void ServiceSocketEvents();
+#else
+    void ServiceSocketsSelect();
+#endif
     void ThreadDNSAddressSeed();
+
+#ifdef USE_EPOLL
+    int hEpoll;
+    //! Nodes registered with hEpoll, by id
+    std::map<NodeId, CNode*> mapEventNodes;
+    //! Nodes with readiness left to act on
+    std::vector<CNode*> vEventNodesQueued;
+    //! Set when a socket was left readable only to be fair to the others
+    bool fRecvBacklog;
+#endif
 };
 extern std::unique_ptr<CConnman> g_connman;
 unsigned short GetListenPort();
@@ -108,8 +168,9 @@ bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhite
 bool StartNode(CConnman& connman, boost::thread_group& threadGroup, CScheduler& scheduler, std::string& strNodeError);
 bool StopNode(CConnman& connman);
 void SocketSendData(CNode *pnode);
+/** Return a time (in usec) after nNow, a random exponentially distributed delay averaging nAverageIntervalSeconds */
+int64_t PoissonNextSend(int64_t nNow, int nAverageIntervalSeconds);
 
-typedef int NodeId;
 
 struct CombinerAll
 {
@@ -177,9 +238,7 @@ extern int nMaxConnections;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
-extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
-extern CCriticalSection cs_mapRelay;
+extern CRelayCache relayCache;
 extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
 
 extern std::vector<std::string> vAddedNodes;
@@ -199,6 +258,38 @@ struct LocalServiceInfo {
 extern CCriticalSection cs_mapLocalHost;
 extern std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 
+/** Traffic and handling time of one message command on one connection */
+struct CNodeMsgStats
+{
+    uint64_t nSendMsgs;
+    uint64_t nSendBytes;
+    uint64_t nRecvMsgs;
+    uint64_t nRecvBytes;
+    int64_t nProcessMicros;
+    int64_t nMaxProcessMicros;
+
+    CNodeMsgStats() : nSendMsgs(0), nSendBytes(0), nRecvMsgs(0), nRecvBytes(0), nProcessMicros(0), nMaxProcessMicros(0) {}
+};
+
+typedef std::map<std::string, CNodeMsgStats> mapMsgCmdStats;
+
+/** Approximate heap held for the connected peers, for getmemoryinfo */
+struct CPeerMemoryUsage
+{
+    size_t nPeers;
+    size_t nSendBuffers;    //!< outgoing messages not yet sent
+    size_t nRecvBuffers;    //!< messages received but not yet processed, and pooled receive buffers
+    size_t nQueues;         //!< inventory, address and getdata queues, and the inventory known to the peer
+
+    CPeerMemoryUsage() : nPeers(0), nSendBuffers(0), nRecvBuffers(0), nQueues(0) {}
+};
+
+/**
+ * Add up the buffers of all peers. Buffers that are in use by the network
+ * threads at that moment are left out rather than waited for.
+ */
+CPeerMemoryUsage GetPeerMemoryUsage();
+
 class CNodeStats
 {
 public:
@@ -219,12 +310,59 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    mapMsgCmdStats mapMsgStats;
+    //! Bytes waiting in the send queue of each class
+    size_t nSendQueued[SEND_CLASS_COUNT];
+    bool fBlockRelayOnly;
+    int64_t nLastBlockTime;
+    int64_t nLastTxTime;
+    uint64_t nBlocksFirst;
+    uint64_t nTxsFirst;
 };
 
 
 
 
+/**
+ * Receive buffers of finished messages, kept to be reused for the next large
+ * ones. Buffers are sorted into size classes that double from
+ * MIN_BUFFER_SIZE, and only so many bytes are kept in total.
+ */
+class CRecvBufferPool
+{
+public:
+    static const size_t MIN_BUFFER_SIZE = 64 * 1024;
+    static const size_t MAX_POOLED_BYTES = 16 * 1024 * 1024;
+    static const size_t MAX_BUFFERS_PER_CLASS = 8;
+
+private:
+    CCriticalSection cs;
+    std::vector<std::vector<CSerializeData> > vFree;
+    size_t nPooledBytes;
+
+    static size_t SizeClass(size_t nSize);
+    bool TakeFree(CSerializeData& vch, size_t nClass);
+
+public:
+    CRecvBufferPool();
+
+    /**
+     * Put an empty buffer with room for at least nSize bytes into vch, which
+     * must hold no allocation. A pooled buffer of nSizeIfFree bytes is taken
+     * instead if one is free, but never allocated for.
+     */
+    void Take(CSerializeData& vch, size_t nSize, size_t nSizeIfFree);
+    //! Keep the allocation of vch for reuse, or free it if the pool is full
+    void Give(CSerializeData& vch);
+
+    size_t PooledBytes();
+};
+
 class CNetMessage {
+private:
+    CHash256 hasher;                // hash of the data received so far
+    uint256 data_hash;
+
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
@@ -260,6 +398,11 @@ public:
 
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
+
+    //! The double SHA-256 of the complete data, hashed as it arrived
+    const uint256& GetMessageHash();
+    //! Hand the data buffer back to the receive buffer pool once processed
+    void ReleaseBuffer();
 };
 
 
@@ -273,11 +416,17 @@ public:
     // socket
     uint64_t nServices;
     SOCKET hSocket;
-    CDataStream ssSend;
+    CPlainDataStream ssSend;
     size_t nSendSize; // total size of all vSendMsg entries
-    size_t nSendOffset; // offset inside the first vSendMsg already sent
+    size_t nSendOffset; // offset inside the first message of vSendMsg[nSendClass] already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    //! Queued messages, by SendClass
+    std::deque<CMessageBuffer> vSendMsg[SEND_CLASS_COUNT];
+    size_t nSendSizeByClass[SEND_CLASS_COUNT];
+    //! Bytes of other classes sent while each class waited, since it last sent a message
+    size_t nSendPassedByClass[SEND_CLASS_COUNT];
+    //! The class a message is being sent from, while nSendOffset > 0
+    int nSendClass;
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
@@ -301,6 +450,13 @@ public:
     std::string strSubVer, cleanSubVer;
     bool fWhitelisted; // This peer can bypass DoS banning.
     bool fOneShot;
+    /**
+     * An outbound connection of ours that only relays blocks: we ask for no
+     * transactions in our version message, and neither announce nor take
+     * transactions or addresses on it, so its traffic is small and blocks
+     * arrive on it fast. Set when the connection is made.
+     */
+    bool fBlockRelayOnly;
     bool fClient;
     bool fInbound;
     bool fNetworkNode;
@@ -317,6 +473,18 @@ public:
     CBloomFilter* pfilter;
     int nRefCount;
     NodeId id;
+
+    // Traffic by message command, written by the send and message handler threads
+    CCriticalSection cs_msgStats;
+    mapMsgCmdStats mapMsgStats;
+
+    // Socket readiness for the epoll socket thread, which alone uses these.
+    // Readiness is edge triggered, so it is remembered until a recv or send
+    // finds the socket drained or full.
+    bool fEventsRegistered;
+    bool fEventsQueued;
+    bool fRecvReady;
+    bool fSendReady;
 protected:
 
     // Denial-of-service detection/prevention
@@ -324,6 +492,13 @@ protected:
     static banmap_t setBanned;
     static CCriticalSection cs_setBanned;
     static bool setBannedIsDirty;
+    //! setBanned by address, for IsBanned(CNetAddr) to check connections
+    //! against without taking cs_setBanned; kept in step under both locks
+    static CSubNetIndex banIndex;
+    static boost::shared_mutex cs_banIndex;
+
+    //! Ban subNet until banEntry.nBanUntil unless it already is for longer; cs_setBanned held
+    static void BanLocked(const CSubNet &subNet, const CBanEntry &banEntry);
 
     // Whitelisted ranges. Any node connecting from these is automatically
     // whitelisted (as well as those connecting to whitelisted binds).
@@ -338,6 +513,8 @@ public:
     int nStartingHeight;
 
     // flood relay
+    // Addresses are pushed from the handler threads of other peers too
+    CCriticalSection cs_vAddrToSend;
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
     bool fGetAddr;
@@ -347,6 +524,8 @@ public:
     mruset<CInv> setInventoryKnown;
     std::vector<CInv> vInventoryToSend;
     CCriticalSection cs_inventory;
+    // Time (in usec) of the next transaction announcement batch
+    int64_t nNextInvSend;
     std::set<uint256> setAskFor;
     std::multimap<int64_t, CInv> mapAskFor;
 
@@ -362,7 +541,15 @@ public:
     // Whether a ping is requested.
     bool fPingQueued;
 
-    CNode(SOCKET hSocketIn, const CAddress &addrIn, const std::string &addrNameIn = "", bool fInboundIn = false);
+    // What the peer delivered to us first: when it last sent a block, or a
+    // transaction, we hadn't had before, and how many. Eviction protects the
+    // peers that do.
+    std::atomic<int64_t> nLastBlockTime;
+    std::atomic<int64_t> nLastTxTime;
+    std::atomic<uint64_t> nBlocksFirst;
+    std::atomic<uint64_t> nTxsFirst;
+
+    CNode(SOCKET hSocketIn, const CAddress &addrIn, const std::string &addrNameIn = "", bool fInboundIn = false, bool fBlockRelayOnlyIn = false);
     ~CNode();
 
 private:
@@ -422,14 +609,18 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(addr.GetKey());
     }
 
     void PushAddress(const CAddress& addr)
     {
+        if (fBlockRelayOnly)
+            return;
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_vAddrToSend);
         if (addr.IsValid() && !addrKnown.contains(addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
@@ -452,6 +643,8 @@ public:
     {
         {
             LOCK(cs_inventory);
+            if (fBlockRelayOnly && inv.type == MSG_TX)
+                return;
             if (!setInventoryKnown.count(inv))
                 vInventoryToSend.push_back(inv);
         }
@@ -460,7 +653,8 @@ public:
     void AskFor(const CInv& inv);
 
     // TODO: Document the postcondition of this function.  Is cs_vSend locked?
-    void BeginMessage(const char* pszCommand) EXCLUSIVE_LOCK_FUNCTION(cs_vSend);
+    //! nPayloadSize, if known, lets the message be allocated once at its full size
+    void BeginMessage(const char* pszCommand, size_t nPayloadSize = 0) EXCLUSIVE_LOCK_FUNCTION(cs_vSend);
 
     // TODO: Document the precondition of this function.  Is cs_vSend locked?
     void AbortMessage() UNLOCK_FUNCTION(cs_vSend);
@@ -470,6 +664,42 @@ public:
 
     void PushVersion();
 
+    /**
+     * Serialize a message once, to be queued to many peers with
+     * PushMessageBuffer. The payload is serialized at PROTOCOL_VERSION, so
+     * it must be something that serializes the same for every peer.
+     */
+    template<typename T1>
+    static CMessageBuffer MakeMessage(const char* pszCommand, const T1& a1)
+    {
+        CPlainDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss.reserve(CMessageHeader::HEADER_SIZE + ::GetSerializeSize(a1, SER_NETWORK, PROTOCOL_VERSION));
+        WriteMessageHeader(ss, pszCommand);
+        ss << a1;
+        return FinishMessage(ss);
+    }
+
+    //! Serialized size of a payload, measured without writing it
+    template<typename... Args>
+    size_t PayloadSize(const Args&... args) const
+    {
+        CSizeComputer s(ssSend.GetType(), ssSend.GetVersion());
+        ::SerializeMany(s, args...);
+        return s.size();
+    }
+
+    //! Start a message in the empty stream ss with a header for pszCommand
+    static void WriteMessageHeader(CPlainDataStream& ss, const char* pszCommand);
+    //! Fill in the size and checksum of the message in ss and take its buffer
+    static CMessageBuffer FinishMessage(CPlainDataStream& ss);
+
+    //! Queue a message built with MakeMessage, without copying it
+    void PushMessageBuffer(const CMessageBuffer& msg);
+    //! As PushMessageBuffer, in the send queue of sendClass
+    void PushMessageBuffer(const CMessageBuffer& msg, SendClass sendClass);
+    //! Append msg to the queue of sendClass, sending at once if nothing is queued (requires cs_vSend)
+    void QueueMessage(const CMessageBuffer& msg, SendClass sendClass);
+
 
     void PushMessage(const char* pszCommand)
     {
@@ -490,7 +720,7 @@ public:
     {
         try
         {
-            BeginMessage(pszCommand);
+            BeginMessage(pszCommand, PayloadSize(a1));
             ssSend << a1;
             EndMessage();
         }
@@ -506,7 +736,7 @@ public:
     {
         try
         {
-            BeginMessage(pszCommand);
+            BeginMessage(pszCommand, PayloadSize(a1, a2));
             ssSend << a1 << a2;
             EndMessage();
         }
@@ -522,7 +752,7 @@ public:
     {
         try
         {
-            BeginMessage(pszCommand);
+            BeginMessage(pszCommand, PayloadSize(a1, a2, a3));
             ssSend << a1 << a2 << a3;
             EndMessage();
         }
@@ -538,7 +768,7 @@ public:
     {
         try
         {
-            BeginMessage(pszCommand);
+            BeginMessage(pszCommand, PayloadSize(a1, a2, a3, a4));
             ssSend << a1 << a2 << a3 << a4;
             EndMessage();
         }
@@ -554,7 +784,7 @@ public:
     {
         try
         {
-            BeginMessage(pszCommand);
+            BeginMessage(pszCommand, PayloadSize(a1, a2, a3, a4, a5));
             ssSend << a1 << a2 << a3 << a4 << a5;
             EndMessage();
         }
@@ -570,7 +800,7 @@ public:
     {
         try
         {
-            BeginMessage(pszCommand);
+            BeginMessage(pszCommand, PayloadSize(a1, a2, a3, a4, a5, a6));
             ssSend << a1 << a2 << a3 << a4 << a5 << a6;
             EndMessage();
         }
@@ -586,7 +816,7 @@ public:
     {
         try
         {
-            BeginMessage(pszCommand);
+            BeginMessage(pszCommand, PayloadSize(a1, a2, a3, a4, a5, a6, a7));
             ssSend << a1 << a2 << a3 << a4 << a5 << a6 << a7;
             EndMessage();
         }
@@ -602,7 +832,7 @@ public:
     {
         try
         {
-            BeginMessage(pszCommand);
+            BeginMessage(pszCommand, PayloadSize(a1, a2, a3, a4, a5, a6, a7, a8));
             ssSend << a1 << a2 << a3 << a4 << a5 << a6 << a7 << a8;
             EndMessage();
         }
@@ -618,7 +848,7 @@ public:
     {
         try
         {
-            BeginMessage(pszCommand);
+            BeginMessage(pszCommand, PayloadSize(a1, a2, a3, a4, a5, a6, a7, a8, a9));
             ssSend << a1 << a2 << a3 << a4 << a5 << a6 << a7 << a8 << a9;
             EndMessage();
         }
@@ -650,6 +880,8 @@ public:
     static bool IsBanned(CSubNet subnet);
     static void Ban(const CNetAddr &ip, const BanReason &banReason, int64_t bantimeoffset = 0, bool sinceUnixEpoch = false);
     static void Ban(const CSubNet &subNet, const BanReason &banReason, int64_t bantimeoffset = 0, bool sinceUnixEpoch = false);
+    //! Ban many subnets at once, as imported from a block list
+    static void Ban(const std::vector<CSubNet> &vSubNet, const BanReason &banReason, int64_t bantimeoffset = 0, bool sinceUnixEpoch = false);
     static bool Unban(const CNetAddr &ip);
     static bool Unban(const CSubNet &ip);
     static void GetBanned(banmap_t &banmap);
@@ -664,6 +896,9 @@ public:
 
     void copyStats(CNodeStats &stats);
 
+    //! Account a message received and handled in nProcessMicros
+    void RecordMessageProcessed(const std::string& strCommand, uint64_t nBytes, int64_t nProcessMicros);
+
     static bool IsWhitelistedRange(const CNetAddr &ip);
     static void AddWhitelistedRange(const CSubNet &subnet);
 
@@ -679,7 +914,6 @@ public:
 
 class CTransaction;
 void RelayTransaction(const CTransaction& tx);
-void RelayTransaction(const CTransaction& tx, const CDataStream& ss);
 
 void DumpBanlist();
 
@@ -26,7 +26,12 @@
 #include <arpa/inet.h>
 #endif
 #include <fcntl.h>
+#ifdef USE_EPOLL
+#include <poll.h>
 #endif
+#endif
+
+#include <algorithm>
 
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
 #include <boost/algorithm/string/predicate.hpp> // for startswith() and endswith()
@@ -267,11 +272,16 @@ bool static InterruptibleRecv(char* data, size_t len, int timeout, SOCKET& hSock
                 if (!IsSelectableSocket(hSocket)) {
                     return false;
                 }
+#ifdef USE_EPOLL
+                struct pollfd pollfd = {hSocket, POLLIN, 0};
+                int nRet = poll(&pollfd, 1, std::min(endTime - curTime, maxWait));
+#else
                 struct timeval tval = MillisToTimeval(std::min(endTime - curTime, maxWait));
                 fd_set fdset;
                 FD_ZERO(&fdset);
                 FD_SET(hSocket, &fdset);
                 int nRet = select(hSocket + 1, &fdset, NULL, NULL, &tval);
+#endif
                 if (nRet == SOCKET_ERROR) {
                     return false;
                 }
@@ -465,11 +475,17 @@ bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRe
         // WSAEINVAL is here because some legacy version of winsock uses it
         if (nErr == WSAEINPROGRESS || nErr == WSAEWOULDBLOCK || nErr == WSAEINVAL)
         {
+#ifdef USE_EPOLL
+            // Sockets may be numbered beyond FD_SETSIZE
+            struct pollfd pollfd = {hSocket, POLLOUT, 0};
+            int nRet = poll(&pollfd, 1, nTimeout);
+#else
             struct timeval timeout = MillisToTimeval(nTimeout);
             fd_set fdset;
             FD_ZERO(&fdset);
             FD_SET(hSocket, &fdset);
             int nRet = select(hSocket + 1, NULL, &fdset, NULL, &timeout);
+#endif
             if (nRet == 0)
             {
                 LogPrint("net", "connection to %s timeout\n", addrConnect.ToString());
@@ -1001,6 +1017,11 @@ uint64_t CNetAddr::GetHash() const
     return nRet;
 }
 
+uint64_t CNetAddr::GetHash(uint64_t k0, uint64_t k1) const
+{
+    return CSipHasher(k0, k1).Write(ip, sizeof(ip)).Finalize();
+}
+
 // private extensions to enum Network, only returned by GetExtNetwork,
 // and only used in GetReachabilityFrom
 static const int NET_UNKNOWN = NET_MAX + 0;
@@ -1390,6 +1411,56 @@ bool operator<(const CSubNet& a, const CSubNet& b)
     return (a.network < b.network || (a.network == b.network && memcmp(a.netmask, b.netmask, 16) < 0));
 }
 
+void CSubNetIndex::clear()
+{
+    mapByNetmask.clear();
+    nSize = 0;
+}
+
+void CSubNetIndex::Set(const CSubNet& subNet, int64_t nTime)
+{
+    if (!subNet.valid)
+        return;
+    Bytes netmask, network;
+    std::copy(subNet.netmask, subNet.netmask + 16, netmask.begin());
+    std::copy(subNet.network.ip, subNet.network.ip + 16, network.begin());
+    std::map<Bytes, int64_t>& networks = mapByNetmask[netmask];
+    std::pair<std::map<Bytes, int64_t>::iterator, bool> ret = networks.insert(std::make_pair(network, nTime));
+    if (ret.second)
+        nSize++;
+    else
+        ret.first->second = nTime;
+}
+
+void CSubNetIndex::Erase(const CSubNet& subNet)
+{
+    Bytes netmask, network;
+    std::copy(subNet.netmask, subNet.netmask + 16, netmask.begin());
+    std::copy(subNet.network.ip, subNet.network.ip + 16, network.begin());
+    std::map<Bytes, std::map<Bytes, int64_t> >::iterator it = mapByNetmask.find(netmask);
+    if (it == mapByNetmask.end())
+        return;
+    if (it->second.erase(network))
+        nSize--;
+    if (it->second.empty())
+        mapByNetmask.erase(it);
+}
+
+bool CSubNetIndex::Match(const CNetAddr& addr, int64_t nTime) const
+{
+    if (!addr.IsValid())
+        return false;
+    Bytes network;
+    for (const std::pair<const Bytes, std::map<Bytes, int64_t> >& item : mapByNetmask) {
+        for (int x = 0; x < 16; ++x)
+            network[x] = addr.ip[x] & item.first[x];
+        std::map<Bytes, int64_t>::const_iterator it = item.second.find(network);
+        if (it != item.second.end() && nTime < it->second)
+            return true;
+    }
+    return false;
+}
+
 #ifdef WIN32
 std::string NetworkErrorString(int err)
 {
@@ -13,6 +13,8 @@
 #include "compat.h"
 #include "serialize.h"
 
+#include <array>
+#include <map>
 #include <stdint.h>
 #include <string>
 #include <vector>
@@ -84,6 +86,8 @@ class CNetAddr
         std::string ToStringIP() const;
         unsigned int GetByte(int n) const;
         uint64_t GetHash() const;
+        //! SipHash-2-4 of the address bytes with the given key, for salted hash tables
+        uint64_t GetHash(uint64_t k0, uint64_t k1) const;
         bool GetInAddr(struct in_addr* pipv4Addr) const;
         std::vector<unsigned char> GetGroup() const;
         int GetReachabilityFrom(const CNetAddr *paddrPartner = NULL) const;
@@ -103,6 +107,7 @@ class CNetAddr
         }
 
         friend class CSubNet;
+        friend class CSubNetIndex;
 };
 
 class CSubNet
@@ -139,6 +144,35 @@ class CSubNet
             READWRITE(FLATDATA(netmask));
             READWRITE(FLATDATA(valid));
         }
+
+        friend class CSubNetIndex;
+};
+
+/**
+ * Subnets with a time each, looked up by the addresses in them. The
+ * subnets are grouped by netmask, so that an address is looked up once
+ * for each of the netmasks, of which an index of CIDR subnets has at most
+ * 129, rather than matched against every subnet.
+ */
+class CSubNetIndex
+{
+private:
+    typedef std::array<unsigned char, 16> Bytes;
+    //! For each netmask, the networks under it and their times
+    std::map<Bytes, std::map<Bytes, int64_t> > mapByNetmask;
+    size_t nSize;
+
+public:
+    CSubNetIndex() : nSize(0) {}
+
+    void clear();
+    size_t size() const { return nSize; }
+
+    /** Set the time of subNet, adding it if it is not there */
+    void Set(const CSubNet& subNet, int64_t nTime);
+    void Erase(const CSubNet& subNet);
+    /** Whether addr is in a subnet with a time after nTime */
+    bool Match(const CNetAddr& addr, int64_t nTime) const;
 };
 
 /** A combination of a network address (CNetAddr) and a (TCP) port */
@@ -0,0 +1,410 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "notifysink.h"
+
+#include "compat.h"
+#include "tinyformat.h"
+#include "util.h"
+#include "utilstrencodings.h"
+
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+/** Milliseconds a write waits for the sink to take more before checking for shutdown */
+static const int NOTIFY_SINK_POLL_MS = 1000;
+
+bool ParseNotifySink(const std::string& strSpec, NotifySinkType& type, std::string& strTarget, std::string& strError)
+{
+    size_t nColon = strSpec.find(':');
+    std::string strScheme = strSpec.substr(0, nColon);
+    strTarget = nColon == std::string::npos ? "" : strSpec.substr(nColon + 1);
+    if (strScheme == "exec") {
+        type = NOTIFY_SINK_EXEC;
+    } else if (strScheme == "pipe") {
+        type = NOTIFY_SINK_PIPE;
+    } else if (strScheme == "unix") {
+        type = NOTIFY_SINK_UNIX;
+    } else {
+        strError = strprintf("'%s' is not pipe:<path>, unix:<path> or exec:<cmd>", strSpec);
+        return false;
+    }
+    if (strTarget.empty()) {
+        strError = strprintf("nothing given after %s:", strScheme);
+        return false;
+    }
+#ifdef WIN32
+    if (type != NOTIFY_SINK_EXEC) {
+        strError = strprintf("%s: sinks are not available on this platform", strScheme);
+        return false;
+    }
+#else
+    if (type == NOTIFY_SINK_UNIX && strTarget.size() >= sizeof(((struct sockaddr_un*)NULL)->sun_path)) {
+        strError = strprintf("socket path %s is too long", strTarget);
+        return false;
+    }
+#endif
+    return true;
+}
+
+void CNotifyQueue::Push(const std::string& strKind, const std::string& strArg)
+{
+    std::string strLine = strKind + " " + strArg + "\n";
+    if (strKind == "blocktip") {
+        // Only the latest tip is of interest
+        std::string strPrefix = strKind + " ";
+        for (std::deque<std::string>::iterator it = queue.begin(); it != queue.end(); ++it) {
+            if (it->compare(0, strPrefix.size(), strPrefix) == 0) {
+                queue.erase(it);
+                break;
+            }
+        }
+    } else if (std::find(queue.begin(), queue.end(), strLine) != queue.end()) {
+        return;
+    }
+    while (queue.size() >= nMaxSize) {
+        queue.pop_front();
+        nDropped++;
+    }
+    queue.push_back(strLine);
+}
+
+std::string CNotifyQueue::TakeAll()
+{
+    std::string strLines;
+    for (const std::string& strLine : queue)
+        strLines += strLine;
+    queue.clear();
+    return strLines;
+}
+
+void CNotifyQueue::PushFront(const std::string& strLines)
+{
+    std::deque<std::string> lines;
+    size_t nStart = 0;
+    while (nStart < strLines.size()) {
+        size_t nEnd = strLines.find('\n', nStart);
+        if (nEnd == std::string::npos)
+            nEnd = strLines.size() - 1;
+        lines.push_back(strLines.substr(nStart, nEnd + 1 - nStart));
+        nStart = nEnd + 1;
+    }
+    // What came in meanwhile is newer, so the old lines go if there is no room
+    for (std::deque<std::string>::reverse_iterator it = lines.rbegin(); it != lines.rend(); ++it) {
+        bool fTip = it->compare(0, 9, "blocktip ") == 0;
+        bool fNewer = false;
+        for (const std::string& strQueued : queue) {
+            if (fTip ? strQueued.compare(0, 9, "blocktip ") == 0 : strQueued == *it) {
+                fNewer = true;
+                break;
+            }
+        }
+        if (fNewer)
+            continue;
+        if (queue.size() < nMaxSize)
+            queue.push_front(*it);
+        else
+            nDropped++;
+    }
+}
+
+size_t CNotifyQueue::TakeDropped()
+{
+    size_t n = nDropped;
+    nDropped = 0;
+    return n;
+}
+
+namespace {
+
+/** The sink as opened, written from the notifier thread only */
+class CNotifySinkOutput
+{
+private:
+    NotifySinkType type;
+    std::string strTarget;
+    FILE* file;
+#ifndef WIN32
+    int fd;
+#endif
+
+public:
+    CNotifySinkOutput() : type(NOTIFY_SINK_EXEC), file(NULL)
+#ifndef WIN32
+        , fd(-1)
+#endif
+    {}
+    ~CNotifySinkOutput() { Close(); }
+
+    void Init(NotifySinkType typeIn, const std::string& strTargetIn)
+    {
+        type = typeIn;
+        strTarget = strTargetIn;
+    }
+
+    bool IsOpen() const
+    {
+#ifdef WIN32
+        return file != NULL;
+#else
+        return fd != -1;
+#endif
+    }
+
+    bool Open(std::string& strError);
+    /** Write all of strData, giving up if the sink stops taking it while fStop is set */
+    bool Write(const std::string& strData, const std::atomic<bool>& fStop, std::string& strError);
+    void Close();
+};
+
+bool CNotifySinkOutput::Open(std::string& strError)
+{
+    assert(!IsOpen());
+    if (type == NOTIFY_SINK_EXEC) {
+#ifdef WIN32
+        file = _popen(strTarget.c_str(), "w");
+#else
+        file = popen(strTarget.c_str(), "w");
+#endif
+        if (!file) {
+            strError = strprintf("can't run %s: %s", strTarget, strerror(errno));
+            return false;
+        }
+#ifndef WIN32
+        fd = fileno(file);
+#endif
+    }
+#ifndef WIN32
+    else if (type == NOTIFY_SINK_PIPE) {
+        // Without O_NONBLOCK, opening a FIFO waits for a reader
+        fd = open(strTarget.c_str(), O_WRONLY | O_APPEND | O_NONBLOCK | O_CREAT, 0600);
+        if (fd == -1) {
+            strError = strprintf("can't open %s: %s", strTarget, strerror(errno));
+            return false;
+        }
+    } else {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1) {
+            strError = strprintf("can't create socket: %s", strerror(errno));
+            return false;
+        }
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, strTarget.c_str(), sizeof(addr.sun_path) - 1);
+        if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            strError = strprintf("can't connect to %s: %s", strTarget, strerror(errno));
+            close(fd);
+            fd = -1;
+            return false;
+        }
+    }
+    // Writes wait in poll, so that shutdown is not held up by a sink that stopped reading
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#endif
+    return true;
+}
+
+bool CNotifySinkOutput::Write(const std::string& strData, const std::atomic<bool>& fStop, std::string& strError)
+{
+#ifdef WIN32
+    if (fwrite(strData.data(), 1, strData.size(), file) != strData.size() || fflush(file) != 0) {
+        strError = strprintf("can't write to %s", strTarget);
+        return false;
+    }
+    return true;
+#else
+    size_t nWritten = 0;
+    while (nWritten < strData.size()) {
+        ssize_t n;
+        if (type == NOTIFY_SINK_UNIX)
+            n = send(fd, strData.data() + nWritten, strData.size() - nWritten, MSG_NOSIGNAL);
+        else
+            n = write(fd, strData.data() + nWritten, strData.size() - nWritten);
+        if (n >= 0) {
+            nWritten += n;
+            continue;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            strError = strprintf("can't write to %s: %s", strTarget, strerror(errno));
+            return false;
+        }
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, NOTIFY_SINK_POLL_MS) == 0 && fStop) {
+            strError = "shutting down";
+            return false;
+        }
+    }
+    return true;
+#endif
+}
+
+void CNotifySinkOutput::Close()
+{
+    if (file) {
+        // Waits for the command to see the end of its input and exit
+#ifdef WIN32
+        _pclose(file);
+#else
+        pclose(file);
+#endif
+        file = NULL;
+    }
+#ifndef WIN32
+    else if (fd != -1) {
+        close(fd);
+    }
+    fd = -1;
+#endif
+}
+
+} // anon namespace
+
+static boost::thread notifySinkThread;
+static boost::mutex csNotifySink;
+//! Signalled when there are lines to write, and on shutdown
+static boost::condition_variable condNotifySinkQueue;
+//! Signalled when the queue has room, whether the sink is open changes, and on shutdown
+static boost::condition_variable condNotifySinkRoom;
+static CNotifyQueue queueNotifySink;
+static bool fNotifySinkRunning = false;
+static bool fNotifySinkOpen = false;
+//! Also read by the writes of the notifier thread, without the lock
+static std::atomic<bool> fNotifySinkStop(false);
+static CNotifySinkOutput notifySinkOutput;
+
+static void ThreadNotifySink()
+{
+    std::string strLastError;
+    while (true) {
+        std::string strLines;
+        size_t nDropped;
+        bool fStop;
+        {
+            boost::unique_lock<boost::mutex> lock(csNotifySink);
+            while (queueNotifySink.empty() && !fNotifySinkStop)
+                condNotifySinkQueue.wait(lock);
+            fStop = fNotifySinkStop;
+            strLines = queueNotifySink.TakeAll();
+            nDropped = queueNotifySink.TakeDropped();
+        }
+        condNotifySinkRoom.notify_all();
+        if (nDropped)
+            LogPrintf("notifysink: %u events dropped, as the sink was not there\n", nDropped);
+        if (strLines.empty())
+            return;
+
+        std::string strError;
+        bool fOpen = notifySinkOutput.IsOpen() || notifySinkOutput.Open(strError);
+        if (fOpen) {
+            if (!strLastError.empty())
+                LogPrintf("notifysink: sink is back\n");
+            strLastError.clear();
+        }
+        {
+            boost::lock_guard<boost::mutex> lock(csNotifySink);
+            fNotifySinkOpen = fOpen;
+        }
+        if (fOpen && notifySinkOutput.Write(strLines, fNotifySinkStop, strError))
+            continue;
+
+        // The lines wait for the sink to be reopened, unless this is the last try
+        notifySinkOutput.Close();
+        {
+            boost::unique_lock<boost::mutex> lock(csNotifySink);
+            fNotifySinkOpen = false;
+            if (fStop || fNotifySinkStop) {
+                LogPrintf("notifysink: %s; events not written at shutdown lost\n", strError);
+                return;
+            }
+            queueNotifySink.PushFront(strLines);
+            if (strError != strLastError)
+                LogPrintf("notifysink: %s; trying again every %d seconds\n", strError, NOTIFY_SINK_RETRY_INTERVAL);
+            strLastError = strError;
+            condNotifySinkQueue.wait_for(lock, boost::chrono::seconds(NOTIFY_SINK_RETRY_INTERVAL));
+        }
+        condNotifySinkRoom.notify_all();
+    }
+}
+
+bool StartNotifySink(std::string& strError)
+{
+    if (!mapArgs.count("-notifysink"))
+        return true;
+    NotifySinkType type;
+    std::string strTarget;
+    if (!ParseNotifySink(GetArg("-notifysink", ""), type, strTarget, strError))
+        return false;
+    notifySinkOutput.Init(type, strTarget);
+    {
+        boost::lock_guard<boost::mutex> lock(csNotifySink);
+        fNotifySinkStop = false;
+        fNotifySinkRunning = true;
+    }
+    notifySinkThread = boost::thread(boost::bind(&TraceThread<void (*)()>, "notifysink", &ThreadNotifySink));
+    LogPrintf("notifysink: Writing events to %s\n", GetArg("-notifysink", ""));
+    return true;
+}
+
+void InterruptNotifySink()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(csNotifySink);
+        fNotifySinkStop = true;
+    }
+    condNotifySinkQueue.notify_all();
+    condNotifySinkRoom.notify_all();
+}
+
+void StopNotifySink()
+{
+    if (!IsNotifySinkRunning())
+        return;
+    InterruptNotifySink();
+    notifySinkThread.join();
+    notifySinkOutput.Close();
+    boost::lock_guard<boost::mutex> lock(csNotifySink);
+    queueNotifySink.TakeAll();
+    fNotifySinkRunning = false;
+    fNotifySinkOpen = false;
+}
+
+bool IsNotifySinkRunning()
+{
+    boost::lock_guard<boost::mutex> lock(csNotifySink);
+    return fNotifySinkRunning;
+}
+
+void NotifySink(const std::string& strKind, const std::string& strArg)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(csNotifySink);
+        if (!fNotifySinkRunning || fNotifySinkStop)
+            return;
+        // Back-pressure: wait for a sink that is there to catch up, rather than lose events
+        while (queueNotifySink.full() && fNotifySinkOpen && !fNotifySinkStop)
+            condNotifySinkRoom.wait(lock);
+        queueNotifySink.Push(strKind, SanitizeString(strArg));
+    }
+    condNotifySinkQueue.notify_one();
+}
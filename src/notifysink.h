@@ -0,0 +1,81 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NOTIFYSINK_H
+#define BITCOIN_NOTIFYSINK_H
+
+#include <deque>
+#include <stddef.h>
+#include <string>
+
+/** Lines of events -notifysink holds while the sink is slow or away; the oldest go past that */
+static const size_t NOTIFY_SINK_MAX_QUEUE = 10000;
+/** Seconds between attempts to open a sink that could not be opened */
+static const int NOTIFY_SINK_RETRY_INTERVAL = 5;
+
+enum NotifySinkType
+{
+    NOTIFY_SINK_PIPE, //!< a named pipe or file, opened for appending
+    NOTIFY_SINK_UNIX, //!< a UNIX stream socket, connected to
+    NOTIFY_SINK_EXEC, //!< a command, run once and fed on its standard input
+};
+
+/**
+ * Parse the pipe:<path>, unix:<path> or exec:<command> of -notifysink.
+ * Returns false with strError set if it is none of them, or is not
+ * available on this platform.
+ */
+bool ParseNotifySink(const std::string& strSpec, NotifySinkType& type, std::string& strTarget, std::string& strError);
+
+/**
+ * The events waiting for the sink, as newline-terminated lines. An event
+ * that is already waiting is not queued again, and a new tip replaces the
+ * one waiting, so a busy block costs one line per transaction and only the
+ * latest tip is reported. Not thread-safe.
+ */
+class CNotifyQueue
+{
+private:
+    std::deque<std::string> queue;
+    size_t nMaxSize;
+    size_t nDropped;
+
+public:
+    explicit CNotifyQueue(size_t nMaxSizeIn = NOTIFY_SINK_MAX_QUEUE) : nMaxSize(nMaxSizeIn), nDropped(0) {}
+
+    /** Queue the line for strKind and strArg, dropping the oldest if full */
+    void Push(const std::string& strKind, const std::string& strArg);
+    /** Take every line waiting, concatenated */
+    std::string TakeAll();
+    /** Put what TakeAll returned back in front, as it could not be written */
+    void PushFront(const std::string& strLines);
+
+    bool empty() const { return queue.empty(); }
+    bool full() const { return queue.size() >= nMaxSize; }
+    size_t size() const { return queue.size(); }
+    /** Lines dropped as the queue was full, since the last call */
+    size_t TakeDropped();
+};
+
+/**
+ * Write events to the sink -notifysink names, from a thread of its own,
+ * reopening it when it goes away, instead of running a shell for each of
+ * them as -blocknotify, -walletnotify and -alertnotify do. Once
+ * NOTIFY_SINK_MAX_QUEUE lines are waiting, an open sink that takes them
+ * slower than they come holds up whoever raises the next event, while one
+ * that can't be opened loses the oldest instead.
+ * Returns false with strError set if -notifysink is malformed.
+ */
+bool StartNotifySink(std::string& strError);
+/** Stop taking events, and wake producers waiting for room */
+void InterruptNotifySink();
+/** Write out what is waiting if the sink takes it, and stop */
+void StopNotifySink();
+
+/** Whether events are going to a sink */
+bool IsNotifySinkRunning();
+/** Queue an event of strKind, "blocktip", "wallettx" or "alert", for the sink if there is one */
+void NotifySink(const std::string& strKind, const std::string& strArg);
+
+#endif // BITCOIN_NOTIFYSINK_H
@@ -0,0 +1,208 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_OPENHASHMAP_H
+#define BITCOIN_OPENHASHMAP_H
+
+#include "memusage.h"
+
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+/**
+ * A hash map that keeps its entries in one array, probing linearly from the
+ * slot the hash picks, rather than allocating a node per entry as std::map
+ * and boost::unordered_map do. Lookups touch one or a few adjacent slots, and
+ * the memory used is the array alone, so it suits maps of small keys and
+ * values that are looked up far more often than they are iterated.
+ *
+ * The hash must mix well into the low bits, as a salted SipHash does: the
+ * table size is a power of two and the slot is the hash masked to it.
+ * Inserting may move every entry and erasing may move later ones, so
+ * iterators and references are only valid until the map is next changed.
+ * Keys and values must be default constructible, and the key of an entry
+ * must not be modified through an iterator.
+ */
+template <typename K, typename V, typename Hash>
+class COpenHashMap
+{
+public:
+    typedef std::pair<K, V> value_type;
+
+private:
+    std::vector<value_type> vSlots;
+    std::vector<unsigned char> vUsed;
+    size_t nSize;
+    Hash hasher;
+
+    static const size_t MIN_SLOTS = 16;
+
+    size_t Mask() const { return vSlots.size() - 1; }
+
+    //! Slot holding key, or the free slot where it would go
+    size_t Probe(const K& key) const
+    {
+        size_t i = hasher(key) & Mask();
+        while (vUsed[i] && !(vSlots[i].first == key))
+            i = (i + 1) & Mask();
+        return i;
+    }
+
+    void Rehash(size_t nSlots)
+    {
+        std::vector<value_type> vOldSlots(nSlots);
+        std::vector<unsigned char> vOldUsed(nSlots, 0);
+        // Swapped, so the old entries are re-inserted into the new array
+        vOldSlots.swap(vSlots);
+        vOldUsed.swap(vUsed);
+        for (size_t i = 0; i < vOldSlots.size(); i++) {
+            if (!vOldUsed[i])
+                continue;
+            size_t j = Probe(vOldSlots[i].first);
+            vSlots[j] = std::move(vOldSlots[i]);
+            vUsed[j] = 1;
+        }
+    }
+
+    //! Empty slot i, moving later entries of its probe run back to close the gap
+    void EraseSlot(size_t i)
+    {
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & Mask();
+            if (!vUsed[j])
+                break;
+            // The entry at j may move to i only if i is between its home slot and j
+            size_t nHome = hasher(vSlots[j].first) & Mask();
+            if (((j - nHome) & Mask()) >= ((j - i) & Mask())) {
+                vSlots[i] = std::move(vSlots[j]);
+                i = j;
+            }
+        }
+        vSlots[i] = value_type();
+        vUsed[i] = 0;
+        nSize--;
+    }
+
+public:
+    template <typename Map, typename Value>
+    class basic_iterator
+    {
+    private:
+        Map* map;
+        size_t i;
+
+        void Skip()
+        {
+            while (i < map->vUsed.size() && !map->vUsed[i])
+                i++;
+        }
+
+        friend class COpenHashMap;
+
+    public:
+        basic_iterator(Map* mapIn, size_t iIn) : map(mapIn), i(iIn) { Skip(); }
+        template <typename OtherMap, typename OtherValue>
+        basic_iterator(const basic_iterator<OtherMap, OtherValue>& it) : map(it.map), i(it.i) {}
+
+        Value& operator*() const { return map->vSlots[i]; }
+        Value* operator->() const { return &map->vSlots[i]; }
+        basic_iterator& operator++()
+        {
+            i++;
+            Skip();
+            return *this;
+        }
+        basic_iterator operator++(int)
+        {
+            basic_iterator it = *this;
+            ++*this;
+            return it;
+        }
+        bool operator==(const basic_iterator& it) const { return i == it.i; }
+        bool operator!=(const basic_iterator& it) const { return i != it.i; }
+
+        template <typename OtherMap, typename OtherValue>
+        friend class basic_iterator;
+    };
+
+    typedef basic_iterator<COpenHashMap, value_type> iterator;
+    typedef basic_iterator<const COpenHashMap, const value_type> const_iterator;
+
+    COpenHashMap() : nSize(0) {}
+
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, vSlots.size()); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, vSlots.size()); }
+
+    iterator find(const K& key)
+    {
+        if (nSize == 0)
+            return end();
+        size_t i = Probe(key);
+        return vUsed[i] ? iterator(this, i) : end();
+    }
+
+    const_iterator find(const K& key) const
+    {
+        if (nSize == 0)
+            return end();
+        size_t i = Probe(key);
+        return vUsed[i] ? const_iterator(this, i) : end();
+    }
+
+    size_t count(const K& key) const { return find(key) != end(); }
+
+    V& operator[](const K& key)
+    {
+        if (nSize > 0) {
+            size_t i = Probe(key);
+            if (vUsed[i])
+                return vSlots[i].second;
+        }
+        // Grow at three quarters full, so that probe runs stay short
+        if ((nSize + 1) * 4 > vSlots.size() * 3)
+            Rehash(vSlots.empty() ? MIN_SLOTS : vSlots.size() * 2);
+        size_t i = Probe(key);
+        if (!vUsed[i]) {
+            vSlots[i].first = key;
+            vUsed[i] = 1;
+            nSize++;
+        }
+        return vSlots[i].second;
+    }
+
+    size_t erase(const K& key)
+    {
+        if (nSize == 0)
+            return 0;
+        size_t i = Probe(key);
+        if (!vUsed[i])
+            return 0;
+        EraseSlot(i);
+        return 1;
+    }
+
+    void erase(iterator it) { EraseSlot(it.i); }
+
+    //! Remove every entry and give back the array
+    void clear()
+    {
+        std::vector<value_type>().swap(vSlots);
+        std::vector<unsigned char>().swap(vUsed);
+        nSize = 0;
+    }
+
+    size_t DynamicMemoryUsage() const
+    {
+        return memusage::DynamicUsage(vSlots) + memusage::DynamicUsage(vUsed);
+    }
+};
+
+#endif // BITCOIN_OPENHASHMAP_H
@@ -11,53 +11,61 @@
 #include "txmempool.h"
 #include "util.h"
 
+#include <algorithm>
+
+/**
+ * Renormalize the stored moving averages once their scale drops below this,
+ * which is every ~6900 blocks at the default decay.
+ */
+static const double MIN_AVERAGES_SCALE = 1e-6;
+
 void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
-                                unsigned int maxConfirms, double _decay, std::string _dataTypeString)
+                                unsigned int _maxConfirms, double _decay, std::string _dataTypeString)
 {
     decay = _decay;
     dataTypeString = _dataTypeString;
+    maxConfirms = _maxConfirms;
+    scale = 1;
 
     buckets.insert(buckets.end(), defaultBuckets.begin(), defaultBuckets.end());
     buckets.push_back(std::numeric_limits<double>::infinity());
 
-    for (unsigned int i = 0; i < buckets.size(); i++) {
-        bucketMap[buckets[i]] = i;
-    }
-
-    confAvg.resize(maxConfirms);
-    curBlockConf.resize(maxConfirms);
-    unconfTxs.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        confAvg[i].resize(buckets.size());
-        curBlockConf[i].resize(buckets.size());
-        unconfTxs[i].resize(buckets.size());
-    }
-
+    confAvg.resize(maxConfirms * buckets.size());
+    unconfTxs.resize(maxConfirms * buckets.size());
     oldUnconfTxs.resize(buckets.size());
-    curBlockTxCt.resize(buckets.size());
     txCtAvg.resize(buckets.size());
-    curBlockVal.resize(buckets.size());
     avg.resize(buckets.size());
 }
 
-// Zero out the data for the current block
-void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
+void TxConfirmStats::Normalize()
 {
+    for (unsigned int i = 0; i < confAvg.size(); i++)
+        confAvg[i] *= scale;
     for (unsigned int j = 0; j < buckets.size(); j++) {
-        oldUnconfTxs[j] += unconfTxs[nBlockHeight%unconfTxs.size()][j];
-        unconfTxs[nBlockHeight%unconfTxs.size()][j] = 0;
-        for (unsigned int i = 0; i < curBlockConf.size(); i++)
-            curBlockConf[i][j] = 0;
-        curBlockTxCt[j] = 0;
-        curBlockVal[j] = 0;
+        avg[j] *= scale;
+        txCtAvg[j] *= scale;
     }
+    scale = 1;
+}
+
+void TxConfirmStats::NewBlock(unsigned int nBlockHeight)
+{
+    unsigned int blockIndex = nBlockHeight % maxConfirms;
+    for (unsigned int j = 0; j < buckets.size(); j++) {
+        oldUnconfTxs[j] += unconfTxs[blockIndex * buckets.size() + j];
+        unconfTxs[blockIndex * buckets.size() + j] = 0;
+    }
+
+    scale *= decay;
+    if (scale < MIN_AVERAGES_SCALE)
+        Normalize();
 }
 
 unsigned int TxConfirmStats::FindBucketIndex(double val)
 {
-    auto it = bucketMap.lower_bound(val);
-    assert(it != bucketMap.end());
-    return it->second;
+    std::vector<double>::const_iterator it = std::lower_bound(buckets.begin(), buckets.end(), val);
+    assert(it != buckets.end());
+    return it - buckets.begin();
 }
 
 void TxConfirmStats::Record(int blocksToConfirm, double val)
@@ -66,21 +74,12 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
     if (blocksToConfirm < 1)
         return;
     unsigned int bucketindex = FindBucketIndex(val);
-    for (size_t i = blocksToConfirm; i <= curBlockConf.size(); i++) {
-        curBlockConf[i - 1][bucketindex]++;
-    }
-    curBlockTxCt[bucketindex]++;
-    curBlockVal[bucketindex] += val;
-}
-
-void TxConfirmStats::UpdateMovingAverages()
-{
-    for (unsigned int j = 0; j < buckets.size(); j++) {
-        for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay + curBlockConf[i][j];
-        avg[j] = avg[j] * decay + curBlockVal[j];
-        txCtAvg[j] = txCtAvg[j] * decay + curBlockTxCt[j];
+    double weight = 1 / scale;
+    for (size_t i = blocksToConfirm; i <= maxConfirms; i++) {
+        confAvg[(i - 1) * buckets.size() + bucketindex] += weight;
     }
+    txCtAvg[bucketindex] += weight;
+    avg[bucketindex] += val * weight;
 }
 
 // returns -1 on error conditions
@@ -113,15 +112,16 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     unsigned int bestFarBucket = startbucket;
 
     bool foundAnswer = false;
-    unsigned int bins = unconfTxs.size();
+    unsigned int bins = maxConfirms;
+    const double* confAvgTarget = &confAvg[(confTarget - 1) * buckets.size()];
 
     // Start counting from highest(default) or lowest fee/pri transactions
     for (int bucket = startbucket; bucket >= 0 && bucket <= maxbucketindex; bucket += step) {
         curFarBucket = bucket;
-        nConf += confAvg[confTarget - 1][bucket];
-        totalNum += txCtAvg[bucket];
-        for (unsigned int confct = confTarget; confct < GetMaxConfirms(); confct++)
-            extraNum += unconfTxs[(nBlockHeight - confct)%bins][bucket];
+        nConf += confAvgTarget[bucket] * scale;
+        totalNum += txCtAvg[bucket] * scale;
+        for (unsigned int confct = confTarget; confct < maxConfirms; confct++)
+            extraNum += unconfTxs[((nBlockHeight - confct)%bins) * buckets.size() + bucket];
         extraNum += oldUnconfTxs[bucket];
         // If we have enough transaction data points in this range of buckets,
         // we can test for success
@@ -184,11 +184,17 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
 
 void TxConfirmStats::Write(CAutoFile& fileout)
 {
+    // The file keeps the true averages, with one vector per confirmation count
+    Normalize();
+    std::vector<std::vector<double> > fileConfAvg(maxConfirms);
+    for (unsigned int i = 0; i < maxConfirms; i++)
+        fileConfAvg[i].assign(confAvg.begin() + i * buckets.size(), confAvg.begin() + (i + 1) * buckets.size());
+
     fileout << decay;
     fileout << buckets;
     fileout << avg;
     fileout << txCtAvg;
-    fileout << confAvg;
+    fileout << fileConfAvg;
 }
 
 void TxConfirmStats::Read(CAutoFile& filein)
@@ -199,7 +205,7 @@ void TxConfirmStats::Read(CAutoFile& filein)
     std::vector<std::vector<double> > fileConfAvg;
     std::vector<double> fileTxCtAvg;
     double fileDecay;
-    size_t maxConfirms;
+    size_t numConfirms;
     size_t numBuckets;
 
     filein >> fileDecay;
@@ -216,10 +222,10 @@ void TxConfirmStats::Read(CAutoFile& filein)
     if (fileTxCtAvg.size() != numBuckets)
         throw std::runtime_error("Corrupt estimates file. Mismatch in tx count bucket count");
     filein >> fileConfAvg;
-    maxConfirms = fileConfAvg.size();
-    if (maxConfirms <= 0 || maxConfirms > 6 * 24 * 7) // one week
+    numConfirms = fileConfAvg.size();
+    if (numConfirms <= 0 || numConfirms > 6 * 24 * 7) // one week
         throw std::runtime_error("Corrupt estimates file.  Must maintain estimates for between 1 and 1008 (one week) confirms");
-    for (unsigned int i = 0; i < maxConfirms; i++) {
+    for (unsigned int i = 0; i < numConfirms; i++) {
         if (fileConfAvg[i].size() != numBuckets)
             throw std::runtime_error("Corrupt estimates file. Mismatch in fee/pri conf average bucket count");
     }
@@ -228,28 +234,19 @@ void TxConfirmStats::Read(CAutoFile& filein)
     decay = fileDecay;
     buckets = fileBuckets;
     avg = fileAvg;
-    confAvg = fileConfAvg;
     txCtAvg = fileTxCtAvg;
-    bucketMap.clear();
-
-    // Resize the current block variables which aren't stored in the data file
+    maxConfirms = numConfirms;
+    scale = 1;
+    confAvg.clear();
+    confAvg.reserve(maxConfirms * buckets.size());
+    for (unsigned int i = 0; i < maxConfirms; i++)
+        confAvg.insert(confAvg.end(), fileConfAvg[i].begin(), fileConfAvg[i].end());
+
+    // Resize the mempool counts which aren't stored in the data file
     // to match the number of confirms and buckets
-    curBlockConf.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        curBlockConf[i].resize(buckets.size());
-    }
-    curBlockTxCt.resize(buckets.size());
-    curBlockVal.resize(buckets.size());
-
-    unconfTxs.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        unconfTxs[i].resize(buckets.size());
-    }
+    unconfTxs.resize(maxConfirms * buckets.size());
     oldUnconfTxs.resize(buckets.size());
 
-    for (unsigned int i = 0; i < buckets.size(); i++)
-        bucketMap[buckets[i]] = i;
-
     LogPrint("estimatefee", "Reading estimates: %u %s buckets counting confirms up to %u blocks\n",
              numBuckets, dataTypeString, maxConfirms);
 }
@@ -257,8 +254,8 @@ void TxConfirmStats::Read(CAutoFile& filein)
 unsigned int TxConfirmStats::NewTx(unsigned int nBlockHeight, double val)
 {
     unsigned int bucketindex = FindBucketIndex(val);
-    unsigned int blockIndex = nBlockHeight % unconfTxs.size();
-    unconfTxs[blockIndex][bucketindex]++;
+    unsigned int blockIndex = nBlockHeight % maxConfirms;
+    unconfTxs[blockIndex * buckets.size() + bucketindex]++;
     LogPrint("estimatefee", "adding to %s", dataTypeString);
     return bucketindex;
 }
@@ -274,7 +271,7 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
         return;  //This can't happen because we call this with our best seen height, no entries can have higher
     }
 
-    if (blocksAgo >= (int)unconfTxs.size()) {
+    if (blocksAgo >= (int)maxConfirms) {
         if (oldUnconfTxs[bucketindex] > 0)
             oldUnconfTxs[bucketindex]--;
         else
@@ -282,9 +279,9 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
                      bucketindex);
     }
     else {
-        unsigned int blockIndex = entryHeight % unconfTxs.size();
-        if (unconfTxs[blockIndex][bucketindex] > 0)
-            unconfTxs[blockIndex][bucketindex]--;
+        unsigned int blockIndex = entryHeight % maxConfirms;
+        if (unconfTxs[blockIndex * buckets.size() + bucketindex] > 0)
+            unconfTxs[blockIndex * buckets.size() + bucketindex]--;
         else
             LogPrint("estimatefee", "Blockpolicy error, mempool tx removed from blockIndex=%u,bucketIndex=%u already\n",
                      blockIndex, bucketindex);
@@ -293,7 +290,7 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
 
 void CBlockPolicyEstimator::removeTx(uint256 hash)
 {
-    std::map<uint256, TxStatsInfo>::iterator pos = mapMemPoolTxs.find(hash);
+    boost::unordered_map<uint256, TxStatsInfo, CCoinsKeyHasher>::iterator pos = mapMemPoolTxs.find(hash);
     if (pos == mapMemPoolTxs.end()) {
         LogPrint("estimatefee", "Blockpolicy error mempool tx %s not found for removeTx\n",
                  hash.ToString().c_str());
@@ -303,9 +300,12 @@ void CBlockPolicyEstimator::removeTx(uint256 hash)
     unsigned int entryHeight = pos->second.blockHeight;
     unsigned int bucketIndex = pos->second.bucketIndex;
 
-    if (stats != NULL)
+    if (stats != NULL) {
         stats->removeTx(entryHeight, nBestSeenHeight, bucketIndex);
-    mapMemPoolTxs.erase(hash);
+        if (entryHeight < nBestSeenHeight)
+            ClearEstimates();
+    }
+    mapMemPoolTxs.erase(pos);
 }
 
 CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate& _minRelayFee)
@@ -329,6 +329,14 @@ CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate& _minRelayFee)
     feeLikely = CFeeRate(INF_FEERATE);
     priUnlikely = 0;
     priLikely = INF_PRIORITY;
+
+    ClearEstimates();
+}
+
+void CBlockPolicyEstimator::ClearEstimates()
+{
+    feeEstimates.assign(feeStats.GetMaxConfirms(), boost::none);
+    priEstimates.assign(priStats.GetMaxConfirms(), boost::none);
 }
 
 bool CBlockPolicyEstimator::isFeeDataPoint(const CFeeRate &fee, double pri)
@@ -353,7 +361,8 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, boo
 {
     unsigned int txHeight = entry.GetHeight();
     uint256 hash = entry.GetTx().GetHash();
-    if (mapMemPoolTxs[hash].stats != NULL) {
+    TxStatsInfo& info = mapMemPoolTxs[hash];
+    if (info.stats != NULL) {
         LogPrint("estimatefee", "Blockpolicy error mempool tx %s already being tracked\n",
                  hash.ToString().c_str());
 	return;
@@ -384,18 +393,18 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, boo
     // what that will be and its too hard to continue updating it
     // so use starting priority as a proxy
     double curPri = entry.GetPriority(txHeight);
-    mapMemPoolTxs[hash].blockHeight = txHeight;
+    info.blockHeight = txHeight;
 
     LogPrint("estimatefee", "Blockpolicy mempool tx %s ", hash.ToString().substr(0,10));
     // Record this as a priority estimate
     if (entry.GetFee() == 0 || isPriDataPoint(feeRate, curPri)) {
-        mapMemPoolTxs[hash].stats = &priStats;
-        mapMemPoolTxs[hash].bucketIndex =  priStats.NewTx(txHeight, curPri);
+        info.stats = &priStats;
+        info.bucketIndex = priStats.NewTx(txHeight, curPri);
     }
     // Record this as a fee estimate
     else if (isFeeDataPoint(feeRate, curPri)) {
-        mapMemPoolTxs[hash].stats = &feeStats;
-        mapMemPoolTxs[hash].bucketIndex = feeStats.NewTx(txHeight, (double)feeRate.GetFeePerK());
+        info.stats = &feeStats;
+        info.bucketIndex = feeStats.NewTx(txHeight, (double)feeRate.GetFeePerK());
     }
     else {
         LogPrint("estimatefee", "not adding");
@@ -452,6 +461,7 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
         return;
     }
     nBestSeenHeight = nBlockHeight;
+    ClearEstimates();
 
     // Only want to be updating estimates when our blockchain is synced,
     // otherwise we'll miscalculate how many blocks its taking to get included.
@@ -482,18 +492,14 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
     else
         feeUnlikely = CFeeRate(feeUnlikelyEst);
 
-    // Clear the current block states
-    feeStats.ClearCurrent(nBlockHeight);
-    priStats.ClearCurrent(nBlockHeight);
+    // Decay the exponential averages by one block
+    feeStats.NewBlock(nBlockHeight);
+    priStats.NewBlock(nBlockHeight);
 
-    // Repopulate the current block states
+    // Add the transactions of this block to them
     for (unsigned int i = 0; i < entries.size(); i++)
         processBlockTx(nBlockHeight, entries[i]);
 
-    // Update all exponential averages with the current block states
-    feeStats.UpdateMovingAverages();
-    priStats.UpdateMovingAverages();
-
     LogPrint("estimatefee", "Blockpolicy after updating estimates for %u confirmed entries, new mempool map size %u\n",
              entries.size(), mapMemPoolTxs.size());
 }
@@ -504,7 +510,10 @@ CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
     if (confTarget <= 0 || (unsigned int)confTarget > feeStats.GetMaxConfirms())
         return CFeeRate(0);
 
-    double median = feeStats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    boost::optional<double>& cached = feeEstimates[confTarget - 1];
+    if (!cached)
+        cached = feeStats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    double median = *cached;
 
     if (median < 0)
         return CFeeRate(0);
@@ -518,7 +527,10 @@ double CBlockPolicyEstimator::estimatePriority(int confTarget)
     if (confTarget <= 0 || (unsigned int)confTarget > priStats.GetMaxConfirms())
         return -1;
 
-    return priStats.EstimateMedianVal(confTarget, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    boost::optional<double>& cached = priEstimates[confTarget - 1];
+    if (!cached)
+        cached = priStats.EstimateMedianVal(confTarget, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    return *cached;
 }
 
 void CBlockPolicyEstimator::Write(CAutoFile& fileout)
@@ -535,4 +547,5 @@ void CBlockPolicyEstimator::Read(CAutoFile& filein)
     feeStats.Read(filein);
     priStats.Read(filein);
     nBestSeenHeight = nFileBestSeenHeight;
+    ClearEstimates();
 }
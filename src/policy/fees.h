@@ -6,12 +6,15 @@
 #define BITCOIN_POLICYESTIMATOR_H
 
 #include "amount.h"
+#include "coins.h"
 #include "uint256.h"
 
-#include <map>
 #include <string>
 #include <vector>
 
+#include <boost/optional.hpp>
+#include <boost/unordered_map.hpp>
+
 class CAutoFile;
 class CFeeRate;
 class CTxMemPoolEntry;
@@ -84,27 +87,31 @@ class TxConfirmStats
 {
 private:
     //Define the buckets we will group transactions into (both fee buckets and priority buckets)
-    std::vector<double> buckets;              // The upper-bound of the range for the bucket (inclusive)
-    std::map<double, unsigned int> bucketMap; // Map of bucket upper-bound to index into all vectors by bucket
+    std::vector<double> buckets;              // The upper-bound of the range for the bucket (inclusive), ascending
+    unsigned int maxConfirms;
+
+    // All per confirmation and per bucket data is kept in flat arrays indexed
+    // by [Y * buckets.size() + X], so that a scan of the buckets for one
+    // confirmation target reads contiguous memory.
+
+    // The historical moving averages below are stored divided by scale.
+    // Decaying them for a new block only shrinks scale, so a block costs time
+    // in the number of its transactions rather than in the number of buckets
+    // and targets. The true value of an average is its stored value * scale.
+    double scale;
 
     // For each bucket X:
     // Count the total # of txs in each bucket
     // Track the historical moving average of this total over blocks
     std::vector<double> txCtAvg;
-    // and calcuate the total for the current block to update the moving average
-    std::vector<int> curBlockTxCt;
 
     // Count the total # of txs confirmed within Y blocks in each bucket
     // Track the historical moving average of theses totals over blocks
-    std::vector<std::vector<double> > confAvg; // confAvg[Y][X]
-    // and calcuate the totals for the current block to update the moving averages
-    std::vector<std::vector<int> > curBlockConf; // curBlockConf[Y][X]
+    std::vector<double> confAvg; // confAvg[Y][X]
 
     // Sum the total priority/fee of all txs in each bucket
     // Track the historical moving average of this total over blocks
     std::vector<double> avg;
-    // and calculate the total for the current block to update the moving average
-    std::vector<double> curBlockVal;
 
     // Combine the conf counts with tx counts to calculate the confirmation % for each Y,X
     // Combine the total value with the tx counts to calculate the avg fee/priority per bucket
@@ -115,10 +122,13 @@ private:
     // Mempool counts of outstanding transactions
     // For each bucket X, track the number of transactions in the mempool
     // that are unconfirmed for each possible confirmation value Y
-    std::vector<std::vector<int> > unconfTxs;  //unconfTxs[Y][X]
+    std::vector<int> unconfTxs;  //unconfTxs[Y][X]
     // transactions still unconfirmed after MAX_CONFIRMS for each bucket
     std::vector<int> oldUnconfTxs;
 
+    /** Multiply the stored averages by scale and reset it to 1 */
+    void Normalize();
+
 public:
     /** Find the bucket index of a given value */
     unsigned int FindBucketIndex(double val);
@@ -135,11 +145,14 @@ public:
      */
     void Initialize(std::vector<double>& defaultBuckets, unsigned int maxConfirms, double decay, std::string dataTypeString);
 
-    /** Clear the state of the curBlock variables to start counting for the new block */
-    void ClearCurrent(unsigned int nBlockHeight);
+    /**
+     * Decay the historical moving averages by one block and start counting
+     * the transactions confirmed in block nBlockHeight
+     */
+    void NewBlock(unsigned int nBlockHeight);
 
     /**
-     * Record a new transaction data point in the current block stats
+     * Record a new transaction data point in the block passed to the last NewBlock
      * @param blocksToConfirm the number of blocks it took this transaction to confirm
      * @param val either the fee or the priority when entered of the transaction
      * @warning blocksToConfirm is 1-based and has to be >= 1
@@ -153,10 +166,6 @@ public:
     void removeTx(unsigned int entryHeight, unsigned int nBestSeenHeight,
                   unsigned int bucketIndex);
 
-    /** Update our estimates by decaying our historical moving average and updating
-        with the data gathered from the current block */
-    void UpdateMovingAverages();
-
     /**
      * Calculate a fee or priority estimate.  Find the lowest value bucket (or range of buckets
      * to make sure we have enough data points) whose transactions still have sufficient likelihood
@@ -172,7 +181,7 @@ public:
                              double minSuccess, bool requireGreater, unsigned int nBlockHeight);
 
     /** Return the max number of confirms we're tracking */
-    unsigned int GetMaxConfirms() { return confAvg.size(); }
+    unsigned int GetMaxConfirms() { return maxConfirms; }
 
     /** Write state of estimation data to a file*/
     void Write(CAutoFile& fileout);
@@ -271,7 +280,7 @@ private:
     };
 
     // map of txids to information about that transaction
-    std::map<uint256, TxStatsInfo> mapMemPoolTxs;
+    boost::unordered_map<uint256, TxStatsInfo, CCoinsKeyHasher> mapMemPoolTxs;
 
     /** Classes to track historical data on transaction confirmations */
     TxConfirmStats feeStats, priStats;
@@ -279,5 +288,15 @@ private:
     /** Breakpoints to help determine whether a transaction was confirmed by priority or Fee */
     CFeeRate feeLikely, feeUnlikely;
     double priLikely, priUnlikely;
+
+    /**
+     * Answers of estimateFee and estimatePriority by target - 1, computed on
+     * first use. Transactions entering the mempool are only counted by the
+     * estimates once a block has been seen after them, so the answers stay
+     * valid until a block is processed or an older tracked transaction
+     * leaves the mempool.
+     */
+    std::vector<boost::optional<double> > feeEstimates, priEstimates;
+    void ClearEstimates();
 };
 #endif /*BITCOIN_POLICYESTIMATOR_H */
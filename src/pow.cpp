@@ -211,3 +211,36 @@ int64_t GetBlockProofEquivalentTime(const CBlockIndex& to, const CBlockIndex& fr
     }
     return sign * r.GetLow64();
 }
+
+int64_t GetNetworkSolPS(const CBlockIndex* pindex, int lookup, const Consensus::Params& params)
+{
+    if (pindex == NULL || !pindex->nHeight)
+        return 0;
+
+    // If lookup is nonpositive, then use difficulty averaging window.
+    if (lookup <= 0)
+        lookup = params.nPowAveragingWindow;
+
+    // If lookup is larger than chain, then set it to chain length.
+    if (lookup > pindex->nHeight)
+        lookup = pindex->nHeight;
+
+    const CBlockIndex* pindex0 = pindex;
+    int64_t minTime = pindex0->GetBlockTime();
+    int64_t maxTime = minTime;
+    for (int i = 0; i < lookup; i++) {
+        pindex0 = pindex0->pprev;
+        int64_t time = pindex0->GetBlockTime();
+        minTime = std::min(time, minTime);
+        maxTime = std::max(time, maxTime);
+    }
+
+    // In case there's a situation where minTime == maxTime, we don't want a divide by zero exception.
+    if (minTime == maxTime)
+        return 0;
+
+    arith_uint256 workDiff = pindex->nChainWork - pindex0->nChainWork;
+    int64_t timeDiff = maxTime - minTime;
+
+    return (int64_t)(workDiff.getdouble() / timeDiff);
+}
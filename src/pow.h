@@ -31,4 +31,13 @@ arith_uint256 GetBlockProof(const CBlockIndex& block);
 /** Return the time it would take to redo the work difference between from and to, assuming the current hashrate corresponds to the difficulty at tip, in seconds. */
 int64_t GetBlockProofEquivalentTime(const CBlockIndex& to, const CBlockIndex& from, const CBlockIndex& tip, const Consensus::Params&);
 
+/** Blocks the network solution rate is estimated over by default */
+static const int DEFAULT_SOLPS_LOOKUP = 120;
+
+/**
+ * Return average network solutions per second over the lookup blocks up to
+ * pindex, or over the difficulty averaging window if lookup is nonpositive.
+ */
+int64_t GetNetworkSolPS(const CBlockIndex* pindex, int lookup, const Consensus::Params&);
+
 #endif // BITCOIN_POW_H
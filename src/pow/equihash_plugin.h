@@ -0,0 +1,74 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_POW_EQUIHASH_PLUGIN_H
+#define BITCOIN_POW_EQUIHASH_PLUGIN_H
+
+/**
+ * The C interface an Equihash solver plugin exports, for the built-in miner
+ * to run solvers on GPUs and other devices from a shared library. Only
+ * plain C types cross it, so a plugin may be built with any compiler.
+ *
+ * A run is given what the BLAKE2b state of the Equihash generator is
+ * seeded with: the personalization, the serialized header up to the
+ * nonce, and the nonce. Solutions are handed back, as they are found, in
+ * the minimal encoding, the way they go into the block header, without
+ * their length in front.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Version of the interface this header describes */
+#define EQUIHASH_PLUGIN_API_VER 1
+/** Bytes of the BLAKE2b personalization */
+#define EQUIHASH_PLUGIN_PERSONAL_BYTES 16
+
+/** Take solution; nonzero for the run to stop */
+typedef int (*equihash_plugin_solution_fn)(void* user, const unsigned char* solution, size_t solutionLen);
+/** Nonzero for the run to be abandoned, as the work is stale */
+typedef int (*equihash_plugin_cancel_fn)(void* user);
+
+/** The functions, and their names in the library */
+typedef unsigned int (*equihash_plugin_api_version_fn)(void);
+#define EQUIHASH_PLUGIN_API_VERSION "equihash_plugin_api_version"
+
+/** Number of devices the plugin can run on */
+typedef int (*equihash_plugin_device_count_fn)(void);
+#define EQUIHASH_PLUGIN_DEVICE_COUNT "equihash_plugin_device_count"
+
+/** Write the name of device into name, at most nameLen bytes with the terminator; 0 on success */
+typedef int (*equihash_plugin_device_name_fn)(int device, char* name, size_t nameLen);
+#define EQUIHASH_PLUGIN_DEVICE_NAME "equihash_plugin_device_name"
+
+/** Set up a solver for parameters n, k on device; NULL on failure */
+typedef void* (*equihash_plugin_create_fn)(int device, unsigned int n, unsigned int k);
+#define EQUIHASH_PLUGIN_CREATE "equihash_plugin_create"
+
+typedef void (*equihash_plugin_destroy_fn)(void* solver);
+#define EQUIHASH_PLUGIN_DESTROY "equihash_plugin_destroy"
+
+/**
+ * Run solver once, over header and nonce, calling onSolution for each
+ * solution and polling cancel. A solver is only ever run from one thread
+ * at a time. Returns the number of solutions found, or a negative number
+ * on failure.
+ */
+typedef int (*equihash_plugin_solve_fn)(void* solver,
+                                        const unsigned char* personal,
+                                        const unsigned char* header, size_t headerLen,
+                                        const unsigned char* nonce, size_t nonceLen,
+                                        equihash_plugin_solution_fn onSolution,
+                                        equihash_plugin_cancel_fn cancel,
+                                        void* user);
+#define EQUIHASH_PLUGIN_SOLVE "equihash_plugin_solve"
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // BITCOIN_POW_EQUIHASH_PLUGIN_H
@@ -9,10 +9,60 @@
 #include "tinyformat.h"
 #include "utilstrencodings.h"
 #include "crypto/common.h"
+#include "crypto/sha256.h"
+
+struct CBlockHeaderHashEntry
+{
+    int32_t nVersion;
+    uint256 hashPrevBlock;
+    uint256 hashMerkleRoot;
+    uint256 hashFinalSaplingRoot;
+    uint32_t nTime;
+    uint32_t nBits;
+    uint256 nNonce;
+    std::vector<unsigned char> nSolution;
+    uint256 hash;
+
+    explicit CBlockHeaderHashEntry(const CBlockHeader& header) :
+        nVersion(header.nVersion), hashPrevBlock(header.hashPrevBlock), hashMerkleRoot(header.hashMerkleRoot),
+        hashFinalSaplingRoot(header.hashFinalSaplingRoot), nTime(header.nTime), nBits(header.nBits),
+        nNonce(header.nNonce), nSolution(header.nSolution), hash(SerializeHash(header)) {}
+
+    bool Matches(const CBlockHeader& header) const
+    {
+        return nVersion == header.nVersion && nTime == header.nTime && nBits == header.nBits &&
+               nNonce == header.nNonce && hashPrevBlock == header.hashPrevBlock &&
+               hashMerkleRoot == header.hashMerkleRoot && hashFinalSaplingRoot == header.hashFinalSaplingRoot &&
+               nSolution == header.nSolution;
+    }
+};
 
 uint256 CBlockHeader::GetHash() const
 {
-    return SerializeHash(*this);
+    // Comparing the fields is much cheaper than hashing the Equihash solution again
+    std::shared_ptr<const CBlockHeaderHashEntry> entry = hashCache.Get();
+    if (entry && entry->Matches(*this))
+        return entry->hash;
+    entry = std::make_shared<const CBlockHeaderHashEntry>(*this);
+    hashCache.Set(entry);
+    return entry->hash;
+}
+
+/** Whether vMerkleTree holds the tree of exactly the transactions in vtx */
+static bool MerkleTreeMatches(const std::vector<uint256>& vMerkleTree, const std::vector<CTransactionRef>& vtx)
+{
+    size_t nNodes = 0;
+    for (size_t nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+        nNodes += nSize;
+    if (vtx.size() > 0)
+        nNodes++;
+    if (vMerkleTree.size() != nNodes)
+        return false;
+    for (size_t i = 0; i < vtx.size(); i++) {
+        if (vMerkleTree[i] != vtx[i]->GetHash())
+            return false;
+    }
+    return true;
 }
 
 uint256 CBlock::BuildMerkleTree(bool* fMutated) const
@@ -52,23 +102,42 @@ uint256 CBlock::BuildMerkleTree(bool* fMutated) const
        known ways of changing the transactions without affecting the merkle
        root.
     */
+    if (!vtx.empty() && MerkleTreeMatches(vMerkleTree, vtx)) {
+        // Checking a block again (as accepting and then connecting it does)
+        // only needs the mutation check, which reads the tree
+        bool mutated = false;
+        int j = 0;
+        for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2) {
+            if (nSize % 2 == 0 && vMerkleTree[j+nSize-2] == vMerkleTree[j+nSize-1])
+                mutated = true;
+            j += nSize;
+        }
+        if (fMutated) {
+            *fMutated = mutated;
+        }
+        return vMerkleTree.back();
+    }
+
     vMerkleTree.clear();
     vMerkleTree.reserve(vtx.size() * 2 + 16); // Safe upper bound for the number of total nodes.
-    for (std::vector<CTransaction>::const_iterator it(vtx.begin()); it != vtx.end(); ++it)
-        vMerkleTree.push_back(it->GetHash());
+    for (std::vector<CTransactionRef>::const_iterator it(vtx.begin()); it != vtx.end(); ++it)
+        vMerkleTree.push_back((*it)->GetHash());
     int j = 0;
     bool mutated = false;
     for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
     {
-        for (int i = 0; i < nSize; i += 2)
-        {
-            int i2 = std::min(i+1, nSize-1);
-            if (i2 == i + 1 && i2 + 1 == nSize && vMerkleTree[j+i] == vMerkleTree[j+i2]) {
-                // Two identical hashes at the end of the list at a particular level.
-                mutated = true;
-            }
-            vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                       BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
+        if (nSize % 2 == 0 && vMerkleTree[j+nSize-2] == vMerkleTree[j+nSize-1]) {
+            // Two identical hashes at the end of the list at a particular level.
+            mutated = true;
+        }
+        // The pairs of a level are adjacent 64-byte blobs, so hash them all
+        // at once; an odd last entry is paired with itself.
+        size_t pos = vMerkleTree.size();
+        vMerkleTree.resize(pos + (nSize + 1) / 2);
+        SHA256D64(vMerkleTree[pos].begin(), vMerkleTree[j].begin(), nSize / 2);
+        if (nSize % 2) {
+            vMerkleTree.back() = Hash(BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]),
+                                      BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]));
         }
         j += nSize;
     }
@@ -122,7 +191,7 @@ std::string CBlock::ToString() const
         vtx.size());
     for (unsigned int i = 0; i < vtx.size(); i++)
     {
-        s << "  " << vtx[i].ToString() << "\n";
+        s << "  " << vtx[i]->ToString() << "\n";
     }
     s << "  vMerkleTree: ";
     for (unsigned int i = 0; i < vMerkleTree.size(); i++)
@@ -10,6 +10,34 @@
 #include "serialize.h"
 #include "uint256.h"
 
+#include <memory>
+
+struct CBlockHeaderHashEntry;
+
+/**
+ * The hash of a header, kept with a copy of the fields it was computed from
+ * so that a header changed since (as the miner changes its nonce) is hashed
+ * again rather than given a stale hash. The entry is immutable and swapped
+ * atomically, so a header can be hashed from several threads at once.
+ */
+class CBlockHeaderHashCache
+{
+private:
+    std::shared_ptr<const CBlockHeaderHashEntry> entry;
+
+public:
+    CBlockHeaderHashCache() {}
+    CBlockHeaderHashCache(const CBlockHeaderHashCache& other) : entry(std::atomic_load(&other.entry)) {}
+    CBlockHeaderHashCache& operator=(const CBlockHeaderHashCache& other)
+    {
+        std::atomic_store(&entry, std::atomic_load(&other.entry));
+        return *this;
+    }
+
+    std::shared_ptr<const CBlockHeaderHashEntry> Get() const { return std::atomic_load(&entry); }
+    void Set(const std::shared_ptr<const CBlockHeaderHashEntry>& entryIn) { std::atomic_store(&entry, entryIn); }
+};
+
 /** Nodes collect new transactions into a block, hash them into a hash tree,
  * and scan through nonce values to make the block's hash satisfy proof-of-work
  * requirements.  When they solve the proof-of-work, they broadcast the block
@@ -32,6 +60,9 @@ public:
     uint256 nNonce;
     std::vector<unsigned char> nSolution;
 
+    // memory only
+    mutable CBlockHeaderHashCache hashCache;
+
     CBlockHeader()
     {
         SetNull();
@@ -61,6 +92,7 @@ public:
         nBits = 0;
         nNonce = uint256();
         nSolution.clear();
+        hashCache = CBlockHeaderHashCache();
     }
 
     bool IsNull() const
@@ -68,6 +100,7 @@ public:
         return (nBits == 0);
     }
 
+    //! Double SHA256 of the header, only recomputed once a field has changed
     uint256 GetHash() const;
 
     int64_t GetBlockTime() const
@@ -81,7 +114,7 @@ class CBlock : public CBlockHeader
 {
 public:
     // network and disk
-    std::vector<CTransaction> vtx;
+    std::vector<CTransactionRef> vtx;
 
     // memory only
     mutable std::vector<uint256> vMerkleTree;
@@ -123,13 +156,14 @@ public:
         block.nBits          = nBits;
         block.nNonce         = nNonce;
         block.nSolution      = nSolution;
+        block.hashCache      = hashCache;
         return block;
     }
 
     // Build the in-memory merkle tree for this block and return the merkle root.
     // If non-NULL, *mutated is set to whether mutation was detected in the merkle
     // tree (a duplication of transactions in the block leading to an identical
-    // merkle root).
+    // merkle root). A tree already built for the same transactions is reused.
     uint256 BuildMerkleTree(bool* mutated = NULL) const;
 
     std::vector<uint256> GetMerkleBranch(int nIndex) const;
@@ -8,6 +8,7 @@
 #include "hash.h"
 #include "tinyformat.h"
 #include "utilstrencodings.h"
+#include "version.h"
 
 #include "librustzcash.h"
 
@@ -217,6 +218,35 @@ uint256 CMutableTransaction::GetHash() const
 void CTransaction::UpdateHash() const
 {
     *const_cast<uint256*>(&hash) = SerializeHash(*this);
+    UpdateMetadata(::GetSerializeSize(*this, SER_NETWORK, PROTOCOL_VERSION));
+}
+
+void CTransaction::UpdateHash(const unsigned char* pbegin, const unsigned char* pend) const
+{
+    // The same double SHA256 SerializeHash takes of the serialization
+    *const_cast<uint256*>(&hash) = Hash(pbegin, pend);
+    UpdateMetadata(pend - pbegin);
+}
+
+void CTransaction::UpdateMetadata(unsigned int nTotalSizeIn) const
+{
+    // Validation, the mempool and block assembly all ask for these, so
+    // they are worked out once for the life of the transaction
+    *const_cast<unsigned int*>(&nTotalSize) = nTotalSizeIn;
+    unsigned int nSigOps = 0;
+    for (const CTxIn& txin : vin)
+        nSigOps += txin.scriptSig.GetSigOpCount(false);
+    for (const CTxOut& txout : vout)
+        nSigOps += txout.scriptPubKey.GetSigOpCount(false);
+    *const_cast<unsigned int*>(&nLegacySigOps) = nSigOps;
+}
+
+unsigned int CTransaction::GetTotalSize() const
+{
+    // Transactions read without their proofs don't know their size
+    if (nTotalSize == 0)
+        return ::GetSerializeSize(*this, SER_NETWORK, PROTOCOL_VERSION);
+    return nTotalSize;
 }
 
 CTransaction::CTransaction() : nVersion(CTransaction::SPROUT_MIN_CURRENT_VERSION), fOverwintered(false), nVersionGroupId(0), nExpiryHeight(0), vin(), vout(), nLockTime(0), valueBalance(0), vShieldedSpend(), vShieldedOutput(), vjoinsplit(), joinSplitPubKey(), joinSplitSig(), bindingSig() { }
@@ -241,6 +271,7 @@ CTransaction::CTransaction(
                               bindingSig(tx.bindingSig)
 {
     assert(evilDeveloperFlag);
+    UpdateMetadata(0);
 }
 
 CTransaction::CTransaction(CMutableTransaction &&tx) : nVersion(tx.nVersion), fOverwintered(tx.fOverwintered), nVersionGroupId(tx.nVersionGroupId),
@@ -248,7 +279,8 @@ CTransaction::CTransaction(CMutableTransaction &&tx) : nVersion(tx.nVersion), fO
                                                        valueBalance(tx.valueBalance),
                                                        vShieldedSpend(std::move(tx.vShieldedSpend)), vShieldedOutput(std::move(tx.vShieldedOutput)),
                                                        vjoinsplit(std::move(tx.vjoinsplit)),
-                                                       joinSplitPubKey(std::move(tx.joinSplitPubKey)), joinSplitSig(std::move(tx.joinSplitSig))
+                                                       joinSplitPubKey(std::move(tx.joinSplitPubKey)), joinSplitSig(std::move(tx.joinSplitSig)),
+                                                       bindingSig(std::move(tx.bindingSig))
 {
     UpdateHash();
 }
@@ -269,6 +301,8 @@ CTransaction& CTransaction::operator=(const CTransaction &tx) {
     *const_cast<joinsplit_sig_t*>(&joinSplitSig) = tx.joinSplitSig;
     *const_cast<binding_sig_t*>(&bindingSig) = tx.bindingSig;
     *const_cast<uint256*>(&hash) = tx.hash;
+    *const_cast<unsigned int*>(&nTotalSize) = tx.nTotalSize;
+    *const_cast<unsigned int*>(&nLegacySigOps) = tx.nLegacySigOps;
     return *this;
 }
 
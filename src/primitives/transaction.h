@@ -16,6 +16,7 @@
 #include "consensus/consensus.h"
 
 #include <array>
+#include <memory>
 
 #include <boost/variant.hpp>
 
@@ -63,8 +64,13 @@ public:
         READWRITE(anchor);
         READWRITE(nullifier);
         READWRITE(rk);
-        READWRITE(zkproof);
-        READWRITE(spendAuthSig);
+        if (!(s.GetType() & SER_WITHOUT_PROOFS)) {
+            READWRITE(zkproof);
+            READWRITE(spendAuthSig);
+        } else if (ser_action.ForRead()) {
+            zkproof.fill(0);
+            spendAuthSig.fill(0);
+        }
     }
 
     friend bool operator==(const SpendDescription& a, const SpendDescription& b)
@@ -108,8 +114,13 @@ public:
         READWRITE(cm);
         READWRITE(ephemeralKey);
         READWRITE(encCiphertext);
-        READWRITE(outCiphertext);
-        READWRITE(zkproof);
+        if (!(s.GetType() & SER_WITHOUT_PROOFS)) {
+            READWRITE(outCiphertext);
+            READWRITE(zkproof);
+        } else if (ser_action.ForRead()) {
+            outCiphertext.fill(0);
+            zkproof.fill(0);
+        }
     }
 
     friend bool operator==(const OutputDescription& a, const OutputDescription& b)
@@ -166,14 +177,13 @@ inline void SerReadWriteSproutProof(Stream& s, const T& proof, bool useGroth, CS
 template<typename Stream, typename T>
 inline void SerReadWriteSproutProof(Stream& s, T& proof, bool useGroth, CSerActionUnserialize ser_action)
 {
+    // Read straight into the variant rather than through a temporary
     if (useGroth) {
-        libzcash::GrothProof grothProof;
-        ::Unserialize(s, grothProof);
-        proof = grothProof;
+        proof = libzcash::GrothProof();
+        ::Unserialize(s, boost::get<libzcash::GrothProof>(proof));
     } else {
-        libzcash::PHGRProof pghrProof;
-        ::Unserialize(s, pghrProof);
-        proof = pghrProof;
+        proof = libzcash::PHGRProof();
+        ::Unserialize(s, boost::get<libzcash::PHGRProof>(proof));
     }
 }
 
@@ -284,7 +294,16 @@ public:
         READWRITE(ephemeralKey);
         READWRITE(randomSeed);
         READWRITE(macs);
-        ::SerReadWriteSproutProof(s, proof, useGroth, ser_action);
+        if (!(s.GetType() & SER_WITHOUT_PROOFS)) {
+            ::SerReadWriteSproutProof(s, proof, useGroth, ser_action);
+        } else if (ser_action.ForRead()) {
+            // An empty proof of the kind the transaction format has
+            if (useGroth) {
+                proof = libzcash::GrothProof();
+            } else {
+                proof = libzcash::PHGRProof();
+            }
+        }
         READWRITE(ciphertexts);
     }
 
@@ -507,7 +526,14 @@ class CTransaction
 private:
     /** Memory only. */
     const uint256 hash;
+    //! Serialized size, or 0 if not known; derived along with the hash
+    const unsigned int nTotalSize = 0;
+    const unsigned int nLegacySigOps = 0;
     void UpdateHash() const;
+    //! Set the hash from the serialization in [pbegin, pend) rather than serializing again
+    void UpdateHash(const unsigned char* pbegin, const unsigned char* pend) const;
+    //! Set what is derived from the fields other than the hash, given the serialized size
+    void UpdateMetadata(unsigned int nTotalSizeIn) const;
 
 protected:
     /** Developer testing only.  Set evilDeveloperFlag to true.
@@ -515,6 +541,13 @@ protected:
      */
     CTransaction(const CMutableTransaction &tx, bool evilDeveloperFlag);
 
+    /**
+     * A transaction read with SER_WITHOUT_PROOFS can't be hashed, as what
+     * was left out is part of the hash; whoever reads it sets the hash it
+     * was stored under.
+     */
+    void SetHashWithoutProofs(const uint256& hashIn) { *const_cast<uint256*>(&hash) = hashIn; }
+
 public:
     typedef std::array<unsigned char, 64> joinsplit_sig_t;
     typedef std::array<unsigned char, 64> binding_sig_t;
@@ -571,7 +604,26 @@ public:
 
     CTransaction& operator=(const CTransaction& tx);
 
-    ADD_SERIALIZE_METHODS;
+    template <typename Stream>
+    void Serialize(Stream& s) const {
+        NCONST_PTR(this)->SerializationOp(s, CSerActionSerialize());
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s) {
+        // Streams that keep what they have read in memory let the hash be
+        // taken from those bytes, which spares serializing the proofs and
+        // ciphertexts a second time.
+        const unsigned char* pbegin = StreamReadPosition(s);
+        SerializationOp(s, CSerActionUnserialize());
+        if (s.GetType() & SER_WITHOUT_PROOFS) {
+            *const_cast<uint256*>(&hash) = uint256();
+            UpdateMetadata(0);
+        } else if (pbegin)
+            UpdateHash(pbegin, StreamReadPosition(s));
+        else
+            UpdateHash();
+    }
 
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action) {
@@ -617,18 +669,26 @@ public:
             ::SerReadWrite(os, *const_cast<std::vector<JSDescription>*>(&vjoinsplit), ser_action);
             if (vjoinsplit.size() > 0) {
                 READWRITE(*const_cast<uint256*>(&joinSplitPubKey));
-                READWRITE(*const_cast<joinsplit_sig_t*>(&joinSplitSig));
+                if (!(s.GetType() & SER_WITHOUT_PROOFS)) {
+                    READWRITE(*const_cast<joinsplit_sig_t*>(&joinSplitSig));
+                } else if (ser_action.ForRead()) {
+                    const_cast<joinsplit_sig_t*>(&joinSplitSig)->fill(0);
+                }
             }
         }
         if (isSaplingV4 && !(vShieldedSpend.empty() && vShieldedOutput.empty())) {
-            READWRITE(*const_cast<binding_sig_t*>(&bindingSig));
+            if (!(s.GetType() & SER_WITHOUT_PROOFS)) {
+                READWRITE(*const_cast<binding_sig_t*>(&bindingSig));
+            } else if (ser_action.ForRead()) {
+                const_cast<binding_sig_t*>(&bindingSig)->fill(0);
+            }
         }
-        if (ser_action.ForRead())
-            UpdateHash();
     }
 
     template <typename Stream>
-    CTransaction(deserialize_type, Stream& s) : CTransaction(CMutableTransaction(deserialize, s)) {}
+    CTransaction(deserialize_type, Stream& s) : CTransaction() {
+        Unserialize(s);
+    }
 
     bool IsNull() const {
         return vin.empty() && vout.empty();
@@ -638,6 +698,13 @@ public:
         return hash;
     }
 
+    //! The size of the network serialization, kept from when the transaction was built or read
+    unsigned int GetTotalSize() const;
+    //! Sigops in the scripts of the transaction itself, not counting those of P2SH inputs
+    unsigned int GetLegacySigOpCount() const {
+        return nLegacySigOps;
+    }
+
     uint32_t GetHeader() const {
         // When serializing v1 and v2, the 4 byte header is nVersion
         uint32_t header = this->nVersion;
@@ -763,11 +830,19 @@ struct CMutableTransaction
             ::SerReadWrite(os, vjoinsplit, ser_action);
             if (vjoinsplit.size() > 0) {
                 READWRITE(joinSplitPubKey);
-                READWRITE(joinSplitSig);
+                if (!(s.GetType() & SER_WITHOUT_PROOFS)) {
+                    READWRITE(joinSplitSig);
+                } else if (ser_action.ForRead()) {
+                    joinSplitSig.fill(0);
+                }
             }
         }
         if (isSaplingV4 && !(vShieldedSpend.empty() && vShieldedOutput.empty())) {
-            READWRITE(bindingSig);
+            if (!(s.GetType() & SER_WITHOUT_PROOFS)) {
+                READWRITE(bindingSig);
+            } else if (ser_action.ForRead()) {
+                bindingSig.fill(0);
+            }
         }
     }
 
@@ -782,4 +857,12 @@ struct CMutableTransaction
     uint256 GetHash() const;
 };
 
+/**
+ * A transaction shared between the block, mempool and relay structures that
+ * hold it, so that it is deserialized once and never copied.
+ */
+typedef std::shared_ptr<const CTransaction> CTransactionRef;
+static inline CTransactionRef MakeTransactionRef() { return std::make_shared<const CTransaction>(); }
+template <typename Tx> static inline CTransactionRef MakeTransactionRef(Tx&& txIn) { return std::make_shared<const CTransaction>(std::forward<Tx>(txIn)); }
+
 #endif // BITCOIN_PRIMITIVES_TRANSACTION_H
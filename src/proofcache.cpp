@@ -0,0 +1,85 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "proofcache.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "cuckoocache.h"
+#include "random.h"
+#include "util.h"
+
+#include <boost/thread.hpp>
+
+namespace {
+
+/**
+ * Fixed-size cuckoo cache of salted (txid, branch id) digests, as the
+ * signature cache keeps. The per-process salt keeps peers from predicting
+ * where an entry is kept.
+ */
+class CProofCache
+{
+private:
+    uint256 salt;
+    CuckooCache::cache<uint256, CuckooCache::random_blob_hasher> setValid;
+    boost::shared_mutex cs_proofcache;
+
+    uint256 ComputeEntry(const uint256& txid, uint32_t consensusBranchId) const
+    {
+        unsigned char branchId[4];
+        WriteLE32(branchId, consensusBranchId);
+
+        uint256 entry;
+        CSHA256()
+            .Write(salt.begin(), salt.size())
+            .Write(txid.begin(), txid.size())
+            .Write(branchId, sizeof(branchId))
+            .Finalize(entry.begin());
+        return entry;
+    }
+
+public:
+    CProofCache() : salt(GetRandHash())
+    {
+        int64_t nMaxCacheSize = GetArg("-maxproofcachesize", DEFAULT_MAX_PROOF_CACHE_SIZE);
+        setValid.setup(std::max<int64_t>(0, std::min<int64_t>(nMaxCacheSize, MAX_MAX_PROOF_CACHE_SIZE)));
+    }
+
+    // Entries are kept after a lookup, as a transaction's proofs are
+    // looked up again when its block is connected.
+    bool Get(const uint256& txid, uint32_t consensusBranchId)
+    {
+        uint256 entry = ComputeEntry(txid, consensusBranchId);
+
+        boost::shared_lock<boost::shared_mutex> lock(cs_proofcache);
+        return setValid.contains(entry, false);
+    }
+
+    void Set(const uint256& txid, uint32_t consensusBranchId)
+    {
+        uint256 entry = ComputeEntry(txid, consensusBranchId);
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_proofcache);
+        setValid.insert(entry);
+    }
+};
+
+CProofCache& GetProofCache()
+{
+    static CProofCache proofCache;
+    return proofCache;
+}
+
+}
+
+bool GetProofCacheEntry(const uint256& txid, uint32_t consensusBranchId)
+{
+    return GetProofCache().Get(txid, consensusBranchId);
+}
+
+void SetProofCacheEntry(const uint256& txid, uint32_t consensusBranchId)
+{
+    GetProofCache().Set(txid, consensusBranchId);
+}
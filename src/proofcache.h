@@ -0,0 +1,30 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_PROOFCACHE_H
+#define BITCOIN_PROOFCACHE_H
+
+#include "uint256.h"
+
+#include <stdint.h>
+
+/** Default for -maxproofcachesize, the number of verified shielded transactions remembered */
+static const int64_t DEFAULT_MAX_PROOF_CACHE_SIZE = 20000;
+/** Largest -maxproofcachesize allowed */
+static const int64_t MAX_MAX_PROOF_CACHE_SIZE = 1 << 24;
+
+/**
+ * Valid shielded transaction cache, to avoid verifying the JoinSplit and
+ * Sapling proofs and the joinsplit/binding signatures of a transaction twice
+ * (once when accepted into memory pool, and again when accepted into the
+ * block chain).
+ *
+ * Entries are keyed by (txid, consensus branch id): the txid commits to every
+ * proof and signature in the transaction, and the branch id fixes the
+ * signature hash those signatures were checked against.
+ */
+bool GetProofCacheEntry(const uint256& txid, uint32_t consensusBranchId);
+void SetProofCacheEntry(const uint256& txid, uint32_t consensusBranchId);
+
+#endif // BITCOIN_PROOFCACHE_H
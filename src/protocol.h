@@ -168,6 +168,9 @@ enum {
     // Nodes may always request a MSG_FILTERED_BLOCK in a getdata, however,
     // MSG_FILTERED_BLOCK should not appear in any invs except as a part of getdata.
     MSG_FILTERED_BLOCK,
+    // Like MSG_FILTERED_BLOCK, MSG_CMPCT_BLOCK is only asked for in a getdata
+    // and answered with a cmpctblock.
+    MSG_CMPCT_BLOCK,
 };
 
 #endif // BITCOIN_PROTOCOL_H
@@ -32,10 +32,75 @@
 #include <QTreeWidget>
 #include <QTreeWidgetItem>
 
+#include <map>
+
 QList<CAmount> CoinControlDialog::payAmounts;
 CCoinControl* CoinControlDialog::coinControl = new CCoinControl();
 bool CoinControlDialog::fSubtractFeeFromAmount = false;
 
+namespace {
+
+//! What a selected coin adds to the totals of updateLabels
+struct CCoinControlInput
+{
+    CAmount nValue;
+    double dPriority; //!< value times depth plus one
+    unsigned int nBytes;
+    bool fUncompressed;
+};
+
+/**
+ * The running totals of the selected coins, and what each of them adds,
+ * so that updateLabels only looks up the coins selected since it last ran
+ * instead of all of them. Depths change with the tip, so everything is
+ * looked up again when it moves.
+ */
+struct CCoinControlTotals
+{
+    std::map<COutPoint, CCoinControlInput> mapInputs;
+    int nHeight;
+    CAmount nAmount;
+    double dPriorityInputs;
+    unsigned int nBytesInputs;
+    int nQuantityUncompressed;
+
+    CCoinControlTotals() : nHeight(-1) { Clear(); }
+
+    void Clear()
+    {
+        mapInputs.clear();
+        nAmount = 0;
+        dPriorityInputs = 0;
+        nBytesInputs = 0;
+        nQuantityUncompressed = 0;
+    }
+
+    void Add(const COutPoint& outpoint, const CCoinControlInput& input)
+    {
+        if (!mapInputs.insert(std::make_pair(outpoint, input)).second)
+            return;
+        nAmount += input.nValue;
+        dPriorityInputs += input.dPriority;
+        nBytesInputs += input.nBytes;
+        nQuantityUncompressed += input.fUncompressed;
+    }
+
+    void Remove(std::map<COutPoint, CCoinControlInput>::iterator it)
+    {
+        nAmount -= it->second.nValue;
+        dPriorityInputs -= it->second.dPriority;
+        nBytesInputs -= it->second.nBytes;
+        nQuantityUncompressed -= it->second.fUncompressed;
+        mapInputs.erase(it);
+        if (mapInputs.empty())
+            Clear(); // no rounding left over in the priority
+    }
+};
+
+CCoinControlTotals coinControlTotals;
+
+} // anon namespace
+
 bool CCoinControlWidgetItem::operator<(const QTreeWidgetItem &other) const {
     int column = treeWidget()->sortColumn();
     if (column == CoinControlDialog::COLUMN_AMOUNT || column == CoinControlDialog::COLUMN_DATE || column == CoinControlDialog::COLUMN_CONFIRMATIONS)
@@ -113,6 +178,9 @@ CoinControlDialog::CoinControlDialog(const PlatformStyle *platformStyle, QWidget
     // click on checkbox
     connect(ui->treeWidget, SIGNAL(itemChanged(QTreeWidgetItem*, int)), this, SLOT(viewItemChanged(QTreeWidgetItem*, int)));
 
+    // tree mode: add the outputs of a wallet address once it is expanded
+    connect(ui->treeWidget, SIGNAL(itemExpanded(QTreeWidgetItem*)), this, SLOT(populateGroup(QTreeWidgetItem*)));
+
     // click on header
 #if QT_VERSION < 0x050000
     ui->treeWidget->header()->setClickable(true);
@@ -402,6 +470,25 @@ void CoinControlDialog::viewItemChanged(QTreeWidgetItem* item, int column)
             CoinControlDialog::updateLabels(model, this);
     }
 
+    // tree mode: (un)select the outputs of a wallet address not expanded yet
+    else if (column == COLUMN_CHECKBOX && isUnpopulatedGroup(item))
+    {
+        std::map<QString, std::vector<COutPoint> >::const_iterator it = mapCoinGroups.find(item->text(COLUMN_ADDRESS));
+        if (it != mapCoinGroups.end())
+        {
+            bool fSelect = item->checkState(COLUMN_CHECKBOX) != Qt::Unchecked;
+            BOOST_FOREACH(const COutPoint& outpt, it->second)
+            {
+                if (!fSelect)
+                    coinControl->UnSelect(outpt);
+                else if (!model->isLockedCoin(outpt.hash, outpt.n))
+                    coinControl->Select(outpt);
+            }
+            if (ui->treeWidget->isEnabled()) // do not update on every click for (un)select all
+                CoinControlDialog::updateLabels(model, this);
+        }
+    }
+
     // TODO: Remove this temporary qt5 fix after Qt5.3 and Qt5.4 are no longer used.
     //       Fixed in Qt5.5 and above: https://bugreports.qt.io/browse/QTBUG-43473
 #if QT_VERSION >= 0x050000
@@ -468,22 +555,38 @@ void CoinControlDialog::updateLabels(WalletModel *model, QDialog* dialog)
     }
 
     QString sPriorityLabel      = tr("none");
-    CAmount nAmount             = 0;
     CAmount nPayFee             = 0;
     CAmount nAfterFee           = 0;
     CAmount nChange             = 0;
     unsigned int nBytes         = 0;
-    unsigned int nBytesInputs   = 0;
     double dPriority            = 0;
-    double dPriorityInputs      = 0;
-    unsigned int nQuantity      = 0;
-    int nQuantityUncompressed   = 0;
     bool fAllowFree             = false;
 
+    // Bring the totals in step with the selection, both sorted by outpoint
+    CCoinControlTotals& totals = coinControlTotals;
+    {
+        LOCK(cs_main);
+        if (totals.nHeight != chainActive.Height())
+            totals.Clear();
+        totals.nHeight = chainActive.Height();
+    }
     std::vector<COutPoint> vCoinControl;
-    std::vector<COutput>   vOutputs;
+    std::vector<COutPoint> vNew;
     coinControl->ListSelected(vCoinControl);
-    model->getOutputs(vCoinControl, vOutputs);
+    std::map<COutPoint, CCoinControlInput>::iterator it = totals.mapInputs.begin();
+    BOOST_FOREACH(const COutPoint& outpt, vCoinControl) {
+        while (it != totals.mapInputs.end() && it->first < outpt)
+            totals.Remove(it++);
+        if (it != totals.mapInputs.end() && it->first == outpt)
+            ++it;
+        else
+            vNew.push_back(outpt);
+    }
+    while (it != totals.mapInputs.end())
+        totals.Remove(it++);
+
+    std::vector<COutput>   vOutputs;
+    model->getOutputs(vNew, vOutputs);
 
     BOOST_FOREACH(const COutput& out, vOutputs) {
         // unselect already spent, very unlikely scenario, this could happen
@@ -496,14 +599,11 @@ void CoinControlDialog::updateLabels(WalletModel *model, QDialog* dialog)
             continue;
         }
 
-        // Quantity
-        nQuantity++;
-
-        // Amount
-        nAmount += out.tx->vout[out.i].nValue;
-
-        // Priority
-        dPriorityInputs += (double)out.tx->vout[out.i].nValue * (out.nDepth+1);
+        CCoinControlInput input;
+        input.nValue = out.tx->vout[out.i].nValue;
+        input.dPriority = (double)out.tx->vout[out.i].nValue * (out.nDepth+1);
+        input.nBytes = 148; // in all error cases, simply assume 148 here
+        input.fUncompressed = false;
 
         // Bytes
         CTxDestination address;
@@ -511,18 +611,21 @@ void CoinControlDialog::updateLabels(WalletModel *model, QDialog* dialog)
         {
             CPubKey pubkey;
             CKeyID *keyid = boost::get<CKeyID>(&address);
-            if (keyid && model->getPubKey(*keyid, pubkey))
+            if (keyid && model->getPubKey(*keyid, pubkey) && !pubkey.IsCompressed())
             {
-                nBytesInputs += (pubkey.IsCompressed() ? 148 : 180);
-                if (!pubkey.IsCompressed())
-                    nQuantityUncompressed++;
+                input.nBytes = 180;
+                input.fUncompressed = true;
             }
-            else
-                nBytesInputs += 148; // in all error cases, simply assume 148 here
         }
-        else nBytesInputs += 148;
+        totals.Add(outpt, input);
     }
 
+    unsigned int nQuantity      = totals.mapInputs.size();
+    CAmount nAmount             = totals.nAmount;
+    unsigned int nBytesInputs   = totals.nBytesInputs;
+    double dPriorityInputs      = totals.dPriorityInputs;
+    int nQuantityUncompressed   = totals.nQuantityUncompressed;
+
     // calculation
     if (nQuantity > 0)
     {
@@ -667,6 +770,134 @@ void CoinControlDialog::updateLabels(WalletModel *model, QDialog* dialog)
         label->setVisible(nChange < 0);
 }
 
+// bytes the priority of an input of out ignores beyond the free area, cached per key
+int CoinControlDialog::getInputSize(const COutput& out)
+{
+    CTxDestination outputAddress;
+    if (!ExtractDestination(out.tx->vout[out.i].scriptPubKey, outputAddress))
+        return 0;
+    CKeyID *keyid = boost::get<CKeyID>(&outputAddress);
+    if (!keyid)
+        return 0;
+    std::map<CKeyID, int>::const_iterator it = mapInputSize.find(*keyid);
+    if (it != mapInputSize.end())
+        return it->second;
+    CPubKey pubkey;
+    int nInputSize = 0;
+    if (model->getPubKey(*keyid, pubkey) && !pubkey.IsCompressed())
+        nInputSize = 29; // 29 = 180 - 151 (public key is 180 bytes, priority free area is 151 bytes)
+    mapInputSize[*keyid] = nInputSize;
+    return nInputSize;
+}
+
+void CoinControlDialog::addOutputItem(QTreeWidgetItem *parent, const COutput& out, const QString& sWalletAddress, const QString& sWalletLabel,
+                                      int nDisplayUnit, double mempoolEstimatePriority)
+{
+    bool treeMode = parent != NULL;
+    QFlags<Qt::ItemFlag> flgCheckbox = Qt::ItemIsSelectable | Qt::ItemIsEnabled | Qt::ItemIsUserCheckable;
+
+    CCoinControlWidgetItem *itemOutput;
+    if (treeMode)    itemOutput = new CCoinControlWidgetItem(parent);
+    else             itemOutput = new CCoinControlWidgetItem(ui->treeWidget);
+    itemOutput->setFlags(flgCheckbox);
+    itemOutput->setCheckState(COLUMN_CHECKBOX,Qt::Unchecked);
+
+    // address
+    CTxDestination outputAddress;
+    QString sAddress = "";
+    if(ExtractDestination(out.tx->vout[out.i].scriptPubKey, outputAddress))
+    {
+        sAddress = QString::fromStdString(EncodeDestination(outputAddress));
+
+        // if listMode or change => show bitcoin address. In tree mode, address is not shown again for direct wallet address outputs
+        if (!treeMode || (!(sAddress == sWalletAddress)))
+            itemOutput->setText(COLUMN_ADDRESS, sAddress);
+    }
+    int nInputSize = getInputSize(out);
+
+    // label
+    if (!(sAddress == sWalletAddress)) // change
+    {
+        // tooltip from where the change comes from
+        itemOutput->setToolTip(COLUMN_LABEL, tr("change from %1 (%2)").arg(sWalletLabel).arg(sWalletAddress));
+        itemOutput->setText(COLUMN_LABEL, tr("(change)"));
+    }
+    else if (!treeMode)
+    {
+        QString sLabel = model->getAddressTableModel()->labelForAddress(sAddress);
+        if (sLabel.isEmpty())
+            sLabel = tr("(no label)");
+        itemOutput->setText(COLUMN_LABEL, sLabel);
+    }
+
+    // amount
+    itemOutput->setText(COLUMN_AMOUNT, BitcoinUnits::format(nDisplayUnit, out.tx->vout[out.i].nValue));
+    itemOutput->setData(COLUMN_AMOUNT, Qt::UserRole, QVariant((qlonglong)out.tx->vout[out.i].nValue)); // padding so that sorting works correctly
+
+    // date
+    itemOutput->setText(COLUMN_DATE, GUIUtil::dateTimeStr(out.tx->GetTxTime()));
+    itemOutput->setData(COLUMN_DATE, Qt::UserRole, QVariant((qlonglong)out.tx->GetTxTime()));
+
+    // confirmations
+    itemOutput->setText(COLUMN_CONFIRMATIONS, QString::number(out.nDepth));
+    itemOutput->setData(COLUMN_CONFIRMATIONS, Qt::UserRole, QVariant((qlonglong)out.nDepth));
+
+    // priority
+    double dPriority = ((double)out.tx->vout[out.i].nValue  / (nInputSize + 78)) * (out.nDepth+1); // 78 = 2 * 34 + 10
+    itemOutput->setText(COLUMN_PRIORITY, CoinControlDialog::getPriorityLabel(dPriority, mempoolEstimatePriority));
+    itemOutput->setData(COLUMN_PRIORITY, Qt::UserRole, QVariant((qlonglong)dPriority));
+
+    // transaction hash
+    uint256 txhash = out.tx->GetHash();
+    itemOutput->setText(COLUMN_TXHASH, QString::fromStdString(txhash.GetHex()));
+
+    // vout index
+    itemOutput->setText(COLUMN_VOUT_INDEX, QString::number(out.i));
+
+     // disable locked coins
+    if (model->isLockedCoin(txhash, out.i))
+    {
+        COutPoint outpt(txhash, out.i);
+        coinControl->UnSelect(outpt); // just to be sure
+        itemOutput->setDisabled(true);
+        itemOutput->setIcon(COLUMN_CHECKBOX, platformStyle->MultiColorIcon(":/images/locked"));
+    }
+
+    // set checkbox
+    if (coinControl->IsSelected(txhash, out.i))
+        itemOutput->setCheckState(COLUMN_CHECKBOX, Qt::Checked);
+}
+
+// whether item is a wallet address of tree mode whose outputs have not been added yet
+bool CoinControlDialog::isUnpopulatedGroup(QTreeWidgetItem *item) const
+{
+    return ui->radioTreeMode->isChecked() && !item->parent() && !item->data(COLUMN_CHECKBOX, Qt::UserRole).toBool();
+}
+
+// tree mode: add the outputs of a wallet address when it is first expanded
+void CoinControlDialog::populateGroup(QTreeWidgetItem *item)
+{
+    if (!model || !isUnpopulatedGroup(item))
+        return;
+    std::map<QString, std::vector<COutPoint> >::const_iterator it = mapCoinGroups.find(item->text(COLUMN_ADDRESS));
+    if (it == mapCoinGroups.end())
+        return;
+    item->setData(COLUMN_CHECKBOX, Qt::UserRole, true);
+
+    std::vector<COutput> vOutputs;
+    model->getOutputs(it->second, vOutputs);
+    int nDisplayUnit = model->getOptionsModel()->getDisplayUnit();
+    double mempoolEstimatePriority = mempool.estimatePriority(nTxConfirmTarget);
+    QString sWalletLabel = item->text(COLUMN_LABEL);
+
+    bool fEnabled = ui->treeWidget->isEnabled();
+    ui->treeWidget->setEnabled(false); // performance, otherwise updateLabels would be called for every checked checkbox
+    BOOST_FOREACH(const COutput& out, vOutputs)
+        addOutputItem(item, out, it->first, sWalletLabel, nDisplayUnit, mempoolEstimatePriority);
+    item->sortChildren(sortColumn, sortOrder);
+    ui->treeWidget->setEnabled(fEnabled);
+}
+
 void CoinControlDialog::updateView()
 {
     if (!model || !model->getOptionsModel() || !model->getAddressTableModel())
@@ -677,7 +908,6 @@ void CoinControlDialog::updateView()
     ui->treeWidget->clear();
     ui->treeWidget->setEnabled(false); // performance, otherwise updateLabels would be called for every checked checkbox
     ui->treeWidget->setAlternatingRowColors(!treeMode);
-    QFlags<Qt::ItemFlag> flgCheckbox = Qt::ItemIsSelectable | Qt::ItemIsEnabled | Qt::ItemIsUserCheckable;
     QFlags<Qt::ItemFlag> flgTristate = Qt::ItemIsSelectable | Qt::ItemIsEnabled | Qt::ItemIsUserCheckable | Qt::ItemIsTristate;
 
     int nDisplayUnit = model->getOptionsModel()->getDisplayUnit();
@@ -685,127 +915,70 @@ void CoinControlDialog::updateView()
 
     std::map<QString, std::vector<COutput> > mapCoins;
     model->listCoins(mapCoins);
+    mapCoinGroups.clear();
+    mapInputSize.clear();
 
     BOOST_FOREACH(const PAIRTYPE(QString, std::vector<COutput>)& coins, mapCoins) {
-        CCoinControlWidgetItem *itemWalletAddress = new CCoinControlWidgetItem();
-        itemWalletAddress->setCheckState(COLUMN_CHECKBOX, Qt::Unchecked);
         QString sWalletAddress = coins.first;
         QString sWalletLabel = model->getAddressTableModel()->labelForAddress(sWalletAddress);
         if (sWalletLabel.isEmpty())
             sWalletLabel = tr("(no label)");
 
-        if (treeMode)
+        if (!treeMode)
         {
-            // wallet address
-            ui->treeWidget->addTopLevelItem(itemWalletAddress);
-
-            itemWalletAddress->setFlags(flgTristate);
-            itemWalletAddress->setCheckState(COLUMN_CHECKBOX, Qt::Unchecked);
-
-            // label
-            itemWalletAddress->setText(COLUMN_LABEL, sWalletLabel);
-
-            // address
-            itemWalletAddress->setText(COLUMN_ADDRESS, sWalletAddress);
+            BOOST_FOREACH(const COutput& out, coins.second)
+                addOutputItem(NULL, out, sWalletAddress, sWalletLabel, nDisplayUnit, mempoolEstimatePriority);
+            continue;
         }
 
+        // wallet address, whose outputs are only added once it is expanded; it
+        // goes into the view only once set up, so that its check state is not
+        // taken for the user's
+        CCoinControlWidgetItem *itemWalletAddress = new CCoinControlWidgetItem();
+        itemWalletAddress->setFlags(flgTristate);
+        itemWalletAddress->setChildIndicatorPolicy(QTreeWidgetItem::ShowIndicator);
+        itemWalletAddress->setText(COLUMN_LABEL, sWalletLabel);
+        itemWalletAddress->setText(COLUMN_ADDRESS, sWalletAddress);
+
+        std::vector<COutPoint>& vOutpoints = mapCoinGroups[sWalletAddress];
         CAmount nSum = 0;
         double dPrioritySum = 0;
-        int nChildren = 0;
         int nInputSum = 0;
+        int nSelectable = 0;
+        int nSelected = 0;
         BOOST_FOREACH(const COutput& out, coins.second) {
-            int nInputSize = 0;
             nSum += out.tx->vout[out.i].nValue;
-            nChildren++;
-
-            CCoinControlWidgetItem *itemOutput;
-            if (treeMode)    itemOutput = new CCoinControlWidgetItem(itemWalletAddress);
-            else             itemOutput = new CCoinControlWidgetItem(ui->treeWidget);
-            itemOutput->setFlags(flgCheckbox);
-            itemOutput->setCheckState(COLUMN_CHECKBOX,Qt::Unchecked);
-
-            // address
-            CTxDestination outputAddress;
-            QString sAddress = "";
-            if(ExtractDestination(out.tx->vout[out.i].scriptPubKey, outputAddress))
-            {
-                sAddress = QString::fromStdString(EncodeDestination(outputAddress));
-
-                // if listMode or change => show bitcoin address. In tree mode, address is not shown again for direct wallet address outputs
-                if (!treeMode || (!(sAddress == sWalletAddress)))
-                    itemOutput->setText(COLUMN_ADDRESS, sAddress);
-
-                CPubKey pubkey;
-                CKeyID *keyid = boost::get<CKeyID>(&outputAddress);
-                if (keyid && model->getPubKey(*keyid, pubkey) && !pubkey.IsCompressed())
-                    nInputSize = 29; // 29 = 180 - 151 (public key is 180 bytes, priority free area is 151 bytes)
-            }
-
-            // label
-            if (!(sAddress == sWalletAddress)) // change
-            {
-                // tooltip from where the change comes from
-                itemOutput->setToolTip(COLUMN_LABEL, tr("change from %1 (%2)").arg(sWalletLabel).arg(sWalletAddress));
-                itemOutput->setText(COLUMN_LABEL, tr("(change)"));
-            }
-            else if (!treeMode)
-            {
-                QString sLabel = model->getAddressTableModel()->labelForAddress(sAddress);
-                if (sLabel.isEmpty())
-                    sLabel = tr("(no label)");
-                itemOutput->setText(COLUMN_LABEL, sLabel);
-            }
-
-            // amount
-            itemOutput->setText(COLUMN_AMOUNT, BitcoinUnits::format(nDisplayUnit, out.tx->vout[out.i].nValue));
-            itemOutput->setData(COLUMN_AMOUNT, Qt::UserRole, QVariant((qlonglong)out.tx->vout[out.i].nValue)); // padding so that sorting works correctly
-
-            // date
-            itemOutput->setText(COLUMN_DATE, GUIUtil::dateTimeStr(out.tx->GetTxTime()));
-            itemOutput->setData(COLUMN_DATE, Qt::UserRole, QVariant((qlonglong)out.tx->GetTxTime()));
-
-            // confirmations
-            itemOutput->setText(COLUMN_CONFIRMATIONS, QString::number(out.nDepth));
-            itemOutput->setData(COLUMN_CONFIRMATIONS, Qt::UserRole, QVariant((qlonglong)out.nDepth));
-
-            // priority
-            double dPriority = ((double)out.tx->vout[out.i].nValue  / (nInputSize + 78)) * (out.nDepth+1); // 78 = 2 * 34 + 10
-            itemOutput->setText(COLUMN_PRIORITY, CoinControlDialog::getPriorityLabel(dPriority, mempoolEstimatePriority));
-            itemOutput->setData(COLUMN_PRIORITY, Qt::UserRole, QVariant((qlonglong)dPriority));
             dPrioritySum += (double)out.tx->vout[out.i].nValue  * (out.nDepth+1);
-            nInputSum    += nInputSize;
+            nInputSum    += getInputSize(out);
 
-            // transaction hash
             uint256 txhash = out.tx->GetHash();
-            itemOutput->setText(COLUMN_TXHASH, QString::fromStdString(txhash.GetHex()));
-
-            // vout index
-            itemOutput->setText(COLUMN_VOUT_INDEX, QString::number(out.i));
-
-             // disable locked coins
+            vOutpoints.push_back(COutPoint(txhash, out.i));
             if (model->isLockedCoin(txhash, out.i))
             {
-                COutPoint outpt(txhash, out.i);
-                coinControl->UnSelect(outpt); // just to be sure
-                itemOutput->setDisabled(true);
-                itemOutput->setIcon(COLUMN_CHECKBOX, platformStyle->MultiColorIcon(":/images/locked"));
+                coinControl->UnSelect(vOutpoints.back()); // just to be sure
+                continue;
             }
-
-            // set checkbox
+            nSelectable++;
             if (coinControl->IsSelected(txhash, out.i))
-                itemOutput->setCheckState(COLUMN_CHECKBOX, Qt::Checked);
+                nSelected++;
         }
 
+        // the check state its outputs would give it
+        if (nSelected == 0)
+            itemWalletAddress->setCheckState(COLUMN_CHECKBOX, Qt::Unchecked);
+        else if (nSelected == nSelectable)
+            itemWalletAddress->setCheckState(COLUMN_CHECKBOX, Qt::Checked);
+        else
+            itemWalletAddress->setCheckState(COLUMN_CHECKBOX, Qt::PartiallyChecked);
+
         // amount
-        if (treeMode)
-        {
-            dPrioritySum = dPrioritySum / (nInputSum + 78);
-            itemWalletAddress->setText(COLUMN_CHECKBOX, "(" + QString::number(nChildren) + ")");
-            itemWalletAddress->setText(COLUMN_AMOUNT, BitcoinUnits::format(nDisplayUnit, nSum));
-            itemWalletAddress->setData(COLUMN_AMOUNT, Qt::UserRole, QVariant((qlonglong)nSum));
-            itemWalletAddress->setText(COLUMN_PRIORITY, CoinControlDialog::getPriorityLabel(dPrioritySum, mempoolEstimatePriority));
-            itemWalletAddress->setData(COLUMN_PRIORITY, Qt::UserRole, QVariant((qlonglong)dPrioritySum));
-        }
+        dPrioritySum = dPrioritySum / (nInputSum + 78);
+        itemWalletAddress->setText(COLUMN_CHECKBOX, "(" + QString::number(coins.second.size()) + ")");
+        itemWalletAddress->setText(COLUMN_AMOUNT, BitcoinUnits::format(nDisplayUnit, nSum));
+        itemWalletAddress->setData(COLUMN_AMOUNT, Qt::UserRole, QVariant((qlonglong)nSum));
+        itemWalletAddress->setText(COLUMN_PRIORITY, CoinControlDialog::getPriorityLabel(dPrioritySum, mempoolEstimatePriority));
+        itemWalletAddress->setData(COLUMN_PRIORITY, Qt::UserRole, QVariant((qlonglong)dPrioritySum));
+        ui->treeWidget->addTopLevelItem(itemWalletAddress);
     }
 
     // expand all partially selected
@@ -6,6 +6,11 @@
 #define BITCOIN_QT_COINCONTROLDIALOG_H
 
 #include "amount.h"
+#include "primitives/transaction.h"
+#include "pubkey.h"
+
+#include <map>
+#include <vector>
 
 #include <QAbstractButton>
 #include <QAction>
@@ -20,6 +25,7 @@ class PlatformStyle;
 class WalletModel;
 
 class CCoinControl;
+class COutput;
 class CTxMemPool;
 
 namespace Ui {
@@ -71,8 +77,17 @@ private:
 
     const PlatformStyle *platformStyle;
 
+    //! Tree mode: the outputs of each wallet address, added to the view when it is expanded
+    std::map<QString, std::vector<COutPoint> > mapCoinGroups;
+    //! Bytes of the input of each key that priority ignores, as looked up by getInputSize
+    std::map<CKeyID, int> mapInputSize;
+
     void sortView(int, Qt::SortOrder);
     void updateView();
+    int getInputSize(const COutput& out);
+    void addOutputItem(QTreeWidgetItem *parent, const COutput& out, const QString& sWalletAddress, const QString& sWalletLabel,
+                       int nDisplayUnit, double mempoolEstimatePriority);
+    bool isUnpopulatedGroup(QTreeWidgetItem *item) const;
 
     enum
     {
@@ -111,6 +126,7 @@ private Q_SLOTS:
     void buttonBoxClicked(QAbstractButton*);
     void buttonSelectAllClicked();
     void updateLabelLocked();
+    void populateGroup(QTreeWidgetItem*);
 };
 
 #endif // BITCOIN_QT_COINCONTROLDIALOG_H
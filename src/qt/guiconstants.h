@@ -8,6 +8,9 @@
 /* Milliseconds between model updates */
 static const int MODEL_UPDATE_DELAY = 250;
 
+/* TransactionTableModel -- Wallet transactions loaded per step, between which the GUI stays responsive */
+static const int TRANSACTION_LOAD_CHUNK = 500;
+
 /* AskPassphraseDialog -- Maximum passphrase length */
 static const int MAX_PASSPHRASE_SIZE = 1024;
 
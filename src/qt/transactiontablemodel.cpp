@@ -25,6 +25,9 @@
 #include <QDebug>
 #include <QIcon>
 #include <QList>
+#include <QTimer>
+
+#include <algorithm>
 
 #include <boost/foreach.hpp>
 
@@ -61,7 +64,8 @@ class TransactionTablePriv
 public:
     TransactionTablePriv(CWallet *wallet, TransactionTableModel *parent) :
         wallet(wallet),
-        parent(parent)
+        parent(parent),
+        nLoaded(0)
     {
     }
 
@@ -74,20 +78,85 @@ public:
      */
     QList<TransactionRecord> cachedWallet;
 
-    /* Query entire wallet anew from core.
+    /* Hashes of the wallet transactions when it was last queried, in the same
+     * order, and how many of them have been loaded into cachedWallet.
+     */
+    std::vector<uint256> vToLoad;
+    size_t nLoaded;
+
+    /* Query entire wallet anew from core. Only the hashes are taken here:
+     * the transactions are decomposed by loadChunk(), a chunk at a time.
      */
     void refreshWallet()
     {
         qDebug() << "TransactionTablePriv::refreshWallet";
         cachedWallet.clear();
+        vToLoad.clear();
+        nLoaded = 0;
         {
-            LOCK2(cs_main, wallet->cs_wallet);
+            LOCK(wallet->cs_wallet);
+            vToLoad.reserve(wallet->mapWallet.size());
             for(std::map<uint256, CWalletTx>::iterator it = wallet->mapWallet.begin(); it != wallet->mapWallet.end(); ++it)
+                vToLoad.push_back(it->first);
+        }
+    }
+
+    /* Load the next TRANSACTION_LOAD_CHUNK wallet transactions into the
+       model. Returns whether any are left to load.
+     */
+    bool loadChunk()
+    {
+        size_t nEnd = std::min(nLoaded + TRANSACTION_LOAD_CHUNK, vToLoad.size());
+        QList<TransactionRecord> loaded;
+        {
+            LOCK2(cs_main, wallet->cs_wallet);
+            for(; nLoaded < nEnd; nLoaded++)
+            {
+                const uint256 &hash = vToLoad[nLoaded];
+                // Notifications since the query may have removed the transaction or added it already
+                std::map<uint256, CWalletTx>::iterator mi = wallet->mapWallet.find(hash);
+                if(mi == wallet->mapWallet.end() || !TransactionRecord::showTransaction(mi->second))
+                    continue;
+                QList<TransactionRecord>::iterator lower = qLowerBound(
+                    cachedWallet.begin(), cachedWallet.end(), hash, TxLessThan());
+                if(lower != cachedWallet.end() && lower->hash == hash)
+                    continue;
+                loaded.append(TransactionRecord::decomposeTransaction(wallet, mi->second));
+            }
+        }
+
+        // Loaded rows are old transactions, so keep the view from announcing them as new
+        bool fProcessingQueued = parent->fProcessingQueuedTransactions;
+        parent->fProcessingQueuedTransactions = true;
+        // Insert in runs, each as many rows as go before the same cached one;
+        // unless notifications added rows meanwhile that is a single run
+        int i = 0;
+        while(i < loaded.size())
+        {
+            QList<TransactionRecord>::iterator lower = qLowerBound(
+                cachedWallet.begin(), cachedWallet.end(), loaded[i].hash, TxLessThan());
+            int insertIndex = (lower - cachedWallet.begin());
+            int end = i + 1;
+            if(lower == cachedWallet.end())
+                end = loaded.size();
+            else
+                while(end < loaded.size() && loaded[end].hash < lower->hash)
+                    end++;
+            parent->beginInsertRows(QModelIndex(), insertIndex, insertIndex+(end-i)-1);
+            for(; i < end; i++)
             {
-                if(TransactionRecord::showTransaction(it->second))
-                    cachedWallet.append(TransactionRecord::decomposeTransaction(wallet, it->second));
+                cachedWallet.insert(insertIndex, loaded[i]);
+                insertIndex += 1;
             }
+            parent->endInsertRows();
         }
+        parent->fProcessingQueuedTransactions = fProcessingQueued;
+
+        if(nLoaded < vToLoad.size())
+            return true;
+        std::vector<uint256>().swap(vToLoad);
+        nLoaded = 0;
+        return false;
     }
 
     /* Update our model of the wallet incrementally, to synchronize our model of the wallet
@@ -249,6 +318,8 @@ TransactionTableModel::TransactionTableModel(const PlatformStyle *platformStyle,
     connect(walletModel->getOptionsModel(), SIGNAL(displayUnitChanged(int)), this, SLOT(updateDisplayUnit()));
 
     subscribeToCoreSignals();
+
+    QTimer::singleShot(0, this, SLOT(loadMoreTransactions()));
 }
 
 TransactionTableModel::~TransactionTableModel()
@@ -272,6 +343,12 @@ void TransactionTableModel::updateTransaction(const QString &hash, int status, b
     priv->updateWallet(updated, status, showTransaction);
 }
 
+void TransactionTableModel::loadMoreTransactions()
+{
+    if(priv->loadChunk())
+        QTimer::singleShot(0, this, SLOT(loadMoreTransactions()));
+}
+
 void TransactionTableModel::updateConfirmations()
 {
     // Blocks came in since last poll.
@@ -713,6 +790,9 @@ public:
     TransactionNotification(uint256 hash, ChangeType status, bool showTransaction):
         hash(hash), status(status), showTransaction(showTransaction) {}
 
+    const uint256 &getHash() const { return hash; }
+    bool getShowTransaction() const { return showTransaction; }
+
     void invoke(QObject *ttm)
     {
         QString strHash = QString::fromStdString(hash.GetHex());
@@ -731,6 +811,11 @@ private:
 static bool fQueueNotifications = false;
 static std::vector< TransactionNotification > vQueueNotifications;
 
+// notifications not yet taken by the GUI thread, so that a block changing
+// many transactions posts one batch rather than an event per transaction
+static CCriticalSection cs_pendingNotifications;
+static std::vector< TransactionNotification > vPendingNotifications;
+
 static void NotifyTransactionChanged(TransactionTableModel *ttm, CWallet *wallet, const uint256 &hash, ChangeType status)
 {
     // Find transaction in wallet
@@ -746,7 +831,34 @@ static void NotifyTransactionChanged(TransactionTableModel *ttm, CWallet *wallet
         vQueueNotifications.push_back(notification);
         return;
     }
-    notification.invoke(ttm);
+
+    {
+        LOCK(cs_pendingNotifications);
+        vPendingNotifications.push_back(notification);
+        // The batch is already posted
+        if (vPendingNotifications.size() > 1)
+            return;
+    }
+    QMetaObject::invokeMethod(ttm, "processPendingNotifications", Qt::QueuedConnection);
+}
+
+void TransactionTableModel::processPendingNotifications()
+{
+    std::vector<TransactionNotification> vNotifications;
+    {
+        LOCK(cs_pendingNotifications);
+        vNotifications.swap(vPendingNotifications);
+    }
+
+    // Only the latest notification of each transaction counts: as an update,
+    // it adds or removes the transaction's rows as the model needs
+    std::map<uint256, bool> mapLatest;
+    BOOST_FOREACH(const TransactionNotification &notification, vNotifications)
+        mapLatest[notification.getHash()] = notification.getShowTransaction();
+    qDebug() << "TransactionTableModel::processPendingNotifications: " + QString::number(vNotifications.size()) +
+                " notifications for " + QString::number(mapLatest.size()) + " transactions";
+    for (std::map<uint256, bool>::const_iterator it = mapLatest.begin(); it != mapLatest.end(); ++it)
+        priv->updateWallet(it->first, CT_UPDATED, it->second);
 }
 
 static void ShowProgress(TransactionTableModel *ttm, const std::string &title, int nProgress)
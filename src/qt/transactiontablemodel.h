@@ -107,6 +107,10 @@ private:
 public Q_SLOTS:
     /* New transaction, or transaction changed status */
     void updateTransaction(const QString &hash, int status, bool showTransaction);
+    /* Apply the transaction notifications queued from the core since the last call */
+    void processPendingNotifications();
+    /* Load the next chunk of the wallet's transactions, until all are loaded */
+    void loadMoreTransactions();
     void updateConfirmations();
     void updateDisplayUnit();
     /** Updates the column title to "Amount (DisplayUnit)" and emits headerDataChanged() signal for table headers to react. */
@@ -21,6 +21,7 @@
 #include "wallet/wallet.h"
 #include "wallet/walletdb.h" // for BackupWallet
 
+#include <atomic>
 #include <stdint.h>
 
 #include <QDebug>
@@ -29,14 +30,70 @@
 
 #include <boost/foreach.hpp>
 
+/* Object for computing the wallet's balances in a separate thread.
+ */
+class BalanceWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    BalanceWorker(const WalletModel *model, CWallet *wallet) : fQueued(false), model(model), wallet(wallet) {}
+
+    // Whether a computation has been requested and not yet started
+    std::atomic<bool> fQueued;
+
+public Q_SLOTS:
+    void compute();
+
+Q_SIGNALS:
+    void balancesChanged(const WalletBalances &balances);
+
+private:
+    const WalletModel *model;
+    CWallet *wallet;
+    // The balances last posted to the GUI thread
+    WalletBalances lastBalances;
+};
+
+#include "walletmodel.moc"
+
+void BalanceWorker::compute()
+{
+    fQueued = false;
+
+    WalletBalances balances;
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        CAmount zConfirmed = model->getZBalance(false);
+        CAmount zAll = model->getZBalance(true);
+        balances.tBalance = model->getTBalance();
+        balances.zBalance = zConfirmed;
+        balances.balance = balances.tBalance + zConfirmed;
+        balances.unconfirmedBalance = wallet->GetUnconfirmedBalance() + (zAll - zConfirmed);
+        balances.immatureBalance = wallet->GetImmatureBalance();
+        balances.unshielded = model->getUnshielded();
+
+        if (wallet->HaveWatchOnly())
+        {
+            balances.watchOnlyBalance = wallet->GetWatchOnlyBalance();
+            balances.watchUnconfBalance = wallet->GetUnconfirmedWatchOnlyBalance();
+            balances.watchImmatureBalance = wallet->GetImmatureWatchOnlyBalance();
+        }
+    }
+
+    if (balances == lastBalances)
+        return;
+    lastBalances = balances;
+    Q_EMIT balancesChanged(balances);
+}
+
 WalletModel::WalletModel(const PlatformStyle *platformStyle, CWallet *wallet, OptionsModel *optionsModel, QObject *parent) :
     QObject(parent), wallet(wallet), optionsModel(optionsModel), addressTableModel(0), coinSelectionTableModel(0),
     transactionTableModel(0),
     recentRequestsTableModel(0),
-    cachedBalance(0), cachedUnconfirmedBalance(0), cachedImmatureBalance(0),
     cachedEncryptionStatus(Unencrypted),
     cachedNumBlocks(0),
-    cachedTBalance(0), cachedZBalance(0), cachedUnshielded(0)
+    balanceWorker(0)
 {
     fHaveWatchOnly = wallet->HaveWatchOnly();
     fForceCheckBalanceChanged = false;
@@ -46,6 +103,15 @@ WalletModel::WalletModel(const PlatformStyle *platformStyle, CWallet *wallet, Op
     transactionTableModel = new TransactionTableModel(platformStyle, wallet, this);
     recentRequestsTableModel = new RecentRequestsTableModel(wallet, this);
 
+    qRegisterMetaType<WalletBalances>("WalletBalances");
+    balanceWorker = new BalanceWorker(this, wallet);
+    balanceWorker->moveToThread(&balanceThread);
+    connect(this, SIGNAL(balanceCheckRequested()), balanceWorker, SLOT(compute()));
+    connect(balanceWorker, SIGNAL(balancesChanged(WalletBalances)), this, SLOT(updateBalances(WalletBalances)));
+    // Delete the worker in its own thread once its event loop is done
+    connect(&balanceThread, SIGNAL(finished()), balanceWorker, SLOT(deleteLater()), Qt::DirectConnection);
+    balanceThread.start();
+
     // This timer will be fired repeatedly to update the balance
     pollTimer = new QTimer(this);
     connect(pollTimer, SIGNAL(timeout()), this, SLOT(pollBalanceChanged()));
@@ -57,6 +123,8 @@ WalletModel::WalletModel(const PlatformStyle *platformStyle, CWallet *wallet, Op
 WalletModel::~WalletModel()
 {
     unsubscribeFromCoreSignals();
+    balanceThread.quit();
+    balanceThread.wait();
 }
 
 CAmount WalletModel::getZBalance(bool showUnconfirmed) const
@@ -157,22 +225,18 @@ void WalletModel::updateStatus()
 
 void WalletModel::pollBalanceChanged()
 {
-    // Get required locks upfront. This avoids the GUI from getting stuck on
-    // periodical polls if the core is holding the locks for a longer time -
-    // for example, during a wallet rescan.
-    TRY_LOCK(cs_main, lockMain);
-    if(!lockMain)
-        return;
-    TRY_LOCK(wallet->cs_wallet, lockWallet);
-    if(!lockWallet)
-        return;
+    // The height is read from the chain tip snapshot and the balances are
+    // computed by the balance worker, so polls take none of the core's locks
+    // and never stall the GUI, for example during a wallet rescan.
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    int nHeight = tip ? tip->nHeight : -1;
 
-    if(fForceCheckBalanceChanged || chainActive.Height() != cachedNumBlocks)
+    if(fForceCheckBalanceChanged || nHeight != cachedNumBlocks)
     {
         fForceCheckBalanceChanged = false;
 
         // Balance and number of transactions might have changed
-        cachedNumBlocks = chainActive.Height();
+        cachedNumBlocks = nHeight;
 
         checkBalanceChanged();
         if(transactionTableModel)
@@ -182,43 +246,20 @@ void WalletModel::pollBalanceChanged()
 
 void WalletModel::checkBalanceChanged()
 {
-    CAmount newBalance = getBalance();
-    CAmount newUnconfirmedBalance = getUnconfirmedBalance();
-    CAmount newImmatureBalance = getImmatureBalance();
-    CAmount newWatchOnlyBalance = 0;
-    CAmount newWatchUnconfBalance = 0;
-    CAmount newWatchImmatureBalance = 0;
-
-    CAmount newTBalance = getTBalance();
-    CAmount newZBalance = getZBalance(false);
-    CAmount newUnshielded = getUnshielded();
-
-    if (haveWatchOnly())
-    {
-        newWatchOnlyBalance = getWatchBalance();
-        newWatchUnconfBalance = getWatchUnconfirmedBalance();
-        newWatchImmatureBalance = getWatchImmatureBalance();
-    }
+    // A computation still queued will see the wallet as it is now, so at
+    // most one is queued however often this is called
+    if(!balanceWorker->fQueued.exchange(true))
+        Q_EMIT balanceCheckRequested();
+}
 
-    if(cachedBalance != newBalance || cachedUnconfirmedBalance != newUnconfirmedBalance || cachedImmatureBalance != newImmatureBalance ||
-        cachedWatchOnlyBalance != newWatchOnlyBalance || cachedWatchUnconfBalance != newWatchUnconfBalance || cachedWatchImmatureBalance != newWatchImmatureBalance ||
-        cachedTBalance != newTBalance || cachedZBalance != newZBalance || cachedUnshielded != newUnshielded)
-    {
-        cachedBalance = newBalance;
-        cachedUnconfirmedBalance = newUnconfirmedBalance;
-        cachedImmatureBalance = newImmatureBalance;
-
-        cachedTBalance = newTBalance;
-        cachedZBalance = newZBalance;
-        cachedUnshielded = newUnshielded;
-
-        cachedWatchOnlyBalance = newWatchOnlyBalance;
-        cachedWatchUnconfBalance = newWatchUnconfBalance;
-        cachedWatchImmatureBalance = newWatchImmatureBalance;
-        Q_EMIT balanceChanged(newBalance, newUnconfirmedBalance, newImmatureBalance,
-                            newWatchOnlyBalance, newWatchUnconfBalance, newWatchImmatureBalance,
-                            newTBalance, newZBalance, newUnshielded);
-    }
+void WalletModel::updateBalances(const WalletBalances &balances)
+{
+    if(balances == cachedBalances)
+        return;
+    cachedBalances = balances;
+    Q_EMIT balanceChanged(balances.balance, balances.unconfirmedBalance, balances.immatureBalance,
+                        balances.watchOnlyBalance, balances.watchUnconfBalance, balances.watchImmatureBalance,
+                        balances.tBalance, balances.zBalance, balances.unshielded);
 }
 
 void WalletModel::updateTransaction()
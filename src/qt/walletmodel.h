@@ -14,9 +14,12 @@
 #include <map>
 #include <vector>
 
+#include <QMetaType>
 #include <QObject>
+#include <QThread>
 
 class AddressTableModel;
+class BalanceWorker;
 class CoinSelectionTableModel;
 class OptionsModel;
 class PlatformStyle;
@@ -96,6 +99,33 @@ public:
     }
 };
 
+/** Balances of a wallet, computed together by the balance worker */
+struct WalletBalances
+{
+    CAmount balance;
+    CAmount unconfirmedBalance;
+    CAmount immatureBalance;
+    CAmount watchOnlyBalance;
+    CAmount watchUnconfBalance;
+    CAmount watchImmatureBalance;
+    CAmount tBalance;
+    CAmount zBalance;
+    CAmount unshielded;
+
+    WalletBalances() : balance(0), unconfirmedBalance(0), immatureBalance(0),
+        watchOnlyBalance(0), watchUnconfBalance(0), watchImmatureBalance(0),
+        tBalance(0), zBalance(0), unshielded(0) {}
+
+    bool operator==(const WalletBalances &b) const
+    {
+        return balance == b.balance && unconfirmedBalance == b.unconfirmedBalance && immatureBalance == b.immatureBalance &&
+            watchOnlyBalance == b.watchOnlyBalance && watchUnconfBalance == b.watchUnconfBalance && watchImmatureBalance == b.watchImmatureBalance &&
+            tBalance == b.tBalance && zBalance == b.zBalance && unshielded == b.unshielded;
+    }
+};
+
+Q_DECLARE_METATYPE(WalletBalances)
+
 /** Interface to LitecoinZ wallet from Qt view code. */
 class WalletModel : public QObject
 {
@@ -223,27 +253,25 @@ private:
     RecentRequestsTableModel *recentRequestsTableModel;
 
     // Cache some values to be able to detect changes
-    CAmount cachedBalance;
-    CAmount cachedUnconfirmedBalance;
-    CAmount cachedImmatureBalance;
-    CAmount cachedWatchOnlyBalance;
-    CAmount cachedWatchUnconfBalance;
-    CAmount cachedWatchImmatureBalance;
-
-    CAmount cachedTBalance;
-    CAmount cachedZBalance;
-    CAmount cachedUnshielded;
+    WalletBalances cachedBalances;
 
     EncryptionStatus cachedEncryptionStatus;
     int cachedNumBlocks;
 
     QTimer *pollTimer;
 
+    // Balances are computed in this thread, so the GUI never waits for the core's locks
+    QThread balanceThread;
+    BalanceWorker *balanceWorker;
+
     void subscribeToCoreSignals();
     void unsubscribeFromCoreSignals();
     void checkBalanceChanged();
 
 Q_SIGNALS:
+    // Asks the balance worker to compute the balances
+    void balanceCheckRequested();
+
     // Signals that balance in wallet changed
     void balanceChanged(const CAmount& balance, const CAmount& unconfirmedBalance, const CAmount& immatureBalance,
                         const CAmount& watchOnlyBalance, const CAmount& watchUnconfBalance, const CAmount& watchImmatureBalance,
@@ -280,6 +308,8 @@ public Q_SLOTS:
     void updateWatchOnlyFlag(bool fHaveWatchonly);
     /* Current, immature or unconfirmed balance might have changed - emit 'balanceChanged' if so */
     void pollBalanceChanged();
+    /* Balances computed by the balance worker differ from the last ones */
+    void updateBalances(const WalletBalances &balances);
 };
 
 #endif // BITCOIN_QT_WALLETMODEL_H
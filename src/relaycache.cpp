@@ -0,0 +1,127 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "relaycache.h"
+
+#include "core_memusage.h"
+#include "memusage.h"
+#include "utiltime.h"
+
+size_t CRelayCache::EntryUsage(const CEntry& entry) const
+{
+    size_t nEntryUsage = memusage::MallocUsage(sizeof(memusage::stl_list_node<CEntry>)) +
+                         memusage::MallocUsage(sizeof(memusage::boost_unordered_node<std::pair<const uint256, EntryList::iterator> >)) +
+                         memusage::MallocUsage(sizeof(std::pair<int64_t, uint256>));
+    if (!entry.fInMempool)
+        nEntryUsage += memusage::DynamicUsage(entry.tx) + RecursiveDynamicUsage(*entry.tx);
+    return nEntryUsage;
+}
+
+void CRelayCache::EraseEntry(EntryList::iterator it)
+{
+    nUsage -= EntryUsage(*it);
+    mapEntries.erase(it->hash);
+    listEntries.erase(it);
+}
+
+void CRelayCache::Expire(int64_t nNow)
+{
+    while (!vExpiration.empty() && vExpiration.front().first < nNow) {
+        boost::unordered_map<uint256, EntryList::iterator, CCoinsKeyHasher>::iterator it = mapEntries.find(vExpiration.front().second);
+        // An entry relayed again has a later expiry of its own
+        if (it != mapEntries.end() && it->second->nExpire == vExpiration.front().first)
+            EraseEntry(it->second);
+        vExpiration.pop_front();
+    }
+}
+
+void CRelayCache::Trim()
+{
+    while (nUsage > nMaxUsage && !listEntries.empty())
+        EraseEntry(--listEntries.end());
+}
+
+void CRelayCache::SetLimit(size_t nMaxUsageIn)
+{
+    LOCK(cs);
+    nMaxUsage = nMaxUsageIn;
+    Trim();
+}
+
+void CRelayCache::Add(const CTransactionRef& tx, bool fInMempool)
+{
+    int64_t nNow = GetTime();
+    LOCK(cs);
+    Expire(nNow);
+    boost::unordered_map<uint256, EntryList::iterator, CCoinsKeyHasher>::iterator it = mapEntries.find(tx->GetHash());
+    if (it != mapEntries.end())
+        EraseEntry(it->second);
+    listEntries.push_front(CEntry());
+    CEntry& entry = listEntries.front();
+    entry.hash = tx->GetHash();
+    entry.tx = tx;
+    entry.nExpire = nNow + RELAY_CACHE_EXPIRY;
+    entry.fInMempool = fInMempool;
+    mapEntries[entry.hash] = listEntries.begin();
+    vExpiration.push_back(std::make_pair(entry.nExpire, entry.hash));
+    nUsage += EntryUsage(entry);
+    Trim();
+}
+
+CTransactionRef CRelayCache::Get(const uint256& hash)
+{
+    int64_t nNow = GetTime();
+    LOCK(cs);
+    Expire(nNow);
+    boost::unordered_map<uint256, EntryList::iterator, CCoinsKeyHasher>::iterator it = mapEntries.find(hash);
+    if (it == mapEntries.end()) {
+        nMisses++;
+        return CTransactionRef();
+    }
+    // Move to the front as the most recently used.
+    listEntries.splice(listEntries.begin(), listEntries, it->second);
+    nHits++;
+    return listEntries.front().tx;
+}
+
+void CRelayCache::RemovedFromMempool(const CTransaction& tx)
+{
+    LOCK(cs);
+    boost::unordered_map<uint256, EntryList::iterator, CCoinsKeyHasher>::iterator it = mapEntries.find(tx.GetHash());
+    if (it == mapEntries.end() || !it->second->fInMempool)
+        return;
+    CEntry& entry = *it->second;
+    nUsage -= EntryUsage(entry);
+    entry.fInMempool = false;
+    nUsage += EntryUsage(entry);
+    Trim();
+}
+
+void CRelayCache::Clear()
+{
+    LOCK(cs);
+    listEntries.clear();
+    mapEntries.clear();
+    vExpiration.clear();
+    nUsage = 0;
+}
+
+size_t CRelayCache::size() const
+{
+    LOCK(cs);
+    return listEntries.size();
+}
+
+size_t CRelayCache::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    return nUsage + memusage::MallocUsage(sizeof(void*) * mapEntries.bucket_count());
+}
+
+void CRelayCache::GetStats(uint64_t& nHitsOut, uint64_t& nMissesOut) const
+{
+    LOCK(cs);
+    nHitsOut = nHits;
+    nMissesOut = nMisses;
+}
@@ -0,0 +1,83 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RELAYCACHE_H
+#define BITCOIN_RELAYCACHE_H
+
+#include "coins.h"
+#include "primitives/transaction.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <deque>
+#include <list>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+
+#include <boost/unordered_map.hpp>
+
+/** Default for -relaycache, the MiB of relayed transactions no longer in the mempool kept for peers to fetch */
+static const int64_t DEFAULT_RELAY_CACHE = 16;
+/** Seconds a relayed transaction stays fetchable by the peers it was announced to */
+static const int64_t RELAY_CACHE_EXPIRY = 15 * 60;
+
+/**
+ * Transactions announced to peers, kept for RELAY_CACHE_EXPIRY seconds so
+ * that peers asking for them get them even if they have since left the
+ * mempool. The cache holds the transactions the mempool holds, by shared
+ * pointer, so while a transaction is in the mempool its entry costs only
+ * the bookkeeping. Apart from that, only the transactions that have left
+ * the mempool count against the configured number of bytes, and the least
+ * recently used entries are dropped first when it is exceeded.
+ */
+class CRelayCache
+{
+private:
+    struct CEntry
+    {
+        uint256 hash;
+        CTransactionRef tx;
+        int64_t nExpire;
+        //! Whether the mempool still holds tx, so that it costs us nothing
+        bool fInMempool;
+    };
+    typedef std::list<CEntry> EntryList;
+
+    mutable CCriticalSection cs;
+    size_t nMaxUsage;
+    size_t nUsage;
+    //! Most recently used first
+    EntryList listEntries;
+    boost::unordered_map<uint256, EntryList::iterator, CCoinsKeyHasher> mapEntries;
+    //! Expiry times in the order entries were added
+    std::deque<std::pair<int64_t, uint256> > vExpiration;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    size_t EntryUsage(const CEntry& entry) const;
+    void EraseEntry(EntryList::iterator it);
+    void Expire(int64_t nNow);
+    void Trim();
+
+public:
+    CRelayCache() : nMaxUsage(0), nUsage(0), nHits(0), nMisses(0) {}
+
+    //! Keep at most nMaxUsageIn bytes, transactions out of the mempool included
+    void SetLimit(size_t nMaxUsageIn);
+
+    //! Keep tx for relay; fInMempool tells whether the mempool shares it
+    void Add(const CTransactionRef& tx, bool fInMempool);
+    //! The unexpired relayed transaction hash, or NULL
+    CTransactionRef Get(const uint256& hash);
+    //! Connected to the mempool: tx now costs the cache its own memory
+    void RemovedFromMempool(const CTransaction& tx);
+    void Clear();
+
+    size_t size() const;
+    size_t DynamicMemoryUsage() const;
+    void GetStats(uint64_t& nHitsOut, uint64_t& nMissesOut) const;
+};
+
+#endif // BITCOIN_RELAYCACHE_H
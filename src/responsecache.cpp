@@ -0,0 +1,229 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "responsecache.h"
+
+#include "chain.h"
+#include "consensus/consensus.h"
+#include "crypto/sha256.h"
+#include "main.h"
+#include "memusage.h"
+#include "tinyformat.h"
+#include "utilstrencodings.h"
+
+#include <algorithm>
+
+// A reorg may disconnect up to COINBASE_MATURITY - 1 blocks, and the block
+// below those it disconnects gets another next block
+const int CResponseCache::MIN_DEPTH = COINBASE_MATURITY + 1;
+
+bool CanCacheResponse(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    return responseCache.IsEnabled() && chainActive.Contains(pindex) &&
+           CResponseCache::IsBuried(pindex->nHeight, chainActive.Height());
+}
+
+static size_t StringUsage(const std::string& str)
+{
+    // Short strings are kept inside the object
+    return str.capacity() > 15 ? memusage::MallocUsage(str.capacity() + 1) : 0;
+}
+
+size_t CResponseCache::EntryUsage(const CEntry& entry) const
+{
+    return memusage::MallocUsage(sizeof(memusage::stl_list_node<CEntry>)) +
+           memusage::MallocUsage(sizeof(memusage::boost_unordered_node<std::pair<const std::string, EntryList::iterator> >)) +
+           2 * StringUsage(entry.strKey) + StringUsage(entry.strHead) + StringUsage(entry.strTail) + StringUsage(entry.strTag);
+}
+
+void CResponseCache::EraseEntry(EntryList::iterator it)
+{
+    nUsage -= EntryUsage(*it);
+    mapEntries.erase(it->strKey);
+    listEntries.erase(it);
+}
+
+void CResponseCache::Trim()
+{
+    while (nUsage > nMaxUsage && !listEntries.empty())
+        EraseEntry(--listEntries.end());
+}
+
+void CResponseCache::SetLimit(size_t nMaxUsageIn)
+{
+    LOCK(cs);
+    nMaxUsage = nMaxUsageIn;
+    Trim();
+}
+
+bool CResponseCache::IsEnabled() const
+{
+    LOCK(cs);
+    return nMaxUsage > 0;
+}
+
+std::string CResponseCache::MakeKey(const std::string& strMethod, const std::string& strParams, const std::string& strFormat)
+{
+    std::string strKey = strMethod;
+    strKey += '\0';
+    strKey += strParams;
+    strKey += '\0';
+    strKey += strFormat;
+    return strKey;
+}
+
+bool CResponseCache::IsBuried(int nHeight, int nTipHeight)
+{
+    return nHeight >= 0 && nTipHeight - nHeight + 1 >= MIN_DEPTH;
+}
+
+bool CResponseCache::MatchesTag(const std::string& strHeader, const std::string& strTag)
+{
+    size_t nPos = 0;
+    while (nPos <= strHeader.size()) {
+        size_t nEnd = strHeader.find(',', nPos);
+        if (nEnd == std::string::npos)
+            nEnd = strHeader.size();
+        std::string strCandidate = strHeader.substr(nPos, nEnd - nPos);
+        size_t nBegin = strCandidate.find_first_not_of(" \t");
+        if (nBegin != std::string::npos) {
+            strCandidate = strCandidate.substr(nBegin, strCandidate.find_last_not_of(" \t") - nBegin + 1);
+            // A weak comparison is all If-None-Match asks for
+            if (strCandidate.compare(0, 2, "W/") == 0)
+                strCandidate.erase(0, 2);
+            if (strCandidate == "*" || strCandidate == strTag)
+                return true;
+        }
+        nPos = nEnd + 1;
+    }
+    return false;
+}
+
+bool CResponseCache::Get(const std::string& strKey, int nTipHeight, std::string& strReply, std::string& strTag)
+{
+    LOCK(cs);
+    if (nMaxUsage == 0)
+        return false;
+    boost::unordered_map<std::string, EntryList::iterator>::iterator it = mapEntries.find(strKey);
+    if (it == mapEntries.end()) {
+        nMisses++;
+        return false;
+    }
+    // Move to the front as the most recently used.
+    listEntries.splice(listEntries.begin(), listEntries, it->second);
+    const CEntry& entry = listEntries.front();
+    strReply = entry.strHead;
+    if (entry.fConfirmations) {
+        int nConfirmations = nTipHeight - entry.nHeight + 1;
+        strReply += itostr(nConfirmations);
+        strReply += entry.strTail;
+        strTag = strprintf("\"%s-%d\"", entry.strTag, nConfirmations);
+    } else {
+        strTag = strprintf("\"%s\"", entry.strTag);
+    }
+    nHits++;
+    return true;
+}
+
+void CResponseCache::Put(const std::string& strKey, int nHeight, const std::string& strReply, bool fConfirmations, std::string* pstrTag)
+{
+    CEntry entry;
+    std::string strConfirmations;
+    entry.strKey = strKey;
+    entry.nHeight = nHeight;
+    entry.fConfirmations = false;
+    if (fConfirmations) {
+        static const std::string strMember = "\"confirmations\":";
+        size_t nBegin = strReply.find(strMember);
+        if (nBegin != std::string::npos) {
+            nBegin += strMember.size();
+            size_t nEnd = strReply.find_first_not_of("-0123456789", nBegin);
+            if (nEnd == std::string::npos)
+                nEnd = strReply.size();
+            strConfirmations = strReply.substr(nBegin, nEnd - nBegin);
+            entry.strHead = strReply.substr(0, nBegin);
+            entry.strTail = strReply.substr(nEnd);
+            entry.fConfirmations = true;
+        }
+    }
+    if (!entry.fConfirmations)
+        entry.strHead = strReply;
+
+    // Hashed before taking the lock, as a block in JSON runs to megabytes
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    CSHA256()
+        .Write((const unsigned char*)entry.strHead.data(), entry.strHead.size())
+        .Write((const unsigned char*)entry.strTail.data(), entry.strTail.size())
+        .Finalize(hash);
+    entry.strTag = HexStr(hash, hash + 16);
+    if (pstrTag) {
+        if (entry.fConfirmations)
+            *pstrTag = strprintf("\"%s-%s\"", entry.strTag, strConfirmations);
+        else
+            *pstrTag = strprintf("\"%s\"", entry.strTag);
+    }
+
+    LOCK(cs);
+    // A reply that would push out most of the others isn't worth keeping
+    if (EntryUsage(entry) > nMaxUsage / 4)
+        return;
+    boost::unordered_map<std::string, EntryList::iterator>::iterator it = mapEntries.find(strKey);
+    if (it != mapEntries.end())
+        EraseEntry(it->second);
+    listEntries.push_front(CEntry());
+    listEntries.front().strKey.swap(entry.strKey);
+    listEntries.front().nHeight = entry.nHeight;
+    listEntries.front().strHead.swap(entry.strHead);
+    listEntries.front().strTail.swap(entry.strTail);
+    listEntries.front().fConfirmations = entry.fConfirmations;
+    listEntries.front().strTag.swap(entry.strTag);
+    mapEntries[strKey] = listEntries.begin();
+    nUsage += EntryUsage(listEntries.front());
+    nMaxHeight = std::max(nMaxHeight, nHeight);
+    Trim();
+}
+
+void CResponseCache::BlockDisconnected(int nHeight)
+{
+    LOCK(cs);
+    // The block before it loses its next block
+    if (nHeight - 1 > nMaxHeight)
+        return;
+    EntryList::iterator it = listEntries.begin();
+    while (it != listEntries.end()) {
+        EntryList::iterator itErase = it++;
+        if (itErase->nHeight >= nHeight - 1)
+            EraseEntry(itErase);
+    }
+    nMaxHeight = nHeight - 2;
+}
+
+void CResponseCache::Clear()
+{
+    LOCK(cs);
+    listEntries.clear();
+    mapEntries.clear();
+    nUsage = 0;
+    nMaxHeight = -1;
+}
+
+size_t CResponseCache::size() const
+{
+    LOCK(cs);
+    return listEntries.size();
+}
+
+size_t CResponseCache::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    return nUsage + memusage::MallocUsage(sizeof(void*) * mapEntries.bucket_count());
+}
+
+void CResponseCache::GetStats(uint64_t& nHitsOut, uint64_t& nMissesOut) const
+{
+    LOCK(cs);
+    nHitsOut = nHits;
+    nMissesOut = nMisses;
+}
@@ -0,0 +1,108 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RESPONSECACHE_H
+#define BITCOIN_RESPONSECACHE_H
+
+#include "sync.h"
+
+#include <list>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include <boost/unordered_map.hpp>
+
+class CBlockIndex;
+
+/** Default for -rpcresponsecache, the MiB of RPC and REST replies about buried blocks kept in memory */
+static const int64_t DEFAULT_RESPONSE_CACHE = 16;
+
+/**
+ * Whether replies about pindex may be cached: it must be in the active chain
+ * and buried deeply enough. Must be called with cs_main held.
+ */
+bool CanCacheResponse(const CBlockIndex* pindex);
+
+/**
+ * Replies to RPC and REST queries about blocks and transactions buried
+ * deeper than a reorg can reach, such as getblock or /rest/tx/. What they
+ * say doesn't change, apart from the count of confirmations, which is
+ * filled in from the height of the tip whenever a reply is served. Each
+ * reply is keyed by the method, its parameters and the format, and is
+ * given an entity tag for conditional REST requests. The cache holds at
+ * most a configured number of bytes, dropping the least recently used
+ * replies first, and replies about a block must be erased when the block,
+ * or the one after it, is disconnected.
+ */
+class CResponseCache
+{
+private:
+    struct CEntry
+    {
+        std::string strKey;
+        //! Height of the block the reply is about
+        int nHeight;
+        //! The reply up to the count of confirmations, then the rest of it
+        std::string strHead;
+        std::string strTail;
+        bool fConfirmations;
+        std::string strTag;
+    };
+    typedef std::list<CEntry> EntryList;
+
+    mutable CCriticalSection cs;
+    size_t nMaxUsage;
+    size_t nUsage;
+    //! Most recently used first
+    EntryList listEntries;
+    boost::unordered_map<std::string, EntryList::iterator> mapEntries;
+    //! No entry is about a block above this height
+    int nMaxHeight;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    size_t EntryUsage(const CEntry& entry) const;
+    void EraseEntry(EntryList::iterator it);
+    void Trim();
+
+public:
+    //! Confirmations a block needs before replies about it are cached
+    static const int MIN_DEPTH;
+
+    CResponseCache() : nMaxUsage(0), nUsage(0), nMaxHeight(-1), nHits(0), nMisses(0) {}
+
+    //! Keep at most nMaxUsageIn bytes; 0 disables the cache
+    void SetLimit(size_t nMaxUsageIn);
+    bool IsEnabled() const;
+
+    static std::string MakeKey(const std::string& strMethod, const std::string& strParams, const std::string& strFormat);
+    //! Whether a reply about the block at nHeight may be cached with the tip at nTipHeight
+    static bool IsBuried(int nHeight, int nTipHeight);
+    /** Whether the If-None-Match header strHeader matches strTag */
+    static bool MatchesTag(const std::string& strHeader, const std::string& strTag);
+
+    /**
+     * Get the reply for strKey, with the confirmations of a block at
+     * nTipHeight - nHeight + 1, and its entity tag. Must be called with
+     * cs_main held, for the tip not to move before the reply is used.
+     */
+    bool Get(const std::string& strKey, int nTipHeight, std::string& strReply, std::string& strTag);
+    /**
+     * Keep strReply, a reply about the block at nHeight, for strKey. With
+     * fConfirmations it is JSON whose first "confirmations" member is the
+     * count that changes with the tip. The entity tag of strReply is
+     * returned in pstrTag, if given, whether or not the reply is kept.
+     */
+    void Put(const std::string& strKey, int nHeight, const std::string& strReply, bool fConfirmations, std::string* pstrTag = NULL);
+    //! Erase the replies the disconnection of the block at nHeight changes
+    void BlockDisconnected(int nHeight);
+    void Clear();
+
+    size_t size() const;
+    size_t DynamicMemoryUsage() const;
+    void GetStats(uint64_t& nHitsOut, uint64_t& nMissesOut) const;
+};
+
+#endif // BITCOIN_RESPONSECACHE_H
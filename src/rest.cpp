@@ -5,23 +5,35 @@
 
 #include "primitives/block.h"
 #include "primitives/transaction.h"
+#include "blockfilemap.h"
 #include "main.h"
 #include "httpserver.h"
+#include "responsecache.h"
+#include "rpc/jsonwriter.h"
 #include "rpc/server.h"
+#include "shieldedindex.h"
 #include "streams.h"
 #include "sync.h"
+#include "treestate.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "utilstrencodings.h"
 #include "version.h"
 
 #include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
 #include <boost/dynamic_bitset.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include <univalue.h>
 
 using namespace std;
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+//! Replies larger than this are sent in chunks of about this size
+static const size_t REST_REPLY_CHUNK_SIZE = 64 * 1024;
+//! Most blocks of shielded data sent for one request
+static const long MAX_REST_COMPACT_BLOCKS = 2000;
 
 enum RetFormat {
     RF_UNDEF,
@@ -41,25 +53,35 @@ static const struct {
 };
 
 struct CCoin {
-    uint32_t nTxVer; // Don't call this nVersion, that name has a special meaning inside IMPLEMENT_SERIALIZE
     uint32_t nHeight;
     CTxOut out;
 
+    CCoin() : nHeight(0) {}
+    CCoin(Coin&& in) : nHeight(in.nHeight), out(std::move(in.out)) {}
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action)
     {
-        READWRITE(nTxVer);
+        // The transaction version is no longer stored in the UTXO set; keep
+        // the field in the BIP64 response for compatibility.
+        uint32_t nTxVerDummy = 0;
+        READWRITE(nTxVerDummy);
         READWRITE(nHeight);
         READWRITE(out);
     }
 };
 
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
+extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, CJSONWriter& writer);
 extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, CJSONWriter& writer);
 extern UniValue mempoolInfoToJSON();
 extern UniValue mempoolToJSON(bool fVerbose = false);
+extern void mempoolToJSON(CJSONWriter& writer);
+extern UniValue mempoolEntryToJSON(const TxMempoolInfo& info);
+extern bool mempoolInfoSince(uint64_t nSince, std::vector<TxMempoolInfo>& vInfo, std::vector<uint256>& vRemoved, uint64_t& nSequence);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
 
@@ -70,6 +92,37 @@ static bool RESTERR(HTTPRequest* req, enum HTTPStatusCode status, string message
     return false;
 }
 
+static const char* ContentType(enum RetFormat rf)
+{
+    switch (rf) {
+    case RF_BINARY:
+        return "application/octet-stream";
+    case RF_JSON:
+        return "application/json";
+    default:
+        return "text/plain";
+    }
+}
+
+/**
+ * Send strReply in format rf, tagged with strTag if it is cached. A client
+ * that already has the reply with that tag is told it hasn't changed.
+ */
+static bool WriteTaggedReply(HTTPRequest* req, enum RetFormat rf, const string& strReply, const string& strTag)
+{
+    if (!strTag.empty()) {
+        req->WriteHeader("ETag", strTag);
+        std::pair<bool, string> ifNoneMatch = req->GetHeader("If-None-Match");
+        if (ifNoneMatch.first && CResponseCache::MatchesTag(ifNoneMatch.second, strTag)) {
+            req->WriteReply(HTTP_NOT_MODIFIED);
+            return true;
+        }
+    }
+    req->WriteHeader("Content-Type", ContentType(rf));
+    req->WriteReply(HTTP_OK, strReply);
+    return true;
+}
+
 static enum RetFormat ParseDataFormat(vector<string>& params, const string& strReq)
 {
     boost::split(params, strReq, boost::is_any_of("."));
@@ -189,6 +242,166 @@ static bool rest_headers(HTTPRequest* req,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static void WriteReplyText(HTTPRequest* req, const std::string& strText)
+{
+    req->WriteReplyChunk(strText);
+}
+
+/**
+ * Shielded data of a range of blocks of the active chain, from the shielded
+ * index, for light wallets. For each block this sends its height (int32),
+ * hash, parent hash, time (uint32) and CCompactShieldedBlock record.
+ */
+static bool rest_compactblocks(HTTPRequest* req,
+                               const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No block count specified. Use /rest/compactblocks/<count>/<hash>.<ext>.");
+
+    long count = strtol(path[0].c_str(), NULL, 10);
+    if (count < 1 || count > MAX_REST_COMPACT_BLOCKS)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Block count out of range: " + path[0]);
+
+    string hashStr = path[1];
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    if (rf != RF_BINARY && rf != RF_HEX)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+    if (!fShieldedIndex)
+        return RESTERR(req, HTTP_NOT_FOUND, "Shielded index not enabled (use -shieldedindex)");
+
+    std::vector<const CBlockIndex *> blocks;
+    blocks.reserve(count);
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        const CBlockIndex *pindex = (it != mapBlockIndex.end()) ? it->second : NULL;
+        if (pindex == NULL || !chainActive.Contains(pindex))
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found in the active chain");
+        while (pindex != NULL) {
+            blocks.push_back(pindex);
+            if (blocks.size() == (unsigned long)count)
+                break;
+            pindex = chainActive.Next(pindex);
+        }
+    }
+
+    req->WriteHeader("Content-Type", rf == RF_BINARY ? "application/octet-stream" : "text/plain");
+    req->StartReply(HTTP_OK);
+    CDataStream ssBlocks(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_FOREACH(const CBlockIndex *pindex, blocks) {
+        // The records are read without cs_main; a block that was
+        // disconnected meanwhile has lost its record and ends the range.
+        CCompactShieldedBlock record;
+        if (!pblocktree->ReadShieldedIndex(pindex->GetBlockHash(), record))
+            break;
+        uint256 hashPrev = pindex->pprev ? pindex->pprev->GetBlockHash() : uint256();
+        ssBlocks << pindex->nHeight << pindex->GetBlockHash() << hashPrev << pindex->nTime << record;
+        if (ssBlocks.size() >= REST_REPLY_CHUNK_SIZE) {
+            req->WriteReplyChunk(rf == RF_BINARY ? ssBlocks.str() : HexStr(ssBlocks.begin(), ssBlocks.end()));
+            ssBlocks.clear();
+        }
+    }
+    req->WriteReplyChunk(rf == RF_BINARY ? ssBlocks.str() : HexStr(ssBlocks.begin(), ssBlocks.end()) + "\n");
+    req->EndReply();
+    return true;
+}
+
+/**
+ * The Sprout and Sapling note commitment trees as of the end of a block of
+ * the active chain, for light wallets to start their witnesses from.
+ */
+static bool rest_treestate(HTTPRequest* req,
+                           const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+
+    string hashStr = params[0];
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    int nHeight;
+    uint32_t nTime;
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        const CBlockIndex *pindex = (it != mapBlockIndex.end()) ? it->second : NULL;
+        // Only the anchors of the active chain are kept in the coins database
+        if (pindex == NULL || !chainActive.Contains(pindex))
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found in the active chain");
+        if (!GetTreeStateAt(pindex, sproutTree, saplingTree))
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " tree state not available");
+        nHeight = pindex->nHeight;
+        nTime = pindex->nTime;
+    }
+
+    CDataStream ssTrees(SER_NETWORK, PROTOCOL_VERSION);
+    ssTrees << nHeight << hash << nTime << sproutTree << saplingTree;
+
+    switch (rf) {
+    case RF_BINARY: {
+        string binaryTrees = ssTrees.str();
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, binaryTrees);
+        return true;
+    }
+
+    case RF_HEX: {
+        string strHex = HexStr(ssTrees.begin(), ssTrees.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+
+    case RF_JSON: {
+        CDataStream ssSprout(SER_NETWORK, PROTOCOL_VERSION);
+        ssSprout << sproutTree;
+        CDataStream ssSapling(SER_NETWORK, PROTOCOL_VERSION);
+        ssSapling << saplingTree;
+
+        UniValue sprout(UniValue::VOBJ);
+        sprout.push_back(Pair("root", sproutTree.root().GetHex()));
+        sprout.push_back(Pair("tree", HexStr(ssSprout.begin(), ssSprout.end())));
+        UniValue sapling(UniValue::VOBJ);
+        sapling.push_back(Pair("root", saplingTree.root().GetHex()));
+        sapling.push_back(Pair("tree", HexStr(ssSapling.begin(), ssSapling.end())));
+
+        UniValue result(UniValue::VOBJ);
+        result.push_back(Pair("hash", hash.GetHex()));
+        result.push_back(Pair("height", nHeight));
+        result.push_back(Pair("time", (int64_t)nTime));
+        result.push_back(Pair("sprout", sprout));
+        result.push_back(Pair("sapling", sapling));
+        string strJSON = result.write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static bool rest_block(HTTPRequest* req,
                        const std::string& strURIPart,
                        bool showTxDetails)
@@ -204,43 +417,78 @@ static bool rest_block(HTTPRequest* req,
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
     CBlock block;
+    CBlockFileRegion region;
     CBlockIndex* pblockindex = NULL;
+    string strKey = CResponseCache::MakeKey(showTxDetails ? "rest/block" : "rest/block/notxdetails", hash.GetHex(), rf_names[rf].name);
+    string strReply, strTag;
     {
         LOCK(cs_main);
-        if (mapBlockIndex.count(hash) == 0)
-            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
-
-        pblockindex = mapBlockIndex[hash];
-        if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
-
-        if (!ReadBlockFromDisk(block, pblockindex))
-            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        // A cached reply is sent below, without holding cs_main
+        bool fCached = rf != RF_UNDEF && responseCache.Get(strKey, chainActive.Height(), strReply, strTag);
+        if (!fCached) {
+            if (mapBlockIndex.count(hash) == 0)
+                return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+
+            pblockindex = mapBlockIndex[hash];
+            if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+                return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
+
+            // Binary and hex replies are the block as it is stored on disk
+            if (rf == RF_BINARY || rf == RF_HEX) {
+                if (!ReadRawBlockFromDisk(region, pblockindex->GetBlockPos()))
+                    return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+            } else if (!ReadBlockFromDisk(block, pblockindex)) {
+                return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+            }
+            // A reply to cache is written whole, rather than streamed
+            if (rf != RF_UNDEF && CanCacheResponse(pblockindex)) {
+                if (rf == RF_BINARY) {
+                    strReply.assign(region.begin(), region.end());
+                } else if (rf == RF_HEX) {
+                    strReply = HexStr(region.begin(), region.end()) + "\n";
+                } else {
+                    CJSONWriter writer(strReply);
+                    blockToJSON(block, pblockindex, showTxDetails, writer);
+                    strReply += "\n";
+                }
+                responseCache.Put(strKey, pblockindex->nHeight, strReply, rf == RF_JSON, &strTag);
+            }
+        }
     }
-
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-    ssBlock << block;
+    if (!strTag.empty())
+        return WriteTaggedReply(req, rf, strReply, strTag);
 
     switch (rf) {
     case RF_BINARY: {
-        string binaryBlock = ssBlock.str();
         req->WriteHeader("Content-Type", "application/octet-stream");
-        req->WriteReply(HTTP_OK, binaryBlock);
+        req->StartReply(HTTP_OK);
+        for (const char* p = region.begin(); p < region.end(); p += REST_REPLY_CHUNK_SIZE)
+            req->WriteReplyChunk(p, std::min((size_t)(region.end() - p), REST_REPLY_CHUNK_SIZE));
+        req->EndReply();
         return true;
     }
 
     case RF_HEX: {
-        string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
         req->WriteHeader("Content-Type", "text/plain");
-        req->WriteReply(HTTP_OK, strHex);
+        req->StartReply(HTTP_OK);
+        // Each chunk is twice the size of the bytes it is the hex of
+        for (const char* p = region.begin(); p < region.end(); p += REST_REPLY_CHUNK_SIZE / 2)
+            req->WriteReplyChunk(HexStr(p, std::min(region.end(), p + REST_REPLY_CHUNK_SIZE / 2)));
+        req->WriteReplyChunk("\n");
+        req->EndReply();
         return true;
     }
 
     case RF_JSON: {
-        UniValue objBlock = blockToJSON(block, pblockindex, showTxDetails);
-        string strJSON = objBlock.write() + "\n";
+        string strJSON;
+        CJSONWriter writer(strJSON);
         req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        req->StartReply(HTTP_OK);
+        writer.SetFlush(boost::bind(WriteReplyText, req, _1), REST_REPLY_CHUNK_SIZE);
+        blockToJSON(block, pblockindex, showTxDetails, writer);
+        strJSON += "\n";
+        req->WriteReplyChunk(strJSON);
+        req->EndReply();
         return true;
     }
 
@@ -325,11 +573,15 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
 
     switch (rf) {
     case RF_JSON: {
-        UniValue mempoolObject = mempoolToJSON(true);
-
-        string strJSON = mempoolObject.write() + "\n";
+        string strJSON;
+        CJSONWriter writer(strJSON);
         req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        req->StartReply(HTTP_OK);
+        writer.SetFlush(boost::bind(WriteReplyText, req, _1), REST_REPLY_CHUNK_SIZE);
+        mempoolToJSON(writer);
+        strJSON += "\n";
+        req->WriteReplyChunk(strJSON);
+        req->EndReply();
         return true;
     }
     default: {
@@ -341,45 +593,69 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
     return true; // continue to process further HTTP reqs on this cxn
 }
 
-static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
+/**
+ * Mempool contents added and removed after a mempool sequence number, as
+ * /rest/mempool/entries/<since>.<ext>, or all of them without <since>. The
+ * reply is serialized entry by entry from a copy taken under a short lock.
+ */
+static bool rest_mempool_entries(HTTPRequest* req, const std::string& strURIPart)
 {
     if (!CheckWarmup(req))
         return false;
     vector<string> params;
     const RetFormat rf = ParseDataFormat(params, strURIPart);
 
-    string hashStr = params[0];
-    uint256 hash;
-    if (!ParseHashStr(hashStr, hash))
-        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+    uint64_t nSince = 0;
+    if (params[0].size() > 1 && params[0][0] == '/') {
+        int64_t n;
+        if (!ParseInt64(params[0].substr(1), &n) || n < 0)
+            return RESTERR(req, HTTP_BAD_REQUEST, "Invalid sequence number: " + params[0].substr(1));
+        nSince = n;
+    } else if (!params[0].empty()) {
+        return RESTERR(req, HTTP_NOT_FOUND, "not found");
+    }
 
-    CTransaction tx;
-    uint256 hashBlock = uint256();
-    if (!GetTransaction(hash, tx, hashBlock, true))
-        return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
-
-    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
-    ssTx << tx;
+    std::vector<TxMempoolInfo> vInfo;
+    std::vector<uint256> vRemoved;
+    uint64_t nSequence;
+    bool fFull = !mempoolInfoSince(nSince, vInfo, vRemoved, nSequence) || nSince == 0;
 
     switch (rf) {
-    case RF_BINARY: {
-        string binaryTx = ssTx.str();
-        req->WriteHeader("Content-Type", "application/octet-stream");
-        req->WriteReply(HTTP_OK, binaryTx);
-        return true;
-    }
-
+    case RF_BINARY:
     case RF_HEX: {
-        string strHex = HexStr(ssTx.begin(), ssTx.end()) + "\n";
-        req->WriteHeader("Content-Type", "text/plain");
-        req->WriteReply(HTTP_OK, strHex);
+        CDataStream ssEntries(SER_NETWORK, PROTOCOL_VERSION);
+        ssEntries << nSequence << fFull << vRemoved << vInfo;
+
+        if (rf == RF_BINARY) {
+            string binaryEntries = ssEntries.str();
+            req->WriteHeader("Content-Type", "application/octet-stream");
+            req->WriteReply(HTTP_OK, binaryEntries);
+        } else {
+            string strHex = HexStr(ssEntries.begin(), ssEntries.end()) + "\n";
+            req->WriteHeader("Content-Type", "text/plain");
+            req->WriteReply(HTTP_OK, strHex);
+        }
         return true;
     }
 
     case RF_JSON: {
-        UniValue objTx(UniValue::VOBJ);
-        TxToJSON(tx, hashBlock, objTx);
-        string strJSON = objTx.write() + "\n";
+        // Written out piece by piece rather than as one UniValue tree for
+        // the whole mempool
+        string strJSON = "{\"sequence\":" + i64tostr(nSequence) + ",\"full\":" + (fFull ? "true" : "false") + ",\"added\":{";
+        for (size_t i = 0; i < vInfo.size(); i++) {
+            UniValue entry = mempoolEntryToJSON(vInfo[i]);
+            entry.push_back(Pair("sequence", (int64_t)vInfo[i].nSequence));
+            if (i > 0)
+                strJSON += ",";
+            strJSON += "\"" + vInfo[i].hash.ToString() + "\":" + entry.write();
+        }
+        strJSON += "},\"removed\":[";
+        for (size_t i = 0; i < vRemoved.size(); i++) {
+            if (i > 0)
+                strJSON += ",";
+            strJSON += "\"" + vRemoved[i].ToString() + "\"";
+        }
+        strJSON += "]}\n";
         req->WriteHeader("Content-Type", "application/json");
         req->WriteReply(HTTP_OK, strJSON);
         return true;
@@ -394,6 +670,65 @@ static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+
+    string hashStr = params[0];
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    if (rf == RF_UNDEF)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+
+    string strKey = CResponseCache::MakeKey("rest/tx", hash.GetHex(), rf_names[rf].name);
+    string strReply, strTag;
+    {
+        LOCK(cs_main);
+        if (responseCache.Get(strKey, chainActive.Height(), strReply, strTag))
+            return WriteTaggedReply(req, rf, strReply, strTag);
+    }
+
+    CTransaction tx;
+    uint256 hashBlock = uint256();
+    if (!GetTransaction(hash, tx, hashBlock, true))
+        return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << tx;
+
+    {
+        // TxToJSON looks up the block in mapBlockIndex and chainActive
+        LOCK(cs_main);
+        switch (rf) {
+        case RF_BINARY:
+            strReply = ssTx.str();
+            break;
+        case RF_HEX:
+            strReply = HexStr(ssTx.begin(), ssTx.end()) + "\n";
+            break;
+        default: {
+            CJSONWriter writer(strReply);
+            writer.BeginObject();
+            TxToJSON(tx, hashBlock, writer);
+            writer.EndObject();
+            strReply += "\n";
+            break;
+        }
+        }
+
+        // Only transactions in a buried block are cached, not those of the mempool
+        BlockMap::iterator mi = hashBlock.IsNull() ? mapBlockIndex.end() : mapBlockIndex.find(hashBlock);
+        if (mi != mapBlockIndex.end() && CanCacheResponse(mi->second))
+            responseCache.Put(strKey, mi->second->nHeight, strReply, rf == RF_JSON, &strTag);
+    }
+    return WriteTaggedReply(req, rf, strReply, strTag);
+}
+
 static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
 {
     if (!CheckWarmup(req))
@@ -493,6 +828,11 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     vector<CCoin> outs;
     std::string bitmapStringRepresentation;
     boost::dynamic_bitset<unsigned char> hits(vOutPoints.size());
+    boost::dynamic_bitset<unsigned char> fromDisk(vOutPoints.size());
+    std::vector<Coin> vCoins(vOutPoints.size());
+    int nHeight;
+    uint256 hashTip;
+    boost::scoped_ptr<CCoinsViewDBSnapshot> psnapshot;
     {
         LOCK2(cs_main, mempool.cs);
 
@@ -505,26 +845,30 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
         if (fCheckMemPool)
             view.SetBackend(viewMempool); // switch cache backend to db+mempool in case user likes to query mempool
 
+        nHeight = chainActive.Height();
+        hashTip = chainActive.Tip()->GetBlockHash();
         for (size_t i = 0; i < vOutPoints.size(); i++) {
-            CCoins coins;
-            uint256 hash = vOutPoints[i].hash;
-            if (view.GetCoins(hash, coins)) {
-                mempool.pruneSpent(hash, coins);
-                if (coins.IsAvailable(vOutPoints[i].n)) {
-                    hits[i] = true;
-                    // Safe to index into vout here because IsAvailable checked if it's off the end of the array, or if
-                    // n is valid but points to an already spent output (IsNull).
-                    CCoin coin;
-                    coin.nTxVer = coins.nVersion;
-                    coin.nHeight = coins.nHeight;
-                    coin.out = coins.vout.at(vOutPoints[i].n);
-                    assert(!coin.out.IsNull());
-                    outs.push_back(coin);
-                }
+            if (fCheckMemPool && mempool.isSpent(vOutPoints[i]))
+                continue;
+            if (pcoinsmemory || viewChain.IsCoinCached(vOutPoints[i]) || (fCheckMemPool && mempool.exists(vOutPoints[i].hash))) {
+                hits[i] = view.GetCoin(vOutPoints[i], vCoins[i]);
+            } else {
+                // Unchanged since the last flush; read from the database
+                // below, once cs_main has been released.
+                fromDisk[i] = true;
             }
-
-            bitmapStringRepresentation.append(hits[i] ? "1" : "0"); // form a binary string representation (human-readable for json output)
         }
+        if (fromDisk.any())
+            psnapshot.reset(new CCoinsViewDBSnapshot(*pcoinsdbview));
+    }
+
+    for (size_t i = 0; i < vOutPoints.size(); i++) {
+        if (fromDisk[i])
+            hits[i] = psnapshot->GetCoin(vOutPoints[i], vCoins[i]);
+        if (hits[i])
+            outs.emplace_back(std::move(vCoins[i]));
+
+        bitmapStringRepresentation.append(hits[i] ? "1" : "0"); // form a binary string representation (human-readable for json output)
     }
     boost::to_block_range(hits, std::back_inserter(bitmap));
 
@@ -533,7 +877,7 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
         // serialize data
         // use exact same output as mentioned in Bip64
         CDataStream ssGetUTXOResponse(SER_NETWORK, PROTOCOL_VERSION);
-        ssGetUTXOResponse << chainActive.Height() << chainActive.Tip()->GetBlockHash() << bitmap << outs;
+        ssGetUTXOResponse << nHeight << hashTip << bitmap << outs;
         string ssGetUTXOResponseString = ssGetUTXOResponse.str();
 
         req->WriteHeader("Content-Type", "application/octet-stream");
@@ -543,7 +887,7 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
 
     case RF_HEX: {
         CDataStream ssGetUTXOResponse(SER_NETWORK, PROTOCOL_VERSION);
-        ssGetUTXOResponse << chainActive.Height() << chainActive.Tip()->GetBlockHash() << bitmap << outs;
+        ssGetUTXOResponse << nHeight << hashTip << bitmap << outs;
         string strHex = HexStr(ssGetUTXOResponse.begin(), ssGetUTXOResponse.end()) + "\n";
 
         req->WriteHeader("Content-Type", "text/plain");
@@ -556,14 +900,13 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
 
         // pack in some essentials
         // use more or less the same output as mentioned in Bip64
-        objGetUTXOResponse.push_back(Pair("chainHeight", chainActive.Height()));
-        objGetUTXOResponse.push_back(Pair("chaintipHash", chainActive.Tip()->GetBlockHash().GetHex()));
+        objGetUTXOResponse.push_back(Pair("chainHeight", nHeight));
+        objGetUTXOResponse.push_back(Pair("chaintipHash", hashTip.GetHex()));
         objGetUTXOResponse.push_back(Pair("bitmap", bitmapStringRepresentation));
 
         UniValue utxos(UniValue::VARR);
         BOOST_FOREACH (const CCoin& coin, outs) {
             UniValue utxo(UniValue::VOBJ);
-            utxo.push_back(Pair("txvers", (int32_t)coin.nTxVer));
             utxo.push_back(Pair("height", (int32_t)coin.nHeight));
             utxo.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
 
@@ -600,7 +943,10 @@ static const struct {
       {"/rest/chaininfo", rest_chaininfo},
       {"/rest/mempool/info", rest_mempool_info},
       {"/rest/mempool/contents", rest_mempool_contents},
+      {"/rest/mempool/entries", rest_mempool_entries},
       {"/rest/headers/", rest_headers},
+      {"/rest/compactblocks/", rest_compactblocks},
+      {"/rest/treestate/", rest_treestate},
       {"/rest/getutxos", rest_getutxos},
 };
 
@@ -5,26 +5,36 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "amount.h"
+#include "blockfilemap.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "coinstatsindex.h"
 #include "consensus/validation.h"
 #include "main.h"
 #include "primitives/transaction.h"
+#include "responsecache.h"
+#include "rpc/jsonwriter.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
+#include "treestate.h"
+#include "txdb.h"
 #include "util.h"
 
 #include <stdint.h>
 
 #include <univalue.h>
 
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+
 #include <regex>
 
 using namespace std;
 
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
+extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, CJSONWriter& writer);
 void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 
 double GetDifficultyINTERNAL(const CBlockIndex* blockindex, bool networkDifficulty)
@@ -113,7 +123,7 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     result.push_back(Pair("finalsaplingroot", blockindex->hashFinalSaplingRoot.GetHex()));
     result.push_back(Pair("time", (int64_t)blockindex->nTime));
     result.push_back(Pair("nonce", blockindex->nNonce.GetHex()));
-    result.push_back(Pair("solution", HexStr(blockindex->nSolution)));
+    result.push_back(Pair("solution", HexStr(blockindex->GetBlockHeader().nSolution)));
     result.push_back(Pair("bits", strprintf("%08x", blockindex->nBits)));
     result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
     result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
@@ -142,8 +152,9 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
     result.push_back(Pair("finalsaplingroot", block.hashFinalSaplingRoot.GetHex()));
     UniValue txs(UniValue::VARR);
-    BOOST_FOREACH(const CTransaction&tx, block.vtx)
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx)
     {
+        const CTransaction& tx = *ptx;
         if(txDetails)
         {
             UniValue objTx(UniValue::VOBJ);
@@ -175,6 +186,76 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     return result;
 }
 
+static void ValuePoolDesc(
+    const std::string &name,
+    const boost::optional<CAmount> chainValue,
+    const boost::optional<CAmount> valueDelta,
+    CJSONWriter& writer)
+{
+    writer.BeginObject();
+    writer.Key("id").String(name);
+    writer.Key("monitored").Bool((bool)chainValue);
+    if (chainValue) {
+        writer.Key("chainValue").Amount(*chainValue);
+        writer.Key("chainValueZat").Int(*chainValue);
+    }
+    if (valueDelta) {
+        writer.Key("valueDelta").Amount(*valueDelta);
+        writer.Key("valueDeltaZat").Int(*valueDelta);
+    }
+    writer.EndObject();
+}
+
+/** Write the object blockToJSON returns, without building the UniValue tree */
+void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, CJSONWriter& writer)
+{
+    writer.BeginObject();
+    writer.Key("hash").Blob(block.GetHash());
+    int confirmations = -1;
+    // Only report confirmations if the block is on the main chain
+    if (chainActive.Contains(blockindex))
+        confirmations = chainActive.Height() - blockindex->nHeight + 1;
+    writer.Key("confirmations").Int(confirmations);
+    writer.Key("size").Int(::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    writer.Key("height").Int(blockindex->nHeight);
+    writer.Key("version").Int(block.nVersion);
+    writer.Key("merkleroot").Blob(block.hashMerkleRoot);
+    writer.Key("finalsaplingroot").Blob(block.hashFinalSaplingRoot);
+    writer.Key("tx").BeginArray();
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx)
+    {
+        const CTransaction& tx = *ptx;
+        if(txDetails)
+        {
+            writer.BeginObject();
+            TxToJSON(tx, uint256(), writer);
+            writer.EndObject();
+        }
+        else
+            writer.Blob(tx.GetHash());
+    }
+    writer.EndArray();
+    writer.Key("time").Int(block.GetBlockTime());
+    writer.Key("nonce").Blob(block.nNonce);
+    writer.Key("solution").Hex(block.nSolution);
+    writer.Key("bits").String(strprintf("%08x", block.nBits));
+    writer.Key("difficulty").Double(GetDifficulty(blockindex));
+    writer.Key("chainwork").String(blockindex->nChainWork.GetHex());
+    writer.Key("anchor").Blob(blockindex->hashFinalSproutRoot);
+
+    writer.Key("valuePools").BeginArray();
+    ValuePoolDesc("sprout", blockindex->nChainSproutValue, blockindex->nSproutValue, writer);
+    ValuePoolDesc("sapling", blockindex->nChainSaplingValue, blockindex->nSaplingValue, writer);
+    writer.EndArray();
+
+    if (blockindex->pprev)
+        writer.Key("previousblockhash").Blob(blockindex->pprev->GetBlockHash());
+    CBlockIndex *pnext = chainActive.Next(blockindex);
+    if (pnext)
+        writer.Key("nextblockhash").Blob(pnext->GetBlockHash());
+    writer.EndObject();
+}
+
 UniValue getblockcount(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -188,8 +269,8 @@ UniValue getblockcount(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockcount", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Height();
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    return tip ? tip->nHeight : -1;
 }
 
 UniValue getbestblockhash(const UniValue& params, bool fHelp)
@@ -205,8 +286,10 @@ UniValue getbestblockhash(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getbestblockhash", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Tip()->GetBlockHash().GetHex();
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    if (!tip)
+        throw JSONRPCError(RPC_IN_WARMUP, "No chain tip yet");
+    return tip->hash.GetHex();
 }
 
 UniValue getdifficulty(const UniValue& params, bool fHelp)
@@ -226,39 +309,81 @@ UniValue getdifficulty(const UniValue& params, bool fHelp)
     return GetNetworkDifficulty();
 }
 
+UniValue mempoolEntryToJSON(const TxMempoolInfo& info)
+{
+    UniValue o(UniValue::VOBJ);
+    o.push_back(Pair("size", (int)info.nTxSize));
+    o.push_back(Pair("fee", ValueFromAmount(info.nFee)));
+    o.push_back(Pair("time", info.nTime));
+    o.push_back(Pair("height", (int)info.nHeight));
+    o.push_back(Pair("startingpriority", info.dStartingPriority));
+    o.push_back(Pair("currentpriority", info.dCurrentPriority));
+    set<string> setDepends;
+    BOOST_FOREACH(const uint256& hash, info.vDepends)
+        setDepends.insert(hash.ToString());
+
+    UniValue depends(UniValue::VARR);
+    BOOST_FOREACH(const string& dep, setDepends)
+    {
+        depends.push_back(dep);
+    }
+
+    o.push_back(Pair("depends", depends));
+    return o;
+}
+
+bool mempoolInfoSince(uint64_t nSince, std::vector<TxMempoolInfo>& vInfo, std::vector<uint256>& vRemoved, uint64_t& nSequence)
+{
+    int nHeight;
+    {
+        LOCK(cs_main);
+        nHeight = chainActive.Height();
+    }
+    return mempool.infoSince(nSince, nHeight, vInfo, vRemoved, nSequence);
+}
+
+/** Write the object mempoolToJSON(true) returns, without building the UniValue tree */
+void mempoolToJSON(CJSONWriter& writer)
+{
+    std::vector<TxMempoolInfo> vInfo;
+    std::vector<uint256> vRemoved;
+    uint64_t nSequence;
+    mempoolInfoSince(0, vInfo, vRemoved, nSequence);
+
+    writer.BeginObject();
+    BOOST_FOREACH(const TxMempoolInfo& info, vInfo) {
+        writer.Key(info.hash.ToString()).BeginObject();
+        writer.Key("size").Int((int)info.nTxSize);
+        writer.Key("fee").Amount(info.nFee);
+        writer.Key("time").Int(info.nTime);
+        writer.Key("height").Int((int)info.nHeight);
+        writer.Key("startingpriority").Double(info.dStartingPriority);
+        writer.Key("currentpriority").Double(info.dCurrentPriority);
+        set<string> setDepends;
+        BOOST_FOREACH(const uint256& hash, info.vDepends)
+            setDepends.insert(hash.ToString());
+        writer.Key("depends").BeginArray();
+        BOOST_FOREACH(const string& dep, setDepends)
+            writer.String(dep);
+        writer.EndArray();
+        writer.EndObject();
+    }
+    writer.EndObject();
+}
+
 UniValue mempoolToJSON(bool fVerbose = false)
 {
     if (fVerbose)
     {
-        LOCK(mempool.cs);
+        // Only the summaries are copied under the mempool lock
+        std::vector<TxMempoolInfo> vInfo;
+        std::vector<uint256> vRemoved;
+        uint64_t nSequence;
+        mempoolInfoSince(0, vInfo, vRemoved, nSequence);
+
         UniValue o(UniValue::VOBJ);
-        BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
-        {
-            const uint256& hash = e.GetTx().GetHash();
-            UniValue info(UniValue::VOBJ);
-            info.push_back(Pair("size", (int)e.GetTxSize()));
-            info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
-            info.push_back(Pair("time", e.GetTime()));
-            info.push_back(Pair("height", (int)e.GetHeight()));
-            info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
-            info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
-            const CTransaction& tx = e.GetTx();
-            set<string> setDepends;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-                if (mempool.exists(txin.prevout.hash))
-                    setDepends.insert(txin.prevout.hash.ToString());
-            }
-
-            UniValue depends(UniValue::VARR);
-            BOOST_FOREACH(const string& dep, setDepends)
-            {
-                depends.push_back(dep);
-            }
-
-            info.push_back(Pair("depends", depends));
-            o.push_back(Pair(hash.ToString(), info));
-        }
+        BOOST_FOREACH(const TxMempoolInfo& info, vInfo)
+            o.push_back(Pair(info.hash.ToString(), mempoolEntryToJSON(info)));
         return o;
     }
     else
@@ -306,13 +431,77 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getrawmempool", "true")
         );
 
-    LOCK(cs_main);
-
     bool fVerbose = false;
     if (params.size() > 0)
         fVerbose = params[0].get_bool();
 
-    return mempoolToJSON(fVerbose);
+    if (!fVerbose)
+        return mempoolToJSON(false);
+
+    std::string strJSON;
+    CJSONWriter writer(strJSON);
+    mempoolToJSON(writer);
+    return RawJSONValue(strJSON);
+}
+
+UniValue getmempoolentries(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getmempoolentries ( since )\n"
+            "\nReturns the transactions added to and removed from the memory pool after a mempool sequence number.\n"
+            "Poll with the \"sequence\" of the previous result to follow the mempool. Removals are applied before additions.\n"
+            "\nArguments:\n"
+            "1. since             (numeric, optional, default=0) sequence number of a previous result, 0 for all transactions\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"sequence\" : n,             (numeric) mempool sequence number this result is current to\n"
+            "  \"full\" : true|false,        (boolean) whether \"added\" lists the whole mempool, as when since is too old\n"
+            "  \"added\" : {                 (json object) entries added after since, as in getrawmempool true\n"
+            "    \"transactionid\" : {       (json object)\n"
+            "      \"sequence\" : n,         (numeric) mempool sequence number at which the transaction was added\n"
+            "      ...\n"
+            "    }, ...\n"
+            "  },\n"
+            "  \"removed\" : [               (json array of string) ids of the transactions removed after since\n"
+            "    \"transactionid\", ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples\n"
+            + HelpExampleCli("getmempoolentries", "")
+            + HelpExampleCli("getmempoolentries", "1234")
+            + HelpExampleRpc("getmempoolentries", "1234")
+        );
+
+    uint64_t nSince = 0;
+    if (params.size() > 0) {
+        int64_t n = params[0].get_int64();
+        if (n < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid sequence number");
+        nSince = n;
+    }
+
+    std::vector<TxMempoolInfo> vInfo;
+    std::vector<uint256> vRemoved;
+    uint64_t nSequence;
+    bool fKnown = mempoolInfoSince(nSince, vInfo, vRemoved, nSequence);
+
+    UniValue added(UniValue::VOBJ);
+    BOOST_FOREACH(const TxMempoolInfo& info, vInfo) {
+        UniValue entry = mempoolEntryToJSON(info);
+        entry.push_back(Pair("sequence", (int64_t)info.nSequence));
+        added.push_back(Pair(info.hash.ToString(), entry));
+    }
+    UniValue removed(UniValue::VARR);
+    BOOST_FOREACH(const uint256& hash, vRemoved)
+        removed.push_back(hash.ToString());
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("sequence", (int64_t)nSequence));
+    ret.push_back(Pair("full", nSince == 0 || !fKnown));
+    ret.push_back(Pair("added", added));
+    ret.push_back(Pair("removed", removed));
+    return ret;
 }
 
 UniValue getblockhash(const UniValue& params, bool fHelp)
@@ -340,6 +529,43 @@ UniValue getblockhash(const UniValue& params, bool fHelp)
     return pblockindex->GetBlockHash().GetHex();
 }
 
+UniValue getblockhashes(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "getblockhashes high low\n"
+            "\nReturns the hashes of the blocks with a time in a range (requires -timestampindex).\n"
+            "\nArguments:\n"
+            "1. high         (numeric, required) The time after the newest block to return\n"
+            "2. low          (numeric, required) The time of the oldest block to return\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"hash\"       (string) The block hash\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockhashes", "1231614698 1231024505")
+            + HelpExampleRpc("getblockhashes", "1231614698, 1231024505")
+        );
+
+    if (!fTimestampIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Timestamp index not enabled (use -timestampindex)");
+
+    int64_t nHigh = params[0].get_int64();
+    int64_t nLow = params[1].get_int64();
+    if (nLow < 0 || nHigh < nLow || nHigh > std::numeric_limits<uint32_t>::max())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid time range");
+
+    std::vector<uint256> hashes;
+    if (!pblocktree->ReadTimestampIndex(nHigh, nLow, hashes))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information for block hashes");
+
+    UniValue result(UniValue::VARR);
+    BOOST_FOREACH(const uint256& hash, hashes)
+        result.push_back(hash.GetHex());
+    return result;
+}
+
 UniValue getblockheader(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -386,15 +612,55 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
 
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
+    std::string strKey = CResponseCache::MakeKey("getblockheader", hash.GetHex(), fVerbose ? "1" : "0");
+    std::string strJSON, strTag;
+    if (responseCache.Get(strKey, chainActive.Height(), strJSON, strTag))
+        return RawJSONValue(strJSON);
+
+    UniValue result;
     if (!fVerbose)
     {
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
         ssBlock << pblockindex->GetBlockHeader();
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+        result = HexStr(ssBlock.begin(), ssBlock.end());
+    } else {
+        result = blockheaderToJSON(pblockindex);
+    }
+
+    if (CanCacheResponse(pblockindex))
+        responseCache.Put(strKey, pblockindex->nHeight, result.write(), fVerbose);
+    return result;
+}
+
+/** The hash of a block given by hash, or by height in the active chain */
+static uint256 ParseBlockHashOrHeight(const UniValue& param)
+{
+    AssertLockHeld(cs_main);
+    std::string strHash = param.get_str();
+
+    // If height is supplied, find the hash
+    if (strHash.size() < (2 * sizeof(uint256))) {
+        // std::stoi allows characters, whereas we want to be strict
+        regex r("[[:digit:]]+");
+        if (!regex_match(strHash, r)) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height parameter");
+        }
+
+        int nHeight = -1;
+        try {
+            nHeight = std::stoi(strHash);
+        }
+        catch (const std::exception &e) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height parameter");
+        }
+
+        if (nHeight < 0 || nHeight > chainActive.Height()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+        }
+        strHash = chainActive[nHeight]->GetBlockHash().GetHex();
     }
 
-    return blockheaderToJSON(pblockindex);
+    return uint256S(strHash);
 }
 
 UniValue getblock(const UniValue& params, bool fHelp)
@@ -447,31 +713,7 @@ UniValue getblock(const UniValue& params, bool fHelp)
 
     LOCK(cs_main);
 
-    std::string strHash = params[0].get_str();
-
-    // If height is supplied, find the hash
-    if (strHash.size() < (2 * sizeof(uint256))) {
-        // std::stoi allows characters, whereas we want to be strict
-        regex r("[[:digit:]]+");
-        if (!regex_match(strHash, r)) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height parameter");
-        }
-
-        int nHeight = -1;
-        try {
-            nHeight = std::stoi(strHash);
-        }
-        catch (const std::exception &e) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height parameter");
-        }
-
-        if (nHeight < 0 || nHeight > chainActive.Height()) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
-        }
-        strHash = chainActive[nHeight]->GetBlockHash().GetHex();
-    }
-
-    uint256 hash(uint256S(strHash));
+    uint256 hash = ParseBlockHashOrHeight(params[0]);
 
     int verbosity = 1;
     if (params.size() > 1) {
@@ -495,18 +737,178 @@ UniValue getblock(const UniValue& params, bool fHelp)
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
+    // Blocks asked for by height are cached under their hash, as they are
+    // only cached once no reorg can change which block is at that height
+    std::string strKey = CResponseCache::MakeKey("getblock", hash.GetHex(), itostr(verbosity));
+    std::string strJSON, strTag;
+    if (responseCache.Get(strKey, chainActive.Height(), strJSON, strTag))
+        return RawJSONValue(strJSON);
+    bool fCache = CanCacheResponse(pblockindex);
+
+    if (verbosity == 0)
+    {
+        // The serialization on disk is the one we would produce
+        CBlockFileRegion region;
+        if (!ReadRawBlockFromDisk(region, pblockindex->GetBlockPos()))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+        std::string strHex = HexStr(region.begin(), region.end());
+        if (!fCache)
+            return strHex;
+        strJSON = "\"" + strHex + "\"";
+        responseCache.Put(strKey, pblockindex->nHeight, strJSON, false);
+        return RawJSONValue(strJSON);
+    }
+
     if(!ReadBlockFromDisk(block, pblockindex))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
-    if (verbosity == 0)
+    if (verbosity == 1 && !fCache)
+        return blockToJSON(block, pblockindex);
+
+    CJSONWriter writer(strJSON);
+    blockToJSON(block, pblockindex, verbosity == 2, writer);
+    if (fCache)
+        responseCache.Put(strKey, pblockindex->nHeight, strJSON, true);
+    return RawJSONValue(strJSON);
+}
+
+UniValue z_gettreestate(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "z_gettreestate \"hash|height\"\n"
+            "\nReturn the Sprout and Sapling note commitment trees as of the end of a block of the active chain,\n"
+            "for wallets to start note witnesses from.\n"
+            "\nArguments:\n"
+            "1. \"hash|height\"          (string, required) The block hash or height\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"hash\" : \"hash\",       (string) The block hash\n"
+            "  \"height\" : n,          (numeric) The block height\n"
+            "  \"time\" : ttt,          (numeric) The block time in seconds since epoch (Jan 1 1970 GMT)\n"
+            "  \"sprout\" : {\n"
+            "    \"root\" : \"hex\",      (string) The root of the Sprout tree after the block\n"
+            "    \"tree\" : \"hex\"       (string) The serialized frontier of the tree\n"
+            "  },\n"
+            "  \"sapling\" : {\n"
+            "    \"root\" : \"hex\",      (string) The root of the Sapling tree after the block\n"
+            "    \"tree\" : \"hex\"       (string) The serialized frontier of the tree\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_gettreestate", "12800")
+            + HelpExampleRpc("z_gettreestate", "\"00000000febc373a1da2bd9f887b105ad79ddc26ac26c2b28652d64e5207c5b5\"")
+        );
+
+    LOCK(cs_main);
+
+    uint256 hash = ParseBlockHashOrHeight(params[0]);
+    BlockMap::const_iterator it = mapBlockIndex.find(hash);
+    if (it == mapBlockIndex.end())
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+    const CBlockIndex* pindex = it->second;
+    // Only the anchors of the active chain are kept in the coins database
+    if (!chainActive.Contains(pindex))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Block not in the active chain");
+
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+    if (!GetTreeStateAt(pindex, sproutTree, saplingTree))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Tree state not available");
+
+    CDataStream ssSprout(SER_NETWORK, PROTOCOL_VERSION);
+    ssSprout << sproutTree;
+    CDataStream ssSapling(SER_NETWORK, PROTOCOL_VERSION);
+    ssSapling << saplingTree;
+
+    UniValue sprout(UniValue::VOBJ);
+    sprout.push_back(Pair("root", sproutTree.root().GetHex()));
+    sprout.push_back(Pair("tree", HexStr(ssSprout.begin(), ssSprout.end())));
+    UniValue sapling(UniValue::VOBJ);
+    sapling.push_back(Pair("root", saplingTree.root().GetHex()));
+    sapling.push_back(Pair("tree", HexStr(ssSapling.begin(), ssSapling.end())));
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("hash", hash.GetHex()));
+    result.push_back(Pair("height", pindex->nHeight));
+    result.push_back(Pair("time", (int64_t)pindex->nTime));
+    result.push_back(Pair("sprout", sprout));
+    result.push_back(Pair("sapling", sapling));
+    return result;
+}
+
+UniValue z_getnotewitness(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 2 || params.size() > 3)
+        throw runtime_error(
+            "z_getnotewitness \"txid\" n ( jsoutput )\n"
+            "\nBuild the witness of a shielded note as of the tip of the active chain, from the tree state\n"
+            "before its block and the note commitments added since, so that no witness has to have been kept\n"
+            "since the note was received. With -shieldedindex the later blocks are not read in full.\n"
+            "\nArguments:\n"
+            "1. \"txid\"       (string, required) The transaction the note was created in\n"
+            "2. n            (numeric, required) The index of the Sapling output, or of the JoinSplit with jsoutput\n"
+            "3. jsoutput     (numeric, optional) The output of JoinSplit n, for a Sprout note\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\" : n,          (numeric) The height of the block the note is in\n"
+            "  \"anchorheight\" : n,    (numeric) The height of the block the witness is as of\n"
+            "  \"anchor\" : \"hex\",      (string) The root of the tree the witness is for, to spend the note with\n"
+            "  \"position\" : n,        (numeric) The position of the note commitment in the tree\n"
+            "  \"witness\" : \"hex\"      (string) The serialized witness\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_getnotewitness", "\"mytxid\" 0")
+            + HelpExampleCli("z_getnotewitness", "\"mytxid\" 0 1")
+            + HelpExampleRpc("z_getnotewitness", "\"mytxid\", 0")
+        );
+
+    uint256 txid = ParseHashV(params[0], "txid");
+    int n = params[1].get_int();
+    bool fSprout = params.size() > 2;
+    int nJSOutput = fSprout ? params[2].get_int() : 0;
+
+    CTransaction tx;
+    uint256 hashBlock;
+    const CBlockIndex* pindexNote = NULL;
+    const CBlockIndex* pindexTip = NULL;
     {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+        LOCK(cs_main);
+        if (!GetTransaction(txid, tx, hashBlock, true))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available about transaction");
+        BlockMap::const_iterator it = hashBlock.IsNull() ? mapBlockIndex.end() : mapBlockIndex.find(hashBlock);
+        if (it == mapBlockIndex.end() || !chainActive.Contains(it->second))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Transaction not in the active chain");
+        pindexNote = it->second;
+        pindexTip = chainActive.Tip();
     }
 
-    return blockToJSON(block, pblockindex, verbosity >= 2);
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("height", pindexNote->nHeight));
+    result.push_back(Pair("anchorheight", pindexTip->nHeight));
+    std::string strError;
+    CDataStream ssWitness(SER_NETWORK, PROTOCOL_VERSION);
+    if (fSprout) {
+        if (n < 0 || (size_t)n >= tx.vjoinsplit.size() || nJSOutput < 0 || nJSOutput >= ZC_NUM_JS_OUTPUTS)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid JoinSplit output");
+        SproutWitness witness;
+        if (!BuildSproutWitness(tx.vjoinsplit[n].commitments[nJSOutput], pindexNote, pindexTip, witness, strError))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, strError);
+        ssWitness << witness;
+        result.push_back(Pair("anchor", witness.root().GetHex()));
+        result.push_back(Pair("position", (uint64_t)witness.position()));
+    } else {
+        if (n < 0 || (size_t)n >= tx.vShieldedOutput.size())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid Sapling output");
+        SaplingWitness witness;
+        if (!BuildSaplingWitness(tx.vShieldedOutput[n].cm, pindexNote, pindexTip, witness, strError))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, strError);
+        ssWitness << witness;
+        result.push_back(Pair("anchor", witness.root().GetHex()));
+        result.push_back(Pair("position", (uint64_t)witness.position()));
+    }
+    result.push_back(Pair("witness", HexStr(ssWitness.begin(), ssWitness.end())));
+    return result;
 }
 
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
@@ -515,16 +917,20 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
         throw runtime_error(
             "gettxoutsetinfo\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time, unless -coinstatsindex is enabled.\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"transactions\": n,      (numeric) The number of transactions, without -coinstatsindex\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
-            "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
-            "  \"total_amount\": x.xxx          (numeric) The total amount\n"
+            "  \"bytes_serialized\": n,  (numeric) The serialized size, without -coinstatsindex\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash, without -coinstatsindex\n"
+            "  \"bogosize\": n,          (numeric) A database-independent size of the set, with -coinstatsindex\n"
+            "  \"muhash\": \"hash\",      (string) The MuHash of the unspent outputs, with -coinstatsindex\n"
+            "  \"total_amount\": x.xxx,  (numeric) The total amount\n"
+            "  \"sprout_pool\": x.xxx,   (numeric) The value in the Sprout pool, with -coinstatsindex, if known\n"
+            "  \"sapling_pool\": x.xxx   (numeric) The value in the Sapling pool, with -coinstatsindex, if known\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
@@ -533,9 +939,42 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 
     UniValue ret(UniValue::VOBJ);
 
+    if (fCoinStatsIndex) {
+        // The index keeps the totals of every connected block, so there is
+        // nothing to scan
+        CCoinStatsRecord record;
+        CBlockIndex* pindex;
+        {
+            LOCK(cs_main);
+            pindex = chainActive.Tip();
+            if (!pblocktree->ReadCoinStatsIndex(pindex->GetBlockHash(), record))
+                throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the coin stats index");
+        }
+        uint256 hashMuHash;
+        record.muhash.Finalize(hashMuHash.begin());
+        ret.push_back(Pair("height", (int64_t)pindex->nHeight));
+        ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
+        ret.push_back(Pair("txouts", (int64_t)record.nTransactionOutputs));
+        ret.push_back(Pair("bogosize", (int64_t)record.nBogoSize));
+        ret.push_back(Pair("muhash", hashMuHash.GetHex()));
+        ret.push_back(Pair("total_amount", ValueFromAmount(record.nTotalAmount)));
+        if (pindex->nChainSproutValue)
+            ret.push_back(Pair("sprout_pool", ValueFromAmount(*pindex->nChainSproutValue)));
+        if (pindex->nChainSaplingValue)
+            ret.push_back(Pair("sapling_pool", ValueFromAmount(*pindex->nChainSaplingValue)));
+        return ret;
+    }
+
     CCoinsStats stats;
-    FlushStateToDisk();
-    if (pcoinsTip->GetStats(stats)) {
+    // Walk the coin database outside cs_main so that block connection is not
+    // held up for the duration; the snapshot pins the state just flushed.
+    boost::scoped_ptr<CCoinsViewDBSnapshot> pview;
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        pview.reset(new CCoinsViewDBSnapshot(*pcoinsdbview));
+    }
+    if (pview->GetStats(stats)) {
         ret.push_back(Pair("height", (int64_t)stats.nHeight));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
@@ -547,6 +986,272 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue pruneblockchain(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "pruneblockchain height\n"
+            "\nPrunes the block and undo files of blocks up to the given height, as far as they can be.\n"
+            "Blocks within 288 of the tip are always kept. Requires -prune.\n"
+            "\nArguments:\n"
+            "1. \"height\"       (numeric, required) The block height to prune up to\n"
+            "\nResult:\n"
+            "n    (numeric) Height of the last block pruned.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("pruneblockchain", "1000")
+            + HelpExampleRpc("pruneblockchain", "1000"));
+
+    if (!fPruneMode)
+        throw JSONRPCError(RPC_MISC_ERROR, "Cannot prune blocks because node is not in prune mode.");
+
+    LOCK(cs_main);
+
+    int heightParam = params[0].get_int();
+    if (heightParam < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative block height.");
+
+    unsigned int height = (unsigned int) heightParam;
+    unsigned int chainHeight = (unsigned int) chainActive.Height();
+    if (chainHeight < Params().PruneAfterHeight())
+        throw JSONRPCError(RPC_MISC_ERROR, "Blockchain is too short for pruning.");
+    else if (height > chainHeight)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Blockchain is shorter than the attempted prune height.");
+    else if (height > chainHeight - MIN_BLOCKS_TO_KEEP) {
+        LogPrint("rpc", "Attempt to prune blocks close to the tip.  Retaining the minimum number of blocks.\n");
+        height = chainHeight - MIN_BLOCKS_TO_KEEP;
+    }
+
+    PruneBlockFilesManual(height);
+
+    // The files are unlinked in the background, but the index already
+    // reflects what was pruned
+    const CBlockIndex* block = chainActive.Tip();
+    while (block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA))
+        block = block->pprev;
+    return uint64_t(block->pprev ? block->nHeight - 1 : 0);
+}
+
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrites the unspent transaction outputs, the Sprout and Sapling nullifiers and the note commitment\n"
+            "tree anchors at the current tip to a file, so that the chainstate can be shipped and checked.\n"
+            "This call takes some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"   (string, required) The file to write, relative to the data directory unless absolute.\n"
+            "              It must not exist yet.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"path\": \"path\",          (string) The absolute path of the file written\n"
+            "  \"height\": n,             (numeric) The height of the base block\n"
+            "  \"base_hash\": \"hash\",     (string) The hash of the base block\n"
+            "  \"coins_written\": n,      (numeric) The number of unspent outputs written\n"
+            "  \"nullifiers_written\": n, (numeric) The number of Sprout and Sapling nullifiers written\n"
+            "  \"anchors_written\": n,    (numeric) The number of Sprout and Sapling anchors written\n"
+            "  \"txoutset_hash\": \"hash\", (string) The hash of the contents of the file\n"
+            "  \"committed\": true|false  (boolean) If the hash matches the one known for this height\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    boost::filesystem::path pathTemp = path.string() + ".incomplete";
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    // Walk the coin database outside cs_main, as gettxoutsetinfo does
+    boost::scoped_ptr<CCoinsViewDBSnapshot> pview;
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        pview.reset(new CCoinsViewDBSnapshot(*pcoinsdbview));
+    }
+
+    CTxOutSetDump dump;
+    {
+        CAutoFile file(fopen(pathTemp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Unable to open " + pathTemp.string() + " for writing");
+        if (!pview->Dump(file, dump)) {
+            file.fclose();
+            boost::filesystem::remove(pathTemp);
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the coin database");
+        }
+        FileCommit(file.Get());
+    }
+    if (!RenameOver(pathTemp, path))
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to rename " + pathTemp.string() + " to " + path.string());
+
+    int nHeight;
+    {
+        LOCK(cs_main);
+        nHeight = mapBlockIndex.find(dump.hashBlock)->second->nHeight;
+    }
+    const std::map<int, uint256>& mapHashes = Params().TxOutSetHashes();
+    std::map<int, uint256>::const_iterator it = mapHashes.find(nHeight);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("height", nHeight));
+    ret.push_back(Pair("base_hash", dump.hashBlock.GetHex()));
+    ret.push_back(Pair("coins_written", (uint64_t)dump.nCoins));
+    ret.push_back(Pair("nullifiers_written", (uint64_t)dump.nNullifiers));
+    ret.push_back(Pair("anchors_written", (uint64_t)dump.nAnchors));
+    ret.push_back(Pair("txoutset_hash", dump.hashContents.GetHex()));
+    ret.push_back(Pair("committed", it != mapHashes.end() && it->second == dump.hashContents));
+    return ret;
+}
+
+static UniValue DBStatsToJSON(const CDBStats& stats)
+{
+    UniValue ret(UniValue::VOBJ);
+    uint64_t nLookups = stats.nCacheHits + stats.nCacheMisses;
+    ret.push_back(Pair("engine", stats.strEngine));
+    ret.push_back(Pair("cache_hits", (uint64_t)stats.nCacheHits));
+    ret.push_back(Pair("cache_misses", (uint64_t)stats.nCacheMisses));
+    ret.push_back(Pair("cache_hit_ratio", nLookups ? (double)stats.nCacheHits / nLookups : 0.0));
+    ret.push_back(Pair("compactions", (uint64_t)stats.nCompactions));
+    ret.push_back(Pair("compaction_time", stats.dCompactionTime));
+    ret.push_back(Pair("range_compactions", (uint64_t)stats.nRangeCompactions));
+    ret.push_back(Pair("range_compaction_time", stats.dRangeCompactionTime));
+    ret.push_back(Pair(stats.strEngine + "_stats", stats.strEngineStats));
+    return ret;
+}
+
+UniValue getdbstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getdbstats\n"
+            "\nReturns storage engine statistics of the chainstate and block index databases since startup.\n"
+            "The block cache and compaction counts are those of LevelDB, and 0 for other engines.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {             (json object) The chainstate database\n"
+            "    \"engine\": \"str\",          (string) The storage engine, as set by -coindbengine\n"
+            "    \"cache_hits\": n,          (numeric) Block cache lookups that found the block\n"
+            "    \"cache_misses\": n,        (numeric) Block cache lookups that had to read the block from disk\n"
+            "    \"cache_hit_ratio\": x.xxx, (numeric) Share of block cache lookups that were hits\n"
+            "    \"compactions\": n,         (numeric) The number of compactions\n"
+            "    \"compaction_time\": n,     (numeric) Seconds spent in compactions\n"
+            "    \"range_compactions\": n,   (numeric) Compactions of key ranges requested by the node, e.g. by -dbcompactinterval\n"
+            "    \"range_compaction_time\": n, (numeric) Seconds spent in those\n"
+            "    \"leveldb_stats\": \"str\"    (string) The leveldb.stats property, or lmdb_stats with LMDB's environment statistics\n"
+            "  },\n"
+            "  \"blockindex\": {             (json object) The block index database, same fields\n"
+            "    ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbstats", "")
+            + HelpExampleRpc("getdbstats", "")
+        );
+
+    CDBStats coinsStats, blockStats;
+    {
+        LOCK(cs_main);
+        pcoinsdbview->GetDBStats(coinsStats);
+        pblocktree->GetDBStats(blockStats);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("chainstate", DBStatsToJSON(coinsStats)));
+    ret.push_back(Pair("blockindex", DBStatsToJSON(blockStats)));
+    return ret;
+}
+
+static UniValue BlockConnectStatsToJSON(const CBlockConnectStats& stats)
+{
+    UniValue phases(UniValue::VOBJ);
+    phases.push_back(Pair("load", stats.nTimeLoad * 0.000001));
+    phases.push_back(Pair("checkblock", stats.nTimeCheckBlock * 0.000001));
+    phases.push_back(Pair("coins", stats.nTimeCoins * 0.000001));
+    phases.push_back(Pair("scripts", stats.nTimeScripts * 0.000001));
+    phases.push_back(Pair("proofs", stats.nTimeProofs * 0.000001));
+    phases.push_back(Pair("anchors", stats.nTimeAnchors * 0.000001));
+    phases.push_back(Pair("connect", stats.nTimeConnect * 0.000001));
+    phases.push_back(Pair("index", stats.nTimeIndex * 0.000001));
+    phases.push_back(Pair("flush", stats.nTimeFlush * 0.000001));
+    phases.push_back(Pair("chainstate", stats.nTimeChainState * 0.000001));
+    phases.push_back(Pair("postconnect", stats.nTimePostConnect * 0.000001));
+    phases.push_back(Pair("total", stats.nTimeTotal * 0.000001));
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("blocks", stats.nBlocks));
+    ret.push_back(Pair("transactions", stats.nTransactions));
+    ret.push_back(Pair("inputs", stats.nInputs));
+    ret.push_back(Pair("time", phases));
+    return ret;
+}
+
+static const std::string strBlockConnectStatsHelp =
+    "{\n"
+    "  \"blocks\": n,           (numeric) Blocks connected or checked\n"
+    "  \"transactions\": n,     (numeric) Their transactions\n"
+    "  \"inputs\": n,           (numeric) Their transparent inputs, not counting coinbases\n"
+    "  \"time\": {              (json object) Seconds spent in each phase\n"
+    "    \"load\": x.xxx,       (numeric) Reading blocks and prefetching their inputs\n"
+    "    \"checkblock\": x.xxx, (numeric) Context-free block checks\n"
+    "    \"coins\": x.xxx,      (numeric) Looking inputs up and updating the coins\n"
+    "    \"scripts\": x.xxx,    (numeric) Script checks and waiting for the script threads\n"
+    "    \"proofs\": x.xxx,     (numeric) JoinSplit proof checks and waiting for the proof threads\n"
+    "    \"anchors\": x.xxx,    (numeric) Note commitment trees and anchors\n"
+    "    \"connect\": x.xxx,    (numeric) All of connecting the blocks, including the above but loading\n"
+    "    \"index\": x.xxx,      (numeric) Writing undo data and indexes\n"
+    "    \"flush\": x.xxx,      (numeric) Flushing each block's cache layer\n"
+    "    \"chainstate\": x.xxx, (numeric) Writing the chain state when it was due\n"
+    "    \"postconnect\": x.xxx, (numeric) Mempool and wallet updates\n"
+    "    \"total\": x.xxx       (numeric) All of it\n"
+    "  }\n"
+    "}\n";
+
+UniValue getblockconnectstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getblockconnectstats\n"
+            "\nReturns the time spent connecting blocks since startup, by phase.\n"
+            "\nResult:\n"
+            + strBlockConnectStatsHelp +
+            "\nExamples:\n"
+            + HelpExampleCli("getblockconnectstats", "")
+            + HelpExampleRpc("getblockconnectstats", "")
+        );
+
+    LOCK(cs_main);
+    return BlockConnectStatsToJSON(blockConnectStats);
+}
+
+UniValue benchconnectblocks(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "benchconnectblocks startheight endheight\n"
+            "\nConnects the blocks of the active chain from startheight to endheight again and returns the time\n"
+            "spent by phase. The chain state is taken back below startheight in memory first, and nothing is\n"
+            "written, so this can be run against a copy of a data directory to compare validation changes.\n"
+            "Use -connect=0 to keep the tip from moving. This call can take a long time and holds cs_main.\n"
+            "\nArguments:\n"
+            "1. startheight   (numeric, required) The first block to connect\n"
+            "2. endheight     (numeric, required) The last block to connect, at most the current height\n"
+            "\nResult:\n"
+            + strBlockConnectStatsHelp +
+            "\nExamples:\n"
+            + HelpExampleCli("benchconnectblocks", "400000 401000")
+            + HelpExampleRpc("benchconnectblocks", "400000, 401000")
+        );
+
+    CBlockConnectStats stats;
+    std::string strError;
+    if (!BenchmarkConnectBlocks(params[0].get_int(), params[1].get_int(), stats, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+    return BlockConnectStatsToJSON(stats);
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -572,7 +1277,6 @@ UniValue gettxout(const UniValue& params, bool fHelp)
             "        ,...\n"
             "     ]\n"
             "  },\n"
-            "  \"version\" : n,              (numeric) The version\n"
             "  \"coinbase\" : true|false     (boolean) Coinbase or not\n"
             "}\n"
 
@@ -585,8 +1289,6 @@ UniValue gettxout(const UniValue& params, bool fHelp)
             + HelpExampleRpc("gettxout", "\"txid\", 1")
         );
 
-    LOCK(cs_main);
-
     UniValue ret(UniValue::VOBJ);
 
     std::string strHash = params[0].get_str();
@@ -596,33 +1298,39 @@ UniValue gettxout(const UniValue& params, bool fHelp)
     if (params.size() > 2)
         fMempool = params[2].get_bool();
 
-    CCoins coins;
-    if (fMempool) {
-        LOCK(mempool.cs);
-        CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
-            return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
-    } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+    COutPoint out(hash, n);
+    Coin coin;
+    CBlockIndex *pindex;
+    boost::scoped_ptr<CCoinsViewDBSnapshot> psnapshot;
+    {
+        LOCK2(cs_main, mempool.cs);
+        pindex = mapBlockIndex.find(pcoinsTip->GetBestBlock())->second;
+        if (fMempool && mempool.isSpent(out)) // TODO: filtering spent coins should be done by the CCoinsViewMemPool
             return NullUniValue;
+        // The coin database may be behind a chainstate held in memory
+        if (pcoinsmemory || pcoinsTip->IsCoinCached(out) || (fMempool && mempool.exists(out.hash))) {
+            CCoinsViewMemPool viewMempool(pcoinsTip, mempool);
+            CCoinsView &view = fMempool ? static_cast<CCoinsView&>(viewMempool) : *pcoinsTip;
+            if (!view.GetCoin(out, coin))
+                return NullUniValue;
+        } else {
+            // The output has not changed since the chainstate was last
+            // flushed, so read it from the database without holding cs_main.
+            psnapshot.reset(new CCoinsViewDBSnapshot(*pcoinsdbview));
+        }
     }
-    if (n<0 || (unsigned int)n>=coins.vout.size() || coins.vout[n].IsNull())
+    if (psnapshot && !psnapshot->GetCoin(out, coin))
         return NullUniValue;
-
-    BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
-    CBlockIndex *pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if (coin.nHeight == MEMPOOL_HEIGHT)
         ret.push_back(Pair("confirmations", 0));
     else
-        ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
+        ret.push_back(Pair("confirmations", (int64_t)(pindex->nHeight - coin.nHeight + 1)));
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
+    ret.push_back(Pair("coinbase", (bool)coin.fCoinBase));
 
     return ret;
 }
@@ -929,6 +1637,10 @@ UniValue mempoolInfoToJSON()
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
     ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
+    ret.push_back(Pair("sequence", (int64_t)mempool.GetSequence()));
 
     return ret;
 }
@@ -944,6 +1656,9 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
             "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"maxmempool\": xxxxx          (numeric) Maximum memory usage for the mempool\n"
+            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee rate in " + CURRENCY_UNIT + "/kB for a tx to be accepted\n"
+            "  \"sequence\": xxxxx            (numeric) Mempool sequence number, see getmempoolentries\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
@@ -1031,25 +1746,34 @@ UniValue reconsiderblock(const UniValue& params, bool fHelp)
 }
 
 static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
-    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true  },
-    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true  },
-    { "blockchain",         "getblockcount",          &getblockcount,          true  },
-    { "blockchain",         "getblock",               &getblock,               true  },
-    { "blockchain",         "getblockhash",           &getblockhash,           true  },
-    { "blockchain",         "getblockheader",         &getblockheader,         true  },
-    { "blockchain",         "getchaintips",           &getchaintips,           true  },
-    { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
-    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true  },
-    { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
-    { "blockchain",         "gettxout",               &gettxout,               true  },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
-    { "blockchain",         "verifychain",            &verifychain,            true  },
+{ //  category              name                      actor (function)         okSafeMode  okParallel
+  //  --------------------- ------------------------  -----------------------  ----------  ----------
+    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,  false },
+    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,  true  },
+    { "blockchain",         "benchconnectblocks",     &benchconnectblocks,     true,  false },
+    { "blockchain",         "getblockcount",          &getblockcount,          true,  true  },
+    { "blockchain",         "getblock",               &getblock,               true,  true  },
+    { "blockchain",         "getblockhash",           &getblockhash,           true,  true  },
+    { "blockchain",         "getblockhashes",         &getblockhashes,         true,  true  },
+    { "blockchain",         "getblockconnectstats",   &getblockconnectstats,   true,  false },
+    { "blockchain",         "getblockheader",         &getblockheader,         true,  true  },
+    { "blockchain",         "getchaintips",           &getchaintips,           true,  false },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true,  false },
+    { "blockchain",         "getdbstats",             &getdbstats,             true,  false },
+    { "blockchain",         "getdifficulty",          &getdifficulty,          true,  true  },
+    { "blockchain",         "getmempoolentries",      &getmempoolentries,      true,  true  },
+    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,  false },
+    { "blockchain",         "getrawmempool",          &getrawmempool,          true,  false },
+    { "blockchain",         "gettxout",               &gettxout,               true,  true  },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  false },
+    { "blockchain",         "pruneblockchain",        &pruneblockchain,        true,  false },
+    { "blockchain",         "verifychain",            &verifychain,            true,  false },
+    { "blockchain",         "z_getnotewitness",       &z_getnotewitness,       true,  false },
+    { "blockchain",         "z_gettreestate",         &z_gettreestate,         true,  true  },
 
     /* Not shown in help */
-    { "hidden",             "invalidateblock",        &invalidateblock,        true  },
-    { "hidden",             "reconsiderblock",        &reconsiderblock,        true  },
+    { "hidden",             "invalidateblock",        &invalidateblock,        true,  false },
+    { "hidden",             "reconsiderblock",        &reconsiderblock,        true,  false },
 };
 
 void RegisterBlockchainRPCCommands(CRPCTable &tableRPC)
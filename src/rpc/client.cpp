@@ -48,6 +48,13 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getbalance", 1 },
     { "getbalance", 2 },
     { "getblockhash", 0 },
+    { "getblockhashes", 0 },
+    { "getblockhashes", 1 },
+    { "getaddressbalance", 0 },
+    { "getaddressdeltas", 0 },
+    { "getaddresstxids", 0 },
+    { "getaddressutxos", 0 },
+    { "getspentinfo", 0 },
     { "move", 2 },
     { "move", 3 },
     { "sendfrom", 2 },
@@ -75,6 +82,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getblockheader", 1 },
     { "gettransaction", 1 },
     { "getrawtransaction", 1 },
+    { "getrawtransactions", 0 },
+    { "getrawtransactions", 1 },
     { "createrawtransaction", 0 },
     { "createrawtransaction", 1 },
     { "createrawtransaction", 2 },
@@ -83,17 +92,26 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "signrawtransaction", 2 },
     { "sendrawtransaction", 1 },
     { "fundrawtransaction", 1 },
+    { "pruneblockchain", 0 },
+    { "benchconnectblocks", 0 },
+    { "benchconnectblocks", 1 },
+    { "getlockstats", 1 },
+    { "gettraces", 1 },
+    { "gettraces", 2 },
     { "gettxout", 1 },
     { "gettxout", 2 },
     { "gettxoutproof", 0 },
     { "lockunspent", 0 },
     { "lockunspent", 1 },
     { "importprivkey", 2 },
+    { "importprivkey", 3 },
     { "importaddress", 2 },
+    { "importaddress", 3 },
     { "verifychain", 0 },
     { "verifychain", 1 },
     { "keypoolrefill", 0 },
     { "getrawmempool", 0 },
+    { "getmempoolentries", 0 },
     { "estimatefee", 0 },
     { "estimatepriority", 0 },
     { "prioritisetransaction", 1 },
@@ -106,7 +124,9 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "zcrawjoinsplit", 4 },
     { "zcbenchmark", 1 },
     { "zcbenchmark", 2 },
+    { "zcbenchmark", 3 },
     { "getblocksubsidy", 0},
+    { "z_getnewaddresses", 0},
     { "z_listaddresses", 0},
     { "z_listreceivedbyaddress", 1},
     { "z_listunspent", 0 },
@@ -124,15 +144,21 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "z_mergetoaddress", 2},
     { "z_mergetoaddress", 3},
     { "z_mergetoaddress", 4},
+    { "z_mergetoaddress", 6},
     { "z_sendmany", 1},
     { "z_sendmany", 2},
     { "z_sendmany", 3},
     { "z_shieldcoinbase", 2},
     { "z_shieldcoinbase", 3},
+    { "z_shieldcoinbase", 4},
     { "z_getoperationstatus", 0},
+    { "z_getoperationstatus", 1},
     { "z_getoperationresult", 0},
+    { "z_getoperationresult", 1},
     { "z_importkey", 2 },
     { "z_importviewingkey", 2 },
+    { "z_importkeys", 0 },
+    { "z_importkeys", 1 },
     { "z_getpaymentdisclosure", 1},
     { "z_getpaymentdisclosure", 2}
 };
@@ -0,0 +1,117 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/jsonwriter.h"
+
+#include "tinyformat.h"
+#include "utilstrencodings.h"
+
+#include <iomanip>
+#include <sstream>
+
+void CJSONWriter::Escape(const std::string& s)
+{
+    // The same escapes as UniValue uses
+    for (size_t i = 0; i < s.size(); i++) {
+        unsigned char ch = s[i];
+        switch (ch) {
+        case '"': str += "\\\""; break;
+        case '\\': str += "\\\\"; break;
+        case '\b': str += "\\b"; break;
+        case '\t': str += "\\t"; break;
+        case '\n': str += "\\n"; break;
+        case '\f': str += "\\f"; break;
+        case '\r': str += "\\r"; break;
+        default:
+            if (ch < 0x20 || ch == 0x7f)
+                str += strprintf("\\u%04x", ch);
+            else
+                str += ch;
+        }
+    }
+}
+
+void CJSONWriter::AppendHex(const unsigned char* pbegin, const unsigned char* pend, bool fReverse)
+{
+    static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
+                                     '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+    Separate();
+    size_t nPos = str.size();
+    size_t nSize = pend - pbegin;
+    str.resize(nPos + 2 * nSize + 2);
+    char* p = &str[nPos];
+    *p++ = '"';
+    for (size_t i = 0; i < nSize; i++) {
+        unsigned char c = fReverse ? pbegin[nSize - 1 - i] : pbegin[i];
+        *p++ = hexmap[c >> 4];
+        *p++ = hexmap[c & 15];
+    }
+    *p = '"';
+    fSeparate = true;
+}
+
+CJSONWriter& CJSONWriter::Key(const std::string& key)
+{
+    Separate();
+    str += '"';
+    Escape(key);
+    str += "\":";
+    return *this;
+}
+
+CJSONWriter& CJSONWriter::String(const std::string& s)
+{
+    Separate();
+    str += '"';
+    Escape(s);
+    str += '"';
+    fSeparate = true;
+    return *this;
+}
+
+CJSONWriter& CJSONWriter::Int(int64_t n)
+{
+    Separate();
+    str += i64tostr(n);
+    fSeparate = true;
+    return *this;
+}
+
+CJSONWriter& CJSONWriter::Bool(bool f)
+{
+    Separate();
+    str += f ? "true" : "false";
+    fSeparate = true;
+    return *this;
+}
+
+CJSONWriter& CJSONWriter::Null()
+{
+    Separate();
+    str += "null";
+    fSeparate = true;
+    return *this;
+}
+
+CJSONWriter& CJSONWriter::Double(double d)
+{
+    Separate();
+    std::ostringstream oss;
+    oss << std::setprecision(16) << d;
+    str += oss.str();
+    fSeparate = true;
+    return *this;
+}
+
+CJSONWriter& CJSONWriter::Amount(const CAmount& amount)
+{
+    Separate();
+    bool sign = amount < 0;
+    int64_t n_abs = (sign ? -amount : amount);
+    int64_t quotient = n_abs / COIN;
+    int64_t remainder = n_abs % COIN;
+    str += strprintf("%s%d.%08d", sign ? "-" : "", quotient, remainder);
+    fSeparate = true;
+    return *this;
+}
@@ -0,0 +1,118 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPC_JSONWRITER_H
+#define BITCOIN_RPC_JSONWRITER_H
+
+#include "amount.h"
+
+#include <stdint.h>
+#include <string>
+
+#include <boost/function.hpp>
+
+/**
+ * Writes JSON straight into a string, for results too large to build as a
+ * UniValue tree first. The output is byte for byte what UniValue::write()
+ * gives for the same values without indentation.
+ *
+ * With a flush function set, the text written so far is handed to it and
+ * cleared whenever an object or array ends and it has grown past a size, so
+ * a reply can be sent while the rest of it is still being written.
+ */
+class CJSONWriter
+{
+private:
+    std::string& str;
+    //! Whether a value has just been completed, so the next one needs a comma
+    bool fSeparate;
+    boost::function<void(const std::string&)> flush;
+    size_t nFlushSize;
+
+    void Separate()
+    {
+        if (fSeparate)
+            str += ',';
+        fSeparate = false;
+    }
+    void Escape(const std::string& s);
+    void AppendHex(const unsigned char* pbegin, const unsigned char* pend, bool fReverse);
+    void MaybeFlush()
+    {
+        if (flush && str.size() >= nFlushSize) {
+            flush(str);
+            str.clear();
+        }
+    }
+
+public:
+    CJSONWriter(std::string& strIn) : str(strIn), fSeparate(false), nFlushSize(0) {}
+
+    //! Hand the text to flushIn whenever nFlushSizeIn bytes or more are pending
+    void SetFlush(const boost::function<void(const std::string&)>& flushIn, size_t nFlushSizeIn)
+    {
+        flush = flushIn;
+        nFlushSize = nFlushSizeIn;
+    }
+
+    CJSONWriter& BeginObject()
+    {
+        Separate();
+        str += '{';
+        return *this;
+    }
+    CJSONWriter& EndObject()
+    {
+        str += '}';
+        fSeparate = true;
+        MaybeFlush();
+        return *this;
+    }
+    CJSONWriter& BeginArray()
+    {
+        Separate();
+        str += '[';
+        return *this;
+    }
+    CJSONWriter& EndArray()
+    {
+        str += ']';
+        fSeparate = true;
+        MaybeFlush();
+        return *this;
+    }
+    //! Start a member of the current object; the value is written next
+    CJSONWriter& Key(const std::string& key);
+
+    CJSONWriter& String(const std::string& s);
+    CJSONWriter& Int(int64_t n);
+    CJSONWriter& Bool(bool f);
+    CJSONWriter& Null();
+    CJSONWriter& Double(double d);
+    //! An amount in coins, as ValueFromAmount writes it
+    CJSONWriter& Amount(const CAmount& amount);
+
+    //! A string of the bytes in hex, as HexStr gives
+    CJSONWriter& Hex(const unsigned char* pbegin, const unsigned char* pend)
+    {
+        AppendHex(pbegin, pend, false);
+        return *this;
+    }
+    template<typename T>
+    CJSONWriter& Hex(const T& data)
+    {
+        const unsigned char* pbegin = data.empty() ? NULL : (const unsigned char*)&data[0];
+        AppendHex(pbegin, pbegin + data.size(), false);
+        return *this;
+    }
+    //! A hash or other blob, as GetHex gives (most significant byte first)
+    template<typename T>
+    CJSONWriter& Blob(const T& blob)
+    {
+        AppendHex(blob.begin(), blob.end(), true);
+        return *this;
+    }
+};
+
+#endif // BITCOIN_RPC_JSONWRITER_H
@@ -9,9 +9,11 @@
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
 #include "core_io.h"
+#include "corebudget.h"
 #ifdef ENABLE_MINING
 #include "crypto/equihash.h"
 #endif
+#include "httpserver.h"
 #include "init.h"
 #include "main.h"
 #include "metrics.h"
@@ -20,15 +22,22 @@
 #include "pow.h"
 #include "rpc/server.h"
 #include "txmempool.h"
+#include "ui_interface.h"
 #include "util.h"
+#include "utilmoneystr.h"
 #include "validationinterface.h"
 #ifdef ENABLE_WALLET
 #include "wallet/wallet.h"
 #endif
 
+#include <limits>
+#include <list>
+#include <memory>
 #include <stdint.h>
 
 #include <boost/assign/list_of.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 
 #include <univalue.h>
 
@@ -40,40 +49,19 @@ using namespace std;
  * If 'height' is nonnegative, compute the estimate at the time when a given block was found.
  */
 int64_t GetNetworkHashPS(int lookup, int height) {
+    // The usual estimate, for the tip over the default window, is kept with
+    // the tip, so it is neither walked for nor needs cs_main
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    if (tip && lookup == DEFAULT_SOLPS_LOOKUP && (height < 0 || height >= tip->nHeight))
+        return tip->nNetworkSolPS;
+
+    LOCK(cs_main);
     CBlockIndex *pb = chainActive.Tip();
 
     if (height >= 0 && height < chainActive.Height())
         pb = chainActive[height];
 
-    if (pb == NULL || !pb->nHeight)
-        return 0;
-
-    // If lookup is nonpositive, then use difficulty averaging window.
-    if (lookup <= 0)
-        lookup = Params().GetConsensus().nPowAveragingWindow;
-
-    // If lookup is larger than chain, then set it to chain length.
-    if (lookup > pb->nHeight)
-        lookup = pb->nHeight;
-
-    CBlockIndex *pb0 = pb;
-    int64_t minTime = pb0->GetBlockTime();
-    int64_t maxTime = minTime;
-    for (int i = 0; i < lookup; i++) {
-        pb0 = pb0->pprev;
-        int64_t time = pb0->GetBlockTime();
-        minTime = std::min(time, minTime);
-        maxTime = std::max(time, maxTime);
-    }
-
-    // In case there's a situation where minTime == maxTime, we don't want a divide by zero exception.
-    if (minTime == maxTime)
-        return 0;
-
-    arith_uint256 workDiff = pb->nChainWork - pb0->nChainWork;
-    int64_t timeDiff = maxTime - minTime;
-
-    return (int64_t)(workDiff.getdouble() / timeDiff);
+    return GetNetworkSolPS(pb, lookup, Params().GetConsensus());
 }
 
 UniValue getlocalsolps(const UniValue& params, bool fHelp)
@@ -112,8 +100,7 @@ UniValue getnetworksolps(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getnetworksolps", "")
        );
 
-    LOCK(cs_main);
-    return GetNetworkHashPS(params.size() > 0 ? params[0].get_int() : 120, params.size() > 1 ? params[1].get_int() : -1);
+    return GetNetworkHashPS(params.size() > 0 ? params[0].get_int() : DEFAULT_SOLPS_LOOKUP, params.size() > 1 ? params[1].get_int() : -1);
 }
 
 UniValue getnetworkhashps(const UniValue& params, bool fHelp)
@@ -135,8 +122,7 @@ UniValue getnetworkhashps(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getnetworkhashps", "")
        );
 
-    LOCK(cs_main);
-    return GetNetworkHashPS(params.size() > 0 ? params[0].get_int() : 120, params.size() > 1 ? params[1].get_int() : -1);
+    return GetNetworkHashPS(params.size() > 0 ? params[0].get_int() : DEFAULT_SOLPS_LOOKUP, params.size() > 1 ? params[1].get_int() : -1);
 }
 
 #ifdef ENABLE_MINING
@@ -431,6 +417,289 @@ static UniValue BIP22ValidationResult(const CValidationState& state)
     return "valid?";
 }
 
+//! Mempool state when the shared template was last rebuilt; guarded by cs_main
+static unsigned int nTransactionsUpdatedLast;
+static CAmount nFeesAddedLast;
+
+static UniValue BlockTemplateResult();
+
+namespace {
+
+/**
+ * A getblocktemplate long poll that is answered, without holding a thread
+ * while it waits, once the template it was given is worth replacing.
+ */
+struct CLongPollWaiter
+{
+    uint256 hashWatchedChain;
+    unsigned int nTransactionsUpdated;
+    //! Fees added to the mempool since the listeners started at which to answer
+    CAmount nFeesTarget;
+    //! Time after which any change to the mempool is reason enough to answer
+    int64_t nTimeRefresh;
+    RPCDeferredReply reply;
+};
+
+boost::mutex cs_longpoll;
+std::list<CLongPollWaiter> lLongPollWaiters;
+//! Fees of the transactions added to the mempool since the listeners started
+CAmount nLongPollFeesAdded = 0;
+//! Smallest nFeesTarget of the waiters
+CAmount nLongPollNextFees = std::numeric_limits<CAmount>::max();
+bool fLongPollStarted = false;
+
+} // namespace
+
+/** Build the template once and send it to every waiter that was woken */
+static void ServeLongPolls(std::shared_ptr<std::vector<RPCDeferredReply> > vReplies)
+{
+    UniValue result;
+    UniValue objError;
+    try {
+        LOCK(cs_main);
+        if (!IsRPCRunning())
+            throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
+        result = BlockTemplateResult();
+    } catch (const UniValue& e) {
+        objError = e;
+    } catch (const std::exception& e) {
+        objError = JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+    BOOST_FOREACH (const RPCDeferredReply& reply, *vReplies)
+        reply(result, objError);
+}
+
+/**
+ * Answer the waiters fWake picks, from one task on an RPC worker thread. The
+ * callers may hold mempool.cs, so nothing here takes cs_main. Requires
+ * cs_longpoll.
+ */
+template <typename Predicate>
+static void WakeLongPolls(Predicate fWake)
+{
+    std::shared_ptr<std::vector<RPCDeferredReply> > vReplies(new std::vector<RPCDeferredReply>());
+    nLongPollNextFees = std::numeric_limits<CAmount>::max();
+    for (std::list<CLongPollWaiter>::iterator it = lLongPollWaiters.begin(); it != lLongPollWaiters.end();) {
+        if (fWake(*it)) {
+            vReplies->push_back(it->reply);
+            it = lLongPollWaiters.erase(it);
+        } else {
+            nLongPollNextFees = std::min(nLongPollNextFees, it->nFeesTarget);
+            ++it;
+        }
+    }
+    if (vReplies->empty())
+        return;
+    if (!IsRPCRunning() || !HTTPEnqueueTask(boost::bind(&ServeLongPolls, vReplies), HTTP_WORK_DEFAULT)) {
+        UniValue objError = IsRPCRunning() ? JSONRPCError(RPC_INTERNAL_ERROR, "Work queue depth exceeded")
+                                           : JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
+        BOOST_FOREACH (const RPCDeferredReply& reply, *vReplies)
+            reply(NullUniValue, objError);
+    }
+}
+
+static void LongPollBlockTip(const uint256& hashNewTip)
+{
+    boost::unique_lock<boost::mutex> lock(cs_longpoll);
+    WakeLongPolls([&hashNewTip](const CLongPollWaiter& waiter) { return waiter.hashWatchedChain != hashNewTip; });
+}
+
+static void LongPollEntryAdded(const CTxMemPoolEntry& entry)
+{
+    boost::unique_lock<boost::mutex> lock(cs_longpoll);
+    nLongPollFeesAdded += entry.GetFee();
+    if (nLongPollFeesAdded < nLongPollNextFees)
+        return;
+    WakeLongPolls([](const CLongPollWaiter& waiter) { return nLongPollFeesAdded >= waiter.nFeesTarget; });
+}
+
+void CheckLongPolls()
+{
+    unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    int64_t nNow = GetTime();
+    boost::unique_lock<boost::mutex> lock(cs_longpoll);
+    if (lLongPollWaiters.empty())
+        return;
+    WakeLongPolls([nTransactionsUpdated, nNow](const CLongPollWaiter& waiter) {
+        return nNow >= waiter.nTimeRefresh && nTransactionsUpdated != waiter.nTransactionsUpdated;
+    });
+}
+
+static void LongPollStopped()
+{
+    boost::unique_lock<boost::mutex> lock(cs_longpoll);
+    // RPC isn't running any more, so every waiter is told so
+    WakeLongPolls([](const CLongPollWaiter&) { return true; });
+}
+
+/** Start listening for the events that answer long polls, on first use */
+static void StartLongPolls()
+{
+    boost::unique_lock<boost::mutex> lock(cs_longpoll);
+    if (fLongPollStarted)
+        return;
+    uiInterface.NotifyBlockTip.connect(&LongPollBlockTip);
+    mempool.NotifyEntryAdded.connect(&LongPollEntryAdded);
+    RPCServer::OnStopped(&LongPollStopped);
+    fLongPollStarted = true;
+}
+
+static CAmount GetLongPollFeesAdded()
+{
+    boost::unique_lock<boost::mutex> lock(cs_longpoll);
+    return nLongPollFeesAdded;
+}
+
+static void AddLongPollWaiter(const CLongPollWaiter& waiterIn, const RPCDeferredReply& reply)
+{
+    boost::unique_lock<boost::mutex> lock(cs_longpoll);
+    lLongPollWaiters.push_back(waiterIn);
+    CLongPollWaiter& waiter = lLongPollWaiters.back();
+    waiter.reply = reply;
+
+    // The tip may have moved on since the call looked, but the notification
+    // of any later one comes after this
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    uint256 hashTip = tip ? tip->hash : uint256();
+    CLongPollWaiter* pwaiter = &waiter;
+    WakeLongPolls([pwaiter, &hashTip](const CLongPollWaiter& w) {
+        return &w == pwaiter && (!IsRPCRunning() || w.hashWatchedChain != hashTip || nLongPollFeesAdded >= w.nFeesTarget);
+    });
+}
+
+/**
+ * The template every getblocktemplate call is answered with. It is shared
+ * between calls and only rebuilt when the tip has changed, or the mempool has
+ * and the template is more than a few seconds old. Requires cs_main.
+ */
+static UniValue BlockTemplateResult()
+{
+    // TODO: Re-enable coinbasevalue once a specification has been written
+    bool coinbasetxn = true;
+
+    static CBlockIndex* pindexPrev;
+    static int64_t nStart;
+    static CBlockTemplate* pblocktemplate;
+    if (pindexPrev != chainActive.Tip() ||
+        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
+    {
+        // Clear pindexPrev so future calls make a new block, despite any failures from here on
+        pindexPrev = NULL;
+
+        // Store the pindexBest used before CreateNewBlockWithKey, to avoid races
+        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+        nFeesAddedLast = GetLongPollFeesAdded();
+        CBlockIndex* pindexPrevNew = chainActive.Tip();
+        nStart = GetTime();
+
+        // Create new block
+        if(pblocktemplate)
+        {
+            delete pblocktemplate;
+            pblocktemplate = NULL;
+        }
+#ifdef ENABLE_WALLET
+        CReserveKey reservekey(pwalletMain);
+        pblocktemplate = CreateNewBlockWithKey(reservekey);
+#else
+        pblocktemplate = CreateNewBlockWithKey();
+#endif
+        if (!pblocktemplate)
+            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+
+        // Need to update only after we know CreateNewBlockWithKey succeeded
+        pindexPrev = pindexPrevNew;
+    }
+    CBlock* pblock = &pblocktemplate->block; // pointer for convenience
+
+    // Update nTime
+    UpdateTime(pblock, Params().GetConsensus(), pindexPrev);
+    pblock->nNonce = uint256();
+
+    UniValue aCaps(UniValue::VARR); aCaps.push_back("proposal");
+
+    UniValue txCoinbase = NullUniValue;
+    UniValue transactions(UniValue::VARR);
+    map<uint256, int64_t> setTxIndex;
+    int i = 0;
+    BOOST_FOREACH (const CTransactionRef& ptx, pblock->vtx) {
+        const CTransaction& tx = *ptx;
+        uint256 txHash = tx.GetHash();
+        setTxIndex[txHash] = i++;
+
+        if (tx.IsCoinBase() && !coinbasetxn)
+            continue;
+
+        UniValue entry(UniValue::VOBJ);
+
+        entry.push_back(Pair("data", EncodeHexTx(tx)));
+
+        entry.push_back(Pair("hash", txHash.GetHex()));
+
+        UniValue deps(UniValue::VARR);
+        BOOST_FOREACH (const CTxIn &in, tx.vin)
+        {
+            if (setTxIndex.count(in.prevout.hash))
+                deps.push_back(setTxIndex[in.prevout.hash]);
+        }
+        entry.push_back(Pair("depends", deps));
+
+        int index_in_template = i - 1;
+        entry.push_back(Pair("fee", pblocktemplate->vTxFees[index_in_template]));
+        entry.push_back(Pair("sigops", pblocktemplate->vTxSigOps[index_in_template]));
+
+        if (tx.IsCoinBase()) {
+            // Show founders' reward if it is required
+            entry.push_back(Pair("required", true));
+            txCoinbase = entry;
+        } else {
+            transactions.push_back(entry);
+        }
+    }
+
+    UniValue aux(UniValue::VOBJ);
+    aux.push_back(Pair("flags", HexStr(COINBASE_FLAGS.begin(), COINBASE_FLAGS.end())));
+
+    arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
+
+    static UniValue aMutable(UniValue::VARR);
+    if (aMutable.empty())
+    {
+        aMutable.push_back("time");
+        aMutable.push_back("transactions");
+        aMutable.push_back("prevblock");
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("capabilities", aCaps));
+    result.push_back(Pair("version", pblock->nVersion));
+    result.push_back(Pair("previousblockhash", pblock->hashPrevBlock.GetHex()));
+    result.push_back(Pair("finalsaplingroothash", pblock->hashFinalSaplingRoot.GetHex()));
+    result.push_back(Pair("transactions", transactions));
+    if (coinbasetxn) {
+        assert(txCoinbase.isObject());
+        result.push_back(Pair("coinbasetxn", txCoinbase));
+    } else {
+        result.push_back(Pair("coinbaseaux", aux));
+        result.push_back(Pair("coinbasevalue", (int64_t)pblock->vtx[0]->vout[0].nValue));
+    }
+    result.push_back(Pair("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast)));
+    result.push_back(Pair("target", hashTarget.GetHex()));
+    result.push_back(Pair("mintime", (int64_t)pindexPrev->GetMedianTimePast()+1));
+    result.push_back(Pair("mutable", aMutable));
+    result.push_back(Pair("noncerange", "00000000ffffffff"));
+    result.push_back(Pair("sigoplimit", (int64_t)MAX_BLOCK_SIGOPS));
+    result.push_back(Pair("sizelimit", (int64_t)MAX_BLOCK_SIZE));
+    result.push_back(Pair("curtime", pblock->GetBlockTime()));
+    result.push_back(Pair("bits", strprintf("%08x", pblock->nBits)));
+    int height = pindexPrev->nHeight + 1;
+    result.push_back(Pair("height", (int64_t)height));
+    result.push_back(Pair("equihashn", (int64_t)(Params().EquihashN(height))));
+    result.push_back(Pair("equihashk", (int64_t)(Params().EquihashK(height))));
+
+    return result;
+}
+
 UniValue getblocktemplate(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -511,8 +780,6 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
 
     std::string strMode = "template";
     UniValue lpval = NullUniValue;
-    // TODO: Re-enable coinbasevalue once a specification has been written
-    bool coinbasetxn = true;
     if (params.size() > 0)
     {
         const UniValue& oparam = params[0].get_obj();
@@ -567,7 +834,7 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     if (IsInitialBlockDownload())
         throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "LitecoinZ is downloading blocks...");
 
-    static unsigned int nTransactionsUpdatedLast;
+    StartLongPolls();
 
     if (!lpval.isNull())
     {
@@ -591,150 +858,55 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
             nTransactionsUpdatedLastLP = nTransactionsUpdatedLast;
         }
 
-        // Release the wallet and main lock while waiting
-        LEAVE_CRITICAL_SECTION(cs_main);
-        {
-            checktxtime = boost::get_system_time() + boost::posix_time::minutes(1);
-
-            boost::unique_lock<boost::mutex> lock(csBestBlock);
-            while (chainActive.Tip()->GetBlockHash() == hashWatchedChain && IsRPCRunning())
+        if (RPCCanDefer()) {
+            // Wait without a thread, to be answered as soon as the tip changes
+            // or transactions paying -longpollfeedelta in fees have arrived
+            // since the caller's template, or after a minute if the mempool has
+            // changed at all, as CheckLongPolls finds
+            if (chainActive.Tip()->GetBlockHash() == hashWatchedChain) {
+                CAmount nFeeDelta = DEFAULT_LONGPOLL_FEE_DELTA;
+                if (mapArgs.count("-longpollfeedelta"))
+                    ParseMoney(mapArgs["-longpollfeedelta"], nFeeDelta);
+                CLongPollWaiter waiter;
+                waiter.hashWatchedChain = hashWatchedChain;
+                waiter.nTransactionsUpdated = nTransactionsUpdatedLastLP;
+                // Count from the template the caller has if it's the current one
+                CAmount nFeesBase = nTransactionsUpdatedLastLP == nTransactionsUpdatedLast ? nFeesAddedLast : GetLongPollFeesAdded();
+                waiter.nFeesTarget = nFeesBase + nFeeDelta;
+                waiter.nTimeRefresh = GetTime() + 60;
+                RPCDeferral deferral;
+                deferral.start = boost::bind(&AddLongPollWaiter, waiter, _1);
+                throw deferral;
+            }
+        } else {
+            // Release the wallet and main lock while waiting
+            LEAVE_CRITICAL_SECTION(cs_main);
             {
-                if (!cvBlockChange.timed_wait(lock, checktxtime))
+                checktxtime = boost::get_system_time() + boost::posix_time::minutes(1);
+                // Don't keep this request's core while waiting
+                CCoreRelease releaseCore;
+
+                boost::unique_lock<boost::mutex> lock(csBestBlock);
+                while (chainActive.Tip()->GetBlockHash() == hashWatchedChain && IsRPCRunning())
                 {
-                    // Timeout: Check transactions for update
-                    if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLastLP)
-                        break;
-                    checktxtime += boost::posix_time::seconds(10);
+                    if (!cvBlockChange.timed_wait(lock, checktxtime))
+                    {
+                        // Timeout: Check transactions for update
+                        if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLastLP)
+                            break;
+                        checktxtime += boost::posix_time::seconds(10);
+                    }
                 }
             }
-        }
-        ENTER_CRITICAL_SECTION(cs_main);
-
-        if (!IsRPCRunning())
-            throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
-        // TODO: Maybe recheck connections/IBD and (if something wrong) send an expires-immediately template to stop miners?
-    }
-
-    // Update block
-    static CBlockIndex* pindexPrev;
-    static int64_t nStart;
-    static CBlockTemplate* pblocktemplate;
-    if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
-    {
-        // Clear pindexPrev so future calls make a new block, despite any failures from here on
-        pindexPrev = NULL;
-
-        // Store the pindexBest used before CreateNewBlockWithKey, to avoid races
-        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-        CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
-
-        // Create new block
-        if(pblocktemplate)
-        {
-            delete pblocktemplate;
-            pblocktemplate = NULL;
-        }
-#ifdef ENABLE_WALLET
-        CReserveKey reservekey(pwalletMain);
-        pblocktemplate = CreateNewBlockWithKey(reservekey);
-#else
-        pblocktemplate = CreateNewBlockWithKey();
-#endif
-        if (!pblocktemplate)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-        // Need to update only after we know CreateNewBlockWithKey succeeded
-        pindexPrev = pindexPrevNew;
-    }
-    CBlock* pblock = &pblocktemplate->block; // pointer for convenience
-
-    // Update nTime
-    UpdateTime(pblock, Params().GetConsensus(), pindexPrev);
-    pblock->nNonce = uint256();
+            ENTER_CRITICAL_SECTION(cs_main);
 
-    UniValue aCaps(UniValue::VARR); aCaps.push_back("proposal");
-
-    UniValue txCoinbase = NullUniValue;
-    UniValue transactions(UniValue::VARR);
-    map<uint256, int64_t> setTxIndex;
-    int i = 0;
-    BOOST_FOREACH (const CTransaction& tx, pblock->vtx) {
-        uint256 txHash = tx.GetHash();
-        setTxIndex[txHash] = i++;
-
-        if (tx.IsCoinBase() && !coinbasetxn)
-            continue;
-
-        UniValue entry(UniValue::VOBJ);
-
-        entry.push_back(Pair("data", EncodeHexTx(tx)));
-
-        entry.push_back(Pair("hash", txHash.GetHex()));
-
-        UniValue deps(UniValue::VARR);
-        BOOST_FOREACH (const CTxIn &in, tx.vin)
-        {
-            if (setTxIndex.count(in.prevout.hash))
-                deps.push_back(setTxIndex[in.prevout.hash]);
+            if (!IsRPCRunning())
+                throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
         }
-        entry.push_back(Pair("depends", deps));
-
-        int index_in_template = i - 1;
-        entry.push_back(Pair("fee", pblocktemplate->vTxFees[index_in_template]));
-        entry.push_back(Pair("sigops", pblocktemplate->vTxSigOps[index_in_template]));
-
-        if (tx.IsCoinBase()) {
-            // Show founders' reward if it is required
-            entry.push_back(Pair("required", true));
-            txCoinbase = entry;
-        } else {
-            transactions.push_back(entry);
-        }
-    }
-
-    UniValue aux(UniValue::VOBJ);
-    aux.push_back(Pair("flags", HexStr(COINBASE_FLAGS.begin(), COINBASE_FLAGS.end())));
-
-    arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
-
-    static UniValue aMutable(UniValue::VARR);
-    if (aMutable.empty())
-    {
-        aMutable.push_back("time");
-        aMutable.push_back("transactions");
-        aMutable.push_back("prevblock");
-    }
-
-    UniValue result(UniValue::VOBJ);
-    result.push_back(Pair("capabilities", aCaps));
-    result.push_back(Pair("version", pblock->nVersion));
-    result.push_back(Pair("previousblockhash", pblock->hashPrevBlock.GetHex()));
-    result.push_back(Pair("finalsaplingroothash", pblock->hashFinalSaplingRoot.GetHex()));
-    result.push_back(Pair("transactions", transactions));
-    if (coinbasetxn) {
-        assert(txCoinbase.isObject());
-        result.push_back(Pair("coinbasetxn", txCoinbase));
-    } else {
-        result.push_back(Pair("coinbaseaux", aux));
-        result.push_back(Pair("coinbasevalue", (int64_t)pblock->vtx[0].vout[0].nValue));
+        // TODO: Maybe recheck connections/IBD and (if something wrong) send an expires-immediately template to stop miners?
     }
-    result.push_back(Pair("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast)));
-    result.push_back(Pair("target", hashTarget.GetHex()));
-    result.push_back(Pair("mintime", (int64_t)pindexPrev->GetMedianTimePast()+1));
-    result.push_back(Pair("mutable", aMutable));
-    result.push_back(Pair("noncerange", "00000000ffffffff"));
-    result.push_back(Pair("sigoplimit", (int64_t)MAX_BLOCK_SIGOPS));
-    result.push_back(Pair("sizelimit", (int64_t)MAX_BLOCK_SIZE));
-    result.push_back(Pair("curtime", pblock->GetBlockTime()));
-    result.push_back(Pair("bits", strprintf("%08x", pblock->nBits)));
-    int height = pindexPrev->nHeight + 1;
-    result.push_back(Pair("height", (int64_t)height));
-    result.push_back(Pair("equihashn", (int64_t)(Params().EquihashN(height))));
-    result.push_back(Pair("equihashk", (int64_t)(Params().EquihashK(height))));
 
-    return result;
+    return BlockTemplateResult();
 }
 
 class submitblock_StateCatcher : public CValidationInterface
@@ -911,25 +1083,25 @@ UniValue getblocksubsidy(const UniValue& params, bool fHelp)
 }
 
 static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
-    { "mining",             "getlocalsolps",          &getlocalsolps,          true  },
-    { "mining",             "getnetworksolps",        &getnetworksolps,        true  },
-    { "mining",             "getnetworkhashps",       &getnetworkhashps,       true  },
-    { "mining",             "getmininginfo",          &getmininginfo,          true  },
-    { "mining",             "prioritisetransaction",  &prioritisetransaction,  true  },
-    { "mining",             "getblocktemplate",       &getblocktemplate,       true  },
-    { "mining",             "submitblock",            &submitblock,            true  },
-    { "mining",             "getblocksubsidy",        &getblocksubsidy,        true  },
+{ //  category              name                      actor (function)         okSafeMode  okParallel
+  //  --------------------- ------------------------  -----------------------  ----------  ----------
+    { "mining",             "getlocalsolps",          &getlocalsolps,          true,  false },
+    { "mining",             "getnetworksolps",        &getnetworksolps,        true,  false },
+    { "mining",             "getnetworkhashps",       &getnetworkhashps,       true,  false },
+    { "mining",             "getmininginfo",          &getmininginfo,          true,  false },
+    { "mining",             "prioritisetransaction",  &prioritisetransaction,  true,  false },
+    { "mining",             "getblocktemplate",       &getblocktemplate,       true,  false },
+    { "mining",             "submitblock",            &submitblock,            true,  false },
+    { "mining",             "getblocksubsidy",        &getblocksubsidy,        true,  false },
 
 #ifdef ENABLE_MINING
-    { "generating",         "getgenerate",            &getgenerate,            true  },
-    { "generating",         "setgenerate",            &setgenerate,            true  },
-    { "generating",         "generate",               &generate,               true  },
+    { "generating",         "getgenerate",            &getgenerate,            true,  false },
+    { "generating",         "setgenerate",            &setgenerate,            true,  false },
+    { "generating",         "generate",               &generate,               true,  false },
 #endif
 
-    { "util",               "estimatefee",            &estimatefee,            true  },
-    { "util",               "estimatepriority",       &estimatepriority,       true  },
+    { "util",               "estimatefee",            &estimatefee,            true,  false },
+    { "util",               "estimatepriority",       &estimatepriority,       true,  false },
 };
 
 void RegisterMiningRPCCommands(CRPCTable &tableRPC)
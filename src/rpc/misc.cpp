@@ -4,6 +4,8 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "addressindex.h"
+#include "addrman.h"
 #include "clientversion.h"
 #include "init.h"
 #include "key_io.h"
@@ -12,13 +14,23 @@
 #include "netbase.h"
 #include "rpc/server.h"
 #include "timedata.h"
+#include "txdb.h"
+#include "responsecache.h"
+#include "txindexcache.h"
+#include "txmempool.h"
 #include "util.h"
+#include "utilstrencodings.h"
 #ifdef ENABLE_WALLET
+#include "wallet/rpcwallet.h"
 #include "wallet/wallet.h"
 #include "wallet/walletdb.h"
 #endif
 
+#include <algorithm>
 #include <stdint.h>
+#ifdef HAVE_MALLOC_INFO
+#include <malloc.h>
+#endif
 
 #include <boost/assign/list_of.hpp>
 
@@ -43,6 +55,12 @@ using namespace std;
  **/
 UniValue getinfo(const UniValue& params, bool fHelp)
 {
+#ifdef ENABLE_WALLET
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+#else
+    CWallet * const pwallet = NULL;
+#endif
+
     if (fHelp || params.size() != 0)
         throw runtime_error(
             "getinfo\n"
@@ -72,7 +90,7 @@ UniValue getinfo(const UniValue& params, bool fHelp)
         );
 
 #ifdef ENABLE_WALLET
-    LOCK2(cs_main, pwalletMain ? &pwalletMain->cs_wallet : NULL);
+    LOCK2(cs_main, pwallet ? &pwallet->cs_wallet : NULL);
 #else
     LOCK(cs_main);
 #endif
@@ -84,9 +102,9 @@ UniValue getinfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("version", CLIENT_VERSION));
     obj.push_back(Pair("protocolversion", PROTOCOL_VERSION));
 #ifdef ENABLE_WALLET
-    if (pwalletMain) {
-        obj.push_back(Pair("walletversion", pwalletMain->GetVersion()));
-        obj.push_back(Pair("balance",       ValueFromAmount(pwalletMain->GetBalance())));
+    if (pwallet) {
+        obj.push_back(Pair("walletversion", pwallet->GetVersion()));
+        obj.push_back(Pair("balance",       ValueFromAmount(pwallet->GetBalance())));
     }
 #endif
     obj.push_back(Pair("blocks",        (int)chainActive.Height()));
@@ -96,12 +114,12 @@ UniValue getinfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("difficulty",    (double)GetDifficulty()));
     obj.push_back(Pair("testnet",       Params().TestnetToBeDeprecatedFieldRPC()));
 #ifdef ENABLE_WALLET
-    if (pwalletMain) {
-        obj.push_back(Pair("keypoololdest", pwalletMain->GetOldestKeyPoolTime()));
-        obj.push_back(Pair("keypoolsize",   (int)pwalletMain->GetKeyPoolSize()));
+    if (pwallet) {
+        obj.push_back(Pair("keypoololdest", pwallet->GetOldestKeyPoolTime()));
+        obj.push_back(Pair("keypoolsize",   (int)pwallet->GetKeyPoolSize()));
     }
-    if (pwalletMain && pwalletMain->IsCrypted())
-        obj.push_back(Pair("unlocked_until", nWalletUnlockTime));
+    if (pwallet && pwallet->IsCrypted())
+        obj.push_back(Pair("unlocked_until", pwallet->nRelockTime));
     obj.push_back(Pair("paytxfee",      ValueFromAmount(payTxFee.GetFeePerK())));
 #endif
     obj.push_back(Pair("relayfee",      ValueFromAmount(::minRelayTxFee.GetFeePerK())));
@@ -113,13 +131,17 @@ UniValue getinfo(const UniValue& params, bool fHelp)
 class DescribeAddressVisitor : public boost::static_visitor<UniValue>
 {
 public:
+    CWallet * const pwallet;
+
+    explicit DescribeAddressVisitor(CWallet *_pwallet) : pwallet(_pwallet) {}
+
     UniValue operator()(const CNoDestination &dest) const { return UniValue(UniValue::VOBJ); }
 
     UniValue operator()(const CKeyID &keyID) const {
         UniValue obj(UniValue::VOBJ);
         CPubKey vchPubKey;
         obj.push_back(Pair("isscript", false));
-        if (pwalletMain && pwalletMain->GetPubKey(keyID, vchPubKey)) {
+        if (pwallet && pwallet->GetPubKey(keyID, vchPubKey)) {
             obj.push_back(Pair("pubkey", HexStr(vchPubKey)));
             obj.push_back(Pair("iscompressed", vchPubKey.IsCompressed()));
         }
@@ -130,7 +152,7 @@ public:
         UniValue obj(UniValue::VOBJ);
         CScript subscript;
         obj.push_back(Pair("isscript", true));
-        if (pwalletMain && pwalletMain->GetCScript(scriptID, subscript)) {
+        if (pwallet && pwallet->GetCScript(scriptID, subscript)) {
             std::vector<CTxDestination> addresses;
             txnouttype whichType;
             int nRequired;
@@ -152,6 +174,12 @@ public:
 
 UniValue validateaddress(const UniValue& params, bool fHelp)
 {
+#ifdef ENABLE_WALLET
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+#else
+    CWallet * const pwallet = NULL;
+#endif
+
     if (fHelp || params.size() != 1)
         throw runtime_error(
             "validateaddress \"litecoinzaddress\"\n"
@@ -175,7 +203,7 @@ UniValue validateaddress(const UniValue& params, bool fHelp)
         );
 
 #ifdef ENABLE_WALLET
-    LOCK2(cs_main, pwalletMain ? &pwalletMain->cs_wallet : NULL);
+    LOCK2(cs_main, pwallet ? &pwallet->cs_wallet : NULL);
 #else
     LOCK(cs_main);
 #endif
@@ -194,13 +222,13 @@ UniValue validateaddress(const UniValue& params, bool fHelp)
         ret.push_back(Pair("scriptPubKey", HexStr(scriptPubKey.begin(), scriptPubKey.end())));
 
 #ifdef ENABLE_WALLET
-        isminetype mine = pwalletMain ? IsMine(*pwalletMain, dest) : ISMINE_NO;
+        isminetype mine = pwallet ? IsMine(*pwallet, dest) : ISMINE_NO;
         ret.push_back(Pair("ismine", (mine & ISMINE_SPENDABLE) ? true : false));
         ret.push_back(Pair("iswatchonly", (mine & ISMINE_WATCH_ONLY) ? true: false));
-        UniValue detail = boost::apply_visitor(DescribeAddressVisitor(), dest);
+        UniValue detail = boost::apply_visitor(DescribeAddressVisitor(pwallet), dest);
         ret.pushKVs(detail);
-        if (pwalletMain && pwalletMain->mapAddressBook.count(dest))
-            ret.push_back(Pair("account", pwalletMain->mapAddressBook[dest].name));
+        if (pwallet && pwallet->mapAddressBook.count(dest))
+            ret.push_back(Pair("account", pwallet->mapAddressBook[dest].name));
 #endif
     }
     return ret;
@@ -210,6 +238,10 @@ UniValue validateaddress(const UniValue& params, bool fHelp)
 class DescribePaymentAddressVisitor : public boost::static_visitor<UniValue>
 {
 public:
+    CWallet * const pwallet;
+
+    explicit DescribePaymentAddressVisitor(CWallet *_pwallet) : pwallet(_pwallet) {}
+
     UniValue operator()(const libzcash::InvalidEncoding &zaddr) const { return UniValue(UniValue::VOBJ); }
 
     UniValue operator()(const libzcash::SproutPaymentAddress &zaddr) const {
@@ -218,8 +250,8 @@ public:
         obj.push_back(Pair("payingkey", zaddr.a_pk.GetHex()));
         obj.push_back(Pair("transmissionkey", zaddr.pk_enc.GetHex()));
 #ifdef ENABLE_WALLET
-        if (pwalletMain) {
-            obj.push_back(Pair("ismine", pwalletMain->HaveSproutSpendingKey(zaddr)));
+        if (pwallet) {
+            obj.push_back(Pair("ismine", pwallet->HaveSproutSpendingKey(zaddr)));
         }
 #endif
         return obj;
@@ -231,12 +263,12 @@ public:
         obj.push_back(Pair("diversifier", HexStr(zaddr.d)));
         obj.push_back(Pair("diversifiedtransmissionkey", zaddr.pk_d.GetHex()));
 #ifdef ENABLE_WALLET
-        if (pwalletMain) {
+        if (pwallet) {
             libzcash::SaplingIncomingViewingKey ivk;
             libzcash::SaplingFullViewingKey fvk;
-            bool isMine = pwalletMain->GetSaplingIncomingViewingKey(zaddr, ivk) &&
-                pwalletMain->GetSaplingFullViewingKey(ivk, fvk) &&
-                pwalletMain->HaveSaplingSpendingKey(fvk);
+            bool isMine = pwallet->GetSaplingIncomingViewingKey(zaddr, ivk) &&
+                pwallet->GetSaplingFullViewingKey(ivk, fvk) &&
+                pwallet->HaveSaplingSpendingKey(fvk);
             obj.push_back(Pair("ismine", isMine));
         }
 #endif
@@ -246,6 +278,12 @@ public:
 
 UniValue z_validateaddress(const UniValue& params, bool fHelp)
 {
+#ifdef ENABLE_WALLET
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+#else
+    CWallet * const pwallet = NULL;
+#endif
+
     if (fHelp || params.size() != 1)
         throw runtime_error(
             "z_validateaddress \"zaddr\"\n"
@@ -271,7 +309,7 @@ UniValue z_validateaddress(const UniValue& params, bool fHelp)
 
 
 #ifdef ENABLE_WALLET
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 #else
     LOCK(cs_main);
 #endif
@@ -285,7 +323,7 @@ UniValue z_validateaddress(const UniValue& params, bool fHelp)
     if (isValid)
     {
         ret.push_back(Pair("address", strAddress));
-        UniValue detail = boost::apply_visitor(DescribePaymentAddressVisitor(), address);
+        UniValue detail = boost::apply_visitor(DescribePaymentAddressVisitor(pwallet), address);
         ret.pushKVs(detail);
     }
     return ret;
@@ -295,7 +333,7 @@ UniValue z_validateaddress(const UniValue& params, bool fHelp)
 /**
  * Used by addmultisigaddress / createmultisig:
  */
-CScript _createmultisig_redeemScript(const UniValue& params)
+CScript _createmultisig_redeemScript(CWallet * const pwallet, const UniValue& params)
 {
     int nRequired = params[0].get_int();
     const UniValue& keys = params[1].get_array();
@@ -317,13 +355,13 @@ CScript _createmultisig_redeemScript(const UniValue& params)
 #ifdef ENABLE_WALLET
         // Case 1: Bitcoin address and we have full public key:
         CTxDestination dest = DecodeDestination(ks);
-        if (pwalletMain && IsValidDestination(dest)) {
+        if (pwallet && IsValidDestination(dest)) {
             const CKeyID *keyID = boost::get<CKeyID>(&dest);
             if (!keyID) {
                 throw std::runtime_error(strprintf("%s does not refer to a key", ks));
             }
             CPubKey vchPubKey;
-            if (!pwalletMain->GetPubKey(*keyID, vchPubKey)) {
+            if (!pwallet->GetPubKey(*keyID, vchPubKey)) {
                 throw std::runtime_error(strprintf("no full public key for address %s", ks));
             }
             if (!vchPubKey.IsFullyValid())
@@ -357,6 +395,12 @@ CScript _createmultisig_redeemScript(const UniValue& params)
 
 UniValue createmultisig(const UniValue& params, bool fHelp)
 {
+#ifdef ENABLE_WALLET
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+#else
+    CWallet * const pwallet = NULL;
+#endif
+
     if (fHelp || params.size() < 2 || params.size() > 2)
     {
         string msg = "createmultisig nrequired [\"key\",...]\n"
@@ -387,7 +431,7 @@ UniValue createmultisig(const UniValue& params, bool fHelp)
     }
 
     // Construct using pay-to-script-hash:
-    CScript inner = _createmultisig_redeemScript(params);
+    CScript inner = _createmultisig_redeemScript(pwallet, params);
     CScriptID innerID(inner);
 
     UniValue result(UniValue::VOBJ);
@@ -484,17 +528,694 @@ UniValue setmocktime(const UniValue& params, bool fHelp)
     return NullUniValue;
 }
 
+static UniValue LockStatsToJSON(const CLockSiteStats& stats)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("lock", stats.strName));
+    if (!stats.strFile.empty()) {
+        obj.push_back(Pair("file", stats.strFile));
+        obj.push_back(Pair("line", stats.nLine));
+    }
+    obj.push_back(Pair("acquired", stats.nAcquired));
+    obj.push_back(Pair("contended", stats.nContended));
+    obj.push_back(Pair("wait", stats.nWaitMicros * 0.000001));
+    obj.push_back(Pair("maxwait", stats.nMaxWaitMicros * 0.000001));
+    obj.push_back(Pair("hold", stats.nHoldMicros * 0.000001));
+    if (!stats.strFile.empty()) {
+        UniValue histogram(UniValue::VOBJ);
+        for (int i = 0; i < CLockSite::WAIT_BUCKETS; i++) {
+            std::string strBound = i < CLockSite::WAIT_BUCKETS - 1 ? strprintf("%dus", CLockSite::WAIT_BUCKET_BOUNDS[i]) : "inf";
+            histogram.push_back(Pair(strBound, stats.waitBuckets[i]));
+        }
+        obj.push_back(Pair("waits", histogram));
+    }
+    return obj;
+}
+
+static bool CompareLockWait(const CLockSiteStats& a, const CLockSiteStats& b)
+{
+    return a.nWaitMicros > b.nWaitMicros;
+}
+
+UniValue getlockstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "getlockstats ( \"lock\" count )\n"
+            "\nReturns how often locks were taken and waited for since startup, by lock and by the place in\n"
+            "the source they were taken at, most waited for first. Only LOCK, LOCK2 and TRY_LOCK are counted.\n"
+            "\nArguments:\n"
+            "1. \"lock\"        (string, optional) Only report locks whose name contains this, such as cs_main\n"
+            "2. count         (numeric, optional, default=20) The number of call sites to report\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"locks\": [           (array) Totals by lock, named by their last identifier\n"
+            "    {\n"
+            "      \"lock\": \"name\",   (string) The lock\n"
+            "      \"acquired\": n,     (numeric) Times it was taken\n"
+            "      \"contended\": n,    (numeric) Times it had to be waited for\n"
+            "      \"wait\": x.xxx,     (numeric) Seconds spent waiting for it\n"
+            "      \"maxwait\": x.xxx,  (numeric) The longest wait, in seconds\n"
+            "      \"hold\": x.xxx      (numeric) Seconds it was held for\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"sites\": [           (array) The same by call site, with \"file\" and \"line\", and\n"
+            "                       \"waits\", the number of waits of up to each length\n"
+            "    ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getlockstats", "")
+            + HelpExampleCli("getlockstats", "\"cs_main\" 10")
+            + HelpExampleRpc("getlockstats", "\"cs_wallet\", 10")
+        );
+
+    std::string strFilter = params.size() > 0 ? params[0].get_str() : "";
+    int nCount = params.size() > 1 ? params[1].get_int() : 20;
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+
+    std::vector<CLockSiteStats> vLocks = GetLockSiteStats(true);
+    std::vector<CLockSiteStats> vSites = GetLockSiteStats();
+    std::sort(vLocks.begin(), vLocks.end(), CompareLockWait);
+    std::sort(vSites.begin(), vSites.end(), CompareLockWait);
+
+    UniValue locks(UniValue::VARR);
+    BOOST_FOREACH(const CLockSiteStats& stats, vLocks) {
+        if (stats.strName.find(strFilter) != std::string::npos)
+            locks.push_back(LockStatsToJSON(stats));
+    }
+    UniValue sites(UniValue::VARR);
+    BOOST_FOREACH(const CLockSiteStats& stats, vSites) {
+        if ((int)sites.size() >= nCount)
+            break;
+        if (stats.strName.find(strFilter) != std::string::npos)
+            sites.push_back(LockStatsToJSON(stats));
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("locks", locks));
+    ret.push_back(Pair("sites", sites));
+    return ret;
+}
+
+#if !defined(WIN32) && defined(__GNUC__)
+// Only defined when the node runs on jemalloc or tcmalloc, linked in or preloaded
+extern "C" int mallctl(const char* name, void* oldp, size_t* oldlenp, void* newp, size_t newlen) __attribute__((weak));
+extern "C" int MallocExtension_GetNumericProperty(const char* property, size_t* value) __attribute__((weak));
+#endif
+
+/** Statistics of the allocator, if it is one that keeps them */
+static UniValue AllocatorStatsToJSON()
+{
+    UniValue obj(UniValue::VOBJ);
+#if !defined(WIN32) && defined(__GNUC__)
+    if (mallctl) {
+        // The statistics are a snapshot, taken when the epoch is advanced
+        uint64_t nEpoch = 1;
+        size_t nLen = sizeof(nEpoch);
+        mallctl("epoch", &nEpoch, &nLen, &nEpoch, nLen);
+        obj.push_back(Pair("name", "jemalloc"));
+        const char* stats[] = {"allocated", "active", "resident", "mapped"};
+        BOOST_FOREACH(const char* stat, stats) {
+            size_t nValue;
+            nLen = sizeof(nValue);
+            if (mallctl(strprintf("stats.%s", stat).c_str(), &nValue, &nLen, NULL, 0) == 0)
+                obj.push_back(Pair(stat, (uint64_t)nValue));
+        }
+    } else if (MallocExtension_GetNumericProperty) {
+        obj.push_back(Pair("name", "tcmalloc"));
+        const char* stats[][2] = {
+            {"allocated", "generic.current_allocated_bytes"},
+            {"heapsize", "generic.heap_size"},
+            {"pageheapfree", "tcmalloc.pageheap_free_bytes"},
+            {"unmapped", "tcmalloc.pageheap_unmapped_bytes"},
+        };
+        for (size_t i = 0; i < sizeof(stats) / sizeof(stats[0]); i++) {
+            size_t nValue;
+            if (MallocExtension_GetNumericProperty(stats[i][1], &nValue))
+                obj.push_back(Pair(stats[i][0], (uint64_t)nValue));
+        }
+    }
+#endif
+    return obj;
+}
+
+#ifdef HAVE_MALLOC_INFO
+static std::string MallocInfo()
+{
+    char* ptr = NULL;
+    size_t size = 0;
+    FILE* f = open_memstream(&ptr, &size);
+    if (f) {
+        malloc_info(0, f);
+        fclose(f);
+        if (ptr) {
+            std::string str(ptr, size);
+            free(ptr);
+            return str;
+        }
+    }
+    return "";
+}
+#endif
+
+UniValue getmemoryinfo(const UniValue& params, bool fHelp)
+{
+#ifdef ENABLE_WALLET
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+#else
+    CWallet * const pwallet = NULL;
+#endif
+
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getmemoryinfo ( \"mode\" )\n"
+            "\nReturns the approximate heap memory used by each major structure of the node, in bytes.\n"
+            "These are estimates from the sizes of the structures; the allocator's own overhead and\n"
+            "the database caches set aside by -dbcache are not included.\n"
+            "\nArguments:\n"
+            "1. \"mode\"       (string, optional, default=\"stats\") \"stats\", or \"mallocinfo\" for the\n"
+            "                 XML statistics of glibc's malloc_info\n"
+            "\nResult (mode \"stats\"):\n"
+            "{\n"
+            "  \"blockindex\": {          (object) The block index\n"
+            "    \"entries\": n,\n"
+            "    \"usage\": n\n"
+            "  },\n"
+            "  \"coinscache\": {          (object) The chainstate cache, limited by -dbcache\n"
+            "    \"coins\": n,            (numeric) Cached unspent outputs\n"
+            "    \"anchors\": n,          (numeric) Cached Sprout and Sapling anchor trees\n"
+            "    \"nullifiers\": n,       (numeric) Cached Sprout and Sapling nullifiers\n"
+            "    \"usage\": n\n"
+            "  },\n"
+            "  \"mempool\": {             (object) The memory pool, as getmempoolinfo reports it\n"
+            "    \"size\": n,\n"
+            "    \"usage\": n\n"
+            "  },\n"
+            "  \"orphans\": {             (object) Transactions waiting for their inputs\n"
+            "    \"size\": n,\n"
+            "    \"usage\": n\n"
+            "  },\n"
+            "  \"txindexcache\": {        (object) Transactions read through -txindex, limited by -txindexcache\n"
+            "    \"size\": n,\n"
+            "    \"hits\": n,            (numeric) Lookups answered from it since startup\n"
+            "    \"misses\": n,          (numeric) Lookups that had to read the block files\n"
+            "    \"usage\": n\n"
+            "  },\n"
+            "  \"responsecache\": {       (object) RPC and REST replies about buried blocks, limited by -rpcresponsecache\n"
+            "    \"size\": n,\n"
+            "    \"hits\": n,            (numeric) Queries answered from it since startup\n"
+            "    \"misses\": n,          (numeric) Queries that had to be worked out\n"
+            "    \"usage\": n\n"
+            "  },\n"
+            "  \"relaycache\": {          (object) Transactions announced to peers, of which those out of the mempool are limited by -relaycache\n"
+            "    \"size\": n,\n"
+            "    \"hits\": n,            (numeric) Requests answered from it since startup\n"
+            "    \"misses\": n,          (numeric) Requests for transactions it didn't hold\n"
+            "    \"usage\": n\n"
+            "  },\n"
+            "  \"addrman\": {             (object) Known peer addresses\n"
+            "    \"addresses\": n,\n"
+            "    \"usage\": n\n"
+            "  },\n"
+            "  \"peers\": {               (object) Buffers of the connected peers; those in use at that moment are left out\n"
+            "    \"count\": n,\n"
+            "    \"sendbuffers\": n,      (numeric) Messages not yet sent\n"
+            "    \"recvbuffers\": n,      (numeric) Messages not yet processed, and pooled receive buffers\n"
+            "    \"queues\": n,           (numeric) Inventory, address and getdata queues\n"
+            "    \"usage\": n\n"
+            "  },\n"
+            "  \"wallet\": {              (object) The wallet, if enabled\n"
+            "    \"transactions\": n,     (numeric) Wallet transactions\n"
+            "    \"notedata\": n,         (numeric) Their note data, and the nullifier and spend maps\n"
+            "    \"witnesses\": n,        (numeric) Cached witnesses of the notes\n"
+            "    \"usage\": n\n"
+            "  },\n"
+            "  \"total\": n,              (numeric) The sum of the above\n"
+            "  \"allocator\": {           (object) When running on jemalloc or tcmalloc, its own statistics\n"
+            "    \"name\": \"name\",\n"
+            "    ...\n"
+            "  }\n"
+            "}\n"
+            "\nResult (mode \"mallocinfo\"):\n"
+            "\"<malloc version=\"1\">...\"\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmemoryinfo", "")
+            + HelpExampleRpc("getmemoryinfo", "")
+        );
+
+    std::string strMode = params.size() > 0 ? params[0].get_str() : "stats";
+    if (strMode == "mallocinfo") {
+#ifdef HAVE_MALLOC_INFO
+        return MallocInfo();
+#else
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "mallocinfo is only available when compiled with glibc 2.10+");
+#endif
+    } else if (strMode != "stats") {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown mode " + strMode);
+    }
+
+    // Taken before cs_main, which the network threads take while holding peer buffers
+    CPeerMemoryUsage peerUsage = GetPeerMemoryUsage();
+
+    UniValue ret(UniValue::VOBJ);
+    size_t nTotal = 0;
+    {
+        LOCK2(cs_main, mempool.cs);
+
+        UniValue blockindex(UniValue::VOBJ);
+        size_t nBlockIndex = GetBlockIndexMemoryUsage();
+        blockindex.push_back(Pair("entries", (uint64_t)mapBlockIndex.size()));
+        blockindex.push_back(Pair("usage", (uint64_t)nBlockIndex));
+        ret.push_back(Pair("blockindex", blockindex));
+        nTotal += nBlockIndex;
+
+        if (pcoinsTip) {
+            UniValue coinscache(UniValue::VOBJ);
+            size_t nCoins = pcoinsTip->DynamicMemoryUsage();
+            coinscache.push_back(Pair("coins", (uint64_t)pcoinsTip->DynamicMemoryUsageCoins()));
+            coinscache.push_back(Pair("anchors", (uint64_t)pcoinsTip->DynamicMemoryUsageAnchors()));
+            coinscache.push_back(Pair("nullifiers", (uint64_t)pcoinsTip->DynamicMemoryUsageNullifiers()));
+            coinscache.push_back(Pair("usage", (uint64_t)nCoins));
+            ret.push_back(Pair("coinscache", coinscache));
+            nTotal += nCoins;
+        }
+
+        UniValue mempoolobj(UniValue::VOBJ);
+        size_t nMempool = mempool.DynamicMemoryUsage();
+        mempoolobj.push_back(Pair("size", (uint64_t)mempool.size()));
+        mempoolobj.push_back(Pair("usage", (uint64_t)nMempool));
+        ret.push_back(Pair("mempool", mempoolobj));
+        nTotal += nMempool;
+
+        UniValue orphans(UniValue::VOBJ);
+        size_t nOrphans;
+        size_t nOrphanUsage = GetOrphanPoolMemoryUsage(nOrphans);
+        orphans.push_back(Pair("size", (uint64_t)nOrphans));
+        orphans.push_back(Pair("usage", (uint64_t)nOrphanUsage));
+        ret.push_back(Pair("orphans", orphans));
+        nTotal += nOrphanUsage;
+    }
+
+    UniValue txindexcache(UniValue::VOBJ);
+    size_t nTxIndexCache = txIndexCache.DynamicMemoryUsage();
+    uint64_t nHits, nMisses;
+    txIndexCache.GetStats(nHits, nMisses);
+    txindexcache.push_back(Pair("size", (uint64_t)txIndexCache.size()));
+    txindexcache.push_back(Pair("hits", nHits));
+    txindexcache.push_back(Pair("misses", nMisses));
+    txindexcache.push_back(Pair("usage", (uint64_t)nTxIndexCache));
+    ret.push_back(Pair("txindexcache", txindexcache));
+    nTotal += nTxIndexCache;
+
+    UniValue responsecache(UniValue::VOBJ);
+    size_t nResponseCache = responseCache.DynamicMemoryUsage();
+    responseCache.GetStats(nHits, nMisses);
+    responsecache.push_back(Pair("size", (uint64_t)responseCache.size()));
+    responsecache.push_back(Pair("hits", nHits));
+    responsecache.push_back(Pair("misses", nMisses));
+    responsecache.push_back(Pair("usage", (uint64_t)nResponseCache));
+    ret.push_back(Pair("responsecache", responsecache));
+    nTotal += nResponseCache;
+
+    UniValue relaycache(UniValue::VOBJ);
+    size_t nRelayCache = relayCache.DynamicMemoryUsage();
+    relayCache.GetStats(nHits, nMisses);
+    relaycache.push_back(Pair("size", (uint64_t)relayCache.size()));
+    relaycache.push_back(Pair("hits", nHits));
+    relaycache.push_back(Pair("misses", nMisses));
+    relaycache.push_back(Pair("usage", (uint64_t)nRelayCache));
+    ret.push_back(Pair("relaycache", relaycache));
+    nTotal += nRelayCache;
+
+    UniValue addrmanobj(UniValue::VOBJ);
+    size_t nAddrman = addrman.DynamicMemoryUsage();
+    addrmanobj.push_back(Pair("addresses", (uint64_t)addrman.size()));
+    addrmanobj.push_back(Pair("usage", (uint64_t)nAddrman));
+    ret.push_back(Pair("addrman", addrmanobj));
+    nTotal += nAddrman;
+
+    UniValue peers(UniValue::VOBJ);
+    size_t nPeers = peerUsage.nSendBuffers + peerUsage.nRecvBuffers + peerUsage.nQueues;
+    peers.push_back(Pair("count", (uint64_t)peerUsage.nPeers));
+    peers.push_back(Pair("sendbuffers", (uint64_t)peerUsage.nSendBuffers));
+    peers.push_back(Pair("recvbuffers", (uint64_t)peerUsage.nRecvBuffers));
+    peers.push_back(Pair("queues", (uint64_t)peerUsage.nQueues));
+    peers.push_back(Pair("usage", (uint64_t)nPeers));
+    ret.push_back(Pair("peers", peers));
+    nTotal += nPeers;
+
+#ifdef ENABLE_WALLET
+    if (pwallet) {
+        size_t nTransactions, nNoteData, nWitnesses;
+        {
+            LOCK2(cs_main, pwallet->cs_wallet);
+            pwallet->GetMemoryUsage(nTransactions, nNoteData, nWitnesses);
+        }
+        UniValue wallet(UniValue::VOBJ);
+        wallet.push_back(Pair("transactions", (uint64_t)nTransactions));
+        wallet.push_back(Pair("notedata", (uint64_t)nNoteData));
+        wallet.push_back(Pair("witnesses", (uint64_t)nWitnesses));
+        wallet.push_back(Pair("usage", (uint64_t)(nTransactions + nNoteData + nWitnesses)));
+        ret.push_back(Pair("wallet", wallet));
+        nTotal += nTransactions + nNoteData + nWitnesses;
+    }
+#endif
+
+    ret.push_back(Pair("total", (uint64_t)nTotal));
+    UniValue allocator = AllocatorStatsToJSON();
+    if (!allocator.empty())
+        ret.push_back(Pair("allocator", allocator));
+    return ret;
+}
+
+/** The address named by a string, as its type and hash in the address indexes */
+static bool GetIndexedAddress(const std::string& str, uint160& hashBytes, int& type)
+{
+    CTxDestination dest = DecodeDestination(str);
+    if (const CKeyID* keyID = boost::get<CKeyID>(&dest)) {
+        hashBytes = *keyID;
+        type = ADDRESS_INDEX_PUBKEYHASH;
+        return true;
+    }
+    if (const CScriptID* scriptID = boost::get<CScriptID>(&dest)) {
+        hashBytes = *scriptID;
+        type = ADDRESS_INDEX_SCRIPTHASH;
+        return true;
+    }
+    return false;
+}
+
+static std::string GetIndexedAddressString(const uint160& hashBytes, int type)
+{
+    if (type == ADDRESS_INDEX_SCRIPTHASH)
+        return EncodeDestination(CScriptID(hashBytes));
+    return EncodeDestination(CKeyID(hashBytes));
+}
+
+/** The addresses of the first parameter, which is either an address or an object with an "addresses" array */
+static std::vector<std::pair<uint160, int> > GetIndexedAddresses(const UniValue& param)
+{
+    std::vector<std::string> vStrings;
+    if (param.isStr()) {
+        vStrings.push_back(param.get_str());
+    } else if (param.isObject()) {
+        UniValue addresses = find_value(param.get_obj(), "addresses");
+        if (!addresses.isArray())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Addresses is expected to be an array");
+        for (size_t i = 0; i < addresses.size(); i++)
+            vStrings.push_back(addresses[i].get_str());
+    } else {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Expected an address or an object with addresses");
+    }
+
+    std::vector<std::pair<uint160, int> > vAddresses;
+    BOOST_FOREACH(const std::string& str, vStrings) {
+        uint160 hashBytes;
+        int type;
+        if (!GetIndexedAddress(str, hashBytes, type))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address: " + str);
+        vAddresses.push_back(std::make_pair(hashBytes, type));
+    }
+    return vAddresses;
+}
+
+/** Read the "start" and "end" heights of a range query, 0 if not given */
+static void GetHeightRange(const UniValue& param, int& nStart, int& nEnd)
+{
+    nStart = nEnd = 0;
+    if (!param.isObject())
+        return;
+    UniValue start = find_value(param.get_obj(), "start");
+    UniValue end = find_value(param.get_obj(), "end");
+    if (start.isNum())
+        nStart = start.get_int();
+    if (end.isNum())
+        nEnd = end.get_int();
+    if (nStart < 0 || nEnd < 0 || (nEnd > 0 && nEnd < nStart))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Start and end must be heights with start <= end");
+}
+
+static std::vector<std::pair<CAddressIndexKey, CAmount> > ReadAddressIndexes(const std::vector<std::pair<uint160, int> >& vAddresses, int nStart, int nEnd)
+{
+    if (!fAddressIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled (use -addressindex)");
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    for (std::vector<std::pair<uint160, int> >::const_iterator it = vAddresses.begin(); it != vAddresses.end(); it++) {
+        if (!pblocktree->ReadAddressIndex(it->first, it->second, addressIndex, nStart, nEnd))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    }
+    return addressIndex;
+}
+
+UniValue getaddressbalance(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance {\"addresses\": [\"address\",...]}\n"
+            "\nReturns the balance of the transparent addresses (requires -addressindex).\n"
+            "\nArguments:\n"
+            "{\n"
+            "  \"addresses\"   (array, required) The addresses\n"
+            "    [\n"
+            "      \"address\"  (string) The address\n"
+            "      ,...\n"
+            "    ]\n"
+            "}\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"balance\"    (numeric) The current balance in " + CURRENCY_UNIT + "\n"
+            "  \"received\"   (numeric) The total amount ever received in " + CURRENCY_UNIT + "\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressbalance", "'{\"addresses\": [\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"]}'")
+            + HelpExampleRpc("getaddressbalance", "{\"addresses\": [\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"]}")
+        );
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex = ReadAddressIndexes(GetIndexedAddresses(params[0]), 0, 0);
+
+    CAmount nBalance = 0;
+    CAmount nReceived = 0;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it = addressIndex.begin(); it != addressIndex.end(); it++) {
+        if (it->second > 0)
+            nReceived += it->second;
+        nBalance += it->second;
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("balance", ValueFromAmount(nBalance)));
+    result.push_back(Pair("received", ValueFromAmount(nReceived)));
+    return result;
+}
+
+UniValue getaddressdeltas(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressdeltas {\"addresses\": [\"address\",...], \"start\": n, \"end\": n}\n"
+            "\nReturns the outputs to and spends from the transparent addresses in a range of\n"
+            "heights, in chain order (requires -addressindex).\n"
+            "\nArguments:\n"
+            "{\n"
+            "  \"addresses\"   (array, required) The addresses\n"
+            "  \"start\"       (numeric, optional) The first height to include\n"
+            "  \"end\"         (numeric, optional) The last height to include\n"
+            "}\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"satoshis\"    (numeric) The change of the balance, in zatoshis\n"
+            "    \"txid\"        (string) The transaction id\n"
+            "    \"index\"       (numeric) The index of the input or output\n"
+            "    \"blockindex\"  (numeric) The position of the transaction in its block\n"
+            "    \"height\"      (numeric) The height of the block\n"
+            "    \"address\"     (string) The address\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"], \"start\": 1000, \"end\": 2000}'")
+            + HelpExampleRpc("getaddressdeltas", "{\"addresses\": [\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"], \"start\": 1000, \"end\": 2000}")
+        );
+
+    int nStart, nEnd;
+    GetHeightRange(params[0], nStart, nEnd);
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex = ReadAddressIndexes(GetIndexedAddresses(params[0]), nStart, nEnd);
+
+    UniValue result(UniValue::VARR);
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it = addressIndex.begin(); it != addressIndex.end(); it++) {
+        UniValue delta(UniValue::VOBJ);
+        delta.push_back(Pair("satoshis", it->second));
+        delta.push_back(Pair("txid", it->first.txhash.GetHex()));
+        delta.push_back(Pair("index", (int)it->first.index));
+        delta.push_back(Pair("blockindex", (int)it->first.txindex));
+        delta.push_back(Pair("height", it->first.blockHeight));
+        delta.push_back(Pair("address", GetIndexedAddressString(it->first.hashBytes, it->first.type)));
+        result.push_back(delta);
+    }
+    return result;
+}
+
+static bool AddressIndexHeightLess(const std::pair<CAddressIndexKey, CAmount>& a, const std::pair<CAddressIndexKey, CAmount>& b)
+{
+    if (a.first.blockHeight != b.first.blockHeight)
+        return a.first.blockHeight < b.first.blockHeight;
+    return a.first.txindex < b.first.txindex;
+}
+
+UniValue getaddresstxids(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddresstxids {\"addresses\": [\"address\",...], \"start\": n, \"end\": n}\n"
+            "\nReturns the ids of the transactions of the transparent addresses in a range of\n"
+            "heights, in chain order (requires -addressindex).\n"
+            "\nArguments:\n"
+            "{\n"
+            "  \"addresses\"   (array, required) The addresses\n"
+            "  \"start\"       (numeric, optional) The first height to include\n"
+            "  \"end\"         (numeric, optional) The last height to include\n"
+            "}\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"transactionid\"  (string) The transaction id\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"]}'")
+            + HelpExampleRpc("getaddresstxids", "{\"addresses\": [\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"]}")
+        );
+
+    int nStart, nEnd;
+    GetHeightRange(params[0], nStart, nEnd);
+    std::vector<std::pair<uint160, int> > vAddresses = GetIndexedAddresses(params[0]);
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex = ReadAddressIndexes(vAddresses, nStart, nEnd);
+    // The entries of each address are in chain order already
+    if (vAddresses.size() > 1)
+        std::stable_sort(addressIndex.begin(), addressIndex.end(), AddressIndexHeightLess);
+
+    UniValue result(UniValue::VARR);
+    std::set<uint256> setSeen;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it = addressIndex.begin(); it != addressIndex.end(); it++) {
+        if (setSeen.insert(it->first.txhash).second)
+            result.push_back(it->first.txhash.GetHex());
+    }
+    return result;
+}
+
+UniValue getaddressutxos(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressutxos {\"addresses\": [\"address\",...]}\n"
+            "\nReturns the unspent outputs of the transparent addresses (requires -addressindex).\n"
+            "\nArguments:\n"
+            "{\n"
+            "  \"addresses\"   (array, required) The addresses\n"
+            "}\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"address\"      (string) The address\n"
+            "    \"txid\"         (string) The id of the transaction of the output\n"
+            "    \"outputIndex\"  (numeric) The index of the output\n"
+            "    \"script\"       (string) The script, in hex\n"
+            "    \"satoshis\"     (numeric) The value of the output, in zatoshis\n"
+            "    \"height\"       (numeric) The height of the block of the output\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"]}'")
+            + HelpExampleRpc("getaddressutxos", "{\"addresses\": [\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"]}")
+        );
+
+    std::vector<std::pair<uint160, int> > vAddresses = GetIndexedAddresses(params[0]);
+    if (!fAddressIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled (use -addressindex)");
+
+    UniValue result(UniValue::VARR);
+    for (std::vector<std::pair<uint160, int> >::const_iterator it = vAddresses.begin(); it != vAddresses.end(); it++) {
+        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
+        if (!pblocktree->ReadAddressUnspentIndex(it->first, it->second, unspentOutputs))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        std::string strAddress = GetIndexedAddressString(it->first, it->second);
+        for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator uit = unspentOutputs.begin(); uit != unspentOutputs.end(); uit++) {
+            UniValue output(UniValue::VOBJ);
+            output.push_back(Pair("address", strAddress));
+            output.push_back(Pair("txid", uit->first.txhash.GetHex()));
+            output.push_back(Pair("outputIndex", (int)uit->first.index));
+            output.push_back(Pair("script", HexStr(uit->second.script.begin(), uit->second.script.end())));
+            output.push_back(Pair("satoshis", uit->second.satoshis));
+            output.push_back(Pair("height", uit->second.blockHeight));
+            result.push_back(output);
+        }
+    }
+    return result;
+}
+
+UniValue getspentinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1 || !params[0].isObject())
+        throw runtime_error(
+            "getspentinfo {\"txid\": \"txid\", \"index\": n}\n"
+            "\nReturns the input that spent a transparent output (requires -spentindex).\n"
+            "\nArguments:\n"
+            "{\n"
+            "  \"txid\"   (string, required) The id of the transaction of the output\n"
+            "  \"index\"  (numeric, required) The index of the output\n"
+            "}\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txid\"    (string) The id of the spending transaction\n"
+            "  \"index\"   (numeric) The index of the spending input\n"
+            "  \"height\"  (numeric) The height of the block of the spending transaction\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getspentinfo", "'{\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 0}'")
+            + HelpExampleRpc("getspentinfo", "{\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 0}")
+        );
+
+    if (!fSpentIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Spent index not enabled (use -spentindex)");
+
+    uint256 txid = ParseHashV(find_value(params[0].get_obj(), "txid"), "txid");
+    UniValue indexValue = find_value(params[0].get_obj(), "index");
+    if (!indexValue.isNum() || indexValue.get_int() < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid index");
+
+    CSpentIndexValue value;
+    if (!pblocktree->ReadSpentIndex(CSpentIndexKey(txid, indexValue.get_int()), value))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to get spent info");
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("txid", value.txid.GetHex()));
+    result.push_back(Pair("index", (int)value.inputIndex));
+    result.push_back(Pair("height", value.blockHeight));
+    return result;
+}
+
 static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
-    { "control",            "getinfo",                &getinfo,                true  }, /* uses wallet if enabled */
-    { "util",               "validateaddress",        &validateaddress,        true  }, /* uses wallet if enabled */
-    { "util",               "z_validateaddress",      &z_validateaddress,      true  }, /* uses wallet if enabled */
-    { "util",               "createmultisig",         &createmultisig,         true  },
-    { "util",               "verifymessage",          &verifymessage,          true  },
+{ //  category              name                      actor (function)         okSafeMode  okParallel
+  //  --------------------- ------------------------  -----------------------  ----------  ----------
+    { "control",            "getinfo",                &getinfo,                true,  false }, /* uses wallet if enabled */
+    { "control",            "getlockstats",           &getlockstats,           true,  true  },
+    { "control",            "getmemoryinfo",          &getmemoryinfo,          true,  true  },
+    { "util",               "validateaddress",        &validateaddress,        true,  true  }, /* uses wallet if enabled */
+    { "util",               "z_validateaddress",      &z_validateaddress,      true,  true  }, /* uses wallet if enabled */
+    { "util",               "createmultisig",         &createmultisig,         true,  true  },
+    { "util",               "verifymessage",          &verifymessage,          true,  true  },
+
+    /* Address and spent indexes */
+    { "addressindex",       "getaddressbalance",      &getaddressbalance,      false, true  },
+    { "addressindex",       "getaddressdeltas",       &getaddressdeltas,       false, true  },
+    { "addressindex",       "getaddresstxids",        &getaddresstxids,        false, true  },
+    { "addressindex",       "getaddressutxos",        &getaddressutxos,        false, true  },
+    { "blockchain",         "getspentinfo",           &getspentinfo,           false, true  },
 
     /* Not shown in help */
-    { "hidden",             "setmocktime",            &setmocktime,            true  },
+    { "hidden",             "setmocktime",            &setmocktime,            true,  false },
 };
 
 void RegisterMiscRPCCommands(CRPCTable &tableRPC)
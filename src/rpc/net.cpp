@@ -7,11 +7,13 @@
 
 #include "clientversion.h"
 #include "main.h"
+#include "metrics.h"
 #include "net.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "sync.h"
 #include "timedata.h"
+#include "trace.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "version.h"
@@ -94,6 +96,11 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"lastrecv\": ttt,           (numeric) The time in seconds since epoch (Jan 1 1970 GMT) of the last receive\n"
             "    \"bytessent\": n,            (numeric) The total bytes sent\n"
             "    \"bytesrecv\": n,            (numeric) The total bytes received\n"
+            "    \"sendqueue\": {           (json object) Bytes waiting to be sent, by class, in the order they are sent\n"
+            "      \"block\": n,              (numeric) Blocks and headers near the tip, and control messages\n"
+            "      \"tx\": n,                 (numeric) Transaction relay\n"
+            "      \"bulk\": n                (numeric) Addresses and historical blocks\n"
+            "    },\n"
             "    \"conntime\": ttt,           (numeric) The connection time in seconds since epoch (Jan 1 1970 GMT)\n"
             "    \"timeoffset\": ttt,         (numeric) The time offset in seconds\n"
             "    \"pingtime\": n,             (numeric) ping time\n"
@@ -101,6 +108,11 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"version\": v,              (numeric) The peer version, such as 170004\n"
             "    \"subver\": \"/MagicBean:x.y.z[-v]/\",  (string) The string version\n"
             "    \"inbound\": true|false,     (boolean) Inbound (true) or Outbound (false)\n"
+            "    \"blockrelayonly\": true|false, (boolean) Whether this is an outbound connection that only relays blocks\n"
+            "    \"lastblock\": ttt,          (numeric) The time in seconds since epoch (Jan 1 1970 GMT) the peer last sent us a block we didn't have\n"
+            "    \"lasttransaction\": ttt,    (numeric) The time in seconds since epoch (Jan 1 1970 GMT) the peer last sent us a transaction we didn't have\n"
+            "    \"blocksfirst\": n,          (numeric) The number of blocks the peer was the first to send us\n"
+            "    \"transactionsfirst\": n,    (numeric) The number of transactions the peer was the first to send us\n"
             "    \"startingheight\": n,       (numeric) The starting height (block) of the peer\n"
             "    \"banscore\": n,             (numeric) The ban score\n"
             "    \"synced_headers\": n,       (numeric) The last header we have in common with this peer\n"
@@ -108,7 +120,20 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
-            "    ]\n"
+            "    ],\n"
+            "    \"blockwindow\": n,          (numeric) The number of blocks that may be in flight from this peer at once\n"
+            "    \"blocklatency\": n,         (numeric) The average time in seconds from asking this peer for a block to receiving it\n"
+            "    \"blockrate\": n,            (numeric) The average number of blocks per second this peer delivers\n"
+            "    \"msgstats\": {             (json object) Traffic by message command\n"
+            "      \"command\": {\n"
+            "        \"sentmsgs\": n,         (numeric) Messages sent\n"
+            "        \"sentbytes\": n,        (numeric) Bytes sent, including headers\n"
+            "        \"recvmsgs\": n,         (numeric) Messages received and handled\n"
+            "        \"recvbytes\": n,        (numeric) Bytes received, including headers\n"
+            "        \"processtime\": n,      (numeric) Seconds spent handling them\n"
+            "        \"maxprocesstime\": n    (numeric) The longest one took to handle, in seconds\n"
+            "      }, ...\n"
+            "    }\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -137,6 +162,10 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
         obj.push_back(Pair("lastrecv", stats.nLastRecv));
         obj.push_back(Pair("bytessent", stats.nSendBytes));
         obj.push_back(Pair("bytesrecv", stats.nRecvBytes));
+        UniValue sendqueue(UniValue::VOBJ);
+        for (int nClass = 0; nClass < SEND_CLASS_COUNT; nClass++)
+            sendqueue.push_back(Pair(GetSendClassName((SendClass)nClass), (uint64_t)stats.nSendQueued[nClass]));
+        obj.push_back(Pair("sendqueue", sendqueue));
         obj.push_back(Pair("conntime", stats.nTimeConnected));
         obj.push_back(Pair("timeoffset", stats.nTimeOffset));
         obj.push_back(Pair("pingtime", stats.dPingTime));
@@ -148,6 +177,11 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
         // their ver message.
         obj.push_back(Pair("subver", stats.cleanSubVer));
         obj.push_back(Pair("inbound", stats.fInbound));
+        obj.push_back(Pair("blockrelayonly", stats.fBlockRelayOnly));
+        obj.push_back(Pair("lastblock", stats.nLastBlockTime));
+        obj.push_back(Pair("lasttransaction", stats.nLastTxTime));
+        obj.push_back(Pair("blocksfirst", stats.nBlocksFirst));
+        obj.push_back(Pair("transactionsfirst", stats.nTxsFirst));
         obj.push_back(Pair("startingheight", stats.nStartingHeight));
         if (fStateStats) {
             obj.push_back(Pair("banscore", statestats.nMisbehavior));
@@ -158,7 +192,22 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("blockwindow", statestats.nBlockWindow));
+            obj.push_back(Pair("blocklatency", statestats.nBlockLatency / 1e6));
+            obj.push_back(Pair("blockrate", statestats.dBlocksPerSecond));
         }
+        UniValue msgstats(UniValue::VOBJ);
+        for (mapMsgCmdStats::const_iterator it = stats.mapMsgStats.begin(); it != stats.mapMsgStats.end(); ++it) {
+            UniValue cmd(UniValue::VOBJ);
+            cmd.push_back(Pair("sentmsgs", it->second.nSendMsgs));
+            cmd.push_back(Pair("sentbytes", it->second.nSendBytes));
+            cmd.push_back(Pair("recvmsgs", it->second.nRecvMsgs));
+            cmd.push_back(Pair("recvbytes", it->second.nRecvBytes));
+            cmd.push_back(Pair("processtime", it->second.nProcessMicros * 0.000001));
+            cmd.push_back(Pair("maxprocesstime", it->second.nMaxProcessMicros * 0.000001));
+            msgstats.push_back(Pair(it->first, cmd));
+        }
+        obj.push_back(Pair("msgstats", msgstats));
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
         ret.push_back(obj);
@@ -366,7 +415,19 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
             "{\n"
             "  \"totalbytesrecv\": n,   (numeric) Total bytes received\n"
             "  \"totalbytessent\": n,   (numeric) Total bytes sent\n"
-            "  \"timemillis\": t        (numeric) Total cpu time\n"
+            "  \"timemillis\": t,       (numeric) Total cpu time\n"
+            "  \"msgstats\": {          (json object) Traffic of all peers since startup, by message command\n"
+            "    \"command\": {\n"
+            "      \"sentmsgs\": n,      (numeric) Messages sent\n"
+            "      \"sentbytes\": n,     (numeric) Bytes sent, including headers\n"
+            "      \"recvmsgs\": n,      (numeric) Messages received and handled\n"
+            "      \"recvbytes\": n,     (numeric) Bytes received, including headers\n"
+            "      \"processtime\": n,   (numeric) Seconds spent handling them\n"
+            "      \"processtimes\": {   (json object) How many took up to each number of seconds to handle,\n"
+            "        \"bound\": n, ...   counting each in the first bucket it fits\n"
+            "      }\n"
+            "    }, ...\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getnettotals", "")
@@ -377,9 +438,87 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
     obj.push_back(Pair("totalbytesrecv", CNode::GetTotalBytesRecv()));
     obj.push_back(Pair("totalbytessent", CNode::GetTotalBytesSent()));
     obj.push_back(Pair("timemillis", GetTimeMillis()));
+    UniValue msgstats(UniValue::VOBJ);
+    ForEachNetMessageMetrics([&msgstats](const std::string& strCommand, const NetMessageMetrics& metrics) {
+        UniValue cmd(UniValue::VOBJ);
+        cmd.push_back(Pair("sentmsgs", metrics.sent.value.load()));
+        cmd.push_back(Pair("sentbytes", metrics.sentBytes.value.load()));
+        cmd.push_back(Pair("recvmsgs", metrics.received.value.load()));
+        cmd.push_back(Pair("recvbytes", metrics.receivedBytes.value.load()));
+        cmd.push_back(Pair("processtime", metrics.processTime.sum()));
+        UniValue times(UniValue::VOBJ);
+        uint64_t nBelow = 0;
+        for (int i = 0; i <= AtomicHistogram::BUCKETS; i++) {
+            uint64_t nCumulative = std::max(nBelow, metrics.processTime.cumulativeCount(i));
+            std::string strBound = i < AtomicHistogram::BUCKETS ? strprintf("%g", AtomicHistogram::BUCKET_BOUNDS[i]) : "inf";
+            times.push_back(Pair(strBound, nCumulative - nBelow));
+            nBelow = nCumulative;
+        }
+        cmd.push_back(Pair("processtimes", times));
+        msgstats.push_back(Pair(strCommand, cmd));
+    });
+    obj.push_back(Pair("msgstats", msgstats));
     return obj;
 }
 
+UniValue gettraces(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 3)
+        throw runtime_error(
+            "gettraces ( \"hash\" since count )\n"
+            "\nReturns the latest trace points recorded for blocks and transactions, oldest first. Times are\n"
+            "microseconds since the epoch, so the traces of several nodes show how long a block or transaction\n"
+            "took to propagate between them. See -tracebuffer.\n"
+            "\nArguments:\n"
+            "1. \"hash\"     (string, optional) Only the trace points of this block or transaction; \"\" for all\n"
+            "2. since      (numeric, optional, default=0) Only trace points from this time on, in microseconds\n"
+            "3. count      (numeric, optional, default=1000) The number of the latest trace points to return\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"time\": n,          (numeric) When it happened, in microseconds since the epoch\n"
+            "    \"event\": \"name\",   (string) block_header_received, block_received, block_prevalidated,\n"
+            "                        block_connected, block_tip_updated, block_relayed, tx_received,\n"
+            "                        tx_accepted, tx_relayed or tx_mined\n"
+            "    \"hash\": \"hash\",    (string) The block or transaction\n"
+            "    \"peer\": n,          (numeric, optional) The peer it came from\n"
+            "    \"height\": n,        (numeric, optional) The height of the block\n"
+            "    \"duration\": n       (numeric, optional) How long the step took, in seconds: since the block\n"
+            "                        was received for block_prevalidated\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("gettraces", "")
+            + HelpExampleCli("gettraces", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
+            + HelpExampleRpc("gettraces", "\"\", 0, 100")
+        );
+
+    uint256 hash;
+    bool fHash = params.size() > 0 && !params[0].get_str().empty();
+    if (fHash)
+        hash = ParseHashV(params[0], "hash");
+    int64_t nSince = params.size() > 1 ? params[1].get_int64() : 0;
+    int nCount = params.size() > 2 ? params[2].get_int() : 1000;
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+
+    UniValue ret(UniValue::VARR);
+    BOOST_FOREACH(const CTraceEntry& entry, GetTraces(fHash ? &hash : NULL, nSince, nCount)) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("time", entry.nTime));
+        obj.push_back(Pair("event", GetTraceEventName(entry.event)));
+        obj.push_back(Pair("hash", entry.hash.GetHex()));
+        if (entry.nPeer >= 0)
+            obj.push_back(Pair("peer", entry.nPeer));
+        if (entry.nHeight >= 0)
+            obj.push_back(Pair("height", entry.nHeight));
+        if (entry.nDuration > 0)
+            obj.push_back(Pair("duration", entry.nDuration * 0.000001));
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
 static UniValue GetNetworksInfo()
 {
     UniValue networks(UniValue::VARR);
@@ -495,6 +634,48 @@ UniValue getnetworkinfo(const UniValue& params, bool fHelp)
     return obj;
 }
 
+//! Parse an "ip(/netmask)" of setban
+static CSubNet ParseBanSubNet(const std::string& str)
+{
+    CSubNet subNet = str.find("/") != string::npos ? CSubNet(str) : CSubNet(CNetAddr(str));
+    if (!subNet.IsValid())
+        throw JSONRPCError(RPC_CLIENT_NODE_ALREADY_ADDED, "Error: Invalid IP/Subnet " + str);
+    return subNet;
+}
+
+//! setban with an array of subnets, banned under one lock and written out once
+static UniValue setbanmany(const UniValue& subnets, const string& strCommand, const UniValue& params)
+{
+    std::vector<CSubNet> vSubNet;
+    vSubNet.reserve(subnets.size());
+    for (size_t i = 0; i < subnets.size(); i++)
+        vSubNet.push_back(ParseBanSubNet(subnets[i].get_str()));
+
+    if (strCommand == "add")
+    {
+        int64_t banTime = 0; //use standard bantime if not specified
+        if (params.size() >= 3 && !params[2].isNull())
+            banTime = params[2].get_int64();
+        bool absolute = params.size() == 4 && params[3].isTrue();
+        CNode::Ban(vSubNet, BanReasonManuallyAdded, banTime, absolute);
+
+        //disconnect possible nodes
+        for (const CSubNet& subNet : vSubNet)
+            while (CNode *bannedNode = FindNode(subNet))
+                bannedNode->fDisconnect = true;
+    }
+    else
+    {
+        for (const CSubNet& subNet : vSubNet)
+            CNode::Unban(subNet);
+    }
+
+    DumpBanlist(); //store banlist to disk
+    uiInterface.BannedListChanged();
+
+    return NullUniValue;
+}
+
 UniValue setban(const UniValue& params, bool fHelp)
 {
     string strCommand;
@@ -506,7 +687,8 @@ UniValue setban(const UniValue& params, bool fHelp)
                             "setban \"ip(/netmask)\" \"add|remove\" (bantime) (absolute)\n"
                             "\nAttempts add or remove a IP/Subnet from the banned list.\n"
                             "\nArguments:\n"
-                            "1. \"ip(/netmask)\" (string, required) The IP/Subnet (see getpeerinfo for nodes ip) with a optional netmask (default is /32 = single ip)\n"
+                            "1. \"ip(/netmask)\" (string or array, required) The IP/Subnet (see getpeerinfo for nodes ip) with a optional netmask (default is /32 = single ip),\n"
+                            "                   or an array of them to add or remove at once, as when importing a block list; those already banned are then not an error\n"
                             "2. \"command\"      (string, required) 'add' to add a IP/Subnet to the list, 'remove' to remove a IP/Subnet from the list\n"
                             "3. \"bantime\"      (numeric, optional) time in seconds how long (or until when if [absolute] is set) the ip is banned (0 or empty means using the default time of 24h which can also be overwritten by the -bantime startup argument)\n"
                             "4. \"absolute\"     (boolean, optional) If set, the bantime must be a absolute timestamp in seconds since epoch (Jan 1 1970 GMT)\n"
@@ -514,8 +696,12 @@ UniValue setban(const UniValue& params, bool fHelp)
                             + HelpExampleCli("setban", "\"192.168.0.6\" \"add\" 86400")
                             + HelpExampleCli("setban", "\"192.168.0.0/24\" \"add\"")
                             + HelpExampleRpc("setban", "\"192.168.0.6\", \"add\" 86400")
+                            + HelpExampleRpc("setban", "[\"192.168.0.0/24\", \"10.1.2.3\"], \"add\" 86400")
                             );
 
+    if (params[0].isArray())
+        return setbanmany(params[0], strCommand, params);
+
     CSubNet subNet;
     CNetAddr netAddr;
     bool isSubnet = false;
@@ -611,20 +797,21 @@ UniValue clearbanned(const UniValue& params, bool fHelp)
 }
 
 static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
-    { "network",            "getconnectioncount",     &getconnectioncount,     true  },
-    { "network",            "getdeprecationinfo",     &getdeprecationinfo,     true  },
-    { "network",            "ping",                   &ping,                   true  },
-    { "network",            "getpeerinfo",            &getpeerinfo,            true  },
-    { "network",            "addnode",                &addnode,                true  },
-    { "network",            "disconnectnode",         &disconnectnode,         true  },
-    { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true  },
-    { "network",            "getnettotals",           &getnettotals,           true  },
-    { "network",            "getnetworkinfo",         &getnetworkinfo,         true  },
-    { "network",            "setban",                 &setban,                 true  },
-    { "network",            "listbanned",             &listbanned,             true  },
-    { "network",            "clearbanned",            &clearbanned,            true  },
+{ //  category              name                      actor (function)         okSafeMode  okParallel
+  //  --------------------- ------------------------  -----------------------  ----------  ----------
+    { "network",            "getconnectioncount",     &getconnectioncount,     true,  false },
+    { "network",            "getdeprecationinfo",     &getdeprecationinfo,     true,  false },
+    { "network",            "ping",                   &ping,                   true,  false },
+    { "network",            "getpeerinfo",            &getpeerinfo,            true,  false },
+    { "network",            "addnode",                &addnode,                true,  false },
+    { "network",            "disconnectnode",         &disconnectnode,         true,  false },
+    { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true,  false },
+    { "network",            "getnettotals",           &getnettotals,           true,  false },
+    { "network",            "gettraces",              &gettraces,              true,  true  },
+    { "network",            "getnetworkinfo",         &getnetworkinfo,         true,  false },
+    { "network",            "setban",                 &setban,                 true,  false },
+    { "network",            "listbanned",             &listbanned,             true,  false },
+    { "network",            "clearbanned",            &clearbanned,            true,  false },
 };
 
 void RegisterNetRPCCommands(CRPCTable &tableRPC)
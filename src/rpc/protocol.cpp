@@ -49,8 +49,16 @@ UniValue JSONRPCReplyObj(const UniValue& result, const UniValue& error, const Un
 
 string JSONRPCReply(const UniValue& result, const UniValue& error, const UniValue& id)
 {
-    UniValue reply = JSONRPCReplyObj(result, error, id);
-    return reply.write() + "\n";
+    // What JSONRPCReplyObj(result, error, id).write() gives, without
+    // copying the result into a reply object first
+    string strReply = "{\"result\":";
+    strReply += error.isNull() ? result.write() : "null";
+    strReply += ",\"error\":";
+    strReply += error.write();
+    strReply += ",\"id\":";
+    strReply += id.write();
+    strReply += "}\n";
+    return strReply;
 }
 
 UniValue JSONRPCError(int code, const string& message)
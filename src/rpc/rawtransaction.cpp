@@ -15,6 +15,8 @@
 #include "merkleblock.h"
 #include "net.h"
 #include "primitives/transaction.h"
+#include "responsecache.h"
+#include "rpc/jsonwriter.h"
 #include "rpc/server.h"
 #include "script/script.h"
 #include "script/script_error.h"
@@ -22,6 +24,7 @@
 #include "script/standard.h"
 #include "uint256.h"
 #ifdef ENABLE_WALLET
+#include "wallet/rpcwallet.h"
 #include "wallet/wallet.h"
 #endif
 
@@ -219,6 +222,162 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
     }
 }
 
+static void ScriptPubKeyToJSON(const CScript& scriptPubKey, CJSONWriter& writer)
+{
+    txnouttype type;
+    vector<CTxDestination> addresses;
+    int nRequired;
+
+    writer.BeginObject();
+    writer.Key("asm").String(ScriptToAsmStr(scriptPubKey));
+    writer.Key("hex").Hex(scriptPubKey);
+
+    if (!ExtractDestinations(scriptPubKey, type, addresses, nRequired)) {
+        writer.Key("type").String(GetTxnOutputType(type));
+        writer.EndObject();
+        return;
+    }
+
+    writer.Key("reqSigs").Int(nRequired);
+    writer.Key("type").String(GetTxnOutputType(type));
+    writer.Key("addresses").BeginArray();
+    for (const CTxDestination& addr : addresses) {
+        writer.String(EncodeDestination(addr));
+    }
+    writer.EndArray();
+    writer.EndObject();
+}
+
+/**
+ * Write the same members as TxToJSON adds to entry into the object being
+ * written, without building them as a UniValue tree first. Blocks full of
+ * shielded transactions otherwise spend most of the time of getblock and
+ * getrawtransaction on allocating and copying the tree.
+ */
+void TxToJSON(const CTransaction& tx, const uint256 hashBlock, CJSONWriter& writer)
+{
+    writer.Key("txid").Blob(tx.GetHash());
+    writer.Key("overwintered").Bool(tx.fOverwintered);
+    writer.Key("version").Int(tx.nVersion);
+    if (tx.fOverwintered) {
+        writer.Key("versiongroupid").String(HexInt(tx.nVersionGroupId));
+    }
+    writer.Key("locktime").Int(tx.nLockTime);
+    if (tx.fOverwintered) {
+        writer.Key("expiryheight").Int(tx.nExpiryHeight);
+    }
+    writer.Key("vin").BeginArray();
+    BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+        writer.BeginObject();
+        if (tx.IsCoinBase())
+            writer.Key("coinbase").Hex(txin.scriptSig);
+        else {
+            writer.Key("txid").Blob(txin.prevout.hash);
+            writer.Key("vout").Int(txin.prevout.n);
+            writer.Key("scriptSig").BeginObject();
+            writer.Key("asm").String(ScriptToAsmStr(txin.scriptSig, true));
+            writer.Key("hex").Hex(txin.scriptSig);
+            writer.EndObject();
+        }
+        writer.Key("sequence").Int(txin.nSequence);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.Key("vout").BeginArray();
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        const CTxOut& txout = tx.vout[i];
+        writer.BeginObject();
+        writer.Key("value").Amount(txout.nValue);
+        writer.Key("valueZat").Int(txout.nValue);
+        writer.Key("n").Int(i);
+        writer.Key("scriptPubKey");
+        ScriptPubKeyToJSON(txout.scriptPubKey, writer);
+        writer.EndObject();
+    }
+    writer.EndArray();
+
+    bool useGroth = tx.fOverwintered && tx.nVersion >= SAPLING_TX_VERSION;
+    writer.Key("vjoinsplit").BeginArray();
+    for (const JSDescription& jsdescription : tx.vjoinsplit) {
+        writer.BeginObject();
+        writer.Key("vpub_old").Amount(jsdescription.vpub_old);
+        writer.Key("vpub_new").Amount(jsdescription.vpub_new);
+        writer.Key("anchor").Blob(jsdescription.anchor);
+        writer.Key("nullifiers").BeginArray();
+        for (const uint256& nf : jsdescription.nullifiers)
+            writer.Blob(nf);
+        writer.EndArray();
+        writer.Key("commitments").BeginArray();
+        for (const uint256& commitment : jsdescription.commitments)
+            writer.Blob(commitment);
+        writer.EndArray();
+        writer.Key("onetimePubKey").Blob(jsdescription.ephemeralKey);
+        writer.Key("randomSeed").Blob(jsdescription.randomSeed);
+        writer.Key("macs").BeginArray();
+        for (const uint256& mac : jsdescription.macs)
+            writer.Blob(mac);
+        writer.EndArray();
+
+        CDataStream ssProof(SER_NETWORK, PROTOCOL_VERSION);
+        auto ps = SproutProofSerializer<CDataStream>(ssProof, useGroth);
+        boost::apply_visitor(ps, jsdescription.proof);
+        writer.Key("proof").Hex(ssProof);
+
+        writer.Key("ciphertexts").BeginArray();
+        for (const ZCNoteEncryption::Ciphertext& ct : jsdescription.ciphertexts)
+            writer.Hex(ct);
+        writer.EndArray();
+        writer.EndObject();
+    }
+    writer.EndArray();
+
+    if (useGroth) {
+        writer.Key("valueBalance").Amount(tx.valueBalance);
+        writer.Key("vShieldedSpend").BeginArray();
+        for (const SpendDescription& spendDesc : tx.vShieldedSpend) {
+            writer.BeginObject();
+            writer.Key("cv").Blob(spendDesc.cv);
+            writer.Key("anchor").Blob(spendDesc.anchor);
+            writer.Key("nullifier").Blob(spendDesc.nullifier);
+            writer.Key("rk").Blob(spendDesc.rk);
+            writer.Key("proof").Hex(spendDesc.zkproof);
+            writer.Key("spendAuthSig").Hex(spendDesc.spendAuthSig);
+            writer.EndObject();
+        }
+        writer.EndArray();
+        writer.Key("vShieldedOutput").BeginArray();
+        for (const OutputDescription& outputDesc : tx.vShieldedOutput) {
+            writer.BeginObject();
+            writer.Key("cv").Blob(outputDesc.cv);
+            writer.Key("cmu").Blob(outputDesc.cm);
+            writer.Key("ephemeralKey").Blob(outputDesc.ephemeralKey);
+            writer.Key("encCiphertext").Hex(outputDesc.encCiphertext);
+            writer.Key("outCiphertext").Hex(outputDesc.outCiphertext);
+            writer.Key("proof").Hex(outputDesc.zkproof);
+            writer.EndObject();
+        }
+        writer.EndArray();
+        if (!(tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty())) {
+            writer.Key("bindingSig").Hex(tx.bindingSig);
+        }
+    }
+
+    if (!hashBlock.IsNull()) {
+        writer.Key("blockhash").Blob(hashBlock);
+        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+        if (mi != mapBlockIndex.end() && (*mi).second) {
+            CBlockIndex* pindex = (*mi).second;
+            if (chainActive.Contains(pindex)) {
+                writer.Key("confirmations").Int(1 + chainActive.Height() - pindex->nHeight);
+                writer.Key("time").Int(pindex->GetBlockTime());
+                writer.Key("blocktime").Int(pindex->GetBlockTime());
+            }
+            else
+                writer.Key("confirmations").Int(0);
+        }
+    }
+}
+
 UniValue getrawtransaction(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -321,20 +480,109 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
     if (params.size() > 1)
         fVerbose = (params[1].get_int() != 0);
 
+    std::string strKey = CResponseCache::MakeKey("getrawtransaction", hash.GetHex(), fVerbose ? "1" : "0");
+    std::string strJSON, strTag;
+    if (responseCache.Get(strKey, chainActive.Height(), strJSON, strTag))
+        return RawJSONValue(strJSON);
+
     CTransaction tx;
     uint256 hashBlock;
     if (!GetTransaction(hash, tx, hashBlock, true))
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available about transaction");
 
+    // Only transactions in a buried block are cached, not those of the mempool
+    BlockMap::iterator mi = hashBlock.IsNull() ? mapBlockIndex.end() : mapBlockIndex.find(hashBlock);
+    bool fCache = mi != mapBlockIndex.end() && CanCacheResponse(mi->second);
+
     string strHex = EncodeHexTx(tx);
 
-    if (!fVerbose)
-        return strHex;
+    if (!fVerbose) {
+        if (!fCache)
+            return strHex;
+        strJSON = "\"" + strHex + "\"";
+        responseCache.Put(strKey, mi->second->nHeight, strJSON, false);
+        return RawJSONValue(strJSON);
+    }
 
-    UniValue result(UniValue::VOBJ);
-    result.push_back(Pair("hex", strHex));
-    TxToJSON(tx, hashBlock, result);
-    return result;
+    CJSONWriter writer(strJSON);
+    writer.BeginObject();
+    writer.Key("hex").String(strHex);
+    TxToJSON(tx, hashBlock, writer);
+    writer.EndObject();
+    if (fCache)
+        responseCache.Put(strKey, mi->second->nHeight, strJSON, true);
+    return RawJSONValue(strJSON);
+}
+
+UniValue getrawtransactions(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getrawtransactions [\"txid\",...] ( verbose )\n"
+            "\nReturn the raw transaction data of several transactions, as getrawtransaction does for one.\n"
+            "With -txindex, the transactions are read from the block files in the order they are stored\n"
+            "in rather than the order they are asked for, so this is much faster than a getrawtransaction\n"
+            "call per transaction.\n"
+
+            "\nArguments:\n"
+            "1. \"txids\"       (string, required) A json array of transaction ids\n"
+            "    [\n"
+            "      \"txid\"     (string) A transaction id\n"
+            "      ,...\n"
+            "    ]\n"
+            "2. verbose       (numeric, optional, default=0) If 0, return strings, other return json objects\n"
+
+            "\nResult:\n"
+            "[                 (json array) In the order of \"txids\"\n"
+            "  \"data\"          (string or json object) As getrawtransaction gives it with verbose, or null\n"
+            "                  if there is no information available about the transaction\n"
+            "  ,...\n"
+            "]\n"
+
+            "\nExamples:\n"
+            + HelpExampleCli("getrawtransactions", "\"[\\\"mytxid\\\",\\\"myothertxid\\\"]\"")
+            + HelpExampleCli("getrawtransactions", "\"[\\\"mytxid\\\",\\\"myothertxid\\\"]\" 1")
+            + HelpExampleRpc("getrawtransactions", "[\"mytxid\",\"myothertxid\"], 1")
+        );
+
+    UniValue txids = params[0].get_array();
+    std::vector<uint256> vHash;
+    vHash.reserve(txids.size());
+    for (size_t i = 0; i < txids.size(); i++)
+        vHash.push_back(ParseHashV(txids[i], "txid"));
+
+    bool fVerbose = false;
+    if (params.size() > 1)
+        fVerbose = (params[1].get_int() != 0);
+
+    std::vector<CTransaction> vTx;
+    std::vector<uint256> vHashBlock;
+    std::vector<bool> vFound;
+    GetTransactions(vHash, vTx, vHashBlock, vFound, true);
+
+    // TxToJSON looks up the blocks in mapBlockIndex and chainActive
+    LOCK(cs_main);
+
+    std::string strJSON;
+    CJSONWriter writer(strJSON);
+    writer.BeginArray();
+    for (size_t i = 0; i < vHash.size(); i++) {
+        if (!vFound[i]) {
+            writer.Null();
+            continue;
+        }
+        std::string strHex = EncodeHexTx(vTx[i]);
+        if (!fVerbose) {
+            writer.String(strHex);
+            continue;
+        }
+        writer.BeginObject();
+        writer.Key("hex").String(strHex);
+        TxToJSON(vTx[i], vHashBlock[i], writer);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    return RawJSONValue(strJSON);
 }
 
 UniValue gettxoutproof(const UniValue& params, bool fHelp)
@@ -385,9 +633,9 @@ UniValue gettxoutproof(const UniValue& params, bool fHelp)
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
         pblockindex = mapBlockIndex[hashBlock];
     } else {
-        CCoins coins;
-        if (pcoinsTip->GetCoins(oneTxid, coins) && coins.nHeight > 0 && coins.nHeight <= chainActive.Height())
-            pblockindex = chainActive[coins.nHeight];
+        const Coin& coin = AccessByTxid(*pcoinsTip, oneTxid);
+        if (!coin.IsSpent() && coin.nHeight > 0 && coin.nHeight <= chainActive.Height())
+            pblockindex = chainActive[coin.nHeight];
     }
 
     if (pblockindex == NULL)
@@ -405,8 +653,8 @@ UniValue gettxoutproof(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
     unsigned int ntxFound = 0;
-    BOOST_FOREACH(const CTransaction&tx, block.vtx)
-        if (setTxids.count(tx.GetHash()))
+    BOOST_FOREACH(const CTransactionRef& tx, block.vtx)
+        if (setTxids.count(tx->GetHash()))
             ntxFound++;
     if (ntxFound != setTxids.size())
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "(Not all) transactions not found in specified block");
@@ -721,6 +969,12 @@ static void TxInErrorToJSON(const CTxIn& txin, UniValue& vErrorsRet, const std::
 
 UniValue signrawtransaction(const UniValue& params, bool fHelp)
 {
+#ifdef ENABLE_WALLET
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+#else
+    CWallet * const pwallet = NULL;
+#endif
+
     if (fHelp || params.size() < 1 || params.size() > 5)
         throw runtime_error(
             "signrawtransaction \"hexstring\" ( [{\"txid\":\"id\",\"vout\":n,\"scriptPubKey\":\"hex\",\"redeemScript\":\"hex\"},...] [\"privatekey1\",...] sighashtype )\n"
@@ -730,7 +984,7 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
             "The third optional argument (may be null) is an array of base58-encoded private\n"
             "keys that, if given, will be the only keys used to sign the transaction.\n"
 #ifdef ENABLE_WALLET
-            + HelpRequiringPassphrase() + "\n"
+            + HelpRequiringPassphrase(pwallet) + "\n"
 #endif
 
             "\nArguments:\n"
@@ -783,7 +1037,7 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
         );
 
 #ifdef ENABLE_WALLET
-    LOCK2(cs_main, pwalletMain ? &pwalletMain->cs_wallet : NULL);
+    LOCK2(cs_main, pwallet ? &pwallet->cs_wallet : NULL);
 #else
     LOCK(cs_main);
 #endif
@@ -820,9 +1074,7 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
         view.SetBackend(viewMempool); // temporarily switch cache backend to db+mempool view
 
         BOOST_FOREACH(const CTxIn& txin, mergedTx.vin) {
-            const uint256& prevHash = txin.prevout.hash;
-            CCoins coins;
-            view.AccessCoins(prevHash); // this is certainly allowed to fail
+            view.AccessCoin(txin.prevout); // Load entries from viewChain into view; can fail.
         }
 
         view.SetBackend(viewDummy); // switch back to avoid locking mempool for too long
@@ -842,8 +1094,8 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
         }
     }
 #ifdef ENABLE_WALLET
-    else if (pwalletMain)
-        EnsureWalletIsUnlocked();
+    else if (pwallet)
+        EnsureWalletIsUnlocked(pwallet);
 #endif
 
     // Add previous txouts given in the RPC call:
@@ -868,20 +1120,22 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
             CScript scriptPubKey(pkData.begin(), pkData.end());
 
             {
-                CCoinsModifier coins = view.ModifyCoins(txid);
-                if (coins->IsAvailable(nOut) && coins->vout[nOut].scriptPubKey != scriptPubKey) {
+                const COutPoint out(txid, nOut);
+                const Coin& coin = view.AccessCoin(out);
+                if (!coin.IsSpent() && coin.out.scriptPubKey != scriptPubKey) {
                     string err("Previous output scriptPubKey mismatch:\n");
-                    err = err + ScriptToAsmStr(coins->vout[nOut].scriptPubKey) + "\nvs:\n"+
+                    err = err + ScriptToAsmStr(coin.out.scriptPubKey) + "\nvs:\n"+
                         ScriptToAsmStr(scriptPubKey);
                     throw JSONRPCError(RPC_DESERIALIZATION_ERROR, err);
                 }
-                if ((unsigned int)nOut >= coins->vout.size())
-                    coins->vout.resize(nOut+1);
-                coins->vout[nOut].scriptPubKey = scriptPubKey;
-                coins->vout[nOut].nValue = 0;
+                Coin newcoin;
+                newcoin.out.scriptPubKey = scriptPubKey;
+                newcoin.out.nValue = 0;
                 if (prevOut.exists("amount")) {
-                    coins->vout[nOut].nValue = AmountFromValue(find_value(prevOut, "amount"));
+                    newcoin.out.nValue = AmountFromValue(find_value(prevOut, "amount"));
                 }
+                newcoin.nHeight = 1;
+                view.AddCoin(out, std::move(newcoin), true);
             }
 
             // if redeemScript given and not using the local wallet (private keys
@@ -899,7 +1153,7 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
     }
 
 #ifdef ENABLE_WALLET
-    const CKeyStore& keystore = ((fGivenKeys || !pwalletMain) ? tempKeystore : *pwalletMain);
+    const CKeyStore& keystore = ((fGivenKeys || !pwallet) ? tempKeystore : *pwallet);
 #else
     const CKeyStore& keystore = tempKeystore;
 #endif
@@ -922,7 +1176,6 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid sighash param");
     }
 
-    bool fHashSingle = ((nHashType & ~SIGHASH_ANYONECANPAY) == SIGHASH_SINGLE);
     // Use the approximate release height if it is greater so offline nodes 
     // have a better estimation of the current height and will be more likely to
     // determine the correct consensus branch ID.  Regtest mode ignores release height.
@@ -943,36 +1196,22 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
     // Script verification errors
     UniValue vErrors(UniValue::VARR);
 
-    // Use CTransaction for the constant parts of the
-    // transaction to avoid rehashing.
-    const CTransaction txConst(mergedTx);
-    // Sign what we can:
+    // Outputs spent by the inputs, null where unknown
+    vector<CTxOut> vSpent(mergedTx.vin.size());
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
-        CTxIn& txin = mergedTx.vin[i];
-        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if (coins == NULL || !coins->IsAvailable(txin.prevout.n)) {
-            TxInErrorToJSON(txin, vErrors, "Input not found or already spent");
-            continue;
-        }
-        const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
-        const CAmount& amount = coins->vout[txin.prevout.n].nValue;
-
-        SignatureData sigdata;
-        // Only sign SIGHASH_SINGLE if there's a corresponding output:
-        if (!fHashSingle || (i < mergedTx.vout.size()))
-            ProduceSignature(MutableTransactionSignatureCreator(&keystore, &mergedTx, i, amount, nHashType), prevPubKey, sigdata, consensusBranchId);
-
-        // ... and merge in other signatures:
-        BOOST_FOREACH(const CMutableTransaction& txv, txVariants) {
-            sigdata = CombineSignatures(prevPubKey, TransactionSignatureChecker(&txConst, i, amount), sigdata, DataFromTransaction(txv, i), consensusBranchId);
-        }
-
-        UpdateTransaction(mergedTx, i, sigdata);
+        const Coin& coin = view.AccessCoin(mergedTx.vin[i].prevout);
+        if (!coin.IsSpent())
+            vSpent[i] = coin.out;
+    }
 
-        ScriptError serror = SCRIPT_ERR_OK;
-        if (!VerifyScript(txin.scriptSig, prevPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&txConst, i, amount), consensusBranchId, &serror)) {
-            TxInErrorToJSON(txin, vErrors, ScriptErrorString(serror));
-        }
+    // Sign what we can:
+    vector<ScriptError> vScriptErrors = SignTransactionInputs(keystore, mergedTx, vSpent, txVariants,
+                                                              nHashType, consensusBranchId, std::max(nScriptCheckThreads, 1));
+    for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
+        if (vSpent[i].IsNull())
+            TxInErrorToJSON(mergedTx.vin[i], vErrors, "Input not found or already spent");
+        else if (vScriptErrors[i] != SCRIPT_ERR_OK)
+            TxInErrorToJSON(mergedTx.vin[i], vErrors, ScriptErrorString(vScriptErrors[i]));
     }
     bool fComplete = vErrors.empty();
 
@@ -1036,9 +1275,12 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp)
         fOverrideFees = params[1].get_bool();
 
     CCoinsViewCache &view = *pcoinsTip;
-    const CCoins* existingCoins = view.AccessCoins(hashTx);
+    bool fHaveChain = false;
+    for (size_t o = 0; !fHaveChain && o < tx.vout.size(); o++) {
+        const Coin& existingCoin = view.AccessCoin(COutPoint(hashTx, o));
+        fHaveChain = !existingCoin.IsSpent();
+    }
     bool fHaveMempool = mempool.exists(hashTx);
-    bool fHaveChain = existingCoins && existingCoins->nHeight < 1000000000;
     if (!fHaveMempool && !fHaveChain) {
         // push to local node and sync with wallets
         CValidationState state;
@@ -1062,16 +1304,17 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp)
 }
 
 static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
-    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true  },
-    { "rawtransactions",    "createrawtransaction",   &createrawtransaction,   true  },
-    { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true  },
-    { "rawtransactions",    "decodescript",           &decodescript,           true  },
-    { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false },
-    { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false }, /* uses wallet if enabled */
-    { "blockchain",         "gettxoutproof",          &gettxoutproof,          true  },
-    { "blockchain",         "verifytxoutproof",       &verifytxoutproof,       true  },
+{ //  category              name                      actor (function)         okSafeMode  okParallel
+  //  --------------------- ------------------------  -----------------------  ----------  ----------
+    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true,  true  },
+    { "rawtransactions",    "getrawtransactions",     &getrawtransactions,     true,  true  },
+    { "rawtransactions",    "createrawtransaction",   &createrawtransaction,   true,  false },
+    { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true,  true  },
+    { "rawtransactions",    "decodescript",           &decodescript,           true,  true  },
+    { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false, false },
+    { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false, false }, /* uses wallet if enabled */
+    { "blockchain",         "gettxoutproof",          &gettxoutproof,          true,  true  },
+    { "blockchain",         "verifytxoutproof",       &verifytxoutproof,       true,  true  },
 };
 
 void RegisterRawTransactionRPCCommands(CRPCTable &tableRPC)
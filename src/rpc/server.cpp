@@ -6,16 +6,24 @@
 
 #include "rpc/server.h"
 
+#include "httpserver.h"
 #include "init.h"
 #include "key_io.h"
+#include "metrics.h"
 #include "random.h"
 #include "sync.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utilstrencodings.h"
+#include "validationinterface.h"
 #include "asyncrpcqueue.h"
+#ifdef ENABLE_WALLET
+#include "wallet/rpcwallet.h"
+#include "wallet/wallet.h"
+#endif
 
 #include <memory>
+#include <set>
 
 #include <univalue.h>
 
@@ -132,6 +140,12 @@ UniValue ValueFromAmount(const CAmount& amount)
             strprintf("%s%d.%08d", sign ? "-" : "", quotient, remainder));
 }
 
+UniValue RawJSONValue(const std::string& strJSON)
+{
+    // UniValue writes the text of a number as it is
+    return UniValue(UniValue::VNUM, strJSON);
+}
+
 uint256 ParseHashV(const UniValue& v, string strName)
 {
     string strHex;
@@ -253,15 +267,60 @@ UniValue stop(const UniValue& params, bool fHelp)
     return "LitecoinZ server stopping";
 }
 
+UniValue getrpcinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrpcinfo\n"
+            "\nReturns the state of the work queues that calls are run from.\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"class\": \"name\",       (string) fast, default, wallet or heavy\n"
+            "    \"threads\": n,            (numeric) Worker threads of the queue\n"
+            "    \"depth\": n,              (numeric) Requests waiting for a thread\n"
+            "    \"requests\": n,           (numeric) Requests run so far\n"
+            "    \"rejected\": n,           (numeric) Requests turned away because the queue was full\n"
+            "    \"avgwait\": n,            (numeric) Average time a request waited for a thread, in microseconds\n"
+            "    \"maxwait\": n,            (numeric) Longest time a request waited for a thread, in microseconds\n"
+            "    \"avgrun\": n,             (numeric) Average time a request took to run, in microseconds\n"
+            "    \"maxrun\": n              (numeric) Longest time a request took to run, in microseconds\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrpcinfo", "")
+            + HelpExampleRpc("getrpcinfo", "")
+        );
+
+    UniValue ret(UniValue::VARR);
+    std::vector<HTTPWorkStats> vStats = GetHTTPWorkStats();
+    BOOST_FOREACH(const HTTPWorkStats& stats, vStats) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("class", stats.strClass));
+        obj.push_back(Pair("threads", stats.nThreads));
+        obj.push_back(Pair("depth", (uint64_t)stats.nDepth));
+        obj.push_back(Pair("requests", stats.nRequests));
+        obj.push_back(Pair("rejected", stats.nRejected));
+        obj.push_back(Pair("avgwait", stats.nRequests ? stats.nWaitTotal / (int64_t)stats.nRequests : 0));
+        obj.push_back(Pair("maxwait", stats.nWaitMax));
+        obj.push_back(Pair("avgrun", stats.nRequests ? stats.nRunTotal / (int64_t)stats.nRequests : 0));
+        obj.push_back(Pair("maxrun", stats.nRunMax));
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
 /**
  * Call Table
  */
 static const CRPCCommand vRPCCommands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
+{ //  category              name                      actor (function)         okSafeMode  okParallel
+  //  --------------------- ------------------------  -----------------------  ----------  ----------
     /* Overall control/query calls */
-    { "control",            "help",                   &help,                   true  },
-    { "control",            "stop",                   &stop,                   true  },
+    { "control",            "getrpcinfo",             &getrpcinfo,             true,  true  },
+    { "control",            "help",                   &help,                   true,  false },
+    { "control",            "stop",                   &stop,                   true,  false },
 };
 
 CRPCTable::CRPCTable()
@@ -344,6 +403,48 @@ bool IsRPCRunning()
     return fRPCRunning;
 }
 
+//! The deferral scope of the calling thread; not owned
+static void NoCleanup(RPCDeferralScope*) {}
+static boost::thread_specific_ptr<RPCDeferralScope> threadDeferralScope(NoCleanup);
+
+bool RPCCanDefer()
+{
+    return threadDeferralScope.get() != NULL;
+}
+
+RPCDeferralScope::RPCDeferralScope() : fOwner(threadDeferralScope.get() == NULL)
+{
+    if (fOwner)
+        threadDeferralScope.reset(this);
+}
+
+RPCDeferralScope::~RPCDeferralScope()
+{
+    if (fOwner)
+        threadDeferralScope.reset();
+}
+
+//! The request URI of the calling thread, if it is in a request
+static boost::thread_specific_ptr<std::string> threadRequestURI;
+
+std::string GetRPCRequestURI()
+{
+    return threadRequestURI.get() ? *threadRequestURI : "/";
+}
+
+RPCRequestURIScope::RPCRequestURIScope(const std::string& strURI) : strPrevious(GetRPCRequestURI())
+{
+    threadRequestURI.reset(new std::string(strURI));
+}
+
+RPCRequestURIScope::~RPCRequestURIScope()
+{
+    if (strPrevious == "/")
+        threadRequestURI.reset();
+    else
+        threadRequestURI.reset(new std::string(strPrevious));
+}
+
 void SetRPCWarmupStatus(const std::string& newStatus)
 {
     LOCK(cs_rpcWarmup);
@@ -395,6 +496,133 @@ void JSONRequest::parse(const UniValue& valRequest)
         throw JSONRPCError(RPC_INVALID_REQUEST, "Params must be an array");
 }
 
+/** Read a string without escapes or control characters, the quotes excluded */
+static bool ReadSimpleString(const std::string& str, size_t& nPos, std::string& strOut)
+{
+    if (nPos >= str.size() || str[nPos] != '"')
+        return false;
+    size_t nEnd = nPos + 1;
+    while (nEnd < str.size() && str[nEnd] != '"') {
+        unsigned char ch = str[nEnd];
+        if (ch < 0x20 || ch >= 0x80 || ch == '\\')
+            return false;
+        nEnd++;
+    }
+    if (nEnd >= str.size())
+        return false;
+    strOut = str.substr(nPos + 1, nEnd - nPos - 1);
+    nPos = nEnd + 1;
+    return true;
+}
+
+/** Read null, a simple string or an integer without leading zeros */
+static bool ReadSimpleScalar(const std::string& str, size_t& nPos, UniValue& valOut)
+{
+    if (nPos >= str.size())
+        return false;
+    if (str[nPos] == '"') {
+        std::string strValue;
+        if (!ReadSimpleString(str, nPos, strValue))
+            return false;
+        valOut = UniValue(strValue);
+        return true;
+    }
+    if (str.compare(nPos, 4, "null") == 0) {
+        valOut = NullUniValue;
+        nPos += 4;
+        return true;
+    }
+    size_t nEnd = nPos;
+    if (nEnd < str.size() && str[nEnd] == '-')
+        nEnd++;
+    size_t nDigits = nEnd;
+    while (nEnd < str.size() && str[nEnd] >= '0' && str[nEnd] <= '9')
+        nEnd++;
+    if (nEnd == nDigits || (str[nDigits] == '0' && nEnd - nDigits > 1))
+        return false;
+    // Fractions and exponents are left to the full parser
+    if (nEnd < str.size() && (str[nEnd] == '.' || str[nEnd] == 'e' || str[nEnd] == 'E'))
+        return false;
+    valOut.setNumStr(str.substr(nPos, nEnd - nPos));
+    nPos = nEnd;
+    return true;
+}
+
+static void SkipSpace(const std::string& str, size_t& nPos)
+{
+    while (nPos < str.size() && (str[nPos] == ' ' || str[nPos] == '\t' || str[nPos] == '\r' || str[nPos] == '\n'))
+        nPos++;
+}
+
+bool JSONRequest::parseSimple(const std::string& strRequest)
+{
+    size_t nPos = 0;
+    SkipSpace(strRequest, nPos);
+    if (nPos >= strRequest.size() || strRequest[nPos] != '{')
+        return false;
+    nPos++;
+    bool fMethod = false, fId = false;
+    UniValue valId;
+    std::string strMethodIn;
+    std::set<std::string> setKeys;
+    while (true) {
+        SkipSpace(strRequest, nPos);
+        std::string strKey;
+        if (!ReadSimpleString(strRequest, nPos, strKey) || !setKeys.insert(strKey).second)
+            return false;
+        SkipSpace(strRequest, nPos);
+        if (nPos >= strRequest.size() || strRequest[nPos] != ':')
+            return false;
+        nPos++;
+        SkipSpace(strRequest, nPos);
+        if (strKey == "params") {
+            // Only calls without parameters take this path
+            if (strRequest.compare(nPos, 4, "null") == 0) {
+                nPos += 4;
+            } else {
+                if (nPos >= strRequest.size() || strRequest[nPos] != '[')
+                    return false;
+                nPos++;
+                SkipSpace(strRequest, nPos);
+                if (nPos >= strRequest.size() || strRequest[nPos] != ']')
+                    return false;
+                nPos++;
+            }
+        } else if (strKey == "method") {
+            if (!ReadSimpleString(strRequest, nPos, strMethodIn))
+                return false;
+            fMethod = true;
+        } else {
+            UniValue val;
+            if (!ReadSimpleScalar(strRequest, nPos, val))
+                return false;
+            if (strKey == "id") {
+                valId = val;
+                fId = true;
+            }
+        }
+        SkipSpace(strRequest, nPos);
+        if (nPos >= strRequest.size())
+            return false;
+        if (strRequest[nPos] == '}')
+            break;
+        if (strRequest[nPos] != ',')
+            return false;
+        nPos++;
+    }
+    nPos++;
+    SkipSpace(strRequest, nPos);
+    if (nPos != strRequest.size() || !fMethod)
+        return false;
+
+    id = fId ? valId : NullUniValue;
+    strMethod = strMethodIn;
+    if (strMethod != "getblocktemplate")
+        LogPrint("rpc", "ThreadRPCServer method=%s\n", SanitizeString(strMethod));
+    params = UniValue(UniValue::VARR);
+    return true;
+}
+
 static UniValue JSONRPCExecOne(const UniValue& req)
 {
     UniValue rpc_result(UniValue::VOBJ);
@@ -419,11 +647,89 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
+/** Consecutive calls of a batch request that may run at the same time */
+struct CRPCParallelCalls
+{
+    //! The request URI of the batch, for the helper threads
+    std::string strURI;
+    std::vector<UniValue> vReq;
+    std::vector<UniValue> vReply;
+    boost::mutex cs;
+    boost::condition_variable cond;
+    //! Index of the next call to start and number of calls finished
+    size_t nNext;
+    size_t nDone;
+
+    CRPCParallelCalls() : nNext(0), nDone(0) {}
+};
+
+static void RunParallelCalls(std::shared_ptr<CRPCParallelCalls> calls)
+{
+    RPCRequestURIScope uriScope(calls->strURI);
+    while (true) {
+        size_t n;
+        {
+            boost::unique_lock<boost::mutex> lock(calls->cs);
+            if (calls->nNext == calls->vReq.size())
+                return;
+            n = calls->nNext++;
+        }
+        UniValue reply = JSONRPCExecOne(calls->vReq[n]);
+        boost::unique_lock<boost::mutex> lock(calls->cs);
+        calls->vReply[n] = reply;
+        if (++calls->nDone == calls->vReq.size())
+            calls->cond.notify_all();
+    }
+}
+
+static bool IsParallelCall(const UniValue& req)
+{
+    if (!req.isObject())
+        return false;
+    const UniValue& method = find_value(req, "method");
+    if (!method.isStr())
+        return false;
+    const CRPCCommand *pcmd = tableRPC[method.get_str()];
+    return pcmd && pcmd->okParallel;
+}
+
 std::string JSONRPCExecBatch(const UniValue& vReq)
 {
     UniValue ret(UniValue::VARR);
-    for (size_t reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    size_t reqIdx = 0;
+    while (reqIdx < vReq.size()) {
+        size_t reqEnd = reqIdx;
+        while (reqEnd < vReq.size() && IsParallelCall(vReq[reqEnd]))
+            reqEnd++;
+        if (reqEnd - reqIdx < 2) {
+            ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+            reqIdx++;
+            continue;
+        }
+
+        // Spread a run of read-only calls over the fast HTTP worker threads.
+        // This thread takes calls from the run as well, so the batch
+        // finishes even if no helper ever gets a thread.
+        std::shared_ptr<CRPCParallelCalls> calls(new CRPCParallelCalls());
+        calls->strURI = GetRPCRequestURI();
+        for (size_t i = reqIdx; i < reqEnd; i++)
+            calls->vReq.push_back(vReq[i]);
+        calls->vReply.resize(calls->vReq.size());
+        int64_t nHelpers = std::min((int64_t)calls->vReq.size() - 1, GetArg("-rpcfastthreads", DEFAULT_HTTP_FAST_THREADS));
+        for (int64_t i = 0; i < nHelpers; i++) {
+            if (!HTTPEnqueueTask(boost::bind(&RunParallelCalls, calls)))
+                break;
+        }
+        RunParallelCalls(calls);
+        {
+            boost::unique_lock<boost::mutex> lock(calls->cs);
+            while (calls->nDone < calls->vReq.size())
+                calls->cond.wait(lock);
+        }
+        for (size_t i = 0; i < calls->vReply.size(); i++)
+            ret.push_back(calls->vReply[i]);
+        reqIdx = reqEnd;
+    }
 
     return ret.write() + "\n";
 }
@@ -444,6 +750,18 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
 
     g_rpcSignals.PreCommand(*pcmd);
 
+    // Wallet calls see the effects of every block and transaction that was
+    // accepted before they were made, even when the wallet is behind. Other
+    // wallets being behind doesn't hold them up.
+    if (pcmd->category == "wallet") {
+#ifdef ENABLE_WALLET
+        SyncWithValidationInterfaceQueue(GetWalletForJSONRPCRequest());
+#else
+        SyncWithValidationInterfaceQueue();
+#endif
+    }
+
+    HistogramTimer timer(GetRPCMethodMetrics(pcmd->name));
     try
     {
         // Execute
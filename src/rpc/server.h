@@ -33,6 +33,8 @@ namespace RPCServer
 
 class CBlockIndex;
 class CNetAddr;
+class CTransaction;
+class CWallet;
 
 class JSONRequest
 {
@@ -43,6 +45,12 @@ public:
 
     JSONRequest() { id = NullUniValue; }
     void parse(const UniValue& valRequest);
+    /**
+     * Parse the common shape of a call without parameters straight from its
+     * text, without a UniValue of the whole request. Gives false for anything
+     * else, which is left to parse().
+     */
+    bool parseSimple(const std::string& strRequest);
 };
 
 /** Query whether RPC is running */
@@ -124,6 +132,53 @@ void RPCUnregisterTimerInterface(RPCTimerInterface *iface);
  */
 void RPCRunLater(const std::string& name, boost::function<void(void)> func, int64_t nSeconds);
 
+/** Sends the answer to a deferred call: result, or objError if it isn't null */
+typedef boost::function<void(const UniValue& result, const UniValue& objError)> RPCDeferredReply;
+
+/**
+ * Thrown by an RPC method, when RPCCanDefer() allows it, to answer after it
+ * has returned instead of holding a worker thread while it waits for an
+ * event. The server calls start with a function that sends the answer, which
+ * may be called from any thread but only once, and must not be called with
+ * locks held that the server's reply path could need.
+ */
+struct RPCDeferral
+{
+    boost::function<void(const RPCDeferredReply&)> start;
+};
+
+/** Whether the call being run on this thread may throw RPCDeferral */
+bool RPCCanDefer();
+
+/** Lets the calls run on this thread while it exists throw RPCDeferral */
+class RPCDeferralScope
+{
+private:
+    bool fOwner;
+
+public:
+    RPCDeferralScope();
+    ~RPCDeferralScope();
+};
+
+/**
+ * The path of the HTTP request the call run on this thread came in on, such
+ * as /wallet/<name> for a call to one of several wallets, or "/" outside of
+ * a request.
+ */
+std::string GetRPCRequestURI();
+
+/** Sets what GetRPCRequestURI() returns on this thread while it exists */
+class RPCRequestURIScope
+{
+private:
+    std::string strPrevious;
+
+public:
+    explicit RPCRequestURIScope(const std::string& strURI);
+    ~RPCRequestURIScope();
+};
+
 typedef UniValue(*rpcfn_type)(const UniValue& params, bool fHelp);
 
 class CRPCCommand
@@ -133,6 +188,8 @@ public:
     std::string name;
     rpcfn_type actor;
     bool okSafeMode;
+    //! Whether the call only reads state, so that the calls of a batch request can run at the same time
+    bool okParallel;
 };
 
 /**
@@ -181,16 +238,19 @@ extern uint256 ParseHashO(const UniValue& o, std::string strKey);
 extern std::vector<unsigned char> ParseHexV(const UniValue& v, std::string strName);
 extern std::vector<unsigned char> ParseHexO(const UniValue& o, std::string strKey);
 
-extern int64_t nWalletUnlockTime;
 extern CAmount AmountFromValue(const UniValue& value);
 extern UniValue ValueFromAmount(const CAmount& amount);
+/** Wrap a result that is already serialized as JSON, so that it is sent out as it is.
+ *  The value can't be read back as an object, so only return it from RPC calls. */
+extern UniValue RawJSONValue(const std::string& strJSON);
 extern double GetDifficulty(const CBlockIndex* blockindex = NULL);
 extern double GetNetworkDifficulty(const CBlockIndex* blockindex = NULL);
-extern std::string HelpRequiringPassphrase();
+extern std::string HelpRequiringPassphrase(CWallet* const pwallet);
 extern std::string HelpExampleCli(const std::string& methodname, const std::string& args);
 extern std::string HelpExampleRpc(const std::string& methodname, const std::string& args);
 
-extern void EnsureWalletIsUnlocked();
+extern void EnsureWalletIsUnlocked(CWallet* const pwallet);
+extern void EnsureShieldedRequirementsMet(const CTransaction& tx);
 extern UniValue z_sendmany(const UniValue& params, bool fHelp); // in rpcwallet.cpp
 extern UniValue z_shieldcoinbase(const UniValue& params, bool fHelp); // in rpcwallet.cpp
 extern UniValue z_listreceivedbyaddress(const UniValue& params, bool fHelp); // in rpcwallet.cpp
@@ -201,6 +261,9 @@ void InterruptRPC();
 void StopRPC();
 std::string JSONRPCExecBatch(const UniValue& vReq);
 
+/** Answer the getblocktemplate long polls due for a refresh, every few seconds */
+extern void CheckLongPolls(); // in rpc/mining.cpp
+
 extern std::string experimentalDisabledHelpMsg(const std::string& rpc, const std::string& enableArg);
 
 #endif // BITCOIN_RPCSERVER_H
@@ -6,11 +6,12 @@
 
 #include "reverselock.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <boost/bind.hpp>
 #include <utility>
 
-CScheduler::CScheduler() : nThreadsServicingQueue(0), stopRequested(false), stopWhenEmpty(false)
+CScheduler::CScheduler() : nLastTaskId(0), nThreadsServicingQueue(0), stopRequested(false), stopWhenEmpty(false)
 {
 }
 
@@ -50,8 +51,23 @@ void CScheduler::serviceQueue()
             if (shouldStop() || taskQueue.empty())
                 continue;
 
-            Function f = taskQueue.begin()->second;
+            // The first task can also have been cancelled or rescheduled while
+            // we waited, so check it's really due.
+            boost::chrono::system_clock::time_point tDue = taskQueue.begin()->first;
+            boost::chrono::system_clock::time_point tStart = boost::chrono::system_clock::now();
+            if (tDue > tStart)
+                continue;
+
+            TaskId id = taskQueue.begin()->second;
             taskQueue.erase(taskQueue.begin());
+            std::map<TaskId, Task>::iterator it = mapTasks.find(id);
+            assert(it != mapTasks.end());
+            Function f = it->second.f;
+            std::string strName = it->second.strName.empty() ? "other" : it->second.strName;
+            it->second.fQueued = false;
+            // A task that runs once is finished as soon as it starts
+            if (it->second.nRepeatSeconds == 0)
+                mapTasks.erase(it);
 
             {
                 // Unlock before calling f, so it can reschedule itself or another task
@@ -59,6 +75,26 @@ void CScheduler::serviceQueue()
                 reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
                 f();
             }
+
+            boost::chrono::system_clock::time_point tEnd = boost::chrono::system_clock::now();
+            int64_t nRunMicros = boost::chrono::duration_cast<boost::chrono::microseconds>(tEnd - tStart).count();
+            TaskStats& stats = mapTaskStats[strName];
+            stats.nRuns++;
+            stats.nRunMicros += nRunMicros;
+            stats.nMaxRunMicros = std::max(stats.nMaxRunMicros, nRunMicros);
+            stats.nLateMicros += boost::chrono::duration_cast<boost::chrono::microseconds>(tStart - tDue).count();
+
+            // Repeat unless cancelled while running
+            it = mapTasks.find(id);
+            if (it != mapTasks.end()) {
+                Task& task = it->second;
+                if (task.fRescheduled) {
+                    task.fRescheduled = false;
+                    queueTask(id, task, task.tRescheduled);
+                } else {
+                    queueTask(id, task, tEnd + boost::chrono::seconds(task.nRepeatSeconds));
+                }
+            }
         } catch (...) {
             --nThreadsServicingQueue;
             throw;
@@ -79,29 +115,75 @@ void CScheduler::stop(bool drain)
     newTaskScheduled.notify_all();
 }
 
-void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t)
+void CScheduler::queueTask(CScheduler::TaskId id, CScheduler::Task& task, boost::chrono::system_clock::time_point t)
 {
-    {
-        boost::unique_lock<boost::mutex> lock(newTaskMutex);
-        taskQueue.insert(std::make_pair(t, f));
-    }
-    newTaskScheduled.notify_one();
+    task.itQueued = taskQueue.insert(std::make_pair(t, id));
+    task.fQueued = true;
+    // Any thread may be waiting for a later task, so wake them all to
+    // have one of them wait for this one instead
+    newTaskScheduled.notify_all();
+}
+
+CScheduler::TaskId CScheduler::addTask(CScheduler::Function f, boost::chrono::system_clock::time_point t,
+                                       int64_t nRepeatSeconds, const std::string& strName)
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    TaskId id = ++nLastTaskId;
+    Task& task = mapTasks[id];
+    task.f = f;
+    task.strName = strName;
+    task.nRepeatSeconds = nRepeatSeconds;
+    task.fRescheduled = false;
+    queueTask(id, task, t);
+    return id;
+}
+
+CScheduler::TaskId CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t, const std::string& strName)
+{
+    return addTask(f, t, 0, strName);
 }
 
-void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds)
+CScheduler::TaskId CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds, const std::string& strName)
 {
-    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds));
+    return schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds), strName);
 }
 
-static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds)
+CScheduler::TaskId CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds, const std::string& strName)
 {
-    f();
-    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaSeconds), deltaSeconds);
+    // A repeating task needs a positive interval to be told apart from one that runs once
+    return addTask(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds),
+                   std::max<int64_t>(deltaSeconds, 1), strName);
 }
 
-void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds)
+bool CScheduler::cancel(CScheduler::TaskId id)
 {
-    scheduleFromNow(boost::bind(&Repeat, this, f, deltaSeconds), deltaSeconds);
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    std::map<TaskId, Task>::iterator it = mapTasks.find(id);
+    if (it == mapTasks.end())
+        return false;
+    if (it->second.fQueued)
+        taskQueue.erase(it->second.itQueued);
+    mapTasks.erase(it);
+    // Threads draining the queue may now find it empty
+    newTaskScheduled.notify_all();
+    return true;
+}
+
+bool CScheduler::reschedule(CScheduler::TaskId id, boost::chrono::system_clock::time_point t)
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    std::map<TaskId, Task>::iterator it = mapTasks.find(id);
+    if (it == mapTasks.end())
+        return false;
+    Task& task = it->second;
+    if (task.fQueued) {
+        taskQueue.erase(task.itQueued);
+        queueTask(id, task, t);
+    } else {
+        task.fRescheduled = true;
+        task.tRescheduled = t;
+    }
+    return true;
 }
 
 size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
@@ -115,3 +197,9 @@ size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
     }
     return result;
 }
+
+std::map<std::string, CScheduler::TaskStats> CScheduler::getTaskStats() const
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    return mapTaskStats;
+}
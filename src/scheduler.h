@@ -14,6 +14,8 @@
 #include <boost/chrono/chrono.hpp>
 #include <boost/thread.hpp>
 #include <map>
+#include <stdint.h>
+#include <string>
 
 //
 // Simple class for background tasks that should be run
@@ -24,7 +26,10 @@
 // CScheduler* s = new CScheduler();
 // s->scheduleFromNow(doSomething, 11); // Assuming a: void doSomething() { }
 // s->scheduleFromNow(boost::bind(Class::func, this, argument), 3);
+// CScheduler::TaskId id = s->scheduleEvery(doSomething, 60, "something");
+// s->cancel(id);
 // boost::thread* t = new boost::thread(boost::bind(CScheduler::serviceQueue, s));
+// (more threads may run serviceQueue, so that a slow task doesn't delay the others)
 //
 // ... then at program shutdown, clean up the thread running serviceQueue:
 // t->interrupt();
@@ -33,6 +38,9 @@
 // delete s; // Must be done after thread is interrupted/joined.
 //
 
+// Threads init starts to service the scheduler's queue
+static const int DEFAULT_SCHEDULER_THREADS = 2;
+
 class CScheduler
 {
 public:
@@ -41,23 +49,47 @@ public:
 
     typedef boost::function<void(void)> Function;
 
-    // Call func at/after time t
-    void schedule(Function f, boost::chrono::system_clock::time_point t);
+    // Identifies a scheduled task, for cancel() and reschedule(). Never 0.
+    typedef uint64_t TaskId;
+
+    // Run time of the tasks scheduled under one name
+    struct TaskStats
+    {
+        uint64_t nRuns;
+        // Total and longest time spent running
+        int64_t nRunMicros;
+        int64_t nMaxRunMicros;
+        // Total time between when runs were due and when they started
+        int64_t nLateMicros;
+    };
+
+    // Call func at/after time t. strName groups the task's run times in
+    // getTaskStats(); use a constant, as every name is kept.
+    TaskId schedule(Function f, boost::chrono::system_clock::time_point t, const std::string& strName = "");
 
     // Convenience method: call f once deltaSeconds from now
-    void scheduleFromNow(Function f, int64_t deltaSeconds);
+    TaskId scheduleFromNow(Function f, int64_t deltaSeconds, const std::string& strName = "");
 
     // Another convenience method: call f approximately
     // every deltaSeconds forever, starting deltaSeconds from now.
     // To be more precise: every time f is finished, it
     // is rescheduled to run deltaSeconds later. If you
     // need more accurate scheduling, don't use this method.
-    void scheduleEvery(Function f, int64_t deltaSeconds);
+    // The task keeps its id across runs.
+    TaskId scheduleEvery(Function f, int64_t deltaSeconds, const std::string& strName = "");
+
+    // Remove a task, so that it doesn't run again. A run already started
+    // finishes. Returns false if the task is unknown or has finished.
+    bool cancel(TaskId id);
 
-    // To keep things as simple as possible, there is no unschedule.
+    // Move the next run of a task to time t. If it is running, a repeating
+    // task's next run is moved instead. Returns false if the task is unknown
+    // or has finished.
+    bool reschedule(TaskId id, boost::chrono::system_clock::time_point t);
 
     // Services the queue 'forever'. Should be run in a thread,
-    // and interrupted using boost::interrupt_thread
+    // and interrupted using boost::interrupt_thread. Several threads
+    // may service the queue, so a long task only holds up one of them.
     void serviceQueue();
 
     // Tell any threads running serviceQueue to stop as soon as they're
@@ -70,14 +102,39 @@ public:
     size_t getQueueInfo(boost::chrono::system_clock::time_point &first,
                         boost::chrono::system_clock::time_point &last) const;
 
+    // Run times by task name, unnamed tasks under "other"
+    std::map<std::string, TaskStats> getTaskStats() const;
+
 private:
-    std::multimap<boost::chrono::system_clock::time_point, Function> taskQueue;
+    typedef std::multimap<boost::chrono::system_clock::time_point, TaskId> TaskQueue;
+
+    struct Task
+    {
+        Function f;
+        std::string strName;
+        // Seconds between runs, or 0 to run once
+        int64_t nRepeatSeconds;
+        // Whether it's in taskQueue, at itQueued, rather than running
+        bool fQueued;
+        TaskQueue::iterator itQueued;
+        // Set by reschedule() while it runs, for when it next runs
+        bool fRescheduled;
+        boost::chrono::system_clock::time_point tRescheduled;
+    };
+
+    TaskQueue taskQueue;
+    std::map<TaskId, Task> mapTasks;
+    std::map<std::string, TaskStats> mapTaskStats;
+    TaskId nLastTaskId;
     boost::condition_variable newTaskScheduled;
     mutable boost::mutex newTaskMutex;
     int nThreadsServicingQueue;
     bool stopRequested;
     bool stopWhenEmpty;
     bool shouldStop() { return stopRequested || (stopWhenEmpty && taskQueue.empty()); }
+
+    TaskId addTask(Function f, boost::chrono::system_clock::time_point t, int64_t nRepeatSeconds, const std::string& strName);
+    void queueTask(TaskId id, Task& task, boost::chrono::system_clock::time_point t);
 };
 
 #endif
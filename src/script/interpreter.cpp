@@ -1339,6 +1339,171 @@ bool TransactionSignatureChecker::CheckLockTime(const CScriptNum& nLockTime) con
 }
 
 
+namespace {
+
+/** Outcome of a fast path: decided either way, or left to the interpreter */
+enum TemplateResult {
+    TEMPLATE_UNDECIDED,
+    TEMPLATE_TRUE,
+    TEMPLATE_FALSE,
+};
+
+/**
+ * Read a script made only of data pushes into vPushes, as EvalScript would
+ * leave them on the stack. Fails, leaving the script to the interpreter, on
+ * any other opcode, an oversized push, or a push MINIMALDATA would reject.
+ */
+bool ReadPushes(const CScript& script, unsigned int flags, vector<valtype>& vPushes)
+{
+    if (script.size() > MAX_SCRIPT_SIZE)
+        return false;
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    valtype vchPushValue;
+    while (pc < script.end()) {
+        if (!script.GetOp(pc, opcode, vchPushValue) || opcode > OP_PUSHDATA4)
+            return false;
+        if (vchPushValue.size() > MAX_SCRIPT_ELEMENT_SIZE)
+            return false;
+        if ((flags & SCRIPT_VERIFY_MINIMALDATA) && !CheckMinimalPush(vchPushValue, opcode))
+            return false;
+        vPushes.push_back(vchPushValue);
+    }
+    return vPushes.size() <= 1000;
+}
+
+bool IsPayToPubKeyHashTemplate(const CScript& script)
+{
+    return script.size() == 25 &&
+           script[0] == OP_DUP &&
+           script[1] == OP_HASH160 &&
+           script[2] == 20 &&
+           script[23] == OP_EQUALVERIFY &&
+           script[24] == OP_CHECKSIG;
+}
+
+/** Match OP_m <pubkey>... OP_n OP_CHECKMULTISIG with 1 <= m <= n <= 16 */
+bool MatchMultisigTemplate(const CScript& script, unsigned int flags, int& nRequired, vector<valtype>& vKeys)
+{
+    if (script.size() > MAX_SCRIPT_SIZE)
+        return false;
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    valtype vchPushValue;
+    if (!script.GetOp(pc, opcode, vchPushValue) || opcode < OP_1 || opcode > OP_16)
+        return false;
+    nRequired = CScript::DecodeOP_N(opcode);
+    while (script.GetOp(pc, opcode, vchPushValue) && opcode <= OP_PUSHDATA4) {
+        if (vchPushValue.size() > MAX_SCRIPT_ELEMENT_SIZE)
+            return false;
+        if ((flags & SCRIPT_VERIFY_MINIMALDATA) && !CheckMinimalPush(vchPushValue, opcode))
+            return false;
+        vKeys.push_back(vchPushValue);
+    }
+    if (opcode < OP_1 || opcode > OP_16 || CScript::DecodeOP_N(opcode) != (int)vKeys.size() || nRequired > (int)vKeys.size())
+        return false;
+    return script.GetOp(pc, opcode) && opcode == OP_CHECKMULTISIG && pc == script.end();
+}
+
+/**
+ * CHECKMULTISIG with vArgs, the dummy element and then the signatures, as
+ * the whole stack. Signatures and keys are tried from the last, in the
+ * order the interpreter uses, so that the same signature checks are made.
+ */
+TemplateResult CheckMultisigTemplate(
+    const vector<valtype>& vArgs,
+    const CScript& script,
+    int nRequired,
+    const vector<valtype>& vKeys,
+    unsigned int flags,
+    const BaseSignatureChecker& checker,
+    uint32_t consensusBranchId)
+{
+    if ((int)vArgs.size() != nRequired + 1)
+        return TEMPLATE_UNDECIDED;
+    if ((flags & SCRIPT_VERIFY_NULLDUMMY) && vArgs[0].size())
+        return TEMPLATE_UNDECIDED;
+
+    int nSigsCount = nRequired;
+    int nKeysCount = vKeys.size();
+    while (nSigsCount > 0) {
+        const valtype& vchSig = vArgs[nSigsCount];
+        const valtype& vchPubKey = vKeys[nKeysCount - 1];
+        // The interpreter reports the first badly encoded element it checks
+        if (!CheckSignatureEncoding(vchSig, flags, NULL) || !CheckPubKeyEncoding(vchPubKey, flags, NULL))
+            return TEMPLATE_UNDECIDED;
+        if (checker.CheckSig(vchSig, vchPubKey, script, consensusBranchId))
+            nSigsCount--;
+        nKeysCount--;
+        if (nSigsCount > nKeysCount)
+            return TEMPLATE_FALSE;
+    }
+    return TEMPLATE_TRUE;
+}
+
+/**
+ * Verify P2PKH, bare multisig and P2SH multisig spends without running the
+ * interpreter. Only spends whose every step is known are decided; whenever
+ * the interpreter would fail for a reason other than a signature not
+ * matching, the spend is left to it so that it reports the error.
+ */
+TemplateResult VerifyStandardTemplate(
+    const CScript& scriptSig,
+    const CScript& scriptPubKey,
+    unsigned int flags,
+    const BaseSignatureChecker& checker,
+    uint32_t consensusBranchId)
+{
+    vector<valtype> vPushes;
+    if (!ReadPushes(scriptSig, flags, vPushes))
+        return TEMPLATE_UNDECIDED;
+
+    if (IsPayToPubKeyHashTemplate(scriptPubKey)) {
+        if (vPushes.size() != 2)
+            return TEMPLATE_UNDECIDED;
+        const valtype& vchSig = vPushes[0];
+        const valtype& vchPubKey = vPushes[1];
+        unsigned char hash[CRIPEMD160::OUTPUT_SIZE];
+        unsigned char sha[CSHA256::OUTPUT_SIZE];
+        CSHA256().Write(begin_ptr(vchPubKey), vchPubKey.size()).Finalize(sha);
+        CRIPEMD160().Write(sha, sizeof(sha)).Finalize(hash);
+        if (memcmp(hash, &scriptPubKey[3], sizeof(hash)) != 0)
+            return TEMPLATE_UNDECIDED;
+        if (!CheckSignatureEncoding(vchSig, flags, NULL) || !CheckPubKeyEncoding(vchPubKey, flags, NULL))
+            return TEMPLATE_UNDECIDED;
+        return checker.CheckSig(vchSig, vchPubKey, scriptPubKey, consensusBranchId) ? TEMPLATE_TRUE : TEMPLATE_FALSE;
+    }
+
+    int nRequired;
+    vector<valtype> vKeys;
+    if (MatchMultisigTemplate(scriptPubKey, flags, nRequired, vKeys)) {
+        // CLEANSTACK only matters with P2SH, where the extra elements of a
+        // bare multisig spend would remain below the result
+        return CheckMultisigTemplate(vPushes, scriptPubKey, nRequired, vKeys, flags, checker, consensusBranchId);
+    }
+
+    if ((flags & SCRIPT_VERIFY_P2SH) && scriptPubKey.IsPayToScriptHash()) {
+        if (vPushes.empty() || vPushes.size() >= 1000)
+            return TEMPLATE_UNDECIDED;
+        const valtype& vchRedeemScript = vPushes.back();
+        unsigned char hash[CRIPEMD160::OUTPUT_SIZE];
+        unsigned char sha[CSHA256::OUTPUT_SIZE];
+        CSHA256().Write(begin_ptr(vchRedeemScript), vchRedeemScript.size()).Finalize(sha);
+        CRIPEMD160().Write(sha, sizeof(sha)).Finalize(hash);
+        if (memcmp(hash, &scriptPubKey[2], sizeof(hash)) != 0)
+            return TEMPLATE_UNDECIDED;
+        CScript redeemScript(vchRedeemScript.begin(), vchRedeemScript.end());
+        if (!MatchMultisigTemplate(redeemScript, flags, nRequired, vKeys))
+            return TEMPLATE_UNDECIDED;
+        vPushes.pop_back();
+        return CheckMultisigTemplate(vPushes, redeemScript, nRequired, vKeys, flags, checker, consensusBranchId);
+    }
+
+    return TEMPLATE_UNDECIDED;
+}
+
+} // anon namespace
+
 bool VerifyScript(
     const CScript& scriptSig,
     const CScript& scriptPubKey,
@@ -1346,6 +1511,26 @@ bool VerifyScript(
     const BaseSignatureChecker& checker,
     uint32_t consensusBranchId,
     ScriptError* serror)
+{
+    // Where a standard template decides the spend, the interpreter would
+    // have ended with the same result and error
+    switch (VerifyStandardTemplate(scriptSig, scriptPubKey, flags, checker, consensusBranchId)) {
+    case TEMPLATE_TRUE:
+        return set_success(serror);
+    case TEMPLATE_FALSE:
+        return set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+    default:
+        return VerifyScriptGeneric(scriptSig, scriptPubKey, flags, checker, consensusBranchId, serror);
+    }
+}
+
+bool VerifyScriptGeneric(
+    const CScript& scriptSig,
+    const CScript& scriptPubKey,
+    unsigned int flags,
+    const BaseSignatureChecker& checker,
+    uint32_t consensusBranchId,
+    ScriptError* serror)
 {
     set_error(serror, SCRIPT_ERR_UNKNOWN_ERROR);
 
@@ -168,6 +168,11 @@ bool EvalScript(
     const BaseSignatureChecker& checker,
     uint32_t consensusBranchId,
     ScriptError* error = NULL);
+/**
+ * Verify a spend. P2PKH, bare multisig and P2SH multisig spends are checked
+ * directly against their templates, without the interpreter, with the same
+ * result and error VerifyScriptGeneric gives.
+ */
 bool VerifyScript(
     const CScript& scriptSig,
     const CScript& scriptPubKey,
@@ -175,5 +180,13 @@ bool VerifyScript(
     const BaseSignatureChecker& checker,
     uint32_t consensusBranchId,
     ScriptError* serror = NULL);
+/** Verify a spend by interpreting both scripts, whatever their form */
+bool VerifyScriptGeneric(
+    const CScript& scriptSig,
+    const CScript& scriptPubKey,
+    unsigned int flags,
+    const BaseSignatureChecker& checker,
+    uint32_t consensusBranchId,
+    ScriptError* serror = NULL);
 
 #endif // BITCOIN_SCRIPT_INTERPRETER_H
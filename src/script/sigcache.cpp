@@ -5,13 +5,15 @@
 
 #include "sigcache.h"
 
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "cuckoocache.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
 
 namespace {
 
@@ -19,56 +21,83 @@ namespace {
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
  * again when accepted into the block chain)
+ *
+ * Entries are salted digests of (signature hash, signature, public key), so
+ * each takes 32 bytes and peers can't predict where an entry is kept. They
+ * are held in fixed-size cuckoo caches, which allocate nothing per entry and
+ * let lookups proceed under a shared lock. The script check threads look up
+ * every input's signatures here, so the entries are also split into shards
+ * by the first byte of the digest, each with its own lock, and an insertion
+ * only blocks lookups in its own shard.
  */
 class CSignatureCache
 {
 private:
-     //! sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
+    static const size_t SHARDS = 16;
+
+    struct Shard {
+        CuckooCache::cache<uint256, CuckooCache::random_blob_hasher> setValid;
+        boost::shared_mutex cs_shard;
+    };
+
+    uint256 salt;
+    Shard shards[SHARDS];
+
+    uint256 ComputeEntry(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey) const
+    {
+        // The signature's length keeps the split between it and the key unambiguous
+        unsigned char sigSize[4];
+        WriteLE32(sigSize, vchSig.size());
+
+        uint256 entry;
+        CSHA256()
+            .Write(salt.begin(), salt.size())
+            .Write(hash.begin(), hash.size())
+            .Write(sigSize, sizeof(sigSize))
+            .Write(vchSig.data(), vchSig.size())
+            .Write(pubKey.begin(), pubKey.size())
+            .Finalize(entry.begin());
+        return entry;
+    }
+
+    Shard& GetShard(const uint256& entry)
+    {
+        return shards[*entry.begin() % SHARDS];
+    }
 
 public:
+    CSignatureCache() : salt(GetRandHash())
+    {
+        // -maxsigcachesize is in megabytes; a block has at most 20,000
+        // signature operations, and the default holds about 50 times that.
+        int64_t nMaxCacheSize = std::max<int64_t>(0, std::min<int64_t>(
+            GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE), MAX_MAX_SIG_CACHE_SIZE));
+        size_t nShardBytes = (size_t)std::min<uint64_t>((uint64_t)nMaxCacheSize << 20, SIZE_MAX) / SHARDS;
+        uint32_t nElems = 0;
+        for (size_t i = 0; i < SHARDS; i++) {
+            nElems += shards[i].setValid.setup_bytes(nShardBytes);
+        }
+        LogPrintf("Using %zu MiB out of %zu requested for signature cache, able to store %u elements\n",
+                  (nElems * sizeof(uint256)) >> 20, (size_t)nMaxCacheSize, nElems);
+    }
+
     bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey, bool erase)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        uint256 entry = ComputeEntry(hash, vchSig, pubKey);
+        Shard& shard = GetShard(entry);
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
-        return false;
+        boost::shared_lock<boost::shared_mutex> lock(shard.cs_shard);
+        return shard.setValid.contains(entry, erase);
     }
 
     void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there can be no more than 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
-        }
+        uint256 entry = ComputeEntry(hash, vchSig, pubKey);
+        Shard& shard = GetShard(entry);
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+        boost::unique_lock<boost::shared_mutex> lock(shard.cs_shard);
+        shard.setValid.insert(entry);
     }
 };
 
@@ -78,7 +107,9 @@ bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsig
 {
     static CSignatureCache signatureCache;
 
-    if (signatureCache.Get(sighash, vchSig, pubkey))
+    // A signature checked again without storing is being checked for a
+    // block, and won't be looked up after that
+    if (signatureCache.Get(sighash, vchSig, pubkey, !store))
         return true;
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
@@ -12,13 +12,18 @@
 
 class CPubKey;
 
+/** Default for -maxsigcachesize, the megabytes of valid signatures remembered */
+static const int64_t DEFAULT_MAX_SIG_CACHE_SIZE = 32;
+/** Largest -maxsigcachesize allowed, in megabytes */
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
     bool store;
 
 public:
-    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amount, bool storeIn, PrecomputedTransactionData& txdataIn) : TransactionSignatureChecker(txToIn, nInIn, amount, txdataIn), store(storeIn) {}
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amount, bool storeIn, const PrecomputedTransactionData& txdataIn) : TransactionSignatureChecker(txToIn, nInIn, amount, txdataIn), store(storeIn) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
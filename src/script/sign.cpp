@@ -11,13 +11,21 @@
 #include "script/standard.h"
 #include "uint256.h"
 
+#include <atomic>
+#include <exception>
+
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 
 using namespace std;
 
 typedef std::vector<unsigned char> valtype;
 
-TransactionSignatureCreator::TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, int nHashTypeIn) : BaseSignatureCreator(keystoreIn), txTo(txToIn), nIn(nInIn), nHashType(nHashTypeIn), amount(amountIn), checker(txTo, nIn, amountIn) {}
+//! Below this many inputs SignTransactionInputs signs them on the calling thread
+static const size_t MIN_PARALLEL_SIGN_INPUTS = 16;
+
+TransactionSignatureCreator::TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, int nHashTypeIn, const PrecomputedTransactionData* txdataIn) : BaseSignatureCreator(keystoreIn), txTo(txToIn), nIn(nInIn), nHashType(nHashTypeIn), amount(amountIn), txdata(txdataIn),
+    checker(txdataIn ? TransactionSignatureChecker(txTo, nIn, amountIn, *txdataIn) : TransactionSignatureChecker(txTo, nIn, amountIn)) {}
 
 bool TransactionSignatureCreator::CreateSig(std::vector<unsigned char>& vchSig, const CKeyID& address, const CScript& scriptCode, uint32_t consensusBranchId) const
 {
@@ -27,7 +35,7 @@ bool TransactionSignatureCreator::CreateSig(std::vector<unsigned char>& vchSig,
 
     uint256 hash;
     try {
-        hash = SignatureHash(scriptCode, *txTo, nIn, nHashType, amount, consensusBranchId);
+        hash = SignatureHash(scriptCode, *txTo, nIn, nHashType, amount, consensusBranchId, txdata);
     } catch (logic_error ex) {
         return false;
     }
@@ -168,6 +176,76 @@ void UpdateTransaction(CMutableTransaction& tx, unsigned int nIn, const Signatur
     tx.vin[nIn].scriptSig = data.scriptSig;
 }
 
+std::vector<ScriptError> SignTransactionInputs(
+    const CKeyStore& keystore,
+    CMutableTransaction& txTo,
+    const std::vector<CTxOut>& vSpent,
+    const std::vector<CMutableTransaction>& txVariants,
+    int nHashType,
+    uint32_t consensusBranchId,
+    int nThreads)
+{
+    assert(vSpent.size() == txTo.vin.size());
+
+    // Signatures don't cover the scriptSigs, so every input is signed
+    // against this one copy and its precomputed data
+    const CTransaction txConst(txTo);
+    const PrecomputedTransactionData txdata(txConst);
+    bool fHashSingle = ((nHashType & ~SIGHASH_ANYONECANPAY) == SIGHASH_SINGLE);
+
+    std::vector<SignatureData> vSigData(txTo.vin.size());
+    std::vector<ScriptError> vErrors(txTo.vin.size(), SCRIPT_ERR_UNKNOWN_ERROR);
+    std::atomic<size_t> nNext(0);
+    boost::mutex cs_exception;
+    std::exception_ptr exception;
+    auto sign = [&]() {
+        try {
+            for (size_t i = nNext++; i < vSpent.size(); i = nNext++) {
+                if (vSpent[i].IsNull())
+                    continue;
+                const CScript& prevPubKey = vSpent[i].scriptPubKey;
+                const CAmount& amount = vSpent[i].nValue;
+                const TransactionSignatureChecker checker(&txConst, i, amount, txdata);
+
+                SignatureData sigdata;
+                // Only sign SIGHASH_SINGLE if there's a corresponding output:
+                if (!fHashSingle || (i < txConst.vout.size()))
+                    ProduceSignature(TransactionSignatureCreator(&keystore, &txConst, i, amount, nHashType, &txdata), prevPubKey, sigdata, consensusBranchId);
+
+                // ... and merge in other signatures:
+                BOOST_FOREACH(const CMutableTransaction& txv, txVariants)
+                    sigdata = CombineSignatures(prevPubKey, checker, sigdata, DataFromTransaction(txv, i), consensusBranchId);
+
+                vErrors[i] = SCRIPT_ERR_OK;
+                VerifyScript(sigdata.scriptSig, prevPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, checker, consensusBranchId, &vErrors[i]);
+                vSigData[i] = sigdata;
+            }
+        } catch (...) {
+            boost::unique_lock<boost::mutex> lock(cs_exception);
+            if (!exception)
+                exception = std::current_exception();
+            // Leave the other threads nothing more to sign
+            nNext = vSpent.size();
+        }
+    };
+
+    if (vSpent.size() < MIN_PARALLEL_SIGN_INPUTS)
+        nThreads = 1;
+    boost::thread_group workers;
+    for (int i = 1; i < nThreads; i++)
+        workers.create_thread(sign);
+    sign();
+    workers.join_all();
+    if (exception)
+        std::rethrow_exception(exception);
+
+    for (unsigned int i = 0; i < txTo.vin.size(); i++) {
+        if (!vSpent[i].IsNull())
+            UpdateTransaction(txTo, i, vSigData[i]);
+    }
+    return vErrors;
+}
+
 bool SignSignature(
     const CKeyStore &keystore,
     const CScript& fromPubKey,
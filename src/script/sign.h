@@ -8,10 +8,13 @@
 
 #include "script/interpreter.h"
 
+#include <vector>
+
 class CKeyID;
 class CKeyStore;
 class CScript;
 class CTransaction;
+class CTxOut;
 
 struct CMutableTransaction;
 
@@ -36,10 +39,12 @@ class TransactionSignatureCreator : public BaseSignatureCreator {
     unsigned int nIn;
     int nHashType;
     CAmount amount;
+    const PrecomputedTransactionData* txdata;
     const TransactionSignatureChecker checker;
 
 public:
-    TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, int nHashTypeIn=SIGHASH_ALL);
+    /** txdataIn, if given, is the precomputed sighash data of txToIn, shared by the signers of each of its inputs. */
+    TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, int nHashTypeIn=SIGHASH_ALL, const PrecomputedTransactionData* txdataIn=NULL);
     const BaseSignatureChecker& Checker() const { return checker; }
     bool CreateSig(std::vector<unsigned char>& vchSig, const CKeyID& keyid, const CScript& scriptCode, uint32_t consensusBranchId) const;
 };
@@ -98,4 +103,21 @@ SignatureData CombineSignatures(
 SignatureData DataFromTransaction(const CMutableTransaction& tx, unsigned int nIn);
 void UpdateTransaction(CMutableTransaction& tx, unsigned int nIn, const SignatureData& data);
 
+/**
+ * Sign every input of txTo whose spent output is known, merge in the
+ * signatures each of txVariants has for it, and verify the result. vSpent
+ * holds the output each input spends, null where it is not known; those
+ * inputs are left as they are. The inputs share one set of precomputed
+ * sighash data and are signed on up to nThreads threads. Returns the script
+ * error of each input, SCRIPT_ERR_OK for those that verify.
+ */
+std::vector<ScriptError> SignTransactionInputs(
+    const CKeyStore& keystore,
+    CMutableTransaction& txTo,
+    const std::vector<CTxOut>& vSpent,
+    const std::vector<CMutableTransaction>& txVariants,
+    int nHashType,
+    uint32_t consensusBranchId,
+    int nThreads);
+
 #endif // BITCOIN_SCRIPT_SIGN_H
@@ -12,6 +12,12 @@
 #include "script/interpreter.h"
 #include "version.h"
 
+#include <algorithm>
+#include <atomic>
+#include <system_error>
+#include <thread>
+#include <vector>
+
 namespace {
 
 /** A class that deserializes a single CTransaction one time. */
@@ -25,7 +31,7 @@ public:
     m_remaining(txToLen)
     {}
 
-    void& read(char* pch, size_t nSize)
+    void read(char* pch, size_t nSize)
     {
         if (nSize > m_remaining)
             throw std::ios_base::failure(std::string(__func__) + ": end of data");
@@ -102,6 +108,67 @@ int zcashconsensus_verify_script(const unsigned char *scriptPubKey, unsigned int
     }
 }
 
+int zcashconsensus_verify_script_batch(const unsigned char *txTo, unsigned int txToLen,
+                                    const zcashconsensus_spent_output *spentOutputs, unsigned int nSpentOutputs,
+                                    unsigned int flags, uint32_t consensusBranchId, unsigned int nThreads,
+                                    unsigned int *pnFailedIn, zcashconsensus_error* err)
+{
+    try {
+        TxInputStream stream(SER_NETWORK, PROTOCOL_VERSION, txTo, txToLen);
+        CTransaction tx;
+        stream >> tx;
+        if (GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION) != txToLen)
+            return set_error(err, zcashconsensus_ERR_TX_SIZE_MISMATCH);
+        if (nSpentOutputs != tx.vin.size() || (nSpentOutputs > 0 && spentOutputs == NULL))
+            return set_error(err, zcashconsensus_ERR_SPENT_OUTPUTS_MISMATCH);
+
+        // Regardless of the verification result, the tx did not error.
+        set_error(err, zcashconsensus_ERR_OK);
+        const PrecomputedTransactionData txdata(tx);
+        const size_t nInputs = tx.vin.size();
+        // Inputs after the first failure found so far need no checking
+        std::atomic<size_t> nFailedIn(nInputs);
+        std::atomic<size_t> nNext(0);
+        auto check = [&]() {
+            for (size_t i = nNext++; i < nFailedIn; i = nNext++) {
+                const zcashconsensus_spent_output& spent = spentOutputs[i];
+                if (!VerifyScript(
+                        tx.vin[i].scriptSig,
+                        CScript(spent.scriptPubKey, spent.scriptPubKey + spent.scriptPubKeyLen),
+                        flags,
+                        TransactionSignatureChecker(&tx, i, spent.amount, txdata),
+                        consensusBranchId,
+                        NULL)) {
+                    size_t nPrev = nFailedIn;
+                    while (i < nPrev && !nFailedIn.compare_exchange_weak(nPrev, i)) {}
+                }
+            }
+        };
+
+        if (nThreads == 0)
+            nThreads = std::max(1U, std::thread::hardware_concurrency());
+        std::vector<std::thread> workers;
+        try {
+            for (size_t i = 1; i < std::min<size_t>(nThreads, nInputs); i++)
+                workers.emplace_back(check);
+        } catch (const std::system_error&) {
+            // Check with the threads there are
+        }
+        check();
+        for (std::thread& worker : workers)
+            worker.join();
+
+        if (nFailedIn < nInputs) {
+            if (pnFailedIn)
+                *pnFailedIn = nFailedIn;
+            return 0;
+        }
+        return 1;
+    } catch (const std::exception&) {
+        return set_error(err, zcashconsensus_ERR_TX_DESERIALIZE); // Error deserializing
+    }
+}
+
 unsigned int zcashconsensus_version()
 {
     // Just use the API version for now
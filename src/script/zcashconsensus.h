@@ -33,7 +33,7 @@
 extern "C" {
 #endif
 
-#define ZCASHCONSENSUS_API_VER 0
+#define ZCASHCONSENSUS_API_VER 1
 
 typedef enum zcashconsensus_error_t
 {
@@ -41,6 +41,7 @@ typedef enum zcashconsensus_error_t
     zcashconsensus_ERR_TX_INDEX,
     zcashconsensus_ERR_TX_SIZE_MISMATCH,
     zcashconsensus_ERR_TX_DESERIALIZE,
+    zcashconsensus_ERR_SPENT_OUTPUTS_MISMATCH,
 } zcashconsensus_error;
 
 /** Script verification flags */
@@ -59,6 +60,27 @@ EXPORT_SYMBOL int zcashconsensus_verify_script(const unsigned char *scriptPubKey
                                     const unsigned char *txTo        , unsigned int txToLen,
                                     unsigned int nIn, unsigned int flags, zcashconsensus_error* err);
 
+/** An output spent by an input of the transaction given to zcashconsensus_verify_script_batch */
+typedef struct zcashconsensus_spent_output
+{
+    const unsigned char *scriptPubKey;
+    unsigned int scriptPubKeyLen;
+    int64_t amount;
+} zcashconsensus_spent_output;
+
+/// Returns 1 if every input of the serialized transaction pointed to by
+/// txTo correctly spends the matching entry of spentOutputs, which holds
+/// one output per input, under the additional constraints specified by flags
+/// and the signature hashing rules of consensusBranchId. The transaction is
+/// deserialized and its signature hash midstates computed once for all the
+/// inputs, which are checked on up to nThreads threads (0 for one per core).
+/// If not NULL, pnFailedIn will contain the first input that fails, and err
+/// an error/success code for the operation.
+EXPORT_SYMBOL int zcashconsensus_verify_script_batch(const unsigned char *txTo, unsigned int txToLen,
+                                    const zcashconsensus_spent_output *spentOutputs, unsigned int nSpentOutputs,
+                                    unsigned int flags, uint32_t consensusBranchId, unsigned int nThreads,
+                                    unsigned int *pnFailedIn, zcashconsensus_error* err);
+
 EXPORT_SYMBOL unsigned int zcashconsensus_version();
 
 #ifdef __cplusplus
@@ -44,6 +44,18 @@ static const unsigned int MAX_SIZE = 0x02000000;
 struct deserialize_type {};
 constexpr deserialize_type deserialize {};
 
+/**
+ * Where the next byte a stream reads is, for streams whose bytes stay in
+ * memory after they are read, so that an object can be hashed from the
+ * bytes it was deserialized from instead of being serialized again. Other
+ * streams return nullptr; CSpanReader overloads this.
+ */
+template<typename Stream>
+inline const unsigned char* StreamReadPosition(const Stream& s)
+{
+    return nullptr;
+}
+
 /**
  * Used to bypass the rule against non-const reference to temporary
  * where it makes sense with wrappers such as CFlatData or CTxDB
@@ -111,6 +123,11 @@ template<typename Stream> inline void ser_writedata32(Stream &s, uint32_t obj)
     obj = htole32(obj);
     s.write((char*)&obj, 4);
 }
+template<typename Stream> inline void ser_writedata32be(Stream &s, uint32_t obj)
+{
+    obj = htobe32(obj);
+    s.write((char*)&obj, 4);
+}
 template<typename Stream> inline void ser_writedata64(Stream &s, uint64_t obj)
 {
     obj = htole64(obj);
@@ -134,6 +151,12 @@ template<typename Stream> inline uint32_t ser_readdata32(Stream &s)
     s.read((char*)&obj, 4);
     return le32toh(obj);
 }
+template<typename Stream> inline uint32_t ser_readdata32be(Stream &s)
+{
+    uint32_t obj;
+    s.read((char*)&obj, 4);
+    return be32toh(obj);
+}
 template<typename Stream> inline uint64_t ser_readdata64(Stream &s)
 {
     uint64_t obj;
@@ -180,6 +203,9 @@ enum
     SER_NETWORK         = (1 << 0),
     SER_DISK            = (1 << 1),
     SER_GETHASH         = (1 << 2),
+
+    // modifiers
+    SER_WITHOUT_PROOFS  = (1 << 3), //!< Leave out the proofs and signatures of shielded transfers
 };
 
 #define READWRITE(obj)      (::SerReadWrite(s, (obj), ser_action))
@@ -0,0 +1,104 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "shieldedindex.h"
+
+#include "script/standard.h"
+
+#include <string.h>
+
+namespace {
+
+// Tags keeping the different kinds of filter elements apart
+const unsigned char FILTER_SCRIPT = 'r';
+const unsigned char FILTER_KEY = 'k';
+const unsigned char FILTER_SPEND = 'o';
+
+GCSFilter::Element TaggedElement(unsigned char tag, const unsigned char* begin, const unsigned char* end)
+{
+    GCSFilter::Element element;
+    element.reserve(1 + (end - begin));
+    element.push_back(tag);
+    element.insert(element.end(), begin, end);
+    return element;
+}
+
+} // namespace
+
+CCompactSaplingOutput::CCompactSaplingOutput(const OutputDescription& output) :
+    cm(output.cm), ephemeralKey(output.ephemeralKey)
+{
+    memcpy(encCiphertext.data(), output.encCiphertext.data(), encCiphertext.size());
+}
+
+CCompactShieldedBlock::CCompactShieldedBlock(const CBlock& block)
+{
+    GCSFilter::ElementSet elements;
+    for (const CTransactionRef& ptx : block.vtx) {
+        const CTransaction& tx = *ptx;
+        if (!tx.vjoinsplit.empty() || !tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty()) {
+            CCompactShieldedTx ctx;
+            for (const JSDescription& jsdesc : tx.vjoinsplit) {
+                ctx.vSproutNullifiers.insert(ctx.vSproutNullifiers.end(), jsdesc.nullifiers.begin(), jsdesc.nullifiers.end());
+                ctx.vSproutCommitments.insert(ctx.vSproutCommitments.end(), jsdesc.commitments.begin(), jsdesc.commitments.end());
+            }
+            for (const SpendDescription& spend : tx.vShieldedSpend) {
+                ctx.vSaplingNullifiers.push_back(spend.nullifier);
+            }
+            for (const OutputDescription& output : tx.vShieldedOutput) {
+                ctx.vSaplingOutputs.push_back(CCompactSaplingOutput(output));
+            }
+            vtx.push_back(ctx);
+        }
+
+        if (!tx.IsCoinBase()) {
+            for (const CTxIn& txin : tx.vin) {
+                elements.insert(TransparentFilterSpendElement(txin.prevout.hash));
+            }
+        }
+        for (const CTxOut& txout : tx.vout) {
+            GetTransparentFilterElements(txout.scriptPubKey, elements);
+        }
+    }
+    transparentFilter = GCSFilter(FILTER_K0, FILTER_K1, elements);
+}
+
+void GetTransparentFilterElements(const CScript& scriptPubKey, GCSFilter::ElementSet& elements)
+{
+    if (scriptPubKey.empty()) {
+        return;
+    }
+    elements.insert(TaggedElement(FILTER_SCRIPT, &scriptPubKey[0], &scriptPubKey[0] + scriptPubKey.size()));
+
+    txnouttype whichType;
+    std::vector<std::vector<unsigned char>> vSolutions;
+    if (!Solver(scriptPubKey, whichType, vSolutions)) {
+        return;
+    }
+    switch (whichType) {
+    case TX_PUBKEY:
+        elements.insert(TransparentFilterKeyElement(CPubKey(vSolutions[0]).GetID()));
+        break;
+    case TX_PUBKEYHASH:
+        elements.insert(TransparentFilterKeyElement(CKeyID(uint160(vSolutions[0]))));
+        break;
+    case TX_MULTISIG:
+        for (size_t i = 1; i + 1 < vSolutions.size(); i++) {
+            elements.insert(TransparentFilterKeyElement(CPubKey(vSolutions[i]).GetID()));
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+GCSFilter::Element TransparentFilterKeyElement(const CKeyID& keyID)
+{
+    return TaggedElement(FILTER_KEY, keyID.begin(), keyID.end());
+}
+
+GCSFilter::Element TransparentFilterSpendElement(const uint256& txid)
+{
+    return TaggedElement(FILTER_SPEND, txid.begin(), txid.end());
+}
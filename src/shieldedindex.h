@@ -0,0 +1,104 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SHIELDEDINDEX_H
+#define BITCOIN_SHIELDEDINDEX_H
+
+#include "blockfilter.h"
+#include "primitives/block.h"
+#include "pubkey.h"
+#include "serialize.h"
+#include "uint256.h"
+#include "zcash/NoteEncryption.hpp"
+
+#include <vector>
+
+class CScript;
+
+/** The parts of a Sapling output needed to trial-decrypt it (ZIP 307). */
+class CCompactSaplingOutput
+{
+public:
+    uint256 cm;
+    uint256 ephemeralKey;
+    libzcash::SaplingCompactCiphertext encCiphertext;
+
+    CCompactSaplingOutput() {}
+    explicit CCompactSaplingOutput(const OutputDescription& output);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(cm);
+        READWRITE(ephemeralKey);
+        READWRITE(encCiphertext);
+    }
+};
+
+/** The shielded components of a transaction that a wallet rescan looks at. */
+class CCompactShieldedTx
+{
+public:
+    std::vector<uint256> vSproutNullifiers;
+    //! Note commitments of all JoinSplits, in order
+    std::vector<uint256> vSproutCommitments;
+    std::vector<uint256> vSaplingNullifiers;
+    std::vector<CCompactSaplingOutput> vSaplingOutputs;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(vSproutNullifiers);
+        READWRITE(vSproutCommitments);
+        READWRITE(vSaplingNullifiers);
+        READWRITE(vSaplingOutputs);
+    }
+};
+
+/**
+ * Per-block record of the shielded index (-shieldedindex). It holds what a
+ * wallet rescan needs to tell whether a block can concern the wallet, and to
+ * advance note witnesses past the block when it does not, so that most
+ * blocks never have to be read from disk in full.
+ *
+ * Transparent outputs and spends are summarized in a Golomb-coded set over
+ * the elements returned by GetTransparentFilterElements and
+ * TransparentFilterSpendElement. The set is keyed with fixed constants rather
+ * than the block hash, so a wallet hashes its query elements once per scan.
+ */
+class CCompactShieldedBlock
+{
+public:
+    static const uint64_t FILTER_K0 = 0x4c5a53686c644978ULL;
+    static const uint64_t FILTER_K1 = 0x5472616e73706172ULL;
+
+    //! Transactions with shielded components, in block order
+    std::vector<CCompactShieldedTx> vtx;
+    GCSFilter transparentFilter;
+
+    CCompactShieldedBlock() {}
+    explicit CCompactShieldedBlock(const CBlock& block);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(vtx);
+        READWRITE(transparentFilter);
+    }
+};
+
+/**
+ * Add the filter elements for an output script: the script itself, and the
+ * ID of every key a standard pay-to-pubkey(-hash) or multisig script names.
+ */
+void GetTransparentFilterElements(const CScript& scriptPubKey, GCSFilter::ElementSet& elements);
+/** Filter element for a key, matching the outputs GetTransparentFilterElements adds it for. */
+GCSFilter::Element TransparentFilterKeyElement(const CKeyID& keyID);
+/** Filter element for a transparent input spending an output of txid. */
+GCSFilter::Element TransparentFilterSpendElement(const uint256& txid);
+
+#endif // BITCOIN_SHIELDEDINDEX_H
@@ -0,0 +1,721 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stratum.h"
+
+#include "chainparams.h"
+#include "chainparamsbase.h"
+#include "consensus/validation.h"
+#include "crypto/common.h"
+#include "key_io.h"
+#include "main.h"
+#include "metrics.h"
+#include "miner.h"
+#include "netbase.h"
+#include "pow.h"
+#include "random.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "sync.h"
+#include "timedata.h"
+#include "txmempool.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <event2/listener.h>
+#include <event2/thread.h>
+
+/** Jobs kept for the shares still coming in on them */
+static const size_t MAX_STRATUM_JOBS = 16;
+/** Seconds between checks of the mempool for a new job, and of the share rates */
+static const int STRATUM_TIMER_INTERVAL = 30;
+/** Longest line a miner may send */
+static const size_t MAX_STRATUM_LINE = 32 * 1024;
+/** Shares waiting to be checked beyond which new ones are turned down */
+static const size_t MAX_STRATUM_QUEUE = 4096;
+/** Seconds a connection may stay silent */
+static const int STRATUM_TIMEOUT = 30 * 60;
+/** Seconds over which the share rate of a connection is measured */
+static const int64_t STRATUM_RETARGET_INTERVAL = 120;
+/** Seconds each connection is meant to take per share */
+static const int64_t STRATUM_SHARE_INTERVAL = 10;
+
+//! Stratum error codes
+enum {
+    STRATUM_ERR_OTHER = 20,
+    STRATUM_ERR_JOB_NOT_FOUND = 21,
+    STRATUM_ERR_DUPLICATE = 22,
+    STRATUM_ERR_LOW_DIFFICULTY = 23,
+    STRATUM_ERR_UNAUTHORIZED = 24,
+    STRATUM_ERR_NOT_SUBSCRIBED = 25,
+};
+
+namespace {
+
+struct CStratumJob
+{
+    std::string strId;
+    CBlock block;
+    arith_uint256 hashTarget;
+    //! The headers of the shares taken, for none to count twice
+    std::set<uint256> setSubmitted;
+};
+typedef std::shared_ptr<CStratumJob> StratumJobRef;
+
+struct CStratumClient
+{
+    boost::mutex cs;
+    //! NULL once the connection is closed; freed on the event thread only
+    struct bufferevent* bev;
+    CService addr;
+    std::vector<unsigned char> vNonce1;
+    bool fSubscribed;
+    bool fAuthorized;
+    std::string strWorker;
+    double dDifficulty;
+    arith_uint256 target;
+    //! The target before the last change, which the jobs sent before it are still worked on at
+    arith_uint256 targetPrev;
+    int64_t nRetargetStart;
+    unsigned int nRetargetShares;
+
+    CStratumClient() : bev(NULL), fSubscribed(false), fAuthorized(false), dDifficulty(0), nRetargetStart(0), nRetargetShares(0) {}
+};
+typedef std::shared_ptr<CStratumClient> StratumClientRef;
+
+} // anon namespace
+
+static struct event_base* stratumBase = NULL;
+static struct evconnlistener* stratumListener = NULL;
+static struct event* stratumJobEvent = NULL;
+static struct event* stratumTimerEvent = NULL;
+static boost::thread stratumThread;
+static boost::thread_group stratumWorkers;
+
+static CScript stratumScriptPubKey;
+static double dStratumDifficulty = DEFAULT_STRATUM_DIFFICULTY;
+static std::string strStratumPassword;
+static uint32_t nStratumNonce1 = 0;
+//! The connections, by their bufferevent; used on the event thread only
+static std::map<struct bufferevent*, StratumClientRef> mapStratumClients;
+
+static CCriticalSection cs_stratumJobs;
+static std::map<std::string, StratumJobRef> mapStratumJobs;
+//! The ids of the jobs kept, oldest first
+static std::deque<std::string> dequeStratumJobs;
+static StratumJobRef pStratumJob;
+static uint64_t nStratumJobId = 0;
+static unsigned int nStratumTxUpdated = 0;
+
+static boost::mutex csStratumQueue;
+static boost::condition_variable condStratumQueue;
+static std::deque<std::function<void()> > queueStratum;
+static bool fStratumQueueStop = false;
+
+int GetDefaultStratumPort()
+{
+    const std::string strNetwork = Params().NetworkIDString();
+    if (strNetwork == CBaseChainParams::TESTNET)
+        return 39335;
+    if (strNetwork == CBaseChainParams::REGTEST)
+        return 49445;
+    return 29335;
+}
+
+arith_uint256 GetStratumTarget(double dDifficulty, const Consensus::Params& params)
+{
+    // In thousandths, for a difficulty below 1 to be given too
+    dDifficulty = std::max(0.001, std::min(1e15, dDifficulty));
+    arith_uint256 target = UintToArith256(params.powLimit);
+    target /= arith_uint256((uint64_t)(dDifficulty * 1000));
+    // Beyond the easiest target there is, every hash is a share
+    if (target > ~arith_uint256() / 1000)
+        return ~arith_uint256();
+    target *= 1000;
+    return target;
+}
+
+static std::string HexLE32(uint32_t n)
+{
+    unsigned char buf[4];
+    WriteLE32(buf, n);
+    return HexStr(buf, buf + sizeof(buf));
+}
+
+UniValue StratumNotifyParams(const std::string& strJobId, const CBlockHeader& header, bool fClean)
+{
+    UniValue params(UniValue::VARR);
+    params.push_back(strJobId);
+    params.push_back(HexLE32(header.nVersion));
+    params.push_back(HexStr(header.hashPrevBlock.begin(), header.hashPrevBlock.end()));
+    params.push_back(HexStr(header.hashMerkleRoot.begin(), header.hashMerkleRoot.end()));
+    params.push_back(HexStr(header.hashFinalSaplingRoot.begin(), header.hashFinalSaplingRoot.end()));
+    params.push_back(HexLE32(header.nTime));
+    params.push_back(HexLE32(header.nBits));
+    params.push_back(fClean);
+    return params;
+}
+
+bool StratumSubmitHeader(const CBlockHeader& jobHeader, const std::vector<unsigned char>& vNonce1,
+                         const std::string& strTime, const std::string& strNonce2, const std::string& strSolution,
+                         CBlockHeader& header, std::string& strError)
+{
+    header = jobHeader;
+    if (strTime.size() != 8 || !IsHex(strTime)) {
+        strError = "Malformed time";
+        return false;
+    }
+    std::vector<unsigned char> vTime = ParseHex(strTime);
+    header.nTime = ReadLE32(&vTime[0]);
+
+    if (vNonce1.size() > header.nNonce.size() || strNonce2.size() != 2 * (header.nNonce.size() - vNonce1.size()) ||
+        (!strNonce2.empty() && !IsHex(strNonce2))) {
+        strError = "Malformed nonce";
+        return false;
+    }
+    std::vector<unsigned char> vNonce2 = ParseHex(strNonce2);
+    std::copy(vNonce1.begin(), vNonce1.end(), header.nNonce.begin());
+    std::copy(vNonce2.begin(), vNonce2.end(), header.nNonce.begin() + vNonce1.size());
+
+    if (!IsHex(strSolution)) {
+        strError = "Malformed solution";
+        return false;
+    }
+    try {
+        CDataStream ss(ParseHex(strSolution), SER_NETWORK, PROTOCOL_VERSION);
+        ss >> header.nSolution;
+        if (!ss.empty()) {
+            strError = "Malformed solution";
+            return false;
+        }
+    } catch (const std::exception&) {
+        strError = "Malformed solution";
+        return false;
+    }
+    return true;
+}
+
+static UniValue StratumError(int nCode, const std::string& strMessage)
+{
+    UniValue error(UniValue::VARR);
+    error.push_back(nCode);
+    error.push_back(strMessage);
+    error.push_back(NullUniValue);
+    return error;
+}
+
+static std::string StratumNotification(const std::string& strMethod, const UniValue& params)
+{
+    UniValue notification(UniValue::VOBJ);
+    notification.push_back(Pair("id", NullUniValue));
+    notification.push_back(Pair("method", strMethod));
+    notification.push_back(Pair("params", params));
+    return notification.write() + "\n";
+}
+
+//! Must be called with client->cs held
+static void StratumSendLocked(CStratumClient& client, const std::string& strLine)
+{
+    if (client.bev)
+        bufferevent_write(client.bev, strLine.data(), strLine.size());
+}
+
+static void StratumReply(const StratumClientRef& client, const UniValue& id, const UniValue& result, const UniValue& error)
+{
+    UniValue reply(UniValue::VOBJ);
+    reply.push_back(Pair("id", id));
+    reply.push_back(Pair("result", result));
+    reply.push_back(Pair("error", error));
+    boost::lock_guard<boost::mutex> lock(client->cs);
+    StratumSendLocked(*client, reply.write() + "\n");
+}
+
+static std::string StratumTargetNotification(const CStratumClient& client)
+{
+    UniValue params(UniValue::VARR);
+    params.push_back(client.target.GetHex());
+    return StratumNotification("mining.set_target", params);
+}
+
+static StratumJobRef GetStratumJob()
+{
+    LOCK(cs_stratumJobs);
+    return pStratumJob;
+}
+
+/**
+ * Count a share of client, if fShare, and once the share rate has been
+ * measured long enough, move the difficulty towards a share every
+ * STRATUM_SHARE_INTERVAL seconds, by at most a factor of 4 each time. The
+ * new target is sent with the current job again, as it only applies to
+ * the jobs after it.
+ */
+static void StratumRetarget(const StratumClientRef& client, bool fShare)
+{
+    StratumJobRef job = GetStratumJob();
+    int64_t nNow = GetTime();
+    boost::lock_guard<boost::mutex> lock(client->cs);
+    if (!client->fAuthorized)
+        return;
+    if (fShare)
+        client->nRetargetShares++;
+    int64_t nElapsed = nNow - client->nRetargetStart;
+    if (nElapsed < STRATUM_RETARGET_INTERVAL)
+        return;
+    double dFactor = (double)client->nRetargetShares * STRATUM_SHARE_INTERVAL / nElapsed;
+    dFactor = std::max(0.25, std::min(4.0, dFactor));
+    client->nRetargetStart = nNow;
+    client->nRetargetShares = 0;
+    if (dFactor > 0.75 && dFactor < 1.5)
+        return;
+
+    client->dDifficulty = std::max(0.001, client->dDifficulty * dFactor);
+    client->targetPrev = client->target;
+    client->target = GetStratumTarget(client->dDifficulty, Params().GetConsensus());
+    LogPrint("stratum", "stratum: difficulty of %s set to %g\n", client->addr.ToString(), client->dDifficulty);
+    StratumSendLocked(*client, StratumTargetNotification(*client));
+    if (job)
+        StratumSendLocked(*client, StratumNotification("mining.notify", StratumNotifyParams(job->strId, job->block, false)));
+}
+
+/** Check a share of client on a worker thread, and process its block if it is one */
+static void StratumCheckShare(const StratumClientRef& client, const UniValue& id, const std::string& strJobId,
+                              const std::string& strTime, const std::string& strNonce2, const std::string& strSolution)
+{
+    StratumJobRef job;
+    {
+        LOCK(cs_stratumJobs);
+        std::map<std::string, StratumJobRef>::iterator it = mapStratumJobs.find(strJobId);
+        if (it != mapStratumJobs.end())
+            job = it->second;
+    }
+    if (!job) {
+        StratumReply(client, id, false, StratumError(STRATUM_ERR_JOB_NOT_FOUND, "Job not found"));
+        return;
+    }
+
+    std::vector<unsigned char> vNonce1;
+    arith_uint256 target;
+    std::string strWorker;
+    {
+        boost::lock_guard<boost::mutex> lock(client->cs);
+        vNonce1 = client->vNonce1;
+        target = std::max(client->target, client->targetPrev);
+        strWorker = client->strWorker;
+    }
+
+    CBlockHeader header;
+    std::string strError;
+    if (!StratumSubmitHeader(job->block, vNonce1, strTime, strNonce2, strSolution, header, strError)) {
+        StratumReply(client, id, false, StratumError(STRATUM_ERR_OTHER, strError));
+        return;
+    }
+    if (header.nTime < job->block.nTime || header.nTime > GetAdjustedTime() + 2 * 60 * 60) {
+        StratumReply(client, id, false, StratumError(STRATUM_ERR_OTHER, "Time out of range"));
+        return;
+    }
+
+    // The hash is cheap next to the solution, so is checked first
+    uint256 hash = header.GetHash();
+    if (UintToArith256(hash) > target) {
+        StratumReply(client, id, false, StratumError(STRATUM_ERR_LOW_DIFFICULTY, "Low difficulty share"));
+        return;
+    }
+    if (!CheckEquihashSolution(&header, Params())) {
+        StratumReply(client, id, false, StratumError(STRATUM_ERR_OTHER, "Invalid solution"));
+        return;
+    }
+    {
+        LOCK(cs_stratumJobs);
+        if (!job->setSubmitted.insert(hash).second) {
+            StratumReply(client, id, false, StratumError(STRATUM_ERR_DUPLICATE, "Duplicate share"));
+            return;
+        }
+    }
+
+    if (UintToArith256(hash) <= job->hashTarget) {
+        CBlock block(job->block);
+        block.nTime = header.nTime;
+        block.nNonce = header.nNonce;
+        block.nSolution = header.nSolution;
+        LogPrintf("stratum: %s found block %s\n", strWorker, hash.GetHex());
+        CValidationState state;
+        if (ProcessNewBlock(state, NULL, &block, true, NULL))
+            TrackMinedBlock(hash);
+        else
+            LogPrintf("stratum: block %s not accepted: %s\n", hash.GetHex(), state.GetRejectReason());
+    }
+
+    StratumReply(client, id, true, NullUniValue);
+    StratumRetarget(client, true);
+}
+
+static bool StratumQueue(const std::function<void()>& f)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(csStratumQueue);
+        if (queueStratum.size() >= MAX_STRATUM_QUEUE)
+            return false;
+        queueStratum.push_back(f);
+    }
+    condStratumQueue.notify_one();
+    return true;
+}
+
+static void ThreadStratumWorker()
+{
+    while (true) {
+        std::function<void()> f;
+        {
+            boost::unique_lock<boost::mutex> lock(csStratumQueue);
+            while (queueStratum.empty() && !fStratumQueueStop)
+                condStratumQueue.wait(lock);
+            if (fStratumQueueStop)
+                return;
+            f = queueStratum.front();
+            queueStratum.pop_front();
+        }
+        f();
+    }
+}
+
+/** Build a job from a new block template and send it to every miner; on the event thread */
+static void StratumUpdateJob(bool fClean)
+{
+    if (IsInitialBlockDownload())
+        return;
+    nStratumTxUpdated = mempool.GetTransactionsUpdated();
+    std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(stratumScriptPubKey));
+    if (!pblocktemplate) {
+        LogPrintf("stratum: Unable to create a block template\n");
+        return;
+    }
+    StratumJobRef job = std::make_shared<CStratumJob>();
+    job->block = pblocktemplate->block;
+    job->block.hashMerkleRoot = job->block.BuildMerkleTree();
+    job->hashTarget.SetCompact(job->block.nBits);
+    {
+        LOCK(cs_stratumJobs);
+        job->strId = strprintf("%x", ++nStratumJobId);
+        if (fClean) {
+            mapStratumJobs.clear();
+            dequeStratumJobs.clear();
+        }
+        while (dequeStratumJobs.size() >= MAX_STRATUM_JOBS) {
+            mapStratumJobs.erase(dequeStratumJobs.front());
+            dequeStratumJobs.pop_front();
+        }
+        mapStratumJobs[job->strId] = job;
+        dequeStratumJobs.push_back(job->strId);
+        pStratumJob = job;
+    }
+
+    std::string strLine = StratumNotification("mining.notify", StratumNotifyParams(job->strId, job->block, fClean));
+    for (const std::pair<struct bufferevent* const, StratumClientRef>& item : mapStratumClients) {
+        CStratumClient& client = *item.second;
+        boost::lock_guard<boost::mutex> lock(client.cs);
+        if (client.fAuthorized) {
+            client.targetPrev = client.target;
+            StratumSendLocked(client, strLine);
+        }
+    }
+    LogPrint("stratum", "stratum: job %s on %s with %u transactions\n", job->strId,
+             job->block.hashPrevBlock.GetHex(), job->block.vtx.size());
+}
+
+static void StratumBlockTip(const uint256& hashNewTip)
+{
+    if (stratumJobEvent)
+        event_active(stratumJobEvent, 0, 0);
+}
+
+static void StratumJobCallback(evutil_socket_t, short, void*)
+{
+    StratumUpdateJob(true);
+}
+
+static void StratumTimerCallback(evutil_socket_t, short, void*)
+{
+    if (!GetStratumJob())
+        StratumUpdateJob(true);
+    else if (mempool.GetTransactionsUpdated() != nStratumTxUpdated)
+        StratumUpdateJob(false);
+    // Connections whose shares have stopped coming in are eased here
+    for (const std::pair<struct bufferevent* const, StratumClientRef>& item : mapStratumClients)
+        StratumRetarget(item.second, false);
+}
+
+/** Handle a request of client; false if the connection is to be closed */
+static bool StratumProcessLine(const StratumClientRef& client, const std::string& strLine)
+{
+    UniValue request;
+    if (!request.read(strLine) || !request.isObject())
+        return false;
+    const UniValue& id = find_value(request, "id");
+    const UniValue& method = find_value(request, "method");
+    const UniValue& params = find_value(request, "params");
+    if (!method.isStr() || !params.isArray()) {
+        StratumReply(client, id, NullUniValue, StratumError(STRATUM_ERR_OTHER, "Invalid request"));
+        return true;
+    }
+    const std::string& strMethod = method.get_str();
+
+    if (strMethod == "mining.subscribe") {
+        UniValue result(UniValue::VARR);
+        {
+            boost::lock_guard<boost::mutex> lock(client->cs);
+            client->fSubscribed = true;
+            result.push_back(NullUniValue);
+            result.push_back(HexStr(client->vNonce1));
+        }
+        StratumReply(client, id, result, NullUniValue);
+    } else if (strMethod == "mining.authorize") {
+        if (params.size() < 1 || !params[0].isStr()) {
+            StratumReply(client, id, false, StratumError(STRATUM_ERR_OTHER, "Invalid parameters"));
+            return true;
+        }
+        std::string strPassword = params.size() > 1 && params[1].isStr() ? params[1].get_str() : "";
+        StratumJobRef job = GetStratumJob();
+        boost::lock_guard<boost::mutex> lock(client->cs);
+        UniValue reply(UniValue::VOBJ);
+        reply.push_back(Pair("id", id));
+        if (!client->fSubscribed) {
+            reply.push_back(Pair("result", false));
+            reply.push_back(Pair("error", StratumError(STRATUM_ERR_NOT_SUBSCRIBED, "Not subscribed")));
+        } else if (!strStratumPassword.empty() && !TimingResistantEqual(strPassword, strStratumPassword)) {
+            reply.push_back(Pair("result", false));
+            reply.push_back(Pair("error", StratumError(STRATUM_ERR_UNAUTHORIZED, "Unauthorized worker")));
+        } else {
+            client->fAuthorized = true;
+            client->strWorker = params[0].get_str();
+            reply.push_back(Pair("result", true));
+            reply.push_back(Pair("error", NullUniValue));
+        }
+        StratumSendLocked(*client, reply.write() + "\n");
+        if (client->fAuthorized) {
+            StratumSendLocked(*client, StratumTargetNotification(*client));
+            if (job)
+                StratumSendLocked(*client, StratumNotification("mining.notify", StratumNotifyParams(job->strId, job->block, true)));
+        }
+    } else if (strMethod == "mining.submit") {
+        {
+            boost::lock_guard<boost::mutex> lock(client->cs);
+            if (!client->fAuthorized) {
+                UniValue reply(UniValue::VOBJ);
+                reply.push_back(Pair("id", id));
+                reply.push_back(Pair("result", false));
+                reply.push_back(Pair("error", StratumError(STRATUM_ERR_UNAUTHORIZED, "Unauthorized worker")));
+                StratumSendLocked(*client, reply.write() + "\n");
+                return true;
+            }
+        }
+        if (params.size() < 5 || !params[1].isStr() || !params[2].isStr() || !params[3].isStr() || !params[4].isStr()) {
+            StratumReply(client, id, false, StratumError(STRATUM_ERR_OTHER, "Invalid parameters"));
+            return true;
+        }
+        if (!StratumQueue(std::bind(&StratumCheckShare, client, id, params[1].get_str(), params[2].get_str(),
+                                    params[3].get_str(), params[4].get_str())))
+            StratumReply(client, id, false, StratumError(STRATUM_ERR_OTHER, "Server busy"));
+    } else if (strMethod == "mining.extranonce.subscribe") {
+        // NONCE_1 is fixed for the life of the connection
+        StratumReply(client, id, false, NullUniValue);
+    } else {
+        StratumReply(client, id, NullUniValue, StratumError(STRATUM_ERR_OTHER, "Method not found"));
+    }
+    return true;
+}
+
+static void StratumClose(struct bufferevent* bev)
+{
+    std::map<struct bufferevent*, StratumClientRef>::iterator it = mapStratumClients.find(bev);
+    if (it == mapStratumClients.end())
+        return;
+    {
+        boost::lock_guard<boost::mutex> lock(it->second->cs);
+        it->second->bev = NULL;
+    }
+    LogPrint("stratum", "stratum: connection from %s closed\n", it->second->addr.ToString());
+    mapStratumClients.erase(it);
+    bufferevent_free(bev);
+}
+
+static void StratumReadCallback(struct bufferevent* bev, void*)
+{
+    std::map<struct bufferevent*, StratumClientRef>::iterator it = mapStratumClients.find(bev);
+    if (it == mapStratumClients.end())
+        return;
+    StratumClientRef client = it->second;
+    struct evbuffer* input = bufferevent_get_input(bev);
+    size_t nLength;
+    char* line;
+    while ((line = evbuffer_readln(input, &nLength, EVBUFFER_EOL_CRLF)) != NULL) {
+        std::string strLine(line, nLength);
+        free(line);
+        if (strLine.empty())
+            continue;
+        if (!StratumProcessLine(client, strLine)) {
+            LogPrint("stratum", "stratum: malformed request from %s\n", client->addr.ToString());
+            StratumClose(bev);
+            return;
+        }
+    }
+    if (evbuffer_get_length(input) > MAX_STRATUM_LINE)
+        StratumClose(bev);
+}
+
+static void StratumEventCallback(struct bufferevent* bev, short what, void*)
+{
+    if (what & (BEV_EVENT_EOF | BEV_EVENT_ERROR | BEV_EVENT_TIMEOUT))
+        StratumClose(bev);
+}
+
+static void StratumAcceptCallback(struct evconnlistener*, evutil_socket_t fd, struct sockaddr* addr, int, void*)
+{
+    // Callbacks run without the lock of the bufferevent, for the workers
+    // to only ever take it inside the lock of a connection
+    struct bufferevent* bev = bufferevent_socket_new(stratumBase, fd,
+        BEV_OPT_CLOSE_ON_FREE | BEV_OPT_THREADSAFE | BEV_OPT_DEFER_CALLBACKS | BEV_OPT_UNLOCK_CALLBACKS);
+    if (!bev) {
+        evutil_closesocket(fd);
+        return;
+    }
+    StratumClientRef client = std::make_shared<CStratumClient>();
+    client->bev = bev;
+    client->addr.SetSockAddr(addr);
+    client->vNonce1.resize(STRATUM_NONCE1_SIZE);
+    WriteLE32(&client->vNonce1[0], nStratumNonce1++);
+    client->dDifficulty = dStratumDifficulty;
+    client->target = client->targetPrev = GetStratumTarget(client->dDifficulty, Params().GetConsensus());
+    client->nRetargetStart = GetTime();
+    mapStratumClients[bev] = client;
+    LogPrint("stratum", "stratum: connection from %s\n", client->addr.ToString());
+
+    struct timeval tv = {STRATUM_TIMEOUT, 0};
+    bufferevent_set_timeouts(bev, &tv, NULL);
+    bufferevent_setcb(bev, StratumReadCallback, NULL, StratumEventCallback, NULL);
+    bufferevent_enable(bev, EV_READ | EV_WRITE);
+}
+
+static void ThreadStratum()
+{
+    event_base_dispatch(stratumBase);
+}
+
+bool StartStratum()
+{
+    assert(!stratumBase);
+    stratumScriptPubKey = GetScriptForDestination(DecodeDestination(GetArg("-mineraddress", "")));
+    if (mapArgs.count("-stratumdifficulty") && !ParseDouble(mapArgs["-stratumdifficulty"], &dStratumDifficulty))
+        dStratumDifficulty = DEFAULT_STRATUM_DIFFICULTY;
+    strStratumPassword = GetArg("-stratumpassword", "");
+    // Each run starts elsewhere in the nonce space
+    nStratumNonce1 = GetRand(std::numeric_limits<uint32_t>::max());
+
+    CService addrBind;
+    if (!Lookup(GetArg("-stratumbind", DEFAULT_STRATUM_BIND).c_str(), addrBind, GetArg("-stratumport", GetDefaultStratumPort()), false)) {
+        LogPrintf("stratum: Invalid -stratumbind address\n");
+        return false;
+    }
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    if (!addrBind.GetSockAddr((struct sockaddr*)&sockaddr, &len)) {
+        LogPrintf("stratum: Unable to bind to %s\n", addrBind.ToString());
+        return false;
+    }
+
+#ifdef WIN32
+    evthread_use_windows_threads();
+#else
+    evthread_use_pthreads();
+#endif
+    stratumBase = event_base_new();
+    if (!stratumBase) {
+        LogPrintf("stratum: Unable to create event_base\n");
+        return false;
+    }
+    stratumListener = evconnlistener_new_bind(stratumBase, StratumAcceptCallback, NULL,
+        LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE, -1, (struct sockaddr*)&sockaddr, len);
+    if (!stratumListener) {
+        LogPrintf("stratum: Unable to bind to %s\n", addrBind.ToString());
+        event_base_free(stratumBase);
+        stratumBase = NULL;
+        return false;
+    }
+    stratumJobEvent = event_new(stratumBase, -1, 0, StratumJobCallback, NULL);
+    stratumTimerEvent = event_new(stratumBase, -1, EV_PERSIST, StratumTimerCallback, NULL);
+    struct timeval tv = {STRATUM_TIMER_INTERVAL, 0};
+    event_add(stratumTimerEvent, &tv);
+    uiInterface.NotifyBlockTip.connect(&StratumBlockTip);
+
+    int nThreads = GetArg("-stratumthreads", DEFAULT_STRATUM_THREADS);
+    if (nThreads <= 0)
+        nThreads = GetNumCores();
+    fStratumQueueStop = false;
+    for (int i = 0; i < nThreads; i++)
+        stratumWorkers.create_thread(boost::bind(&TraceThread<void (*)()>, "stratumcheck", &ThreadStratumWorker));
+
+    // The first job
+    event_active(stratumJobEvent, 0, 0);
+    stratumThread = boost::thread(boost::bind(&TraceThread<void (*)()>, "stratum", &ThreadStratum));
+    LogPrintf("stratum: Listening on %s with %d verification threads\n", addrBind.ToString(), nThreads);
+    return true;
+}
+
+void InterruptStratum()
+{
+    if (stratumBase) {
+        LogPrintf("stratum: Thread interrupt\n");
+        event_base_loopbreak(stratumBase);
+    }
+    {
+        boost::lock_guard<boost::mutex> lock(csStratumQueue);
+        fStratumQueueStop = true;
+    }
+    condStratumQueue.notify_all();
+}
+
+void StopStratum()
+{
+    if (!stratumBase)
+        return;
+    InterruptStratum();
+    uiInterface.NotifyBlockTip.disconnect(&StratumBlockTip);
+    stratumThread.join();
+    stratumWorkers.join_all();
+    {
+        boost::lock_guard<boost::mutex> lock(csStratumQueue);
+        queueStratum.clear();
+    }
+    while (!mapStratumClients.empty())
+        StratumClose(mapStratumClients.begin()->first);
+    event_free(stratumTimerEvent);
+    event_free(stratumJobEvent);
+    stratumTimerEvent = stratumJobEvent = NULL;
+    evconnlistener_free(stratumListener);
+    stratumListener = NULL;
+    event_base_free(stratumBase);
+    stratumBase = NULL;
+    {
+        LOCK(cs_stratumJobs);
+        mapStratumJobs.clear();
+        dequeStratumJobs.clear();
+        pStratumJob.reset();
+    }
+}
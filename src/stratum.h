@@ -0,0 +1,62 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_STRATUM_H
+#define BITCOIN_STRATUM_H
+
+#include "arith_uint256.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <univalue.h>
+
+class CBlockHeader;
+namespace Consensus { struct Params; }
+
+/** Default for -stratum, whether to serve pool miners over Stratum */
+static const bool DEFAULT_STRATUM = false;
+/** Default for -stratumbind */
+static const char DEFAULT_STRATUM_BIND[] = "127.0.0.1";
+/** Default for -stratumdifficulty, the share difficulty new connections start at */
+static const double DEFAULT_STRATUM_DIFFICULTY = 1.0;
+/** Default for -stratumthreads, the threads checking shares; 0 for one per core */
+static const int DEFAULT_STRATUM_THREADS = 0;
+/** Bytes of the 32-byte header nonce each connection is given, as NONCE_1 */
+static const unsigned int STRATUM_NONCE1_SIZE = 4;
+
+/**
+ * The Stratum server for pool mining, as ZIP 301 specifies it for
+ * Equihash: the header nonce is split in two, the first part fixed for
+ * each connection and the rest searched by the miner, so no two
+ * connections ever work on the same header. Jobs are built from the block
+ * template of the miner, for the coinbase to pay -mineraddress, and
+ * pushed again whenever the tip moves or the mempool has changed. Shares
+ * are checked against a target set per connection, which follows the rate
+ * its shares come in at, on a pool of threads, and the solutions that meet
+ * the block target are processed as blocks at once.
+ */
+bool StartStratum();
+/** Interrupt the Stratum server, for it to stop taking work */
+void InterruptStratum();
+/** Stop the Stratum server */
+void StopStratum();
+//! The default port of the Stratum server for the network in use
+int GetDefaultStratumPort();
+
+/** The share target of difficulty dDifficulty, the proof of work limit being difficulty 1 */
+arith_uint256 GetStratumTarget(double dDifficulty, const Consensus::Params& params);
+/** The parameters of mining.notify for the job strJobId working on header */
+UniValue StratumNotifyParams(const std::string& strJobId, const CBlockHeader& header, bool fClean);
+/**
+ * Fill header in from the header of a job and the fields of a
+ * mining.submit: the time, NONCE_2 and the solution, with its length in
+ * front, in hex. Returns false with strError set if any is malformed.
+ */
+bool StratumSubmitHeader(const CBlockHeader& jobHeader, const std::vector<unsigned char>& vNonce1,
+                         const std::string& strTime, const std::string& strNonce2, const std::string& strSolution,
+                         CBlockHeader& header, std::string& strError);
+
+#endif // BITCOIN_STRATUM_H
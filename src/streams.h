@@ -119,7 +119,9 @@ public:
         Init(nTypeIn, nVersionIn);
     }
 
-    CBaseDataStream(const std::vector<char>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
+    //! A template, so that it doesn't clash with the constructor above when vector_type is std::vector<char>
+    template <typename Allocator>
+    CBaseDataStream(const std::vector<char, Allocator>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
     {
         Init(nTypeIn, nVersionIn);
     }
@@ -176,6 +178,9 @@ public:
     const_reference operator[](size_type pos) const  { return vch[pos + nReadPos]; }
     reference operator[](size_type pos)              { return vch[pos + nReadPos]; }
     void clear()                                     { vch.clear(); nReadPos = 0; }
+    size_type capacity() const                       { return vch.capacity() - nReadPos; }
+    //! Exchange the whole underlying buffer with vchIn and read from its start
+    void swap(vector_type& vchIn)                    { vch.swap(vchIn); nReadPos = 0; }
     iterator insert(iterator it, const char& x=char()) { return vch.insert(it, x); }
     void insert(iterator it, size_type n, const char& x) { vch.insert(it, n, x); }
 
@@ -404,6 +409,84 @@ public:
 
 };
 
+/**
+ * Data stream for bytes that hold nothing secret, such as network messages
+ * and database records. Unlike CDataStream its buffer is freed without being
+ * wiped first, which for large buffers costs as much as filling them did.
+ */
+class CPlainDataStream : public CBaseDataStream<std::vector<char> >
+{
+public:
+    explicit CPlainDataStream(int nTypeIn, int nVersionIn) : CBaseDataStream(nTypeIn, nVersionIn) { }
+
+    CPlainDataStream(const char* pbegin, const char* pend, int nTypeIn, int nVersionIn) :
+            CBaseDataStream(pbegin, pend, nTypeIn, nVersionIn) { }
+};
+
+/**
+ * Read-only stream over bytes owned by someone else, such as a mapped block
+ * file or a received message. Unlike CDataStream it does not copy them into
+ * a buffer of its own, and bytes already read stay where they are, so a
+ * transaction deserialized from it is hashed from them (see
+ * StreamReadPosition). The bytes must outlive the reader.
+ */
+class CSpanReader
+{
+private:
+    const unsigned char* pbegin;
+    const unsigned char* pcur;
+    const unsigned char* pend;
+
+    int nType;
+    int nVersion;
+
+public:
+    CSpanReader(const unsigned char* pbeginIn, const unsigned char* pendIn, int nTypeIn, int nVersionIn) :
+        pbegin(pbeginIn), pcur(pbeginIn), pend(pendIn), nType(nTypeIn), nVersion(nVersionIn) { }
+
+    //! View the bytes of s that haven't been read yet
+    explicit CSpanReader(const CDataStream& s) :
+        pbegin(s.empty() ? nullptr : (const unsigned char*)&s[0]), pcur(pbegin), pend(pbegin + s.size()),
+        nType(s.GetType()), nVersion(s.GetVersion()) { }
+
+    int GetType() const          { return nType; }
+    int GetVersion() const       { return nVersion; }
+
+    size_t size() const          { return pend - pcur; }
+    bool empty() const           { return pcur == pend; }
+    //! Number of bytes read or ignored so far
+    size_t consumed() const      { return pcur - pbegin; }
+    const unsigned char* position() const { return pcur; }
+
+    void read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::read(): end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+    }
+
+    void ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::ignore(): end of data");
+        pcur += nSize;
+    }
+
+    template<typename T>
+    CSpanReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+};
+
+inline const unsigned char* StreamReadPosition(const CSpanReader& s)
+{
+    return s.position();
+}
+
 
 
 
@@ -7,11 +7,105 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
+#include <map>
 #include <stdio.h>
 
 #include <boost/foreach.hpp>
 #include <boost/thread.hpp>
 
+const int64_t CLockSite::WAIT_BUCKET_BOUNDS[CLockSite::WAIT_BUCKETS - 1] = {
+    10, 100, 1000, 10000, 100000, 1000000, 10000000
+};
+
+static boost::mutex& LockSitesMutex()
+{
+    static boost::mutex mutex;
+    return mutex;
+}
+
+// Sites are function-local statics registered on first use, so the list is
+// too, to exist before any of them
+static std::vector<CLockSite*>& LockSites()
+{
+    static std::vector<CLockSite*> sites;
+    return sites;
+}
+
+CLockSite::CLockSite(const char* pszNameIn, const char* pszFileIn, int nLineIn) :
+    pszName(pszNameIn), pszFile(pszFileIn), nLine(nLineIn),
+    nAcquired(0), nContended(0), nWaitMicros(0), nMaxWaitMicros(0), nHoldMicros(0)
+{
+    for (int i = 0; i < WAIT_BUCKETS; i++)
+        waitBuckets[i] = 0;
+    boost::unique_lock<boost::mutex> lock(LockSitesMutex());
+    LockSites().push_back(this);
+}
+
+void CLockSite::AddWait(int64_t nMicros)
+{
+    if (nMicros < 0)
+        nMicros = 0;
+    nContended.fetch_add(1, std::memory_order_relaxed);
+    nWaitMicros.fetch_add(nMicros, std::memory_order_relaxed);
+    uint64_t nMax = nMaxWaitMicros.load(std::memory_order_relaxed);
+    while ((uint64_t)nMicros > nMax && !nMaxWaitMicros.compare_exchange_weak(nMax, nMicros, std::memory_order_relaxed))
+        ;
+    int i = 0;
+    while (i < WAIT_BUCKETS - 1 && nMicros > WAIT_BUCKET_BOUNDS[i])
+        i++;
+    waitBuckets[i].fetch_add(1, std::memory_order_relaxed);
+}
+
+/** The last identifier of a lock expression, or of its first choice if it has two */
+static std::string LockName(std::string strExpr)
+{
+    size_t nChoice = strExpr.find('?');
+    if (nChoice != std::string::npos)
+        strExpr = strExpr.substr(nChoice + 1, strExpr.find(':', nChoice) - nChoice - 1);
+    size_t nStart = strExpr.find_last_of(".>&*:");
+    std::string strName = nStart == std::string::npos ? strExpr : strExpr.substr(nStart + 1);
+    size_t nEnd = strName.find_first_of(" )");
+    return nEnd == std::string::npos ? strName : strName.substr(0, nEnd);
+}
+
+std::vector<CLockSiteStats> GetLockSiteStats(bool fByLock)
+{
+    // Locks in static functions of headers have a site in each file that
+    // includes them; merge those
+    std::map<std::pair<std::string, int>, CLockSiteStats> mapStats;
+    boost::unique_lock<boost::mutex> lock(LockSitesMutex());
+    BOOST_FOREACH(const CLockSite* psite, LockSites()) {
+        std::pair<std::string, int> key = fByLock ? std::make_pair(LockName(psite->pszName), 0) :
+                                                    std::make_pair(std::string(psite->pszFile), psite->nLine);
+        std::map<std::pair<std::string, int>, CLockSiteStats>::iterator it = mapStats.find(key);
+        if (it == mapStats.end()) {
+            CLockSiteStats stats;
+            stats.strName = fByLock ? key.first : psite->pszName;
+            stats.strFile = fByLock ? "" : psite->pszFile;
+            stats.nLine = key.second;
+            stats.nAcquired = stats.nContended = stats.nWaitMicros = stats.nMaxWaitMicros = stats.nHoldMicros = 0;
+            for (int i = 0; i < CLockSite::WAIT_BUCKETS; i++)
+                stats.waitBuckets[i] = 0;
+            it = mapStats.insert(std::make_pair(key, stats)).first;
+        }
+        CLockSiteStats& stats = it->second;
+        stats.nAcquired += psite->nAcquired.load(std::memory_order_relaxed);
+        stats.nContended += psite->nContended.load(std::memory_order_relaxed);
+        stats.nWaitMicros += psite->nWaitMicros.load(std::memory_order_relaxed);
+        stats.nMaxWaitMicros = std::max(stats.nMaxWaitMicros, psite->nMaxWaitMicros.load(std::memory_order_relaxed));
+        stats.nHoldMicros += psite->nHoldMicros.load(std::memory_order_relaxed);
+        for (int i = 0; i < CLockSite::WAIT_BUCKETS; i++)
+            stats.waitBuckets[i] += psite->waitBuckets[i].load(std::memory_order_relaxed);
+    }
+
+    std::vector<CLockSiteStats> vStats;
+    vStats.reserve(mapStats.size());
+    for (std::map<std::pair<std::string, int>, CLockSiteStats>::const_iterator it = mapStats.begin(); it != mapStats.end(); ++it)
+        vStats.push_back(it->second);
+    return vStats;
+}
+
 #ifdef DEBUG_LOCKCONTENTION
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 {
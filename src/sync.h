@@ -8,6 +8,12 @@
 
 #include "threadsafety.h"
 
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
@@ -99,37 +105,108 @@ void static inline AssertLockHeldInternal(const char* pszName, const char* pszFi
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/**
+ * Contention statistics of one LOCK or TRY_LOCK call site, kept for the
+ * lifetime of the process. An uncontended acquisition costs a counter
+ * increment and two clock reads for the hold time; waits are only timed
+ * when the lock was already taken.
+ */
+class CLockSite
+{
+public:
+    static const int WAIT_BUCKETS = 8;
+    //! Upper bounds of the wait buckets in microseconds; the last bucket has none
+    static const int64_t WAIT_BUCKET_BOUNDS[WAIT_BUCKETS - 1];
+
+    const char* const pszName;
+    const char* const pszFile;
+    const int nLine;
+    std::atomic<uint64_t> nAcquired;
+    std::atomic<uint64_t> nContended;
+    std::atomic<uint64_t> nWaitMicros;
+    std::atomic<uint64_t> nMaxWaitMicros;
+    std::atomic<uint64_t> nHoldMicros;
+    std::atomic<uint64_t> waitBuckets[WAIT_BUCKETS];
+
+    CLockSite(const char* pszNameIn, const char* pszFileIn, int nLineIn);
+
+    //! Count an acquisition that had to wait nMicros
+    void AddWait(int64_t nMicros);
+};
+
+/** Totals of the call sites at one place in the source */
+struct CLockSiteStats
+{
+    std::string strName;
+    std::string strFile;
+    int nLine;
+    uint64_t nAcquired;
+    uint64_t nContended;
+    uint64_t nWaitMicros;
+    uint64_t nMaxWaitMicros;
+    uint64_t nHoldMicros;
+    uint64_t waitBuckets[CLockSite::WAIT_BUCKETS];
+};
+
+/**
+ * The statistics of every call site that has taken a lock, by file and line,
+ * or with fByLock summed by the name of the lock: its last identifier, so
+ * that pwalletMain->cs_wallet and cs_wallet count together. Those have an
+ * empty file.
+ */
+std::vector<CLockSiteStats> GetLockSiteStats(bool fByLock = false);
+
+/** Monotonic clock of the lock statistics, in microseconds */
+static inline int64_t LockStatsMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template <typename Mutex>
 class SCOPED_LOCKABLE CMutexLock
 {
 private:
     boost::unique_lock<Mutex> lock;
+    CLockSite* psite;
+    int64_t nLockedAt;
 
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
+        if (lock.try_lock()) {
+            if (psite)
+                nLockedAt = LockStatsMicros();
+        } else {
 #ifdef DEBUG_LOCKCONTENTION
-        if (!lock.try_lock()) {
             PrintLockContention(pszName, pszFile, nLine);
 #endif
+            int64_t nWaitStart = psite ? LockStatsMicros() : 0;
             lock.lock();
-#ifdef DEBUG_LOCKCONTENTION
+            if (psite) {
+                nLockedAt = LockStatsMicros();
+                psite->AddWait(nLockedAt - nWaitStart);
+            }
         }
-#endif
+        if (psite)
+            psite->nAcquired.fetch_add(1, std::memory_order_relaxed);
     }
 
     bool TryEnter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()), true);
         lock.try_lock();
-        if (!lock.owns_lock())
+        if (!lock.owns_lock()) {
             LeaveCritical();
+        } else if (psite) {
+            nLockedAt = LockStatsMicros();
+            psite->nAcquired.fetch_add(1, std::memory_order_relaxed);
+        }
         return lock.owns_lock();
     }
 
 public:
-    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : lock(mutexIn, boost::defer_lock)
+    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false, CLockSite* psiteIn = NULL) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : lock(mutexIn, boost::defer_lock), psite(psiteIn), nLockedAt(0)
     {
         if (fTry)
             TryEnter(pszName, pszFile, nLine);
@@ -137,7 +214,7 @@ public:
             Enter(pszName, pszFile, nLine);
     }
 
-    CMutexLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(pmutexIn)
+    CMutexLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false, CLockSite* psiteIn = NULL) EXCLUSIVE_LOCK_FUNCTION(pmutexIn) : psite(psiteIn), nLockedAt(0)
     {
         if (!pmutexIn) return;
 
@@ -150,8 +227,11 @@ public:
 
     ~CMutexLock() UNLOCK_FUNCTION()
     {
-        if (lock.owns_lock())
+        if (lock.owns_lock()) {
+            if (psite)
+                psite->nHoldMicros.fetch_add(LockStatsMicros() - nLockedAt, std::memory_order_relaxed);
             LeaveCritical();
+        }
     }
 
     operator bool()
@@ -162,9 +242,12 @@ public:
 
 typedef CMutexLock<CCriticalSection> CCriticalBlock;
 
-#define LOCK(cs) CCriticalBlock criticalblock(cs, #cs, __FILE__, __LINE__)
-#define LOCK2(cs1, cs2) CCriticalBlock criticalblock1(cs1, #cs1, __FILE__, __LINE__), criticalblock2(cs2, #cs2, __FILE__, __LINE__)
-#define TRY_LOCK(cs, name) CCriticalBlock name(cs, #cs, __FILE__, __LINE__, true)
+/** The statistics of the call site it appears at, created the first time it runs */
+#define LOCK_SITE(cs) ([]() -> CLockSite* { static CLockSite site(#cs, __FILE__, __LINE__); return &site; }())
+
+#define LOCK(cs) CCriticalBlock criticalblock(cs, #cs, __FILE__, __LINE__, false, LOCK_SITE(cs))
+#define LOCK2(cs1, cs2) CCriticalBlock criticalblock1(cs1, #cs1, __FILE__, __LINE__, false, LOCK_SITE(cs1)), criticalblock2(cs2, #cs2, __FILE__, __LINE__, false, LOCK_SITE(cs2))
+#define TRY_LOCK(cs, name) CCriticalBlock name(cs, #cs, __FILE__, __LINE__, true, LOCK_SITE(cs))
 
 #define ENTER_CRITICAL_SECTION(cs)                            \
     {                                                         \
@@ -26,4 +26,15 @@ BOOST_AUTO_TEST_CASE(sanity)
     BOOST_CHECK(Checkpoints::GetTotalBlocksEstimate(checkpoints) >= 134444);
 }
 */
+
+BOOST_AUTO_TEST_CASE(header_commitment)
+{
+    // The committed header chain must not contradict the checkpoints
+    const CChainParams& params = Params(CBaseChainParams::MAIN);
+    const Consensus::Params& consensus = params.GetConsensus();
+    const MapCheckpoints& checkpoints = params.Checkpoints().mapCheckpoints;
+    MapCheckpoints::const_iterator it = checkpoints.find(consensus.nHeaderCommitmentHeight);
+    BOOST_CHECK(it != checkpoints.end() && it->second == consensus.hashHeaderCommitment);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -28,15 +28,28 @@
 #include <boost/test/data/test_case.hpp>
 
 // Tests this internal-to-main.cpp method:
-extern bool AddOrphanTx(const CTransaction& tx, NodeId peer);
+extern bool AddOrphanTx(const CTransactionRef& ptx, NodeId peer);
 extern void EraseOrphansFor(NodeId peer);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
+extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxBytes);
 struct COrphanTx {
-    CTransaction tx;
+    CTransactionRef tx;
     NodeId fromPeer;
+    int64_t nTimeExpire;
+    unsigned int nSize;
+    size_t nPeerPos;
 };
-extern std::map<uint256, COrphanTx> mapOrphanTransactions;
-extern std::map<uint256, std::set<uint256> > mapOrphanTransactionsByPrev;
+typedef boost::unordered_map<uint256, COrphanTx, CCoinsKeyHasher> OrphanMap;
+struct IteratorComparator
+{
+    template<typename I>
+    bool operator()(const I& a, const I& b) const
+    {
+        return &(*a) < &(*b);
+    }
+};
+extern OrphanMap mapOrphanTransactions;
+extern boost::unordered_map<COutPoint, std::set<OrphanMap::iterator, IteratorComparator>, SaltedOutpointHasher> mapOrphanTransactionsByPrev;
+extern size_t nOrphanBytes;
 
 CService ip(uint32_t i)
 {
@@ -112,17 +125,26 @@ BOOST_AUTO_TEST_CASE(DoS_bantime)
 
 CTransaction RandomOrphan()
 {
-    std::map<uint256, COrphanTx>::iterator it;
-    it = mapOrphanTransactions.lower_bound(GetRandHash());
-    if (it == mapOrphanTransactions.end())
-        it = mapOrphanTransactions.begin();
-    return it->second.tx;
+    OrphanMap::iterator it = mapOrphanTransactions.begin();
+    std::advance(it, GetRand(mapOrphanTransactions.size()));
+    return *it->second.tx;
+}
+
+size_t OrphanBytesFor(NodeId peer)
+{
+    size_t nBytes = 0;
+    for (OrphanMap::iterator it = mapOrphanTransactions.begin(); it != mapOrphanTransactions.end(); ++it) {
+        if (it->second.fromPeer == peer)
+            nBytes += it->second.nSize;
+    }
+    return nBytes;
 }
 
 // Parameterized testing over consensus branch ids
 BOOST_DATA_TEST_CASE(DoS_mapOrphans, boost::unit_test::data::xrange(static_cast<int>(Consensus::MAX_NETWORK_UPGRADES)))
 {
     uint32_t consensusBranchId = NetworkUpgradeInfo[sample].nBranchId;
+    LOCK(cs_orphans);
 
     CKey key;
     key.MakeNewKey(true);
@@ -141,7 +163,7 @@ BOOST_DATA_TEST_CASE(DoS_mapOrphans, boost::unit_test::data::xrange(static_cast<
         tx.vout[0].nValue = 1*CENT;
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
 
-        AddOrphanTx(tx, i);
+        AddOrphanTx(MakeTransactionRef(tx), i);
     }
 
     // ... and 50 that depend on other orphans:
@@ -158,7 +180,7 @@ BOOST_DATA_TEST_CASE(DoS_mapOrphans, boost::unit_test::data::xrange(static_cast<
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
         SignSignature(keystore, txPrev, tx, 0, SIGHASH_ALL, consensusBranchId);
 
-        AddOrphanTx(tx, i);
+        AddOrphanTx(MakeTransactionRef(tx), i);
     }
 
     // This really-big orphan should be ignored:
@@ -182,7 +204,7 @@ BOOST_DATA_TEST_CASE(DoS_mapOrphans, boost::unit_test::data::xrange(static_cast<
         for (unsigned int j = 1; j < tx.vin.size(); j++)
             tx.vin[j].scriptSig = tx.vin[0].scriptSig;
 
-        BOOST_CHECK(!AddOrphanTx(tx, i));
+        BOOST_CHECK(!AddOrphanTx(MakeTransactionRef(tx), i));
     }
 
     // Test EraseOrphansFor:
@@ -194,13 +216,58 @@ BOOST_DATA_TEST_CASE(DoS_mapOrphans, boost::unit_test::data::xrange(static_cast<
     }
 
     // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
+    LimitOrphanTxSize(40, std::numeric_limits<size_t>::max());
     BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
+    LimitOrphanTxSize(10, std::numeric_limits<size_t>::max());
     BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
+    LimitOrphanTxSize(0, std::numeric_limits<size_t>::max());
     BOOST_CHECK(mapOrphanTransactions.empty());
     BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    BOOST_CHECK_EQUAL(nOrphanBytes, 0);
+}
+
+BOOST_AUTO_TEST_CASE(DoS_mapOrphansLimits)
+{
+    SetMockTime(GetTime());
+    LOCK(cs_orphans);
+
+    // Peer 0 floods, peer 1 sends a few
+    size_t nTotal = 0;
+    for (int i = 0; i < 30; i++)
+    {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.n = 0;
+        tx.vin[0].prevout.hash = GetRandHash();
+        tx.vin[0].scriptSig << OP_1;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 1*CENT;
+        tx.vout[0].scriptPubKey = CScript() << OP_1;
+
+        BOOST_CHECK(AddOrphanTx(MakeTransactionRef(tx), i < 25 ? 0 : 1));
+        nTotal += ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    }
+    BOOST_CHECK_EQUAL(nOrphanBytes, nTotal);
+    size_t nPeer1Bytes = OrphanBytesFor(1);
+
+    // Over the byte budget, the peer holding the most goes first
+    LimitOrphanTxSize(100, nTotal / 2);
+    BOOST_CHECK(nOrphanBytes <= nTotal / 2);
+    BOOST_CHECK_EQUAL(OrphanBytesFor(1), nPeer1Bytes);
+    BOOST_CHECK_EQUAL(nOrphanBytes, OrphanBytesFor(0) + OrphanBytesFor(1));
+
+    EraseOrphansFor(0);
+    BOOST_CHECK_EQUAL(mapOrphanTransactions.size(), 5);
+    BOOST_CHECK_EQUAL(nOrphanBytes, nPeer1Bytes);
+
+    // Orphans expire
+    SetMockTime(GetTime() + ORPHAN_TX_EXPIRE_TIME + ORPHAN_TX_EXPIRE_INTERVAL + 1);
+    LimitOrphanTxSize(100, std::numeric_limits<size_t>::max());
+    BOOST_CHECK(mapOrphanTransactions.empty());
+    BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    BOOST_CHECK_EQUAL(nOrphanBytes, 0);
+
+    SetMockTime(0);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,79 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+#include "key.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "version.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(addressindex_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(address_index_key_types)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    uint160 hashBytes;
+
+    BOOST_CHECK_EQUAL(GetAddressIndexKey(GetScriptForDestination(pubkey.GetID()), hashBytes), ADDRESS_INDEX_PUBKEYHASH);
+    BOOST_CHECK(hashBytes == pubkey.GetID());
+
+    // Pay-to-pubkey outputs are filed under the ID of their key
+    hashBytes.SetNull();
+    BOOST_CHECK_EQUAL(GetAddressIndexKey(CScript() << ToByteVector(pubkey) << OP_CHECKSIG, hashBytes), ADDRESS_INDEX_PUBKEYHASH);
+    BOOST_CHECK(hashBytes == pubkey.GetID());
+
+    CScript redeemScript = GetScriptForMultisig(1, std::vector<CPubKey>(1, pubkey));
+    BOOST_CHECK_EQUAL(GetAddressIndexKey(GetScriptForDestination(CScriptID(redeemScript)), hashBytes), ADDRESS_INDEX_SCRIPTHASH);
+    BOOST_CHECK(hashBytes == CScriptID(redeemScript));
+
+    BOOST_CHECK_EQUAL(GetAddressIndexKey(redeemScript, hashBytes), ADDRESS_INDEX_NONE);
+    BOOST_CHECK_EQUAL(GetAddressIndexKey(CScript() << OP_RETURN << std::vector<unsigned char>(20, 1), hashBytes), ADDRESS_INDEX_NONE);
+}
+
+BOOST_AUTO_TEST_CASE(address_index_key_order)
+{
+    // Keys of one address must sort by height and then position in the
+    // block, so that a range of heights is a range of keys
+    uint160 hashBytes;
+    hashBytes.SetHex("0102030405060708090a0b0c0d0e0f1011121314");
+    uint256 txhash;
+    txhash.SetHex("ff");
+    CAddressIndexKey a(ADDRESS_INDEX_PUBKEYHASH, hashBytes, 255, 7, txhash, 0, false);
+    CAddressIndexKey b(ADDRESS_INDEX_PUBKEYHASH, hashBytes, 256, 1, uint256(), 0, false);
+    CAddressIndexKey c(ADDRESS_INDEX_PUBKEYHASH, hashBytes, 256, 2, uint256(), 0, false);
+
+    CDataStream ssA(SER_DISK, CLIENT_VERSION), ssB(SER_DISK, CLIENT_VERSION), ssC(SER_DISK, CLIENT_VERSION);
+    ssA << a;
+    ssB << b;
+    ssC << c;
+    BOOST_CHECK(ssA.str() < ssB.str());
+    BOOST_CHECK(ssB.str() < ssC.str());
+
+    // The iterator key for a height is a prefix of the keys at that height
+    CDataStream ssStart(SER_DISK, CLIENT_VERSION);
+    ssStart << CAddressIndexIteratorKey(ADDRESS_INDEX_PUBKEYHASH, hashBytes, 256);
+    BOOST_CHECK(ssA.str() < ssStart.str());
+    BOOST_CHECK_EQUAL(ssB.str().substr(0, ssStart.size()), ssStart.str());
+
+    CAddressIndexKey d;
+    ssC >> d;
+    BOOST_CHECK_EQUAL(d.type, ADDRESS_INDEX_PUBKEYHASH);
+    BOOST_CHECK(d.hashBytes == hashBytes);
+    BOOST_CHECK_EQUAL(d.blockHeight, 256);
+    BOOST_CHECK_EQUAL(d.txindex, 2U);
+    BOOST_CHECK(!d.spending);
+
+    CDataStream ssTime1(SER_DISK, CLIENT_VERSION), ssTime2(SER_DISK, CLIENT_VERSION);
+    ssTime1 << CTimestampIndexKey(0x01ff, txhash);
+    ssTime2 << CTimestampIndexKey(0x0200, uint256());
+    BOOST_CHECK(ssTime1.str() < ssTime2.str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
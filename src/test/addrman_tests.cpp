@@ -6,8 +6,10 @@
 #include <string>
 #include <boost/test/unit_test.hpp>
 
+#include "clientversion.h"
 #include "hash.h"
 #include "random.h"
+#include "streams.h"
 
 using namespace std;
 
@@ -518,4 +520,36 @@ BOOST_AUTO_TEST_CASE(caddrinfo_get_new_bucket)
     //  than 64 buckets.
     BOOST_CHECK(buckets.size() > 64);
 }
+
+BOOST_AUTO_TEST_CASE(addrman_modifications)
+{
+    CAddrManTest addrman;
+
+    // Test 35: Every change moves the modification count on, so dumps of an
+    //  unchanged addrman can be skipped.
+    CNetAddr source = CNetAddr("252.2.2.2");
+    CService addr1 = CService("250.1.1.1", 8333);
+    uint64_t nModifications = addrman.GetModificationCount();
+    BOOST_CHECK(addrman.GetModificationCount() == nModifications);
+
+    addrman.Add(CAddress(addr1), source);
+    BOOST_CHECK(addrman.GetModificationCount() != nModifications);
+    nModifications = addrman.GetModificationCount();
+
+    addrman.Good(addr1);
+    BOOST_CHECK(addrman.GetModificationCount() != nModifications);
+    nModifications = addrman.GetModificationCount();
+
+    addrman.Select();
+    BOOST_CHECK(addrman.GetModificationCount() == nModifications);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << addrman;
+    BOOST_CHECK(addrman.GetModificationCount() == nModifications);
+
+    CAddrManTest addrman2;
+    ss >> addrman2;
+    BOOST_CHECK(addrman2.size() == 1);
+    BOOST_CHECK(addrman2.Find(addr1) != NULL);
+}
 BOOST_AUTO_TEST_SUITE_END()
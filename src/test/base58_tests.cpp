@@ -10,6 +10,7 @@
 
 #include "key.h"
 #include "key_io.h"
+#include "random.h"
 #include "script/script.h"
 #include "test/test_bitcoin.h"
 #include "uint256.h"
@@ -75,6 +76,28 @@ BOOST_AUTO_TEST_CASE(base58_DecodeBase58)
     BOOST_CHECK_EQUAL_COLLECTIONS(result.begin(), result.end(), expected.begin(), expected.end());
 }
 
+// Goal: check that the conversion limbs carry correctly across every length
+BOOST_AUTO_TEST_CASE(base58_roundtrip)
+{
+    seed_insecure_rand(true);
+    std::vector<unsigned char> result;
+    for (size_t len = 0; len < 100; len++) {
+        for (int round = 0; round < 20; round++) {
+            std::vector<unsigned char> data(len);
+            for (size_t i = 0; i < len; i++) {
+                // Runs of leading zeroes, and of 0x00 and 0xff bytes inside
+                if (i < (size_t)(round % 4))
+                    data[i] = 0;
+                else
+                    data[i] = (round % 3 == 0) ? 0xff : (insecure_rand() % 4 == 0 ? 0 : insecure_rand() & 0xff);
+            }
+            std::string base58string = EncodeBase58(data);
+            BOOST_CHECK(DecodeBase58(base58string, result));
+            BOOST_CHECK_EQUAL_COLLECTIONS(result.begin(), result.end(), data.begin(), data.end());
+        }
+    }
+}
+
 // Goal: check that parsed keys match test payload
 BOOST_AUTO_TEST_CASE(base58_keys_valid_parse)
 {
@@ -0,0 +1,106 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "blockarchive.h"
+
+#include "blockfilemap.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace boost::filesystem;
+
+static std::vector<char> ReadWholeFile(const path& p)
+{
+    std::ifstream file(p.string().c_str(), std::ios::binary);
+    return std::vector<char>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+BOOST_FIXTURE_TEST_SUITE(blockarchive_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(blockarchive_not_an_archive)
+{
+    path dir = temp_directory_path() / unique_path();
+    create_directories(dir);
+    path raw = dir / "blk00000.dat";
+    std::ofstream(CBlockArchive::GetArchivePath(raw).string().c_str()) << "not compressed at all";
+
+    CBlockFileMap filemap;
+    CBlockArchive archive(filemap);
+    BOOST_CHECK(CBlockArchive::GetArchivePath(raw) == dir / "blk00000.zst");
+    BOOST_CHECK(!archive.Load(0, raw));
+    BOOST_CHECK(!archive.IsCompressed(0));
+    remove_all(dir);
+}
+
+#ifdef USE_ZSTD
+BOOST_AUTO_TEST_CASE(blockarchive_roundtrip)
+{
+    path dir = temp_directory_path() / unique_path();
+    create_directories(dir);
+    path raw = dir / "blk00003.dat";
+
+    // Three and a bit frames of compressible data, then preallocated zeroes
+    // that are left out of the archive
+    size_t nRawSize = BLOCK_ARCHIVE_FRAME_SIZE * 3 + 1000;
+    std::vector<char> vData(nRawSize);
+    for (size_t i = 0; i < vData.size(); i++)
+        vData[i] = (i % 7 == 0) ? (char)insecure_rand() : (char)(i / 4096);
+    {
+        std::ofstream file(raw.string().c_str(), std::ios::binary);
+        file.write(vData.data(), vData.size());
+        std::vector<char> vZeroes(4096, 0);
+        file.write(vZeroes.data(), vZeroes.size());
+    }
+
+    BOOST_REQUIRE(CBlockArchive::Compress(raw, nRawSize, 3));
+    BOOST_CHECK(file_size(CBlockArchive::GetArchivePath(raw)) < nRawSize);
+
+    for (int nMappings = 0; nMappings <= 1; nMappings++) {
+        CBlockFileMap filemap;
+        filemap.SetLimit(nMappings);
+        CBlockArchive archive(filemap);
+        BOOST_REQUIRE(archive.Load(3, raw));
+        BOOST_CHECK(archive.IsCompressed(3));
+        BOOST_CHECK(!archive.IsCompressed(2));
+
+        // Within a frame, across frames, the end, and past the end
+        const size_t vRanges[][2] = {{0, 80}, {BLOCK_ARCHIVE_FRAME_SIZE - 10, 20},
+                                     {100, BLOCK_ARCHIVE_FRAME_SIZE * 2}, {nRawSize - 500, 500}};
+        for (const auto& range : vRanges) {
+            CBlockFileRegion region;
+            BOOST_REQUIRE(archive.Read(3, range[0], range[1], region));
+            BOOST_CHECK_EQUAL(region.size(), range[1]);
+            BOOST_CHECK(std::equal(region.begin(), region.end(), vData.begin() + range[0]));
+        }
+        CBlockFileRegion region;
+        BOOST_CHECK(!archive.Read(3, nRawSize - 10, 20, region));
+        BOOST_CHECK(!archive.Read(2, 0, 10, region));
+    }
+
+    // Expanding writes back what was compressed
+    remove(raw);
+    CBlockFileMap filemap;
+    CBlockArchive archive(filemap);
+    BOOST_REQUIRE(archive.Load(3, raw));
+    BOOST_REQUIRE(archive.Expand(3, raw));
+    BOOST_CHECK(!archive.IsCompressed(3));
+    BOOST_CHECK(!exists(CBlockArchive::GetArchivePath(raw)));
+    BOOST_CHECK(ReadWholeFile(raw) == vData);
+
+    remove_all(dir);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,139 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "version.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockencodings_tests, BasicTestingSetup)
+
+static CBlock BuildBlockTestCase()
+{
+    CBlock block;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig.resize(10);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 42;
+
+    block.vtx.resize(4);
+    block.vtx[0] = MakeTransactionRef(tx);
+    block.nVersion = 4;
+    block.hashPrevBlock = GetRandHash();
+    block.nBits = 0x207fffff;
+
+    for (int i = 1; i < 4; i++) {
+        tx.vin[0].prevout.hash = GetRandHash();
+        tx.vin[0].prevout.n = i;
+        block.vtx[i] = MakeTransactionRef(tx);
+    }
+
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(SimpleRoundTripTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    CBlock block(BuildBlockTestCase());
+
+    CMutableTransaction tx1(*block.vtx[1]);
+    CMutableTransaction tx3(*block.vtx[3]);
+    pool.addUnchecked(block.vtx[1]->GetHash(), entry.FromTx(tx1));
+    pool.addUnchecked(block.vtx[3]->GetHash(), entry.FromTx(tx3));
+
+    CBlockHeaderAndShortTxIDs shortIDs(block);
+    BOOST_CHECK_EQUAL(shortIDs.BlockTxCount(), 4);
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << shortIDs;
+
+    CBlockHeaderAndShortTxIDs shortIDs2;
+    stream >> shortIDs2;
+    BOOST_CHECK_EQUAL(shortIDs2.header.GetHash().ToString(), block.GetHash().ToString());
+    BOOST_CHECK_EQUAL(shortIDs2.GetShortID(block.vtx[2]->GetHash()), shortIDs.GetShortID(block.vtx[2]->GetHash()));
+
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs2) == READ_STATUS_OK);
+    BOOST_CHECK(partialBlock.IsTxAvailable(0));
+    BOOST_CHECK(partialBlock.IsTxAvailable(1));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(2));
+    BOOST_CHECK(partialBlock.IsTxAvailable(3));
+
+    CBlock block2;
+    std::vector<CTransactionRef> vtx_missing;
+    // Nothing given for the missing transaction
+    BOOST_CHECK(partialBlock.FillBlock(block2, vtx_missing) == READ_STATUS_INVALID);
+
+    // The wrong transaction gives a block that doesn't match the header
+    vtx_missing.push_back(block.vtx[1]);
+    BOOST_CHECK(partialBlock.FillBlock(block2, vtx_missing) == READ_STATUS_FAILED);
+
+    vtx_missing[0] = block.vtx[2];
+    BOOST_CHECK(partialBlock.FillBlock(block2, vtx_missing) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block2.GetHash().ToString(), block.GetHash().ToString());
+    BOOST_CHECK_EQUAL(block2.BuildMerkleTree().ToString(), block.hashMerkleRoot.ToString());
+}
+
+BOOST_AUTO_TEST_CASE(EmptyMempoolTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    CBlock block(BuildBlockTestCase());
+
+    CBlockHeaderAndShortTxIDs shortIDs(block);
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs) == READ_STATUS_OK);
+    BOOST_CHECK(partialBlock.IsTxAvailable(0));
+    for (size_t i = 1; i < block.vtx.size(); i++)
+        BOOST_CHECK(!partialBlock.IsTxAvailable(i));
+
+    std::vector<CTransactionRef> vtx_missing(block.vtx.begin() + 1, block.vtx.end());
+    CBlock block2;
+    BOOST_CHECK(partialBlock.FillBlock(block2, vtx_missing) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block2.GetHash().ToString(), block.GetHash().ToString());
+}
+
+BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest)
+{
+    BlockTransactionsRequest req1;
+    req1.blockhash = GetRandHash();
+    req1.indexes.resize(4);
+    req1.indexes[0] = 0;
+    req1.indexes[1] = 1;
+    req1.indexes[2] = 3;
+    req1.indexes[3] = 4;
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << req1;
+
+    BlockTransactionsRequest req2;
+    stream >> req2;
+
+    BOOST_CHECK_EQUAL(req1.blockhash.ToString(), req2.blockhash.ToString());
+    BOOST_CHECK_EQUAL(req1.indexes.size(), req2.indexes.size());
+    for (size_t i = 0; i < req1.indexes.size(); i++)
+        BOOST_CHECK_EQUAL(req1.indexes[i], req2.indexes[i]);
+}
+
+BOOST_AUTO_TEST_CASE(TransactionsRequestOverflowTest)
+{
+    // Differential indexes that add up past 16 bits are rejected
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << GetRandHash();
+    WriteCompactSize(stream, 2);
+    WriteCompactSize(stream, 0xffff);
+    WriteCompactSize(stream, 0);
+
+    BlockTransactionsRequest req;
+    BOOST_CHECK_THROW(stream >> req, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,123 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+#include "key.h"
+#include "random.h"
+#include "script/standard.h"
+#include "shieldedindex.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+
+#include <algorithm>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+static GCSFilter::Element RandomElement()
+{
+    uint256 rand = GetRandHash();
+    return GCSFilter::Element(rand.begin(), rand.end());
+}
+
+static std::vector<uint64_t> HashElements(uint64_t k0, uint64_t k1, const std::vector<GCSFilter::Element>& elements)
+{
+    std::vector<uint64_t> hashes;
+    for (const GCSFilter::Element& element : elements) {
+        hashes.push_back(GCSFilter::HashElement(k0, k1, element));
+    }
+    std::sort(hashes.begin(), hashes.end());
+    return hashes;
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_test)
+{
+    GCSFilter::ElementSet included;
+    std::vector<GCSFilter::Element> excluded;
+    for (int i = 0; i < 100; ++i) {
+        included.insert(RandomElement());
+        excluded.push_back(RandomElement());
+    }
+
+    GCSFilter filter(0, 0, included);
+    BOOST_CHECK_EQUAL(filter.GetN(), included.size());
+
+    for (const GCSFilter::Element& element : included) {
+        BOOST_CHECK(filter.MatchAnyHashed(HashElements(0, 0, {element})));
+
+        // A single member is enough among many non-members
+        std::vector<GCSFilter::Element> query = excluded;
+        query.push_back(element);
+        BOOST_CHECK(filter.MatchAnyHashed(HashElements(0, 0, query)));
+    }
+    BOOST_CHECK(!filter.MatchAnyHashed(HashElements(0, 0, excluded)));
+
+    // Round trip through serialization
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << filter;
+    GCSFilter filter2;
+    ss >> filter2;
+    BOOST_CHECK_EQUAL(filter2.GetN(), filter.GetN());
+    BOOST_CHECK(filter2.GetEncoded() == filter.GetEncoded());
+
+    GCSFilter empty(0, 0, GCSFilter::ElementSet());
+    BOOST_CHECK(!empty.MatchAnyHashed(HashElements(0, 0, excluded)));
+}
+
+BOOST_AUTO_TEST_CASE(compact_shielded_block_transparent_filter)
+{
+    CKey key, otherKey;
+    key.MakeNewKey(true);
+    otherKey.MakeNewKey(true);
+    CKeyID keyID = key.GetPubKey().GetID();
+    CScript redeemScript = GetScriptForMultisig(1, {otherKey.GetPubKey()});
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vout.resize(1);
+    coinbase.vout[0].scriptPubKey = GetScriptForDestination(CScriptID(redeemScript));
+
+    uint256 prevTxid = GetRandHash();
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(prevTxid, 0);
+    spend.vout.resize(1);
+    spend.vout[0].scriptPubKey = GetScriptForDestination(keyID);
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    block.vtx.push_back(MakeTransactionRef(spend));
+
+    CCompactShieldedBlock compact(block);
+    BOOST_CHECK(compact.vtx.empty());
+
+    auto match = [&compact](const GCSFilter::Element& element) {
+        return compact.transparentFilter.MatchAnyHashed(HashElements(
+            CCompactShieldedBlock::FILTER_K0, CCompactShieldedBlock::FILTER_K1, {element}));
+    };
+
+    // Outputs are found by key ID and by script
+    BOOST_CHECK(match(TransparentFilterKeyElement(keyID)));
+    GCSFilter::ElementSet p2sh;
+    GetTransparentFilterElements(coinbase.vout[0].scriptPubKey, p2sh);
+    for (const GCSFilter::Element& element : p2sh) {
+        BOOST_CHECK(match(element));
+    }
+    // Spends are found by the txid of the spent output, but not for the coinbase
+    BOOST_CHECK(match(TransparentFilterSpendElement(prevTxid)));
+    BOOST_CHECK(!match(TransparentFilterSpendElement(uint256())));
+
+    BOOST_CHECK(!match(TransparentFilterKeyElement(otherKey.GetPubKey().GetID())));
+    BOOST_CHECK(!match(TransparentFilterSpendElement(GetRandHash())));
+
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << compact;
+    CCompactShieldedBlock compact2;
+    ss >> compact2;
+    BOOST_CHECK(compact2.transparentFilter.GetEncoded() == compact.transparentFilter.GetEncoded());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
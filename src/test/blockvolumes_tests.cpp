@@ -0,0 +1,66 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockvolumes.h"
+
+#include "test/test_bitcoin.h"
+
+#include <fstream>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace boost::filesystem;
+
+static void TouchFile(const path& p)
+{
+    create_directories(p.parent_path());
+    std::ofstream file(p.string().c_str());
+}
+
+BOOST_FIXTURE_TEST_SUITE(blockvolumes_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(blockvolumes_placement)
+{
+    path base = temp_directory_path() / unique_path();
+    std::vector<path> vVolumes;
+    vVolumes.push_back(base / "a");
+    vVolumes.push_back(base / "b");
+    create_directories(vVolumes[0]);
+    create_directories(vVolumes[1]);
+
+    CBlockVolumes volumes;
+    volumes.SetVolumes(vVolumes);
+
+    // Files nobody placed resolve to the first volume
+    BOOST_CHECK(volumes.GetFilePath(5, "blk") == vVolumes[0] / "blk00005.dat");
+
+    // New files take turns, and undo files follow their block files
+    volumes.PlaceNewFile(0);
+    volumes.PlaceNewFile(1);
+    BOOST_CHECK(volumes.GetFilePath(0, "blk") == vVolumes[0] / "blk00000.dat");
+    BOOST_CHECK(volumes.GetFilePath(1, "blk") == vVolumes[1] / "blk00001.dat");
+    BOOST_CHECK(volumes.GetFilePath(1, "rev") == vVolumes[1] / "rev00001.dat");
+    BOOST_CHECK(volumes.GetAvailableSpace(1) > 0);
+    TouchFile(volumes.GetFilePath(0, "blk"));
+    TouchFile(volumes.GetFilePath(1, "blk"));
+
+    // Existing files are found where they are, whatever the order of the volumes
+    std::vector<path> vReordered(vVolumes.rbegin(), vVolumes.rend());
+    volumes.SetVolumes(vReordered);
+    BOOST_CHECK(volumes.GetFilePath(0, "blk") == vVolumes[0] / "blk00000.dat");
+    BOOST_CHECK(volumes.GetFilePath(1, "rev") == vVolumes[1] / "rev00001.dat");
+    volumes.PlaceNewFile(1);
+    BOOST_CHECK(volumes.GetFilePath(1, "blk") == vVolumes[1] / "blk00001.dat");
+
+    // Once deleted and forgotten, a file may be placed again
+    remove(vVolumes[1] / "blk00001.dat");
+    volumes.Forget(1);
+    BOOST_CHECK(volumes.GetFilePath(1, "blk") == vReordered[0] / "blk00001.dat");
+
+    remove_all(base);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
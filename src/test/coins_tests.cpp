@@ -10,12 +10,15 @@
 #include "test/test_bitcoin.h"
 #include "consensus/validation.h"
 #include "main.h"
+#include "txdb.h"
 #include "undo.h"
 #include "primitives/transaction.h"
 #include "pubkey.h"
 
+#include <limits>
 #include <vector>
 #include <map>
+#include <utility>
 
 #include <boost/test/unit_test.hpp>
 #include "zcash/IncrementalMerkleTree.hpp"
@@ -27,7 +30,7 @@ class CCoinsViewTest : public CCoinsView
     uint256 hashBestBlock_;
     uint256 hashBestSproutAnchor_;
     uint256 hashBestSaplingAnchor_;
-    std::map<uint256, CCoins> map_;
+    std::map<COutPoint, Coin> map_;
     std::map<uint256, SproutMerkleTree> mapSproutAnchors_;
     std::map<uint256, SaplingMerkleTree> mapSaplingAnchors_;
     std::map<uint256, bool> mapSproutNullifiers_;
@@ -107,29 +110,29 @@ public:
         }
     }
 
-    bool GetCoins(const uint256& txid, CCoins& coins) const
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
     {
-        std::map<uint256, CCoins>::const_iterator it = map_.find(txid);
+        std::map<COutPoint, Coin>::const_iterator it = map_.find(outpoint);
         if (it == map_.end()) {
             return false;
         }
-        coins = it->second;
-        if (coins.IsPruned() && insecure_rand() % 2 == 0) {
+        coin = it->second;
+        if (coin.IsSpent() && insecure_rand() % 2 == 0) {
             // Randomly return false in case of an empty entry.
             return false;
         }
         return true;
     }
 
-    bool HaveCoins(const uint256& txid) const
+    bool HaveCoin(const COutPoint& outpoint) const
     {
-        CCoins coins;
-        return GetCoins(txid, coins);
+        Coin coin;
+        return GetCoin(outpoint, coin);
     }
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
 
-    void BatchWriteNullifiers(CNullifiersMap& mapNullifiers, std::map<uint256, bool>& cacheNullifiers)
+    void BatchWriteNullifiers(CNullifiersMap& mapNullifiers, std::map<uint256, bool>& cacheNullifiers, bool fErase)
     {
         for (CNullifiersMap::iterator it = mapNullifiers.begin(); it != mapNullifiers.end(); ) {
             if (it->second.entered) {
@@ -137,13 +140,16 @@ public:
             } else {
                 cacheNullifiers.erase(it->first);
             }
-            mapNullifiers.erase(it++);
+            if (fErase) {
+                mapNullifiers.erase(it++);
+            } else {
+                it++;
+            }
         }
-        mapNullifiers.clear();
     }
 
     template<typename Tree, typename Map>
-    void BatchWriteAnchors(Map& mapAnchors, std::map<uint256, Tree>& cacheAnchors)
+    void BatchWriteAnchors(Map& mapAnchors, std::map<uint256, Tree>& cacheAnchors, bool fErase)
     {
         for (auto it = mapAnchors.begin(); it != mapAnchors.end(); ) {
             if (it->second.entered) {
@@ -152,7 +158,11 @@ public:
             } else {
                 cacheAnchors.erase(it->first);
             }
-            mapAnchors.erase(it++);
+            if (fErase) {
+                mapAnchors.erase(it++);
+            } else {
+                it++;
+            }
         }
     }
 
@@ -163,26 +173,31 @@ public:
                     CAnchorsSproutMap& mapSproutAnchors,
                     CAnchorsSaplingMap& mapSaplingAnchors,
                     CNullifiersMap& mapSproutNullifiers,
-                    CNullifiersMap& mapSaplingNullifiers)
+                    CNullifiersMap& mapSaplingNullifiers,
+                    bool fErase)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
-            map_[it->first] = it->second.coins;
-            if (it->second.coins.IsPruned() && insecure_rand() % 3 == 0) {
-                // Randomly delete empty entries on write.
-                map_.erase(it->first);
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                // Same optimization used in CCoinsViewDB is to only write dirty entries.
+                map_[it->first] = it->second.coin();
+                if (it->second.coin().IsSpent() && insecure_rand() % 3 == 0) {
+                    // Randomly delete empty entries on write.
+                    map_.erase(it->first);
+                }
+            }
+            if (fErase) {
+                mapCoins.erase(it++);
+            } else {
+                it++;
             }
-            mapCoins.erase(it++);
         }
 
-        BatchWriteAnchors<SproutMerkleTree, CAnchorsSproutMap>(mapSproutAnchors, mapSproutAnchors_);
-        BatchWriteAnchors<SaplingMerkleTree, CAnchorsSaplingMap>(mapSaplingAnchors, mapSaplingAnchors_);
+        BatchWriteAnchors<SproutMerkleTree, CAnchorsSproutMap>(mapSproutAnchors, mapSproutAnchors_, fErase);
+        BatchWriteAnchors<SaplingMerkleTree, CAnchorsSaplingMap>(mapSaplingAnchors, mapSaplingAnchors_, fErase);
 
-        BatchWriteNullifiers(mapSproutNullifiers, mapSproutNullifiers_);
-        BatchWriteNullifiers(mapSaplingNullifiers, mapSaplingNullifiers_);
+        BatchWriteNullifiers(mapSproutNullifiers, mapSproutNullifiers_, fErase);
+        BatchWriteNullifiers(mapSaplingNullifiers, mapSaplingNullifiers_, fErase);
 
-        mapCoins.clear();
-        mapSproutAnchors.clear();
-        mapSaplingAnchors.clear();
         hashBestBlock_ = hashBlock;
         hashBestSproutAnchor_ = hashSproutAnchor;
         hashBestSaplingAnchor_ = hashSaplingAnchor;
@@ -200,19 +215,41 @@ public:
     void SelfTest() const
     {
         // Manually recompute the dynamic usage of the whole data, and compare it.
-        size_t ret = memusage::DynamicUsage(cacheCoins) +
-                     memusage::DynamicUsage(cacheSproutAnchors) +
-                     memusage::DynamicUsage(cacheSaplingAnchors) +
-                     memusage::DynamicUsage(cacheSproutNullifiers) +
-                     memusage::DynamicUsage(cacheSaplingNullifiers);
+        size_t count = 0;
+        size_t coinsUsage = memusage::DynamicUsage(cacheCoins);
         for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
-            ret += it->second.coins.DynamicMemoryUsage();
+            coinsUsage += it->second.coin().DynamicMemoryUsage();
+            ++count;
         }
+        size_t anchorsUsage = memusage::DynamicUsage(cacheSproutAnchors) + memusage::DynamicUsage(cacheSaplingAnchors);
+        for (CAnchorsSproutMap::const_iterator it = cacheSproutAnchors.begin(); it != cacheSproutAnchors.end(); it++) {
+            anchorsUsage += it->second.tree.DynamicMemoryUsage();
+        }
+        for (CAnchorsSaplingMap::const_iterator it = cacheSaplingAnchors.begin(); it != cacheSaplingAnchors.end(); it++) {
+            anchorsUsage += it->second.tree.DynamicMemoryUsage();
+        }
+        size_t ret = coinsUsage + anchorsUsage +
+                     memusage::DynamicUsage(cacheSproutNullifiers) +
+                     memusage::DynamicUsage(cacheSaplingNullifiers);
+        BOOST_CHECK_EQUAL(GetCacheSize(), count);
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
+        BOOST_CHECK_EQUAL(DynamicMemoryUsageCoins(), coinsUsage);
+        BOOST_CHECK_EQUAL(DynamicMemoryUsageAnchors(), anchorsUsage);
     }
 
+    bool NullifierInCache(const uint256 &nf) const { return cacheSaplingNullifiers.count(nf) > 0; }
+    bool AnchorInCache(const uint256 &rt) const { return cacheSaplingAnchors.count(rt) > 0; }
+
 };
 
+bool operator==(const Coin &a, const Coin &b) {
+    // Empty Coin objects are always equal.
+    if (a.IsSpent() && b.IsSpent()) return true;
+    return a.fCoinBase == b.fCoinBase &&
+           a.nHeight == b.nHeight &&
+           a.out == b.out;
+}
+
 class TxWithNullifiers
 {
 public:
@@ -532,6 +569,55 @@ BOOST_AUTO_TEST_CASE(anchor_regression_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(coins_memory_snapshot_test)
+{
+    CCoinsViewDB db(1 << 20, true);
+    COutPoint outpointOld(GetRandHash(), 0);
+    CTxOut txout;
+    txout.nValue = 500;
+    txout.scriptPubKey = CScript() << OP_1;
+    {
+        CCoinsViewCache writer(&db);
+        writer.AddCoin(outpointOld, Coin(txout, 100, false), false);
+        writer.SetBestBlock(GetRandHash());
+        BOOST_CHECK(writer.Flush());
+    }
+
+    CCoinsViewMemory memory(db);
+    BOOST_CHECK(memory.Load());
+    BOOST_CHECK(memory.HaveCoin(outpointOld));
+    BOOST_CHECK(memory.GetBestBlock() == db.GetBestBlock());
+
+    // Changes are seen in memory, and only reach the database with a snapshot
+    COutPoint outpointNew(GetRandHash(), 1);
+    TxWithNullifiers txWithNullifiers;
+    uint256 hashBlock = GetRandHash();
+    {
+        CCoinsViewCache cache(&memory);
+        cache.SpendCoin(outpointOld);
+        cache.AddCoin(outpointNew, Coin(txout, 101, false), false);
+        cache.SetNullifiers(txWithNullifiers.tx, true);
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!memory.HaveCoin(outpointOld));
+    BOOST_CHECK(memory.HaveCoin(outpointNew));
+    BOOST_CHECK(memory.GetNullifier(txWithNullifiers.sproutNullifier, SPROUT));
+    BOOST_CHECK(memory.GetBestBlock() == hashBlock);
+    BOOST_CHECK(db.HaveCoin(outpointOld));
+    BOOST_CHECK(!db.HaveCoin(outpointNew));
+
+    BOOST_CHECK(memory.WriteSnapshot());
+    BOOST_CHECK(!memory.SnapshotFailed());
+    BOOST_CHECK(!db.HaveCoin(outpointOld));
+    BOOST_CHECK(db.HaveCoin(outpointNew));
+    BOOST_CHECK(db.GetNullifier(txWithNullifiers.saplingNullifier, SAPLING));
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+
+    // Nothing new to write
+    BOOST_CHECK(memory.WriteSnapshot());
+}
+
 BOOST_AUTO_TEST_CASE(nullifiers_test)
 {
     CCoinsViewTest base;
@@ -555,6 +641,68 @@ BOOST_AUTO_TEST_CASE(nullifiers_test)
     checkNullifierCache(cache3, txWithNullifiers, false);
 }
 
+BOOST_AUTO_TEST_CASE(shielded_cache_trim_test)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    // Fill the nullifier cache with unmodified entries.
+    std::vector<uint256> vLookedUp;
+    for (int i = 0; i < 1000; i++) {
+        vLookedUp.push_back(GetRandHash());
+        BOOST_CHECK(!cache.GetNullifier(vLookedUp.back(), SAPLING));
+    }
+    TxWithNullifiers txWithNullifiers;
+    cache.SetNullifiers(txWithNullifiers.tx, true);
+    // Make the first lookup the most recently used one.
+    BOOST_CHECK(!cache.GetNullifier(vLookedUp[0], SAPLING));
+
+    size_t nLimit = cache.DynamicMemoryUsageNullifiers() / 2;
+    cache.TrimShieldedCaches(std::numeric_limits<size_t>::max(), nLimit);
+    BOOST_CHECK(cache.DynamicMemoryUsageNullifiers() <= nLimit);
+    BOOST_CHECK(cache.NullifierInCache(vLookedUp[0]));
+    BOOST_CHECK(!cache.NullifierInCache(vLookedUp[1]));
+    // Modified entries are never evicted.
+    cache.TrimShieldedCaches(std::numeric_limits<size_t>::max(), 0);
+    BOOST_CHECK(cache.NullifierInCache(txWithNullifiers.saplingNullifier));
+    checkNullifierCache(cache, txWithNullifiers, true);
+
+    // An anchor can only be evicted once it has been written back, and is
+    // then fetched again on demand.
+    SaplingMerkleTree tree;
+    tree.append(GetRandHash());
+    cache.PushAnchor(tree);
+    cache.TrimShieldedCaches(0, std::numeric_limits<size_t>::max());
+    BOOST_CHECK(cache.AnchorInCache(tree.root()));
+    BOOST_CHECK(cache.Sync());
+    cache.TrimShieldedCaches(0, std::numeric_limits<size_t>::max());
+    BOOST_CHECK(!cache.AnchorInCache(tree.root()));
+    BOOST_CHECK(cache.HaveAnchor(tree.root(), SAPLING));
+    BOOST_CHECK(cache.AnchorInCache(tree.root()));
+    cache.SelfTest();
+
+    // What a child cache writes back is the most recently used.
+    SaplingMerkleTree treeChild {tree};
+    treeChild.append(GetRandHash());
+    TxWithNullifiers txChild;
+    {
+        CCoinsViewCacheTest child(&cache);
+        child.PushAnchor(treeChild);
+        child.SetNullifiers(txChild.tx, true);
+        BOOST_CHECK(child.Flush());
+    }
+    BOOST_CHECK(cache.Sync());
+    cache.TrimShieldedCaches(cache.DynamicMemoryUsageAnchors() - 1, cache.DynamicMemoryUsageNullifiers() - 1);
+    BOOST_CHECK(cache.AnchorInCache(treeChild.root()));
+    BOOST_CHECK(cache.NullifierInCache(txChild.saplingNullifier));
+    cache.SelfTest();
+
+    // Dropping the coins keeps the shielded caches.
+    cache.ClearCoins();
+    BOOST_CHECK(cache.AnchorInCache(treeChild.root()));
+    BOOST_CHECK(cache.NullifierInCache(txWithNullifiers.saplingNullifier));
+}
+
 template<typename Tree> void anchorsFlushImpl(ShieldedType type)
 {
     CCoinsViewTest base;
@@ -758,7 +906,7 @@ static const unsigned int NUM_SIMULATION_ITERATIONS = 40000;
 // This is a large randomized insert/remove simulation test on a variable-size
 // stack of caches on top of CCoinsViewTest.
 //
-// It will randomly create/update/delete CCoins entries to a tip of caches, with
+// It will randomly create/update/delete Coin entries to a tip of caches, with
 // txids picked from a limited list of random 256-bit hashes. Occasionally, a
 // new tip is added to the stack of caches, or the tip is flushed and removed.
 //
@@ -769,14 +917,17 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     // Various coverage trackers.
     bool removed_all_caches = false;
     bool reached_4_caches = false;
+    bool synced_a_cache = false;
     bool added_an_entry = false;
+    bool added_an_unspendable_entry = false;
     bool removed_an_entry = false;
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool uncached_an_entry = false;
 
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
@@ -794,36 +945,53 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
         // Do a random modification.
         {
             uint256 txid = txids[insecure_rand() % txids.size()]; // txid we're going to modify in this iteration.
-            CCoins& coins = result[txid];
-            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
-            BOOST_CHECK(coins == *entry);
-            if (insecure_rand() % 5 == 0 || coins.IsPruned()) {
-                if (coins.IsPruned()) {
-                    added_an_entry = true;
+            Coin& coin = result[COutPoint(txid, 0)];
+            const Coin& entry = (insecure_rand() % 500 == 0) ? AccessByTxid(*stack.back(), txid) : stack.back()->AccessCoin(COutPoint(txid, 0));
+            BOOST_CHECK(coin == entry);
+
+            if (insecure_rand() % 5 == 0 || coin.IsSpent()) {
+                Coin newcoin;
+                newcoin.out.nValue = insecure_rand();
+                newcoin.nHeight = 1;
+                bool possible_overwrite = !coin.IsSpent() || insecure_rand() & 1;
+                if (insecure_rand() % 16 == 0 && coin.IsSpent()) {
+                    newcoin.out.scriptPubKey.assign(1 + (insecure_rand() & 0x3F), OP_RETURN);
+                    BOOST_CHECK(newcoin.out.scriptPubKey.IsUnspendable());
+                    added_an_unspendable_entry = true;
                 } else {
-                    updated_an_entry = true;
+                    // Random sizes so we can test memory usage accounting
+                    newcoin.out.scriptPubKey.assign(insecure_rand() & 0x3F, 0);
+                    (coin.IsSpent() ? added_an_entry : updated_an_entry) = true;
+                    coin = newcoin;
                 }
-                coins.nVersion = insecure_rand();
-                coins.vout.resize(1);
-                coins.vout[0].nValue = insecure_rand();
-                *entry = coins;
+                stack.back()->AddCoin(COutPoint(txid, 0), std::move(newcoin), possible_overwrite);
             } else {
-                coins.Clear();
-                entry->Clear();
                 removed_an_entry = true;
+                coin.Clear();
+                stack.back()->SpendCoin(COutPoint(txid, 0));
             }
         }
 
+        // One every 10 iterations, remove a random entry from the cache
+        if (insecure_rand() % 10 == 0) {
+            COutPoint out(txids[insecure_rand() % txids.size()], 0);
+            int cacheid = insecure_rand() % stack.size();
+            stack[cacheid]->Uncache(out);
+            uncached_an_entry |= !stack[cacheid]->HaveCoinInCache(out);
+        }
+
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                    found_an_entry = true;
-                } else {
-                    BOOST_CHECK(it->second.IsPruned());
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
+                if (coin.IsSpent()) {
                     missed_an_entry = true;
+                } else {
+                    BOOST_CHECK(stack.back()->HaveCoinInCache(it->first));
+                    found_an_entry = true;
                 }
             }
             BOOST_FOREACH(const CCoinsViewCacheTest *test, stack) {
@@ -831,6 +999,15 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
             }
         }
 
+        if (insecure_rand() % 100 == 0) {
+            // Every 100 iterations, write back an intermediate cache while keeping its contents.
+            if (stack.size() > 1 && insecure_rand() % 2 == 0) {
+                unsigned int syncIndex = insecure_rand() % (stack.size() - 1);
+                BOOST_CHECK(stack[syncIndex]->Sync());
+                synced_a_cache = true;
+            }
+        }
+
         if (insecure_rand() % 100 == 0) {
             // Every 100 iterations, change the cache stack.
             if (stack.size() > 0 && insecure_rand() % 2 == 0) {
@@ -862,11 +1039,14 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     // Verify coverage.
     BOOST_CHECK(removed_all_caches);
     BOOST_CHECK(reached_4_caches);
+    BOOST_CHECK(synced_a_cache);
     BOOST_CHECK(added_an_entry);
+    BOOST_CHECK(added_an_unspendable_entry);
     BOOST_CHECK(removed_an_entry);
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(uncached_an_entry);
 }
 
 BOOST_AUTO_TEST_CASE(coins_coinbase_spends)
@@ -913,56 +1093,70 @@ BOOST_AUTO_TEST_CASE(coins_coinbase_spends)
     }
 }
 
+BOOST_AUTO_TEST_CASE(coins_warm_test)
+{
+    CCoinsViewTest base;
+    COutPoint outpoint(GetRandHash(), 0);
+    {
+        CCoinsViewCacheTest writer(&base);
+        CTxOut txout;
+        txout.nValue = 500;
+        txout.scriptPubKey = CScript() << OP_1;
+        writer.AddCoin(outpoint, Coin(txout, 100, false), false);
+        writer.Flush();
+    }
+
+    CCoinsViewCacheTest cache(&base);
+    BOOST_CHECK(!cache.HaveCoinInCache(outpoint));
+    Coin coin;
+    BOOST_CHECK(cache.GetBackend()->GetCoin(outpoint, coin));
+    cache.WarmCoin(outpoint, Coin(coin));
+    BOOST_CHECK(cache.HaveCoinInCache(outpoint));
+    BOOST_CHECK(cache.AccessCoin(outpoint) == coin);
+    cache.SelfTest();
+
+    // A coin already in the cache, e.g. spent since it was read, is kept.
+    cache.SpendCoin(outpoint);
+    BOOST_CHECK(!cache.HaveCoinInCache(outpoint));
+    BOOST_CHECK(cache.IsCoinCached(outpoint));
+    cache.WarmCoin(outpoint, Coin(coin));
+    BOOST_CHECK(cache.AccessCoin(outpoint).IsSpent());
+    cache.SelfTest();
+}
+
 BOOST_AUTO_TEST_CASE(ccoins_serialization)
 {
     // Good example
-    CDataStream ss1(ParseHex("0104835800816115944e077fe7c803cfa57f29b36bf87c1d358bb85e"), SER_DISK, CLIENT_VERSION);
-    CCoins cc1;
+    CDataStream ss1(ParseHex("97f23c835800816115944e077fe7c803cfa57f29b36bf87c1d35"), SER_DISK, CLIENT_VERSION);
+    Coin cc1;
     ss1 >> cc1;
-    BOOST_CHECK_EQUAL(cc1.nVersion, 1);
     BOOST_CHECK_EQUAL(cc1.fCoinBase, false);
     BOOST_CHECK_EQUAL(cc1.nHeight, 203998);
-    BOOST_CHECK_EQUAL(cc1.vout.size(), 2);
-    BOOST_CHECK_EQUAL(cc1.IsAvailable(0), false);
-    BOOST_CHECK_EQUAL(cc1.IsAvailable(1), true);
-    BOOST_CHECK_EQUAL(cc1.vout[1].nValue, 60000000000ULL);
-    BOOST_CHECK_EQUAL(HexStr(cc1.vout[1].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
+    BOOST_CHECK_EQUAL(cc1.out.nValue, 60000000000ULL);
+    BOOST_CHECK_EQUAL(HexStr(cc1.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
 
     // Good example
-    CDataStream ss2(ParseHex("0109044086ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4eebbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa486af3b"), SER_DISK, CLIENT_VERSION);
-    CCoins cc2;
+    CDataStream ss2(ParseHex("8ddf77bbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa4"), SER_DISK, CLIENT_VERSION);
+    Coin cc2;
     ss2 >> cc2;
-    BOOST_CHECK_EQUAL(cc2.nVersion, 1);
     BOOST_CHECK_EQUAL(cc2.fCoinBase, true);
     BOOST_CHECK_EQUAL(cc2.nHeight, 120891);
-    BOOST_CHECK_EQUAL(cc2.vout.size(), 17);
-    for (int i = 0; i < 17; i++) {
-        BOOST_CHECK_EQUAL(cc2.IsAvailable(i), i == 4 || i == 16);
-    }
-    BOOST_CHECK_EQUAL(cc2.vout[4].nValue, 234925952);
-    BOOST_CHECK_EQUAL(HexStr(cc2.vout[4].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("61b01caab50f1b8e9c50a5057eb43c2d9563a4ee"))))));
-    BOOST_CHECK_EQUAL(cc2.vout[16].nValue, 110397);
-    BOOST_CHECK_EQUAL(HexStr(cc2.vout[16].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))))));
+    BOOST_CHECK_EQUAL(cc2.out.nValue, 110397);
+    BOOST_CHECK_EQUAL(HexStr(cc2.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))))));
 
     // Smallest possible example
-    CDataStream ssx(SER_DISK, CLIENT_VERSION);
-    BOOST_CHECK_EQUAL(HexStr(ssx.begin(), ssx.end()), "");
-
-    CDataStream ss3(ParseHex("0002000600"), SER_DISK, CLIENT_VERSION);
-    CCoins cc3;
+    CDataStream ss3(ParseHex("000006"), SER_DISK, CLIENT_VERSION);
+    Coin cc3;
     ss3 >> cc3;
-    BOOST_CHECK_EQUAL(cc3.nVersion, 0);
     BOOST_CHECK_EQUAL(cc3.fCoinBase, false);
     BOOST_CHECK_EQUAL(cc3.nHeight, 0);
-    BOOST_CHECK_EQUAL(cc3.vout.size(), 1);
-    BOOST_CHECK_EQUAL(cc3.IsAvailable(0), true);
-    BOOST_CHECK_EQUAL(cc3.vout[0].nValue, 0);
-    BOOST_CHECK_EQUAL(cc3.vout[0].scriptPubKey.size(), 0);
+    BOOST_CHECK_EQUAL(cc3.out.nValue, 0);
+    BOOST_CHECK_EQUAL(cc3.out.scriptPubKey.size(), 0);
 
     // scriptPubKey that ends beyond the end of the stream
-    CDataStream ss4(ParseHex("0002000800"), SER_DISK, CLIENT_VERSION);
+    CDataStream ss4(ParseHex("000007"), SER_DISK, CLIENT_VERSION);
     try {
-        CCoins cc4;
+        Coin cc4;
         ss4 >> cc4;
         BOOST_CHECK_MESSAGE(false, "We should have thrown");
     } catch (const std::ios_base::failure& e) {
@@ -973,13 +1167,51 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     uint64_t x = 3000000000ULL;
     tmp << VARINT(x);
     BOOST_CHECK_EQUAL(HexStr(tmp.begin(), tmp.end()), "8a95c0bb00");
-    CDataStream ss5(ParseHex("0002008a95c0bb0000"), SER_DISK, CLIENT_VERSION);
+    CDataStream ss5(ParseHex("00008a95c0bb00"), SER_DISK, CLIENT_VERSION);
     try {
-        CCoins cc5;
+        Coin cc5;
         ss5 >> cc5;
         BOOST_CHECK_MESSAGE(false, "We should have thrown");
     } catch (const std::ios_base::failure& e) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(txundo_serialization)
+{
+    // Undo records written before the per-output model carry a transaction
+    // version after the height for the last spend of a transaction, and no
+    // metadata at all for earlier spends.
+    CDataStream ss(ParseHex("0203000006000006"), SER_DISK, CLIENT_VERSION);
+    CTxUndo undo;
+    ss >> undo;
+    BOOST_CHECK_EQUAL(undo.vprevout.size(), 2);
+    BOOST_CHECK_EQUAL(undo.vprevout[0].nHeight, 1);
+    BOOST_CHECK_EQUAL(undo.vprevout[0].fCoinBase, true);
+    BOOST_CHECK_EQUAL(undo.vprevout[1].nHeight, 0);
+    BOOST_CHECK_EQUAL(undo.vprevout[1].fCoinBase, false);
+
+    // Records are written back in the same layout, with a zero version.
+    CDataStream ss2(SER_DISK, CLIENT_VERSION);
+    ss2 << undo;
+    BOOST_CHECK_EQUAL(HexStr(ss2.begin(), ss2.end()), "0203000006000006");
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_entry_layout)
+{
+    // The flags share the Coin's padding
+    BOOST_CHECK_EQUAL(sizeof(CCoinsCacheEntry), sizeof(Coin));
+
+    // Assigning the coin leaves the flags alone
+    CCoinsCacheEntry entry;
+    entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+    CCoinsCacheEntry other;
+    other.coin() = Coin(CTxOut(5, CScript() << OP_TRUE), 100, true);
+    entry.coin() = std::move(other.coin());
+    BOOST_CHECK_EQUAL(entry.flags, CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH);
+    BOOST_CHECK_EQUAL(entry.coin().nHeight, 100);
+    BOOST_CHECK(entry.coin().IsCoinBase());
+    BOOST_CHECK_EQUAL(entry.coin().out.nValue, 5);
+    BOOST_CHECK_EQUAL(other.flags, 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,113 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "corebudget.h"
+
+#include "test/test_bitcoin.h"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+static boost::mutex csOrder;
+static std::vector<CoreClass> vOrder;
+
+static void TakeCore(CoreClass coreClass)
+{
+    CCoreReservation core(coreClass);
+    boost::unique_lock<boost::mutex> lock(csOrder);
+    vOrder.push_back(coreClass);
+}
+
+static void WaitForWaiting(CoreClass coreClass, int nWaiting)
+{
+    while (GetCoreClassStats(coreClass).nWaiting < nWaiting)
+        MilliSleep(1);
+}
+
+BOOST_FIXTURE_TEST_SUITE(corebudget_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(corebudget_nesting)
+{
+    SetCoreBudget(1);
+    uint64_t nBefore = GetCoreClassStats(CORE_CLASS_RPC).nReservations;
+    {
+        CCoreReservation outer(CORE_CLASS_RPC);
+        // An inner reservation on the same thread must not wait for the outer one
+        CCoreReservation inner(CORE_CLASS_WALLET);
+        BOOST_CHECK_EQUAL(GetCoreClassStats(CORE_CLASS_RPC).nRunning, 1);
+        BOOST_CHECK_EQUAL(GetCoreClassStats(CORE_CLASS_WALLET).nRunning, 0);
+        {
+            CCoreRelease release;
+            BOOST_CHECK_EQUAL(GetCoreClassStats(CORE_CLASS_RPC).nRunning, 0);
+        }
+        BOOST_CHECK_EQUAL(GetCoreClassStats(CORE_CLASS_RPC).nRunning, 1);
+    }
+    BOOST_CHECK_EQUAL(GetCoreClassStats(CORE_CLASS_RPC).nRunning, 0);
+    BOOST_CHECK_EQUAL(GetCoreClassStats(CORE_CLASS_RPC).nReservations, nBefore + 2);
+    SetCoreBudget(0);
+}
+
+BOOST_AUTO_TEST_CASE(corebudget_priority)
+{
+    SetCoreBudget(1);
+    vOrder.clear();
+    boost::thread_group threads;
+    {
+        CCoreReservation core(CORE_CLASS_RPC);
+        // Validation doesn't wait, even with the budget used up
+        TakeCore(CORE_CLASS_VALIDATION);
+
+        threads.create_thread(boost::bind(TakeCore, CORE_CLASS_MINING));
+        WaitForWaiting(CORE_CLASS_MINING, 1);
+        threads.create_thread(boost::bind(TakeCore, CORE_CLASS_WALLET));
+        WaitForWaiting(CORE_CLASS_WALLET, 1);
+        threads.create_thread(boost::bind(TakeCore, CORE_CLASS_RELAY));
+        WaitForWaiting(CORE_CLASS_RELAY, 1);
+    }
+    threads.join_all();
+
+    BOOST_REQUIRE_EQUAL(vOrder.size(), 4U);
+    BOOST_CHECK_EQUAL(vOrder[0], CORE_CLASS_VALIDATION);
+    BOOST_CHECK_EQUAL(vOrder[1], CORE_CLASS_RELAY);
+    BOOST_CHECK_EQUAL(vOrder[2], CORE_CLASS_WALLET);
+    BOOST_CHECK_EQUAL(vOrder[3], CORE_CLASS_MINING);
+    SetCoreBudget(0);
+}
+
+static std::atomic<int> nSlotsTaken(0);
+
+static void TakeWorkerSlot()
+{
+    CWorkerSlot slot;
+    nSlotsTaken++;
+}
+
+BOOST_AUTO_TEST_CASE(corebudget_worker_slots)
+{
+    SetWorkerBudget(1);
+    nSlotsTaken = 0;
+    boost::thread_group threads;
+    {
+        CWorkerSlot slot;
+        // Another queue's worker waits for the slot in use
+        threads.create_thread(TakeWorkerSlot);
+        MilliSleep(50);
+        BOOST_CHECK_EQUAL(nSlotsTaken.load(), 0);
+    }
+    threads.join_all();
+    BOOST_CHECK_EQUAL(nSlotsTaken.load(), 1);
+
+    // Without a limit nothing waits
+    SetWorkerBudget(0);
+    {
+        CWorkerSlot slot;
+        TakeWorkerSlot();
+    }
+    BOOST_CHECK_EQUAL(nSlotsTaken.load(), 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
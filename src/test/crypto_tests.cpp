@@ -2,13 +2,18 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "crypto/blake2b.h"
+#include "crypto/common.h"
+#include "crypto/muhash.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "hash.h"
 #include "random.h"
+#include "streams.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 
@@ -248,4 +253,129 @@ BOOST_AUTO_TEST_CASE(hmac_sha512_testvectors) {
                    "b6022cac3c4982b10d5eeb55c3e4de15134676fb6de0446065c97440fa8c6a58");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    for (int i = 0; i <= 32; ++i) {
+        unsigned char in[64 * 32];
+        unsigned char out1[32 * 32], out2[32 * 32];
+        for (int j = 0; j < 64 * i; ++j) {
+            in[j] = insecure_rand();
+        }
+        for (int j = 0; j < i; ++j) {
+            CHash256().Write(in + 64 * j, 64).Finalize(out1 + 32 * j);
+        }
+        SHA256D64(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(blake2b_midstate) {
+    const size_t outlens[] = {1, 32, 50, 64};
+    unsigned char personalization[crypto_generichash_blake2b_PERSONALBYTES] = {};
+    memcpy(personalization, "ZcashPoW", 8);
+    for (size_t outlen : outlens) {
+        // Cover prefixes that leave the suffix in the first block, straddling
+        // a block boundary, and after libsodium has buffered two blocks.
+        for (size_t prefixlen = 0; prefixlen <= 300; prefixlen += 7) {
+            std::vector<unsigned char> prefix(prefixlen);
+            for (size_t i = 0; i < prefixlen; i++) {
+                prefix[i] = insecure_rand();
+            }
+            crypto_generichash_blake2b_state state;
+            crypto_generichash_blake2b_init_salt_personal(&state, NULL, 0, outlen, NULL, personalization);
+            crypto_generichash_blake2b_update(&state, prefix.data(), prefixlen);
+
+            CBLAKE2bMidstate midstate(state, outlen);
+            BOOST_CHECK(midstate.IsValid());
+            if (!midstate.IsValid()) continue;
+
+            uint32_t suffixes[11];
+            for (size_t i = 0; i < 11; i++) {
+                suffixes[i] = insecure_rand();
+            }
+            std::vector<unsigned char> batch(11 * outlen);
+            midstate.FinalizeLE32(suffixes, 11, batch.data());
+            for (size_t i = 0; i < 11; i++) {
+                crypto_generichash_blake2b_state copy = state;
+                unsigned char le[4];
+                WriteLE32(le, suffixes[i]);
+                std::vector<unsigned char> expected(outlen);
+                crypto_generichash_blake2b_update(&copy, le, sizeof(le));
+                crypto_generichash_blake2b_final(&copy, expected.data(), outlen);
+                BOOST_CHECK(std::equal(expected.begin(), expected.end(), batch.begin() + i * outlen));
+            }
+        }
+    }
+}
+
+static uint256 FinalizeMuHash(MuHash3072 hash)
+{
+    uint256 out;
+    hash.Finalize(out.begin());
+    return out;
+}
+
+static MuHash3072 MuHashOf(const std::vector<unsigned char>& element)
+{
+    MuHash3072 hash;
+    hash.Insert(element.data(), element.size());
+    return hash;
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    // The empty set is the SHA256 of the number one
+    BOOST_CHECK_EQUAL(FinalizeMuHash(MuHash3072()).GetHex(),
+                      "dd5ad2a105c2d29495f577245c357409002329b9f4d6182c0af3dc2f462555c8");
+
+    std::vector<unsigned char> a = ParseHex("00"), b = ParseHex("0102"), c = ParseHex("030405");
+
+    // Insertion order does not matter
+    MuHash3072 abc, cba;
+    abc.Insert(a.data(), a.size()).Insert(b.data(), b.size()).Insert(c.data(), c.size());
+    cba.Insert(c.data(), c.size()).Insert(b.data(), b.size()).Insert(a.data(), a.size());
+    BOOST_CHECK(FinalizeMuHash(abc) == FinalizeMuHash(cba));
+    BOOST_CHECK(FinalizeMuHash(abc) != FinalizeMuHash(MuHashOf(a)));
+
+    // Removing an element undoes its insertion, even before it was inserted
+    MuHash3072 ac = abc;
+    ac.Remove(b.data(), b.size());
+    MuHash3072 ac2;
+    ac2.Remove(b.data(), b.size()).Insert(c.data(), c.size()).Insert(b.data(), b.size()).Insert(a.data(), a.size());
+    BOOST_CHECK(FinalizeMuHash(ac) == FinalizeMuHash(ac2));
+    MuHash3072 ac3 = MuHashOf(a);
+    ac3.Insert(c.data(), c.size());
+    BOOST_CHECK(FinalizeMuHash(ac) == FinalizeMuHash(ac3));
+
+    MuHash3072 empty = abc;
+    empty.Remove(a.data(), a.size()).Remove(b.data(), b.size()).Remove(c.data(), c.size());
+    BOOST_CHECK(FinalizeMuHash(empty) == FinalizeMuHash(MuHash3072()));
+
+    // Sets combine and split
+    MuHash3072 combined = MuHashOf(a);
+    combined *= MuHashOf(b);
+    combined *= MuHashOf(c);
+    BOOST_CHECK(FinalizeMuHash(combined) == FinalizeMuHash(abc));
+    combined /= MuHashOf(b);
+    BOOST_CHECK(FinalizeMuHash(combined) == FinalizeMuHash(ac3));
+
+    // The numerator and denominator survive serialization
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << ac;
+    BOOST_CHECK_EQUAL(ss.size(), 2 * Num3072::BYTE_SIZE);
+    MuHash3072 ac4;
+    ss >> ac4;
+    BOOST_CHECK(FinalizeMuHash(ac4) == FinalizeMuHash(ac3));
+
+    // Values of at least the prime reduce like any other
+    unsigned char data[Num3072::BYTE_SIZE];
+    memset(data, 0xff, sizeof(data));
+    Num3072 big(data), one;
+    big.Divide(big);
+    unsigned char out[Num3072::BYTE_SIZE], expected[Num3072::BYTE_SIZE];
+    big.ToBytes(out);
+    one.ToBytes(expected);
+    BOOST_CHECK(memcmp(out, expected, sizeof(out)) == 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,98 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+
+#include "random.h"
+#include "uint256.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+typedef CuckooCache::cache<uint256, CuckooCache::random_blob_hasher> HashCache;
+
+static std::vector<uint256> RandomHashes(size_t n)
+{
+    std::vector<uint256> hashes(n);
+    for (size_t i = 0; i < n; i++) {
+        for (int j = 0; j < 8; j++) {
+            uint32_t word = insecure_rand();
+            memcpy(hashes[i].begin() + 4 * j, &word, 4);
+        }
+    }
+    return hashes;
+}
+
+static size_t CountContained(const HashCache& cache, const std::vector<uint256>& hashes, size_t nBegin, size_t nEnd)
+{
+    size_t nFound = 0;
+    for (size_t i = nBegin; i < nEnd; i++) {
+        nFound += cache.contains(hashes[i], false);
+    }
+    return nFound;
+}
+
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(cuckoocache_empty)
+{
+    seed_insecure_rand(true);
+    HashCache cache;
+    cache.setup_bytes(1 << 16);
+    std::vector<uint256> hashes = RandomHashes(1000);
+    BOOST_CHECK_EQUAL(CountContained(cache, hashes, 0, hashes.size()), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_hit_rate)
+{
+    seed_insecure_rand(true);
+    HashCache cache;
+    uint32_t nSize = cache.setup_bytes(1 << 16);
+    BOOST_CHECK_EQUAL(nSize, (1U << 16) / sizeof(uint256));
+
+    // Filled to less than a generation, nothing has to be dropped
+    std::vector<uint256> hashes = RandomHashes(nSize * 2);
+    size_t nFill = nSize * 40 / 100;
+    for (size_t i = 0; i < nFill; i++) {
+        cache.insert(hashes[i]);
+    }
+    BOOST_CHECK_EQUAL(CountContained(cache, hashes, 0, nFill), nFill);
+    BOOST_CHECK_EQUAL(CountContained(cache, hashes, nFill, hashes.size()), 0U);
+
+    // Inserting twice the capacity keeps almost all of the newest generation
+    for (size_t i = nFill; i < hashes.size(); i++) {
+        cache.insert(hashes[i]);
+    }
+    size_t nRecent = nSize * 40 / 100;
+    BOOST_CHECK(CountContained(cache, hashes, hashes.size() - nRecent, hashes.size()) >= nRecent * 95 / 100);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_erase)
+{
+    seed_insecure_rand(true);
+    HashCache cache;
+    uint32_t nSize = cache.setup_bytes(1 << 16);
+
+    // Half the table, marked erasable as it is looked up
+    std::vector<uint256> hashes = RandomHashes(nSize);
+    size_t nHalf = nSize / 2;
+    for (size_t i = 0; i < nHalf; i++) {
+        cache.insert(hashes[i]);
+    }
+    for (size_t i = 0; i < nHalf; i++) {
+        BOOST_CHECK(cache.contains(hashes[i], true));
+    }
+    // Erased elements stay until overwritten
+    BOOST_CHECK_EQUAL(CountContained(cache, hashes, 0, nHalf), nHalf);
+
+    // The rest overwrite the erased elements rather than being dropped
+    for (size_t i = nHalf; i < hashes.size(); i++) {
+        cache.insert(hashes[i]);
+    }
+    BOOST_CHECK(CountContained(cache, hashes, nHalf, hashes.size()) >= (hashes.size() - nHalf) * 99 / 100);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,10 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
 #include "dbwrapper.h"
 #include "uint256.h"
 #include "random.h"
@@ -118,6 +122,141 @@ BOOST_AUTO_TEST_CASE(dbwrapper_iterator)
     }
 }
 
+// Test that a snapshot does not see later writes
+BOOST_AUTO_TEST_CASE(dbwrapper_snapshot)
+{
+    {
+        path ph = temp_directory_path() / unique_path();
+        CDBWrapper dbw(ph, (1 << 20), true, false);
+
+        char key = 'i';
+        uint256 in = GetRandHash();
+        char key2 = 'j';
+        uint256 in2 = GetRandHash();
+
+        uint256 res;
+
+        BOOST_CHECK(dbw.Write(key, in));
+        CDBSnapshot snapshot(dbw);
+        BOOST_CHECK(dbw.Write(key, in2));
+        BOOST_CHECK(dbw.Write(key2, in2));
+
+        BOOST_CHECK(dbw.Read(key, res));
+        BOOST_CHECK_EQUAL(res.ToString(), in2.ToString());
+        BOOST_CHECK(dbw.Read(key, res, snapshot));
+        BOOST_CHECK_EQUAL(res.ToString(), in.ToString());
+        BOOST_CHECK(dbw.Exists(key2));
+        BOOST_CHECK(!dbw.Read(key2, res, snapshot));
+
+        boost::scoped_ptr<CDBIterator> it(dbw.NewIterator(snapshot));
+        it->Seek(key);
+        char key_res;
+        BOOST_REQUIRE(it->Valid());
+        BOOST_CHECK(it->GetKey(key_res));
+        BOOST_CHECK_EQUAL(key_res, key);
+        it->Next();
+        BOOST_CHECK(!it->Valid());
+    }
+}
+
+// Test tunable options and statistics
+BOOST_AUTO_TEST_CASE(dbwrapper_options_stats)
+{
+    mapArgs["-testdbblocksize"] = "1024";
+    mapArgs["-testdbbloombits"] = "0";
+    mapArgs["-testdbwritebuffer"] = "1";
+    CDBOptions dbOptions = GetDBOptionsFromArgs("testdb");
+    mapArgs.erase("-testdbblocksize");
+    mapArgs.erase("-testdbbloombits");
+    mapArgs.erase("-testdbwritebuffer");
+    BOOST_CHECK_EQUAL(dbOptions.nBlockSize, 1024U);
+    BOOST_CHECK_EQUAL(dbOptions.nBloomBits, 0);
+    BOOST_CHECK_EQUAL(dbOptions.nWriteBufferSize, 1U << 20);
+
+    path ph = temp_directory_path() / unique_path();
+    CDBWrapper dbw(ph, (1 << 20), true, false, false, dbOptions);
+    char key = 'k';
+    uint256 in = GetRandHash();
+    uint256 res;
+    BOOST_CHECK(dbw.Write(key, in));
+    BOOST_CHECK(dbw.Read(key, res));
+    BOOST_CHECK_EQUAL(res.ToString(), in.ToString());
+
+    CDBStats stats;
+    dbw.GetDBStats(stats);
+    BOOST_CHECK_EQUAL(stats.strEngine, "leveldb");
+    BOOST_CHECK(stats.strEngineStats.find("Compactions") != std::string::npos);
+    BOOST_CHECK_EQUAL(stats.nCompactions, 0U);
+    BOOST_CHECK_EQUAL(stats.nRangeCompactions, 0U);
+}
+
+// Test engine selection
+BOOST_AUTO_TEST_CASE(dbwrapper_engine)
+{
+    BOOST_CHECK(IsDBEngineAvailable("leveldb"));
+    BOOST_CHECK(!IsDBEngineAvailable("nosuchdb"));
+
+    CDBOptions dbOptions;
+    dbOptions.strEngine = "nosuchdb";
+    path ph = temp_directory_path() / unique_path();
+    BOOST_CHECK_THROW(CDBWrapper(ph, (1 << 20), false, false, false, dbOptions), dbwrapper_error);
+
+#ifdef USE_LMDB
+    // The same reads, writes, snapshots and ordering through LMDB
+    dbOptions.strEngine = "lmdb";
+    {
+        CDBWrapper dbw(ph, (1 << 20), false, true, true, dbOptions);
+        BOOST_CHECK_EQUAL(std::string(dbw.GetEngineName()), "lmdb");
+        for (int x = 0; x < 256; x++) {
+            BOOST_CHECK(dbw.Write(make_pair('k', x), x * x));
+        }
+        CDBSnapshot snapshot(dbw);
+        BOOST_CHECK(dbw.Erase(make_pair('k', 7)));
+        int res;
+        BOOST_CHECK(!dbw.Read(make_pair('k', 7), res));
+        BOOST_CHECK(dbw.Read(make_pair('k', 7), res, snapshot));
+        BOOST_CHECK_EQUAL(res, 49);
+
+        boost::scoped_ptr<CDBIterator> it(dbw.NewIterator());
+        it->Seek(make_pair('k', 0));
+        int nCount = 0;
+        for (; it->Valid(); it->Next(), nCount++) {
+            pair<char, int> key;
+            BOOST_REQUIRE(it->GetKey(key) && it->GetValue(res));
+            BOOST_CHECK_EQUAL(res, key.second * key.second);
+        }
+        BOOST_CHECK_EQUAL(nCount, 255);
+        BOOST_CHECK(dbwrapper_private::GetObfuscateKey(dbw) != std::vector<unsigned char>(8, 0));
+    }
+
+    // A database stays with the engine that wrote it, unless wiped
+    dbOptions.strEngine = "leveldb";
+    BOOST_CHECK_THROW(CDBWrapper(ph, (1 << 20), false, false, false, dbOptions), dbwrapper_error);
+    CDBWrapper dbw(ph, (1 << 20), false, true, false, dbOptions);
+    BOOST_CHECK(dbw.IsEmpty());
+#endif
+}
+
+// Test range compaction and size estimates
+BOOST_AUTO_TEST_CASE(dbwrapper_compact_range)
+{
+    path ph = temp_directory_path() / unique_path();
+    CDBWrapper dbw(ph, (1 << 20), true, false);
+    for (int i = 0; i < 1000; i++) {
+        BOOST_CHECK(dbw.Write(make_pair('k', i), GetRandHash()));
+    }
+    // Writes still in the write buffer do not take up disk yet.
+    BOOST_CHECK_EQUAL(dbw.EstimateSize(make_pair('k', 0), make_pair('l', 0)), 0U);
+
+    dbw.CompactRange(make_pair('k', 0), make_pair('l', 0));
+    BOOST_CHECK(dbw.EstimateSize(make_pair('k', 0), make_pair('l', 0)) > 0);
+    BOOST_CHECK_EQUAL(dbw.EstimateSize(make_pair('x', 0), make_pair('y', 0)), 0U);
+
+    CDBStats stats;
+    dbw.GetDBStats(stats);
+    BOOST_CHECK_EQUAL(stats.nRangeCompactions, 1U);
+}
+
 BOOST_AUTO_TEST_CASE(iterator_ordering)
 {
     path ph = temp_directory_path() / unique_path();
@@ -82,6 +82,21 @@ void TestEquihashSolvers(unsigned int n, unsigned int k, const std::string &I, c
     BOOST_TEST_MESSAGE(strm.str());
     BOOST_CHECK(retOpt == solns);
     BOOST_CHECK(retOpt == ret);
+
+    // The bucketed solver should have the exact same result
+    std::set<std::vector<uint32_t>> retBucket;
+    std::function<bool(std::vector<unsigned char>)> validBlockBucket =
+            [&retBucket, cBitLen](std::vector<unsigned char> soln) {
+        retBucket.insert(GetIndicesFromMinimal(soln, cBitLen));
+        return false;
+    };
+    EhBucketSolveUncancellable(n, k, state, validBlockBucket);
+    BOOST_TEST_MESSAGE("[Bucket] Number of solutions: " << retBucket.size());
+    strm.str("");
+    PrintSolutions(strm, retBucket);
+    BOOST_TEST_MESSAGE(strm.str());
+    BOOST_CHECK(retBucket == solns);
+    BOOST_CHECK(retBucket == ret);
 }
 #endif
 
@@ -0,0 +1,89 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/jsonwriter.h"
+#include "rpc/server.h"
+
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/script.h"
+#include "uint256.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <univalue.h>
+
+extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
+extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, CJSONWriter& writer);
+
+BOOST_FIXTURE_TEST_SUITE(jsonwriter_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(jsonwriter_values)
+{
+    std::string strJSON;
+    CJSONWriter writer(strJSON);
+    std::vector<unsigned char> vch(3);
+    vch[0] = 0x00; vch[1] = 0xab; vch[2] = 0x7f;
+    uint256 hash = GetRandHash();
+
+    writer.BeginObject();
+    writer.Key("str").String("a\"b\\c\n\x01\x7f");
+    writer.Key("int").Int(-42);
+    writer.Key("bool").Bool(true);
+    writer.Key("double").Double(1.0 / 3);
+    writer.Key("amount").Amount(-123456789);
+    writer.Key("hex").Hex(vch);
+    writer.Key("hash").Blob(hash);
+    writer.Key("empty").BeginArray().EndArray();
+    writer.Key("array").BeginArray().Int(1).BeginObject().EndObject().String("x").EndArray();
+    writer.EndObject();
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("str", "a\"b\\c\n\x01\x7f"));
+    obj.push_back(Pair("int", -42));
+    obj.push_back(Pair("bool", true));
+    obj.push_back(Pair("double", 1.0 / 3));
+    obj.push_back(Pair("amount", ValueFromAmount(-123456789)));
+    obj.push_back(Pair("hex", HexStr(vch)));
+    obj.push_back(Pair("hash", hash.GetHex()));
+    obj.push_back(Pair("empty", UniValue(UniValue::VARR)));
+    UniValue array(UniValue::VARR);
+    array.push_back(1);
+    array.push_back(UniValue(UniValue::VOBJ));
+    array.push_back("x");
+    obj.push_back(Pair("array", array));
+
+    BOOST_CHECK_EQUAL(strJSON, obj.write());
+    BOOST_CHECK_EQUAL(RawJSONValue(strJSON).write(), obj.write());
+}
+
+BOOST_AUTO_TEST_CASE(jsonwriter_transaction)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(2);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 1);
+    mtx.vin[0].scriptSig << OP_1 << std::vector<unsigned char>(33, 2);
+    mtx.vin[1].prevout = COutPoint(GetRandHash(), 0);
+    mtx.vout.resize(2);
+    mtx.vout[0].nValue = 150000000;
+    mtx.vout[0].scriptPubKey << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+    mtx.vout[1].nValue = 1;
+    mtx.vout[1].scriptPubKey << OP_RETURN;
+    CTransaction tx(mtx);
+
+    UniValue entry(UniValue::VOBJ);
+    TxToJSON(tx, uint256(), entry);
+
+    std::string strJSON;
+    CJSONWriter writer(strJSON);
+    writer.BeginObject();
+    TxToJSON(tx, uint256(), writer);
+    writer.EndObject();
+
+    BOOST_CHECK_EQUAL(strJSON, entry.write());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 
 #include "consensus/upgrades.h"
 #include "main.h"
+#include "script/interpreter.h"
 #include "txmempool.h"
 #include "util.h"
 
@@ -103,6 +104,106 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolPackageStateTest)
+{
+    // Parent with two children, which are both spent by one grandchild
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(2);
+    for (int i = 0; i < 2; i++)
+    {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 33000LL;
+    }
+    CMutableTransaction txChild[2];
+    for (int i = 0; i < 2; i++)
+    {
+        txChild[i].vin.resize(1);
+        txChild[i].vin[0].scriptSig = CScript() << OP_11;
+        txChild[i].vin[0].prevout.hash = txParent.GetHash();
+        txChild[i].vin[0].prevout.n = i;
+        txChild[i].vout.resize(1);
+        txChild[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txChild[i].vout[0].nValue = 11000LL;
+    }
+    CMutableTransaction txGrandChild;
+    txGrandChild.vin.resize(2);
+    for (int i = 0; i < 2; i++)
+    {
+        txGrandChild.vin[i].scriptSig = CScript() << OP_11;
+        txGrandChild.vin[i].prevout.hash = txChild[i].GetHash();
+        txGrandChild.vin[i].prevout.n = 0;
+    }
+    txGrandChild.vout.resize(1);
+    txGrandChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txGrandChild.vout[0].nValue = 11000LL;
+
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(1000LL).SigOps(1).FromTx(txParent));
+    pool.addUnchecked(txChild[0].GetHash(), entry.Fee(10000LL).SigOps(2).FromTx(txChild[0]));
+    pool.addUnchecked(txChild[1].GetHash(), entry.Fee(0LL).SigOps(3).FromTx(txChild[1]));
+    pool.addUnchecked(txGrandChild.GetHash(), entry.Fee(100000LL).SigOps(4).FromTx(txGrandChild));
+
+    CTxMemPool::txiter itParent = pool.mapTx.find(txParent.GetHash());
+    CTxMemPool::txiter itChild0 = pool.mapTx.find(txChild[0].GetHash());
+    CTxMemPool::txiter itChild1 = pool.mapTx.find(txChild[1].GetHash());
+    CTxMemPool::txiter itGrandChild = pool.mapTx.find(txGrandChild.GetHash());
+
+    BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(itParent).size(), 2);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolParents(itGrandChild).size(), 2);
+
+    uint64_t nSizeParent = itParent->GetTxSize();
+    uint64_t nSizeAll = nSizeParent + itChild0->GetTxSize() + itChild1->GetTxSize() + itGrandChild->GetTxSize();
+    BOOST_CHECK_EQUAL(itParent->GetCountWithDescendants(), 4);
+    BOOST_CHECK_EQUAL(itParent->GetSizeWithDescendants(), nSizeAll);
+    BOOST_CHECK_EQUAL(itParent->GetModFeesWithDescendants(), 111000LL);
+    BOOST_CHECK_EQUAL(itChild0->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(itGrandChild->GetCountWithAncestors(), 4);
+    BOOST_CHECK_EQUAL(itGrandChild->GetSizeWithAncestors(), nSizeAll);
+    BOOST_CHECK_EQUAL(itGrandChild->GetModFeesWithAncestors(), 111000LL);
+    BOOST_CHECK_EQUAL(itGrandChild->GetSigOpCountWithAncestors(), 10);
+
+    // Fee deltas show up in the package state on both sides
+    pool.PrioritiseTransaction(txChild[1].GetHash(), txChild[1].GetHash().ToString(), 0, 5000LL);
+    BOOST_CHECK_EQUAL(itChild1->GetModifiedFee(), 5000LL);
+    BOOST_CHECK_EQUAL(itParent->GetModFeesWithDescendants(), 116000LL);
+    BOOST_CHECK_EQUAL(itGrandChild->GetModFeesWithAncestors(), 116000LL);
+    BOOST_CHECK_EQUAL(itChild0->GetModFeesWithAncestors(), 11000LL);
+
+    // Confirming the parent leaves its descendants with one ancestor less
+    std::vector<CTransactionRef> vtx;
+    vtx.push_back(MakeTransactionRef(txParent));
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtx, 1, conflicts);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolParents(itChild0).size(), 0);
+    BOOST_CHECK_EQUAL(itChild0->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(itChild0->GetModFeesWithAncestors(), 10000LL);
+    BOOST_CHECK_EQUAL(itGrandChild->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(itGrandChild->GetSizeWithAncestors(), nSizeAll - nSizeParent);
+    BOOST_CHECK_EQUAL(itGrandChild->GetModFeesWithAncestors(), 115000LL);
+    BOOST_CHECK_EQUAL(itGrandChild->GetSigOpCountWithAncestors(), 9);
+
+    // The ancestor fee rate index puts the grandchild's package first
+    CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator it = pool.mapTx.get<ancestor_score>().begin();
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), txGrandChild.GetHash().ToString());
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), txChild[0].GetHash().ToString());
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), txChild[1].GetHash().ToString());
+    BOOST_CHECK(it == pool.mapTx.get<ancestor_score>().end());
+
+    // Removing a child takes the grandchild along and updates the other child
+    std::list<CTransaction> removed;
+    pool.remove(txChild[0], removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 2);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+    BOOST_CHECK_EQUAL(itChild1->GetCountWithDescendants(), 1);
+    BOOST_CHECK_EQUAL(itChild1->GetSizeWithDescendants(), itChild1->GetTxSize());
+    BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(itChild1).size(), 0);
+}
+
 BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
 {
     CTxMemPool pool(CFeeRate(0));
@@ -212,6 +313,166 @@ BOOST_AUTO_TEST_CASE(RemoveWithoutBranchId) {
     BOOST_CHECK_EQUAL(pool.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(RemoveExpired) {
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    entry.hadNoDependencies = true;
+
+    // Transactions expiring after heights 1 to 10, and one that never expires
+    for (auto i = 0; i < 11; i++) {
+        CMutableTransaction tx = CMutableTransaction();
+        tx.fOverwintered = true;
+        tx.nVersion = OVERWINTER_TX_VERSION;
+        tx.nVersionGroupId = OVERWINTER_VERSION_GROUP_ID;
+        tx.nExpiryHeight = i;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = (i + 1) * COIN;
+        pool.addUnchecked(tx.GetHash(), entry.FromTx(tx));
+    }
+    BOOST_CHECK_EQUAL(pool.size(), 11);
+
+    // Nothing has expired at height 1, and at height 6 the first five have
+    pool.removeExpired(1);
+    BOOST_CHECK_EQUAL(pool.size(), 11);
+    pool.removeExpired(6);
+    BOOST_CHECK_EQUAL(pool.size(), 6);
+    for (CTxMemPool::indexed_transaction_set::const_iterator it = pool.mapTx.begin(); it != pool.mapTx.end(); it++) {
+        BOOST_CHECK(!IsExpiredTx(it->GetTx(), 6));
+    }
+
+    // Far above them, only the transaction without an expiry height is left
+    pool.removeExpired(1000);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+    BOOST_CHECK_EQUAL(pool.mapTx.begin()->GetTx().nExpiryHeight, 0);
+}
+
+BOOST_AUTO_TEST_CASE(RemoveWithAnchor) {
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    entry.hadNoDependencies = true;
+    uint256 anchorA = GetRandHash();
+    uint256 anchorB = GetRandHash();
+
+    // Sapling spends from two anchors, and one transaction spending from both
+    for (auto i = 0; i < 9; i++) {
+        CMutableTransaction tx = CMutableTransaction();
+        tx.fOverwintered = true;
+        tx.nVersion = SAPLING_TX_VERSION;
+        tx.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+        tx.vShieldedSpend.resize(i == 8 ? 2 : 1);
+        tx.vShieldedSpend[0].anchor = i % 2 ? anchorB : anchorA;
+        tx.vShieldedSpend[0].nullifier = GetRandHash();
+        if (i == 8) {
+            tx.vShieldedSpend[1].anchor = anchorB;
+            tx.vShieldedSpend[1].nullifier = GetRandHash();
+        }
+        pool.addUnchecked(tx.GetHash(), entry.FromTx(tx));
+    }
+    BOOST_CHECK_EQUAL(pool.size(), 9);
+
+    // Sprout anchors are kept apart from Sapling ones
+    pool.removeWithAnchor(anchorA, SPROUT);
+    BOOST_CHECK_EQUAL(pool.size(), 9);
+
+    pool.removeWithAnchor(anchorA, SAPLING);
+    BOOST_CHECK_EQUAL(pool.size(), 4);
+    pool.removeWithAnchor(anchorA, SAPLING);
+    BOOST_CHECK_EQUAL(pool.size(), 4);
+    pool.removeWithAnchor(anchorB, SAPLING);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    SetMockTime(42);
+    CTxMemPool pool(CFeeRate(1000));
+    TestMemPoolEntryHelper entry;
+    entry.dPriority = 10.0;
+
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_1;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(10000LL).FromTx(tx1, &pool));
+
+    // A low fee parent paid for by its child
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vin.resize(1);
+    tx2.vin[0].scriptSig = CScript() << OP_2;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    tx2.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(5000LL).FromTx(tx2, &pool));
+
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vin.resize(1);
+    tx3.vin[0].prevout = COutPoint(tx2.GetHash(), 0);
+    tx3.vin[0].scriptSig = CScript() << OP_2;
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+    tx3.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx3.GetHash(), entry.Fee(20000LL).FromTx(tx3, &pool));
+
+    CMutableTransaction tx4 = CMutableTransaction();
+    tx4.vin.resize(1);
+    tx4.vin[0].prevout = COutPoint(uint256S("0004"), 0);
+    tx4.vin[0].scriptSig = CScript() << OP_4;
+    tx4.vout.resize(1);
+    tx4.vout[0].scriptPubKey = CScript() << OP_4 << OP_EQUAL;
+    tx4.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx4.GetHash(), entry.Fee(1000LL).FromTx(tx4, &pool));
+    BOOST_CHECK_EQUAL(pool.size(), 4);
+
+    // Nothing to do if the pool is within the limit
+    pool.TrimToSize(pool.DynamicMemoryUsage());
+    BOOST_CHECK_EQUAL(pool.size(), 4);
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(0));
+
+    // tx4 has the lowest fee rate; the spent outpoint is reported back
+    std::vector<COutPoint> vNoSpendsRemaining;
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1, &vNoSpendsRemaining);
+    BOOST_CHECK(!pool.exists(tx4.GetHash()));
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+    BOOST_CHECK_EQUAL(vNoSpendsRemaining.size(), 1);
+    BOOST_CHECK(vNoSpendsRemaining[0] == tx4.vin[0].prevout);
+    CAmount nMinFeeRate = CFeeRate(1000LL, ::GetSerializeSize(tx4, SER_NETWORK, PROTOCOL_VERSION)).GetFeePerK() + 1000;
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nMinFeeRate);
+
+    // tx2 is kept by the fee of tx3, so tx1 goes next
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(tx1.GetHash()));
+    BOOST_CHECK(pool.exists(tx2.GetHash()));
+    BOOST_CHECK(pool.exists(tx3.GetHash()));
+    nMinFeeRate = CFeeRate(10000LL, ::GetSerializeSize(tx1, SER_NETWORK, PROTOCOL_VERSION)).GetFeePerK() + 1000;
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nMinFeeRate);
+
+    // Packages go whole
+    pool.TrimToSize(1);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    nMinFeeRate = std::max(nMinFeeRate, CFeeRate(25000LL, ::GetSerializeSize(tx2, SER_NETWORK, PROTOCOL_VERSION) +
+                                                 ::GetSerializeSize(tx3, SER_NETWORK, PROTOCOL_VERSION)).GetFeePerK() + 1000);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nMinFeeRate);
+
+    // The minimum fee only decays after a block
+    SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nMinFeeRate);
+
+    std::vector<CTransactionRef> vtx;
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtx, 1, conflicts);
+    SetMockTime(42 + 2 * CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nMinFeeRate / 2);
+
+    // ... and drops to zero below half the minimum relay fee
+    SetMockTime(42 + 20 * CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(0));
+
+    SetMockTime(0);
+}
+
 // Test that nCheckFrequency is set correctly when calling setSanityCheck().
 // https://github.com/zcash/zcash/issues/3134
 BOOST_AUTO_TEST_CASE(SetSanityCheck) {
@@ -222,4 +483,119 @@ BOOST_AUTO_TEST_CASE(SetSanityCheck) {
     BOOST_CHECK_EQUAL(pool.GetCheckFrequency(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolTxDataTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction tx = CMutableTransaction();
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx.vout[0].nValue = 10 * COIN;
+    uint256 hash = tx.GetHash();
+
+    CTxMemPoolEntry e = entry.FromTx(tx);
+    size_t nUsage = e.DynamicMemoryUsage();
+    std::shared_ptr<const PrecomputedTransactionData> txdata = std::make_shared<PrecomputedTransactionData>(CTransaction(tx));
+    e.SetTxData(txdata);
+    BOOST_CHECK(e.DynamicMemoryUsage() > nUsage);
+
+    BOOST_CHECK(!pool.GetTxData(hash));
+    pool.addUnchecked(hash, e);
+    BOOST_CHECK(pool.GetTxData(hash) == txdata);
+
+    std::list<CTransaction> removed;
+    pool.remove(tx, removed, true);
+    BOOST_CHECK(!pool.GetTxData(hash));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSharedTxTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction mtx = CMutableTransaction();
+    mtx.vin.resize(1);
+    mtx.vin[0].scriptSig = CScript() << OP_1;
+    mtx.vout.resize(1);
+    mtx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    mtx.vout[0].nValue = 10 * COIN;
+    CTransactionRef ptx = MakeTransactionRef(mtx);
+    uint256 hash = ptx->GetHash();
+
+    BOOST_CHECK(!pool.get(hash));
+    pool.addUnchecked(hash, entry.FromTx(ptx));
+    // The pool holds the transaction it was given, not a copy
+    BOOST_CHECK(pool.get(hash) == ptx);
+    BOOST_CHECK(&pool.mapTx.find(hash)->GetTx() == ptx.get());
+
+    // A block that was filled from the pool keeps it after it leaves the pool
+    std::vector<CTransactionRef> vtx;
+    vtx.push_back(pool.get(hash));
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtx, 1, conflicts);
+    BOOST_CHECK(!pool.get(hash));
+    BOOST_CHECK(vtx[0] == ptx);
+    BOOST_CHECK_EQUAL(ptx.use_count(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolInfoSinceTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    std::vector<TxMempoolInfo> vInfo;
+    std::vector<uint256> vRemoved;
+    uint64_t nSequence;
+
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_1;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(1000).FromTx(tx1, &pool));
+
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(tx1.GetHash(), 0);
+    tx2.vin[0].scriptSig = CScript() << OP_2;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    tx2.vout[0].nValue = 9 * COIN;
+
+    BOOST_CHECK(pool.infoSince(0, 1, vInfo, vRemoved, nSequence));
+    BOOST_CHECK_EQUAL(vInfo.size(), 1);
+    BOOST_CHECK(vRemoved.empty());
+    BOOST_CHECK_EQUAL(nSequence, pool.GetSequence());
+    uint64_t nFirst = nSequence;
+
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(2000).FromTx(tx2, &pool));
+    BOOST_CHECK(pool.infoSince(nFirst, 1, vInfo, vRemoved, nSequence));
+    BOOST_CHECK_EQUAL(vInfo.size(), 1);
+    BOOST_CHECK(vInfo[0].hash == tx2.GetHash());
+    BOOST_CHECK_EQUAL(vInfo[0].nFee, 2000);
+    BOOST_CHECK_EQUAL(vInfo[0].vDepends.size(), 1);
+    BOOST_CHECK(vInfo[0].vDepends[0] == tx1.GetHash());
+    uint64_t nSecond = nSequence;
+
+    std::list<CTransaction> removed;
+    pool.remove(tx1, removed, true);
+    BOOST_CHECK(pool.infoSince(nSecond, 1, vInfo, vRemoved, nSequence));
+    BOOST_CHECK(vInfo.empty());
+    BOOST_CHECK_EQUAL(vRemoved.size(), 2);
+    BOOST_CHECK_EQUAL(nSequence, nSecond + 2);
+
+    // After a clear the earlier removals are unknown, so all entries are returned
+    pool.clear();
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(1000).FromTx(tx1, &pool));
+    BOOST_CHECK(!pool.infoSince(nSecond, 1, vInfo, vRemoved, nSequence));
+    BOOST_CHECK_EQUAL(vInfo.size(), 1);
+    BOOST_CHECK(vRemoved.empty());
+
+    // A sequence number from the future, e.g. from before a restart, is unknown too
+    BOOST_CHECK(!pool.infoSince(nSequence + 1, 1, vInfo, vRemoved, nSequence));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -236,6 +236,44 @@ BOOST_AUTO_TEST_CASE(subnet_test)
     BOOST_CHECK_EQUAL(subnet.ToString(), "1:2:3:4:5:6:7:8/ffff:ffff:ffff:fffe:ffff:ffff:ffff:ff0f");
 }
 
+BOOST_AUTO_TEST_CASE(subnet_index)
+{
+    CSubNetIndex index;
+    index.Set(CSubNet("1.2.3.0/24"), 100);
+    index.Set(CSubNet(CNetAddr("5.6.7.8")), 200);
+    index.Set(CSubNet("1:2:3:4::/64"), 300);
+    index.Set(CSubNet("9.8.0.0/255.0.255.0"), 400);
+    BOOST_CHECK_EQUAL(index.size(), 4);
+
+    BOOST_CHECK(index.Match(CNetAddr("1.2.3.4"), 50));
+    BOOST_CHECK(!index.Match(CNetAddr("1.2.3.4"), 100)); // Expired
+    BOOST_CHECK(!index.Match(CNetAddr("1.2.4.4"), 50));
+    BOOST_CHECK(index.Match(CNetAddr("5.6.7.8"), 50));
+    BOOST_CHECK(!index.Match(CNetAddr("5.6.7.9"), 50));
+    BOOST_CHECK(index.Match(CNetAddr("1:2:3:4:5:6:7:8"), 50));
+    BOOST_CHECK(!index.Match(CNetAddr("1:2:3:5:5:6:7:8"), 50));
+    BOOST_CHECK(index.Match(CNetAddr("9.1.0.2"), 50));
+    BOOST_CHECK(!index.Match(CNetAddr("9.1.1.2"), 50));
+    BOOST_CHECK(!index.Match(CNetAddr("257.0.0.1"), 50));
+
+    // A second subnet under the same netmask, and a new time for the first
+    index.Set(CSubNet("1.2.4.0/24"), 100);
+    index.Set(CSubNet("1.2.3.0/24"), 150);
+    BOOST_CHECK_EQUAL(index.size(), 5);
+    BOOST_CHECK(index.Match(CNetAddr("1.2.4.4"), 50));
+    BOOST_CHECK(index.Match(CNetAddr("1.2.3.4"), 100));
+
+    index.Erase(CSubNet("1.2.3.0/24"));
+    index.Erase(CSubNet("1.2.3.0/24"));
+    BOOST_CHECK_EQUAL(index.size(), 4);
+    BOOST_CHECK(!index.Match(CNetAddr("1.2.3.4"), 50));
+    BOOST_CHECK(index.Match(CNetAddr("1.2.4.4"), 50));
+
+    index.clear();
+    BOOST_CHECK_EQUAL(index.size(), 0);
+    BOOST_CHECK(!index.Match(CNetAddr("5.6.7.8"), 50));
+}
+
 BOOST_AUTO_TEST_CASE(netbase_getgroup)
 {
     BOOST_CHECK(CNetAddr("127.0.0.1").GetGroup() == boost::assign::list_of(0)); // Local -> !Routable()
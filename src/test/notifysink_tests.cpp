@@ -0,0 +1,77 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "notifysink.h"
+
+#include "test/test_bitcoin.h"
+
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(notifysink_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(notifysink_parse)
+{
+    NotifySinkType type;
+    std::string strTarget, strError;
+    BOOST_CHECK(ParseNotifySink("exec:cat >> /tmp/events", type, strTarget, strError));
+    BOOST_CHECK(type == NOTIFY_SINK_EXEC);
+    BOOST_CHECK_EQUAL(strTarget, "cat >> /tmp/events");
+    BOOST_CHECK(!ParseNotifySink("exec:", type, strTarget, strError));
+    BOOST_CHECK(!ParseNotifySink("/tmp/events", type, strTarget, strError));
+    BOOST_CHECK(!ParseNotifySink("tcp:127.0.0.1:1234", type, strTarget, strError));
+#ifndef WIN32
+    BOOST_CHECK(ParseNotifySink("pipe:/tmp/events", type, strTarget, strError));
+    BOOST_CHECK(type == NOTIFY_SINK_PIPE);
+    BOOST_CHECK_EQUAL(strTarget, "/tmp/events");
+    BOOST_CHECK(ParseNotifySink("unix:/tmp/events.sock", type, strTarget, strError));
+    BOOST_CHECK(type == NOTIFY_SINK_UNIX);
+    BOOST_CHECK(!ParseNotifySink("unix:/" + std::string(200, 'x'), type, strTarget, strError));
+#endif
+}
+
+BOOST_AUTO_TEST_CASE(notifysink_queue_coalesce)
+{
+    CNotifyQueue queue;
+    queue.Push("blocktip", "aa");
+    queue.Push("wallettx", "11");
+    queue.Push("blocktip", "bb");
+    queue.Push("wallettx", "11");
+    queue.Push("wallettx", "22");
+    BOOST_CHECK_EQUAL(queue.size(), 3);
+    BOOST_CHECK_EQUAL(queue.TakeAll(), "wallettx 11\nblocktip bb\nwallettx 22\n");
+    BOOST_CHECK(queue.empty());
+
+    // Once taken, the same transaction is reported again
+    queue.Push("wallettx", "11");
+    BOOST_CHECK_EQUAL(queue.TakeAll(), "wallettx 11\n");
+    BOOST_CHECK_EQUAL(queue.TakeDropped(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(notifysink_queue_bounded)
+{
+    CNotifyQueue queue(2);
+    queue.Push("wallettx", "11");
+    queue.Push("wallettx", "22");
+    BOOST_CHECK(queue.full());
+    queue.Push("wallettx", "33");
+    BOOST_CHECK_EQUAL(queue.TakeDropped(), 1);
+    BOOST_CHECK_EQUAL(queue.TakeDropped(), 0);
+    std::string strLines = queue.TakeAll();
+    BOOST_CHECK_EQUAL(strLines, "wallettx 22\nwallettx 33\n");
+
+    // Lines that could not be written go back in front of newer ones, and
+    // the old tip makes way for the new
+    queue.Push("blocktip", "bb");
+    queue.PushFront("blocktip aa\nwallettx 11\n");
+    BOOST_CHECK_EQUAL(queue.TakeAll(), "wallettx 11\nblocktip bb\n");
+    BOOST_CHECK_EQUAL(queue.TakeDropped(), 0);
+    queue.Push("wallettx", "44");
+    queue.PushFront(strLines);
+    BOOST_CHECK_EQUAL(queue.TakeDropped(), 1);
+    BOOST_CHECK_EQUAL(queue.TakeAll(), "wallettx 33\nwallettx 44\n");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
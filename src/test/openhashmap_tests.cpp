@@ -0,0 +1,82 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "openhashmap.h"
+
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <map>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+//! Few distinct hashes, so that keys share probe runs
+struct CollidingHasher
+{
+    size_t operator()(uint32_t key) const { return key % 7; }
+};
+
+typedef COpenHashMap<uint32_t, uint32_t, CollidingHasher> TestMap;
+
+void CheckSame(const TestMap& map, const std::map<uint32_t, uint32_t>& ref)
+{
+    BOOST_CHECK_EQUAL(map.size(), ref.size());
+    size_t nIterated = 0;
+    for (TestMap::const_iterator it = map.begin(); it != map.end(); ++it) {
+        std::map<uint32_t, uint32_t>::const_iterator refit = ref.find(it->first);
+        BOOST_REQUIRE(refit != ref.end());
+        BOOST_CHECK_EQUAL(it->second, refit->second);
+        nIterated++;
+    }
+    BOOST_CHECK_EQUAL(nIterated, ref.size());
+}
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(openhashmap_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(openhashmap_random_operations)
+{
+    seed_insecure_rand(true);
+    TestMap map;
+    std::map<uint32_t, uint32_t> ref;
+    BOOST_CHECK(map.find(1) == map.end());
+    BOOST_CHECK_EQUAL(map.erase(1), 0U);
+
+    for (int i = 0; i < 20000; i++) {
+        uint32_t key = insecure_rand() % 500;
+        switch (insecure_rand() % 3) {
+        case 0:
+            map[key] = i;
+            ref[key] = i;
+            break;
+        case 1:
+            BOOST_CHECK_EQUAL(map.erase(key), ref.erase(key));
+            break;
+        case 2:
+            BOOST_CHECK_EQUAL(map.count(key), ref.count(key));
+            if (ref.count(key))
+                BOOST_CHECK_EQUAL(map.find(key)->second, ref[key]);
+            break;
+        }
+        if (i % 1000 == 0)
+            CheckSame(map, ref);
+    }
+    CheckSame(map, ref);
+
+    // Erasing through an iterator leaves the other entries reachable
+    TestMap::iterator it = map.find(ref.begin()->first);
+    BOOST_REQUIRE(it != map.end());
+    map.erase(it);
+    ref.erase(ref.begin());
+    CheckSame(map, ref);
+
+    BOOST_CHECK(map.DynamicMemoryUsage() > 0);
+    map.clear();
+    ref.clear();
+    CheckSame(map, ref);
+    BOOST_CHECK_EQUAL(map.DynamicMemoryUsage(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
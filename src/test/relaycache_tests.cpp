@@ -0,0 +1,86 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "relaycache.h"
+
+#include "primitives/transaction.h"
+#include "test/test_bitcoin.h"
+#include "utiltime.h"
+
+#include <boost/test/unit_test.hpp>
+
+static CTransactionRef MakeTx(int n, size_t nScriptSize = 10)
+{
+    CMutableTransaction mtx;
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = n;
+    mtx.vout[0].scriptPubKey = CScript(std::vector<unsigned char>(nScriptSize, 0x51));
+    return MakeTransactionRef(mtx);
+}
+
+BOOST_FIXTURE_TEST_SUITE(relaycache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(relaycache_get)
+{
+    CRelayCache cache;
+    cache.SetLimit(1 << 20);
+    CTransactionRef tx = MakeTx(1);
+    cache.Add(tx, true);
+    // The very object is shared, not a copy
+    BOOST_CHECK(cache.Get(tx->GetHash()) == tx);
+    BOOST_CHECK(!cache.Get(MakeTx(2)->GetHash()));
+
+    uint64_t nHits, nMisses;
+    cache.GetStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nHits, 1U);
+    BOOST_CHECK_EQUAL(nMisses, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(relaycache_expiry)
+{
+    CRelayCache cache;
+    cache.SetLimit(1 << 20);
+    int64_t nNow = GetTime();
+    SetMockTime(nNow);
+    CTransactionRef tx = MakeTx(1);
+    cache.Add(tx, true);
+    SetMockTime(nNow + RELAY_CACHE_EXPIRY);
+    BOOST_CHECK(cache.Get(tx->GetHash()));
+
+    // Relayed again, it lasts from then on
+    cache.Add(tx, true);
+    SetMockTime(nNow + RELAY_CACHE_EXPIRY + 1);
+    BOOST_CHECK(cache.Get(tx->GetHash()));
+    SetMockTime(nNow + 2 * RELAY_CACHE_EXPIRY + 1);
+    BOOST_CHECK(!cache.Get(tx->GetHash()));
+    BOOST_CHECK_EQUAL(cache.size(), 0U);
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(relaycache_limit)
+{
+    CRelayCache cache;
+    cache.SetLimit(64 * 1024);
+    std::vector<CTransactionRef> vtx;
+    for (int i = 0; i < 200; i++) {
+        vtx.push_back(MakeTx(i, 1000));
+        cache.Add(vtx.back(), true);
+    }
+    // Shared with the mempool, they take little of the budget
+    BOOST_CHECK_EQUAL(cache.size(), 200U);
+    size_t nShared = cache.DynamicMemoryUsage();
+
+    // Once they leave it they count, the least recently used going first
+    BOOST_CHECK(cache.Get(vtx[0]->GetHash()));
+    for (int i = 0; i < 200; i++)
+        cache.RemovedFromMempool(*vtx[i]);
+    BOOST_CHECK(cache.DynamicMemoryUsage() > nShared);
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= 64 * 1024 + 4096);
+    BOOST_CHECK(cache.size() < 200U);
+    BOOST_CHECK(cache.Get(vtx[199]->GetHash()));
+    BOOST_CHECK(cache.Get(vtx[0]->GetHash()));
+    BOOST_CHECK(!cache.Get(vtx[1]->GetHash()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,118 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "responsecache.h"
+
+#include "test/test_bitcoin.h"
+#include "utilstrencodings.h"
+
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(responsecache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(responsecache_get)
+{
+    CResponseCache cache;
+    std::string strKey = CResponseCache::MakeKey("getblock", "00ff", "0");
+    std::string strReply, strTag;
+
+    // Disabled until given a limit
+    cache.Put(strKey, 10, "\"00ff\"", false);
+    BOOST_CHECK(!cache.Get(strKey, 500, strReply, strTag));
+    BOOST_CHECK_EQUAL(cache.size(), 0U);
+
+    cache.SetLimit(1 << 20);
+    std::string strPutTag;
+    cache.Put(strKey, 10, "\"00ff\"", false, &strPutTag);
+    BOOST_CHECK(cache.Get(strKey, 500, strReply, strTag));
+    BOOST_CHECK_EQUAL(strReply, "\"00ff\"");
+    BOOST_CHECK_EQUAL(strTag, strPutTag);
+    BOOST_CHECK(!cache.Get(CResponseCache::MakeKey("getblock", "00ff", "1"), 500, strReply, strTag));
+
+    uint64_t nHits, nMisses;
+    cache.GetStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nHits, 1U);
+    BOOST_CHECK_EQUAL(nMisses, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(responsecache_confirmations)
+{
+    CResponseCache cache;
+    cache.SetLimit(1 << 20);
+    std::string strKey = CResponseCache::MakeKey("getblock", "00ff", "1");
+    std::string strPutTag, strReply, strTag, strLaterTag;
+
+    cache.Put(strKey, 100, "{\"hash\":\"00ff\",\"confirmations\":401,\"height\":100}", true, &strPutTag);
+    BOOST_CHECK(cache.Get(strKey, 500, strReply, strTag));
+    BOOST_CHECK_EQUAL(strReply, "{\"hash\":\"00ff\",\"confirmations\":401,\"height\":100}");
+    BOOST_CHECK_EQUAL(strTag, strPutTag);
+
+    // The count follows the tip, and so does the tag
+    BOOST_CHECK(cache.Get(strKey, 600, strReply, strLaterTag));
+    BOOST_CHECK_EQUAL(strReply, "{\"hash\":\"00ff\",\"confirmations\":501,\"height\":100}");
+    BOOST_CHECK(strLaterTag != strTag);
+}
+
+BOOST_AUTO_TEST_CASE(responsecache_disconnect)
+{
+    CResponseCache cache;
+    cache.SetLimit(1 << 20);
+    for (int i = 0; i < 10; i++)
+        cache.Put(CResponseCache::MakeKey("getblockheader", itostr(i), "0"), 100 + i, "\"00\"", false);
+    BOOST_CHECK_EQUAL(cache.size(), 10U);
+
+    // Out of reach of what is cached
+    cache.BlockDisconnected(200);
+    BOOST_CHECK_EQUAL(cache.size(), 10U);
+
+    // The block and the one below it change
+    cache.BlockDisconnected(105);
+    BOOST_CHECK_EQUAL(cache.size(), 4U);
+    std::string strReply, strTag;
+    BOOST_CHECK(cache.Get(CResponseCache::MakeKey("getblockheader", "3", "0"), 500, strReply, strTag));
+    BOOST_CHECK(!cache.Get(CResponseCache::MakeKey("getblockheader", "4", "0"), 500, strReply, strTag));
+}
+
+BOOST_AUTO_TEST_CASE(responsecache_limit)
+{
+    CResponseCache cache;
+    cache.SetLimit(64 * 1024);
+    std::string strBody(1000, 'a');
+    for (int i = 0; i < 200; i++)
+        cache.Put(CResponseCache::MakeKey("rest/tx", itostr(i), "hex"), 100, strBody, false);
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= 64 * 1024 + 4096);
+    BOOST_CHECK(cache.size() < 200U);
+
+    // The most recent are kept
+    std::string strReply, strTag;
+    BOOST_CHECK(cache.Get(CResponseCache::MakeKey("rest/tx", "199", "hex"), 500, strReply, strTag));
+    BOOST_CHECK(!cache.Get(CResponseCache::MakeKey("rest/tx", "0", "hex"), 500, strReply, strTag));
+
+    // Replies too large for the cache aren't kept
+    cache.Put("large", 100, std::string(32 * 1024, 'b'), false);
+    BOOST_CHECK(!cache.Get("large", 500, strReply, strTag));
+}
+
+BOOST_AUTO_TEST_CASE(responsecache_buried)
+{
+    BOOST_CHECK(!CResponseCache::IsBuried(100, 100));
+    BOOST_CHECK(!CResponseCache::IsBuried(100, 100 + CResponseCache::MIN_DEPTH - 2));
+    BOOST_CHECK(CResponseCache::IsBuried(100, 100 + CResponseCache::MIN_DEPTH - 1));
+    BOOST_CHECK(!CResponseCache::IsBuried(-1, 1000));
+}
+
+BOOST_AUTO_TEST_CASE(responsecache_tags)
+{
+    BOOST_CHECK(CResponseCache::MatchesTag("\"abc\"", "\"abc\""));
+    BOOST_CHECK(CResponseCache::MatchesTag("W/\"abc\"", "\"abc\""));
+    BOOST_CHECK(CResponseCache::MatchesTag("\"x\", \"abc\"", "\"abc\""));
+    BOOST_CHECK(CResponseCache::MatchesTag(" * ", "\"abc\""));
+    BOOST_CHECK(!CResponseCache::MatchesTag("\"abcd\"", "\"abc\""));
+    BOOST_CHECK(!CResponseCache::MatchesTag("", "\"abc\""));
+    BOOST_CHECK(!CResponseCache::MatchesTag(" , ", "\"abc\""));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
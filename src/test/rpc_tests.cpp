@@ -218,6 +218,47 @@ BOOST_AUTO_TEST_CASE(json_parse_errors)
     BOOST_CHECK_THROW(ParseNonRFCJSONValue("3J98t1WpEZ73CNmQviecrnyiWrnqRhWNL"), std::runtime_error);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_parse_simple_request)
+{
+    // The simple parse agrees with the full one where it applies
+    const char* const vRequests[] = {
+        "{\"jsonrpc\":\"1.0\",\"id\":\"curltest\",\"method\":\"getblockcount\",\"params\":[]}",
+        " { \"method\" : \"getinfo\" , \"id\" : 17 }\n",
+        "{\"method\":\"getinfo\",\"params\":null,\"id\":null}",
+        "{\"id\":-3,\"method\":\"getinfo\"}",
+    };
+    for (size_t i = 0; i < ARRAYLEN(vRequests); i++) {
+        JSONRequest jreqSimple, jreq;
+        BOOST_CHECK(jreqSimple.parseSimple(vRequests[i]));
+        UniValue valRequest;
+        BOOST_CHECK(valRequest.read(vRequests[i]));
+        jreq.parse(valRequest);
+        BOOST_CHECK_EQUAL(jreqSimple.strMethod, jreq.strMethod);
+        BOOST_CHECK_EQUAL(jreqSimple.id.write(), jreq.id.write());
+        BOOST_CHECK_EQUAL(jreqSimple.params.write(), jreq.params.write());
+    }
+
+    // Everything else is left to the full parse
+    JSONRequest jreq;
+    BOOST_CHECK(!jreq.parseSimple("{\"method\":\"getblock\",\"params\":[\"00\"],\"id\":1}"));
+    BOOST_CHECK(!jreq.parseSimple("{\"method\":\"get\\u0041\",\"id\":1}"));
+    BOOST_CHECK(!jreq.parseSimple("{\"method\":\"getinfo\",\"id\":1.5}"));
+    BOOST_CHECK(!jreq.parseSimple("{\"method\":\"getinfo\",\"method\":\"stop\"}"));
+    BOOST_CHECK(!jreq.parseSimple("{\"method\":\"getinfo\"} x"));
+    BOOST_CHECK(!jreq.parseSimple("{\"id\":1}"));
+    BOOST_CHECK(!jreq.parseSimple("[{\"method\":\"getinfo\"}]"));
+    BOOST_CHECK(!jreq.parseSimple("{\"method\":\"getinfo\",\"id\":01}"));
+}
+
+BOOST_AUTO_TEST_CASE(rpc_reply)
+{
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("blocks", 10));
+    BOOST_CHECK_EQUAL(JSONRPCReply(result, NullUniValue, UniValue(1)), JSONRPCReplyObj(result, NullUniValue, UniValue(1)).write() + "\n");
+    UniValue error = JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found");
+    BOOST_CHECK_EQUAL(JSONRPCReply(result, error, UniValue("a")), JSONRPCReplyObj(result, error, UniValue("a")).write() + "\n");
+}
+
 BOOST_AUTO_TEST_CASE(rpc_ban)
 {
     BOOST_CHECK_NO_THROW(CallRPC(string("clearbanned")));
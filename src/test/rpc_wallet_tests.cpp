@@ -436,7 +436,7 @@ BOOST_AUTO_TEST_CASE(rpc_wallet_z_exportwallet)
     // There's no way to really delete a private key so we will read in the
     // exported wallet file and search for the spending key and payment address.
 
-    EnsureWalletIsUnlocked();
+    EnsureWalletIsUnlocked(pwalletMain);
 
     ifstream file;
     file.open(exportfilepath.string().c_str(), std::ios::in | std::ios::ate);
@@ -636,6 +636,45 @@ BOOST_AUTO_TEST_CASE(rpc_wallet_z_importexport)
     BOOST_CHECK_THROW(CallRPC("z_getnewaddress toomanyargs"), runtime_error);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_wallet_z_getnewaddresses)
+{
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    if (!pwalletMain->HaveHDSeed()) {
+        pwalletMain->GenerateNewSeed();
+    }
+
+    UniValue retValue;
+    BOOST_CHECK_THROW(CallRPC("z_getnewaddresses"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("z_getnewaddresses 0"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("z_getnewaddresses 1001"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("z_getnewaddresses 1 badtype"), runtime_error);
+
+    // The addresses are new, distinct, and the next account keys in order
+    uint32_t nAccount = pwalletMain->GetHDChain().saplingAccountCounter;
+    BOOST_CHECK_NO_THROW(retValue = CallRPC("z_getnewaddresses 20 sapling"));
+    UniValue arr = retValue.get_array();
+    BOOST_CHECK_EQUAL(arr.size(), 20);
+    std::unordered_set<std::string> newaddrs;
+    for (size_t i = 0; i < arr.size(); i++) {
+        newaddrs.insert(arr[i].get_str());
+        auto address = DecodePaymentAddress(arr[i].get_str());
+        BOOST_ASSERT(boost::get<libzcash::SaplingPaymentAddress>(&address) != nullptr);
+        BOOST_CHECK(boost::apply_visitor(HaveSpendingKeyForPaymentAddress(pwalletMain), address));
+        auto addr = boost::get<libzcash::SaplingPaymentAddress>(address);
+
+        libzcash::SaplingIncomingViewingKey ivk;
+        BOOST_CHECK(pwalletMain->GetSaplingIncomingViewingKey(addr, ivk));
+        BOOST_CHECK_EQUAL(pwalletMain->mapSaplingZKeyMetadata[ivk].hdKeypath,
+                          "m/32'/" + std::to_string(Params().BIP44CoinType()) + "'/" + std::to_string(nAccount + i) + "'");
+    }
+    BOOST_CHECK_EQUAL(newaddrs.size(), 20);
+    BOOST_CHECK_EQUAL(pwalletMain->GetHDChain().saplingAccountCounter, nAccount + 20);
+
+    BOOST_CHECK_NO_THROW(retValue = CallRPC("z_getnewaddresses 3 sprout"));
+    BOOST_CHECK_EQUAL(retValue.get_array().size(), 3);
+}
+
 
 
 /**
@@ -822,6 +861,108 @@ BOOST_AUTO_TEST_CASE(rpc_wallet_async_operations_parallel_cancel)
     BOOST_CHECK(ids.size()==0);
 }
 
+class MockHeavyOperation : public MockSleepOperation {
+public:
+    MockHeavyOperation(int t=1000) : MockSleepOperation(t) {}
+    virtual ~MockHeavyOperation() {}
+    virtual bool isHeavy() const {
+        return true;
+    }
+    virtual void main() {
+        set_state(OperationStatus::EXECUTING);
+        start_execution_clock();
+        start_phase("proving");
+        std::this_thread::sleep_for(std::chrono::milliseconds(naptime));
+        start_phase("broadcast");
+        stop_execution_clock();
+        set_result(UniValue(UniValue::VSTR, "done"));
+        set_state(OperationStatus::SUCCESS);
+    }
+};
+
+// This tests that heavy operations leave a worker free for short ones
+BOOST_AUTO_TEST_CASE(rpc_wallet_async_operations_heavy)
+{
+    std::shared_ptr<AsyncRPCQueue> q = std::make_shared<AsyncRPCQueue>();
+    q->addWorker();
+    q->addWorker();
+
+    std::shared_ptr<AsyncRPCOperation> heavy1(new MockHeavyOperation(2000));
+    std::shared_ptr<AsyncRPCOperation> heavy2(new MockHeavyOperation(2000));
+    std::shared_ptr<AsyncRPCOperation> light(new MockSleepOperation(100));
+    q->addOperation(heavy1);
+    q->addOperation(heavy2);
+    q->addOperation(light);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+
+    // The second heavy operation waits for the first, the light one passes it
+    BOOST_CHECK_EQUAL(heavy1->isExecuting(), true);
+    BOOST_CHECK_EQUAL(heavy2->isReady(), true);
+    BOOST_CHECK_EQUAL(light->isSuccess(), true);
+
+    UniValue status = heavy1->getStatus();
+    BOOST_CHECK_EQUAL(find_value(status, "phase").get_str(), "proving");
+
+    q->finishAndWait();
+    BOOST_CHECK_EQUAL(heavy2->isSuccess(), true);
+
+    status = heavy2->getStatus();
+    BOOST_CHECK(find_value(status, "phase").isNull());
+    UniValue timing = find_value(status, "timing");
+    BOOST_CHECK(find_value(timing, "proving_secs").get_real() >= 1.9);
+    BOOST_CHECK(!find_value(timing, "broadcast_secs").isNull());
+}
+
+// This tests the limits on finished operations and the result database
+BOOST_AUTO_TEST_CASE(rpc_wallet_async_operations_results)
+{
+    std::shared_ptr<AsyncRPCQueue> q = std::make_shared<AsyncRPCQueue>();
+    std::shared_ptr<CAsyncRPCResultDB> db = std::make_shared<CAsyncRPCResultDB>(pathTemp / "asyncresults", 1 << 20, true);
+    q->setResultLimits(2, DEFAULT_ASYNC_RESULT_TTL);
+    q->setResultDB(db);
+
+    std::vector<AsyncRPCOperationId> ids;
+    for (int i = 0; i < 4; i++) {
+        std::shared_ptr<AsyncRPCOperation> op(new MockSleepOperation(10));
+        ids.push_back(op->getId());
+        q->addOperation(op);
+    }
+    q->addWorker();
+    q->finishAndWait();
+
+    // Only the last two finished stay in memory, all are on disk
+    BOOST_CHECK_EQUAL(q->getAllOperationIds().size(), 2U);
+    BOOST_CHECK(!q->getOperationForId(ids[0]));
+    BOOST_CHECK(q->getOperationForId(ids[3]));
+
+    AsyncRPCOperationFilter filter;
+    BOOST_CHECK_EQUAL(q->getOperationStatuses(filter, false).size(), 4U);
+    filter.status = "failed";
+    BOOST_CHECK_EQUAL(q->getOperationStatuses(filter, false).size(), 0U);
+    filter.status = "success";
+    filter.limit = 3;
+    BOOST_CHECK_EQUAL(q->getOperationStatuses(filter, false).size(), 3U);
+
+    filter = AsyncRPCOperationFilter();
+    filter.ids.insert(ids[0]);
+    std::vector<UniValue> statuses = q->getOperationStatuses(filter, true);
+    BOOST_CHECK_EQUAL(statuses.size(), 1U);
+    BOOST_CHECK_EQUAL(find_value(statuses[0], "id").get_str(), ids[0]);
+    BOOST_CHECK_EQUAL(find_value(statuses[0], "status").get_str(), "success");
+
+    // Removed from the database too
+    BOOST_CHECK_EQUAL(q->getOperationStatuses(filter, false).size(), 0U);
+    CAsyncRPCResult result;
+    BOOST_CHECK(!db->ReadResult(ids[0], result));
+    BOOST_CHECK(db->ReadResult(ids[1], result));
+
+    // Expired results are dropped from memory and disk
+    q->setResultLimits(2, 0);
+    BOOST_CHECK_EQUAL(q->getAllOperationIds().size(), 0U);
+    BOOST_CHECK_EQUAL(db->EraseFinishedBefore(std::numeric_limits<uint32_t>::max()), 3U);
+    BOOST_CHECK_EQUAL(q->getOperationStatuses(AsyncRPCOperationFilter(), false).size(), 0U);
+}
+
 // This tests z_getoperationstatus, z_getoperationresult, z_listoperationids
 BOOST_AUTO_TEST_CASE(rpc_z_getoperations)
 {
@@ -834,6 +975,10 @@ BOOST_AUTO_TEST_CASE(rpc_z_getoperations)
     BOOST_CHECK_NO_THROW(CallRPC("z_getoperationstatus [\"opid-1234\"]"));
     BOOST_CHECK_THROW(CallRPC("z_getoperationstatus [] toomanyargs"), runtime_error);
     BOOST_CHECK_THROW(CallRPC("z_getoperationstatus not_an_array"), runtime_error);
+    BOOST_CHECK_NO_THROW(CallRPC("z_getoperationstatus [] {\"status\":\"success\",\"limit\":10}"));
+    BOOST_CHECK_THROW(CallRPC("z_getoperationstatus [] {\"limit\":-1}"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("z_getoperationstatus [] {\"status\":1}"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("z_getoperationstatus [] {} toomanyargs"), runtime_error);
 
     BOOST_CHECK_NO_THROW(CallRPC("z_getoperationresult"));
     BOOST_CHECK_NO_THROW(CallRPC("z_getoperationresult []"));
@@ -1281,7 +1426,7 @@ BOOST_AUTO_TEST_CASE(rpc_z_sendmany_taddr_to_sapling)
     BOOST_CHECK_EQUAL(0, chainActive.Height());
     CBlock block;
     block.hashPrevBlock = chainActive.Tip()->GetBlockHash();
-    block.vtx.push_back(wtx);
+    block.vtx.push_back(MakeTransactionRef(wtx));
     block.hashMerkleRoot = block.BuildMerkleTree();
     auto blockHash = block.GetHash();
     CBlockIndex fakeIndex {block};
@@ -1526,7 +1671,7 @@ BOOST_AUTO_TEST_CASE(rpc_z_shieldcoinbase_parameters)
 
     BOOST_CHECK_THROW(CallRPC("z_shieldcoinbase"), runtime_error);
     BOOST_CHECK_THROW(CallRPC("z_shieldcoinbase toofewargs"), runtime_error);
-    BOOST_CHECK_THROW(CallRPC("z_shieldcoinbase too many args shown here"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("z_shieldcoinbase too many args are shown here"), runtime_error);
 
     // bad from address
     BOOST_CHECK_THROW(CallRPC("z_shieldcoinbase "
@@ -1561,6 +1706,13 @@ BOOST_AUTO_TEST_CASE(rpc_z_shieldcoinbase_parameters)
     "100 -1"
     ), runtime_error);
 
+    // invalid number of transactions, must be at least 1
+    BOOST_CHECK_THROW(CallRPC("z_shieldcoinbase "
+    "tmRr6yJonqGK23UVhrKuyvTpF8qxQQjKigJ "
+    "tnpoQJVnYBZZqkFadj2bJJLThNCxbADGB5gSGeYTAGGrT5tejsxY9Zc1BtY8nnHmZkB "
+    "0.0001 50 0"
+    ), runtime_error);
+
     // Mutable tx containing contextual information we need to build tx
     UniValue retValue = CallRPC("getblockcount");
     int nHeight = retValue.get_int();
@@ -1695,7 +1847,7 @@ BOOST_AUTO_TEST_CASE(rpc_z_mergetoaddress_parameters)
 
     BOOST_CHECK_THROW(CallRPC("z_mergetoaddress"), runtime_error);
     BOOST_CHECK_THROW(CallRPC("z_mergetoaddress toofewargs"), runtime_error);
-    BOOST_CHECK_THROW(CallRPC("z_mergetoaddress just too many args present for this method"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("z_mergetoaddress just too many args are present for this method"), runtime_error);
 
     std::string taddr1 = "T1SvzJ7oUaq4X5YTyuZeJxUjLizMxUMHQEu";
     std::string taddr2 = "T18dkMN1JVMjpzRNTkFtnwhPz8CUQhwfuaH";
@@ -1764,6 +1916,10 @@ BOOST_AUTO_TEST_CASE(rpc_z_mergetoaddress_parameters)
     CheckRPCThrows("z_mergetoaddress [\"" + taddr1 + "\"] " + aSproutAddr + " 0.0001 100 100 " + badmemo,
         "Invalid parameter, size of memo is larger than maximum allowed 512");
 
+    // invalid number of transactions, must be at least 1
+    CheckRPCThrows("z_mergetoaddress [\"" + taddr1 + "\"] " + aSproutAddr + " 0.0001 100 100 AB 0",
+        "Number of transactions must be at least 1");
+
     // Mutable tx containing contextual information we need to build tx
     UniValue retValue = CallRPC("getblockcount");
     int nHeight = retValue.get_int();
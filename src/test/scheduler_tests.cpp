@@ -109,4 +109,61 @@ BOOST_AUTO_TEST_CASE(manythreads)
     BOOST_CHECK_EQUAL(counterSum, 200);
 }
 
+static void countTask(int& counter)
+{
+    counter++;
+}
+
+// Runs three times in a row, rescheduling itself while running, then cancels itself
+static void repeatTask(CScheduler& s, const CScheduler::TaskId& id, int& counter)
+{
+    if (++counter < 3)
+        BOOST_CHECK(s.reschedule(id, boost::chrono::system_clock::now()));
+    else
+        BOOST_CHECK(s.cancel(id));
+}
+
+BOOST_AUTO_TEST_CASE(cancel_reschedule)
+{
+    CScheduler s;
+    boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+    boost::chrono::system_clock::time_point later = now + boost::chrono::hours(1);
+
+    int counter[4] = {0, 0, 0, 0};
+    CScheduler::TaskId id0 = s.schedule(boost::bind(&countTask, boost::ref(counter[0])), now, "count");
+    CScheduler::TaskId id1 = s.schedule(boost::bind(&countTask, boost::ref(counter[1])), later, "count");
+    CScheduler::TaskId id2 = s.schedule(boost::bind(&countTask, boost::ref(counter[2])), later);
+    BOOST_CHECK(id0 != 0 && id1 != id0 && id2 != id1);
+
+    // Cancelled before it runs, and moved from an hour away to now
+    BOOST_CHECK(s.cancel(id0));
+    BOOST_CHECK(!s.cancel(id0));
+    BOOST_CHECK(s.reschedule(id1, now));
+
+    CScheduler::TaskId id3 = s.scheduleEvery(boost::bind(&repeatTask, boost::ref(s), boost::cref(id3), boost::ref(counter[3])), 3600, "repeat");
+
+    boost::chrono::system_clock::time_point first, last;
+    BOOST_CHECK_EQUAL(s.getQueueInfo(first, last), 3U);
+    BOOST_CHECK(s.cancel(id2));
+    BOOST_CHECK_EQUAL(s.getQueueInfo(first, last), 2U);
+    BOOST_CHECK(s.reschedule(id3, now));
+
+    boost::thread t(boost::bind(&CScheduler::serviceQueue, &s));
+    s.stop(true);
+    t.join();
+
+    BOOST_CHECK_EQUAL(counter[0], 0);
+    BOOST_CHECK_EQUAL(counter[1], 1);
+    BOOST_CHECK_EQUAL(counter[2], 0);
+    BOOST_CHECK_EQUAL(counter[3], 3);
+    // Finished tasks are unknown
+    BOOST_CHECK(!s.cancel(id1));
+    BOOST_CHECK(!s.reschedule(id3, now));
+
+    std::map<std::string, CScheduler::TaskStats> stats = s.getTaskStats();
+    BOOST_CHECK_EQUAL(stats.size(), 2U);
+    BOOST_CHECK_EQUAL(stats["count"].nRuns, 1U);
+    BOOST_CHECK_EQUAL(stats["repeat"].nRuns, 3U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
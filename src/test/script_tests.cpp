@@ -97,10 +97,18 @@ void DoTest(const CScript& scriptPubKey, const CScript& scriptSig, int flags, ui
     CMutableTransaction tx2 = tx;
     BOOST_CHECK_MESSAGE(VerifyScript(scriptSig, scriptPubKey, flags, MutableTransactionSignatureChecker(&tx, 0, txCredit.vout[0].nValue), consensusBranchId, &err) == expect, message);
     BOOST_CHECK_MESSAGE(expect == (err == SCRIPT_ERR_OK), std::string(ScriptErrorString(err)) + ": " + message);
+    // The standard template fast paths must agree with the interpreter
+    ScriptError errGeneric;
+    BOOST_CHECK_MESSAGE(VerifyScriptGeneric(scriptSig, scriptPubKey, flags, MutableTransactionSignatureChecker(&tx, 0, txCredit.vout[0].nValue), consensusBranchId, &errGeneric) == expect, "generic: " + message);
+    BOOST_CHECK_MESSAGE(err == errGeneric, std::string(ScriptErrorString(errGeneric)) + " (generic): " + message);
 #if defined(HAVE_CONSENSUS_LIB)
     CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
     stream << tx2;
     BOOST_CHECK_MESSAGE(zcashconsensus_verify_script(begin_ptr(scriptPubKey), scriptPubKey.size(), (const unsigned char*)&stream[0], stream.size(), 0, flags, NULL) == expect,message);
+    zcashconsensus_spent_output spent = {begin_ptr(scriptPubKey), (unsigned int)scriptPubKey.size(), txCredit.vout[0].nValue};
+    unsigned int nFailedIn = 1;
+    BOOST_CHECK_MESSAGE(zcashconsensus_verify_script_batch((const unsigned char*)&stream[0], stream.size(), &spent, 1, flags, consensusBranchId, 1, &nFailedIn, NULL) == expect, "batch: " + message);
+    BOOST_CHECK_MESSAGE(expect || nFailedIn == 0, "batch: " + message);
 #endif
 }
 
@@ -988,4 +996,86 @@ BOOST_AUTO_TEST_CASE(script_GetScriptAsm)
     BOOST_CHECK_EQUAL(derSig + "83 " + pubKey, ScriptToAsmStr(CScript() << ToByteVector(ParseHex(derSig + "83")) << vchPubKey));
 }
 
+static void CheckTemplateMatchesInterpreter(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags,
+                                            const CMutableTransaction& txTo, uint32_t consensusBranchId, bool expect)
+{
+    ScriptError err, errGeneric;
+    MutableTransactionSignatureChecker checker(&txTo, 0, 0);
+    bool fResult = VerifyScript(scriptSig, scriptPubKey, flags, checker, consensusBranchId, &err);
+    bool fGeneric = VerifyScriptGeneric(scriptSig, scriptPubKey, flags, checker, consensusBranchId, &errGeneric);
+    BOOST_CHECK_EQUAL(fResult, expect);
+    BOOST_CHECK_EQUAL(fResult, fGeneric);
+    BOOST_CHECK_MESSAGE(err == errGeneric, std::string(ScriptErrorString(err)) + " != " + ScriptErrorString(errGeneric));
+}
+
+// Parameterized testing over consensus branch ids
+BOOST_DATA_TEST_CASE(script_standard_templates, boost::unit_test::data::xrange(static_cast<int>(Consensus::MAX_NETWORK_UPGRADES)))
+{
+    uint32_t consensusBranchId = NetworkUpgradeInfo[sample].nBranchId;
+    const unsigned int vFlags[] = {
+        SCRIPT_VERIFY_NONE,
+        SCRIPT_VERIFY_P2SH,
+        STANDARD_SCRIPT_VERIFY_FLAGS,
+    };
+
+    CKey key1, key2, key3;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(false);
+    key3.MakeNewKey(true);
+
+    // P2PKH
+    CScript scriptP2PKH = GetScriptForDestination(key1.GetPubKey().GetID());
+    CMutableTransaction txFrom = BuildCreditingTransaction(scriptP2PKH);
+    CMutableTransaction txTo = BuildSpendingTransaction(CScript(), txFrom);
+    uint256 hash = SignatureHash(scriptP2PKH, txTo, 0, SIGHASH_ALL, 0, consensusBranchId);
+    std::vector<unsigned char> vchSig1, vchSig3;
+    BOOST_CHECK(key1.Sign(hash, vchSig1));
+    BOOST_CHECK(key3.Sign(hash, vchSig3));
+    vchSig1.push_back((unsigned char)SIGHASH_ALL);
+    vchSig3.push_back((unsigned char)SIGHASH_ALL);
+    std::vector<unsigned char> vchBadHashType(vchSig1);
+    vchBadHashType.back() = 0x21;
+
+    // 2-of-3 multisig, bare and through P2SH
+    CScript scriptMultisig;
+    scriptMultisig << OP_2 << ToByteVector(key1.GetPubKey()) << ToByteVector(key2.GetPubKey()) << ToByteVector(key3.GetPubKey()) << OP_3 << OP_CHECKMULTISIG;
+    CScript scriptP2SH = GetScriptForDestination(CScriptID(scriptMultisig));
+    std::vector<CKey> vGood, vWrongOrder, vWrongKey;
+    vGood.push_back(key1);
+    vGood.push_back(key3);
+    vWrongOrder.push_back(key3);
+    vWrongOrder.push_back(key1);
+    vWrongKey.push_back(key1);
+    vWrongKey.push_back(key1);
+    CScript multisigGood = sign_multisig(scriptMultisig, vGood, txTo, consensusBranchId);
+    CScript multisigWrongOrder = sign_multisig(scriptMultisig, vWrongOrder, txTo, consensusBranchId);
+    CScript multisigWrongKey = sign_multisig(scriptMultisig, vWrongKey, txTo, consensusBranchId);
+    CScript multisigDummy = multisigGood;
+    multisigDummy[0] = OP_1;
+
+    for (unsigned int flags : vFlags) {
+        bool fP2SH = (flags & SCRIPT_VERIFY_P2SH) != 0;
+        bool fNullDummy = (flags & SCRIPT_VERIFY_NULLDUMMY) != 0;
+        bool fCleanStack = (flags & SCRIPT_VERIFY_CLEANSTACK) != 0;
+
+        CheckTemplateMatchesInterpreter(CScript() << vchSig1 << ToByteVector(key1.GetPubKey()), scriptP2PKH, flags, txTo, consensusBranchId, true);
+        CheckTemplateMatchesInterpreter(CScript() << vchSig3 << ToByteVector(key1.GetPubKey()), scriptP2PKH, flags, txTo, consensusBranchId, false);
+        CheckTemplateMatchesInterpreter(CScript() << vchSig3 << ToByteVector(key3.GetPubKey()), scriptP2PKH, flags, txTo, consensusBranchId, false);
+        CheckTemplateMatchesInterpreter(CScript() << vchBadHashType << ToByteVector(key1.GetPubKey()), scriptP2PKH, flags, txTo, consensusBranchId, false);
+        CheckTemplateMatchesInterpreter(CScript() << ToByteVector(key1.GetPubKey()), scriptP2PKH, flags, txTo, consensusBranchId, false);
+        CheckTemplateMatchesInterpreter(CScript() << OP_0 << vchSig1 << ToByteVector(key1.GetPubKey()), scriptP2PKH, flags, txTo, consensusBranchId, !fCleanStack);
+
+        CheckTemplateMatchesInterpreter(multisigGood, scriptMultisig, flags, txTo, consensusBranchId, true);
+        CheckTemplateMatchesInterpreter(multisigWrongOrder, scriptMultisig, flags, txTo, consensusBranchId, false);
+        CheckTemplateMatchesInterpreter(multisigWrongKey, scriptMultisig, flags, txTo, consensusBranchId, false);
+        CheckTemplateMatchesInterpreter(multisigDummy, scriptMultisig, flags, txTo, consensusBranchId, !fNullDummy);
+
+        CScript redeem = CScript() << std::vector<unsigned char>(scriptMultisig.begin(), scriptMultisig.end());
+        CheckTemplateMatchesInterpreter(multisigGood + redeem, scriptP2SH, flags, txTo, consensusBranchId, true);
+        CheckTemplateMatchesInterpreter(multisigWrongOrder + redeem, scriptP2SH, flags, txTo, consensusBranchId, !fP2SH);
+        CheckTemplateMatchesInterpreter(multisigWrongKey + redeem, scriptP2SH, flags, txTo, consensusBranchId, !fP2SH);
+        CheckTemplateMatchesInterpreter(multisigDummy + redeem, scriptP2SH, flags, txTo, consensusBranchId, !fNullDummy);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,70 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stratum.h"
+
+#include "chainparams.h"
+#include "primitives/block.h"
+#include "test/test_bitcoin.h"
+#include "utilstrencodings.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(stratum_tests, BasicTestingSetup)
+
+//! Whether a is b up to the rounding of the thousandths of a difficulty
+static bool IsNear(const arith_uint256& a, const arith_uint256& b)
+{
+    return a <= b + 1000 && a + 1000 >= b;
+}
+
+BOOST_AUTO_TEST_CASE(stratum_target)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    arith_uint256 powLimit = UintToArith256(params.powLimit);
+    BOOST_CHECK(IsNear(GetStratumTarget(1, params), powLimit));
+    BOOST_CHECK(IsNear(GetStratumTarget(4, params), powLimit / 4));
+    BOOST_CHECK(GetStratumTarget(8, params) < GetStratumTarget(2, params));
+    // Below 1, shares easier than the proof of work limit
+    BOOST_CHECK(GetStratumTarget(0.5, params) > powLimit);
+    BOOST_CHECK(GetStratumTarget(0, params) == GetStratumTarget(0.001, params));
+}
+
+BOOST_AUTO_TEST_CASE(stratum_submit)
+{
+    const CBlock& genesis = Params().GenesisBlock();
+    UniValue notify = StratumNotifyParams("1f", genesis, true);
+    BOOST_CHECK_EQUAL(notify.size(), 8U);
+    BOOST_CHECK_EQUAL(notify[0].get_str(), "1f");
+    BOOST_CHECK_EQUAL(notify[2].get_str(), HexStr(genesis.hashPrevBlock.begin(), genesis.hashPrevBlock.end()));
+    BOOST_CHECK(notify[7].get_bool());
+
+    // The miner sends back the time of the job, the nonce past NONCE_1 and
+    // the solution, which are the genesis block's own
+    std::vector<unsigned char> vNonce1(genesis.nNonce.begin(), genesis.nNonce.begin() + STRATUM_NONCE1_SIZE);
+    std::string strNonce2 = HexStr(genesis.nNonce.begin() + STRATUM_NONCE1_SIZE, genesis.nNonce.end());
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << genesis.nSolution;
+    std::string strSolution = HexStr(ss.begin(), ss.end());
+
+    CBlockHeader job = genesis.GetBlockHeader();
+    job.nNonce.SetNull();
+    job.nSolution.clear();
+    CBlockHeader header;
+    std::string strError;
+    BOOST_CHECK(StratumSubmitHeader(job, vNonce1, notify[5].get_str(), strNonce2, strSolution, header, strError));
+    BOOST_CHECK(header.GetHash() == genesis.GetHash());
+
+    BOOST_CHECK(!StratumSubmitHeader(job, vNonce1, "0000", strNonce2, strSolution, header, strError));
+    BOOST_CHECK_EQUAL(strError, "Malformed time");
+    BOOST_CHECK(!StratumSubmitHeader(job, vNonce1, notify[5].get_str(), strNonce2 + "00", strSolution, header, strError));
+    BOOST_CHECK_EQUAL(strError, "Malformed nonce");
+    BOOST_CHECK(!StratumSubmitHeader(job, vNonce1, notify[5].get_str(), strNonce2, strSolution + "00", header, strError));
+    BOOST_CHECK_EQUAL(strError, "Malformed solution");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
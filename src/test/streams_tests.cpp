@@ -2,6 +2,8 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "primitives/block.h"
+#include "random.h"
 #include "streams.h"
 #include "support/allocators/zeroafterfree.h"
 #include "test/test_bitcoin.h"
@@ -64,4 +66,63 @@ BOOST_AUTO_TEST_CASE(streams_serializedata_xor)
             std::string(ds.begin(), ds.end()));  
 }         
 
+BOOST_AUTO_TEST_CASE(streams_span_reader)
+{
+    // A Sapling transaction, whose proofs and ciphertexts make up most of it
+    CMutableTransaction mtx;
+    mtx.fOverwintered = true;
+    mtx.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+    mtx.nVersion = SAPLING_TX_VERSION;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1;
+    mtx.vShieldedSpend.resize(1);
+    mtx.vShieldedOutput.resize(2);
+    GetRandBytes(mtx.vShieldedSpend[0].zkproof.begin(), mtx.vShieldedSpend[0].zkproof.size());
+    for (OutputDescription& output : mtx.vShieldedOutput) {
+        GetRandBytes(output.encCiphertext.begin(), output.encCiphertext.size());
+        GetRandBytes(output.outCiphertext.begin(), output.outCiphertext.size());
+        GetRandBytes(output.zkproof.begin(), output.zkproof.size());
+    }
+    GetRandBytes(mtx.bindingSig.begin(), mtx.bindingSig.size());
+    CTransaction tx(mtx);
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(tx));
+    block.vtx.push_back(MakeTransactionRef(mtx));
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block << tx;
+
+    // Transactions read in place are hashed from their bytes, and get the
+    // same hash as serializing them again would
+    CSpanReader reader(ss);
+    CBlock blockRead;
+    CTransactionRef ptx;
+    reader >> blockRead >> ptx;
+    BOOST_CHECK(reader.empty());
+    BOOST_CHECK_EQUAL(reader.consumed(), ss.size());
+    BOOST_REQUIRE_EQUAL(blockRead.vtx.size(), 2);
+    BOOST_CHECK(blockRead.vtx[0]->GetHash() == tx.GetHash());
+    BOOST_CHECK(blockRead.vtx[1]->GetHash() == tx.GetHash());
+    BOOST_CHECK(ptx->GetHash() == tx.GetHash());
+    BOOST_CHECK(ptx->bindingSig == tx.bindingSig);
+    BOOST_CHECK(ptx->vShieldedOutput[1].zkproof == tx.vShieldedOutput[1].zkproof);
+    BOOST_CHECK(blockRead.BuildMerkleTree() == block.BuildMerkleTree());
+
+    // The viewed bytes are untouched
+    CDataStream ssCopy(ss);
+    CTransaction txCopy;
+    ssCopy.ignore(::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    ssCopy >> txCopy;
+    BOOST_CHECK(txCopy.GetHash() == tx.GetHash());
+
+    uint8_t n;
+    BOOST_CHECK_THROW(reader >> n, std::ios_base::failure);
+    CDataStream ssEmpty(SER_NETWORK, PROTOCOL_VERSION);
+    CSpanReader readerEmpty(ssEmpty);
+    BOOST_CHECK(readerEmpty.empty());
+    BOOST_CHECK_THROW(readerEmpty >> n, std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,97 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sync.h"
+#include "test/test_bitcoin.h"
+#include "utiltime.h"
+
+#include <atomic>
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sync_tests, BasicTestingSetup)
+
+/** The statistics of the lock site at nLine of this file */
+static CLockSiteStats FindSite(int nLine)
+{
+    BOOST_FOREACH(const CLockSiteStats& stats, GetLockSiteStats()) {
+        if (stats.strFile == __FILE__ && stats.nLine == nLine)
+            return stats;
+    }
+    BOOST_ERROR("no lock site at line " << nLine);
+    return CLockSiteStats();
+}
+
+BOOST_AUTO_TEST_CASE(lockstats_uncontended)
+{
+    CCriticalSection cs;
+    int nLine = 0;
+    for (int i = 0; i < 3; i++) {
+        nLine = __LINE__; LOCK(cs);
+    }
+    CLockSiteStats stats = FindSite(nLine);
+    BOOST_CHECK_EQUAL(stats.strName, "cs");
+    BOOST_CHECK_EQUAL(stats.nAcquired, 3);
+    BOOST_CHECK_EQUAL(stats.nContended, 0);
+    BOOST_CHECK_EQUAL(stats.nWaitMicros, 0);
+
+    // Recursive and try locks count as acquisitions too
+    LOCK(cs);
+    int nTryLine = __LINE__; TRY_LOCK(cs, lockTry);
+    BOOST_CHECK(bool(lockTry));
+    BOOST_CHECK_EQUAL(FindSite(nTryLine).nAcquired, 1);
+}
+
+BOOST_AUTO_TEST_CASE(lockstats_contended)
+{
+    CCriticalSection cs;
+    std::atomic<bool> fLocked(false);
+    int nHolderLine = 0;
+    boost::thread holder([&]() {
+        nHolderLine = __LINE__; LOCK(cs);
+        fLocked = true;
+        MilliSleep(50);
+    });
+    while (!fLocked)
+        MilliSleep(1);
+
+    int nLine = __LINE__; TRY_LOCK(cs, lockTry);
+    BOOST_CHECK(!bool(lockTry));
+    int nWaitLine = 0;
+    {
+        nWaitLine = __LINE__; LOCK(cs);
+    }
+    holder.join();
+
+    // A failed try is neither an acquisition nor a wait
+    BOOST_CHECK_EQUAL(FindSite(nLine).nAcquired, 0);
+    BOOST_CHECK_EQUAL(FindSite(nLine).nContended, 0);
+
+    CLockSiteStats stats = FindSite(nWaitLine);
+    BOOST_CHECK_EQUAL(stats.nAcquired, 1);
+    BOOST_CHECK_EQUAL(stats.nContended, 1);
+    BOOST_CHECK(stats.nWaitMicros > 0);
+    BOOST_CHECK_EQUAL(stats.nMaxWaitMicros, stats.nWaitMicros);
+    uint64_t nBuckets = 0;
+    for (int i = 0; i < CLockSite::WAIT_BUCKETS; i++)
+        nBuckets += stats.waitBuckets[i];
+    BOOST_CHECK_EQUAL(nBuckets, 1);
+
+    BOOST_CHECK(FindSite(nHolderLine).nHoldMicros >= 40000);
+
+    // Sites are summed by lock name too
+    bool fFound = false;
+    BOOST_FOREACH(const CLockSiteStats& lockStats, GetLockSiteStats(true)) {
+        if (lockStats.strName == "cs") {
+            fFound = true;
+            BOOST_CHECK(lockStats.strFile.empty());
+            BOOST_CHECK(lockStats.nContended >= 1);
+        }
+    }
+    BOOST_CHECK(fFound);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
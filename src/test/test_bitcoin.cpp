@@ -8,6 +8,7 @@
 #include "test_bitcoin.h"
 
 #include "crypto/common.h"
+#include "crypto/sha256.h"
 
 #include "key.h"
 #include "main.h"
@@ -76,6 +77,7 @@ JoinSplitTestingSetup::~JoinSplitTestingSetup()
 BasicTestingSetup::BasicTestingSetup()
 {
     assert(init_and_check_sodium() != -1);
+    SHA256AutoDetect();
     ECC_Start();
     SetupEnvironment();
     SetupNetworking();
@@ -153,7 +155,13 @@ TestingSetup::~TestingSetup()
 CTxMemPoolEntry TestMemPoolEntryHelper::FromTx(CMutableTransaction &tx, CTxMemPool *pool) {
     return CTxMemPoolEntry(tx, nFee, nTime, dPriority, nHeight,
                            pool ? pool->HasNoInputsOf(tx) : hadNoDependencies,
-                           spendsCoinbase, nBranchId);
+                           spendsCoinbase, sigOpCount, nBranchId);
+}
+
+CTxMemPoolEntry TestMemPoolEntryHelper::FromTx(const CTransactionRef &ptx, CTxMemPool *pool) {
+    return CTxMemPoolEntry(ptx, nFee, nTime, dPriority, nHeight,
+                           pool ? pool->HasNoInputsOf(*ptx) : hadNoDependencies,
+                           spendsCoinbase, sigOpCount, nBranchId);
 }
 
 void Shutdown(void* parg)
@@ -30,7 +30,6 @@ struct JoinSplitTestingSetup: public BasicTestingSetup {
  */
 class CConnman;
 struct TestingSetup: public JoinSplitTestingSetup {
-    CCoinsViewDB *pcoinsdbview;
     boost::filesystem::path orig_current_path;
     boost::filesystem::path pathTemp;
     boost::thread_group threadGroup;
@@ -52,14 +51,16 @@ struct TestMemPoolEntryHelper
     unsigned int nHeight;
     bool hadNoDependencies;
     bool spendsCoinbase;
+    unsigned int sigOpCount;
     uint32_t nBranchId;
 
     TestMemPoolEntryHelper() :
         nFee(0), nTime(0), dPriority(0.0), nHeight(1),
-        hadNoDependencies(false), spendsCoinbase(false),
+        hadNoDependencies(false), spendsCoinbase(false), sigOpCount(1),
         nBranchId(SPROUT_BRANCH_ID) { }
 
     CTxMemPoolEntry FromTx(CMutableTransaction &tx, CTxMemPool *pool = NULL);
+    CTxMemPoolEntry FromTx(const CTransactionRef &ptx, CTxMemPool *pool = NULL);
 
     // Change the default value
     TestMemPoolEntryHelper &Fee(CAmount _fee) { nFee = _fee; return *this; }
@@ -68,6 +69,7 @@ struct TestMemPoolEntryHelper
     TestMemPoolEntryHelper &Height(unsigned int _height) { nHeight = _height; return *this; }
     TestMemPoolEntryHelper &HadNoDependencies(bool _hnd) { hadNoDependencies = _hnd; return *this; }
     TestMemPoolEntryHelper &SpendsCoinbase(bool _flag) { spendsCoinbase = _flag; return *this; }
+    TestMemPoolEntryHelper &SigOps(unsigned int _sigops) { sigOpCount = _sigops; return *this; }
     TestMemPoolEntryHelper &BranchId(uint32_t _branchId) { nBranchId = _branchId; return *this; }
 };
 #endif
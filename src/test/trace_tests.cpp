@@ -0,0 +1,55 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "trace.h"
+#include "arith_uint256.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(trace_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(trace_ring)
+{
+    std::vector<uint256> hashes;
+    for (int i = 0; i < 5; i++)
+        hashes.push_back(ArithToUint256(arith_uint256(i + 1)));
+
+    // Disabled by default
+    Trace(TRACE_TX_RECEIVED, hashes[0]);
+    BOOST_CHECK(GetTraces(NULL, 0, 100).empty());
+
+    SetTraceBufferSize(3);
+    for (int i = 0; i < 5; i++)
+        Trace(TRACE_TX_RECEIVED, hashes[i], i, -1, 10 * i);
+
+    // Only the last three are kept, oldest first
+    std::vector<CTraceEntry> traces = GetTraces(NULL, 0, 100);
+    BOOST_CHECK_EQUAL(traces.size(), 3);
+    for (int i = 0; i < 3; i++) {
+        BOOST_CHECK(traces[i].hash == hashes[i + 2]);
+        BOOST_CHECK_EQUAL(traces[i].nPeer, i + 2);
+        BOOST_CHECK_EQUAL(traces[i].nDuration, 10 * (i + 2));
+    }
+    BOOST_CHECK(traces[0].nTime <= traces[2].nTime);
+
+    // count returns the latest
+    traces = GetTraces(NULL, 0, 1);
+    BOOST_CHECK_EQUAL(traces.size(), 1);
+    BOOST_CHECK(traces[0].hash == hashes[4]);
+
+    traces = GetTraces(&hashes[3], 0, 100);
+    BOOST_CHECK_EQUAL(traces.size(), 1);
+    BOOST_CHECK_EQUAL(traces[0].nPeer, 3);
+    BOOST_CHECK(GetTraces(&hashes[0], 0, 100).empty());
+    BOOST_CHECK(GetTraces(NULL, traces[0].nTime + 1000000000, 100).empty());
+
+    BOOST_CHECK_EQUAL(std::string(GetTraceEventName(TRACE_BLOCK_PREVALIDATED)), "block_prevalidated");
+
+    SetTraceBufferSize(0);
+    Trace(TRACE_TX_RECEIVED, hashes[0]);
+    BOOST_CHECK(GetTraces(NULL, 0, 100).empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -283,6 +283,24 @@ BOOST_AUTO_TEST_CASE(basic_transaction_tests)
     // Check that duplicate txins fail
     tx.vin.push_back(tx.vin[0]);
     BOOST_CHECK_MESSAGE(!CheckTransaction(tx, state, verifier) || !state.IsValid(), "Transaction with duplicate txins should be invalid.");
+
+    // What is kept along with the hash matches what it is derived from,
+    // whether the transaction was built or read
+    CTransaction txBuilt(tx);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << txBuilt;
+    CTransaction txRead;
+    ss >> txRead;
+    unsigned int nSigOps = 0;
+    for (const CTxIn& txin : tx.vin)
+        nSigOps += txin.scriptSig.GetSigOpCount(false);
+    for (const CTxOut& txout : tx.vout)
+        nSigOps += txout.scriptPubKey.GetSigOpCount(false);
+    for (const CTransaction& t : {txBuilt, txRead}) {
+        BOOST_CHECK_EQUAL(t.GetTotalSize(), ::GetSerializeSize(txBuilt, SER_NETWORK, PROTOCOL_VERSION));
+        BOOST_CHECK_EQUAL(t.GetLegacySigOpCount(), nSigOps);
+    }
+    BOOST_CHECK_EQUAL(nSigOps, 2U);
 }
 
 //
@@ -311,14 +329,14 @@ SetupDummyInputs(CBasicKeyStore& keystoreRet, CCoinsViewCache& coinsRet)
     dummyTransactions[0].vout[0].scriptPubKey << ToByteVector(key[0].GetPubKey()) << OP_CHECKSIG;
     dummyTransactions[0].vout[1].nValue = 50*CENT;
     dummyTransactions[0].vout[1].scriptPubKey << ToByteVector(key[1].GetPubKey()) << OP_CHECKSIG;
-    coinsRet.ModifyCoins(dummyTransactions[0].GetHash())->FromTx(dummyTransactions[0], 0);
+    AddCoins(coinsRet, dummyTransactions[0], 0);
 
     dummyTransactions[1].vout.resize(2);
     dummyTransactions[1].vout[0].nValue = 21*CENT;
     dummyTransactions[1].vout[0].scriptPubKey = GetScriptForDestination(key[2].GetPubKey().GetID());
     dummyTransactions[1].vout[1].nValue = 22*CENT;
     dummyTransactions[1].vout[1].scriptPubKey = GetScriptForDestination(key[3].GetPubKey().GetID());
-    coinsRet.ModifyCoins(dummyTransactions[1].GetHash())->FromTx(dummyTransactions[1], 0);
+    AddCoins(coinsRet, dummyTransactions[1], 0);
 
     return dummyTransactions;
 }
@@ -720,19 +738,13 @@ BOOST_AUTO_TEST_CASE(test_big_overwinter_transaction) {
     for (int i=0; i<20; i++)
         threadGroup.create_thread(boost::bind(&CCheckQueue<CScriptCheck>::Thread, boost::ref(scriptcheckqueue)));
 
-    CCoins coins;
-    coins.nVersion = 1;
-    coins.fCoinBase = false;
-    for(uint32_t i = 0; i < mtx.vin.size(); i++) {
-        CTxOut txout;
-        txout.nValue = 1000;
-        txout.scriptPubKey = scriptPubKey;
-        coins.vout.push_back(txout);
-    }
+    CTxOut txout;
+    txout.nValue = 1000;
+    txout.scriptPubKey = scriptPubKey;
 
     for(uint32_t i = 0; i < mtx.vin.size(); i++) {
         std::vector<CScriptCheck> vChecks;
-        CScriptCheck check(coins, tx, i, SCRIPT_VERIFY_P2SH, false, consensusBranchId, &txdata);
+        CScriptCheck check(txout, tx, i, SCRIPT_VERIFY_P2SH, false, consensusBranchId, &txdata);
         vChecks.push_back(CScriptCheck());
         check.swap(vChecks.back());
         control.Add(vChecks);
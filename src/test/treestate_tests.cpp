@@ -0,0 +1,47 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "treestate.h"
+
+#include "chain.h"
+#include "main.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(treestate_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(treestate_genesis)
+{
+    LOCK(cs_main);
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+    BOOST_CHECK(GetTreeStateAt(chainActive.Tip(), sproutTree, saplingTree));
+    BOOST_CHECK(sproutTree.root() == SproutMerkleTree::empty_root());
+    BOOST_CHECK(saplingTree.root() == SaplingMerkleTree::empty_root());
+
+    BOOST_CHECK(!GetTreeStateAt(NULL, sproutTree, saplingTree));
+}
+
+BOOST_AUTO_TEST_CASE(treestate_witness_not_found)
+{
+    const CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        pindex = chainActive.Tip();
+    }
+    std::string strError;
+    SaplingWitness saplingWitness;
+    BOOST_CHECK(!BuildSaplingWitness(GetRandHash(), pindex, pindex, saplingWitness, strError));
+    BOOST_CHECK_EQUAL(strError, "Note commitment not found in its block");
+
+    SproutWitness sproutWitness;
+    BOOST_CHECK(!BuildSproutWitness(GetRandHash(), pindex, pindex, sproutWitness, strError));
+    BOOST_CHECK_EQUAL(strError, "Note commitment not found in its block");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
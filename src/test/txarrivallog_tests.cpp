@@ -0,0 +1,73 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txarrivallog.h"
+
+#include "chain.h"
+#include "main.h"
+#include "primitives/transaction.h"
+#include "test/test_bitcoin.h"
+
+#include <stdio.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+static CTransaction MakeTx(int n)
+{
+    CMutableTransaction mtx;
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = n;
+    mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    return CTransaction(mtx);
+}
+
+BOOST_FIXTURE_TEST_SUITE(txarrivallog_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(txarrivallog_roundtrip)
+{
+    boost::filesystem::path path = pathTemp / "arrivals.log";
+    BOOST_CHECK(OpenTxArrivalLog(path));
+    RecordTxArrival(MakeTx(1), 1000);
+    RecordTxArrival(MakeTx(2), 2500);
+    CloseTxArrivalLog();
+    // Nothing is recorded once closed
+    RecordTxArrival(MakeTx(3), 3000);
+
+    uint256 hashTip;
+    int nHeight;
+    std::vector<CTxArrival> vArrivals;
+    std::string strError;
+    BOOST_CHECK(ReadTxArrivalLog(path, hashTip, nHeight, vArrivals, strError));
+    BOOST_CHECK(hashTip == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK_EQUAL(nHeight, chainActive.Height());
+    BOOST_CHECK_EQUAL(vArrivals.size(), 2);
+    BOOST_CHECK_EQUAL(vArrivals[0].nTime, 1000);
+    BOOST_CHECK(vArrivals[0].tx->GetHash() == MakeTx(1).GetHash());
+    BOOST_CHECK_EQUAL(vArrivals[1].nTime, 2500);
+    BOOST_CHECK(vArrivals[1].tx->GetHash() == MakeTx(2).GetHash());
+
+    // A record cut short is left out
+    boost::filesystem::resize_file(path, boost::filesystem::file_size(path) - 3);
+    BOOST_CHECK(ReadTxArrivalLog(path, hashTip, nHeight, vArrivals, strError));
+    BOOST_CHECK_EQUAL(vArrivals.size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(txarrivallog_invalid)
+{
+    uint256 hashTip;
+    int nHeight;
+    std::vector<CTxArrival> vArrivals;
+    std::string strError;
+    BOOST_CHECK(!ReadTxArrivalLog(pathTemp / "missing.log", hashTip, nHeight, vArrivals, strError));
+
+    // Opened, but no transaction came
+    boost::filesystem::path path = pathTemp / "empty.log";
+    BOOST_CHECK(OpenTxArrivalLog(path));
+    CloseTxArrivalLog();
+    BOOST_CHECK(!ReadTxArrivalLog(path, hashTip, nHeight, vArrivals, strError));
+    BOOST_CHECK_EQUAL(strError, strprintf("%s has no transactions recorded", path.string()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,87 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txindexcache.h"
+
+#include "primitives/transaction.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+static CTransaction RandomTransaction()
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = insecure_rand() % 1000000;
+    mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    return CTransaction(mtx);
+}
+
+BOOST_FIXTURE_TEST_SUITE(txindexcache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(txindexcache_get)
+{
+    CTxIndexCache cache;
+    CTransaction tx = RandomTransaction();
+    uint256 hashBlock = GetRandHash();
+    CTransaction txOut;
+    uint256 hashBlockOut;
+
+    // Disabled until given a limit
+    cache.Put(tx, hashBlock);
+    BOOST_CHECK(!cache.Get(tx.GetHash(), txOut, hashBlockOut));
+    BOOST_CHECK_EQUAL(cache.size(), 0U);
+
+    cache.SetLimit(1 << 20);
+    cache.Put(tx, hashBlock);
+    BOOST_CHECK(cache.Get(tx.GetHash(), txOut, hashBlockOut));
+    BOOST_CHECK(txOut == tx);
+    BOOST_CHECK(hashBlockOut == hashBlock);
+    BOOST_CHECK(!cache.Get(GetRandHash(), txOut, hashBlockOut));
+
+    uint64_t nHits, nMisses;
+    cache.GetStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nHits, 1U);
+    BOOST_CHECK_EQUAL(nMisses, 1U);
+
+    cache.Erase(tx.GetHash());
+    BOOST_CHECK(!cache.Get(tx.GetHash(), txOut, hashBlockOut));
+    BOOST_CHECK_EQUAL(cache.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(txindexcache_eviction)
+{
+    seed_insecure_rand(true);
+    CTxIndexCache cache;
+    cache.SetLimit(64 * 1024);
+
+    std::vector<CTransaction> vTx;
+    for (int i = 0; i < 1000; i++) {
+        vTx.push_back(RandomTransaction());
+        cache.Put(vTx.back(), uint256());
+        // A lookup keeps the first transaction the most recently used
+        CTransaction txOut;
+        uint256 hashBlockOut;
+        BOOST_CHECK(cache.Get(vTx[0].GetHash(), txOut, hashBlockOut));
+    }
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= 64 * 1024 + 16 * 1024);
+    BOOST_CHECK(cache.size() < vTx.size());
+
+    // The newest are kept and the oldest dropped, except the one looked up
+    CTransaction txOut;
+    uint256 hashBlockOut;
+    BOOST_CHECK(cache.Get(vTx.back().GetHash(), txOut, hashBlockOut));
+    BOOST_CHECK(!cache.Get(vTx[1].GetHash(), txOut, hashBlockOut));
+
+    // Shrinking drops the rest
+    cache.SetLimit(0);
+    BOOST_CHECK_EQUAL(cache.size(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -488,4 +488,33 @@ BOOST_AUTO_TEST_CASE(test_ParseFixedPoint)
     BOOST_CHECK(!ParseFixedPoint("1.", 8, &amount));
 }
 
+BOOST_AUTO_TEST_CASE(util_LogRateLimit)
+{
+    fDebug = true;
+    mapMultiArgs["-debug"] = std::vector<std::string>(1, "net");
+    nLogRateLimit = 3;
+
+    // -debug is cached per thread, so read it from a fresh one
+    int nAccepted = 0;
+    bool fOtherCategory = true;
+    boost::thread thread([&] {
+        for (int i = 0; i < 20; i++) {
+            if (LogAcceptCategory("net"))
+                nAccepted++;
+        }
+        fOtherCategory = LogAcceptCategory("mempool");
+    });
+    thread.join();
+
+    nLogRateLimit = DEFAULT_LOG_RATE_LIMIT;
+    mapMultiArgs.erase("-debug");
+    fDebug = false;
+
+    // The loop may straddle a second
+    BOOST_CHECK(nAccepted >= 3 && nAccepted <= 6);
+    BOOST_CHECK(!fOtherCategory);
+    // Uncategorized messages are never limited
+    BOOST_CHECK(LogAcceptCategory(NULL));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,93 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "trace.h"
+
+#include "util.h"
+#include "utiltime.h"
+
+#include <atomic>
+#include <mutex>
+
+namespace {
+
+std::mutex cs_trace;
+//! Ring of trace points; nNextTrace is where the next one goes
+std::vector<CTraceEntry> vTraces;
+size_t nNextTrace = 0;
+bool fTracesWrapped = false;
+std::atomic<size_t> nTraceBufferSize(0);
+
+} // namespace
+
+void SetTraceBufferSize(size_t nSize)
+{
+    std::unique_lock<std::mutex> lock(cs_trace);
+    std::vector<CTraceEntry>().swap(vTraces);
+    vTraces.reserve(nSize);
+    nNextTrace = 0;
+    fTracesWrapped = false;
+    nTraceBufferSize = nSize;
+}
+
+void Trace(TraceEvent event, const uint256& hash, int nPeer, int nHeight, int64_t nDuration)
+{
+    if (nTraceBufferSize == 0)
+        return;
+
+    CTraceEntry entry;
+    entry.nTime = GetTimeMicros();
+    entry.event = event;
+    entry.hash = hash;
+    entry.nPeer = nPeer;
+    entry.nHeight = nHeight;
+    entry.nDuration = nDuration;
+    if (LogAcceptCategory("trace")) {
+        LogPrintf("trace %s %s peer=%d height=%d duration=%.3fms\n", GetTraceEventName(event), hash.ToString(),
+                  nPeer, nHeight, nDuration * 0.001);
+    }
+
+    std::unique_lock<std::mutex> lock(cs_trace);
+    if (vTraces.size() < nTraceBufferSize) {
+        vTraces.push_back(entry);
+        nNextTrace = vTraces.size() % nTraceBufferSize;
+    } else {
+        vTraces[nNextTrace] = entry;
+        nNextTrace = (nNextTrace + 1) % vTraces.size();
+        fTracesWrapped = true;
+    }
+}
+
+const char* GetTraceEventName(TraceEvent event)
+{
+    switch (event) {
+    case TRACE_BLOCK_HEADER_RECEIVED: return "block_header_received";
+    case TRACE_BLOCK_RECEIVED: return "block_received";
+    case TRACE_BLOCK_PREVALIDATED: return "block_prevalidated";
+    case TRACE_BLOCK_CONNECTED: return "block_connected";
+    case TRACE_BLOCK_TIP_UPDATED: return "block_tip_updated";
+    case TRACE_BLOCK_RELAYED: return "block_relayed";
+    case TRACE_TX_RECEIVED: return "tx_received";
+    case TRACE_TX_ACCEPTED: return "tx_accepted";
+    case TRACE_TX_RELAYED: return "tx_relayed";
+    case TRACE_TX_MINED: return "tx_mined";
+    }
+    return "unknown";
+}
+
+std::vector<CTraceEntry> GetTraces(const uint256* phash, int64_t nSince, size_t nMax)
+{
+    std::vector<CTraceEntry> vResult;
+    std::unique_lock<std::mutex> lock(cs_trace);
+    size_t nStart = fTracesWrapped ? nNextTrace : 0;
+    for (size_t i = 0; i < vTraces.size(); i++) {
+        const CTraceEntry& entry = vTraces[(nStart + i) % vTraces.size()];
+        if (entry.nTime < nSince || (phash && entry.hash != *phash))
+            continue;
+        vResult.push_back(entry);
+    }
+    if (vResult.size() > nMax)
+        vResult.erase(vResult.begin(), vResult.end() - nMax);
+    return vResult;
+}
@@ -0,0 +1,54 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TRACE_H
+#define BITCOIN_TRACE_H
+
+#include "uint256.h"
+
+#include <stdint.h>
+#include <vector>
+
+/** Default for -tracebuffer, the number of trace points kept */
+static const unsigned int DEFAULT_TRACE_BUFFER = 10000;
+
+/** Points in the life of a block or a transaction that are traced */
+enum TraceEvent
+{
+    TRACE_BLOCK_HEADER_RECEIVED,    //!< A header new to us, from any source
+    TRACE_BLOCK_RECEIVED,           //!< A block, before it is checked
+    TRACE_BLOCK_PREVALIDATED,       //!< Checked and stored; the duration is since it was received
+    TRACE_BLOCK_CONNECTED,          //!< Connected to the tip; the duration is ConnectTip's
+    TRACE_BLOCK_TIP_UPDATED,        //!< The tip moved to the block
+    TRACE_BLOCK_RELAYED,            //!< Announced to the peers
+    TRACE_TX_RECEIVED,
+    TRACE_TX_ACCEPTED,              //!< Accepted to the mempool; the duration is the acceptance's
+    TRACE_TX_RELAYED,
+    TRACE_TX_MINED,                 //!< In a connected block, outside initial block download
+};
+
+/** One trace point. Times are microseconds since the epoch, so that the traces of nodes can be compared. */
+struct CTraceEntry
+{
+    int64_t nTime;
+    TraceEvent event;
+    uint256 hash;
+    int nPeer;              //!< The peer it came from, or -1
+    int nHeight;            //!< The height of the block, or -1
+    int64_t nDuration;      //!< In microseconds, where the event has one
+};
+
+/** Keep the last nSize trace points, dropping those kept; 0 disables tracing */
+void SetTraceBufferSize(size_t nSize);
+
+/** Record a trace point, if tracing is enabled. Also logged in the "trace" debug category. */
+void Trace(TraceEvent event, const uint256& hash, int nPeer = -1, int nHeight = -1, int64_t nDuration = 0);
+
+/** The name of an event as gettraces reports it */
+const char* GetTraceEventName(TraceEvent event);
+
+/** The kept trace points from nSince on, optionally only those of hash, oldest first and at most nMax of the newest */
+std::vector<CTraceEntry> GetTraces(const uint256* phash, int64_t nSince, size_t nMax);
+
+#endif // BITCOIN_TRACE_H
@@ -7,19 +7,30 @@
 #include "main.h"
 #include "pubkey.h"
 #include "script/sign.h"
+#include "support/cleanse.h"
+
+#include <algorithm>
 
 #include <boost/variant.hpp>
 #include <librustzcash.h>
 
 SpendDescriptionInfo::SpendDescriptionInfo(
     libzcash::SaplingExpandedSpendingKey expsk,
+    libzcash::SaplingFullViewingKey fvk,
     libzcash::SaplingNote note,
     uint256 anchor,
-    SaplingWitness witness) : expsk(expsk), note(note), anchor(anchor), witness(witness)
+    SaplingWitness witness) : expsk(expsk), fvk(fvk), note(note), anchor(anchor), witness(witness)
 {
     librustzcash_sapling_generate_r(alpha.begin());
 }
 
+SpendDescriptionInfo::~SpendDescriptionInfo()
+{
+    // The spending key is a plain value, wiped like the wallet's decrypted keys
+    memory_cleanse(&expsk, sizeof(expsk));
+    memory_cleanse(alpha.begin(), alpha.size());
+}
+
 TransactionBuilder::TransactionBuilder(
     const Consensus::Params& consensusParams,
     int nHeight,
@@ -46,7 +57,13 @@ bool TransactionBuilder::AddSaplingSpend(
         }
     }
 
-    spends.emplace_back(expsk, note, anchor, witness);
+    // Spends of many notes usually share one key, so look at the latest first
+    auto same = std::find_if(spends.rbegin(), spends.rend(), [&expsk](const SpendDescriptionInfo& spend) {
+        return spend.expsk == expsk;
+    });
+    auto fvk = same != spends.rend() ? same->fvk : expsk.full_viewing_key();
+
+    spends.emplace_back(expsk, fvk, note, anchor, witness);
     mtx.valueBalance += note.value();
     return true;
 }
@@ -143,10 +160,9 @@ boost::optional<CTransaction> TransactionBuilder::Build()
             // tChangeAddr has already been validated.
             assert(AddTransparentOutput(tChangeAddr.value(), change));
         } else if (!spends.empty()) {
-            auto fvk = spends[0].expsk.full_viewing_key();
             auto note = spends[0].note;
             libzcash::SaplingPaymentAddress changeAddr(note.d, note.pk_d);
-            AddSaplingOutput(fvk.ovk, changeAddr, change);
+            AddSaplingOutput(spends[0].fvk.ovk, changeAddr, change);
         } else {
             return boost::none;
         }
@@ -156,33 +172,58 @@ boost::optional<CTransaction> TransactionBuilder::Build()
     // Sapling spends and outputs
     //
 
-    auto ctx = librustzcash_sapling_proving_ctx_init();
-
-    // Create Sapling SpendDescriptions
-    for (auto spend : spends) {
+    // Everything that can fail, other than the proofs themselves, is worked
+    // out before any proof is made, so that a bad note can't waste minutes
+    // of proving.
+    std::vector<uint256> spendNullifiers;
+    std::vector<std::vector<unsigned char>> spendWitnesses;
+    for (const SpendDescriptionInfo& spend : spends) {
         auto cm = spend.note.cm();
-        auto nf = spend.note.nullifier(
-            spend.expsk.full_viewing_key(), spend.witness.position());
+        auto nf = spend.note.nullifier(spend.fvk, spend.witness.position());
         if (!(cm && nf)) {
-            librustzcash_sapling_proving_ctx_free(ctx);
             return boost::none;
         }
+        spendNullifiers.push_back(*nf);
 
         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
         ss << spend.witness.path();
-        std::vector<unsigned char> witness(ss.begin(), ss.end());
+        spendWitnesses.push_back(std::vector<unsigned char>(ss.begin(), ss.end()));
+    }
+
+    std::vector<uint256> outputCommitments;
+    std::vector<libzcash::SaplingNotePlaintextEncryptionResult> outputEncryptions;
+    for (const OutputDescriptionInfo& output : outputs) {
+        auto cm = output.note.cm();
+        if (!cm) {
+            return boost::none;
+        }
+        outputCommitments.push_back(*cm);
+
+        libzcash::SaplingNotePlaintext notePlaintext(output.note, output.memo);
+        auto res = notePlaintext.encrypt(output.note.pk_d);
+        if (!res) {
+            return boost::none;
+        }
+        outputEncryptions.push_back(res.get());
+    }
+
+    auto ctx = librustzcash_sapling_proving_ctx_init();
+
+    // Create Sapling SpendDescriptions
+    for (size_t i = 0; i < spends.size(); i++) {
+        const SpendDescriptionInfo& spend = spends[i];
 
         SpendDescription sdesc;
         if (!librustzcash_sapling_spend_proof(
                 ctx,
-                spend.expsk.full_viewing_key().ak.begin(),
+                spend.fvk.ak.begin(),
                 spend.expsk.nsk.begin(),
                 spend.note.d.data(),
                 spend.note.r.begin(),
                 spend.alpha.begin(),
                 spend.note.value(),
                 spend.anchor.begin(),
-                witness.data(),
+                spendWitnesses[i].data(),
                 sdesc.cv.begin(),
                 sdesc.rk.begin(),
                 sdesc.zkproof.data())) {
@@ -191,27 +232,14 @@ boost::optional<CTransaction> TransactionBuilder::Build()
         }
 
         sdesc.anchor = spend.anchor;
-        sdesc.nullifier = *nf;
+        sdesc.nullifier = spendNullifiers[i];
         mtx.vShieldedSpend.push_back(sdesc);
     }
 
     // Create Sapling OutputDescriptions
-    for (auto output : outputs) {
-        auto cm = output.note.cm();
-        if (!cm) {
-            librustzcash_sapling_proving_ctx_free(ctx);
-            return boost::none;
-        }
-
-        libzcash::SaplingNotePlaintext notePlaintext(output.note, output.memo);
-
-        auto res = notePlaintext.encrypt(output.note.pk_d);
-        if (!res) {
-            librustzcash_sapling_proving_ctx_free(ctx);
-            return boost::none;
-        }
-        auto enc = res.get();
-        auto encryptor = enc.second;
+    for (size_t i = 0; i < outputs.size(); i++) {
+        const OutputDescriptionInfo& output = outputs[i];
+        auto& encryptor = outputEncryptions[i].second;
 
         OutputDescription odesc;
         if (!librustzcash_sapling_output_proof(
@@ -227,9 +255,9 @@ boost::optional<CTransaction> TransactionBuilder::Build()
             return boost::none;
         }
 
-        odesc.cm = *cm;
+        odesc.cm = outputCommitments[i];
         odesc.ephemeralKey = encryptor.get_epk();
-        odesc.encCiphertext = enc.first;
+        odesc.encCiphertext = outputEncryptions[i].first;
 
         libzcash::SaplingOutgoingPlaintext outPlaintext(output.note.pk_d, encryptor.get_esk());
         odesc.outCiphertext = outPlaintext.encrypt(
@@ -246,11 +274,17 @@ boost::optional<CTransaction> TransactionBuilder::Build()
 
     auto consensusBranchId = CurrentEpochBranchId(nHeight, consensusParams);
 
+    // The spend authorization and binding signatures are not covered by the
+    // sighash, so the hashes of the transaction can be computed once here and
+    // shared by every signature below.
+    CTransaction txNewConst(mtx);
+    PrecomputedTransactionData txdata(txNewConst);
+
     // Empty output script.
     uint256 dataToBeSigned;
     CScript scriptCode;
     try {
-        dataToBeSigned = SignatureHash(scriptCode, mtx, NOT_AN_INPUT, SIGHASH_ALL, 0, consensusBranchId);
+        dataToBeSigned = SignatureHash(scriptCode, txNewConst, NOT_AN_INPUT, SIGHASH_ALL, 0, consensusBranchId, &txdata);
     } catch (std::logic_error ex) {
         librustzcash_sapling_proving_ctx_free(ctx);
         return boost::none;
@@ -273,13 +307,12 @@ boost::optional<CTransaction> TransactionBuilder::Build()
     librustzcash_sapling_proving_ctx_free(ctx);
 
     // Transparent signatures
-    CTransaction txNewConst(mtx);
     for (int nIn = 0; nIn < mtx.vin.size(); nIn++) {
         auto tIn = tIns[nIn];
         SignatureData sigdata;
         bool signSuccess = ProduceSignature(
             TransactionSignatureCreator(
-                keystore, &txNewConst, nIn, tIn.value, SIGHASH_ALL),
+                keystore, &txNewConst, nIn, tIn.value, SIGHASH_ALL, &txdata),
             tIn.scriptPubKey, sigdata, consensusBranchId);
 
         if (!signSuccess) {
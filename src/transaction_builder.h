@@ -20,6 +20,8 @@
 
 struct SpendDescriptionInfo {
     libzcash::SaplingExpandedSpendingKey expsk;
+    //! Derived from expsk once per key, for the nullifier, proof and change
+    libzcash::SaplingFullViewingKey fvk;
     libzcash::SaplingNote note;
     uint256 alpha;
     uint256 anchor;
@@ -27,9 +29,11 @@ struct SpendDescriptionInfo {
 
     SpendDescriptionInfo(
         libzcash::SaplingExpandedSpendingKey expsk,
+        libzcash::SaplingFullViewingKey fvk,
         libzcash::SaplingNote note,
         uint256 anchor,
         SaplingWitness witness);
+    ~SpendDescriptionInfo();
 };
 
 struct OutputDescriptionInfo {
@@ -75,7 +79,8 @@ public:
     void SetFee(CAmount fee);
 
     // Returns false if the anchor does not match the anchor used by
-    // previously-added Sapling spends.
+    // previously-added Sapling spends. The full viewing key of expsk is
+    // derived only for the first spend with it.
     bool AddSaplingSpend(
         libzcash::SaplingExpandedSpendingKey expsk,
         libzcash::SaplingNote note,
@@ -0,0 +1,154 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "treestate.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "consensus/upgrades.h"
+#include "main.h"
+#include "shieldedindex.h"
+#include "tinyformat.h"
+#include "txdb.h"
+
+#include <algorithm>
+#include <vector>
+
+bool GetTreeStateAt(const CBlockIndex* pindex, SproutMerkleTree& sproutTree, SaplingMerkleTree& saplingTree)
+{
+    AssertLockHeld(cs_main);
+    if (pindex == NULL || !chainActive.Contains(pindex))
+        return false;
+    const CBlockIndex* pnext = chainActive.Next(pindex);
+    uint256 sproutRoot = pnext ? pnext->hashSproutAnchor : pcoinsTip->GetBestAnchor(SPROUT);
+    // Before Sapling the header field was reserved, and the tree empty
+    uint256 saplingRoot = SaplingMerkleTree::empty_root();
+    if (NetworkUpgradeActive(pindex->nHeight, Params().GetConsensus(), Consensus::UPGRADE_SAPLING))
+        saplingRoot = pindex->hashFinalSaplingRoot;
+    return pcoinsTip->GetSproutAnchorAt(sproutRoot, sproutTree) &&
+           pcoinsTip->GetSaplingAnchorAt(saplingRoot, saplingTree);
+}
+
+static void TakeTree(SproutMerkleTree& tree, const SproutMerkleTree& sproutTree, const SaplingMerkleTree& saplingTree)
+{
+    tree = sproutTree;
+}
+
+static void TakeTree(SaplingMerkleTree& tree, const SproutMerkleTree& sproutTree, const SaplingMerkleTree& saplingTree)
+{
+    tree = saplingTree;
+}
+
+//! The commitments of the tree's kind that ctx adds, in order
+static void GetCommitments(const CCompactShieldedTx& ctx, const SproutMerkleTree&, std::vector<uint256>& vCommitments)
+{
+    vCommitments = ctx.vSproutCommitments;
+}
+
+static void GetCommitments(const CCompactShieldedTx& ctx, const SaplingMerkleTree&, std::vector<uint256>& vCommitments)
+{
+    vCommitments.clear();
+    for (const CCompactSaplingOutput& output : ctx.vSaplingOutputs)
+        vCommitments.push_back(output.cm);
+}
+
+template<typename Tree, typename Witness>
+static bool BuildWitness(const uint256& cm, const CBlockIndex* pindexNote, const CBlockIndex* pindexTo,
+                         Witness& witness, std::string& strError)
+{
+    Tree tree;
+    std::vector<const CBlockIndex*> vIndex;
+    std::vector<CDiskBlockPos> vPos;
+    {
+        LOCK(cs_main);
+        if (!chainActive.Contains(pindexNote) || !chainActive.Contains(pindexTo)) {
+            strError = "Block not in the active chain";
+            return false;
+        }
+        if (pindexTo->nHeight < pindexNote->nHeight) {
+            strError = "Witness requested for a height before the note";
+            return false;
+        }
+        if (pindexNote->pprev) {
+            SproutMerkleTree sproutTree;
+            SaplingMerkleTree saplingTree;
+            if (!GetTreeStateAt(pindexNote->pprev, sproutTree, saplingTree)) {
+                strError = "Tree state not available";
+                return false;
+            }
+            TakeTree(tree, sproutTree, saplingTree);
+        }
+        for (const CBlockIndex* pindex = pindexTo; pindex != pindexNote->pprev; pindex = pindex->pprev) {
+            if (!fShieldedIndex && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+                strError = "Block not available (pruned data)";
+                return false;
+            }
+            vIndex.push_back(pindex);
+            vPos.push_back(pindex->GetBlockPos());
+        }
+        std::reverse(vIndex.begin(), vIndex.end());
+        std::reverse(vPos.begin(), vPos.end());
+    }
+
+    // The blocks are read without cs_main; had one been disconnected
+    // meanwhile, the final check of the active chain fails.
+    bool fFound = false;
+    std::vector<uint256> vCommitments;
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        CCompactShieldedBlock record;
+        if (!fShieldedIndex || !pblocktree->ReadShieldedIndex(vIndex[i]->GetBlockHash(), record)) {
+            CBlock block;
+            if (!ReadBlockFromDisk(block, vPos[i])) {
+                strError = strprintf("Can't read block %s from disk", vIndex[i]->GetBlockHash().ToString());
+                return false;
+            }
+            record = CCompactShieldedBlock(block);
+        }
+        for (const CCompactShieldedTx& ctx : record.vtx) {
+            GetCommitments(ctx, tree, vCommitments);
+            for (const uint256& cmAdded : vCommitments) {
+                if (fFound) {
+                    witness.append(cmAdded);
+                } else {
+                    tree.append(cmAdded);
+                    if (i == 0 && cmAdded == cm) {
+                        witness = tree.witness();
+                        fFound = true;
+                    }
+                }
+            }
+        }
+        if (i == 0 && !fFound) {
+            strError = "Note commitment not found in its block";
+            return false;
+        }
+    }
+
+    LOCK(cs_main);
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+    if (!GetTreeStateAt(pindexTo, sproutTree, saplingTree)) {
+        strError = "The active chain changed while the witness was built";
+        return false;
+    }
+    Tree treeTo;
+    TakeTree(treeTo, sproutTree, saplingTree);
+    if (witness.root() != treeTo.root()) {
+        strError = "Witness does not match the tree state of the block";
+        return false;
+    }
+    return true;
+}
+
+bool BuildSaplingWitness(const uint256& cm, const CBlockIndex* pindexNote, const CBlockIndex* pindexTo,
+                         SaplingWitness& witness, std::string& strError)
+{
+    return BuildWitness<SaplingMerkleTree>(cm, pindexNote, pindexTo, witness, strError);
+}
+
+bool BuildSproutWitness(const uint256& cm, const CBlockIndex* pindexNote, const CBlockIndex* pindexTo,
+                        SproutWitness& witness, std::string& strError)
+{
+    return BuildWitness<SproutMerkleTree>(cm, pindexNote, pindexTo, witness, strError);
+}
@@ -0,0 +1,40 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TREESTATE_H
+#define BITCOIN_TREESTATE_H
+
+#include "uint256.h"
+#include "zcash/IncrementalMerkleTree.hpp"
+
+#include <string>
+
+class CBlockIndex;
+
+/**
+ * The Sprout and Sapling note commitment trees as of the end of block pindex
+ * of the active chain. The coins database keeps the frontier of every tree
+ * the active chain has had, by root; the roots of each height are found
+ * from the block index: the Sapling root in the header, and the Sprout root
+ * as the anchor the next block starts from, or the best anchor at the tip.
+ * Must be called with cs_main held.
+ */
+bool GetTreeStateAt(const CBlockIndex* pindex, SproutMerkleTree& sproutTree, SaplingMerkleTree& saplingTree);
+
+/**
+ * Build the witness, as of the end of block pindexTo of the active chain, of
+ * the Sapling note commitment cm added in block pindexNote. The tree state
+ * before pindexNote is taken from the coins database, and only the
+ * commitments added since are replayed, from the shielded index where it
+ * has the blocks and from the block files otherwise, so no witness needs to
+ * have been kept since the note was received. cs_main must not be held, as
+ * the blocks are read without it.
+ */
+bool BuildSaplingWitness(const uint256& cm, const CBlockIndex* pindexNote, const CBlockIndex* pindexTo,
+                         SaplingWitness& witness, std::string& strError);
+//! As BuildSaplingWitness, for a Sprout note commitment
+bool BuildSproutWitness(const uint256& cm, const CBlockIndex* pindexNote, const CBlockIndex* pindexTo,
+                        SproutWitness& witness, std::string& strError);
+
+#endif // BITCOIN_TREESTATE_H
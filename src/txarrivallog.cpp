@@ -0,0 +1,113 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txarrivallog.h"
+
+#include "chain.h"
+#include "clientversion.h"
+#include "main.h"
+#include "streams.h"
+#include "util.h"
+
+#include <memory>
+#include <mutex>
+
+static const uint64_t TX_ARRIVAL_LOG_VERSION = 1;
+
+namespace {
+
+std::mutex cs_arrivallog;
+std::unique_ptr<CAutoFile> pArrivalLog;
+bool fArrivalLogStarted = false;
+
+} // namespace
+
+bool OpenTxArrivalLog(const boost::filesystem::path& path)
+{
+    std::unique_lock<std::mutex> lock(cs_arrivallog);
+    FILE* file = fopen(path.string().c_str(), "wb");
+    if (!file)
+        return false;
+    pArrivalLog.reset(new CAutoFile(file, SER_DISK, CLIENT_VERSION));
+    fArrivalLogStarted = false;
+    LogPrintf("Recording the transactions peers send to %s\n", path.string());
+    return true;
+}
+
+void CloseTxArrivalLog()
+{
+    std::unique_lock<std::mutex> lock(cs_arrivallog);
+    pArrivalLog.reset();
+}
+
+void RecordTxArrival(const CTransaction& tx, int64_t nTime)
+{
+    std::unique_lock<std::mutex> lock(cs_arrivallog);
+    if (!pArrivalLog)
+        return;
+
+    try {
+        if (!fArrivalLogStarted) {
+            uint256 hashTip;
+            int nHeight;
+            {
+                LOCK(cs_main);
+                hashTip = chainActive.Tip()->GetBlockHash();
+                nHeight = chainActive.Height();
+            }
+            *pArrivalLog << TX_ARRIVAL_LOG_VERSION << hashTip << nHeight;
+            fArrivalLogStarted = true;
+        }
+        *pArrivalLog << nTime << tx;
+        fflush(pArrivalLog->Get());
+    } catch (const std::exception& e) {
+        LogPrintf("%s: stopped recording transactions: %s\n", __func__, e.what());
+        pArrivalLog.reset();
+    }
+}
+
+bool ReadTxArrivalLog(const boost::filesystem::path& path, uint256& hashTip, int& nHeight,
+                      std::vector<CTxArrival>& vArrivals, std::string& strError)
+{
+    CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        strError = strprintf("Can't open %s", path.string());
+        return false;
+    }
+
+    vArrivals.clear();
+    try {
+        uint64_t nVersion;
+        file >> nVersion;
+        if (nVersion != TX_ARRIVAL_LOG_VERSION) {
+            strError = strprintf("%s is not a transaction arrival log of version %d", path.string(), TX_ARRIVAL_LOG_VERSION);
+            return false;
+        }
+        file >> hashTip >> nHeight;
+    } catch (const std::exception&) {
+        strError = strprintf("%s has no transactions recorded", path.string());
+        return false;
+    }
+
+    while (true) {
+        CTxArrival arrival;
+        CTransaction tx;
+        try {
+            file >> arrival.nTime;
+        } catch (const std::exception&) {
+            break;
+        }
+        try {
+            file >> tx;
+        } catch (const std::exception& e) {
+            if (feof(file.Get()))
+                break;
+            strError = strprintf("Failed to read transaction %d of %s: %s", vArrivals.size(), path.string(), e.what());
+            return false;
+        }
+        arrival.tx = MakeTransactionRef(std::move(tx));
+        vArrivals.push_back(arrival);
+    }
+    return true;
+}
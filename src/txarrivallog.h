@@ -0,0 +1,44 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXARRIVALLOG_H
+#define BITCOIN_TXARRIVALLOG_H
+
+#include "primitives/transaction.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+/** A transaction as a peer sent it */
+struct CTxArrival
+{
+    int64_t nTime;          //!< When it was received, in microseconds since the epoch
+    CTransactionRef tx;
+};
+
+/**
+ * Record every transaction peers send to path, for zcbenchmark acceptmempool
+ * to replay, replacing what it held. The log starts with the tip the node had
+ * when the first transaction came, which is the chainstate to replay it at.
+ * Returns false if path can't be written.
+ */
+bool OpenTxArrivalLog(const boost::filesystem::path& path);
+void CloseTxArrivalLog();
+
+/** Append tx to the log, if it is open. Each record is flushed as it is written. */
+void RecordTxArrival(const CTransaction& tx, int64_t nTime);
+
+/**
+ * Read a log OpenTxArrivalLog wrote, and the tip it was recorded from. A
+ * record cut short, as the last one may be if the node stopped abruptly, is
+ * left out. Returns false with strError set if path isn't such a log.
+ */
+bool ReadTxArrivalLog(const boost::filesystem::path& path, uint256& hashTip, int& nHeight,
+                      std::vector<CTxArrival>& vArrivals, std::string& strError);
+
+#endif // BITCOIN_TXARRIVALLOG_H
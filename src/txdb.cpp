@@ -6,11 +6,17 @@
 
 #include "txdb.h"
 
+#include "addressindex.h"
 #include "chainparams.h"
+#include "coinstatsindex.h"
 #include "hash.h"
+#include "init.h"
 #include "main.h"
 #include "pow.h"
+#include "shieldedindex.h"
+#include "ui_interface.h"
 #include "uint256.h"
+#include "util.h"
 
 #include <stdint.h>
 
@@ -24,23 +30,118 @@ static const char DB_SPROUT_ANCHOR = 'A';
 static const char DB_SAPLING_ANCHOR = 'Z';
 static const char DB_NULLIFIER = 's';
 static const char DB_SAPLING_NULLIFIER = 'S';
+static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
+static const char DB_SHIELDED_INDEX = 'C';
 static const char DB_BLOCK_INDEX = 'b';
+static const char DB_ADDRESSINDEX = 'd';
+static const char DB_ADDRESSUNSPENTINDEX = 'u';
+static const char DB_SPENTINDEX = 'p';
+static const char DB_TIMESTAMPINDEX = 'T';
+static const char DB_COINSTATSINDEX = 'M';
 
 static const char DB_BEST_BLOCK = 'B';
+static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_BEST_SPROUT_ANCHOR = 'a';
 static const char DB_BEST_SAPLING_ANCHOR = 'z';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
 
+namespace {
 
-CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe) {
+struct CoinEntry {
+    COutPoint* outpoint;
+    char key;
+    CoinEntry(const COutPoint* ptr) : outpoint(const_cast<COutPoint*>(ptr)), key(DB_COIN)  {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(key);
+        READWRITE(outpoint->hash);
+        READWRITE(VARINT(outpoint->n));
+    }
+};
+
+/**
+ * Legacy per-transaction record, as stored under DB_COINS before the
+ * switch to one record per output. Only used by CCoinsViewDB::Upgrade().
+ *
+ * Serialized format:
+ * - VARINT(nVersion)
+ * - VARINT(nCode)
+ * - unspentness bitvector, for vout[2] and further; least significant byte first
+ * - the non-spent CTxOuts (via CTxOutCompressor)
+ * - VARINT(nHeight)
+ *
+ * The nCode value consists of:
+ * - bit 1: IsCoinBase()
+ * - bit 2: vout[0] is not spent
+ * - bit 4: vout[1] is not spent
+ * - The higher bits encode N, the number of non-zero bytes in the following bitvector.
+ *   - In case both bit 2 and bit 4 are unset, they encode N-1, as there must be at
+ *     least one non-spent output).
+ */
+class CCoins
+{
+public:
+    //! whether transaction is a coinbase
+    bool fCoinBase;
+
+    //! unspent transaction outputs; spent outputs are .IsNull(); spent outputs at the end of the array are dropped
+    std::vector<CTxOut> vout;
+
+    //! at which height this transaction was included in the active block chain
+    int nHeight;
+
+    CCoins() : fCoinBase(false), vout(0), nHeight(0) { }
+
+    template<typename Stream>
+    void Unserialize(Stream &s) {
+        unsigned int nCode = 0;
+        // version
+        int nVersionDummy;
+        ::Unserialize(s, VARINT(nVersionDummy));
+        // header code
+        ::Unserialize(s, VARINT(nCode));
+        fCoinBase = nCode & 1;
+        std::vector<bool> vAvail(2, false);
+        vAvail[0] = (nCode & 2) != 0;
+        vAvail[1] = (nCode & 4) != 0;
+        unsigned int nMaskCode = (nCode / 8) + ((nCode & 6) != 0 ? 0 : 1);
+        // spentness bitmask
+        while (nMaskCode > 0) {
+            unsigned char chAvail = 0;
+            ::Unserialize(s, chAvail);
+            for (unsigned int p = 0; p < 8; p++) {
+                bool f = (chAvail & (1 << p)) != 0;
+                vAvail.push_back(f);
+            }
+            if (chAvail != 0)
+                nMaskCode--;
+        }
+        // txouts themself
+        vout.assign(vAvail.size(), CTxOut());
+        for (unsigned int i = 0; i < vAvail.size(); i++) {
+            if (vAvail[i])
+                ::Unserialize(s, REF(CTxOutCompressor(vout[i])));
+        }
+        // coinbase height
+        ::Unserialize(s, VARINT(nHeight));
+    }
+};
+
+}
+
+
+CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe, false, GetDBOptionsFromArgs("coindb")), fNullifierFiltersLoaded(false), fWriting(false), nLastWriteTime(0), nCompactPosition(0) {
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, false, GetDBOptionsFromArgs("coindb")), fNullifierFiltersLoaded(false), fWriting(false), nLastWriteTime(0), nCompactPosition(0)
 {
 }
 
@@ -52,7 +153,8 @@ bool CCoinsViewDB::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree)
         return true;
     }
 
-    bool read = db.Read(make_pair(DB_SPROUT_ANCHOR, rt), tree);
+    libzcash::CompactFrontier<SproutMerkleTree> frontier(tree);
+    bool read = db.Read(make_pair(DB_SPROUT_ANCHOR, rt), frontier);
 
     return read;
 }
@@ -64,19 +166,35 @@ bool CCoinsViewDB::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree
         return true;
     }
 
-    bool read = db.Read(make_pair(DB_SAPLING_ANCHOR, rt), tree);
+    libzcash::CompactFrontier<SaplingMerkleTree> frontier(tree);
+    bool read = db.Read(make_pair(DB_SAPLING_ANCHOR, rt), frontier);
 
     return read;
 }
 
+bool CCoinsViewDB::HaveAnchor(const uint256 &rt, ShieldedType type) const {
+    switch (type) {
+        case SPROUT:
+            return rt == SproutMerkleTree::empty_root() || db.Exists(make_pair(DB_SPROUT_ANCHOR, rt));
+        case SAPLING:
+            return rt == SaplingMerkleTree::empty_root() || db.Exists(make_pair(DB_SAPLING_ANCHOR, rt));
+        default:
+            throw runtime_error("Unknown shielded type");
+    }
+}
+
 bool CCoinsViewDB::GetNullifier(const uint256 &nf, ShieldedType type) const {
     bool spent = false;
     char dbChar;
     switch (type) {
         case SPROUT:
+            if (fNullifierFiltersLoaded && !sproutNullifierFilter.contains(nf))
+                return false;
             dbChar = DB_NULLIFIER;
             break;
         case SAPLING:
+            if (fNullifierFiltersLoaded && !saplingNullifierFilter.contains(nf))
+                return false;
             dbChar = DB_SAPLING_NULLIFIER;
             break;
         default:
@@ -85,12 +203,12 @@ bool CCoinsViewDB::GetNullifier(const uint256 &nf, ShieldedType type) const {
     return db.Read(make_pair(dbChar, nf), spent);
 }
 
-bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    return db.Read(CoinEntry(&outpoint), coin);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -100,6 +218,14 @@ uint256 CCoinsViewDB::GetBestBlock() const {
     return hashBestChain;
 }
 
+std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
+    std::vector<uint256> vhashHeadBlocks;
+    if (!db.Read(DB_HEAD_BLOCKS, vhashHeadBlocks)) {
+        return std::vector<uint256>();
+    }
+    return vhashHeadBlocks;
+}
+
 uint256 CCoinsViewDB::GetBestAnchor(ShieldedType type) const {
     uint256 hashBestAnchor;
 
@@ -119,37 +245,73 @@ uint256 CCoinsViewDB::GetBestAnchor(ShieldedType type) const {
     return hashBestAnchor;
 }
 
-void BatchWriteNullifiers(CDBBatch& batch, CNullifiersMap& mapToUse, const char& dbChar)
+/**
+ * Write the current batch if it has grown beyond nBatchSize and start a new
+ * one. The records written so far are not consistent with any block until
+ * the final batch of CCoinsViewDB::BatchWrite lands.
+ */
+static void WritePartialBatch(CDBWrapper& db, CDBBatch& batch, size_t nBatchSize)
+{
+    if (nBatchSize == 0 || batch.SizeEstimate() <= nBatchSize)
+        return;
+    LogPrint("coindb", "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
+    db.WriteBatch(batch);
+    batch.Clear();
+}
+
+/**
+ * Nullifiers written are also added to pfilter, if given. Erased ones are left
+ * in it: the filter only has to never miss a nullifier that is in the database.
+ */
+void BatchWriteNullifiers(CDBWrapper& db, CDBBatch& batch, size_t nBatchSize, CNullifiersMap& mapToUse, const char& dbChar, CBlockedBloomFilter* pfilter, bool fErase)
 {
     for (CNullifiersMap::iterator it = mapToUse.begin(); it != mapToUse.end();) {
         if (it->second.flags & CNullifiersCacheEntry::DIRTY) {
             if (!it->second.entered)
                 batch.Erase(make_pair(dbChar, it->first));
-            else
+            else {
                 batch.Write(make_pair(dbChar, it->first), true);
+                if (pfilter)
+                    pfilter->insert(it->first);
+            }
             // TODO: changed++? ... See comment in CCoinsViewDB::BatchWrite. If this is needed we could return an int
         }
-        CNullifiersMap::iterator itOld = it++;
-        mapToUse.erase(itOld);
+        if (fErase) {
+            CNullifiersMap::iterator itOld = it++;
+            mapToUse.erase(itOld);
+        } else {
+            it++;
+        }
+        WritePartialBatch(db, batch, nBatchSize);
     }
 }
 
+/**
+ * Anchor removals are collected into batchFinal rather than written as we go:
+ * replaying an interrupted flush rolls the old tip back with PopAnchor, which
+ * needs the trees of the blocks being disconnected to still be present.
+ */
 template<typename Map, typename MapIterator, typename MapEntry, typename Tree>
-void BatchWriteAnchors(CDBBatch& batch, Map& mapToUse, const char& dbChar)
+void BatchWriteAnchors(CDBWrapper& db, CDBBatch& batch, CDBBatch& batchFinal, size_t nBatchSize, Map& mapToUse, const char& dbChar, bool fErase)
 {
     for (MapIterator it = mapToUse.begin(); it != mapToUse.end();) {
         if (it->second.flags & MapEntry::DIRTY) {
             if (!it->second.entered)
-                batch.Erase(make_pair(dbChar, it->first));
+                batchFinal.Erase(make_pair(dbChar, it->first));
             else {
                 if (it->first != Tree::empty_root()) {
-                    batch.Write(make_pair(dbChar, it->first), it->second.tree);
+                    batch.Write(make_pair(dbChar, it->first), libzcash::CompactFrontier<Tree>(it->second.tree));
                 }
             }
             // TODO: changed++?
         }
-        MapIterator itOld = it++;
-        mapToUse.erase(itOld);
+        if (fErase) {
+            MapIterator itOld = it++;
+            mapToUse.erase(itOld);
+        } else {
+            it++;
+        }
+        WritePartialBatch(db, batch, nBatchSize);
     }
 }
 
@@ -160,41 +322,169 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
                               CAnchorsSproutMap &mapSproutAnchors,
                               CAnchorsSaplingMap &mapSaplingAnchors,
                               CNullifiersMap &mapSproutNullifiers,
-                              CNullifiersMap &mapSaplingNullifiers) {
+                              CNullifiersMap &mapSaplingNullifiers,
+                              bool fErase) {
+    fWriting = true;
     CDBBatch batch(db);
+    CDBBatch batchFinal(db);
     size_t count = 0;
     size_t changed = 0;
+    // Without a block hash there is no head marker to recover from, so the
+    // regular records are not split up.
+    size_t nBatchSize = hashBlock.IsNull() ? 0 : (size_t)GetArg("-dbbatchsize", nDefaultDbBatchSize);
+
+    if (!hashBlock.IsNull()) {
+        uint256 old_tip = GetBestBlock();
+        if (old_tip.IsNull()) {
+            // We may be in the middle of replaying.
+            std::vector<uint256> old_heads = GetHeadBlocks();
+            if (old_heads.size() == 2) {
+                assert(old_heads[0] == hashBlock);
+                old_tip = old_heads[1];
+            }
+        }
+
+        // In the first batch, mark the database as being in the middle of a
+        // transition from old_tip to hashBlock.
+        batch.Erase(DB_BEST_BLOCK);
+        batch.Write(DB_HEAD_BLOCKS, std::vector<uint256>{hashBlock, old_tip});
+    }
+
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(make_pair(DB_COINS, it->first));
+            CoinEntry entry(&it->first);
+            if (it->second.coin().IsSpent())
+                batch.Erase(entry);
             else
-                batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
+                batch.Write(entry, it->second.coin());
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase) {
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+        } else {
+            it++;
+        }
+        WritePartialBatch(db, batch, nBatchSize);
     }
 
-    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::iterator, CAnchorsSproutCacheEntry, SproutMerkleTree>(batch, mapSproutAnchors, DB_SPROUT_ANCHOR);
-    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree>(batch, mapSaplingAnchors, DB_SAPLING_ANCHOR);
+    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::iterator, CAnchorsSproutCacheEntry, SproutMerkleTree>(db, batch, batchFinal, nBatchSize, mapSproutAnchors, DB_SPROUT_ANCHOR, fErase);
+    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree>(db, batch, batchFinal, nBatchSize, mapSaplingAnchors, DB_SAPLING_ANCHOR, fErase);
+
+    ::BatchWriteNullifiers(db, batch, nBatchSize, mapSproutNullifiers, DB_NULLIFIER, fNullifierFiltersLoaded ? &sproutNullifierFilter : NULL, fErase);
+    ::BatchWriteNullifiers(db, batch, nBatchSize, mapSaplingNullifiers, DB_SAPLING_NULLIFIER, fNullifierFiltersLoaded ? &saplingNullifierFilter : NULL, fErase);
 
-    ::BatchWriteNullifiers(batch, mapSproutNullifiers, DB_NULLIFIER);
-    ::BatchWriteNullifiers(batch, mapSaplingNullifiers, DB_SAPLING_NULLIFIER);
+    // Whatever is left of the regular records goes out first; the final
+    // batch then marks the database as consistent with hashBlock again.
+    db.WriteBatch(batch);
 
-    if (!hashBlock.IsNull())
-        batch.Write(DB_BEST_BLOCK, hashBlock);
+    if (!hashBlock.IsNull()) {
+        batchFinal.Erase(DB_HEAD_BLOCKS);
+        batchFinal.Write(DB_BEST_BLOCK, hashBlock);
+    }
     if (!hashSproutAnchor.IsNull())
-        batch.Write(DB_BEST_SPROUT_ANCHOR, hashSproutAnchor);
+        batchFinal.Write(DB_BEST_SPROUT_ANCHOR, hashSproutAnchor);
     if (!hashSaplingAnchor.IsNull())
-        batch.Write(DB_BEST_SAPLING_ANCHOR, hashSaplingAnchor);
+        batchFinal.Write(DB_BEST_SAPLING_ANCHOR, hashSaplingAnchor);
+
+    LogPrint("coindb", "Writing final batch of %.2f MiB\n", batchFinal.SizeEstimate() * (1.0 / 1048576.0));
+    bool ret = db.WriteBatch(batchFinal);
+    LogPrint("coindb", "Committed %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+
+    nLastWriteTime = GetTime();
+    fWriting = false;
+
+    // A filter filled past its sizing loses selectivity; rebuild it with room to grow.
+    if (ret && fNullifierFiltersLoaded) {
+        if (sproutNullifierFilter.size() > sproutNullifierFilter.capacity())
+            ret = LoadNullifierFilter(sproutNullifierFilter, DB_NULLIFIER);
+        if (ret && saplingNullifierFilter.size() > saplingNullifierFilter.capacity())
+            ret = LoadNullifierFilter(saplingNullifierFilter, DB_SAPLING_NULLIFIER);
+        fNullifierFiltersLoaded = ret;
+    }
+    return ret;
+}
+
+bool CCoinsViewDB::LoadNullifierFilter(CBlockedBloomFilter &filter, char dbChar) {
+    // Count first so the filter can be sized before it is filled.
+    size_t nCount = 0;
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    std::pair<char, uint256> key;
+    for (pcursor->Seek(make_pair(dbChar, uint256())); pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        if (!pcursor->GetKey(key) || key.first != dbChar)
+            break;
+        nCount++;
+    }
+
+    filter.reset(std::max<size_t>(2 * nCount, 1 << 16));
+    for (pcursor->Seek(make_pair(dbChar, uint256())); pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        if (!pcursor->GetKey(key) || key.first != dbChar)
+            break;
+        filter.insert(key.second);
+    }
+    if (filter.size() != nCount)
+        return error("%s: nullifier set changed while loading", __func__);
+    return true;
+}
+
+/** Key spaces compacted by CCoinsViewDB::CompactStep, each in COMPACT_SLICES slices */
+static const char vCompactKeySpaces[] = {DB_COIN, DB_NULLIFIER, DB_SAPLING_NULLIFIER, DB_SPROUT_ANCHOR, DB_SAPLING_ANCHOR};
+static const unsigned int COMPACT_SLICES = 16;
+
+/** Start of slice nSlice of a key space; the slice past the last one is the next key space. */
+static std::pair<char, uint256> CompactSliceStart(char dbChar, unsigned int nSlice)
+{
+    uint256 start;
+    if (nSlice == COMPACT_SLICES)
+        return make_pair((char)(dbChar + 1), start);
+    *start.begin() = nSlice * (256 / COMPACT_SLICES);
+    return make_pair(dbChar, start);
+}
+
+unsigned int CCoinsViewDB::CompactStep(size_t nMaxBytes, int64_t nIdleSeconds) {
+    const unsigned int nTotalSlices = sizeof(vCompactKeySpaces) * COMPACT_SLICES;
+    unsigned int nCompacted = 0;
+    size_t nBytes = 0;
+    int64_t nStart = GetTimeMicros();
+    // Look at each slice at most once per call, skipping empty ones.
+    for (unsigned int i = 0; i < nTotalSlices && nBytes < nMaxBytes; i++) {
+        if (fWriting || GetTime() - nLastWriteTime < nIdleSeconds)
+            break;
+        char dbChar = vCompactKeySpaces[nCompactPosition / COMPACT_SLICES];
+        unsigned int nSlice = nCompactPosition % COMPACT_SLICES;
+        nCompactPosition = (nCompactPosition + 1) % nTotalSlices;
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
-    return db.WriteBatch(batch);
+        std::pair<char, uint256> begin = CompactSliceStart(dbChar, nSlice);
+        std::pair<char, uint256> end = CompactSliceStart(dbChar, nSlice + 1);
+        size_t nSize = db.EstimateSize(begin, end);
+        if (nSize == 0)
+            continue;
+        db.CompactRange(begin, end);
+        nBytes += nSize;
+        nCompacted++;
+        LogPrint("coindb", "Compacted '%c' slice %u/%u (~%.2f MiB)\n", dbChar, nSlice + 1, COMPACT_SLICES, nSize * (1.0 / 1048576.0));
+    }
+    if (nCompacted)
+        LogPrint("coindb", "Compacted %u chainstate slices (~%.2f MiB) in %.2fs\n", nCompacted, nBytes * (1.0 / 1048576.0), (GetTimeMicros() - nStart) * 0.000001);
+    return nCompacted;
+}
+
+bool CCoinsViewDB::LoadNullifierFilters() {
+    fNullifierFiltersLoaded = false;
+    if (!LoadNullifierFilter(sproutNullifierFilter, DB_NULLIFIER) ||
+        !LoadNullifierFilter(saplingNullifierFilter, DB_SAPLING_NULLIFIER))
+        return false;
+    fNullifierFiltersLoaded = true;
+    LogPrintf("Loaded nullifier filters: %u Sprout, %u Sapling nullifiers (%.1f MiB)\n",
+        sproutNullifierFilter.size(), saplingNullifierFilter.size(),
+        (sproutNullifierFilter.DynamicMemoryUsage() + saplingNullifierFilter.DynamicMemoryUsage()) * (1.0 / 1048576.0));
+    return true;
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, false, GetDBOptionsFromArgs("blockdb")) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -218,42 +508,76 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 }
 
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
-    /* It seems that there are no "const iterators" for LevelDB.  Since we
-       only need read operations on it, use a const-cast to get around
-       that restriction.  */
-    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
-    pcursor->Seek(DB_COINS);
+    return CCoinsViewDBSnapshot(*this).GetStats(stats);
+}
 
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+CCoinsViewDBSnapshot::CCoinsViewDBSnapshot(const CCoinsViewDB &view) : db(view.db), snapshot(view.db) {
+}
+
+bool CCoinsViewDBSnapshot::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    return db.Read(CoinEntry(&outpoint), coin, snapshot);
+}
+
+bool CCoinsViewDBSnapshot::HaveCoin(const COutPoint &outpoint) const {
+    Coin coin;
+    return GetCoin(outpoint, coin);
+}
+
+uint256 CCoinsViewDBSnapshot::GetBestBlock() const {
+    uint256 hashBestChain;
+    if (!db.Read(DB_BEST_BLOCK, hashBestChain, snapshot))
+        return uint256();
+    return hashBestChain;
+}
+
+bool CCoinsViewDBSnapshot::GetStats(CCoinsStats &stats) const {
+    // Reading the best block and the coins from one snapshot keeps them
+    // consistent with each other.
     stats.hashBlock = GetBestBlock();
+    if (stats.hashBlock.IsNull())
+        return error("CCoinsViewDBSnapshot::GetStats() : no best block, a flush is in progress");
+
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator(snapshot));
+    pcursor->Seek(DB_COIN);
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
+    uint256 prevTxid;
+    bool fOutputs = false;
+    COutPoint key;
+    CoinEntry entry(&key);
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && key.first == DB_COINS) {
-            if (pcursor->GetValue(coins)) {
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
+        Coin coin;
+        if (pcursor->GetKey(entry) && entry.key == DB_COIN) {
+            if (pcursor->GetValue(coin)) {
+                // Outputs are sorted by txid in the database, so they can be
+                // hashed grouped by transaction.
+                if (!fOutputs || key.hash != prevTxid) {
+                    if (fOutputs)
+                        ss << VARINT(0);
+                    ss << key.hash;
+                    ss << VARINT(coin.nHeight * 2 + coin.fCoinBase);
+                    stats.nTransactions++;
+                    prevTxid = key.hash;
+                    fOutputs = true;
                 }
+                stats.nTransactionOutputs++;
+                ss << VARINT(key.n + 1);
+                ss << coin.out;
+                nTotalAmount += coin.out.nValue;
                 stats.nSerializedSize += 32 + pcursor->GetValueSize();
-                ss << VARINT(0);
             } else {
-                return error("CCoinsViewDB::GetStats() : unable to read value");
+                return error("CCoinsViewDBSnapshot::GetStats() : unable to read value");
             }
         } else {
             break;
         }
         pcursor->Next();
     }
+    if (fOutputs)
+        ss << VARINT(0);
     {
         LOCK(cs_main);
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
@@ -263,6 +587,456 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     return true;
 }
 
+/** Write the records of one nullifier or anchor key space, as Dump describes. */
+template<typename Value>
+static bool ReadDumpValue(CDBIterator &cursor, Value &value)
+{
+    return cursor.GetValue(value);
+}
+
+/** Anchors are stored as compact frontiers, but dumped in the default tree format */
+template<size_t Depth, typename Hash>
+static bool ReadDumpValue(CDBIterator &cursor, libzcash::IncrementalMerkleTree<Depth, Hash> &tree)
+{
+    libzcash::CompactFrontier<libzcash::IncrementalMerkleTree<Depth, Hash> > frontier(tree);
+    return cursor.GetValue(frontier);
+}
+
+template<typename Value>
+static bool DumpKeySpace(CDBIterator &cursor, char dbChar, CAutoFile &file, CHashWriter &hasher, uint64_t &nRecords)
+{
+    std::pair<char, uint256> key;
+    for (cursor.Seek(make_pair(dbChar, uint256())); cursor.Valid(); cursor.Next()) {
+        boost::this_thread::interruption_point();
+        if (!cursor.GetKey(key) || key.first != dbChar)
+            break;
+        Value value;
+        if (!ReadDumpValue(cursor, value))
+            return error("%s: unable to read value", __func__);
+        file << true << key.second << value;
+        hasher << key.second << value;
+        nRecords++;
+    }
+    file << false;
+    hasher << false;
+    return true;
+}
+
+bool CCoinsViewDBSnapshot::Dump(CAutoFile &file, CTxOutSetDump &dump) const {
+    dump.hashBlock = GetBestBlock();
+    if (dump.hashBlock.IsNull())
+        return error("CCoinsViewDBSnapshot::Dump() : no best block, a flush is in progress");
+    file << TXOUTSET_DUMP_VERSION << dump.hashBlock;
+
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator(snapshot));
+    COutPoint outpoint;
+    CoinEntry entry(&outpoint);
+    for (pcursor->Seek(DB_COIN); pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        if (!pcursor->GetKey(entry) || entry.key != DB_COIN)
+            break;
+        Coin coin;
+        if (!pcursor->GetValue(coin))
+            return error("CCoinsViewDBSnapshot::Dump() : unable to read coin");
+        file << true << outpoint << coin;
+        hasher << outpoint << coin;
+        dump.nCoins++;
+    }
+    file << false;
+    hasher << false;
+
+    if (!DumpKeySpace<bool>(*pcursor, DB_NULLIFIER, file, hasher, dump.nNullifiers) ||
+        !DumpKeySpace<bool>(*pcursor, DB_SAPLING_NULLIFIER, file, hasher, dump.nNullifiers) ||
+        !DumpKeySpace<SproutMerkleTree>(*pcursor, DB_SPROUT_ANCHOR, file, hasher, dump.nAnchors) ||
+        !DumpKeySpace<SaplingMerkleTree>(*pcursor, DB_SAPLING_ANCHOR, file, hasher, dump.nAnchors))
+        return false;
+
+    uint256 hashSproutAnchor, hashSaplingAnchor;
+    db.Read(DB_BEST_SPROUT_ANCHOR, hashSproutAnchor, snapshot);
+    db.Read(DB_BEST_SAPLING_ANCHOR, hashSaplingAnchor, snapshot);
+    file << hashSproutAnchor << hashSaplingAnchor;
+    hasher << hashSproutAnchor << hashSaplingAnchor;
+
+    dump.hashContents = hasher.GetHash();
+    return true;
+}
+
+CCoinsViewMemory::CCoinsViewMemory(CCoinsViewDB &dbIn) : db(dbIn), nCoinsUsage(0), fPending(false), fSnapshotRequested(false), fSnapshotFailed(false)
+{
+    ResetPending();
+}
+
+void CCoinsViewMemory::ResetPending()
+{
+    pendingCoins.reset(new CCoinsMap());
+    pendingSproutAnchors.reset(new CAnchorsSproutMap());
+    pendingSaplingAnchors.reset(new CAnchorsSaplingMap());
+    pendingSproutNullifiers.reset(new CNullifiersMap());
+    pendingSaplingNullifiers.reset(new CNullifiersMap());
+    fPending = false;
+}
+
+template<typename Tree>
+static bool LoadMemoryAnchors(CDBIterator &cursor, char dbChar, boost::unordered_map<uint256, Tree, CCoinsKeyHasher> &mapAnchors)
+{
+    std::pair<char, uint256> key;
+    for (cursor.Seek(make_pair(dbChar, uint256())); cursor.Valid(); cursor.Next()) {
+        boost::this_thread::interruption_point();
+        if (!cursor.GetKey(key) || key.first != dbChar)
+            break;
+        Tree tree;
+        if (!ReadDumpValue(cursor, tree))
+            return error("%s: unable to read anchor %s", __func__, key.second.ToString());
+        mapAnchors.emplace(key.second, std::move(tree));
+    }
+    return true;
+}
+
+static void LoadMemoryNullifiers(CDBIterator &cursor, char dbChar, boost::unordered_set<uint256, CCoinsKeyHasher> &setNullifiers)
+{
+    std::pair<char, uint256> key;
+    for (cursor.Seek(make_pair(dbChar, uint256())); cursor.Valid(); cursor.Next()) {
+        boost::this_thread::interruption_point();
+        if (!cursor.GetKey(key) || key.first != dbChar)
+            break;
+        setNullifiers.insert(key.second);
+    }
+}
+
+bool CCoinsViewMemory::Load() {
+    int64_t nStart = GetTimeMillis();
+    boost::scoped_ptr<CDBIterator> pcursor(db.db.NewIterator());
+    COutPoint outpoint;
+    CoinEntry entry(&outpoint);
+    for (pcursor->Seek(DB_COIN); pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        if (!pcursor->GetKey(entry) || entry.key != DB_COIN)
+            break;
+        Coin coin;
+        if (!pcursor->GetValue(coin))
+            return error("CCoinsViewMemory::Load() : unable to read coin");
+        nCoinsUsage += coin.DynamicMemoryUsage();
+        mapCoins.emplace(outpoint, std::move(coin));
+    }
+    LoadMemoryNullifiers(*pcursor, DB_NULLIFIER, setSproutNullifiers);
+    LoadMemoryNullifiers(*pcursor, DB_SAPLING_NULLIFIER, setSaplingNullifiers);
+    if (!LoadMemoryAnchors(*pcursor, DB_SPROUT_ANCHOR, mapSproutAnchors) ||
+        !LoadMemoryAnchors(*pcursor, DB_SAPLING_ANCHOR, mapSaplingAnchors))
+        return false;
+    hashBlock = db.GetBestBlock();
+    hashSproutAnchor = db.GetBestAnchor(SPROUT);
+    hashSaplingAnchor = db.GetBestAnchor(SAPLING);
+
+    LogPrintf("Loaded the chainstate into memory: %u coins, %u nullifiers, %u anchors (%.1f MiB) in %dms\n",
+        mapCoins.size(), setSproutNullifiers.size() + setSaplingNullifiers.size(),
+        mapSproutAnchors.size() + mapSaplingAnchors.size(), DynamicMemoryUsage() * (1.0 / 1048576.0), GetTimeMillis() - nStart);
+    return true;
+}
+
+bool CCoinsViewMemory::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const {
+    if (rt == SproutMerkleTree::empty_root()) {
+        tree = SproutMerkleTree();
+        return true;
+    }
+    boost::unordered_map<uint256, SproutMerkleTree, CCoinsKeyHasher>::const_iterator it = mapSproutAnchors.find(rt);
+    if (it == mapSproutAnchors.end())
+        return false;
+    tree = it->second;
+    return true;
+}
+
+bool CCoinsViewMemory::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const {
+    if (rt == SaplingMerkleTree::empty_root()) {
+        tree = SaplingMerkleTree();
+        return true;
+    }
+    boost::unordered_map<uint256, SaplingMerkleTree, CCoinsKeyHasher>::const_iterator it = mapSaplingAnchors.find(rt);
+    if (it == mapSaplingAnchors.end())
+        return false;
+    tree = it->second;
+    return true;
+}
+
+bool CCoinsViewMemory::HaveAnchor(const uint256 &rt, ShieldedType type) const {
+    switch (type) {
+        case SPROUT:
+            return rt == SproutMerkleTree::empty_root() || mapSproutAnchors.count(rt);
+        case SAPLING:
+            return rt == SaplingMerkleTree::empty_root() || mapSaplingAnchors.count(rt);
+        default:
+            throw runtime_error("Unknown shielded type");
+    }
+}
+
+bool CCoinsViewMemory::GetNullifier(const uint256 &nf, ShieldedType type) const {
+    switch (type) {
+        case SPROUT:
+            return setSproutNullifiers.count(nf);
+        case SAPLING:
+            return setSaplingNullifiers.count(nf);
+        default:
+            throw runtime_error("Unknown shielded type");
+    }
+}
+
+bool CCoinsViewMemory::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    boost::unordered_map<COutPoint, Coin, SaltedOutpointHasher>::const_iterator it = mapCoins.find(outpoint);
+    if (it == mapCoins.end())
+        return false;
+    coin = it->second;
+    return true;
+}
+
+bool CCoinsViewMemory::HaveCoin(const COutPoint &outpoint) const {
+    return mapCoins.count(outpoint);
+}
+
+uint256 CCoinsViewMemory::GetBestBlock() const {
+    return hashBlock;
+}
+
+uint256 CCoinsViewMemory::GetBestAnchor(ShieldedType type) const {
+    switch (type) {
+        case SPROUT:
+            return hashSproutAnchor;
+        case SAPLING:
+            return hashSaplingAnchor;
+        default:
+            throw runtime_error("Unknown shielded type");
+    }
+}
+
+/** Apply the dirty anchors of mapIn, and note them in mapPending for the next snapshot */
+template<typename Map, typename Tree>
+static void BatchWriteMemoryAnchors(Map &mapIn, boost::unordered_map<uint256, Tree, CCoinsKeyHasher> &mapAnchors, Map &mapPending, bool fErase)
+{
+    for (typename Map::iterator it = mapIn.begin(); it != mapIn.end();) {
+        if (it->second.flags & Map::mapped_type::DIRTY) {
+            if (it->second.entered)
+                mapAnchors[it->first] = it->second.tree;
+            else
+                mapAnchors.erase(it->first);
+            typename Map::mapped_type &pending = mapPending[it->first];
+            pending.entered = it->second.entered;
+            pending.tree = it->second.tree;
+            pending.flags = Map::mapped_type::DIRTY;
+        }
+        if (fErase)
+            it = mapIn.erase(it);
+        else
+            ++it;
+    }
+}
+
+static void BatchWriteMemoryNullifiers(CNullifiersMap &mapIn, boost::unordered_set<uint256, CCoinsKeyHasher> &setNullifiers, CNullifiersMap &mapPending, bool fErase)
+{
+    for (CNullifiersMap::iterator it = mapIn.begin(); it != mapIn.end();) {
+        if (it->second.flags & CNullifiersCacheEntry::DIRTY) {
+            if (it->second.entered)
+                setNullifiers.insert(it->first);
+            else
+                setNullifiers.erase(it->first);
+            CNullifiersCacheEntry &pending = mapPending[it->first];
+            pending.entered = it->second.entered;
+            pending.flags = CNullifiersCacheEntry::DIRTY;
+        }
+        if (fErase)
+            it = mapIn.erase(it);
+        else
+            ++it;
+    }
+}
+
+bool CCoinsViewMemory::BatchWrite(CCoinsMap &mapCoinsIn,
+                                  const uint256 &hashBlockIn,
+                                  const uint256 &hashSproutAnchorIn,
+                                  const uint256 &hashSaplingAnchorIn,
+                                  CAnchorsSproutMap &mapSproutAnchorsIn,
+                                  CAnchorsSaplingMap &mapSaplingAnchorsIn,
+                                  CNullifiersMap &mapSproutNullifiersIn,
+                                  CNullifiersMap &mapSaplingNullifiersIn,
+                                  bool fErase) {
+    boost::unique_lock<boost::mutex> lock(cs);
+    for (CCoinsMap::iterator it = mapCoinsIn.begin(); it != mapCoinsIn.end();) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            const Coin &coin = it->second.coin();
+            boost::unordered_map<COutPoint, Coin, SaltedOutpointHasher>::iterator itOurs = mapCoins.find(it->first);
+            if (itOurs != mapCoins.end()) {
+                nCoinsUsage -= itOurs->second.DynamicMemoryUsage();
+                if (coin.IsSpent())
+                    mapCoins.erase(itOurs);
+                else
+                    itOurs->second = coin;
+            } else if (!coin.IsSpent()) {
+                mapCoins.emplace(it->first, coin);
+            }
+            if (!coin.IsSpent())
+                nCoinsUsage += coin.DynamicMemoryUsage();
+            CCoinsCacheEntry &pending = (*pendingCoins)[it->first];
+            pending.coin() = coin;
+            pending.flags = CCoinsCacheEntry::DIRTY;
+        }
+        if (fErase)
+            it = mapCoinsIn.erase(it);
+        else
+            ++it;
+    }
+    BatchWriteMemoryAnchors(mapSproutAnchorsIn, mapSproutAnchors, *pendingSproutAnchors, fErase);
+    BatchWriteMemoryAnchors(mapSaplingAnchorsIn, mapSaplingAnchors, *pendingSaplingAnchors, fErase);
+    BatchWriteMemoryNullifiers(mapSproutNullifiersIn, setSproutNullifiers, *pendingSproutNullifiers, fErase);
+    BatchWriteMemoryNullifiers(mapSaplingNullifiersIn, setSaplingNullifiers, *pendingSaplingNullifiers, fErase);
+
+    if (!hashBlockIn.IsNull())
+        hashBlock = hashBlockIn;
+    if (!hashSproutAnchorIn.IsNull())
+        hashSproutAnchor = hashSproutAnchorIn;
+    if (!hashSaplingAnchorIn.IsNull())
+        hashSaplingAnchor = hashSaplingAnchorIn;
+    fPending = true;
+    return true;
+}
+
+bool CCoinsViewMemory::WriteSnapshot() {
+    LOCK(cs_write);
+    std::unique_ptr<CCoinsMap> coins;
+    std::unique_ptr<CAnchorsSproutMap> sproutAnchors;
+    std::unique_ptr<CAnchorsSaplingMap> saplingAnchors;
+    std::unique_ptr<CNullifiersMap> sproutNullifiers;
+    std::unique_ptr<CNullifiersMap> saplingNullifiers;
+    uint256 hashBlockSnapshot, hashSproutAnchorSnapshot, hashSaplingAnchorSnapshot;
+    {
+        // Taking the changes is all that waits for BatchWrite; the state
+        // they bring the database to is that of one block, as BatchWrite
+        // is only called between blocks.
+        boost::unique_lock<boost::mutex> lock(cs);
+        fSnapshotRequested = false;
+        if (!fPending)
+            return !fSnapshotFailed;
+        coins = std::move(pendingCoins);
+        sproutAnchors = std::move(pendingSproutAnchors);
+        saplingAnchors = std::move(pendingSaplingAnchors);
+        sproutNullifiers = std::move(pendingSproutNullifiers);
+        saplingNullifiers = std::move(pendingSaplingNullifiers);
+        hashBlockSnapshot = hashBlock;
+        hashSproutAnchorSnapshot = hashSproutAnchor;
+        hashSaplingAnchorSnapshot = hashSaplingAnchor;
+        ResetPending();
+    }
+
+    int64_t nStart = GetTimeMillis();
+    size_t nChanged = coins->size();
+    bool ret;
+    try {
+        ret = db.BatchWrite(*coins, hashBlockSnapshot, hashSproutAnchorSnapshot, hashSaplingAnchorSnapshot,
+                            *sproutAnchors, *saplingAnchors, *sproutNullifiers, *saplingNullifiers);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+        ret = false;
+    }
+    if (!ret) {
+        fSnapshotFailed = true;
+        return error("%s: failed to write the chainstate at block %s", __func__, hashBlockSnapshot.ToString());
+    }
+    LogPrint("coindb", "Wrote chainstate snapshot at block %s, %u changed coins, in %dms\n",
+        hashBlockSnapshot.ToString(), nChanged, GetTimeMillis() - nStart);
+    return true;
+}
+
+void CCoinsViewMemory::RequestSnapshot() {
+    boost::unique_lock<boost::mutex> lock(cs);
+    fSnapshotRequested = true;
+    cond.notify_one();
+}
+
+void CCoinsViewMemory::ThreadSnapshot() {
+    RenameThread("litecoinz-snapshot");
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (!fSnapshotRequested)
+                cond.wait(lock); // interruption point
+        }
+        // Once started, a snapshot is written whole
+        boost::this_thread::disable_interruption noInterrupt;
+        WriteSnapshot();
+    }
+}
+
+size_t CCoinsViewMemory::DynamicMemoryUsage() const {
+    return memusage::DynamicUsage(mapCoins) + nCoinsUsage +
+           memusage::DynamicUsage(mapSproutAnchors) + memusage::DynamicUsage(mapSaplingAnchors) +
+           memusage::DynamicUsage(setSproutNullifiers) + memusage::DynamicUsage(setSaplingNullifiers);
+}
+
+/** Upgrade the database from older formats.
+ *
+ * Currently implemented: from the per-tx utxo model (0.8..0.14.x) to per-txout.
+ */
+bool CCoinsViewDB::Upgrade() {
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(make_pair(DB_COINS, uint256()));
+    if (!pcursor->Valid()) {
+        return true;
+    }
+
+    int64_t count = 0;
+    LogPrintf("Upgrading utxo-set database...\n");
+    LogPrintf("[0%%]...");
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0);
+    size_t batch_size = 1 << 24;
+    CDBBatch batch(db);
+    int reportDone = 0;
+    std::pair<char, uint256> key;
+    std::pair<char, uint256> prev_key = make_pair(DB_COINS, uint256());
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) {
+            break;
+        }
+        if (pcursor->GetKey(key) && key.first == DB_COINS) {
+            if (count++ % 256 == 0) {
+                uint32_t high = 0x100 * *key.second.begin() + *(key.second.begin() + 1);
+                int percentageDone = (int)(high * 100.0 / 65536.0 + 0.5);
+                uiInterface.ShowProgress(_("Upgrading UTXO database"), percentageDone);
+                if (reportDone < percentageDone/10) {
+                    // report max. every 10% step
+                    LogPrintf("[%d%%]...", percentageDone);
+                    reportDone = percentageDone/10;
+                }
+            }
+            CCoins old_coins;
+            if (!pcursor->GetValue(old_coins)) {
+                return error("%s: cannot parse CCoins record", __func__);
+            }
+            COutPoint outpoint(key.second, 0);
+            for (size_t i = 0; i < old_coins.vout.size(); ++i) {
+                if (!old_coins.vout[i].IsNull() && !old_coins.vout[i].scriptPubKey.IsUnspendable()) {
+                    Coin newcoin(std::move(old_coins.vout[i]), old_coins.nHeight, old_coins.fCoinBase);
+                    outpoint.n = i;
+                    CoinEntry entry(&outpoint);
+                    batch.Write(entry, newcoin);
+                }
+            }
+            batch.Erase(key);
+            if (batch.SizeEstimate() > batch_size) {
+                db.WriteBatch(batch);
+                batch.Clear();
+                db.CompactRange(prev_key, key);
+                prev_key = key;
+            }
+            pcursor->Next();
+        } else {
+            break;
+        }
+    }
+    db.WriteBatch(batch);
+    db.CompactRange(make_pair(DB_COINS, uint256()), key);
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE");
+    return !ShutdownRequested();
+}
+
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
     CDBBatch batch(*this);
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
@@ -270,11 +1044,22 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     }
     batch.Write(DB_LAST_BLOCK, nLastFile);
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
-        batch.Write(make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
+        CDiskBlockIndex diskindex(*it);
+        if (diskindex.nSolution.empty())
+            return error("%s: no Equihash solution for block %s", __func__, (*it)->GetBlockHash().ToString());
+        batch.Write(make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), diskindex);
     }
     return WriteBatch(batch, true);
 }
 
+bool CBlockTreeDB::ReadBlockSolution(const uint256 &hash, std::vector<unsigned char> &nSolution) {
+    CDiskBlockIndex diskindex;
+    if (!Read(make_pair(DB_BLOCK_INDEX, hash), diskindex))
+        return false;
+    nSolution.swap(diskindex.nSolution);
+    return true;
+}
+
 bool CBlockTreeDB::EraseBatchSync(const std::vector<const CBlockIndex*>& blockinfo) {
     CDBBatch batch(*this);
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
@@ -294,6 +1079,118 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadShieldedIndex(const uint256 &hash, CCompactShieldedBlock &block) {
+    return Read(make_pair(DB_SHIELDED_INDEX, hash), block);
+}
+
+bool CBlockTreeDB::WriteShieldedIndex(const uint256 &hash, const CCompactShieldedBlock &block) {
+    return Write(make_pair(DB_SHIELDED_INDEX, hash), block);
+}
+
+bool CBlockTreeDB::EraseShieldedIndex(const uint256 &hash) {
+    return Erase(make_pair(DB_SHIELDED_INDEX, hash));
+}
+
+bool CBlockTreeDB::ReadCoinStatsIndex(const uint256 &hash, CCoinStatsRecord &stats) {
+    return Read(make_pair(DB_COINSTATSINDEX, hash), stats);
+}
+
+bool CBlockTreeDB::WriteCoinStatsIndex(const uint256 &hash, const CCoinStatsRecord &stats) {
+    return Write(make_pair(DB_COINSTATSINDEX, hash), stats);
+}
+
+bool CBlockTreeDB::UpdateBlockIndexes(const std::vector<std::pair<uint256, CDiskTxPos> > &vTxPos, const CBlockIndexesUpdate &update, bool fErase) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vTxPos.begin(); it!=vTxPos.end(); it++)
+        batch.Write(make_pair(DB_TXINDEX, it->first), it->second);
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=update.vAddressIndex.begin(); it!=update.vAddressIndex.end(); it++) {
+        if (fErase)
+            batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
+        else
+            batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
+    }
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=update.vAddressUnspentIndex.begin(); it!=update.vAddressUnspentIndex.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
+        else
+            batch.Write(make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
+    }
+    for (std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >::const_iterator it=update.vSpentIndex.begin(); it!=update.vSpentIndex.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(make_pair(DB_SPENTINDEX, it->first));
+        else
+            batch.Write(make_pair(DB_SPENTINDEX, it->first), it->second);
+    }
+    for (std::vector<CTimestampIndexKey>::const_iterator it=update.vTimestampIndex.begin(); it!=update.vTimestampIndex.end(); it++) {
+        if (fErase)
+            batch.Erase(make_pair(DB_TIMESTAMPINDEX, *it));
+        else
+            batch.Write(make_pair(DB_TIMESTAMPINDEX, *it), '0');
+    }
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadAddressIndex(const uint160 &hashBytes, int type, std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                                    int nStart, int nEnd) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, hashBytes, nStart > 0 ? nStart : 0)));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CAddressIndexKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESSINDEX || key.second.type != type || key.second.hashBytes != hashBytes)
+            break;
+        if (nEnd > 0 && key.second.blockHeight > nEnd)
+            break;
+        CAmount nValue;
+        if (!pcursor->GetValue(nValue))
+            return error("failed to get address index value");
+        addressIndex.push_back(make_pair(key.second, nValue));
+        pcursor->Next();
+    }
+    return true;
+}
+
+bool CBlockTreeDB::ReadAddressUnspentIndex(const uint160 &hashBytes, int type, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, CAddressUnspentIteratorKey(type, hashBytes)));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CAddressUnspentKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESSUNSPENTINDEX || key.second.type != type || key.second.hashBytes != hashBytes)
+            break;
+        CAddressUnspentValue nValue;
+        if (!pcursor->GetValue(nValue))
+            return error("failed to get address unspent value");
+        unspentOutputs.push_back(make_pair(key.second, nValue));
+        pcursor->Next();
+    }
+    return true;
+}
+
+bool CBlockTreeDB::ReadSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value) {
+    return Read(make_pair(DB_SPENTINDEX, key), value);
+}
+
+bool CBlockTreeDB::ReadTimestampIndex(unsigned int nHigh, unsigned int nLow, std::vector<uint256> &hashes) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(make_pair(DB_TIMESTAMPINDEX, CTimestampIndexIteratorKey(nLow)));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CTimestampIndexKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_TIMESTAMPINDEX || key.second.timestamp >= nHigh)
+            break;
+        hashes.push_back(key.second.blockHash);
+        pcursor->Next();
+    }
+    return true;
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -312,50 +1209,92 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
 
     pcursor->Seek(make_pair(DB_BLOCK_INDEX, uint256()));
 
-    // Load mapBlockIndex
-    while (pcursor->Valid()) {
+    // Records are read from the cursor in batches. Deserializing them,
+    // hashing their headers (solution included) and checking their proof of
+    // work is shared out over the -par threads; only linking the entries
+    // into mapBlockIndex is done here.
+    enum { LOAD_OK, LOAD_READ_FAILED, LOAD_INCONSISTENT, LOAD_POW_FAILED };
+    std::vector<uint256> vHash;
+    std::vector<CDataStream> vValue;
+    std::vector<CDiskBlockIndex> vDiskIndex(BLOCK_INDEX_LOAD_BATCH_SIZE);
+    std::vector<int> vResult(BLOCK_INDEX_LOAD_BATCH_SIZE);
+    vHash.reserve(BLOCK_INDEX_LOAD_BATCH_SIZE);
+    vValue.reserve(BLOCK_INDEX_LOAD_BATCH_SIZE);
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+
+    bool fDone = false;
+    while (!fDone) {
         boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->hashSproutAnchor     = diskindex.hashSproutAnchor;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->hashFinalSaplingRoot   = diskindex.hashFinalSaplingRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nArrivalTime   = diskindex.nArrivalTime;
-                pindexNew->nSolution      = diskindex.nSolution;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nCachedBranchId = diskindex.nCachedBranchId;
-                pindexNew->nTx            = diskindex.nTx;
-                pindexNew->nSproutValue   = diskindex.nSproutValue;
-                pindexNew->nSaplingValue  = diskindex.nSaplingValue;
-
-                // Consistency checks
-                auto header = pindexNew->GetBlockHeader();
-                if (header.GetHash() != pindexNew->GetBlockHash())
-                    return error("LoadBlockIndex(): block header inconsistency detected: on-disk = %s, in-memory = %s",
-                       diskindex.ToString(),  pindexNew->ToString());
-
-                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
-                    return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
-
-                pcursor->Next();
-            } else {
-                return error("LoadBlockIndex() : failed to read value");
+        vHash.clear();
+        vValue.clear();
+        while (vHash.size() < BLOCK_INDEX_LOAD_BATCH_SIZE) {
+            std::pair<char, uint256> key;
+            if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_BLOCK_INDEX) {
+                fDone = true;
+                break;
             }
-        } else {
-            break;
+            vHash.push_back(key.second);
+            vValue.push_back(CDataStream(SER_DISK, CLIENT_VERSION));
+            pcursor->GetValueStream(vValue.back());
+            pcursor->Next();
+        }
+
+        const size_t nBatch = vHash.size();
+        std::atomic<size_t> nNext(0);
+        auto check = [&]() {
+            for (size_t i = nNext++; i < nBatch; i = nNext++) {
+                vDiskIndex[i] = CDiskBlockIndex();
+                try {
+                    vValue[i] >> vDiskIndex[i];
+                } catch (const std::exception&) {
+                    vResult[i] = LOAD_READ_FAILED;
+                    continue;
+                }
+                // The record is stored under the hash of its header
+                if (vDiskIndex[i].GetBlockHash() != vHash[i])
+                    vResult[i] = LOAD_INCONSISTENT;
+                else if (!CheckProofOfWork(vHash[i], vDiskIndex[i].nBits, consensusParams))
+                    vResult[i] = LOAD_POW_FAILED;
+                else
+                    vResult[i] = LOAD_OK;
+            }
+        };
+        boost::thread_group workers;
+        for (int i = 1; i < std::min<int>(nBatch, nScriptCheckThreads); i++)
+            workers.create_thread(check);
+        check();
+        workers.join_all();
+
+        for (size_t i = 0; i < nBatch; i++) {
+            const CDiskBlockIndex& diskindex = vDiskIndex[i];
+            if (vResult[i] == LOAD_READ_FAILED)
+                return error("LoadBlockIndex() : failed to read value");
+            if (vResult[i] == LOAD_INCONSISTENT)
+                return error("LoadBlockIndex(): block header inconsistency detected: key = %s, on-disk = %s",
+                   vHash[i].ToString(), diskindex.ToString());
+            if (vResult[i] == LOAD_POW_FAILED)
+                return error("LoadBlockIndex(): CheckProofOfWork failed: %s", diskindex.ToString());
+
+            // Construct block index object. The solution is not kept in memory.
+            CBlockIndex* pindexNew = InsertBlockIndex(vHash[i]);
+            pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
+            pindexNew->nHeight        = diskindex.nHeight;
+            pindexNew->nFile          = diskindex.nFile;
+            pindexNew->nDataPos       = diskindex.nDataPos;
+            pindexNew->nUndoPos       = diskindex.nUndoPos;
+            pindexNew->hashSproutAnchor     = diskindex.hashSproutAnchor;
+            pindexNew->nVersion       = diskindex.nVersion;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->hashFinalSaplingRoot   = diskindex.hashFinalSaplingRoot;
+            pindexNew->nTime          = diskindex.nTime;
+            pindexNew->nBits          = diskindex.nBits;
+            pindexNew->nNonce         = diskindex.nNonce;
+            pindexNew->nArrivalTime   = diskindex.nArrivalTime;
+            pindexNew->nStatus        = diskindex.nStatus;
+            pindexNew->nCachedBranchId = diskindex.nCachedBranchId;
+            pindexNew->nTx            = diskindex.nTx;
+            pindexNew->nSproutValue   = diskindex.nSproutValue;
+            pindexNew->nSaplingValue  = diskindex.nSaplingValue;
         }
     }
 
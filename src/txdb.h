@@ -6,17 +6,32 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "bloom.h"
 #include "coins.h"
 #include "dbwrapper.h"
+#include "sync.h"
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <boost/unordered_set.hpp>
+
+struct CAddressIndexKey;
+struct CAddressUnspentKey;
+struct CAddressUnspentValue;
 class CBlockFileInfo;
 class CBlockIndex;
+struct CBlockIndexesUpdate;
+class CCoinStatsRecord;
+class CCompactShieldedBlock;
 struct CDiskTxPos;
+struct CSpentIndexKey;
+struct CSpentIndexValue;
+class uint160;
 class uint256;
 
 //! -dbcache default (MiB)
@@ -25,22 +40,51 @@ static const int64_t nDefaultDbCache = 450;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -chainstateinmemory default
+static const bool DEFAULT_CHAINSTATE_IN_MEMORY = false;
+//! -dbbatchsize default (bytes)
+static const int64_t nDefaultDbBatchSize = 16 << 20;
+//! -dbcompactinterval default (seconds)
+static const int64_t nDefaultDbCompactInterval = 10;
+//! -dbcompactrate default (MiB per -dbcompactinterval)
+static const int64_t nDefaultDbCompactRate = 16;
+//! Version of the file format written by dumptxoutset
+static const int TXOUTSET_DUMP_VERSION = 1;
+//! Block index entries read from the database before they are deserialized and checked together
+static const size_t BLOCK_INDEX_LOAD_BATCH_SIZE = 4096;
 
 /** CCoinsView backed by the coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
+    friend class CCoinsViewDBSnapshot;
+    friend class CCoinsViewMemory;
 protected:
     CDBWrapper db;
     CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    //! In-memory filters over the spent nullifiers, once LoadNullifierFilters() has run
+    bool fNullifierFiltersLoaded;
+    CBlockedBloomFilter sproutNullifierFilter;
+    CBlockedBloomFilter saplingNullifierFilter;
+
+    //! Set while BatchWrite runs, and when it last finished
+    std::atomic<bool> fWriting;
+    std::atomic<int64_t> nLastWriteTime;
+    //! Next key space slice for CompactStep() to look at
+    unsigned int nCompactPosition;
+
+    bool LoadNullifierFilter(CBlockedBloomFilter &filter, char dbChar);
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
     bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const;
     bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
+    bool HaveAnchor(const uint256 &rt, ShieldedType type) const;
     bool GetNullifier(const uint256 &nf, ShieldedType type) const;
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
     uint256 GetBestBlock() const;
+    std::vector<uint256> GetHeadBlocks() const;
     uint256 GetBestAnchor(ShieldedType type) const;
     bool BatchWrite(CCoinsMap &mapCoins,
                     const uint256 &hashBlock,
@@ -49,8 +93,146 @@ public:
                     CAnchorsSproutMap &mapSproutAnchors,
                     CAnchorsSaplingMap &mapSaplingAnchors,
                     CNullifiersMap &mapSproutNullifiers,
-                    CNullifiersMap &mapSaplingNullifiers);
+                    CNullifiersMap &mapSaplingNullifiers,
+                    bool fErase = true);
     bool GetStats(CCoinsStats &stats) const;
+    void GetDBStats(CDBStats &stats) const { db.GetDBStats(stats); }
+
+    //! Attempt to update from an older database format. Returns whether an error occurred.
+    bool Upgrade();
+
+    /**
+     * Build the nullifier filters from the database. From then on a lookup
+     * of a nullifier that was never spent is answered without a disk read.
+     */
+    bool LoadNullifierFilters();
+
+    /**
+     * Compact the coin, nullifier and anchor key spaces a slice at a time, so
+     * that LevelDB does not have to do it all at once in the middle of a
+     * large flush. Successive calls move through the slices in turn. Stops
+     * after about nMaxBytes of table data, and does nothing while the
+     * database is being written to or was written to less than nIdleSeconds
+     * ago. Returns the number of slices compacted.
+     */
+    unsigned int CompactStep(size_t nMaxBytes, int64_t nIdleSeconds);
+};
+
+/** What CCoinsViewDBSnapshot::Dump wrote */
+struct CTxOutSetDump
+{
+    uint256 hashBlock;
+    uint64_t nCoins;
+    uint64_t nNullifiers;
+    uint64_t nAnchors;
+    //! Hash of everything written after the version and base block hash
+    uint256 hashContents;
+
+    CTxOutSetDump() : nCoins(0), nNullifiers(0), nAnchors(0) {}
+};
+
+/**
+ * Read-only view of the coin database as it was at one point in time, which
+ * can be queried without holding cs_main. Flushes take cs_main, so a snapshot
+ * taken while holding it never sees a partially written chainstate.
+ */
+class CCoinsViewDBSnapshot : public CCoinsView
+{
+private:
+    const CDBWrapper &db;
+    CDBSnapshot snapshot;
+
+public:
+    explicit CCoinsViewDBSnapshot(const CCoinsViewDB &view);
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
+    uint256 GetBestBlock() const;
+    bool GetStats(CCoinsStats &stats) const;
+    /**
+     * Write the coins, the Sprout and Sapling nullifiers and anchors, and
+     * the best anchors to file. Each key space is a run of (true, key,
+     * value) records closed by false.
+     */
+    bool Dump(CAutoFile &file, CTxOutSetDump &dump) const;
+};
+
+/**
+ * The whole chainstate held in memory, for -chainstateinmemory. It is loaded
+ * from the coin database once, at startup, and from then on answers every
+ * lookup itself, without reading the database even for what is not there.
+ * Changes flushed into it are also collected, and written to the database
+ * as a snapshot of the state at one block, by WriteSnapshot or in the
+ * background by ThreadSnapshot. After a crash the blocks since the last
+ * snapshot are connected again from the block files.
+ */
+class CCoinsViewMemory : public CCoinsView
+{
+private:
+    CCoinsViewDB &db;
+
+    boost::unordered_map<COutPoint, Coin, SaltedOutpointHasher> mapCoins;
+    boost::unordered_map<uint256, SproutMerkleTree, CCoinsKeyHasher> mapSproutAnchors;
+    boost::unordered_map<uint256, SaplingMerkleTree, CCoinsKeyHasher> mapSaplingAnchors;
+    boost::unordered_set<uint256, CCoinsKeyHasher> setSproutNullifiers;
+    boost::unordered_set<uint256, CCoinsKeyHasher> setSaplingNullifiers;
+    uint256 hashBlock;
+    uint256 hashSproutAnchor;
+    uint256 hashSaplingAnchor;
+    //! Memory the scripts of mapCoins take
+    size_t nCoinsUsage;
+
+    //! Guards what follows, which the snapshot thread takes from BatchWrite
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    //! What changed since the last snapshot, as dirty entries for CCoinsViewDB::BatchWrite
+    std::unique_ptr<CCoinsMap> pendingCoins;
+    std::unique_ptr<CAnchorsSproutMap> pendingSproutAnchors;
+    std::unique_ptr<CAnchorsSaplingMap> pendingSaplingAnchors;
+    std::unique_ptr<CNullifiersMap> pendingSproutNullifiers;
+    std::unique_ptr<CNullifiersMap> pendingSaplingNullifiers;
+    bool fPending;
+    bool fSnapshotRequested;
+    //! Held while a snapshot is written, so that they land in order
+    CCriticalSection cs_write;
+    std::atomic<bool> fSnapshotFailed;
+
+    void ResetPending();
+
+public:
+    explicit CCoinsViewMemory(CCoinsViewDB &dbIn);
+
+    //! Read the whole coin database
+    bool Load();
+
+    bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const;
+    bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
+    bool HaveAnchor(const uint256 &rt, ShieldedType type) const;
+    bool GetNullifier(const uint256 &nf, ShieldedType type) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
+    uint256 GetBestBlock() const;
+    uint256 GetBestAnchor(ShieldedType type) const;
+    bool BatchWrite(CCoinsMap &mapCoins,
+                    const uint256 &hashBlock,
+                    const uint256 &hashSproutAnchor,
+                    const uint256 &hashSaplingAnchor,
+                    CAnchorsSproutMap &mapSproutAnchors,
+                    CAnchorsSaplingMap &mapSaplingAnchors,
+                    CNullifiersMap &mapSproutNullifiers,
+                    CNullifiersMap &mapSaplingNullifiers,
+                    bool fErase = true);
+
+    /** Write what changed since the last snapshot to the coin database now */
+    bool WriteSnapshot();
+    /** Have the snapshot thread write one */
+    void RequestSnapshot();
+    /** Writes the snapshots RequestSnapshot asks for, until interrupted */
+    void ThreadSnapshot();
+    /** Whether a snapshot failed to be written, which leaves the database behind for good */
+    bool SnapshotFailed() const { return fSnapshotFailed; }
+
+    size_t DynamicMemoryUsage() const;
 };
 
 /** Access to the block database (blocks/index/) */
@@ -63,6 +245,8 @@ private:
     void operator=(const CBlockTreeDB&);
 public:
     bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
+    /** Read the Equihash solution of a block from its index entry */
+    bool ReadBlockSolution(const uint256 &hash, std::vector<unsigned char> &nSolution);
     bool EraseBatchSync(const std::vector<const CBlockIndex*>& blockinfo);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
     bool ReadLastBlockFile(int &nFile);
@@ -70,6 +254,24 @@ public:
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    bool ReadShieldedIndex(const uint256 &hash, CCompactShieldedBlock &block);
+    bool WriteShieldedIndex(const uint256 &hash, const CCompactShieldedBlock &block);
+    bool EraseShieldedIndex(const uint256 &hash);
+    bool ReadCoinStatsIndex(const uint256 &hash, CCoinStatsRecord &stats);
+    bool WriteCoinStatsIndex(const uint256 &hash, const CCoinStatsRecord &stats);
+    /**
+     * Write the -txindex entries of a connected block and its changes to the
+     * address, spent and timestamp indexes in one batch. With fErase the
+     * address and timestamp entries of a disconnected block are erased.
+     */
+    bool UpdateBlockIndexes(const std::vector<std::pair<uint256, CDiskTxPos> > &vTxPos, const CBlockIndexesUpdate &update, bool fErase);
+    /** Read the address index entries of an address between two heights (0 for no limit) */
+    bool ReadAddressIndex(const uint160 &hashBytes, int type, std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                          int nStart = 0, int nEnd = 0);
+    bool ReadAddressUnspentIndex(const uint160 &hashBytes, int type, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs);
+    bool ReadSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value);
+    /** Read the hashes of the blocks with a time in [nLow, nHigh) */
+    bool ReadTimestampIndex(unsigned int nHigh, unsigned int nLow, std::vector<uint256> &hashes);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts();
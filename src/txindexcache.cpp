@@ -0,0 +1,114 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txindexcache.h"
+
+#include "clientversion.h"
+#include "memusage.h"
+#include "primitives/transaction.h"
+#include "streams.h"
+
+size_t CTxIndexCache::EntryUsage(const CEntry& entry) const
+{
+    return memusage::MallocUsage(sizeof(memusage::stl_list_node<CEntry>)) +
+           memusage::MallocUsage(sizeof(memusage::boost_unordered_node<std::pair<const uint256, EntryList::iterator> >)) +
+           memusage::DynamicUsage(entry.vTx);
+}
+
+void CTxIndexCache::EraseEntry(EntryList::iterator it)
+{
+    nUsage -= EntryUsage(*it);
+    mapEntries.erase(it->txid);
+    listEntries.erase(it);
+}
+
+void CTxIndexCache::Trim()
+{
+    while (nUsage > nMaxUsage && !listEntries.empty())
+        EraseEntry(--listEntries.end());
+}
+
+void CTxIndexCache::SetLimit(size_t nMaxUsageIn)
+{
+    LOCK(cs);
+    nMaxUsage = nMaxUsageIn;
+    Trim();
+}
+
+bool CTxIndexCache::Get(const uint256& txid, CTransaction& tx, uint256& hashBlock)
+{
+    LOCK(cs);
+    if (nMaxUsage == 0)
+        return false;
+    boost::unordered_map<uint256, EntryList::iterator, CCoinsKeyHasher>::iterator it = mapEntries.find(txid);
+    if (it == mapEntries.end()) {
+        nMisses++;
+        return false;
+    }
+    // Move to the front as the most recently used.
+    listEntries.splice(listEntries.begin(), listEntries, it->second);
+    const CEntry& entry = listEntries.front();
+    CSpanReader ss(entry.vTx.data(), entry.vTx.data() + entry.vTx.size(), SER_DISK, CLIENT_VERSION);
+    ss >> tx;
+    hashBlock = entry.hashBlock;
+    nHits++;
+    return true;
+}
+
+void CTxIndexCache::Put(const CTransaction& tx, const uint256& hashBlock)
+{
+    // Serialized before taking the lock, as most calls come from disk reads
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << tx;
+
+    LOCK(cs);
+    if (nMaxUsage == 0)
+        return;
+    boost::unordered_map<uint256, EntryList::iterator, CCoinsKeyHasher>::iterator it = mapEntries.find(tx.GetHash());
+    if (it != mapEntries.end())
+        EraseEntry(it->second);
+    listEntries.push_front(CEntry());
+    CEntry& entry = listEntries.front();
+    entry.txid = tx.GetHash();
+    entry.hashBlock = hashBlock;
+    entry.vTx.assign(ss.begin(), ss.end());
+    mapEntries[entry.txid] = listEntries.begin();
+    nUsage += EntryUsage(entry);
+    Trim();
+}
+
+void CTxIndexCache::Erase(const uint256& txid)
+{
+    LOCK(cs);
+    boost::unordered_map<uint256, EntryList::iterator, CCoinsKeyHasher>::iterator it = mapEntries.find(txid);
+    if (it != mapEntries.end())
+        EraseEntry(it->second);
+}
+
+void CTxIndexCache::Clear()
+{
+    LOCK(cs);
+    listEntries.clear();
+    mapEntries.clear();
+    nUsage = 0;
+}
+
+size_t CTxIndexCache::size() const
+{
+    LOCK(cs);
+    return listEntries.size();
+}
+
+size_t CTxIndexCache::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    return nUsage + memusage::MallocUsage(sizeof(void*) * mapEntries.bucket_count());
+}
+
+void CTxIndexCache::GetStats(uint64_t& nHitsOut, uint64_t& nMissesOut) const
+{
+    LOCK(cs);
+    nHitsOut = nHits;
+    nMissesOut = nMisses;
+}
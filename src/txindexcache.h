@@ -0,0 +1,72 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXINDEXCACHE_H
+#define BITCOIN_TXINDEXCACHE_H
+
+#include "coins.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <list>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
+class CTransaction;
+
+/** Default for -txindexcache, the MiB of transactions read through -txindex kept in memory */
+static const int64_t DEFAULT_TXINDEX_CACHE = 16;
+
+/**
+ * Transactions recently read through -txindex, kept serialized together with
+ * the hash of their block, so that lookups of the same transactions don't go
+ * back to the block files. It holds at most a configured number of bytes,
+ * dropping the least recently used transactions first. Only transactions in
+ * the active chain belong in it: they must be erased when their block is
+ * disconnected.
+ */
+class CTxIndexCache
+{
+private:
+    struct CEntry
+    {
+        uint256 txid;
+        uint256 hashBlock;
+        std::vector<unsigned char> vTx;
+    };
+    typedef std::list<CEntry> EntryList;
+
+    mutable CCriticalSection cs;
+    size_t nMaxUsage;
+    size_t nUsage;
+    //! Most recently used first
+    EntryList listEntries;
+    boost::unordered_map<uint256, EntryList::iterator, CCoinsKeyHasher> mapEntries;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    size_t EntryUsage(const CEntry& entry) const;
+    void EraseEntry(EntryList::iterator it);
+    void Trim();
+
+public:
+    CTxIndexCache() : nMaxUsage(0), nUsage(0), nHits(0), nMisses(0) {}
+
+    //! Keep at most nMaxUsageIn bytes; 0 disables the cache
+    void SetLimit(size_t nMaxUsageIn);
+
+    bool Get(const uint256& txid, CTransaction& tx, uint256& hashBlock);
+    void Put(const CTransaction& tx, const uint256& hashBlock);
+    void Erase(const uint256& txid);
+    void Clear();
+
+    size_t size() const;
+    size_t DynamicMemoryUsage() const;
+    void GetStats(uint64_t& nHitsOut, uint64_t& nMissesOut) const;
+};
+
+#endif // BITCOIN_TXINDEXCACHE_H
@@ -10,33 +10,60 @@
 #include "consensus/validation.h"
 #include "main.h"
 #include "policy/fees.h"
+#include "script/interpreter.h"
 #include "streams.h"
 #include "timedata.h"
 #include "util.h"
 #include "utilmoneystr.h"
 #include "version.h"
 
+#include <math.h>
+
 using namespace std;
 
 CTxMemPoolEntry::CTxMemPoolEntry():
-    nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0),
-    hadNoDependencies(false), spendsCoinbase(false)
+    tx(MakeTransactionRef()), nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0),
+    hadNoDependencies(false), spendsCoinbase(false), nSigOpCount(0), feeDelta(0), nSequence(0),
+    nCountWithDescendants(0), nSizeWithDescendants(0), nModFeesWithDescendants(0),
+    nCountWithAncestors(0), nSizeWithAncestors(0), nModFeesWithAncestors(0),
+    nSigOpCountWithAncestors(0)
 {
     nHeight = MEMPOOL_HEIGHT;
 }
 
-CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
+CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
                                  int64_t _nTime, double _dPriority,
                                  unsigned int _nHeight, bool poolHasNoInputsOf,
-                                 bool _spendsCoinbase, uint32_t _nBranchId):
+                                 bool _spendsCoinbase, unsigned int _nSigOps,
+                                 uint32_t _nBranchId):
     tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight),
     hadNoDependencies(poolHasNoInputsOf),
-    spendsCoinbase(_spendsCoinbase), nBranchId(_nBranchId)
+    spendsCoinbase(_spendsCoinbase), nSigOpCount(_nSigOps), nBranchId(_nBranchId),
+    feeDelta(0), nSequence(0)
 {
-    nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-    nModSize = tx.CalculateModifiedSize(nTxSize);
+    nTxSize = tx->GetTotalSize();
+    nModSize = tx->CalculateModifiedSize(nTxSize);
     nUsageSize = RecursiveDynamicUsage(tx);
     feeRate = CFeeRate(nFee, nTxSize);
+
+    nCountWithDescendants = 1;
+    nSizeWithDescendants = nTxSize;
+    nModFeesWithDescendants = nFee;
+
+    nCountWithAncestors = 1;
+    nSizeWithAncestors = nTxSize;
+    nModFeesWithAncestors = nFee;
+    nSigOpCountWithAncestors = nSigOpCount;
+}
+
+CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
+                                 int64_t _nTime, double _dPriority,
+                                 unsigned int _nHeight, bool poolHasNoInputsOf,
+                                 bool _spendsCoinbase, unsigned int _nSigOps,
+                                 uint32_t _nBranchId):
+    CTxMemPoolEntry(MakeTransactionRef(_tx), _nFee, _nTime, _dPriority, _nHeight, poolHasNoInputsOf,
+                    _spendsCoinbase, _nSigOps, _nBranchId)
+{
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -44,17 +71,55 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
     *this = other;
 }
 
+void CTxMemPoolEntry::SetTxData(const std::shared_ptr<const PrecomputedTransactionData>& txdataIn)
+{
+    if (!txdata && txdataIn)
+        nUsageSize += memusage::MallocUsage(sizeof(PrecomputedTransactionData));
+    else if (txdata && !txdataIn)
+        nUsageSize -= memusage::MallocUsage(sizeof(PrecomputedTransactionData));
+    txdata = txdataIn;
+}
+
 double
 CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
 {
-    CAmount nValueIn = tx.GetValueOut()+nFee;
+    CAmount nValueIn = tx->GetValueOut()+nFee;
     double deltaPriority = ((double)(currentHeight-nHeight)*nValueIn)/nModSize;
     double dResult = dPriority + deltaPriority;
     return dResult;
 }
 
+void CTxMemPoolEntry::UpdateFeeDelta(CAmount newFeeDelta)
+{
+    nModFeesWithDescendants += newFeeDelta - feeDelta;
+    nModFeesWithAncestors += newFeeDelta - feeDelta;
+    feeDelta = newFeeDelta;
+}
+
+void CTxMemPoolEntry::UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+{
+    nSizeWithDescendants += modifySize;
+    assert(int64_t(nSizeWithDescendants) > 0);
+    nModFeesWithDescendants += modifyFee;
+    nCountWithDescendants += modifyCount;
+    assert(int64_t(nCountWithDescendants) > 0);
+}
+
+void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount, int modifySigOps)
+{
+    nSizeWithAncestors += modifySize;
+    assert(int64_t(nSizeWithAncestors) > 0);
+    nModFeesWithAncestors += modifyFee;
+    nCountWithAncestors += modifyCount;
+    assert(int64_t(nCountWithAncestors) > 0);
+    nSigOpCountWithAncestors += modifySigOps;
+    assert(int(nSigOpCountWithAncestors) >= 0);
+}
+
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) :
-    nTransactionsUpdated(0)
+    nTransactionsUpdated(0), nSequence(0), nRemovedLogStart(0), cachedInnerUsage(0),
+    lastRollingFeeUpdate(GetTime()), blockSinceLastRollingFeeBump(false), rollingMinimumFeeRate(0),
+    minReasonableRelayFee(_minRelayFee)
 {
     // Sanity checks off by default for performance, because otherwise
     // accepting transactions becomes O(N^2) where N is the number
@@ -69,17 +134,10 @@ CTxMemPool::~CTxMemPool()
     delete minerPolicyEstimator;
 }
 
-void CTxMemPool::pruneSpent(const uint256 &hashTx, CCoins &coins)
+bool CTxMemPool::isSpent(const COutPoint& outpoint)
 {
     LOCK(cs);
-
-    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.lower_bound(COutPoint(hashTx, 0));
-
-    // iterate over all COutPoints in mapNextTx whose hash equals the provided hashTx
-    while (it != mapNextTx.end() && it->first.hash == hashTx) {
-        coins.Spend(it->first.n); // and remove those outputs from coins
-        it++;
-    }
+    return mapNextTx.count(outpoint);
 }
 
 unsigned int CTxMemPool::GetTransactionsUpdated() const
@@ -95,84 +153,311 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
 }
 
 
+void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashesToUpdate)
+{
+    LOCK(cs);
+    // Transactions of the block that are back in the mempool were linked to
+    // each other by addUnchecked, so only children outside of them are new.
+    std::set<uint256> setAlreadyIncluded(vHashesToUpdate.begin(), vHashesToUpdate.end());
+
+    // Walk the block backwards, so that the children of each transaction
+    // have been linked to their own descendants by the time it is reached.
+    BOOST_REVERSE_FOREACH(const uint256 &hash, vHashesToUpdate) {
+        txiter it = mapTx.find(hash);
+        if (it == mapTx.end())
+            continue;
+        for (unsigned int i = 0; i < it->GetTx().vout.size(); i++) {
+            NextTxMap::iterator iter = mapNextTx.find(COutPoint(hash, i));
+            if (iter == mapNextTx.end())
+                continue;
+            const uint256 &childHash = iter->second.ptx->GetHash();
+            txiter childIter = mapTx.find(childHash);
+            assert(childIter != mapTx.end());
+            if (!setAlreadyIncluded.count(childHash)) {
+                UpdateChild(it, childIter, true);
+                UpdateParent(childIter, it, true);
+            }
+        }
+
+        setEntries setDescendants;
+        CalculateDescendants(it, setDescendants);
+        int64_t modifySize = 0;
+        CAmount modifyFee = 0;
+        int64_t modifyCount = 0;
+        BOOST_FOREACH(txiter descendantIt, setDescendants) {
+            if (descendantIt == it || setAlreadyIncluded.count(descendantIt->GetTx().GetHash()))
+                continue;
+            modifySize += descendantIt->GetTxSize();
+            modifyFee += descendantIt->GetModifiedFee();
+            modifyCount++;
+            mapTx.modify(descendantIt, update_ancestor_state(it->GetTxSize(), it->GetModifiedFee(), 1, it->GetSigOpCount()));
+        }
+        mapTx.modify(it, update_descendant_state(modifySize, modifyFee, modifyCount));
+    }
+}
+
+void CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, bool fSearchForParents) const
+{
+    setEntries parentHashes;
+    const CTransaction &tx = entry.GetTx();
+
+    if (fSearchForParents) {
+        // Get parents of this transaction that are in the mempool
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            txiter piter = mapTx.find(tx.vin[i].prevout.hash);
+            if (piter != mapTx.end())
+                parentHashes.insert(piter);
+        }
+    } else {
+        // If we're not searching for parents, we require this to be an
+        // entry in the mempool already.
+        txiter it = mapTx.iterator_to(entry);
+        parentHashes = GetMemPoolParents(it);
+    }
+
+    while (!parentHashes.empty()) {
+        txiter stageit = *parentHashes.begin();
+        setAncestors.insert(stageit);
+        parentHashes.erase(stageit);
+
+        const setEntries &setMemPoolParents = GetMemPoolParents(stageit);
+        BOOST_FOREACH(const txiter &phash, setMemPoolParents) {
+            // If this is a new ancestor, add it.
+            if (!setAncestors.count(phash))
+                parentHashes.insert(phash);
+        }
+    }
+}
+
+void CTxMemPool::CalculateDescendants(txiter entryit, setEntries &setDescendants) const
+{
+    setEntries stage;
+    if (!setDescendants.count(entryit))
+        stage.insert(entryit);
+    // Traverse down the children of entry, only adding children that are not
+    // accounted for in setDescendants already (because those children have
+    // either already been walked, or will be walked in this iteration).
+    while (!stage.empty()) {
+        txiter it = *stage.begin();
+        setDescendants.insert(it);
+        stage.erase(it);
+
+        const setEntries &setChildren = GetMemPoolChildren(it);
+        BOOST_FOREACH(const txiter &childiter, setChildren) {
+            if (!setDescendants.count(childiter))
+                stage.insert(childiter);
+        }
+    }
+}
+
+void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors)
+{
+    const setEntries &parentIters = GetMemPoolParents(it);
+    // add or remove this tx as a child of each parent
+    BOOST_FOREACH(txiter piter, parentIters) {
+        UpdateChild(piter, it, add);
+    }
+    const int64_t updateCount = (add ? 1 : -1);
+    const int64_t updateSize = updateCount * it->GetTxSize();
+    const CAmount updateFee = updateCount * it->GetModifiedFee();
+    BOOST_FOREACH(txiter ancestorIt, setAncestors) {
+        mapTx.modify(ancestorIt, update_descendant_state(updateSize, updateFee, updateCount));
+    }
+}
+
+void CTxMemPool::UpdateEntryForAncestors(txiter it, const setEntries &setAncestors)
+{
+    int64_t updateCount = setAncestors.size();
+    int64_t updateSize = 0;
+    CAmount updateFee = 0;
+    int updateSigOps = 0;
+    BOOST_FOREACH(txiter ancestorIt, setAncestors) {
+        updateSize += ancestorIt->GetTxSize();
+        updateFee += ancestorIt->GetModifiedFee();
+        updateSigOps += ancestorIt->GetSigOpCount();
+    }
+    mapTx.modify(it, update_ancestor_state(updateSize, updateFee, updateCount, updateSigOps));
+}
+
+void CTxMemPool::UpdateChildrenForRemoval(txiter it)
+{
+    const setEntries &setMemPoolChildren = GetMemPoolChildren(it);
+    BOOST_FOREACH(txiter updateIt, setMemPoolChildren) {
+        UpdateParent(updateIt, it, false);
+    }
+}
+
+void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, bool updateDescendants)
+{
+    if (updateDescendants) {
+        // Descendants staying behind, as when a transaction is confirmed in
+        // a block, lose it as an ancestor. Only the cached state is updated
+        // here; mapLinks is still needed to walk the mempool below.
+        BOOST_FOREACH(txiter removeIt, entriesToRemove) {
+            setEntries setDescendants;
+            CalculateDescendants(removeIt, setDescendants);
+            setDescendants.erase(removeIt); // don't update state for self
+            int64_t modifySize = -((int64_t)removeIt->GetTxSize());
+            CAmount modifyFee = -removeIt->GetModifiedFee();
+            int modifySigOps = -(int)removeIt->GetSigOpCount();
+            BOOST_FOREACH(txiter dit, setDescendants) {
+                mapTx.modify(dit, update_ancestor_state(modifySize, modifyFee, -1, modifySigOps));
+            }
+        }
+    }
+    // For each entry, walk back all ancestors and take this transaction out
+    // of their descendant state.
+    BOOST_FOREACH(txiter removeIt, entriesToRemove) {
+        setEntries setAncestors;
+        // Use the links rather than searching for parents: in the middle of
+        // a reorg, before UpdateTransactionsFromBlock has run, the links are
+        // exactly the ancestors whose packages include this transaction.
+        CalculateMemPoolAncestors(*removeIt, setAncestors, false);
+        // This also severs the links from the parents of removeIt.
+        UpdateAncestorsOf(false, removeIt, setAncestors);
+    }
+    // Now sever the links from the children of the removed transactions.
+    BOOST_FOREACH(txiter removeIt, entriesToRemove) {
+        UpdateChildrenForRemoval(removeIt);
+    }
+}
+
 bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, bool fCurrentEstimate)
+{
+    LOCK(cs);
+    setEntries setAncestors;
+    CalculateMemPoolAncestors(entry, setAncestors);
+    return addUnchecked(hash, entry, setAncestors, fCurrentEstimate);
+}
+
+bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, setEntries &setAncestors, bool fCurrentEstimate)
 {
     // Add to memory pool without checking anything.
     // Used by main.cpp AcceptToMemoryPool(), which DOES do
     // all the appropriate checks.
     LOCK(cs);
-    mapTx.insert(entry);
-    const CTransaction& tx = mapTx.find(hash)->GetTx();
-    for (unsigned int i = 0; i < tx.vin.size(); i++)
+    indexed_transaction_set::iterator newit = mapTx.insert(entry).first;
+    mapLinks.insert(make_pair(newit, TxLinks()));
+
+    // Update transaction for any feeDelta created by PrioritiseTransaction
+    std::map<uint256, std::pair<double, CAmount> >::const_iterator pos = mapDeltas.find(hash);
+    if (pos != mapDeltas.end() && pos->second.second != 0)
+        mapTx.modify(newit, update_fee_delta(pos->second.second));
+    mapTx.modify(newit, update_sequence(++nSequence));
+
+    const CTransaction& tx = newit->GetTx();
+    std::set<uint256> setParentTransactions;
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
         mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
+        setParentTransactions.insert(tx.vin[i].prevout.hash);
+    }
     BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
         BOOST_FOREACH(const uint256 &nf, joinsplit.nullifiers) {
             mapSproutNullifiers[nf] = &tx;
         }
+        setSproutAnchors.insert(std::make_pair(joinsplit.anchor, hash));
     }
     for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
         mapSaplingNullifiers[spendDescription.nullifier] = &tx;
+        setSaplingAnchors.insert(std::make_pair(spendDescription.anchor, hash));
     }
+
+    // A new transaction normally has no children in the mempool, as they
+    // would have been orphans. The exception is a transaction that was in
+    // a disconnected block; UpdateTransactionsFromBlock links those up.
+    BOOST_FOREACH(const uint256 &phash, setParentTransactions) {
+        txiter pit = mapTx.find(phash);
+        if (pit != mapTx.end())
+            UpdateParent(newit, pit, true);
+    }
+    UpdateAncestorsOf(true, newit, setAncestors);
+    UpdateEntryForAncestors(newit, setAncestors);
+
     nTransactionsUpdated++;
     totalTxSize += entry.GetTxSize();
     cachedInnerUsage += entry.DynamicMemoryUsage();
     minerPolicyEstimator->processTransaction(entry, fCurrentEstimate);
+    NotifyEntryAdded(*newit);
 
     return true;
 }
 
+void CTxMemPool::removeUnchecked(txiter it)
+{
+    const uint256 hash = it->GetTx().GetHash();
+    const CTransaction& tx = it->GetTx();
+    NotifyEntryRemoved(tx);
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        mapNextTx.erase(txin.prevout);
+    BOOST_FOREACH(const JSDescription& joinsplit, tx.vjoinsplit) {
+        BOOST_FOREACH(const uint256& nf, joinsplit.nullifiers) {
+            mapSproutNullifiers.erase(nf);
+        }
+        setSproutAnchors.erase(std::make_pair(joinsplit.anchor, hash));
+    }
+    for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
+        mapSaplingNullifiers.erase(spendDescription.nullifier);
+        setSaplingAnchors.erase(std::make_pair(spendDescription.anchor, hash));
+    }
+
+    totalTxSize -= it->GetTxSize();
+    cachedInnerUsage -= it->DynamicMemoryUsage();
+    cachedInnerUsage -= memusage::DynamicUsage(mapLinks[it].parents) + memusage::DynamicUsage(mapLinks[it].children);
+    mapLinks.erase(it);
+    mapTx.erase(it);
+    nTransactionsUpdated++;
+    removedLog.push_back(std::make_pair(++nSequence, hash));
+    if (removedLog.size() > MEMPOOL_REMOVED_LOG_SIZE) {
+        nRemovedLogStart = removedLog.front().first;
+        removedLog.pop_front();
+    }
+    minerPolicyEstimator->removeTx(hash);
+}
+
+void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants)
+{
+    AssertLockHeld(cs);
+    UpdateForRemoveFromMempool(stage, updateDescendants);
+    BOOST_FOREACH(const txiter& it, stage) {
+        removeUnchecked(it);
+    }
+}
 
 void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& removed, bool fRecursive)
 {
     // Remove transaction from memory pool
     {
         LOCK(cs);
-        std::deque<uint256> txToRemove;
-        txToRemove.push_back(origTx.GetHash());
-        if (fRecursive && !mapTx.count(origTx.GetHash())) {
+        setEntries txToRemove;
+        txiter origit = mapTx.find(origTx.GetHash());
+        if (origit != mapTx.end()) {
+            txToRemove.insert(origit);
+        } else if (fRecursive) {
             // If recursively removing but origTx isn't in the mempool
             // be sure to remove any children that are in the pool. This can
             // happen during chain re-orgs if origTx isn't re-accepted into
             // the mempool for any reason.
             for (unsigned int i = 0; i < origTx.vout.size(); i++) {
-                std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(origTx.GetHash(), i));
+                NextTxMap::iterator it = mapNextTx.find(COutPoint(origTx.GetHash(), i));
                 if (it == mapNextTx.end())
                     continue;
-                txToRemove.push_back(it->second.ptx->GetHash());
+                txiter nextit = mapTx.find(it->second.ptx->GetHash());
+                assert(nextit != mapTx.end());
+                txToRemove.insert(nextit);
             }
         }
-        while (!txToRemove.empty())
-        {
-            uint256 hash = txToRemove.front();
-            txToRemove.pop_front();
-            if (!mapTx.count(hash))
-                continue;
-            const CTransaction& tx = mapTx.find(hash)->GetTx();
-            if (fRecursive) {
-                for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
-                    if (it == mapNextTx.end())
-                        continue;
-                    txToRemove.push_back(it->second.ptx->GetHash());
-                }
-            }
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-                mapNextTx.erase(txin.prevout);
-            BOOST_FOREACH(const JSDescription& joinsplit, tx.vjoinsplit) {
-                BOOST_FOREACH(const uint256& nf, joinsplit.nullifiers) {
-                    mapSproutNullifiers.erase(nf);
-                }
-            }
-            for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
-                mapSaplingNullifiers.erase(spendDescription.nullifier);
+        setEntries setAllRemoves;
+        if (fRecursive) {
+            BOOST_FOREACH(txiter it, txToRemove) {
+                CalculateDescendants(it, setAllRemoves);
             }
-            removed.push_back(tx);
-            totalTxSize -= mapTx.find(hash)->GetTxSize();
-            cachedInnerUsage -= mapTx.find(hash)->DynamicMemoryUsage();
-            mapTx.erase(hash);
-            nTransactionsUpdated++;
-            minerPolicyEstimator->removeTx(hash);
+        } else {
+            setAllRemoves.swap(txToRemove);
+        }
+        BOOST_FOREACH(txiter it, setAllRemoves) {
+            removed.push_back(it->GetTx());
         }
+        RemoveStaged(setAllRemoves, !fRecursive);
     }
 }
 
@@ -180,29 +465,30 @@ void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMem
 {
     // Remove transactions spending a coinbase which are now immature and no-longer-final transactions
     LOCK(cs);
-    list<CTransaction> transactionsToRemove;
+    setEntries txToRemove;
     for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
         const CTransaction& tx = it->GetTx();
         if (!CheckFinalTx(tx, flags)) {
-            transactionsToRemove.push_back(tx);
+            txToRemove.insert(it);
         } else if (it->GetSpendsCoinbase()) {
             BOOST_FOREACH(const CTxIn& txin, tx.vin) {
                 indexed_transaction_set::const_iterator it2 = mapTx.find(txin.prevout.hash);
                 if (it2 != mapTx.end())
                     continue;
-                const CCoins *coins = pcoins->AccessCoins(txin.prevout.hash);
-		if (nCheckFrequency != 0) assert(coins);
-                if (!coins || (coins->IsCoinBase() && ((signed long)nMemPoolHeight) - coins->nHeight < COINBASE_MATURITY)) {
-                    transactionsToRemove.push_back(tx);
+                const Coin &coin = pcoins->AccessCoin(txin.prevout);
+                if (nCheckFrequency != 0) assert(!coin.IsSpent());
+                if (coin.IsSpent() || (coin.IsCoinBase() && ((signed long)nMemPoolHeight) - coin.nHeight < COINBASE_MATURITY)) {
+                    txToRemove.insert(it);
                     break;
                 }
             }
         }
     }
-    BOOST_FOREACH(const CTransaction& tx, transactionsToRemove) {
-        list<CTransaction> removed;
-        remove(tx, removed, true);
+    setEntries setAllRemoves;
+    BOOST_FOREACH(txiter it, txToRemove) {
+        CalculateDescendants(it, setAllRemoves);
     }
+    RemoveStaged(setAllRemoves, false);
 }
 
 
@@ -213,37 +499,29 @@ void CTxMemPool::removeWithAnchor(const uint256 &invalidRoot, ShieldedType type)
     // from that root -- almost as though they were spending coinbases
     // which are no longer valid to spend due to coinbase maturity.
     LOCK(cs);
-    list<CTransaction> transactionsToRemove;
-
-    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
-        const CTransaction& tx = it->GetTx();
-        switch (type) {
-            case SPROUT:
-                BOOST_FOREACH(const JSDescription& joinsplit, tx.vjoinsplit) {
-                    if (joinsplit.anchor == invalidRoot) {
-                        transactionsToRemove.push_back(tx);
-                        break;
-                    }
-                }
-            break;
-            case SAPLING:
-                BOOST_FOREACH(const SpendDescription& spendDescription, tx.vShieldedSpend) {
-                    if (spendDescription.anchor == invalidRoot) {
-                        transactionsToRemove.push_back(tx);
-                        break;
-                    }
-                }
+    const AnchorIndex* setToUse;
+    switch (type) {
+        case SPROUT:
+            setToUse = &setSproutAnchors;
             break;
-            default:
-                throw runtime_error("Unknown shielded type");
+        case SAPLING:
+            setToUse = &setSaplingAnchors;
             break;
-        }
+        default:
+            throw runtime_error("Unknown shielded type");
     }
 
-    BOOST_FOREACH(const CTransaction& tx, transactionsToRemove) {
-        list<CTransaction> removed;
-        remove(tx, removed, true);
+    setEntries txToRemove;
+    for (AnchorIndex::const_iterator it = setToUse->lower_bound(std::make_pair(invalidRoot, uint256()));
+         it != setToUse->end() && it->first == invalidRoot; it++) {
+        txToRemove.insert(mapTx.find(it->second));
     }
+
+    setEntries setAllRemoves;
+    BOOST_FOREACH(txiter it, txToRemove) {
+        CalculateDescendants(it, setAllRemoves);
+    }
+    RemoveStaged(setAllRemoves, false);
 }
 
 void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>& removed)
@@ -252,7 +530,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
     list<CTransaction> result;
     LOCK(cs);
     BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-        std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(txin.prevout);
+        NextTxMap::iterator it = mapNextTx.find(txin.prevout);
         if (it != mapNextTx.end()) {
             const CTransaction &txConflict = *it->second.ptx;
             if (txConflict != tx)
@@ -264,7 +542,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
 
     BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
         BOOST_FOREACH(const uint256 &nf, joinsplit.nullifiers) {
-            std::map<uint256, const CTransaction*>::iterator it = mapSproutNullifiers.find(nf);
+            NullifierMap::iterator it = mapSproutNullifiers.find(nf);
             if (it != mapSproutNullifiers.end()) {
                 const CTransaction &txConflict = *it->second;
                 if (txConflict != tx) {
@@ -274,7 +552,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
         }
     }
     for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
-        std::map<uint256, const CTransaction*>::iterator it = mapSaplingNullifiers.find(spendDescription.nullifier);
+        NullifierMap::iterator it = mapSaplingNullifiers.find(spendDescription.nullifier);
         if (it != mapSaplingNullifiers.end()) {
             const CTransaction &txConflict = *it->second;
             if (txConflict != tx) {
@@ -286,48 +564,59 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
 
 void CTxMemPool::removeExpired(unsigned int nBlockHeight)
 {
-    // Remove expired txs from the mempool
+    // Remove expired txs from the mempool: those with an expiry height
+    // below nBlockHeight, as 0 means they never expire
     LOCK(cs);
-    list<CTransaction> transactionsToRemove;
-    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++)
+    setEntries txToRemove;
+    const indexed_transaction_set::index<expiry_height>::type& index = mapTx.get<expiry_height>();
+    for (indexed_transaction_set::index<expiry_height>::type::const_iterator it = index.lower_bound(1);
+         it != index.end() && it->GetTx().nExpiryHeight < nBlockHeight; it++)
     {
         const CTransaction& tx = it->GetTx();
-        if (IsExpiredTx(tx, nBlockHeight)) {
-            transactionsToRemove.push_back(tx);
-        }
-    }
-    for (const CTransaction& tx : transactionsToRemove) {
-        list<CTransaction> removed;
-        remove(tx, removed, true);
+        assert(IsExpiredTx(tx, nBlockHeight));
+        txToRemove.insert(mapTx.project<0>(it));
         LogPrint("mempool", "Removing expired txid: %s\n", tx.GetHash().ToString());
     }
+    setEntries setAllRemoves;
+    BOOST_FOREACH(txiter it, txToRemove) {
+        CalculateDescendants(it, setAllRemoves);
+    }
+    RemoveStaged(setAllRemoves, false);
 }
 
 /**
  * Called when a block is connected. Removes from mempool and updates the miner fee estimator.
  */
-void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight,
+void CTxMemPool::removeForBlock(const std::vector<CTransactionRef>& vtx, unsigned int nBlockHeight,
                                 std::list<CTransaction>& conflicts, bool fCurrentEstimate)
 {
     LOCK(cs);
     std::vector<CTxMemPoolEntry> entries;
-    BOOST_FOREACH(const CTransaction& tx, vtx)
+    BOOST_FOREACH(const CTransactionRef& tx, vtx)
     {
-        uint256 hash = tx.GetHash();
+        uint256 hash = tx->GetHash();
 
         indexed_transaction_set::iterator i = mapTx.find(hash);
         if (i != mapTx.end())
             entries.push_back(*i);
     }
-    BOOST_FOREACH(const CTransaction& tx, vtx)
+    BOOST_FOREACH(const CTransactionRef& tx, vtx)
     {
-        std::list<CTransaction> dummy;
-        remove(tx, dummy, false);
-        removeConflicts(tx, conflicts);
-        ClearPrioritisation(tx.GetHash());
+        // The transactions of the block come in order, so whatever is
+        // removed here has no in-mempool ancestors left.
+        txiter it = mapTx.find(tx->GetHash());
+        if (it != mapTx.end()) {
+            setEntries stage;
+            stage.insert(it);
+            RemoveStaged(stage, true);
+        }
+        removeConflicts(*tx, conflicts);
+        ClearPrioritisation(tx->GetHash());
     }
     // After the txs in the new block have been removed from the mempool, update policy estimates
     minerPolicyEstimator->processBlock(nBlockHeight, entries, fCurrentEstimate);
+    lastRollingFeeUpdate = GetTime();
+    blockSinceLastRollingFeeBump = true;
 }
 
 /**
@@ -337,29 +626,44 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
 void CTxMemPool::removeWithoutBranchId(uint32_t nMemPoolBranchId)
 {
     LOCK(cs);
-    std::list<CTransaction> transactionsToRemove;
-
-    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
-        const CTransaction& tx = it->GetTx();
-        if (it->GetValidatedBranchId() != nMemPoolBranchId) {
-            transactionsToRemove.push_back(tx);
-        }
+    setEntries txToRemove;
+
+    // Everything before and after the entries of the branch ID
+    const indexed_transaction_set::index<branch_id>::type& index = mapTx.get<branch_id>();
+    std::pair<indexed_transaction_set::index<branch_id>::type::const_iterator,
+              indexed_transaction_set::index<branch_id>::type::const_iterator> range = index.equal_range(nMemPoolBranchId);
+    for (indexed_transaction_set::index<branch_id>::type::const_iterator it = index.begin(); it != range.first; it++) {
+        txToRemove.insert(mapTx.project<0>(it));
+    }
+    for (indexed_transaction_set::index<branch_id>::type::const_iterator it = range.second; it != index.end(); it++) {
+        txToRemove.insert(mapTx.project<0>(it));
     }
 
-    for (const CTransaction& tx : transactionsToRemove) {
-        std::list<CTransaction> removed;
-        remove(tx, removed, true);
+    setEntries setAllRemoves;
+    BOOST_FOREACH(txiter it, txToRemove) {
+        CalculateDescendants(it, setAllRemoves);
     }
+    RemoveStaged(setAllRemoves, false);
 }
 
 void CTxMemPool::clear()
 {
     LOCK(cs);
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++)
+        NotifyEntryRemoved(it->GetTx());
+    mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
+    mapSproutNullifiers.clear();
+    mapSaplingNullifiers.clear();
+    setSproutAnchors.clear();
+    setSaplingAnchors.clear();
     totalTxSize = 0;
     cachedInnerUsage = 0;
     ++nTransactionsUpdated;
+    // Nothing is logged for the cleared entries, so older deltas are unknown
+    nRemovedLogStart = ++nSequence;
+    removedLog.clear();
 }
 
 void CTxMemPool::check(const CCoinsViewCache *pcoins) const
@@ -385,7 +689,12 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         checkTotal += it->GetTxSize();
         innerUsage += it->DynamicMemoryUsage();
         const CTransaction& tx = it->GetTx();
+        txlinksMap::const_iterator linksiter = mapLinks.find(it);
+        assert(linksiter != mapLinks.end());
+        const TxLinks &links = linksiter->second;
+        innerUsage += memusage::DynamicUsage(links.parents) + memusage::DynamicUsage(links.children);
         bool fDependsWait = false;
+        setEntries setParentCheck;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
             // Check that every mempool transaction's inputs refer to available coins, or other mempool tx's.
             indexed_transaction_set::const_iterator it2 = mapTx.find(txin.prevout.hash);
@@ -393,17 +702,60 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                 const CTransaction& tx2 = it2->GetTx();
                 assert(tx2.vout.size() > txin.prevout.n && !tx2.vout[txin.prevout.n].IsNull());
                 fDependsWait = true;
+                setParentCheck.insert(it2);
             } else {
-                const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
-                assert(coins && coins->IsAvailable(txin.prevout.n));
+                assert(pcoins->HaveCoin(txin.prevout));
             }
             // Check whether its inputs are marked in mapNextTx.
-            std::map<COutPoint, CInPoint>::const_iterator it3 = mapNextTx.find(txin.prevout);
+            NextTxMap::const_iterator it3 = mapNextTx.find(txin.prevout);
             assert(it3 != mapNextTx.end());
             assert(it3->second.ptx == &tx);
             assert(it3->second.n == i);
             i++;
         }
+        assert(setParentCheck == GetMemPoolParents(it));
+
+        // Verify the cached ancestor state
+        setEntries setAncestors;
+        CalculateMemPoolAncestors(*it, setAncestors);
+        uint64_t nCountCheck = setAncestors.size() + 1;
+        uint64_t nSizeCheck = it->GetTxSize();
+        CAmount nFeesCheck = it->GetModifiedFee();
+        unsigned int nSigOpCheck = it->GetSigOpCount();
+        BOOST_FOREACH(txiter ancestorIt, setAncestors) {
+            nSizeCheck += ancestorIt->GetTxSize();
+            nFeesCheck += ancestorIt->GetModifiedFee();
+            nSigOpCheck += ancestorIt->GetSigOpCount();
+        }
+        assert(it->GetCountWithAncestors() == nCountCheck);
+        assert(it->GetSizeWithAncestors() == nSizeCheck);
+        assert(it->GetModFeesWithAncestors() == nFeesCheck);
+        assert(it->GetSigOpCountWithAncestors() == nSigOpCheck);
+
+        // Check children against mapNextTx
+        setEntries setChildrenCheck;
+        for (unsigned int i = 0; i < tx.vout.size(); i++) {
+            NextTxMap::const_iterator iter = mapNextTx.find(COutPoint(tx.GetHash(), i));
+            if (iter == mapNextTx.end())
+                continue;
+            txiter childit = mapTx.find(iter->second.ptx->GetHash());
+            assert(childit != mapTx.end()); // mapNextTx points to in-mempool transactions
+            setChildrenCheck.insert(childit);
+        }
+        assert(setChildrenCheck == GetMemPoolChildren(it));
+
+        // ... and the cached descendant state
+        setEntries setDescendants;
+        CalculateDescendants(it, setDescendants);
+        nSizeCheck = 0;
+        nFeesCheck = 0;
+        BOOST_FOREACH(txiter descendantIt, setDescendants) {
+            nSizeCheck += descendantIt->GetTxSize();
+            nFeesCheck += descendantIt->GetModifiedFee();
+        }
+        assert(it->GetCountWithDescendants() == setDescendants.size());
+        assert(it->GetSizeWithDescendants() == nSizeCheck);
+        assert(it->GetModFeesWithDescendants() == nFeesCheck);
 
         boost::unordered_map<uint256, SproutMerkleTree, CCoinsKeyHasher> intermediates;
 
@@ -428,9 +780,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             intermediates.insert(std::make_pair(tree.root(), tree));
         }
         for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
-            SaplingMerkleTree tree;
-
-            assert(pcoins->GetSaplingAnchorAt(spendDescription.anchor, tree));
+            assert(pcoins->HaveAnchor(spendDescription.anchor, SAPLING));
             assert(!pcoins->GetNullifier(spendDescription.nullifier, SAPLING));
         }
         if (fDependsWait)
@@ -460,7 +810,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             stepsSinceLastRemove = 0;
         }
     }
-    for (std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++) {
+    for (NextTxMap::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++) {
         uint256 hash = it->second.ptx->GetHash();
         indexed_transaction_set::const_iterator it2 = mapTx.find(hash);
         const CTransaction& tx = it2->GetTx();
@@ -472,6 +822,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 
     checkNullifiers(SPROUT);
     checkNullifiers(SAPLING);
+    checkAnchors();
 
     assert(totalTxSize == checkTotal);
     assert(innerUsage == cachedInnerUsage);
@@ -479,7 +830,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 
 void CTxMemPool::checkNullifiers(ShieldedType type) const
 {
-    const std::map<uint256, const CTransaction*>* mapToUse;
+    const NullifierMap* mapToUse;
     switch (type) {
         case SPROUT:
             mapToUse = &mapSproutNullifiers;
@@ -499,6 +850,27 @@ void CTxMemPool::checkNullifiers(ShieldedType type) const
     }
 }
 
+void CTxMemPool::checkAnchors() const
+{
+    size_t nSprout = 0, nSapling = 0;
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+        const CTransaction& tx = it->GetTx();
+        AnchorIndex setSprout, setSapling;
+        for (const JSDescription& joinsplit : tx.vjoinsplit)
+            setSprout.insert(std::make_pair(joinsplit.anchor, tx.GetHash()));
+        for (const SpendDescription& spendDescription : tx.vShieldedSpend)
+            setSapling.insert(std::make_pair(spendDescription.anchor, tx.GetHash()));
+        for (const std::pair<uint256, uint256>& anchor : setSprout)
+            assert(setSproutAnchors.count(anchor));
+        for (const std::pair<uint256, uint256>& anchor : setSapling)
+            assert(setSaplingAnchors.count(anchor));
+        nSprout += setSprout.size();
+        nSapling += setSapling.size();
+    }
+    assert(setSproutAnchors.size() == nSprout);
+    assert(setSaplingAnchors.size() == nSapling);
+}
+
 void CTxMemPool::queryHashes(vector<uint256>& vtxid)
 {
     vtxid.clear();
@@ -518,6 +890,74 @@ bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
     return true;
 }
 
+CTransactionRef CTxMemPool::get(const uint256& hash) const
+{
+    LOCK(cs);
+    indexed_transaction_set::const_iterator i = mapTx.find(hash);
+    if (i == mapTx.end())
+        return CTransactionRef();
+    return i->GetSharedTx();
+}
+
+bool CTxMemPool::infoSince(uint64_t nSince, unsigned int nCurrentHeight, std::vector<TxMempoolInfo>& vInfo,
+                           std::vector<uint256>& vRemoved, uint64_t& nSequenceOut) const
+{
+    LOCK(cs);
+    bool fKnown = nSince == 0 || (nSince >= nRemovedLogStart && nSince <= nSequence);
+    if (!fKnown)
+        nSince = 0;
+
+    vRemoved.clear();
+    if (nSince > 0) {
+        std::deque<std::pair<uint64_t, uint256> >::const_iterator rit = std::upper_bound(
+            removedLog.begin(), removedLog.end(), std::make_pair(nSince, uint256()),
+            [](const std::pair<uint64_t, uint256>& a, const std::pair<uint64_t, uint256>& b) { return a.first < b.first; });
+        for (; rit != removedLog.end(); ++rit)
+            vRemoved.push_back(rit->second);
+    }
+
+    vInfo.clear();
+    vInfo.reserve(nSince == 0 ? mapTx.size() : 0);
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); ++it) {
+        if (it->GetSequence() <= nSince)
+            continue;
+        vInfo.push_back(TxMempoolInfo());
+        TxMempoolInfo& info = vInfo.back();
+        info.hash = it->GetTx().GetHash();
+        info.nSequence = it->GetSequence();
+        info.nFee = it->GetFee();
+        info.nTxSize = it->GetTxSize();
+        info.nTime = it->GetTime();
+        info.nHeight = it->GetHeight();
+        info.dStartingPriority = it->GetPriority(it->GetHeight());
+        info.dCurrentPriority = it->GetPriority(nCurrentHeight);
+        const setEntries& parents = GetMemPoolParents(it);
+        info.vDepends.reserve(parents.size());
+        BOOST_FOREACH(const txiter& pit, parents)
+            info.vDepends.push_back(pit->GetTx().GetHash());
+    }
+    nSequenceOut = nSequence;
+    return fKnown;
+}
+
+std::shared_ptr<const PrecomputedTransactionData> CTxMemPool::GetTxData(const uint256& hash) const
+{
+    LOCK(cs);
+    indexed_transaction_set::const_iterator i = mapTx.find(hash);
+    if (i == mapTx.end()) return std::shared_ptr<const PrecomputedTransactionData>();
+    return i->GetTxData();
+}
+
+bool CTxMemPool::GetSigOpCount(const uint256& hash, unsigned int& nSigOps) const
+{
+    LOCK(cs);
+    indexed_transaction_set::const_iterator i = mapTx.find(hash);
+    if (i == mapTx.end())
+        return false;
+    nSigOps = i->GetSigOpCount();
+    return true;
+}
+
 CFeeRate CTxMemPool::estimateFee(int nBlocks) const
 {
     LOCK(cs);
@@ -571,6 +1011,23 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         std::pair<double, CAmount> &deltas = mapDeltas[hash];
         deltas.first += dPriorityDelta;
         deltas.second += nFeeDelta;
+        txiter it = mapTx.find(hash);
+        if (it != mapTx.end()) {
+            mapTx.modify(it, update_fee_delta(deltas.second));
+            // Now update all ancestors' modified fees with descendants
+            setEntries setAncestors;
+            CalculateMemPoolAncestors(*it, setAncestors, false);
+            BOOST_FOREACH(txiter ancestorIt, setAncestors) {
+                mapTx.modify(ancestorIt, update_descendant_state(0, nFeeDelta, 0));
+            }
+            // ... and all descendants' modified fees with ancestors
+            setEntries setDescendants;
+            CalculateDescendants(it, setDescendants);
+            setDescendants.erase(it);
+            BOOST_FOREACH(txiter descendantIt, setDescendants) {
+                mapTx.modify(descendantIt, update_ancestor_state(0, nFeeDelta, 0, 0));
+            }
+        }
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -619,24 +1076,139 @@ bool CCoinsViewMemPool::GetNullifier(const uint256 &nf, ShieldedType type) const
     return mempool.nullifierExists(nf, type) || base->GetNullifier(nf, type);
 }
 
-bool CCoinsViewMemPool::GetCoins(const uint256 &txid, CCoins &coins) const {
+bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     // If an entry in the mempool exists, always return that one, as it's guaranteed to never
     // conflict with the underlying cache, and it cannot have pruned entries (as it contains full)
     // transactions. First checking the underlying cache risks returning a pruned entry instead.
-    CTransaction tx;
-    if (mempool.lookup(txid, tx)) {
-        coins = CCoins(tx, MEMPOOL_HEIGHT);
-        return true;
+    CTransactionRef ptx = mempool.get(outpoint.hash);
+    if (ptx) {
+        if (outpoint.n < ptx->vout.size()) {
+            coin = Coin(ptx->vout[outpoint.n], MEMPOOL_HEIGHT, false);
+            return true;
+        } else {
+            return false;
+        }
     }
-    return (base->GetCoins(txid, coins) && !coins.IsPruned());
+    return (base->GetCoin(outpoint, coin) && !coin.IsSpent());
 }
 
-bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
-    return mempool.exists(txid) || base->HaveCoins(txid);
+bool CCoinsViewMemPool::HaveCoin(const COutPoint &outpoint) const {
+    Coin coin;
+    return GetCoin(outpoint, coin);
 }
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
-    // Estimate the overhead of mapTx to be 6 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 6 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + cachedInnerUsage;
+    // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + mapNextTx.DynamicMemoryUsage() +
+           mapSproutNullifiers.DynamicMemoryUsage() + mapSaplingNullifiers.DynamicMemoryUsage() +
+           memusage::DynamicUsage(setSproutAnchors) + memusage::DynamicUsage(setSaplingAnchors) +
+           memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + cachedInnerUsage;
+}
+
+CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const {
+    LOCK(cs);
+    if (!blockSinceLastRollingFeeBump || rollingMinimumFeeRate == 0)
+        return CFeeRate(rollingMinimumFeeRate);
+
+    int64_t time = GetTime();
+    if (time > lastRollingFeeUpdate + 10) {
+        double halflife = ROLLING_FEE_HALFLIFE;
+        if (DynamicMemoryUsage() < sizelimit / 4)
+            halflife /= 4;
+        else if (DynamicMemoryUsage() < sizelimit / 2)
+            halflife /= 2;
+
+        rollingMinimumFeeRate = rollingMinimumFeeRate / pow(2.0, (time - lastRollingFeeUpdate) / halflife);
+        lastRollingFeeUpdate = time;
+
+        if (rollingMinimumFeeRate < minReasonableRelayFee.GetFeePerK() / 2) {
+            rollingMinimumFeeRate = 0;
+            return CFeeRate(0);
+        }
+    }
+    return std::max(CFeeRate(rollingMinimumFeeRate), minReasonableRelayFee);
+}
+
+void CTxMemPool::trackPackageRemoved(const CFeeRate& rate) {
+    AssertLockHeld(cs);
+    if (rate.GetFeePerK() > rollingMinimumFeeRate) {
+        rollingMinimumFeeRate = rate.GetFeePerK();
+        blockSinceLastRollingFeeBump = false;
+    }
+}
+
+void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining) {
+    LOCK(cs);
+
+    unsigned nTxnRemoved = 0;
+    CFeeRate maxFeeRateRemoved(0);
+    while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit) {
+        indexed_transaction_set::index<descendant_score>::type::iterator it = mapTx.get<descendant_score>().end();
+        --it;
+
+        // The new minimum fee is the fee rate of the removed package plus the
+        // minimum relay fee, so that transactions paying what was just evicted
+        // cannot come straight back in before a block is found.
+        CFeeRate removed(it->GetModFeesWithDescendants(), it->GetSizeWithDescendants());
+        removed = CFeeRate(removed.GetFeePerK() + minReasonableRelayFee.GetFeePerK());
+        trackPackageRemoved(removed);
+        maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
+
+        setEntries stage;
+        CalculateDescendants(mapTx.project<0>(it), stage);
+        nTxnRemoved += stage.size();
+
+        std::vector<COutPoint> vPrevouts;
+        if (pvNoSpendsRemaining) {
+            BOOST_FOREACH(txiter stageit, stage) {
+                BOOST_FOREACH(const CTxIn& txin, stageit->GetTx().vin)
+                    vPrevouts.push_back(txin.prevout);
+            }
+        }
+        RemoveStaged(stage, false);
+        BOOST_FOREACH(const COutPoint& prevout, vPrevouts) {
+            if (!mapTx.count(prevout.hash) && !mapNextTx.count(prevout))
+                pvNoSpendsRemaining->push_back(prevout);
+        }
+    }
+
+    if (maxFeeRateRemoved > CFeeRate(0))
+        LogPrint("mempool", "Removed %u txn, rolling minimum fee bumped to %s\n", nTxnRemoved, maxFeeRateRemoved.ToString());
+}
+
+void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
+{
+    setEntries s;
+    if (add && mapLinks[entry].children.insert(child).second) {
+        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
+    } else if (!add && mapLinks[entry].children.erase(child)) {
+        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    }
+}
+
+void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
+{
+    setEntries s;
+    if (add && mapLinks[entry].parents.insert(parent).second) {
+        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
+    } else if (!add && mapLinks[entry].parents.erase(parent)) {
+        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    }
+}
+
+const CTxMemPool::setEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
+{
+    assert(entry != mapTx.end());
+    txlinksMap::const_iterator it = mapLinks.find(entry);
+    assert(it != mapLinks.end());
+    return it->second.parents;
+}
+
+const CTxMemPool::setEntries & CTxMemPool::GetMemPoolChildren(txiter entry) const
+{
+    assert(entry != mapTx.end());
+    txlinksMap::const_iterator it = mapLinks.find(entry);
+    assert(it != mapLinks.end());
+    return it->second.children;
 }
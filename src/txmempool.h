@@ -7,18 +7,26 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <deque>
 #include <list>
+#include <memory>
+#include <set>
 
 #include "amount.h"
 #include "coins.h"
+#include "openhashmap.h"
 #include "primitives/transaction.h"
 #include "sync.h"
 
 #undef foreach
 #include "boost/multi_index_container.hpp"
+#include "boost/multi_index/hashed_index.hpp"
 #include "boost/multi_index/ordered_index.hpp"
 
+#include <boost/signals2/signal.hpp>
+
 class CAutoFile;
+struct PrecomputedTransactionData;
 
 inline double AllowFreeThreshold()
 {
@@ -32,16 +40,25 @@ inline bool AllowFree(double dPriority)
     return dPriority > AllowFreeThreshold();
 }
 
-/** Fake height value used in CCoins to signify they are only in the memory pool (since 0.8) */
+/** Fake height value used in Coin to signify they are only in the memory pool (since 0.8) */
 static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
 
 /**
  * CTxMemPool stores these:
+ *
+ * Besides the transaction itself, each entry caches the size, fee and count
+ * of the set of in-mempool transactions it depends on ("ancestors") and of
+ * the set of in-mempool transactions depending on it ("descendants"). Both
+ * sets include the entry itself. CTxMemPool keeps these up to date as
+ * transactions are added and removed.
+ *
+ * Fees in the cached state are modified fees: the fee paid plus any delta
+ * set with prioritisetransaction.
  */
 class CTxMemPoolEntry
 {
 private:
-    CTransaction tx;
+    CTransactionRef tx;
     CAmount nFee; //! Cached to avoid expensive parent-transaction lookups
     size_t nTxSize; //! ... and avoid recomputing tx size
     size_t nModSize; //! ... and modified size for priority
@@ -52,29 +69,128 @@ private:
     unsigned int nHeight; //! Chain height when entering the mempool
     bool hadNoDependencies; //! Not dependent on any other txs when it entered the mempool
     bool spendsCoinbase; //! keep track of transactions that spend a coinbase
+    unsigned int nSigOpCount; //! Legacy and P2SH sigops
     uint32_t nBranchId; //! Branch ID this transaction is known to commit to, cached for efficiency
+    CAmount feeDelta; //! Fee delta applied with prioritisetransaction
+    uint64_t nSequence; //! Mempool sequence number at which it was added
+    std::shared_ptr<const PrecomputedTransactionData> txdata; //! Sighash midstates from the script checks at admission
+
+    // Information about descendants of this transaction that are in the
+    // mempool, including this one
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
+
+    // Analogous statistics for ancestor transactions
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    unsigned int nSigOpCountWithAncestors;
 
 public:
+    CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
+                    int64_t _nTime, double _dPriority, unsigned int _nHeight,
+                    bool poolHasNoInputsOf, bool spendsCoinbase,
+                    unsigned int nSigOps, uint32_t nBranchId);
+    //! Takes a copy of _tx
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                     int64_t _nTime, double _dPriority, unsigned int _nHeight,
-                    bool poolHasNoInputsOf, bool spendsCoinbase, uint32_t nBranchId);
+                    bool poolHasNoInputsOf, bool spendsCoinbase,
+                    unsigned int nSigOps, uint32_t nBranchId);
     CTxMemPoolEntry();
     CTxMemPoolEntry(const CTxMemPoolEntry& other);
 
-    const CTransaction& GetTx() const { return this->tx; }
+    const CTransaction& GetTx() const { return *this->tx; }
+    //! The transaction itself, for blocks and relay to share rather than copy
+    const CTransactionRef& GetSharedTx() const { return this->tx; }
     double GetPriority(unsigned int currentHeight) const;
     CAmount GetFee() const { return nFee; }
     CFeeRate GetFeeRate() const { return feeRate; }
     size_t GetTxSize() const { return nTxSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
+    uint64_t GetSequence() const { return nSequence; }
     bool WasClearAtEntry() const { return hadNoDependencies; }
+    unsigned int GetSigOpCount() const { return nSigOpCount; }
+    CAmount GetModifiedFee() const { return nFee + feeDelta; }
     size_t DynamicMemoryUsage() const { return nUsageSize; }
+    const std::shared_ptr<const PrecomputedTransactionData>& GetTxData() const { return txdata; }
+    //! Must be called before the entry is added to the pool, as it changes the memory usage
+    void SetTxData(const std::shared_ptr<const PrecomputedTransactionData>& txdataIn);
+
+    // Adjusts the descendant state
+    void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    // Adjusts the ancestor state
+    void UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount, int modifySigOps);
+    // Updates the fee delta used for the modified fee, and the package state
+    void UpdateFeeDelta(CAmount feeDelta);
+    void SetSequence(uint64_t nSequenceIn) { nSequence = nSequenceIn; }
+
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
+
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+    unsigned int GetSigOpCountWithAncestors() const { return nSigOpCountWithAncestors; }
 
     bool GetSpendsCoinbase() const { return spendsCoinbase; }
     uint32_t GetValidatedBranchId() const { return nBranchId; }
 };
 
+// Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
+struct update_descendant_state
+{
+    update_descendant_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount)
+    {}
+
+    void operator() (CTxMemPoolEntry &e)
+        { e.UpdateDescendantState(modifySize, modifyFee, modifyCount); }
+
+    private:
+        int64_t modifySize;
+        CAmount modifyFee;
+        int64_t modifyCount;
+};
+
+struct update_ancestor_state
+{
+    update_ancestor_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount, int _modifySigOps) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount), modifySigOps(_modifySigOps)
+    {}
+
+    void operator() (CTxMemPoolEntry &e)
+        { e.UpdateAncestorState(modifySize, modifyFee, modifyCount, modifySigOps); }
+
+    private:
+        int64_t modifySize;
+        CAmount modifyFee;
+        int64_t modifyCount;
+        int modifySigOps;
+};
+
+struct update_fee_delta
+{
+    update_fee_delta(CAmount _feeDelta) : feeDelta(_feeDelta) { }
+
+    void operator() (CTxMemPoolEntry &e) { e.UpdateFeeDelta(feeDelta); }
+
+private:
+    CAmount feeDelta;
+};
+
+struct update_sequence
+{
+    update_sequence(uint64_t _nSequence) : nSequence(_nSequence) { }
+
+    void operator() (CTxMemPoolEntry &e) { e.SetSequence(nSequence); }
+
+private:
+    uint64_t nSequence;
+};
+
 // extracts a TxMemPoolEntry's transaction hash
 struct mempoolentry_txid
 {
@@ -85,17 +201,88 @@ struct mempoolentry_txid
     }
 };
 
-class CompareTxMemPoolEntryByFee
+// extracts the height after which a TxMemPoolEntry's transaction expires, 0 if it never does
+struct mempoolentry_expiry
+{
+    typedef uint32_t result_type;
+    result_type operator() (const CTxMemPoolEntry &entry) const
+    {
+        return entry.GetTx().IsCoinBase() ? 0 : entry.GetTx().nExpiryHeight;
+    }
+};
+
+// extracts the branch ID a TxMemPoolEntry's transaction was validated against
+struct mempoolentry_branchid
+{
+    typedef uint32_t result_type;
+    result_type operator() (const CTxMemPoolEntry &entry) const
+    {
+        return entry.GetValidatedBranchId();
+    }
+};
+
+/**
+ * Sort by the higher of the fee rate of an entry alone and of the entry
+ * together with all of its descendants, highest first, using the modified
+ * fees. Ties are broken by time, oldest first. The package at the end is
+ * the one evicted when the mempool is full.
+ */
+class CompareTxMemPoolEntryByDescendantScore
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
-        if (a.GetFeeRate() == b.GetFeeRate())
+        bool fUseADescendants = UseDescendantScore(a);
+        bool fUseBDescendants = UseDescendantScore(b);
+
+        double aModFee = fUseADescendants ? a.GetModFeesWithDescendants() : a.GetModifiedFee();
+        double aSize = fUseADescendants ? a.GetSizeWithDescendants() : a.GetTxSize();
+
+        double bModFee = fUseBDescendants ? b.GetModFeesWithDescendants() : b.GetModifiedFee();
+        double bSize = fUseBDescendants ? b.GetSizeWithDescendants() : b.GetTxSize();
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
+        double f1 = aModFee * bSize;
+        double f2 = aSize * bModFee;
+
+        if (f1 == f2)
             return a.GetTime() < b.GetTime();
-        return a.GetFeeRate() > b.GetFeeRate();
+        return f1 > f2;
+    }
+
+    // Calculate which score to use for an entry (avoiding division).
+    static bool UseDescendantScore(const CTxMemPoolEntry& a)
+    {
+        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
+        double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
+        return f2 > f1;
+    }
+};
+
+/**
+ * Sort by the fee rate of an entry together with all of its ancestors,
+ * highest first, using the modified fees. Ties are broken by txid.
+ */
+class CompareTxMemPoolEntryByAncestorFee
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
+        double f1 = (double)a.GetModFeesWithAncestors() * b.GetSizeWithAncestors();
+        double f2 = (double)b.GetModFeesWithAncestors() * a.GetSizeWithAncestors();
+        if (f1 == f2)
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        return f1 > f2;
     }
 };
 
+// Multi_index tag names
+struct descendant_score {};
+struct ancestor_score {};
+struct expiry_height {};
+struct branch_id {};
+
 class CBlockPolicyEstimator;
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
@@ -112,6 +299,41 @@ public:
     size_t DynamicMemoryUsage() const { return 0; }
 };
 
+/**
+ * Summary of a mempool entry, copied out under the mempool lock so that
+ * it can be reported after the lock is released.
+ */
+struct TxMempoolInfo
+{
+    uint256 hash;
+    uint64_t nSequence;
+    CAmount nFee;
+    uint32_t nTxSize;
+    int64_t nTime;
+    uint32_t nHeight;
+    double dStartingPriority;
+    double dCurrentPriority;
+    std::vector<uint256> vDepends; //! In-mempool parents, sorted by txid
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hash);
+        READWRITE(nSequence);
+        READWRITE(nFee);
+        READWRITE(nTxSize);
+        READWRITE(nTime);
+        READWRITE(nHeight);
+        READWRITE(dStartingPriority);
+        READWRITE(dCurrentPriority);
+        READWRITE(vDepends);
+    }
+};
+
+/** Number of removed txids kept for mempool delta queries */
+static const unsigned int MEMPOOL_REMOVED_LOG_SIZE = 100000;
+
 /**
  * CTxMemPool stores valid-according-to-the-current-best-chain
  * transactions that may be included in the next block.
@@ -127,35 +349,102 @@ class CTxMemPool
 private:
     uint32_t nCheckFrequency; //! Value n means that n times in 2^32 we check.
     unsigned int nTransactionsUpdated;
+    uint64_t nSequence; //! Bumped for every transaction added to or removed from the pool
+    //! Recently removed txids with the sequence number of their removal, oldest first
+    std::deque<std::pair<uint64_t, uint256> > removedLog;
+    uint64_t nRemovedLogStart; //! Removals are known for sequence numbers after this
     CBlockPolicyEstimator* minerPolicyEstimator;
 
     uint64_t totalTxSize = 0; //! sum of all mempool tx' byte sizes
     uint64_t cachedInnerUsage; //! sum of dynamic memory usage of all the map elements (NOT the maps themselves)
 
-    std::map<uint256, const CTransaction*> mapSproutNullifiers;
-    std::map<uint256, const CTransaction*> mapSaplingNullifiers;
+    mutable int64_t lastRollingFeeUpdate;
+    mutable bool blockSinceLastRollingFeeBump;
+    mutable double rollingMinimumFeeRate; //! Minimum fee rate to get into the pool, decreases exponentially
+    CFeeRate minReasonableRelayFee;
+
+    void trackPackageRemoved(const CFeeRate& rate);
+
+    typedef COpenHashMap<uint256, const CTransaction*, CCoinsKeyHasher> NullifierMap;
+    NullifierMap mapSproutNullifiers;
+    NullifierMap mapSaplingNullifiers;
+
+    //! Anchors spent from, each with the txid of every transaction spending from it
+    typedef std::set<std::pair<uint256, uint256> > AnchorIndex;
+    AnchorIndex setSproutAnchors;
+    AnchorIndex setSaplingAnchors;
 
     void checkNullifiers(ShieldedType type) const;
+    void checkAnchors() const;
 
 public:
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; // public only for testing
+
     typedef boost::multi_index_container<
         CTxMemPoolEntry,
         boost::multi_index::indexed_by<
-            // sorted by txid
-            boost::multi_index::ordered_unique<mempoolentry_txid>,
-            // sorted by fee rate
+            // hashed by txid
+            boost::multi_index::hashed_unique<mempoolentry_txid, CCoinsKeyHasher>,
+            // sorted by fee rate with descendants
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<descendant_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByDescendantScore
+            >,
+            // sorted by fee rate with ancestors
             boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<ancestor_score>,
                 boost::multi_index::identity<CTxMemPoolEntry>,
-                CompareTxMemPoolEntryByFee
+                CompareTxMemPoolEntryByAncestorFee
+            >,
+            // sorted by expiry height
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<expiry_height>,
+                mempoolentry_expiry
+            >,
+            // sorted by validated branch ID
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<branch_id>,
+                mempoolentry_branchid
             >
         >
     > indexed_transaction_set;
 
     mutable CCriticalSection cs;
     indexed_transaction_set mapTx;
-    std::map<COutPoint, CInPoint> mapNextTx;
+
+    typedef indexed_transaction_set::nth_index<0>::type::iterator txiter;
+    struct CompareIteratorByHash {
+        bool operator()(const txiter &a, const txiter &b) const {
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        }
+    };
+    typedef std::set<txiter, CompareIteratorByHash> setEntries;
+
+    const setEntries & GetMemPoolParents(txiter entry) const;
+    const setEntries & GetMemPoolChildren(txiter entry) const;
+
+private:
+    struct TxLinks {
+        setEntries parents;
+        setEntries children;
+    };
+
+    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
+    txlinksMap mapLinks;
+
+    void UpdateParent(txiter entry, txiter parent, bool add);
+    void UpdateChild(txiter entry, txiter child, bool add);
+
+public:
+    typedef COpenHashMap<COutPoint, CInPoint, SaltedOutpointHasher> NextTxMap;
+    NextTxMap mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
+    /** Fired with cs held for every entry that is added to or removed from mapTx */
+    boost::signals2::signal<void (const CTxMemPoolEntry&)> NotifyEntryAdded;
+    boost::signals2::signal<void (const CTransaction&)> NotifyEntryRemoved;
+
     CTxMemPool(const CFeeRate& _minRelayFee);
     ~CTxMemPool();
 
@@ -168,18 +457,55 @@ public:
     void check(const CCoinsViewCache *pcoins) const;
     void setSanityCheck(double dFrequency = 1.0) { nCheckFrequency = static_cast<uint32_t>(dFrequency * 4294967295.0); }
 
+    // addUnchecked must update the state of all ancestors of the new entry.
+    // The version without setAncestors looks them up, the other one takes
+    // them from a previous call to CalculateMemPoolAncestors.
     bool addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, bool fCurrentEstimate = true);
+    bool addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, setEntries &setAncestors, bool fCurrentEstimate = true);
+
     void remove(const CTransaction &tx, std::list<CTransaction>& removed, bool fRecursive = false);
     void removeWithAnchor(const uint256 &invalidRoot, ShieldedType type);
     void removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags);
     void removeConflicts(const CTransaction &tx, std::list<CTransaction>& removed);
     void removeExpired(unsigned int nBlockHeight);
-    void removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight,
+    void removeForBlock(const std::vector<CTransactionRef>& vtx, unsigned int nBlockHeight,
                         std::list<CTransaction>& conflicts, bool fCurrentEstimate = true);
     void removeWithoutBranchId(uint32_t nMemPoolBranchId);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
-    void pruneSpent(const uint256& hash, CCoins &coins);
+
+    /**
+     * Remove a set of transactions from the mempool. If a transaction is in
+     * the set, all its in-mempool descendants must be too, unless
+     * updateDescendants is true; then the ancestor state of the descendants
+     * left behind is updated instead, which is what a block needs.
+     */
+    void RemoveStaged(setEntries &stage, bool updateDescendants);
+
+    /**
+     * When transactions of a disconnected block are added back, they may
+     * already have in-mempool descendants, which addUnchecked does not look
+     * for. vHashesToUpdate are the txids of those transactions that made it
+     * back into the mempool, in block order; this links them to their
+     * children and updates the package state of everything involved.
+     */
+    void UpdateTransactionsFromBlock(const std::vector<uint256> &vHashesToUpdate);
+
+    /**
+     * Find all in-mempool ancestors of entry, not including entry itself.
+     * With fSearchForParents the parents are found by looking up the inputs
+     * of entry, which works whether or not it is in the mempool; otherwise
+     * entry must be in the mempool and its links are used.
+     */
+    void CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, bool fSearchForParents = true) const;
+
+    /**
+     * Add entryit and all its in-mempool descendants to setDescendants.
+     * Entries already in setDescendants are assumed to have had their own
+     * descendants added too, and are not walked again.
+     */
+    void CalculateDescendants(txiter entryit, setEntries &setDescendants) const;
+    bool isSpent(const COutPoint& outpoint);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
     /**
@@ -195,6 +521,23 @@ public:
 
     bool nullifierExists(const uint256& nullifier, ShieldedType type) const;
 
+    /**
+     * The minimum fee rate to get into the mempool, which may itself not be
+     * enough to get in if the mempool is full. It is raised whenever
+     * transactions are evicted and decays back with a half-life of
+     * ROLLING_FEE_HALFLIFE once a block has been found, faster when the
+     * mempool is far below sizelimit.
+     */
+    CFeeRate GetMinFee(size_t sizelimit) const;
+
+    /**
+     * Remove transactions from the mempool until its dynamic size is <=
+     * sizelimit, lowest descendant score first. If pvNoSpendsRemaining is
+     * given, the outpoints spent by removed transactions that no mempool
+     * transaction spends any more are appended to it.
+     */
+    void TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining = NULL);
+
     unsigned long size()
     {
         LOCK(cs);
@@ -207,6 +550,24 @@ public:
         return totalTxSize;
     }
 
+    uint64_t GetSequence() const
+    {
+        LOCK(cs);
+        return nSequence;
+    }
+
+    /**
+     * Copy the summaries of the entries added after sequence number nSince,
+     * or of all entries if nSince is 0, and the txids removed after it.
+     * Only this copy is made under the lock. Returns false, with the
+     * summaries of all entries, if removals that far back are no longer
+     * known. nSequenceOut becomes the sequence number the result is current
+     * to; a transaction may be listed both as removed and added, in that
+     * order.
+     */
+    bool infoSince(uint64_t nSince, unsigned int nCurrentHeight, std::vector<TxMempoolInfo>& vInfo,
+                   std::vector<uint256>& vRemoved, uint64_t& nSequenceOut) const;
+
     bool exists(uint256 hash) const
     {
         LOCK(cs);
@@ -214,6 +575,12 @@ public:
     }
 
     bool lookup(uint256 hash, CTransaction& result) const;
+    //! The transaction with the given hash, shared with the pool, or null
+    CTransactionRef get(const uint256& hash) const;
+    /** The precomputed sighash data stored with transaction hash, or NULL if there is none */
+    std::shared_ptr<const PrecomputedTransactionData> GetTxData(const uint256& hash) const;
+    /** The legacy and P2SH sigops counted when transaction hash was accepted, if it is in the pool */
+    bool GetSigOpCount(const uint256& hash, unsigned int& nSigOps) const;
 
     /** Estimate fee rate needed to get into the next nBlocks */
     CFeeRate estimateFee(int nBlocks) const;
@@ -231,6 +598,18 @@ public:
     uint32_t GetCheckFrequency() const {
         return nCheckFrequency;
     }
+
+private:
+    /** Set ancestor state for an entry that is being added */
+    void UpdateEntryForAncestors(txiter it, const setEntries &setAncestors);
+    /** Update ancestors of hash to add/remove it as a descendant transaction. */
+    void UpdateAncestorsOf(bool add, txiter hash, setEntries &setAncestors);
+    /** For each transaction being removed, update ancestors and any direct children. */
+    void UpdateForRemoveFromMempool(const setEntries &entriesToRemove, bool updateDescendants);
+    /** Sever link between specified transaction and direct children. */
+    void UpdateChildrenForRemoval(txiter entry);
+    /** Remove a single entry. Its links must already have been dealt with. */
+    void removeUnchecked(txiter entry);
 };
 
 /** 
@@ -245,8 +624,8 @@ protected:
 public:
     CCoinsViewMemPool(CCoinsView *baseIn, CTxMemPool &mempoolIn);
     bool GetNullifier(const uint256 &txid, ShieldedType type) const;
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
 };
 
 #endif // BITCOIN_TXMEMPOOL_H
@@ -113,6 +113,8 @@ bool fServer = false;
 bool fLogTimestamps = DEFAULT_LOGTIMESTAMPS;
 bool fLogTimeMicros = DEFAULT_LOGTIMEMICROS;
 bool fLogIPs = DEFAULT_LOGIPS;
+unsigned int nLogRateLimit = DEFAULT_LOG_RATE_LIMIT;
+uint64_t nMaxDebugLogSize = (uint64_t)DEFAULT_MAX_DEBUG_LOG_SIZE * 1000000;
 std::atomic<bool> fReopenDebugLog(false);
 CTranslationInterface translationInterface;
 
@@ -182,6 +184,32 @@ static boost::once_flag debugPrintInitFlag = BOOST_ONCE_INIT;
 static FILE* fileout = NULL;
 static boost::mutex* mutexDebugLog = NULL;
 static list<string> *vMsgsBeforeOpenLog;
+/** Bytes in debug.log, for rotation */
+static uint64_t nDebugLogSize = 0;
+
+/** Per-category counts for -debugratelimit, under their own mutex */
+struct CLogRateState
+{
+    int64_t nSecond;
+    unsigned int nLogged;
+    uint64_t nSuppressed;
+
+    CLogRateState() : nSecond(0), nLogged(0), nSuppressed(0) {}
+};
+static boost::mutex* mutexLogRates = NULL;
+static map<string, CLogRateState>* mapLogRates = NULL;
+
+/**
+ * While fAsyncLog is set, messages are appended to strAsyncLog under
+ * mutexDebugLog and only the writer thread touches fileout.
+ */
+static const size_t MAX_ASYNC_LOG_BUFFER = 16 * 1024 * 1024;
+static bool fAsyncLog = false;
+static bool fStopAsyncLog = false;
+static string* strAsyncLog = NULL;
+static uint64_t nAsyncLogDropped = 0;
+static boost::condition_variable* condAsyncLog = NULL;
+static boost::thread* threadAsyncLog = NULL;
 
 [[noreturn]] void new_handler_terminate()
 {
@@ -207,6 +235,57 @@ static void DebugPrintInit()
     assert(mutexDebugLog == NULL);
     mutexDebugLog = new boost::mutex();
     vMsgsBeforeOpenLog = new list<string>;
+    mutexLogRates = new boost::mutex();
+    mapLogRates = new map<string, CLogRateState>;
+}
+
+static uint64_t DebugLogFileSize()
+{
+    boost::system::error_code ec;
+    uintmax_t nSize = boost::filesystem::file_size(GetDataDir() / "debug.log", ec);
+    return ec ? 0 : nSize;
+}
+
+/** Move debug.log to debug.log.1, replacing the one before, and start anew */
+static void RotateDebugLog()
+{
+    boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
+    boost::filesystem::path pathOld = GetDataDir() / "debug.log.1";
+    fclose(fileout);
+    boost::system::error_code ec;
+    boost::filesystem::remove(pathOld, ec);
+    boost::filesystem::rename(pathDebug, pathOld, ec);
+    fileout = fopen(pathDebug.string().c_str(), "a");
+    if (fileout) setbuf(fileout, NULL); // unbuffered
+    // If the rename failed this is the old file; try again after as much again
+    nDebugLogSize = 0;
+}
+
+/**
+ * Write to debug.log, reopening and rotating it as needed. Called with
+ * mutexDebugLog held, or from the writer thread while logging is
+ * asynchronous.
+ */
+static int WriteDebugLog(const std::string &str)
+{
+    // reopen the log file, if requested
+    if (fReopenDebugLog) {
+        fReopenDebugLog = false;
+        if (fileout) {
+            boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
+            fileout = freopen(pathDebug.string().c_str(), "a", fileout);
+            if (fileout) setbuf(fileout, NULL); // unbuffered
+            nDebugLogSize = DebugLogFileSize();
+        }
+    }
+    if (fileout == NULL)
+        return 0;
+
+    int ret = FileWriteStr(str, fileout);
+    nDebugLogSize += ret;
+    if (nMaxDebugLogSize > 0 && nDebugLogSize >= nMaxDebugLogSize)
+        RotateDebugLog();
+    return ret;
 }
 
 void OpenDebugLog()
@@ -219,10 +298,11 @@ void OpenDebugLog()
     boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
     fileout = fopen(pathDebug.string().c_str(), "a");
     if (fileout) setbuf(fileout, NULL); // unbuffered
+    nDebugLogSize = DebugLogFileSize();
 
     // dump buffered messages from before we opened the log
     while (!vMsgsBeforeOpenLog->empty()) {
-        FileWriteStr(vMsgsBeforeOpenLog->front(), fileout);
+        WriteDebugLog(vMsgsBeforeOpenLog->front());
         vMsgsBeforeOpenLog->pop_front();
     }
 
@@ -230,6 +310,94 @@ void OpenDebugLog()
     vMsgsBeforeOpenLog = NULL;
 }
 
+static void AsyncLogThread()
+{
+    RenameThread("litecoinz-log");
+    boost::mutex::scoped_lock lock(*mutexDebugLog);
+    string str;
+    while (true) {
+        while (strAsyncLog->empty() && !fStopAsyncLog)
+            condAsyncLog->wait(lock);
+        if (strAsyncLog->empty())
+            break;
+        // Swapping keeps both buffers' capacity, so appends rarely allocate
+        str.swap(*strAsyncLog);
+        uint64_t nDropped = nAsyncLogDropped;
+        nAsyncLogDropped = 0;
+
+        lock.unlock();
+        WriteDebugLog(str);
+        if (nDropped > 0)
+            WriteDebugLog(strprintf("Dropped %u log messages while the log writer was behind\n", nDropped));
+        str.clear();
+        lock.lock();
+    }
+    // Still under the lock, so nothing is appended that is not written
+    fAsyncLog = false;
+}
+
+void StartAsyncLogging()
+{
+    boost::call_once(&DebugPrintInit, debugPrintInitFlag);
+    boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+
+    if (fAsyncLog || fileout == NULL)
+        return;
+    if (strAsyncLog == NULL) {
+        strAsyncLog = new string;
+        condAsyncLog = new boost::condition_variable;
+    }
+    fStopAsyncLog = false;
+    fAsyncLog = true;
+    threadAsyncLog = new boost::thread(&AsyncLogThread);
+}
+
+void StopAsyncLogging()
+{
+    boost::thread* thread;
+    {
+        boost::call_once(&DebugPrintInit, debugPrintInitFlag);
+        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+        if (threadAsyncLog == NULL)
+            return;
+        fStopAsyncLog = true;
+        condAsyncLog->notify_one();
+        thread = threadAsyncLog;
+        threadAsyncLog = NULL;
+    }
+    thread->join();
+    delete thread;
+}
+
+/**
+ * Count a message against its category's -debugratelimit. When a new second
+ * starts, the messages suppressed in the last one are reported.
+ */
+static bool LogRateAccept(const char* category)
+{
+    boost::call_once(&DebugPrintInit, debugPrintInitFlag);
+    // Not mockable, so that mocked time does not freeze the limit
+    int64_t nSecond = GetTimeMicros() / 1000000;
+    uint64_t nSuppressed = 0;
+    {
+        boost::mutex::scoped_lock scoped_lock(*mutexLogRates);
+        CLogRateState& state = (*mapLogRates)[category];
+        if (state.nSecond != nSecond) {
+            nSuppressed = state.nSuppressed;
+            state = CLogRateState();
+            state.nSecond = nSecond;
+        }
+        if (state.nLogged >= nLogRateLimit) {
+            state.nSuppressed++;
+            return false;
+        }
+        state.nLogged++;
+    }
+    if (nSuppressed > 0)
+        LogPrintStr(strprintf("Suppressed %u %s messages over -debugratelimit\n", nSuppressed, category));
+    return true;
+}
+
 bool LogAcceptCategory(const char* category)
 {
     if (category != NULL)
@@ -255,6 +423,9 @@ bool LogAcceptCategory(const char* category)
             setCategories.count(string("1")) == 0 &&
             setCategories.count(string(category)) == 0)
             return false;
+
+        if (nLogRateLimit > 0 && !LogRateAccept(category))
+            return false;
     }
     return true;
 }
@@ -271,9 +442,17 @@ static std::string LogTimestampStr(const std::string &str, bool *fStartedNewLine
     if (!fLogTimestamps)
         return str;
 
-    if (*fStartedNewLine)
-        strStamped =  DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetTime()) + ' ' + str;
-    else
+    if (*fStartedNewLine) {
+        // Formatting the time is slow, and busy categories log many times a second
+        static int64_t nStampTime = 0;
+        static string strStamp;
+        int64_t nTime = GetTime();
+        if (nTime != nStampTime || strStamp.empty()) {
+            strStamp = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nTime) + ' ';
+            nStampTime = nTime;
+        }
+        strStamped = strStamp + str;
+    } else
         strStamped = str;
 
     if (!str.empty() && str[str.size()-1] == '\n')
@@ -302,22 +481,26 @@ int LogPrintStr(const std::string &str)
         string strTimestamped = LogTimestampStr(str, &fStartedNewLine);
 
         // buffer if we haven't opened the log yet
-        if (fileout == NULL) {
-            assert(vMsgsBeforeOpenLog);
+        if (vMsgsBeforeOpenLog) {
             ret = strTimestamped.length();
             vMsgsBeforeOpenLog->push_back(strTimestamped);
         }
-        else
+        else if (fAsyncLog)
         {
-            // reopen the log file, if requested
-            if (fReopenDebugLog) {
-                fReopenDebugLog = false;
-                boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
-                if (freopen(pathDebug.string().c_str(),"a",fileout) != NULL)
-                    setbuf(fileout, NULL); // unbuffered
+            ret = strTimestamped.length();
+            if (strAsyncLog->size() + strTimestamped.size() > MAX_ASYNC_LOG_BUFFER) {
+                nAsyncLogDropped++;
+            } else {
+                // The writer only waits when it has emptied the buffer
+                bool fWake = strAsyncLog->empty();
+                strAsyncLog->append(strTimestamped);
+                if (fWake)
+                    condAsyncLog->notify_one();
             }
-
-            ret = FileWriteStr(strTimestamped, fileout);
+        }
+        else
+        {
+            ret = WriteDebugLog(strTimestamped);
         }
     }
     return ret;
@@ -33,6 +33,11 @@
 static const bool DEFAULT_LOGTIMEMICROS = false;
 static const bool DEFAULT_LOGIPS        = false;
 static const bool DEFAULT_LOGTIMESTAMPS = true;
+static const bool DEFAULT_ASYNC_LOG     = false;
+/** Messages per second of each -debug category, 0 for no limit */
+static const unsigned int DEFAULT_LOG_RATE_LIMIT = 0;
+/** Size in MB at which debug.log is rotated, 0 to never rotate */
+static const unsigned int DEFAULT_MAX_DEBUG_LOG_SIZE = 0;
 
 /** Signals for translation. */
 class CTranslationInterface
@@ -52,6 +57,8 @@ extern bool fServer;
 
 extern bool fLogTimestamps;
 extern bool fLogIPs;
+extern unsigned int nLogRateLimit;
+extern uint64_t nMaxDebugLogSize;
 extern std::atomic<bool> fReopenDebugLog;
 extern CTranslationInterface translationInterface;
 
@@ -138,6 +145,14 @@ boost::filesystem::path GetSpecialFolderPath(int nFolder, bool fCreate = true);
 #endif
 boost::filesystem::path GetTempPath();
 void OpenDebugLog();
+/**
+ * Hand debug.log writes to a background thread, so that threads that log
+ * only append to a buffer. Messages logged while the writer is too far
+ * behind are counted and dropped.
+ */
+void StartAsyncLogging();
+/** Write out what is buffered and go back to writing from the caller */
+void StopAsyncLogging();
 void ShrinkDebugFile();
 void runCommand(const std::string& strCommand);
 const boost::filesystem::path GetExportDir();
@@ -5,38 +5,255 @@
 
 #include "validationinterface.h"
 
-static CMainSignals g_signals;
+#include "chain.h"
+#include "primitives/block.h"
+#include "sync.h"
+#include "util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+
+/** Runs notifications one at a time, in the order they were queued */
+class CValidationQueue
+{
+private:
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    CConditionVariable condDone;
+    std::deque<boost::function<void()> > queue;
+    bool fRunning;
+    bool fStopping;
+    uint64_t nQueued;
+    uint64_t nDone;
+    std::string strName;
+    boost::thread thread;
+
+    void Run()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (true) {
+            while (queue.empty() && !fStopping)
+                cond.wait(lock);
+            if (queue.empty()) {
+                // Stopping, and everything queued has been delivered
+                fRunning = false;
+                condDone.notify_all();
+                return;
+            }
+            boost::function<void()> f = queue.front();
+            queue.pop_front();
+            lock.unlock();
+            f();
+            lock.lock();
+            nDone++;
+            condDone.notify_all();
+        }
+    }
+
+public:
+    CValidationQueue(const std::string& strNameIn) : fRunning(false), fStopping(false), nQueued(0), nDone(0), strName(strNameIn) {}
+
+    void Start()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fRunning)
+            return;
+        fRunning = true;
+        fStopping = false;
+        thread = boost::thread(boost::bind(&TraceThread<boost::function<void()> >, strName.c_str(),
+            boost::function<void()>(boost::bind(&CValidationQueue::Run, this))));
+    }
+
+    void Stop()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            if (!fRunning)
+                return;
+            fStopping = true;
+            cond.notify_all();
+        }
+        thread.join();
+    }
+
+    bool IsRunning()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        return fRunning;
+    }
+
+    //! Returns false if the queue is not running, for the caller to deliver f itself
+    bool Push(const boost::function<void()>& f)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (!fRunning)
+            return false;
+        queue.push_back(f);
+        nQueued++;
+        cond.notify_one();
+        return true;
+    }
+
+    uint64_t Depth()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        return nQueued - nDone;
+    }
+
+    void Sync()
+    {
+        // A listener waiting for itself would never return
+        if (boost::this_thread::get_id() == thread.get_id())
+            return;
+        boost::unique_lock<boost::mutex> lock(cs);
+        uint64_t nTarget = nQueued;
+        while (fRunning && nDone < nTarget)
+            condDone.wait(lock);
+    }
+};
+
+/**
+ * Listeners and the queue their notifications run on. The shared lane has
+ * every listener but those registered with a queue of their own, which get
+ * a lane each for the queued notifications, so that a slow wallet does not
+ * hold up the others. The notifications raised directly on GetMainSignals()
+ * go to everyone through the shared lane.
+ */
+struct CValidationLane
+{
+    CMainSignals signals;
+    CValidationQueue queue;
+    CValidationInterface* pListener;
+    std::atomic<int> nDeliveredTipHeight;
+
+    CValidationLane(const std::string& strName, CValidationInterface* pListenerIn) :
+        queue(strName), pListener(pListenerIn), nDeliveredTipHeight(-1) {}
+};
+
+typedef std::shared_ptr<CValidationLane> CValidationLaneRef;
+
+static CValidationLane g_lane("notify", NULL);
+static CMainSignals& g_signals = g_lane.signals;
+
+static CCriticalSection cs_lanes;
+//! Lanes of the listeners with a queue of their own
+static std::vector<CValidationLaneRef> vOwnLanes;
+//! Whether the queues have been started, so that lanes added later start too
+static bool fQueuesStarted = false;
+
+static std::vector<CValidationLaneRef> GetOwnLanes()
+{
+    LOCK(cs_lanes);
+    return vOwnLanes;
+}
+
+/** Give f the signals of every lane, on the lane's queue if it runs */
+static void Deliver(const boost::function<void(CValidationLane&)>& f)
+{
+    if (!g_lane.queue.Push(boost::bind(f, boost::ref(g_lane))))
+        f(g_lane);
+    for (const CValidationLaneRef& lane : GetOwnLanes()) {
+        if (!lane->queue.Push(boost::bind(f, boost::ref(*lane))))
+            f(*lane);
+    }
+}
+
+static bool IsQueueRunning()
+{
+    return g_lane.queue.IsRunning();
+}
+
+void CValidationInterface::SyncBlock(const CBlock *pblock) {
+    BOOST_FOREACH(const CTransactionRef &tx, pblock->vtx)
+        SyncTransaction(*tx, pblock);
+}
 
 CMainSignals& GetMainSignals()
 {
     return g_signals;
 }
 
-void RegisterValidationInterface(CValidationInterface* pwalletIn) {
-    g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
-    g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
-    g_signals.EraseTransaction.connect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
-    g_signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
-    g_signals.ChainTip.connect(boost::bind(&CValidationInterface::ChainTip, pwalletIn, _1, _2, _3, _4, _5));
-    g_signals.SetBestChain.connect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
+void ConnectQueued(CMainSignals& signals, CValidationInterface* pwalletIn) {
+    signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
+    signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
+    signals.SyncBlock.connect(boost::bind(&CValidationInterface::SyncBlock, pwalletIn, _1));
+    signals.EraseTransaction.connect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
+    signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
+    signals.ChainTip.connect(boost::bind(&CValidationInterface::ChainTip, pwalletIn, _1, _2, _3, _4, _5));
+    signals.SetBestChain.connect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
+}
+
+void DisconnectQueued(CMainSignals& signals, CValidationInterface* pwalletIn) {
+    signals.ChainTip.disconnect(boost::bind(&CValidationInterface::ChainTip, pwalletIn, _1, _2, _3, _4, _5));
+    signals.SetBestChain.disconnect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
+    signals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
+    signals.EraseTransaction.disconnect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
+    signals.SyncBlock.disconnect(boost::bind(&CValidationInterface::SyncBlock, pwalletIn, _1));
+    signals.SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
+    signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
+}
+
+void RegisterValidationInterface(CValidationInterface* pwalletIn, bool fOwnQueue) {
+    if (fOwnQueue) {
+        CValidationLaneRef lane = std::make_shared<CValidationLane>("notify-wallet", pwalletIn);
+        ConnectQueued(lane->signals, pwalletIn);
+        LOCK(cs_lanes);
+        // Start from where the shared lane is, having had no notifications yet
+        lane->nDeliveredTipHeight = g_lane.nDeliveredTipHeight.load();
+        if (fQueuesStarted)
+            lane->queue.Start();
+        vOwnLanes.push_back(lane);
+    } else {
+        ConnectQueued(g_signals, pwalletIn);
+    }
     g_signals.Inventory.connect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
     g_signals.Broadcast.connect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1));
     g_signals.BlockChecked.connect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
+    g_signals.ShieldedReceived.connect(boost::bind(&CValidationInterface::ShieldedReceived, pwalletIn, _1));
 }
 
 void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
+    CValidationLaneRef lane;
+    {
+        LOCK(cs_lanes);
+        for (std::vector<CValidationLaneRef>::iterator it = vOwnLanes.begin(); it != vOwnLanes.end(); ++it) {
+            if ((*it)->pListener == pwalletIn) {
+                lane = *it;
+                vOwnLanes.erase(it);
+                break;
+            }
+        }
+    }
+    if (lane) {
+        // Let the listener finish what was queued for it
+        lane->queue.Stop();
+        DisconnectQueued(lane->signals, pwalletIn);
+    } else {
+        DisconnectQueued(g_signals, pwalletIn);
+    }
+
+    g_signals.ShieldedReceived.disconnect(boost::bind(&CValidationInterface::ShieldedReceived, pwalletIn, _1));
     g_signals.BlockChecked.disconnect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
     g_signals.Broadcast.disconnect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1));
     g_signals.Inventory.disconnect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
-    g_signals.ChainTip.disconnect(boost::bind(&CValidationInterface::ChainTip, pwalletIn, _1, _2, _3, _4, _5));
-    g_signals.SetBestChain.disconnect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
-    g_signals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
-    g_signals.EraseTransaction.disconnect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
-    g_signals.SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
-    g_signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
 }
 
 void UnregisterAllValidationInterfaces() {
+    std::vector<CValidationLaneRef> vLanes;
+    {
+        LOCK(cs_lanes);
+        vLanes.swap(vOwnLanes);
+    }
+    for (const CValidationLaneRef& lane : vLanes)
+        lane->queue.Stop();
+    g_signals.ShieldedReceived.disconnect_all_slots();
     g_signals.BlockChecked.disconnect_all_slots();
     g_signals.Broadcast.disconnect_all_slots();
     g_signals.Inventory.disconnect_all_slots();
@@ -44,10 +261,151 @@ void UnregisterAllValidationInterfaces() {
     g_signals.SetBestChain.disconnect_all_slots();
     g_signals.UpdatedTransaction.disconnect_all_slots();
     g_signals.EraseTransaction.disconnect_all_slots();
+    g_signals.SyncBlock.disconnect_all_slots();
     g_signals.SyncTransaction.disconnect_all_slots();
     g_signals.UpdatedBlockTip.disconnect_all_slots();
 }
 
-void SyncWithWallets(const CTransaction &tx, const CBlock *pblock) {
-    g_signals.SyncTransaction(tx, pblock);
+void StartValidationInterfaceQueue() {
+    LOCK(cs_lanes);
+    fQueuesStarted = true;
+    g_lane.queue.Start();
+    for (const CValidationLaneRef& lane : vOwnLanes)
+        lane->queue.Start();
+}
+
+void StopValidationInterfaceQueue() {
+    std::vector<CValidationLaneRef> vLanes;
+    {
+        LOCK(cs_lanes);
+        fQueuesStarted = false;
+        vLanes = vOwnLanes;
+    }
+    g_lane.queue.Stop();
+    for (const CValidationLaneRef& lane : vLanes)
+        lane->queue.Stop();
+}
+
+void SyncWithValidationInterfaceQueue() {
+    g_lane.queue.Sync();
+    for (const CValidationLaneRef& lane : GetOwnLanes())
+        lane->queue.Sync();
+}
+
+void SyncWithValidationInterfaceQueue(CValidationInterface* pListener) {
+    g_lane.queue.Sync();
+    for (const CValidationLaneRef& lane : GetOwnLanes()) {
+        if (lane->pListener == pListener)
+            lane->queue.Sync();
+    }
+}
+
+uint64_t GetValidationInterfaceQueueDepth() {
+    uint64_t nDepth = g_lane.queue.Depth();
+    for (const CValidationLaneRef& lane : GetOwnLanes())
+        nDepth = std::max(nDepth, lane->queue.Depth());
+    return nDepth;
+}
+
+int GetValidationInterfaceTipHeight() {
+    int nHeight = g_lane.nDeliveredTipHeight;
+    for (const CValidationLaneRef& lane : GetOwnLanes())
+        nHeight = std::min(nHeight, lane->nDeliveredTipHeight.load());
+    return nHeight;
+}
+
+static void DeliverTransaction(const std::shared_ptr<const CTransaction>& ptx, CValidationLane& lane) {
+    lane.signals.SyncTransaction(*ptx, NULL);
+}
+
+static void DeliverBlockTransactions(const std::shared_ptr<const CBlock>& pblock, CValidationLane& lane) {
+    lane.signals.SyncBlock(pblock.get());
+}
+
+static void DeliverChainTip(const CBlockIndex* pindex, const std::shared_ptr<const CBlock>& pblock,
+                            const SproutMerkleTree& sproutTree, const SaplingMerkleTree& saplingTree, bool added,
+                            CValidationLane& lane) {
+    lane.signals.ChainTip(pindex, pblock.get(), sproutTree, saplingTree, added);
+    lane.nDeliveredTipHeight = added ? pindex->nHeight : pindex->nHeight - 1;
+}
+
+static void DeliverUpdatedBlockTip(const CBlockIndex* pindex, CValidationLane& lane) {
+    lane.signals.UpdatedBlockTip(pindex);
+}
+
+static void DeliverUpdatedTransaction(const uint256& hash, CValidationLane& lane) {
+    lane.signals.UpdatedTransaction(hash);
+}
+
+static void DeliverSetBestChain(const CBlockLocator& locator, CValidationLane& lane) {
+    lane.signals.SetBestChain(locator);
+}
+
+void SyncWithWallets(const CTransaction &tx) {
+    if (!IsQueueRunning()) {
+        // Spare the copy
+        g_signals.SyncTransaction(tx, NULL);
+        for (const CValidationLaneRef& lane : GetOwnLanes())
+            lane->signals.SyncTransaction(tx, NULL);
+        return;
+    }
+    Deliver(boost::bind(&DeliverTransaction, std::make_shared<const CTransaction>(tx), _1));
+}
+
+void SyncWithWallets(const std::shared_ptr<const CTransaction>& ptx) {
+    Deliver(boost::bind(&DeliverTransaction, ptx, _1));
+}
+
+void SyncBlockWithWallets(const std::shared_ptr<const CBlock>& pblock) {
+    Deliver(boost::bind(&DeliverBlockTransactions, pblock, _1));
+}
+
+void NotifyUpdatedBlockTip(const CBlockIndex* pindex) {
+    Deliver(boost::bind(&DeliverUpdatedBlockTip, pindex, _1));
+}
+
+void NotifyUpdatedTransaction(const uint256& hash) {
+    Deliver(boost::bind(&DeliverUpdatedTransaction, hash, _1));
+}
+
+void NotifyChainTip(const CBlockIndex* pindex, const std::shared_ptr<const CBlock>& pblock,
+                    const SproutMerkleTree& sproutTree, const SaplingMerkleTree& saplingTree, bool added) {
+    Deliver(boost::bind(&DeliverChainTip, pindex, pblock, sproutTree, saplingTree, added, _1));
+}
+
+static void DeliverBlocksConnected(const std::shared_ptr<const std::vector<CConnectedBlock> >& pvBlocks, CValidationLane& lane) {
+    for (const CConnectedBlock& connected : *pvBlocks) {
+        for (const std::shared_ptr<const CTransaction>& ptx : connected.vtxConflicted)
+            DeliverTransaction(ptx, lane);
+        DeliverBlockTransactions(connected.pblock, lane);
+        DeliverChainTip(connected.pindex, connected.pblock, connected.sproutTree, connected.saplingTree, true, lane);
+    }
+}
+
+void NotifyBlocksConnected(std::vector<CConnectedBlock>&& vBlocks) {
+    if (vBlocks.empty())
+        return;
+    Deliver(boost::bind(&DeliverBlocksConnected, std::make_shared<const std::vector<CConnectedBlock> >(std::move(vBlocks)), _1));
+}
+
+void NotifySetBestChain(const CBlockLocator& locator) {
+    Deliver(boost::bind(&DeliverSetBestChain, locator, _1));
+}
+
+static void DeliverShieldedReceived(const std::shared_ptr<const std::vector<CShieldedReceipt> >& pvReceipts) {
+    for (const CShieldedReceipt& receipt : *pvReceipts)
+        g_signals.ShieldedReceived(receipt);
+}
+
+void NotifyShieldedReceived(std::vector<CShieldedReceipt>&& vReceipts) {
+    if (vReceipts.empty())
+        return;
+    // Only the shared lane has ShieldedReceived listeners
+    boost::function<void()> f = boost::bind(&DeliverShieldedReceived, std::make_shared<const std::vector<CShieldedReceipt> >(std::move(vReceipts)));
+    if (!g_lane.queue.Push(f))
+        f();
+}
+
+bool HaveShieldedReceivedListeners() {
+    return !g_signals.ShieldedReceived.empty();
 }
@@ -6,33 +6,141 @@
 #ifndef BITCOIN_VALIDATIONINTERFACE_H
 #define BITCOIN_VALIDATIONINTERFACE_H
 
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <boost/signals2/signal.hpp>
 
+#include "amount.h"
+#include "serialize.h"
+#include "uint256.h"
 #include "zcash/IncrementalMerkleTree.hpp"
+#include "zcash/Zcash.h"
 
 class CBlock;
 class CBlockIndex;
 struct CBlockLocator;
 class CTransaction;
 class CValidationInterface;
+struct CMainSignals;
 class CValidationState;
-class uint256;
+
+/** Default for -asyncnotifications */
+static const bool DEFAULT_ASYNC_NOTIFICATIONS = true;
 
 // These functions dispatch to one or all registered wallets
 
-/** Register a wallet to receive updates from core */
-void RegisterValidationInterface(CValidationInterface* pwalletIn);
+/**
+ * Register a wallet to receive updates from core. With fOwnQueue the queued
+ * notifications below reach it on a thread of its own rather than the one
+ * shared by the other listeners, so that several wallets take them in
+ * parallel, each in order.
+ */
+void RegisterValidationInterface(CValidationInterface* pwalletIn, bool fOwnQueue = false);
 /** Unregister a wallet from core */
 void UnregisterValidationInterface(CValidationInterface* pwalletIn);
 /** Unregister all wallets from core */
 void UnregisterAllValidationInterfaces();
 /** Push an updated transaction to all registered wallets */
-void SyncWithWallets(const CTransaction& tx, const CBlock* pblock = NULL);
+void SyncWithWallets(const CTransaction& tx);
+/** As above, sharing ptx with the listeners rather than copying it */
+void SyncWithWallets(const std::shared_ptr<const CTransaction>& ptx);
+/** Push the transactions of a newly connected block to all registered wallets */
+void SyncBlockWithWallets(const std::shared_ptr<const CBlock>& pblock);
+
+/**
+ * The notifications below are delivered in order on a background thread
+ * once the notification queue has been started, so that listeners such as
+ * the wallet do not hold up block connection. Listeners get shared copies of
+ * the blocks and transactions, which stay valid however late they run. Until
+ * the queue is started, and after it is stopped, they are delivered
+ * synchronously.
+ */
+void StartValidationInterfaceQueue();
+/** Deliver the notifications still queued, then return to synchronous delivery */
+void StopValidationInterfaceQueue();
+/**
+ * Wait until every notification raised before the call has been delivered.
+ * Must not be called with cs_main held, as the listeners take it.
+ */
+void SyncWithValidationInterfaceQueue();
+/** As above, but only for what pListener is notified of, however far behind other listeners are */
+void SyncWithValidationInterfaceQueue(CValidationInterface* pListener);
+/** Notifications queued but not delivered yet, on the queue furthest behind */
+uint64_t GetValidationInterfaceQueueDepth();
+/** Height of the last chain tip delivered to every listener, or -1 before the first */
+int GetValidationInterfaceTipHeight();
+
+void NotifyUpdatedBlockTip(const CBlockIndex* pindex);
+void NotifyUpdatedTransaction(const uint256& hash);
+void NotifyChainTip(const CBlockIndex* pindex, const std::shared_ptr<const CBlock>& pblock,
+                    const SproutMerkleTree& sproutTree, const SaplingMerkleTree& saplingTree, bool added);
+void NotifySetBestChain(const CBlockLocator& locator);
+
+/** A shielded output a wallet has decrypted, in the mempool or in a block */
+struct CShieldedReceipt
+{
+    uint256 txid;
+    //! The JoinSplit the output is in, or -1 for a Sapling output
+    int32_t js;
+    //! Index of the output in the JoinSplit, or among the Sapling outputs
+    uint32_t n;
+    //! Height of the block the transaction is in, or -1 if it is in the mempool
+    int32_t nHeight;
+    //! The encoded payment address it pays
+    std::string address;
+    CAmount value;
+    std::array<unsigned char, ZC_MEMO_SIZE> memo;
+
+    CShieldedReceipt() : js(-1), n(0), nHeight(-1), value(0) { memo.fill(0); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(txid);
+        READWRITE(js);
+        READWRITE(n);
+        READWRITE(nHeight);
+        READWRITE(address);
+        READWRITE(value);
+        READWRITE(memo);
+    }
+};
+/**
+ * Queue receipts for the ShieldedReceived listeners. Wallets raise this from
+ * their own notifications, so that on the notification thread it is
+ * delivered once they are done with the transaction and have let go of it.
+ */
+void NotifyShieldedReceived(std::vector<CShieldedReceipt>&& vReceipts);
+/** Whether anything listens for receipts, so that wallets need not decrypt them for nobody */
+bool HaveShieldedReceivedListeners();
+
+/** A block connected to the tip, with what its notifications carry */
+struct CConnectedBlock
+{
+    const CBlockIndex* pindex;
+    std::shared_ptr<const CBlock> pblock;
+    //! The commitment trees from before the block
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+    //! Mempool transactions the block conflicted
+    std::vector<std::shared_ptr<const CTransaction> > vtxConflicted;
+};
+/**
+ * For each of a run of blocks connected together, in order, the same
+ * SyncWithWallets, SyncBlockWithWallets and NotifyChainTip as for a block
+ * connected on its own, queued as a single notification.
+ */
+void NotifyBlocksConnected(std::vector<CConnectedBlock>&& vBlocks);
 
 class CValidationInterface {
 protected:
     virtual void UpdatedBlockTip(const CBlockIndex *pindex) {}
     virtual void SyncTransaction(const CTransaction &tx, const CBlock *pblock) {}
+    virtual void SyncBlock(const CBlock *pblock);
     virtual void EraseFromWallet(const uint256 &hash) {}
     virtual void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, SproutMerkleTree sproutTree, SaplingMerkleTree saplingTree, bool added) {}
     virtual void SetBestChain(const CBlockLocator &locator) {}
@@ -40,7 +148,10 @@ protected:
     virtual void Inventory(const uint256 &hash) {}
     virtual void ResendWalletTransactions(int64_t nBestBlockTime) {}
     virtual void BlockChecked(const CBlock&, const CValidationState&) {}
-    friend void ::RegisterValidationInterface(CValidationInterface*);
+    virtual void ShieldedReceived(const CShieldedReceipt &receipt) {}
+    friend void ::RegisterValidationInterface(CValidationInterface*, bool);
+    friend void ConnectQueued(CMainSignals&, CValidationInterface*);
+    friend void DisconnectQueued(CMainSignals&, CValidationInterface*);
     friend void ::UnregisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterAllValidationInterfaces();
 };
@@ -50,6 +161,8 @@ struct CMainSignals {
     boost::signals2::signal<void (const CBlockIndex *)> UpdatedBlockTip;
     /** Notifies listeners of updated transaction data (transaction, and optionally the block it is found in. */
     boost::signals2::signal<void (const CTransaction &, const CBlock *)> SyncTransaction;
+    /** Notifies listeners of all the transactions in a block, which by default get a SyncTransaction each. */
+    boost::signals2::signal<void (const CBlock *)> SyncBlock;
     /** Notifies listeners of an erased transaction (currently disabled, requires transaction replacement). */
     boost::signals2::signal<void (const uint256 &)> EraseTransaction;
     /** Notifies listeners of an updated transaction without new data (for now: a coinbase potentially becoming visible). */
@@ -64,6 +177,8 @@ struct CMainSignals {
     boost::signals2::signal<void (int64_t nBestBlockTime)> Broadcast;
     /** Notifies listeners of a block validation result */
     boost::signals2::signal<void (const CBlock&, const CValidationState&)> BlockChecked;
+    /** Notifies listeners of a shielded output a wallet has decrypted */
+    boost::signals2::signal<void (const CShieldedReceipt &)> ShieldedReceived;
 };
 
 CMainSignals& GetMainSignals();
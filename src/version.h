@@ -10,7 +10,7 @@
  * network protocol versioning
  */
 
-static const int PROTOCOL_VERSION = 170007;
+static const int PROTOCOL_VERSION = 170008;
 
 //! initial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 209;
@@ -25,4 +25,7 @@ static const int CADDR_TIME_VERSION = 31402;
 //! "filter*" commands are disabled without NODE_BLOOM after and including this version
 static const int NO_BLOOM_VERSION = 170004;
 
+//! "sendcmpct", "cmpctblock", "getblocktxn" and "blocktxn" are understood starting with this version
+static const int COMPACT_BLOCKS_VERSION = 170008;
+
 #endif // BITCOIN_VERSION_H
@@ -0,0 +1,178 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "asyncrpcoperation_batch.h"
+
+#include "corebudget.h"
+#include "init.h"
+#include "miner.h"
+#include "rpc/server.h"
+#include "util.h"
+#include "wallet.h"
+
+#include <algorithm>
+#include <thread>
+
+AsyncRPCOperation_batch::AsyncRPCOperation_batch(
+        std::string method,
+        std::vector<std::shared_ptr<AsyncRPCOperation> > operations,
+        UniValue contextInfo) :
+        method_(method), contextinfo_(contextInfo), operations_(operations), next_(0)
+{
+    assert(!operations_.empty());
+
+    LogPrint("zrpc", "%s: %s initialized with %d transactions\n", getId(), method_, operations_.size());
+}
+
+AsyncRPCOperation_batch::~AsyncRPCOperation_batch() {
+}
+
+void AsyncRPCOperation_batch::main() {
+    if (isCancelled()) {
+        // Let each of them release its inputs
+        for (auto& operation : operations_) {
+            operation->cancel();
+            operation->main();
+        }
+        return;
+    }
+
+    set_state(OperationStatus::EXECUTING);
+    start_execution_clock();
+    start_phase("proving");
+
+#ifdef ENABLE_MINING
+  #ifdef ENABLE_WALLET
+    GenerateBitcoins(false, NULL, 0);
+  #else
+    GenerateBitcoins(false, 0);
+  #endif
+#endif
+
+    size_t nThreads = std::min(operations_.size(), ASYNC_RPC_BATCH_MAX_PARALLEL);
+    {
+        // The threads take cores of their own
+        CCoreRelease release;
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < nThreads; i++) {
+            threads.emplace_back(&AsyncRPCOperation_batch::run_operations, this);
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+#ifdef ENABLE_MINING
+  #ifdef ENABLE_WALLET
+    GenerateBitcoins(GetBoolArg("-gen",false), pwalletMain, GetArg("-genproclimit", 1));
+  #else
+    GenerateBitcoins(GetBoolArg("-gen",false), GetArg("-genproclimit", 1));
+  #endif
+#endif
+
+    stop_execution_clock();
+
+    UniValue txids(UniValue::VARR);
+    size_t nFailed = 0;
+    std::shared_ptr<AsyncRPCOperation> firstFailed;
+    for (auto& operation : operations_) {
+        if (operation->isSuccess()) {
+            txids.push_back(find_value(operation->getResult(), "txid"));
+        } else {
+            if (!firstFailed && operation->isFailed()) {
+                firstFailed = operation;
+            }
+            nFailed++;
+        }
+    }
+
+    if (nFailed == 0) {
+        UniValue o(UniValue::VOBJ);
+        o.push_back(Pair("txids", txids));
+        set_result(o);
+        set_state(OperationStatus::SUCCESS);
+    } else {
+        if (firstFailed) {
+            set_error_code(firstFailed->getErrorCode());
+            set_error_message(strprintf("%d of %d transactions were not sent, the first because: %s",
+                nFailed, operations_.size(), firstFailed->getErrorMessage()));
+        } else {
+            set_error_code(-1);
+            set_error_message(strprintf("%d of %d transactions were cancelled", nFailed, operations_.size()));
+        }
+        set_state(OperationStatus::FAILED);
+    }
+
+    LogPrintf("%s: %s finished (status=%s, %d of %d transactions sent)\n",
+        getId(), method_, getStateAsString(), operations_.size() - nFailed, operations_.size());
+}
+
+void AsyncRPCOperation_batch::run_operations() {
+    while (true) {
+        size_t i = next_++;
+        if (i >= operations_.size()) {
+            return;
+        }
+        std::shared_ptr<AsyncRPCOperation> operation = operations_[i];
+        CCoreReservation core(CORE_CLASS_WALLET);
+        RPCRequestURIScope uriScope(operation->getRequestURI());
+        // Don't start proving what can't be sent. A cancelled operation
+        // only releases its inputs.
+        if (ShutdownRequested()) {
+            operation->cancel();
+        }
+        operation->main();
+    }
+}
+
+/**
+ * Override getStatus() to append how far the batch is, and the outcome of
+ * each of its transactions, to the default status object.
+ */
+UniValue AsyncRPCOperation_batch::getStatus() const {
+    UniValue obj = AsyncRPCOperation::getStatus();
+
+    if (!contextinfo_.isNull()) {
+        obj.push_back(Pair("method", method_));
+        obj.push_back(Pair("params", contextinfo_));
+    }
+
+    size_t nQueued = 0, nExecuting = 0, nSent = 0, nFailed = 0, nCancelled = 0;
+    UniValue transactions(UniValue::VARR);
+    for (auto& operation : operations_) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("status", operation->getStateAsString()));
+        switch (operation->getState()) {
+        case OperationStatus::READY:
+            nQueued++;
+            break;
+        case OperationStatus::EXECUTING:
+            nExecuting++;
+            break;
+        case OperationStatus::SUCCESS:
+            nSent++;
+            entry.push_back(Pair("txid", find_value(operation->getResult(), "txid")));
+            break;
+        case OperationStatus::FAILED:
+            nFailed++;
+            entry.push_back(Pair("error", operation->getError()));
+            break;
+        case OperationStatus::CANCELLED:
+            nCancelled++;
+            break;
+        }
+        transactions.push_back(entry);
+    }
+
+    UniValue progress(UniValue::VOBJ);
+    progress.push_back(Pair("transactions", static_cast<uint64_t>(operations_.size())));
+    progress.push_back(Pair("queued", static_cast<uint64_t>(nQueued)));
+    progress.push_back(Pair("executing", static_cast<uint64_t>(nExecuting)));
+    progress.push_back(Pair("sent", static_cast<uint64_t>(nSent)));
+    progress.push_back(Pair("failed", static_cast<uint64_t>(nFailed)));
+    progress.push_back(Pair("cancelled", static_cast<uint64_t>(nCancelled)));
+    obj.push_back(Pair("progress", progress));
+    obj.push_back(Pair("transactions", transactions));
+    return obj;
+}
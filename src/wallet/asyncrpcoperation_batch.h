@@ -0,0 +1,69 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef ASYNCRPCOPERATION_BATCH_H
+#define ASYNCRPCOPERATION_BATCH_H
+
+#include "asyncrpcoperation.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <univalue.h>
+
+// Most transactions of a batch proven at the same time. Each proof uses
+// several cores for part of its work, and needs its own memory.
+static const size_t ASYNC_RPC_BATCH_MAX_PARALLEL = 4;
+
+/**
+ * Runs operations that each build and send a transaction of their own,
+ * such as the parts of a z_shieldcoinbase split over many transactions,
+ * several at a time rather than one after another in the queue. Each of
+ * them waits for a core of the budget -threads sets before it starts.
+ *
+ * The operations are not queued themselves, so z_getoperationstatus
+ * knows only this one, which reports how many of them are done, and the
+ * txid or error of each. It succeeds if all of them do.
+ *
+ * main() stops mining while it runs, so the operations it is given should
+ * have pauseMining set to false.
+ */
+class AsyncRPCOperation_batch : public AsyncRPCOperation {
+public:
+    AsyncRPCOperation_batch(
+        std::string method,
+        std::vector<std::shared_ptr<AsyncRPCOperation> > operations,
+        UniValue contextInfo = NullUniValue);
+    virtual ~AsyncRPCOperation_batch();
+
+    // We don't want to be copied or moved around
+    AsyncRPCOperation_batch(AsyncRPCOperation_batch const&) = delete;             // Copy construct
+    AsyncRPCOperation_batch(AsyncRPCOperation_batch&&) = delete;                  // Move construct
+    AsyncRPCOperation_batch& operator=(AsyncRPCOperation_batch const&) = delete;  // Copy assign
+    AsyncRPCOperation_batch& operator=(AsyncRPCOperation_batch &&) = delete;      // Move assign
+
+    virtual void main();
+
+    virtual UniValue getStatus() const;
+
+    // Every transaction of the batch needs at least one proof
+    virtual bool isHeavy() const {
+        return true;
+    }
+
+private:
+    std::string method_;
+    UniValue contextinfo_;     // optional data to include in return value from getStatus()
+
+    std::vector<std::shared_ptr<AsyncRPCOperation> > operations_;
+    // Index of the next operation a thread of main() will take
+    std::atomic<size_t> next_;
+
+    // Run operations until none are left to take
+    void run_operations();
+};
+
+#endif /* ASYNCRPCOPERATION_BATCH_H */
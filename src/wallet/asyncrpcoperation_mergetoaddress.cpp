@@ -22,6 +22,7 @@
 #include "utilmoneystr.h"
 #include "utiltime.h"
 #include "wallet.h"
+#include "wallet/rpcwallet.h"
 #include "walletdb.h"
 #include "zcash/IncrementalMerkleTree.hpp"
 
@@ -66,6 +67,8 @@ AsyncRPCOperation_mergetoaddress::AsyncRPCOperation_mergetoaddress(
     tx_(contextualTx), utxoInputs_(utxoInputs), sproutNoteInputs_(sproutNoteInputs),
     saplingNoteInputs_(saplingNoteInputs), recipient_(recipient), fee_(fee), contextinfo_(contextInfo)
 {
+    pwallet_ = GetWalletForJSONRPCRequest();
+
     if (fee < 0 || fee > MAX_MONEY) {
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Fee is out of range");
     }
@@ -139,11 +142,13 @@ void AsyncRPCOperation_mergetoaddress::main()
     bool success = false;
 
 #ifdef ENABLE_MINING
+    if (pauseMining) {
 #ifdef ENABLE_WALLET
-    GenerateBitcoins(false, NULL, 0);
+        GenerateBitcoins(false, NULL, 0);
 #else
-    GenerateBitcoins(false, 0);
+        GenerateBitcoins(false, 0);
 #endif
+    }
 #endif
 
     try {
@@ -168,11 +173,13 @@ void AsyncRPCOperation_mergetoaddress::main()
     }
 
 #ifdef ENABLE_MINING
+    if (pauseMining) {
 #ifdef ENABLE_WALLET
-    GenerateBitcoins(GetBoolArg("-gen", false), pwalletMain, GetArg("-genproclimit", 1));
+        GenerateBitcoins(GetBoolArg("-gen", false), pwalletMain, GetArg("-genproclimit", 1));
 #else
-    GenerateBitcoins(GetBoolArg("-gen", false), GetArg("-genproclimit", 1));
+        GenerateBitcoins(GetBoolArg("-gen", false), GetArg("-genproclimit", 1));
 #endif
+    }
 #endif
 
     stop_execution_clock();
@@ -321,17 +328,15 @@ bool AsyncRPCOperation_mergetoaddress::main_impl()
             auto expsk = std::get<3>(saplingNoteInput);
             expsks.push_back(expsk);
             if (!ovk) {
-                ovk = expsk.full_viewing_key().ovk;
+                ovk = expsk.ovk;
             }
         }
 
         // Fetch Sapling anchor and witnesses
-        uint256 anchor;
-        std::vector<boost::optional<SaplingWitness>> witnesses;
-        {
-            LOCK2(cs_main, pwalletMain->cs_wallet);
-            pwalletMain->GetSaplingNoteWitnesses(saplingOPs, witnesses, anchor);
-        }
+        start_phase("witness");
+        SaplingWitnessSnapshot snapshot = pwallet_->SnapshotSaplingNoteWitnesses(saplingOPs);
+        const uint256& anchor = snapshot.anchor;
+        const std::vector<boost::optional<SaplingWitness>>& witnesses = snapshot.witnesses;
 
         // Add Sapling spends
         for (size_t i = 0; i < saplingNotes.size(); i++) {
@@ -360,7 +365,7 @@ bool AsyncRPCOperation_mergetoaddress::main_impl()
                 // recoverable, while keeping it logically separate from the ZIP 32
                 // Sapling key hierarchy, which the user might not be using.
                 HDSeed seed;
-                if (!pwalletMain->GetHDSeed(seed)) {
+                if (!pwallet_->GetHDSeed(seed)) {
                     throw JSONRPCError(
                         RPC_WALLET_ERROR,
                         "AsyncRPCOperation_sendmany: HD seed not found");
@@ -375,6 +380,7 @@ bool AsyncRPCOperation_mergetoaddress::main_impl()
 
 
         // Build the transaction
+        start_phase("proving");
         auto maybe_tx = builder_.Build();
         if (!maybe_tx) {
             throw JSONRPCError(RPC_WALLET_ERROR, "Failed to build transaction.");
@@ -383,8 +389,10 @@ bool AsyncRPCOperation_mergetoaddress::main_impl()
 
         // Send the transaction
         // TODO: Use CWallet::CommitTransaction instead of sendrawtransaction
+        start_phase("broadcast");
         auto signedtxn = EncodeHexTx(tx_);
         if (!testmode) {
+            EnsureShieldedRequirementsMet(tx_);
             UniValue params = UniValue(UniValue::VARR);
             params.push_back(signedtxn);
             UniValue sendResultValue = sendrawtransaction(params, false);
@@ -477,15 +485,15 @@ bool AsyncRPCOperation_mergetoaddress::main_impl()
     // When spending notes, take a snapshot of note witnesses and anchors as the treestate will
     // change upon arrival of new blocks which contain joinsplit transactions.  This is likely
     // to happen as creating a chained joinsplit transaction can take longer than the block interval.
+    start_phase("witness");
     {
-        LOCK2(cs_main, pwalletMain->cs_wallet);
+        std::vector<JSOutPoint> vOutPoints;
         for (auto t : sproutNoteInputs_) {
-            JSOutPoint jso = std::get<0>(t);
-            std::vector<JSOutPoint> vOutPoints = {jso};
-            uint256 inputAnchor;
-            std::vector<boost::optional<SproutWitness>> vInputWitnesses;
-            pwalletMain->GetSproutNoteWitnesses(vOutPoints, vInputWitnesses, inputAnchor);
-            jsopWitnessAnchorMap[jso.ToString()] = MergeToAddressWitnessAnchorData{vInputWitnesses[0], inputAnchor};
+            vOutPoints.push_back(std::get<0>(t));
+        }
+        SproutWitnessSnapshot snapshot = pwallet_->SnapshotSproutNoteWitnesses(vOutPoints);
+        for (size_t i = 0; i < vOutPoints.size(); i++) {
+            jsopWitnessAnchorMap[vOutPoints[i].ToString()] = MergeToAddressWitnessAnchorData{snapshot.witnesses[i], snapshot.anchor};
         }
     }
 
@@ -566,15 +574,16 @@ bool AsyncRPCOperation_mergetoaddress::main_impl()
         // Consume change as the first input of the JoinSplit.
         //
         if (jsChange > 0) {
-            LOCK2(cs_main, pwalletMain->cs_wallet);
-
             // Update tree state with previous joinsplit
             SproutMerkleTree tree;
             auto it = intermediates.find(prevJoinSplit.anchor);
             if (it != intermediates.end()) {
                 tree = it->second;
-            } else if (!pcoinsTip->GetSproutAnchorAt(prevJoinSplit.anchor, tree)) {
-                throw JSONRPCError(RPC_WALLET_ERROR, "Could not find previous JoinSplit anchor");
+            } else {
+                LOCK(cs_main);
+                if (!pcoinsTip->GetSproutAnchorAt(prevJoinSplit.anchor, tree)) {
+                    throw JSONRPCError(RPC_WALLET_ERROR, "Could not find previous JoinSplit anchor");
+                }
             }
 
             assert(changeOutputIndex != -1);
@@ -656,8 +665,8 @@ bool AsyncRPCOperation_mergetoaddress::main_impl()
             int wtxHeight = -1;
             int wtxDepth = -1;
             {
-                LOCK2(cs_main, pwalletMain->cs_wallet);
-                const CWalletTx& wtx = pwalletMain->mapWallet[jso.hash];
+                LOCK2(cs_main, pwallet_->cs_wallet);
+                const CWalletTx& wtx = pwallet_->mapWallet[jso.hash];
                 // Zero confirmation notes belong to transactions which have not yet been mined
                 if (mapBlockIndex.find(wtx.hashBlock) == mapBlockIndex.end()) {
                     throw JSONRPCError(RPC_WALLET_ERROR, strprintf("mapBlockIndex does not contain block hash %s", wtx.hashBlock.ToString()));
@@ -772,6 +781,8 @@ extern UniValue signrawtransaction(const UniValue& params, bool fHelp);
  */
 void AsyncRPCOperation_mergetoaddress::sign_send_raw_transaction(UniValue obj)
 {
+    start_phase("broadcast");
+
     // Sign the raw transaction
     UniValue rawtxnValue = find_value(obj, "rawtxn");
     if (rawtxnValue.isNull()) {
@@ -796,8 +807,14 @@ void AsyncRPCOperation_mergetoaddress::sign_send_raw_transaction(UniValue obj)
     }
     std::string signedtxn = hexValue.get_str();
 
+    // Keep the signed transaction so we can hash to the same txid
+    CDataStream stream(ParseHex(signedtxn), SER_NETWORK, PROTOCOL_VERSION);
+    CTransaction tx;
+    stream >> tx;
+
     // Send the signed transaction
     if (!testmode) {
+        EnsureShieldedRequirementsMet(tx);
         params.clear();
         params.setArray();
         params.push_back(signedtxn);
@@ -813,11 +830,6 @@ void AsyncRPCOperation_mergetoaddress::sign_send_raw_transaction(UniValue obj)
         set_result(o);
     } else {
         // Test mode does not send the transaction to the network.
-
-        CDataStream stream(ParseHex(signedtxn), SER_NETWORK, PROTOCOL_VERSION);
-        CTransaction tx;
-        stream >> tx;
-
         UniValue o(UniValue::VOBJ);
         o.push_back(Pair("test", 1));
         o.push_back(Pair("txid", tx.GetHash().ToString()));
@@ -825,10 +837,6 @@ void AsyncRPCOperation_mergetoaddress::sign_send_raw_transaction(UniValue obj)
         set_result(o);
     }
 
-    // Keep the signed transaction so we can hash to the same txid
-    CDataStream stream(ParseHex(signedtxn), SER_NETWORK, PROTOCOL_VERSION);
-    CTransaction tx;
-    stream >> tx;
     tx_ = tx;
 }
 
@@ -847,13 +855,9 @@ UniValue AsyncRPCOperation_mergetoaddress::perform_joinsplit(MergeToAddressJSInf
 
 UniValue AsyncRPCOperation_mergetoaddress::perform_joinsplit(MergeToAddressJSInfo& info, std::vector<JSOutPoint>& outPoints)
 {
-    std::vector<boost::optional<SproutWitness>> witnesses;
-    uint256 anchor;
-    {
-        LOCK(cs_main);
-        pwalletMain->GetSproutNoteWitnesses(outPoints, witnesses, anchor);
-    }
-    return perform_joinsplit(info, witnesses, anchor);
+    start_phase("witness");
+    SproutWitnessSnapshot snapshot = pwallet_->SnapshotSproutNoteWitnesses(outPoints);
+    return perform_joinsplit(info, snapshot.witnesses, snapshot.anchor);
 }
 
 UniValue AsyncRPCOperation_mergetoaddress::perform_joinsplit(
@@ -861,6 +865,8 @@ UniValue AsyncRPCOperation_mergetoaddress::perform_joinsplit(
     std::vector<boost::optional<SproutWitness>> witnesses,
     uint256 anchor)
 {
+    start_phase("proving");
+
     if (anchor.IsNull()) {
         throw std::runtime_error("anchor is null");
     }
@@ -1061,9 +1067,9 @@ UniValue AsyncRPCOperation_mergetoaddress::getStatus() const
  * Lock input utxos
  */
  void AsyncRPCOperation_mergetoaddress::lock_utxos() {
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet_->cs_wallet);
     for (auto utxo : utxoInputs_) {
-        pwalletMain->LockCoin(std::get<0>(utxo));
+        pwallet_->LockCoin(std::get<0>(utxo));
     }
 }
 
@@ -1071,9 +1077,9 @@ UniValue AsyncRPCOperation_mergetoaddress::getStatus() const
  * Unlock input utxos
  */
 void AsyncRPCOperation_mergetoaddress::unlock_utxos() {
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet_->cs_wallet);
     for (auto utxo : utxoInputs_) {
-        pwalletMain->UnlockCoin(std::get<0>(utxo));
+        pwallet_->UnlockCoin(std::get<0>(utxo));
     }
 }
 
@@ -1082,12 +1088,12 @@ void AsyncRPCOperation_mergetoaddress::unlock_utxos() {
  * Lock input notes
  */
  void AsyncRPCOperation_mergetoaddress::lock_notes() {
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet_->cs_wallet);
     for (auto note : sproutNoteInputs_) {
-        pwalletMain->LockNote(std::get<0>(note));
+        pwallet_->LockNote(std::get<0>(note));
     }
     for (auto note : saplingNoteInputs_) {
-        pwalletMain->LockNote(std::get<0>(note));
+        pwallet_->LockNote(std::get<0>(note));
     }
 }
 
@@ -1095,11 +1101,11 @@ void AsyncRPCOperation_mergetoaddress::unlock_utxos() {
  * Unlock input notes
  */
 void AsyncRPCOperation_mergetoaddress::unlock_notes() {
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet_->cs_wallet);
     for (auto note : sproutNoteInputs_) {
-        pwalletMain->UnlockNote(std::get<0>(note));
+        pwallet_->UnlockNote(std::get<0>(note));
     }
     for (auto note : saplingNoteInputs_) {
-        pwalletMain->UnlockNote(std::get<0>(note));
+        pwallet_->UnlockNote(std::get<0>(note));
     }
 }
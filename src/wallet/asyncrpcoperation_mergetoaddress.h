@@ -76,15 +76,25 @@ public:
 
     virtual UniValue getStatus() const;
 
+    // Merges spend many inputs at once, each of them needing a proof
+    virtual bool isHeavy() const {
+        return true;
+    }
+
     bool testmode = false; // Set to true to disable sending txs and generating proofs
 
     bool paymentDisclosureMode = false; // Set to true to save esk for encrypted notes in payment disclosure database.
 
+    bool pauseMining = true; // Set to false when whoever runs main() stops mining around it, as AsyncRPCOperation_batch does
+
 private:
     friend class TEST_FRIEND_AsyncRPCOperation_mergetoaddress; // class for unit testing
 
     UniValue contextinfo_; // optional data to include in return value from getStatus()
 
+    // The wallet of the RPC call that created the operation
+    CWallet* pwallet_;
+
     bool isUsingBuilder_; // Indicates that no Sprout addresses are involved
     uint32_t consensusBranchId_;
     CAmount fee_;
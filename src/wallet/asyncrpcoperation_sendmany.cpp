@@ -5,6 +5,7 @@
 #include "asyncrpcoperation_sendmany.h"
 #include "asyncrpcqueue.h"
 #include "amount.h"
+#include "coinselection.h"
 #include "consensus/upgrades.h"
 #include "core_io.h"
 #include "init.h"
@@ -18,6 +19,7 @@
 #include "util.h"
 #include "utilmoneystr.h"
 #include "wallet.h"
+#include "wallet/rpcwallet.h"
 #include "walletdb.h"
 #include "script/interpreter.h"
 #include "utiltime.h"
@@ -28,6 +30,7 @@
 #include <array>
 #include <iostream>
 #include <chrono>
+#include <future>
 #include <thread>
 #include <string>
 
@@ -66,6 +69,8 @@ AsyncRPCOperation_sendmany::AsyncRPCOperation_sendmany(
         UniValue contextInfo) :
         tx_(contextualTx), fromaddress_(fromAddress), t_outputs_(tOutputs), z_outputs_(zOutputs), mindepth_(minDepth), fee_(fee), contextinfo_(contextInfo)
 {
+    pwallet_ = GetWalletForJSONRPCRequest();
+
     assert(fee_ >= 0);
 
     if (minDepth < 0) {
@@ -94,13 +99,13 @@ AsyncRPCOperation_sendmany::AsyncRPCOperation_sendmany(
         auto address = DecodePaymentAddress(fromAddress);
         if (IsValidPaymentAddress(address)) {
             // We don't need to lock on the wallet as spending key related methods are thread-safe
-            if (!boost::apply_visitor(HaveSpendingKeyForPaymentAddress(pwalletMain), address)) {
+            if (!boost::apply_visitor(HaveSpendingKeyForPaymentAddress(pwallet_), address)) {
                 throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid from address, no spending key found for zaddr");
             }
 
             isfromzaddr_ = true;
             frompaymentaddress_ = address;
-            spendingkey_ = boost::apply_visitor(GetSpendingKeyForPaymentAddress(pwalletMain), address).get();
+            spendingkey_ = boost::apply_visitor(GetSpendingKeyForPaymentAddress(pwallet_), address).get();
         } else {
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid from address");
         }
@@ -216,6 +221,8 @@ bool AsyncRPCOperation_sendmany::main_impl() {
     bool isPureTaddrOnlyTx = (isfromtaddr_ && z_outputs_.size() == 0);
     CAmount minersFee = fee_;
 
+    start_phase("selection");
+
     // When spending coinbase utxos, you can only specify a single zaddr as the change must go somewhere
     // and if there are multiple zaddrs, we don't know where to send it.
     if (isfromtaddr_) {
@@ -384,14 +391,14 @@ bool AsyncRPCOperation_sendmany::main_impl() {
         if (isfromzaddr_) {
             auto sk = boost::get<libzcash::SaplingExtendedSpendingKey>(spendingkey_);
             expsk = sk.expsk;
-            ovk = expsk.full_viewing_key().ovk;
+            ovk = expsk.ovk;
         } else {
             // Sending from a t-address, which we don't have an ovk for. Instead,
             // generate a common one from the HD seed. This ensures the data is
             // recoverable, while keeping it logically separate from the ZIP 32
             // Sapling key hierarchy, which the user might not be using.
             HDSeed seed;
-            if (!pwalletMain->GetHDSeed(seed)) {
+            if (!pwallet_->GetHDSeed(seed)) {
                 throw JSONRPCError(
                     RPC_WALLET_ERROR,
                     "AsyncRPCOperation_sendmany::main_impl(): HD seed not found");
@@ -402,10 +409,10 @@ bool AsyncRPCOperation_sendmany::main_impl() {
         // Set change address if we are using transparent funds
         // TODO: Should we just use fromtaddr_ as the change address?
         if (isfromtaddr_) {
-            LOCK2(cs_main, pwalletMain->cs_wallet);
+            LOCK2(cs_main, pwallet_->cs_wallet);
 
-            EnsureWalletIsUnlocked();
-            CReserveKey keyChange(pwalletMain);
+            EnsureWalletIsUnlocked(pwallet_);
+            CReserveKey keyChange(pwallet_);
             CPubKey vchPubKey;
             bool ret = keyChange.GetReservedKey(vchPubKey);
             if (!ret) {
@@ -419,26 +426,41 @@ bool AsyncRPCOperation_sendmany::main_impl() {
             assert(builder_.SendChangeTo(changeAddr));
         }
 
-        // Select Sapling notes
+        // Select Sapling notes. A set that adds up to the target exactly
+        // saves proving a change output; otherwise take the biggest notes
+        // first, and spend up to -consolidateinputs of the smallest along
+        // with them since there is change anyway.
+        std::vector<CAmount> values;
+        for (const SaplingNoteEntry& t : z_sapling_inputs_) {
+            values.push_back(t.note.value());
+        }
+        std::vector<char> selected;
+        CAmount sum = 0;
+        if (!SelectCoinsBnB(values, targetAmount, 1, selected, sum)) {
+            selected.assign(values.size(), false);
+            sum = 0;
+            for (size_t i = 0; i < values.size() && sum < targetAmount; i++) {
+                selected[i] = true;
+                sum += values[i];
+            }
+            if (sum > targetAmount) {
+                sum += SelectConsolidationInputs(values, selected, nConsolidateInputs);
+            }
+        }
         std::vector<SaplingOutPoint> ops;
         std::vector<SaplingNote> notes;
-        CAmount sum = 0;
-        for (auto t : z_sapling_inputs_) {
-            ops.push_back(t.op);
-            notes.push_back(t.note);
-            sum += t.note.value();
-            if (sum >= targetAmount) {
-                break;
+        for (size_t i = 0; i < z_sapling_inputs_.size(); i++) {
+            if (selected[i]) {
+                ops.push_back(z_sapling_inputs_[i].op);
+                notes.push_back(z_sapling_inputs_[i].note);
             }
         }
 
         // Fetch Sapling anchor and witnesses
-        uint256 anchor;
-        std::vector<boost::optional<SaplingWitness>> witnesses;
-        {
-            LOCK2(cs_main, pwalletMain->cs_wallet);
-            pwalletMain->GetSaplingNoteWitnesses(ops, witnesses, anchor);
-        }
+        start_phase("witness");
+        SaplingWitnessSnapshot snapshot = pwallet_->SnapshotSaplingNoteWitnesses(ops);
+        const uint256& anchor = snapshot.anchor;
+        const std::vector<boost::optional<SaplingWitness>>& witnesses = snapshot.witnesses;
 
         // Add Sapling spends
         for (size_t i = 0; i < notes.size(); i++) {
@@ -475,6 +497,7 @@ bool AsyncRPCOperation_sendmany::main_impl() {
         }
 
         // Build the transaction
+        start_phase("proving");
         auto maybe_tx = builder_.Build();
         if (!maybe_tx) {
             throw JSONRPCError(RPC_WALLET_ERROR, "Failed to build transaction.");
@@ -483,8 +506,10 @@ bool AsyncRPCOperation_sendmany::main_impl() {
 
         // Send the transaction
         // TODO: Use CWallet::CommitTransaction instead of sendrawtransaction
+        start_phase("broadcast");
         auto signedtxn = EncodeHexTx(tx_);
         if (!testmode) {
+            EnsureShieldedRequirementsMet(tx_);
             UniValue params = UniValue(UniValue::VARR);
             params.push_back(signedtxn);
             UniValue sendResultValue = sendrawtransaction(params, false);
@@ -577,14 +602,14 @@ bool AsyncRPCOperation_sendmany::main_impl() {
     // change upon arrival of new blocks which contain joinsplit transactions.  This is likely
     // to happen as creating a chained joinsplit transaction can take longer than the block interval.
     if (z_sprout_inputs_.size() > 0) {
-        LOCK2(cs_main, pwalletMain->cs_wallet);
+        start_phase("witness");
+        std::vector<JSOutPoint> vOutPoints;
         for (auto t : z_sprout_inputs_) {
-            JSOutPoint jso = std::get<0>(t);
-            std::vector<JSOutPoint> vOutPoints = { jso };
-            uint256 inputAnchor;
-            std::vector<boost::optional<SproutWitness>> vInputWitnesses;
-            pwalletMain->GetSproutNoteWitnesses(vOutPoints, vInputWitnesses, inputAnchor);
-            jsopWitnessAnchorMap[ jso.ToString() ] = WitnessAnchorData{ vInputWitnesses[0], inputAnchor };
+            vOutPoints.push_back(std::get<0>(t));
+        }
+        SproutWitnessSnapshot snapshot = pwallet_->SnapshotSproutNoteWitnesses(vOutPoints);
+        for (size_t i = 0; i < vOutPoints.size(); i++) {
+            jsopWitnessAnchorMap[ vOutPoints[i].ToString() ] = WitnessAnchorData{ snapshot.witnesses[i], snapshot.anchor };
         }
     }
 
@@ -624,7 +649,8 @@ bool AsyncRPCOperation_sendmany::main_impl() {
         }
 
         // Create joinsplits, where each output represents a zaddr recipient.
-        UniValue obj(UniValue::VOBJ);
+        // They have no input notes and so don't depend on each other.
+        std::vector<AsyncJoinSplitInfo> infos;
         while (zOutputsDeque.size() > 0) {
             AsyncJoinSplitInfo info;
             info.vpub_old = 0;
@@ -647,7 +673,32 @@ bool AsyncRPCOperation_sendmany::main_impl() {
                 // Funds are removed from the value pool and enter the private pool
                 info.vpub_old += value;
             }
-            obj = perform_joinsplit(info);
+            infos.push_back(info);
+        }
+
+        UniValue obj(UniValue::VOBJ);
+        if (!infos.empty()) {
+            start_phase("proving");
+            uint256 anchor;
+            {
+                LOCK(cs_main);
+                anchor = pcoinsTip->GetBestAnchor(SPROUT);
+            }
+
+            // Prove a batch at a time, then add them to the transaction in order
+            std::vector<boost::optional<SproutWitness>> witnesses;
+            for (size_t i = 0; i < infos.size(); i += ASYNC_RPC_OPERATION_MAX_PARALLEL_JOINSPLITS) {
+                size_t end = std::min(infos.size(), i + ASYNC_RPC_OPERATION_MAX_PARALLEL_JOINSPLITS);
+                std::vector<std::future<AsyncJoinSplitProof>> proofs;
+                for (size_t j = i; j < end; j++) {
+                    proofs.push_back(std::async(std::launch::async,
+                        &AsyncRPCOperation_sendmany::prove_joinsplit, this,
+                        std::ref(infos[j]), witnesses, anchor));
+                }
+                for (auto& proof : proofs) {
+                    obj = add_joinsplit(proof.get());
+                }
+            }
         }
         sign_send_raw_transaction(obj);
         return true;
@@ -708,15 +759,16 @@ bool AsyncRPCOperation_sendmany::main_impl() {
         // Consume change as the first input of the JoinSplit.
         //
         if (jsChange > 0) {
-            LOCK2(cs_main, pwalletMain->cs_wallet);
-
             // Update tree state with previous joinsplit
             SproutMerkleTree tree;
             auto it = intermediates.find(prevJoinSplit.anchor);
             if (it != intermediates.end()) {
                 tree = it->second;
-            } else if (!pcoinsTip->GetSproutAnchorAt(prevJoinSplit.anchor, tree)) {
-                throw JSONRPCError(RPC_WALLET_ERROR, "Could not find previous JoinSplit anchor");
+            } else {
+                LOCK(cs_main);
+                if (!pcoinsTip->GetSproutAnchorAt(prevJoinSplit.anchor, tree)) {
+                    throw JSONRPCError(RPC_WALLET_ERROR, "Could not find previous JoinSplit anchor");
+                }
             }
 
             assert(changeOutputIndex != -1);
@@ -795,8 +847,8 @@ bool AsyncRPCOperation_sendmany::main_impl() {
             int wtxHeight = -1;
             int wtxDepth = -1;
             {
-                LOCK2(cs_main, pwalletMain->cs_wallet);
-                const CWalletTx& wtx = pwalletMain->mapWallet[jso.hash];
+                LOCK2(cs_main, pwallet_->cs_wallet);
+                const CWalletTx& wtx = pwallet_->mapWallet[jso.hash];
                 // Zero-confirmation notes belong to transactions which have not yet been mined
                 if (mapBlockIndex.find(wtx.hashBlock) == mapBlockIndex.end()) {
                     throw JSONRPCError(RPC_WALLET_ERROR, strprintf("mapBlockIndex does not contain block hash %s", wtx.hashBlock.ToString()));
@@ -938,6 +990,8 @@ bool AsyncRPCOperation_sendmany::main_impl() {
  */
 void AsyncRPCOperation_sendmany::sign_send_raw_transaction(UniValue obj)
 {   
+    start_phase("broadcast");
+
     // Sign the raw transaction
     UniValue rawtxnValue = find_value(obj, "rawtxn");
     if (rawtxnValue.isNull()) {
@@ -962,8 +1016,14 @@ void AsyncRPCOperation_sendmany::sign_send_raw_transaction(UniValue obj)
     }
     std::string signedtxn = hexValue.get_str();
 
+    // Keep the signed transaction so we can hash to the same txid
+    CDataStream stream(ParseHex(signedtxn), SER_NETWORK, PROTOCOL_VERSION);
+    CTransaction tx;
+    stream >> tx;
+
     // Send the signed transaction
     if (!testmode) {
+        EnsureShieldedRequirementsMet(tx);
         params.clear();
         params.setArray();
         params.push_back(signedtxn);
@@ -979,11 +1039,6 @@ void AsyncRPCOperation_sendmany::sign_send_raw_transaction(UniValue obj)
         set_result(o);
     } else {
         // Test mode does not send the transaction to the network.
-
-        CDataStream stream(ParseHex(signedtxn), SER_NETWORK, PROTOCOL_VERSION);
-        CTransaction tx;
-        stream >> tx;
-
         UniValue o(UniValue::VOBJ);
         o.push_back(Pair("test", 1));
         o.push_back(Pair("txid", tx.GetHash().ToString()));
@@ -991,10 +1046,6 @@ void AsyncRPCOperation_sendmany::sign_send_raw_transaction(UniValue obj)
         set_result(o);
     }
 
-    // Keep the signed transaction so we can hash to the same txid
-    CDataStream stream(ParseHex(signedtxn), SER_NETWORK, PROTOCOL_VERSION);
-    CTransaction tx;
-    stream >> tx;
     tx_ = tx;
 }
 
@@ -1004,9 +1055,9 @@ bool AsyncRPCOperation_sendmany::find_utxos(bool fAcceptCoinbase=false) {
     destinations.insert(fromtaddr_);
     vector<COutput> vecOutputs;
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet_->cs_wallet);
 
-    pwalletMain->AvailableCoins(vecOutputs, false, NULL, true, fAcceptCoinbase);
+    pwallet_->AvailableCoins(vecOutputs, false, NULL, true, fAcceptCoinbase);
 
     BOOST_FOREACH(const COutput& out, vecOutputs) {
         if (!out.fSpendable) {
@@ -1052,8 +1103,8 @@ bool AsyncRPCOperation_sendmany::find_unspent_notes() {
     std::vector<CSproutNotePlaintextEntry> sproutEntries;
     std::vector<SaplingNoteEntry> saplingEntries;
     {
-        LOCK2(cs_main, pwalletMain->cs_wallet);
-        pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, fromaddress_, mindepth_);
+        LOCK2(cs_main, pwallet_->cs_wallet);
+        pwallet_->GetFilteredNotes(sproutEntries, saplingEntries, fromaddress_, mindepth_);
     }
 
     // If using the TransactionBuilder, we only want Sapling notes.
@@ -1118,19 +1169,24 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(AsyncJoinSplitInfo & info
 
 
 UniValue AsyncRPCOperation_sendmany::perform_joinsplit(AsyncJoinSplitInfo & info, std::vector<JSOutPoint> & outPoints) {
-    std::vector<boost::optional < SproutWitness>> witnesses;
-    uint256 anchor;
-    {
-        LOCK(cs_main);
-        pwalletMain->GetSproutNoteWitnesses(outPoints, witnesses, anchor);
-    }
-    return perform_joinsplit(info, witnesses, anchor);
+    start_phase("witness");
+    SproutWitnessSnapshot snapshot = pwallet_->SnapshotSproutNoteWitnesses(outPoints);
+    return perform_joinsplit(info, snapshot.witnesses, snapshot.anchor);
 }
 
 UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
         AsyncJoinSplitInfo & info,
         std::vector<boost::optional < SproutWitness>> witnesses,
         uint256 anchor)
+{
+    start_phase("proving");
+    return add_joinsplit(prove_joinsplit(info, witnesses, anchor));
+}
+
+AsyncJoinSplitProof AsyncRPCOperation_sendmany::prove_joinsplit(
+        AsyncJoinSplitInfo & info,
+        std::vector<boost::optional < SproutWitness>> witnesses,
+        uint256 anchor)
 {
     if (anchor.IsNull()) {
         throw std::runtime_error("anchor is null");
@@ -1160,11 +1216,8 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
         throw runtime_error("unsupported joinsplit input/output counts");
     }
 
-    CMutableTransaction mtx(tx_);
-
-    LogPrint("zrpcunsafe", "%s: creating joinsplit at index %d (vpub_old=%s, vpub_new=%s, in[0]=%s, in[1]=%s, out[0]=%s, out[1]=%s)\n",
+    LogPrint("zrpcunsafe", "%s: creating joinsplit (vpub_old=%s, vpub_new=%s, in[0]=%s, in[1]=%s, out[0]=%s, out[1]=%s)\n",
             getId(),
-            tx_.vjoinsplit.size(),
             FormatMoney(info.vpub_old), FormatMoney(info.vpub_new),
             FormatMoney(info.vjsin[0].note.value()), FormatMoney(info.vjsin[1].note.value()),
             FormatMoney(info.vjsout[0].value), FormatMoney(info.vjsout[1].value)
@@ -1173,33 +1226,36 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
     // Generate the proof, this can take over a minute.
     std::array<libzcash::JSInput, ZC_NUM_JS_INPUTS> inputs
             {info.vjsin[0], info.vjsin[1]};
-    std::array<libzcash::JSOutput, ZC_NUM_JS_OUTPUTS> outputs
-            {info.vjsout[0], info.vjsout[1]};
-    std::array<size_t, ZC_NUM_JS_INPUTS> inputMap;
-    std::array<size_t, ZC_NUM_JS_OUTPUTS> outputMap;
+    AsyncJoinSplitProof proof;
+    proof.outputs = {info.vjsout[0], info.vjsout[1]};
 
-    uint256 esk; // payment disclosure - secret
-
-    JSDescription jsdesc = JSDescription::Randomized(
-            mtx.fOverwintered && (mtx.nVersion >= SAPLING_TX_VERSION),
+    proof.jsdesc = JSDescription::Randomized(
+            tx_.fOverwintered && (tx_.nVersion >= SAPLING_TX_VERSION),
             *pzcashParams,
             joinSplitPubKey_,
             anchor,
             inputs,
-            outputs,
-            inputMap,
-            outputMap,
+            proof.outputs,
+            proof.inputMap,
+            proof.outputMap,
             info.vpub_old,
             info.vpub_new,
             !this->testmode,
-            &esk); // parameter expects pointer to esk, so pass in address
+            &proof.esk); // parameter expects pointer to esk, so pass in address
     {
         auto verifier = libzcash::ProofVerifier::Strict();
-        if (!(jsdesc.Verify(*pzcashParams, verifier, joinSplitPubKey_))) {
+        if (!(proof.jsdesc.Verify(*pzcashParams, verifier, joinSplitPubKey_))) {
             throw std::runtime_error("error verifying joinsplit");
         }
     }
+    return proof;
+}
 
+UniValue AsyncRPCOperation_sendmany::add_joinsplit(const AsyncJoinSplitProof & proof)
+{
+    const JSDescription& jsdesc = proof.jsdesc;
+
+    CMutableTransaction mtx(tx_);
     mtx.vjoinsplit.push_back(jsdesc);
 
     // Empty output script.
@@ -1255,10 +1311,10 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
     UniValue arrInputMap(UniValue::VARR);
     UniValue arrOutputMap(UniValue::VARR);
     for (size_t i = 0; i < ZC_NUM_JS_INPUTS; i++) {
-        arrInputMap.push_back(static_cast<uint64_t>(inputMap[i]));
+        arrInputMap.push_back(static_cast<uint64_t>(proof.inputMap[i]));
     }
     for (size_t i = 0; i < ZC_NUM_JS_OUTPUTS; i++) {
-        arrOutputMap.push_back(static_cast<uint64_t>(outputMap[i]));
+        arrOutputMap.push_back(static_cast<uint64_t>(proof.outputMap[i]));
     }
 
 
@@ -1270,12 +1326,12 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
     size_t js_index = tx_.vjoinsplit.size() - 1;
     uint256 placeholder;
     for (int i = 0; i < ZC_NUM_JS_OUTPUTS; i++) {
-        uint8_t mapped_index = outputMap[i];
+        uint8_t mapped_index = proof.outputMap[i];
         // placeholder for txid will be filled in later when tx has been finalized and signed.
         PaymentDisclosureKey pdKey = {placeholder, js_index, mapped_index};
-        JSOutput output = outputs[mapped_index];
+        JSOutput output = proof.outputs[mapped_index];
         libzcash::SproutPaymentAddress zaddr = output.addr;  // randomized output
-        PaymentDisclosureInfo pdInfo = {PAYMENT_DISCLOSURE_VERSION_EXPERIMENTAL, esk, joinSplitPrivKey, zaddr};
+        PaymentDisclosureInfo pdInfo = {PAYMENT_DISCLOSURE_VERSION_EXPERIMENTAL, proof.esk, joinSplitPrivKey, zaddr};
         paymentDisclosureData_.push_back(PaymentDisclosureKeyInfo(pdKey, pdInfo));
 
         LogPrint("paymentdisclosure", "%s: Payment Disclosure: js=%d, n=%d, zaddr=%s\n", getId(), js_index, int(mapped_index), EncodePaymentAddress(zaddr));
@@ -1315,10 +1371,10 @@ void AsyncRPCOperation_sendmany::add_taddr_outputs_to_tx() {
 
 void AsyncRPCOperation_sendmany::add_taddr_change_output_to_tx(CAmount amount) {
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet_->cs_wallet);
 
-    EnsureWalletIsUnlocked();
-    CReserveKey keyChange(pwalletMain);
+    EnsureWalletIsUnlocked(pwallet_);
+    CReserveKey keyChange(pwallet_);
     CPubKey vchPubKey;
     bool ret = keyChange.GetReservedKey(vchPubKey);
     if (!ret) {
@@ -23,6 +23,14 @@
 // Default transaction fee if caller does not specify one.
 #define ASYNC_RPC_OPERATION_DEFAULT_MINERS_FEE   10000
 
+// Sends to more shielded recipients than this, each needing an output proof,
+// are queued as heavy operations.
+static const size_t ASYNC_RPC_OPERATION_HEAVY_ZOUTPUTS = 10;
+
+// Most JoinSplits proven at the same time when they don't depend on each other.
+// Each proof already uses every core for part of its work, and needs its own memory.
+static const int ASYNC_RPC_OPERATION_MAX_PARALLEL_JOINSPLITS = 4;
+
 using namespace libzcash;
 
 // A recipient is a tuple of address, amount, memo (optional if zaddr)
@@ -50,6 +58,16 @@ struct WitnessAnchorData {
 	uint256 anchor;
 };
 
+// A JoinSplit that has been proven but not yet added to the transaction
+struct AsyncJoinSplitProof
+{
+    JSDescription jsdesc;
+    std::array<libzcash::JSOutput, ZC_NUM_JS_OUTPUTS> outputs;
+    std::array<size_t, ZC_NUM_JS_INPUTS> inputMap;
+    std::array<size_t, ZC_NUM_JS_OUTPUTS> outputMap;
+    uint256 esk; // payment disclosure - secret
+};
+
 class AsyncRPCOperation_sendmany : public AsyncRPCOperation {
 public:
     AsyncRPCOperation_sendmany(
@@ -73,6 +91,11 @@ public:
 
     virtual UniValue getStatus() const;
 
+    // Sprout sends chain one JoinSplit proof after another
+    virtual bool isHeavy() const {
+        return !isUsingBuilder_ || z_outputs_.size() > ASYNC_RPC_OPERATION_HEAVY_ZOUTPUTS;
+    }
+
     bool testmode = false;  // Set to true to disable sending txs and generating proofs
 
     bool paymentDisclosureMode = false; // Set to true to save esk for encrypted notes in payment disclosure database.
@@ -82,6 +105,9 @@ private:
 
     UniValue contextinfo_;     // optional data to include in return value from getStatus()
 
+    // The wallet of the RPC call that created the operation
+    CWallet* pwallet_;
+
     bool isUsingBuilder_; // Indicates that no Sprout addresses are involved
     uint32_t consensusBranchId_;
     CAmount fee_;
@@ -127,6 +153,16 @@ private:
         std::vector<boost::optional < SproutWitness>> witnesses,
         uint256 anchor);
 
+    // Generate the proof for a JoinSplit. Does not touch tx_, so JoinSplits
+    // that don't depend on each other can be proven at the same time.
+    AsyncJoinSplitProof prove_joinsplit(
+        AsyncJoinSplitInfo & info,
+        std::vector<boost::optional < SproutWitness>> witnesses,
+        uint256 anchor);
+
+    // Add a proven JoinSplit to tx_ and sign it
+    UniValue add_joinsplit(const AsyncJoinSplitProof & proof);
+
     void sign_send_raw_transaction(UniValue obj);     // throws exception if there was an error
 
     // payment disclosure!
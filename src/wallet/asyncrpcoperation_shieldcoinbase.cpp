@@ -17,6 +17,7 @@
 #include "util.h"
 #include "utilmoneystr.h"
 #include "wallet.h"
+#include "wallet/rpcwallet.h"
 #include "walletdb.h"
 #include "script/interpreter.h"
 #include "utiltime.h"
@@ -63,6 +64,8 @@ AsyncRPCOperation_shieldcoinbase::AsyncRPCOperation_shieldcoinbase(
         UniValue contextInfo) :
         builder_(builder), tx_(contextualTx), inputs_(inputs), fee_(fee), contextinfo_(contextInfo)
 {
+    pwallet_ = GetWalletForJSONRPCRequest();
+
     assert(contextualTx.nVersion >= 2);  // transaction format version must support vjoinsplit
 
     if (fee < 0 || fee > MAX_MONEY) {
@@ -110,11 +113,13 @@ void AsyncRPCOperation_shieldcoinbase::main() {
     bool success = false;
 
 #ifdef ENABLE_MINING
+    if (pauseMining) {
   #ifdef ENABLE_WALLET
-    GenerateBitcoins(false, NULL, 0);
+        GenerateBitcoins(false, NULL, 0);
   #else
-    GenerateBitcoins(false, 0);
+        GenerateBitcoins(false, 0);
   #endif
+    }
 #endif
 
     try {
@@ -139,11 +144,13 @@ void AsyncRPCOperation_shieldcoinbase::main() {
     }
 
 #ifdef ENABLE_MINING
+    if (pauseMining) {
   #ifdef ENABLE_WALLET
-    GenerateBitcoins(GetBoolArg("-gen",false), pwalletMain, GetArg("-genproclimit", 1));
+        GenerateBitcoins(GetBoolArg("-gen",false), pwalletMain, GetArg("-genproclimit", 1));
   #else
-    GenerateBitcoins(GetBoolArg("-gen",false), GetArg("-genproclimit", 1));
+        GenerateBitcoins(GetBoolArg("-gen",false), GetArg("-genproclimit", 1));
   #endif
+    }
 #endif
 
     stop_execution_clock();
@@ -258,7 +265,7 @@ bool ShieldToAddress::operator()(const libzcash::SaplingPaymentAddress &zaddr) c
     // recoverable, while keeping it logically separate from the ZIP 32
     // Sapling key hierarchy, which the user might not be using.
     HDSeed seed;
-    if (!pwalletMain->GetHDSeed(seed)) {
+    if (!m_op->pwallet_->GetHDSeed(seed)) {
         throw JSONRPCError(
             RPC_WALLET_ERROR,
             "CWallet::GenerateNewSaplingZKey(): HD seed not found");
@@ -274,6 +281,7 @@ bool ShieldToAddress::operator()(const libzcash::SaplingPaymentAddress &zaddr) c
     m_op->builder_.SendChangeTo(zaddr, ovk);
 
     // Build the transaction
+    m_op->start_phase("proving");
     auto maybe_tx = m_op->builder_.Build();
     if (!maybe_tx) {
         throw JSONRPCError(RPC_WALLET_ERROR, "Failed to build transaction.");
@@ -282,6 +290,7 @@ bool ShieldToAddress::operator()(const libzcash::SaplingPaymentAddress &zaddr) c
 
     // Send the transaction
     // TODO: Use CWallet::CommitTransaction instead of sendrawtransaction
+    m_op->start_phase("broadcast");
     auto signedtxn = EncodeHexTx(m_op->tx_);
     if (!m_op->testmode) {
         UniValue params = UniValue(UniValue::VARR);
@@ -319,6 +328,8 @@ bool ShieldToAddress::operator()(const libzcash::InvalidEncoding& no) const {
  */
 void AsyncRPCOperation_shieldcoinbase::sign_send_raw_transaction(UniValue obj)
 {
+    start_phase("broadcast");
+
     // Sign the raw transaction
     UniValue rawtxnValue = find_value(obj, "rawtxn");
     if (rawtxnValue.isNull()) {
@@ -381,6 +392,8 @@ void AsyncRPCOperation_shieldcoinbase::sign_send_raw_transaction(UniValue obj)
 
 
 UniValue AsyncRPCOperation_shieldcoinbase::perform_joinsplit(ShieldCoinbaseJSInfo & info) {
+    start_phase("proving");
+
     uint32_t consensusBranchId;
     uint256 anchor;
     {
@@ -556,10 +569,10 @@ UniValue AsyncRPCOperation_shieldcoinbase::getStatus() const {
  * Lock input utxos
  */
  void AsyncRPCOperation_shieldcoinbase::lock_utxos() {
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet_->cs_wallet);
     for (auto utxo : inputs_) {
         COutPoint outpt(utxo.txid, utxo.vout);
-        pwalletMain->LockCoin(outpt);
+        pwallet_->LockCoin(outpt);
     }
 }
 
@@ -567,9 +580,9 @@ UniValue AsyncRPCOperation_shieldcoinbase::getStatus() const {
  * Unlock input utxos
  */
 void AsyncRPCOperation_shieldcoinbase::unlock_utxos() {
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet_->cs_wallet);
     for (auto utxo : inputs_) {
         COutPoint outpt(utxo.txid, utxo.vout);
-        pwalletMain->UnlockCoin(outpt);
+        pwallet_->UnlockCoin(outpt);
     }
 }
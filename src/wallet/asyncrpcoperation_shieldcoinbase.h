@@ -66,12 +66,17 @@ public:
 
     bool paymentDisclosureMode = false; // Set to true to save esk for encrypted notes in payment disclosure database.
 
+    bool pauseMining = true; // Set to false when whoever runs main() stops mining around it, as AsyncRPCOperation_batch does
+
 private:
     friend class ShieldToAddress;
     friend class TEST_FRIEND_AsyncRPCOperation_shieldcoinbase;    // class for unit testing
 
     UniValue contextinfo_;     // optional data to include in return value from getStatus()
 
+    // The wallet of the RPC call that created the operation
+    CWallet* pwallet_;
+
     CAmount fee_;
     PaymentAddress tozaddr_;
 
@@ -0,0 +1,76 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/coinselection.h"
+
+#include <limits>
+
+bool SelectCoinsBnB(const std::vector<CAmount>& vValue, const CAmount& nTarget, const CAmount& nNoChangeRange,
+                    std::vector<char>& vfBest, CAmount& nBest)
+{
+    // vRemaining[i] is the total of vValue[i..]
+    std::vector<CAmount> vRemaining(vValue.size() + 1, 0);
+    for (size_t i = vValue.size(); i-- > 0; )
+        vRemaining[i] = vRemaining[i + 1] + vValue[i];
+    if (vRemaining[0] < nTarget)
+        return false;
+
+    std::vector<char> vfIncluded(vValue.size(), false);
+    std::vector<size_t> vIncluded;
+    CAmount nTotal = 0;
+    nBest = std::numeric_limits<CAmount>::max();
+    bool fFound = false;
+
+    // Index of the next value to decide on
+    size_t i = 0;
+    for (size_t nTries = 0; nTries < MAX_BNB_TRIES; nTries++)
+    {
+        bool fBacktrack = false;
+        if (nTotal + vRemaining[i] < nTarget) {
+            // Can't reach the target even with everything that is left
+            fBacktrack = true;
+        } else if (nTotal >= nTarget + nNoChangeRange || nTotal >= nBest) {
+            fBacktrack = true;
+        } else if (nTotal >= nTarget) {
+            nBest = nTotal;
+            vfBest = vfIncluded;
+            fFound = true;
+            if (nTotal == nTarget)
+                break;
+            fBacktrack = true;
+        }
+
+        if (!fBacktrack) {
+            // nTotal < nTarget <= nTotal + vRemaining[i], so i is in range
+            vfIncluded[i] = true;
+            vIncluded.push_back(i);
+            nTotal += vValue[i];
+            i++;
+            continue;
+        }
+
+        // Exclude the last value included, and the values equal to it
+        if (vIncluded.empty())
+            break;
+        size_t j = vIncluded.back();
+        vIncluded.pop_back();
+        vfIncluded[j] = false;
+        nTotal -= vValue[j];
+        for (i = j + 1; i < vValue.size() && vValue[i] == vValue[j]; i++) {}
+    }
+    return fFound;
+}
+
+CAmount SelectConsolidationInputs(const std::vector<CAmount>& vValue, std::vector<char>& vfSelected, unsigned int nMax)
+{
+    CAmount nAdded = 0;
+    for (size_t i = vValue.size(); i-- > 0 && nMax > 0; ) {
+        if (!vfSelected[i]) {
+            vfSelected[i] = true;
+            nAdded += vValue[i];
+            nMax--;
+        }
+    }
+    return nAdded;
+}
@@ -0,0 +1,43 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_COINSELECTION_H
+#define BITCOIN_WALLET_COINSELECTION_H
+
+#include "amount.h"
+
+#include <vector>
+
+/** Nodes of the search tree SelectCoinsBnB visits before settling for what it has */
+static const size_t MAX_BNB_TRIES = 100000;
+
+/**
+ * Branch and bound search for a subset of vValue whose total is at least
+ * nTarget and less than nTarget + nNoChangeRange, so that the transaction
+ * needs no change output. vValue must be sorted by descending value, which
+ * is what the inputs and notes to spend are sorted by elsewhere too.
+ *
+ * The search tries including each value before excluding it, and cuts a
+ * branch once what is left can't reach nTarget or the total went past the
+ * best found so far. Values equal to one just excluded are excluded along
+ * with it, so wallets full of identical outputs don't search the same sums
+ * over and over. Of the subsets it finds, the one closest to nTarget is
+ * returned in vfBest, marking the selected indexes of vValue, with its
+ * total in nBest.
+ *
+ * Works on values alone, so it serves transparent outputs and shielded
+ * notes alike.
+ */
+bool SelectCoinsBnB(const std::vector<CAmount>& vValue, const CAmount& nTarget, const CAmount& nNoChangeRange,
+                    std::vector<char>& vfBest, CAmount& nBest);
+
+/**
+ * Mark up to nMax of the unselected entries of vValue, which must be sorted
+ * by descending value, as selected, smallest first. Spending them in a
+ * transaction that has change anyway merges them into that change.
+ * Returns the value added.
+ */
+CAmount SelectConsolidationInputs(const std::vector<CAmount>& vValue, std::vector<char>& vfSelected, unsigned int nMax);
+
+#endif // BITCOIN_WALLET_COINSELECTION_H
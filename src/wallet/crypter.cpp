@@ -7,6 +7,7 @@
 #include "script/script.h"
 #include "script/standard.h"
 #include "streams.h"
+#include "support/cleanse.h"
 #include "util.h"
 
 #include <string>
@@ -196,6 +197,30 @@ bool CCryptoKeyStore::SetCrypted()
     return true;
 }
 
+/** Remember a decrypted key, making room by dropping another if needed */
+template<typename Map>
+static void CacheDecryptedKey(Map& cache, const typename Map::key_type& id, const typename Map::mapped_type& key)
+{
+    if (cache.size() >= MAX_DECRYPTED_KEY_CACHE_SIZE) {
+        memory_cleanse(&cache.begin()->second, sizeof(typename Map::mapped_type));
+        cache.erase(cache.begin());
+    }
+    cache.insert(std::make_pair(id, key));
+}
+
+void CCryptoKeyStore::ClearDecryptedKeys()
+{
+    // CKey clears itself; the shielded keys are plain values
+    LOCK2(cs_KeyStore, cs_SpendingKeyStore);
+    mapDecryptedKeys.clear();
+    for (auto& entry : mapDecryptedSproutSpendingKeys)
+        memory_cleanse(&entry.second, sizeof(entry.second));
+    mapDecryptedSproutSpendingKeys.clear();
+    for (auto& entry : mapDecryptedSaplingSpendingKeys)
+        memory_cleanse(&entry.second, sizeof(entry.second));
+    mapDecryptedSaplingSpendingKeys.clear();
+}
+
 bool CCryptoKeyStore::Lock()
 {
     if (!SetCrypted())
@@ -205,6 +230,7 @@ bool CCryptoKeyStore::Lock()
         LOCK(cs_KeyStore);
         vMasterKey.clear();
     }
+    ClearDecryptedKeys();
 
     NotifyStatusChanged(this);
     return true;
@@ -217,71 +243,32 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
         if (!SetCrypted())
             return false;
 
+        // Every record checks itself against public data (the seed against
+        // its fingerprint, keys against their public key or address), so a
+        // single one that decrypts proves the master key. The rest are only
+        // decrypted when they are used; see GetKey.
         bool keyPass = false;
-        bool keyFail = false;
         if (!cryptedHDSeed.first.IsNull()) {
             HDSeed seed;
-            if (!DecryptHDSeed(vMasterKeyIn, cryptedHDSeed.second, cryptedHDSeed.first, seed))
-            {
-                keyFail = true;
-            } else {
-                keyPass = true;
-            }
-        }
-        CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
-        for (; mi != mapCryptedKeys.end(); ++mi)
-        {
-            const CPubKey &vchPubKey = (*mi).second.first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
+            keyPass = DecryptHDSeed(vMasterKeyIn, cryptedHDSeed.second, cryptedHDSeed.first, seed);
+        } else if (!mapCryptedKeys.empty()) {
+            CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
             CKey key;
-            if (!DecryptKey(vMasterKeyIn, vchCryptedSecret, vchPubKey, key))
-            {
-                keyFail = true;
-                break;
-            }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
-        }
-        CryptedSproutSpendingKeyMap::const_iterator miSprout = mapCryptedSproutSpendingKeys.begin();
-        for (; miSprout != mapCryptedSproutSpendingKeys.end(); ++miSprout)
-        {
-            const libzcash::SproutPaymentAddress &address = (*miSprout).first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*miSprout).second;
+            keyPass = DecryptKey(vMasterKeyIn, mi->second.second, mi->second.first, key);
+        } else if (!mapCryptedSproutSpendingKeys.empty()) {
+            CryptedSproutSpendingKeyMap::const_iterator mi = mapCryptedSproutSpendingKeys.begin();
             libzcash::SproutSpendingKey sk;
-            if (!DecryptSproutSpendingKey(vMasterKeyIn, vchCryptedSecret, address, sk))
-            {
-                keyFail = true;
-                break;
-            }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
-        }
-        CryptedSaplingSpendingKeyMap::const_iterator miSapling = mapCryptedSaplingSpendingKeys.begin();
-        for (; miSapling != mapCryptedSaplingSpendingKeys.end(); ++miSapling)
-        {
-            const libzcash::SaplingExtendedFullViewingKey &extfvk = (*miSapling).first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*miSapling).second;
+            keyPass = DecryptSproutSpendingKey(vMasterKeyIn, mi->second, mi->first, sk);
+            memory_cleanse(&sk, sizeof(sk));
+        } else if (!mapCryptedSaplingSpendingKeys.empty()) {
+            CryptedSaplingSpendingKeyMap::const_iterator mi = mapCryptedSaplingSpendingKeys.begin();
             libzcash::SaplingExtendedSpendingKey sk;
-            if (!DecryptSaplingSpendingKey(vMasterKeyIn, vchCryptedSecret, extfvk, sk))
-            {
-                keyFail = true;
-                break;
-            }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
+            keyPass = DecryptSaplingSpendingKey(vMasterKeyIn, mi->second, mi->first, sk);
+            memory_cleanse(&sk, sizeof(sk));
         }
-        if (keyPass && keyFail)
-        {
-            LogPrintf("The wallet is probably corrupted: Some keys decrypt but not all.\n");
-            assert(false);
-        }
-        if (keyFail || !keyPass)
+        if (!keyPass)
             return false;
         vMasterKey = vMasterKeyIn;
-        fDecryptionThoroughlyChecked = true;
     }
     NotifyStatusChanged(this);
     return true;
@@ -395,12 +382,27 @@ bool CCryptoKeyStore::GetKey(const CKeyID &address, CKey& keyOut) const
         if (!IsCrypted())
             return CBasicKeyStore::GetKey(address, keyOut);
 
+        if (vMasterKey.empty())
+            return false;
+
+        KeyMap::const_iterator cached = mapDecryptedKeys.find(address);
+        if (cached != mapDecryptedKeys.end()) {
+            keyOut = cached->second;
+            return true;
+        }
+
         CryptedKeyMap::const_iterator mi = mapCryptedKeys.find(address);
         if (mi != mapCryptedKeys.end())
         {
             const CPubKey &vchPubKey = (*mi).second.first;
             const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
-            return DecryptKey(vMasterKey, vchCryptedSecret, vchPubKey, keyOut);
+            if (!DecryptKey(vMasterKey, vchCryptedSecret, vchPubKey, keyOut)) {
+                // Unlock proved the master key, so this record is damaged
+                LogPrintf("The wallet is probably corrupted: key %s does not decrypt.\n", address.ToString());
+                return false;
+            }
+            CacheDecryptedKey(mapDecryptedKeys, address, keyOut);
+            return true;
         }
     }
     return false;
@@ -521,11 +523,25 @@ bool CCryptoKeyStore::GetSproutSpendingKey(const libzcash::SproutPaymentAddress
         if (!IsCrypted())
             return CBasicKeyStore::GetSproutSpendingKey(address, skOut);
 
+        if (vMasterKey.empty())
+            return false;
+
+        SproutSpendingKeyMap::const_iterator cached = mapDecryptedSproutSpendingKeys.find(address);
+        if (cached != mapDecryptedSproutSpendingKeys.end()) {
+            skOut = cached->second;
+            return true;
+        }
+
         CryptedSproutSpendingKeyMap::const_iterator mi = mapCryptedSproutSpendingKeys.find(address);
         if (mi != mapCryptedSproutSpendingKeys.end())
         {
             const std::vector<unsigned char> &vchCryptedSecret = (*mi).second;
-            return DecryptSproutSpendingKey(vMasterKey, vchCryptedSecret, address, skOut);
+            if (!DecryptSproutSpendingKey(vMasterKey, vchCryptedSecret, address, skOut)) {
+                LogPrintf("The wallet is probably corrupted: a Sprout spending key does not decrypt.\n");
+                return false;
+            }
+            CacheDecryptedKey(mapDecryptedSproutSpendingKeys, address, skOut);
+            return true;
         }
     }
     return false;
@@ -538,10 +554,24 @@ bool CCryptoKeyStore::GetSaplingSpendingKey(const libzcash::SaplingFullViewingKe
         if (!IsCrypted())
             return CBasicKeyStore::GetSaplingSpendingKey(fvk, skOut);
 
-        for (auto entry : mapCryptedSaplingSpendingKeys) {
+        if (vMasterKey.empty())
+            return false;
+
+        SaplingSpendingKeyMap::const_iterator cached = mapDecryptedSaplingSpendingKeys.find(fvk);
+        if (cached != mapDecryptedSaplingSpendingKeys.end()) {
+            skOut = cached->second;
+            return true;
+        }
+
+        for (const auto& entry : mapCryptedSaplingSpendingKeys) {
             if (entry.first.fvk == fvk) {
                 const std::vector<unsigned char> &vchCryptedSecret = entry.second;
-                return DecryptSaplingSpendingKey(vMasterKey, vchCryptedSecret, entry.first, skOut);
+                if (!DecryptSaplingSpendingKey(vMasterKey, vchCryptedSecret, entry.first, skOut)) {
+                    LogPrintf("The wallet is probably corrupted: a Sapling spending key does not decrypt.\n");
+                    return false;
+                }
+                CacheDecryptedKey(mapDecryptedSaplingSpendingKeys, fvk, skOut);
+                return true;
             }
         }
     }
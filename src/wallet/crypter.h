@@ -16,6 +16,8 @@ class uint256;
 
 const unsigned int WALLET_CRYPTO_KEY_SIZE = 32;
 const unsigned int WALLET_CRYPTO_SALT_SIZE = 8;
+//! Decrypted keys of each kind kept while the wallet is unlocked
+const unsigned int MAX_DECRYPTED_KEY_CACHE_SIZE = 1000;
 
 /**
  * Private key encryption is done based on a CMasterKey,
@@ -139,8 +141,14 @@ private:
     //! if fUseCrypto is false, vMasterKey must be empty
     bool fUseCrypto;
 
-    //! keeps track of whether Unlock has run a thorough check before
-    bool fDecryptionThoroughlyChecked;
+    //! Keys decrypted since the last Unlock, so that GetKey and friends
+    //! don't run AES again for keys in use. Bounded by
+    //! MAX_DECRYPTED_KEY_CACHE_SIZE each and wiped by Lock.
+    mutable KeyMap mapDecryptedKeys;
+    mutable SproutSpendingKeyMap mapDecryptedSproutSpendingKeys;
+    mutable SaplingSpendingKeyMap mapDecryptedSaplingSpendingKeys;
+
+    void ClearDecryptedKeys();
 
 protected:
     bool SetCrypted();
@@ -151,8 +159,13 @@ protected:
     bool Unlock(const CKeyingMaterial& vMasterKeyIn);
 
 public:
-    CCryptoKeyStore() : fUseCrypto(false), fDecryptionThoroughlyChecked(false)
+    CCryptoKeyStore() : fUseCrypto(false)
+    {
+    }
+
+    ~CCryptoKeyStore()
     {
+        ClearDecryptedKeys();
     }
 
     bool IsCrypted() const
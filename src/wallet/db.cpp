@@ -11,6 +11,7 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <errno.h>
 #include <stdint.h>
 
 #ifndef WIN32
@@ -61,6 +62,9 @@ CDBEnv::CDBEnv() : dbenv(NULL)
 
 CDBEnv::~CDBEnv()
 {
+    for (std::map<std::string, CLogDB*>::iterator it = mapLogDb.begin(); it != mapLogDb.end(); ++it)
+        delete it->second;
+    mapLogDb.clear();
     EnvShutdown();
     delete dbenv;
     dbenv = NULL;
@@ -215,6 +219,41 @@ bool CDBEnv::Salvage(const std::string& strFile, bool fAggressive, std::vector<C
 }
 
 
+bool CDBEnv::IsLogDb(const std::string& strFile, bool fCreate)
+{
+    LOCK(cs_db);
+    if (mapLogDb.count(strFile))
+        return true;
+    if (fMockDb || mapDb[strFile] != NULL)
+        return false;
+    boost::filesystem::path path = GetDataDir() / strFile;
+    if (boost::filesystem::exists(path))
+        return CLogDB::IsLogFile(path);
+    return fCreate && GetArg("-walletformat", DEFAULT_WALLET_FORMAT) == "log";
+}
+
+CLogDB* CDBEnv::OpenLogDb(const std::string& strFile, bool fSalvage, std::string& strError)
+{
+    LOCK(cs_db);
+    std::map<std::string, CLogDB*>::iterator it = mapLogDb.find(strFile);
+    if (it != mapLogDb.end())
+        return it->second;
+    CLogDB* plog = new CLogDB(GetDataDir() / strFile);
+    if (!plog->Open(fSalvage, strError)) {
+        delete plog;
+        return NULL;
+    }
+    mapLogDb[strFile] = plog;
+    return plog;
+}
+
+CLogDB* CDBEnv::GetLogDb(const std::string& strFile)
+{
+    LOCK(cs_db);
+    std::map<std::string, CLogDB*>::iterator it = mapLogDb.find(strFile);
+    return it == mapLogDb.end() ? NULL : it->second;
+}
+
 void CDBEnv::CheckpointLSN(const std::string& strFile)
 {
     dbenv->txn_checkpoint(0, 0, 0);
@@ -224,7 +263,76 @@ void CDBEnv::CheckpointLSN(const std::string& strFile)
 }
 
 
-CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), activeTxn(NULL)
+void CDBCursor::close()
+{
+    if (pdbc)
+        pdbc->close();
+    delete this;
+}
+
+int CDBCursor::Read(CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags)
+{
+    if (plog) {
+        CLogDB::Bytes key, value;
+        bool fFound;
+        if (fFlags == DB_SET_RANGE) {
+            fFound = plog->Seek(CLogDB::Bytes(ssKey.begin(), ssKey.end()), true, key, value);
+        } else if (fFlags == DB_NEXT) {
+            fFound = plog->Seek(keyLast, !fStarted, key, value);
+        } else {
+            return EINVAL;
+        }
+        fStarted = true;
+        if (!fFound)
+            return DB_NOTFOUND;
+        keyLast = key;
+
+        ssKey.SetType(SER_DISK);
+        ssKey.clear();
+        ssKey.write((const char*)key.data(), key.size());
+        ssValue.SetType(SER_DISK);
+        ssValue.clear();
+        ssValue.write((const char*)value.data(), value.size());
+        return 0;
+    }
+
+    // Read at cursor
+    Dbt datKey;
+    if (fFlags == DB_SET || fFlags == DB_SET_RANGE || fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE) {
+        datKey.set_data(&ssKey[0]);
+        datKey.set_size(ssKey.size());
+    }
+    Dbt datValue;
+    if (fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE) {
+        datValue.set_data(&ssValue[0]);
+        datValue.set_size(ssValue.size());
+    }
+    datKey.set_flags(DB_DBT_MALLOC);
+    datValue.set_flags(DB_DBT_MALLOC);
+    int ret = pdbc->get(&datKey, &datValue, fFlags);
+    if (ret != 0)
+        return ret;
+    else if (datKey.get_data() == NULL || datValue.get_data() == NULL)
+        return 99999;
+
+    // Convert to streams
+    ssKey.SetType(SER_DISK);
+    ssKey.clear();
+    ssKey.write((char*)datKey.get_data(), datKey.get_size());
+    ssValue.SetType(SER_DISK);
+    ssValue.clear();
+    ssValue.write((char*)datValue.get_data(), datValue.get_size());
+
+    // Clear and free memory
+    memset(datKey.get_data(), 0, datKey.get_size());
+    memset(datValue.get_data(), 0, datValue.get_size());
+    free(datKey.get_data());
+    free(datValue.get_data());
+    return 0;
+}
+
+
+CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), plog(NULL), activeTxn(NULL), fLogTxn(false)
 {
     int ret;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
@@ -237,6 +345,23 @@ CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnClose
     if (fCreate)
         nFlags |= DB_CREATE;
 
+    if (bitdb.IsLogDb(strFilename, fCreate)) {
+        LOCK(bitdb.cs_db);
+        std::string strError;
+        plog = bitdb.OpenLogDb(strFilename, false, strError);
+        if (!plog)
+            throw runtime_error(strprintf("CDB: Can't open database %s: %s", strFilename, strError));
+        strFile = strFilename;
+        ++bitdb.mapFileUseCount[strFile];
+        if (fCreate && !Exists(string("version"))) {
+            bool fTmp = fReadOnly;
+            fReadOnly = false;
+            WriteVersion(CLIENT_VERSION);
+            fReadOnly = fTmp;
+        }
+        return;
+    }
+
     {
         LOCK(bitdb.cs_db);
         if (!bitdb.Open(GetDataDir()))
@@ -283,8 +408,35 @@ CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnClose
     }
 }
 
+bool CDB::WriteLog(const CLogDB::Bytes& key, const CLogDB::Bytes* pvalue)
+{
+    if (fLogTxn) {
+        if (pvalue)
+            batchTxn.Put(key, *pvalue);
+        else
+            batchTxn.Erase(key);
+        return true;
+    }
+    CLogDB::Batch batch;
+    if (pvalue)
+        batch.Put(key, *pvalue);
+    else
+        batch.Erase(key);
+    return plog->Write(batch, false);
+}
+
+bool CDB::ExistsLog(const CLogDB::Bytes& key)
+{
+    int nFound = fLogTxn ? batchTxn.Find(key, NULL) : 0;
+    return nFound > 0 || (nFound == 0 && plog->Exists(key));
+}
+
 void CDB::Flush()
 {
+    // Each batch reaches the operating system as it is appended to a log,
+    // and the flush thread syncs it to the disk
+    if (plog)
+        return;
     if (activeTxn)
         return;
 
@@ -298,6 +450,14 @@ void CDB::Flush()
 
 void CDB::Close()
 {
+    if (plog) {
+        fLogTxn = false;
+        batchTxn.Clear();
+        plog = NULL;
+        LOCK(bitdb.cs_db);
+        --bitdb.mapFileUseCount[strFile];
+        return;
+    }
     if (!pdb)
         return;
     if (activeTxn)
@@ -339,6 +499,15 @@ bool CDBEnv::RemoveDb(const string& strFile)
 
 bool CDB::Rewrite(const string& strFile, const char* pszSkip)
 {
+    if (bitdb.IsLogDb(strFile)) {
+        // A log can be compacted while it is in use
+        CDB db(strFile.c_str(), "r+");
+        if (!db.plog || !db.WriteVersion(CLIENT_VERSION))
+            return false;
+        LogPrintf("CDB::Rewrite: Compacting %s...\n", strFile);
+        return db.plog->Compact(pszSkip ? pszSkip : "");
+    }
+
     while (true) {
         {
             LOCK(bitdb.cs_db);
@@ -366,7 +535,7 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                         fSuccess = false;
                     }
 
-                    Dbc* pcursor = db.GetCursor();
+                    CDBCursor* pcursor = db.GetCursor();
                     if (pcursor)
                         while (fSuccess) {
                             CDataStream ssKey(SER_DISK, CLIENT_VERSION);
@@ -421,9 +590,90 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
 }
 
 
+bool CDB::MigrateToLog(const string& strFile)
+{
+    boost::filesystem::path path = GetDataDir() / strFile;
+    boost::filesystem::path pathLog = path.string() + ".migrate";
+    boost::filesystem::path pathBak = path.string() + strprintf(".%d.bak", GetTime());
+    LogPrintf("CDB::MigrateToLog: Migrating %s to the log format...\n", strFile);
+
+    // Read every record, as Rewrite does
+    CLogDB::Batch batch;
+    size_t nRecords = 0;
+    {
+        CDB db(strFile.c_str(), "r");
+        CDBCursor* pcursor = db.GetCursor();
+        if (!pcursor)
+            return error("CDB::MigrateToLog: Can't read %s", strFile);
+        while (true) {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            int ret = db.ReadAtCursor(pcursor, ssKey, ssValue, DB_NEXT);
+            if (ret == DB_NOTFOUND)
+                break;
+            if (ret != 0) {
+                pcursor->close();
+                return error("CDB::MigrateToLog: Error %d reading %s", ret, strFile);
+            }
+            batch.Put(CLogDB::Bytes(ssKey.begin(), ssKey.end()), CLogDB::Bytes(ssValue.begin(), ssValue.end()));
+            nRecords++;
+        }
+        pcursor->close();
+    }
+
+    // Write them as a single batch, so a log that is cut short is no log
+    {
+        boost::filesystem::remove(pathLog);
+        CLogDB log(pathLog);
+        std::string strError;
+        if (!log.Open(false, strError) || !log.Write(batch, true)) {
+            log.Close();
+            boost::filesystem::remove(pathLog);
+            return error("CDB::MigrateToLog: Can't write %s: %s", pathLog.string(), strError);
+        }
+        log.Close();
+    }
+
+    {
+        LOCK(bitdb.cs_db);
+        bitdb.CloseDb(strFile);
+        bitdb.CheckpointLSN(strFile);
+        bitdb.mapFileUseCount.erase(strFile);
+        bitdb.mapDb.erase(strFile);
+    }
+    try {
+        boost::filesystem::rename(path, pathBak);
+    } catch (const boost::filesystem::filesystem_error& e) {
+        boost::filesystem::remove(pathLog);
+        return error("CDB::MigrateToLog: Can't move %s out of the way: %s", strFile, e.what());
+    }
+    if (!RenameOver(pathLog, path))
+        return error("CDB::MigrateToLog: Can't move %s to %s, restore it from %s", pathLog.string(), strFile, pathBak.string());
+    LogPrintf("CDB::MigrateToLog: Migrated %u records, the Berkeley DB file is kept as %s\n", nRecords, pathBak.string());
+    return true;
+}
+
+
 void CDBEnv::Flush(bool fShutdown)
 {
     int64_t nStart = GetTimeMillis();
+    {
+        // Logs need no environment: sync them, and close those not in use
+        // when shutting down
+        LOCK(cs_db);
+        std::map<std::string, CLogDB*>::iterator it = mapLogDb.begin();
+        while (it != mapLogDb.end()) {
+            it->second->Sync();
+            if (fShutdown && mapFileUseCount[it->first] == 0) {
+                LogPrint("db", "CDBEnv::Flush: %s closed\n", it->first);
+                delete it->second;
+                mapFileUseCount.erase(it->first);
+                mapLogDb.erase(it++);
+            } else {
+                it++;
+            }
+        }
+    }
     // Flush log data to the actual data file on all files that are not in use
     LogPrint("db", "CDBEnv::Flush: Flush(%s)%s\n", fShutdown ? "true" : "false", fDbEnvInit ? "" : " database not started");
     if (!fDbEnvInit)
@@ -434,6 +684,10 @@ void CDBEnv::Flush(bool fShutdown)
         while (mi != mapFileUseCount.end()) {
             string strFile = (*mi).first;
             int nRefCount = (*mi).second;
+            if (mapLogDb.count(strFile)) {
+                mi++;
+                continue;
+            }
             LogPrint("db", "CDBEnv::Flush: Flushing %s (refcount = %d)...\n", strFile, nRefCount);
             if (nRefCount == 0) {
                 // Move log data to the dat file
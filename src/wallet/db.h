@@ -11,6 +11,7 @@
 #include "streams.h"
 #include "sync.h"
 #include "version.h"
+#include "wallet/logdb.h"
 
 #include <map>
 #include <string>
@@ -38,6 +39,8 @@ public:
     DbEnv *dbenv;
     std::map<std::string, int> mapFileUseCount;
     std::map<std::string, Db*> mapDb;
+    //! Files in the log format, which don't use the environment
+    std::map<std::string, CLogDB*> mapLogDb;
 
     CDBEnv();
     ~CDBEnv();
@@ -74,6 +77,17 @@ public:
     void CloseDb(const std::string& strFile);
     bool RemoveDb(const std::string& strFile);
 
+    /**
+     * Whether strFile is, or with fCreate will be created, in the log format:
+     * it is if the file is, and a file that doesn't exist yet is created in
+     * the format -walletformat names. Mock environments only use Berkeley DB.
+     */
+    bool IsLogDb(const std::string& strFile, bool fCreate = false);
+    //! The open log strFile, opening and replaying it if it isn't yet
+    CLogDB* OpenLogDb(const std::string& strFile, bool fSalvage, std::string& strError);
+    //! The log strFile if it is open, NULL otherwise
+    CLogDB* GetLogDb(const std::string& strFile);
+
     DbTxn* TxnBegin(int flags = DB_TXN_WRITE_NOSYNC)
     {
         DbTxn* ptxn = NULL;
@@ -87,13 +101,49 @@ public:
 extern CDBEnv bitdb;
 
 
-/** RAII class that provides access to a Berkeley database */
+/** Cursor over the records of a CDB in key order, whatever its format */
+class CDBCursor
+{
+public:
+    explicit CDBCursor(Dbc* pdbcIn) : pdbc(pdbcIn), plog(NULL), fStarted(false) {}
+    explicit CDBCursor(CLogDB* plogIn) : pdbc(NULL), plog(plogIn), fStarted(false) {}
+
+    //! Release the cursor and free it, as Dbc::close() does
+    void close();
+
+    /**
+     * Read the record after the last one read with DB_NEXT, or the first
+     * one at or after ssKey with DB_SET_RANGE. Returns 0 on success and
+     * DB_NOTFOUND after the last record.
+     */
+    int Read(CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags);
+
+private:
+    Dbc* pdbc;
+    CLogDB* plog;
+    //! Key of the last record read from plog
+    CLogDB::Bytes keyLast;
+    bool fStarted;
+
+    ~CDBCursor() {}
+};
+
+
+/**
+ * RAII class that provides access to a Berkeley database, or to a file in the
+ * log format (see CLogDB), whichever strFile is. In a log, the records of a
+ * transaction are kept in batchTxn until it is committed as a single batch,
+ * and are seen by the reads of the same CDB but not by its cursors.
+ */
 class CDB
 {
 protected:
     Db* pdb;
+    CLogDB* plog;
     std::string strFile;
     DbTxn* activeTxn;
+    bool fLogTxn;
+    CLogDB::Batch batchTxn;
     bool fReadOnly;
     bool fFlushOnClose;
 
@@ -112,6 +162,21 @@ protected:
     template <typename K, typename T>
     bool Read(const K& key, T& value)
     {
+        if (plog) {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            ssKey << key;
+            CLogDB::Bytes vchKey(ssKey.begin(), ssKey.end()), vchValue;
+            int nFound = fLogTxn ? batchTxn.Find(vchKey, &vchValue) : 0;
+            if (nFound < 0 || (nFound == 0 && !plog->Read(vchKey, vchValue)))
+                return false;
+            try {
+                CDataStream ssValue((const char*)vchValue.data(), (const char*)vchValue.data() + vchValue.size(), SER_DISK, CLIENT_VERSION);
+                ssValue >> value;
+            } catch (const std::exception&) {
+                return false;
+            }
+            return true;
+        }
         if (!pdb)
             return false;
 
@@ -146,6 +211,18 @@ protected:
     template <typename K, typename T>
     bool Write(const K& key, const T& value, bool fOverwrite = true)
     {
+        if (plog) {
+            if (fReadOnly)
+                assert(!"Write called on database in read-only mode");
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            ssKey << key;
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            ssValue << value;
+            CLogDB::Bytes vchKey(ssKey.begin(), ssKey.end()), vchValue(ssValue.begin(), ssValue.end());
+            if (!fOverwrite && ExistsLog(vchKey))
+                return false;
+            return WriteLog(vchKey, &vchValue);
+        }
         if (!pdb)
             return false;
         if (fReadOnly)
@@ -175,6 +252,13 @@ protected:
     template <typename K>
     bool Erase(const K& key)
     {
+        if (plog) {
+            if (fReadOnly)
+                assert(!"Erase called on database in read-only mode");
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            ssKey << key;
+            return WriteLog(CLogDB::Bytes(ssKey.begin(), ssKey.end()), NULL);
+        }
         if (!pdb)
             return false;
         if (fReadOnly)
@@ -197,6 +281,11 @@ protected:
     template <typename K>
     bool Exists(const K& key)
     {
+        if (plog) {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            ssKey << key;
+            return ExistsLog(CLogDB::Bytes(ssKey.begin(), ssKey.end()));
+        }
         if (!pdb)
             return false;
 
@@ -214,57 +303,39 @@ protected:
         return (ret == 0);
     }
 
-    Dbc* GetCursor()
+    CDBCursor* GetCursor()
     {
+        if (plog)
+            return new CDBCursor(plog);
         if (!pdb)
             return NULL;
         Dbc* pcursor = NULL;
         int ret = pdb->cursor(NULL, &pcursor, 0);
         if (ret != 0)
             return NULL;
-        return pcursor;
+        return new CDBCursor(pcursor);
     }
 
-    int ReadAtCursor(Dbc* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags = DB_NEXT)
+    int ReadAtCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags = DB_NEXT)
     {
-        // Read at cursor
-        Dbt datKey;
-        if (fFlags == DB_SET || fFlags == DB_SET_RANGE || fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE) {
-            datKey.set_data(&ssKey[0]);
-            datKey.set_size(ssKey.size());
-        }
-        Dbt datValue;
-        if (fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE) {
-            datValue.set_data(&ssValue[0]);
-            datValue.set_size(ssValue.size());
-        }
-        datKey.set_flags(DB_DBT_MALLOC);
-        datValue.set_flags(DB_DBT_MALLOC);
-        int ret = pcursor->get(&datKey, &datValue, fFlags);
-        if (ret != 0)
-            return ret;
-        else if (datKey.get_data() == NULL || datValue.get_data() == NULL)
-            return 99999;
-
-        // Convert to streams
-        ssKey.SetType(SER_DISK);
-        ssKey.clear();
-        ssKey.write((char*)datKey.get_data(), datKey.get_size());
-        ssValue.SetType(SER_DISK);
-        ssValue.clear();
-        ssValue.write((char*)datValue.get_data(), datValue.get_size());
-
-        // Clear and free memory
-        memset(datKey.get_data(), 0, datKey.get_size());
-        memset(datValue.get_data(), 0, datValue.get_size());
-        free(datKey.get_data());
-        free(datValue.get_data());
-        return 0;
+        return pcursor->Read(ssKey, ssValue, fFlags);
     }
 
+private:
+    //! Put, or erase if pvalue is NULL, key in batchTxn or straight in the log
+    bool WriteLog(const CLogDB::Bytes& key, const CLogDB::Bytes* pvalue);
+    bool ExistsLog(const CLogDB::Bytes& key);
+
 public:
     bool TxnBegin()
     {
+        if (plog) {
+            if (fLogTxn)
+                return false;
+            batchTxn.Clear();
+            fLogTxn = true;
+            return true;
+        }
         if (!pdb || activeTxn)
             return false;
         DbTxn* ptxn = bitdb.TxnBegin();
@@ -276,6 +347,14 @@ public:
 
     bool TxnCommit()
     {
+        if (plog) {
+            if (!fLogTxn)
+                return false;
+            fLogTxn = false;
+            bool fSuccess = plog->Write(batchTxn, true);
+            batchTxn.Clear();
+            return fSuccess;
+        }
         if (!pdb || !activeTxn)
             return false;
         int ret = activeTxn->commit(0);
@@ -285,6 +364,13 @@ public:
 
     bool TxnAbort()
     {
+        if (plog) {
+            if (!fLogTxn)
+                return false;
+            fLogTxn = false;
+            batchTxn.Clear();
+            return true;
+        }
         if (!pdb || !activeTxn)
             return false;
         int ret = activeTxn->abort();
@@ -304,6 +390,11 @@ public:
     }
 
     bool static Rewrite(const std::string& strFile, const char* pszSkip = NULL);
+    /**
+     * Copy every record of the Berkeley DB strFile into a log, which then
+     * takes its place. The original is kept as <file>.<time>.bak.
+     */
+    bool static MigrateToLog(const std::string& strFile);
 };
 
 #endif // BITCOIN_WALLET_DB_H
@@ -115,7 +115,7 @@ std::pair<JSOutPoint, SaplingOutPoint> CreateValidBlock(TestWallet& wallet,
     auto saplingNotes = SetSaplingNoteData(wtx);
     wallet.AddToWallet(wtx, true, NULL);
 
-    block.vtx.push_back(wtx);
+    block.vtx.push_back(MakeTransactionRef(wtx));
     wallet.IncrementNoteWitnesses(&index, &block, sproutTree, saplingTree);
 
     return std::make_pair(jsoutpt, saplingNotes[0]);
@@ -200,7 +200,7 @@ TEST(WalletTests, FindUnspentSproutNotes) {
     // Fake-mine the transaction
     EXPECT_EQ(-1, chainActive.Height());
     CBlock block;
-    block.vtx.push_back(wtx);
+    block.vtx.push_back(MakeTransactionRef(wtx));
     block.hashMerkleRoot = block.BuildMerkleTree();
     auto blockHash = block.GetHash();
     CBlockIndex fakeIndex {block};
@@ -237,7 +237,7 @@ TEST(WalletTests, FindUnspentSproutNotes) {
     // Fake-mine a spend transaction
     EXPECT_EQ(0, chainActive.Height());
     CBlock block2;
-    block2.vtx.push_back(wtx2);
+    block2.vtx.push_back(MakeTransactionRef(wtx2));
     block2.hashMerkleRoot = block2.BuildMerkleTree();
     block2.hashPrevBlock = blockHash;
     auto blockHash2 = block2.GetHash();
@@ -296,7 +296,7 @@ TEST(WalletTests, FindUnspentSproutNotes) {
     // Fake-mine the new transaction
     EXPECT_EQ(1, chainActive.Height());
     CBlock block3;
-    block3.vtx.push_back(wtx3);
+    block3.vtx.push_back(MakeTransactionRef(wtx3));
     block3.hashMerkleRoot = block3.BuildMerkleTree();
     block3.hashPrevBlock = blockHash2;
     auto blockHash3 = block3.GetHash();
@@ -654,7 +654,7 @@ TEST(WalletTests, GetConflictedSaplingNotes) {
     EXPECT_EQ(-1, chainActive.Height());
     SproutMerkleTree sproutTree;
     CBlock block;
-    block.vtx.push_back(wtx);
+    block.vtx.push_back(MakeTransactionRef(wtx));
     block.hashMerkleRoot = block.BuildMerkleTree();
     auto blockHash = block.GetHash();
     CBlockIndex fakeIndex {block};
@@ -764,7 +764,7 @@ TEST(WalletTests, SproutNullifierIsSpent) {
     // Fake-mine the transaction
     EXPECT_EQ(-1, chainActive.Height());
     CBlock block;
-    block.vtx.push_back(wtx2);
+    block.vtx.push_back(MakeTransactionRef(wtx2));
     block.hashMerkleRoot = block.BuildMerkleTree();
     auto blockHash = block.GetHash();
     CBlockIndex fakeIndex {block};
@@ -829,7 +829,7 @@ TEST(WalletTests, SaplingNullifierIsSpent) {
     // Fake-mine the transaction
     EXPECT_EQ(-1, chainActive.Height());
     CBlock block;
-    block.vtx.push_back(wtx);
+    block.vtx.push_back(MakeTransactionRef(wtx));
     block.hashMerkleRoot = block.BuildMerkleTree();
     auto blockHash = block.GetHash();
     CBlockIndex fakeIndex {block};
@@ -927,7 +927,7 @@ TEST(WalletTests, NavigateFromSaplingNullifierToNote) {
     EXPECT_EQ(-1, chainActive.Height());
     SproutMerkleTree sproutTree;
     CBlock block;
-    block.vtx.push_back(wtx);
+    block.vtx.push_back(MakeTransactionRef(wtx));
     block.hashMerkleRoot = block.BuildMerkleTree();
     auto blockHash = block.GetHash();
     CBlockIndex fakeIndex {block};
@@ -1055,7 +1055,7 @@ TEST(WalletTests, SpentSaplingNoteIsFromMe) {
     EXPECT_EQ(-1, chainActive.Height());
     SproutMerkleTree sproutTree;
     CBlock block;
-    block.vtx.push_back(wtx);
+    block.vtx.push_back(MakeTransactionRef(wtx));
     block.hashMerkleRoot = block.BuildMerkleTree();
     auto blockHash = block.GetHash();
     CBlockIndex fakeIndex {block};
@@ -1130,7 +1130,7 @@ TEST(WalletTests, SpentSaplingNoteIsFromMe) {
     // Fake-mine this tx into the next block
     EXPECT_EQ(0, chainActive.Height());
     CBlock block2;
-    block2.vtx.push_back(wtx2);
+    block2.vtx.push_back(MakeTransactionRef(wtx2));
     block2.hashMerkleRoot = block2.BuildMerkleTree();
     block2.hashPrevBlock = blockHash;
     auto blockHash2 = block2.GetHash();
@@ -1206,7 +1206,7 @@ TEST(WalletTests, CachedWitnessesEmptyChain) {
     EXPECT_FALSE((bool) saplingWitnesses[0]);
 
     CBlock block;
-    block.vtx.push_back(wtx);
+    block.vtx.push_back(MakeTransactionRef(wtx));
     CBlockIndex index(block);
     SproutMerkleTree sproutTree;
     SaplingMerkleTree saplingTree;
@@ -1223,6 +1223,36 @@ TEST(WalletTests, CachedWitnessesEmptyChain) {
                  ".*nWitnessCacheSize > 0.*");
 }
 
+TEST(WalletTests, CachedWitnessesOnlyVisitNoteTxs) {
+    TestWallet wallet;
+    CBlock block1;
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    // A transaction without notes of ours is never visited
+    auto wtxOther = GetValidReceive(sk, 10, true, 4);
+    wallet.AddToWallet(wtxOther, true, NULL);
+    EXPECT_EQ(0, wallet.setNoteTxs.size());
+
+    CBlockIndex index1(block1);
+    index1.nHeight = 1;
+    auto outpts = CreateValidBlock(wallet, sk, index1, block1, sproutTree, saplingTree);
+    EXPECT_EQ(1, wallet.setNoteTxs.count(outpts.first.hash));
+    EXPECT_EQ(1, wallet.setNoteTxs.size());
+    EXPECT_EQ(1, wallet.mapWallet[outpts.first.hash].mapSproutNoteData[outpts.first].witnessHeight);
+
+    // Entries of transactions no longer in the wallet are dropped
+    wallet.mapWallet.erase(outpts.first.hash);
+    CBlock block2;
+    CBlockIndex index2(block2);
+    index2.nHeight = 2;
+    wallet.IncrementNoteWitnesses(&index2, &block2, sproutTree, saplingTree);
+    EXPECT_EQ(0, wallet.setNoteTxs.size());
+}
+
 TEST(WalletTests, CachedWitnessesChainTip) {
     TestWallet wallet;
     std::pair<uint256, uint256> anchors1;
@@ -1275,7 +1305,7 @@ TEST(WalletTests, CachedWitnessesChainTip) {
         // Second block
         CBlock block2;
         block2.hashPrevBlock = block1.GetHash();
-        block2.vtx.push_back(wtx);
+        block2.vtx.push_back(MakeTransactionRef(wtx));
         CBlockIndex index2(block2);
         index2.nHeight = 2;
         SproutMerkleTree sproutTree2 {sproutTree};
@@ -1662,6 +1692,40 @@ TEST(WalletTests, UpdateSproutNullifierNoteMap) {
     EXPECT_EQ(1, wallet.mapSproutNullifiersToNotes[nullifier].n);
 }
 
+TEST(WalletTests, UpdateSproutNullifierNoteMapInBackground) {
+    TestWallet wallet;
+    uint256 r {GetRandHash()};
+    CKeyingMaterial vMasterKey (r.begin(), r.end());
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    ASSERT_TRUE(wallet.EncryptKeys(vMasterKey));
+
+    // More notes than fit in one batch, found while the wallet was locked
+    std::vector<uint256> nullifiers;
+    for (size_t i = 0; i < NULLIFIER_BATCH_SIZE / 2 + 1; i++) {
+        auto wtx = GetValidReceive(sk, 10, true);
+        mapSproutNoteData_t noteData;
+        for (uint8_t n = 0; n < 2; n++) {
+            nullifiers.push_back(GetNote(sk, wtx, 0, n).nullifier(sk));
+            noteData[JSOutPoint(wtx.GetHash(), 0, n)] = SproutNoteData(sk.address());
+        }
+        wtx.SetSproutNoteData(noteData);
+        wallet.AddToWallet(wtx, true, NULL);
+    }
+
+    ASSERT_TRUE(wallet.Unlock(vMasterKey));
+    wallet.UpdateNullifierNoteMapInBackground();
+
+    for (int i = 0; i < 600 && wallet.GetPendingNullifiers() > 0; i++)
+        MilliSleep(100);
+    EXPECT_EQ(0, wallet.GetPendingNullifiers());
+    LOCK(wallet.cs_wallet);
+    for (const uint256& nullifier : nullifiers)
+        EXPECT_EQ(1, wallet.mapSproutNullifiersToNotes.count(nullifier));
+}
+
 TEST(WalletTests, UpdatedSproutNoteData) {
     TestWallet wallet;
 
@@ -1759,7 +1823,7 @@ TEST(WalletTests, UpdatedSaplingNoteData) {
     EXPECT_EQ(-1, chainActive.Height());
     SproutMerkleTree sproutTree;
     CBlock block;
-    block.vtx.push_back(wtx);
+    block.vtx.push_back(MakeTransactionRef(wtx));
     block.hashMerkleRoot = block.BuildMerkleTree();
     auto blockHash = block.GetHash();
     CBlockIndex fakeIndex {block};
@@ -1913,7 +1977,7 @@ TEST(WalletTests, MarkAffectedSaplingTransactionsDirty) {
     SaplingMerkleTree saplingTree;
     SproutMerkleTree sproutTree;
     CBlock block;
-    block.vtx.push_back(wtx);
+    block.vtx.push_back(MakeTransactionRef(wtx));
     block.hashMerkleRoot = block.BuildMerkleTree();
     auto blockHash = block.GetHash();
     CBlockIndex fakeIndex {block};
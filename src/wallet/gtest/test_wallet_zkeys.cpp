@@ -208,6 +208,49 @@ TEST(wallet_zkeys_tests, StoreAndLoadViewingKeys) {
     ASSERT_TRUE(wallet.HaveSproutViewingKey(addr2));
 }
 
+/**
+ * This test covers key birthdays
+ * UpdateTimeFirstKey()
+ * AddSproutViewingKey() with metadata
+ * CKeyMetadata serialization
+ */
+TEST(wallet_zkeys_tests, KeyBirthdays) {
+    SelectParams(CBaseChainParams::MAIN);
+
+    CWallet wallet;
+    ASSERT_EQ(0, wallet.nTimeFirstKey);
+
+    // The birthday is the earliest key creation time
+    wallet.UpdateTimeFirstKey(2000);
+    ASSERT_EQ(2000, wallet.nTimeFirstKey);
+    auto sk = libzcash::SproutSpendingKey::random();
+    CKeyMetadata meta(1000);
+    meta.nBirthHeight = 10;
+    ASSERT_TRUE(wallet.AddSproutViewingKey(sk.viewing_key(), meta));
+    ASSERT_EQ(1000, wallet.nTimeFirstKey);
+    wallet.UpdateTimeFirstKey(3000);
+    ASSERT_EQ(1000, wallet.nTimeFirstKey);
+
+    // A key of unknown age moves it to the beginning of time
+    ASSERT_TRUE(wallet.AddSproutViewingKey(libzcash::SproutSpendingKey::random().viewing_key()));
+    ASSERT_EQ(1, wallet.nTimeFirstKey);
+
+    // The birth height round-trips, and is unknown in older records
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << meta;
+    CKeyMetadata metaOut;
+    ss >> metaOut;
+    ASSERT_EQ(1000, metaOut.nCreateTime);
+    ASSERT_EQ(10, metaOut.nBirthHeight);
+
+    meta.nVersion = CKeyMetadata::VERSION_WITH_HDDATA;
+    ss << meta;
+    ss >> metaOut;
+    ASSERT_EQ(1000, metaOut.nCreateTime);
+    ASSERT_EQ(-1, metaOut.nBirthHeight);
+    ASSERT_TRUE(ss.empty());
+}
+
 /**
  * This test covers methods on CWalletDB
  * WriteZKey()
@@ -307,7 +350,7 @@ TEST(wallet_zkeys_tests, WriteViewingKeyDirectToDB) {
     int64_t now = GetTime();
     CKeyMetadata meta(now);
     CWalletDB db("wallet-vkey.dat");
-    db.WriteSproutViewingKey(vk);
+    db.WriteSproutViewingKey(vk, meta);
 
     // wallet should not be aware of viewing key
     ASSERT_FALSE(wallet.HaveSproutViewingKey(addr));
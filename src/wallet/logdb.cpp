@@ -0,0 +1,493 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/logdb.h"
+
+#include "clientversion.h"
+#include "crypto/common.h"
+#include "hash.h"
+#include "streams.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <limits>
+#include <string.h>
+
+#include <boost/filesystem.hpp>
+
+static const unsigned char LOGDB_MAGIC[8] = {'l', 't', 'z', 'l', 'o', 'g', 'd', 'b'};
+static const uint32_t LOGDB_VERSION = 1;
+//! Magic and version
+static const size_t LOGDB_HEADER_SIZE = 12;
+//! Payload size and checksum
+static const size_t LOGDB_BATCH_HEADER_SIZE = 8;
+
+enum {
+    LOGDB_PUT = 1,
+    LOGDB_ERASE = 2,
+};
+
+// Size of a record put, as stored in a batch
+static uint64_t RecordSize(const CLogDB::Bytes& key, const CLogDB::Bytes& value)
+{
+    return 1 + GetSizeOfCompactSize(key.size()) + key.size() + GetSizeOfCompactSize(value.size()) + value.size();
+}
+
+static uint32_t Checksum(const CSerializeData& payload)
+{
+    uint256 hash = Hash(payload.begin(), payload.end());
+    return ReadLE32(hash.begin());
+}
+
+void CLogDB::Batch::Put(const Bytes& key, const Bytes& value)
+{
+    Op op;
+    op.fErase = false;
+    op.key = key;
+    op.value = value;
+    vOps.push_back(op);
+    mapLast[key] = vOps.size() - 1;
+}
+
+void CLogDB::Batch::Erase(const Bytes& key)
+{
+    Op op;
+    op.fErase = true;
+    op.key = key;
+    vOps.push_back(op);
+    mapLast[key] = vOps.size() - 1;
+}
+
+void CLogDB::Batch::Clear()
+{
+    vOps.clear();
+    mapLast.clear();
+}
+
+int CLogDB::Batch::Find(const Bytes& key, Bytes* pvalue) const
+{
+    std::map<Bytes, size_t>::const_iterator it = mapLast.find(key);
+    if (it == mapLast.end())
+        return 0;
+    const Op& op = vOps[it->second];
+    if (op.fErase)
+        return -1;
+    if (pvalue)
+        *pvalue = op.value;
+    return 1;
+}
+
+CLogDB::CLogDB(const boost::filesystem::path& pathIn) : path(pathIn), file(NULL), nFileSize(0), nLiveSize(0), fDirty(false)
+{
+}
+
+CLogDB::~CLogDB()
+{
+    Close();
+}
+
+bool CLogDB::IsLogFile(const boost::filesystem::path& path)
+{
+    FILE* filein = fopen(path.string().c_str(), "rb");
+    if (!filein)
+        return false;
+    unsigned char magic[sizeof(LOGDB_MAGIC)];
+    bool fLog = fread(magic, 1, sizeof(magic), filein) == sizeof(magic) && memcmp(magic, LOGDB_MAGIC, sizeof(magic)) == 0;
+    fclose(filein);
+    return fLog;
+}
+
+bool CLogDB::WriteHeader(FILE* fileout)
+{
+    unsigned char header[LOGDB_HEADER_SIZE];
+    memcpy(header, LOGDB_MAGIC, sizeof(LOGDB_MAGIC));
+    WriteLE32(header + sizeof(LOGDB_MAGIC), LOGDB_VERSION);
+    return fwrite(header, 1, sizeof(header), fileout) == sizeof(header);
+}
+
+bool CLogDB::AppendBatch(FILE* fileout, const Batch& batch, uint64_t& nWritten)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    for (const Batch::Op& op : batch.vOps) {
+        ss << (unsigned char)(op.fErase ? LOGDB_ERASE : LOGDB_PUT) << op.key;
+        if (!op.fErase)
+            ss << op.value;
+    }
+    if (ss.size() > std::numeric_limits<uint32_t>::max())
+        return false;
+
+    CSerializeData payload;
+    ss.GetAndClear(payload);
+    unsigned char header[LOGDB_BATCH_HEADER_SIZE];
+    WriteLE32(header, payload.size());
+    WriteLE32(header + 4, Checksum(payload));
+    if (fwrite(header, 1, sizeof(header), fileout) != sizeof(header) ||
+        fwrite(&payload[0], 1, payload.size(), fileout) != payload.size() ||
+        fflush(fileout) != 0)
+        return false;
+    nWritten = sizeof(header) + payload.size();
+    return true;
+}
+
+void CLogDB::Apply(const Batch& batch)
+{
+    for (const Batch::Op& op : batch.vOps) {
+        Index::iterator it = mapIndex.find(op.key);
+        if (it != mapIndex.end()) {
+            nLiveSize -= RecordSize(it->first, it->second);
+            if (op.fErase)
+                mapIndex.erase(it);
+            else
+                it->second = op.value;
+        } else if (!op.fErase) {
+            it = mapIndex.insert(std::make_pair(op.key, op.value)).first;
+        }
+        if (!op.fErase)
+            nLiveSize += RecordSize(it->first, it->second);
+    }
+}
+
+// Whether the file holds nothing but zeros from nOffset on, as it can after a
+// crash while it was extended
+static bool IsZeroTail(FILE* filein, uint64_t nOffset)
+{
+    if (fseek(filein, nOffset, SEEK_SET) != 0)
+        return false;
+    unsigned char buf[4096];
+    size_t nRead;
+    while ((nRead = fread(buf, 1, sizeof(buf), filein)) > 0) {
+        for (size_t i = 0; i < nRead; i++) {
+            if (buf[i] != 0)
+                return false;
+        }
+    }
+    return true;
+}
+
+void CLogDB::Replay(FILE* filein, uint64_t nLength, uint64_t& nGoodSize, bool& fTorn)
+{
+    uint64_t nOffset = LOGDB_HEADER_SIZE;
+    fTorn = false;
+    while (nOffset < nLength) {
+        unsigned char header[LOGDB_BATCH_HEADER_SIZE];
+        if (nLength - nOffset < sizeof(header) || fread(header, 1, sizeof(header), filein) != sizeof(header)) {
+            fTorn = true;
+            break;
+        }
+        uint32_t nSize = ReadLE32(header);
+        if (nSize > nLength - nOffset - sizeof(header)) {
+            fTorn = true;
+            break;
+        }
+
+        CSerializeData payload(nSize);
+        Batch batch;
+        bool fValid = nSize > 0 && fread(&payload[0], 1, nSize, filein) == nSize && Checksum(payload) == ReadLE32(header + 4);
+        if (fValid) {
+            try {
+                CDataStream ss(payload.begin(), payload.end(), SER_DISK, CLIENT_VERSION);
+                while (!ss.empty()) {
+                    unsigned char nType;
+                    Bytes key, value;
+                    ss >> nType >> key;
+                    if (nType == LOGDB_PUT) {
+                        ss >> value;
+                        batch.Put(key, value);
+                    } else if (nType == LOGDB_ERASE) {
+                        batch.Erase(key);
+                    } else {
+                        fValid = false;
+                        break;
+                    }
+                }
+            } catch (const std::exception&) {
+                fValid = false;
+            }
+        }
+        if (!fValid) {
+            // The last batch of the file, or one followed by nothing written
+            // yet, was being appended when the node stopped
+            fTorn = nOffset + sizeof(header) + nSize == nLength || IsZeroTail(filein, nOffset);
+            break;
+        }
+
+        Apply(batch);
+        nOffset += sizeof(header) + nSize;
+    }
+    nGoodSize = nOffset;
+}
+
+bool CLogDB::Open(bool fSalvage, std::string& strError)
+{
+    LOCK(cs_log);
+    if (file)
+        return true;
+
+    std::string strPath = path.string();
+    std::string strName = path.filename().string();
+    try {
+        if (!boost::filesystem::exists(path) || boost::filesystem::file_size(path) == 0) {
+            FILE* fileout = fopen(strPath.c_str(), "wb");
+            if (!fileout) {
+                strError = strprintf("can't create %s", strName);
+                return false;
+            }
+            bool fWritten = WriteHeader(fileout);
+            if (fWritten)
+                FileCommit(fileout);
+            fclose(fileout);
+            if (!fWritten) {
+                strError = strprintf("can't write to %s", strName);
+                return false;
+            }
+        }
+
+        int64_t nStart = GetTimeMillis();
+        uint64_t nLength = boost::filesystem::file_size(path);
+        FILE* filein = fopen(strPath.c_str(), "rb");
+        if (!filein) {
+            strError = strprintf("can't open %s", strName);
+            return false;
+        }
+        unsigned char header[LOGDB_HEADER_SIZE];
+        if (fread(header, 1, sizeof(header), filein) != sizeof(header) || memcmp(header, LOGDB_MAGIC, sizeof(LOGDB_MAGIC)) != 0) {
+            fclose(filein);
+            strError = strprintf("%s is not a wallet log", strName);
+            return false;
+        }
+        if (ReadLE32(header + sizeof(LOGDB_MAGIC)) > LOGDB_VERSION) {
+            fclose(filein);
+            strError = strprintf("%s was written by a newer version", strName);
+            return false;
+        }
+
+        mapIndex.clear();
+        nLiveSize = 0;
+        uint64_t nGoodSize;
+        bool fTorn;
+        Replay(filein, nLength, nGoodSize, fTorn);
+        fclose(filein);
+
+        if (nGoodSize < nLength) {
+            if (fTorn) {
+                LogPrintf("CLogDB::Open: %s ends with an incomplete batch at offset %u, dropping it\n", strName, nGoodSize);
+            } else if (!fSalvage) {
+                mapIndex.clear();
+                nLiveSize = 0;
+                strError = strprintf("%s is corrupt at offset %u", strName, nGoodSize);
+                return false;
+            } else {
+                boost::filesystem::path pathBak = strPath + strprintf(".%d.bak", GetTime());
+                boost::filesystem::copy_file(path, pathBak, boost::filesystem::copy_option::overwrite_if_exists);
+                LogPrintf("CLogDB::Open: %s is corrupt at offset %u, copied it to %s and dropped the rest of it\n",
+                    strName, nGoodSize, pathBak.string());
+            }
+        }
+
+        file = fopen(strPath.c_str(), "ab");
+        if (!file) {
+            mapIndex.clear();
+            nLiveSize = 0;
+            strError = strprintf("can't open %s for writing", strName);
+            return false;
+        }
+        if (nGoodSize < nLength) {
+            TruncateFile(file, nGoodSize);
+            FileCommit(file);
+        }
+        nFileSize = nGoodSize;
+        fDirty = false;
+        LogPrint("db", "CLogDB::Open: %s: %u records, %u of %u bytes live, %dms\n",
+            strName, mapIndex.size(), nLiveSize, nFileSize, GetTimeMillis() - nStart);
+    } catch (const boost::filesystem::filesystem_error& e) {
+        strError = strprintf("%s: %s", strName, e.what());
+        return false;
+    }
+    return true;
+}
+
+void CLogDB::Close()
+{
+    LOCK(cs_log);
+    if (!file)
+        return;
+    if (fDirty)
+        FileCommit(file);
+    fclose(file);
+    file = NULL;
+    mapIndex.clear();
+    nLiveSize = 0;
+    fDirty = false;
+}
+
+bool CLogDB::Read(const Bytes& key, Bytes& value) const
+{
+    LOCK(cs_log);
+    Index::const_iterator it = mapIndex.find(key);
+    if (it == mapIndex.end())
+        return false;
+    value = it->second;
+    return true;
+}
+
+bool CLogDB::Exists(const Bytes& key) const
+{
+    LOCK(cs_log);
+    return mapIndex.count(key) > 0;
+}
+
+bool CLogDB::Seek(const Bytes& key, bool fInclusive, Bytes& keyFound, Bytes& valueFound) const
+{
+    LOCK(cs_log);
+    Index::const_iterator it = fInclusive ? mapIndex.lower_bound(key) : mapIndex.upper_bound(key);
+    if (it == mapIndex.end())
+        return false;
+    keyFound = it->first;
+    valueFound = it->second;
+    return true;
+}
+
+bool CLogDB::Write(const Batch& batch, bool fSync)
+{
+    LOCK(cs_log);
+    if (!file)
+        return false;
+    if (batch.IsEmpty())
+        return true;
+
+    uint64_t nWritten = 0;
+    if (!AppendBatch(file, batch, nWritten)) {
+        // Don't leave part of the batch before the next one
+        clearerr(file);
+        TruncateFile(file, nFileSize);
+        return error("CLogDB::Write: can't append to %s", path.string());
+    }
+    nFileSize += nWritten;
+    Apply(batch);
+    if (fSync) {
+        FileCommit(file);
+        fDirty = false;
+    } else {
+        fDirty = true;
+    }
+    return true;
+}
+
+bool CLogDB::Sync()
+{
+    LOCK(cs_log);
+    if (!file)
+        return false;
+    if (fDirty) {
+        FileCommit(file);
+        fDirty = false;
+    }
+    return true;
+}
+
+bool CLogDB::NeedsCompaction() const
+{
+    LOCK(cs_log);
+    return file && nFileSize >= LOGDB_COMPACT_MIN_SIZE && nFileSize > 2 * nLiveSize;
+}
+
+bool CLogDB::Compact(const std::string& strSkipPrefix)
+{
+    LOCK(cs_log);
+    if (!file)
+        return false;
+
+    int64_t nStart = GetTimeMillis();
+    boost::filesystem::path pathCompact = path.string() + ".compact";
+    FILE* fileout = fopen(pathCompact.string().c_str(), "wb");
+    if (!fileout)
+        return error("CLogDB::Compact: can't create %s", pathCompact.string());
+
+    bool fSuccess = WriteHeader(fileout);
+    uint64_t nNewSize = LOGDB_HEADER_SIZE;
+    std::vector<Bytes> vSkipped;
+    Batch batch;
+    uint64_t nBatchSize = 0;
+    for (Index::const_iterator it = mapIndex.begin(); fSuccess && it != mapIndex.end(); ++it) {
+        if (!strSkipPrefix.empty() && it->first.size() >= strSkipPrefix.size() &&
+            memcmp(&it->first[0], strSkipPrefix.data(), strSkipPrefix.size()) == 0) {
+            vSkipped.push_back(it->first);
+            continue;
+        }
+        // Keys are unique here, so don't index them in the batch
+        Batch::Op op;
+        op.fErase = false;
+        op.key = it->first;
+        op.value = it->second;
+        batch.vOps.push_back(op);
+        nBatchSize += RecordSize(it->first, it->second);
+        if (nBatchSize >= LOGDB_COMPACT_BATCH_SIZE) {
+            uint64_t nWritten = 0;
+            fSuccess = AppendBatch(fileout, batch, nWritten);
+            nNewSize += nWritten;
+            batch.Clear();
+            nBatchSize = 0;
+        }
+    }
+    if (fSuccess && !batch.IsEmpty()) {
+        uint64_t nWritten = 0;
+        fSuccess = AppendBatch(fileout, batch, nWritten);
+        nNewSize += nWritten;
+    }
+    if (fSuccess)
+        FileCommit(fileout);
+    fclose(fileout);
+
+    if (fSuccess) {
+        FileCommit(file);
+        fclose(file);
+        fSuccess = RenameOver(pathCompact, path);
+        file = fopen(path.string().c_str(), "ab");
+        if (!file) {
+            mapIndex.clear();
+            nLiveSize = 0;
+            return error("CLogDB::Compact: can't reopen %s", path.string());
+        }
+    }
+    if (!fSuccess) {
+        boost::filesystem::remove(pathCompact);
+        return error("CLogDB::Compact: failed to rewrite %s", path.string());
+    }
+
+    uint64_t nOldSize = nFileSize;
+    for (const Bytes& key : vSkipped) {
+        Index::iterator it = mapIndex.find(key);
+        nLiveSize -= RecordSize(it->first, it->second);
+        mapIndex.erase(it);
+    }
+    nFileSize = nNewSize;
+    fDirty = false;
+    LogPrint("db", "CLogDB::Compact: %s from %u to %u bytes, %dms\n", path.filename().string(), nOldSize, nFileSize, GetTimeMillis() - nStart);
+    return true;
+}
+
+bool CLogDB::Backup(const boost::filesystem::path& pathDest)
+{
+    LOCK(cs_log);
+    if (!file)
+        return false;
+    try {
+        boost::filesystem::copy_file(path, pathDest, boost::filesystem::copy_option::overwrite_if_exists);
+    } catch (const boost::filesystem::filesystem_error& e) {
+        return error("CLogDB::Backup: can't copy %s to %s: %s", path.string(), pathDest.string(), e.what());
+    }
+    return true;
+}
+
+size_t CLogDB::GetCount() const
+{
+    LOCK(cs_log);
+    return mapIndex.size();
+}
+
+uint64_t CLogDB::GetFileSize() const
+{
+    LOCK(cs_log);
+    return nFileSize;
+}
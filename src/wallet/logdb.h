@@ -0,0 +1,141 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_LOGDB_H
+#define BITCOIN_WALLET_LOGDB_H
+
+#include "support/allocators/zeroafterfree.h"
+#include "sync.h"
+
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+//! Format new wallet files are created in, as given to -walletformat
+static const char* const DEFAULT_WALLET_FORMAT = "bdb";
+
+//! Logs smaller than this are never compacted
+static const uint64_t LOGDB_COMPACT_MIN_SIZE = 1 << 20;
+
+//! Size of the batches a compacted log is rewritten in
+static const size_t LOGDB_COMPACT_BATCH_SIZE = 1 << 20;
+
+/**
+ * A key/value store kept in a single file as an append-only log of batches,
+ * with every live record indexed in memory. It is the "log" format of wallet
+ * files, which CDB uses instead of Berkeley DB when a file is in it.
+ *
+ * The file starts with a magic and a version, followed by batches, each made
+ * of the size and checksum of its payload and the payload itself: the records
+ * put and erased by one write or transaction. A batch is applied entirely or
+ * not at all when the log is replayed on open. Overwritten and erased records
+ * stay in the file until Compact() rewrites it with only the live ones.
+ *
+ * Keys and values are raw bytes, ordered bytewise as Berkeley DB orders them,
+ * and are wiped from memory when they are freed, as most wallet records hold
+ * keys.
+ */
+class CLogDB
+{
+public:
+    typedef std::vector<unsigned char, zero_after_free_allocator<unsigned char> > Bytes;
+
+    /** Records put or erased together by Write() */
+    class Batch
+    {
+    public:
+        void Put(const Bytes& key, const Bytes& value);
+        void Erase(const Bytes& key);
+        void Clear();
+        bool IsEmpty() const { return vOps.empty(); }
+
+        //! Whether key was put (1) or erased (-1) in this batch, 0 if neither
+        int Find(const Bytes& key, Bytes* pvalue) const;
+
+    private:
+        struct Op
+        {
+            bool fErase;
+            Bytes key;
+            Bytes value;
+        };
+        std::vector<Op> vOps;
+        //! Index in vOps of the last change of each key
+        std::map<Bytes, size_t> mapLast;
+
+        friend class CLogDB;
+    };
+
+    explicit CLogDB(const boost::filesystem::path& pathIn);
+    ~CLogDB();
+
+    //! Whether path is a file in the log format
+    static bool IsLogFile(const boost::filesystem::path& path);
+
+    /**
+     * Open the log, creating it if it doesn't exist, and replay it. A batch
+     * cut short at the end of the file, by a crash while it was appended, is
+     * dropped. A complete batch that doesn't match its checksum fails the
+     * open, unless fSalvage: then the file is copied to <file>.<time>.bak and
+     * the batch is dropped with everything after it.
+     */
+    bool Open(bool fSalvage, std::string& strError);
+    void Close();
+
+    bool Read(const Bytes& key, Bytes& value) const;
+    bool Exists(const Bytes& key) const;
+
+    //! The first record with a key after key, or at it if fInclusive
+    bool Seek(const Bytes& key, bool fInclusive, Bytes& keyFound, Bytes& valueFound) const;
+
+    /**
+     * Append batch to the log and apply it to the index. The batch reaches
+     * the operating system before this returns, and the disk if fSync.
+     */
+    bool Write(const Batch& batch, bool fSync);
+
+    //! Make sure what was written reached the disk
+    bool Sync();
+
+    //! Whether most of the file is records that were overwritten or erased
+    bool NeedsCompaction() const;
+
+    /**
+     * Rewrite the file with only the live records, leaving out, and erasing,
+     * those whose key starts with strSkipPrefix if it isn't empty. The new
+     * file replaces the old one once it is complete.
+     */
+    bool Compact(const std::string& strSkipPrefix = "");
+
+    //! Copy the file to pathDest, with everything written so far
+    bool Backup(const boost::filesystem::path& pathDest);
+
+    size_t GetCount() const;
+    uint64_t GetFileSize() const;
+
+private:
+    typedef std::map<Bytes, Bytes> Index;
+
+    mutable CCriticalSection cs_log;
+    const boost::filesystem::path path;
+    FILE* file;
+    Index mapIndex;
+    //! Size of the file up to the end of its last batch
+    uint64_t nFileSize;
+    //! Size the records of mapIndex take in the file
+    uint64_t nLiveSize;
+    //! Whether a batch was written since the last sync
+    bool fDirty;
+
+    void Replay(FILE* filein, uint64_t nLength, uint64_t& nGoodSize, bool& fTorn);
+    void Apply(const Batch& batch);
+    static bool WriteHeader(FILE* fileout);
+    static bool AppendBatch(FILE* fileout, const Batch& batch, uint64_t& nWritten);
+};
+
+#endif // BITCOIN_WALLET_LOGDB_H
@@ -12,6 +12,7 @@
 #include "util.h"
 #include "utiltime.h"
 #include "wallet.h"
+#include "wallet/rpcwallet.h"
 
 #include <fstream>
 #include <stdint.h>
@@ -31,14 +32,15 @@ using namespace std;
 using namespace libzcash;
 
 // Function declaration for function implemented in wallet/rpcwallet.cpp
-bool EnsureWalletIsAvailable(bool avoidException);
+bool EnsureWalletIsAvailable(CWallet* const pwallet, bool avoidException);
 
 /**
  * RPC call to generate a payment disclosure
  */
 UniValue z_getpaymentdisclosure(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     string enableArg = "paymentdisclosure";
@@ -70,9 +72,9 @@ UniValue z_getpaymentdisclosure(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_WALLET_ERROR, "Error: payment disclosure is disabled.");
     }
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    EnsureWalletIsUnlocked();
+    EnsureWalletIsUnlocked(pwallet);
 
     // Check wallet knows about txid
     string txid = params[0].get_str();
@@ -93,10 +95,10 @@ UniValue z_getpaymentdisclosure(const UniValue& params, bool fHelp)
     }
 
     // Check is mine
-    if (!pwalletMain->mapWallet.count(hash)) {
+    if (!pwallet->mapWallet.count(hash)) {
         throw JSONRPCError(RPC_MISC_ERROR, "Transaction does not belong to the wallet");
     }
-    const CWalletTx& wtx = pwalletMain->mapWallet[hash];
+    const CWalletTx& wtx = pwallet->mapWallet[hash];
 
     // Check if shielded tx
     if (wtx.vjoinsplit.empty()) {
@@ -145,7 +147,8 @@ UniValue z_getpaymentdisclosure(const UniValue& params, bool fHelp)
  */
 UniValue z_validatepaymentdisclosure(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     string enableArg = "paymentdisclosure";
@@ -172,9 +175,9 @@ UniValue z_validatepaymentdisclosure(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_WALLET_ERROR, "Error: payment disclosure is disabled.");
     }
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    EnsureWalletIsUnlocked();
+    EnsureWalletIsUnlocked(pwallet);
 
     // Verify the payment disclosure input begins with "zpd:" prefix.
     string strInput = params[0].get_str();
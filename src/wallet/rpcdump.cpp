@@ -14,19 +14,21 @@
 #include "util.h"
 #include "utiltime.h"
 #include "wallet.h"
+#include "wallet/rpcwallet.h"
 
 #include <fstream>
 #include <stdint.h>
 
 #include <boost/algorithm/string.hpp>
+#include <boost/assign/list_of.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 #include <univalue.h>
 
 using namespace std;
 
-void EnsureWalletIsUnlocked();
-bool EnsureWalletIsAvailable(bool avoidException);
+void EnsureWalletIsUnlocked(CWallet* const pwallet);
+bool EnsureWalletIsAvailable(CWallet* const pwallet, bool avoidException);
 
 UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys);
 UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys);
@@ -75,19 +77,120 @@ std::string DecodeDumpString(const std::string &str) {
     return ret.str();
 }
 
+/**
+ * The creation time saved for a key born at nBirthHeight: the time of that
+ * block, or 1, the beginning of time, for keys of unknown age (-1) and keys
+ * born with the chain.
+ */
+static int64_t GetBirthTime(int nBirthHeight)
+{
+    AssertLockHeld(cs_main);
+    if (nBirthHeight <= 0)
+        return 1; // 0 would be considered 'no value'
+    return chainActive[nBirthHeight]->GetBlockTime();
+}
+
+//! Parse the startHeight argument of an import, the height the key was created at
+static int ParseStartHeight(const UniValue& value)
+{
+    AssertLockHeld(cs_main);
+    int nHeight = value.get_int();
+    if (nHeight < 0 || nHeight > chainActive.Height()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+    }
+    return nHeight;
+}
+
+/**
+ * Add key to the wallet with its birthday, nBirthHeight, or -1 if unknown.
+ * Returns false if the wallet already had the key.
+ */
+static bool ImportKey(CWallet* const pwallet, const CKey& key, const std::string& strLabel, int nBirthHeight)
+{
+    CPubKey pubkey = key.GetPubKey();
+    assert(key.VerifyPubKey(pubkey));
+    CKeyID vchAddress = pubkey.GetID();
+
+    pwallet->MarkDirty();
+    pwallet->SetAddressBook(vchAddress, strLabel, "receive");
+
+    // Don't throw error in case a key is already there
+    if (pwallet->HaveKey(vchAddress)) {
+        return false;
+    }
+
+    CKeyMetadata& meta = pwallet->mapKeyMetadata[vchAddress];
+    meta.nCreateTime = GetBirthTime(nBirthHeight);
+    meta.nBirthHeight = nBirthHeight;
+
+    if (!pwallet->AddKeyPubKey(key, pubkey))
+        throw JSONRPCError(RPC_WALLET_ERROR, "Error adding key to wallet");
+    pwallet->UpdateTimeFirstKey(meta.nCreateTime);
+    return true;
+}
+
+/**
+ * Add a spending key to the wallet with its birthday, nBirthHeight, or -1 if
+ * unknown, and set nRescanHeight to the height a rescan for it starts at.
+ */
+static SpendingKeyAddResult ImportSpendingKey(CWallet* const pwallet, const libzcash::SpendingKey& sk, int nBirthHeight, int& nRescanHeight)
+{
+    const Consensus::Params& consensus = Params().GetConsensus();
+    AddSpendingKeyToWallet visitor(pwallet, consensus, GetBirthTime(nBirthHeight), boost::none, boost::none, false, nBirthHeight);
+    auto addResult = boost::apply_visitor(visitor, sk);
+    if (addResult == KeyNotAdded) {
+        throw JSONRPCError(RPC_WALLET_ERROR, "Error adding spending key to wallet");
+    }
+
+    nRescanHeight = std::max(nBirthHeight, 0);
+    // Sapling keys can't have been used before Sapling activated
+    if (boost::get<libzcash::SaplingExtendedSpendingKey>(&sk) != nullptr) {
+        nRescanHeight = std::max(nRescanHeight, AddSpendingKeyToWallet::SaplingBirthHeight(consensus));
+    }
+    nRescanHeight = std::min(nRescanHeight, chainActive.Height());
+    return addResult;
+}
+
+/**
+ * Add a Sprout viewing key to the wallet with its birthday, nBirthHeight, or
+ * -1 if unknown. Returns false if the wallet already had the key.
+ */
+static bool ImportSproutViewingKey(CWallet* const pwallet, const libzcash::SproutViewingKey& vkey, int nBirthHeight)
+{
+    auto addr = vkey.address();
+    if (pwallet->HaveSproutSpendingKey(addr)) {
+        throw JSONRPCError(RPC_WALLET_ERROR, "The wallet already contains the private key for this viewing key");
+    }
+
+    // Don't throw error in case a viewing key is already there
+    if (pwallet->HaveSproutViewingKey(addr)) {
+        return false;
+    }
+
+    pwallet->MarkDirty();
+    CKeyMetadata meta(GetBirthTime(nBirthHeight));
+    meta.nBirthHeight = nBirthHeight;
+    if (!pwallet->AddSproutViewingKey(vkey, meta)) {
+        throw JSONRPCError(RPC_WALLET_ERROR, "Error adding viewing key to wallet");
+    }
+    return true;
+}
+
 UniValue importprivkey(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
     
-    if (fHelp || params.size() < 1 || params.size() > 3)
+    if (fHelp || params.size() < 1 || params.size() > 4)
         throw runtime_error(
-            "importprivkey \"zcashprivkey\" ( \"label\" rescan )\n"
+            "importprivkey \"zcashprivkey\" ( \"label\" rescan startHeight )\n"
             "\nAdds a private key (as returned by dumpprivkey) to your wallet.\n"
             "\nArguments:\n"
             "1. \"zcashprivkey\"   (string, required) The private key (see dumpprivkey)\n"
             "2. \"label\"            (string, optional, default=\"\") An optional label\n"
             "3. rescan               (boolean, optional, default=true) Rescan the wallet for transactions\n"
+            "4. startHeight          (numeric, optional, default=0) Block height the key was created at, to start rescan from\n"
             "\nNote: This call can take minutes to complete if rescan is true.\n"
             "\nExamples:\n"
             "\nDump a private key\n"
@@ -96,13 +199,15 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
             + HelpExampleCli("importprivkey", "\"mykey\"") +
             "\nImport using a label and without rescan\n"
             + HelpExampleCli("importprivkey", "\"mykey\" \"testing\" false") +
+            "\nImport the private key of a key created at height 30000, with partial rescan\n"
+            + HelpExampleCli("importprivkey", "\"mykey\" \"testing\" true 30000") +
             "\nAs a JSON-RPC call\n"
             + HelpExampleRpc("importprivkey", "\"mykey\", \"testing\", false")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    EnsureWalletIsUnlocked();
+    EnsureWalletIsUnlocked(pwallet);
 
     string strSecret = params[0].get_str();
     string strLabel = "";
@@ -114,50 +219,36 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
     if (params.size() > 2)
         fRescan = params[2].get_bool();
 
+    // Height the key was created at, unknown by default
+    int nBirthHeight = -1;
+    if (params.size() > 3)
+        nBirthHeight = ParseStartHeight(params[3]);
+
     CKey key = DecodeSecret(strSecret);
     if (!key.IsValid()) throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid private key encoding");
 
-    CPubKey pubkey = key.GetPubKey();
-    assert(key.VerifyPubKey(pubkey));
-    CKeyID vchAddress = pubkey.GetID();
-    {
-        pwalletMain->MarkDirty();
-        pwalletMain->SetAddressBook(vchAddress, strLabel, "receive");
-
-        // Don't throw error in case a key is already there
-        if (pwalletMain->HaveKey(vchAddress)) {
-            return EncodeDestination(vchAddress);
-        }
-
-        pwalletMain->mapKeyMetadata[vchAddress].nCreateTime = 1;
-
-        if (!pwalletMain->AddKeyPubKey(key, pubkey))
-            throw JSONRPCError(RPC_WALLET_ERROR, "Error adding key to wallet");
-
-        // whenever a key is imported, we need to scan the whole chain
-        pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
-
-        if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
-        }
+    if (ImportKey(pwallet, key, strLabel, nBirthHeight) && fRescan) {
+        pwallet->ScanForWalletTransactions(chainActive[std::max(nBirthHeight, 0)], true);
     }
 
-    return EncodeDestination(vchAddress);
+    return EncodeDestination(key.GetPubKey().GetID());
 }
 
 UniValue importaddress(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
     
-    if (fHelp || params.size() < 1 || params.size() > 3)
+    if (fHelp || params.size() < 1 || params.size() > 4)
         throw runtime_error(
-            "importaddress \"address\" ( \"label\" rescan )\n"
+            "importaddress \"address\" ( \"label\" rescan startHeight )\n"
             "\nAdds an address or script (in hex) that can be watched as if it were in your wallet but cannot be used to spend.\n"
             "\nArguments:\n"
             "1. \"address\"          (string, required) The address\n"
             "2. \"label\"            (string, optional, default=\"\") An optional label\n"
             "3. rescan               (boolean, optional, default=true) Rescan the wallet for transactions\n"
+            "4. startHeight          (numeric, optional, default=0) Block height the address was created at, to start rescan from\n"
             "\nNote: This call can take minutes to complete if rescan is true.\n"
             "\nExamples:\n"
             "\nImport an address with rescan\n"
@@ -168,7 +259,7 @@ UniValue importaddress(const UniValue& params, bool fHelp)
             + HelpExampleRpc("importaddress", "\"myaddress\", \"testing\", false")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     CScript script;
 
@@ -191,27 +282,34 @@ UniValue importaddress(const UniValue& params, bool fHelp)
     if (params.size() > 2)
         fRescan = params[2].get_bool();
 
+    // Height the address was created at, unknown by default
+    int nBirthHeight = -1;
+    if (params.size() > 3)
+        nBirthHeight = ParseStartHeight(params[3]);
+
     {
-        if (::IsMine(*pwalletMain, script) == ISMINE_SPENDABLE)
+        if (::IsMine(*pwallet, script) == ISMINE_SPENDABLE)
             throw JSONRPCError(RPC_WALLET_ERROR, "The wallet already contains the private key for this address or script");
 
         // add to address book or update label
         if (IsValidDestination(dest))
-            pwalletMain->SetAddressBook(dest, strLabel, "receive");
+            pwallet->SetAddressBook(dest, strLabel, "receive");
 
         // Don't throw error in case an address is already there
-        if (pwalletMain->HaveWatchOnly(script))
+        if (pwallet->HaveWatchOnly(script))
             return NullUniValue;
 
-        pwalletMain->MarkDirty();
+        pwallet->MarkDirty();
 
-        if (!pwalletMain->AddWatchOnly(script))
+        CKeyMetadata meta(GetBirthTime(nBirthHeight));
+        meta.nBirthHeight = nBirthHeight;
+        if (!pwallet->AddWatchOnly(script, meta))
             throw JSONRPCError(RPC_WALLET_ERROR, "Error adding address to wallet");
 
         if (fRescan)
         {
-            pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
-            pwalletMain->ReacceptWalletTransactions();
+            pwallet->ScanForWalletTransactions(chainActive[std::max(nBirthHeight, 0)], true);
+            pwallet->ReacceptWalletTransactions();
         }
     }
 
@@ -220,7 +318,8 @@ UniValue importaddress(const UniValue& params, bool fHelp)
 
 UniValue z_importwallet(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() != 1)
@@ -243,7 +342,8 @@ UniValue z_importwallet(const UniValue& params, bool fHelp)
 
 UniValue importwallet(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
     
     if (fHelp || params.size() != 1)
@@ -266,9 +366,10 @@ UniValue importwallet(const UniValue& params, bool fHelp)
 
 UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys)
 {
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    EnsureWalletIsUnlocked();
+    EnsureWalletIsUnlocked(pwallet);
 
     ifstream file;
     file.open(params[0].get_str().c_str(), std::ios::in | std::ios::ate);
@@ -282,9 +383,9 @@ UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys
     int64_t nFilesize = std::max((int64_t)1, (int64_t)file.tellg());
     file.seekg(0, file.beg);
 
-    pwalletMain->ShowProgress(_("Importing..."), 0); // show progress dialog in GUI
+    pwallet->ShowProgress(_("Importing..."), 0); // show progress dialog in GUI
     while (file.good()) {
-        pwalletMain->ShowProgress("", std::max(1, std::min(99, (int)(((double)file.tellg() / (double)nFilesize) * 100))));
+        pwallet->ShowProgress("", std::max(1, std::min(99, (int)(((double)file.tellg() / (double)nFilesize) * 100))));
         std::string line;
         std::getline(file, line);
         if (line.empty() || line[0] == '#')
@@ -304,7 +405,7 @@ UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys
             boost::optional<std::string> seedFpStr = (vstr.size() > 3) ? boost::optional<std::string>(vstr[3]) : boost::none;
             if (IsValidSpendingKey(spendingkey)) {
                 auto addResult = boost::apply_visitor(
-                    AddSpendingKeyToWallet(pwalletMain, Params().GetConsensus(), nTime, hdKeypath, seedFpStr, true), spendingkey);
+                    AddSpendingKeyToWallet(pwallet, Params().GetConsensus(), nTime, hdKeypath, seedFpStr, true), spendingkey);
                 if (addResult == KeyAlreadyExists){
                     LogPrint("zrpc", "Skipping import of zaddr (key already present)\n");
                 } else if (addResult == KeyNotAdded) {
@@ -324,7 +425,7 @@ UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys
         CPubKey pubkey = key.GetPubKey();
         assert(key.VerifyPubKey(pubkey));
         CKeyID keyid = pubkey.GetID();
-        if (pwalletMain->HaveKey(keyid)) {
+        if (pwallet->HaveKey(keyid)) {
             LogPrintf("Skipping import of %s (key already present)\n", EncodeDestination(keyid));
             continue;
         }
@@ -344,28 +445,28 @@ UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys
             }
         }
         LogPrintf("Importing %s...\n", EncodeDestination(keyid));
-        if (!pwalletMain->AddKeyPubKey(key, pubkey)) {
+        if (!pwallet->AddKeyPubKey(key, pubkey)) {
             fGood = false;
             continue;
         }
-        pwalletMain->mapKeyMetadata[keyid].nCreateTime = nTime;
+        pwallet->mapKeyMetadata[keyid].nCreateTime = nTime;
         if (fLabel)
-            pwalletMain->SetAddressBook(keyid, strLabel, "receive");
+            pwallet->SetAddressBook(keyid, strLabel, "receive");
         nTimeBegin = std::min(nTimeBegin, nTime);
     }
     file.close();
-    pwalletMain->ShowProgress("", 100); // hide progress dialog in GUI
+    pwallet->ShowProgress("", 100); // hide progress dialog in GUI
 
     CBlockIndex *pindex = chainActive.Tip();
     while (pindex && pindex->pprev && pindex->GetBlockTime() > nTimeBegin - 7200)
         pindex = pindex->pprev;
 
-    if (!pwalletMain->nTimeFirstKey || nTimeBegin < pwalletMain->nTimeFirstKey)
-        pwalletMain->nTimeFirstKey = nTimeBegin;
+    if (!pwallet->nTimeFirstKey || nTimeBegin < pwallet->nTimeFirstKey)
+        pwallet->nTimeFirstKey = nTimeBegin;
 
     LogPrintf("Rescanning last %i blocks\n", chainActive.Height() - pindex->nHeight + 1);
-    pwalletMain->ScanForWalletTransactions(pindex);
-    pwalletMain->MarkDirty();
+    pwallet->ScanForWalletTransactions(pindex);
+    pwallet->MarkDirty();
 
     if (!fGood)
         throw JSONRPCError(RPC_WALLET_ERROR, "Error adding some keys to wallet");
@@ -375,7 +476,8 @@ UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys
 
 UniValue dumpprivkey(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
     
     if (fHelp || params.size() != 1)
@@ -393,9 +495,9 @@ UniValue dumpprivkey(const UniValue& params, bool fHelp)
             + HelpExampleRpc("dumpprivkey", "\"myaddress\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    EnsureWalletIsUnlocked();
+    EnsureWalletIsUnlocked(pwallet);
 
     std::string strAddress = params[0].get_str();
     CTxDestination dest = DecodeDestination(strAddress);
@@ -407,7 +509,7 @@ UniValue dumpprivkey(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_TYPE_ERROR, "Address does not refer to a key");
     }
     CKey vchSecret;
-    if (!pwalletMain->GetKey(*keyID, vchSecret)) {
+    if (!pwallet->GetKey(*keyID, vchSecret)) {
         throw JSONRPCError(RPC_WALLET_ERROR, "Private key for address " + strAddress + " is not known");
     }
     return EncodeSecret(vchSecret);
@@ -417,7 +519,8 @@ UniValue dumpprivkey(const UniValue& params, bool fHelp)
 
 UniValue z_exportwallet(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
     
     if (fHelp || params.size() != 1)
@@ -438,7 +541,8 @@ UniValue z_exportwallet(const UniValue& params, bool fHelp)
 
 UniValue dumpwallet(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() != 1)
@@ -459,9 +563,10 @@ UniValue dumpwallet(const UniValue& params, bool fHelp)
 
 UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys)
 {
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    EnsureWalletIsUnlocked();
+    EnsureWalletIsUnlocked(pwallet);
 
     boost::filesystem::path exportdir;
     try {
@@ -490,8 +595,8 @@ UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys)
 
     std::map<CKeyID, int64_t> mapKeyBirth;
     std::set<CKeyID> setKeyPool;
-    pwalletMain->GetKeyBirthTimes(mapKeyBirth);
-    pwalletMain->GetAllReserveKeys(setKeyPool);
+    pwallet->GetKeyBirthTimes(mapKeyBirth);
+    pwallet->GetAllReserveKeys(setKeyPool);
 
     // sort time/key pairs
     std::vector<std::pair<int64_t, CKeyID> > vKeyBirth;
@@ -508,7 +613,7 @@ UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys)
     file << strprintf("#   mined on %s\n", EncodeDumpTime(chainActive.Tip()->GetBlockTime()));
     {
         HDSeed hdSeed;
-        pwalletMain->GetHDSeed(hdSeed);
+        pwallet->GetHDSeed(hdSeed);
         auto rawSeed = hdSeed.RawSeed();
         file << strprintf("# HDSeed=%s fingerprint=%s", HexStr(rawSeed.begin(), rawSeed.end()), hdSeed.Fingerprint().GetHex());
         file << "\n";
@@ -519,9 +624,9 @@ UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys)
         std::string strTime = EncodeDumpTime(it->first);
         std::string strAddr = EncodeDestination(keyid);
         CKey key;
-        if (pwalletMain->GetKey(keyid, key)) {
-            if (pwalletMain->mapAddressBook.count(keyid)) {
-                file << strprintf("%s %s label=%s # addr=%s\n", EncodeSecret(key), strTime, EncodeDumpString(pwalletMain->mapAddressBook[keyid].name), strAddr);
+        if (pwallet->GetKey(keyid, key)) {
+            if (pwallet->mapAddressBook.count(keyid)) {
+                file << strprintf("%s %s label=%s # addr=%s\n", EncodeSecret(key), strTime, EncodeDumpString(pwallet->mapAddressBook[keyid].name), strAddr);
             } else if (setKeyPool.count(keyid)) {
                 file << strprintf("%s %s reserve=1 # addr=%s\n", EncodeSecret(key), strTime, strAddr);
             } else {
@@ -533,27 +638,27 @@ UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys)
 
     if (fDumpZKeys) {
         std::set<libzcash::SproutPaymentAddress> sproutAddresses;
-        pwalletMain->GetSproutPaymentAddresses(sproutAddresses);
+        pwallet->GetSproutPaymentAddresses(sproutAddresses);
         file << "\n";
         file << "# Zkeys\n";
         file << "\n";
         for (auto addr : sproutAddresses) {
             libzcash::SproutSpendingKey key;
-            if (pwalletMain->GetSproutSpendingKey(addr, key)) {
-                std::string strTime = EncodeDumpTime(pwalletMain->mapSproutZKeyMetadata[addr].nCreateTime);
+            if (pwallet->GetSproutSpendingKey(addr, key)) {
+                std::string strTime = EncodeDumpTime(pwallet->mapSproutZKeyMetadata[addr].nCreateTime);
                 file << strprintf("%s %s # zaddr=%s\n", EncodeSpendingKey(key), strTime, EncodePaymentAddress(addr));
             }
         }
         std::set<libzcash::SaplingPaymentAddress> saplingAddresses;
-        pwalletMain->GetSaplingPaymentAddresses(saplingAddresses);
+        pwallet->GetSaplingPaymentAddresses(saplingAddresses);
         file << "\n";
         file << "# Sapling keys\n";
         file << "\n";
         for (auto addr : saplingAddresses) {
             libzcash::SaplingExtendedSpendingKey extsk;
-            if (pwalletMain->GetSaplingExtendedSpendingKey(addr, extsk)) {
+            if (pwallet->GetSaplingExtendedSpendingKey(addr, extsk)) {
                 auto ivk = extsk.expsk.full_viewing_key().in_viewing_key();
-                CKeyMetadata keyMeta = pwalletMain->mapSaplingZKeyMetadata[ivk];
+                CKeyMetadata keyMeta = pwallet->mapSaplingZKeyMetadata[ivk];
                 std::string strTime = EncodeDumpTime(keyMeta.nCreateTime);
                 // Keys imported with z_importkey do not have zip32 metadata
                 if (keyMeta.hdKeypath.empty() || keyMeta.seedFp.IsNull()) {
@@ -575,7 +680,8 @@ UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys)
 
 UniValue z_importkey(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() < 1 || params.size() > 3)
@@ -585,7 +691,8 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
             "\nArguments:\n"
             "1. \"zkey\"             (string, required) The zkey (see z_exportkey)\n"
             "2. rescan             (string, optional, default=\"whenkeyisnew\") Rescan the wallet for transactions - can be \"yes\", \"no\" or \"whenkeyisnew\"\n"
-            "3. startHeight        (numeric, optional, default=0) Block height to start rescan from\n"
+            "3. startHeight        (numeric, optional, default=0) Block height the key was created at, to start rescan from.\n"
+            "                      Sapling keys are never searched for before Sapling activation\n"
             "\nNote: This call can take minutes to complete if rescan is true.\n"
             "\nExamples:\n"
             "\nExport a zkey\n"
@@ -600,9 +707,9 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_importkey", "\"mykey\", \"no\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    EnsureWalletIsUnlocked();
+    EnsureWalletIsUnlocked(pwallet);
 
     // Whether to perform rescan after import
     bool fRescan = true;
@@ -629,13 +736,10 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
         }
     }
 
-    // Height to rescan from
-    int nRescanHeight = 0;
+    // Height the key was created at, unknown by default
+    int nBirthHeight = -1;
     if (params.size() > 2)
-        nRescanHeight = params[2].get_int();
-    if (nRescanHeight < 0 || nRescanHeight > chainActive.Height()) {
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
-    }
+        nBirthHeight = ParseStartHeight(params[2]);
 
     string strSecret = params[0].get_str();
     auto spendingkey = DecodeSpendingKey(strSecret);
@@ -644,21 +748,16 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
     }
 
     // Sapling support
-    auto addResult = boost::apply_visitor(AddSpendingKeyToWallet(pwalletMain, Params().GetConsensus()), spendingkey);
+    int nRescanHeight;
+    auto addResult = ImportSpendingKey(pwallet, spendingkey, nBirthHeight, nRescanHeight);
     if (addResult == KeyAlreadyExists && fIgnoreExistingKey) {
         return NullUniValue;
     }
-    pwalletMain->MarkDirty();
-    if (addResult == KeyNotAdded) {
-        throw JSONRPCError(RPC_WALLET_ERROR, "Error adding spending key to wallet");
-    }
-
-    // whenever a key is imported, we need to scan the whole chain
-    pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
+    pwallet->MarkDirty();
 
     // We want to scan for transactions and notes
     if (fRescan) {
-        pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true);
+        pwallet->ScanForWalletTransactions(chainActive[nRescanHeight], true);
     }
 
     return NullUniValue;
@@ -666,7 +765,8 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
 
 UniValue z_importviewingkey(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() < 1 || params.size() > 3)
@@ -676,7 +776,7 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp)
             "\nArguments:\n"
             "1. \"vkey\"             (string, required) The viewing key (see z_exportviewingkey)\n"
             "2. rescan             (string, optional, default=\"whenkeyisnew\") Rescan the wallet for transactions - can be \"yes\", \"no\" or \"whenkeyisnew\"\n"
-            "3. startHeight        (numeric, optional, default=0) Block height to start rescan from\n"
+            "3. startHeight        (numeric, optional, default=0) Block height the key was created at, to start rescan from\n"
             "\nNote: This call can take minutes to complete if rescan is true.\n"
             "\nExamples:\n"
             "\nImport a viewing key\n"
@@ -691,9 +791,9 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_importviewingkey", "\"vkey\", \"no\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    EnsureWalletIsUnlocked();
+    EnsureWalletIsUnlocked(pwallet);
 
     // Whether to perform rescan after import
     bool fRescan = true;
@@ -712,13 +812,10 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp)
         }
     }
 
-    // Height to rescan from
-    int nRescanHeight = 0;
+    // Height the key was created at, unknown by default
+    int nBirthHeight = -1;
     if (params.size() > 2) {
-        nRescanHeight = params[2].get_int();
-    }
-    if (nRescanHeight < 0 || nRescanHeight > chainActive.Height()) {
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+        nBirthHeight = ParseStartHeight(params[2]);
     }
 
     string strVKey = params[0].get_str();
@@ -731,38 +828,172 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Currently, only Sprout viewing keys are supported");
     }
     auto vkey = boost::get<libzcash::SproutViewingKey>(viewingkey);
-    auto addr = vkey.address();
 
-    {
-        if (pwalletMain->HaveSproutSpendingKey(addr)) {
-            throw JSONRPCError(RPC_WALLET_ERROR, "The wallet already contains the private key for this viewing key");
-        }
+    if (!ImportSproutViewingKey(pwallet, vkey, nBirthHeight) && fIgnoreExistingKey) {
+        return NullUniValue;
+    }
 
-        // Don't throw error in case a viewing key is already there
-        if (pwalletMain->HaveSproutViewingKey(addr)) {
-            if (fIgnoreExistingKey) {
-                return NullUniValue;
-            }
+    // We want to scan for transactions and notes
+    if (fRescan) {
+        pwallet->ScanForWalletTransactions(chainActive[std::max(nBirthHeight, 0)], true);
+    }
+
+    return NullUniValue;
+}
+
+UniValue z_importkeys(const UniValue& params, bool fHelp)
+{
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "z_importkeys [key,...] ( rescan )\n"
+            "\nAdds transparent private keys, zkeys and viewing keys to your wallet, then rescans once for all\n"
+            "of them, from the lowest height any of the keys added was created at.\n"
+            "\nArguments:\n"
+            "1. keys               (array, required) The keys, each a string or an object\n"
+            "    [\n"
+            "      \"key\"           (string) A private key (see dumpprivkey), zkey (see z_exportkey) or viewing key\n"
+            "                      (see z_exportviewingkey), of unknown age\n"
+            "      or\n"
+            "      {\n"
+            "        \"key\": \"key\",  (string, required) The key\n"
+            "        \"startHeight\": n, (numeric, optional, default=0) Block height the key was created at\n"
+            "        \"label\": \"label\" (string, optional, default=\"\") A label, for transparent private keys\n"
+            "      }\n"
+            "      ,...\n"
+            "    ]\n"
+            "2. rescan             (boolean, optional, default=true) Rescan the wallet for transactions, if any key was added\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"type\": \"type\",       (string) \"transparent\", \"sprout\", \"sapling\" or \"sproutviewing\"\n"
+            "    \"address\": \"addr\",    (string) The address of the key\n"
+            "    \"added\": true|false,  (boolean) Whether the key was new to the wallet\n"
+            "    \"startHeight\": n      (numeric) Block height a rescan for the key starts at\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nNote: This call can take minutes to complete if rescan is true.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_importkeys", "'[\"mykey\", {\"key\": \"myvkey\", \"startHeight\": 30000}]'") +
+            "\nImport without rescan\n"
+            + HelpExampleCli("z_importkeys", "'[\"mykey\"]' false") +
+            "\nAs a JSON-RPC call\n"
+            + HelpExampleRpc("z_importkeys", "[\"mykey\", {\"key\": \"myvkey\", \"startHeight\": 30000}]")
+        );
+
+    LOCK2(cs_main, pwallet->cs_wallet);
+
+    const UniValue& keys = params[0].get_array();
+
+    // Whether to perform rescan after import
+    bool fRescan = true;
+    if (params.size() > 1)
+        fRescan = params[1].get_bool();
+
+    // Decode all the keys first, so that none is added if any is invalid
+    struct CKeyToImport {
+        CKey key;
+        libzcash::SpendingKey spendingkey;
+        libzcash::ViewingKey viewingkey;
+        std::string strLabel;
+        int nBirthHeight;
+    };
+    std::vector<CKeyToImport> vImport(keys.size());
+    bool fPrivate = false;
+    for (size_t i = 0; i < keys.size(); i++) {
+        CKeyToImport& entry = vImport[i];
+        entry.nBirthHeight = -1;
+        std::string strKey;
+        if (keys[i].isStr()) {
+            strKey = keys[i].get_str();
         } else {
-            pwalletMain->MarkDirty();
+            const UniValue& obj = keys[i].get_obj();
+            RPCTypeCheckObj(obj, boost::assign::map_list_of("key", UniValue::VSTR));
+            strKey = find_value(obj, "key").get_str();
+            const UniValue& startHeight = find_value(obj, "startHeight");
+            if (!startHeight.isNull())
+                entry.nBirthHeight = ParseStartHeight(startHeight);
+            const UniValue& label = find_value(obj, "label");
+            if (!label.isNull())
+                entry.strLabel = label.get_str();
+        }
 
-            if (!pwalletMain->AddSproutViewingKey(vkey)) {
-                throw JSONRPCError(RPC_WALLET_ERROR, "Error adding viewing key to wallet");
+        entry.key = DecodeSecret(strKey);
+        if (entry.key.IsValid()) {
+            fPrivate = true;
+            continue;
+        }
+        entry.spendingkey = DecodeSpendingKey(strKey);
+        if (IsValidSpendingKey(entry.spendingkey)) {
+            fPrivate = true;
+            continue;
+        }
+        entry.viewingkey = DecodeViewingKey(strKey);
+        if (!IsValidViewingKey(entry.viewingkey)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, strprintf("Invalid key at index %u", i));
+        }
+        // TODO: Add Sapling support, as in z_importviewingkey.
+        if (boost::get<libzcash::SproutViewingKey>(&entry.viewingkey) == nullptr) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Currently, only Sprout viewing keys are supported");
+        }
+    }
+    if (fPrivate)
+        EnsureWalletIsUnlocked(pwallet);
+
+    UniValue results(UniValue::VARR);
+    int nRescanHeight = -1;
+    for (const CKeyToImport& entry : vImport) {
+        UniValue result(UniValue::VOBJ);
+        bool fAdded;
+        int nKeyRescanHeight = std::max(entry.nBirthHeight, 0);
+        if (entry.key.IsValid()) {
+            result.push_back(Pair("type", "transparent"));
+            result.push_back(Pair("address", EncodeDestination(entry.key.GetPubKey().GetID())));
+            fAdded = ImportKey(pwallet, entry.key, entry.strLabel, entry.nBirthHeight);
+        } else if (IsValidSpendingKey(entry.spendingkey)) {
+            bool fSapling = boost::get<libzcash::SaplingExtendedSpendingKey>(&entry.spendingkey) != nullptr;
+            result.push_back(Pair("type", fSapling ? "sapling" : "sprout"));
+            if (fSapling) {
+                auto sk = boost::get<libzcash::SaplingExtendedSpendingKey>(entry.spendingkey);
+                result.push_back(Pair("address", EncodePaymentAddress(sk.DefaultAddress())));
+            } else {
+                auto sk = boost::get<libzcash::SproutSpendingKey>(entry.spendingkey);
+                result.push_back(Pair("address", EncodePaymentAddress(sk.address())));
             }
+            fAdded = ImportSpendingKey(pwallet, entry.spendingkey, entry.nBirthHeight, nKeyRescanHeight) == KeyAdded;
+            if (fAdded)
+                pwallet->MarkDirty();
+        } else {
+            auto vkey = boost::get<libzcash::SproutViewingKey>(entry.viewingkey);
+            result.push_back(Pair("type", "sproutviewing"));
+            result.push_back(Pair("address", EncodePaymentAddress(vkey.address())));
+            fAdded = ImportSproutViewingKey(pwallet, vkey, entry.nBirthHeight);
         }
+        result.push_back(Pair("added", fAdded));
+        result.push_back(Pair("startHeight", nKeyRescanHeight));
+        results.push_back(result);
 
-        // We want to scan for transactions and notes
-        if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true);
-        }
+        if (fAdded && (nRescanHeight < 0 || nKeyRescanHeight < nRescanHeight))
+            nRescanHeight = nKeyRescanHeight;
     }
 
-    return NullUniValue;
+    // One rescan finds the transactions and notes of all the keys added
+    if (fRescan && nRescanHeight >= 0) {
+        pwallet->ScanForWalletTransactions(chainActive[nRescanHeight], true);
+        pwallet->ReacceptWalletTransactions();
+    }
+
+    return results;
 }
 
 UniValue z_exportkey(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() != 1)
@@ -780,9 +1011,9 @@ UniValue z_exportkey(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_exportkey", "\"myaddress\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    EnsureWalletIsUnlocked();
+    EnsureWalletIsUnlocked(pwallet);
 
     string strAddress = params[0].get_str();
 
@@ -792,7 +1023,7 @@ UniValue z_exportkey(const UniValue& params, bool fHelp)
     }
 
     // Sapling support
-    auto sk = boost::apply_visitor(GetSpendingKeyForPaymentAddress(pwalletMain), address);
+    auto sk = boost::apply_visitor(GetSpendingKeyForPaymentAddress(pwallet), address);
     if (!sk) {
         throw JSONRPCError(RPC_WALLET_ERROR, "Wallet does not hold private zkey for this zaddr");
     }
@@ -801,7 +1032,8 @@ UniValue z_exportkey(const UniValue& params, bool fHelp)
 
 UniValue z_exportviewingkey(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() != 1)
@@ -818,9 +1050,9 @@ UniValue z_exportviewingkey(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_exportviewingkey", "\"myaddress\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    EnsureWalletIsUnlocked();
+    EnsureWalletIsUnlocked(pwallet);
 
     string strAddress = params[0].get_str();
 
@@ -835,9 +1067,9 @@ UniValue z_exportviewingkey(const UniValue& params, bool fHelp)
     auto addr = boost::get<libzcash::SproutPaymentAddress>(address);
 
     libzcash::SproutViewingKey vk;
-    if (!pwalletMain->GetSproutViewingKey(addr, vk)) {
+    if (!pwallet->GetSproutViewingKey(addr, vk)) {
         libzcash::SproutSpendingKey k;
-        if (!pwalletMain->GetSproutSpendingKey(addr, k)) {
+        if (!pwallet->GetSproutSpendingKey(addr, k)) {
             throw JSONRPCError(RPC_WALLET_ERROR, "Wallet does not hold private key or viewing key for this zaddr");
         }
         vk = k.viewing_key();
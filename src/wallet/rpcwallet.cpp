@@ -7,6 +7,7 @@
 #include "amount.h"
 #include "consensus/upgrades.h"
 #include "core_io.h"
+#include "httpserver.h"
 #include "init.h"
 #include "key_io.h"
 #include "main.h"
@@ -19,6 +20,7 @@
 #include "utilmoneystr.h"
 #include "wallet.h"
 #include "walletdb.h"
+#include "wallet/rpcwallet.h"
 #include "primitives/transaction.h"
 #include "zcbenchmarks.h"
 #include "script/interpreter.h"
@@ -27,6 +29,7 @@
 #include "utiltime.h"
 #include "asyncrpcoperation.h"
 #include "asyncrpcqueue.h"
+#include "wallet/asyncrpcoperation_batch.h"
 #include "wallet/asyncrpcoperation_mergetoaddress.h"
 #include "wallet/asyncrpcoperation_sendmany.h"
 #include "wallet/asyncrpcoperation_shieldcoinbase.h"
@@ -50,22 +53,37 @@ const std::string ADDR_TYPE_SAPLING = "sapling";
 
 extern UniValue TxJoinSplitToJSON(const CTransaction& tx);
 
-int64_t nWalletUnlockTime;
 static CCriticalSection cs_nWalletUnlockTime;
 
 // Private method:
 UniValue z_getoperationstatus_IMPL(const UniValue&, bool);
 
-std::string HelpRequiringPassphrase()
+CWallet* GetWalletForJSONRPCRequest()
 {
-    return pwalletMain && pwalletMain->IsCrypted()
+    const std::string strPrefix = "/wallet/";
+    std::string strURI = GetRPCRequestURI();
+    if (strURI.compare(0, strPrefix.size(), strPrefix) != 0)
+        return pwalletMain;
+
+    std::string strName = strURI.substr(strPrefix.size());
+    strName = urlDecode(strName.substr(0, strName.find('?')));
+    for (CWallet* pwallet : vpwallets) {
+        if (pwallet->strWalletFile == strName)
+            return pwallet;
+    }
+    throw JSONRPCError(RPC_WALLET_NOT_FOUND, "Requested wallet does not exist or is not loaded");
+}
+
+std::string HelpRequiringPassphrase(CWallet* const pwallet)
+{
+    return pwallet && pwallet->IsCrypted()
         ? "\nRequires wallet passphrase to be set with walletpassphrase call."
         : "";
 }
 
-bool EnsureWalletIsAvailable(bool avoidException)
+bool EnsureWalletIsAvailable(CWallet* const pwallet, bool avoidException)
 {
-    if (!pwalletMain)
+    if (!pwallet)
     {
         if (!avoidException)
             throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found (disabled)");
@@ -75,12 +93,24 @@ bool EnsureWalletIsAvailable(bool avoidException)
     return true;
 }
 
-void EnsureWalletIsUnlocked()
+void EnsureWalletIsUnlocked(CWallet* const pwallet)
 {
-    if (pwalletMain->IsLocked())
+    if (pwallet->IsLocked())
         throw JSONRPCError(RPC_WALLET_UNLOCK_NEEDED, "Error: Please enter the wallet passphrase with walletpassphrase first.");
 }
 
+/**
+ * Shielded spends are proved against a witness snapshot, without holding
+ * cs_main, so the chain may have moved on by the time they are sent. Check
+ * again that the anchors are in the chain and the notes are unspent.
+ */
+void EnsureShieldedRequirementsMet(const CTransaction& tx)
+{
+    LOCK(cs_main);
+    if (!pcoinsTip->HaveShieldedRequirements(tx))
+        throw JSONRPCError(RPC_WALLET_ERROR, "Error: The notes' anchor has left the best chain or a note was spent while the transaction was being proved. Please try again.");
+}
+
 void WalletTxToJSON(const CWalletTx& wtx, UniValue& entry)
 {
     int confirms = wtx.GetDepthInMainChain();
@@ -118,7 +148,8 @@ string AccountFromValue(const UniValue& value)
 
 UniValue getnewaddress(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() > 1)
@@ -134,31 +165,31 @@ UniValue getnewaddress(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getnewaddress", "")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     // Parse the account first so we don't generate a key if there's an error
     string strAccount;
     if (params.size() > 0)
         strAccount = AccountFromValue(params[0]);
 
-    if (!pwalletMain->IsLocked())
-        pwalletMain->TopUpKeyPool();
+    if (!pwallet->IsLocked())
+        pwallet->TopUpKeyPool();
 
     // Generate a new key that is added to wallet
     CPubKey newKey;
-    if (!pwalletMain->GetKeyFromPool(newKey))
+    if (!pwallet->GetKeyFromPool(newKey))
         throw JSONRPCError(RPC_WALLET_KEYPOOL_RAN_OUT, "Error: Keypool ran out, please call keypoolrefill first");
     CKeyID keyID = newKey.GetID();
 
-    pwalletMain->SetAddressBook(keyID, strAccount, "receive");
+    pwallet->SetAddressBook(keyID, strAccount, "receive");
 
     return EncodeDestination(keyID);
 }
 
 
-CTxDestination GetAccountAddress(std::string strAccount, bool bForceNew=false)
+CTxDestination GetAccountAddress(CWallet* const pwallet, std::string strAccount, bool bForceNew=false)
 {
-    CWalletDB walletdb(pwalletMain->strWalletFile);
+    CWalletDB walletdb(pwallet->strWalletFile);
 
     CAccount account;
     walletdb.ReadAccount(strAccount, account);
@@ -169,8 +200,8 @@ CTxDestination GetAccountAddress(std::string strAccount, bool bForceNew=false)
     if (account.vchPubKey.IsValid())
     {
         CScript scriptPubKey = GetScriptForDestination(account.vchPubKey.GetID());
-        for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin();
-             it != pwalletMain->mapWallet.end() && account.vchPubKey.IsValid();
+        for (map<uint256, CWalletTx>::iterator it = pwallet->mapWallet.begin();
+             it != pwallet->mapWallet.end() && account.vchPubKey.IsValid();
              ++it)
         {
             const CWalletTx& wtx = (*it).second;
@@ -183,10 +214,10 @@ CTxDestination GetAccountAddress(std::string strAccount, bool bForceNew=false)
     // Generate a new key
     if (!account.vchPubKey.IsValid() || bForceNew || bKeyUsed)
     {
-        if (!pwalletMain->GetKeyFromPool(account.vchPubKey))
+        if (!pwallet->GetKeyFromPool(account.vchPubKey))
             throw JSONRPCError(RPC_WALLET_KEYPOOL_RAN_OUT, "Error: Keypool ran out, please call keypoolrefill first");
 
-        pwalletMain->SetAddressBook(account.vchPubKey.GetID(), strAccount, "receive");
+        pwallet->SetAddressBook(account.vchPubKey.GetID(), strAccount, "receive");
         walletdb.WriteAccount(strAccount, account);
     }
 
@@ -195,7 +226,8 @@ CTxDestination GetAccountAddress(std::string strAccount, bool bForceNew=false)
 
 UniValue getaccountaddress(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() != 1)
@@ -213,21 +245,22 @@ UniValue getaccountaddress(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getaccountaddress", "\"myaccount\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     // Parse the account first so we don't generate a key if there's an error
     string strAccount = AccountFromValue(params[0]);
 
     UniValue ret(UniValue::VSTR);
 
-    ret = EncodeDestination(GetAccountAddress(strAccount));
+    ret = EncodeDestination(GetAccountAddress(pwallet, strAccount));
     return ret;
 }
 
 
 UniValue getrawchangeaddress(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() > 1)
@@ -242,12 +275,12 @@ UniValue getrawchangeaddress(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getrawchangeaddress", "")
        );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    if (!pwalletMain->IsLocked())
-        pwalletMain->TopUpKeyPool();
+    if (!pwallet->IsLocked())
+        pwallet->TopUpKeyPool();
 
-    CReserveKey reservekey(pwalletMain);
+    CReserveKey reservekey(pwallet);
     CPubKey vchPubKey;
     if (!reservekey.GetReservedKey(vchPubKey))
         throw JSONRPCError(RPC_WALLET_KEYPOOL_RAN_OUT, "Error: Keypool ran out, please call keypoolrefill first");
@@ -262,7 +295,8 @@ UniValue getrawchangeaddress(const UniValue& params, bool fHelp)
 
 UniValue setaccount(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -277,7 +311,7 @@ UniValue setaccount(const UniValue& params, bool fHelp)
             + HelpExampleRpc("setaccount", "\"t14oHp2v54vfmdgQ3v3SNuQga8JKHTNi2a1\", \"tabby\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     CTxDestination dest = DecodeDestination(params[0].get_str());
     if (!IsValidDestination(dest)) {
@@ -289,15 +323,15 @@ UniValue setaccount(const UniValue& params, bool fHelp)
         strAccount = AccountFromValue(params[1]);
 
     // Only add the account if the address is yours.
-    if (IsMine(*pwalletMain, dest)) { 
+    if (IsMine(*pwallet, dest)) { 
         // Detect when changing the account of an address that is the 'unused current key' of another account:
-        if (pwalletMain->mapAddressBook.count(dest)) {
-            std::string strOldAccount = pwalletMain->mapAddressBook[dest].name;
-            if (dest == GetAccountAddress(strOldAccount)) {
-                GetAccountAddress(strOldAccount, true);
+        if (pwallet->mapAddressBook.count(dest)) {
+            std::string strOldAccount = pwallet->mapAddressBook[dest].name;
+            if (dest == GetAccountAddress(pwallet, strOldAccount)) {
+                GetAccountAddress(pwallet, strOldAccount, true);
             }
         }
-        pwalletMain->SetAddressBook(dest, strAccount, "receive");
+        pwallet->SetAddressBook(dest, strAccount, "receive");
     }
     else
         throw JSONRPCError(RPC_MISC_ERROR, "setaccount can only be used with own address");
@@ -308,7 +342,8 @@ UniValue setaccount(const UniValue& params, bool fHelp)
 
 UniValue getaccount(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() != 1)
@@ -324,7 +359,7 @@ UniValue getaccount(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getaccount", "\"t14oHp2v54vfmdgQ3v3SNuQga8JKHTNi2a1\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     CTxDestination dest = DecodeDestination(params[0].get_str());
     if (!IsValidDestination(dest)) {
@@ -332,8 +367,8 @@ UniValue getaccount(const UniValue& params, bool fHelp)
     }
 
     std::string strAccount;
-    std::map<CTxDestination, CAddressBookData>::iterator mi = pwalletMain->mapAddressBook.find(dest);
-    if (mi != pwalletMain->mapAddressBook.end() && !(*mi).second.name.empty()) {
+    std::map<CTxDestination, CAddressBookData>::iterator mi = pwallet->mapAddressBook.find(dest);
+    if (mi != pwallet->mapAddressBook.end() && !(*mi).second.name.empty()) {
         strAccount = (*mi).second.name;
     }
     return strAccount;
@@ -342,7 +377,8 @@ UniValue getaccount(const UniValue& params, bool fHelp)
 
 UniValue getaddressesbyaccount(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() != 1)
@@ -361,13 +397,13 @@ UniValue getaddressesbyaccount(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getaddressesbyaccount", "\"tabby\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     string strAccount = AccountFromValue(params[0]);
 
     // Find all addresses that have the given account
     UniValue ret(UniValue::VARR);
-    for (const std::pair<CTxDestination, CAddressBookData>& item : pwalletMain->mapAddressBook) {
+    for (const std::pair<CTxDestination, CAddressBookData>& item : pwallet->mapAddressBook) {
         const CTxDestination& dest = item.first;
         const std::string& strName = item.second.name;
         if (strName == strAccount) {
@@ -377,9 +413,9 @@ UniValue getaddressesbyaccount(const UniValue& params, bool fHelp)
     return ret;
 }
 
-static void SendMoney(const CTxDestination &address, CAmount nValue, bool fSubtractFeeFromAmount, CWalletTx& wtxNew)
+static void SendMoney(CWallet* const pwallet, const CTxDestination &address, CAmount nValue, bool fSubtractFeeFromAmount, CWalletTx& wtxNew)
 {
-    CAmount curBalance = pwalletMain->GetBalance();
+    CAmount curBalance = pwallet->GetBalance();
 
     // Check amount
     if (nValue <= 0)
@@ -392,32 +428,33 @@ static void SendMoney(const CTxDestination &address, CAmount nValue, bool fSubtr
     CScript scriptPubKey = GetScriptForDestination(address);
 
     // Create and send the transaction
-    CReserveKey reservekey(pwalletMain);
+    CReserveKey reservekey(pwallet);
     CAmount nFeeRequired;
     std::string strError;
     vector<CRecipient> vecSend;
     int nChangePosRet = -1;
     CRecipient recipient = {scriptPubKey, nValue, fSubtractFeeFromAmount};
     vecSend.push_back(recipient);
-    if (!pwalletMain->CreateTransaction(vecSend, wtxNew, reservekey, nFeeRequired, nChangePosRet, strError)) {
-        if (!fSubtractFeeFromAmount && nValue + nFeeRequired > pwalletMain->GetBalance())
+    if (!pwallet->CreateTransaction(vecSend, wtxNew, reservekey, nFeeRequired, nChangePosRet, strError)) {
+        if (!fSubtractFeeFromAmount && nValue + nFeeRequired > pwallet->GetBalance())
             strError = strprintf("Error: This transaction requires a transaction fee of at least %s because of its amount, complexity, or use of recently received funds!", FormatMoney(nFeeRequired));
         throw JSONRPCError(RPC_WALLET_ERROR, strError);
     }
-    if (!pwalletMain->CommitTransaction(wtxNew, reservekey))
+    if (!pwallet->CommitTransaction(wtxNew, reservekey))
         throw JSONRPCError(RPC_WALLET_ERROR, "Error: The transaction was rejected! This might happen if some of the coins in your wallet were already spent, such as if you used a copy of wallet.dat and coins were spent in the copy but not marked as spent here.");
 }
 
 UniValue sendtoaddress(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() < 2 || params.size() > 5)
         throw runtime_error(
             "sendtoaddress \"litecoinzaddress\" amount ( \"comment\" \"comment-to\" subtractfeefromamount )\n"
             "\nSend an amount to a given address. The amount is a real and is rounded to the nearest 0.00000001\n"
-            + HelpRequiringPassphrase() +
+            + HelpRequiringPassphrase(pwallet) +
             "\nArguments:\n"
             "1. \"litecoinzaddress\"  (string, required) The LitecoinZ address to send to.\n"
             "2. \"amount\"      (numeric, required) The amount in " + CURRENCY_UNIT + " to send. eg 0.1\n"
@@ -437,7 +474,7 @@ UniValue sendtoaddress(const UniValue& params, bool fHelp)
             + HelpExampleRpc("sendtoaddress", "\"t1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd\", 0.1, \"donation\", \"seans outpost\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     CTxDestination dest = DecodeDestination(params[0].get_str());
     if (!IsValidDestination(dest)) {
@@ -460,16 +497,17 @@ UniValue sendtoaddress(const UniValue& params, bool fHelp)
     if (params.size() > 4)
         fSubtractFeeFromAmount = params[4].get_bool();
 
-    EnsureWalletIsUnlocked();
+    EnsureWalletIsUnlocked(pwallet);
 
-    SendMoney(dest, nAmount, fSubtractFeeFromAmount, wtx);
+    SendMoney(pwallet, dest, nAmount, fSubtractFeeFromAmount, wtx);
 
     return wtx.GetHash().GetHex();
 }
 
 UniValue listaddressgroupings(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp)
@@ -495,11 +533,11 @@ UniValue listaddressgroupings(const UniValue& params, bool fHelp)
             + HelpExampleRpc("listaddressgroupings", "")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     UniValue jsonGroupings(UniValue::VARR);
-    std::map<CTxDestination, CAmount> balances = pwalletMain->GetAddressBalances();
-    for (const std::set<CTxDestination>& grouping : pwalletMain->GetAddressGroupings()) {
+    std::map<CTxDestination, CAmount> balances = pwallet->GetAddressBalances();
+    for (const std::set<CTxDestination>& grouping : pwallet->GetAddressGroupings()) {
         UniValue jsonGrouping(UniValue::VARR);
         for (const CTxDestination& address : grouping)
         {
@@ -507,8 +545,8 @@ UniValue listaddressgroupings(const UniValue& params, bool fHelp)
             addressInfo.push_back(EncodeDestination(address));
             addressInfo.push_back(ValueFromAmount(balances[address]));
             {
-                if (pwalletMain->mapAddressBook.find(address) != pwalletMain->mapAddressBook.end()) {
-                    addressInfo.push_back(pwalletMain->mapAddressBook.find(address)->second.name);
+                if (pwallet->mapAddressBook.find(address) != pwallet->mapAddressBook.end()) {
+                    addressInfo.push_back(pwallet->mapAddressBook.find(address)->second.name);
                 }
             }
             jsonGrouping.push_back(addressInfo);
@@ -520,14 +558,15 @@ UniValue listaddressgroupings(const UniValue& params, bool fHelp)
 
 UniValue signmessage(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() != 2)
         throw runtime_error(
             "signmessage \"t-addr\" \"message\"\n"
             "\nSign a message with the private key of a t-addr"
-            + HelpRequiringPassphrase() + "\n"
+            + HelpRequiringPassphrase(pwallet) + "\n"
             "\nArguments:\n"
             "1. \"t-addr\"  (string, required) The transparent address to use for the private key.\n"
             "2. \"message\"         (string, required) The message to create a signature of.\n"
@@ -544,9 +583,9 @@ UniValue signmessage(const UniValue& params, bool fHelp)
             + HelpExampleRpc("signmessage", "\"t14oHp2v54vfmdgQ3v3SNuQga8JKHTNi2a1\", \"my message\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    EnsureWalletIsUnlocked();
+    EnsureWalletIsUnlocked(pwallet);
 
     string strAddress = params[0].get_str();
     string strMessage = params[1].get_str();
@@ -562,7 +601,7 @@ UniValue signmessage(const UniValue& params, bool fHelp)
     }
 
     CKey key;
-    if (!pwalletMain->GetKey(*keyID, key)) {
+    if (!pwallet->GetKey(*keyID, key)) {
         throw JSONRPCError(RPC_WALLET_ERROR, "Private key not available");
     }
 
@@ -579,7 +618,8 @@ UniValue signmessage(const UniValue& params, bool fHelp)
 
 UniValue getreceivedbyaddress(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -602,7 +642,7 @@ UniValue getreceivedbyaddress(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getreceivedbyaddress", "\"t14oHp2v54vfmdgQ3v3SNuQga8JKHTNi2a1\", 6")
        );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     // Bitcoin address
     CTxDestination dest = DecodeDestination(params[0].get_str());
@@ -610,7 +650,7 @@ UniValue getreceivedbyaddress(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid LitecoinZ address");
     }
     CScript scriptPubKey = GetScriptForDestination(dest);
-    if (!IsMine(*pwalletMain, scriptPubKey)) {
+    if (!IsMine(*pwallet, scriptPubKey)) {
         return ValueFromAmount(0);
     }
 
@@ -621,7 +661,7 @@ UniValue getreceivedbyaddress(const UniValue& params, bool fHelp)
 
     // Tally
     CAmount nAmount = 0;
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+    for (map<uint256, CWalletTx>::iterator it = pwallet->mapWallet.begin(); it != pwallet->mapWallet.end(); ++it)
     {
         const CWalletTx& wtx = (*it).second;
         if (wtx.IsCoinBase() || !CheckFinalTx(wtx))
@@ -639,7 +679,8 @@ UniValue getreceivedbyaddress(const UniValue& params, bool fHelp)
 
 UniValue getreceivedbyaccount(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -662,7 +703,7 @@ UniValue getreceivedbyaccount(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getreceivedbyaccount", "\"tabby\", 6")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     // Minimum confirmations
     int nMinDepth = 1;
@@ -671,11 +712,11 @@ UniValue getreceivedbyaccount(const UniValue& params, bool fHelp)
 
     // Get the set of pub keys assigned to account
     string strAccount = AccountFromValue(params[0]);
-    set<CTxDestination> setAddress = pwalletMain->GetAccountAddresses(strAccount);
+    set<CTxDestination> setAddress = pwallet->GetAccountAddresses(strAccount);
 
     // Tally
     CAmount nAmount = 0;
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+    for (map<uint256, CWalletTx>::iterator it = pwallet->mapWallet.begin(); it != pwallet->mapWallet.end(); ++it)
     {
         const CWalletTx& wtx = (*it).second;
         if (wtx.IsCoinBase() || !CheckFinalTx(wtx))
@@ -684,7 +725,7 @@ UniValue getreceivedbyaccount(const UniValue& params, bool fHelp)
         BOOST_FOREACH(const CTxOut& txout, wtx.vout)
         {
             CTxDestination address;
-            if (ExtractDestination(txout.scriptPubKey, address) && IsMine(*pwalletMain, address) && setAddress.count(address))
+            if (ExtractDestination(txout.scriptPubKey, address) && IsMine(*pwallet, address) && setAddress.count(address))
                 if (wtx.GetDepthInMainChain() >= nMinDepth)
                     nAmount += txout.nValue;
         }
@@ -694,12 +735,12 @@ UniValue getreceivedbyaccount(const UniValue& params, bool fHelp)
 }
 
 
-CAmount GetAccountBalance(CWalletDB& walletdb, const string& strAccount, int nMinDepth, const isminefilter& filter)
+CAmount GetAccountBalance(CWallet* const pwallet, CWalletDB& walletdb, const string& strAccount, int nMinDepth, const isminefilter& filter)
 {
     CAmount nBalance = 0;
 
     // Tally wallet transactions
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+    for (map<uint256, CWalletTx>::iterator it = pwallet->mapWallet.begin(); it != pwallet->mapWallet.end(); ++it)
     {
         const CWalletTx& wtx = (*it).second;
         if (!CheckFinalTx(wtx) || wtx.GetBlocksToMaturity() > 0 || wtx.GetDepthInMainChain() < 0)
@@ -719,16 +760,17 @@ CAmount GetAccountBalance(CWalletDB& walletdb, const string& strAccount, int nMi
     return nBalance;
 }
 
-CAmount GetAccountBalance(const string& strAccount, int nMinDepth, const isminefilter& filter)
+CAmount GetAccountBalance(CWallet* const pwallet, const string& strAccount, int nMinDepth, const isminefilter& filter)
 {
-    CWalletDB walletdb(pwalletMain->strWalletFile);
-    return GetAccountBalance(walletdb, strAccount, nMinDepth, filter);
+    CWalletDB walletdb(pwallet->strWalletFile);
+    return GetAccountBalance(pwallet, walletdb, strAccount, nMinDepth, filter);
 }
 
 
 UniValue getbalance(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() > 3)
@@ -750,10 +792,10 @@ UniValue getbalance(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getbalance", "\"*\", 6")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     if (params.size() == 0)
-        return  ValueFromAmount(pwalletMain->GetBalance());
+        return  ValueFromAmount(pwallet->GetBalance());
 
     int nMinDepth = 1;
     if (params.size() > 1)
@@ -768,7 +810,7 @@ UniValue getbalance(const UniValue& params, bool fHelp)
         // (GetBalance() sums up all unspent TxOuts)
         // getbalance and "getbalance * 1 true" should return the same number
         CAmount nBalance = 0;
-        for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+        for (map<uint256, CWalletTx>::iterator it = pwallet->mapWallet.begin(); it != pwallet->mapWallet.end(); ++it)
         {
             const CWalletTx& wtx = (*it).second;
             if (!CheckFinalTx(wtx) || wtx.GetBlocksToMaturity() > 0 || wtx.GetDepthInMainChain() < 0)
@@ -793,14 +835,15 @@ UniValue getbalance(const UniValue& params, bool fHelp)
 
     string strAccount = AccountFromValue(params[0]);
 
-    CAmount nBalance = GetAccountBalance(strAccount, nMinDepth, filter);
+    CAmount nBalance = GetAccountBalance(pwallet, strAccount, nMinDepth, filter);
 
     return ValueFromAmount(nBalance);
 }
 
 UniValue getunconfirmedbalance(const UniValue &params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() > 0)
@@ -808,15 +851,16 @@ UniValue getunconfirmedbalance(const UniValue &params, bool fHelp)
                 "getunconfirmedbalance\n"
                 "Returns the server's total unconfirmed balance\n");
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    return ValueFromAmount(pwalletMain->GetUnconfirmedBalance());
+    return ValueFromAmount(pwallet->GetUnconfirmedBalance());
 }
 
 
 UniValue movecmd(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() < 3 || params.size() > 5)
@@ -840,7 +884,7 @@ UniValue movecmd(const UniValue& params, bool fHelp)
             + HelpExampleRpc("move", "\"timotei\", \"akiko\", 0.01, 6, \"happy birthday!\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     string strFrom = AccountFromValue(params[0]);
     string strTo = AccountFromValue(params[1]);
@@ -854,7 +898,7 @@ UniValue movecmd(const UniValue& params, bool fHelp)
     if (params.size() > 4)
         strComment = params[4].get_str();
 
-    CWalletDB walletdb(pwalletMain->strWalletFile);
+    CWalletDB walletdb(pwallet->strWalletFile);
     if (!walletdb.TxnBegin())
         throw JSONRPCError(RPC_DATABASE_ERROR, "database error");
 
@@ -862,23 +906,23 @@ UniValue movecmd(const UniValue& params, bool fHelp)
 
     // Debit
     CAccountingEntry debit;
-    debit.nOrderPos = pwalletMain->IncOrderPosNext(&walletdb);
+    debit.nOrderPos = pwallet->IncOrderPosNext(&walletdb);
     debit.strAccount = strFrom;
     debit.nCreditDebit = -nAmount;
     debit.nTime = nNow;
     debit.strOtherAccount = strTo;
     debit.strComment = strComment;
-    walletdb.WriteAccountingEntry(debit);
+    pwallet->AddAccountingEntry(debit, walletdb);
 
     // Credit
     CAccountingEntry credit;
-    credit.nOrderPos = pwalletMain->IncOrderPosNext(&walletdb);
+    credit.nOrderPos = pwallet->IncOrderPosNext(&walletdb);
     credit.strAccount = strTo;
     credit.nCreditDebit = nAmount;
     credit.nTime = nNow;
     credit.strOtherAccount = strFrom;
     credit.strComment = strComment;
-    walletdb.WriteAccountingEntry(credit);
+    pwallet->AddAccountingEntry(credit, walletdb);
 
     if (!walletdb.TxnCommit())
         throw JSONRPCError(RPC_DATABASE_ERROR, "database error");
@@ -889,7 +933,8 @@ UniValue movecmd(const UniValue& params, bool fHelp)
 
 UniValue sendfrom(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() < 3 || params.size() > 6)
@@ -897,7 +942,7 @@ UniValue sendfrom(const UniValue& params, bool fHelp)
             "sendfrom \"fromaccount\" \"tolitecoinzaddress\" amount ( minconf \"comment\" \"comment-to\" )\n"
             "\nDEPRECATED (use sendtoaddress). Sent an amount from an account to a LitecoinZ address.\n"
             "The amount is a real and is rounded to the nearest 0.00000001."
-            + HelpRequiringPassphrase() + "\n"
+            + HelpRequiringPassphrase(pwallet) + "\n"
             "\nArguments:\n"
             "1. \"fromaccount\"       (string, required) MUST be set to the empty string \"\" to represent the default account. Passing any other string will result in an error.\n"
             "2. \"tolitecoinzaddress\"  (string, required) The LitecoinZ address to send funds to.\n"
@@ -919,7 +964,7 @@ UniValue sendfrom(const UniValue& params, bool fHelp)
             + HelpExampleRpc("sendfrom", "\"tabby\", \"t1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd\", 0.01, 6, \"donation\", \"seans outpost\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     std::string strAccount = AccountFromValue(params[0]);
     CTxDestination dest = DecodeDestination(params[1].get_str());
@@ -940,14 +985,14 @@ UniValue sendfrom(const UniValue& params, bool fHelp)
     if (params.size() > 5 && !params[5].isNull() && !params[5].get_str().empty())
         wtx.mapValue["to"]      = params[5].get_str();
 
-    EnsureWalletIsUnlocked();
+    EnsureWalletIsUnlocked(pwallet);
 
     // Check funds
-    CAmount nBalance = GetAccountBalance(strAccount, nMinDepth, ISMINE_SPENDABLE);
+    CAmount nBalance = GetAccountBalance(pwallet, strAccount, nMinDepth, ISMINE_SPENDABLE);
     if (nAmount > nBalance)
         throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Account has insufficient funds");
 
-    SendMoney(dest, nAmount, false, wtx);
+    SendMoney(pwallet, dest, nAmount, false, wtx);
 
     return wtx.GetHash().GetHex();
 }
@@ -955,14 +1000,15 @@ UniValue sendfrom(const UniValue& params, bool fHelp)
 
 UniValue sendmany(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() < 2 || params.size() > 5)
         throw runtime_error(
             "sendmany \"fromaccount\" {\"address\":amount,...} ( minconf \"comment\" [\"address\",...] )\n"
             "\nSend multiple times. Amounts are decimal numbers with at most 8 digits of precision."
-            + HelpRequiringPassphrase() + "\n"
+            + HelpRequiringPassphrase(pwallet) + "\n"
             "\nArguments:\n"
             "1. \"fromaccount\"         (string, required) MUST be set to the empty string \"\" to represent the default account. Passing any other string will result in an error.\n"
             "2. \"amounts\"             (string, required) A json object with addresses and amounts\n"
@@ -994,7 +1040,7 @@ UniValue sendmany(const UniValue& params, bool fHelp)
             + HelpExampleRpc("sendmany", "\"\", \"{\\\"t14oHp2v54vfmdgQ3v3SNuQga8JKHTNi2a1\\\":0.01,\\\"t1353tsE8YMTA4EuV7dgUXGjNFf9KpVvKHz\\\":0.02}\", 6, \"testing\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     string strAccount = AccountFromValue(params[0]);
     UniValue sendTo = params[1].get_obj();
@@ -1044,33 +1090,34 @@ UniValue sendmany(const UniValue& params, bool fHelp)
         vecSend.push_back(recipient);
     }
 
-    EnsureWalletIsUnlocked();
+    EnsureWalletIsUnlocked(pwallet);
 
     // Check funds
-    CAmount nBalance = GetAccountBalance(strAccount, nMinDepth, ISMINE_SPENDABLE);
+    CAmount nBalance = GetAccountBalance(pwallet, strAccount, nMinDepth, ISMINE_SPENDABLE);
     if (totalAmount > nBalance)
         throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Account has insufficient funds");
 
     // Send
-    CReserveKey keyChange(pwalletMain);
+    CReserveKey keyChange(pwallet);
     CAmount nFeeRequired = 0;
     int nChangePosRet = -1;
     string strFailReason;
-    bool fCreated = pwalletMain->CreateTransaction(vecSend, wtx, keyChange, nFeeRequired, nChangePosRet, strFailReason);
+    bool fCreated = pwallet->CreateTransaction(vecSend, wtx, keyChange, nFeeRequired, nChangePosRet, strFailReason);
     if (!fCreated)
         throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, strFailReason);
-    if (!pwalletMain->CommitTransaction(wtx, keyChange))
+    if (!pwallet->CommitTransaction(wtx, keyChange))
         throw JSONRPCError(RPC_WALLET_ERROR, "Transaction commit failed");
 
     return wtx.GetHash().GetHex();
 }
 
 // Defined in rpc/misc.cpp
-extern CScript _createmultisig_redeemScript(const UniValue& params);
+extern CScript _createmultisig_redeemScript(CWallet * const pwallet, const UniValue& params);
 
 UniValue addmultisigaddress(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -1101,18 +1148,18 @@ UniValue addmultisigaddress(const UniValue& params, bool fHelp)
         throw runtime_error(msg);
     }
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     string strAccount;
     if (params.size() > 2)
         strAccount = AccountFromValue(params[2]);
 
     // Construct using pay-to-script-hash:
-    CScript inner = _createmultisig_redeemScript(params);
+    CScript inner = _createmultisig_redeemScript(pwallet, params);
     CScriptID innerID(inner);
-    pwalletMain->AddCScript(inner);
+    pwallet->AddCScript(inner);
 
-    pwalletMain->SetAddressBook(innerID, strAccount, "send");
+    pwallet->SetAddressBook(innerID, strAccount, "send");
     return EncodeDestination(innerID);
 }
 
@@ -1131,7 +1178,7 @@ struct tallyitem
     }
 };
 
-UniValue ListReceived(const UniValue& params, bool fByAccounts)
+UniValue ListReceived(CWallet* const pwallet, const UniValue& params, bool fByAccounts)
 {
     // Minimum confirmations
     int nMinDepth = 1;
@@ -1150,7 +1197,7 @@ UniValue ListReceived(const UniValue& params, bool fByAccounts)
 
     // Tally
     std::map<CTxDestination, tallyitem> mapTally;
-    for (const std::pair<uint256, CWalletTx>& pairWtx : pwalletMain->mapWallet) {
+    for (const std::pair<uint256, CWalletTx>& pairWtx : pwallet->mapWallet) {
         const CWalletTx& wtx = pairWtx.second;
 
         if (wtx.IsCoinBase() || !CheckFinalTx(wtx))
@@ -1166,7 +1213,7 @@ UniValue ListReceived(const UniValue& params, bool fByAccounts)
             if (!ExtractDestination(txout.scriptPubKey, address))
                 continue;
 
-            isminefilter mine = IsMine(*pwalletMain, address);
+            isminefilter mine = IsMine(*pwallet, address);
             if(!(mine & filter))
                 continue;
 
@@ -1182,7 +1229,7 @@ UniValue ListReceived(const UniValue& params, bool fByAccounts)
     // Reply
     UniValue ret(UniValue::VARR);
     std::map<std::string, tallyitem> mapAccountTally;
-    for (const std::pair<CTxDestination, CAddressBookData>& item : pwalletMain->mapAddressBook) {
+    for (const std::pair<CTxDestination, CAddressBookData>& item : pwallet->mapAddressBook) {
         const CTxDestination& dest = item.first;
         const std::string& strAccount = item.second.name;
         std::map<CTxDestination, tallyitem>::iterator it = mapTally.find(dest);
@@ -1249,7 +1296,8 @@ UniValue ListReceived(const UniValue& params, bool fByAccounts)
 
 UniValue listreceivedbyaddress(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() > 3)
@@ -1279,14 +1327,15 @@ UniValue listreceivedbyaddress(const UniValue& params, bool fHelp)
             + HelpExampleRpc("listreceivedbyaddress", "6, true, true")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    return ListReceived(params, false);
+    return ListReceived(pwallet, params, false);
 }
 
 UniValue listreceivedbyaccount(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() > 3)
@@ -1315,9 +1364,9 @@ UniValue listreceivedbyaccount(const UniValue& params, bool fHelp)
             + HelpExampleRpc("listreceivedbyaccount", "6, true, true")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    return ListReceived(params, true);
+    return ListReceived(pwallet, params, true);
 }
 
 static void MaybePushAddress(UniValue & entry, const CTxDestination &dest)
@@ -1327,7 +1376,7 @@ static void MaybePushAddress(UniValue & entry, const CTxDestination &dest)
     }
 }
 
-void ListTransactions(const CWalletTx& wtx, const string& strAccount, int nMinDepth, bool fLong, UniValue& ret, const isminefilter& filter)
+void ListTransactions(CWallet* const pwallet, const CWalletTx& wtx, const string& strAccount, int nMinDepth, bool fLong, UniValue& ret, const isminefilter& filter)
 {
     CAmount nFee;
     string strSentAccount;
@@ -1345,7 +1394,7 @@ void ListTransactions(const CWalletTx& wtx, const string& strAccount, int nMinDe
         BOOST_FOREACH(const COutputEntry& s, listSent)
         {
             UniValue entry(UniValue::VOBJ);
-            if(involvesWatchonly || (::IsMine(*pwalletMain, s.destination) & ISMINE_WATCH_ONLY))
+            if(involvesWatchonly || (::IsMine(*pwallet, s.destination) & ISMINE_WATCH_ONLY))
                 entry.push_back(Pair("involvesWatchonly", true));
             entry.push_back(Pair("account", strSentAccount));
             MaybePushAddress(entry, s.destination);
@@ -1366,12 +1415,12 @@ void ListTransactions(const CWalletTx& wtx, const string& strAccount, int nMinDe
         BOOST_FOREACH(const COutputEntry& r, listReceived)
         {
             string account;
-            if (pwalletMain->mapAddressBook.count(r.destination))
-                account = pwalletMain->mapAddressBook[r.destination].name;
+            if (pwallet->mapAddressBook.count(r.destination))
+                account = pwallet->mapAddressBook[r.destination].name;
             if (fAllAccounts || (account == strAccount))
             {
                 UniValue entry(UniValue::VOBJ);
-                if(involvesWatchonly || (::IsMine(*pwalletMain, r.destination) & ISMINE_WATCH_ONLY))
+                if(involvesWatchonly || (::IsMine(*pwallet, r.destination) & ISMINE_WATCH_ONLY))
                     entry.push_back(Pair("involvesWatchonly", true));
                 entry.push_back(Pair("account", account));
                 MaybePushAddress(entry, r.destination);
@@ -1418,7 +1467,8 @@ void AcentryToJSON(const CAccountingEntry& acentry, const string& strAccount, Un
 
 UniValue listtransactions(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() > 4)
@@ -1474,7 +1524,7 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
             + HelpExampleRpc("listtransactions", "\"*\", 20, 100")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     string strAccount = "*";
     if (params.size() > 0)
@@ -1497,15 +1547,14 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
 
     UniValue ret(UniValue::VARR);
 
-    std::list<CAccountingEntry> acentries;
-    CWallet::TxItems txOrdered = pwalletMain->OrderedTxItems(acentries, strAccount);
+    const CWallet::TxItems& txOrdered = pwallet->wtxOrdered;
 
     // iterate backwards until we have nCount items to return:
-    for (CWallet::TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+    for (CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
     {
         CWalletTx *const pwtx = (*it).second.first;
         if (pwtx != 0)
-            ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
+            ListTransactions(pwallet, *pwtx, strAccount, 0, true, ret, filter);
         CAccountingEntry *const pacentry = (*it).second.second;
         if (pacentry != 0)
             AcentryToJSON(*pacentry, strAccount, ret);
@@ -1540,7 +1589,8 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
 
 UniValue listaccounts(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() > 2)
@@ -1566,7 +1616,7 @@ UniValue listaccounts(const UniValue& params, bool fHelp)
             + HelpExampleRpc("listaccounts", "6")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     int nMinDepth = 1;
     if (params.size() > 0)
@@ -1577,12 +1627,12 @@ UniValue listaccounts(const UniValue& params, bool fHelp)
             includeWatchonly = includeWatchonly | ISMINE_WATCH_ONLY;
 
     map<string, CAmount> mapAccountBalances;
-    BOOST_FOREACH(const PAIRTYPE(CTxDestination, CAddressBookData)& entry, pwalletMain->mapAddressBook) {
-        if (IsMine(*pwalletMain, entry.first) & includeWatchonly) // This address belongs to me
+    BOOST_FOREACH(const PAIRTYPE(CTxDestination, CAddressBookData)& entry, pwallet->mapAddressBook) {
+        if (IsMine(*pwallet, entry.first) & includeWatchonly) // This address belongs to me
             mapAccountBalances[entry.second.name] = 0;
     }
 
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+    for (map<uint256, CWalletTx>::iterator it = pwallet->mapWallet.begin(); it != pwallet->mapWallet.end(); ++it)
     {
         const CWalletTx& wtx = (*it).second;
         CAmount nFee;
@@ -1599,15 +1649,15 @@ UniValue listaccounts(const UniValue& params, bool fHelp)
         if (nDepth >= nMinDepth)
         {
             BOOST_FOREACH(const COutputEntry& r, listReceived)
-                if (pwalletMain->mapAddressBook.count(r.destination))
-                    mapAccountBalances[pwalletMain->mapAddressBook[r.destination].name] += r.amount;
+                if (pwallet->mapAddressBook.count(r.destination))
+                    mapAccountBalances[pwallet->mapAddressBook[r.destination].name] += r.amount;
                 else
                     mapAccountBalances[""] += r.amount;
         }
     }
 
     list<CAccountingEntry> acentries;
-    CWalletDB(pwalletMain->strWalletFile).ListAccountCreditDebit("*", acentries);
+    CWalletDB(pwallet->strWalletFile).ListAccountCreditDebit("*", acentries);
     BOOST_FOREACH(const CAccountingEntry& entry, acentries)
         mapAccountBalances[entry.strAccount] += entry.nCreditDebit;
 
@@ -1620,7 +1670,8 @@ UniValue listaccounts(const UniValue& params, bool fHelp)
 
 UniValue listsinceblock(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp)
@@ -1659,7 +1710,7 @@ UniValue listsinceblock(const UniValue& params, bool fHelp)
             + HelpExampleRpc("listsinceblock", "\"000000000000000bacf66f7497b7dc45ef753ee9a7d38571037cdb1a57f663ad\", 6")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     CBlockIndex *pindex = NULL;
     int target_confirms = 1;
@@ -1691,12 +1742,12 @@ UniValue listsinceblock(const UniValue& params, bool fHelp)
 
     UniValue transactions(UniValue::VARR);
 
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
+    for (map<uint256, CWalletTx>::iterator it = pwallet->mapWallet.begin(); it != pwallet->mapWallet.end(); it++)
     {
         CWalletTx tx = (*it).second;
 
         if (depth == -1 || tx.GetDepthInMainChain() < depth)
-            ListTransactions(tx, "*", 0, true, transactions, filter);
+            ListTransactions(pwallet, tx, "*", 0, true, transactions, filter);
     }
 
     CBlockIndex *pblockLast = chainActive[chainActive.Height() + 1 - target_confirms];
@@ -1711,7 +1762,8 @@ UniValue listsinceblock(const UniValue& params, bool fHelp)
 
 UniValue gettransaction(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -1761,7 +1813,7 @@ UniValue gettransaction(const UniValue& params, bool fHelp)
             + HelpExampleRpc("gettransaction", "\"1075db55d416d3ca199f55b6084e2115b9345e16c5cf302fc80e9d5fbf5d48d\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     uint256 hash;
     hash.SetHex(params[0].get_str());
@@ -1772,9 +1824,9 @@ UniValue gettransaction(const UniValue& params, bool fHelp)
             filter = filter | ISMINE_WATCH_ONLY;
 
     UniValue entry(UniValue::VOBJ);
-    if (!pwalletMain->mapWallet.count(hash))
+    if (!pwallet->mapWallet.count(hash))
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid or non-wallet transaction id");
-    const CWalletTx& wtx = pwalletMain->mapWallet[hash];
+    const CWalletTx& wtx = pwallet->mapWallet[hash];
 
     CAmount nCredit = wtx.GetCredit(filter);
     CAmount nDebit = wtx.GetDebit(filter);
@@ -1788,11 +1840,13 @@ UniValue gettransaction(const UniValue& params, bool fHelp)
     WalletTxToJSON(wtx, entry);
 
     UniValue details(UniValue::VARR);
-    ListTransactions(wtx, "*", 0, false, details, filter);
+    ListTransactions(pwallet, wtx, "*", 0, false, details, filter);
     entry.push_back(Pair("details", details));
 
-    string strHex = EncodeHexTx(static_cast<CTransaction>(wtx));
-    entry.push_back(Pair("hex", strHex));
+    CTransaction tx;
+    if (!wtx.GetFullTransaction(tx))
+        throw JSONRPCError(RPC_WALLET_ERROR, "Can't read the transaction from its block (see -walletcompacttx)");
+    entry.push_back(Pair("hex", EncodeHexTx(tx)));
 
     return entry;
 }
@@ -1800,7 +1854,8 @@ UniValue gettransaction(const UniValue& params, bool fHelp)
 
 UniValue backupwallet(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() != 1)
@@ -1816,7 +1871,7 @@ UniValue backupwallet(const UniValue& params, bool fHelp)
             + HelpExampleRpc("backupwallet", "\"backupdata\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     boost::filesystem::path exportdir;
     try {
@@ -1834,7 +1889,7 @@ UniValue backupwallet(const UniValue& params, bool fHelp)
     }
     boost::filesystem::path exportfilepath = exportdir / clean;
 
-    if (!BackupWallet(*pwalletMain, exportfilepath.string()))
+    if (!BackupWallet(*pwallet, exportfilepath.string()))
         throw JSONRPCError(RPC_WALLET_ERROR, "Error: Wallet backup failed!");
 
     return exportfilepath.string();
@@ -1843,14 +1898,15 @@ UniValue backupwallet(const UniValue& params, bool fHelp)
 
 UniValue keypoolrefill(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() > 1)
         throw runtime_error(
             "keypoolrefill ( newsize )\n"
             "\nFills the keypool."
-            + HelpRequiringPassphrase() + "\n"
+            + HelpRequiringPassphrase(pwallet) + "\n"
             "\nArguments\n"
             "1. newsize     (numeric, optional, default=100) The new keypool size\n"
             "\nExamples:\n"
@@ -1858,7 +1914,7 @@ UniValue keypoolrefill(const UniValue& params, bool fHelp)
             + HelpExampleRpc("keypoolrefill", "")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     // 0 is interpreted by TopUpKeyPool() as the default keypool size given by -keypool
     unsigned int kpSize = 0;
@@ -1868,10 +1924,10 @@ UniValue keypoolrefill(const UniValue& params, bool fHelp)
         kpSize = (unsigned int)params[0].get_int();
     }
 
-    EnsureWalletIsUnlocked();
-    pwalletMain->TopUpKeyPool(kpSize);
+    EnsureWalletIsUnlocked(pwallet);
+    pwallet->TopUpKeyPool(kpSize);
 
-    if (pwalletMain->GetKeyPoolSize() < kpSize)
+    if (pwallet->GetKeyPoolSize() < kpSize)
         throw JSONRPCError(RPC_WALLET_ERROR, "Error refreshing keypool.");
 
     return NullUniValue;
@@ -1881,16 +1937,17 @@ UniValue keypoolrefill(const UniValue& params, bool fHelp)
 static void LockWallet(CWallet* pWallet)
 {
     LOCK(cs_nWalletUnlockTime);
-    nWalletUnlockTime = 0;
+    pWallet->nRelockTime = 0;
     pWallet->Lock();
 }
 
 UniValue walletpassphrase(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
-    if (pwalletMain->IsCrypted() && (fHelp || params.size() != 2))
+    if (pwallet->IsCrypted() && (fHelp || params.size() != 2))
         throw runtime_error(
             "walletpassphrase \"passphrase\" timeout\n"
             "\nStores the wallet decryption key in memory for 'timeout' seconds.\n"
@@ -1910,11 +1967,11 @@ UniValue walletpassphrase(const UniValue& params, bool fHelp)
             + HelpExampleRpc("walletpassphrase", "\"my pass phrase\", 60")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     if (fHelp)
         return true;
-    if (!pwalletMain->IsCrypted())
+    if (!pwallet->IsCrypted())
         throw JSONRPCError(RPC_WALLET_WRONG_ENC_STATE, "Error: running with an unencrypted wallet, but walletpassphrase was called.");
 
     // Note that the walletpassphrase is stored in params[0] which is not mlock()ed
@@ -1926,7 +1983,7 @@ UniValue walletpassphrase(const UniValue& params, bool fHelp)
 
     if (strWalletPass.length() > 0)
     {
-        if (!pwalletMain->Unlock(strWalletPass))
+        if (!pwallet->Unlock(strWalletPass))
             throw JSONRPCError(RPC_WALLET_PASSPHRASE_INCORRECT, "Error: The wallet passphrase entered was incorrect.");
     }
     else
@@ -1934,14 +1991,16 @@ UniValue walletpassphrase(const UniValue& params, bool fHelp)
             "walletpassphrase <passphrase> <timeout>\n"
             "Stores the wallet decryption key in memory for <timeout> seconds.");
 
-    // No need to check return values, because the wallet was unlocked above
-    pwalletMain->UpdateNullifierNoteMap();
-    pwalletMain->TopUpKeyPool();
+    // No need to check return values, because the wallet was unlocked above.
+    // Notes can be spent as soon as their nullifiers are known, so those of
+    // the notes found while locked are computed without holding up the call.
+    pwallet->UpdateNullifierNoteMapInBackground();
+    pwallet->TopUpKeyPool();
 
     int64_t nSleepTime = params[1].get_int64();
     LOCK(cs_nWalletUnlockTime);
-    nWalletUnlockTime = GetTime() + nSleepTime;
-    RPCRunLater("lockwallet", boost::bind(LockWallet, pwalletMain), nSleepTime);
+    pwallet->nRelockTime = GetTime() + nSleepTime;
+    RPCRunLater(strprintf("lockwallet(%s)", pwallet->strWalletFile), boost::bind(LockWallet, pwallet), nSleepTime);
 
     return NullUniValue;
 }
@@ -1949,10 +2008,11 @@ UniValue walletpassphrase(const UniValue& params, bool fHelp)
 
 UniValue walletpassphrasechange(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
-    if (pwalletMain->IsCrypted() && (fHelp || params.size() != 2))
+    if (pwallet->IsCrypted() && (fHelp || params.size() != 2))
         throw runtime_error(
             "walletpassphrasechange \"oldpassphrase\" \"newpassphrase\"\n"
             "\nChanges the wallet passphrase from 'oldpassphrase' to 'newpassphrase'.\n"
@@ -1964,11 +2024,11 @@ UniValue walletpassphrasechange(const UniValue& params, bool fHelp)
             + HelpExampleRpc("walletpassphrasechange", "\"old one\", \"new one\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     if (fHelp)
         return true;
-    if (!pwalletMain->IsCrypted())
+    if (!pwallet->IsCrypted())
         throw JSONRPCError(RPC_WALLET_WRONG_ENC_STATE, "Error: running with an unencrypted wallet, but walletpassphrasechange was called.");
 
     // TODO: get rid of these .c_str() calls by implementing SecureString::operator=(std::string)
@@ -1986,7 +2046,7 @@ UniValue walletpassphrasechange(const UniValue& params, bool fHelp)
             "walletpassphrasechange <oldpassphrase> <newpassphrase>\n"
             "Changes the wallet passphrase from <oldpassphrase> to <newpassphrase>.");
 
-    if (!pwalletMain->ChangeWalletPassphrase(strOldWalletPass, strNewWalletPass))
+    if (!pwallet->ChangeWalletPassphrase(strOldWalletPass, strNewWalletPass))
         throw JSONRPCError(RPC_WALLET_PASSPHRASE_INCORRECT, "Error: The wallet passphrase entered was incorrect.");
 
     return NullUniValue;
@@ -1995,10 +2055,11 @@ UniValue walletpassphrasechange(const UniValue& params, bool fHelp)
 
 UniValue walletlock(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
-    if (pwalletMain->IsCrypted() && (fHelp || params.size() != 0))
+    if (pwallet->IsCrypted() && (fHelp || params.size() != 0))
         throw runtime_error(
             "walletlock\n"
             "\nRemoves the wallet encryption key from memory, locking the wallet.\n"
@@ -2015,17 +2076,17 @@ UniValue walletlock(const UniValue& params, bool fHelp)
             + HelpExampleRpc("walletlock", "")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     if (fHelp)
         return true;
-    if (!pwalletMain->IsCrypted())
+    if (!pwallet->IsCrypted())
         throw JSONRPCError(RPC_WALLET_WRONG_ENC_STATE, "Error: running with an unencrypted wallet, but walletlock was called.");
 
     {
         LOCK(cs_nWalletUnlockTime);
-        pwalletMain->Lock();
-        nWalletUnlockTime = 0;
+        pwallet->Lock();
+        pwallet->nRelockTime = 0;
     }
 
     return NullUniValue;
@@ -2034,7 +2095,8 @@ UniValue walletlock(const UniValue& params, bool fHelp)
 
 UniValue encryptwallet(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     string enableArg = "developerencryptwallet";
@@ -2045,7 +2107,7 @@ UniValue encryptwallet(const UniValue& params, bool fHelp)
         strWalletEncryptionDisabledMsg = experimentalDisabledHelpMsg("encryptwallet", enableArg);
     }
 
-    if (!pwalletMain->IsCrypted() && (fHelp || params.size() != 1))
+    if (!pwallet->IsCrypted() && (fHelp || params.size() != 1))
         throw runtime_error(
             "encryptwallet \"passphrase\"\n"
             + strWalletEncryptionDisabledMsg +
@@ -2070,14 +2132,14 @@ UniValue encryptwallet(const UniValue& params, bool fHelp)
             + HelpExampleRpc("encryptwallet", "\"my pass phrase\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     if (fHelp)
         return true;
     if (!fEnableWalletEncryption) {
         throw JSONRPCError(RPC_WALLET_ENCRYPTION_FAILED, "Error: wallet encryption is disabled.");
     }
-    if (pwalletMain->IsCrypted())
+    if (pwallet->IsCrypted())
         throw JSONRPCError(RPC_WALLET_WRONG_ENC_STATE, "Error: running with an encrypted wallet, but encryptwallet was called.");
 
     // TODO: get rid of this .c_str() by implementing SecureString::operator=(std::string)
@@ -2091,7 +2153,7 @@ UniValue encryptwallet(const UniValue& params, bool fHelp)
             "encryptwallet <passphrase>\n"
             "Encrypts the wallet with <passphrase>.");
 
-    if (!pwalletMain->EncryptWallet(strWalletPass))
+    if (!pwallet->EncryptWallet(strWalletPass))
         throw JSONRPCError(RPC_WALLET_ENCRYPTION_FAILED, "Error: Failed to encrypt the wallet.");
 
     // BDB seems to have a bad habit of writing old data into
@@ -2103,7 +2165,8 @@ UniValue encryptwallet(const UniValue& params, bool fHelp)
 
 UniValue lockunspent(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -2142,7 +2205,7 @@ UniValue lockunspent(const UniValue& params, bool fHelp)
             + HelpExampleRpc("lockunspent", "false, \"[{\\\"txid\\\":\\\"a08e6907dbbd3d809776dbfc5d82e371b764ed838b5655e72f463568df1aadf0\\\",\\\"vout\\\":1}]\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     if (params.size() == 1)
         RPCTypeCheck(params, boost::assign::list_of(UniValue::VBOOL));
@@ -2153,7 +2216,7 @@ UniValue lockunspent(const UniValue& params, bool fHelp)
 
     if (params.size() == 1) {
         if (fUnlock)
-            pwalletMain->UnlockAllCoins();
+            pwallet->UnlockAllCoins();
         return true;
     }
 
@@ -2177,9 +2240,9 @@ UniValue lockunspent(const UniValue& params, bool fHelp)
         COutPoint outpt(uint256S(txid), nOutput);
 
         if (fUnlock)
-            pwalletMain->UnlockCoin(outpt);
+            pwallet->UnlockCoin(outpt);
         else
-            pwalletMain->LockCoin(outpt);
+            pwallet->LockCoin(outpt);
     }
 
     return true;
@@ -2187,7 +2250,8 @@ UniValue lockunspent(const UniValue& params, bool fHelp)
 
 UniValue listlockunspent(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() > 0)
@@ -2216,10 +2280,10 @@ UniValue listlockunspent(const UniValue& params, bool fHelp)
             + HelpExampleRpc("listlockunspent", "")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     vector<COutPoint> vOutpts;
-    pwalletMain->ListLockedCoins(vOutpts);
+    pwallet->ListLockedCoins(vOutpts);
 
     UniValue ret(UniValue::VARR);
 
@@ -2236,7 +2300,8 @@ UniValue listlockunspent(const UniValue& params, bool fHelp)
 
 UniValue settxfee(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() < 1 || params.size() > 1)
@@ -2252,7 +2317,7 @@ UniValue settxfee(const UniValue& params, bool fHelp)
             + HelpExampleRpc("settxfee", "0.00001")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     // Amount
     CAmount nAmount = AmountFromValue(params[0]);
@@ -2263,7 +2328,8 @@ UniValue settxfee(const UniValue& params, bool fHelp)
 
 UniValue getwalletinfo(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() != 0)
@@ -2280,6 +2346,7 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
             "  \"keypoololdest\": xxxxxx,    (numeric) the timestamp (seconds since GMT epoch) of the oldest pre-generated key in the key pool\n"
             "  \"keypoolsize\": xxxx,        (numeric) how many new keys are pre-generated\n"
             "  \"unlocked_until\": ttt,      (numeric) the timestamp in seconds since epoch (midnight Jan 1 1970 GMT) that the wallet is unlocked for transfers, or 0 if the wallet is locked\n"
+            "  \"pending_nullifiers\": n,    (numeric) notes received while the wallet was locked that can't be spent until their nullifiers, computed after walletpassphrase, are known\n"
             "  \"paytxfee\": x.xxxx,         (numeric) the transaction fee configuration, set in " + CURRENCY_UNIT + "/kB\n"
             "  \"seedfp\": \"uint256\",        (string) the BLAKE2b-256 hash of the HD seed\n"
             "}\n"
@@ -2288,28 +2355,75 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getwalletinfo", "")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     UniValue obj(UniValue::VOBJ);
-    obj.push_back(Pair("walletversion", pwalletMain->GetVersion()));
-    obj.push_back(Pair("balance",       ValueFromAmount(pwalletMain->GetBalance())));
-    obj.push_back(Pair("unconfirmed_balance", ValueFromAmount(pwalletMain->GetUnconfirmedBalance())));
-    obj.push_back(Pair("immature_balance",    ValueFromAmount(pwalletMain->GetImmatureBalance())));
-    obj.push_back(Pair("txcount",       (int)pwalletMain->mapWallet.size()));
-    obj.push_back(Pair("keypoololdest", pwalletMain->GetOldestKeyPoolTime()));
-    obj.push_back(Pair("keypoolsize",   (int)pwalletMain->GetKeyPoolSize()));
-    if (pwalletMain->IsCrypted())
-        obj.push_back(Pair("unlocked_until", nWalletUnlockTime));
+    obj.push_back(Pair("walletversion", pwallet->GetVersion()));
+    obj.push_back(Pair("balance",       ValueFromAmount(pwallet->GetBalance())));
+    obj.push_back(Pair("unconfirmed_balance", ValueFromAmount(pwallet->GetUnconfirmedBalance())));
+    obj.push_back(Pair("immature_balance",    ValueFromAmount(pwallet->GetImmatureBalance())));
+    obj.push_back(Pair("txcount",       (int)pwallet->mapWallet.size()));
+    obj.push_back(Pair("keypoololdest", pwallet->GetOldestKeyPoolTime()));
+    obj.push_back(Pair("keypoolsize",   (int)pwallet->GetKeyPoolSize()));
+    if (pwallet->IsCrypted()) {
+        obj.push_back(Pair("unlocked_until", pwallet->nRelockTime));
+        obj.push_back(Pair("pending_nullifiers", (uint64_t)pwallet->GetPendingNullifiers()));
+    }
     obj.push_back(Pair("paytxfee",      ValueFromAmount(payTxFee.GetFeePerK())));
-    uint256 seedFp = pwalletMain->GetHDChain().seedFp;
+    uint256 seedFp = pwallet->GetHDChain().seedFp;
     if (!seedFp.IsNull())
          obj.push_back(Pair("seedfp", seedFp.GetHex()));
     return obj;
 }
 
+UniValue getrescaninfo(const UniValue& params, bool fHelp)
+{
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrescaninfo\n"
+            "Returns the progress of the wallet rescan in progress, if any.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"rescanning\": true|false, (boolean) whether a rescan is running; the fields below are only present if it is\n"
+            "  \"startheight\": n,         (numeric) the height the rescan started from\n"
+            "  \"height\": n,              (numeric) the height of the last block scanned\n"
+            "  \"tipheight\": n,           (numeric) the height the rescan will finish at\n"
+            "  \"progress\": x.xxx,        (numeric) the fraction of the rescan done, weighted by transaction count\n"
+            "  \"duration\": n,            (numeric) seconds since the rescan started\n"
+            "  \"eta\": n                  (numeric) estimated seconds until the rescan finishes, if known\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrescaninfo", "")
+            + HelpExampleRpc("getrescaninfo", "")
+        );
+
+    // No cs_main/cs_wallet here: the rescan holds both until it is done.
+    CWalletRescanProgress progress = pwallet->GetRescanProgress();
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("rescanning", progress.fScanning));
+    if (progress.fScanning) {
+        int64_t nElapsed = GetTimeMillis() - progress.nStartTime;
+        obj.push_back(Pair("startheight", progress.nStartHeight));
+        obj.push_back(Pair("height", progress.nHeight));
+        obj.push_back(Pair("tipheight", progress.nTipHeight));
+        obj.push_back(Pair("progress", progress.dProgress));
+        obj.push_back(Pair("duration", nElapsed / 1000));
+        if (progress.dProgress > 0.0) {
+            obj.push_back(Pair("eta", (int64_t)(nElapsed * (1.0 - progress.dProgress) / progress.dProgress / 1000)));
+        }
+    }
+    return obj;
+}
+
 UniValue resendwallettransactions(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() != 0)
@@ -2321,9 +2435,9 @@ UniValue resendwallettransactions(const UniValue& params, bool fHelp)
             "Returns array of transaction ids that were re-broadcast.\n"
             );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    std::vector<uint256> txids = pwalletMain->ResendWalletTransactionsBefore(GetTime());
+    std::vector<uint256> txids = pwallet->ResendWalletTransactionsBefore(GetTime());
     UniValue result(UniValue::VARR);
     BOOST_FOREACH(const uint256& txid, txids)
     {
@@ -2334,7 +2448,8 @@ UniValue resendwallettransactions(const UniValue& params, bool fHelp)
 
 UniValue listunspent(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() > 3)
@@ -2403,9 +2518,9 @@ UniValue listunspent(const UniValue& params, bool fHelp)
 
     UniValue results(UniValue::VARR);
     vector<COutput> vecOutputs;
-    assert(pwalletMain != NULL);
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-    pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
+    assert(pwallet != NULL);
+    LOCK2(cs_main, pwallet->cs_wallet);
+    pwallet->AvailableCoins(vecOutputs, false, NULL, true);
     BOOST_FOREACH(const COutput& out, vecOutputs) {
         if (out.nDepth < nMinDepth || out.nDepth > nMaxDepth)
             continue;
@@ -2425,13 +2540,13 @@ UniValue listunspent(const UniValue& params, bool fHelp)
         if (fValidAddress) {
             entry.push_back(Pair("address", EncodeDestination(address)));
 
-            if (pwalletMain->mapAddressBook.count(address))
-                entry.push_back(Pair("account", pwalletMain->mapAddressBook[address].name));
+            if (pwallet->mapAddressBook.count(address))
+                entry.push_back(Pair("account", pwallet->mapAddressBook[address].name));
 
             if (scriptPubKey.IsPayToScriptHash()) {
                 const CScriptID& hash = boost::get<CScriptID>(address);
                 CScript redeemScript;
-                if (pwalletMain->GetCScript(hash, redeemScript))
+                if (pwallet->GetCScript(hash, redeemScript))
                     entry.push_back(Pair("redeemScript", HexStr(redeemScript.begin(), redeemScript.end())));
             }
         }
@@ -2449,7 +2564,8 @@ UniValue listunspent(const UniValue& params, bool fHelp)
 
 UniValue z_listunspent(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() > 4)
@@ -2518,7 +2634,7 @@ UniValue z_listunspent(const UniValue& params, bool fHelp)
         fIncludeWatchonly = params[2].get_bool();
     }
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     // User has supplied zaddrs to filter on
     if (params.size() > 3) {
@@ -2539,7 +2655,7 @@ UniValue z_listunspent(const UniValue& params, bool fHelp)
             if (!IsValidPaymentAddress(zaddr)) {
                 throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid parameter, address is not a valid zaddr: ") + address);
             }
-            auto hasSpendingKey = boost::apply_visitor(HaveSpendingKeyForPaymentAddress(pwalletMain), zaddr);
+            auto hasSpendingKey = boost::apply_visitor(HaveSpendingKeyForPaymentAddress(pwallet), zaddr);
             if (!fIncludeWatchonly && !hasSpendingKey) {
                 throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid parameter, spending key for address does not belong to wallet: ") + address);
             }
@@ -2554,11 +2670,11 @@ UniValue z_listunspent(const UniValue& params, bool fHelp)
     else {
         // User did not provide zaddrs, so use default i.e. all addresses
         std::set<libzcash::SproutPaymentAddress> sproutzaddrs = {};
-        pwalletMain->GetSproutPaymentAddresses(sproutzaddrs);
+        pwallet->GetSproutPaymentAddresses(sproutzaddrs);
         
         // Sapling support
         std::set<libzcash::SaplingPaymentAddress> saplingzaddrs = {};
-        pwalletMain->GetSaplingPaymentAddresses(saplingzaddrs);
+        pwallet->GetSaplingPaymentAddresses(saplingzaddrs);
         
         zaddrs.insert(sproutzaddrs.begin(), sproutzaddrs.end());
         zaddrs.insert(saplingzaddrs.begin(), saplingzaddrs.end());
@@ -2567,8 +2683,8 @@ UniValue z_listunspent(const UniValue& params, bool fHelp)
      if (zaddrs.size() > 0) {
         std::vector<CSproutNotePlaintextEntry> sproutEntries;
         std::vector<SaplingNoteEntry> saplingEntries;
-        pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, zaddrs, nMinDepth, nMaxDepth, true, !fIncludeWatchonly, false);
-        std::set<std::pair<PaymentAddress, uint256>> nullifierSet = pwalletMain->GetNullifiersForAddresses(zaddrs);
+        pwallet->GetFilteredNotes(sproutEntries, saplingEntries, zaddrs, nMinDepth, nMaxDepth, true, !fIncludeWatchonly, false);
+        std::set<std::pair<PaymentAddress, uint256>> nullifierSet = pwallet->GetNullifiersForAddresses(zaddrs);
         
         for (auto & entry : sproutEntries) {
             UniValue obj(UniValue::VOBJ);
@@ -2576,14 +2692,14 @@ UniValue z_listunspent(const UniValue& params, bool fHelp)
             obj.push_back(Pair("jsindex", (int)entry.jsop.js ));
             obj.push_back(Pair("jsoutindex", (int)entry.jsop.n));
             obj.push_back(Pair("confirmations", entry.confirmations));
-            bool hasSproutSpendingKey = pwalletMain->HaveSproutSpendingKey(boost::get<libzcash::SproutPaymentAddress>(entry.address));
+            bool hasSproutSpendingKey = pwallet->HaveSproutSpendingKey(boost::get<libzcash::SproutPaymentAddress>(entry.address));
             obj.push_back(Pair("spendable", hasSproutSpendingKey));
             obj.push_back(Pair("address", EncodePaymentAddress(entry.address)));
             obj.push_back(Pair("amount", ValueFromAmount(CAmount(entry.plaintext.value()))));
             std::string data(entry.plaintext.memo().begin(), entry.plaintext.memo().end());
             obj.push_back(Pair("memo", HexStr(data)));
             if (hasSproutSpendingKey) {
-                obj.push_back(Pair("change", pwalletMain->IsNoteSproutChange(nullifierSet, entry.address, entry.jsop)));
+                obj.push_back(Pair("change", pwallet->IsNoteSproutChange(nullifierSet, entry.address, entry.jsop)));
             }
             results.push_back(obj);
         }
@@ -2595,15 +2711,15 @@ UniValue z_listunspent(const UniValue& params, bool fHelp)
             obj.push_back(Pair("confirmations", entry.confirmations));
             libzcash::SaplingIncomingViewingKey ivk;
             libzcash::SaplingFullViewingKey fvk;
-            pwalletMain->GetSaplingIncomingViewingKey(boost::get<libzcash::SaplingPaymentAddress>(entry.address), ivk);
-            pwalletMain->GetSaplingFullViewingKey(ivk, fvk);
-            bool hasSaplingSpendingKey = pwalletMain->HaveSaplingSpendingKey(fvk);
+            pwallet->GetSaplingIncomingViewingKey(boost::get<libzcash::SaplingPaymentAddress>(entry.address), ivk);
+            pwallet->GetSaplingFullViewingKey(ivk, fvk);
+            bool hasSaplingSpendingKey = pwallet->HaveSaplingSpendingKey(fvk);
             obj.push_back(Pair("spendable", hasSaplingSpendingKey));
             obj.push_back(Pair("address", EncodePaymentAddress(entry.address)));
             obj.push_back(Pair("amount", ValueFromAmount(CAmount(entry.note.value())))); // note.value() is equivalent to plaintext.value()
             obj.push_back(Pair("memo", HexStr(entry.memo)));
             if (hasSaplingSpendingKey) {
-                obj.push_back(Pair("change", pwalletMain->IsNoteSaplingChange(nullifierSet, entry.address, entry.op)));
+                obj.push_back(Pair("change", pwallet->IsNoteSaplingChange(nullifierSet, entry.address, entry.op)));
             }
             results.push_back(obj);
         }
@@ -2614,7 +2730,8 @@ UniValue z_listunspent(const UniValue& params, bool fHelp)
 
 UniValue z_listunshielded(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() > 3)
@@ -2678,9 +2795,9 @@ UniValue z_listunshielded(const UniValue& params, bool fHelp)
 
     UniValue results(UniValue::VARR);
     vector<COutput> vecOutputs;
-    assert(pwalletMain != NULL);
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-    pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
+    assert(pwallet != NULL);
+    LOCK2(cs_main, pwallet->cs_wallet);
+    pwallet->AvailableCoins(vecOutputs, false, NULL, true);
     BOOST_FOREACH(const COutput& out, vecOutputs) {
         if (out.nDepth < nMinDepth || out.nDepth > nMaxDepth)
             continue;
@@ -2714,7 +2831,8 @@ UniValue z_listunshielded(const UniValue& params, bool fHelp)
 
 UniValue fundrawtransaction(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() != 1)
@@ -2755,7 +2873,7 @@ UniValue fundrawtransaction(const UniValue& params, bool fHelp)
     CAmount nFee;
     string strFailReason;
     int nChangePos = -1;
-    if(!pwalletMain->FundTransaction(tx, nFee, nChangePos, strFailReason))
+    if(!pwallet->FundTransaction(tx, nFee, nChangePos, strFailReason))
         throw JSONRPCError(RPC_INTERNAL_ERROR, strFailReason);
 
     UniValue result(UniValue::VOBJ);
@@ -2795,9 +2913,58 @@ UniValue zc_sample_joinsplit(const UniValue& params, bool fHelp)
     return HexStr(ss.begin(), ss.end());
 }
 
+static UniValue LatencyToJSON(std::vector<double> latencies)
+{
+    std::sort(latencies.begin(), latencies.end());
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("count", (uint64_t)latencies.size()));
+    obj.push_back(Pair("mean", std::accumulate(latencies.begin(), latencies.end(), 0.0) / latencies.size()));
+    obj.push_back(Pair("median", latencies[latencies.size() / 2]));
+    obj.push_back(Pair("p90", latencies[latencies.size() * 9 / 10]));
+    obj.push_back(Pair("p99", latencies[latencies.size() * 99 / 100]));
+    obj.push_back(Pair("max", latencies.back()));
+    return obj;
+}
+
+static UniValue ReplayLockTimesToJSON(const ReplayLockTimes& times)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("acquired", times.nAcquired));
+    obj.push_back(Pair("holdtime", times.nHoldMicros * 0.000001));
+    obj.push_back(Pair("meanholdtime", times.nAcquired ? times.nHoldMicros * 0.000001 / times.nAcquired : 0));
+    obj.push_back(Pair("contended", times.nContended));
+    obj.push_back(Pair("waittime", times.nWaitMicros * 0.000001));
+    return obj;
+}
+
+static UniValue MempoolReplayResultToJSON(const MempoolReplayResult& replay, size_t nTransactions)
+{
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("runningtime", replay.nRunningTime));
+    result.push_back(Pair("transactions", (uint64_t)nTransactions));
+    result.push_back(Pair("accepted", (uint64_t)replay.nAccepted));
+    result.push_back(Pair("acceptspersecond", replay.nRunningTime > 0 ? replay.nAccepted / replay.nRunningTime : 0));
+    UniValue rejected(UniValue::VOBJ);
+    for (const auto& reject : replay.mapRejected) {
+        rejected.push_back(Pair(reject.first, (uint64_t)reject.second));
+    }
+    result.push_back(Pair("rejected", rejected));
+    UniValue latency(UniValue::VOBJ);
+    for (const auto& type : replay.mapLatencies) {
+        latency.push_back(Pair(type.first, LatencyToJSON(type.second)));
+    }
+    result.push_back(Pair("latency", latency));
+    UniValue locks(UniValue::VOBJ);
+    locks.push_back(Pair("cs_main", ReplayLockTimesToJSON(replay.csMain)));
+    locks.push_back(Pair("mempool.cs", ReplayLockTimesToJSON(replay.mempoolCs)));
+    result.push_back(Pair("locks", locks));
+    return result;
+}
+
 UniValue zc_benchmark(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp)) {
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp)) {
         return NullUniValue;
     }
 
@@ -2817,11 +2984,59 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
             "  }\n"
             "  ...\n"
             "]\n"
+            "\n"
+            "The verification throughput benchmarks\n"
+            "  verifysaplingspends samplecount ( threads batchsize )\n"
+            "  verifysaplingoutputs samplecount ( threads batchsize )\n"
+            "  verifysaplingbundles samplecount ( threads )\n"
+            "  verifyjoinsplits samplecount \"js\" ( threads )\n"
+            "instead run samplecount checks spread over 1, 2, 4, ... and threads\n"
+            "threads (default: the number of cores). Spends and outputs are checked\n"
+            "batchsize to a verification context (default: 1). A bundle is one spend,\n"
+            "two outputs and the binding signature of one transaction; building it\n"
+            "needs Sapling to activate on the network. A joinsplit may have a Groth16\n"
+            "or a PHGR13 proof. They output one result for each thread count:\n"
+            "[\n"
+            "  {\n"
+            "    \"threads\": n,\n"
+            "    \"runningtime\": runningtime,\n"
+            "    \"proofs\": n,                  (numeric) proofs checked, three for each bundle\n"
+            "    \"proofspersecond\": n,\n"
+            "    \"efficiency\": n               (numeric) proofs per second per thread, relative to one thread\n"
+            "  },\n"
+            "  ...\n"
+            "]\n"
+            "\n"
+            "The mempool acceptance benchmark\n"
+            "  acceptmempool samplecount \"file\" ( speed )\n"
+            "replays samplecount times the transactions a node started with\n"
+            "-txarrivallog=file received, accepting them to the mempool one after another\n"
+            "and then removing them again. With speed above 0 (default: 0) each is\n"
+            "passed at its recorded time of arrival, speed times faster, else as soon as\n"
+            "the one before is done. The tip must be the one the log was recorded from,\n"
+            "and the node should have no peers. Latencies run from the arrival of a\n"
+            "transaction to its acceptance or rejection. It outputs one result per sample:\n"
+            "[\n"
+            "  {\n"
+            "    \"runningtime\": runningtime,\n"
+            "    \"transactions\": n,\n"
+            "    \"accepted\": n,\n"
+            "    \"acceptspersecond\": n,\n"
+            "    \"rejected\": { \"reason\": n, ... },\n"
+            "    \"latency\": {               (object) by \"transparent\", \"sprout\" or \"sapling\"\n"
+            "      \"type\": { \"count\": n, \"mean\": n, \"median\": n, \"p90\": n, \"p99\": n, \"max\": n },\n"
+            "      ...\n"
+            "    },\n"
+            "    \"locks\": {                 (object) for \"cs_main\" and \"mempool.cs\"\n"
+            "      \"lock\": { \"acquired\": n, \"holdtime\": n, \"meanholdtime\": n, \"contended\": n, \"waittime\": n },\n"
+            "      ...\n"
+            "    }\n"
+            "  },\n"
+            "  ...\n"
+            "]\n"
             );
     }
 
-    LOCK(cs_main);
-
     std::string benchmarktype = params[0].get_str();
     int samplecount = params[1].get_int();
 
@@ -2829,6 +3044,37 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_TYPE_ERROR, "Invalid samplecount");
     }
 
+    // Takes cs_main for each transaction, as peers' transactions do
+    if (benchmarktype == "acceptmempool") {
+        if (params.size() < 3) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Missing file");
+        }
+        double nSpeed = params.size() > 3 ? params[3].get_real() : 0;
+        std::vector<CTxArrival> vArrivals;
+        uint256 hashTip;
+        int nHeight;
+        std::string strError;
+        if (!ReadTxArrivalLog(params[2].get_str(), hashTip, nHeight, vArrivals, strError)) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strError);
+        }
+        {
+            LOCK(cs_main);
+            if (chainActive.Tip()->GetBlockHash() != hashTip) {
+                throw JSONRPCError(RPC_MISC_ERROR, strprintf("The log was recorded from block %s at height %d, not the tip",
+                    hashTip.GetHex(), nHeight));
+            }
+        }
+
+        UniValue results(UniValue::VARR);
+        for (int i = 0; i < samplecount; i++) {
+            MempoolReplayResult replay = benchmark_accept_mempool(vArrivals, nSpeed);
+            results.push_back(MempoolReplayResultToJSON(replay, vArrivals.size()));
+        }
+        return results;
+    }
+
+    LOCK(cs_main);
+
     std::vector<double> sample_times;
 
     JSDescription samplejoinsplit;
@@ -2838,6 +3084,60 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
         ss >> samplejoinsplit;
     }
 
+    // Throughput benchmarks run samplecount checks at each thread count
+    std::vector<std::pair<int, double>> throughput;
+    int nProofsPerCheck = 1;
+    if (benchmarktype == "verifysaplingspends" || benchmarktype == "verifysaplingoutputs" || benchmarktype == "verifysaplingbundles") {
+        int nMaxThreads = params.size() > 2 ? params[2].get_int() : GetNumCores();
+        int nBatch = params.size() > 3 ? params[3].get_int() : 1;
+        if (nMaxThreads <= 0 || nBatch <= 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid threads or batchsize");
+        }
+        if (benchmarktype == "verifysaplingspends") {
+            throughput = benchmark_verify_sapling_spend_threaded(nMaxThreads, samplecount, nBatch);
+        } else if (benchmarktype == "verifysaplingoutputs") {
+            throughput = benchmark_verify_sapling_output_threaded(nMaxThreads, samplecount, nBatch);
+        } else {
+            throughput = benchmark_verify_sapling_bundle_threaded(nMaxThreads, samplecount);
+            nProofsPerCheck = 3;
+        }
+    } else if (benchmarktype == "verifyjoinsplits") {
+        // Transactions before Sapling carry PHGR13 proofs, which are longer
+        std::vector<unsigned char> vchJoinSplit = ParseHexV(params[2].get_str(), "js");
+        try {
+            CDataStream ss(vchJoinSplit, SER_NETWORK, SAPLING_TX_VERSION | (1 << 31));
+            ss >> samplejoinsplit;
+            if (!ss.empty())
+                throw std::ios_base::failure("not a Groth16 joinsplit");
+        } catch (const std::ios_base::failure&) {
+            CDataStream ss(vchJoinSplit, SER_NETWORK, PROTOCOL_VERSION);
+            ss >> samplejoinsplit;
+        }
+        int nMaxThreads = params.size() > 3 ? params[3].get_int() : GetNumCores();
+        if (nMaxThreads <= 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid threads");
+        }
+        throughput = benchmark_verify_joinsplit_threaded(samplejoinsplit, nMaxThreads, samplecount);
+    }
+    if (!throughput.empty()) {
+        UniValue results(UniValue::VARR);
+        double nSingleRate = 0;
+        for (const std::pair<int, double>& sample : throughput) {
+            int64_t nProofs = (int64_t)samplecount * nProofsPerCheck;
+            double nRate = sample.second > 0 ? nProofs / sample.second : 0;
+            if (sample.first == 1)
+                nSingleRate = nRate;
+            UniValue result(UniValue::VOBJ);
+            result.push_back(Pair("threads", sample.first));
+            result.push_back(Pair("runningtime", sample.second));
+            result.push_back(Pair("proofs", nProofs));
+            result.push_back(Pair("proofspersecond", nRate));
+            result.push_back(Pair("efficiency", nSingleRate > 0 ? nRate / sample.first / nSingleRate : 0));
+            results.push_back(result);
+        }
+        return results;
+    }
+
     for (int i = 0; i < samplecount; i++) {
         if (benchmarktype == "sleep") {
             sample_times.push_back(benchmark_sleep());
@@ -2923,7 +3223,8 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
 
 UniValue zc_raw_receive(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp)) {
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp)) {
         return NullUniValue;
     }
 
@@ -2986,11 +3287,11 @@ UniValue zc_raw_receive(const UniValue& params, bool fHelp)
     SproutPaymentAddress payment_addr = k.address();
     SproutNote decrypted_note = npt.note(payment_addr);
 
-    assert(pwalletMain != NULL);
+    assert(pwallet != NULL);
     std::vector<boost::optional<SproutWitness>> witnesses;
     uint256 anchor;
     uint256 commitment = decrypted_note.cm();
-    pwalletMain->WitnessNoteCommitment(
+    pwallet->WitnessNoteCommitment(
         {commitment},
         witnesses,
         anchor
@@ -3010,7 +3311,8 @@ UniValue zc_raw_receive(const UniValue& params, bool fHelp)
 
 UniValue zc_raw_joinsplit(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp)) {
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp)) {
         return NullUniValue;
     }
 
@@ -3089,7 +3391,7 @@ UniValue zc_raw_joinsplit(const UniValue& params, bool fHelp)
 
     uint256 anchor;
     std::vector<boost::optional<SproutWitness>> witnesses;
-    pwalletMain->WitnessNoteCommitment(commitments, witnesses, anchor);
+    pwallet->WitnessNoteCommitment(commitments, witnesses, anchor);
 
     assert(witnesses.size() == notes.size());
     assert(notes.size() == keys.size());
@@ -3209,7 +3511,8 @@ UniValue zc_raw_joinsplit(const UniValue& params, bool fHelp)
 
 UniValue zc_raw_keygen(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp)) {
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp)) {
         return NullUniValue;
     }
 
@@ -3241,7 +3544,8 @@ UniValue zc_raw_keygen(const UniValue& params, bool fHelp)
 
 UniValue z_getnewaddress(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     std::string defaultType = ADDR_TYPE_SAPLING;
@@ -3262,9 +3566,9 @@ UniValue z_getnewaddress(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_getnewaddress", "")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    EnsureWalletIsUnlocked();
+    EnsureWalletIsUnlocked(pwallet);
 
     auto addrType = defaultType;
     if (params.size() > 0) {
@@ -3272,20 +3576,93 @@ UniValue z_getnewaddress(const UniValue& params, bool fHelp)
     }
 
     if (addrType == ADDR_TYPE_SPROUT) {
-        std::string pubaddr = EncodePaymentAddress(pwalletMain->GenerateNewSproutZKey());
-        pwalletMain->SetZAddressBook(pubaddr, "", "zreceive");
+        std::string pubaddr = EncodePaymentAddress(pwallet->GenerateNewSproutZKey());
+        pwallet->SetZAddressBook(pubaddr, "", "zreceive");
         return pubaddr;
     } else if (addrType == ADDR_TYPE_SAPLING) {
-        return EncodePaymentAddress(pwalletMain->GenerateNewSaplingZKey());
+        return EncodePaymentAddress(pwallet->GenerateNewSaplingZKey());
     } else {
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid address type");
     }
 }
 
+// Upper bound on count, as the wallet stays locked while the keys are generated
+#define Z_GETNEWADDRESSES_MAX_COUNT 1000
+
+UniValue z_getnewaddresses(const UniValue& params, bool fHelp)
+{
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
+        return NullUniValue;
+
+    std::string defaultType = ADDR_TYPE_SAPLING;
+
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "z_getnewaddresses count ( type )\n"
+            "\nReturns count new shielded addresses for receiving payments. The keys are\n"
+            "generated together and written to the wallet in a single database transaction.\n"
+            "\nArguments:\n"
+            "1. count          (numeric, required) The number of addresses, from 1 to " + std::to_string(Z_GETNEWADDRESSES_MAX_COUNT) + ".\n"
+            "2. \"type\"         (string, optional, default=\"" + defaultType + "\") The type of address. One of [\""
+            + ADDR_TYPE_SPROUT + "\", \"" + ADDR_TYPE_SAPLING + "\"].\n"
+            "\nResult:\n"
+            "[                     (json array of string)\n"
+            "  \"litecoinzaddress\"  (string) a new shielded address\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_getnewaddresses", "100")
+            + HelpExampleCli("z_getnewaddresses", "100 " + ADDR_TYPE_SAPLING)
+            + HelpExampleRpc("z_getnewaddresses", "100")
+        );
+
+    int nCount = params[0].get_int();
+    if (nCount < 1 || nCount > Z_GETNEWADDRESSES_MAX_COUNT)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid count, must be between 1 and " + std::to_string(Z_GETNEWADDRESSES_MAX_COUNT));
+
+    auto addrType = defaultType;
+    if (params.size() > 1) {
+        addrType = params[1].get_str();
+    }
+    if (addrType != ADDR_TYPE_SPROUT && addrType != ADDR_TYPE_SAPLING) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid address type");
+    }
+
+    LOCK2(cs_main, pwallet->cs_wallet);
+
+    EnsureWalletIsUnlocked(pwallet);
+
+    UniValue ret(UniValue::VARR);
+    bool fBatch = pwallet->BeginBatch();
+    try {
+        if (addrType == ADDR_TYPE_SPROUT) {
+            for (int i = 0; i < nCount; i++) {
+                std::string pubaddr = EncodePaymentAddress(pwallet->GenerateNewSproutZKey());
+                pwallet->SetZAddressBook(pubaddr, "", "zreceive");
+                ret.push_back(pubaddr);
+            }
+        } else {
+            for (const libzcash::SaplingPaymentAddress& addr : pwallet->GenerateNewSaplingZKeys(nCount)) {
+                ret.push_back(EncodePaymentAddress(addr));
+            }
+        }
+    } catch (...) {
+        // The keys are in memory already; commit what was written so far
+        if (fBatch)
+            pwallet->CommitBatch();
+        throw;
+    }
+    if (fBatch)
+        pwallet->CommitBatch();
+    return ret;
+}
+
 
 UniValue z_listaddresses(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() > 1)
@@ -3304,7 +3681,7 @@ UniValue z_listaddresses(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_listaddresses", "")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     bool fIncludeWatchonly = false;
     if (params.size() > 0) {
@@ -3314,23 +3691,23 @@ UniValue z_listaddresses(const UniValue& params, bool fHelp)
     UniValue ret(UniValue::VARR);
     {
         std::set<libzcash::SproutPaymentAddress> addresses;
-        pwalletMain->GetSproutPaymentAddresses(addresses);
+        pwallet->GetSproutPaymentAddresses(addresses);
         for (auto addr : addresses) {
-            if (fIncludeWatchonly || pwalletMain->HaveSproutSpendingKey(addr)) {
+            if (fIncludeWatchonly || pwallet->HaveSproutSpendingKey(addr)) {
                 ret.push_back(EncodePaymentAddress(addr));
             }
         }
     }
     {
         std::set<libzcash::SaplingPaymentAddress> addresses;
-        pwalletMain->GetSaplingPaymentAddresses(addresses);
+        pwallet->GetSaplingPaymentAddresses(addresses);
         libzcash::SaplingIncomingViewingKey ivk;
         libzcash::SaplingFullViewingKey fvk;
         for (auto addr : addresses) {
             if (fIncludeWatchonly || (
-                pwalletMain->GetSaplingIncomingViewingKey(addr, ivk) &&
-                pwalletMain->GetSaplingFullViewingKey(ivk, fvk) &&
-                pwalletMain->HaveSaplingSpendingKey(fvk)
+                pwallet->GetSaplingIncomingViewingKey(addr, ivk) &&
+                pwallet->GetSaplingFullViewingKey(ivk, fvk) &&
+                pwallet->HaveSaplingSpendingKey(fvk)
             )) {
                 ret.push_back(EncodePaymentAddress(addr));
             }
@@ -3339,7 +3716,7 @@ UniValue z_listaddresses(const UniValue& params, bool fHelp)
     return ret;
 }
 
-CAmount getBalanceTaddr(std::string transparentAddress, int minDepth=1, bool ignoreUnspendable=true) {
+CAmount getBalanceTaddr(CWallet* const pwallet, std::string transparentAddress, int minDepth=1, bool ignoreUnspendable=true) {
     std::set<CTxDestination> destinations;
     vector<COutput> vecOutputs;
     CAmount balance = 0;
@@ -3352,9 +3729,9 @@ CAmount getBalanceTaddr(std::string transparentAddress, int minDepth=1, bool ign
         destinations.insert(taddr);
     }
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
+    pwallet->AvailableCoins(vecOutputs, false, NULL, true);
 
     BOOST_FOREACH(const COutput& out, vecOutputs) {
         if (out.nDepth < minDepth) {
@@ -3382,12 +3759,12 @@ CAmount getBalanceTaddr(std::string transparentAddress, int minDepth=1, bool ign
     return balance;
 }
 
-CAmount getBalanceZaddr(std::string address, int minDepth = 1, bool ignoreUnspendable=true) {
+CAmount getBalanceZaddr(CWallet* const pwallet, std::string address, int minDepth = 1, bool ignoreUnspendable=true) {
     CAmount balance = 0;
     std::vector<CSproutNotePlaintextEntry> sproutEntries;
     std::vector<SaplingNoteEntry> saplingEntries;
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-    pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, address, minDepth, true, ignoreUnspendable);
+    LOCK2(cs_main, pwallet->cs_wallet);
+    pwallet->GetFilteredNotes(sproutEntries, saplingEntries, address, minDepth, true, ignoreUnspendable);
     for (auto & entry : sproutEntries) {
         balance += CAmount(entry.plaintext.value());
     }
@@ -3400,7 +3777,8 @@ CAmount getBalanceZaddr(std::string address, int minDepth = 1, bool ignoreUnspen
 
 UniValue z_listreceivedbyaddress(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size()==0 || params.size() >2)
@@ -3425,7 +3803,7 @@ UniValue z_listreceivedbyaddress(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_listreceivedbyaddress", "\"ztfaW34Gj9FrnGUEf833ywDVL62NWXBM81u6EQnM6VR45eYnXhwztecW1SjxA7JrmAXKJhxhj3vDNEpVCQoSvVoSpmbhtjf\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     int nMinDepth = 1;
     if (params.size() > 1) {
@@ -3444,19 +3822,19 @@ UniValue z_listreceivedbyaddress(const UniValue& params, bool fHelp)
     }
 
     // Visitor to support Sprout and Sapling addrs
-    if (!boost::apply_visitor(PaymentAddressBelongsToWallet(pwalletMain), zaddr)) {
+    if (!boost::apply_visitor(PaymentAddressBelongsToWallet(pwallet), zaddr)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "From address does not belong to this node, zaddr spending key or viewing key not found.");
     }
 
     UniValue result(UniValue::VARR);
     std::vector<CSproutNotePlaintextEntry> sproutEntries;
     std::vector<SaplingNoteEntry> saplingEntries;
-    pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, fromaddress, nMinDepth, false, false);
+    pwallet->GetFilteredNotes(sproutEntries, saplingEntries, fromaddress, nMinDepth, false, false);
 
     std::set<std::pair<PaymentAddress, uint256>> nullifierSet;
-    auto hasSpendingKey = boost::apply_visitor(HaveSpendingKeyForPaymentAddress(pwalletMain), zaddr);
+    auto hasSpendingKey = boost::apply_visitor(HaveSpendingKeyForPaymentAddress(pwallet), zaddr);
     if (hasSpendingKey) {
-        nullifierSet = pwalletMain->GetNullifiersForAddresses({zaddr});
+        nullifierSet = pwallet->GetNullifiersForAddresses({zaddr});
     }
 
     if (boost::get<libzcash::SproutPaymentAddress>(&zaddr) != nullptr) {
@@ -3469,7 +3847,7 @@ UniValue z_listreceivedbyaddress(const UniValue& params, bool fHelp)
             obj.push_back(Pair("jsindex", entry.jsop.js));
             obj.push_back(Pair("jsoutindex", entry.jsop.n));
             if (hasSpendingKey) {
-                obj.push_back(Pair("change", pwalletMain->IsNoteSproutChange(nullifierSet, entry.address, entry.jsop)));
+                obj.push_back(Pair("change", pwallet->IsNoteSproutChange(nullifierSet, entry.address, entry.jsop)));
             }
             result.push_back(obj);
         }
@@ -3481,7 +3859,7 @@ UniValue z_listreceivedbyaddress(const UniValue& params, bool fHelp)
             obj.push_back(Pair("memo", HexStr(entry.memo)));
             obj.push_back(Pair("outindex", (int)entry.op.n));
             if (hasSpendingKey) {
-                obj.push_back(Pair("change", pwalletMain->IsNoteSaplingChange(nullifierSet, entry.address, entry.op)));
+                obj.push_back(Pair("change", pwallet->IsNoteSaplingChange(nullifierSet, entry.address, entry.op)));
             }
             result.push_back(obj);
         }
@@ -3491,7 +3869,8 @@ UniValue z_listreceivedbyaddress(const UniValue& params, bool fHelp)
 
 UniValue z_getbalance(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size()==0 || params.size() >2)
@@ -3514,7 +3893,7 @@ UniValue z_getbalance(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_getbalance", "\"myaddress\", 5")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     int nMinDepth = 1;
     if (params.size() > 1) {
@@ -3534,16 +3913,16 @@ UniValue z_getbalance(const UniValue& params, bool fHelp)
         if (!IsValidPaymentAddress(res)) {
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid from address, should be a taddr or zaddr.");
         }
-        if (!boost::apply_visitor(PaymentAddressBelongsToWallet(pwalletMain), res)) {
+        if (!boost::apply_visitor(PaymentAddressBelongsToWallet(pwallet), res)) {
              throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "From address does not belong to this node, spending key or viewing key not found.");
         }
     }
 
     CAmount nBalance = 0;
     if (fromTaddr) {
-        nBalance = getBalanceTaddr(fromaddress, nMinDepth, false);
+        nBalance = getBalanceTaddr(pwallet, fromaddress, nMinDepth, false);
     } else {
-        nBalance = getBalanceZaddr(fromaddress, nMinDepth, false);
+        nBalance = getBalanceZaddr(pwallet, fromaddress, nMinDepth, false);
     }
 
     return ValueFromAmount(nBalance);
@@ -3552,7 +3931,8 @@ UniValue z_getbalance(const UniValue& params, bool fHelp)
 
 UniValue z_gettotalbalance(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() > 2)
@@ -3580,7 +3960,7 @@ UniValue z_gettotalbalance(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_gettotalbalance", "5")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     int nMinDepth = 1;
     if (params.size() > 0) {
@@ -3597,10 +3977,10 @@ UniValue z_gettotalbalance(const UniValue& params, bool fHelp)
 
     // getbalance and "getbalance * 1 true" should return the same number
     // but they don't because wtx.GetAmounts() does not handle tx where there are no outputs
-    // pwalletMain->GetBalance() does not accept min depth parameter
+    // pwallet->GetBalance() does not accept min depth parameter
     // so we use our own method to get balance of utxos.
-    CAmount nBalance = getBalanceTaddr("", nMinDepth, !fIncludeWatchonly);
-    CAmount nPrivateBalance = getBalanceZaddr("", nMinDepth, !fIncludeWatchonly);
+    CAmount nBalance = getBalanceTaddr(pwallet, "", nMinDepth, !fIncludeWatchonly);
+    CAmount nPrivateBalance = getBalanceZaddr(pwallet, "", nMinDepth, !fIncludeWatchonly);
     CAmount nTotalBalance = nBalance + nPrivateBalance;
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("transparent", FormatMoney(nBalance)));
@@ -3611,20 +3991,31 @@ UniValue z_gettotalbalance(const UniValue& params, bool fHelp)
 
 UniValue z_getoperationresult(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
-    if (fHelp || params.size() > 1)
+    if (fHelp || params.size() > 2)
         throw runtime_error(
-            "z_getoperationresult ([\"operationid\", ... ]) \n"
+            "z_getoperationresult ([\"operationid\", ... ] filter) \n"
             "\nRetrieve the result and status of an operation which has finished, and then remove the operation from memory."
-            + HelpRequiringPassphrase() + "\n"
+            + HelpRequiringPassphrase(pwallet) + "\n"
             "\nArguments:\n"
             "1. \"operationid\"         (array, optional) A list of operation ids we are interested in.  If not provided, examine all operations known to the node.\n"
+            "2. filter                 (object, optional) Only report the operations matching all of\n"
+            "    {\n"
+            "      \"status\": \"status\"    (string, optional) The state of the operation e.g. \"success\"\n"
+            "      \"from_time\": n        (numeric, optional) The earliest creation_time, in seconds since epoch\n"
+            "      \"to_time\": n          (numeric, optional) The creation_time to report operations created before\n"
+            "      \"limit\": n            (numeric, optional) Report at most n operations, the oldest first\n"
+            "    }\n"
+            "\nFinished operations are kept in memory up to -rpcasyncresults, for -rpcasyncresultttl seconds, and on\n"
+            "disk for as long with -rpcasyncpersist.\n"
             "\nResult:\n"
             "\"    [object, ...]\"      (array) A list of JSON objects\n"
             "\nExamples:\n"
             + HelpExampleCli("z_getoperationresult", "'[\"operationid\", ... ]'")
+            + HelpExampleCli("z_getoperationresult", "'[]' '{\"status\": \"success\", \"limit\": 100}'")
             + HelpExampleRpc("z_getoperationresult", "'[\"operationid\", ... ]'")
         );
 
@@ -3634,20 +4025,31 @@ UniValue z_getoperationresult(const UniValue& params, bool fHelp)
 
 UniValue z_getoperationstatus(const UniValue& params, bool fHelp)
 {
-   if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+   if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
-    if (fHelp || params.size() > 1)
+    if (fHelp || params.size() > 2)
         throw runtime_error(
-            "z_getoperationstatus ([\"operationid\", ... ]) \n"
+            "z_getoperationstatus ([\"operationid\", ... ] filter) \n"
             "\nGet operation status and any associated result or error data.  The operation will remain in memory."
-            + HelpRequiringPassphrase() + "\n"
+            + HelpRequiringPassphrase(pwallet) + "\n"
             "\nArguments:\n"
             "1. \"operationid\"         (array, optional) A list of operation ids we are interested in.  If not provided, examine all operations known to the node.\n"
+            "2. filter                 (object, optional) Only report the operations matching all of\n"
+            "    {\n"
+            "      \"status\": \"status\"    (string, optional) The state of the operation e.g. \"success\"\n"
+            "      \"from_time\": n        (numeric, optional) The earliest creation_time, in seconds since epoch\n"
+            "      \"to_time\": n          (numeric, optional) The creation_time to report operations created before\n"
+            "      \"limit\": n            (numeric, optional) Report at most n operations, the oldest first\n"
+            "    }\n"
+            "\nFinished operations are kept in memory up to -rpcasyncresults, for -rpcasyncresultttl seconds, and on\n"
+            "disk for as long with -rpcasyncpersist.\n"
             "\nResult:\n"
             "\"    [object, ...]\"      (array) A list of JSON objects\n"
             "\nExamples:\n"
             + HelpExampleCli("z_getoperationstatus", "'[\"operationid\", ... ]'")
+            + HelpExampleCli("z_getoperationstatus", "'[]' '{\"status\": \"failed\", \"from_time\": 1530000000}'")
             + HelpExampleRpc("z_getoperationstatus", "'[\"operationid\", ... ]'")
         );
 
@@ -3657,58 +4059,38 @@ UniValue z_getoperationstatus(const UniValue& params, bool fHelp)
 
 UniValue z_getoperationstatus_IMPL(const UniValue& params, bool fRemoveFinishedOperations=false)
 {
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    std::set<AsyncRPCOperationId> filter;
-    if (params.size()==1) {
+    AsyncRPCOperationFilter filter;
+    if (params.size() > 0) {
         UniValue ids = params[0].get_array();
         for (const UniValue & v : ids.getValues()) {
-            filter.insert(v.get_str());
+            filter.ids.insert(v.get_str());
         }
     }
-    bool useFilter = (filter.size()>0);
-
-    UniValue ret(UniValue::VARR);
-    std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
-    std::vector<AsyncRPCOperationId> ids = q->getAllOperationIds();
-
-    for (auto id : ids) {
-        if (useFilter && !filter.count(id))
-            continue;
-
-        std::shared_ptr<AsyncRPCOperation> operation = q->getOperationForId(id);
-        if (!operation) {
-            continue;
-            // It's possible that the operation was removed from the internal queue and map during this loop
-            // throw JSONRPCError(RPC_INVALID_PARAMETER, "No operation exists for that id.");
-        }
-
-        UniValue obj = operation->getStatus();
-        std::string s = obj["status"].get_str();
-        if (fRemoveFinishedOperations) {
-            // Caller is only interested in retrieving finished results
-            if ("success"==s || "failed"==s || "cancelled"==s) {
-                ret.push_back(obj);
-                q->popOperationForId(id);
-            }
-        } else {
-            ret.push_back(obj);
+    if (params.size() > 1) {
+        UniValue options = params[1].get_obj();
+        RPCTypeCheckObj(options, boost::assign::map_list_of("status", UniValue::VSTR)("from_time", UniValue::VNUM)("to_time", UniValue::VNUM)("limit", UniValue::VNUM), true);
+        if (options.exists("status"))
+            filter.status = options["status"].get_str();
+        if (options.exists("from_time"))
+            filter.fromTime = options["from_time"].get_int64();
+        if (options.exists("to_time"))
+            filter.toTime = options["to_time"].get_int64();
+        if (options.exists("limit")) {
+            int64_t nLimit = options["limit"].get_int64();
+            if (nLimit < 0)
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, limit must not be negative");
+            filter.limit = nLimit;
         }
     }
 
-    std::vector<UniValue> arrTmp = ret.getValues();
-
-    // sort results chronologically by creation_time
-    std::sort(arrTmp.begin(), arrTmp.end(), [](UniValue a, UniValue b) -> bool {
-        const int64_t t1 = find_value(a.get_obj(), "creation_time").get_int64();
-        const int64_t t2 = find_value(b.get_obj(), "creation_time").get_int64();
-        return t1 < t2;
-    });
-
-    ret.clear();
-    ret.setArray();
-    ret.push_backV(arrTmp);
+    // Statuses come sorted chronologically by creation_time
+    std::vector<UniValue> statuses = getAsyncRPCQueue()->getOperationStatuses(filter, fRemoveFinishedOperations);
 
+    UniValue ret(UniValue::VARR);
+    ret.push_backV(statuses);
     return ret;
 }
 
@@ -3727,7 +4109,8 @@ UniValue z_getoperationstatus_IMPL(const UniValue& params, bool fRemoveFinishedO
 
 UniValue z_sendmany(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() < 2 || params.size() > 4)
@@ -3737,7 +4120,7 @@ UniValue z_sendmany(const UniValue& params, bool fHelp)
             "\nChange generated from a taddr flows to a new taddr address, while change generated from a zaddr returns to itself."
             "\nWhen sending coinbase UTXOs to a zaddr, change is not allowed. The entire value of the UTXO(s) must be consumed."
             + strprintf("\nBefore Sapling activates, the maximum number of zaddr outputs is %d due to transaction size limits.\n", Z_SENDMANY_MAX_ZADDR_OUTPUTS_BEFORE_SAPLING)
-            + HelpRequiringPassphrase() + "\n"
+            + HelpRequiringPassphrase(pwallet) + "\n"
             "\nArguments:\n"
             "1. \"fromaddress\"         (string, required) The taddr or zaddr to send the funds from.\n"
             "2. \"amounts\"             (array, required) An array of json objects representing the amounts to send.\n"
@@ -3756,7 +4139,7 @@ UniValue z_sendmany(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_sendmany", "\"t1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd\", [{\"address\": \"ztfaW34Gj9FrnGUEf833ywDVL62NWXBM81u6EQnM6VR45eYnXhwztecW1SjxA7JrmAXKJhxhj3vDNEpVCQoSvVoSpmbhtjf\" ,\"amount\": 5.0}]")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     // Check that the from address is valid.
     auto fromaddress = params[0].get_str();
@@ -3772,7 +4155,7 @@ UniValue z_sendmany(const UniValue& params, bool fHelp)
         }
 
         // Check that we have the spending key
-        if (!boost::apply_visitor(HaveSpendingKeyForPaymentAddress(pwalletMain), res)) {
+        if (!boost::apply_visitor(HaveSpendingKeyForPaymentAddress(pwallet), res)) {
              throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "From address does not belong to this node, zaddr spending key not found.");
         }
 
@@ -3981,7 +4364,7 @@ UniValue z_sendmany(const UniValue& params, bool fHelp)
     // Builder (used if Sapling addresses are involved)
     boost::optional<TransactionBuilder> builder;
     if (noSproutAddrs) {
-        builder = TransactionBuilder(Params().GetConsensus(), nextBlockHeight, pwalletMain);
+        builder = TransactionBuilder(Params().GetConsensus(), nextBlockHeight, pwallet);
     }
 
     // Contextual transaction we will build on
@@ -4018,12 +4401,13 @@ When estimating the number of coinbase utxos we can shield in a single transacti
 
 UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
-    if (fHelp || params.size() < 2 || params.size() > 4)
+    if (fHelp || params.size() < 2 || params.size() > 5)
         throw runtime_error(
-            "z_shieldcoinbase \"fromaddress\" \"tozaddress\" ( fee ) ( limit )\n"
+            "z_shieldcoinbase \"fromaddress\" \"tozaddress\" ( fee ) ( limit ) ( transactions )\n"
             "\nShield transparent coinbase funds by sending to a shielded zaddr.  This is an asynchronous operation and utxos"
             "\nselected for shielding will be locked.  If there is an error, they are unlocked.  The RPC call `listlockunspent`"
             "\ncan be used to return a list of locked utxos.  The number of coinbase utxos selected for shielding can be limited"
@@ -4031,7 +4415,7 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
             "\noption will determine the number of uxtos.  Any limit is constrained by the consensus rule defining a maximum"
             "\ntransaction size of "
             + strprintf("%d bytes before Sapling, and %d bytes once Sapling activates.", MAX_TX_SIZE_BEFORE_SAPLING, MAX_TX_SIZE_AFTER_SAPLING)
-            + HelpRequiringPassphrase() + "\n"
+            + HelpRequiringPassphrase(pwallet) + "\n"
             "\nArguments:\n"
             "1. \"fromaddress\"         (string, required) The address is a taddr or \"*\" for all taddrs belonging to the wallet.\n"
             "2. \"toaddress\"           (string, required) The address is a zaddr.\n"
@@ -4039,12 +4423,16 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
             + strprintf("%s", FormatMoney(SHIELD_COINBASE_DEFAULT_MINERS_FEE)) + ") The fee amount to attach to this transaction.\n"
             "4. limit                 (numeric, optional, default="
             + strprintf("%d", SHIELD_COINBASE_DEFAULT_LIMIT) + ") Limit on the maximum number of utxos to shield.  Set to 0 to use node option -mempooltxinputlimit (before Overwinter), or as many as will fit in the transaction (after Overwinter).\n"
+            "5. transactions          (numeric, optional, default=1) Most transactions to shield the utxos in, each of them within the limit\n"
+            "                         and paying the fee.  They are proven "
+            + strprintf("%d", ASYNC_RPC_BATCH_MAX_PARALLEL) + " at a time, as far as -threads allows, under one operationid.\n"
             "\nResult:\n"
             "{\n"
             "  \"remainingUTXOs\": xxx       (numeric) Number of coinbase utxos still available for shielding.\n"
             "  \"remainingValue\": xxx       (numeric) Value of coinbase utxos still available for shielding.\n"
             "  \"shieldingUTXOs\": xxx        (numeric) Number of coinbase utxos being shielded.\n"
             "  \"shieldingValue\": xxx        (numeric) Value of coinbase utxos being shielded.\n"
+            "  \"transactions\": xxx          (numeric) Number of transactions they are shielded in.\n"
             "  \"opid\": xxx          (string) An operationid to pass to z_getoperationstatus to get the result of the operation.\n"
             "}\n"
             "\nExamples:\n"
@@ -4052,7 +4440,7 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_shieldcoinbase", "\"t1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd\", \"ztfaW34Gj9FrnGUEf833ywDVL62NWXBM81u6EQnM6VR45eYnXhwztecW1SjxA7JrmAXKJhxhj3vDNEpVCQoSvVoSpmbhtjf\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     // Validate the from address
     auto fromaddress = params[0].get_str();
@@ -4089,6 +4477,14 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
         }
     }
 
+    int nTransactions = 1;
+    if (params.size() > 4) {
+        nTransactions = params[4].get_int();
+        if (nTransactions < 1) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Number of transactions must be at least 1");
+        }
+    }
+
     int nextBlockHeight = chainActive.Height() + 1;
     bool overwinterActive = NetworkUpgradeActive(nextBlockHeight, Params().GetConsensus(), Consensus::UPGRADE_OVERWINTER);
     unsigned int max_tx_size = MAX_TX_SIZE_AFTER_SAPLING;
@@ -4109,11 +4505,12 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
         }
     }
 
-    // Prepare to get coinbase utxos
-    std::vector<ShieldCoinbaseUTXO> inputs;
-    CAmount shieldedValue = 0;
+    // Prepare to get coinbase utxos, for as many transactions as the caller allows
+    std::vector<std::vector<ShieldCoinbaseUTXO>> batches(1);
+    std::vector<CAmount> batchValues(1, 0);
     CAmount remainingValue = 0;
-    size_t estimatedTxSize = 2000;  // 1802 joinsplit description + tx overhead + wiggle room
+    const size_t emptyTxSize = 2000;  // 1802 joinsplit description + tx overhead + wiggle room
+    size_t estimatedTxSize = emptyTxSize;
     size_t utxoCounter = 0;
     bool maxedOutFlag = false;
     size_t mempoolLimit = (nLimit != 0) ? nLimit : (overwinterActive ? 0 : (size_t)GetArg("-mempooltxinputlimit", 0));
@@ -4126,7 +4523,7 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
 
     // Get available utxos
     vector<COutput> vecOutputs;
-    pwalletMain->AvailableCoins(vecOutputs, true, NULL, false, true);
+    pwallet->AvailableCoins(vecOutputs, true, NULL, false, true);
 
     // Find unspent coinbase utxos and update estimated size
     BOOST_FOREACH(const COutput& out, vecOutputs) {
@@ -4154,14 +4551,21 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
         if (!maxedOutFlag) {
             size_t increase = (boost::get<CScriptID>(&address) != nullptr) ? CTXIN_SPEND_P2SH_SIZE : CTXIN_SPEND_DUST_SIZE;
             if (estimatedTxSize + increase >= max_tx_size ||
-                (mempoolLimit > 0 && utxoCounter > mempoolLimit))
+                (mempoolLimit > 0 && batches.back().size() >= mempoolLimit))
             {
-                maxedOutFlag = true;
-            } else {
+                if (batches.size() < (size_t)nTransactions) {
+                    batches.emplace_back();
+                    batchValues.push_back(0);
+                    estimatedTxSize = emptyTxSize;
+                } else {
+                    maxedOutFlag = true;
+                }
+            }
+            if (!maxedOutFlag) {
                 estimatedTxSize += increase;
                 ShieldCoinbaseUTXO utxo = {out.tx->GetHash(), out.i, scriptPubKey, nValue};
-                inputs.push_back(utxo);
-                shieldedValue += nValue;
+                batches.back().push_back(utxo);
+                batchValues.back() += nValue;
             }
         }
 
@@ -4170,20 +4574,34 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
         }
     }
 
-    size_t numUtxos = inputs.size();
-
-    if (numUtxos == 0) {
+    if (batches[0].empty()) {
         throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Could not find any coinbase funds to shield.");
     }
 
-    if (shieldedValue < nFee) {
+    // Leave the coins of any later transaction not worth its fee for another call
+    for (size_t i = batches.size() - 1; i > 0; i--) {
+        if (batchValues[i] - nFee < nFee) {
+            remainingValue += batchValues[i];
+            batches.erase(batches.begin() + i);
+            batchValues.erase(batchValues.begin() + i);
+        }
+    }
+
+    size_t numUtxos = 0;
+    CAmount shieldedValue = 0;
+    for (size_t i = 0; i < batches.size(); i++) {
+        numUtxos += batches[i].size();
+        shieldedValue += batchValues[i];
+    }
+
+    if (batchValues[0] < nFee) {
         throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS,
             strprintf("Insufficient coinbase funds, have %s, which is less than miners fee %s",
-            FormatMoney(shieldedValue), FormatMoney(nFee)));
+            FormatMoney(batchValues[0]), FormatMoney(nFee)));
     }
 
     // Check that the user specified fee is sane (if too high, it can result in error -25 absurd fee)
-    CAmount netAmount = shieldedValue - nFee;
+    CAmount netAmount = batchValues[0] - nFee;
     if (nFee > netAmount) {
         throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Fee %s is greater than the net amount to be shielded %s", FormatMoney(nFee), FormatMoney(netAmount)));
     }
@@ -4194,10 +4612,6 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
     contextInfo.push_back(Pair("toaddress", params[1]));
     contextInfo.push_back(Pair("fee", ValueFromAmount(nFee)));
 
-    // Builder (used if Sapling addresses are involved)
-    TransactionBuilder builder = TransactionBuilder(
-        Params().GetConsensus(), nextBlockHeight, pwalletMain);
-
     // Contextual transaction we will build on
     // (used if no Sapling addresses are involved)
     CMutableTransaction contextualTx = CreateNewContextualCMutableTransaction(
@@ -4206,9 +4620,24 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
         contextualTx.nVersion = 2; // Tx format should support vjoinsplits 
     }
 
+    std::vector<std::shared_ptr<AsyncRPCOperation>> operations;
+    for (const std::vector<ShieldCoinbaseUTXO>& inputs : batches) {
+        // Builder (used if Sapling addresses are involved)
+        TransactionBuilder builder = TransactionBuilder(
+            Params().GetConsensus(), nextBlockHeight, pwallet);
+
+        std::shared_ptr<AsyncRPCOperation_shieldcoinbase> shield(
+            new AsyncRPCOperation_shieldcoinbase(builder, contextualTx, inputs, destaddress, nFee, contextInfo));
+        shield->pauseMining = batches.size() == 1;
+        operations.push_back(shield);
+    }
+
     // Create operation and add to global queue
     std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
-    std::shared_ptr<AsyncRPCOperation> operation( new AsyncRPCOperation_shieldcoinbase(builder, contextualTx, inputs, destaddress, nFee, contextInfo) );
+    std::shared_ptr<AsyncRPCOperation> operation = operations[0];
+    if (operations.size() > 1) {
+        operation.reset(new AsyncRPCOperation_batch("z_shieldcoinbase", operations, contextInfo));
+    }
     q->addOperation(operation);
     AsyncRPCOperationId operationId = operation->getId();
 
@@ -4218,6 +4647,7 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
     o.push_back(Pair("remainingValue", ValueFromAmount(remainingValue)));
     o.push_back(Pair("shieldingUTXOs", static_cast<uint64_t>(numUtxos)));
     o.push_back(Pair("shieldingValue", ValueFromAmount(shieldedValue)));
+    o.push_back(Pair("transactions", static_cast<uint64_t>(operations.size())));
     o.push_back(Pair("opid", operationId));
     return o;
 }
@@ -4231,9 +4661,22 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
 #define OUTPUTDESCRIPTION_SIZE GetSerializeSize(OutputDescription(), SER_NETWORK, PROTOCOL_VERSION)
 #define SPENDDESCRIPTION_SIZE GetSerializeSize(SpendDescription(), SER_NETWORK, PROTOCOL_VERSION)
 
+// The inputs z_mergetoaddress puts in one of its transactions
+struct MergeToAddressBatch {
+    std::vector<MergeToAddressInputUTXO> utxoInputs;
+    std::vector<MergeToAddressInputSproutNote> sproutNoteInputs;
+    std::vector<MergeToAddressInputSaplingNote> saplingNoteInputs;
+    CAmount utxoValue;
+    CAmount noteValue;
+    size_t estimatedTxSize;
+
+    explicit MergeToAddressBatch(size_t estimatedTxSizeIn) : utxoValue(0), noteValue(0), estimatedTxSize(estimatedTxSizeIn) {}
+};
+
 UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     string enableArg = "zmergetoaddress";
@@ -4243,9 +4686,9 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
         strDisabledMsg = experimentalDisabledHelpMsg("z_mergetoaddress", enableArg);
     }
 
-    if (fHelp || params.size() < 2 || params.size() > 6)
+    if (fHelp || params.size() < 2 || params.size() > 7)
         throw runtime_error(
-            "z_mergetoaddress [\"fromaddress\", ... ] \"toaddress\" ( fee ) ( transparent_limit ) ( shielded_limit ) ( memo )\n"
+            "z_mergetoaddress [\"fromaddress\", ... ] \"toaddress\" ( fee ) ( transparent_limit ) ( shielded_limit ) ( memo ) ( transactions )\n"
             + strDisabledMsg +
             "\nMerge multiple UTXOs and notes into a single UTXO or note.  Coinbase UTXOs are ignored; use `z_shieldcoinbase`"
             "\nto combine those into a single note."
@@ -4255,7 +4698,7 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
             "\nparameter is set to zero, and Overwinter is not yet active, the -mempooltxinputlimit option will determine the"
             "\nnumber of UTXOs.  Any limit is constrained by the consensus rule defining a maximum transaction size of"
             + strprintf("\n%d bytes before Sapling, and %d bytes once Sapling activates.", MAX_TX_SIZE_BEFORE_SAPLING, MAX_TX_SIZE_AFTER_SAPLING)
-            + HelpRequiringPassphrase() + "\n"
+            + HelpRequiringPassphrase(pwallet) + "\n"
             "\nArguments:\n"
             "1. fromaddresses         (string, required) A JSON array with addresses.\n"
             "                         The following special strings are accepted inside the array:\n"
@@ -4275,6 +4718,9 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
             "4. shielded_limit        (numeric, optional, default="
             + strprintf("%d Sprout or %d Sapling Notes", MERGE_TO_ADDRESS_DEFAULT_SPROUT_LIMIT, MERGE_TO_ADDRESS_DEFAULT_SAPLING_LIMIT) + ") Limit on the maximum number of notes to merge.  Set to 0 to merge as many as will fit in the transaction.\n"
             "5. \"memo\"                (string, optional) Encoded as hex. When toaddress is a z-addr, this will be stored in the memo field of the new note.\n"
+            "6. transactions          (numeric, optional, default=1) Most transactions to merge in, each of them within the limits and\n"
+            "                         paying the fee.  They are proven "
+            + strprintf("%d", ASYNC_RPC_BATCH_MAX_PARALLEL) + " at a time, as far as -threads allows, under one operationid.\n"
             "\nResult:\n"
             "{\n"
             "  \"remainingUTXOs\": xxx               (numeric) Number of UTXOs still available for merging.\n"
@@ -4285,6 +4731,7 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
             "  \"mergingTransparentValue\": xxx      (numeric) Value of UTXOs being merged.\n"
             "  \"mergingNotes\": xxx                 (numeric) Number of notes being merged.\n"
             "  \"mergingShieldedValue\": xxx         (numeric) Value of notes being merged.\n"
+            "  \"transactions\": xxx                 (numeric) Number of transactions they are merged in.\n"
             "  \"opid\": xxx          (string) An operationid to pass to z_getoperationstatus to get the result of the operation.\n"
             "}\n"
             "\nExamples:\n"
@@ -4296,7 +4743,7 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_WALLET_ERROR, "Error: z_mergetoaddress is disabled.");
     }
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     bool useAnyUTXO = false;
     bool useAnySprout = false;
@@ -4418,14 +4865,17 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
         }
     }
 
+    int nTransactions = 1;
+    if (params.size() > 6) {
+        nTransactions = params[6].get_int();
+        if (nTransactions < 1) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Number of transactions must be at least 1");
+        }
+    }
+
     MergeToAddressRecipient recipient(destaddress, memo);
 
-    // Prepare to get UTXOs and notes
-    std::vector<MergeToAddressInputUTXO> utxoInputs;
-    std::vector<MergeToAddressInputSproutNote> sproutNoteInputs;
-    std::vector<MergeToAddressInputSaplingNote> saplingNoteInputs;
-    CAmount mergedUTXOValue = 0;
-    CAmount mergedNoteValue = 0;
+    // Prepare to get UTXOs and notes, for as many transactions as the caller allows
     CAmount remainingUTXOValue = 0;
     CAmount remainingNoteValue = 0;
     size_t utxoCounter = 0;
@@ -4435,17 +4885,18 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
     size_t mempoolLimit = (nUTXOLimit != 0) ? nUTXOLimit : (overwinterActive ? 0 : (size_t)GetArg("-mempooltxinputlimit", 0));
 
     unsigned int max_tx_size = saplingActive ? MAX_TX_SIZE_AFTER_SAPLING : MAX_TX_SIZE_BEFORE_SAPLING;
-    size_t estimatedTxSize = 200;  // tx overhead + wiggle room
+    size_t emptyTxSize = 200;  // tx overhead + wiggle room
     if (isToSproutZaddr) {
-        estimatedTxSize += JOINSPLIT_SIZE;
+        emptyTxSize += JOINSPLIT_SIZE;
     } else if (isToSaplingZaddr) {
-        estimatedTxSize += OUTPUTDESCRIPTION_SIZE;
+        emptyTxSize += OUTPUTDESCRIPTION_SIZE;
     }
+    std::vector<MergeToAddressBatch> batches(1, MergeToAddressBatch(emptyTxSize));
 
     if (useAnyUTXO || taddrs.size() > 0) {
         // Get available utxos
         vector<COutput> vecOutputs;
-        pwalletMain->AvailableCoins(vecOutputs, true, NULL, false, false);
+        pwallet->AvailableCoins(vecOutputs, true, NULL, false, false);
 
         // Find unspent utxos and update estimated size
         for (const COutput& out : vecOutputs) {
@@ -4469,15 +4920,21 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
 
             if (!maxedOutUTXOsFlag) {
                 size_t increase = (boost::get<CScriptID>(&address) != nullptr) ? CTXIN_SPEND_P2SH_SIZE : CTXIN_SPEND_DUST_SIZE;
-                if (estimatedTxSize + increase >= max_tx_size ||
-                    (mempoolLimit > 0 && utxoCounter > mempoolLimit))
+                if (batches.back().estimatedTxSize + increase >= max_tx_size ||
+                    (mempoolLimit > 0 && batches.back().utxoInputs.size() >= mempoolLimit))
                 {
-                    maxedOutUTXOsFlag = true;
-                } else {
-                    estimatedTxSize += increase;
+                    if (batches.size() < (size_t)nTransactions) {
+                        batches.push_back(MergeToAddressBatch(emptyTxSize));
+                    } else {
+                        maxedOutUTXOsFlag = true;
+                    }
+                }
+                if (!maxedOutUTXOsFlag) {
+                    MergeToAddressBatch& batch = batches.back();
+                    batch.estimatedTxSize += increase;
                     COutPoint utxo(out.tx->GetHash(), out.i);
-                    utxoInputs.emplace_back(utxo, nValue, scriptPubKey);
-                    mergedUTXOValue += nValue;
+                    batch.utxoInputs.emplace_back(utxo, nValue, scriptPubKey);
+                    batch.utxoValue += nValue;
                 }
             }
 
@@ -4491,7 +4948,7 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
         // Get available notes
         std::vector<CSproutNotePlaintextEntry> sproutEntries;
         std::vector<SaplingNoteEntry> saplingEntries;
-        pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, zaddrs);
+        pwallet->GetFilteredNotes(sproutEntries, saplingEntries, zaddrs);
 
         // If Sapling is not active, do not allow sending from a sapling addresses.
         if (!saplingActive && saplingEntries.size() > 0) {
@@ -4511,26 +4968,35 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
                 "Cannot send between Sprout and Sapling addresses using z_mergetoaddress");
         }
 
+        // If we haven't added any notes yet and the merge is to a
+        // z-address, we have already accounted for the first JoinSplit.
+        auto sproutIncrease = [isToSproutZaddr](const MergeToAddressBatch& batch) -> size_t {
+            return (batch.sproutNoteInputs.empty() && !isToSproutZaddr) || (batch.sproutNoteInputs.size() % 2 == 0) ? JOINSPLIT_SIZE : 0;
+        };
+
         // Find unspent notes and update estimated size
         for (const CSproutNotePlaintextEntry& entry : sproutEntries) {
             noteCounter++;
             CAmount nValue = entry.plaintext.value();
 
             if (!maxedOutNotesFlag) {
-                // If we haven't added any notes yet and the merge is to a
-                // z-address, we have already accounted for the first JoinSplit.
-                size_t increase = (sproutNoteInputs.empty() && !isToSproutZaddr) || (sproutNoteInputs.size() % 2 == 0) ? JOINSPLIT_SIZE : 0;
-                if (estimatedTxSize + increase >= max_tx_size ||
-                    (sproutNoteLimit > 0 && noteCounter > sproutNoteLimit))
+                if (batches.back().estimatedTxSize + sproutIncrease(batches.back()) >= max_tx_size ||
+                    (sproutNoteLimit > 0 && batches.back().sproutNoteInputs.size() >= (size_t)sproutNoteLimit))
                 {
-                    maxedOutNotesFlag = true;
-                } else {
-                    estimatedTxSize += increase;
+                    if (batches.size() < (size_t)nTransactions) {
+                        batches.push_back(MergeToAddressBatch(emptyTxSize));
+                    } else {
+                        maxedOutNotesFlag = true;
+                    }
+                }
+                if (!maxedOutNotesFlag) {
+                    MergeToAddressBatch& batch = batches.back();
+                    batch.estimatedTxSize += sproutIncrease(batch);
                     auto zaddr = entry.address;
                     SproutSpendingKey zkey;
-                    pwalletMain->GetSproutSpendingKey(zaddr, zkey);
-                    sproutNoteInputs.emplace_back(entry.jsop, entry.plaintext.note(zaddr), nValue, zkey);
-                    mergedNoteValue += nValue;
+                    pwallet->GetSproutSpendingKey(zaddr, zkey);
+                    batch.sproutNoteInputs.emplace_back(entry.jsop, entry.plaintext.note(zaddr), nValue, zkey);
+                    batch.noteValue += nValue;
                 }
             }
 
@@ -4544,18 +5010,24 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
             CAmount nValue = entry.note.value();
             if (!maxedOutNotesFlag) {
                 size_t increase = SPENDDESCRIPTION_SIZE;
-                if (estimatedTxSize + increase >= max_tx_size ||
-                    (saplingNoteLimit > 0 && noteCounter > saplingNoteLimit))
+                if (batches.back().estimatedTxSize + increase >= max_tx_size ||
+                    (saplingNoteLimit > 0 && batches.back().saplingNoteInputs.size() >= (size_t)saplingNoteLimit))
                 {
-                    maxedOutNotesFlag = true;
-                } else {
-                    estimatedTxSize += increase;
+                    if (batches.size() < (size_t)nTransactions) {
+                        batches.push_back(MergeToAddressBatch(emptyTxSize));
+                    } else {
+                        maxedOutNotesFlag = true;
+                    }
+                }
+                if (!maxedOutNotesFlag) {
+                    MergeToAddressBatch& batch = batches.back();
+                    batch.estimatedTxSize += increase;
                     libzcash::SaplingExtendedSpendingKey extsk;
-                    if (!pwalletMain->GetSaplingExtendedSpendingKey(entry.address, extsk)) {
+                    if (!pwallet->GetSaplingExtendedSpendingKey(entry.address, extsk)) {
                         throw JSONRPCError(RPC_INVALID_PARAMETER, "Could not find spending key for payment address.");
                     }
-                    saplingNoteInputs.emplace_back(entry.op, entry.note, nValue, extsk.expsk);
-                    mergedNoteValue += nValue;
+                    batch.saplingNoteInputs.emplace_back(entry.op, entry.note, nValue, extsk.expsk);
+                    batch.noteValue += nValue;
                 }
             }
 
@@ -4565,8 +5037,26 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
         }
     }
 
-    size_t numUtxos = utxoInputs.size();
-    size_t numNotes = sproutNoteInputs.size() + saplingNoteInputs.size();
+    // Leave the inputs of any later transaction not worth its fee for another call
+    for (size_t i = batches.size() - 1; i > 0; i--) {
+        const MergeToAddressBatch& batch = batches[i];
+        if (batch.utxoValue + batch.noteValue - nFee < nFee) {
+            remainingUTXOValue += batch.utxoValue;
+            remainingNoteValue += batch.noteValue;
+            batches.erase(batches.begin() + i);
+        }
+    }
+
+    size_t numUtxos = 0;
+    size_t numNotes = 0;
+    CAmount mergedUTXOValue = 0;
+    CAmount mergedNoteValue = 0;
+    for (const MergeToAddressBatch& batch : batches) {
+        numUtxos += batch.utxoInputs.size();
+        numNotes += batch.sproutNoteInputs.size() + batch.saplingNoteInputs.size();
+        mergedUTXOValue += batch.utxoValue;
+        mergedNoteValue += batch.noteValue;
+    }
 
     if (numUtxos == 0 && numNotes == 0) {
         throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Could not find any funds to merge.");
@@ -4580,7 +5070,7 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Destination address is also the only source address, and all its funds are already merged.");
     }
 
-    CAmount mergedValue = mergedUTXOValue + mergedNoteValue;
+    CAmount mergedValue = batches[0].utxoValue + batches[0].noteValue;
     if (mergedValue < nFee) {
         throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS,
             strprintf("Insufficient funds, have %s, which is less than miners fee %s",
@@ -4599,24 +5089,35 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
     contextInfo.push_back(Pair("toaddress", params[1]));
     contextInfo.push_back(Pair("fee", ValueFromAmount(nFee)));
 
-    // Contextual transaction we will build on
-    CMutableTransaction contextualTx = CreateNewContextualCMutableTransaction(
-        Params().GetConsensus(),
-        nextBlockHeight);
-    bool isSproutShielded = sproutNoteInputs.size() > 0 || isToSproutZaddr;
-    if (contextualTx.nVersion == 1 && isSproutShielded) {
-        contextualTx.nVersion = 2; // Tx format should support vjoinsplit
-    }
+    std::vector<std::shared_ptr<AsyncRPCOperation>> operations;
+    for (const MergeToAddressBatch& batch : batches) {
+        // Contextual transaction we will build on
+        CMutableTransaction contextualTx = CreateNewContextualCMutableTransaction(
+            Params().GetConsensus(),
+            nextBlockHeight);
+        bool isSproutShielded = batch.sproutNoteInputs.size() > 0 || isToSproutZaddr;
+        if (contextualTx.nVersion == 1 && isSproutShielded) {
+            contextualTx.nVersion = 2; // Tx format should support vjoinsplit
+        }
 
-    // Builder (used if Sapling addresses are involved)
-    boost::optional<TransactionBuilder> builder;
-    if (isToSaplingZaddr || saplingNoteInputs.size() > 0) {
-        builder = TransactionBuilder(Params().GetConsensus(), nextBlockHeight, pwalletMain);
+        // Builder (used if Sapling addresses are involved)
+        boost::optional<TransactionBuilder> builder;
+        if (isToSaplingZaddr || batch.saplingNoteInputs.size() > 0) {
+            builder = TransactionBuilder(Params().GetConsensus(), nextBlockHeight, pwallet);
+        }
+
+        std::shared_ptr<AsyncRPCOperation_mergetoaddress> merge(
+            new AsyncRPCOperation_mergetoaddress(builder, contextualTx, batch.utxoInputs, batch.sproutNoteInputs, batch.saplingNoteInputs, recipient, nFee, contextInfo));
+        merge->pauseMining = batches.size() == 1;
+        operations.push_back(merge);
     }
+
     // Create operation and add to global queue
     std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
-    std::shared_ptr<AsyncRPCOperation> operation(
-        new AsyncRPCOperation_mergetoaddress(builder, contextualTx, utxoInputs, sproutNoteInputs, saplingNoteInputs, recipient, nFee, contextInfo) );
+    std::shared_ptr<AsyncRPCOperation> operation = operations[0];
+    if (operations.size() > 1) {
+        operation.reset(new AsyncRPCOperation_batch("z_mergetoaddress", operations, contextInfo));
+    }
     q->addOperation(operation);
     AsyncRPCOperationId operationId = operation->getId();
 
@@ -4630,6 +5131,7 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
     o.push_back(Pair("mergingTransparentValue", ValueFromAmount(mergedUTXOValue)));
     o.push_back(Pair("mergingNotes", static_cast<uint64_t>(numNotes)));
     o.push_back(Pair("mergingShieldedValue", ValueFromAmount(mergedNoteValue)));
+    o.push_back(Pair("transactions", static_cast<uint64_t>(operations.size())));
     o.push_back(Pair("opid", operationId));
     return o;
 }
@@ -4637,7 +5139,8 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
 
 UniValue z_listoperationids(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
+    CWallet * const pwallet = GetWalletForJSONRPCRequest();
+    if (!EnsureWalletIsAvailable(pwallet, fHelp))
         return NullUniValue;
 
     if (fHelp || params.size() > 1)
@@ -4656,27 +5159,16 @@ UniValue z_listoperationids(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_listoperationids", "")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    std::string filter;
-    bool useFilter = false;
+    AsyncRPCOperationFilter filter;
     if (params.size()==1) {
-        filter = params[0].get_str();
-        useFilter = true;
+        filter.status = params[0].get_str();
     }
 
     UniValue ret(UniValue::VARR);
-    std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
-    std::vector<AsyncRPCOperationId> ids = q->getAllOperationIds();
-    for (auto id : ids) {
-        std::shared_ptr<AsyncRPCOperation> operation = q->getOperationForId(id);
-        if (!operation) {
-            continue;
-        }
-        std::string state = operation->getStateAsString();
-        if (useFilter && filter.compare(state)!=0)
-            continue;
-        ret.push_back(id);
+    for (const UniValue& obj : getAsyncRPCQueue()->getOperationStatuses(filter, false)) {
+        ret.push_back(find_value(obj, "id"));
     }
 
     return ret;
@@ -4691,6 +5183,7 @@ extern UniValue z_exportkey(const UniValue& params, bool fHelp);
 extern UniValue z_importkey(const UniValue& params, bool fHelp);
 extern UniValue z_exportviewingkey(const UniValue& params, bool fHelp);
 extern UniValue z_importviewingkey(const UniValue& params, bool fHelp);
+extern UniValue z_importkeys(const UniValue& params, bool fHelp);
 extern UniValue z_exportwallet(const UniValue& params, bool fHelp);
 extern UniValue z_importwallet(const UniValue& params, bool fHelp);
 
@@ -4698,76 +5191,79 @@ extern UniValue z_getpaymentdisclosure(const UniValue& params, bool fHelp); // i
 extern UniValue z_validatepaymentdisclosure(const UniValue &params, bool fHelp);
 
 static const CRPCCommand commands[] =
-{ //  category              name                        actor (function)           okSafeMode
-    //  --------------------- ------------------------    -----------------------    ----------
-    { "rawtransactions",    "fundrawtransaction",       &fundrawtransaction,       false },
-    { "hidden",             "resendwallettransactions", &resendwallettransactions, true  },
-    { "wallet",             "addmultisigaddress",       &addmultisigaddress,       true  },
-    { "wallet",             "backupwallet",             &backupwallet,             true  },
-    { "wallet",             "dumpprivkey",              &dumpprivkey,              true  },
-    { "wallet",             "dumpwallet",               &dumpwallet,               true  },
-    { "wallet",             "encryptwallet",            &encryptwallet,            true  },
-    { "wallet",             "getaccountaddress",        &getaccountaddress,        true  },
-    { "wallet",             "getaccount",               &getaccount,               true  },
-    { "wallet",             "getaddressesbyaccount",    &getaddressesbyaccount,    true  },
-    { "wallet",             "getbalance",               &getbalance,               false },
-    { "wallet",             "getnewaddress",            &getnewaddress,            true  },
-    { "wallet",             "getrawchangeaddress",      &getrawchangeaddress,      true  },
-    { "wallet",             "getreceivedbyaccount",     &getreceivedbyaccount,     false },
-    { "wallet",             "getreceivedbyaddress",     &getreceivedbyaddress,     false },
-    { "wallet",             "gettransaction",           &gettransaction,           false },
-    { "wallet",             "getunconfirmedbalance",    &getunconfirmedbalance,    false },
-    { "wallet",             "getwalletinfo",            &getwalletinfo,            false },
-    { "wallet",             "importprivkey",            &importprivkey,            true  },
-    { "wallet",             "importwallet",             &importwallet,             true  },
-    { "wallet",             "importaddress",            &importaddress,            true  },
-    { "wallet",             "keypoolrefill",            &keypoolrefill,            true  },
-    { "wallet",             "listaccounts",             &listaccounts,             false },
-    { "wallet",             "listaddressgroupings",     &listaddressgroupings,     false },
-    { "wallet",             "listlockunspent",          &listlockunspent,          false },
-    { "wallet",             "listreceivedbyaccount",    &listreceivedbyaccount,    false },
-    { "wallet",             "listreceivedbyaddress",    &listreceivedbyaddress,    false },
-    { "wallet",             "listsinceblock",           &listsinceblock,           false },
-    { "wallet",             "listtransactions",         &listtransactions,         false },
-    { "wallet",             "listunspent",              &listunspent,              false },
-    { "wallet",             "lockunspent",              &lockunspent,              true  },
-    { "wallet",             "move",                     &movecmd,                  false },
-    { "wallet",             "sendfrom",                 &sendfrom,                 false },
-    { "wallet",             "sendmany",                 &sendmany,                 false },
-    { "wallet",             "sendtoaddress",            &sendtoaddress,            false },
-    { "wallet",             "setaccount",               &setaccount,               true  },
-    { "wallet",             "settxfee",                 &settxfee,                 true  },
-    { "wallet",             "signmessage",              &signmessage,              true  },
-    { "wallet",             "walletlock",               &walletlock,               true  },
-    { "wallet",             "walletpassphrasechange",   &walletpassphrasechange,   true  },
-    { "wallet",             "walletpassphrase",         &walletpassphrase,         true  },
-    { "wallet",             "zcbenchmark",              &zc_benchmark,             true  },
-    { "wallet",             "zcrawkeygen",              &zc_raw_keygen,            true  },
-    { "wallet",             "zcrawjoinsplit",           &zc_raw_joinsplit,         true  },
-    { "wallet",             "zcrawreceive",             &zc_raw_receive,           true  },
-    { "wallet",             "zcsamplejoinsplit",        &zc_sample_joinsplit,      true  },
-    { "wallet",             "z_listreceivedbyaddress",  &z_listreceivedbyaddress,  false },
-    { "wallet",             "z_listunspent",            &z_listunspent,            false },
-    { "wallet",             "z_listunshielded",         &z_listunshielded,         false },
-    { "wallet",             "z_getbalance",             &z_getbalance,             false },
-    { "wallet",             "z_gettotalbalance",        &z_gettotalbalance,        false },
-    { "wallet",             "z_mergetoaddress",         &z_mergetoaddress,         false },
-    { "wallet",             "z_sendmany",               &z_sendmany,               false },
-    { "wallet",             "z_shieldcoinbase",         &z_shieldcoinbase,         false },
-    { "wallet",             "z_getoperationstatus",     &z_getoperationstatus,     true  },
-    { "wallet",             "z_getoperationresult",     &z_getoperationresult,     true  },
-    { "wallet",             "z_listoperationids",       &z_listoperationids,       true  },
-    { "wallet",             "z_getnewaddress",          &z_getnewaddress,          true  },
-    { "wallet",             "z_listaddresses",          &z_listaddresses,          true  },
-    { "wallet",             "z_exportkey",              &z_exportkey,              true  },
-    { "wallet",             "z_importkey",              &z_importkey,              true  },
-    { "wallet",             "z_exportviewingkey",       &z_exportviewingkey,       true  },
-    { "wallet",             "z_importviewingkey",       &z_importviewingkey,       true  },
-    { "wallet",             "z_exportwallet",           &z_exportwallet,           true  },
-    { "wallet",             "z_importwallet",           &z_importwallet,           true  },
+{ //  category              name                        actor (function)           okSafeMode  okParallel
+    //  --------------------- ------------------------    -----------------------    ----------  ----------
+    { "rawtransactions",    "fundrawtransaction",       &fundrawtransaction,       false, false },
+    { "hidden",             "resendwallettransactions", &resendwallettransactions, true,  false },
+    { "wallet",             "addmultisigaddress",       &addmultisigaddress,       true,  false },
+    { "wallet",             "backupwallet",             &backupwallet,             true,  false },
+    { "wallet",             "dumpprivkey",              &dumpprivkey,              true,  false },
+    { "wallet",             "dumpwallet",               &dumpwallet,               true,  false },
+    { "wallet",             "encryptwallet",            &encryptwallet,            true,  false },
+    { "wallet",             "getaccountaddress",        &getaccountaddress,        true,  false },
+    { "wallet",             "getaccount",               &getaccount,               true,  false },
+    { "wallet",             "getaddressesbyaccount",    &getaddressesbyaccount,    true,  false },
+    { "wallet",             "getbalance",               &getbalance,               false, false },
+    { "wallet",             "getnewaddress",            &getnewaddress,            true,  false },
+    { "wallet",             "getrawchangeaddress",      &getrawchangeaddress,      true,  false },
+    { "wallet",             "getrescaninfo",            &getrescaninfo,            true,  false },
+    { "wallet",             "getreceivedbyaccount",     &getreceivedbyaccount,     false, false },
+    { "wallet",             "getreceivedbyaddress",     &getreceivedbyaddress,     false, false },
+    { "wallet",             "gettransaction",           &gettransaction,           false, false },
+    { "wallet",             "getunconfirmedbalance",    &getunconfirmedbalance,    false, false },
+    { "wallet",             "getwalletinfo",            &getwalletinfo,            false, false },
+    { "wallet",             "importprivkey",            &importprivkey,            true,  false },
+    { "wallet",             "importwallet",             &importwallet,             true,  false },
+    { "wallet",             "importaddress",            &importaddress,            true,  false },
+    { "wallet",             "keypoolrefill",            &keypoolrefill,            true,  false },
+    { "wallet",             "listaccounts",             &listaccounts,             false, false },
+    { "wallet",             "listaddressgroupings",     &listaddressgroupings,     false, false },
+    { "wallet",             "listlockunspent",          &listlockunspent,          false, false },
+    { "wallet",             "listreceivedbyaccount",    &listreceivedbyaccount,    false, false },
+    { "wallet",             "listreceivedbyaddress",    &listreceivedbyaddress,    false, false },
+    { "wallet",             "listsinceblock",           &listsinceblock,           false, false },
+    { "wallet",             "listtransactions",         &listtransactions,         false, false },
+    { "wallet",             "listunspent",              &listunspent,              false, false },
+    { "wallet",             "lockunspent",              &lockunspent,              true,  false },
+    { "wallet",             "move",                     &movecmd,                  false, false },
+    { "wallet",             "sendfrom",                 &sendfrom,                 false, false },
+    { "wallet",             "sendmany",                 &sendmany,                 false, false },
+    { "wallet",             "sendtoaddress",            &sendtoaddress,            false, false },
+    { "wallet",             "setaccount",               &setaccount,               true,  false },
+    { "wallet",             "settxfee",                 &settxfee,                 true,  false },
+    { "wallet",             "signmessage",              &signmessage,              true,  false },
+    { "wallet",             "walletlock",               &walletlock,               true,  false },
+    { "wallet",             "walletpassphrasechange",   &walletpassphrasechange,   true,  false },
+    { "wallet",             "walletpassphrase",         &walletpassphrase,         true,  false },
+    { "wallet",             "zcbenchmark",              &zc_benchmark,             true,  false },
+    { "wallet",             "zcrawkeygen",              &zc_raw_keygen,            true,  false },
+    { "wallet",             "zcrawjoinsplit",           &zc_raw_joinsplit,         true,  false },
+    { "wallet",             "zcrawreceive",             &zc_raw_receive,           true,  false },
+    { "wallet",             "zcsamplejoinsplit",        &zc_sample_joinsplit,      true,  false },
+    { "wallet",             "z_listreceivedbyaddress",  &z_listreceivedbyaddress,  false, false },
+    { "wallet",             "z_listunspent",            &z_listunspent,            false, false },
+    { "wallet",             "z_listunshielded",         &z_listunshielded,         false, false },
+    { "wallet",             "z_getbalance",             &z_getbalance,             false, false },
+    { "wallet",             "z_gettotalbalance",        &z_gettotalbalance,        false, false },
+    { "wallet",             "z_mergetoaddress",         &z_mergetoaddress,         false, false },
+    { "wallet",             "z_sendmany",               &z_sendmany,               false, false },
+    { "wallet",             "z_shieldcoinbase",         &z_shieldcoinbase,         false, false },
+    { "wallet",             "z_getoperationstatus",     &z_getoperationstatus,     true,  false },
+    { "wallet",             "z_getoperationresult",     &z_getoperationresult,     true,  false },
+    { "wallet",             "z_listoperationids",       &z_listoperationids,       true,  false },
+    { "wallet",             "z_getnewaddress",          &z_getnewaddress,          true,  false },
+    { "wallet",             "z_getnewaddresses",        &z_getnewaddresses,        true,  false },
+    { "wallet",             "z_listaddresses",          &z_listaddresses,          true,  false },
+    { "wallet",             "z_exportkey",              &z_exportkey,              true,  false },
+    { "wallet",             "z_importkey",              &z_importkey,              true,  false },
+    { "wallet",             "z_exportviewingkey",       &z_exportviewingkey,       true,  false },
+    { "wallet",             "z_importviewingkey",       &z_importviewingkey,       true,  false },
+    { "wallet",             "z_importkeys",             &z_importkeys,             true,  false },
+    { "wallet",             "z_exportwallet",           &z_exportwallet,           true,  false },
+    { "wallet",             "z_importwallet",           &z_importwallet,           true,  false },
     // TODO: rearrange into another category
-    { "disclosure",         "z_getpaymentdisclosure",   &z_getpaymentdisclosure,   true  },
-    { "disclosure",         "z_validatepaymentdisclosure", &z_validatepaymentdisclosure, true }
+    { "disclosure",         "z_getpaymentdisclosure",   &z_getpaymentdisclosure,   true,  false },
+    { "disclosure",         "z_validatepaymentdisclosure", &z_validatepaymentdisclosure, true,  false }
 };
 
 void RegisterWalletRPCCommands(CRPCTable &tableRPC)
@@ -6,7 +6,15 @@
 #define BITCOIN_WALLET_RPCWALLET_H
 
 class CRPCTable;
+class CWallet;
 
 void RegisterWalletRPCCommands(CRPCTable &tableRPC);
 
+/**
+ * The wallet a call is for: the one named by a request to /wallet/<name>,
+ * and the default wallet, if any, for requests to anywhere else. Throws
+ * RPC_WALLET_NOT_FOUND if no wallet of that name is loaded.
+ */
+CWallet* GetWalletForJSONRPCRequest();
+
 #endif //BITCOIN_WALLET_RPCWALLET_H
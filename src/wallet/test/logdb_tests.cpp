@@ -0,0 +1,173 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/logdb.h"
+
+#include "test/test_bitcoin.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(logdb_tests, TestingSetup)
+
+static CLogDB::Bytes B(const std::string& str)
+{
+    return CLogDB::Bytes(str.begin(), str.end());
+}
+
+static std::string S(const CLogDB::Bytes& vch)
+{
+    return std::string(vch.begin(), vch.end());
+}
+
+static void Put(CLogDB& log, const std::string& strKey, const std::string& strValue)
+{
+    CLogDB::Batch batch;
+    batch.Put(B(strKey), B(strValue));
+    BOOST_CHECK(log.Write(batch, false));
+}
+
+BOOST_AUTO_TEST_CASE(logdb_replay)
+{
+    boost::filesystem::path path = pathTemp / "replay.dat";
+    std::string strError;
+    CLogDB::Bytes value;
+    {
+        CLogDB log(path);
+        BOOST_CHECK(log.Open(false, strError));
+        BOOST_CHECK(CLogDB::IsLogFile(path));
+        Put(log, "b", "1");
+        Put(log, "a", "2");
+        Put(log, "b", "3");
+
+        CLogDB::Batch batch;
+        batch.Put(B("c"), B("4"));
+        batch.Erase(B("a"));
+        BOOST_CHECK_EQUAL(batch.Find(B("a"), NULL), -1);
+        BOOST_CHECK_EQUAL(batch.Find(B("c"), &value), 1);
+        BOOST_CHECK_EQUAL(batch.Find(B("d"), NULL), 0);
+        BOOST_CHECK(log.Write(batch, true));
+    }
+
+    CLogDB log(path);
+    BOOST_CHECK(log.Open(false, strError));
+    BOOST_CHECK_EQUAL(log.GetCount(), 2U);
+    BOOST_CHECK(!log.Exists(B("a")));
+    BOOST_CHECK(log.Read(B("b"), value));
+    BOOST_CHECK_EQUAL(S(value), "3");
+
+    // Records come back in key order
+    CLogDB::Bytes key;
+    BOOST_CHECK(log.Seek(CLogDB::Bytes(), true, key, value));
+    BOOST_CHECK_EQUAL(S(key), "b");
+    BOOST_CHECK(log.Seek(key, false, key, value));
+    BOOST_CHECK_EQUAL(S(key), "c");
+    BOOST_CHECK(!log.Seek(key, false, key, value));
+
+    BOOST_CHECK(!CLogDB::IsLogFile(pathTemp / "missing.dat"));
+}
+
+BOOST_AUTO_TEST_CASE(logdb_torn_tail)
+{
+    boost::filesystem::path path = pathTemp / "torn.dat";
+    std::string strError;
+    uint64_t nSize;
+    {
+        CLogDB log(path);
+        BOOST_CHECK(log.Open(false, strError));
+        Put(log, "kept", "1");
+        nSize = log.GetFileSize();
+        Put(log, "lost", "2");
+    }
+
+    // Cut the last batch short, as a crash while appending it would
+    boost::filesystem::resize_file(path, boost::filesystem::file_size(path) - 1);
+
+    CLogDB log(path);
+    BOOST_CHECK(log.Open(false, strError));
+    BOOST_CHECK(log.Exists(B("kept")));
+    BOOST_CHECK(!log.Exists(B("lost")));
+    BOOST_CHECK_EQUAL(log.GetFileSize(), nSize);
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(path), nSize);
+
+    // What follows is appended after the last good batch
+    Put(log, "next", "3");
+    log.Close();
+    BOOST_CHECK(log.Open(false, strError));
+    BOOST_CHECK_EQUAL(log.GetCount(), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(logdb_corrupt)
+{
+    boost::filesystem::path path = pathTemp / "corrupt.dat";
+    std::string strError;
+    uint64_t nSize;
+    {
+        CLogDB log(path);
+        BOOST_CHECK(log.Open(false, strError));
+        Put(log, "first", "1");
+        nSize = log.GetFileSize();
+        Put(log, "second", "2");
+        Put(log, "third", "3");
+    }
+
+    // Flip the last byte of the second batch
+    FILE* file = fopen(path.string().c_str(), "r+b");
+    BOOST_REQUIRE(file);
+    int nOffset = nSize + 8 + 1 + 1 + 6 + 1;
+    fseek(file, nOffset, SEEK_SET);
+    int c = fgetc(file);
+    fseek(file, nOffset, SEEK_SET);
+    fputc(c ^ 0xff, file);
+    fclose(file);
+
+    CLogDB log(path);
+    BOOST_CHECK(!log.Open(false, strError));
+    BOOST_CHECK(strError.find("corrupt") != std::string::npos);
+
+    BOOST_CHECK(log.Open(true, strError));
+    BOOST_CHECK_EQUAL(log.GetCount(), 1U);
+    BOOST_CHECK(log.Exists(B("first")));
+    BOOST_CHECK_EQUAL(log.GetFileSize(), nSize);
+}
+
+BOOST_AUTO_TEST_CASE(logdb_compact)
+{
+    boost::filesystem::path path = pathTemp / "compact.dat";
+    std::string strError;
+    CLogDB log(path);
+    BOOST_CHECK(log.Open(false, strError));
+
+    std::string strValue(1000, 'x');
+    for (int i = 0; i < 2000; i++)
+        Put(log, "key", strValue + strprintf("%d", i));
+    Put(log, "\x04poolA", "1");
+    Put(log, "\x04poolB", "2");
+    Put(log, "other", "3");
+    BOOST_CHECK(log.NeedsCompaction());
+
+    uint64_t nSize = log.GetFileSize();
+    BOOST_CHECK(log.Compact("\x04pool"));
+    BOOST_CHECK(log.GetFileSize() < nSize / 100);
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(path), log.GetFileSize());
+    BOOST_CHECK(!log.NeedsCompaction());
+    BOOST_CHECK(!log.Exists(B("\x04poolA")));
+    BOOST_CHECK_EQUAL(log.GetCount(), 2U);
+
+    // The compacted file is appended to, and replays as it was
+    Put(log, "after", "4");
+    log.Close();
+    BOOST_CHECK(log.Open(false, strError));
+    BOOST_CHECK_EQUAL(log.GetCount(), 3U);
+    CLogDB::Bytes value;
+    BOOST_CHECK(log.Read(B("key"), value));
+    BOOST_CHECK_EQUAL(S(value), strValue + "1999");
+    BOOST_CHECK(!boost::filesystem::exists(path.string() + ".compact"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "wallet/wallet.h"
+#include "wallet/coinselection.h"
 
 #include <set>
 #include <stdint.h>
@@ -307,4 +308,115 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(coin_selection_bnb)
+{
+    vector<char> vfBest;
+    CAmount nBest;
+
+    vector<CAmount> vValue;
+    vValue.push_back(8 * CENT);
+    vValue.push_back(7 * CENT);
+    vValue.push_back(6 * CENT);
+    vValue.push_back(5 * CENT);
+
+    // 6 + 5 is the only way to make 11 exactly
+    BOOST_CHECK(SelectCoinsBnB(vValue, 11 * CENT, 1, vfBest, nBest));
+    BOOST_CHECK_EQUAL(nBest, 11 * CENT);
+    BOOST_CHECK(!vfBest[0] && !vfBest[1] && vfBest[2] && vfBest[3]);
+
+    // No subset makes 16 or 17 cents, and 7 + 6 + 5 = 18 is the closest above
+    BOOST_CHECK(!SelectCoinsBnB(vValue, 16 * CENT, 1, vfBest, nBest));
+    BOOST_CHECK(!SelectCoinsBnB(vValue, 16 * CENT, 2 * CENT, vfBest, nBest));
+    BOOST_CHECK(SelectCoinsBnB(vValue, 16 * CENT, 3 * CENT, vfBest, nBest));
+    BOOST_CHECK_EQUAL(nBest, 18 * CENT);
+
+    // More than everything
+    BOOST_CHECK(!SelectCoinsBnB(vValue, 27 * CENT, 10 * CENT, vfBest, nBest));
+    BOOST_CHECK(SelectCoinsBnB(vValue, 26 * CENT, 1, vfBest, nBest));
+    BOOST_CHECK_EQUAL(nBest, 26 * CENT);
+
+    // Many identical values are searched once, not once per combination
+    vValue.assign(100000, COIN);
+    vValue.push_back(CENT);
+    BOOST_CHECK(SelectCoinsBnB(vValue, 50000 * COIN + CENT, 1, vfBest, nBest));
+    BOOST_CHECK_EQUAL(nBest, 50000 * COIN + CENT);
+    BOOST_CHECK(!SelectCoinsBnB(vValue, 50000 * COIN + 2 * CENT, 1, vfBest, nBest));
+
+    // Consolidation takes the smallest unselected values
+    vValue.clear();
+    vValue.push_back(5 * CENT);
+    vValue.push_back(3 * CENT);
+    vValue.push_back(2 * CENT);
+    vValue.push_back(1 * CENT);
+    vector<char> vfSelected(vValue.size(), false);
+    vfSelected[3] = true;
+    BOOST_CHECK_EQUAL(SelectConsolidationInputs(vValue, vfSelected, 2), 5 * CENT);
+    BOOST_CHECK(!vfSelected[0] && vfSelected[1] && vfSelected[2] && vfSelected[3]);
+    BOOST_CHECK_EQUAL(SelectConsolidationInputs(vValue, vfSelected, 2), 5 * CENT);
+    BOOST_CHECK_EQUAL(SelectConsolidationInputs(vValue, vfSelected, 2), 0);
+}
+
+BOOST_AUTO_TEST_CASE(coin_selection_consolidation)
+{
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+
+    LOCK(wallet.cs_wallet);
+
+    empty_wallet();
+    add_coin(1 * CENT);
+    add_coin(2 * CENT);
+    add_coin(4 * CENT);
+    add_coin(20 * CENT);
+
+    // Without change nothing is added, even when asked to consolidate
+    nConsolidateInputs = 2;
+    BOOST_CHECK(wallet.SelectCoinsMinConf(6 * CENT, 1, 1, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 6 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+
+    // 4.5 cents is best made as 4 + 2 with change, and the 1 cent coin
+    // comes along
+    BOOST_CHECK(wallet.SelectCoinsMinConf(4.5 * CENT, 1, 1, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 7 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 3U);
+
+    nConsolidateInputs = DEFAULT_CONSOLIDATE_INPUTS;
+    BOOST_CHECK(wallet.SelectCoinsMinConf(4.5 * CENT, 1, 1, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 6 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+
+    empty_wallet();
+}
+
+BOOST_AUTO_TEST_CASE(ismine_cache)
+{
+    CWallet keystore;
+    LOCK(keystore.cs_wallet);
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    CTxOut txout(COIN, GetScriptForDestination(pubkey.GetID()));
+    CMutableTransaction mtx;
+    mtx.vout.push_back(txout);
+    CWalletTx wtx(&keystore, mtx);
+
+    BOOST_CHECK(keystore.IsMine(txout) == ISMINE_NO);
+    BOOST_CHECK(wtx.IsMine(0) == ISMINE_NO);
+    // Asked again, the cached answers are given
+    BOOST_CHECK(keystore.IsMine(txout) == ISMINE_NO);
+    BOOST_CHECK_EQUAL(wtx.GetOutputsCredit(ISMINE_ALL), 0);
+
+    // Each change to the keystore makes both caches start over
+    BOOST_CHECK(keystore.AddWatchOnly(txout.scriptPubKey));
+    BOOST_CHECK(keystore.IsMine(txout) == ISMINE_WATCH_ONLY);
+    BOOST_CHECK(wtx.IsMine(0) == ISMINE_WATCH_ONLY);
+
+    BOOST_CHECK(keystore.AddKeyPubKey(key, pubkey));
+    BOOST_CHECK(keystore.IsMine(txout) == ISMINE_SPENDABLE);
+    BOOST_CHECK(wtx.IsMine(0) == ISMINE_SPENDABLE);
+    BOOST_CHECK_EQUAL(wtx.GetOutputsCredit(ISMINE_SPENDABLE), COIN);
+    BOOST_CHECK_EQUAL(wtx.GetOutputsCredit(ISMINE_WATCH_ONLY), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -7,24 +7,31 @@
 #include "wallet/wallet.h"
 
 #include "checkpoints.h"
+#include "checkqueue.h"
 #include "coincontrol.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
 #include "consensus/consensus.h"
+#include "core_memusage.h"
 #include "init.h"
 #include "key_io.h"
 #include "main.h"
+#include "memusage.h"
 #include "net.h"
+#include "notifysink.h"
 #include "rpc/protocol.h"
 #include "script/script.h"
 #include "script/sign.h"
 #include "timedata.h"
+#include "txdb.h"
 #include "utilmoneystr.h"
+#include "wallet/coinselection.h"
 #include "zcash/Note.hpp"
 #include "crypter.h"
 #include "zcash/zip32.h"
 
 #include <assert.h>
+#include <deque>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
@@ -38,8 +45,10 @@ CFeeRate payTxFee(DEFAULT_TRANSACTION_FEE);
 CAmount maxTxFee = DEFAULT_TRANSACTION_MAXFEE;
 unsigned int nTxConfirmTarget = DEFAULT_TX_CONFIRM_TARGET;
 bool bSpendZeroConfChange = true;
+unsigned int nConsolidateInputs = DEFAULT_CONSOLIDATE_INPUTS;
 bool fSendFreeTransactions = false;
 bool fPayAtLeastCustomFee = true;
+bool fWalletCompactTx = DEFAULT_WALLET_COMPACT_TX;
 
 /**
  * Fees smaller than this (in satoshi) are considered zero fee (for transaction creation)
@@ -95,6 +104,7 @@ libzcash::SproutPaymentAddress CWallet::GenerateNewSproutZKey()
     // Create new metadata
     int64_t nCreationTime = GetTime();
     mapSproutZKeyMetadata[addr] = CKeyMetadata(nCreationTime);
+    UpdateTimeFirstKey(nCreationTime);
 
     if (!AddSproutZKey(k))
         throw std::runtime_error("CWallet::GenerateNewSproutZKey(): AddSproutZKey failed");
@@ -103,12 +113,18 @@ libzcash::SproutPaymentAddress CWallet::GenerateNewSproutZKey()
 
 // Generate a new Sapling spending key and return its public payment address
 SaplingPaymentAddress CWallet::GenerateNewSaplingZKey()
+{
+    return GenerateNewSaplingZKeys(1)[0];
+}
+
+std::vector<SaplingPaymentAddress> CWallet::GenerateNewSaplingZKeys(size_t nKeys)
 {
     AssertLockHeld(cs_wallet); // mapSaplingZKeyMetadata
 
     // Create new metadata
     int64_t nCreationTime = GetTime();
     CKeyMetadata metadata(nCreationTime);
+    UpdateTimeFirstKey(nCreationTime);
 
     // Try to get the seed
     HDSeed seed;
@@ -121,33 +137,65 @@ SaplingPaymentAddress CWallet::GenerateNewSaplingZKey()
     // We use a fixed keypath scheme of m/32'/coin_type'/account'
     // Derive m/32'
     auto m_32h = m.Derive(32 | ZIP32_HARDENED_KEY_LIMIT);
-    // Derive m/32'/coin_type'
+    // Derive m/32'/coin_type', which every account key below is derived from
     auto m_32h_cth = m_32h.Derive(bip44CoinType | ZIP32_HARDENED_KEY_LIMIT);
 
-    // Derive account key at next index, skip keys already known to the wallet
-    libzcash::SaplingExtendedSpendingKey xsk;
-    do
-    {
-        xsk = m_32h_cth.Derive(hdChain.saplingAccountCounter | ZIP32_HARDENED_KEY_LIMIT);
-        metadata.hdKeypath = "m/32'/" + std::to_string(bip44CoinType) + "'/" + std::to_string(hdChain.saplingAccountCounter) + "'";
-        metadata.seedFp = hdChain.seedFp;
-        // Increment childkey index
-        hdChain.saplingAccountCounter++;
-    } while (HaveSaplingSpendingKey(xsk.expsk.full_viewing_key()));
+    std::vector<libzcash::SaplingExtendedSpendingKey> vxsk;
+    std::vector<libzcash::SaplingFullViewingKey> vfvk;
+    std::vector<SaplingPaymentAddress> addrs;
+    std::vector<uint32_t> vAccounts;
+    while (vxsk.size() < nKeys) {
+        // Derive account keys at the next indexes. Each only depends on
+        // m/32'/coin_type', so the -par threads can share them out.
+        size_t nBatch = nKeys - vxsk.size();
+        uint32_t nFirst = hdChain.saplingAccountCounter;
+        std::vector<libzcash::SaplingExtendedSpendingKey> vDerived(nBatch);
+        std::vector<libzcash::SaplingFullViewingKey> vFvk(nBatch);
+        std::vector<SaplingPaymentAddress> vAddr(nBatch);
+        std::atomic<size_t> nNext(0);
+        auto derive = [&]() {
+            for (size_t i = nNext++; i < nBatch; i = nNext++) {
+                vDerived[i] = m_32h_cth.Derive((nFirst + i) | ZIP32_HARDENED_KEY_LIMIT);
+                vFvk[i] = vDerived[i].expsk.full_viewing_key();
+                vAddr[i] = vDerived[i].DefaultAddress();
+            }
+        };
+        boost::thread_group workers;
+        for (int i = 1; i < std::min<int>(nBatch, nScriptCheckThreads); i++)
+            workers.create_thread(derive);
+        derive();
+        workers.join_all();
+
+        // Increment childkey index, and skip keys already known to the wallet
+        hdChain.saplingAccountCounter += nBatch;
+        for (size_t i = 0; i < nBatch; i++) {
+            if (!HaveSaplingSpendingKey(vFvk[i])) {
+                vxsk.push_back(vDerived[i]);
+                vfvk.push_back(vFvk[i]);
+                addrs.push_back(vAddr[i]);
+                vAccounts.push_back(nFirst + i);
+            }
+        }
+    }
 
     // Update the chain model in the database
-    if (fFileBacked && !CWalletDB(strWalletFile).WriteHDChain(hdChain))
-        throw std::runtime_error("CWallet::GenerateNewSaplingZKey(): Writing HD chain model failed");
+    if (fFileBacked) {
+        bool fWritten = pwalletdbBatch ? pwalletdbBatch->WriteHDChain(hdChain) : CWalletDB(strWalletFile).WriteHDChain(hdChain);
+        if (!fWritten)
+            throw std::runtime_error("CWallet::GenerateNewSaplingZKey(): Writing HD chain model failed");
+    }
 
-    auto ivk = xsk.expsk.full_viewing_key().in_viewing_key();
-    mapSaplingZKeyMetadata[ivk] = metadata;
+    for (size_t i = 0; i < vxsk.size(); i++) {
+        metadata.hdKeypath = "m/32'/" + std::to_string(bip44CoinType) + "'/" + std::to_string(vAccounts[i]) + "'";
+        metadata.seedFp = hdChain.seedFp;
+        mapSaplingZKeyMetadata[vfvk[i].in_viewing_key()] = metadata;
 
-    auto addr = xsk.DefaultAddress();
-    if (!AddSaplingZKey(xsk, addr)) {
-        throw std::runtime_error("CWallet::GenerateNewSaplingZKey(): AddSaplingZKey failed");
+        if (!AddSaplingZKey(vxsk[i], addrs[i])) {
+            throw std::runtime_error("CWallet::GenerateNewSaplingZKey(): AddSaplingZKey failed");
+        }
     }
-    // return default sapling payment address.
-    return addr;
+    // return default sapling payment addresses.
+    return addrs;
 }
 
 // Add spending key to keystore
@@ -167,6 +215,9 @@ bool CWallet::AddSaplingZKey(
 
     if (!IsCrypted()) {
         auto ivk = sk.expsk.full_viewing_key().in_viewing_key();
+        if (pwalletdbBatch) {
+            return pwalletdbBatch->WriteSaplingZKey(ivk, sk, mapSaplingZKeyMetadata[ivk]);
+        }
         return CWalletDB(strWalletFile).WriteSaplingZKey(ivk, sk, mapSaplingZKeyMetadata[ivk]);
     }
 
@@ -189,6 +240,9 @@ bool CWallet::AddSaplingIncomingViewingKey(
     }
 
     if (!IsCrypted()) {
+        if (pwalletdbBatch) {
+            return pwalletdbBatch->WriteSaplingPaymentAddress(addr, ivk);
+        }
         return CWalletDB(strWalletFile).WriteSaplingPaymentAddress(addr, ivk);
     }
 
@@ -213,6 +267,9 @@ bool CWallet::AddSproutZKey(const libzcash::SproutSpendingKey &key)
         return true;
 
     if (!IsCrypted()) {
+        if (pwalletdbBatch) {
+            return pwalletdbBatch->WriteZKey(addr, key, mapSproutZKeyMetadata[addr]);
+        }
         return CWalletDB(strWalletFile).WriteZKey(addr,
                                                   key,
                                                   mapSproutZKeyMetadata[addr]);
@@ -238,8 +295,7 @@ CPubKey CWallet::GenerateNewKey()
     // Create new metadata
     int64_t nCreationTime = GetTime();
     mapKeyMetadata[pubkey.GetID()] = CKeyMetadata(nCreationTime);
-    if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
-        nTimeFirstKey = nCreationTime;
+    UpdateTimeFirstKey(nCreationTime);
 
     if (!AddKeyPubKey(secret, pubkey))
         throw std::runtime_error("CWallet::GenerateNewKey(): AddKey failed");
@@ -251,6 +307,7 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    MarkIsMineDirty();
 
     // check if we need to remove from watch-only
     CScript script;
@@ -261,6 +318,9 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     if (!fFileBacked)
         return true;
     if (!IsCrypted()) {
+        if (pwalletdbBatch) {
+            return pwalletdbBatch->WriteKey(pubkey, secret.GetPrivKey(), mapKeyMetadata[pubkey.GetID()]);
+        }
         return CWalletDB(strWalletFile).WriteKey(pubkey,
                                                  secret.GetPrivKey(),
                                                  mapKeyMetadata[pubkey.GetID()]);
@@ -274,6 +334,7 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
 
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
+    MarkIsMineDirty();
     if (!fFileBacked)
         return true;
     {
@@ -282,6 +343,10 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
             return pwalletdbEncryption->WriteCryptedKey(vchPubKey,
                                                         vchCryptedSecret,
                                                         mapKeyMetadata[vchPubKey.GetID()]);
+        else if (pwalletdbBatch)
+            return pwalletdbBatch->WriteCryptedKey(vchPubKey,
+                                                   vchCryptedSecret,
+                                                   mapKeyMetadata[vchPubKey.GetID()]);
         else
             return CWalletDB(strWalletFile).WriteCryptedKey(vchPubKey,
                                                             vchCryptedSecret,
@@ -307,6 +372,11 @@ bool CWallet::AddCryptedSproutSpendingKey(
                                                          rk,
                                                          vchCryptedSecret,
                                                          mapSproutZKeyMetadata[address]);
+        } else if (pwalletdbBatch) {
+            return pwalletdbBatch->WriteCryptedZKey(address,
+                                                    rk,
+                                                    vchCryptedSecret,
+                                                    mapSproutZKeyMetadata[address]);
         } else {
             return CWalletDB(strWalletFile).WriteCryptedZKey(address,
                                                              rk,
@@ -331,6 +401,10 @@ bool CWallet::AddCryptedSaplingSpendingKey(const libzcash::SaplingExtendedFullVi
             return pwalletdbEncryption->WriteCryptedSaplingZKey(extfvk,
                                                          vchCryptedSecret,
                                                          mapSaplingZKeyMetadata[extfvk.fvk.in_viewing_key()]);
+        } else if (pwalletdbBatch) {
+            return pwalletdbBatch->WriteCryptedSaplingZKey(extfvk,
+                                                    vchCryptedSecret,
+                                                    mapSaplingZKeyMetadata[extfvk.fvk.in_viewing_key()]);
         } else {
             return CWalletDB(strWalletFile).WriteCryptedSaplingZKey(extfvk,
                                                          vchCryptedSecret,
@@ -343,23 +417,42 @@ bool CWallet::AddCryptedSaplingSpendingKey(const libzcash::SaplingExtendedFullVi
 bool CWallet::LoadKeyMetadata(const CPubKey &pubkey, const CKeyMetadata &meta)
 {
     AssertLockHeld(cs_wallet); // mapKeyMetadata
-    if (meta.nCreateTime && (!nTimeFirstKey || meta.nCreateTime < nTimeFirstKey))
-        nTimeFirstKey = meta.nCreateTime;
+    UpdateTimeFirstKey(meta.nCreateTime);
 
     mapKeyMetadata[pubkey.GetID()] = meta;
     return true;
 }
 
+void CWallet::UpdateTimeFirstKey(int64_t nCreateTime)
+{
+    if (!nCreateTime)
+        nTimeFirstKey = 1; // 0 would be considered 'no value'
+    else if (!nTimeFirstKey || nCreateTime < nTimeFirstKey)
+        nTimeFirstKey = nCreateTime;
+}
+
 bool CWallet::LoadZKeyMetadata(const SproutPaymentAddress &addr, const CKeyMetadata &meta)
 {
     AssertLockHeld(cs_wallet); // mapSproutZKeyMetadata
+    UpdateTimeFirstKey(meta.nCreateTime);
     mapSproutZKeyMetadata[addr] = meta;
     return true;
 }
 
+bool CWallet::LoadKey(const CKey& key, const CPubKey &pubkey)
+{
+    if (!CCryptoKeyStore::AddKeyPubKey(key, pubkey))
+        return false;
+    MarkIsMineDirty();
+    return true;
+}
+
 bool CWallet::LoadCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret)
 {
-    return CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret);
+    if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
+        return false;
+    MarkIsMineDirty();
+    return true;
 }
 
 bool CWallet::LoadCryptedZKey(const libzcash::SproutPaymentAddress &addr, const libzcash::ReceivingKey &rk, const std::vector<unsigned char> &vchCryptedSecret)
@@ -377,6 +470,7 @@ bool CWallet::LoadCryptedSaplingZKey(
 bool CWallet::LoadSaplingZKeyMetadata(const libzcash::SaplingIncomingViewingKey &ivk, const CKeyMetadata &meta)
 {
     AssertLockHeld(cs_wallet); // mapSaplingZKeyMetadata
+    UpdateTimeFirstKey(meta.nCreateTime);
     mapSaplingZKeyMetadata[ivk] = meta;
     return true;
 }
@@ -399,15 +493,21 @@ bool CWallet::LoadZKey(const libzcash::SproutSpendingKey &key)
 }
 
 bool CWallet::AddSproutViewingKey(const libzcash::SproutViewingKey &vk)
+{
+    // No birthday information
+    return AddSproutViewingKey(vk, CKeyMetadata());
+}
+
+bool CWallet::AddSproutViewingKey(const libzcash::SproutViewingKey &vk, const CKeyMetadata &meta)
 {
     if (!CCryptoKeyStore::AddSproutViewingKey(vk)) {
         return false;
     }
-    nTimeFirstKey = 1; // No birthday information for viewing keys.
+    UpdateTimeFirstKey(meta.nCreateTime);
     if (!fFileBacked) {
         return true;
     }
-    return CWalletDB(strWalletFile).WriteSproutViewingKey(vk);
+    return CWalletDB(strWalletFile).WriteSproutViewingKey(vk, meta);
 }
 
 bool CWallet::RemoveSproutViewingKey(const libzcash::SproutViewingKey &vk)
@@ -434,6 +534,7 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    MarkIsMineDirty();
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -452,18 +553,28 @@ bool CWallet::LoadCScript(const CScript& redeemScript)
         return true;
     }
 
-    return CCryptoKeyStore::AddCScript(redeemScript);
+    if (!CCryptoKeyStore::AddCScript(redeemScript))
+        return false;
+    MarkIsMineDirty();
+    return true;
 }
 
 bool CWallet::AddWatchOnly(const CScript &dest)
+{
+    // No birthday information
+    return AddWatchOnly(dest, CKeyMetadata());
+}
+
+bool CWallet::AddWatchOnly(const CScript &dest, const CKeyMetadata &meta)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
-    nTimeFirstKey = 1; // No birthday information for watch-only keys.
+    MarkIsMineDirty();
+    UpdateTimeFirstKey(meta.nCreateTime);
     NotifyWatchonlyChanged(true);
     if (!fFileBacked)
         return true;
-    return CWalletDB(strWalletFile).WriteWatchOnly(dest);
+    return CWalletDB(strWalletFile).WriteWatchOnly(dest, meta);
 }
 
 bool CWallet::RemoveWatchOnly(const CScript &dest)
@@ -471,6 +582,7 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveWatchOnly(dest))
         return false;
+    MarkIsMineDirty();
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
     if (fFileBacked)
@@ -482,7 +594,10 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
 
 bool CWallet::LoadWatchOnly(const CScript &dest)
 {
-    return CCryptoKeyStore::AddWatchOnly(dest);
+    if (!CCryptoKeyStore::AddWatchOnly(dest))
+        return false;
+    MarkIsMineDirty();
+    return true;
 }
 
 bool CWallet::Unlock(const SecureString& strWalletPassphrase)
@@ -560,9 +675,24 @@ void CWallet::ChainTip(const CBlockIndex *pindex,
     if (added) {
         IncrementNoteWitnesses(pindex, pblock, sproutTree, saplingTree);
     } else {
-        DecrementNoteWitnesses(pindex);
+        // The trees are those before the block being disconnected
+        DecrementNoteWitnesses(pindex, sproutTree, saplingTree);
     }
     UpdateSaplingNullifierNoteMapForBlock(pblock);
+
+    LOCK2(cs_main, cs_wallet);
+    if (!added) {
+        // What the disconnected block spent may be unspent again
+        for (const CTransactionRef& ptx : pblock->vtx) {
+            const CTransaction& tx = *ptx;
+            if (mapWallet.count(tx.GetHash())) {
+                MarkSpentByMaybeUnspent(tx);
+            }
+        }
+    } else {
+        CompactTransactions();
+    }
+    PruneSpentTxs();
 }
 
 void CWallet::SetBestChain(const CBlockLocator& loc)
@@ -586,7 +716,13 @@ std::set<std::pair<libzcash::PaymentAddress, uint256>> CWallet::GetNullifiersFor
             ivkMap[ivk].push_back(*saplingAddr);
         }
     }
-    for (const auto & txPair : mapWallet) {
+    LOCK(cs_wallet);
+    for (const uint256 & hash : GetNoteTxsForAddresses(addresses)) {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(hash);
+        if (mit == mapWallet.end()) {
+            continue;
+        }
+        const auto & txPair = *mit;
         // Sprout
         for (const auto & noteDataPair : txPair.second.mapSproutNoteData) {
             auto & noteData = noteDataPair.second;
@@ -672,6 +808,8 @@ bool CWallet::SetMinVersion(enum WalletFeature nVersion, CWalletDB* pwalletdbIn,
 
     if (fFileBacked)
     {
+        if (!pwalletdbIn)
+            pwalletdbIn = pwalletdbBatch;
         CWalletDB* pwalletdb = pwalletdbIn ? pwalletdbIn : new CWalletDB(strWalletFile);
         if (nWalletVersion > 40000)
             pwalletdb->WriteMinVersion(nWalletVersion);
@@ -751,6 +889,16 @@ void CWallet::Flush(bool shutdown)
 
 bool CWallet::Verify(const string& walletFile, string& warningString, string& errorString)
 {
+    if (bitdb.IsLogDb(walletFile, true))
+    {
+        // A log needs no database environment. It is checked as it is
+        // replayed, which keeps it open for the wallet to load.
+        std::string strError;
+        if (!bitdb.OpenLogDb(walletFile, GetBoolArg("-salvagewallet", false), strError))
+            errorString += strprintf(_("Error opening wallet %s: %s; -salvagewallet drops what follows a corrupt record"), walletFile, strError);
+        return true;
+    }
+
     if (!bitdb.Open(GetDataDir()))
     {
         // try moving the database env out of the way
@@ -791,6 +939,15 @@ bool CWallet::Verify(const string& walletFile, string& warningString, string& er
         }
         if (r == CDBEnv::RECOVER_FAIL)
             errorString += _("wallet.dat corrupt, salvage failed");
+
+        if (r != CDBEnv::RECOVER_FAIL && GetArg("-walletformat", DEFAULT_WALLET_FORMAT) == "log")
+        {
+            std::string strError;
+            if (!CDB::MigrateToLog(walletFile))
+                errorString += strprintf(_("Error migrating %s to the log format, see debug.log"), walletFile);
+            else if (!bitdb.OpenLogDb(walletFile, false, strError))
+                errorString += strprintf(_("Error opening wallet %s: %s"), walletFile, strError);
+        }
     }
 
     return true;
@@ -887,6 +1044,113 @@ bool CWallet::IsSaplingSpent(const uint256& nullifier) const {
     return false;
 }
 
+/** True if a transaction deeper than any reorg can go spends key */
+template <class Spends>
+static bool HasSpendBeyondReorg(const std::map<uint256, CWalletTx>& mapWallet, const Spends& spends, const typename Spends::key_type& key)
+{
+    auto range = spends.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() > (int)MAX_REORG_LENGTH) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * True if every output and note of ours in wtx is spent for good. Notes
+ * whose nullifier isn't known yet count as unspent.
+ */
+bool CWallet::IsSpentBeyondReorg(const CWalletTx& wtx) const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    uint256 hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        if (wtx.IsMine(i) != ISMINE_NO &&
+            !HasSpendBeyondReorg(mapWallet, mapTxSpends, COutPoint(hash, i))) {
+            return false;
+        }
+    }
+    for (const auto& item : wtx.mapSproutNoteData) {
+        if (!item.second.nullifier ||
+            !HasSpendBeyondReorg(mapWallet, mapTxSproutNullifiers, *item.second.nullifier)) {
+            return false;
+        }
+    }
+    for (const auto& item : wtx.mapSaplingNoteData) {
+        if (!item.second.nullifier ||
+            !HasSpendBeyondReorg(mapWallet, mapTxSaplingNullifiers, *item.second.nullifier)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void CWallet::MarkSpentByMaybeUnspent(const CTransaction& tx)
+{
+    AssertLockHeld(cs_wallet);
+
+    for (const CTxIn& txin : tx.vin) {
+        if (mapWallet.count(txin.prevout.hash)) {
+            setMaybeUnspentTxs.insert(txin.prevout.hash);
+        }
+    }
+    for (const JSDescription& jsdesc : tx.vjoinsplit) {
+        for (const uint256& nullifier : jsdesc.nullifiers) {
+            boost::unordered_map<uint256, JSOutPoint, CCoinsKeyHasher>::const_iterator it = mapSproutNullifiersToNotes.find(nullifier);
+            if (it != mapSproutNullifiersToNotes.end()) {
+                setMaybeUnspentTxs.insert(it->second.hash);
+            }
+        }
+    }
+    for (const SpendDescription& spend : tx.vShieldedSpend) {
+        boost::unordered_map<uint256, SaplingOutPoint, CCoinsKeyHasher>::const_iterator it = mapSaplingNullifiersToNotes.find(spend.nullifier);
+        if (it != mapSaplingNullifiersToNotes.end()) {
+            setMaybeUnspentTxs.insert(it->second.hash);
+        }
+    }
+}
+
+void CWallet::PruneSpentTxs()
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    std::set<uint256>::iterator it = setMaybeUnspentTxs.begin();
+    while (it != setMaybeUnspentTxs.end()) {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(*it);
+        if (mit == mapWallet.end() || IsSpentBeyondReorg(mit->second)) {
+            it = setMaybeUnspentTxs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void CWallet::CompactTransactions()
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    if (!fWalletCompactTx || !fFileBacked)
+        return;
+
+    std::unique_ptr<CWalletDB> pwalletdb;
+    for (std::pair<const uint256, CWalletTx>& item : mapWallet) {
+        CWalletTx& wtx = item.second;
+        if (wtx.fCompact || (wtx.vjoinsplit.empty() && wtx.vShieldedSpend.empty() && wtx.vShieldedOutput.empty()))
+            continue;
+        if (wtx.GetDepthInMainChain() <= (int)MAX_REORG_LENGTH)
+            continue;
+        if (!pwalletdb)
+            pwalletdb.reset(new CWalletDB(strWalletFile));
+        wtx.fCompact = true;
+        wtx.WriteToDisk(pwalletdb.get());
+    }
+}
+
 void CWallet::AddToTransparentSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(make_pair(outpoint, wtxid));
@@ -937,21 +1201,22 @@ void CWallet::AddToSpends(const uint256& wtxid)
 void CWallet::ClearNoteWitnessCache()
 {
     LOCK(cs_wallet);
-    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-        for (mapSproutNoteData_t::value_type& item : wtxItem.second.mapSproutNoteData) {
+    for (CWalletTx* pwtx : GetNoteTxs()) {
+        for (mapSproutNoteData_t::value_type& item : pwtx->mapSproutNoteData) {
             item.second.witnesses.clear();
             item.second.witnessHeight = -1;
         }
-        for (mapSaplingNoteData_t::value_type& item : wtxItem.second.mapSaplingNoteData) {
+        for (mapSaplingNoteData_t::value_type& item : pwtx->mapSaplingNoteData) {
             item.second.witnesses.clear();
             item.second.witnessHeight = -1;
         }
     }
+    mapWitnessFrontiers.clear();
     nWitnessCacheSize = 0;
 }
 
-template<typename NoteDataMap>
-void CopyPreviousWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize)
+template<typename NoteDataMap, typename WitnessFrontier, typename Tree>
+void TrackNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, WitnessFrontier& frontier, const Tree& tree)
 {
     for (auto& item : noteDataMap) {
         auto* nd = &(item.second);
@@ -966,36 +1231,22 @@ void CopyPreviousWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nW
             // Witnesses being incremented should always be either -1
             // (never incremented or decremented) or one below indexHeight
             assert((nd->witnessHeight == -1) || (nd->witnessHeight == indexHeight - 1));
-            // Copy the witness for the previous block if we have one
             if (nd->witnesses.size() > 0) {
-                nd->witnesses.push_front(nd->witnesses.front());
-            }
-            if (nd->witnesses.size() > WITNESS_CACHE_SIZE) {
-                nd->witnesses.pop_back();
+                // Older versions cached a witness per block; only the
+                // most recent one is kept now.
+                nd->witnesses.resize(1);
+                frontier.track(nd->witnesses.front(), tree);
             }
         }
     }
 }
 
-template<typename NoteDataMap>
-void AppendNoteCommitment(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const uint256& note_commitment)
-{
-    for (auto& item : noteDataMap) {
-        auto* nd = &(item.second);
-        if (nd->witnessHeight < indexHeight && nd->witnesses.size() > 0) {
-            // Check the validity of the cache
-            // See comment in CopyPreviousWitnesses about validity.
-            assert(nWitnessCacheSize >= nd->witnesses.size());
-            nd->witnesses.front().append(note_commitment);
-        }
-    }
-}
-
-template<typename OutPoint, typename NoteData, typename Witness>
-void WitnessNoteIfMine(std::map<OutPoint, NoteData>& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const OutPoint& key, const Witness& witness)
+template<typename OutPoint, typename NoteData, typename Tree, typename WitnessFrontier>
+void WitnessNoteIfMine(std::map<OutPoint, NoteData>& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const OutPoint& key, const Tree& tree, WitnessFrontier& frontier)
 {
     if (noteDataMap.count(key) && noteDataMap[key].witnessHeight < indexHeight) {
         auto* nd = &(noteDataMap[key]);
+        auto witness = tree.witness();
         if (nd->witnesses.size() > 0) {
             // We think this can happen because we write out the
             // witness cache state after every block increment or
@@ -1011,9 +1262,11 @@ void WitnessNoteIfMine(std::map<OutPoint, NoteData>& noteDataMap, int indexHeigh
                         nd->witnesses.front().root().GetHex(),
                         indexHeight,
                         witness.root().GetHex());
+            frontier.untrack(nd->witnesses.front());
             nd->witnesses.clear();
         }
         nd->witnesses.push_front(witness);
+        frontier.track(nd->witnesses.front(), tree);
         // Set height to one less than pindex so it gets incremented
         nd->witnessHeight = indexHeight - 1;
         // Check the validity of the cache
@@ -1030,22 +1283,33 @@ void UpdateWitnessHeights(NoteDataMap& noteDataMap, int indexHeight, int64_t nWi
         if (nd->witnessHeight < indexHeight) {
             nd->witnessHeight = indexHeight;
             // Check the validity of the cache
-            // See comment in CopyPreviousWitnesses about validity.
+            // See comment in TrackNoteWitnesses about validity.
             assert(nWitnessCacheSize >= nd->witnesses.size());
         }
     }
 }
 
+/**
+ * Each note keeps a single witness, which is advanced through an
+ * IncrementalWitnessFrontier shared by all notes rather than by appending
+ * every commitment to every witness. The frontiers of the trees before the
+ * block are checkpointed so that DecrementNoteWitnesses can rewind the
+ * witnesses without a copy per note and block.
+ */
 void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
                                      const CBlock* pblockIn,
                                      SproutMerkleTree& sproutTree,
                                      SaplingMerkleTree& saplingTree)
 {
     LOCK(cs_wallet);
-    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-       ::CopyPreviousWitnesses(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
-       ::CopyPreviousWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+    SproutWitnessFrontier sproutFrontier;
+    SaplingWitnessFrontier saplingFrontier;
+    std::vector<CWalletTx*> vNoteTxs = GetNoteTxs();
+    for (CWalletTx* pwtx : vNoteTxs) {
+       ::TrackNoteWitnesses(pwtx->mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, sproutFrontier, sproutTree);
+       ::TrackNoteWitnesses(pwtx->mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, saplingFrontier, saplingTree);
     }
+    CheckpointWitnessFrontiers(pindex->nHeight, sproutTree, saplingTree);
 
     if (nWitnessCacheSize < WITNESS_CACHE_SIZE) {
         nWitnessCacheSize += 1;
@@ -1058,7 +1322,8 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
         pblock = &block;
     }
 
-    for (const CTransaction& tx : pblock->vtx) {
+    for (const CTransactionRef& ptx : pblock->vtx) {
+        const CTransaction& tx = *ptx;
         auto hash = tx.GetHash();
         bool txIsOurs = mapWallet.count(hash);
         // Sprout
@@ -1069,14 +1334,12 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
                 sproutTree.append(note_commitment);
 
                 // Increment existing witnesses
-                for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                    ::AppendNoteCommitment(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, note_commitment);
-                }
+                sproutFrontier.appended(sproutTree);
 
                 // If this is our note, witness it
                 if (txIsOurs) {
                     JSOutPoint jsoutpt {hash, i, j};
-                    ::WitnessNoteIfMine(mapWallet[hash].mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, jsoutpt, sproutTree.witness());
+                    ::WitnessNoteIfMine(mapWallet[hash].mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, jsoutpt, sproutTree, sproutFrontier);
                 }
             }
         }
@@ -1086,22 +1349,22 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
             saplingTree.append(note_commitment);
 
             // Increment existing witnesses
-            for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                ::AppendNoteCommitment(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, note_commitment);
-            }
+            saplingFrontier.appended(saplingTree);
 
             // If this is our note, witness it
             if (txIsOurs) {
                 SaplingOutPoint outPoint {hash, i};
-                ::WitnessNoteIfMine(mapWallet[hash].mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, outPoint, saplingTree.witness());
+                ::WitnessNoteIfMine(mapWallet[hash].mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, outPoint, saplingTree, saplingFrontier);
             }
         }
     }
+    sproutFrontier.finish(sproutTree);
+    saplingFrontier.finish(saplingTree);
 
     // Update witness heights
-    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-        ::UpdateWitnessHeights(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
-        ::UpdateWitnessHeights(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+    for (CWalletTx* pwtx : vNoteTxs) {
+        ::UpdateWitnessHeights(pwtx->mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
+        ::UpdateWitnessHeights(pwtx->mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
     }
 
     // For performance reasons, we write out the witness cache in
@@ -1109,8 +1372,60 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
     // of the wallet.dat is maintained).
 }
 
-template<typename NoteDataMap>
-void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize)
+void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
+                                     const CCompactShieldedBlock& block,
+                                     SproutMerkleTree& sproutTree,
+                                     SaplingMerkleTree& saplingTree)
+{
+    LOCK(cs_wallet);
+    SproutWitnessFrontier sproutFrontier;
+    SaplingWitnessFrontier saplingFrontier;
+    std::vector<CWalletTx*> vNoteTxs = GetNoteTxs();
+    for (CWalletTx* pwtx : vNoteTxs) {
+       ::TrackNoteWitnesses(pwtx->mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, sproutFrontier, sproutTree);
+       ::TrackNoteWitnesses(pwtx->mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, saplingFrontier, saplingTree);
+    }
+    CheckpointWitnessFrontiers(pindex->nHeight, sproutTree, saplingTree);
+
+    if (nWitnessCacheSize < WITNESS_CACHE_SIZE) {
+        nWitnessCacheSize += 1;
+    }
+
+    // None of the notes are ours, so existing witnesses only need to be
+    // advanced past them.
+    for (const CCompactShieldedTx& tx : block.vtx) {
+        for (const uint256& note_commitment : tx.vSproutCommitments) {
+            sproutTree.append(note_commitment);
+            sproutFrontier.appended(sproutTree);
+        }
+        for (const CCompactSaplingOutput& output : tx.vSaplingOutputs) {
+            saplingTree.append(output.cm);
+            saplingFrontier.appended(saplingTree);
+        }
+    }
+    sproutFrontier.finish(sproutTree);
+    saplingFrontier.finish(saplingTree);
+
+    // Update witness heights
+    for (CWalletTx* pwtx : vNoteTxs) {
+        ::UpdateWitnessHeights(pwtx->mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
+        ::UpdateWitnessHeights(pwtx->mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+    }
+}
+
+void CWallet::CheckpointWitnessFrontiers(int nHeight,
+                                         const SproutMerkleTree& sproutTree,
+                                         const SaplingMerkleTree& saplingTree)
+{
+    AssertLockHeld(cs_wallet);
+    // Anything above is from a chain we have since moved away from
+    mapWitnessFrontiers.erase(mapWitnessFrontiers.lower_bound(nHeight), mapWitnessFrontiers.end());
+    mapWitnessFrontiers.erase(mapWitnessFrontiers.begin(), mapWitnessFrontiers.lower_bound(nHeight - WITNESS_CACHE_SIZE));
+    mapWitnessFrontiers[nHeight] = std::make_pair(sproutTree, saplingTree);
+}
+
+template<typename NoteDataMap, typename Tree>
+void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const Tree* tree)
 {
     for (auto& item : noteDataMap) {
         auto* nd = &(item.second);
@@ -1124,8 +1439,18 @@ void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t n
             // (never incremented or decremented) or equal to the height
             // of the block being removed (indexHeight)
             assert((nd->witnessHeight == -1) || (nd->witnessHeight == indexHeight));
-            if (nd->witnesses.size() > 0) {
+            if (nd->witnesses.size() > 1) {
+                // Cache written by an older version, which kept the
+                // witness for every block
                 nd->witnesses.pop_front();
+            } else if (nd->witnesses.size() > 0) {
+                if (tree && nd->witnesses.front().position() < tree->size()) {
+                    nd->witnesses.front().rewind(*tree);
+                } else {
+                    // The note was added by the block being removed, or
+                    // we do not know the tree before it
+                    nd->witnesses.pop_front();
+                }
             }
             // indexHeight is the height of the block being removed, so 
             // the new witness cache height is one below it.
@@ -1141,7 +1466,7 @@ void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t n
         // We don't set nWitnessCacheSize to zero at the start of the
         // reindex because the on-disk blocks had already resulted in a
         // chain that didn't trigger the assertion below.
-        if (nd->witnessHeight < indexHeight) {
+        if (nd->witnessHeight < indexHeight && nd->witnesses.size() > 1) {
             // Subtract 1 to compare to what nWitnessCacheSize will be after
             // decrementing.
             assert((nWitnessCacheSize - 1) >= nd->witnesses.size());
@@ -1152,10 +1477,34 @@ void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t n
 void CWallet::DecrementNoteWitnesses(const CBlockIndex* pindex)
 {
     LOCK(cs_wallet);
-    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-        ::DecrementNoteWitnesses(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
-        ::DecrementNoteWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+    auto it = mapWitnessFrontiers.find(pindex->nHeight);
+    if (it != mapWitnessFrontiers.end()) {
+        // Copy, as the checkpoint is erased
+        std::pair<SproutMerkleTree, SaplingMerkleTree> trees = it->second;
+        DecrementNoteWitnesses(pindex, trees.first, trees.second);
+        return;
+    }
+
+    LogPrintf("%s: no tree state checkpointed at height %d, dropping the witnesses of notes that need a rewind\n", __func__, pindex->nHeight);
+    for (CWalletTx* pwtx : GetNoteTxs()) {
+        ::DecrementNoteWitnesses(pwtx->mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, (const SproutMerkleTree*) nullptr);
+        ::DecrementNoteWitnesses(pwtx->mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, (const SaplingMerkleTree*) nullptr);
+    }
+    nWitnessCacheSize -= 1;
+    // TODO: If nWitnessCache is zero, we need to regenerate the caches (#1302)
+    assert(nWitnessCacheSize > 0);
+}
+
+void CWallet::DecrementNoteWitnesses(const CBlockIndex* pindex,
+                                     const SproutMerkleTree& sproutTree,
+                                     const SaplingMerkleTree& saplingTree)
+{
+    LOCK(cs_wallet);
+    for (CWalletTx* pwtx : GetNoteTxs()) {
+        ::DecrementNoteWitnesses(pwtx->mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, &sproutTree);
+        ::DecrementNoteWitnesses(pwtx->mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, &saplingTree);
     }
+    mapWitnessFrontiers.erase(pindex->nHeight);
     nWitnessCacheSize -= 1;
     // TODO: If nWitnessCache is zero, we need to regenerate the caches (#1302)
     assert(nWitnessCacheSize > 0);
@@ -1268,79 +1617,241 @@ int64_t CWallet::IncOrderPosNext(CWalletDB *pwalletdb)
     return nRet;
 }
 
-CWallet::TxItems CWallet::OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount)
+bool CWallet::AddAccountingEntry(const CAccountingEntry& acentry, CWalletDB& walletdb)
 {
-    AssertLockHeld(cs_wallet); // mapWallet
-    CWalletDB walletdb(strWalletFile);
+    AssertLockHeld(cs_wallet); // wtxOrdered
+    if (!walletdb.WriteAccountingEntry(acentry))
+        return false;
 
-    // First: get all CWalletTx and CAccountingEntry into a sorted-by-order multimap.
-    TxItems txOrdered;
+    laccentries.push_back(acentry);
+    CAccountingEntry& entry = laccentries.back();
+    wtxOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+    return true;
+}
 
-    // Note: maintaining indices in the database of (account,time) --> txid and (account, time) --> acentry
-    // would make this much faster for applications that do this a lot.
-    for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-    {
-        CWalletTx* wtx = &((*it).second);
-        txOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
+void CWallet::AddToNoteIndex(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    uint256 hash = wtx.GetHash();
+    for (const auto& item : wtx.mapSproutNoteData) {
+        mapSproutAddressTxs[item.second.address].insert(hash);
     }
-    acentries.clear();
-    walletdb.ListAccountCreditDebit(strAccount, acentries);
-    BOOST_FOREACH(CAccountingEntry& entry, acentries)
-    {
-        txOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+    for (const auto& item : wtx.mapSaplingNoteData) {
+        mapSaplingIvkTxs[item.second.ivk].insert(hash);
     }
+    if (!wtx.mapSproutNoteData.empty() || !wtx.mapSaplingNoteData.empty()) {
+        setNoteTxs.insert(hash);
+    }
+}
 
-    return txOrdered;
+std::vector<CWalletTx*> CWallet::GetNoteTxs()
+{
+    AssertLockHeld(cs_wallet);
+    std::vector<CWalletTx*> vNoteTxs;
+    vNoteTxs.reserve(setNoteTxs.size());
+    std::set<uint256>::iterator it = setNoteTxs.begin();
+    while (it != setNoteTxs.end()) {
+        std::map<uint256, CWalletTx>::iterator mi = mapWallet.find(*it);
+        if (mi == mapWallet.end()) {
+            // Zapped since it was indexed
+            it = setNoteTxs.erase(it);
+        } else {
+            vNoteTxs.push_back(&mi->second);
+            ++it;
+        }
+    }
+    return vNoteTxs;
+}
+
+std::set<uint256> CWallet::GetNoteTxsForAddresses(const std::set<libzcash::PaymentAddress>& addresses)
+{
+    AssertLockHeld(cs_wallet);
+    std::set<uint256> txs;
+    for (const auto& addr : addresses) {
+        const std::set<uint256>* found = nullptr;
+        if (auto sproutAddr = boost::get<libzcash::SproutPaymentAddress>(&addr)) {
+            auto it = mapSproutAddressTxs.find(*sproutAddr);
+            if (it != mapSproutAddressTxs.end()) {
+                found = &it->second;
+            }
+        } else if (auto saplingAddr = boost::get<libzcash::SaplingPaymentAddress>(&addr)) {
+            libzcash::SaplingIncomingViewingKey ivk;
+            if (GetSaplingIncomingViewingKey(*saplingAddr, ivk)) {
+                auto it = mapSaplingIvkTxs.find(ivk);
+                if (it != mapSaplingIvkTxs.end()) {
+                    found = &it->second;
+                }
+            }
+        }
+        if (found) {
+            txs.insert(found->begin(), found->end());
+        }
+    }
+    return txs;
 }
 
 void CWallet::MarkDirty()
 {
     {
         LOCK(cs_wallet);
-        BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
+        BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet) {
             item.second.MarkDirty();
+            // New keys may own outputs of transactions already pruned
+            setMaybeUnspentTxs.insert(item.first);
+        }
     }
 }
 
+namespace {
+
+//! What it takes to compute the nullifier of a Sprout note outside cs_wallet
+struct CSproutNullifierWork
+{
+    uint256 txid;
+    JSOutPoint jsop;
+    libzcash::SproutPaymentAddress address;
+    ZCNoteEncryption::Ciphertext ciphertext;
+    uint256 ephemeralKey;
+    uint256 hSig;
+    boost::optional<uint256> nullifier;
+};
+
+} // namespace
+
 /**
  * Ensure that every note in the wallet (for which we possess a spending key)
- * has a cached nullifier.
+ * has a cached nullifier. Sprout nullifiers need the spending key, so those
+ * of notes found while the wallet was locked are computed here, in batches
+ * on the -par threads. Each batch is stored as it is done, so that its notes
+ * can be spent while the rest are computed. Returns false if the wallet is
+ * or becomes locked before all are.
+ *
+ * Sapling nullifiers only need the full viewing key, so they are computed
+ * as their notes are found.
  */
 bool CWallet::UpdateNullifierNoteMap()
 {
+    size_t nPending = 0;
     {
         LOCK(cs_wallet);
 
         if (IsLocked())
             return false;
 
-        ZCNoteDecryption dec;
-        for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-            for (mapSproutNoteData_t::value_type& item : wtxItem.second.mapSproutNoteData) {
-                if (!item.second.nullifier) {
-                    if (GetNoteDecryptor(item.second.address, dec)) {
-                        auto i = item.first.js;
-                        auto hSig = wtxItem.second.vjoinsplit[i].h_sig(
-                            *pzcashParams, wtxItem.second.joinSplitPubKey);
-                        item.second.nullifier = GetSproutNoteNullifier(
-                            wtxItem.second.vjoinsplit[i],
-                            item.second.address,
-                            dec,
-                            hSig,
-                            item.first.n);
+        for (const std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+            for (const mapSproutNoteData_t::value_type& item : wtxItem.second.mapSproutNoteData) {
+                if (!item.second.nullifier && HaveSproutSpendingKey(item.second.address))
+                    nPending++;
+            }
+            UpdateNullifierNoteMapWithTx(wtxItem.second);
+        }
+    }
+    nNullifiersPending = nPending;
+    if (nPending == 0)
+        return true;
+
+    LogPrintf("Computing the nullifiers of %u notes received while the wallet was locked\n", nPending);
+    int64_t nStart = GetTimeMillis();
+    boost::optional<uint256> hashLast;
+    bool fDone = false;
+    while (!fDone) {
+        boost::this_thread::interruption_point();
+
+        // Take the next batch from where the last one ended
+        std::vector<CSproutNullifierWork> vWork;
+        std::map<libzcash::SproutPaymentAddress, std::pair<ZCNoteDecryption, libzcash::SproutSpendingKey>> mapKeys;
+        {
+            LOCK(cs_wallet);
+            if (IsLocked()) {
+                LogPrintf("Wallet locked with the nullifiers of %u notes left to compute\n", nNullifiersPending.load());
+                nNullifiersPending = 0;
+                return false;
+            }
+            std::map<uint256, CWalletTx>::const_iterator it = hashLast ? mapWallet.upper_bound(*hashLast) : mapWallet.begin();
+            for (; it != mapWallet.end() && vWork.size() < NULLIFIER_BATCH_SIZE; ++it) {
+                const CWalletTx& wtx = it->second;
+                for (const mapSproutNoteData_t::value_type& item : wtx.mapSproutNoteData) {
+                    if (item.second.nullifier)
+                        continue;
+                    const libzcash::SproutPaymentAddress& address = item.second.address;
+                    if (!mapKeys.count(address)) {
+                        ZCNoteDecryption dec;
+                        libzcash::SproutSpendingKey key;
+                        if (!GetNoteDecryptor(address, dec) || !GetSproutSpendingKey(address, key))
+                            continue;
+                        mapKeys.insert(std::make_pair(address, std::make_pair(dec, key)));
                     }
+                    const JSDescription& jsdesc = wtx.vjoinsplit[item.first.js];
+                    CSproutNullifierWork work;
+                    work.txid = it->first;
+                    work.jsop = item.first;
+                    work.address = address;
+                    work.ciphertext = jsdesc.ciphertexts[item.first.n];
+                    work.ephemeralKey = jsdesc.ephemeralKey;
+                    work.hSig = jsdesc.h_sig(*pzcashParams, wtx.joinSplitPubKey);
+                    vWork.push_back(work);
                 }
+                hashLast = it->first;
             }
+            fDone = it == mapWallet.end();
+        }
 
-            // TODO: Sapling.  This method is only called from RPC walletpassphrase, which is currently unsupported
-            // as RPC encryptwallet is hidden behind two flags: -developerencryptwallet -experimentalfeatures
+        std::atomic<size_t> nNext(0);
+        auto compute = [&]() {
+            for (size_t i = nNext++; i < vWork.size(); i = nNext++) {
+                CSproutNullifierWork& work = vWork[i];
+                const auto& keys = mapKeys.at(work.address);
+                try {
+                    auto note_pt = libzcash::SproutNotePlaintext::decrypt(
+                        keys.first, work.ciphertext, work.ephemeralKey, work.hSig, (unsigned char) work.jsop.n);
+                    work.nullifier = note_pt.note(work.address).nullifier(keys.second);
+                } catch (const std::exception& e) {
+                    LogPrintf("%s: could not decrypt note %s: %s\n", __func__, work.jsop.ToString(), e.what());
+                }
+            }
+        };
+        boost::thread_group workers;
+        for (int i = 1; i < std::min<int>(vWork.size(), nScriptCheckThreads); i++)
+            workers.create_thread(compute);
+        compute();
+        workers.join_all();
 
-            UpdateNullifierNoteMapWithTx(wtxItem.second);
+        {
+            LOCK(cs_wallet);
+            for (const CSproutNullifierWork& work : vWork) {
+                if (!work.nullifier)
+                    continue;
+                // The transaction may have gone, or been found again, meanwhile
+                std::map<uint256, CWalletTx>::iterator mi = mapWallet.find(work.txid);
+                if (mi == mapWallet.end())
+                    continue;
+                mapSproutNoteData_t::iterator ni = mi->second.mapSproutNoteData.find(work.jsop);
+                if (ni == mi->second.mapSproutNoteData.end() || ni->second.nullifier)
+                    continue;
+                ni->second.nullifier = work.nullifier;
+                mapSproutNullifiersToNotes[*work.nullifier] = work.jsop;
+            }
         }
+        nNullifiersPending = nNullifiersPending > vWork.size() ? nNullifiersPending - vWork.size() : 0;
     }
+    nNullifiersPending = 0;
+    LogPrintf("Computed the nullifiers of %u notes in %dms\n", nPending, GetTimeMillis() - nStart);
     return true;
 }
 
+void CWallet::UpdateNullifierNoteMapInBackground()
+{
+    // A run left from an earlier unlock starts over
+    if (nullifierThread.joinable()) {
+        nullifierThread.interrupt();
+        nullifierThread.join();
+    }
+    nullifierThread = boost::thread([this]() {
+        RenameThread("litecoinz-nullifiers");
+        UpdateNullifierNoteMap();
+    });
+}
+
 /**
  * Update mapSproutNullifiersToNotes and mapSaplingNullifiersToNotes
  * with the cached nullifiers in this tx.
@@ -1413,7 +1924,8 @@ void CWallet::UpdateSaplingNullifierNoteMapWithTx(CWalletTx& wtx) {
 void CWallet::UpdateSaplingNullifierNoteMapForBlock(const CBlock *pblock) {
     LOCK(cs_wallet);
 
-    for (const CTransaction& tx : pblock->vtx) {
+    for (const CTransactionRef& ptx : pblock->vtx) {
+        const CTransaction& tx = *ptx;
         auto hash = tx.GetHash();
         bool txIsOurs = mapWallet.count(hash);
         if (txIsOurs) {
@@ -1429,9 +1941,15 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
     if (fFromLoadWallet)
     {
         mapWallet[hash] = wtxIn;
-        mapWallet[hash].BindWallet(this);
-        UpdateNullifierNoteMapWithTx(mapWallet[hash]);
+        CWalletTx& wtx = mapWallet[hash];
+        wtx.BindWallet(this);
+        // Rebuilt by LoadWallet once every order position is known
+        wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
+        UpdateNullifierNoteMapWithTx(wtx);
         AddToSpends(hash);
+        AddToNoteIndex(wtx);
+        setMaybeUnspentTxs.insert(hash);
+        AddResendCandidate(wtx);
     }
     else
     {
@@ -1441,11 +1959,13 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         CWalletTx& wtx = (*ret.first).second;
         wtx.BindWallet(this);
         UpdateNullifierNoteMapWithTx(wtx);
+        setMaybeUnspentTxs.insert(hash);
         bool fInsertedNew = ret.second;
         if (fInsertedNew)
         {
             wtx.nTimeReceived = GetAdjustedTime();
             wtx.nOrderPos = IncOrderPosNext(pwalletdb);
+            wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
 
             wtx.nTimeSmart = wtx.nTimeReceived;
             if (!wtxIn.hashBlock.IsNull())
@@ -1457,9 +1977,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
                     {
                         // Tolerate times up to the last timestamp in the wallet not more than 5 minutes into the future
                         int64_t latestTolerated = latestNow + 300;
-                        std::list<CAccountingEntry> acentries;
-                        TxItems txOrdered = OrderedTxItems(acentries);
-                        for (TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+                        const TxItems& txOrdered = wtxOrdered;
+                        for (TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
                         {
                             CWalletTx *const pwtx = (*it).second.first;
                             if (pwtx == &wtx)
@@ -1520,6 +2039,9 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
             }
         }
 
+        AddToNoteIndex(wtx);
+        AddResendCandidate(wtx);
+
         //// debug print
         LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
@@ -1534,6 +2056,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
 
+        NotifySink("wallettx", wtxIn.GetHash().GetHex());
+
         // notify an external script when a wallet transaction comes in or is updated
         std::string strCmd = GetArg("-walletnotify", "");
 
@@ -1590,13 +2114,25 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
  * If fUpdate is true, existing transactions will be updated.
  */
 bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate)
+{
+    AssertLockHeld(cs_wallet);
+    bool fExisted = mapWallet.count(tx.GetHash()) != 0;
+    if (fExisted && !fUpdate) return false;
+    return AddToWalletIfInvolvingMe(tx, pblock, fUpdate, FindMySproutNotes(tx), FindMySaplingNotes(tx));
+}
+
+/**
+ * As above, but with the results of FindMySproutNotes and FindMySaplingNotes
+ * for tx already computed by the caller.
+ */
+bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate,
+                                       const mapSproutNoteData_t& sproutNoteData,
+                                       const std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>& saplingNoteDataAndAddressesToAdd)
 {
     {
         AssertLockHeld(cs_wallet);
         bool fExisted = mapWallet.count(tx.GetHash()) != 0;
         if (fExisted && !fUpdate) return false;
-        auto sproutNoteData = FindMySproutNotes(tx);
-        auto saplingNoteDataAndAddressesToAdd = FindMySaplingNotes(tx);
         auto saplingNoteData = saplingNoteDataAndAddressesToAdd.first;
         auto addressesToAdd = saplingNoteDataAndAddressesToAdd.second;
         for (const auto &addressToAdd : addressesToAdd) {
@@ -1620,16 +2156,92 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
             if (pblock)
                 wtx.SetMerkleBranch(*pblock);
 
+            // Receipts are told of when first seen, and again when first mined
+            bool fNotify = (sproutNoteData.size() > 0 || saplingNoteData.size() > 0) &&
+                           (!fExisted || (pblock && mapWallet[tx.GetHash()].hashBlock.IsNull())) &&
+                           HaveShieldedReceivedListeners();
+
             // Do not flush the wallet here for performance reasons
             // this is safe, as in case of a crash, we rescan the necessary blocks on startup through our SetBestChain-mechanism
-            CWalletDB walletdb(strWalletFile, "r+", false);
-
-            return AddToWallet(wtx, false, &walletdb);
+            bool fAdded;
+            if (pwalletdbBatch) {
+                fAdded = AddToWallet(wtx, false, pwalletdbBatch);
+            } else {
+                CWalletDB walletdb(strWalletFile, "r+", false);
+                fAdded = AddToWallet(wtx, false, &walletdb);
+            }
+            if (fAdded && fNotify)
+                NotifyShieldedReceipts(tx, pblock, sproutNoteData, saplingNoteData);
+            return fAdded;
         }
     }
     return false;
 }
 
+void CWallet::NotifyShieldedReceipts(const CTransaction& tx, const CBlock* pblock,
+                                     const mapSproutNoteData_t& sproutNoteData, const mapSaplingNoteData_t& saplingNoteData)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    int nHeight = -1;
+    if (pblock) {
+        BlockMap::const_iterator mi = mapBlockIndex.find(pblock->GetHash());
+        if (mi != mapBlockIndex.end())
+            nHeight = mi->second->nHeight;
+    }
+
+    std::vector<CShieldedReceipt> vReceipts;
+    for (const std::pair<const JSOutPoint, SproutNoteData>& item : sproutNoteData) {
+        const JSOutPoint& jsop = item.first;
+        ZCNoteDecryption decryptor;
+        if (!GetNoteDecryptor(item.second.address, decryptor))
+            continue;
+        const JSDescription& jsdesc = tx.vjoinsplit[jsop.js];
+        try {
+            SproutNotePlaintext plaintext = SproutNotePlaintext::decrypt(
+                    decryptor,
+                    jsdesc.ciphertexts[jsop.n],
+                    jsdesc.ephemeralKey,
+                    jsdesc.h_sig(*pzcashParams, tx.joinSplitPubKey),
+                    (unsigned char) jsop.n);
+            CShieldedReceipt receipt;
+            receipt.txid = tx.GetHash();
+            receipt.js = jsop.js;
+            receipt.n = jsop.n;
+            receipt.nHeight = nHeight;
+            receipt.address = EncodePaymentAddress(item.second.address);
+            receipt.value = plaintext.value();
+            receipt.memo = plaintext.memo();
+            vReceipts.push_back(receipt);
+        } catch (const std::exception &exc) {
+            // FindMySproutNotes decrypted it a moment ago
+            LogPrintf("NotifyShieldedReceipts(): Unexpected error decrypting note of %s: %s\n", tx.GetHash().GetHex(), exc.what());
+        }
+    }
+    for (const std::pair<const SaplingOutPoint, SaplingNoteData>& item : saplingNoteData) {
+        const SaplingOutPoint& op = item.first;
+        const libzcash::SaplingIncomingViewingKey& ivk = item.second.ivk;
+        const OutputDescription& output = tx.vShieldedOutput[op.n];
+        auto maybe_pt = SaplingNotePlaintext::decrypt(output.encCiphertext, ivk, output.ephemeralKey, output.cm);
+        if (!maybe_pt)
+            continue;
+        auto notePt = maybe_pt.get();
+        auto maybe_pa = ivk.address(notePt.d);
+        if (!maybe_pa)
+            continue;
+        CShieldedReceipt receipt;
+        receipt.txid = tx.GetHash();
+        receipt.js = -1;
+        receipt.n = op.n;
+        receipt.nHeight = nHeight;
+        receipt.address = EncodePaymentAddress(maybe_pa.get());
+        receipt.value = notePt.value();
+        receipt.memo = notePt.memo();
+        vReceipts.push_back(receipt);
+    }
+    NotifyShieldedReceived(std::move(vReceipts));
+}
+
 void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
 {
     LOCK2(cs_main, cs_wallet);
@@ -1639,6 +2251,49 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     MarkAffectedTransactionsDirty(tx);
 }
 
+void CWallet::SyncBlock(const CBlock* pblock)
+{
+    LOCK2(cs_main, cs_wallet);
+    bool fBatch = BeginBatch();
+    for (const CTransactionRef& ptx : pblock->vtx) {
+        const CTransaction& tx = *ptx;
+        SyncTransaction(tx, pblock);
+    }
+    if (fBatch)
+        CommitBatch();
+}
+
+bool CWallet::BeginBatch()
+{
+    // The batch holds page locks until it is committed, so every write to
+    // the wallet file in between has to come from this thread through
+    // pwalletdbBatch. Holding cs_wallet throughout keeps other threads out.
+    AssertLockHeld(cs_wallet);
+    if (!fFileBacked || pwalletdbBatch)
+        return false;
+    pwalletdbBatch = new CWalletDB(strWalletFile, "r+", false);
+    if (!pwalletdbBatch->TxnBegin()) {
+        LogPrintf("BeginBatch(): Couldn't start atomic write\n");
+        delete pwalletdbBatch;
+        pwalletdbBatch = NULL;
+        return false;
+    }
+    return true;
+}
+
+void CWallet::CommitBatch()
+{
+    AssertLockHeld(cs_wallet);
+    if (!pwalletdbBatch)
+        return;
+    // Like the unbatched writes this is not flushed, so a failure loses at
+    // most what the startup rescan from the best block finds again
+    if (!pwalletdbBatch->TxnCommit())
+        LogPrintf("CommitBatch(): Couldn't commit atomic write\n");
+    delete pwalletdbBatch;
+    pwalletdbBatch = NULL;
+}
+
 void CWallet::MarkAffectedTransactionsDirty(const CTransaction& tx)
 {
     // If a transaction changes 'conflicted' state, that changes the balance
@@ -1647,13 +2302,13 @@ void CWallet::MarkAffectedTransactionsDirty(const CTransaction& tx)
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
     {
         if (mapWallet.count(txin.prevout.hash))
-            mapWallet[txin.prevout.hash].MarkDirty();
+            mapWallet[txin.prevout.hash].MarkSpentDirty();
     }
     for (const JSDescription& jsdesc : tx.vjoinsplit) {
         for (const uint256& nullifier : jsdesc.nullifiers) {
             if (mapSproutNullifiersToNotes.count(nullifier) &&
                 mapWallet.count(mapSproutNullifiersToNotes[nullifier].hash)) {
-                mapWallet[mapSproutNullifiersToNotes[nullifier].hash].MarkDirty();
+                mapWallet[mapSproutNullifiersToNotes[nullifier].hash].MarkSpentDirty();
             }
         }
     }
@@ -1662,7 +2317,7 @@ void CWallet::MarkAffectedTransactionsDirty(const CTransaction& tx)
         uint256 nullifier = spend.nullifier;
         if (mapSaplingNullifiersToNotes.count(nullifier) &&
             mapWallet.count(mapSaplingNullifiersToNotes[nullifier].hash)) {
-            mapWallet[mapSaplingNullifiersToNotes[nullifier].hash].MarkDirty();
+            mapWallet[mapSaplingNullifiersToNotes[nullifier].hash].MarkSpentDirty();
         }
     }
 }
@@ -1673,6 +2328,18 @@ void CWallet::EraseFromWallet(const uint256 &hash)
         return;
     {
         LOCK(cs_wallet);
+        setMaybeUnspentTxs.erase(hash);
+        std::map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end()) {
+            setResendCandidates.erase(std::make_pair(mi->second.nTimeReceived, hash));
+            std::pair<TxItems::iterator, TxItems::iterator> range = wtxOrdered.equal_range(mi->second.nOrderPos);
+            for (TxItems::iterator it = range.first; it != range.second; ++it) {
+                if (it->second.first == &mi->second) {
+                    wtxOrdered.erase(it);
+                    break;
+                }
+            }
+        }
         if (mapWallet.erase(hash))
             CWalletDB(strWalletFile).EraseTx(hash);
     }
@@ -1708,6 +2375,109 @@ boost::optional<uint256> CWallet::GetSproutNoteNullifier(const JSDescription &js
     return ret;
 }
 
+static CCheckQueue<CTrialDecryptionCheck> trialdecryptionqueue(4, CORE_CLASS_WALLET);
+static std::atomic<int> nTrialDecryptionThreads(0);
+//! Serializes use of trialdecryptionqueue between wallets
+static CCriticalSection cs_trialdecryption;
+
+//! Below this many trial decryptions in a transaction, queueing costs more than it saves
+static const size_t MIN_PARALLEL_TRIAL_DECRYPTIONS = 64;
+//! Smallest key slice worth handing to a worker as a separate task
+static const size_t MIN_KEYS_PER_TRIAL_DECRYPTION = 16;
+
+void ThreadTrialDecryption() {
+    RenameThread("litecoinz-decrypt");
+    nTrialDecryptionThreads++;
+    trialdecryptionqueue.Thread();
+}
+
+bool CTrialDecryptionCheck::operator()()
+{
+    if (pSproutKeys) {
+        // The scalar multiplication dominates a trial decryption, and the
+        // ciphertexts of a JoinSplit share it, so each key's is done once.
+        size_t nLeft = pjsdesc->ciphertexts.size();
+        for (size_t k = nBegin; k < nEnd && nLeft > 0; k++) {
+            const ZCNoteDecryption& decryptor = (*pSproutKeys)[k]->second;
+            try {
+                uint256 dhsecret = decryptor.shared_secret(pjsdesc->ephemeralKey);
+                for (size_t n = 0; n < pjsdesc->ciphertexts.size(); n++) {
+                    if (pResult[n].nKey >= 0) {
+                        continue;
+                    }
+                    auto note = SproutNotePlaintext::try_decrypt(
+                        decryptor,
+                        pjsdesc->ciphertexts[n],
+                        dhsecret,
+                        pjsdesc->ephemeralKey,
+                        hSig,
+                        (unsigned char) n);
+                    if (note) {
+                        pResult[n].sproutNote = *note;
+                        pResult[n].nKey = k;
+                        nLeft--;
+                    }
+                }
+            } catch (const std::exception &exc) {
+                // Unexpected failure
+                LogPrintf("FindMySproutNotes(): Unexpected error while testing decrypt:\n");
+                LogPrintf("%s\n", exc.what());
+            }
+        }
+    } else if (pSaplingKeys && pcompact) {
+        for (size_t k = nBegin; k < nEnd; k++) {
+            if (SaplingNotePlaintext::compact_decrypt(
+                    pcompact->encCiphertext, (*pSaplingKeys)[k], pcompact->ephemeralKey, pcompact->cm)) {
+                pResult->nKey = k;
+                break;
+            }
+        }
+    } else if (pSaplingKeys) {
+        for (size_t k = nBegin; k < nEnd; k++) {
+            uint256 pk_d;
+            auto result = SaplingNotePlaintext::decrypt(
+                poutput->encCiphertext, (*pSaplingKeys)[k], poutput->ephemeralKey, poutput->cm, &pk_d);
+            if (result) {
+                pResult->saplingNote = result.get();
+                pResult->saplingAddress = SaplingPaymentAddress(result->d, pk_d);
+                pResult->nKey = k;
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Number of key slices to split each output's trial decryptions into, or 0
+ * if the whole transaction should be decrypted on the calling thread.
+ */
+static size_t TrialDecryptionSlices(size_t nOutputs, size_t nKeys)
+{
+    int nThreads = nTrialDecryptionThreads;
+    if (nThreads == 0 || nOutputs * nKeys < MIN_PARALLEL_TRIAL_DECRYPTIONS) {
+        return 0;
+    }
+    // Give every worker and the master something to do even when the
+    // transaction has a single output.
+    size_t nSlices = std::min<size_t>(nThreads + 1, nKeys / MIN_KEYS_PER_TRIAL_DECRYPTION);
+    return std::max<size_t>(nSlices, 1);
+}
+
+static void RunTrialDecryptionChecks(std::vector<CTrialDecryptionCheck>& vChecks, bool fParallel)
+{
+    if (fParallel) {
+        LOCK(cs_trialdecryption);
+        CCheckQueueControl<CTrialDecryptionCheck> control(&trialdecryptionqueue);
+        control.Add(vChecks);
+        control.Wait();
+    } else {
+        for (CTrialDecryptionCheck& check : vChecks) {
+            check();
+        }
+    }
+}
+
 /**
  * Finds all output notes in the given transaction that have been sent to
  * PaymentAddresses in this wallet.
@@ -1717,38 +2487,101 @@ boost::optional<uint256> CWallet::GetSproutNoteNullifier(const JSDescription &js
  * already have been cached in CWalletTx.mapSproutNoteData.
  */
 mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx) const
+{
+    return FindMySproutNotes(std::vector<const CTransaction*>(1, &tx))[0];
+}
+
+/**
+ * Batch variant of FindMySproutNotes, returning one map per transaction.
+ * Trial decryptions for all of the transactions are scheduled together, so
+ * that many small transactions can still make use of the worker threads.
+ */
+std::vector<mapSproutNoteData_t> CWallet::FindMySproutNotes(const std::vector<const CTransaction*>& vtx) const
 {
     LOCK(cs_SpendingKeyStore);
-    uint256 hash = tx.GetHash();
 
-    mapSproutNoteData_t noteData;
-    for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
-        auto hSig = tx.vjoinsplit[i].h_sig(*pzcashParams, tx.joinSplitPubKey);
-        for (uint8_t j = 0; j < tx.vjoinsplit[i].ciphertexts.size(); j++) {
-            for (const NoteDecryptorMap::value_type& item : mapNoteDecryptors) {
-                try {
-                    auto address = item.first;
-                    JSOutPoint jsoutpt {hash, i, j};
-                    auto nullifier = GetSproutNoteNullifier(
-                        tx.vjoinsplit[i],
-                        address,
-                        item.second,
-                        hSig, j);
-                    if (nullifier) {
-                        SproutNoteData nd {address, *nullifier};
-                        noteData.insert(std::make_pair(jsoutpt, nd));
-                    } else {
-                        SproutNoteData nd {address};
-                        noteData.insert(std::make_pair(jsoutpt, nd));
-                    }
-                    break;
-                } catch (const note_decryption_failed &err) {
-                    // Couldn't decrypt with this decryptor
-                } catch (const std::exception &exc) {
-                    // Unexpected failure
-                    LogPrintf("FindMySproutNotes(): Unexpected error while testing decrypt:\n");
-                    LogPrintf("%s\n", exc.what());
+    std::vector<mapSproutNoteData_t> noteData(vtx.size());
+    if (mapNoteDecryptors.empty()) {
+        return noteData;
+    }
+
+    std::vector<const NoteDecryptorMap::value_type*> keys;
+    keys.reserve(mapNoteDecryptors.size());
+    for (const NoteDecryptorMap::value_type& item : mapNoteDecryptors) {
+        keys.push_back(&item);
+    }
+
+    // (transaction index, outpoint) of the first ciphertext of every
+    // JoinSplit, and its hSig
+    static const size_t NUM_CIPHERTEXTS = ZC_NUM_JS_OUTPUTS;
+    std::vector<std::pair<size_t, JSOutPoint>> joinsplits;
+    std::vector<uint256> hSigs;
+    for (size_t t = 0; t < vtx.size(); t++) {
+        const CTransaction& tx = *vtx[t];
+        if (tx.vjoinsplit.empty()) {
+            continue;
+        }
+        uint256 hash = tx.GetHash();
+        for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
+            joinsplits.push_back(std::make_pair(t, JSOutPoint {hash, i, 0}));
+            hSigs.push_back(tx.vjoinsplit[i].h_sig(*pzcashParams, tx.joinSplitPubKey));
+        }
+    }
+    if (joinsplits.empty()) {
+        return noteData;
+    }
+
+    // Each check tries one slice of the keys against every ciphertext of a
+    // JoinSplit; results are laid out by JoinSplit, then slice, then ciphertext.
+    size_t nSlices = TrialDecryptionSlices(joinsplits.size() * NUM_CIPHERTEXTS, keys.size());
+    size_t nSlicesPerOutput = std::max<size_t>(nSlices, 1);
+    std::vector<CTrialDecryptionResult> results(joinsplits.size() * nSlicesPerOutput * NUM_CIPHERTEXTS);
+    std::vector<CTrialDecryptionCheck> vChecks;
+    vChecks.reserve(joinsplits.size() * nSlicesPerOutput);
+    for (size_t n = 0; n < joinsplits.size(); n++) {
+        const JSDescription& jsdesc = vtx[joinsplits[n].first]->vjoinsplit[joinsplits[n].second.js];
+        for (size_t s = 0; s < nSlicesPerOutput; s++) {
+            vChecks.emplace_back(jsdesc, hSigs[n], keys,
+                                 s * keys.size() / nSlicesPerOutput, (s + 1) * keys.size() / nSlicesPerOutput,
+                                 &results[(n * nSlicesPerOutput + s) * NUM_CIPHERTEXTS]);
+        }
+    }
+    RunTrialDecryptionChecks(vChecks, nSlices > 0);
+
+    std::vector<std::pair<size_t, JSOutPoint>> outpoints;
+    for (size_t n = 0; n < joinsplits.size(); n++) {
+        for (uint8_t j = 0; j < NUM_CIPHERTEXTS; j++) {
+            JSOutPoint jsoutpt = joinsplits[n].second;
+            jsoutpt.n = j;
+            outpoints.push_back(std::make_pair(joinsplits[n].first, jsoutpt));
+        }
+    }
+    for (size_t n = 0; n < outpoints.size(); n++) {
+        for (size_t s = 0; s < nSlicesPerOutput; s++) {
+            size_t js = n / NUM_CIPHERTEXTS;
+            const CTrialDecryptionResult& result = results[(js * nSlicesPerOutput + s) * NUM_CIPHERTEXTS + n % NUM_CIPHERTEXTS];
+            if (result.nKey < 0) {
+                continue;
+            }
+            auto address = keys[result.nKey]->first;
+            try {
+                // SpendingKeys are only available if:
+                // - We have them (this isn't a viewing key)
+                // - The wallet is unlocked
+                libzcash::SproutSpendingKey key;
+                if (GetSproutSpendingKey(address, key)) {
+                    SproutNoteData nd {address, result.sproutNote.note(address).nullifier(key)};
+                    noteData[outpoints[n].first].insert(std::make_pair(outpoints[n].second, nd));
+                } else {
+                    SproutNoteData nd {address};
+                    noteData[outpoints[n].first].insert(std::make_pair(outpoints[n].second, nd));
                 }
+                break;
+            } catch (const std::exception &exc) {
+                // Unexpected failure, move on to the key the next slice found
+                LogPrintf("FindMySproutNotes(): Unexpected error while computing nullifier:\n");
+                LogPrintf("%s\n", exc.what());
+                continue;
             }
         }
     }
@@ -1765,37 +2598,153 @@ mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx) const
  * already have been cached in CWalletTx.mapSaplingNoteData.
  */
 std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySaplingNotes(const CTransaction &tx) const
+{
+    return FindMySaplingNotes(std::vector<const CTransaction*>(1, &tx))[0];
+}
+
+/** Batch variant of FindMySaplingNotes, returning one result per transaction. */
+std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> CWallet::FindMySaplingNotes(const std::vector<const CTransaction*>& vtx) const
 {
     LOCK(cs_SpendingKeyStore);
-    uint256 hash = tx.GetHash();
 
-    mapSaplingNoteData_t noteData;
-    SaplingIncomingViewingKeyMap viewingKeysToAdd;
+    std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> noteData(vtx.size());
+    if (mapSaplingFullViewingKeys.empty()) {
+        return noteData;
+    }
+
+    std::vector<SaplingIncomingViewingKey> keys;
+    keys.reserve(mapSaplingFullViewingKeys.size());
+    for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
+        keys.push_back(it->first);
+    }
+
+    // (transaction index, output index) of every shielded output
+    std::vector<std::pair<size_t, uint32_t>> outputs;
+    for (size_t t = 0; t < vtx.size(); t++) {
+        for (uint32_t i = 0; i < vtx[t]->vShieldedOutput.size(); ++i) {
+            outputs.push_back(std::make_pair(t, i));
+        }
+    }
+    if (outputs.empty()) {
+        return noteData;
+    }
 
     // Protocol Spec: 4.19 Block Chain Scanning (Sapling)
-    for (uint32_t i = 0; i < tx.vShieldedOutput.size(); ++i) {
-        const OutputDescription output = tx.vShieldedOutput[i];
-        for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
-            SaplingIncomingViewingKey ivk = it->first;
-            auto result = SaplingNotePlaintext::decrypt(output.encCiphertext, ivk, output.ephemeralKey, output.cm);
-            if (!result) {
+    size_t nSlices = TrialDecryptionSlices(outputs.size(), keys.size());
+    size_t nSlicesPerOutput = std::max<size_t>(nSlices, 1);
+    std::vector<CTrialDecryptionResult> results(outputs.size() * nSlicesPerOutput);
+    std::vector<CTrialDecryptionCheck> vChecks;
+    vChecks.reserve(results.size());
+    for (size_t n = 0; n < outputs.size(); n++) {
+        const OutputDescription& output = vtx[outputs[n].first]->vShieldedOutput[outputs[n].second];
+        for (size_t s = 0; s < nSlicesPerOutput; s++) {
+            vChecks.emplace_back(output, keys,
+                                 s * keys.size() / nSlicesPerOutput, (s + 1) * keys.size() / nSlicesPerOutput,
+                                 &results[n * nSlicesPerOutput + s]);
+        }
+    }
+    RunTrialDecryptionChecks(vChecks, nSlices > 0);
+
+    for (size_t n = 0; n < outputs.size(); n++) {
+        for (size_t s = 0; s < nSlicesPerOutput; s++) {
+            const CTrialDecryptionResult& result = results[n * nSlicesPerOutput + s];
+            if (result.nKey < 0) {
                 continue;
             }
-            auto address = ivk.address(result.get().d);
-            if (address && mapSaplingIncomingViewingKeys.count(address.get()) == 0) {
-                viewingKeysToAdd[address.get()] = ivk;
+            SaplingIncomingViewingKey ivk = keys[result.nKey];
+            // The decryption already derived the address, so unlike
+            // ivk.address() this needs no further scalar multiplication
+            if (mapSaplingIncomingViewingKeys.count(result.saplingAddress) == 0) {
+                noteData[outputs[n].first].second[result.saplingAddress] = ivk;
             }
             // We don't cache the nullifier here as computing it requires knowledge of the note position
             // in the commitment tree, which can only be determined when the transaction has been mined.
-            SaplingOutPoint op {hash, i};
+            SaplingOutPoint op {vtx[outputs[n].first]->GetHash(), outputs[n].second};
             SaplingNoteData nd;
             nd.ivk = ivk;
-            noteData.insert(std::make_pair(op, nd));
+            noteData[outputs[n].first].first.insert(std::make_pair(op, nd));
             break;
         }
     }
 
-    return std::make_pair(noteData, viewingKeysToAdd);
+    return noteData;
+}
+
+/**
+ * For each compact Sapling output from the shielded index, whether it
+ * decrypts to a note for one of the wallet's incoming viewing keys.
+ */
+std::vector<bool> CWallet::MatchCompactSaplingOutputs(const std::vector<const CCompactSaplingOutput*>& voutputs) const
+{
+    LOCK(cs_SpendingKeyStore);
+
+    std::vector<bool> matches(voutputs.size(), false);
+    if (voutputs.empty() || mapSaplingFullViewingKeys.empty()) {
+        return matches;
+    }
+
+    std::vector<SaplingIncomingViewingKey> keys;
+    keys.reserve(mapSaplingFullViewingKeys.size());
+    for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
+        keys.push_back(it->first);
+    }
+
+    size_t nSlices = TrialDecryptionSlices(voutputs.size(), keys.size());
+    size_t nSlicesPerOutput = std::max<size_t>(nSlices, 1);
+    std::vector<CTrialDecryptionResult> results(voutputs.size() * nSlicesPerOutput);
+    std::vector<CTrialDecryptionCheck> vChecks;
+    vChecks.reserve(results.size());
+    for (size_t n = 0; n < voutputs.size(); n++) {
+        for (size_t s = 0; s < nSlicesPerOutput; s++) {
+            vChecks.emplace_back(*voutputs[n], keys,
+                                 s * keys.size() / nSlicesPerOutput, (s + 1) * keys.size() / nSlicesPerOutput,
+                                 &results[n * nSlicesPerOutput + s]);
+        }
+    }
+    RunTrialDecryptionChecks(vChecks, nSlices > 0);
+
+    for (size_t n = 0; n < voutputs.size(); n++) {
+        for (size_t s = 0; s < nSlicesPerOutput; s++) {
+            if (results[n * nSlicesPerOutput + s].nKey >= 0) {
+                matches[n] = true;
+                break;
+            }
+        }
+    }
+    return matches;
+}
+
+std::vector<uint64_t> CWallet::GetTransparentFilterQuery() const
+{
+    GCSFilter::ElementSet elements;
+    {
+        LOCK(cs_KeyStore);
+        std::set<CKeyID> setKeyIDs;
+        GetKeys(setKeyIDs);
+        for (const CKeyID& keyID : setKeyIDs) {
+            elements.insert(TransparentFilterKeyElement(keyID));
+        }
+        for (const auto& item : mapScripts) {
+            GetTransparentFilterElements(GetScriptForDestination(item.first), elements);
+        }
+        for (const CScript& script : setWatchOnly) {
+            GetTransparentFilterElements(script, elements);
+        }
+    }
+    {
+        LOCK(cs_wallet);
+        for (const auto& item : mapWallet) {
+            elements.insert(TransparentFilterSpendElement(item.first));
+        }
+    }
+
+    std::vector<uint64_t> hashes;
+    hashes.reserve(elements.size());
+    for (const GCSFilter::Element& element : elements) {
+        hashes.push_back(GCSFilter::HashElement(CCompactShieldedBlock::FILTER_K0, CCompactShieldedBlock::FILTER_K1, element));
+    }
+    std::sort(hashes.begin(), hashes.end());
+    return hashes;
 }
 
 bool CWallet::IsSproutNullifierFromMe(const uint256& nullifier) const
@@ -1831,10 +2780,14 @@ void CWallet::GetSproutNoteWitnesses(std::vector<JSOutPoint> notes,
     boost::optional<uint256> rt;
     int i = 0;
     for (JSOutPoint note : notes) {
-        if (mapWallet.count(note.hash) &&
-                mapWallet[note.hash].mapSproutNoteData.count(note) &&
-                mapWallet[note.hash].mapSproutNoteData[note].witnesses.size() > 0) {
-            witnesses[i] = mapWallet[note.hash].mapSproutNoteData[note].witnesses.front();
+        auto wtxIt = mapWallet.find(note.hash);
+        if (wtxIt == mapWallet.end()) {
+            i++;
+            continue;
+        }
+        auto ndIt = wtxIt->second.mapSproutNoteData.find(note);
+        if (ndIt != wtxIt->second.mapSproutNoteData.end() && ndIt->second.witnesses.size() > 0) {
+            witnesses[i] = ndIt->second.witnesses.front();
             if (!rt) {
                 rt = witnesses[i]->root();
             } else {
@@ -1858,10 +2811,14 @@ void CWallet::GetSaplingNoteWitnesses(std::vector<SaplingOutPoint> notes,
     boost::optional<uint256> rt;
     int i = 0;
     for (SaplingOutPoint note : notes) {
-        if (mapWallet.count(note.hash) &&
-                mapWallet[note.hash].mapSaplingNoteData.count(note) &&
-                mapWallet[note.hash].mapSaplingNoteData[note].witnesses.size() > 0) {
-            witnesses[i] = mapWallet[note.hash].mapSaplingNoteData[note].witnesses.front();
+        auto wtxIt = mapWallet.find(note.hash);
+        if (wtxIt == mapWallet.end()) {
+            i++;
+            continue;
+        }
+        auto ndIt = wtxIt->second.mapSaplingNoteData.find(note);
+        if (ndIt != wtxIt->second.mapSaplingNoteData.end() && ndIt->second.witnesses.size() > 0) {
+            witnesses[i] = ndIt->second.witnesses.front();
             if (!rt) {
                 rt = witnesses[i]->root();
             } else {
@@ -1876,6 +2833,27 @@ void CWallet::GetSaplingNoteWitnesses(std::vector<SaplingOutPoint> notes,
     }
 }
 
+SproutWitnessSnapshot CWallet::SnapshotSproutNoteWitnesses(const std::vector<JSOutPoint>& notes)
+{
+    SproutWitnessSnapshot snapshot;
+    GetSproutNoteWitnesses(notes, snapshot.witnesses, snapshot.anchor);
+    return snapshot;
+}
+
+SaplingWitnessSnapshot CWallet::SnapshotSaplingNoteWitnesses(const std::vector<SaplingOutPoint>& notes)
+{
+    SaplingWitnessSnapshot snapshot;
+    GetSaplingNoteWitnesses(notes, snapshot.witnesses, snapshot.anchor);
+    return snapshot;
+}
+
+void CWallet::MarkIsMineDirty()
+{
+    LOCK(cs_ismine);
+    mapIsMineCache.clear();
+    nIsMineGeneration++;
+}
+
 isminetype CWallet::IsMine(const CTxIn &txin) const
 {
     {
@@ -1885,7 +2863,7 @@ isminetype CWallet::IsMine(const CTxIn &txin) const
         {
             const CWalletTx& prev = (*mi).second;
             if (txin.prevout.n < prev.vout.size())
-                return IsMine(prev.vout[txin.prevout.n]);
+                return prev.IsMine(txin.prevout.n);
         }
     }
     return ISMINE_NO;
@@ -1900,7 +2878,7 @@ CAmount CWallet::GetDebit(const CTxIn &txin, const isminefilter& filter) const
         {
             const CWalletTx& prev = (*mi).second;
             if (txin.prevout.n < prev.vout.size())
-                if (IsMine(prev.vout[txin.prevout.n]) & filter)
+                if (prev.IsMine(txin.prevout.n) & filter)
                     return prev.vout[txin.prevout.n].nValue;
         }
     }
@@ -1909,7 +2887,23 @@ CAmount CWallet::GetDebit(const CTxIn &txin, const isminefilter& filter) const
 
 isminetype CWallet::IsMine(const CTxOut& txout) const
 {
-    return ::IsMine(*this, txout.scriptPubKey);
+    {
+        LOCK(cs_ismine);
+        boost::unordered_map<CScript, isminetype, CScriptHasher>::const_iterator it = mapIsMineCache.find(txout.scriptPubKey);
+        if (it != mapIsMineCache.end())
+            return it->second;
+    }
+
+    unsigned int nGeneration = nIsMineGeneration;
+    isminetype mine = ::IsMine(*this, txout.scriptPubKey);
+    LOCK(cs_ismine);
+    // Keys added while the script was solved may have changed the answer
+    if (nGeneration == nIsMineGeneration) {
+        if (mapIsMineCache.size() >= MAX_ISMINE_CACHE_SIZE)
+            mapIsMineCache.clear();
+        mapIsMineCache[txout.scriptPubKey] = mine;
+    }
+    return mine;
 }
 
 CAmount CWallet::GetCredit(const CTxOut& txout, const isminefilter& filter) const
@@ -1928,7 +2922,7 @@ bool CWallet::IsChange(const CTxOut& txout) const
     // a better way of identifying which outputs are 'the send' and which are
     // 'the change' will need to be implemented (maybe extend CWalletTx to remember
     // which output, if any, was change).
-    if (::IsMine(*this, txout.scriptPubKey))
+    if (IsMine(txout))
     {
         CTxDestination address;
         if (!ExtractDestination(txout.scriptPubKey, address))
@@ -2098,7 +3092,7 @@ bool CWallet::LoadCryptedHDSeed(const uint256& seedFp, const std::vector<unsigne
     return CCryptoKeyStore::SetCryptedHDSeed(seedFp, seed);
 }
 
-void CWalletTx::SetSproutNoteData(mapSproutNoteData_t &noteData)
+void CWalletTx::SetSproutNoteData(const mapSproutNoteData_t &noteData)
 {
     mapSproutNoteData.clear();
     for (const std::pair<JSOutPoint, SproutNoteData> nd : noteData) {
@@ -2114,7 +3108,7 @@ void CWalletTx::SetSproutNoteData(mapSproutNoteData_t &noteData)
     }
 }
 
-void CWalletTx::SetSaplingNoteData(mapSaplingNoteData_t &noteData)
+void CWalletTx::SetSaplingNoteData(const mapSaplingNoteData_t &noteData)
 {
     mapSaplingNoteData.clear();
     for (const std::pair<SaplingOutPoint, SaplingNoteData> nd : noteData) {
@@ -2252,7 +3246,7 @@ void CWalletTx::GetAmounts(list<COutputEntry>& listReceived,
     for (unsigned int i = 0; i < vout.size(); ++i)
     {
         const CTxOut& txout = vout[i];
-        isminetype fIsMine = pwallet->IsMine(txout);
+        isminetype fIsMine = IsMine(i);
         // Only need to handle txouts if AT LEAST one of these is true:
         //   1) they debit from us (sent)
         //   2) the output is to us (received)
@@ -2340,8 +3334,9 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
         CBlock block;
         ReadBlockFromDisk(block, pindex);
 
-        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        BOOST_FOREACH(const CTransactionRef& ptx, block.vtx)
         {
+            const CTransaction& tx = *ptx;
             BOOST_FOREACH(const JSDescription& jsdesc, tx.vjoinsplit)
             {
                 BOOST_FOREACH(const uint256 &note_commitment, jsdesc.commitments)
@@ -2368,9 +3363,8 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
         uint256 current_anchor = tree.root();
 
         // Consistency check: we should be able to find the current tree
-        // in our CCoins view.
-        SproutMerkleTree dummy_tree;
-        assert(pcoinsTip->GetSproutAnchorAt(current_anchor, dummy_tree));
+        // in our coins view.
+        assert(pcoinsTip->HaveAnchor(current_anchor, SPROUT));
 
         pindex = chainActive.Next(pindex);
     }
@@ -2385,10 +3379,90 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
     }
 }
 
+//! Blocks the rescan reader thread may have buffered ahead of the wallet
+static const size_t WALLET_RESCAN_PREFETCH_BLOCKS = 32;
+//! Blocks whose shielded outputs are trial-decrypted together during a rescan
+static const size_t WALLET_RESCAN_BATCH_BLOCKS = 16;
+
+/**
+ * Reads the blocks of a rescan from disk on a separate thread, so that block
+ * I/O and header checks overlap with trial decryption. Blocks are handed out
+ * in the order of vIndex, with at most nMaxBlocks read ahead.
+ */
+class CBlockPrefetcher
+{
+private:
+    const std::vector<CBlockIndex*>& vIndex;
+    const size_t nMaxBlocks;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<CBlock> queue;
+    bool fStop;
+    boost::thread thread;
+
+    void Run()
+    {
+        RenameThread("litecoinz-rescan");
+        for (CBlockIndex* pindex : vIndex) {
+            CBlock block;
+            ReadBlockFromDisk(block, pindex);
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fStop && queue.size() >= nMaxBlocks) {
+                cond.wait(lock);
+            }
+            if (fStop) {
+                return;
+            }
+            queue.push_back(std::move(block));
+            cond.notify_all();
+        }
+    }
+
+public:
+    CBlockPrefetcher(const std::vector<CBlockIndex*>& vIndexIn, size_t nMaxBlocksIn) :
+        vIndex(vIndexIn), nMaxBlocks(nMaxBlocksIn), fStop(false)
+    {
+        thread = boost::thread(&CBlockPrefetcher::Run, this);
+    }
+
+    ~CBlockPrefetcher()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+            cond.notify_all();
+        }
+        thread.join();
+    }
+
+    /** Wait for the next block. Must be called at most vIndex.size() times. */
+    void Next(CBlock& block)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (queue.empty()) {
+            cond.wait(lock);
+        }
+        block = std::move(queue.front());
+        queue.pop_front();
+        cond.notify_all();
+    }
+};
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
+ *
+ * The scan is pipelined: a reader thread fetches blocks ahead, the shielded
+ * outputs of WALLET_RESCAN_BATCH_BLOCKS blocks at a time are trial-decrypted
+ * on the trial decryption workers, and the results are then committed to the
+ * wallet block by block, in chain order, together with the witness updates.
+ *
+ * With -shieldedindex, the batches are trial-decrypted from the index instead
+ * and only blocks that may concern the wallet are read from disk; the note
+ * witnesses are advanced past the others from their index records.
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
@@ -2408,61 +3482,224 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
         while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
             pindex = chainActive.Next(pindex);
 
+        // The active chain cannot change while we hold cs_main, so the reader
+        // thread can be given the whole range up front.
+        std::vector<CBlockIndex*> vIndex;
+        for (CBlockIndex* pindexScan = pindex; pindexScan; pindexScan = chainActive.Next(pindexScan)) {
+            vIndex.push_back(pindexScan);
+        }
+
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
         double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
         double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
-        while (pindex)
         {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+            LOCK(cs_rescanProgress);
+            rescanProgress.fScanning = true;
+            rescanProgress.nStartHeight = pindex ? pindex->nHeight : chainActive.Height();
+            rescanProgress.nHeight = rescanProgress.nStartHeight;
+            rescanProgress.nTipHeight = chainActive.Height();
+            rescanProgress.nStartTime = GetTimeMillis();
+            rescanProgress.dProgress = 0;
+        }
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+        auto getTrees = [&](const CBlockIndex* pindex, SproutMerkleTree& sproutTree, SaplingMerkleTree& saplingTree) {
+            // This should never fail: we should always be able to get the tree
+            // state on the path to the tip of our chain
+            assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, sproutTree));
+            if (pindex->pprev) {
+                if (NetworkUpgradeActive(pindex->pprev->nHeight, Params().GetConsensus(), Consensus::UPGRADE_SAPLING)) {
+                    assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingTree));
+                }
+            }
+        };
+
+        // Add the block's transactions to the wallet, given their trial
+        // decryption results starting at index nTx, and increment note witness caches
+        auto commitBlock = [&](const CBlockIndex* pindex, const CBlock& block,
+                               const std::vector<mapSproutNoteData_t>& sproutNoteData,
+                               const std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>>& saplingNoteData,
+                               size_t nTx) {
+            for (const CTransactionRef& ptx : block.vtx)
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate)) {
+                const CTransaction& tx = *ptx;
+                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate, sproutNoteData[nTx], saplingNoteData[nTx])) {
                     myTxHashes.push_back(tx.GetHash());
                     ret++;
                 }
+                nTx++;
             }
 
             SproutMerkleTree sproutTree;
             SaplingMerkleTree saplingTree;
-            // This should never fail: we should always be able to get the tree
-            // state on the path to the tip of our chain
-            assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, sproutTree));
-            if (pindex->pprev) {
-                if (NetworkUpgradeActive(pindex->pprev->nHeight, Params().GetConsensus(), Consensus::UPGRADE_SAPLING)) {
-                    assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingTree));
+            getTrees(pindex, sproutTree, saplingTree);
+            ChainTip(pindex, &block, sproutTree, saplingTree, true);
+        };
+
+        auto reportProgress = [&](CBlockIndex* pindex) {
+            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+
+            {
+                LOCK(cs_rescanProgress);
+                rescanProgress.nHeight = pindex->nHeight;
+                if (dProgressTip - dProgressStart > 0.0) {
+                    rescanProgress.dProgress = std::max(0.0, std::min(1.0,
+                        (Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart)));
                 }
             }
-            // Increment note witness caches
-            ChainTip(pindex, &block, sproutTree, saplingTree, true);
 
-            pindex = chainActive.Next(pindex);
             if (GetTime() >= nNow + 60) {
                 nNow = GetTime();
                 LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
             }
+        };
+
+        if (fShieldedIndex) {
+            bool fHaveSproutKeys;
+            {
+                LOCK(cs_SpendingKeyStore);
+                fHaveSproutKeys = !mapNoteDecryptors.empty();
+            }
+            std::set<uint256> setWalletBlocks;
+            for (const auto& item : mapWallet) {
+                if (!item.second.hashBlock.IsNull()) {
+                    setWalletBlocks.insert(item.second.hashBlock);
+                }
+            }
+            std::vector<uint64_t> vFilterQuery = GetTransparentFilterQuery();
+            size_t nSkipped = 0;
+
+            for (size_t nBatchStart = 0; nBatchStart < vIndex.size(); nBatchStart += WALLET_RESCAN_BATCH_BLOCKS) {
+                size_t nBatchSize = std::min(WALLET_RESCAN_BATCH_BLOCKS, vIndex.size() - nBatchStart);
+                std::vector<CCompactShieldedBlock> vCompact(nBatchSize);
+                std::vector<bool> vHaveCompact(nBatchSize);
+                std::vector<const CCompactSaplingOutput*> vOutputs;
+                for (size_t i = 0; i < nBatchSize; i++) {
+                    vHaveCompact[i] = pblocktree->ReadShieldedIndex(vIndex[nBatchStart + i]->GetBlockHash(), vCompact[i]);
+                    for (const CCompactShieldedTx& ctx : vCompact[i].vtx) {
+                        for (const CCompactSaplingOutput& output : ctx.vSaplingOutputs) {
+                            vOutputs.push_back(&output);
+                        }
+                    }
+                }
+                std::vector<bool> vOutputMatches = MatchCompactSaplingOutputs(vOutputs);
+
+                bool fBatch = BeginBatch();
+                size_t nOutput = 0;
+                for (size_t i = 0; i < nBatchSize; i++) {
+                    pindex = vIndex[nBatchStart + i];
+                    const CCompactShieldedBlock& compact = vCompact[i];
+
+                    // Anything that could make AddToWalletIfInvolvingMe accept one of
+                    // the block's transactions, or IncrementNoteWitnesses witness one
+                    // of its notes, means that the block has to be scanned in full.
+                    bool fRelevant = !vHaveCompact[i] || setWalletBlocks.count(pindex->GetBlockHash());
+                    for (const CCompactShieldedTx& ctx : compact.vtx) {
+                        for (size_t n = 0; n < ctx.vSaplingOutputs.size(); n++) {
+                            fRelevant |= vOutputMatches[nOutput++];
+                        }
+                        // Sprout notes cannot be trial-decrypted from the index
+                        fRelevant |= fHaveSproutKeys && !ctx.vSproutCommitments.empty();
+                        for (const uint256& nullifier : ctx.vSproutNullifiers) {
+                            fRelevant = fRelevant || IsSproutNullifierFromMe(nullifier);
+                        }
+                        for (const uint256& nullifier : ctx.vSaplingNullifiers) {
+                            fRelevant = fRelevant || IsSaplingNullifierFromMe(nullifier);
+                        }
+                    }
+                    fRelevant = fRelevant || compact.transparentFilter.MatchAnyHashed(vFilterQuery);
+
+                    if (fRelevant) {
+                        CBlock block;
+                        ReadBlockFromDisk(block, pindex);
+                        std::vector<const CTransaction*> vtx;
+                        for (const CTransactionRef& tx : block.vtx) {
+                            vtx.push_back(tx.get());
+                        }
+                        size_t nTxHashesBefore = myTxHashes.size();
+                        commitBlock(pindex, block, FindMySproutNotes(vtx), FindMySaplingNotes(vtx), 0);
+
+                        // Later blocks may spend the transparent outputs of transactions we just found
+                        for (size_t n = nTxHashesBefore; n < myTxHashes.size(); n++) {
+                            uint64_t hash = GCSFilter::HashElement(CCompactShieldedBlock::FILTER_K0, CCompactShieldedBlock::FILTER_K1,
+                                                                   TransparentFilterSpendElement(myTxHashes[n]));
+                            vFilterQuery.insert(std::lower_bound(vFilterQuery.begin(), vFilterQuery.end(), hash), hash);
+                        }
+                    } else {
+                        SproutMerkleTree sproutTree;
+                        SaplingMerkleTree saplingTree;
+                        getTrees(pindex, sproutTree, saplingTree);
+                        IncrementNoteWitnesses(pindex, compact, sproutTree, saplingTree);
+                        nSkipped++;
+                    }
+
+                    reportProgress(pindex);
+                }
+                if (fBatch)
+                    CommitBatch();
+            }
+            LogPrintf("Rescan skipped %u of %u blocks using the shielded index\n", nSkipped, vIndex.size());
+        } else {
+            CBlockPrefetcher prefetcher(vIndex, WALLET_RESCAN_PREFETCH_BLOCKS);
+            for (size_t nBatchStart = 0; nBatchStart < vIndex.size(); nBatchStart += WALLET_RESCAN_BATCH_BLOCKS) {
+                size_t nBatchSize = std::min(WALLET_RESCAN_BATCH_BLOCKS, vIndex.size() - nBatchStart);
+                std::vector<CBlock> vBlocks(nBatchSize);
+                std::vector<const CTransaction*> vtx;
+                for (CBlock& block : vBlocks) {
+                    prefetcher.Next(block);
+                    for (const CTransactionRef& tx : block.vtx) {
+                        vtx.push_back(tx.get());
+                    }
+                }
+
+                // The wallet's keys do not change during the scan, so the whole
+                // batch can be decrypted before any of it is committed.
+                auto sproutNoteData = FindMySproutNotes(vtx);
+                auto saplingNoteData = FindMySaplingNotes(vtx);
+
+                bool fBatch = BeginBatch();
+                size_t nTx = 0;
+                for (size_t i = 0; i < nBatchSize; i++) {
+                    pindex = vIndex[nBatchStart + i];
+                    commitBlock(pindex, vBlocks[i], sproutNoteData, saplingNoteData, nTx);
+                    nTx += vBlocks[i].vtx.size();
+                    reportProgress(pindex);
+                }
+                if (fBatch)
+                    CommitBatch();
+            }
         }
 
         // After rescanning, persist Sapling note data that might have changed, e.g. nullifiers.
         // Do not flush the wallet here for performance reasons.
+        bool fBatch = BeginBatch();
         CWalletDB walletdb(strWalletFile, "r+", false);
         for (auto hash : myTxHashes) {
             CWalletTx wtx = mapWallet[hash];
             if (!wtx.mapSaplingNoteData.empty()) {
-                if (!wtx.WriteToDisk(&walletdb)) {
+                if (!wtx.WriteToDisk(pwalletdbBatch ? pwalletdbBatch : &walletdb)) {
                     LogPrintf("Rescanning... WriteToDisk failed to update Sapling note data for: %s\n", hash.ToString());
                 }
             }
         }
+        if (fBatch)
+            CommitBatch();
 
+        {
+            LOCK(cs_rescanProgress);
+            rescanProgress = CWalletRescanProgress();
+        }
         ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
     return ret;
 }
 
+CWalletRescanProgress CWallet::GetRescanProgress() const
+{
+    LOCK(cs_rescanProgress);
+    return rescanProgress;
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     // If transactions aren't being broadcasted, don't let them into local mempool either
@@ -2491,7 +3728,15 @@ void CWallet::ReacceptWalletTransactions()
         CWalletTx& wtx = *(item.second);
 
         LOCK(mempool.cs);
-        wtx.AcceptToMemoryPool(false);
+        if (wtx.fCompact) {
+            // The proofs the mempool checks are only in the block now
+            CTransaction tx;
+            CValidationState state;
+            if (wtx.GetFullTransaction(tx))
+                ::AcceptToMemoryPool(mempool, state, tx, false, NULL, true);
+        } else {
+            wtx.AcceptToMemoryPool(false);
+        }
     }
 }
 
@@ -2500,15 +3745,36 @@ bool CWalletTx::RelayWalletTransaction()
     assert(pwallet->GetBroadcastTransactions());
     if (!IsCoinBase())
     {
-        if (GetDepthInMainChain() == 0) {
+        CTransaction tx;
+        if (GetDepthInMainChain() == 0 && GetFullTransaction(tx)) {
             LogPrintf("Relaying wtx %s\n", GetHash().ToString());
-            RelayTransaction((CTransaction)*this);
+            RelayTransaction(tx);
             return true;
         }
     }
     return false;
 }
 
+bool CWalletTx::GetFullTransaction(CTransaction& txOut) const
+{
+    if (!fCompact) {
+        txOut = *this;
+        return true;
+    }
+
+    AssertLockHeld(cs_main);
+    BlockMap::const_iterator mi = mapBlockIndex.find(hashBlock);
+    if (mi == mapBlockIndex.end() || nIndex < 0)
+        return false;
+    CBlock block;
+    if (!ReadBlockFromDisk(block, mi->second))
+        return false;
+    if ((size_t)nIndex >= block.vtx.size() || block.vtx[nIndex]->GetHash() != GetHash())
+        return false;
+    txOut = *block.vtx[nIndex];
+    return true;
+}
+
 set<uint256> CWalletTx::GetConflicts() const
 {
     set<uint256> result;
@@ -2521,6 +3787,38 @@ set<uint256> CWalletTx::GetConflicts() const
     return result;
 }
 
+isminetype CWalletTx::IsMine(unsigned int n) const
+{
+    assert(n < vout.size());
+    unsigned int nGeneration = pwallet->GetIsMineGeneration();
+    if (nIsMineGeneration != nGeneration || vIsMineCached.size() != vout.size()) {
+        vIsMineCached.assign(vout.size(), ISMINE_UNKNOWN);
+        nIsMineGeneration = nGeneration;
+    }
+    if (vIsMineCached[n] == ISMINE_UNKNOWN)
+        vIsMineCached[n] = pwallet->IsMine(vout[n]);
+    return (isminetype)vIsMineCached[n];
+}
+
+CAmount CWalletTx::GetOutputCredit(unsigned int n, const isminefilter& filter) const
+{
+    if (!MoneyRange(vout[n].nValue))
+        throw std::runtime_error("CWalletTx::GetOutputCredit(): value out of range");
+    return ((IsMine(n) & filter) ? vout[n].nValue : 0);
+}
+
+CAmount CWalletTx::GetOutputsCredit(const isminefilter& filter) const
+{
+    CAmount nCredit = 0;
+    for (unsigned int i = 0; i < vout.size(); i++)
+    {
+        nCredit += GetOutputCredit(i, filter);
+        if (!MoneyRange(nCredit))
+            throw std::runtime_error("CWalletTx::GetOutputsCredit(): value out of range");
+    }
+    return nCredit;
+}
+
 CAmount CWalletTx::GetDebit(const isminefilter& filter) const
 {
     if (vin.empty())
@@ -2566,7 +3864,7 @@ CAmount CWalletTx::GetCredit(const isminefilter& filter) const
             credit += nCreditCached;
         else
         {
-            nCreditCached = pwallet->GetCredit(*this, ISMINE_SPENDABLE);
+            nCreditCached = GetOutputsCredit(ISMINE_SPENDABLE);
             fCreditCached = true;
             credit += nCreditCached;
         }
@@ -2577,7 +3875,7 @@ CAmount CWalletTx::GetCredit(const isminefilter& filter) const
             credit += nWatchCreditCached;
         else
         {
-            nWatchCreditCached = pwallet->GetCredit(*this, ISMINE_WATCH_ONLY);
+            nWatchCreditCached = GetOutputsCredit(ISMINE_WATCH_ONLY);
             fWatchCreditCached = true;
             credit += nWatchCreditCached;
         }
@@ -2591,7 +3889,7 @@ CAmount CWalletTx::GetImmatureCredit(bool fUseCache) const
     {
         if (fUseCache && fImmatureCreditCached)
             return nImmatureCreditCached;
-        nImmatureCreditCached = pwallet->GetCredit(*this, ISMINE_SPENDABLE);
+        nImmatureCreditCached = GetOutputsCredit(ISMINE_SPENDABLE);
         fImmatureCreditCached = true;
         return nImmatureCreditCached;
     }
@@ -2617,8 +3915,7 @@ CAmount CWalletTx::GetAvailableCredit(bool fUseCache) const
     {
         if (!pwallet->IsSpent(hashTx, i))
         {
-            const CTxOut &txout = vout[i];
-            nCredit += pwallet->GetCredit(txout, ISMINE_SPENDABLE);
+            nCredit += GetOutputCredit(i, ISMINE_SPENDABLE);
             if (!MoneyRange(nCredit))
                 throw std::runtime_error("CWalletTx::GetAvailableCredit() : value out of range");
         }
@@ -2635,7 +3932,7 @@ CAmount CWalletTx::GetImmatureWatchOnlyCredit(const bool& fUseCache) const
     {
         if (fUseCache && fImmatureWatchCreditCached)
             return nImmatureWatchCreditCached;
-        nImmatureWatchCreditCached = pwallet->GetCredit(*this, ISMINE_WATCH_ONLY);
+        nImmatureWatchCreditCached = GetOutputsCredit(ISMINE_WATCH_ONLY);
         fImmatureWatchCreditCached = true;
         return nImmatureWatchCreditCached;
     }
@@ -2660,8 +3957,7 @@ CAmount CWalletTx::GetAvailableWatchOnlyCredit(const bool& fUseCache) const
     {
         if (!pwallet->IsSpent(GetHash(), i))
         {
-            const CTxOut &txout = vout[i];
-            nCredit += pwallet->GetCredit(txout, ISMINE_WATCH_ONLY);
+            nCredit += GetOutputCredit(i, ISMINE_WATCH_ONLY);
             if (!MoneyRange(nCredit))
                 throw std::runtime_error("CWalletTx::GetAvailableCredit() : value out of range");
         }
@@ -2713,33 +4009,46 @@ bool CWalletTx::IsTrusted() const
         const CWalletTx* parent = pwallet->GetWalletTx(txin.prevout.hash);
         if (parent == NULL)
             return false;
-        const CTxOut& parentOut = parent->vout[txin.prevout.n];
-        if (pwallet->IsMine(parentOut) != ISMINE_SPENDABLE)
+        if (parent->IsMine(txin.prevout.n) != ISMINE_SPENDABLE)
             return false;
     }
     return true;
 }
 
+void CWallet::AddResendCandidate(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    if (!wtx.IsCoinBase())
+        setResendCandidates.insert(std::make_pair(wtx.nTimeReceived, wtx.GetHash()));
+}
+
 std::vector<uint256> CWallet::ResendWalletTransactionsBefore(int64_t nTime)
 {
     std::vector<uint256> result;
 
     LOCK(cs_wallet);
-    // Sort them in chronological order
-    multimap<unsigned int, CWalletTx*> mapSorted;
-    BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
-    {
-        CWalletTx& wtx = item.second;
+    int nNextHeight = chainActive.Height() + 1;
+    // The candidates are in chronological order
+    std::set<std::pair<unsigned int, uint256> >::iterator it = setResendCandidates.begin();
+    while (it != setResendCandidates.end()) {
         // Don't rebroadcast if newer than nTime:
-        if (wtx.nTimeReceived > nTime)
+        if (it->first > nTime)
+            break;
+        std::map<uint256, CWalletTx>::iterator mi = mapWallet.find(it->second);
+        if (mi == mapWallet.end()) {
+            it = setResendCandidates.erase(it);
             continue;
-        mapSorted.insert(make_pair(wtx.nTimeReceived, &wtx));
-    }
-    BOOST_FOREACH(PAIRTYPE(const unsigned int, CWalletTx*)& item, mapSorted)
-    {
-        CWalletTx& wtx = *item.second;
+        }
+        CWalletTx& wtx = mi->second;
+        // Neither a confirmed nor an expired transaction is relayed again,
+        // unless a reorg syncs it back in
+        if (wtx.GetDepthInMainChain() > 0 || IsExpiredTx(wtx, nNextHeight)) {
+            it = setResendCandidates.erase(it);
+            continue;
+        }
         if (wtx.RelayWalletTransaction())
             result.push_back(wtx.GetHash());
+        ++it;
     }
     return result;
 }
@@ -2783,8 +4092,11 @@ CAmount CWallet::GetBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (const uint256& hash : setMaybeUnspentTxs)
         {
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+            if (it == mapWallet.end())
+                continue;
             const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableCredit();
@@ -2799,8 +4111,11 @@ CAmount CWallet::GetUnconfirmedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (const uint256& hash : setMaybeUnspentTxs)
         {
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+            if (it == mapWallet.end())
+                continue;
             const CWalletTx* pcoin = &(*it).second;
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableCredit();
@@ -2814,8 +4129,11 @@ CAmount CWallet::GetImmatureBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (const uint256& hash : setMaybeUnspentTxs)
         {
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+            if (it == mapWallet.end())
+                continue;
             const CWalletTx* pcoin = &(*it).second;
             nTotal += pcoin->GetImmatureCredit();
         }
@@ -2828,8 +4146,11 @@ CAmount CWallet::GetWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (const uint256& hash : setMaybeUnspentTxs)
         {
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+            if (it == mapWallet.end())
+                continue;
             const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
@@ -2844,8 +4165,11 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (const uint256& hash : setMaybeUnspentTxs)
         {
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+            if (it == mapWallet.end())
+                continue;
             const CWalletTx* pcoin = &(*it).second;
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
@@ -2859,8 +4183,11 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (const uint256& hash : setMaybeUnspentTxs)
         {
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+            if (it == mapWallet.end())
+                continue;
             const CWalletTx* pcoin = &(*it).second;
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
@@ -2877,9 +4204,11 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (const uint256& wtxid : setMaybeUnspentTxs)
         {
-            const uint256& wtxid = it->first;
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+            if (it == mapWallet.end())
+                continue;
             const CWalletTx* pcoin = &(*it).second;
 
             if (!CheckFinalTx(*pcoin))
@@ -2904,7 +4233,7 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
                 continue;
 
             for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                isminetype mine = IsMine(pcoin->vout[i]);
+                isminetype mine = pcoin->IsMine(i);
                 if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
                     !IsLockedCoin((*it).first, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
                     (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected((*it).first, i)))
@@ -2914,7 +4243,7 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
     }
 }
 
-static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
+static void ApproximateBestSubset(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
                                   vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
 {
     vector<char> vfIncluded;
@@ -3026,22 +4355,37 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
         return true;
     }
 
-    // Solve subset sum by stochastic approximation
     sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+    vector<CAmount> vAmounts;
+    vAmounts.reserve(vValue.size());
+    for (unsigned int i = 0; i < vValue.size(); i++)
+        vAmounts.push_back(vValue[i].first);
     vector<char> vfBest;
     CAmount nBest;
 
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
-    if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
+    // Change below the dust threshold goes to the fee, so a subset this
+    // close to the target needs no change output at all
+    CAmount nNoChangeRange = CTxOut(0, GetScriptForDestination(CKeyID())).GetDustThreshold(::minRelayTxFee);
+    bool fChangeless = SelectCoinsBnB(vAmounts, nTargetValue, std::max<CAmount>(nNoChangeRange, 1), vfBest, nBest);
+    if (fChangeless) {
+        LogPrint("selectcoins", "SelectCoins() found a subset without change\n");
+    } else {
+        // Solve subset sum by stochastic approximation, with fewer
+        // iterations the more coins each one has to go through
+        int nIterations = std::max<int>(1, std::min<size_t>(1000, MAX_SUBSET_SUM_STEPS / vValue.size()));
+        ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, nIterations);
+        if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
+            ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, nIterations);
+    }
 
     // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
     //                                   or the next bigger coin is closer), return the bigger coin
-    if (coinLowestLarger.second.first &&
+    if (!fChangeless && coinLowestLarger.second.first &&
         ((nBest != nTargetValue && nBest < nTargetValue + CENT) || coinLowestLarger.first <= nBest))
     {
         setCoinsRet.insert(coinLowestLarger.second);
         nValueRet += coinLowestLarger.first;
+        vfBest.assign(vValue.size(), false);
     }
     else {
         for (unsigned int i = 0; i < vValue.size(); i++)
@@ -3058,6 +4402,19 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
         LogPrint("selectcoins", "total %s\n", FormatMoney(nBest));
     }
 
+    // The change output absorbs the smallest coins for little more than
+    // their inputs' share of the fee
+    if (!fChangeless && nConsolidateInputs > 0) {
+        vector<char> vfConsolidate = vfBest;
+        SelectConsolidationInputs(vAmounts, vfConsolidate, nConsolidateInputs);
+        for (unsigned int i = 0; i < vValue.size(); i++)
+            if (vfConsolidate[i] && !vfBest[i])
+            {
+                setCoinsRet.insert(vValue[i].second);
+                nValueRet += vValue[i].first;
+            }
+    }
+
     return true;
 }
 
@@ -3453,13 +4810,14 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                 // Sign
                 int nIn = 0;
                 CTransaction txNewConst(txNew);
+                PrecomputedTransactionData txdata(txNewConst);
                 BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, setCoins)
                 {
                     bool signSuccess;
                     const CScript& scriptPubKey = coin.first->vout[coin.second].scriptPubKey;
                     SignatureData sigdata;
                     if (sign)
-                        signSuccess = ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, coin.first->vout[coin.second].nValue, SIGHASH_ALL), scriptPubKey, sigdata, consensusBranchId);
+                        signSuccess = ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, coin.first->vout[coin.second].nValue, SIGHASH_ALL, &txdata), scriptPubKey, sigdata, consensusBranchId);
                     else
                         signSuccess = ProduceSignature(DummySignatureCreator(this), scriptPubKey, sigdata, consensusBranchId);
 
@@ -3631,6 +4989,21 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
         return nLoadWalletRet;
     fFirstRunRet = !vchDefaultKey.IsValid();
 
+    {
+        // Loading may have renumbered transactions (see ReorderTransactions)
+        LOCK(cs_wallet);
+        wtxOrdered.clear();
+        for (std::map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
+            CWalletTx* wtx = &(it->second);
+            wtxOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
+        }
+        laccentries.clear();
+        CWalletDB(strWalletFile).ListAccountCreditDebit("*", laccentries);
+        BOOST_FOREACH(CAccountingEntry& entry, laccentries) {
+            wtxOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+        }
+    }
+
     uiInterface.LoadWallet(this);
 
     return DB_LOAD_OK;
@@ -3757,7 +5130,10 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         if (IsLocked())
             return false;
 
+        // The new keys and their pool entries are committed together
+        bool fBatch = BeginBatch();
         CWalletDB walletdb(strWalletFile);
+        CWalletDB* pwalletdb = pwalletdbBatch ? pwalletdbBatch : &walletdb;
 
         // Top up key pool
         unsigned int nTargetSize;
@@ -3771,11 +5147,13 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
             int64_t nEnd = 1;
             if (!setKeyPool.empty())
                 nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
+            if (!pwalletdb->WritePool(nEnd, CKeyPool(GenerateNewKey())))
                 throw runtime_error("TopUpKeyPool(): writing generated key failed");
             setKeyPool.insert(nEnd);
             LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
         }
+        if (fBatch)
+            CommitBatch();
     }
     return true;
 }
@@ -4299,6 +5677,31 @@ bool CWallet::GetDestData(const CTxDestination &dest, const std::string &key, st
     return false;
 }
 
+void CWallet::GetMemoryUsage(size_t& nTransactions, size_t& nNoteData, size_t& nWitnesses) const
+{
+    AssertLockHeld(cs_wallet);
+    nTransactions = memusage::DynamicUsage(mapWallet);
+    nNoteData = memusage::DynamicUsage(mapTxSpends) +
+                memusage::DynamicUsage(mapTxSproutNullifiers) + memusage::DynamicUsage(mapTxSaplingNullifiers) +
+                memusage::DynamicUsage(mapSproutNullifiersToNotes) + memusage::DynamicUsage(mapSaplingNullifiersToNotes);
+    nWitnesses = 0;
+    for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
+        const CWalletTx& wtx = it->second;
+        nTransactions += RecursiveDynamicUsage(wtx) + memusage::DynamicUsage(wtx.vMerkleBranch) + memusage::DynamicUsage(wtx.mapValue);
+        nNoteData += memusage::DynamicUsage(wtx.mapSproutNoteData) + memusage::DynamicUsage(wtx.mapSaplingNoteData);
+        for (const std::pair<const JSOutPoint, SproutNoteData>& nd : wtx.mapSproutNoteData) {
+            nWitnesses += memusage::DynamicUsage(nd.second.witnesses);
+            for (const SproutWitness& witness : nd.second.witnesses)
+                nWitnesses += witness.DynamicMemoryUsage();
+        }
+        for (const std::pair<const SaplingOutPoint, SaplingNoteData>& nd : wtx.mapSaplingNoteData) {
+            nWitnesses += memusage::DynamicUsage(nd.second.witnesses);
+            for (const SaplingWitness& witness : nd.second.witnesses)
+                nWitnesses += witness.DynamicMemoryUsage();
+        }
+    }
+}
+
 CKeyPool::CKeyPool()
 {
     nTime = GetTime();
@@ -4326,7 +5729,7 @@ int CMerkleTx::SetMerkleBranch(const CBlock& block)
 
     // Locate the transaction
     for (nIndex = 0; nIndex < (int)block.vtx.size(); nIndex++)
-        if (block.vtx[nIndex] == *(CTransaction*)this)
+        if (*block.vtx[nIndex] == *(CTransaction*)this)
             break;
     if (nIndex == (int)block.vtx.size())
     {
@@ -4438,8 +5841,31 @@ void CWallet::GetFilteredNotes(
 {
     LOCK2(cs_main, cs_wallet);
 
-    for (auto & p : mapWallet) {
-        CWalletTx wtx = p.second;
+    // Transactions with nothing unspent left have no notes to report
+    // unless spent notes are asked for
+    std::vector<const CWalletTx*> vTxs;
+    if (!filterAddresses.empty()) {
+        for (const uint256& hash : GetNoteTxsForAddresses(filterAddresses)) {
+            std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+            if (it != mapWallet.end() && (!ignoreSpent || setMaybeUnspentTxs.count(hash))) {
+                vTxs.push_back(&it->second);
+            }
+        }
+    } else if (ignoreSpent) {
+        for (const uint256& hash : setMaybeUnspentTxs) {
+            std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+            if (it != mapWallet.end()) {
+                vTxs.push_back(&it->second);
+            }
+        }
+    } else {
+        for (const auto& p : mapWallet) {
+            vTxs.push_back(&p.second);
+        }
+    }
+
+    for (const CWalletTx* pwtx : vTxs) {
+        const CWalletTx& wtx = *pwtx;
 
         // Filter the transactions before checking for notes
         if (!CheckFinalTx(wtx) ||
@@ -4634,14 +6060,25 @@ SpendingKeyAddResult AddSpendingKeyToWallet::operator()(const libzcash::SproutSp
     }
     if (m_wallet->HaveSproutSpendingKey(addr)) {
         return KeyAlreadyExists;
-    } else if (m_wallet-> AddSproutZKey(sk)) {
-        m_wallet->mapSproutZKeyMetadata[addr].nCreateTime = nTime;
+    }
+    // The metadata is saved along with the key
+    CKeyMetadata meta(nTime);
+    meta.nBirthHeight = nBirthHeight;
+    m_wallet->mapSproutZKeyMetadata[addr] = meta;
+    m_wallet->UpdateTimeFirstKey(nTime);
+    if (m_wallet-> AddSproutZKey(sk)) {
         return KeyAdded;
     } else {
+        m_wallet->mapSproutZKeyMetadata.erase(addr);
         return KeyNotAdded;
     }
 }
 
+int AddSpendingKeyToWallet::SaplingBirthHeight(const Consensus::Params &params)
+{
+    return std::max(0, params.vUpgrades[Consensus::UPGRADE_SAPLING].nActivationHeight);
+}
+
 SpendingKeyAddResult AddSpendingKeyToWallet::operator()(const libzcash::SaplingExtendedSpendingKey &sk) const {
     auto fvk = sk.expsk.full_viewing_key();
     auto ivk = fvk.in_viewing_key();
@@ -4654,24 +6091,26 @@ SpendingKeyAddResult AddSpendingKeyToWallet::operator()(const libzcash::SaplingE
         if (m_wallet->HaveSaplingSpendingKey(fvk)) {
             return KeyAlreadyExists;
         } else {
-            if (!m_wallet-> AddSaplingZKey(sk, addr)) {
-                return KeyNotAdded;
-            }
-
+            // The metadata is saved along with the key
+            CKeyMetadata meta(nTime);
             // Sapling addresses can't have been used in transactions prior to activation.
-            if (params.vUpgrades[Consensus::UPGRADE_SAPLING].nActivationHeight == Consensus::NetworkUpgrade::ALWAYS_ACTIVE) {
-                m_wallet->mapSaplingZKeyMetadata[ivk].nCreateTime = nTime;
-            } else {
+            if (params.vUpgrades[Consensus::UPGRADE_SAPLING].nActivationHeight != Consensus::NetworkUpgrade::ALWAYS_ACTIVE) {
                 // 154051200 seconds from epoch is Friday, 26 October 2018 00:00:00 GMT - definitely before Sapling activates
-                m_wallet->mapSaplingZKeyMetadata[ivk].nCreateTime = std::max((int64_t) 154051200, nTime);
+                meta.nCreateTime = std::max((int64_t) 154051200, nTime);
             }
+            meta.nBirthHeight = std::max(nBirthHeight, SaplingBirthHeight(params));
             if (hdKeypath) {
-                m_wallet->mapSaplingZKeyMetadata[ivk].hdKeypath = hdKeypath.get();
+                meta.hdKeypath = hdKeypath.get();
             }
             if (seedFpStr) {
-                uint256 seedFp;
-                seedFp.SetHex(seedFpStr.get());
-                m_wallet->mapSaplingZKeyMetadata[ivk].seedFp = seedFp;
+                meta.seedFp.SetHex(seedFpStr.get());
+            }
+            m_wallet->mapSaplingZKeyMetadata[ivk] = meta;
+            m_wallet->UpdateTimeFirstKey(meta.nCreateTime);
+
+            if (!m_wallet-> AddSaplingZKey(sk, addr)) {
+                m_wallet->mapSaplingZKeyMetadata.erase(ivk);
+                return KeyNotAdded;
             }
             return KeyAdded;
         }
@@ -14,6 +14,7 @@
 #include "main.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
+#include "shieldedindex.h"
 #include "tinyformat.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -28,6 +29,7 @@
 #include "base58.h"
 
 #include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -36,6 +38,9 @@
 #include <utility>
 #include <vector>
 
+#include <boost/thread/thread.hpp>
+#include <boost/unordered_map.hpp>
+
 /**
  * Settings
  */
@@ -43,8 +48,10 @@ extern CFeeRate payTxFee;
 extern CAmount maxTxFee;
 extern unsigned int nTxConfirmTarget;
 extern bool bSpendZeroConfChange;
+extern unsigned int nConsolidateInputs;
 extern bool fSendFreeTransactions;
 extern bool fPayAtLeastCustomFee;
+extern bool fWalletCompactTx;
 
 //! -paytxfee default
 static const CAmount DEFAULT_TRANSACTION_FEE = 0;
@@ -56,6 +63,12 @@ static const CAmount nHighTransactionFeeWarning = 0.01 * COIN;
 static const CAmount DEFAULT_TRANSACTION_MAXFEE = 0.1 * COIN;
 //! -txconfirmtarget default
 static const unsigned int DEFAULT_TX_CONFIRM_TARGET = 2;
+//! -consolidateinputs default
+static const unsigned int DEFAULT_CONSOLIDATE_INPUTS = 0;
+//! -walletcompacttx default
+static const bool DEFAULT_WALLET_COMPACT_TX = false;
+//! Coins times iterations the stochastic subset sum in coin selection may go through
+static const size_t MAX_SUBSET_SUM_STEPS = 10000000;
 //! -maxtxfee will warn if called with a higher fee than this amount (in satoshis)
 static const CAmount nHighTransactionMaxFeeWarning = 100 * nHighTransactionFeeWarning;
 //! Largest (in bytes) free transaction we're willing to create
@@ -67,6 +80,10 @@ static const unsigned int WITNESS_CACHE_SIZE = MAX_REORG_LENGTH + 1;
 
 //! Size of HD seed in bytes
 static const size_t HD_WALLET_SEED_LENGTH = 32;
+//! Scripts whose IsMine result CWallet remembers before it starts over
+static const size_t MAX_ISMINE_CACHE_SIZE = 100000;
+//! Sprout notes whose nullifiers are computed, and then stored, together after an unlock
+static const size_t NULLIFIER_BATCH_SIZE = 256;
 
 class CBlockIndex;
 class CCoinControl;
@@ -224,8 +241,10 @@ public:
     boost::optional<uint256> nullifier;
 
     /**
-     * Cached incremental witnesses for spendable Notes.
-     * Beginning of the list is the most recent witness.
+     * Cached incremental witness for spendable Notes. Only the most recent
+     * witness is kept; CWallet::DecrementNoteWitnesses rewinds it to the
+     * tree of an earlier block. Wallets written by older versions may hold
+     * a witness per block, most recent first.
      */
     std::list<SproutWitness> witnesses;
 
@@ -339,6 +358,16 @@ struct CUnspentNotePlaintextEntry {
     int nHeight;
 };
 
+/** Witnesses of notes to be spent, in order, and the anchor they share. */
+template<typename WitnessT>
+struct NoteWitnessSnapshot
+{
+    std::vector<boost::optional<WitnessT>> witnesses;
+    uint256 anchor;
+};
+typedef NoteWitnessSnapshot<SproutWitness> SproutWitnessSnapshot;
+typedef NoteWitnessSnapshot<SaplingWitness> SaplingWitnessSnapshot;
+
 /** A transaction with a merkle branch linking it to the block chain. */
 class CMerkleTx : public CTransaction
 {
@@ -419,6 +448,12 @@ public:
     int64_t nOrderPos; //! position in ordered transaction list
 
     // memory only
+    /**
+     * Stored without the proofs and signatures of its shielded parts, in a
+     * "ctx" record (see CWallet::CompactTransactions). What is held of them
+     * may be zeros; GetFullTransaction reads them back from the block.
+     */
+    bool fCompact;
     mutable bool fDebitCached;
     mutable bool fCreditCached;
     mutable bool fImmatureCreditCached;
@@ -437,6 +472,13 @@ public:
     mutable CAmount nImmatureWatchCreditCached;
     mutable CAmount nAvailableWatchCreditCached;
     mutable CAmount nChangeCached;
+    /**
+     * The isminetype of each output, or ISMINE_UNKNOWN where it hasn't been
+     * asked yet, valid while the wallet's keys, scripts and watch-only
+     * addresses are those of nIsMineGeneration (see CWallet::MarkIsMineDirty).
+     */
+    mutable std::vector<unsigned char> vIsMineCached;
+    mutable unsigned int nIsMineGeneration;
 
     CWalletTx()
     {
@@ -470,6 +512,7 @@ public:
         nTimeSmart = 0;
         fFromMe = false;
         strFromAccount.clear();
+        fCompact = false;
         fDebitCached = false;
         fCreditCached = false;
         fImmatureCreditCached = false;
@@ -479,6 +522,8 @@ public:
         fImmatureWatchCreditCached = false;
         fAvailableWatchCreditCached = false;
         fChangeCached = false;
+        vIsMineCached.clear();
+        nIsMineGeneration = 0;
         nDebitCached = 0;
         nCreditCached = 0;
         nImmatureCreditCached = 0;
@@ -553,14 +598,41 @@ public:
         fChangeCached = false;
     }
 
+    //! Recalculate only what depends on which outputs are spent
+    void MarkSpentDirty()
+    {
+        fAvailableCreditCached = false;
+        fAvailableWatchCreditCached = false;
+    }
+
     void BindWallet(CWallet *pwalletIn)
     {
         pwallet = pwalletIn;
+        vIsMineCached.clear();
         MarkDirty();
     }
 
-    void SetSproutNoteData(mapSproutNoteData_t &noteData);
-    void SetSaplingNoteData(mapSaplingNoteData_t &noteData);
+    void SetSproutNoteData(const mapSproutNoteData_t &noteData);
+    void SetSaplingNoteData(const mapSaplingNoteData_t &noteData);
+
+    //! Set up a transaction read from a "ctx" record stored under hashIn
+    void LoadCompact(const uint256& hashIn)
+    {
+        SetHashWithoutProofs(hashIn);
+        fCompact = true;
+    }
+    /**
+     * The transaction with its proofs and signatures: itself, or for a
+     * compact one, as read from its block. Must be called with cs_main held.
+     */
+    bool GetFullTransaction(CTransaction& txOut) const;
+
+    //! Whether output n is ours, as CWallet::IsMine(vout[n]) but cached
+    isminetype IsMine(unsigned int n) const;
+    //! The value of output n if it is ours by filter, else 0
+    CAmount GetOutputCredit(unsigned int n, const isminefilter& filter) const;
+    //! The value of the outputs that are ours by filter
+    CAmount GetOutputsCredit(const isminefilter& filter) const;
 
     //! filter decides which addresses will count towards the debit
     CAmount GetDebit(const isminefilter& filter) const;
@@ -727,6 +799,91 @@ private:
 };
 
 
+/** Outcome of trial-decrypting one shielded output against a slice of keys. */
+struct CTrialDecryptionResult
+{
+    //! Index into the key list of the first key in the slice that decrypted the output, or -1
+    int nKey;
+    libzcash::SproutNotePlaintext sproutNote;
+    libzcash::SaplingNotePlaintext saplingNote;
+    //! The recipient of saplingNote, derived while checking its commitment
+    libzcash::SaplingPaymentAddress saplingAddress;
+
+    CTrialDecryptionResult() : nKey(-1) {}
+};
+
+/**
+ * Closure representing one trial decryption task: a Sprout ciphertext or a
+ * Sapling output description tried against keys [nBegin, nEnd) of a key list.
+ * Tasks for different outputs and key slices are independent, so
+ * CWallet::FindMySproutNotes and CWallet::FindMySaplingNotes spread them over
+ * the trial decryption queue and merge the results afterwards.
+ */
+class CTrialDecryptionCheck
+{
+private:
+    const std::vector<const NoteDecryptorMap::value_type*>* pSproutKeys;
+    const std::vector<libzcash::SaplingIncomingViewingKey>* pSaplingKeys;
+    const JSDescription* pjsdesc;
+    uint256 hSig;
+    const OutputDescription* poutput;
+    const CCompactSaplingOutput* pcompact;
+    size_t nBegin;
+    size_t nEnd;
+    CTrialDecryptionResult* pResult;
+
+public:
+    CTrialDecryptionCheck() : pSproutKeys(NULL), pSaplingKeys(NULL), pjsdesc(NULL),
+                              poutput(NULL), pcompact(NULL), nBegin(0), nEnd(0), pResult(NULL) {}
+    //! Tries all of the JoinSplit's ciphertexts, with the result for ciphertext n in pResultIn[n]
+    CTrialDecryptionCheck(const JSDescription& jsdescIn, const uint256& hSigIn,
+                          const std::vector<const NoteDecryptorMap::value_type*>& keys,
+                          size_t nBeginIn, size_t nEndIn, CTrialDecryptionResult* pResultIn) :
+        pSproutKeys(&keys), pSaplingKeys(NULL), pjsdesc(&jsdescIn), hSig(hSigIn),
+        poutput(NULL), pcompact(NULL), nBegin(nBeginIn), nEnd(nEndIn), pResult(pResultIn) {}
+    CTrialDecryptionCheck(const OutputDescription& outputIn,
+                          const std::vector<libzcash::SaplingIncomingViewingKey>& keys,
+                          size_t nBeginIn, size_t nEndIn, CTrialDecryptionResult* pResultIn) :
+        pSproutKeys(NULL), pSaplingKeys(&keys), pjsdesc(NULL),
+        poutput(&outputIn), pcompact(NULL), nBegin(nBeginIn), nEnd(nEndIn), pResult(pResultIn) {}
+    //! Only sets pResult->nKey, as a compact output carries no memo
+    CTrialDecryptionCheck(const CCompactSaplingOutput& compactIn,
+                          const std::vector<libzcash::SaplingIncomingViewingKey>& keys,
+                          size_t nBeginIn, size_t nEndIn, CTrialDecryptionResult* pResultIn) :
+        pSproutKeys(NULL), pSaplingKeys(&keys), pjsdesc(NULL),
+        poutput(NULL), pcompact(&compactIn), nBegin(nBeginIn), nEnd(nEndIn), pResult(pResultIn) {}
+
+    bool operator()();
+
+    void swap(CTrialDecryptionCheck& check) {
+        std::swap(pSproutKeys, check.pSproutKeys);
+        std::swap(pSaplingKeys, check.pSaplingKeys);
+        std::swap(pjsdesc, check.pjsdesc);
+        std::swap(hSig, check.hSig);
+        std::swap(poutput, check.poutput);
+        std::swap(pcompact, check.pcompact);
+        std::swap(nBegin, check.nBegin);
+        std::swap(nEnd, check.nEnd);
+        std::swap(pResult, check.pResult);
+    }
+};
+
+/** Run an instance of the trial decryption checking thread */
+void ThreadTrialDecryption();
+
+/** Snapshot of the state of a running CWallet::ScanForWalletTransactions. */
+struct CWalletRescanProgress
+{
+    bool fScanning;
+    int nStartHeight;
+    int nHeight;        //!< height of the last block committed to the wallet
+    int nTipHeight;
+    int64_t nStartTime; //!< GetTimeMillis() when the rescan started
+    double dProgress;   //!< fraction of the rescan done, weighted by transaction count
+
+    CWalletRescanProgress() : fScanning(false), nStartHeight(0), nHeight(0), nTipHeight(0), nStartTime(0), dProgress(0) {}
+};
+
 /** 
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -738,6 +895,9 @@ private:
 
     CWalletDB *pwalletdbEncryption;
 
+    //! Open database transaction that transaction writes go to between BeginBatch and CommitBatch
+    CWalletDB *pwalletdbBatch;
+
     //! the current wallet version: clients below this version are not able to load the wallet
     int nWalletVersion;
 
@@ -748,6 +908,10 @@ private:
     int64_t nLastResend;
     bool fBroadcastTransactions;
 
+    //! Progress of ScanForWalletTransactions, readable without cs_main or cs_wallet
+    mutable CCriticalSection cs_rescanProgress;
+    CWalletRescanProgress rescanProgress;
+
     template <class T>
     using TxSpendMap = std::multimap<T, uint256>;
     /**
@@ -770,7 +934,49 @@ private:
     void AddToSaplingSpends(const uint256& nullifier, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    /**
+     * Transactions that may still hold an unspent output or note of ours.
+     * Once everything of ours in a transaction has been spent by one buried
+     * deeper than MAX_REORG_LENGTH it can't become spendable again, so it is
+     * dropped from here and balance and coin queries no longer visit it.
+     * Importing keys puts every transaction back (see MarkDirty).
+     */
+    std::set<uint256> setMaybeUnspentTxs;
+    /**
+     * Transactions that may still need rebroadcasting, by the time they were
+     * received. Every transaction added or updated goes in, a block
+     * disconnection syncing its transactions in again, and
+     * ResendWalletTransactionsBefore drops those it finds confirmed or
+     * expired, so resends only visit the unconfirmed ones.
+     */
+    std::set<std::pair<unsigned int, uint256> > setResendCandidates;
+    void AddResendCandidate(const CWalletTx& wtx);
+
+    /**
+     * What IsMine said of recent scripts, and the generation of the keys,
+     * scripts and watch-only addresses it said it for; a change to any of
+     * them starts a new generation (see MarkIsMineDirty). cs_ismine only
+     * guards the map and is taken under any other lock.
+     */
+    mutable CCriticalSection cs_ismine;
+    mutable boost::unordered_map<CScript, isminetype, CScriptHasher> mapIsMineCache;
+    std::atomic<unsigned int> nIsMineGeneration;
+
+    bool IsSpentBeyondReorg(const CWalletTx& wtx) const;
+    // Put back the transactions whose outputs and notes tx spends
+    void MarkSpentByMaybeUnspent(const CTransaction& tx);
+    void PruneSpentTxs();
+
 public:
+    /**
+     * With -walletcompacttx, store the shielded transactions buried deeper
+     * than MAX_REORG_LENGTH without their proofs and signatures, which make
+     * up most of their size and which the wallet has no more use for once
+     * they can't be reorganized away. Their outputs, nullifiers,
+     * commitments and note ciphertexts, memos included, are kept.
+     */
+    void CompactTransactions();
+
     /*
      * Size of the incremental witness cache for the notes in our wallet.
      * This will always be greater than or equal to the size of the largest
@@ -781,6 +987,16 @@ public:
     void ClearNoteWitnessCache();
 
 protected:
+    /**
+     * Note commitment trees before each of the last WITNESS_CACHE_SIZE
+     * blocks passed to IncrementNoteWitnesses, by height, which are all
+     * note witnesses need to be rewound past those blocks.
+     */
+    std::map<int, std::pair<SproutMerkleTree, SaplingMerkleTree>> mapWitnessFrontiers;
+
+    void CheckpointWitnessFrontiers(int nHeight,
+                                    const SproutMerkleTree& sproutTree,
+                                    const SaplingMerkleTree& saplingTree);
     /**
      * pindex is the new tip being connected.
      */
@@ -789,9 +1005,29 @@ protected:
                                 SproutMerkleTree& sproutTree,
                                 SaplingMerkleTree& saplingTree);
     /**
-     * pindex is the old tip being disconnected.
+     * As above, from the shielded index record of a block that contains
+     * none of the wallet's transactions.
+     */
+    void IncrementNoteWitnesses(const CBlockIndex* pindex,
+                                const CCompactShieldedBlock& block,
+                                SproutMerkleTree& sproutTree,
+                                SaplingMerkleTree& saplingTree);
+    /**
+     * Sorted hashes of the transparent filter elements (see
+     * CCompactShieldedBlock) that could make a block relevant to this wallet.
+     */
+    std::vector<uint64_t> GetTransparentFilterQuery() const;
+    /**
+     * pindex is the old tip being disconnected, using the trees
+     * checkpointed when it was connected.
      */
     void DecrementNoteWitnesses(const CBlockIndex* pindex);
+    /**
+     * As above, given the trees as of the block before pindex.
+     */
+    void DecrementNoteWitnesses(const CBlockIndex* pindex,
+                                const SproutMerkleTree& sproutTree,
+                                const SaplingMerkleTree& saplingTree);
 
     template <typename WalletDB>
     void SetBestChainINTERNAL(WalletDB& walletdb, const CBlockLocator& loc) {
@@ -843,6 +1079,10 @@ protected:
     /* the hd chain data model (chain counters) */
     CHDChain hdChain;
 
+    //! Computes the nullifiers of notes found while locked, after an unlock
+    boost::thread nullifierThread;
+    std::atomic<size_t> nNullifiersPending;
+
 public:
     /*
      * Main wallet lock.
@@ -850,12 +1090,18 @@ public:
      *   except for:
      *      fFileBacked (immutable after instantiation)
      *      strWalletFile (immutable after instantiation)
+     *      rescanProgress (protected by cs_rescanProgress)
+     *      nNullifiersPending (atomic)
+     *      nRelockTime (protected by the RPC server's cs_nWalletUnlockTime)
      */
     mutable CCriticalSection cs_wallet;
 
     bool fFileBacked;
     std::string strWalletFile;
 
+    //! When walletpassphrase has arranged for the wallet to be locked again, or 0
+    int64_t nRelockTime;
+
     std::set<int64_t> setKeyPool;
     std::map<CKeyID, CKeyMetadata> mapKeyMetadata;
     std::map<libzcash::SproutPaymentAddress, CKeyMetadata> mapSproutZKeyMetadata;
@@ -880,8 +1126,14 @@ public:
 
     ~CWallet()
     {
+        if (nullifierThread.joinable()) {
+            nullifierThread.interrupt();
+            nullifierThread.join();
+        }
         delete pwalletdbEncryption;
         pwalletdbEncryption = NULL;
+        delete pwalletdbBatch;
+        pwalletdbBatch = NULL;
     }
 
     void SetNull()
@@ -891,12 +1143,16 @@ public:
         fFileBacked = false;
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
+        pwalletdbBatch = NULL;
+        nNullifiersPending = 0;
+        nRelockTime = 0;
         nOrderPosNext = 0;
         nNextResend = 0;
         nLastResend = 0;
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
         nWitnessCacheSize = 0;
+        nIsMineGeneration = 1;
     }
 
     /**
@@ -947,9 +1203,23 @@ public:
      * - Restarting the node with -reindex (which operates on a locked wallet
      *   but with the now-cached nullifiers).
      */
-    std::map<uint256, JSOutPoint> mapSproutNullifiersToNotes;
+    boost::unordered_map<uint256, JSOutPoint, CCoinsKeyHasher> mapSproutNullifiersToNotes;
+
+    boost::unordered_map<uint256, SaplingOutPoint, CCoinsKeyHasher> mapSaplingNullifiersToNotes;
 
-    std::map<uint256, SaplingOutPoint> mapSaplingNullifiersToNotes;
+    /**
+     * The wallet transactions with notes for each Sprout address and Sapling
+     * incoming viewing key, so that looking up one address doesn't visit,
+     * and decrypt, the notes of all the others. Entries are only added, so
+     * lookups must check mapWallet.
+     */
+    std::map<libzcash::SproutPaymentAddress, std::set<uint256>> mapSproutAddressTxs;
+    std::map<libzcash::SaplingIncomingViewingKey, std::set<uint256>> mapSaplingIvkTxs;
+    /**
+     * The wallet transactions with any notes, the only ones whose witnesses
+     * connecting or disconnecting a block changes. Pruned by GetNoteTxs.
+     */
+    std::set<uint256> setNoteTxs;
 
     std::map<uint256, CWalletTx> mapWallet;
 
@@ -1005,9 +1275,15 @@ public:
     //! Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
     //! Adds a key to the store, without saving it to disk (used by LoadWallet)
-    bool LoadKey(const CKey& key, const CPubKey &pubkey) { return CCryptoKeyStore::AddKeyPubKey(key, pubkey); }
+    bool LoadKey(const CKey& key, const CPubKey &pubkey);
     //! Load metadata (used by LoadWallet)
     bool LoadKeyMetadata(const CPubKey &pubkey, const CKeyMetadata &metadata);
+    /**
+     * Lower the wallet birthday, nTimeFirstKey, to a key created at
+     * nCreateTime; 0, for a key of unknown age, moves it to the beginning
+     * of time. Rescans skip the blocks from before the birthday.
+     */
+    void UpdateTimeFirstKey(int64_t nCreateTime);
 
     bool LoadMinVersion(int nVersion) { AssertLockHeld(cs_wallet); nWalletVersion = nVersion; nWalletMaxVersion = std::max(nWalletMaxVersion, nVersion); return true; }
 
@@ -1029,6 +1305,8 @@ public:
 
     //! Adds a watch-only address to the store, and saves it to disk.
     bool AddWatchOnly(const CScript &dest);
+    //! As AddWatchOnly, saving the birthday of the address in meta
+    bool AddWatchOnly(const CScript &dest, const CKeyMetadata &meta);
     bool RemoveWatchOnly(const CScript &dest);
     //! Adds a watch-only address to the store, without saving it to disk (used by LoadWallet)
     bool LoadWatchOnly(const CScript &dest);
@@ -1039,6 +1317,13 @@ public:
 
     void GetKeyBirthTimes(std::map<CKeyID, int64_t> &mapKeyBirth) const;
 
+    /**
+     * Approximate heap use of the wallet transactions, split into the
+     * transactions, their note data and nullifier and spend maps, and the
+     * cached witnesses of the notes. Requires cs_wallet.
+     */
+    void GetMemoryUsage(size_t& nTransactions, size_t& nNoteData, size_t& nWitnesses) const;
+
     /**
       * Sprout ZKeys
       */
@@ -1060,6 +1345,8 @@ public:
 
     //! Adds a Sprout viewing key to the store, and saves it to disk.
     bool AddSproutViewingKey(const libzcash::SproutViewingKey &vk);
+    //! As AddSproutViewingKey, saving the birthday of the key in meta
+    bool AddSproutViewingKey(const libzcash::SproutViewingKey &vk, const CKeyMetadata &meta);
     bool RemoveSproutViewingKey(const libzcash::SproutViewingKey &vk);
     //! Adds a Sprout viewing key to the store, without saving it to disk (used by LoadWallet)
     bool LoadSproutViewingKey(const libzcash::SproutViewingKey &dest);
@@ -1069,6 +1356,8 @@ public:
       */
     //! Generates new Sapling key
     libzcash::SaplingPaymentAddress GenerateNewSaplingZKey();
+    //! Generates the next nKeys Sapling spending keys at once, returning their default addresses
+    std::vector<libzcash::SaplingPaymentAddress> GenerateNewSaplingZKeys(size_t nKeys);
     //! Adds Sapling spending key to the store, and saves it to disk
     bool AddSaplingZKey(
         const libzcash::SaplingExtendedSpendingKey &key,
@@ -1103,26 +1392,55 @@ public:
     typedef std::multimap<int64_t, TxPair > TxItems;
 
     /**
-     * Get the wallet's activity log
-     * @return multimap of ordered transactions and accounting entries
-     * @warning Returned pointers are *only* valid within the scope of passed acentries
+     * The wallet's activity log: every transaction and accounting entry by
+     * nOrderPos, kept up to date as they are added so that the newest ones
+     * can be read without sorting the whole wallet.
      */
-    TxItems OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount = "");
+    TxItems wtxOrdered;
+    std::list<CAccountingEntry> laccentries;
+
+    bool AddAccountingEntry(const CAccountingEntry&, CWalletDB& walletdb);
+
+    void AddToNoteIndex(const CWalletTx& wtx);
+    //! The transactions of setNoteTxs still in mapWallet
+    std::vector<CWalletTx*> GetNoteTxs();
+    // The wallet transactions that may hold notes for any of addresses
+    std::set<uint256> GetNoteTxsForAddresses(const std::set<libzcash::PaymentAddress>& addresses);
 
     void MarkDirty();
     bool UpdateNullifierNoteMap();
+    //! Run UpdateNullifierNoteMap on a thread of its own, as walletpassphrase does
+    void UpdateNullifierNoteMapInBackground();
+    //! Notes whose nullifiers UpdateNullifierNoteMap has yet to compute
+    size_t GetPendingNullifiers() const { return nNullifiersPending; }
     void UpdateNullifierNoteMapWithTx(const CWalletTx& wtx);
     void UpdateSaplingNullifierNoteMapWithTx(CWalletTx& wtx);
     void UpdateSaplingNullifierNoteMapForBlock(const CBlock* pblock);
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+    void SyncBlock(const CBlock* pblock);
+    /**
+     * Group the transaction writes that follow into one database transaction,
+     * committed by CommitBatch, instead of one per record. Returns false if
+     * a batch is already open or the wallet is not file backed, in which case
+     * the caller must not commit.
+     */
+    bool BeginBatch();
+    void CommitBatch();
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
+    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate,
+                                  const mapSproutNoteData_t& sproutNoteData,
+                                  const std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>& saplingNoteDataAndAddressesToAdd);
+    /** Tell the ShieldedReceived listeners about the notes of tx found for the wallet */
+    void NotifyShieldedReceipts(const CTransaction& tx, const CBlock* pblock,
+                                const mapSproutNoteData_t& sproutNoteData, const mapSaplingNoteData_t& saplingNoteData);
     void EraseFromWallet(const uint256 &hash);
     void WitnessNoteCommitment(
          std::vector<uint256> commitments,
          std::vector<boost::optional<SproutWitness>>& witnesses,
          uint256 &final_anchor);
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    CWalletRescanProgress GetRescanProgress() const;
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime);
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime);
@@ -1161,7 +1479,10 @@ public:
         const uint256& hSig,
         uint8_t n) const;
     mapSproutNoteData_t FindMySproutNotes(const CTransaction& tx) const;
+    std::vector<mapSproutNoteData_t> FindMySproutNotes(const std::vector<const CTransaction*>& vtx) const;
     std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(const CTransaction& tx) const;
+    std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> FindMySaplingNotes(const std::vector<const CTransaction*>& vtx) const;
+    std::vector<bool> MatchCompactSaplingOutputs(const std::vector<const CCompactSaplingOutput*>& voutputs) const;
     bool IsSproutNullifierFromMe(const uint256& nullifier) const;
     bool IsSaplingNullifierFromMe(const uint256& nullifier) const;
 
@@ -1173,7 +1494,21 @@ public:
          std::vector<SaplingOutPoint> notes,
          std::vector<boost::optional<SaplingWitness>>& witnesses,
          uint256 &final_anchor);
+    /**
+     * Copy the witnesses of the given notes and the anchor they share. Only
+     * cs_wallet is taken, and only for the copy, so callers should not hold
+     * cs_main: proving against the snapshot then blocks nothing, and the
+     * anchor is checked against the chain again when the transaction is sent.
+     */
+    SproutWitnessSnapshot SnapshotSproutNoteWitnesses(const std::vector<JSOutPoint>& notes);
+    SaplingWitnessSnapshot SnapshotSaplingNoteWitnesses(const std::vector<SaplingOutPoint>& notes);
 
+    /**
+     * Forget what IsMine said of every script and wallet transaction output,
+     * for a key, script or watch-only address has been added or removed.
+     */
+    void MarkIsMineDirty();
+    unsigned int GetIsMineGeneration() const { return nIsMineGeneration; }
     isminetype IsMine(const CTxIn& txin) const;
     CAmount GetDebit(const CTxIn& txin, const isminefilter& filter) const;
     isminetype IsMine(const CTxOut& txout) const;
@@ -1425,17 +1760,22 @@ private:
     boost::optional<std::string> hdKeypath; // currently sapling only
     boost::optional<std::string> seedFpStr; // currently sapling only
     bool log;
+    int nBirthHeight; // -1 if unknown
 public:
     AddSpendingKeyToWallet(CWallet *wallet, const Consensus::Params &params) :
-        m_wallet(wallet), params(params), nTime(1), hdKeypath(boost::none), seedFpStr(boost::none), log(false) {}
+        m_wallet(wallet), params(params), nTime(1), hdKeypath(boost::none), seedFpStr(boost::none), log(false), nBirthHeight(-1) {}
     AddSpendingKeyToWallet(
         CWallet *wallet,
         const Consensus::Params &params,
         int64_t _nTime,
         boost::optional<std::string> _hdKeypath,
         boost::optional<std::string> _seedFp,
-        bool _log
-    ) : m_wallet(wallet), params(params), nTime(_nTime), hdKeypath(_hdKeypath), seedFpStr(_seedFp), log(_log) {}
+        bool _log,
+        int _nBirthHeight = -1
+    ) : m_wallet(wallet), params(params), nTime(_nTime), hdKeypath(_hdKeypath), seedFpStr(_seedFp), log(_log), nBirthHeight(_nBirthHeight) {}
+
+    //! The height before which a Sapling key can't have been used
+    static int SaplingBirthHeight(const Consensus::Params &params);
 
 
     SpendingKeyAddResult operator()(const libzcash::SproutSpendingKey &sk) const;
@@ -5,11 +5,15 @@
 
 #include "wallet_ismine.h"
 
+#include "hash.h"
 #include "key.h"
 #include "keystore.h"
+#include "random.h"
 #include "script/script.h"
 #include "script/standard.h"
 
+#include <limits>
+
 #include <boost/foreach.hpp>
 
 using namespace std;
@@ -90,3 +94,13 @@ isminetype IsMine(const CKeyStore &keystore, const CScript& scriptPubKey)
         return ISMINE_WATCH_ONLY;
     return ISMINE_NO;
 }
+
+CScriptHasher::CScriptHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+size_t CScriptHasher::operator()(const CScript& script) const
+{
+    CSipHasher hasher(k0, k1);
+    if (!script.empty())
+        hasher.Write(&script[0], script.size());
+    return hasher.Finalize();
+}
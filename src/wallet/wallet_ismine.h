@@ -7,10 +7,13 @@
 #define BITCOIN_WALLET_WALLET_ISMINE_H
 
 #include "key.h"
+#include "script/script.h"
 #include "script/standard.h"
 
+#include <stddef.h>
+#include <stdint.h>
+
 class CKeyStore;
-class CScript;
 
 /** IsMine() return codes */
 enum isminetype
@@ -22,8 +25,22 @@ enum isminetype
 };
 /** used for bitflags of isminetype */
 typedef uint8_t isminefilter;
+/** Stands for an isminetype not worked out yet in caches of them */
+static const uint8_t ISMINE_UNKNOWN = 0xff;
 
 isminetype IsMine(const CKeyStore& keystore, const CScript& scriptPubKey);
 isminetype IsMine(const CKeyStore& keystore, const CTxDestination& dest);
 
+/** Salted hash of a script, for hash maps keyed by scriptPubKey */
+class CScriptHasher
+{
+private:
+    uint64_t k0, k1;
+
+public:
+    CScriptHasher();
+
+    size_t operator()(const CScript& script) const;
+};
+
 #endif // BITCOIN_WALLET_WALLET_ISMINE_H
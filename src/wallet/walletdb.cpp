@@ -11,6 +11,7 @@
 #include "main.h"
 #include "protocol.h"
 #include "serialize.h"
+#include "streams.h"
 #include "sync.h"
 #include "util.h"
 #include "utiltime.h"
@@ -22,6 +23,8 @@
 #include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
 
+#include <atomic>
+
 using namespace std;
 
 static uint64_t nAccountingEntryNumber = 0;
@@ -56,15 +59,45 @@ bool CWalletDB::ErasePurpose(const string& strPurpose)
     return Erase(make_pair(string("purpose"), strPurpose));
 }
 
+/** A wallet transaction serialized without the proofs and signatures of its shielded parts */
+class CWalletTxWithoutProofs
+{
+    CWalletTx& wtx;
+public:
+    explicit CWalletTxWithoutProofs(CWalletTx& wtxIn) : wtx(wtxIn) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        OverrideStream<Stream> os(&s, s.GetType() | SER_WITHOUT_PROOFS, s.GetVersion());
+        os << wtx;
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        OverrideStream<Stream> os(&s, s.GetType() | SER_WITHOUT_PROOFS, s.GetVersion());
+        os >> wtx;
+    }
+};
+
 bool CWalletDB::WriteTx(uint256 hash, const CWalletTx& wtx)
 {
     nWalletDBUpdated++;
+    if (wtx.fCompact) {
+        // A compact transaction has a "ctx" record in place of its "tx" one
+        if (!Write(std::make_pair(std::string("ctx"), hash), CWalletTxWithoutProofs(const_cast<CWalletTx&>(wtx))))
+            return false;
+        Erase(std::make_pair(std::string("tx"), hash));
+        return true;
+    }
     return Write(std::make_pair(std::string("tx"), hash), wtx);
 }
 
 bool CWalletDB::EraseTx(uint256 hash)
 {
     nWalletDBUpdated++;
+    Erase(std::make_pair(std::string("ctx"), hash));
     return Erase(std::make_pair(std::string("tx"), hash));
 }
 
@@ -185,15 +218,18 @@ bool CWalletDB::WriteSaplingPaymentAddress(
     return Write(std::make_pair(std::string("sapzaddr"), addr), ivk, false);
 }
 
-bool CWalletDB::WriteSproutViewingKey(const libzcash::SproutViewingKey &vk)
+bool CWalletDB::WriteSproutViewingKey(const libzcash::SproutViewingKey &vk, const CKeyMetadata &meta)
 {
     nWalletDBUpdated++;
+    if (!Write(std::make_pair(std::string("vkeymeta"), vk), meta))
+        return false;
     return Write(std::make_pair(std::string("vkey"), vk), '1');
 }
 
 bool CWalletDB::EraseSproutViewingKey(const libzcash::SproutViewingKey &vk)
 {
     nWalletDBUpdated++;
+    Erase(std::make_pair(std::string("vkeymeta"), vk));
     return Erase(std::make_pair(std::string("vkey"), vk));
 }
 
@@ -203,15 +239,18 @@ bool CWalletDB::WriteCScript(const uint160& hash, const CScript& redeemScript)
     return Write(std::make_pair(std::string("cscript"), hash), *(const CScriptBase*)(&redeemScript), false);
 }
 
-bool CWalletDB::WriteWatchOnly(const CScript &dest)
+bool CWalletDB::WriteWatchOnly(const CScript &dest, const CKeyMetadata &meta)
 {
     nWalletDBUpdated++;
+    if (!Write(std::make_pair(std::string("watchmeta"), *(const CScriptBase*)(&dest)), meta))
+        return false;
     return Write(std::make_pair(std::string("watchs"), *(const CScriptBase*)(&dest)), '1');
 }
 
 bool CWalletDB::EraseWatchOnly(const CScript &dest)
 {
     nWalletDBUpdated++;
+    Erase(std::make_pair(std::string("watchmeta"), *(const CScriptBase*)(&dest)));
     return Erase(std::make_pair(std::string("watchs"), *(const CScriptBase*)(&dest)));
 }
 
@@ -303,7 +342,7 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
 {
     bool fAllAccounts = (strAccount == "*");
 
-    Dbc* pcursor = GetCursor();
+    CDBCursor* pcursor = GetCursor();
     if (!pcursor)
         throw runtime_error("CWalletDB::ListAccountCreditDebit(): cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -427,22 +466,135 @@ public:
     unsigned int nCZKeys;
     unsigned int nZKeyMeta;
     unsigned int nSapZAddrs;
+    unsigned int nWatchKeys;
+    unsigned int nWatchMeta;
     bool fIsEncrypted;
     bool fAnyUnordered;
     int nFileVersion;
     vector<uint256> vWalletUpgrade;
 
     CWalletScanState() {
-        nKeys = nCKeys = nKeyMeta = nZKeys = nCZKeys = nZKeyMeta = nSapZAddrs = 0;
+        nKeys = nCKeys = nKeyMeta = nZKeys = nCZKeys = nZKeyMeta = nSapZAddrs = nWatchKeys = nWatchMeta = 0;
         fIsEncrypted = false;
         fAnyUnordered = false;
         nFileVersion = 0;
     }
 };
 
+/** A "tx" or "ctx" record read from the cursor, and what decoding it gave */
+struct CWalletTxRecord {
+    CDataStream ssKey;
+    CDataStream ssValue;
+    bool fCompact;
+    uint256 hash;
+    CWalletTx wtx;
+    bool fUpgraded;
+    bool fValid;
+    string strErr;
+
+    CWalletTxRecord(const CDataStream& ssKeyIn, const CDataStream& ssValueIn, bool fCompactIn) :
+        ssKey(ssKeyIn), ssValue(ssValueIn), fCompact(fCompactIn), fUpgraded(false), fValid(false) {}
+};
+
+//! Below this many transaction records LoadWallet decodes them on its own thread
+static const size_t MIN_PARALLEL_WALLET_TX_RECORDS = 64;
+
+/**
+ * Decode and check the rest of a "tx" or, with fCompact, "ctx" record. This
+ * needs no wallet state, so LoadWallet can run it for many records at once.
+ */
+static bool ReadWalletTx(CDataStream& ssKey, CDataStream& ssValue, bool fCompact, uint256& hash, CWalletTx& wtx,
+                         bool& fUpgraded, string& strErr)
+{
+    ssKey >> hash;
+    CValidationState state;
+    if (fCompact) {
+        // Neither the proofs nor the hash can be checked without what was
+        // left out; the transaction was checked before it was compacted.
+        CWalletTxWithoutProofs wrapper(wtx);
+        ssValue >> wrapper;
+        wtx.LoadCompact(hash);
+        if (!(CheckTransactionWithoutProofVerification(wtx, state) && state.IsValid()))
+            return false;
+    } else {
+        ssValue >> wtx;
+        auto verifier = libzcash::ProofVerifier::Strict();
+        if (!(CheckTransaction(wtx, state, verifier) && (wtx.GetHash() == hash) && state.IsValid()))
+            return false;
+    }
+
+    // Undo serialize changes in 31600
+    fUpgraded = false;
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+    {
+        if (!ssValue.empty())
+        {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                               wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        }
+        else
+        {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        fUpgraded = true;
+    }
+    return true;
+}
+
+static void LoadWalletTx(CWallet* pwallet, const uint256& hash, const CWalletTx& wtx, bool fUpgraded,
+                         CWalletScanState& wss)
+{
+    if (fUpgraded)
+        wss.vWalletUpgrade.push_back(hash);
+
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+
+    pwallet->AddToWallet(wtx, true, NULL);
+}
+
+/**
+ * Decode the deferred "tx" records. Deserializing them and verifying their
+ * proofs is most of the time spent loading a wallet with a long history, so
+ * the records are shared out over the -par threads.
+ */
+static void ReadWalletTxs(vector<CWalletTxRecord>& vRecords)
+{
+    std::atomic<size_t> nNext(0);
+    auto decode = [&]() {
+        for (size_t i = nNext++; i < vRecords.size(); i = nNext++) {
+            CWalletTxRecord& record = vRecords[i];
+            try {
+                record.fValid = ReadWalletTx(record.ssKey, record.ssValue, record.fCompact, record.hash,
+                                             record.wtx, record.fUpgraded, record.strErr);
+            } catch (const std::exception&) {
+                record.fValid = false;
+            }
+        }
+    };
+
+    int nThreads = vRecords.size() < MIN_PARALLEL_WALLET_TX_RECORDS ? 1 : std::max(nScriptCheckThreads, 1);
+    boost::thread_group workers;
+    for (int i = 1; i < nThreads; i++)
+        workers.create_thread(decode);
+    decode();
+    workers.join_all();
+}
+
+/**
+ * Read one record into the wallet. With pvTxRecords, "tx" and "ctx" records
+ * are only queued there, for LoadWallet to decode together once the cursor
+ * is done.
+ */
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
-             CWalletScanState &wss, string& strType, string& strErr)
+             CWalletScanState &wss, string& strType, string& strErr,
+             vector<CWalletTxRecord>* pvTxRecords = NULL)
 {
     try {
         // Unserialize
@@ -461,41 +613,19 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             ssKey >> strAddress;
             ssValue >> pwallet->mapAddressBook[DecodeDestination(strAddress)].purpose;
         }
-        else if (strType == "tx")
+        else if (strType == "tx" || strType == "ctx")
         {
+            bool fCompact = strType == "ctx";
+            if (pvTxRecords) {
+                pvTxRecords->push_back(CWalletTxRecord(ssKey, ssValue, fCompact));
+                return true;
+            }
             uint256 hash;
-            ssKey >> hash;
             CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            auto verifier = libzcash::ProofVerifier::Strict();
-            if (!(CheckTransaction(wtx, state, verifier) && (wtx.GetHash() == hash) && state.IsValid()))
+            bool fUpgraded;
+            if (!ReadWalletTx(ssKey, ssValue, fCompact, hash, wtx, fUpgraded, strErr))
                 return false;
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-            {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
-
-            pwallet->AddToWallet(wtx, true, NULL);
+            LoadWalletTx(pwallet, hash, wtx, fUpgraded, wss);
         }
         else if (strType == "acentry")
         {
@@ -522,10 +652,17 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             ssValue >> fYes;
             if (fYes == '1')
                 pwallet->LoadWatchOnly(script);
+            wss.nWatchKeys++;
+        }
+        else if (strType == "watchmeta")
+        {
+            CScript script;
+            ssKey >> *(CScriptBase*)(&script);
+            CKeyMetadata keyMeta;
+            ssValue >> keyMeta;
+            wss.nWatchMeta++;
 
-            // Watch-only addresses have no birthday information for now,
-            // so set the wallet birthday to the beginning of time.
-            pwallet->nTimeFirstKey = 1;
+            pwallet->UpdateTimeFirstKey(keyMeta.nCreateTime);
         }
         else if (strType == "vkey")
         {
@@ -535,10 +672,17 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             ssValue >> fYes;
             if (fYes == '1')
                 pwallet->LoadSproutViewingKey(vk);
+            wss.nWatchKeys++;
+        }
+        else if (strType == "vkeymeta")
+        {
+            libzcash::SproutViewingKey vk;
+            ssKey >> vk;
+            CKeyMetadata keyMeta;
+            ssValue >> keyMeta;
+            wss.nWatchMeta++;
 
-            // Viewing keys have no birthday information for now,
-            // so set the wallet birthday to the beginning of time.
-            pwallet->nTimeFirstKey = 1;
+            pwallet->UpdateTimeFirstKey(keyMeta.nCreateTime);
         }
         else if (strType == "zkey")
         {
@@ -676,7 +820,7 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             libzcash::ReceivingKey rk(rkValue);
             vector<unsigned char> vchCryptedSecret;
             ssValue >> vchCryptedSecret;
-            wss.nCKeys++;
+            wss.nCZKeys++;
 
             if (!pwallet->LoadCryptedZKey(addr, rk, vchCryptedSecret))
             {
@@ -693,7 +837,7 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             ssValue >> extfvk;
             vector<unsigned char> vchCryptedSecret;
             ssValue >> vchCryptedSecret;
-            wss.nCKeys++;
+            wss.nCZKeys++;
 
             if (!pwallet->LoadCryptedSaplingZKey(extfvk, vchCryptedSecret))
             {
@@ -711,11 +855,6 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             wss.nKeyMeta++;
 
             pwallet->LoadKeyMetadata(vchPubKey, keyMeta);
-
-            // find earliest key creation time, as wallet birthday
-            if (!pwallet->nTimeFirstKey ||
-                (keyMeta.nCreateTime < pwallet->nTimeFirstKey))
-                pwallet->nTimeFirstKey = keyMeta.nCreateTime;
         }
         else if (strType == "zkeymeta")
         {
@@ -726,8 +865,6 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             wss.nZKeyMeta++;
 
             pwallet->LoadZKeyMetadata(addr, keyMeta);
-
-            // ignore earliest key creation time as taddr will exist before any zaddr
         }
         else if (strType == "sapzkeymeta")
         {
@@ -872,6 +1009,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 {
     pwallet->vchDefaultKey = CPubKey();
     CWalletScanState wss;
+    vector<CWalletTxRecord> vTxRecords;
     bool fNoncriticalErrors = false;
     DBErrors result = DB_LOAD_OK;
 
@@ -886,7 +1024,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         }
 
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        CDBCursor* pcursor = GetCursor();
         if (!pcursor)
         {
             LogPrintf("Error getting wallet database cursor\n");
@@ -909,7 +1047,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 
             // Try to be tolerant of single corrupt records:
             string strType, strErr;
-            if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
+            if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr, &vTxRecords))
             {
                 // losing keys is considered a catastrophic error, anything else
                 // we assume the user can live with:
@@ -919,7 +1057,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 {
                     // Leave other errors alone, if we try to fix them we might make things worse.
                     fNoncriticalErrors = true; // ... but do warn the user there is something wrong.
-                    if (strType == "tx")
+                    if (strType == "tx" || strType == "ctx")
                         // Rescan if there is a bad transaction record:
                         SoftSetBoolArg("-rescan", true);
                 }
@@ -928,6 +1066,20 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 LogPrintf("%s\n", strErr);
         }
         pcursor->close();
+
+        // Transactions go in after everything else, in the order they were read
+        ReadWalletTxs(vTxRecords);
+        for (const CWalletTxRecord& record : vTxRecords) {
+            if (record.fValid) {
+                LoadWalletTx(pwallet, record.hash, record.wtx, record.fUpgraded, wss);
+            } else {
+                // Rescan if there is a bad transaction record:
+                fNoncriticalErrors = true;
+                SoftSetBoolArg("-rescan", true);
+            }
+            if (!record.strErr.empty())
+                LogPrintf("%s\n", record.strErr);
+        }
     }
     catch (const boost::thread_interrupted&) {
         throw;
@@ -953,7 +1105,9 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
            wss.nZKeys, wss.nCZKeys, wss.nZKeyMeta, wss.nZKeys + wss.nCZKeys);
 
     // nTimeFirstKey is only reliable if all keys have metadata
-    if ((wss.nKeys + wss.nCKeys) != wss.nKeyMeta)
+    if ((wss.nKeys + wss.nCKeys) != wss.nKeyMeta ||
+        (wss.nZKeys + wss.nCZKeys) != wss.nZKeyMeta ||
+        wss.nWatchKeys != wss.nWatchMeta)
         pwallet->nTimeFirstKey = 1; // 0 would be considered 'no value'
 
     BOOST_FOREACH(uint256 hash, wss.vWalletUpgrade)
@@ -989,7 +1143,7 @@ DBErrors CWalletDB::FindWalletTx(CWallet* pwallet, vector<uint256>& vTxHash, vec
         }
 
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        CDBCursor* pcursor = GetCursor();
         if (!pcursor)
         {
             LogPrintf("Error getting wallet database cursor\n");
@@ -1012,14 +1166,20 @@ DBErrors CWalletDB::FindWalletTx(CWallet* pwallet, vector<uint256>& vTxHash, vec
 
             string strType;
             ssKey >> strType;
-            if (strType == "tx") {
+            if (strType == "tx" || strType == "ctx") {
                 uint256 hash;
                 ssKey >> hash;
 
                 std::vector<unsigned char> txData(ssValue.begin(), ssValue.end());
                 try {
                     CWalletTx wtx;
-                    ssValue >> wtx;
+                    if (strType == "ctx") {
+                        CWalletTxWithoutProofs wrapper(wtx);
+                        ssValue >> wrapper;
+                        wtx.LoadCompact(hash);
+                    } else {
+                        ssValue >> wtx;
+                    }
                     vWtx.push_back(wtx);
                 } catch (...) {
                     // Decode failure likely due to Sapling v4 transaction format change
@@ -1064,7 +1224,7 @@ DBErrors CWalletDB::ZapWalletTx(CWallet* pwallet, vector<CWalletTx>& vWtx)
     return DB_LOAD_OK;
 }
 
-void ThreadFlushWalletDB(const string& strFile)
+void ThreadFlushWalletDB(const std::vector<std::string>& vstrFiles)
 {
     // Make this thread recognisable as the wallet flushing thread
     RenameThread("litecoinz-wallet");
@@ -1089,6 +1249,18 @@ void ThreadFlushWalletDB(const string& strFile)
             nLastWalletUpdate = GetTime();
         }
 
+        // Logs don't have to be closed to be self contained: sync what was
+        // appended to them, and compact those mostly made of dead records
+        for (const std::string& strFile : vstrFiles)
+        {
+            CLogDB* plog = bitdb.GetLogDb(strFile);
+            if (!plog)
+                continue;
+            plog->Sync();
+            if (plog->NeedsCompaction())
+                plog->Compact();
+        }
+
         if (nLastFlushed != nWalletDBUpdated && GetTime() - nLastWalletUpdate >= 2)
         {
             TRY_LOCK(bitdb.cs_db,lockDb);
@@ -1099,26 +1271,29 @@ void ThreadFlushWalletDB(const string& strFile)
                 map<string, int>::iterator mi = bitdb.mapFileUseCount.begin();
                 while (mi != bitdb.mapFileUseCount.end())
                 {
-                    nRefCount += (*mi).second;
+                    if (!bitdb.mapLogDb.count((*mi).first))
+                        nRefCount += (*mi).second;
                     mi++;
                 }
 
                 if (nRefCount == 0)
                 {
                     boost::this_thread::interruption_point();
-                    map<string, int>::iterator mi = bitdb.mapFileUseCount.find(strFile);
-                    if (mi != bitdb.mapFileUseCount.end())
+                    nLastFlushed = nWalletDBUpdated;
+                    for (const std::string& strFile : vstrFiles)
                     {
-                        LogPrint("db", "Flushing wallet.dat\n");
-                        nLastFlushed = nWalletDBUpdated;
+                        map<string, int>::iterator mi = bitdb.mapFileUseCount.find(strFile);
+                        if (mi == bitdb.mapFileUseCount.end() || bitdb.mapLogDb.count(strFile))
+                            continue;
+                        LogPrint("db", "Flushing %s\n", strFile);
                         int64_t nStart = GetTimeMillis();
 
-                        // Flush wallet.dat so it's self contained
+                        // Flush the wallet file so it's self contained
                         bitdb.CloseDb(strFile);
                         bitdb.CheckpointLSN(strFile);
 
-                        bitdb.mapFileUseCount.erase(mi++);
-                        LogPrint("db", "Flushed wallet.dat %dms\n", GetTimeMillis() - nStart);
+                        bitdb.mapFileUseCount.erase(mi);
+                        LogPrint("db", "Flushed %s %dms\n", strFile, GetTimeMillis() - nStart);
                     }
                 }
             }
@@ -1130,6 +1305,18 @@ bool BackupWallet(const CWallet& wallet, const string& strDest)
 {
     if (!wallet.fFileBacked)
         return false;
+    CLogDB* plog = bitdb.GetLogDb(wallet.strWalletFile);
+    if (plog)
+    {
+        // A log is consistent after every batch, so copy it as it is
+        boost::filesystem::path pathDest(strDest);
+        if (boost::filesystem::is_directory(pathDest))
+            pathDest /= wallet.strWalletFile;
+        if (!plog->Backup(pathDest))
+            return false;
+        LogPrintf("copied %s to %s\n", wallet.strWalletFile, pathDest.string());
+        return true;
+    }
     while (true)
     {
         {
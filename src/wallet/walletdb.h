@@ -79,11 +79,13 @@ class CKeyMetadata
 public:
     static const int VERSION_BASIC=1;
     static const int VERSION_WITH_HDDATA=10;
-    static const int CURRENT_VERSION=VERSION_WITH_HDDATA;
+    static const int VERSION_WITH_BIRTH_HEIGHT=11;
+    static const int CURRENT_VERSION=VERSION_WITH_BIRTH_HEIGHT;
     int nVersion;
     int64_t nCreateTime; // 0 means unknown
     std::string hdKeypath; //optional HD/zip32 keypath
     uint256 seedFp;
+    int nBirthHeight; // height of the first block the key can appear in, -1 means unknown
 
     CKeyMetadata()
     {
@@ -106,6 +108,8 @@ public:
             READWRITE(hdKeypath);
             READWRITE(seedFp);
         }
+        if (this->nVersion >= VERSION_WITH_BIRTH_HEIGHT)
+            READWRITE(nBirthHeight);
     }
 
     void SetNull()
@@ -114,6 +118,7 @@ public:
         nCreateTime = 0;
         hdKeypath.clear();
         seedFp.SetNull();
+        nBirthHeight = -1;
     }
 };
 
@@ -140,7 +145,7 @@ public:
 
     bool WriteCScript(const uint160& hash, const CScript& redeemScript);
 
-    bool WriteWatchOnly(const CScript &script);
+    bool WriteWatchOnly(const CScript &script, const CKeyMetadata &meta);
     bool EraseWatchOnly(const CScript &script);
 
     bool WriteBestBlock(const CBlockLocator& locator);
@@ -197,7 +202,7 @@ public:
                           const std::vector<unsigned char>& vchCryptedSecret,
                           const CKeyMetadata &keyMeta);
 
-    bool WriteSproutViewingKey(const libzcash::SproutViewingKey &vk);
+    bool WriteSproutViewingKey(const libzcash::SproutViewingKey &vk, const CKeyMetadata &meta);
     bool EraseSproutViewingKey(const libzcash::SproutViewingKey &vk);
 
 private:
@@ -208,6 +213,6 @@ private:
 };
 
 bool BackupWallet(const CWallet& wallet, const std::string& strDest);
-void ThreadFlushWalletDB(const std::string& strFile);
+void ThreadFlushWalletDB(const std::vector<std::string>& vstrFiles);
 
 #endif // BITCOIN_WALLET_WALLETDB_H
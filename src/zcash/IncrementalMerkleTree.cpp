@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <assert.h>
 #include <stdexcept>
 
 #include <boost/foreach.hpp>
@@ -133,6 +135,7 @@ void IncrementalMerkleTree<Depth, Hash>::append(Hash obj) {
     if (is_complete(Depth)) {
         throw std::runtime_error("tree is full");
     }
+    cached_root = boost::none;
 
     if (!left) {
         // Set the left leaf
@@ -165,6 +168,67 @@ void IncrementalMerkleTree<Depth, Hash>::append(Hash obj) {
     }
 }
 
+// Rather than carrying each element up the tree on its own, this works a
+// level at a time: the nodes completed at one level are hashed in pairs to
+// give the next level's, so every internal node is hashed exactly once and
+// the per-append bookkeeping is done once per level instead.
+template<size_t Depth, typename Hash>
+void IncrementalMerkleTree<Depth, Hash>::append_many(const std::vector<Hash>& objs) {
+    if (objs.empty()) {
+        return;
+    }
+    if (objs.size() > ((uint64_t)1 << Depth) - size()) {
+        throw std::runtime_error("tree is full");
+    }
+    cached_root = boost::none;
+
+    // Leaves not yet combined come first. After the last append, the
+    // final two leaves are left in left and right rather than combined.
+    std::vector<Hash> level;
+    level.reserve(objs.size() + 2);
+    if (left) {
+        level.push_back(*left);
+    }
+    if (right) {
+        level.push_back(*right);
+    }
+    level.insert(level.end(), objs.begin(), objs.end());
+
+    size_t nPaired = level.size() % 2 ? level.size() - 1 : level.size() - 2;
+    left = level[nPaired];
+    right = nPaired + 1 < level.size() ? boost::optional<Hash>(level[nPaired + 1]) : boost::none;
+
+    std::vector<Hash> next;
+    for (size_t i = 0; i < nPaired; i += 2) {
+        next.push_back(Hash::combine(level[i], level[i + 1], 0));
+    }
+    level.swap(next);
+
+    // Above the leaves, a parent is a left node waiting for its sibling
+    for (size_t d = 1; !level.empty(); d++) {
+        assert(d < Depth);
+        next.clear();
+        size_t i = 0;
+        if (d - 1 < parents.size() && parents[d - 1]) {
+            next.push_back(Hash::combine(*parents[d - 1], level[0], d));
+            i = 1;
+        }
+        for (; i + 1 < level.size(); i += 2) {
+            next.push_back(Hash::combine(level[i], level[i + 1], d));
+        }
+        boost::optional<Hash> waiting;
+        if (i < level.size()) {
+            waiting = level[i];
+        }
+        if (d - 1 < parents.size()) {
+            parents[d - 1] = waiting;
+        } else {
+            parents.push_back(waiting);
+        }
+        level.swap(next);
+    }
+}
+
 // This is for allowing the witness to determine if a subtree has filled
 // to a particular depth, or for append() to ensure we're not appending
 // to a full tree.
@@ -224,6 +288,24 @@ size_t IncrementalMerkleTree<Depth, Hash>::next_depth(size_t skip) const {
     return d + skip;
 }
 
+// This returns the frontier of the rightmost subtree of the given depth,
+// i.e. the tree holding only the elements appended since the last multiple
+// of 2^depth. The lower levels of a frontier only depend on those elements.
+template<size_t Depth, typename Hash>
+IncrementalMerkleTree<Depth, Hash> IncrementalMerkleTree<Depth, Hash>::frontier(size_t depth) const {
+    assert(depth > 0);
+
+    IncrementalMerkleTree<Depth, Hash> subtree;
+    subtree.left = left;
+    subtree.right = right;
+    subtree.parents.assign(parents.begin(), parents.begin() + std::min(parents.size(), depth - 1));
+    while (!subtree.parents.empty() && !subtree.parents.back()) {
+        subtree.parents.pop_back();
+    }
+
+    return subtree;
+}
+
 // This calculates the root of the tree.
 template<size_t Depth, typename Hash>
 Hash IncrementalMerkleTree<Depth, Hash>::root(size_t depth,
@@ -348,16 +430,137 @@ void IncrementalWitness<Depth, Hash>::append(Hash obj) {
     }
 }
 
+// The position right after the subtree holding the uncle that is next
+// after `skip` filled ones, i.e. the tree size at which it starts.
+template<size_t Depth, typename Hash>
+uint64_t IncrementalWitness<Depth, Hash>::uncle_start(size_t skip) const {
+    size_t depth = tree.next_depth(skip);
+    return ((position() >> depth) + 1) << depth;
+}
+
+// The tree size at which that uncle is complete.
+template<size_t Depth, typename Hash>
+uint64_t IncrementalWitness<Depth, Hash>::uncle_end(size_t skip) const {
+    return uncle_start(skip) + (uint64_t(1) << tree.next_depth(skip));
+}
+
+// The size of the tree this witness has been advanced to.
+template<size_t Depth, typename Hash>
+uint64_t IncrementalWitness<Depth, Hash>::tree_size() const {
+    return uncle_start(filled.size()) + (cursor ? cursor->size() : 0);
+}
+
+template<size_t Depth, typename Hash>
+void IncrementalWitness<Depth, Hash>::rewind(const IncrementalMerkleTree<Depth, Hash>& frontier) {
+    uint64_t size = frontier.size();
+    if (size <= position() || size > tree_size()) {
+        throw std::runtime_error("frontier is not an earlier state of the witnessed tree");
+    }
+
+    while (!filled.empty() && uncle_end(filled.size() - 1) > size) {
+        filled.pop_back();
+    }
+
+    // Restore the cursor, and the depth append() would have left behind
+    cursor = boost::none;
+    if (size > uncle_start(filled.size())) {
+        cursor_depth = tree.next_depth(filled.size());
+        cursor = frontier.frontier(cursor_depth);
+    } else if (!filled.empty()) {
+        cursor_depth = tree.next_depth(filled.size() - 1);
+    } else {
+        cursor_depth = 0;
+    }
+}
+
+template<size_t Depth, typename Hash>
+void IncrementalWitnessFrontier<Depth, Hash>::track(Witness& witness,
+                                                    const IncrementalMerkleTree<Depth, Hash>& tree) {
+    if (witness.tree_size() != tree.size()) {
+        unsynced.push_back(&witness);
+        return;
+    }
+
+    // The cursor is rebuilt from the tree in finish()
+    witness.cursor = boost::none;
+    tracked.push_back(&witness);
+    if (witness.tree.next_depth(witness.filled.size()) < Depth) {
+        waiting.insert(std::make_pair(witness.uncle_end(witness.filled.size()), &witness));
+    }
+}
+
+template<size_t Depth, typename Hash>
+void IncrementalWitnessFrontier<Depth, Hash>::untrack(const Witness& witness) {
+    auto matches = [&witness](const Witness* w) { return w == &witness; };
+    tracked.erase(std::remove_if(tracked.begin(), tracked.end(), matches), tracked.end());
+    unsynced.erase(std::remove_if(unsynced.begin(), unsynced.end(), matches), unsynced.end());
+    for (auto it = waiting.begin(); it != waiting.end(); ) {
+        if (it->second == &witness) {
+            it = waiting.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+template<size_t Depth, typename Hash>
+void IncrementalWitnessFrontier<Depth, Hash>::appended(const IncrementalMerkleTree<Depth, Hash>& tree) {
+    for (Witness* witness : unsynced) {
+        witness->append(tree.last());
+    }
+
+    uint64_t size = tree.size();
+    // Roots of the subtrees completed by this element, by depth
+    std::map<size_t, Hash> completed;
+    while (!waiting.empty() && waiting.begin()->first <= size) {
+        Witness* witness = waiting.begin()->second;
+        waiting.erase(waiting.begin());
+
+        size_t depth = witness->tree.next_depth(witness->filled.size());
+        auto it = completed.find(depth);
+        if (it == completed.end()) {
+            Hash root = depth == 0 ? tree.last() : tree.frontier(depth).root(depth);
+            it = completed.insert(std::make_pair(depth, root)).first;
+        }
+        witness->filled.push_back(it->second);
+        witness->cursor_depth = depth;
+
+        if (witness->tree.next_depth(witness->filled.size()) < Depth) {
+            waiting.insert(std::make_pair(witness->uncle_end(witness->filled.size()), witness));
+        }
+    }
+}
+
+template<size_t Depth, typename Hash>
+void IncrementalWitnessFrontier<Depth, Hash>::finish(const IncrementalMerkleTree<Depth, Hash>& tree) {
+    uint64_t size = tree.size();
+    for (Witness* witness : tracked) {
+        if (size > witness->uncle_start(witness->filled.size())) {
+            witness->cursor_depth = witness->tree.next_depth(witness->filled.size());
+            witness->cursor = tree.frontier(witness->cursor_depth);
+        }
+    }
+    waiting.clear();
+    tracked.clear();
+    unsynced.clear();
+}
+
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
 
 template class IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
 template class IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
 
+template class IncrementalWitnessFrontier<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
+template class IncrementalWitnessFrontier<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
+
 template class IncrementalMerkleTree<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, PedersenHash>;
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, PedersenHash>;
 
 template class IncrementalWitness<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, PedersenHash>;
 template class IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, PedersenHash>;
 
+template class IncrementalWitnessFrontier<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, PedersenHash>;
+template class IncrementalWitnessFrontier<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, PedersenHash>;
+
 } // end namespace `libzcash`
@@ -3,6 +3,7 @@
 
 #include <array>
 #include <deque>
+#include <map>
 #include <boost/optional.hpp>
 #include <boost/static_assert.hpp>
 
@@ -82,10 +83,14 @@ bool operator==(const EmptyMerkleRoots<Depth, Hash>& a,
 template<size_t Depth, typename Hash>
 class IncrementalWitness;
 
+template<size_t Depth, typename Hash>
+class IncrementalWitnessFrontier;
+
 template<size_t Depth, typename Hash>
 class IncrementalMerkleTree {
 
 friend class IncrementalWitness<Depth, Hash>;
+friend class IncrementalWitnessFrontier<Depth, Hash>;
 
 public:
     BOOST_STATIC_ASSERT(Depth >= 1);
@@ -101,8 +106,14 @@ public:
     size_t size() const;
 
     void append(Hash obj);
+    //! Append all of objs in order; the same as appending them one at a time
+    void append_many(const std::vector<Hash>& objs);
     Hash root() const {
-        return root(Depth, std::deque<Hash>());
+        // Kept until the tree changes, as it costs Depth hashes and is
+        // usually asked for more than once per block
+        if (!cached_root)
+            cached_root = root(Depth, std::deque<Hash>());
+        return *cached_root;
     }
     Hash last() const;
 
@@ -117,6 +128,8 @@ public:
         READWRITE(left);
         READWRITE(right);
         READWRITE(parents);
+        if (ser_action.ForRead())
+            cached_root = boost::none;
 
         wfcheck();
     }
@@ -125,24 +138,133 @@ public:
         return emptyroots.empty_root(Depth);
     }
 
+    //! Write the tree in the CompactFrontier format
+    template<typename Stream>
+    void SerializeFrontier(Stream& s) const {
+        uint64_t mask = (left ? 1 : 0) | (right ? 2 : 0);
+        for (size_t i = 0; i < parents.size(); i++) {
+            if (parents[i]) {
+                mask |= (uint64_t)1 << (i + 2);
+            }
+        }
+        unsigned char marker = FRONTIER_MARKER;
+        ::Serialize(s, marker);
+        ::Serialize(s, VARINT(mask));
+        if (left) {
+            ::Serialize(s, *left);
+        }
+        if (right) {
+            ::Serialize(s, *right);
+        }
+        for (const boost::optional<Hash>& parent : parents) {
+            if (parent) {
+                ::Serialize(s, *parent);
+            }
+        }
+    }
+
+    //! Read the tree in either the CompactFrontier or the default format
+    template<typename Stream>
+    void UnserializeFrontier(Stream& s) {
+        unsigned char marker;
+        ::Unserialize(s, marker);
+        cached_root = boost::none;
+        if (marker != FRONTIER_MARKER) {
+            // The default format, whose first byte is the discriminant of left
+            if (marker == 0x01) {
+                Hash obj;
+                ::Unserialize(s, obj);
+                left = obj;
+            } else if (marker == 0x00) {
+                left = boost::none;
+            } else {
+                throw std::ios_base::failure("non-canonical optional discriminant");
+            }
+            ::Unserialize(s, right);
+            ::Unserialize(s, parents);
+            wfcheck();
+            return;
+        }
+
+        uint64_t mask;
+        ::Unserialize(s, VARINT(mask));
+        if (mask >> (Depth + 1)) {
+            throw std::ios_base::failure("tree has too many parents");
+        }
+        left = boost::none;
+        right = boost::none;
+        parents.clear();
+        Hash obj;
+        if (mask & 1) {
+            ::Unserialize(s, obj);
+            left = obj;
+        }
+        if (mask & 2) {
+            ::Unserialize(s, obj);
+            right = obj;
+        }
+        for (size_t i = 0; (mask >> (i + 2)) != 0; i++) {
+            if ((mask >> (i + 2)) & 1) {
+                ::Unserialize(s, obj);
+                parents.push_back(obj);
+            } else {
+                parents.push_back(boost::none);
+            }
+        }
+        wfcheck();
+    }
+
     template <size_t D, typename H>
     friend bool operator==(const IncrementalMerkleTree<D, H>& a,
                            const IncrementalMerkleTree<D, H>& b);
 
 private:
+    //! First byte of the CompactFrontier format, never the first of the default one
+    static const unsigned char FRONTIER_MARKER = 0xff;
+
     static EmptyMerkleRoots<Depth, Hash> emptyroots;
     boost::optional<Hash> left;
     boost::optional<Hash> right;
 
     // Collapsed "left" subtrees ordered toward the root of the tree.
     std::vector<boost::optional<Hash>> parents;
+    // Memory only: root(), cleared whenever the tree changes.
+    mutable boost::optional<Hash> cached_root;
     MerklePath path(std::deque<Hash> filler_hashes = std::deque<Hash>()) const;
     Hash root(size_t depth, std::deque<Hash> filler_hashes = std::deque<Hash>()) const;
     bool is_complete(size_t depth = Depth) const;
     size_t next_depth(size_t skip) const;
+    IncrementalMerkleTree<Depth, Hash> frontier(size_t depth) const;
     void wfcheck() const;
 };
 
+/**
+ * Serialization wrapper storing a tree as just its frontier: a bitmask of
+ * which of left, right and the parents are present, followed by the hashes
+ * of those alone. The default format spends a byte on every node and a
+ * length on the parents. Trees in the default format are read as well, so
+ * records written before the switch still load.
+ */
+template<typename Tree>
+class CompactFrontier
+{
+private:
+    Tree& tree;
+
+public:
+    explicit CompactFrontier(Tree& treeIn) : tree(treeIn) { }
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        tree.SerializeFrontier(s);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        tree.UnserializeFrontier(s);
+    }
+};
+
 template<size_t Depth, typename Hash>
 bool operator==(const IncrementalMerkleTree<Depth, Hash>& a,
                 const IncrementalMerkleTree<Depth, Hash>& b) {
@@ -155,11 +277,18 @@ bool operator==(const IncrementalMerkleTree<Depth, Hash>& a,
 template <size_t Depth, typename Hash>
 class IncrementalWitness {
 friend class IncrementalMerkleTree<Depth, Hash>;
+friend class IncrementalWitnessFrontier<Depth, Hash>;
 
 public:
     // Required for Unserialize()
     IncrementalWitness() {}
 
+    size_t DynamicMemoryUsage() const {
+        return tree.DynamicMemoryUsage() +
+               filled.capacity() * 32 + // filled
+               (cursor ? cursor->DynamicMemoryUsage() : 0); // cursor
+    }
+
     MerklePath path() const {
         return tree.path(partial_path());
     }
@@ -180,6 +309,10 @@ public:
 
     void append(Hash obj);
 
+    // Roll the witness back to an earlier state of the tree, given
+    // by its frontier. The witnessed element must be in that tree.
+    void rewind(const IncrementalMerkleTree<Depth, Hash>& frontier);
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -201,6 +334,9 @@ private:
     boost::optional<IncrementalMerkleTree<Depth, Hash>> cursor;
     size_t cursor_depth = 0;
     std::deque<Hash> partial_path() const;
+    uint64_t uncle_start(size_t skip) const;
+    uint64_t uncle_end(size_t skip) const;
+    uint64_t tree_size() const;
     IncrementalWitness(IncrementalMerkleTree<Depth, Hash> tree) : tree(tree) {}
 };
 
@@ -213,6 +349,40 @@ bool operator==(const IncrementalWitness<Depth, Hash>& a,
             a.cursor_depth == b.cursor_depth);
 }
 
+/**
+ * Advances many witnesses into the same tree at once.
+ *
+ * Appending to every witness separately costs a hash per witness and
+ * element. The uncles a witness is waiting for are subtrees of the tree
+ * itself, so instead each witness is keyed by the tree size at which its
+ * next uncle is complete, that uncle's root is computed once from the
+ * tree's frontier for every witness waiting on it, and the partial cursors
+ * are copied from the frontier when the batch is finished.
+ *
+ * Usage: track() each witness against the current tree, call appended()
+ * after every element appended to the tree, then finish(). The tracked
+ * witnesses must not be destroyed before finish() unless untrack()ed.
+ */
+template<size_t Depth, typename Hash>
+class IncrementalWitnessFrontier {
+public:
+    void track(IncrementalWitness<Depth, Hash>& witness,
+               const IncrementalMerkleTree<Depth, Hash>& tree);
+    void untrack(const IncrementalWitness<Depth, Hash>& witness);
+    void appended(const IncrementalMerkleTree<Depth, Hash>& tree);
+    void finish(const IncrementalMerkleTree<Depth, Hash>& tree);
+
+private:
+    typedef IncrementalWitness<Depth, Hash> Witness;
+
+    // Witnesses by the tree size at which their next uncle is complete
+    std::multimap<uint64_t, Witness*> waiting;
+    std::vector<Witness*> tracked;
+    // Witnesses that do not match the tree they are tracked against,
+    // which are advanced one element at a time instead
+    std::vector<Witness*> unsynced;
+};
+
 class SHA256Compress : public uint256 {
 public:
     SHA256Compress() : uint256() {}
@@ -254,10 +424,16 @@ typedef libzcash::IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, l
 typedef libzcash::IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::SHA256Compress> SproutWitness;
 typedef libzcash::IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::SHA256Compress> SproutTestingWitness;
 
+typedef libzcash::IncrementalWitnessFrontier<INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::SHA256Compress> SproutWitnessFrontier;
+typedef libzcash::IncrementalWitnessFrontier<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::SHA256Compress> SproutTestingWitnessFrontier;
+
 typedef libzcash::IncrementalMerkleTree<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::PedersenHash> SaplingMerkleTree;
 typedef libzcash::IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::PedersenHash> SaplingTestingMerkleTree;
 
 typedef libzcash::IncrementalWitness<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::PedersenHash> SaplingWitness;
 typedef libzcash::IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::PedersenHash> SaplingTestingWitness;
 
+typedef libzcash::IncrementalWitnessFrontier<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::PedersenHash> SaplingWitnessFrontier;
+typedef libzcash::IncrementalWitnessFrontier<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::PedersenHash> SaplingTestingWitnessFrontier;
+
 #endif /* ZC_INCREMENTALMERKLETREE_H_ */
@@ -4,6 +4,7 @@
 
 #include "zcash/util.h"
 
+#include <atomic>
 #include <memory>
 
 #include <boost/foreach.hpp>
@@ -22,6 +23,10 @@
 #include "streams.h"
 #include "version.h"
 
+#ifdef MULTICORE
+#include <omp.h>
+#endif
+
 using namespace libsnark;
 
 namespace libzcash {
@@ -30,6 +35,26 @@ namespace libzcash {
 
 static CCriticalSection cs_ParamsIO;
 
+static std::atomic<int> nProveThreads(0);
+static std::atomic<int> nVerifyThreads(0);
+
+void SetProofThreads(int nProveThreadsIn, int nVerifyThreadsIn)
+{
+    nProveThreads = std::max(nProveThreadsIn, 0);
+    nVerifyThreads = std::max(nVerifyThreadsIn, 0);
+}
+
+/** Limit the OpenMP regions libsnark runs from this thread to nThreads, if set */
+static void UseProofThreads(int nThreads)
+{
+#ifdef MULTICORE
+    // The thread count is per calling thread, so it is set for every proof
+    if (nThreads > 0) {
+        omp_set_num_threads(nThreads);
+    }
+#endif
+}
+
 template<typename T>
 void saveToFile(const std::string path, T& obj) {
     LOCK(cs_ParamsIO);
@@ -128,6 +153,7 @@ public:
                 vpub_new
             );
 
+            UseProofThreads(nVerifyThreads);
             return verifier.check(
                 vk,
                 vk_precomp,
@@ -359,6 +385,7 @@ public:
             throw std::runtime_error(strprintf("could not load param file at %s", pkPath));
         }
 
+        UseProofThreads(nProveThreads);
         return PHGRProof(r1cs_ppzksnark_prover_streaming<ppzksnark_ppT>(
             fh,
             primary_input,
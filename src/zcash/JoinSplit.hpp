@@ -23,6 +23,14 @@ static constexpr size_t GROTH_PROOF_SIZE = (
 typedef std::array<unsigned char, GROTH_PROOF_SIZE> GrothProof;
 typedef boost::variant<PHGRProof, GrothProof> SproutProof;
 
+/**
+ * Set how many threads libsnark's multi-exponentiations and FFTs may use
+ * for one PHGR13 proof, when it is built with MULTICORE. The counts are
+ * applied on the calling thread by JoinSplit::prove and JoinSplit::verify;
+ * 0 leaves OpenMP's default of one thread per core.
+ */
+void SetProofThreads(int nProveThreads, int nVerifyThreads);
+
 class JSInput {
 public:
     SproutWitness witness;
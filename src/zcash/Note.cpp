@@ -1,5 +1,6 @@
 #include "Note.hpp"
 #include "prf.h"
+#include "crypto/common.h"
 #include "crypto/sha256.h"
 
 #include "random.h"
@@ -121,6 +122,30 @@ SproutNotePlaintext SproutNotePlaintext::decrypt(const ZCNoteDecryption& decrypt
     return ret;
 }
 
+boost::optional<SproutNotePlaintext> SproutNotePlaintext::try_decrypt(const ZCNoteDecryption& decryptor,
+                                     const ZCNoteDecryption::Ciphertext& ciphertext,
+                                     const uint256& dhsecret,
+                                     const uint256& ephemeralKey,
+                                     const uint256& h_sig,
+                                     unsigned char nonce
+                                    )
+{
+    auto plaintext = decryptor.try_decrypt(ciphertext, dhsecret, ephemeralKey, h_sig, nonce);
+    if (!plaintext) {
+        return boost::none;
+    }
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << *plaintext;
+
+    SproutNotePlaintext ret;
+    ss >> ret;
+
+    assert(ss.size() == 0);
+
+    return ret;
+}
+
 ZCNoteEncryption::Ciphertext SproutNotePlaintext::encrypt(ZCNoteEncryption& encryptor,
                                                     const uint256& pk_enc,
                                                     const boost::optional<uint256>& sk_enc
@@ -189,7 +214,8 @@ boost::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt(
     const SaplingEncCiphertext &ciphertext,
     const uint256 &ivk,
     const uint256 &epk,
-    const uint256 &cmu
+    const uint256 &cmu,
+    uint256* pk_d_out
 )
 {
     auto pt = AttemptSaplingEncDecryption(ciphertext, ivk, epk);
@@ -227,9 +253,54 @@ boost::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt(
         return boost::none;
     }
 
+    if (pk_d_out) {
+        *pk_d_out = pk_d;
+    }
     return ret;
 }
 
+bool SaplingNotePlaintext::compact_decrypt(
+    const SaplingCompactCiphertext &ciphertext,
+    const uint256 &ivk,
+    const uint256 &epk,
+    const uint256 &cmu
+)
+{
+    auto pt = AttemptSaplingCompactDecryption(ciphertext, ivk, epk);
+    if (!pt) {
+        return false;
+    }
+
+    // Lead byte, then d (11 bytes), value (8 bytes, little endian) and rcm (32 bytes)
+    const unsigned char* p = pt->begin();
+    if (p[0] != 0x01) {
+        return false;
+    }
+    diversifier_t d;
+    memcpy(d.data(), p + ZC_NOTEPLAINTEXT_LEADING, ZC_DIVERSIFIER_SIZE);
+    uint64_t value = ReadLE64(p + ZC_NOTEPLAINTEXT_LEADING + ZC_DIVERSIFIER_SIZE);
+    const unsigned char* rcm = p + ZC_NOTEPLAINTEXT_LEADING + ZC_DIVERSIFIER_SIZE + ZC_V_SIZE;
+
+    uint256 pk_d;
+    if (!librustzcash_ivk_to_pkd(ivk.begin(), d.data(), pk_d.begin())) {
+        return false;
+    }
+
+    uint256 cmu_expected;
+    if (!librustzcash_sapling_compute_cm(
+        d.data(),
+        pk_d.begin(),
+        value,
+        rcm,
+        cmu_expected.begin()
+    ))
+    {
+        return false;
+    }
+
+    return cmu_expected == cmu;
+}
+
 boost::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt(
     const SaplingEncCiphertext &ciphertext,
     const uint256 &epk,
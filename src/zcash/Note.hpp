@@ -111,6 +111,16 @@ public:
                                  unsigned char nonce
                                 );
 
+    // Trial decryption with the secret from decryptor.shared_secret(ephemeralKey);
+    // boost::none if the ciphertext isn't for this decryptor.
+    static boost::optional<SproutNotePlaintext> try_decrypt(const ZCNoteDecryption& decryptor,
+                                 const ZCNoteDecryption::Ciphertext& ciphertext,
+                                 const uint256& dhsecret,
+                                 const uint256& ephemeralKey,
+                                 const uint256& h_sig,
+                                 unsigned char nonce
+                                );
+
     ZCNoteEncryption::Ciphertext encrypt(ZCNoteEncryption& encryptor,
                                          const uint256& pk_enc,
                                          const boost::optional<uint256>& sk_enc = boost::none
@@ -128,11 +138,15 @@ public:
 
     SaplingNotePlaintext(const SaplingNote& note, std::array<unsigned char, ZC_MEMO_SIZE> memo);
 
+    // The recipient's pk_d is derived from ivk to check the commitment;
+    // if pk_d_out is given it is returned there, saving a caller that
+    // wants the address from deriving it a second time.
     static boost::optional<SaplingNotePlaintext> decrypt(
         const SaplingEncCiphertext &ciphertext,
         const uint256 &ivk,
         const uint256 &epk,
-        const uint256 &cmu
+        const uint256 &cmu,
+        uint256* pk_d_out = NULL
     );
 
     static boost::optional<SaplingNotePlaintext> decrypt(
@@ -143,6 +157,15 @@ public:
         const uint256 &cmu
     );
 
+    // Trial-decrypts the leading bytes of a note ciphertext (ZIP 307) and
+    // checks them against the note commitment. The memo is not recovered.
+    static bool compact_decrypt(
+        const SaplingCompactCiphertext &ciphertext,
+        const uint256 &ivk,
+        const uint256 &epk,
+        const uint256 &cmu
+    );
+
     boost::optional<SaplingNote> note(const SaplingIncomingViewingKey& ivk) const;
 
     virtual ~SaplingNotePlaintext() {}
@@ -187,6 +187,36 @@ boost::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
     return plaintext;
 }
 
+boost::optional<SaplingCompactPlaintext> AttemptSaplingCompactDecryption(
+    const SaplingCompactCiphertext &ciphertext,
+    const uint256 &ivk,
+    const uint256 &epk
+)
+{
+    uint256 dhsecret;
+
+    if (!librustzcash_sapling_ka_agree(epk.begin(), ivk.begin(), dhsecret.begin())) {
+        return boost::none;
+    }
+
+    // Construct the symmetric key
+    unsigned char K[NOTEENCRYPTION_CIPHER_KEYSIZE];
+    KDF_Sapling(K, dhsecret, epk);
+
+    // The nonce is zero because we never reuse keys
+    unsigned char cipher_nonce[crypto_aead_chacha20poly1305_IETF_NPUBBYTES] = {};
+
+    // ChaCha20-Poly1305 uses block 0 of the keystream for the Poly1305 key,
+    // so the plaintext starts at block 1.
+    SaplingCompactPlaintext plaintext;
+    crypto_stream_chacha20_ietf_xor_ic(
+        plaintext.begin(),
+        ciphertext.begin(), ZC_SAPLING_COMPACT_PLAINTEXT_SIZE,
+        cipher_nonce, 1, K);
+
+    return plaintext;
+}
+
 boost::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption (
     const SaplingEncCiphertext &ciphertext,
     const uint256 &epk,
@@ -346,6 +376,16 @@ typename NoteDecryption<MLEN>::Plaintext NoteDecryption<MLEN>::decrypt
                                           const uint256 &hSig,
                                           unsigned char nonce
                                          ) const
+{
+    auto plaintext = try_decrypt(ciphertext, shared_secret(epk), epk, hSig, nonce);
+    if (!plaintext) {
+        throw note_decryption_failed();
+    }
+    return *plaintext;
+}
+
+template<size_t MLEN>
+uint256 NoteDecryption<MLEN>::shared_secret(const uint256 &epk) const
 {
     uint256 dhsecret;
 
@@ -353,16 +393,30 @@ typename NoteDecryption<MLEN>::Plaintext NoteDecryption<MLEN>::decrypt
         throw std::logic_error("Could not create DH secret");
     }
 
-    try {
-        return decrypt_INTERNAL(ciphertext, dhsecret, epk, pk_enc, hSig, nonce);
-    } catch (note_decryption_failed) {
-        return decrypt_INTERNAL(ciphertext, dhsecret, epk, sk_enc, hSig, nonce);
-    }
+    return dhsecret;
 }
 
 template<size_t MLEN>
-typename NoteDecryption<MLEN>::Plaintext NoteDecryption<MLEN>::decrypt_INTERNAL
+boost::optional<typename NoteDecryption<MLEN>::Plaintext> NoteDecryption<MLEN>::try_decrypt
                                          (const NoteDecryption<MLEN>::Ciphertext &ciphertext,
+                                          const uint256 &dhsecret,
+                                          const uint256 &epk,
+                                          const uint256 &hSig,
+                                          unsigned char nonce
+                                         ) const
+{
+    NoteDecryption<MLEN>::Plaintext plaintext;
+    if (decrypt_INTERNAL(plaintext, ciphertext, dhsecret, epk, pk_enc, hSig, nonce) ||
+        decrypt_INTERNAL(plaintext, ciphertext, dhsecret, epk, sk_enc, hSig, nonce)) {
+        return plaintext;
+    }
+    return boost::none;
+}
+
+template<size_t MLEN>
+bool NoteDecryption<MLEN>::decrypt_INTERNAL
+                                         (NoteDecryption<MLEN>::Plaintext &plaintext,
+                                          const NoteDecryption<MLEN>::Ciphertext &ciphertext,
                                           const uint256 &dhsecret,
                                           const uint256 &epk,
                                           const uint256 &ck_enc,
@@ -375,20 +429,15 @@ typename NoteDecryption<MLEN>::Plaintext NoteDecryption<MLEN>::decrypt_INTERNAL
     // The nonce is zero because we never reuse keys
     unsigned char cipher_nonce[crypto_aead_chacha20poly1305_IETF_NPUBBYTES] = {};
 
-    NoteDecryption<MLEN>::Plaintext plaintext;
-
     // Message length is always NOTEENCRYPTION_AUTH_BYTES less than
-    // the ciphertext length.
-    if (crypto_aead_chacha20poly1305_ietf_decrypt(plaintext.begin(), NULL,
+    // the ciphertext length. The tag is checked before anything is
+    // decrypted, so a key that doesn't fit costs no decryption.
+    return crypto_aead_chacha20poly1305_ietf_decrypt(plaintext.begin(), NULL,
                                              NULL,
                                              ciphertext.begin(), NoteDecryption<MLEN>::CLEN,
                                              NULL,
                                              0,
-                                             cipher_nonce, K) != 0) {
-        throw note_decryption_failed();
-    }
-
-    return plaintext;
+                                             cipher_nonce, K) == 0;
 }
 
 //
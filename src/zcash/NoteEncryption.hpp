@@ -20,6 +20,10 @@ namespace libzcash {
 typedef std::array<unsigned char, ZC_SAPLING_ENCCIPHERTEXT_SIZE> SaplingEncCiphertext;
 typedef std::array<unsigned char, ZC_SAPLING_ENCPLAINTEXT_SIZE> SaplingEncPlaintext;
 
+// Leading bytes of a ciphertext for the recipient, enough to trial-decrypt it
+typedef std::array<unsigned char, ZC_SAPLING_COMPACT_PLAINTEXT_SIZE> SaplingCompactCiphertext;
+typedef std::array<unsigned char, ZC_SAPLING_COMPACT_PLAINTEXT_SIZE> SaplingCompactPlaintext;
+
 // Ciphertext for outgoing viewing key to decrypt
 typedef std::array<unsigned char, ZC_SAPLING_OUTCIPHERTEXT_SIZE> SaplingOutCiphertext;
 typedef std::array<unsigned char, ZC_SAPLING_OUTPLAINTEXT_SIZE> SaplingOutPlaintext;
@@ -73,6 +77,15 @@ boost::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
     const uint256 &epk
 );
 
+// Decrypts the leading bytes of a Sapling note ciphertext. There is no
+// authentication tag to check, so this always "succeeds" unless key agreement
+// fails; the caller must check the result against the note commitment.
+boost::optional<SaplingCompactPlaintext> AttemptSaplingCompactDecryption(
+    const SaplingCompactCiphertext &ciphertext,
+    const uint256 &ivk,
+    const uint256 &epk
+);
+
 // Attempts to decrypt a Sapling note using outgoing plaintext.
 // This will not check that the contents of the ciphertext are correct.
 boost::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption (
@@ -153,8 +166,23 @@ public:
                       unsigned char nonce
                      ) const;
 
+    // The Diffie-Hellman secret with the sender of ciphertexts under epk.
+    // Every ciphertext of a JoinSplit shares its epk, so trial decryption
+    // computes this once per key and JoinSplit for try_decrypt.
+    uint256 shared_secret(const uint256 &epk) const;
+
+    // As decrypt, given the secret from shared_secret, and returning
+    // boost::none rather than throwing when this key doesn't decrypt it.
+    boost::optional<Plaintext> try_decrypt(const Ciphertext &ciphertext,
+                                           const uint256 &dhsecret,
+                                           const uint256 &epk,
+                                           const uint256 &hSig,
+                                           unsigned char nonce
+                                          ) const;
+
 private:
-    static Plaintext decrypt_INTERNAL(
+    static bool decrypt_INTERNAL(
+            Plaintext &plaintext,
             const Ciphertext &ciphertext,
             const uint256 &dhsecret,
             const uint256 &epk,
@@ -259,6 +259,9 @@ public:
     // such as during reindexing.
     static ProofVerifier Disabled();
 
+    // Whether proofs are really checked
+    bool IsEnabled() const { return perform_verification; }
+
     template <typename VerificationKey,
               typename ProcessedVerificationKey,
               typename PrimaryInput,
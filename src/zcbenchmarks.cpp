@@ -1,4 +1,6 @@
+#include <atomic>
 #include <cstdio>
+#include <functional>
 #include <future>
 #include <map>
 #include <thread>
@@ -19,9 +21,12 @@
 #include "miner.h"
 #include "pow.h"
 #include "rpc/server.h"
+#include "script/interpreter.h"
 #include "script/sign.h"
+#include "script/standard.h"
 #include "sodium.h"
 #include "streams.h"
+#include "transaction_builder.h"
 #include "txdb.h"
 #include "utiltest.h"
 #include "wallet/wallet.h"
@@ -188,8 +193,13 @@ double benchmark_solve_equihash()
     struct timeval tv_start;
     timer_start(tv_start);
     std::set<std::vector<unsigned int>> solns;
-    EhOptimisedSolveUncancellable(n, k, eh_state,
-                                  [](std::vector<unsigned char> soln) { return false; });
+    if (GetArg("-equihashsolver", "default") == "bucket") {
+        EhBucketSolveUncancellable(n, k, eh_state,
+                                   [](std::vector<unsigned char> soln) { return false; });
+    } else {
+        EhOptimisedSolveUncancellable(n, k, eh_state,
+                                      [](std::vector<unsigned char> soln) { return false; });
+    }
     return timer_stop(tv_start);
 }
 
@@ -321,7 +331,7 @@ double benchmark_increment_note_witnesses(size_t nTxs)
 
         wtx.SetSproutNoteData(noteData);
         wallet.AddToWallet(wtx, true, NULL);
-        block1.vtx.push_back(wtx);
+        block1.vtx.push_back(MakeTransactionRef(wtx));
     }
     CBlockIndex index1(block1);
     index1.nHeight = 1;
@@ -344,7 +354,7 @@ double benchmark_increment_note_witnesses(size_t nTxs)
 
         wtx.SetSproutNoteData(noteData);
         wallet.AddToWallet(wtx, true, NULL);
-        block2.vtx.push_back(wtx);
+        block2.vtx.push_back(MakeTransactionRef(wtx));
     }
     CBlockIndex index2(block2);
     index2.nHeight = 2;
@@ -568,15 +578,37 @@ double benchmark_create_sapling_output()
     return t;
 }
 
-// Verify Sapling spend from testnet
+// Sapling spend from testnet
 // txid: abbd823cbd3d4e3b52023599d81a96b74817e95ce5bb58354f979156bd22ecc8
 // position: 0
-double benchmark_verify_sapling_spend()
+static SpendDescription SampleSaplingSpend()
 {
     SpendDescription spend;
     CDataStream ss(ParseHex("8c6cf86bbb83bf0d075e5bd9bb4b5cd56141577be69f032880b11e26aa32aa5ef09fd00899e4b469fb11f38e9d09dc0379f0b11c23b5fe541765f76695120a03f0261d32af5d2a2b1e5c9a04200cd87d574dc42349de9790012ce560406a8a876a1e54cfcdc0eb74998abec2a9778330eeb2a0ac0e41d0c9ed5824fbd0dbf7da930ab299966ce333fd7bc1321dada0817aac5444e02c754069e218746bf879d5f2a20a8b028324fb2c73171e63336686aa5ec2e6e9a08eb18b87c14758c572f4531ccf6b55d09f44beb8b47563be4eff7a52598d80959dd9c9fee5ac4783d8370cb7d55d460053d3e067b5f9fe75ff2722623fb1825fcba5e9593d4205b38d1f502ff03035463043bd393a5ee039ce75a5d54f21b395255df6627ef96751566326f7d4a77d828aa21b1827282829fcbc42aad59cdb521e1a3aaa08b99ea8fe7fff0a04da31a52260fc6daeccd79bb877bdd8506614282258e15b3fe74bf71a93f4be3b770119edf99a317b205eea7d5ab800362b97384273888106c77d633600"), SER_NETWORK, PROTOCOL_VERSION);
     ss >> spend;
-    uint256 dataToBeSigned = uint256S("0x2dbf83fe7b88a7cbd80fac0c719483906bb9a0c4fc69071e4780d5f2c76e592c");
+    return spend;
+}
+
+static uint256 SampleSaplingSpendSighash()
+{
+    return uint256S("0x2dbf83fe7b88a7cbd80fac0c719483906bb9a0c4fc69071e4780d5f2c76e592c");
+}
+
+// Sapling output from testnet
+// txid: abbd823cbd3d4e3b52023599d81a96b74817e95ce5bb58354f979156bd22ecc8
+// position: 0
+static OutputDescription SampleSaplingOutput()
+{
+    OutputDescription output;
+    CDataStream ss(ParseHex("edd742af18857e5ec2d71d346a7fe2ac97c137339bd5268eea86d32e0ff4f38f76213fa8cfed3347ac4e8572dd88aff395c0c10a59f8b3f49d2bc539ed6c726667e29d4763f914ddd0abf1cdfa84e44de87c233434c7e69b8b5b8f4623c8aa444163425bae5cef842972fed66046c1c6ce65c866ad894d02e6e6dcaae7a962d9f2ef95757a09c486928e61f0f7aed90ad0a542b0d3dc5fe140dfa7626b9315c77e03b055f19cbacd21a866e46f06c00e0c7792b2a590a611439b510a9aaffcf1073bad23e712a9268b36888e3727033eee2ab4d869f54a843f93b36ef489fb177bf74b41a9644e5d2a0a417c6ac1c8869bc9b83273d453f878ed6fd96b82a5939903f7b64ecaf68ea16e255a7fb7cc0b6d8b5608a1c6b0ed3024cc62c2f0f9c5cfc7b431ae6e9d40815557aa1d010523f9e1960de77b2274cb6710d229d475c87ae900183206ba90cb5bbc8ec0df98341b82726c705e0308ca5dc08db4db609993a1046dfb43dfd8c760be506c0bed799bb2205fc29dc2e654dce731034a23b0aaf6da0199248702ee0523c159f41f4cbfff6c35ace4dd9ae834e44e09c76a0cbdda1d3f6a2c75ad71212daf9575ab5f09ca148718e667f29ddf18c8a330a86ace18a86e89454653902aa393c84c6b694f27d0d42e24e7ac9fe34733de5ec15f5066081ce912c62c1a804a2bb4dedcef7cc80274f6bb9e89e2fce91dc50d6a73c8aefb9872f1cf3524a92626a0b8f39bbf7bf7d96ca2f770fc04d7f457021c536a506a187a93b2245471ddbfb254a71bc4a0d72c8d639a31c7b1920087ffca05c24214157e2e7b28184e91989ef0b14f9b34c3dc3cc0ac64226b9e337095870cb0885737992e120346e630a416a9b217679ce5a778fb15779c136bcecca5efe79012013d77d90b4e99dd22c8f35bc77121716e160d05bd30d288ee8886390ee436f85bdc9029df888a3a3326d9d4ddba5cb5318b3274928829d662e96fea1d601f7a306251ed8c6cc4e5a3a7a98c35a3650482a0eee08f3b4c2da9b22947c96138f1505c2f081f8972d429f3871f32bef4aaa51aa6945df8e9c9760531ac6f627d17c1518202818a91ca304fb4037875c666060597976144fcbbc48a776a2c61beb9515fa8f3ae6d3a041d320a38a8ac75cb47bb9c866ee497fc3cd13299970c4b369c1c2ceb4220af082fbecdd8114492a8e4d713b5a73396fd224b36c1185bd5e20d683e6c8db35346c47ae7401988255da7cfffdced5801067d4d296688ee8fe424b4a8a69309ce257eefb9345ebfda3f6de46bb11ec94133e1f72cd7ac54934d6cf17b3440800e70b80ebc7c7bfc6fb0fc2c"), SER_NETWORK, PROTOCOL_VERSION);
+    ss >> output;
+    return output;
+}
+
+double benchmark_verify_sapling_spend()
+{
+    SpendDescription spend = SampleSaplingSpend();
+    uint256 dataToBeSigned = SampleSaplingSpendSighash();
 
     auto ctx = librustzcash_sapling_verification_ctx_init();
 
@@ -602,14 +634,9 @@ double benchmark_verify_sapling_spend()
     return t;
 }
 
-// Verify Sapling output from testnet
-// txid: abbd823cbd3d4e3b52023599d81a96b74817e95ce5bb58354f979156bd22ecc8
-// position: 0
 double benchmark_verify_sapling_output()
 {
-    OutputDescription output;
-    CDataStream ss(ParseHex("edd742af18857e5ec2d71d346a7fe2ac97c137339bd5268eea86d32e0ff4f38f76213fa8cfed3347ac4e8572dd88aff395c0c10a59f8b3f49d2bc539ed6c726667e29d4763f914ddd0abf1cdfa84e44de87c233434c7e69b8b5b8f4623c8aa444163425bae5cef842972fed66046c1c6ce65c866ad894d02e6e6dcaae7a962d9f2ef95757a09c486928e61f0f7aed90ad0a542b0d3dc5fe140dfa7626b9315c77e03b055f19cbacd21a866e46f06c00e0c7792b2a590a611439b510a9aaffcf1073bad23e712a9268b36888e3727033eee2ab4d869f54a843f93b36ef489fb177bf74b41a9644e5d2a0a417c6ac1c8869bc9b83273d453f878ed6fd96b82a5939903f7b64ecaf68ea16e255a7fb7cc0b6d8b5608a1c6b0ed3024cc62c2f0f9c5cfc7b431ae6e9d40815557aa1d010523f9e1960de77b2274cb6710d229d475c87ae900183206ba90cb5bbc8ec0df98341b82726c705e0308ca5dc08db4db609993a1046dfb43dfd8c760be506c0bed799bb2205fc29dc2e654dce731034a23b0aaf6da0199248702ee0523c159f41f4cbfff6c35ace4dd9ae834e44e09c76a0cbdda1d3f6a2c75ad71212daf9575ab5f09ca148718e667f29ddf18c8a330a86ace18a86e89454653902aa393c84c6b694f27d0d42e24e7ac9fe34733de5ec15f5066081ce912c62c1a804a2bb4dedcef7cc80274f6bb9e89e2fce91dc50d6a73c8aefb9872f1cf3524a92626a0b8f39bbf7bf7d96ca2f770fc04d7f457021c536a506a187a93b2245471ddbfb254a71bc4a0d72c8d639a31c7b1920087ffca05c24214157e2e7b28184e91989ef0b14f9b34c3dc3cc0ac64226b9e337095870cb0885737992e120346e630a416a9b217679ce5a778fb15779c136bcecca5efe79012013d77d90b4e99dd22c8f35bc77121716e160d05bd30d288ee8886390ee436f85bdc9029df888a3a3326d9d4ddba5cb5318b3274928829d662e96fea1d601f7a306251ed8c6cc4e5a3a7a98c35a3650482a0eee08f3b4c2da9b22947c96138f1505c2f081f8972d429f3871f32bef4aaa51aa6945df8e9c9760531ac6f627d17c1518202818a91ca304fb4037875c666060597976144fcbbc48a776a2c61beb9515fa8f3ae6d3a041d320a38a8ac75cb47bb9c866ee497fc3cd13299970c4b369c1c2ceb4220af082fbecdd8114492a8e4d713b5a73396fd224b36c1185bd5e20d683e6c8db35346c47ae7401988255da7cfffdced5801067d4d296688ee8fe424b4a8a69309ce257eefb9345ebfda3f6de46bb11ec94133e1f72cd7ac54934d6cf17b3440800e70b80ebc7c7bfc6fb0fc2c"), SER_NETWORK, PROTOCOL_VERSION);
-    ss >> output;
+    OutputDescription output = SampleSaplingOutput();
 
     auto ctx = librustzcash_sapling_verification_ctx_init();
 
@@ -631,3 +658,268 @@ double benchmark_verify_sapling_output()
     }
     return timer_stop(tv_start);
 }
+
+/**
+ * Run check until it has covered nChecks items, nBatch at a time, on
+ * nThreads threads, and return the seconds taken. check is passed the
+ * number of items to verify and returns whether they verified.
+ */
+static double run_checks_threaded(int nThreads, int nChecks, int nBatch, const std::function<bool(int)>& check)
+{
+    std::atomic<int> nNext(0);
+    std::atomic<bool> fFailed(false);
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nThreads; i++) {
+        threads.emplace_back([&] {
+            int nStart;
+            while ((nStart = nNext.fetch_add(nBatch)) < nChecks) {
+                if (!check(std::min(nBatch, nChecks - nStart)))
+                    fFailed = true;
+            }
+        });
+    }
+    for (auto it = threads.begin(); it != threads.end(); it++) {
+        it->join();
+    }
+    double t = timer_stop(tv_start);
+
+    if (fFailed) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Benchmark check failed to verify");
+    }
+    return t;
+}
+
+static std::vector<std::pair<int, double>> run_throughput(int nMaxThreads, int nChecks, int nBatch, const std::function<bool(int)>& check)
+{
+    std::vector<std::pair<int, double>> ret;
+    for (int nThreads = 1; ; nThreads = std::min(2 * nThreads, nMaxThreads)) {
+        ret.push_back(std::make_pair(nThreads, run_checks_threaded(nThreads, nChecks, nBatch, check)));
+        if (nThreads >= nMaxThreads)
+            break;
+    }
+    return ret;
+}
+
+std::vector<std::pair<int, double>> benchmark_verify_sapling_spend_threaded(int nMaxThreads, int nChecks, int nBatch)
+{
+    SpendDescription spend = SampleSaplingSpend();
+    uint256 dataToBeSigned = SampleSaplingSpendSighash();
+
+    return run_throughput(nMaxThreads, nChecks, nBatch, [&](int nCount) {
+        auto ctx = librustzcash_sapling_verification_ctx_init();
+        bool result = true;
+        for (int i = 0; i < nCount && result; i++) {
+            result = librustzcash_sapling_check_spend(
+                ctx,
+                spend.cv.begin(),
+                spend.anchor.begin(),
+                spend.nullifier.begin(),
+                spend.rk.begin(),
+                spend.zkproof.begin(),
+                spend.spendAuthSig.begin(),
+                dataToBeSigned.begin());
+        }
+        librustzcash_sapling_verification_ctx_free(ctx);
+        return result;
+    });
+}
+
+std::vector<std::pair<int, double>> benchmark_verify_sapling_output_threaded(int nMaxThreads, int nChecks, int nBatch)
+{
+    OutputDescription output = SampleSaplingOutput();
+
+    return run_throughput(nMaxThreads, nChecks, nBatch, [&](int nCount) {
+        auto ctx = librustzcash_sapling_verification_ctx_init();
+        bool result = true;
+        for (int i = 0; i < nCount && result; i++) {
+            result = librustzcash_sapling_check_output(
+                ctx,
+                output.cv.begin(),
+                output.cm.begin(),
+                output.ephemeralKey.begin(),
+                output.zkproof.begin());
+        }
+        librustzcash_sapling_verification_ctx_free(ctx);
+        return result;
+    });
+}
+
+/**
+ * Build a transaction spending one Sapling note to one Sapling output and
+ * change, at the Sapling activation height of the current network.
+ */
+static CTransaction SampleSaplingTransaction(uint256& dataToBeSigned)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    int nHeight = consensusParams.vUpgrades[Consensus::UPGRADE_SAPLING].nActivationHeight;
+    if (nHeight == Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Sapling does not activate on this network");
+    }
+
+    CBasicKeyStore keystore;
+    CKey tsk;
+    tsk.MakeNewKey(true);
+    keystore.AddKey(tsk);
+    auto scriptPubKey = GetScriptForDestination(tsk.GetPubKey().GetID());
+
+    auto sk = libzcash::SaplingSpendingKey::random();
+    auto expsk = sk.expanded_spending_key();
+    auto fvk = sk.full_viewing_key();
+    auto ivk = fvk.in_viewing_key();
+    auto pk = sk.default_address();
+
+    // Shield a made-up transparent coin to get a note to spend
+    auto builder1 = TransactionBuilder(consensusParams, nHeight, &keystore);
+    builder1.AddTransparentInput(COutPoint(), scriptPubKey, 50000);
+    builder1.AddSaplingOutput(fvk.ovk, pk, 40000, {});
+    auto maybe_tx1 = builder1.Build();
+    if (!maybe_tx1) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Could not build shielding transaction");
+    }
+    auto tx1 = maybe_tx1.get();
+
+    auto maybe_pt = libzcash::SaplingNotePlaintext::decrypt(
+        tx1.vShieldedOutput[0].encCiphertext, ivk, tx1.vShieldedOutput[0].ephemeralKey, tx1.vShieldedOutput[0].cm);
+    if (!maybe_pt) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Could not decrypt shielded note");
+    }
+    auto note = maybe_pt.get().note(ivk).get();
+    SaplingMerkleTree tree;
+    tree.append(tx1.vShieldedOutput[0].cm);
+
+    auto builder2 = TransactionBuilder(consensusParams, nHeight);
+    builder2.AddSaplingSpend(expsk, note, tree.root(), tree.witness());
+    builder2.AddSaplingOutput(fvk.ovk, pk, 25000, {});
+    auto maybe_tx2 = builder2.Build();
+    if (!maybe_tx2) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Could not build Sapling transaction");
+    }
+    CTransaction tx2 = maybe_tx2.get();
+
+    uint32_t consensusBranchId = CurrentEpochBranchId(nHeight, consensusParams);
+    dataToBeSigned = SignatureHash(CScript(), tx2, NOT_AN_INPUT, SIGHASH_ALL, 0, consensusBranchId);
+    return tx2;
+}
+
+std::vector<std::pair<int, double>> benchmark_verify_sapling_bundle_threaded(int nMaxThreads, int nChecks)
+{
+    uint256 dataToBeSigned;
+    CTransaction tx = SampleSaplingTransaction(dataToBeSigned);
+
+    return run_throughput(nMaxThreads, nChecks, 1, [&](int nCount) {
+        CSaplingCheck check(tx, dataToBeSigned);
+        return check();
+    });
+}
+
+std::vector<std::pair<int, double>> benchmark_verify_joinsplit_threaded(const JSDescription &joinsplit, int nMaxThreads, int nChecks)
+{
+    // As in benchmark_verify_joinsplit, the result is not checked, so that
+    // joinsplits made for another joinSplitPubKey can be timed
+    uint256 joinSplitPubKey;
+    return run_throughput(nMaxThreads, nChecks, 1, [&](int nCount) {
+        auto verifier = libzcash::ProofVerifier::Strict();
+        joinsplit.Verify(*pzcashParams, verifier, joinSplitPubKey);
+        return true;
+    });
+}
+
+static const char* ReplayTxType(const CTransaction& tx)
+{
+    if (!tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty())
+        return "sapling";
+    if (!tx.vjoinsplit.empty())
+        return "sprout";
+    return "transparent";
+}
+
+// Sites of mempool.cs go by several names, and CTxMemPool's own by "cs"
+static bool IsMempoolLockSite(const CLockSiteStats& site)
+{
+    if (site.strName == "mempool.cs" || site.strName == "pool.cs" || site.strName == "pool->cs")
+        return true;
+    return site.strName == "cs" && site.strFile.find("txmempool.") != std::string::npos;
+}
+
+static void GetReplayLockTimes(ReplayLockTimes& csMain, ReplayLockTimes& mempoolCs)
+{
+    csMain = mempoolCs = ReplayLockTimes();
+    for (const CLockSiteStats& site : GetLockSiteStats()) {
+        ReplayLockTimes* ptimes = site.strName == "cs_main" ? &csMain : IsMempoolLockSite(site) ? &mempoolCs : NULL;
+        if (ptimes) {
+            ptimes->nAcquired += site.nAcquired;
+            ptimes->nContended += site.nContended;
+            ptimes->nHoldMicros += site.nHoldMicros;
+            ptimes->nWaitMicros += site.nWaitMicros;
+        }
+    }
+}
+
+static ReplayLockTimes ReplayLockTimesSince(const ReplayLockTimes& before, const ReplayLockTimes& after)
+{
+    ReplayLockTimes times;
+    times.nAcquired = after.nAcquired - before.nAcquired;
+    times.nContended = after.nContended - before.nContended;
+    times.nHoldMicros = after.nHoldMicros - before.nHoldMicros;
+    times.nWaitMicros = after.nWaitMicros - before.nWaitMicros;
+    return times;
+}
+
+MempoolReplayResult benchmark_accept_mempool(const std::vector<CTxArrival>& vArrivals, double nSpeed)
+{
+    MempoolReplayResult result;
+    if (vArrivals.empty())
+        return result;
+
+    std::vector<CTransactionRef> vAccepted;
+    ReplayLockTimes csMainBefore, mempoolCsBefore;
+    GetReplayLockTimes(csMainBefore, mempoolCsBefore);
+
+    int64_t nStart = GetTimeMicros();
+    int64_t nFirstArrival = vArrivals.front().nTime;
+    for (const CTxArrival& arrival : vArrivals) {
+        int64_t nArrival = GetTimeMicros();
+        if (nSpeed > 0) {
+            int64_t nDue = nStart + (int64_t)((arrival.nTime - nFirstArrival) / nSpeed);
+            if (nDue > nArrival)
+                MilliSleep((nDue - nArrival) / 1000);
+            nArrival = nDue;
+        }
+
+        // As a transaction from a peer is, under cs_main and with the free
+        // transaction rate limit
+        CValidationState state;
+        bool fMissingInputs = false;
+        bool fAccepted;
+        {
+            LOCK(cs_main);
+            fAccepted = AcceptToMemoryPool(mempool, state, arrival.tx, true, &fMissingInputs);
+        }
+        result.mapLatencies[ReplayTxType(*arrival.tx)].push_back((GetTimeMicros() - nArrival) * 0.000001);
+        if (fAccepted) {
+            result.nAccepted++;
+            vAccepted.push_back(arrival.tx);
+        } else {
+            result.mapRejected[fMissingInputs ? "missing-inputs" : state.GetRejectReason()]++;
+        }
+    }
+    result.nRunningTime = (GetTimeMicros() - nStart) * 0.000001;
+
+    ReplayLockTimes csMainAfter, mempoolCsAfter;
+    GetReplayLockTimes(csMainAfter, mempoolCsAfter);
+    result.csMain = ReplayLockTimesSince(csMainBefore, csMainAfter);
+    result.mempoolCs = ReplayLockTimesSince(mempoolCsBefore, mempoolCsAfter);
+
+    // Children first, so that each removal is of a transaction with none
+    {
+        LOCK(cs_main);
+        for (auto it = vAccepted.rbegin(); it != vAccepted.rend(); ++it) {
+            std::list<CTransaction> removed;
+            mempool.remove(**it, removed, true);
+        }
+    }
+    return result;
+}
@@ -4,6 +4,12 @@
 #include <sys/time.h>
 #include <stdlib.h>
 
+#include <map>
+#include <string>
+#include <vector>
+
+#include "txarrivallog.h"
+
 extern double benchmark_sleep();
 extern double benchmark_parameter_loading();
 extern double benchmark_create_joinsplit();
@@ -24,4 +30,48 @@ extern double benchmark_create_sapling_output();
 extern double benchmark_verify_sapling_spend();
 extern double benchmark_verify_sapling_output();
 
+/**
+ * Verification throughput: nChecks checks are spread over 1, 2, 4, ... and
+ * nMaxThreads threads, and the seconds taken at each thread count are
+ * returned with it. Spends and outputs are checked nBatch to a verification
+ * context, as the spends or outputs of one transaction are.
+ */
+extern std::vector<std::pair<int, double>> benchmark_verify_sapling_spend_threaded(int nMaxThreads, int nChecks, int nBatch);
+extern std::vector<std::pair<int, double>> benchmark_verify_sapling_output_threaded(int nMaxThreads, int nChecks, int nBatch);
+//! Checks a transaction's whole Sapling bundle: one spend, two outputs and the binding signature
+extern std::vector<std::pair<int, double>> benchmark_verify_sapling_bundle_threaded(int nMaxThreads, int nChecks);
+extern std::vector<std::pair<int, double>> benchmark_verify_joinsplit_threaded(const JSDescription &joinsplit, int nMaxThreads, int nChecks);
+
+/** How long the replay held a lock, and waited for it, over all its call sites */
+struct ReplayLockTimes
+{
+    uint64_t nAcquired = 0;
+    uint64_t nContended = 0;
+    uint64_t nHoldMicros = 0;
+    uint64_t nWaitMicros = 0;
+};
+
+struct MempoolReplayResult
+{
+    size_t nAccepted = 0;
+    //! Transactions not accepted, by reject reason
+    std::map<std::string, size_t> mapRejected;
+    double nRunningTime = 0;
+    //! Seconds from the arrival of each transaction to its acceptance or
+    //! rejection, by "transparent", "sprout" or "sapling"
+    std::map<std::string, std::vector<double>> mapLatencies;
+    ReplayLockTimes csMain;
+    ReplayLockTimes mempoolCs;
+};
+
+/**
+ * Pass the transactions of a -txarrivallog to AcceptToMemoryPool one after
+ * another, as they come in from peers, and then remove those accepted so
+ * that the next run starts from the same mempool. With nSpeed above 0 each
+ * is passed at its recorded arrival time, divided by nSpeed; otherwise as
+ * soon as the last is done. The tip should be the one the log was recorded
+ * from, and nothing else should be feeding the mempool meanwhile.
+ */
+extern MempoolReplayResult benchmark_accept_mempool(const std::vector<CTxArrival>& vArrivals, double nSpeed);
+
 #endif
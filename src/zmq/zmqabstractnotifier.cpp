@@ -20,3 +20,16 @@ bool CZMQAbstractNotifier::NotifyTransaction(const CTransaction &/*transaction*/
 {
     return true;
 }
+
+bool CZMQAbstractNotifier::NotifyShieldedReceipt(const CShieldedReceipt &/*receipt*/)
+{
+    return true;
+}
+
+CZMQNotifierStats CZMQAbstractNotifier::GetStats() const
+{
+    CZMQNotifierStats stats;
+    stats.type = type;
+    stats.address = address;
+    return stats;
+}
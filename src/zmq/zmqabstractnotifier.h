@@ -8,10 +8,24 @@
 #include "zmqconfig.h"
 
 class CBlockIndex;
+struct CShieldedReceipt;
 class CZMQAbstractNotifier;
 
 typedef CZMQAbstractNotifier* (*CZMQNotifierFactory)();
 
+/** What a notifier has published so far */
+struct CZMQNotifierStats
+{
+    std::string type;
+    std::string address;
+    //! Sequence number of the next message, counting dropped ones
+    uint32_t nSequence;
+    uint64_t nMessages;
+    uint64_t nBytes;
+
+    CZMQNotifierStats() : nSequence(0), nMessages(0), nBytes(0) {}
+};
+
 class CZMQAbstractNotifier
 {
 public:
@@ -34,6 +48,15 @@ public:
 
     virtual bool NotifyBlock(const CBlockIndex *pindex);
     virtual bool NotifyTransaction(const CTransaction &transaction);
+    virtual bool NotifyShieldedReceipt(const CShieldedReceipt &receipt);
+
+    //! Account for blocks or transactions that were dropped before they
+    //! could be published, so subscribers see a gap in the sequence
+    virtual void NotifyBlocksDropped(unsigned int nCount) {}
+    virtual void NotifyTransactionsDropped(unsigned int nCount) {}
+    virtual void NotifyShieldedReceiptsDropped(unsigned int nCount) {}
+
+    virtual CZMQNotifierStats GetStats() const;
 
 protected:
     void *psocket;
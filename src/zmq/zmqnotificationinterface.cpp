@@ -9,14 +9,21 @@
 #include "main.h"
 #include "streams.h"
 #include "util.h"
+#include "utiltime.h"
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+
+CZMQNotificationInterface* pzmqNotificationInterface = NULL;
 
 void zmqError(const char *str)
 {
     LogPrint("zmq", "zmq: Error: %s, errno=%s\n", str, zmq_strerror(errno));
 }
 
-CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(NULL)
+CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(NULL), fStop(false), nBlocksDropped(0), nTransactionsDropped(0), nReceiptsDropped(0)
 {
+    stats.nLimit = std::max((int64_t)1, GetArg("-zmqqueuesize", DEFAULT_ZMQ_QUEUE_SIZE));
 }
 
 CZMQNotificationInterface::~CZMQNotificationInterface()
@@ -39,6 +46,7 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
     factories["pubhashtx"] = CZMQAbstractNotifier::Create<CZMQPublishHashTransactionNotifier>;
     factories["pubrawblock"] = CZMQAbstractNotifier::Create<CZMQPublishRawBlockNotifier>;
     factories["pubrawtx"] = CZMQAbstractNotifier::Create<CZMQPublishRawTransactionNotifier>;
+    factories["pubshieldedreceipt"] = CZMQAbstractNotifier::Create<CZMQPublishShieldedReceiptNotifier>;
 
     for (std::map<std::string, CZMQNotifierFactory>::const_iterator i=factories.begin(); i!=factories.end(); ++i)
     {
@@ -103,6 +111,9 @@ bool CZMQNotificationInterface::Initialize()
         return false;
     }
 
+    threadPublish = boost::thread(boost::bind(&TraceThread<boost::function<void()> >, "zmqpub",
+        boost::function<void()>(boost::bind(&CZMQNotificationInterface::ThreadPublish, this))));
+
     return true;
 }
 
@@ -110,6 +121,14 @@ bool CZMQNotificationInterface::Initialize()
 void CZMQNotificationInterface::Shutdown()
 {
     LogPrint("zmq", "zmq: Shutdown notification interface\n");
+    {
+        boost::unique_lock<boost::mutex> lock(cs_queue);
+        fStop = true;
+        condQueue.notify_all();
+    }
+    if (threadPublish.joinable())
+        threadPublish.join();
+
     if (pcontext)
     {
         for (std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin(); i!=notifiers.end(); ++i)
@@ -124,29 +143,88 @@ void CZMQNotificationInterface::Shutdown()
     }
 }
 
-void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
+void CZMQNotificationInterface::Enqueue(const CBlockIndex *pindex, const CTransaction *ptx, const CShieldedReceipt *preceipt)
 {
-    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
-    {
-        CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyBlock(pindex))
-        {
-            i++;
+    boost::unique_lock<boost::mutex> lock(cs_queue);
+    if (fStop)
+        return;
+    if (queue.size() >= stats.nLimit) {
+        // Never wait for the publisher; its subscribers will see the gap
+        if (pindex) {
+            nBlocksDropped++;
+            stats.nBlocksDropped++;
+        } else if (preceipt) {
+            nReceiptsDropped++;
+            stats.nReceiptsDropped++;
+        } else {
+            nTransactionsDropped++;
+            stats.nTransactionsDropped++;
         }
-        else
+        return;
+    }
+
+    Event event;
+    event.pindex = pindex;
+    if (ptx)
+        event.ptx = std::make_shared<const CTransaction>(*ptx);
+    if (preceipt)
+        event.preceipt = std::make_shared<const CShieldedReceipt>(*preceipt);
+    event.nBlocksDropped = nBlocksDropped;
+    event.nTransactionsDropped = nTransactionsDropped;
+    event.nReceiptsDropped = nReceiptsDropped;
+    nBlocksDropped = 0;
+    nTransactionsDropped = 0;
+    nReceiptsDropped = 0;
+    queue.push_back(event);
+    stats.nQueued++;
+    stats.nMaxSize = std::max(stats.nMaxSize, queue.size());
+    condQueue.notify_one();
+}
+
+void CZMQNotificationInterface::ThreadPublish()
+{
+    while (true) {
+        Event event;
         {
-            notifier->Shutdown();
-            i = notifiers.erase(i);
+            boost::unique_lock<boost::mutex> lock(cs_queue);
+            while (!fStop && queue.empty())
+                condQueue.wait(lock);
+            if (fStop)
+                return;
+            event = queue.front();
+            queue.pop_front();
         }
+
+        int64_t nStart = GetTimeMicros();
+        Publish(event);
+        int64_t nTime = GetTimeMicros() - nStart;
+
+        boost::unique_lock<boost::mutex> lock(cs_queue);
+        stats.nPublished++;
+        stats.nPublishTime += nTime;
     }
 }
 
-void CZMQNotificationInterface::SyncTransaction(const CTransaction &tx, const CBlock *pblock)
+void CZMQNotificationInterface::Publish(const Event &event)
 {
+    LOCK(cs_notifiers);
     for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
     {
         CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyTransaction(tx))
+        if (event.nBlocksDropped)
+            notifier->NotifyBlocksDropped(event.nBlocksDropped);
+        if (event.nTransactionsDropped)
+            notifier->NotifyTransactionsDropped(event.nTransactionsDropped);
+        if (event.nReceiptsDropped)
+            notifier->NotifyShieldedReceiptsDropped(event.nReceiptsDropped);
+        bool fPublished;
+        if (event.pindex)
+            fPublished = notifier->NotifyBlock(event.pindex);
+        else if (event.preceipt)
+            fPublished = notifier->NotifyShieldedReceipt(*event.preceipt);
+        else
+            fPublished = notifier->NotifyTransaction(*event.ptx);
+        if (fPublished)
         {
             i++;
         }
@@ -157,3 +235,31 @@ void CZMQNotificationInterface::SyncTransaction(const CTransaction &tx, const CB
         }
     }
 }
+
+void CZMQNotificationInterface::GetStats(CZMQQueueStats &queueStats, std::vector<CZMQNotifierStats> &notifierStats)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs_queue);
+        queueStats = stats;
+        queueStats.nSize = queue.size();
+    }
+    LOCK(cs_notifiers);
+    notifierStats.clear();
+    for (std::list<CZMQAbstractNotifier*>::const_iterator i = notifiers.begin(); i != notifiers.end(); ++i)
+        notifierStats.push_back((*i)->GetStats());
+}
+
+void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
+{
+    Enqueue(pindex, NULL);
+}
+
+void CZMQNotificationInterface::SyncTransaction(const CTransaction &tx, const CBlock *pblock)
+{
+    Enqueue(NULL, &tx);
+}
+
+void CZMQNotificationInterface::ShieldedReceived(const CShieldedReceipt &receipt)
+{
+    Enqueue(NULL, NULL, &receipt);
+}
@@ -5,13 +5,48 @@
 #ifndef BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
 #define BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
 
+#include "sync.h"
 #include "validationinterface.h"
-#include <string>
+#include "zmqabstractnotifier.h"
+
+#include <deque>
+#include <list>
 #include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/thread/thread.hpp>
 
 class CBlockIndex;
-class CZMQAbstractNotifier;
 
+/** Default for -zmqqueuesize, the number of events waiting to be published */
+static const unsigned int DEFAULT_ZMQ_QUEUE_SIZE = 10000;
+
+/** The state of the publisher queue */
+struct CZMQQueueStats
+{
+    size_t nSize;
+    size_t nLimit;
+    size_t nMaxSize;
+    uint64_t nQueued;
+    uint64_t nPublished;
+    uint64_t nBlocksDropped;
+    uint64_t nTransactionsDropped;
+    uint64_t nReceiptsDropped;
+    int64_t nPublishTime; //!< Microseconds spent publishing
+
+    CZMQQueueStats() : nSize(0), nLimit(0), nMaxSize(0), nQueued(0), nPublished(0),
+                       nBlocksDropped(0), nTransactionsDropped(0), nReceiptsDropped(0), nPublishTime(0) {}
+};
+
+/**
+ * Publishes validation events over ZMQ from a thread of its own. The
+ * validation callbacks only queue the event; reading and serializing it is
+ * left to the publisher thread. When a slow publisher lets the queue fill up,
+ * new events are dropped and the notifiers' sequence numbers are advanced
+ * past them, so block connection never waits on ZMQ.
+ */
 class CZMQNotificationInterface : public CValidationInterface
 {
 public:
@@ -19,6 +54,8 @@ public:
 
     static CZMQNotificationInterface* CreateWithArguments(const std::map<std::string, std::string> &args);
 
+    void GetStats(CZMQQueueStats &queueStats, std::vector<CZMQNotifierStats> &notifierStats);
+
 protected:
     bool Initialize();
     void Shutdown();
@@ -26,12 +63,43 @@ protected:
     // CValidationInterface
     void SyncTransaction(const CTransaction &tx, const CBlock *pblock);
     void UpdatedBlockTip(const CBlockIndex *pindex);
+    void ShieldedReceived(const CShieldedReceipt &receipt);
 
 private:
+    struct Event
+    {
+        const CBlockIndex *pindex; //!< NULL for a transaction or a receipt
+        std::shared_ptr<const CTransaction> ptx;
+        std::shared_ptr<const CShieldedReceipt> preceipt;
+        //! Events dropped just before this one
+        unsigned int nBlocksDropped;
+        unsigned int nTransactionsDropped;
+        unsigned int nReceiptsDropped;
+    };
+
     CZMQNotificationInterface();
 
+    void Enqueue(const CBlockIndex *pindex, const CTransaction *ptx, const CShieldedReceipt *preceipt = NULL);
+    void ThreadPublish();
+    void Publish(const Event &event);
+
     void *pcontext;
+    //! The publisher thread holds cs_notifiers while it publishes
+    CCriticalSection cs_notifiers;
     std::list<CZMQAbstractNotifier*> notifiers;
+
+    CWaitableCriticalSection cs_queue;
+    CConditionVariable condQueue;
+    std::deque<Event> queue;
+    bool fStop;
+    unsigned int nBlocksDropped;
+    unsigned int nTransactionsDropped;
+    unsigned int nReceiptsDropped;
+    CZMQQueueStats stats;
+
+    boost::thread threadPublish;
 };
 
+extern CZMQNotificationInterface* pzmqNotificationInterface;
+
 #endif // BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
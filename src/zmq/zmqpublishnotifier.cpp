@@ -3,8 +3,10 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "zmqpublishnotifier.h"
+#include "blockfilemap.h"
 #include "main.h"
 #include "util.h"
+#include "validationinterface.h"
 
 static std::multimap<std::string, CZMQAbstractPublishNotifier*> mapPublishNotifiers;
 
@@ -12,6 +14,7 @@ static const char *MSG_HASHBLOCK = "hashblock";
 static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
+static const char *MSG_SHIELDEDRECEIPT = "shieldedreceipt";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -135,10 +138,21 @@ bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* d
 
     /* increment memory only sequence number after sending */
     nSequence++;
+    nMessages++;
+    nBytes += size;
 
     return true;
 }
 
+CZMQNotifierStats CZMQAbstractPublishNotifier::GetStats() const
+{
+    CZMQNotifierStats stats = CZMQAbstractNotifier::GetStats();
+    stats.nSequence = nSequence;
+    stats.nMessages = nMessages;
+    stats.nBytes = nBytes;
+    return stats;
+}
+
 bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     uint256 hash = pindex->GetBlockHash();
@@ -163,20 +177,24 @@ bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
 
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    CDiskBlockPos pos;
     {
         LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex))
-        {
-            zmqError("Can't read block from disk");
-            return false;
-        }
-
-        ss << block;
+        pos = pindex->GetBlockPos();
+    }
+    // A block's bytes on disk are its network serialization, so they are
+    // sent as they are, straight from the mapping where there is one.
+    CBlockFileRegion region;
+    if (!ReadRawBlockFromDisk(region, pos))
+    {
+        // The block may have been pruned while it waited to be published;
+        // leave a gap in the sequence rather than stop publishing.
+        zmqError("Can't read block from disk");
+        SkipMessages(1);
+        return true;
     }
 
-    return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
+    return SendMessage(MSG_RAWBLOCK, region.begin(), region.size());
 }
 
 bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
@@ -187,3 +205,11 @@ bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &tr
     ss << transaction;
     return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
 }
+
+bool CZMQPublishShieldedReceiptNotifier::NotifyShieldedReceipt(const CShieldedReceipt &receipt)
+{
+    LogPrint("zmq", "zmq: Publish shieldedreceipt %s\n", receipt.txid.GetHex());
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << receipt;
+    return SendMessage(MSG_SHIELDEDRECEIPT, &(*ss.begin()), ss.size());
+}
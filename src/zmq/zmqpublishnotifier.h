@@ -13,8 +13,11 @@ class CZMQAbstractPublishNotifier : public CZMQAbstractNotifier
 {
 private:
     uint32_t nSequence; //! upcounting per message sequence number
+    uint64_t nMessages;
+    uint64_t nBytes;
 
 public:
+    CZMQAbstractPublishNotifier() : nSequence(0), nMessages(0), nBytes(0) {}
 
     /* send zmq multipart message
        parts:
@@ -23,33 +26,48 @@ public:
           * message sequence number
     */
     bool SendMessage(const char *command, const void* data, size_t size);
+    //! Use up sequence numbers for messages that were never sent
+    void SkipMessages(unsigned int nCount) { nSequence += nCount; }
 
     bool Initialize(void *pcontext);
     void Shutdown();
+
+    CZMQNotifierStats GetStats() const;
 };
 
 class CZMQPublishHashBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
     bool NotifyBlock(const CBlockIndex *pindex);
+    void NotifyBlocksDropped(unsigned int nCount) { SkipMessages(nCount); }
 };
 
 class CZMQPublishHashTransactionNotifier : public CZMQAbstractPublishNotifier
 {
 public:
     bool NotifyTransaction(const CTransaction &transaction);
+    void NotifyTransactionsDropped(unsigned int nCount) { SkipMessages(nCount); }
 };
 
 class CZMQPublishRawBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
     bool NotifyBlock(const CBlockIndex *pindex);
+    void NotifyBlocksDropped(unsigned int nCount) { SkipMessages(nCount); }
 };
 
 class CZMQPublishRawTransactionNotifier : public CZMQAbstractPublishNotifier
 {
 public:
     bool NotifyTransaction(const CTransaction &transaction);
+    void NotifyTransactionsDropped(unsigned int nCount) { SkipMessages(nCount); }
+};
+
+class CZMQPublishShieldedReceiptNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyShieldedReceipt(const CShieldedReceipt &receipt);
+    void NotifyShieldedReceiptsDropped(unsigned int nCount) { SkipMessages(nCount); }
 };
 
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H
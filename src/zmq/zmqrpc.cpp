@@ -0,0 +1,88 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "zmq/zmqrpc.h"
+
+#include "rpc/server.h"
+#include "utilstrencodings.h"
+#include "zmq/zmqnotificationinterface.h"
+
+#include <univalue.h>
+
+#include <boost/foreach.hpp>
+
+using namespace std;
+
+UniValue getzmqnotifications(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getzmqnotifications\n"
+            "\nReturns the active ZMQ notifiers and the state of the queue they publish from.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"queue_size\": n,            (numeric) Events waiting to be published\n"
+            "  \"queue_limit\": n,           (numeric) The -zmqqueuesize limit\n"
+            "  \"max_queue_size\": n,        (numeric) The largest the queue has been\n"
+            "  \"queued\": n,                (numeric) Events queued since startup\n"
+            "  \"published\": n,             (numeric) Events published since startup\n"
+            "  \"publish_time\": n,          (numeric) Seconds spent publishing them\n"
+            "  \"dropped_blocks\": n,        (numeric) Block events dropped because the queue was full\n"
+            "  \"dropped_transactions\": n,  (numeric) Transaction events dropped because the queue was full\n"
+            "  \"dropped_receipts\": n,      (numeric) Shielded receipt events dropped because the queue was full\n"
+            "  \"notifiers\": [\n"
+            "    {\n"
+            "      \"type\": \"pubtype\",      (string) Type of notification\n"
+            "      \"address\": \"...\",       (string) Address of the publisher\n"
+            "      \"sequence\": n,          (numeric) Sequence number of the next message\n"
+            "      \"messages\": n,          (numeric) Messages sent\n"
+            "      \"bytes\": n              (numeric) Bytes of message data sent\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getzmqnotifications", "")
+            + HelpExampleRpc("getzmqnotifications", "")
+        );
+
+    CZMQQueueStats queueStats;
+    std::vector<CZMQNotifierStats> notifierStats;
+    if (pzmqNotificationInterface)
+        pzmqNotificationInterface->GetStats(queueStats, notifierStats);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("queue_size", (uint64_t)queueStats.nSize));
+    ret.push_back(Pair("queue_limit", (uint64_t)queueStats.nLimit));
+    ret.push_back(Pair("max_queue_size", (uint64_t)queueStats.nMaxSize));
+    ret.push_back(Pair("queued", queueStats.nQueued));
+    ret.push_back(Pair("published", queueStats.nPublished));
+    ret.push_back(Pair("publish_time", queueStats.nPublishTime * 0.000001));
+    ret.push_back(Pair("dropped_blocks", queueStats.nBlocksDropped));
+    ret.push_back(Pair("dropped_transactions", queueStats.nTransactionsDropped));
+    ret.push_back(Pair("dropped_receipts", queueStats.nReceiptsDropped));
+    UniValue notifiers(UniValue::VARR);
+    BOOST_FOREACH(const CZMQNotifierStats& stats, notifierStats) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("type", stats.type));
+        obj.push_back(Pair("address", stats.address));
+        obj.push_back(Pair("sequence", (uint64_t)stats.nSequence));
+        obj.push_back(Pair("messages", stats.nMessages));
+        obj.push_back(Pair("bytes", stats.nBytes));
+        notifiers.push_back(obj);
+    }
+    ret.push_back(Pair("notifiers", notifiers));
+    return ret;
+}
+
+static const CRPCCommand commands[] =
+{ //  category              name                      actor (function)         okSafeMode  okParallel
+  //  --------------------- ------------------------  -----------------------  ----------  ----------
+    { "zmq",                "getzmqnotifications",    &getzmqnotifications,    true,  true  },
+};
+
+void RegisterZMQRPCCommands(CRPCTable &tableRPC)
+{
+    for (unsigned int vcidx = 0; vcidx < ARRAYLEN(commands); vcidx++)
+        tableRPC.appendCommand(commands[vcidx].name, &commands[vcidx]);
+}
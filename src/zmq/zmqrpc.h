@@ -0,0 +1,13 @@
+// Copyright (c) 2018 The LitecoinZ developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ZMQ_ZMQRPC_H
+#define BITCOIN_ZMQ_ZMQRPC_H
+
+class CRPCTable;
+
+/** Register ZMQ RPC commands */
+void RegisterZMQRPCCommands(CRPCTable &tableRPC);
+
+#endif // BITCOIN_ZMQ_ZMQRPC_H